@@ -183,6 +183,15 @@ class AddressIndexTest(BitcoinTestFramework):
         deltasAll = self.nodes[1].getaddressdeltas({"addresses": [address2]})
         assert_equal(len(deltasAll), len(deltas))
 
+        # Check that the deltas can be read in pages
+        page = self.nodes[1].getaddressdeltas({"addresses": [address2], "limit": 1})
+        deltasPaged = page["deltas"]
+        while "cursor" in page:
+            page = self.nodes[1].getaddressdeltas({"addresses": [address2], "limit": 1, "cursor": page["cursor"]})
+            assert_equal(len(page["deltas"]), 1)
+            deltasPaged += page["deltas"]
+        assert_equal(deltasPaged, deltasAll)
+
         # Check that deltas can be returned from range of block heights
         deltas = self.nodes[1].getaddressdeltas({"addresses": [address2], "start": 113, "end": 113})
         assert_equal(len(deltas), 1)
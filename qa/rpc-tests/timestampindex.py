@@ -54,6 +54,18 @@ class TimestampIndexTest(BitcoinTestFramework):
 
         assert_equal(hashes, blockhashes)
 
+        print "Checking paged timestamp index..."
+        paged = []
+        options = {"noOrphans": True, "limit": 10}
+        while True:
+            page = self.nodes[1].getblockhashes(high, low, options)
+            assert(len(page["hashes"]) <= 10)
+            paged.extend(page["hashes"])
+            if "cursor" not in page:
+                break
+            options["cursor"] = page["cursor"]
+        assert_equal(paged, blockhashes)
+
         print "Passed\n"
 
 
@@ -23,6 +23,9 @@
 #include "serialize.h"
 #include "streams.h"
 
+#include <algorithm>
+#include <functional>
+
 int CAddrInfo::GetTriedBucket(const uint256& nKey, const std::vector<bool> &asmap) const
 {
     uint64_t hash1 = (CHashWriter(SER_GETHASH, 0) << nKey << GetKey()).GetHash().GetCheapHash();
@@ -513,6 +516,42 @@ void CAddrMan::GetAddr_(std::vector<CAddress>& vAddr)
     }
 }
 
+void CAddrMan::GetRecentlyGood_(std::vector<CAddress>& vAddr, size_t nMax)
+{
+    std::vector<std::pair<int64_t, int> > vTried;
+    for (std::map<int, CAddrInfo>::const_iterator it = mapInfo.begin(); it != mapInfo.end(); it++) {
+        if (it->second.fInTried && !it->second.IsTerrible())
+            vTried.push_back(std::make_pair(it->second.nLastSuccess, it->first));
+    }
+    size_t nCount = std::min(nMax, vTried.size());
+    std::partial_sort(vTried.begin(), vTried.begin() + nCount, vTried.end(), std::greater<std::pair<int64_t, int> >());
+    for (size_t i = 0; i < nCount; i++)
+        vAddr.push_back(mapInfo[vTried[i].second]);
+}
+
+void CAddrMan::Replace_(CAddrMan& other)
+{
+    std::vector<CAddrInfo> vOwn;
+    for (std::map<int, CAddrInfo>::const_iterator it = mapInfo.begin(); it != mapInfo.end(); it++)
+        vOwn.push_back(it->second);
+
+    std::swap(nKey, other.nKey);
+    std::swap(nIdCount, other.nIdCount);
+    mapInfo.swap(other.mapInfo);
+    mapAddr.swap(other.mapAddr);
+    vRandom.swap(other.vRandom);
+    std::swap(nTried, other.nTried);
+    std::swap(vvTried, other.vvTried);
+    std::swap(nNew, other.nNew);
+    std::swap(vvNew, other.vvNew);
+
+    for (std::vector<CAddrInfo>::const_iterator it = vOwn.begin(); it != vOwn.end(); it++) {
+        Add_(*it, it->source, 0);
+        if (it->fInTried)
+            Good_(*it, it->nLastSuccess);
+    }
+}
+
 void CAddrMan::Connected_(const CService& addr, int64_t nTime)
 {
     CAddrInfo* pinfo = Find(addr);
@@ -269,6 +269,12 @@ protected:
     //! Mark an entry as currently-connected-to.
     void Connected_(const CService &addr, int64_t nTime);
 
+    //! Select the tried addresses connected to most recently.
+    void GetRecentlyGood_(std::vector<CAddress> &vAddr, size_t nMax);
+
+    //! Take over the tables of another instance, re-adding our own entries to them.
+    void Replace_(CAddrMan &other);
+
 public:
     // Compressed IP->ASN mapping, loaded from a file when a node starts.
     // Should be always empty if no file was provided.
@@ -643,6 +649,32 @@ public:
         }
     }
 
+    //! Return up to nMax tried addresses, the ones connected to most recently first.
+    std::vector<CAddress> GetRecentlyGood(size_t nMax)
+    {
+        std::vector<CAddress> vAddr;
+        {
+            LOCK(cs);
+            GetRecentlyGood_(vAddr, nMax);
+        }
+        return vAddr;
+    }
+
+    /**
+     * Take over the contents of another instance that was filled without
+     * holding our lock, such as one read from peers.dat in the background.
+     * Addresses added to this one in the meantime are added again on top.
+     */
+    void Replace(CAddrMan &other)
+    {
+        {
+            LOCK2(cs, other.cs);
+            Check();
+            Replace_(other);
+            Check();
+        }
+    }
+
 };
 
 #endif // BITCOIN_ADDRMAN_H
@@ -15,7 +15,7 @@ typedef AMQPAbstractNotifier* (*AMQPNotifierFactory)();
 class AMQPAbstractNotifier
 {
 public:
-    AMQPAbstractNotifier() { }
+    AMQPAbstractNotifier() : maxQueue(0), dropOldest(true) { }
     virtual ~AMQPAbstractNotifier();
 
     template <typename T>
@@ -28,6 +28,8 @@ public:
     void SetType(const std::string &t) { type = t; }
     std::string GetAddress() const { return address; }
     void SetAddress(const std::string &a) { address = a; }
+    //! Bound of the send queue of the address, and whether a full queue drops its oldest message or the new one
+    void SetQueueOptions(size_t n, bool fDropOldest) { maxQueue = n; dropOldest = fDropOldest; }
 
     virtual bool Initialize() = 0;
     virtual void Shutdown() = 0;
@@ -38,6 +40,8 @@ public:
 protected:
     std::string type;
     std::string address;
+    size_t maxQueue;
+    bool dropOldest;
 };
 
 #endif // ZCASH_AMQP_AMQPABSTRACTNOTIFIER_H
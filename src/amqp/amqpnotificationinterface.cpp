@@ -4,6 +4,7 @@
 
 #include "amqpnotificationinterface.h"
 #include "amqppublishnotifier.h"
+#include "amqpsender.h"
 
 #include "version.h"
 #include "main.h"
@@ -15,13 +16,9 @@
 // The boost::signals2 signals and slot system is thread safe, so CValidationInterface listeners
 // can be invoked from any thread.
 //
-// Currently signals are fired from main.cpp so the callbacks should be invoked on the same thread.
-// It should be safe to share objects responsible for sending, as they should not be run concurrently
-// across different threads.
-//
-// Developers should be mindful of where notifications are fired to avoid potential race conditions.
-// For example, different signals targeting the same address could be fired from different threads
-// in different parts of the system around the same time.
+// The callbacks run on the validation queue thread. A notifier only adds its message to the bounded
+// queue of the AMQPSender of its address; the sender's proton container thread does the sending and
+// reconnects to the broker, so a slow or unreachable broker never holds up the callbacks.
 //
 // Like the ZMQ notification interface, if a notifier fails to send a message, the notifier is shut down.
 //
@@ -62,6 +59,22 @@ AMQPNotificationInterface* AMQPNotificationInterface::CreateWithArguments(const
         }
     }
 
+    size_t nQueueSize = DEFAULT_AMQP_QUEUE_SIZE;
+    std::map<std::string, std::string>::const_iterator size = args.find("-amqpqueuesize");
+    if (size != args.end())
+        nQueueSize = std::max<int64_t>(atoi64(size->second), 1);
+    bool fDropOldest = true;
+    std::map<std::string, std::string>::const_iterator policy = args.find("-amqpdroppolicy");
+    if (policy != args.end()) {
+        if (policy->second == "newest") {
+            fDropOldest = false;
+        } else if (policy->second != "oldest") {
+            LogPrintf("amqp: Unknown -amqpdroppolicy %s, dropping the oldest messages\n", policy->second);
+        }
+    }
+    for (std::list<AMQPAbstractNotifier*>::iterator i = notifiers.begin(); i != notifiers.end(); ++i)
+        (*i)->SetQueueOptions(nQueueSize, fDropOldest);
+
     if (!notifiers.empty()) {
         notificationInterface = new AMQPNotificationInterface();
         notificationInterface->notifiers = notifiers;
@@ -8,10 +8,25 @@
 #include "validationinterface.h"
 #include <string>
 #include <map>
+#include <vector>
 
 class CBlockIndex;
 class AMQPAbstractNotifier;
 
+/** Send queue of one broker address, see GetAMQPSenderStats */
+struct AMQPSenderStats
+{
+    std::string address;
+    bool fConnected;
+    size_t nQueued;
+    uint64_t nSent;
+    uint64_t nDropped;
+    uint64_t nReconnects;
+};
+
+//! The send queues of the AMQP publishers, taking none of the validation locks
+std::vector<AMQPSenderStats> GetAMQPSenderStats();
+
 class AMQPNotificationInterface : public CValidationInterface
 {
 public:
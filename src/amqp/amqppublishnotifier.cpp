@@ -3,14 +3,18 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "amqppublishnotifier.h"
+#include "amqpnotificationinterface.h"
 #include "main.h"
 #include "util.h"
 
 #include "amqpsender.h"
 
 #include <memory>
+#include <mutex>
 #include <thread>
 
+//! Guards mapPublishNotifiers, which the metrics read from their own thread
+static std::mutex cs_mapPublishNotifiers;
 static std::multimap<std::string, AMQPAbstractPublishNotifier*> mapPublishNotifiers;
 
 static const char *MSG_HASHBLOCK = "hashblock";
@@ -41,11 +45,12 @@ void AMQPAbstractPublishNotifier::SpawnProtonContainer()
 
 bool AMQPAbstractPublishNotifier::Initialize()
 {
+    std::lock_guard<std::mutex> guard(cs_mapPublishNotifiers);
     std::multimap<std::string, AMQPAbstractPublishNotifier*>::iterator i = mapPublishNotifiers.find(address);
 
     if (i == mapPublishNotifiers.end()) {
         try {
-            handler_ = std::make_shared<AMQPSender>(address);
+            handler_ = std::make_shared<AMQPSender>(address, maxQueue ? maxQueue : DEFAULT_AMQP_QUEUE_SIZE, dropOldest);
             thread_ = std::make_shared<std::thread>(&AMQPAbstractPublishNotifier::SpawnProtonContainer, this);
         }
         catch (std::exception &e) {
@@ -68,16 +73,20 @@ void AMQPAbstractPublishNotifier::Shutdown()
 {
     LogPrint("amqp", "amqp: Shutdown notifier %s at %s\n", GetType(), GetAddress());
 
-    int count = mapPublishNotifiers.count(address);
+    int count;
+    {
+        std::lock_guard<std::mutex> guard(cs_mapPublishNotifiers);
+        count = mapPublishNotifiers.count(address);
 
-    // remove this notifier from the list of publishers using this address
-    typedef std::multimap<std::string, AMQPAbstractPublishNotifier*>::iterator iterator;
-    std::pair<iterator, iterator> iterpair = mapPublishNotifiers.equal_range(address);
+        // remove this notifier from the list of publishers using this address
+        typedef std::multimap<std::string, AMQPAbstractPublishNotifier*>::iterator iterator;
+        std::pair<iterator, iterator> iterpair = mapPublishNotifiers.equal_range(address);
 
-    for (iterator it = iterpair.first; it != iterpair.second; ++it) {
-        if (it->second == this) {
-            mapPublishNotifiers.erase(it);
-            break;
+        for (iterator it = iterpair.first; it != iterpair.second; ++it) {
+            if (it->second == this) {
+                mapPublishNotifiers.erase(it);
+                break;
+            }
         }
     }
 
@@ -89,7 +98,28 @@ void AMQPAbstractPublishNotifier::Shutdown()
                 thread_->join();
             }
         }
+        LogPrint("amqp", "amqp: Sent %u messages to %s, dropped %u, reconnected %u times\n",
+                 handler_->sent(), address, handler_->dropped(), handler_->reconnects());
+    }
+}
+
+std::vector<AMQPSenderStats> GetAMQPSenderStats()
+{
+    std::vector<AMQPSenderStats> vStats;
+    std::lock_guard<std::mutex> guard(cs_mapPublishNotifiers);
+    for (std::multimap<std::string, AMQPAbstractPublishNotifier*>::const_iterator it = mapPublishNotifiers.begin(); it != mapPublishNotifiers.end(); ) {
+        std::shared_ptr<AMQPSender> sender = it->second->GetSender();
+        AMQPSenderStats stats;
+        stats.address = it->first;
+        stats.fConnected = sender->isConnected();
+        stats.nQueued = sender->pending();
+        stats.nSent = sender->sent();
+        stats.nDropped = sender->dropped();
+        stats.nReconnects = sender->reconnects();
+        vStats.push_back(stats);
+        it = mapPublishNotifiers.upper_bound(it->first);
     }
+    return vStats;
 }
 
 
@@ -156,7 +186,7 @@ bool AMQPPublishRawBlockNotifier::NotifyBlock(const CBlockIndex *pindex)
     {
         LOCK(cs_main);
         CBlock block;
-        if(!ReadBlockFromDisk(block, pindex)) {
+        if(!ReadBlockFromDisk(block, pindex, 1)) {
             LogPrint("amqp", "amqp: Can't read block from disk");
             return false;
         }
@@ -17,7 +17,7 @@ class CBlockIndex;
 class AMQPAbstractPublishNotifier : public AMQPAbstractNotifier
 {
 private:
-    uint64_t sequence_;                         // memory only, per notifier instance: upcounting message sequence number
+    uint64_t sequence_ = 0;                       // memory only, per notifier instance: upcounting message sequence number
 
     std::shared_ptr<std::thread> thread_;       // proton container thread, may be shared between notifiers
     std::shared_ptr<AMQPSender> handler_;      // proton container message handler, may be shared between notifiers
@@ -27,6 +27,8 @@ public:
     bool Initialize();
     void Shutdown();
     void SpawnProtonContainer();
+
+    std::shared_ptr<AMQPSender> GetSender() const { return handler_; }
 };
 
 class AMQPPublishHashBlockNotifier : public AMQPAbstractPublishNotifier
@@ -6,77 +6,153 @@
 #define ZCASH_AMQP_AMQPSENDER_H
 
 #include "amqpconfig.h"
+#include "util.h"
 
+#include <algorithm>
+#include <atomic>
 #include <deque>
 #include <memory>
-#include <future>
-#include <iostream>
-
+#include <mutex>
+#include <vector>
+
+//! -amqpqueuesize default
+static const unsigned int DEFAULT_AMQP_QUEUE_SIZE = 10000;
+//! -amqpdroppolicy default
+static const char* const DEFAULT_AMQP_DROP_POLICY = "oldest";
+
+/**
+ * Proton handler of one broker connection.
+ *
+ * publish() only adds the message to a bounded queue, from any thread, and
+ * never waits on the broker. The proton objects are only used from the
+ * container thread, which sends as much of the queue as the broker gives
+ * credit for, each time credit is granted and every AMQP_TICK_MILLIS. Once
+ * the queue is full either the oldest message or the new one is dropped.
+ * A lost connection is opened again after a delay that doubles up to
+ * AMQP_MAX_RECONNECT_MILLIS, and the queue is kept meanwhile.
+ */
 class AMQPSender : public proton::messaging_handler {
   private:
-    std::deque<proton::message> messages_; 
+    static const int AMQP_TICK_MILLIS = 50;
+    static const int AMQP_MIN_RECONNECT_MILLIS = 500;
+    static const int AMQP_MAX_RECONNECT_MILLIS = 60000;
+    //! How long terminate() leaves the queue to drain
+    static const int AMQP_DRAIN_MILLIS = 2000;
+
+    std::deque<proton::message> messages_;
+    size_t maxMessages_;
+    bool dropOldest_;
+    std::string address_;
     proton::url url_;
+    proton::container* container_ = nullptr;
     proton::connection conn_;
     proton::sender sender_;
     std::mutex lock_;
     std::atomic<bool> terminated_ = {false};
+    std::atomic<bool> connected_ = {false};
+    std::atomic<uint64_t> sent_ = {0};
+    std::atomic<uint64_t> dropped_ = {0};
+    std::atomic<uint64_t> reconnects_ = {0};
+
+    // Only used from the container thread
+    bool reconnecting_ = false;
+    int reconnectMillis_ = AMQP_MIN_RECONNECT_MILLIS;
+    int drainedMillis_ = 0;
+
+    void connect() {
+        reconnecting_ = false;
+        proton::duration t(10000);   // milliseconds
+        proton::connection_options opts = proton::connection_options().idle_timeout(t);
+        conn_ = container_->connect(url_, opts);
+        sender_ = conn_.open_sender(url_.path());
+    }
+
+    void tick() {
+        dispatch();
+        if (isTerminated()) {
+            if (!connected_ || pending() == 0 || drainedMillis_ >= AMQP_DRAIN_MILLIS) {
+                if (connected_)
+                    conn_.close();
+                connected_ = false;
+                container_->stop();
+                return;
+            }
+            drainedMillis_ += AMQP_TICK_MILLIS;
+        }
+        container_->schedule(proton::duration(AMQP_TICK_MILLIS), [this]() { tick(); });
+    }
+
+    // Connection lost or never made, it is tried again after the backoff
+    void lost(const std::string& what) {
+        connected_ = false;
+        if (isTerminated() || reconnecting_)
+            return;
+        LogPrint("amqp", "amqp: connection to %s lost (%s), retrying in %dms\n", address_, what, reconnectMillis_);
+        reconnecting_ = true;
+        reconnects_++;
+        container_->schedule(proton::duration(reconnectMillis_), [this]() {
+            if (!isTerminated())
+                connect();
+        });
+        reconnectMillis_ = std::min(reconnectMillis_ * 2, AMQP_MAX_RECONNECT_MILLIS);
+    }
 
   public:
 
-    AMQPSender(const std::string& url) : url_(url) {}
+    AMQPSender(const std::string& url, size_t maxMessages = DEFAULT_AMQP_QUEUE_SIZE, bool dropOldest = true) :
+        maxMessages_(std::max<size_t>(maxMessages, 1)), dropOldest_(dropOldest), address_(url), url_(url) {}
 
     // Callback to initialize the container when run() is invoked
     void on_container_start(proton::container& c) override {
-        proton::duration t(10000);   // milliseconds
-        proton::connection_options opts = proton::connection_options().idle_timeout(t);
-        conn_ = c.connect(url_, opts);
-        sender_ = conn_.open_sender(url_.path());
+        container_ = &c;
+        connect();
+        tick();
     }
 
-    // Remote end signals when the local end can send (i.e. has credit) 
-    void on_sendable(proton::sender &s) override {
-        dispatch();
+    void on_sender_open(proton::sender &s) override {
+        connected_ = true;
+        reconnectMillis_ = AMQP_MIN_RECONNECT_MILLIS;
     }
 
-    // Publish message by adding to queue and trying to dispatch it
-    void publish(const proton::message &m) {
-        add_message(m);
+    // Remote end signals when the local end can send (i.e. has credit)
+    void on_sendable(proton::sender &s) override {
         dispatch();
     }
 
-    // Add message to queue
-    void add_message(const proton::message &m) {
+    // Publish message by adding it to the queue, the container thread sends it
+    void publish(const proton::message &m) {
         std::lock_guard<std::mutex> guard(lock_);
+        if (messages_.size() >= maxMessages_) {
+            dropped_++;
+            if (!dropOldest_)
+                return;
+            messages_.pop_front();
+        }
         messages_.push_back(m);
     }
 
-    // Send messages in queue
+    // Send the messages in the queue the broker has credit for, from the container thread
     void dispatch() {
-        std::lock_guard<std::mutex> guard(lock_);
-
-        if (isTerminated()) {
-            throw std::runtime_error("amqp connection was terminated");
-        }
-
-        if (!conn_.active()) {
-            throw std::runtime_error("amqp connection is not active");
-        }
-
-        while (messages_.size() > 0) {
-            if (sender_.credit()) {
-                const proton::message& m = messages_.front();
-                sender_.send(m);
+        if (!connected_)
+            return;
+
+        std::vector<proton::message> batch;
+        {
+            std::lock_guard<std::mutex> guard(lock_);
+            int credit = sender_.credit();
+            while (credit-- > 0 && !messages_.empty()) {
+                batch.push_back(std::move(messages_.front()));
                 messages_.pop_front();
-            } else {
-                break;
             }
         }
+        for (const proton::message& m : batch) {
+            sender_.send(m);
+            sent_++;
+        }
     }
 
-    // Close connection to remote end.  Container event-loop, by default, will auto-stop.
+    // Close the connection once the queue drained, which stops the container event-loop
     void terminate() {
-        std::lock_guard<std::mutex> guard(lock_);
-        conn_.close();
         terminated_.store(true);
     }
 
@@ -84,29 +160,39 @@ class AMQPSender : public proton::messaging_handler {
         return terminated_.load();
     }
 
+    size_t pending() {
+        std::lock_guard<std::mutex> guard(lock_);
+        return messages_.size();
+    }
+
+    bool isConnected() const { return connected_.load(); }
+    uint64_t sent() const { return sent_.load(); }
+    uint64_t dropped() const { return dropped_.load(); }
+    uint64_t reconnects() const { return reconnects_.load(); }
+
     void on_transport_error(proton::transport &t) override {
         t.connection().close();
-        throw t.error();
+        lost(t.error().what());
     }
 
     void on_connection_error(proton::connection &c) override {
         c.close();
-        throw c.error();
+        lost(c.error().what());
     }
 
     void on_session_error(proton::session &s) override {
         s.connection().close();
-        throw s.error();
+        lost(s.error().what());
     }
 
     void on_receiver_error(proton::receiver &r) override {
         r.connection().close();
-        throw r.error();
+        lost(r.error().what());
     }
 
     void on_sender_error(proton::sender &s) override {
         s.connection().close();
-        throw s.error();
+        lost(s.error().what());
     }
 
 };
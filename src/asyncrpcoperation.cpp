@@ -23,6 +23,7 @@
 #include <boost/uuid/uuid_generators.hpp>
 #include <boost/uuid/uuid_io.hpp>
 
+#include <algorithm>
 #include <string>
 #include <ctime>
 #include <chrono>
@@ -99,6 +100,16 @@ void AsyncRPCOperation::stop_execution_clock() {
     end_time_ = std::chrono::system_clock::now();
 }
 
+void AsyncRPCOperation::mark_queued() {
+    std::lock_guard<std::mutex> guard(lock_);
+    queued_time_ = std::chrono::system_clock::now();
+}
+
+void AsyncRPCOperation::mark_dequeued() {
+    std::lock_guard<std::mutex> guard(lock_);
+    dequeued_time_ = std::chrono::system_clock::now();
+}
+
 /**
  * Implement this virtual method in any subclass.  This is just an example implementation.
  */
@@ -178,11 +189,20 @@ UniValue AsyncRPCOperation::getStatus() const {
     UniValue result = this->getResult();
     if (!result.isNull()) {
         obj.push_back(Pair("result", result));
+    }
 
-        // Include execution time for successful operation
+    std::lock_guard<std::mutex> guard(lock_);
+    // Time spent waiting for a worker, so far while the operation is still queued
+    std::chrono::time_point<std::chrono::system_clock> unset;
+    if (queued_time_ != unset) {
+        std::chrono::time_point<std::chrono::system_clock> until = dequeued_time_ != unset ? dequeued_time_ : std::chrono::system_clock::now();
+        std::chrono::duration<double> wait_seconds = until - queued_time_;
+        obj.push_back(Pair("queue_wait_secs", std::max(0.0, wait_seconds.count())));
+    }
+    // Include execution time for finished operations
+    if (status == OperationStatus::SUCCESS || status == OperationStatus::FAILED) {
         std::chrono::duration<double> elapsed_seconds = end_time_ - start_time_;
         obj.push_back(Pair("execution_secs", elapsed_seconds.count()));
-
     }
     return obj;
 }
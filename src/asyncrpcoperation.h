@@ -51,6 +51,21 @@ typedef enum class operationStateEnum {
     SUCCESS
 } OperationStatus;
 
+/**
+ * The AsyncRPCQueue starts operations of a higher priority first. Background
+ * operations build large proofs and may be limited to fewer workers, so they
+ * never hold up payments queued after them.
+ */
+typedef enum class operationPriorityEnum {
+    HIGH = 0,
+    NORMAL,
+    BACKGROUND
+} OperationPriority;
+
+static const size_t NUM_OPERATION_PRIORITIES = 3;
+
+class AsyncRPCQueue;
+
 class AsyncRPCOperation {
 public:
     AsyncRPCOperation();
@@ -76,6 +91,16 @@ public:
         return creation_time_;
     }
 
+    // Name of the kind of operation, usually the RPC method. Operations of
+    // the same type share the concurrency limit of the queue for the type.
+    virtual std::string getType() const {
+        return "operation";
+    }
+
+    virtual OperationPriority getPriority() const {
+        return OperationPriority::NORMAL;
+    }
+
     // Override this method to add data to the default status object.
     virtual UniValue getStatus() const;
 
@@ -129,6 +154,8 @@ protected:
     std::string error_message_;
     std::atomic<OperationStatus> state_;
     std::chrono::time_point<std::chrono::system_clock> start_time_, end_time_;  
+    // Set by the AsyncRPCQueue when the operation is added and when a worker picks it up
+    std::chrono::time_point<std::chrono::system_clock> queued_time_, dequeued_time_;
 
     void start_execution_clock();
     void stop_execution_clock();
@@ -153,6 +180,10 @@ protected:
     }
     
 private:
+    friend class AsyncRPCQueue;
+
+    void mark_queued();
+    void mark_dequeued();
 
     // Derived classes should write their own copy constructor and assignment operators
     AsyncRPCOperation(const AsyncRPCOperation& orig);
@@ -30,7 +30,8 @@ shared_ptr<AsyncRPCQueue> AsyncRPCQueue::sharedInstance() {
     return q;
 }
 
-AsyncRPCQueue::AsyncRPCQueue() : closed_(false), finish_(false) {
+AsyncRPCQueue::AsyncRPCQueue() : closed_(false), finish_(false),
+    default_type_limit_(0), background_limit_(0), running_background_(0) {
 }
 
 AsyncRPCQueue::~AsyncRPCQueue() {
@@ -43,46 +44,96 @@ AsyncRPCQueue::~AsyncRPCQueue() {
 void AsyncRPCQueue::run(size_t workerId) {
 
     while (true) {
-        AsyncRPCOperationId key;
         std::shared_ptr<AsyncRPCOperation> operation;
+        std::string type;
+        bool background;
         {
             std::unique_lock<std::mutex> guard(lock_);
-            while (operation_id_queue_.empty() && !isClosed() && !isFinishing()) {
+            while (true) {
+                // Exit if the queue is closing.
+                if (isClosed()) {
+                    for (auto& queue : operation_id_queues_) {
+                        queue.clear();
+                    }
+                    return;
+                }
+
+                operation = pop_runnable();
+                if (operation) {
+                    break;
+                }
+
+                // Exit if the queue is empty and we are finishing up
+                if (isFinishing() && queues_empty()) {
+                    return;
+                }
+
+                // Wait for new operations, or for a running one to free its slot
                 this->condition_.wait(guard);
             }
 
-            // Exit if the queue is empty and we are finishing up
-            if (isFinishing() && operation_id_queue_.empty()) {
-                break;
+            type = operation->getType();
+            background = operation->getPriority() == OperationPriority::BACKGROUND;
+            running_by_type_[type]++;
+            if (background) {
+                running_background_++;
             }
+        }
 
-            // Exit if the queue is closing.
-            if (isClosed()) {
-                while (!operation_id_queue_.empty()) {
-                    operation_id_queue_.pop();
-                }
-                break;
+        operation->mark_dequeued();
+        operation->main();
+
+        {
+            std::lock_guard<std::mutex> guard(lock_);
+            if (--running_by_type_[type] == 0) {
+                running_by_type_.erase(type);
             }
+            if (background) {
+                running_background_--;
+            }
+            // Operations passed over for the limits may run now
+            this->condition_.notify_all();
+        }
+    }
+}
 
-            // Get operation id
-            key = operation_id_queue_.front();
-            operation_id_queue_.pop();
+std::shared_ptr<AsyncRPCOperation> AsyncRPCQueue::pop_runnable() {
+    for (auto& queue : operation_id_queues_) {
+        for (auto it = queue.begin(); it != queue.end(); ) {
+            AsyncRPCOperationMap::const_iterator iter = operation_map_.find(*it);
+            if (iter == operation_map_.end() || iter->second->isCancelled()) {
+                // removed from the map or cancelled while queued, skip it
+                it = queue.erase(it);
+                continue;
+            }
 
-            // Search operation map
-            AsyncRPCOperationMap::const_iterator iter = operation_map_.find(key);
-            if (iter != operation_map_.end()) {
-                operation = iter->second;
+            std::shared_ptr<AsyncRPCOperation> operation = iter->second;
+            std::string type = operation->getType();
+            std::map<std::string, size_t>::const_iterator limit = type_limits_.find(type);
+            size_t type_limit = limit != type_limits_.end() ? limit->second : default_type_limit_;
+            std::map<std::string, size_t>::const_iterator running = running_by_type_.find(type);
+            bool type_full = type_limit > 0 && running != running_by_type_.end() && running->second >= type_limit;
+            bool background_full = operation->getPriority() == OperationPriority::BACKGROUND &&
+                background_limit_ > 0 && running_background_ >= background_limit_;
+            if (type_full || background_full) {
+                ++it;
+                continue;
             }
+
+            queue.erase(it);
+            return operation;
         }
+    }
+    return std::shared_ptr<AsyncRPCOperation>();
+}
 
-        if (!operation) {
-            // cannot find operation in map, may have been removed
-        } else if (operation->isCancelled()) {
-            // skip cancelled operation
-        } else {
-            operation->main();
+bool AsyncRPCQueue::queues_empty() const {
+    for (auto& queue : operation_id_queues_) {
+        if (!queue.empty()) {
+            return false;
         }
     }
+    return true;
 }
 
 
@@ -106,8 +157,10 @@ void AsyncRPCQueue::addOperation(const std::shared_ptr<AsyncRPCOperation> &ptrOp
 
     AsyncRPCOperationId id = ptrOperation->getId();
     operation_map_.emplace(id, ptrOperation);
-    operation_id_queue_.push(id);
-    this->condition_.notify_one();
+    ptrOperation->mark_queued();
+    operation_id_queues_[(size_t)ptrOperation->getPriority()].push_back(id);
+    // Not notify_one: the woken worker may find the operation over its limits
+    this->condition_.notify_all();
 }
 
 /**
@@ -183,7 +236,29 @@ void AsyncRPCQueue::cancelAllOperations() {
  */
 size_t AsyncRPCQueue::getOperationCount() const {
     std::lock_guard<std::mutex> guard(lock_);
-    return operation_id_queue_.size();
+    size_t count = 0;
+    for (auto& queue : operation_id_queues_) {
+        count += queue.size();
+    }
+    return count;
+}
+
+void AsyncRPCQueue::setDefaultTypeLimit(size_t limit) {
+    std::lock_guard<std::mutex> guard(lock_);
+    default_type_limit_ = limit;
+    this->condition_.notify_all();
+}
+
+void AsyncRPCQueue::setTypeLimit(const std::string& type, size_t limit) {
+    std::lock_guard<std::mutex> guard(lock_);
+    type_limits_[type] = limit;
+    this->condition_.notify_all();
+}
+
+void AsyncRPCQueue::setBackgroundLimit(size_t limit) {
+    std::lock_guard<std::mutex> guard(lock_);
+    background_limit_ = limit;
+    this->condition_.notify_all();
 }
 
 /**
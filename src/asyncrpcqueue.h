@@ -25,7 +25,8 @@
 #include <iostream>
 #include <string>
 #include <chrono>
-#include <queue>
+#include <deque>
+#include <map>
 #include <unordered_map>
 #include <vector>
 #include <future>
@@ -36,7 +37,16 @@
 
 typedef std::unordered_map<AsyncRPCOperationId, std::shared_ptr<AsyncRPCOperation> > AsyncRPCOperationMap; 
 
+// Default number of workers of the shared queue (-rpcasyncthreads)
+static const int DEFAULT_ASYNC_RPC_THREADS = 2;
 
+/**
+ * Operations are queued by priority and started in order of priority, first
+ * come first served within a priority. An operation whose type already runs
+ * on as many workers as the limit for the type allows, or a background
+ * operation while the background limit is reached, is passed over until one
+ * of those finishes. A limit of 0 means no limit.
+ */
 class AsyncRPCQueue {
 public:
     static shared_ptr<AsyncRPCQueue> sharedInstance();
@@ -65,10 +75,20 @@ public:
     void addOperation(const std::shared_ptr<AsyncRPCOperation> &ptrOperation);
     std::vector<AsyncRPCOperationId> getAllOperationIds() const;
 
+    // Concurrency limit for the types without a limit of their own
+    void setDefaultTypeLimit(size_t limit);
+    void setTypeLimit(const std::string& type, size_t limit);
+    // Number of background operations that may run at the same time
+    void setBackgroundLimit(size_t limit);
+
 private:
     // addWorker() will spawn a new thread on run())
     void run(size_t workerId);
     void wait_for_worker_threads();
+    // Takes the next operation a worker may start off the queues, dropping
+    // the ones that were removed or cancelled. Requires lock_.
+    std::shared_ptr<AsyncRPCOperation> pop_runnable();
+    bool queues_empty() const;
 
     // Why this is not a recursive lock: http://www.zaval.org/resources/library/butenhof1.html
     mutable std::mutex lock_;
@@ -76,8 +96,14 @@ private:
     std::atomic<bool> closed_;
     std::atomic<bool> finish_;
     AsyncRPCOperationMap operation_map_;
-    std::queue <AsyncRPCOperationId> operation_id_queue_;
+    std::deque<AsyncRPCOperationId> operation_id_queues_[NUM_OPERATION_PRIORITIES];
     std::vector<std::thread> workers_;
+    size_t default_type_limit_;
+    std::map<std::string, size_t> type_limits_;
+    size_t background_limit_;
+    // Operations executing now, by type, and the background ones among them
+    std::map<std::string, size_t> running_by_type_;
+    size_t running_background_;
 };
 
 #endif
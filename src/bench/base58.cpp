@@ -0,0 +1,45 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench/bench.h"
+
+#include "base58.h"
+#include "random.h"
+
+#include <vector>
+
+static void Base58Encode(benchmark::State& state)
+{
+    // Size of a transparent address with its version and checksum
+    std::vector<unsigned char> vch(25);
+    GetRandBytes(vch.data(), vch.size());
+    while (state.KeepRunning()) {
+        EncodeBase58(vch);
+    }
+}
+
+static void Base58CheckEncode(benchmark::State& state)
+{
+    std::vector<unsigned char> vch(21);
+    GetRandBytes(vch.data(), vch.size());
+    while (state.KeepRunning()) {
+        EncodeBase58Check(vch);
+    }
+}
+
+static void Base58Decode(benchmark::State& state)
+{
+    std::vector<unsigned char> vch(25);
+    GetRandBytes(vch.data(), vch.size());
+    std::string str = EncodeBase58(vch);
+    std::vector<unsigned char> vchRet;
+    while (state.KeepRunning()) {
+        vchRet.clear();
+        DecodeBase58(str, vchRet);
+    }
+}
+
+BENCHMARK(Base58Encode);
+BENCHMARK(Base58CheckEncode);
+BENCHMARK(Base58Decode);
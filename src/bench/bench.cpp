@@ -0,0 +1,126 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench/bench.h"
+
+#include "tinyformat.h"
+
+#include <algorithm>
+
+#include <univalue.h>
+
+namespace benchmark {
+
+bool State::KeepRunning()
+{
+    if (nLeft > 1) {
+        nLeft--;
+        return true;
+    }
+    if (nLeft == 1) {
+        int64_t nElapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - batchStart).count();
+        bool fShort = nElapsed < MIN_BATCH_NANOS && nBatch < MAX_BATCH;
+        if (nWarmup > 0 || fShort) {
+            // Warmup batches are dropped, and grow until they are timed well
+            if (nWarmup > 0)
+                nWarmup--;
+            if (fShort)
+                nBatch *= 2;
+        } else {
+            vSamples.push_back((double)nElapsed / nBatch);
+            if ((int)vSamples.size() >= nSamples)
+                return false;
+        }
+    }
+    nLeft = nBatch;
+    batchStart = clock::now();
+    return true;
+}
+
+BenchRunner::BenchmarkMap& BenchRunner::benchmarks()
+{
+    static BenchmarkMap benchmarks_map;
+    return benchmarks_map;
+}
+
+BenchRunner::BenchRunner(const std::string& name, BenchFunction func)
+{
+    benchmarks().insert(std::make_pair(name, func));
+}
+
+std::vector<std::string> BenchRunner::List()
+{
+    std::vector<std::string> vNames;
+    for (const BenchmarkMap::value_type& entry : benchmarks())
+        vNames.push_back(entry.first);
+    return vNames;
+}
+
+std::vector<Result> BenchRunner::RunAll(const std::string& filter, int nWarmup, int nSamples)
+{
+    std::vector<Result> results;
+    for (const BenchmarkMap::value_type& entry : benchmarks()) {
+        if (!filter.empty() && entry.first.find(filter) == std::string::npos)
+            continue;
+        State state(nWarmup, nSamples);
+        entry.second(state);
+        if (state.vSamples.empty())
+            continue;
+
+        std::vector<double> vSorted = state.vSamples;
+        std::sort(vSorted.begin(), vSorted.end());
+        Result result;
+        result.name = entry.first;
+        result.nBatch = state.GetBatch();
+        result.nSamples = vSorted.size();
+        result.min = vSorted.front();
+        result.median = Percentile(vSorted, 50);
+        result.p90 = Percentile(vSorted, 90);
+        result.p99 = Percentile(vSorted, 99);
+        result.max = vSorted.back();
+        results.push_back(result);
+    }
+    return results;
+}
+
+double Percentile(const std::vector<double>& vSorted, double p)
+{
+    if (vSorted.empty())
+        return 0;
+    // Interpolates between the two closest ranks
+    double rank = p / 100 * (vSorted.size() - 1);
+    size_t lower = (size_t)rank;
+    if (lower + 1 >= vSorted.size())
+        return vSorted.back();
+    return vSorted[lower] + (rank - lower) * (vSorted[lower + 1] - vSorted[lower]);
+}
+
+std::string FormatText(const std::vector<Result>& results)
+{
+    std::string str = "# Benchmark, samples, batch, min, median, p90, p99, max (ns per evaluation)\n";
+    for (const Result& result : results)
+        str += strprintf("%s, %u, %u, %.1f, %.1f, %.1f, %.1f, %.1f\n", result.name, result.nSamples, result.nBatch,
+                         result.min, result.median, result.p90, result.p99, result.max);
+    return str;
+}
+
+std::string FormatJSON(const std::vector<Result>& results)
+{
+    UniValue arr(UniValue::VARR);
+    for (const Result& result : results) {
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("name", result.name));
+        obj.push_back(Pair("samples", (uint64_t)result.nSamples));
+        obj.push_back(Pair("batch", result.nBatch));
+        obj.push_back(Pair("min_ns", result.min));
+        obj.push_back(Pair("median_ns", result.median));
+        obj.push_back(Pair("p90_ns", result.p90));
+        obj.push_back(Pair("p99_ns", result.p99));
+        obj.push_back(Pair("max_ns", result.max));
+        arr.push_back(obj);
+    }
+    return arr.write(2) + "\n";
+}
+
+} // namespace benchmark
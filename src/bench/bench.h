@@ -0,0 +1,100 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BENCH_BENCH_H
+#define BITCOIN_BENCH_BENCH_H
+
+#include <stdint.h>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/preprocessor/cat.hpp>
+#include <boost/preprocessor/stringize.hpp>
+
+/**
+ * Micro benchmarks of the hot paths of the node and the wallet, run by
+ * bench_pirate. A benchmark is a function of a State that repeats the code
+ * it measures while KeepRunning() is true, after its own setup:
+ *
+ *     static void Base58Encode(benchmark::State& state)
+ *     {
+ *         ... setup ...
+ *         while (state.KeepRunning()) {
+ *             ... code that is measured ...
+ *         }
+ *     }
+ *     BENCHMARK(Base58Encode);
+ *
+ * Evaluations are timed in batches, the batch doubling through the warmup
+ * until one takes at least MIN_BATCH_NANOS so the clock doesn't weigh on
+ * fast code. Every batch after the warmup is a sample of the time of one
+ * evaluation.
+ */
+namespace benchmark {
+
+typedef std::chrono::steady_clock clock;
+
+//! Time a batch of evaluations takes at least once the warmup is over
+static const int64_t MIN_BATCH_NANOS = 1000000;
+//! Limit of the evaluations of a batch, for code the compiler removed
+static const uint64_t MAX_BATCH = (uint64_t)1 << 30;
+
+class State
+{
+    int nWarmup;
+    int nSamples;
+    uint64_t nBatch;
+    uint64_t nLeft;
+    clock::time_point batchStart;
+
+public:
+    //! Nanoseconds per evaluation of each sample
+    std::vector<double> vSamples;
+
+    State(int nWarmupIn, int nSamplesIn) : nWarmup(nWarmupIn), nSamples(nSamplesIn), nBatch(1), nLeft(0) {}
+
+    bool KeepRunning();
+
+    uint64_t GetBatch() const { return nBatch; }
+};
+
+typedef std::function<void(State&)> BenchFunction;
+
+/** Result of a benchmark, in nanoseconds per evaluation */
+struct Result
+{
+    std::string name;
+    uint64_t nBatch;
+    size_t nSamples;
+    double min, median, p90, p99, max;
+};
+
+class BenchRunner
+{
+    typedef std::map<std::string, BenchFunction> BenchmarkMap;
+    static BenchmarkMap& benchmarks();
+
+public:
+    BenchRunner(const std::string& name, BenchFunction func);
+
+    //! Runs the benchmarks whose name contains filter, all of them when it is empty
+    static std::vector<Result> RunAll(const std::string& filter, int nWarmup, int nSamples);
+    static std::vector<std::string> List();
+};
+
+//! Value of the pth percentile of sorted samples
+double Percentile(const std::vector<double>& vSorted, double p);
+
+std::string FormatText(const std::vector<Result>& results);
+std::string FormatJSON(const std::vector<Result>& results);
+
+} // namespace benchmark
+
+#define BENCHMARK(n) \
+    benchmark::BenchRunner BOOST_PP_CAT(bench_, BOOST_PP_CAT(__LINE__, n))(BOOST_PP_STRINGIZE(n), n);
+
+#endif // BITCOIN_BENCH_BENCH_H
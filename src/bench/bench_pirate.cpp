@@ -0,0 +1,51 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench/bench.h"
+
+#include "chainparams.h"
+#include "crypto/common.h"
+#include "key.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <algorithm>
+
+static const int DEFAULT_BENCH_WARMUP = 2;
+static const int DEFAULT_BENCH_SAMPLES = 10;
+
+int main(int argc, char** argv)
+{
+    SetupEnvironment();
+    ParseParameters(argc, argv);
+
+    if (mapArgs.count("-?") || mapArgs.count("-h") || mapArgs.count("-help")) {
+        printf("Usage: bench_pirate [options]\n\n"
+               "  -filter=<str>   Only run the benchmarks whose name contains <str>\n"
+               "  -list           List the benchmarks and exit\n"
+               "  -warmup=<n>     Batches to drop before sampling (default: %d)\n"
+               "  -samples=<n>    Samples of each benchmark (default: %d)\n"
+               "  -json           Print the results as JSON\n",
+               DEFAULT_BENCH_WARMUP, DEFAULT_BENCH_SAMPLES);
+        return 0;
+    }
+    if (GetBoolArg("-list", false)) {
+        for (const std::string& name : benchmark::BenchRunner::List())
+            printf("%s\n", name.c_str());
+        return 0;
+    }
+
+    assert(init_and_check_sodium() != -1);
+    ECC_Start();
+    SelectParams(CBaseChainParams::REGTEST);
+
+    int nSamples = std::max<int64_t>(1, GetArg("-samples", DEFAULT_BENCH_SAMPLES));
+    int nWarmup = std::max<int64_t>(0, GetArg("-warmup", DEFAULT_BENCH_WARMUP));
+    std::vector<benchmark::Result> results = benchmark::BenchRunner::RunAll(GetArg("-filter", ""), nWarmup, nSamples);
+    std::string str = GetBoolArg("-json", false) ? benchmark::FormatJSON(results) : benchmark::FormatText(results);
+    fputs(str.c_str(), stdout);
+
+    ECC_Stop();
+    return 0;
+}
@@ -0,0 +1,118 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench/bench.h"
+
+#include "checkqueue.h"
+#include "crypto/sha256.h"
+#include "util.h"
+
+#include <algorithm>
+#include <vector>
+
+#include <boost/thread.hpp>
+
+/**
+ * Stands for a check of a block, hashing for as long as its cost says, in
+ * units of about an ECDSA verification. The blocks below are made of them
+ * in the proportions of real blocks, so the time is that of the queue
+ * spreading the checks of a block over the script check threads rather
+ * than of the checks themselves, which the other benchmarks time.
+ */
+class CBenchCheck
+{
+private:
+    unsigned int nCost;
+
+public:
+    CBenchCheck() : nCost(1) {}
+    CBenchCheck(unsigned int nCostIn) : nCost(nCostIn) {}
+
+    bool operator()()
+    {
+        unsigned char hash[CSHA256::OUTPUT_SIZE] = {0};
+        for (unsigned int i = 0; i < nCost * 64; i++)
+            CSHA256().Write(hash, sizeof(hash)).Finalize(hash);
+        return hash[0] != 0 || hash[1] != 0 || nCost > 0;
+    }
+
+    void swap(CBenchCheck& check) { std::swap(nCost, check.nCost); }
+
+    unsigned int GetCost() const { return nCost; }
+};
+
+//! A queue and its worker threads, one for each core but the one of the master, as with -par=0
+static CCheckQueue<CBenchCheck>* StartQueue(unsigned int nBatchSize)
+{
+    CCheckQueue<CBenchCheck>* pqueue = new CCheckQueue<CBenchCheck>(nBatchSize);
+    // Left running until the benchmarks exit
+    boost::thread_group* pthreads = new boost::thread_group();
+    for (int i = 0; i < std::max(1, GetNumCores() - 1); i++)
+        pthreads->create_thread(boost::bind(&CCheckQueue<CBenchCheck>::Thread, pqueue));
+    return pqueue;
+}
+
+//! Batch sizes of the script and Sapling check queues of main.cpp
+static CCheckQueue<CBenchCheck>& ScriptQueue()
+{
+    static CCheckQueue<CBenchCheck>* pqueue = StartQueue(128);
+    return *pqueue;
+}
+
+static CCheckQueue<CBenchCheck>& SaplingQueue()
+{
+    static CCheckQueue<CBenchCheck>* pqueue = StartQueue(16);
+    return *pqueue;
+}
+
+//! Adds the checks of each transaction in turn, as ConnectBlock does, and waits for them
+static void ConnectChecks(CCheckQueue<CBenchCheck>& queue, const std::vector<std::vector<unsigned int>>& vBlock)
+{
+    CCheckQueueControl<CBenchCheck> control(&queue);
+    for (const std::vector<unsigned int>& vTxCosts : vBlock) {
+        std::vector<CBenchCheck> vChecks(vTxCosts.begin(), vTxCosts.end());
+        control.Add(vChecks);
+    }
+    if (!control.Wait())
+        abort();
+}
+
+static void CheckQueueTransparentBlock(benchmark::State& state)
+{
+    // 1000 transactions of two signatures
+    std::vector<std::vector<unsigned int>> vBlock(1000, std::vector<unsigned int>(2, 1));
+    CCheckQueue<CBenchCheck>& queue = ScriptQueue();
+    while (state.KeepRunning()) {
+        ConnectChecks(queue, vBlock);
+    }
+}
+
+static void CheckQueueCCBlock(benchmark::State& state)
+{
+    // 1000 transactions of two inputs, one in eight spending a CC output whose Eval is run in the check
+    std::vector<std::vector<unsigned int>> vBlock(1000, std::vector<unsigned int>(2, 1));
+    for (size_t i = 0; i < vBlock.size(); i += 8)
+        vBlock[i][0] = 16;
+    CCheckQueue<CBenchCheck>& queue = ScriptQueue();
+    while (state.KeepRunning()) {
+        ConnectChecks(queue, vBlock);
+    }
+}
+
+static void CheckQueueSaplingBlock(benchmark::State& state)
+{
+    // 100 Sapling transactions of one to eight spends and outputs, a check for each transaction, the
+    // heaviest last in the block
+    std::vector<std::vector<unsigned int>> vBlock;
+    for (size_t i = 0; i < 100; i++)
+        vBlock.push_back(std::vector<unsigned int>(1, 16 * (1 + i * 8 / 100)));
+    CCheckQueue<CBenchCheck>& queue = SaplingQueue();
+    while (state.KeepRunning()) {
+        ConnectChecks(queue, vBlock);
+    }
+}
+
+BENCHMARK(CheckQueueTransparentBlock);
+BENCHMARK(CheckQueueCCBlock);
+BENCHMARK(CheckQueueSaplingBlock);
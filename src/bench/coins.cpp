@@ -0,0 +1,70 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench/bench.h"
+
+#include "coins.h"
+#include "random.h"
+#include "script/standard.h"
+
+#include <vector>
+
+//! Coins of a block's worth of transactions
+static const int BENCH_COINS = 1000;
+
+static std::vector<uint256> AddCoins(CCoinsViewCache& cache, int nCoins)
+{
+    CScript script = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, 1) << OP_EQUALVERIFY << OP_CHECKSIG;
+    std::vector<uint256> vTxids;
+    for (int i = 0; i < nCoins; i++) {
+        vTxids.push_back(GetRandHash());
+        CCoinsModifier coins = cache.ModifyCoins(vTxids.back());
+        coins->nHeight = 100;
+        coins->vout.resize(2);
+        coins->vout[0] = CTxOut(100000, script);
+        coins->vout[1] = CTxOut(200000, script);
+    }
+    return vTxids;
+}
+
+static void CoinsCacheHit(benchmark::State& state)
+{
+    CCoinsView base;
+    CCoinsViewCache cache(&base);
+    std::vector<uint256> vTxids = AddCoins(cache, BENCH_COINS);
+    size_t i = 0;
+    while (state.KeepRunning()) {
+        cache.AccessCoins(vTxids[i++ % vTxids.size()]);
+    }
+}
+
+static void CoinsCacheFetch(benchmark::State& state)
+{
+    // Misses of a new cache on top of the chainstate one, as when a block is connected
+    CCoinsView base;
+    CCoinsViewCache parent(&base);
+    std::vector<uint256> vTxids = AddCoins(parent, BENCH_COINS);
+    while (state.KeepRunning()) {
+        CCoinsViewCache cache(&parent);
+        for (const uint256& txid : vTxids)
+            cache.AccessCoins(txid);
+    }
+}
+
+static void CoinsCacheFlush(benchmark::State& state)
+{
+    CCoinsView base;
+    CCoinsViewCache parent(&base);
+    std::vector<uint256> vTxids = AddCoins(parent, BENCH_COINS);
+    while (state.KeepRunning()) {
+        CCoinsViewCache cache(&parent);
+        for (const uint256& txid : vTxids)
+            cache.ModifyCoins(txid)->vout[0].nValue++;
+        cache.Flush();
+    }
+}
+
+BENCHMARK(CoinsCacheHit);
+BENCHMARK(CoinsCacheFetch);
+BENCHMARK(CoinsCacheFlush);
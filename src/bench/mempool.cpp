@@ -0,0 +1,131 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench/bench.h"
+
+#include "random.h"
+#include "txmempool.h"
+
+#include <map>
+#include <vector>
+
+//! Inputs and nullifiers of a full mempool
+static const int BENCH_MEMPOOL_ENTRIES = 100000;
+
+typedef std::map<COutPoint, CInPoint> orderedNextTxMap;
+typedef std::map<uint256, const CTransaction*> orderedNullifierMap;
+typedef boost::unordered_map<uint256, const CTransaction*, CCoinsKeyHasher, std::equal_to<uint256>,
+    pool_allocator<std::pair<const uint256, const CTransaction*>>> pooledNullifierMap;
+
+//! Twice as many outpoints as the maps hold, the second half for the transactions being admitted
+static const std::vector<COutPoint>& MempoolOutPoints()
+{
+    static std::vector<COutPoint> vOutPoints;
+    if (vOutPoints.empty()) {
+        for (int i = 0; i < 2 * BENCH_MEMPOOL_ENTRIES; i++)
+            vOutPoints.push_back(COutPoint(GetRandHash(), i % 4));
+    }
+    return vOutPoints;
+}
+
+template <typename Map>
+static void FillNextTx(Map& mapNextTx, const std::vector<COutPoint>& vOutPoints)
+{
+    for (int i = 0; i < BENCH_MEMPOOL_ENTRIES; i++)
+        mapNextTx.insert(std::make_pair(vOutPoints[i], CInPoint(nullptr, i)));
+}
+
+template <typename Map>
+static void AdmitNextTx(benchmark::State& state, Map& mapNextTx)
+{
+    // The conflict check and insert of an admission, and the erase of an eviction, at a steady size
+    const std::vector<COutPoint>& vOutPoints = MempoolOutPoints();
+    FillNextTx(mapNextTx, vOutPoints);
+    size_t i = 0, nConflicts = 0;
+    while (state.KeepRunning()) {
+        const COutPoint& outpoint = vOutPoints[(i + BENCH_MEMPOOL_ENTRIES) % vOutPoints.size()];
+        if (mapNextTx.count(outpoint))
+            nConflicts++;
+        mapNextTx.insert(std::make_pair(outpoint, CInPoint(nullptr, 0)));
+        mapNextTx.erase(vOutPoints[i++ % vOutPoints.size()]);
+    }
+    if (nConflicts > 0 || mapNextTx.size() != BENCH_MEMPOOL_ENTRIES)
+        abort();
+}
+
+template <typename Map>
+static void LookupNextTx(benchmark::State& state, Map& mapNextTx)
+{
+    // Half the inputs checked are spent in the mempool, as when a block's transactions are removed
+    const std::vector<COutPoint>& vOutPoints = MempoolOutPoints();
+    FillNextTx(mapNextTx, vOutPoints);
+    size_t i = 0, nFound = 0;
+    while (state.KeepRunning()) {
+        if (mapNextTx.find(vOutPoints[(i++ * 7919) % vOutPoints.size()]) != mapNextTx.end())
+            nFound++;
+    }
+    if (nFound > i)
+        abort();
+}
+
+template <typename Map>
+static void LookupNullifier(benchmark::State& state, Map& mapNullifiers)
+{
+    const std::vector<COutPoint>& vOutPoints = MempoolOutPoints();
+    for (int i = 0; i < BENCH_MEMPOOL_ENTRIES; i++)
+        mapNullifiers.insert(std::make_pair(vOutPoints[i].hash, nullptr));
+    size_t i = 0, nFound = 0;
+    while (state.KeepRunning()) {
+        if (mapNullifiers.count(vOutPoints[(i++ * 7919) % vOutPoints.size()].hash))
+            nFound++;
+    }
+    if (nFound > i)
+        abort();
+}
+
+static void MempoolNextTxAdmit(benchmark::State& state)
+{
+    PoolResource pool;
+    CTxMemPool::nextTxMap mapNextTx(0, SaltedOutpointHasher(), std::equal_to<COutPoint>(), CTxMemPool::nextTxMap::allocator_type(&pool));
+    AdmitNextTx(state, mapNextTx);
+}
+
+static void MempoolNextTxAdmitOrdered(benchmark::State& state)
+{
+    orderedNextTxMap mapNextTx;
+    AdmitNextTx(state, mapNextTx);
+}
+
+static void MempoolNextTxLookup(benchmark::State& state)
+{
+    PoolResource pool;
+    CTxMemPool::nextTxMap mapNextTx(0, SaltedOutpointHasher(), std::equal_to<COutPoint>(), CTxMemPool::nextTxMap::allocator_type(&pool));
+    LookupNextTx(state, mapNextTx);
+}
+
+static void MempoolNextTxLookupOrdered(benchmark::State& state)
+{
+    orderedNextTxMap mapNextTx;
+    LookupNextTx(state, mapNextTx);
+}
+
+static void MempoolNullifierLookup(benchmark::State& state)
+{
+    PoolResource pool;
+    pooledNullifierMap mapNullifiers(0, CCoinsKeyHasher(), std::equal_to<uint256>(), pooledNullifierMap::allocator_type(&pool));
+    LookupNullifier(state, mapNullifiers);
+}
+
+static void MempoolNullifierLookupOrdered(benchmark::State& state)
+{
+    orderedNullifierMap mapNullifiers;
+    LookupNullifier(state, mapNullifiers);
+}
+
+BENCHMARK(MempoolNextTxAdmit);
+BENCHMARK(MempoolNextTxAdmitOrdered);
+BENCHMARK(MempoolNextTxLookup);
+BENCHMARK(MempoolNextTxLookupOrdered);
+BENCHMARK(MempoolNullifierLookup);
+BENCHMARK(MempoolNullifierLookupOrdered);
@@ -0,0 +1,80 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench/bench.h"
+
+#include "bloom.h"
+#include "net.h"
+#include "random.h"
+
+#include <vector>
+
+//! Hashes of announced transactions, more than the filters remember so they keep rolling
+static const std::vector<uint256>& InventoryHashes()
+{
+    static std::vector<uint256> vHashes;
+    if (vHashes.empty()) {
+        for (int i = 0; i < 4 * INVENTORY_KNOWN_MAX; i++)
+            vHashes.push_back(GetRandHash());
+    }
+    return vHashes;
+}
+
+static void RollingBloomInventoryKnown(benchmark::State& state)
+{
+    // What SendMessages does for each transaction announced to a peer
+    CRollingBloomFilter filter(INVENTORY_KNOWN_MAX, 0.000001);
+    const std::vector<uint256>& vHashes = InventoryHashes();
+    size_t i = 0, nKnown = 0;
+    while (state.KeepRunning()) {
+        const uint256& hash = vHashes[i++ % vHashes.size()];
+        if (filter.contains(hash))
+            nKnown++;
+        else
+            filter.insert(hash);
+    }
+    if (nKnown > i)
+        abort();
+}
+
+static void RollingBloomAddrKnown(benchmark::State& state)
+{
+    // The keys of CService are 18 bytes, an IPv6 address and a port
+    CRollingBloomFilter filter(5000, 0.001);
+    std::vector<std::vector<unsigned char>> vKeys;
+    for (int i = 0; i < 20000; i++) {
+        uint256 hash = GetRandHash();
+        vKeys.push_back(std::vector<unsigned char>(hash.begin(), hash.begin() + 18));
+    }
+    size_t i = 0, nKnown = 0;
+    while (state.KeepRunning()) {
+        const std::vector<unsigned char>& vKey = vKeys[i++ % vKeys.size()];
+        if (filter.contains(vKey))
+            nKnown++;
+        else
+            filter.insert(vKey);
+    }
+    if (nKnown > i)
+        abort();
+}
+
+static void AskForInsertErase(benchmark::State& state)
+{
+    // A peer with a full queue of requests, each answered after as many others were asked for
+    std::unordered_set<uint256, SaltedInvHasher> setAskFor;
+    const std::vector<uint256>& vHashes = InventoryHashes();
+    for (size_t i = 0; i < vHashes.size() / 2; i++)
+        setAskFor.insert(vHashes[i]);
+    size_t i = 0;
+    while (state.KeepRunning()) {
+        setAskFor.insert(vHashes[(i + vHashes.size() / 2) % vHashes.size()]);
+        setAskFor.erase(vHashes[i++ % vHashes.size()]);
+    }
+    if (setAskFor.size() != vHashes.size() / 2)
+        abort();
+}
+
+BENCHMARK(RollingBloomInventoryKnown);
+BENCHMARK(RollingBloomAddrKnown);
+BENCHMARK(AskForInsertErase);
@@ -0,0 +1,61 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench/bench.h"
+
+#include "zcash/IncrementalMerkleTree.hpp"
+#include "zcash/Note.hpp"
+
+#include <vector>
+
+//! Note commitments of a block's worth of Sapling outputs
+static std::vector<libzcash::PedersenHash> MakeCommitments(size_t nCommitments)
+{
+    libzcash::SaplingPaymentAddress addr = libzcash::SaplingSpendingKey::random().default_address();
+    std::vector<libzcash::PedersenHash> vCommitments;
+    for (size_t i = 0; i < nCommitments; i++)
+        vCommitments.push_back(libzcash::SaplingNote(addr, i).cm().get());
+    return vCommitments;
+}
+
+static void SaplingTreeAppend(benchmark::State& state)
+{
+    std::vector<libzcash::PedersenHash> vCommitments = MakeCommitments(100);
+    SaplingMerkleTree tree;
+    size_t i = 0;
+    while (state.KeepRunning()) {
+        tree.append(vCommitments[i++ % vCommitments.size()]);
+    }
+}
+
+static void SaplingWitnessUpdate(benchmark::State& state)
+{
+    // Witnesses of a wallet's notes brought up to date with a block, as the
+    // wallet does for every block it connects
+    std::vector<libzcash::PedersenHash> vCommitments = MakeCommitments(20);
+    SaplingMerkleTree tree;
+    std::vector<SaplingWitness> vWitnesses;
+    for (size_t i = 0; i < 100; i++) {
+        tree.append(vCommitments[i % vCommitments.size()]);
+        vWitnesses.push_back(tree.witness());
+    }
+    while (state.KeepRunning()) {
+        for (SaplingWitness& witness : vWitnesses)
+            witness.append_batch(vCommitments);
+    }
+}
+
+static void SaplingTreeRoot(benchmark::State& state)
+{
+    std::vector<libzcash::PedersenHash> vCommitments = MakeCommitments(100);
+    SaplingMerkleTree tree;
+    tree.append_batch(vCommitments);
+    while (state.KeepRunning()) {
+        tree.root();
+    }
+}
+
+BENCHMARK(SaplingTreeAppend);
+BENCHMARK(SaplingWitnessUpdate);
+BENCHMARK(SaplingTreeRoot);
@@ -0,0 +1,47 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench/bench.h"
+
+#include "random.h"
+#include "uint256.h"
+
+#include <univalue.h>
+
+//! Array like the transaction lists of the wallet RPCs, of nEntries objects
+static UniValue MakeTransactionList(int nEntries)
+{
+    UniValue arr(UniValue::VARR);
+    for (int i = 0; i < nEntries; i++) {
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("txid", GetRandHash().GetHex()));
+        obj.push_back(Pair("address", GetRandHash().GetHex().substr(0, 34)));
+        obj.push_back(Pair("amount", 1.2345678));
+        obj.push_back(Pair("confirmations", i));
+        obj.push_back(Pair("time", (int64_t)1500000000 + i));
+        obj.push_back(Pair("memo", std::string(64, 'f')));
+        arr.push_back(obj);
+    }
+    return arr;
+}
+
+static void UniValueWrite(benchmark::State& state)
+{
+    UniValue arr = MakeTransactionList(1000);
+    while (state.KeepRunning()) {
+        arr.write();
+    }
+}
+
+static void UniValueRead(benchmark::State& state)
+{
+    std::string str = MakeTransactionList(1000).write();
+    while (state.KeepRunning()) {
+        UniValue val;
+        val.read(str);
+    }
+}
+
+BENCHMARK(UniValueWrite);
+BENCHMARK(UniValueRead);
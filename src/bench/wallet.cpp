@@ -0,0 +1,52 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench/bench.h"
+
+#include "primitives/transaction.h"
+#include "wallet/wallet.h"
+#include "zcash/Note.hpp"
+
+#include <vector>
+
+//! Shielded outputs of a typical transaction
+static const size_t BENCH_SAPLING_OUTPUTS = 2;
+
+//! Outputs to an address none of the benchmark keys has, the usual case of a block
+static std::vector<OutputDescription> MakeOutputs(size_t nOutputs)
+{
+    std::vector<OutputDescription> vOutputs;
+    libzcash::SaplingPaymentAddress addr = libzcash::SaplingSpendingKey::random().default_address();
+    std::array<unsigned char, ZC_MEMO_SIZE> memo = {{0xF6}};
+    for (size_t i = 0; i < nOutputs; i++) {
+        libzcash::SaplingNote note(addr, 10000 + i);
+        auto enc = libzcash::SaplingNotePlaintext(note, memo).encrypt(addr.pk_d).get();
+        OutputDescription output;
+        output.cm = note.cm().get();
+        output.ephemeralKey = enc.second.get_epk();
+        output.encCiphertext = enc.first;
+        vOutputs.push_back(output);
+    }
+    return vOutputs;
+}
+
+static void TrialDecrypt(benchmark::State& state, size_t nKeys)
+{
+    std::vector<libzcash::SaplingIncomingViewingKey> vIvks;
+    for (size_t i = 0; i < nKeys; i++)
+        vIvks.push_back(libzcash::SaplingSpendingKey::random().expanded_spending_key().full_viewing_key().in_viewing_key());
+    std::vector<OutputDescription> vOutputs = MakeOutputs(BENCH_SAPLING_OUTPUTS);
+    std::vector<SaplingTrialDecryptionResult> vResults;
+    while (state.KeepRunning()) {
+        CWallet::TrialDecryptSaplingOutputs(vOutputs, vIvks, vResults);
+    }
+}
+
+static void SaplingTrialDecrypt1(benchmark::State& state) { TrialDecrypt(state, 1); }
+static void SaplingTrialDecrypt100(benchmark::State& state) { TrialDecrypt(state, 100); }
+static void SaplingTrialDecrypt10000(benchmark::State& state) { TrialDecrypt(state, 10000); }
+
+BENCHMARK(SaplingTrialDecrypt1);
+BENCHMARK(SaplingTrialDecrypt100);
+BENCHMARK(SaplingTrialDecrypt10000);
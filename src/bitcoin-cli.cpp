@@ -25,6 +25,8 @@
 #include "util.h"
 #include "utilstrencodings.h"
 
+#include <algorithm>
+#include <boost/algorithm/string.hpp>
 #include <boost/filesystem/operations.hpp>
 #include <stdio.h>
 
@@ -40,6 +42,7 @@ using namespace std;
 
 static const int DEFAULT_HTTP_CLIENT_TIMEOUT=900;
 static const int CONTINUE_EXECUTION=-1;
+static const int DEFAULT_BATCH_SIZE=1;
 
 std::string HelpMessageCli()
 {
@@ -58,6 +61,8 @@ std::string HelpMessageCli()
     strUsage += HelpMessageOpt("-rpcpassword=<pw>", _("Password for JSON-RPC connections"));
     strUsage += HelpMessageOpt("-rpcclienttimeout=<n>", strprintf(_("Timeout in seconds during HTTP requests, or 0 for no timeout. (default: %d)"), DEFAULT_HTTP_CLIENT_TIMEOUT));
     strUsage += HelpMessageOpt("-stdin", _("Read extra arguments from standard input, one per line until EOF/Ctrl-D (recommended for sensitive information such as passphrases)"));
+    strUsage += HelpMessageOpt("-batch", _("Read one command per line from standard input, its arguments separated by spaces, until EOF/Ctrl-D, and send them all over one connection. Replies are printed one per line, in order"));
+    strUsage += HelpMessageOpt("-batchsize=<n>", strprintf(_("With -batch, send up to <n> commands in each request, so they are executed without waiting for the replies in between (default: %d)"), DEFAULT_BATCH_SIZE));
 
     return strUsage;
 }
@@ -147,10 +152,11 @@ static int AppInitRPC(int argc, char* argv[])
 /** Reply structure for request_done to fill in */
 struct HTTPReply
 {
-    HTTPReply(): status(0), error(-1) {}
+    HTTPReply(): status(0), error(-1), done(false) {}
 
     int status;
     int error;
+    bool done;
     std::string body;
 };
 
@@ -179,6 +185,7 @@ const char *http_errorstring(int code)
 static void http_request_done(struct evhttp_request *req, void *ctx)
 {
     HTTPReply *reply = static_cast<HTTPReply*>(ctx);
+    reply->done = true;
 
     if (req == NULL) {
         /* If req is NULL, it means an error occurred while connecting: the
@@ -209,74 +216,107 @@ static void http_error_cb(enum evhttp_request_error err, void *ctx)
 }
 #endif
 
-UniValue CallRPC(const std::string& strMethod, const UniValue& params)
+/**
+ * Connection to the RPC server. With keep-alive the connection stays open
+ * between requests, and libevent opens it again if the server closed it while
+ * idle.
+ */
+class CRPCConnection
 {
-    std::string host = GetArg("-rpcconnect", "127.0.0.1");
-    int port = GetArg("-rpcport", BaseParams().RPCPort());
-    BITCOIND_RPCPORT = port;
-    // Obtain event base
-    raii_event_base base = obtain_event_base();
-
-    // Synchronously look up hostname
-    raii_evhttp_connection evcon = obtain_evhttp_connection_base(base.get(), host, port);
-    evhttp_connection_set_timeout(evcon.get(), GetArg("-rpcclienttimeout", DEFAULT_HTTP_CLIENT_TIMEOUT));
-
-    HTTPReply response;
-    raii_evhttp_request req = obtain_evhttp_request(http_request_done, (void*)&response);
-    if (req == NULL)
-        throw std::runtime_error("create http request failed");
+private:
+    std::string host;
+    int port;
+    bool fKeepAlive;
+    std::string strAuthorization;
+    raii_event_base base;
+    raii_evhttp_connection evcon;
+
+public:
+    CRPCConnection(bool fKeepAliveIn) : fKeepAlive(fKeepAliveIn)
+    {
+        host = GetArg("-rpcconnect", "127.0.0.1");
+        port = GetArg("-rpcport", BaseParams().RPCPort());
+        BITCOIND_RPCPORT = port;
+
+        // Get credentials
+        std::string strRPCUserColonPass;
+        if (mapArgs["-rpcpassword"] == "") {
+            // Try fall back to cookie-based authentication if no password is provided
+            if (!GetAuthCookie(&strRPCUserColonPass)) {
+                throw std::runtime_error(strprintf(
+                    _("Could not locate RPC credentials. No authentication cookie could be found,\n"
+                      "and no rpcpassword is set in the configuration file (%s)."),
+                        GetConfigFile().string().c_str()));
+
+            }
+        } else {
+            strRPCUserColonPass = mapArgs["-rpcuser"] + ":" + mapArgs["-rpcpassword"];
+        }
+        strAuthorization = std::string("Basic ") + EncodeBase64(strRPCUserColonPass);
+
+        // Obtain event base
+        base = obtain_event_base();
+
+        // Synchronously look up hostname
+        evcon = obtain_evhttp_connection_base(base.get(), host, port);
+        evhttp_connection_set_timeout(evcon.get(), GetArg("-rpcclienttimeout", DEFAULT_HTTP_CLIENT_TIMEOUT));
+    }
+
+    /** Posts a JSON-RPC request, or a batch of them, and returns the parsed reply */
+    UniValue Post(const std::string& strRequest)
+    {
+        HTTPReply response;
+        raii_evhttp_request req = obtain_evhttp_request(http_request_done, (void*)&response);
+        if (req == NULL)
+            throw std::runtime_error("create http request failed");
 #if LIBEVENT_VERSION_NUMBER >= 0x02010300
-    evhttp_request_set_error_cb(req.get(), http_error_cb);
+        evhttp_request_set_error_cb(req.get(), http_error_cb);
 #endif
 
-    // Get credentials
-    std::string strRPCUserColonPass;
-    if (mapArgs["-rpcpassword"] == "") {
-        // Try fall back to cookie-based authentication if no password is provided
-        if (!GetAuthCookie(&strRPCUserColonPass)) {
-            throw std::runtime_error(strprintf(
-                _("Could not locate RPC credentials. No authentication cookie could be found,\n"
-                  "and no rpcpassword is set in the configuration file (%s)."),
-                    GetConfigFile().string().c_str()));
+        struct evkeyvalq* output_headers = evhttp_request_get_output_headers(req.get());
+        assert(output_headers);
+        evhttp_add_header(output_headers, "Host", host.c_str());
+        evhttp_add_header(output_headers, "Connection", fKeepAlive ? "keep-alive" : "close");
+        evhttp_add_header(output_headers, "Authorization", strAuthorization.c_str());
+
+        // Attach request data
+        struct evbuffer* output_buffer = evhttp_request_get_output_buffer(req.get());
+        assert(output_buffer);
+        evbuffer_add(output_buffer, strRequest.data(), strRequest.size());
+
+        int r = evhttp_make_request(evcon.get(), req.get(), EVHTTP_REQ_POST, "/");
+        req.release(); // ownership moved to evcon in above call
+        if (r != 0) {
+            throw CConnectionFailed("send http request failed");
+        }
 
+        // An open keep-alive connection keeps the loop busy, so only run it until the reply is in
+        while (!response.done) {
+            if (event_base_loop(base.get(), EVLOOP_ONCE) != 0)
+                break;
         }
-    } else {
-        strRPCUserColonPass = mapArgs["-rpcuser"] + ":" + mapArgs["-rpcpassword"];
-    }
 
-    struct evkeyvalq* output_headers = evhttp_request_get_output_headers(req.get());
-    assert(output_headers);
-    evhttp_add_header(output_headers, "Host", host.c_str());
-    evhttp_add_header(output_headers, "Connection", "close");
-    evhttp_add_header(output_headers, "Authorization", (std::string("Basic ") + EncodeBase64(strRPCUserColonPass)).c_str());
-
-    // Attach request data
-    std::string strRequest = JSONRPCRequest(strMethod, params, 1);
-    struct evbuffer* output_buffer = evhttp_request_get_output_buffer(req.get());
-    assert(output_buffer);
-    evbuffer_add(output_buffer, strRequest.data(), strRequest.size());
-
-    int r = evhttp_make_request(evcon.get(), req.get(), EVHTTP_REQ_POST, "/");
-    req.release(); // ownership moved to evcon in above call
-    if (r != 0) {
-        throw CConnectionFailed("send http request failed");
+        if (response.status == 0)
+            throw CConnectionFailed(strprintf("couldn't connect to server: %s (code %d)\n(make sure server is running and you are connecting to the correct RPC port)", http_errorstring(response.error), response.error));
+        else if (response.status == HTTP_UNAUTHORIZED)
+            throw std::runtime_error("incorrect rpcuser or rpcpassword (authorization failed)");
+        else if (response.status >= 400 && response.status != HTTP_BAD_REQUEST && response.status != HTTP_NOT_FOUND && response.status != HTTP_INTERNAL_SERVER_ERROR)
+            throw std::runtime_error(strprintf("server returned HTTP error %d", response.status));
+        else if (response.body.empty())
+            throw std::runtime_error("no response from server");
+
+        // Parse reply
+        UniValue valReply(UniValue::VSTR);
+        if (!valReply.read(response.body))
+            throw std::runtime_error("couldn't parse reply from server");
+        return valReply;
     }
+};
 
-    event_base_dispatch(base.get());
-
-    if (response.status == 0)
-        throw CConnectionFailed(strprintf("couldn't connect to server: %s (code %d)\n(make sure server is running and you are connecting to the correct RPC port)", http_errorstring(response.error), response.error));
-    else if (response.status == HTTP_UNAUTHORIZED)
-        throw std::runtime_error("incorrect rpcuser or rpcpassword (authorization failed)");
-    else if (response.status >= 400 && response.status != HTTP_BAD_REQUEST && response.status != HTTP_NOT_FOUND && response.status != HTTP_INTERNAL_SERVER_ERROR)
-        throw std::runtime_error(strprintf("server returned HTTP error %d", response.status));
-    else if (response.body.empty())
-        throw std::runtime_error("no response from server");
-
-    // Parse reply
-    UniValue valReply(UniValue::VSTR);
-    if (!valReply.read(response.body))
-        throw std::runtime_error("couldn't parse reply from server");
+UniValue CallRPC(const std::string& strMethod, const UniValue& params)
+{
+    CRPCConnection conn(false);
+    UniValue valReply = conn.Post(JSONRPCRequest(strMethod, params, 1));
     const UniValue& reply = valReply.get_obj();
     if (reply.empty())
         throw std::runtime_error("expected reply to have result, error and id properties");
@@ -284,6 +324,82 @@ UniValue CallRPC(const std::string& strMethod, const UniValue& params)
     return reply;
 }
 
+/** Formats a reply on one line for -batch, returns the exit code of the command */
+static int FormatBatchReply(const UniValue& reply, std::string& strPrint)
+{
+    const UniValue& result = find_value(reply, "result");
+    const UniValue& error  = find_value(reply, "error");
+    if (!error.isNull()) {
+        strPrint = "error: " + error.write();
+        const UniValue& errCode = find_value(error, "code");
+        return errCode.isNum() ? abs(errCode.get_int()) : EXIT_FAILURE;
+    }
+    if (result.isNull())
+        strPrint = "";
+    else if (result.isStr())
+        strPrint = result.get_str();
+    else
+        strPrint = result.write();
+    return 0;
+}
+
+/**
+ * Runs the commands read from stdin over one keep-alive connection. Up to
+ * -batchsize commands go into one JSON-RPC batch, so the server executes them
+ * back to back; the replies are matched to the commands by id.
+ */
+static int BatchRPC()
+{
+    const size_t nBatchSize = std::max((int64_t)1, GetArg("-batchsize", DEFAULT_BATCH_SIZE));
+    CRPCConnection conn(true);
+    int nRet = 0;
+    bool fEOF = false;
+    while (!fEOF) {
+        UniValue batch(UniValue::VARR);
+        std::string line;
+        while (batch.size() < nBatchSize) {
+            if (!std::getline(std::cin, line)) {
+                fEOF = true;
+                break;
+            }
+            std::vector<std::string> args;
+            boost::split(args, line, boost::is_any_of(" \t"), boost::token_compress_on);
+            args.erase(std::remove(args.begin(), args.end(), std::string()), args.end());
+            if (args.empty())
+                continue;
+            UniValue params = RPCConvertValues(args[0], std::vector<std::string>(args.begin()+1, args.end()));
+            UniValue request(UniValue::VOBJ);
+            request.push_back(Pair("method", args[0]));
+            request.push_back(Pair("params", params));
+            request.push_back(Pair("id", (int)batch.size()));
+            batch.push_back(request);
+        }
+        if (batch.empty())
+            break;
+
+        const UniValue valReply = conn.Post(batch.write() + "\n");
+        if (!valReply.isArray())
+            throw std::runtime_error("expected a batch reply from server");
+        std::vector<const UniValue*> vReplies(batch.size(), (const UniValue*)NULL);
+        for (size_t i = 0; i < valReply.size(); i++) {
+            const UniValue& id = find_value(valReply[i], "id");
+            if (id.isNum() && id.get_int() >= 0 && (size_t)id.get_int() < vReplies.size())
+                vReplies[id.get_int()] = &valReply[i];
+        }
+        for (size_t i = 0; i < vReplies.size(); i++) {
+            if (vReplies[i] == NULL)
+                throw std::runtime_error("missing reply in batch reply from server");
+            std::string strPrint;
+            int nCode = FormatBatchReply(*vReplies[i], strPrint);
+            if (nCode != 0)
+                nRet = nCode;
+            fprintf(stdout, "%s\n", strPrint.c_str());
+        }
+        fflush(stdout);
+    }
+    return nRet;
+}
+
 int CommandLineRPC(int argc, char *argv[])
 {
     std::string strPrint;
@@ -294,6 +410,11 @@ int CommandLineRPC(int argc, char *argv[])
             argc--;
             argv++;
         }
+        if (GetBoolArg("-batch", false)) {
+            if (argc > 1)
+                throw std::runtime_error("-batch reads the commands from standard input, not the command line");
+            return BatchRPC();
+        }
         std::vector<std::string> args = std::vector<std::string>(&argv[1], &argv[argc]);
         if (GetBoolArg("-stdin", false)) {
             // Read one arg per line from stdin and append
@@ -0,0 +1,340 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockcompress.h"
+
+#include "crypto/common.h"
+#include "hash.h"
+#include "main.h"
+#include "sync.h"
+#include "util.h"
+#include "utiltime.h"
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <string.h>
+
+#include <boost/filesystem.hpp>
+#include <zlib.h>
+
+int nBlockCompressionLevel = DEFAULT_BLOCK_COMPRESSION;
+
+//! Marker of a compressed record; as a block version it is negative, as an undo vector size above MAX_SIZE
+static const unsigned char COMPRESSED_RECORD_MAGIC[4] = {0xff, 'Z', 'B', 0xfe};
+
+//! Bytes of the windows the dictionary trainer counts
+static const size_t DICTIONARY_WINDOW_SIZE = 8;
+//! Bits of the hash the window counters are indexed by
+static const int DICTIONARY_HASH_BITS = 20;
+//! Longest string taken into a dictionary in one piece
+static const size_t MAX_DICTIONARY_SEGMENT_SIZE = 256;
+//! Most block bytes a dictionary is trained on
+static const size_t MAX_DICTIONARY_SAMPLE_BYTES = 16 * 1024 * 1024;
+
+static CCriticalSection cs_dictionaries;
+//! Dictionaries used so far, by id
+static std::map<uint32_t, std::shared_ptr<const std::vector<unsigned char> > > mapDictionaries;
+//! Id new records are compressed with, 0 for none, and the highest id in the blocks directory
+static uint32_t nCurrentDictionary = 0;
+static uint32_t nLastDictionary = 0;
+//! Chain height the current dictionary was trained at, or last tried to be
+static int nDictionaryHeight = -1;
+
+bool IsCompressedRecord(const char* pData, size_t nSize)
+{
+    return nSize >= COMPRESSED_RECORD_HEADER_SIZE && memcmp(pData, COMPRESSED_RECORD_MAGIC, sizeof(COMPRESSED_RECORD_MAGIC)) == 0;
+}
+
+uint32_t GetRecordDictionaryId(const char* pData)
+{
+    return ReadLE32((const unsigned char*)pData + 4);
+}
+
+bool CompressRecord(const char* pData, size_t nSize, int nLevel, uint32_t nDictId, const std::vector<unsigned char>& vDict, std::vector<char>& vFrame)
+{
+    if (nSize > MAX_SIZE)
+        return false;
+
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    if (deflateInit(&strm, nLevel) != Z_OK)
+        return false;
+    if (!vDict.empty() && deflateSetDictionary(&strm, &vDict[0], vDict.size()) != Z_OK) {
+        deflateEnd(&strm);
+        return false;
+    }
+
+    // The bound lets a single call finish the stream
+    vFrame.resize(COMPRESSED_RECORD_HEADER_SIZE + deflateBound(&strm, nSize));
+    strm.next_in = (Bytef*)pData;
+    strm.avail_in = nSize;
+    strm.next_out = (Bytef*)&vFrame[COMPRESSED_RECORD_HEADER_SIZE];
+    strm.avail_out = vFrame.size() - COMPRESSED_RECORD_HEADER_SIZE;
+    int ret = deflate(&strm, Z_FINISH);
+    size_t nCompressed = strm.total_out;
+    deflateEnd(&strm);
+    if (ret != Z_STREAM_END)
+        return false;
+
+    vFrame.resize(COMPRESSED_RECORD_HEADER_SIZE + nCompressed);
+    unsigned char* p = (unsigned char*)&vFrame[0];
+    memcpy(p, COMPRESSED_RECORD_MAGIC, sizeof(COMPRESSED_RECORD_MAGIC));
+    WriteLE32(p + 4, nDictId);
+    WriteLE32(p + 8, nSize);
+    WriteLE32(p + 12, nCompressed);
+    return true;
+}
+
+size_t DecompressRecord(const char* pData, size_t nSize, const std::vector<unsigned char>& vDict, std::vector<char>& vRaw)
+{
+    if (!IsCompressedRecord(pData, nSize))
+        throw std::ios_base::failure("DecompressRecord: not a compressed record");
+    const unsigned char* p = (const unsigned char*)pData;
+    uint32_t nRawSize = ReadLE32(p + 8);
+    uint32_t nCompressed = ReadLE32(p + 12);
+    if (nRawSize > MAX_SIZE || nCompressed > nSize - COMPRESSED_RECORD_HEADER_SIZE)
+        throw std::ios_base::failure("DecompressRecord: invalid record size");
+
+    vRaw.resize(nRawSize);
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    if (inflateInit(&strm) != Z_OK)
+        throw std::ios_base::failure("DecompressRecord: inflateInit failed");
+    strm.next_in = (Bytef*)(p + COMPRESSED_RECORD_HEADER_SIZE);
+    strm.avail_in = nCompressed;
+    strm.next_out = (Bytef*)begin_ptr(vRaw);
+    strm.avail_out = nRawSize;
+    int ret = inflate(&strm, Z_FINISH);
+    if (ret == Z_NEED_DICT) {
+        // zlib checks the dictionary against the checksum kept in the stream
+        if (vDict.empty() || inflateSetDictionary(&strm, &vDict[0], vDict.size()) != Z_OK)
+            ret = Z_DATA_ERROR;
+        else
+            ret = inflate(&strm, Z_FINISH);
+    }
+    bool fOk = ret == Z_STREAM_END && strm.total_out == nRawSize;
+    inflateEnd(&strm);
+    if (!fOk)
+        throw std::ios_base::failure("DecompressRecord: corrupt compressed record");
+    return COMPRESSED_RECORD_HEADER_SIZE + nCompressed;
+}
+
+static inline uint32_t WindowHash(const unsigned char* p)
+{
+    return (uint32_t)((ReadLE64(p) * 0x9E3779B97F4A7C15ULL) >> (64 - DICTIONARY_HASH_BITS));
+}
+
+bool TrainBlockDictionary(const std::vector<std::vector<char> >& vSamples, std::vector<unsigned char>& vDict)
+{
+    vDict.clear();
+
+    // Count every window of the samples, colliding windows share a counter
+    std::vector<uint32_t> vCount((size_t)1 << DICTIONARY_HASH_BITS, 0);
+    for (const std::vector<char>& sample : vSamples) {
+        const unsigned char* p = (const unsigned char*)begin_ptr(sample);
+        for (size_t i = 0; i + DICTIONARY_WINDOW_SIZE <= sample.size(); i++)
+            vCount[WindowHash(p + i)]++;
+    }
+
+    // Runs of windows that recur in a good part of the samples make the segments.
+    // The counters of a segment are cleared, so each string is taken once.
+    const uint32_t nMinCount = std::max<uint32_t>(2, vSamples.size() / 4);
+    std::vector<std::pair<uint64_t, std::vector<unsigned char> > > vSegments;
+    for (const std::vector<char>& sample : vSamples) {
+        const unsigned char* p = (const unsigned char*)begin_ptr(sample);
+        size_t i = 0;
+        while (i + DICTIONARY_WINDOW_SIZE <= sample.size()) {
+            if (vCount[WindowHash(p + i)] < nMinCount) {
+                i++;
+                continue;
+            }
+            uint64_t nScore = 0;
+            size_t j = i;
+            while (j + DICTIONARY_WINDOW_SIZE <= sample.size() && j - i + DICTIONARY_WINDOW_SIZE < MAX_DICTIONARY_SEGMENT_SIZE) {
+                uint32_t& count = vCount[WindowHash(p + j)];
+                if (count < nMinCount)
+                    break;
+                nScore += count;
+                count = 0;
+                j++;
+            }
+            size_t nEnd = j - 1 + DICTIONARY_WINDOW_SIZE;
+            vSegments.push_back(std::make_pair(nScore, std::vector<unsigned char>(p + i, p + nEnd)));
+            i = nEnd;
+        }
+    }
+    if (vSegments.empty())
+        return false;
+
+    // Keep the best segments, zlib finds the ones at the end of the dictionary cheapest
+    std::sort(vSegments.begin(), vSegments.end(), [](const std::pair<uint64_t, std::vector<unsigned char> >& a, const std::pair<uint64_t, std::vector<unsigned char> >& b) {
+        return a.first > b.first;
+    });
+    size_t nTaken = 0, nBytes = 0;
+    while (nTaken < vSegments.size() && nBytes + vSegments[nTaken].second.size() <= MAX_BLOCK_DICTIONARY_SIZE)
+        nBytes += vSegments[nTaken++].second.size();
+    vDict.reserve(nBytes);
+    for (size_t k = nTaken; k-- > 0; )
+        vDict.insert(vDict.end(), vSegments[k].second.begin(), vSegments[k].second.end());
+    return !vDict.empty();
+}
+
+static boost::filesystem::path GetDictionaryPath(uint32_t nId)
+{
+    return GetDataDir() / "blocks" / strprintf("dict%05u.dat", nId);
+}
+
+static bool ReadDictionaryFile(uint32_t nId, int& nHeight, std::vector<unsigned char>& vDict)
+{
+    CAutoFile filein(fopen(GetDictionaryPath(nId).string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return false;
+    uint256 hashChecksum;
+    try {
+        filein >> nHeight >> vDict >> hashChecksum;
+    } catch (const std::exception& e) {
+        return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+    }
+    if (hashChecksum != Hash(vDict.begin(), vDict.end()))
+        return error("%s: checksum mismatch of dictionary %u", __func__, nId);
+    return true;
+}
+
+static bool WriteDictionaryFile(uint32_t nId, int nHeight, const std::vector<unsigned char>& vDict)
+{
+    boost::filesystem::path path = GetDictionaryPath(nId);
+    boost::filesystem::path pathTmp = path;
+    pathTmp += ".tmp";
+    CAutoFile fileout(fopen(pathTmp.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+    if (fileout.IsNull())
+        return error("%s: failed to open %s", __func__, pathTmp.string());
+    try {
+        fileout << nHeight << vDict << Hash(vDict.begin(), vDict.end());
+    } catch (const std::exception& e) {
+        return error("%s: I/O error - %s", __func__, e.what());
+    }
+    // The dictionary has to be on disk before any record that uses it
+    FileCommit(fileout.Get());
+    fileout.fclose();
+    if (!RenameOver(pathTmp, path))
+        return error("%s: failed to rename %s", __func__, pathTmp.string());
+    return true;
+}
+
+//! Dictionary nId, loaded from its file when first used
+static std::shared_ptr<const std::vector<unsigned char> > GetDictionary(uint32_t nId)
+{
+    LOCK(cs_dictionaries);
+    std::map<uint32_t, std::shared_ptr<const std::vector<unsigned char> > >::const_iterator it = mapDictionaries.find(nId);
+    if (it != mapDictionaries.end())
+        return it->second;
+    int nHeight;
+    std::shared_ptr<std::vector<unsigned char> > pdict = std::make_shared<std::vector<unsigned char> >();
+    if (!ReadDictionaryFile(nId, nHeight, *pdict))
+        return std::shared_ptr<const std::vector<unsigned char> >();
+    mapDictionaries[nId] = pdict;
+    return pdict;
+}
+
+void InitBlockDictionaries()
+{
+    LOCK(cs_dictionaries);
+    nCurrentDictionary = 0;
+    nDictionaryHeight = -1;
+    uint32_t nId = 1;
+    while (boost::filesystem::exists(GetDictionaryPath(nId)))
+        nId++;
+    nLastDictionary = nId - 1;
+    if (nLastDictionary == 0)
+        return;
+
+    std::shared_ptr<std::vector<unsigned char> > pdict = std::make_shared<std::vector<unsigned char> >();
+    if (ReadDictionaryFile(nLastDictionary, nDictionaryHeight, *pdict)) {
+        mapDictionaries[nLastDictionary] = pdict;
+        nCurrentDictionary = nLastDictionary;
+        LogPrintf("%s: compressing with dictionary %u of %u bytes, trained at height %d\n", __func__, nCurrentDictionary, pdict->size(), nDictionaryHeight);
+    }
+}
+
+void UpdateBlockDictionary()
+{
+    AssertLockHeld(cs_main);
+    if (nBlockCompressionLevel <= 0)
+        return;
+
+    int nHeight = chainActive.Height();
+    uint32_t nId;
+    {
+        LOCK(cs_dictionaries);
+        if (nHeight < BLOCK_DICTIONARY_SAMPLE_BLOCKS || (nDictionaryHeight >= 0 && nHeight - nDictionaryHeight < BLOCK_DICTIONARY_RETRAIN_INTERVAL))
+            return;
+        // A failed training waits as long as a successful one
+        nDictionaryHeight = nHeight;
+        nId = nLastDictionary + 1;
+    }
+
+    int64_t nStart = GetTimeMillis();
+    std::vector<std::vector<char> > vSamples;
+    size_t nSampleBytes = 0;
+    const CBlockIndex* pindex = chainActive.Tip();
+    for (int i = 0; i < BLOCK_DICTIONARY_SAMPLE_BLOCKS && pindex != NULL && nSampleBytes < MAX_DICTIONARY_SAMPLE_BYTES; i++, pindex = pindex->pprev) {
+        CBlock block;
+        if (!(pindex->nStatus & BLOCK_HAVE_DATA) || !ReadBlockFromDisk(block, pindex, false))
+            continue;
+        CDataStream ss(SER_DISK, CLIENT_VERSION);
+        ss << block;
+        vSamples.push_back(std::vector<char>(ss.begin(), ss.end()));
+        nSampleBytes += ss.size();
+    }
+
+    std::shared_ptr<std::vector<unsigned char> > pdict = std::make_shared<std::vector<unsigned char> >();
+    if (!TrainBlockDictionary(vSamples, *pdict)) {
+        LogPrintf("%s: no strings recur in the last %u blocks, not training a dictionary\n", __func__, vSamples.size());
+        return;
+    }
+    if (!WriteDictionaryFile(nId, nHeight, *pdict))
+        return;
+
+    LOCK(cs_dictionaries);
+    mapDictionaries[nId] = pdict;
+    nCurrentDictionary = nLastDictionary = nId;
+    LogPrintf("%s: trained dictionary %u of %u bytes on %u blocks of %u bytes in %dms\n", __func__,
+        nId, pdict->size(), vSamples.size(), nSampleBytes, GetTimeMillis() - nStart);
+}
+
+bool CompressRecordForDisk(std::vector<char>& vRecord)
+{
+    int nLevel = nBlockCompressionLevel;
+    if (nLevel <= 0 || vRecord.empty())
+        return false;
+
+    uint32_t nId;
+    std::shared_ptr<const std::vector<unsigned char> > pdict;
+    {
+        LOCK(cs_dictionaries);
+        nId = nCurrentDictionary;
+        if (nId != 0)
+            pdict = mapDictionaries[nId];
+    }
+    static const std::vector<unsigned char> vNoDict;
+    std::vector<char> vFrame;
+    if (!CompressRecord(begin_ptr(vRecord), vRecord.size(), nLevel, nId, pdict ? *pdict : vNoDict, vFrame) || vFrame.size() >= vRecord.size())
+        return false;
+    vRecord.swap(vFrame);
+    return true;
+}
+
+size_t DecompressRecordFromDisk(const char* pData, size_t nSize, std::vector<char>& vRaw)
+{
+    if (!IsCompressedRecord(pData, nSize))
+        throw std::ios_base::failure("DecompressRecordFromDisk: not a compressed record");
+    uint32_t nId = GetRecordDictionaryId(pData);
+    if (nId == 0)
+        return DecompressRecord(pData, nSize, std::vector<unsigned char>(), vRaw);
+    std::shared_ptr<const std::vector<unsigned char> > pdict = GetDictionary(nId);
+    if (!pdict)
+        throw std::ios_base::failure(strprintf("DecompressRecordFromDisk: dictionary %u is missing", nId));
+    return DecompressRecord(pData, nSize, *pdict, vRaw);
+}
@@ -0,0 +1,94 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKCOMPRESS_H
+#define BITCOIN_BLOCKCOMPRESS_H
+
+#include "clientversion.h"
+#include "serialize.h"
+#include "streams.h"
+
+#include <ios>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+//! Default for -blockcompression, 0 stores blocks and undo data uncompressed
+static const int DEFAULT_BLOCK_COMPRESSION = 0;
+//! Bytes of the frame header in front of the zlib stream of a compressed record
+static const size_t COMPRESSED_RECORD_HEADER_SIZE = 16;
+//! Largest preset dictionary zlib makes use of
+static const size_t MAX_BLOCK_DICTIONARY_SIZE = 32 * 1024;
+//! Recent blocks a dictionary is trained on
+static const int BLOCK_DICTIONARY_SAMPLE_BLOCKS = 256;
+//! Blocks after which a dictionary is trained again
+static const int BLOCK_DICTIONARY_RETRAIN_INTERVAL = 20000;
+
+/**
+ * With -blockcompression=<level> new blocks and undo data are written to the
+ * blk and rev files deflated with zlib, each record on its own so one can
+ * still be read at its position. A compressed record is a frame of a marker,
+ * the id of the preset dictionary, the raw and the compressed size, then the
+ * zlib stream. The marker can't start an uncompressed record, where it would
+ * be a negative block version or an impossible undo vector size, so both
+ * kinds are read from the same files and the option can be changed at any
+ * time. A record that does not get smaller is written uncompressed.
+ *
+ * The dictionary is trained on the recent blocks of the active chain, from
+ * the strings that recur between them, such as script templates and the
+ * fixed parts of transactions, and trained again as the chain grows. Ids are
+ * never reused; each dictionary is kept as blocks/dictNNNNN.dat for as long
+ * as the records that use it.
+ */
+extern int nBlockCompressionLevel;
+
+//! Whether the nSize bytes at pData start with a compressed record
+bool IsCompressedRecord(const char* pData, size_t nSize);
+//! Frame of the nSize bytes at pData deflated at nLevel, with the preset dictionary vDict unless it is empty
+bool CompressRecord(const char* pData, size_t nSize, int nLevel, uint32_t nDictId, const std::vector<unsigned char>& vDict, std::vector<char>& vFrame);
+//! Inflates the frame at pData into vRaw, returns the size of the frame; throws if it is corrupt
+size_t DecompressRecord(const char* pData, size_t nSize, const std::vector<unsigned char>& vDict, std::vector<char>& vRaw);
+//! Dictionary id of the frame at pData, which has to be a compressed record
+uint32_t GetRecordDictionaryId(const char* pData);
+
+//! Dictionary of the strings common to the samples, most frequent last; false if none recur
+bool TrainBlockDictionary(const std::vector<std::vector<char> >& vSamples, std::vector<unsigned char>& vDict);
+
+//! Finds the dictionaries in the blocks directory, the last one is used for new records
+void InitBlockDictionaries();
+//! Trains a new dictionary when the chain grew enough since the current one was. Requires cs_main.
+void UpdateBlockDictionary();
+
+//! Replaces vRecord with its compressed frame, when -blockcompression is set and it gets smaller
+bool CompressRecordForDisk(std::vector<char>& vRecord);
+//! Inflates the frame at pData with the dictionary it names, returns the size of the frame; throws on failure
+size_t DecompressRecordFromDisk(const char* pData, size_t nSize, std::vector<char>& vRaw);
+
+/** Serialization of obj as it is stored in a blk or rev file */
+template <typename T>
+void SerializeRecord(const T& obj, std::vector<char>& vRecord)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << obj;
+    vRecord.assign(ss.begin(), ss.end());
+    CompressRecordForDisk(vRecord);
+}
+
+/** Unserializes obj from the record at pData, compressed or not, returns the bytes of the record read */
+template <typename T>
+size_t UnserializeRecord(const char* pData, size_t nSize, T& obj)
+{
+    if (IsCompressedRecord(pData, nSize)) {
+        std::vector<char> vRaw;
+        size_t nFrame = DecompressRecordFromDisk(pData, nSize, vRaw);
+        CSpanReader reader(SER_DISK, CLIENT_VERSION, begin_ptr(vRaw), vRaw.size());
+        reader >> obj;
+        return nFrame;
+    }
+    CSpanReader reader(SER_DISK, CLIENT_VERSION, pData, nSize);
+    reader >> obj;
+    return nSize - reader.size();
+}
+
+#endif // BITCOIN_BLOCKCOMPRESS_H
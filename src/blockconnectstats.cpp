@@ -0,0 +1,89 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockconnectstats.h"
+
+#include "chain.h"
+#include "sync.h"
+#include "util.h"
+#include "util/trace.h"
+
+#include <deque>
+
+bool fBlockProfile = DEFAULT_BLOCKPROFILE;
+
+static CCriticalSection cs_blockconnectstats;
+static CBlockConnectStats currentStats;
+static CBlockConnectStats totalStats;
+static std::deque<CBlockConnectStats> dequeStats;
+
+static const char* stageNames[CONNECT_STAGE_COUNT] = {
+    "read", "proofs", "inputs", "cceval", "scripts", "index", "komodo",
+    "flush", "chainstate", "mempool", "updatetip", "wallet", "chaintip"
+};
+
+CBlockConnectStats::CBlockConnectStats() : nHeight(-1), nTx(0), nBlocks(0), nTotalMicros(0)
+{
+    for (int i = 0; i < CONNECT_STAGE_COUNT; i++)
+        nStageMicros[i] = 0;
+}
+
+const char* GetBlockConnectStageName(int stage)
+{
+    return stage >= 0 && stage < CONNECT_STAGE_COUNT ? stageNames[stage] : "unknown";
+}
+
+void StartBlockConnectStats()
+{
+    LOCK(cs_blockconnectstats);
+    currentStats = CBlockConnectStats();
+}
+
+void AddBlockConnectTime(BlockConnectStage stage, int64_t nMicros)
+{
+    TRACE2(validation, connect_stage, stageNames[stage], nMicros);
+    LOCK(cs_blockconnectstats);
+    currentStats.nStageMicros[stage] += nMicros;
+}
+
+void FinishBlockConnectStats(const CBlockIndex* pindex, unsigned int nTx, int64_t nTotalMicros)
+{
+    TRACE4(validation, block_connected, pindex->phashBlock->begin(), pindex->GetHeight(), nTx, nTotalMicros);
+    std::string strProfile;
+    {
+        LOCK(cs_blockconnectstats);
+        currentStats.nHeight = pindex->GetHeight();
+        currentStats.hash = pindex->GetBlockHash();
+        currentStats.nTx = nTx;
+        currentStats.nBlocks = 1;
+        currentStats.nTotalMicros = nTotalMicros;
+
+        totalStats.nBlocks++;
+        totalStats.nTx += nTx;
+        totalStats.nTotalMicros += nTotalMicros;
+        for (int i = 0; i < CONNECT_STAGE_COUNT; i++)
+            totalStats.nStageMicros[i] += currentStats.nStageMicros[i];
+
+        dequeStats.push_back(currentStats);
+        if (dequeStats.size() > BLOCK_CONNECT_STATS_HISTORY)
+            dequeStats.pop_front();
+
+        if (fBlockProfile) {
+            for (int i = 0; i < CONNECT_STAGE_COUNT; i++)
+                strProfile += strprintf(" %s=%.2fms", stageNames[i], currentStats.nStageMicros[i] * 0.001);
+        }
+    }
+    if (fBlockProfile)
+        LogPrintf("blockprofile: height=%d txs=%u total=%.2fms%s\n", pindex->GetHeight(), nTx, nTotalMicros * 0.001, strProfile);
+}
+
+std::vector<CBlockConnectStats> GetBlockConnectStats(size_t nMax, CBlockConnectStats& totals)
+{
+    LOCK(cs_blockconnectstats);
+    totals = totalStats;
+    std::vector<CBlockConnectStats> vStats;
+    for (std::deque<CBlockConnectStats>::const_reverse_iterator it = dequeStats.rbegin(); it != dequeStats.rend() && vStats.size() < nMax; ++it)
+        vStats.push_back(*it);
+    return vStats;
+}
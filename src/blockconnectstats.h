@@ -0,0 +1,71 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKCONNECTSTATS_H
+#define BITCOIN_BLOCKCONNECTSTATS_H
+
+#include "uint256.h"
+
+#include <stdint.h>
+#include <vector>
+
+class CBlockIndex;
+
+//! Default for -blockprofile
+static const bool DEFAULT_BLOCKPROFILE = false;
+//! Blocks whose stage times getblockconnectstats keeps
+static const size_t BLOCK_CONNECT_STATS_HISTORY = 1000;
+
+/** Stages of connecting a block to the tip, in the order ConnectTip goes through them */
+enum BlockConnectStage
+{
+    CONNECT_STAGE_READ,         //!< Reading the block from disk
+    CONNECT_STAGE_PROOFS,       //!< CheckBlock and ContextualCheckBlock, with the JoinSplit and Sapling proofs
+    CONNECT_STAGE_INPUTS,       //!< Inputs, coins and commitment trees of the transactions
+    CONNECT_STAGE_CCEVAL,       //!< CC evals of the inputs
+    CONNECT_STAGE_SCRIPTS,      //!< Waiting for the script check threads
+    CONNECT_STAGE_INDEX,        //!< Undo data, notarisations and index writes
+    CONNECT_STAGE_KOMODO,       //!< komodo_connectblock notary state, miners and assets order book
+    CONNECT_STAGE_FLUSH,        //!< Flushing the block's view to the coins tip
+    CONNECT_STAGE_CHAINSTATE,   //!< FlushStateToDisk
+    CONNECT_STAGE_MEMPOOL,      //!< Removing the block's and expired transactions from the mempool
+    CONNECT_STAGE_UPDATETIP,    //!< UpdateTip
+    CONNECT_STAGE_WALLET,       //!< SyncTransaction of the confirmed and conflicted transactions
+    CONNECT_STAGE_CHAINTIP,     //!< ChainTip callbacks, that update the wallet witnesses
+    CONNECT_STAGE_COUNT
+};
+
+/** Microseconds a block, or all blocks for the totals, spent in each stage */
+struct CBlockConnectStats
+{
+    int nHeight;
+    uint256 hash;
+    unsigned int nTx;
+    //! Blocks these are the sum of, 1 except for the totals
+    uint64_t nBlocks;
+    int64_t nTotalMicros;
+    int64_t nStageMicros[CONNECT_STAGE_COUNT];
+
+    CBlockConnectStats();
+};
+
+/**
+ * Time ConnectTip spends in each stage of connecting a block, kept for the
+ * last BLOCK_CONNECT_STATS_HISTORY blocks and summed over all blocks since
+ * startup, with -blockprofile also logged for each block. The stages of
+ * ConnectBlock add to the block ConnectTip started, so calls from
+ * TestBlockValidity or VerifyDB are dropped at the next StartBlockConnectStats.
+ */
+extern bool fBlockProfile;
+
+const char* GetBlockConnectStageName(int stage);
+
+void StartBlockConnectStats();
+void AddBlockConnectTime(BlockConnectStage stage, int64_t nMicros);
+void FinishBlockConnectStats(const CBlockIndex* pindex, unsigned int nTx, int64_t nTotalMicros);
+
+//! Stats of the last nMax blocks, the most recent first, and the totals
+std::vector<CBlockConnectStats> GetBlockConnectStats(size_t nMax, CBlockConnectStats& totals);
+
+#endif // BITCOIN_BLOCKCONNECTSTATS_H
@@ -0,0 +1,123 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilemap.h"
+
+#include "crypto/common.h"
+#include "main.h"
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+//! Bytes of message start and size in front of each record
+static const size_t RECORD_HEADER_SIZE = 8;
+
+CMappedFile::~CMappedFile()
+{
+#ifndef WIN32
+    munmap(const_cast<char*>(pData), nSize);
+#endif
+}
+
+std::shared_ptr<const CMappedFile> MapFileReadOnly(const std::string& path)
+{
+#ifdef WIN32
+    return nullptr;
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return nullptr;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return nullptr;
+    }
+    void* p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+        return nullptr;
+    return std::make_shared<const CMappedFile>(static_cast<const char*>(p), (size_t)st.st_size);
+#endif
+}
+
+std::shared_ptr<const CMappedFile> CBlockFileMapper::Map(const char* prefix, int nFile)
+{
+    return MapFileReadOnly(GetBlockPosFilename(CDiskBlockPos(nFile, 0), prefix).string());
+}
+
+bool CBlockFileMapper::Read(const CDiskBlockPos& pos, const char* prefix, size_t nTrailer, CMappedSpan& span)
+{
+#ifdef WIN32
+    return false;
+#else
+    if (pos.nPos < RECORD_HEADER_SIZE)
+        return false;
+
+    LOCK(cs);
+    std::list<Entry>::iterator it = entries.begin();
+    while (it != entries.end() && (it->nFile != pos.nFile || it->prefix != prefix))
+        ++it;
+
+    // A second try maps the file again, as it may have grown since it was mapped
+    for (int nTry = 0; nTry < 2; nTry++) {
+        if (it == entries.end()) {
+            Entry entry;
+            entry.prefix = prefix;
+            entry.nFile = pos.nFile;
+            entry.file = Map(prefix, pos.nFile);
+            entry.nLastEnd = 0;
+            if (!entry.file)
+                return false;
+            entries.push_front(entry);
+            if (entries.size() > MAX_MAPPED_BLOCK_FILES)
+                entries.pop_back();
+        } else if (it != entries.begin()) {
+            entries.splice(entries.begin(), entries, it);
+        }
+        it = entries.begin();
+
+        const CMappedFile& file = *it->file;
+        if (pos.nPos <= file.size()) {
+            uint64_t nEnd = (uint64_t)pos.nPos + ReadLE32((const unsigned char*)file.data() + pos.nPos - 4) + nTrailer;
+            if (nEnd <= file.size()) {
+                // Records of a file read in order are close after each other
+                if (pos.nPos >= it->nLastEnd && pos.nPos - it->nLastEnd <= MAPPED_BLOCK_FILE_READAHEAD) {
+                    size_t nPageSize = sysconf(_SC_PAGESIZE);
+                    size_t nAheadBegin = nEnd / nPageSize * nPageSize;
+                    size_t nAheadEnd = std::min<uint64_t>(nEnd + MAPPED_BLOCK_FILE_READAHEAD, file.size());
+                    if (nAheadBegin < nAheadEnd)
+                        madvise(const_cast<char*>(file.data()) + nAheadBegin, nAheadEnd - nAheadBegin, MADV_WILLNEED);
+                }
+                it->nLastEnd = nEnd;
+
+                span.file = it->file;
+                span.data = file.data() + pos.nPos;
+                span.size = nEnd - pos.nPos;
+                return true;
+            }
+        }
+        if (nTry == 0) {
+            entries.erase(it);
+            it = entries.end();
+        }
+    }
+    return false;
+#endif
+}
+
+void CBlockFileMapper::Invalidate(int nFile)
+{
+    LOCK(cs);
+    for (std::list<Entry>::iterator it = entries.begin(); it != entries.end(); ) {
+        if (it->nFile == nFile)
+            it = entries.erase(it);
+        else
+            ++it;
+    }
+}
@@ -0,0 +1,92 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKFILEMAP_H
+#define BITCOIN_BLOCKFILEMAP_H
+
+#include "sync.h"
+
+#include <list>
+#include <memory>
+#include <stddef.h>
+#include <string>
+
+struct CDiskBlockPos;
+
+//! Most block and undo files kept mapped
+static const size_t MAX_MAPPED_BLOCK_FILES = sizeof(void*) > 4 ? 16 : 2;
+//! Bytes after a record that are prefetched while a file is read front to back
+static const size_t MAPPED_BLOCK_FILE_READAHEAD = 4 * 1024 * 1024;
+
+/** Read-only mapping of a whole file, unmapped when the last user lets go of it. */
+class CMappedFile
+{
+private:
+    const char* pData;
+    size_t nSize;
+
+    CMappedFile(const CMappedFile&);
+    CMappedFile& operator=(const CMappedFile&);
+
+public:
+    CMappedFile(const char* pDataIn, size_t nSizeIn) : pData(pDataIn), nSize(nSizeIn) {}
+    ~CMappedFile();
+
+    const char* data() const { return pData; }
+    size_t size() const { return nSize; }
+};
+
+/** Maps the file at path read-only, returns null if it is empty or cannot be mapped (always on Windows). */
+std::shared_ptr<const CMappedFile> MapFileReadOnly(const std::string& path);
+
+/** Bytes of a record in a mapped file, valid while the span is kept. */
+struct CMappedSpan
+{
+    std::shared_ptr<const CMappedFile> file;
+    const char* data;
+    size_t size;
+
+    CMappedSpan() : data(NULL), size(0) {}
+};
+
+/**
+ * Serves block and undo records from read-only memory mappings of the blk and
+ * rev files, so reading one needs no file open and seek and no copy into a
+ * buffer before it is deserialized. The mappings of the most recently read
+ * files are kept. While a file is read front to back, as by rescans, the data
+ * after each record is prefetched.
+ *
+ * Files that are deleted, rewritten or truncated have to be invalidated. On
+ * systems without mmap nothing is mapped and callers read the file instead.
+ */
+class CBlockFileMapper
+{
+private:
+    struct Entry {
+        std::string prefix;
+        int nFile;
+        std::shared_ptr<const CMappedFile> file;
+        //! End of the last record read, to detect sequential reads
+        size_t nLastEnd;
+    };
+
+    CCriticalSection cs;
+    //! Most recently used first
+    std::list<Entry> entries;
+
+    static std::shared_ptr<const CMappedFile> Map(const char* prefix, int nFile);
+
+public:
+    /**
+     * Finds the record at pos, which like blocks and undo data is preceded by
+     * the message start and its size, and followed by nTrailer more bytes.
+     * Returns false if the file cannot be mapped or does not hold the record.
+     */
+    bool Read(const CDiskBlockPos& pos, const char* prefix, size_t nTrailer, CMappedSpan& span);
+
+    //! Drops the mappings of blk and rev file nFile
+    void Invalidate(int nFile);
+};
+
+#endif // BITCOIN_BLOCKFILEMAP_H
@@ -19,6 +19,7 @@
 
 #include "bloom.h"
 
+#include "crypto/common.h"
 #include "primitives/transaction.h"
 #include "hash.h"
 #include "script/script.h"
@@ -36,6 +37,102 @@
 
 using namespace std;
 
+namespace {
+
+inline uint32_t BloomRotl32(uint32_t x, int8_t r)
+{
+    return (x << r) | (x >> (32 - r));
+}
+
+//! The mixing of a block of MurmurHash3 (x86_32), as in MurmurHash3() of hash.cpp
+inline uint32_t BloomMixBlock(uint32_t k1)
+{
+    k1 *= 0xcc9e2d51;
+    k1 = BloomRotl32(k1, 15);
+    k1 *= 0x1b873593;
+    return k1;
+}
+
+void ReadPushes(const CScript& script, vector<CBloomElement>& vPushes)
+{
+    CScript::const_iterator pc = script.begin();
+    vector<unsigned char> data;
+    while (pc < script.end())
+    {
+        opcodetype opcode;
+        if (!script.GetOp(pc, opcode, data))
+            break;
+        if (data.size() != 0)
+            vPushes.push_back(CBloomElement(data.data(), data.data() + data.size()));
+    }
+}
+
+}
+
+CBloomElement::CBloomElement(const unsigned char* pbegin, const unsigned char* pend) : nTail(0), nSize(pend - pbegin)
+{
+    vBlocks.reserve(nSize / 4);
+    const unsigned char* p = pbegin;
+    for (; pend - p >= 4; p += 4)
+        vBlocks.push_back(BloomMixBlock(ReadLE32(p)));
+    if (p < pend)
+    {
+        uint32_t k1 = 0;
+        for (unsigned int i = 0; p + i < pend; i++)
+            k1 ^= (uint32_t)p[i] << (8 * i);
+        nTail = BloomMixBlock(k1);
+    }
+}
+
+void CBloomElement::Hash(uint32_t* pHashes, unsigned int nHashes) const
+{
+    // The same rounds for each seed, in loops over the seeds the compiler can vectorize
+    for (size_t i = 0; i < vBlocks.size(); i++)
+    {
+        const uint32_t k1 = vBlocks[i];
+        for (unsigned int j = 0; j < nHashes; j++)
+        {
+            uint32_t h1 = pHashes[j] ^ k1;
+            h1 = BloomRotl32(h1, 13);
+            pHashes[j] = h1 * 5 + 0xe6546b64;
+        }
+    }
+    if (nSize & 3)
+        for (unsigned int j = 0; j < nHashes; j++)
+            pHashes[j] ^= nTail;
+    for (unsigned int j = 0; j < nHashes; j++)
+    {
+        uint32_t h1 = pHashes[j] ^ nSize;
+        h1 ^= h1 >> 16;
+        h1 *= 0x85ebca6b;
+        h1 ^= h1 >> 13;
+        h1 *= 0xc2b2ae35;
+        h1 ^= h1 >> 16;
+        pHashes[j] = h1;
+    }
+}
+
+CBloomTransactionElements::CBloomTransactionElements(const CTransaction& tx)
+{
+    const uint256& txid = tx.GetHash();
+    hash = CBloomElement(txid.begin(), txid.end());
+
+    vOutputPushes.resize(tx.vout.size());
+    for (unsigned int i = 0; i < tx.vout.size(); i++)
+        ReadPushes(tx.vout[i].scriptPubKey, vOutputPushes[i]);
+
+    vPrevouts.reserve(tx.vin.size());
+    vInputPushes.resize(tx.vin.size());
+    for (unsigned int i = 0; i < tx.vin.size(); i++)
+    {
+        CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+        stream << tx.vin[i].prevout;
+        const unsigned char* pbegin = (const unsigned char*)&stream[0];
+        vPrevouts.push_back(CBloomElement(pbegin, pbegin + stream.size()));
+        ReadPushes(tx.vin[i].scriptSig, vInputPushes[i]);
+    }
+}
+
 CBloomFilter::CBloomFilter(unsigned int nElements, double nFPRate, unsigned int nTweakIn, unsigned char nFlagsIn) :
     /**
      * The ideal size for a bloom filter with a given number of elements and false positive rate is:
@@ -56,17 +153,6 @@ CBloomFilter::CBloomFilter(unsigned int nElements, double nFPRate, unsigned int
 {
 }
 
-// Private constructor used by CRollingBloomFilter
-CBloomFilter::CBloomFilter(unsigned int nElements, double nFPRate, unsigned int nTweakIn) :
-    vData((unsigned int)(-1  / LN2SQUARED * nElements * log(nFPRate)) / 8),
-    isFull(false),
-    isEmpty(true),
-    nHashFuncs((unsigned int)(vData.size() * 8 / nElements * LN2)),
-    nTweak(nTweakIn),
-    nFlags(BLOOM_UPDATE_NONE)
-{
-}
-
 inline unsigned int CBloomFilter::Hash(unsigned int nHashNum, const std::vector<unsigned char>& vDataToHash) const
 {
     // 0xFBA4C795 chosen as it guarantees a reasonable bit difference between nHashNum values.
@@ -130,6 +216,31 @@ bool CBloomFilter::contains(const uint256& hash) const
     return contains(data);
 }
 
+bool CBloomFilter::contains(const CBloomElement& element) const
+{
+    if (isFull)
+        return true;
+    if (isEmpty)
+        return false;
+    const unsigned int nBits = vData.size() * 8;
+    uint32_t vHashes[BLOOM_HASH_LANES];
+    for (unsigned int i = 0; i < nHashFuncs; i += BLOOM_HASH_LANES)
+    {
+        // Same seeds as Hash()
+        const unsigned int nHashes = min(BLOOM_HASH_LANES, nHashFuncs - i);
+        for (unsigned int j = 0; j < nHashes; j++)
+            vHashes[j] = (i + j) * 0xFBA4C795 + nTweak;
+        element.Hash(vHashes, nHashes);
+        for (unsigned int j = 0; j < nHashes; j++)
+        {
+            unsigned int nIndex = vHashes[j] % nBits;
+            if (!(vData[nIndex >> 3] & (1 << (7 & nIndex))))
+                return false;
+        }
+    }
+    return true;
+}
+
 void CBloomFilter::clear()
 {
     vData.assign(vData.size(),0);
@@ -149,6 +260,15 @@ bool CBloomFilter::IsWithinSizeConstraints() const
 }
 
 bool CBloomFilter::IsRelevantAndUpdate(const CTransaction& tx)
+{
+    if (isFull)
+        return true;
+    if (isEmpty)
+        return false;
+    return IsRelevantAndUpdate(tx, CBloomTransactionElements(tx));
+}
+
+bool CBloomFilter::IsRelevantAndUpdate(const CTransaction& tx, const CBloomTransactionElements& elements)
 {
     bool fFound = false;
     // Match if the filter contains the hash of tx
@@ -158,7 +278,7 @@ bool CBloomFilter::IsRelevantAndUpdate(const CTransaction& tx)
     if (isEmpty)
         return false;
     const uint256& hash = tx.GetHash();
-    if (contains(hash))
+    if (contains(elements.hash))
         fFound = true;
 
     for (unsigned int i = 0; i < tx.vout.size(); i++)
@@ -168,14 +288,9 @@ bool CBloomFilter::IsRelevantAndUpdate(const CTransaction& tx)
         // If this matches, also add the specific output that was matched.
         // This means clients don't have to update the filter themselves when a new relevant tx 
         // is discovered in order to find spending transactions, which avoids round-tripping and race conditions.
-        CScript::const_iterator pc = txout.scriptPubKey.begin();
-        vector<unsigned char> data;
-        while (pc < txout.scriptPubKey.end())
+        BOOST_FOREACH(const CBloomElement& push, elements.vOutputPushes[i])
         {
-            opcodetype opcode;
-            if (!txout.scriptPubKey.GetOp(pc, opcode, data))
-                break;
-            if (data.size() != 0 && contains(data))
+            if (contains(push))
             {
                 fFound = true;
                 if ((nFlags & BLOOM_UPDATE_MASK) == BLOOM_UPDATE_ALL)
@@ -196,23 +311,16 @@ bool CBloomFilter::IsRelevantAndUpdate(const CTransaction& tx)
     if (fFound)
         return true;
 
-    BOOST_FOREACH(const CTxIn& txin, tx.vin)
+    for (unsigned int i = 0; i < tx.vin.size(); i++)
     {
         // Match if the filter contains an outpoint tx spends
-        if (contains(txin.prevout))
+        if (contains(elements.vPrevouts[i]))
             return true;
 
         // Match if the filter contains any arbitrary script data element in any scriptSig in tx
-        CScript::const_iterator pc = txin.scriptSig.begin();
-        vector<unsigned char> data;
-        while (pc < txin.scriptSig.end())
-        {
-            opcodetype opcode;
-            if (!txin.scriptSig.GetOp(pc, opcode, data))
-                break;
-            if (data.size() != 0 && contains(data))
+        BOOST_FOREACH(const CBloomElement& push, elements.vInputPushes[i])
+            if (contains(push))
                 return true;
-        }
     }
 
     return false;
@@ -231,57 +339,154 @@ void CBloomFilter::UpdateEmptyFull()
     isEmpty = empty;
 }
 
-CRollingBloomFilter::CRollingBloomFilter(unsigned int nElements, double fpRate) :
-    b1(nElements * 2, fpRate, 0), b2(nElements * 2, fpRate, 0)
+CRollingBloomFilter::CRollingBloomFilter(unsigned int nElements, double fpRate)
 {
-    // Implemented using two bloom filters of 2 * nElements each.
-    // We fill them up, and clear them, staggered, every nElements
-    // inserted, so at least one always contains the last nElements
-    // inserted.
-    nInsertions = 0;
-    nBloomSize = nElements * 2;
-
+    nHashFuncs = std::max(1, std::min((int)round(log(fpRate) / log(0.5)), (int)MAX_HASH_FUNCS));
+    nEntriesPerGeneration = std::max(1u, (nElements + 1) / 2);
+    // The rate of a filter of nBits holding the 3 generations at most:
+    // fpRate = pow(1 - exp(-nHashFuncs * nMaxElements / nBits), nHashFuncs)
+    double nMaxElements = nEntriesPerGeneration * 3.0;
+    uint64_t nBits = (uint64_t)ceil(-1.0 * nHashFuncs * nMaxElements / log(1.0 - exp(log(fpRate) / nHashFuncs)));
+    // Two words for each 64 positions, one for each bit of the generation
+    vData.assign(((nBits + 63) / 64) * 2, 0);
     reset();
 }
 
-void CRollingBloomFilter::insert(const std::vector<unsigned char>& vKey)
+void CRollingBloomFilter::Insert(uint64_t nHash)
 {
-    if (nInsertions == 0) {
-        b1.clear();
-    } else if (nInsertions == nBloomSize / 2) {
-        b2.clear();
+    if (nEntriesThisGeneration == nEntriesPerGeneration) {
+        nEntriesThisGeneration = 0;
+        if (++nGeneration == 4)
+            nGeneration = 1;
+        // Wipe the positions last set by the generation now reused
+        uint64_t nMask1 = 0 - (uint64_t)(nGeneration & 1);
+        uint64_t nMask2 = 0 - (uint64_t)(nGeneration >> 1);
+        for (size_t p = 0; p < vData.size(); p += 2) {
+            uint64_t p1 = vData[p], p2 = vData[p + 1];
+            uint64_t mask = (p1 ^ nMask1) | (p2 ^ nMask2);
+            vData[p] = p1 & mask;
+            vData[p + 1] = p2 & mask;
+        }
     }
-    b1.insert(vKey);
-    b2.insert(vKey);
-    if (++nInsertions == nBloomSize) {
-        nInsertions = 0;
+    nEntriesThisGeneration++;
+
+    const uint64_t nPositions = vData.size() * 32;
+    const uint64_t nHash1 = nHash & 0xffffffff;
+    const uint64_t nHash2 = (nHash >> 32) | 1;
+    const uint64_t nBit1 = (uint64_t)(nGeneration & 1), nBit2 = (uint64_t)(nGeneration >> 1);
+    for (unsigned int i = 0; i < nHashFuncs; i++) {
+        uint64_t nIndex = (nHash1 + i * nHash2) % nPositions;
+        size_t nWord = (nIndex >> 6) * 2;
+        unsigned int nBit = nIndex & 63;
+        vData[nWord] = (vData[nWord] & ~((uint64_t)1 << nBit)) | (nBit1 << nBit);
+        vData[nWord + 1] = (vData[nWord + 1] & ~((uint64_t)1 << nBit)) | (nBit2 << nBit);
     }
 }
 
+bool CRollingBloomFilter::Contains(uint64_t nHash) const
+{
+    const uint64_t nPositions = vData.size() * 32;
+    const uint64_t nHash1 = nHash & 0xffffffff;
+    const uint64_t nHash2 = (nHash >> 32) | 1;
+    for (unsigned int i = 0; i < nHashFuncs; i++) {
+        uint64_t nIndex = (nHash1 + i * nHash2) % nPositions;
+        size_t nWord = (nIndex >> 6) * 2;
+        if (!(((vData[nWord] | vData[nWord + 1]) >> (nIndex & 63)) & 1))
+            return false;
+    }
+    return true;
+}
+
+void CRollingBloomFilter::insert(const std::vector<unsigned char>& vKey)
+{
+    Insert(CSipHasher(k0, k1).Write(vKey.data(), vKey.size()).Finalize());
+}
+
 void CRollingBloomFilter::insert(const uint256& hash)
 {
-    vector<unsigned char> data(hash.begin(), hash.end());
-    insert(data);
+    Insert(SipHashUint256(k0, k1, hash));
 }
 
 bool CRollingBloomFilter::contains(const std::vector<unsigned char>& vKey) const
 {
-    if (nInsertions < nBloomSize / 2) {
-        return b2.contains(vKey);
-    }
-    return b1.contains(vKey);
+    return Contains(CSipHasher(k0, k1).Write(vKey.data(), vKey.size()).Finalize());
 }
 
 bool CRollingBloomFilter::contains(const uint256& hash) const
 {
-    vector<unsigned char> data(hash.begin(), hash.end());
-    return contains(data);
+    return Contains(SipHashUint256(k0, k1, hash));
 }
 
 void CRollingBloomFilter::reset()
 {
-    unsigned int nNewTweak = GetRand(std::numeric_limits<unsigned int>::max());
-    b1.reset(nNewTweak);
-    b2.reset(nNewTweak);
-    nInsertions = 0;
+    k0 = GetRand(std::numeric_limits<uint64_t>::max());
+    k1 = GetRand(std::numeric_limits<uint64_t>::max());
+    nEntriesThisGeneration = 0;
+    nGeneration = 1;
+    std::fill(vData.begin(), vData.end(), 0);
+}
+
+CScalableBloomFilter::Layer::Layer(size_t nCapacityIn, double nFPRate) :
+    nCapacity(std::max<size_t>(nCapacityIn, 1)),
+    nInsertions(0)
+{
+    // Same sizing as CBloomFilter, rounded up to whole words
+    nBits = std::max<uint64_t>((uint64_t)(-1 / LN2SQUARED * nCapacity * log(nFPRate)), 64);
+    nBits = (nBits + 63) & ~(uint64_t)63;
+    vData.assign(nBits / 64, 0);
+    nHashFuncs = std::max(1u, std::min((unsigned int)(nBits / nCapacity * LN2), MAX_HASH_FUNCS));
+}
+
+CScalableBloomFilter::CScalableBloomFilter(size_t nInitialCapacity, double nFPRate) :
+    salt(GetRandHash()),
+    nNextFPRate(nFPRate / 4),
+    nInsertions(0)
+{
+    vLayers.push_back(Layer(nInitialCapacity, nFPRate / 2));
+}
+
+void CScalableBloomFilter::insert(const uint256& key)
+{
+    if (vLayers.back().nInsertions >= vLayers.back().nCapacity) {
+        vLayers.push_back(Layer(vLayers.back().nCapacity * 2, nNextFPRate));
+        nNextFPRate /= 2;
+    }
+
+    Layer& layer = vLayers.back();
+    uint64_t nHash = key.GetHash(salt);
+    uint64_t nHash1 = nHash & 0xffffffff;
+    uint64_t nHash2 = (nHash >> 32) | 1;
+    for (unsigned int i = 0; i < layer.nHashFuncs; i++) {
+        uint64_t nIndex = (nHash1 + i * nHash2) % layer.nBits;
+        layer.vData[nIndex >> 6] |= (uint64_t)1 << (nIndex & 63);
+    }
+    layer.nInsertions++;
+    nInsertions++;
+}
+
+bool CScalableBloomFilter::contains(const uint256& key) const
+{
+    uint64_t nHash = key.GetHash(salt);
+    uint64_t nHash1 = nHash & 0xffffffff;
+    uint64_t nHash2 = (nHash >> 32) | 1;
+    for (const Layer& layer : vLayers) {
+        unsigned int i = 0;
+        for (; i < layer.nHashFuncs; i++) {
+            uint64_t nIndex = (nHash1 + i * nHash2) % layer.nBits;
+            if (!(layer.vData[nIndex >> 6] & ((uint64_t)1 << (nIndex & 63))))
+                break;
+        }
+        if (i == layer.nHashFuncs)
+            return true;
+    }
+    return false;
+}
+
+size_t CScalableBloomFilter::GetMemorySize() const
+{
+    size_t nSize = 0;
+    for (const Layer& layer : vLayers) {
+        nSize += layer.vData.size() * sizeof(uint64_t);
+    }
+    return nSize;
 }
@@ -21,12 +21,12 @@
 #define BITCOIN_BLOOM_H
 
 #include "serialize.h"
+#include "uint256.h"
 
 #include <vector>
 
 class COutPoint;
 class CTransaction;
-class uint256;
 
 //! 20,000 items with fp rate < 0.1% or 10,000 items and <0.0001%
 static const unsigned int MAX_BLOOM_FILTER_SIZE = 36000; // bytes
@@ -45,6 +45,50 @@ enum bloomflags
     BLOOM_UPDATE_MASK = 3,
 };
 
+//! Hash functions of a filter MurmurHash3 is run for side by side, as many as 32 bit lanes of a 256 bit vector
+static const unsigned int BLOOM_HASH_LANES = 8;
+
+/**
+ * A data element a bloom filter is matched against, with the MurmurHash3
+ * blocks of its bytes already mixed. The mixing of the blocks doesn't depend
+ * on the seed, so it is done once for each element of a block however many
+ * filters it is matched against, and what is left for each filter are the
+ * rounds over the mixed blocks, run for its hash functions side by side.
+ */
+class CBloomElement
+{
+public:
+    CBloomElement() : nTail(0), nSize(0) {}
+    CBloomElement(const unsigned char* pbegin, const unsigned char* pend);
+
+    //! Turns the seeds into the MurmurHash3 of the element with them
+    void Hash(uint32_t* pHashes, unsigned int nHashes) const;
+
+private:
+    std::vector<uint32_t> vBlocks;
+    uint32_t nTail;
+    uint32_t nSize;
+};
+
+/**
+ * The elements of a transaction IsRelevantAndUpdate matches a filter on: its
+ * hash, the data pushes of the script of each output, and the outpoint and the
+ * data pushes of the script of each input.
+ */
+class CBloomTransactionElements
+{
+public:
+    explicit CBloomTransactionElements(const CTransaction& tx);
+
+    CBloomElement hash;
+    std::vector<std::vector<CBloomElement> > vOutputPushes;
+    std::vector<CBloomElement> vPrevouts;
+    std::vector<std::vector<CBloomElement> > vInputPushes;
+};
+
+//! The elements of the transactions of a block, in the order of the block
+typedef std::vector<CBloomTransactionElements> CBloomBlockElements;
+
 /**
  * BloomFilter is a probabilistic filter which SPV clients provide
  * so that we can filter the transactions we send them.
@@ -68,10 +112,6 @@ private:
 
     unsigned int Hash(unsigned int nHashNum, const std::vector<unsigned char>& vDataToHash) const;
 
-    // Private constructor for CRollingBloomFilter, no restrictions on size
-    CBloomFilter(unsigned int nElements, double nFPRate, unsigned int nTweak);
-    friend class CRollingBloomFilter;
-
 public:
     /**
      * Creates a new bloom filter which will provide the given fp rate when filled with the given number of elements
@@ -102,6 +142,7 @@ public:
     bool contains(const std::vector<unsigned char>& vKey) const;
     bool contains(const COutPoint& outpoint) const;
     bool contains(const uint256& hash) const;
+    bool contains(const CBloomElement& element) const;
 
     void clear();
     void reset(unsigned int nNewTweak);
@@ -112,6 +153,8 @@ public:
 
     //! Also adds any outputs which match the filter to the filter (to match their spending txes)
     bool IsRelevantAndUpdate(const CTransaction& tx);
+    //! Same as above, with the elements of tx already read out of it
+    bool IsRelevantAndUpdate(const CTransaction& tx, const CBloomTransactionElements& elements);
 
     //! Checks for empty and full filters to avoid wasting cpu
     void UpdateEmptyFull();
@@ -120,13 +163,21 @@ public:
 /**
  * RollingBloomFilter is a probabilistic "keep track of most recently inserted" set.
  * Construct it with the number of items to keep track of, and a false-positive
- * rate. Unlike CBloomFilter, by default nTweak is set to a cryptographically
+ * rate. Unlike CBloomFilter, the hash is salted with a cryptographically
  * secure random value for you. Similarly rather than clear() the method
- * reset() is provided, which also changes nTweak to decrease the impact of
+ * reset() is provided, which also changes the salt to decrease the impact of
  * false-positives.
  *
  * contains(item) will always return true if item was one of the last N things
  * insert()'ed ... but may also return true for items that were not inserted.
+ *
+ * Each position of the single filter holds the generation, 1 to 3, of the
+ * last item that set it, or 0, as a bit in each of two adjacent words. Every
+ * N / 2 insertions the next generation starts and the positions of the one
+ * before the last are wiped, so the filter holds between N and 3 N / 2 items.
+ * The positions of an item come from one SipHash of it, so an insertion or a
+ * lookup is one hash and a few words whatever the false-positive rate, and
+ * the wipe is one pass over the words every N / 2 insertions.
  */
 class CRollingBloomFilter
 {
@@ -143,11 +194,59 @@ public:
 
     void reset();
 
+    size_t GetMemorySize() const { return vData.size() * sizeof(uint64_t); }
+
 private:
-    unsigned int nBloomSize;
-    unsigned int nInsertions;
-    CBloomFilter b1, b2;
+    unsigned int nEntriesPerGeneration;
+    unsigned int nEntriesThisGeneration;
+    int nGeneration;
+    unsigned int nHashFuncs;
+    std::vector<uint64_t> vData;
+    uint64_t k0, k1;
+
+    void Insert(uint64_t nHash);
+    bool Contains(uint64_t nHash) const;
 };
 
 
+/**
+ * Local bloom filter over uint256 keys that grows with the number of keys,
+ * without the size limits of the relayed CBloomFilter. Used to rule out
+ * database lookups for keys that were never written, such as fresh
+ * nullifiers.
+ *
+ * Once the newest layer holds as many keys as it was sized for, a layer of
+ * twice the capacity and half the false-positive rate is added, so the
+ * overall rate stays below nFPRate however many keys are inserted.
+ * Bit positions are derived from a salted SipHash of the key, so the rate
+ * cannot be raised with chosen keys. Keys cannot be removed.
+ */
+class CScalableBloomFilter
+{
+public:
+    CScalableBloomFilter(size_t nInitialCapacity, double nFPRate);
+
+    void insert(const uint256& key);
+    bool contains(const uint256& key) const;
+
+    size_t size() const { return nInsertions; }
+    size_t GetMemorySize() const;
+
+private:
+    struct Layer {
+        std::vector<uint64_t> vData;
+        uint64_t nBits;
+        unsigned int nHashFuncs;
+        size_t nCapacity;
+        size_t nInsertions;
+
+        Layer(size_t nCapacityIn, double nFPRate);
+    };
+
+    std::vector<Layer> vLayers;
+    uint256 salt;
+    double nNextFPRate;
+    size_t nInsertions;
+};
+
 #endif // BITCOIN_BLOOM_H
@@ -25,6 +25,8 @@
 
 #include "CCinclude.h"
 
+#include <set>
+
 // CCcustom
 bool AssetsValidate(struct CCcontract_info *cp,Eval* eval,const CTransaction &tx, uint32_t nIn);
 
@@ -43,6 +45,32 @@ int64_t AssetValidateBuyvin(struct CCcontract_info *cp,Eval* eval,int64_t &tmppr
 int64_t AssetValidateSellvin(struct CCcontract_info *cp,Eval* eval,int64_t &tmpprice,std::vector<uint8_t> &tmporigpubkey,char *CCaddr,char *origaddr,const CTransaction &tx,uint256 assetid);
 bool AssetCalcAmounts(struct CCcontract_info *cpAssets, int64_t &inputs, int64_t &outputs, Eval* eval, const CTransaction &tx, uint256 assetid);
 
+// CCassetsbook
+/// An open bid or ask of the assets DEX as the order book keeps it
+struct CAssetOrder
+{
+    uint256 txid;
+    int32_t vout;
+    uint8_t funcid;
+    bool fBid;                      //!< coins on the assets unspendable address, else tokens on its tokens address
+    uint8_t evalcode2;              //!< additional evalcode of the tokens address of an ask
+    uint256 tokenid;
+    uint256 assetid2;
+    int64_t price;                  //!< total still required, as in the opret
+    std::vector<uint8_t> origpubkey;
+    int64_t nValue;                 //!< amount of the order output
+    int64_t nFirstValue;            //!< amount of vout 0 of the order tx
+    bool fMempool;
+
+    CAssetOrder() : vout(0), funcid(0), fBid(false), evalcode2(0), price(0), nValue(0), nFirstValue(0), fMempool(false) {}
+};
+
+void AssetsOrderBookConnect(const CBlock& block);
+void AssetsOrderBookDisconnect(const CBlock& block);
+void AssetsOrderBookAddMempool(const CTransaction& tx);
+/// open orders of ptokenid, of all tokens if NULL, best price first; asks only from the tokens addresses with the evalcodes in setAskEvalcodes2
+void GetAssetsOrders(const uint256* ptokenid, bool fBids, const std::set<uint8_t>& setAskEvalcodes2, std::vector<CAssetOrder>& vOrders);
+
 // CCassetstx
 //int64_t GetAssetBalance(CPubKey pk,uint256 tokenid); // --> GetTokenBalance()
 int64_t AddAssetInputs(struct CCcontract_info *cp, CMutableTransaction &mtx, CPubKey pk, uint256 assetid, int64_t total, int32_t maxinputs);
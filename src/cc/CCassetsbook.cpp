@@ -0,0 +1,319 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "CCassets.h"
+
+#include "arith_uint256.h"
+#include "main.h"
+#include "txmempool.h"
+
+#include <map>
+
+/*
+ The order book keeps the open bids and asks of every token in memory, sorted by the price of one token unit,
+ so tokenorders and mytokenorders no longer read every unspent output of the assets unspendable addresses and
+ fetch and decode the transaction of each.
+
+ It is loaded from the address index the first time it is asked for, the tokens address of an additional
+ evalcode when one is first asked for. From then on the connected and disconnected blocks and the transactions
+ accepted to the mempool keep it current. Orders of mempool transactions are dropped once the transaction is
+ neither in the mempool nor mined, and orders spent by a mempool transaction are left out of the results
+ until the spend either confirms or leaves the mempool.
+
+ Everything here requires cs_main.
+ */
+
+/// price of one token unit as a fraction, coins for bids and asks, units of the other token for swaps
+struct CAssetUnitPrice
+{
+    int64_t num;
+    int64_t den;
+
+    bool operator<(const CAssetUnitPrice& other) const
+    {
+        return arith_uint256(num) * arith_uint256(other.den) < arith_uint256(other.num) * arith_uint256(den);
+    }
+};
+
+struct CAssetTokenBook
+{
+    std::multimap<CAssetUnitPrice, COutPoint> bids;
+    std::multimap<CAssetUnitPrice, COutPoint> asks;
+};
+
+static std::map<COutPoint, CAssetOrder> mapAssetOrders;
+static std::map<uint256, CAssetTokenBook> mapAssetBooks;
+//! bids and the asks without an additional evalcode
+static bool fAssetBookLoaded = false;
+//! additional evalcodes whose tokens address is in the book
+static std::set<uint8_t> setAssetBookEvalcodes2;
+//! additional evalcode of the tokens address of each token's asks, 0 for fungible tokens
+static std::map<uint256, uint8_t> mapTokenEvalcode2;
+
+static CAssetUnitPrice GetAssetUnitPrice(const CAssetOrder& order)
+{
+    CAssetUnitPrice unitPrice;
+    if (order.fBid) {
+        unitPrice.num = order.nValue;
+        unitPrice.den = order.price;
+    } else {
+        unitPrice.num = order.price;
+        unitPrice.den = order.nValue;
+    }
+    if (unitPrice.num < 0 || unitPrice.den <= 0) {
+        unitPrice.num = 0;
+        unitPrice.den = 1;
+    }
+    return unitPrice;
+}
+
+static uint8_t GetTokenEvalcode2(const uint256& tokenid)
+{
+    std::map<uint256, uint8_t>::const_iterator it = mapTokenEvalcode2.find(tokenid);
+    if (it != mapTokenEvalcode2.end())
+        return it->second;
+    vscript_t vopretNonfungible;
+    GetNonfungibleData(tokenid, vopretNonfungible);
+    uint8_t evalcode2 = vopretNonfungible.empty() ? 0 : vopretNonfungible.begin()[0];
+    mapTokenEvalcode2[tokenid] = evalcode2;
+    return evalcode2;
+}
+
+static std::string GetAssetsAskAddress(uint8_t evalcode2)
+{
+    static std::map<uint8_t, std::string> mapAddresses;
+    std::map<uint8_t, std::string>::const_iterator it = mapAddresses.find(evalcode2);
+    if (it != mapAddresses.end())
+        return it->second;
+    struct CCcontract_info *cpAssets, assetsC;
+    char askaddr[64];
+    cpAssets = CCinit(&assetsC, EVAL_ASSETS);
+    cpAssets->additionalTokensEvalcode2 = evalcode2;
+    GetTokensCCaddress(cpAssets, askaddr, GetUnspendable(cpAssets, NULL));
+    return mapAddresses[evalcode2] = askaddr;
+}
+
+static std::string GetAssetsBidAddress()
+{
+    static std::string strAddress;
+    if (strAddress.empty()) {
+        struct CCcontract_info *cpAssets, assetsC;
+        char bidaddr[64];
+        cpAssets = CCinit(&assetsC, EVAL_ASSETS);
+        GetCCaddress(cpAssets, bidaddr, GetUnspendable(cpAssets, NULL));
+        strAddress = bidaddr;
+    }
+    return strAddress;
+}
+
+static void EraseAssetOrder(const COutPoint& outpoint)
+{
+    std::map<COutPoint, CAssetOrder>::iterator it = mapAssetOrders.find(outpoint);
+    if (it == mapAssetOrders.end())
+        return;
+    CAssetTokenBook& book = mapAssetBooks[it->second.tokenid];
+    std::multimap<CAssetUnitPrice, COutPoint>& side = it->second.fBid ? book.bids : book.asks;
+    std::pair<std::multimap<CAssetUnitPrice, COutPoint>::iterator, std::multimap<CAssetUnitPrice, COutPoint>::iterator> range = side.equal_range(GetAssetUnitPrice(it->second));
+    for (std::multimap<CAssetUnitPrice, COutPoint>::iterator itSide = range.first; itSide != range.second; itSide++) {
+        if (itSide->second == outpoint) {
+            side.erase(itSide);
+            break;
+        }
+    }
+    if (book.bids.empty() && book.asks.empty())
+        mapAssetBooks.erase(it->second.tokenid);
+    mapAssetOrders.erase(it);
+}
+
+static void AddAssetOrder(const CAssetOrder& order)
+{
+    const COutPoint outpoint(order.txid, order.vout);
+    std::map<COutPoint, CAssetOrder>::iterator it = mapAssetOrders.find(outpoint);
+    if (it != mapAssetOrders.end()) {
+        // a mempool order that got mined
+        it->second.fMempool = order.fMempool;
+        return;
+    }
+    mapAssetOrders[outpoint] = order;
+    CAssetTokenBook& book = mapAssetBooks[order.tokenid];
+    (order.fBid ? book.bids : book.asks).insert(std::make_pair(GetAssetUnitPrice(order), outpoint));
+}
+
+/// adds the order on tx.vout[v], when it is an output to the assets unspendable address or to a tokens address in the book
+static void AddAssetOrderOutput(const CTransaction& tx, int32_t v, bool fMempool)
+{
+    CAssetOrder order;
+    uint8_t evalCode;
+    if (v < 0 || v >= (int32_t)tx.vout.size() - 1 || tx.vout[v].nValue == 0 || !tx.vout[v].scriptPubKey.IsPayToCryptoCondition())
+        return;
+    if ((order.funcid = DecodeAssetTokenOpRet(tx.vout.back().scriptPubKey, evalCode, order.tokenid, order.assetid2, order.price, order.origpubkey)) == 0)
+        return;
+
+    char destaddr[64];
+    if (Getscriptaddress(destaddr, tx.vout[v].scriptPubKey) == 0)
+        return;
+    if (GetAssetsBidAddress() == destaddr) {
+        order.fBid = true;
+    } else {
+        std::set<uint8_t> setEvalcodes2(setAssetBookEvalcodes2);
+        setEvalcodes2.insert(0);
+        if (order.tokenid != zeroid)
+            setEvalcodes2.insert(GetTokenEvalcode2(order.tokenid));
+        std::set<uint8_t>::const_iterator it;
+        for (it = setEvalcodes2.begin(); it != setEvalcodes2.end(); it++)
+            if (GetAssetsAskAddress(*it) == destaddr)
+                break;
+        if (it == setEvalcodes2.end())
+            return;
+        order.evalcode2 = *it;
+    }
+    order.txid = tx.GetHash();
+    order.vout = v;
+    order.nValue = tx.vout[v].nValue;
+    order.nFirstValue = tx.vout[0].nValue;
+    order.fMempool = fMempool;
+    AddAssetOrder(order);
+}
+
+static void AddAssetOrderOutputs(const CTransaction& tx, bool fMempool)
+{
+    // orders carry their assets data in a tokens opreturn
+    vscript_t vopret;
+    if (tx.vout.size() < 2 || !GetOpReturnData(tx.vout.back().scriptPubKey, vopret) || vopret.size() < 2 || vopret[0] != EVAL_TOKENS)
+        return;
+    for (int32_t v = 0; v < (int32_t)tx.vout.size() - 1; v++)
+        if (tx.vout[v].scriptPubKey.IsPayToCryptoCondition())
+            AddAssetOrderOutput(tx, v, fMempool);
+}
+
+static void LoadAssetOrders(const char* coinaddr)
+{
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > unspentOutputs;
+    SetCCunspents(unspentOutputs, (char*)coinaddr, true);
+    for (std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator it = unspentOutputs.begin(); it != unspentOutputs.end(); it++) {
+        CTransaction ordertx;
+        uint256 hashBlock;
+        if (myGetTransaction(it->first.txhash, ordertx, hashBlock) != 0)
+            AddAssetOrderOutput(ordertx, it->first.index, false);
+    }
+}
+
+static void LoadAssetsOrderBook(const std::set<uint8_t>& setEvalcodes2)
+{
+    bool fLoaded = false;
+    if (!fAssetBookLoaded) {
+        fAssetBookLoaded = true;
+        setAssetBookEvalcodes2.insert(0);
+        LoadAssetOrders(GetAssetsBidAddress().c_str());
+        LoadAssetOrders(GetAssetsAskAddress(0).c_str());
+        fLoaded = true;
+    }
+    for (std::set<uint8_t>::const_iterator it = setEvalcodes2.begin(); it != setEvalcodes2.end(); it++) {
+        if (setAssetBookEvalcodes2.insert(*it).second) {
+            LoadAssetOrders(GetAssetsAskAddress(*it).c_str());
+            fLoaded = true;
+        }
+    }
+    if (!fLoaded)
+        return;
+
+    // the mempool transactions accepted before
+    std::vector<uint256> vtxid;
+    mempool.queryHashes(vtxid);
+    for (std::vector<uint256>::const_iterator it = vtxid.begin(); it != vtxid.end(); it++) {
+        CTransaction tx;
+        if (mempool.lookup(*it, tx))
+            AddAssetOrderOutputs(tx, true);
+    }
+    LogPrint("ccassets", "%s: %u open orders in the assets order book\n", __func__, mapAssetOrders.size());
+}
+
+void AssetsOrderBookConnect(const CBlock& block)
+{
+    AssertLockHeld(cs_main);
+    if (!fAssetBookLoaded)
+        return;
+    for (const CTransaction& tx : block.vtx) {
+        for (const CTxIn& txin : tx.vin)
+            EraseAssetOrder(txin.prevout);
+        AddAssetOrderOutputs(tx, false);
+    }
+}
+
+void AssetsOrderBookDisconnect(const CBlock& block)
+{
+    AssertLockHeld(cs_main);
+    if (!fAssetBookLoaded)
+        return;
+    // the transactions of the block go back to the mempool, which adds their orders again
+    std::set<uint256> setBlockTxids;
+    for (const CTransaction& tx : block.vtx) {
+        setBlockTxids.insert(tx.GetHash());
+        for (int32_t v = 0; v < (int32_t)tx.vout.size(); v++)
+            EraseAssetOrder(COutPoint(tx.GetHash(), v));
+    }
+    // the orders the block filled or cancelled are open again
+    for (const CTransaction& tx : block.vtx) {
+        if (tx.IsCoinBase())
+            continue;
+        for (const CTxIn& txin : tx.vin) {
+            CTransaction prevtx;
+            uint256 hashBlock;
+            const CCoins* coins = pcoinsTip->AccessCoins(txin.prevout.hash);
+            if (coins == NULL || !coins->IsAvailable(txin.prevout.n) || !coins->vout[txin.prevout.n].scriptPubKey.IsPayToCryptoCondition())
+                continue;
+            if (setBlockTxids.count(txin.prevout.hash) == 0 && myGetTransaction(txin.prevout.hash, prevtx, hashBlock) != 0)
+                AddAssetOrderOutput(prevtx, txin.prevout.n, false);
+        }
+    }
+}
+
+void AssetsOrderBookAddMempool(const CTransaction& tx)
+{
+    AssertLockHeld(cs_main);
+    if (fAssetBookLoaded)
+        AddAssetOrderOutputs(tx, true);
+}
+
+void GetAssetsOrders(const uint256* ptokenid, bool fBids, const std::set<uint8_t>& setAskEvalcodes2, std::vector<CAssetOrder>& vOrders)
+{
+    AssertLockHeld(cs_main);
+    LoadAssetsOrderBook(setAskEvalcodes2);
+
+    std::vector<COutPoint> vGone;
+    auto addOrder = [&](const COutPoint& outpoint) {
+        const CAssetOrder& order = mapAssetOrders[outpoint];
+        if (order.fMempool && !mempool.exists(order.txid)) {
+            vGone.push_back(outpoint);
+            return;
+        }
+        if (!order.fBid && setAskEvalcodes2.count(order.evalcode2) == 0)
+            return;
+        {
+            LOCK(mempool.cs);
+            if (mempool.mapNextTx.count(outpoint) != 0)
+                return;
+        }
+        vOrders.push_back(order);
+    };
+    auto addBook = [&](const CAssetTokenBook& book) {
+        // the highest bid and the lowest ask first
+        if (fBids)
+            for (std::multimap<CAssetUnitPrice, COutPoint>::const_reverse_iterator it = book.bids.rbegin(); it != book.bids.rend(); it++)
+                addOrder(it->second);
+        for (std::multimap<CAssetUnitPrice, COutPoint>::const_iterator it = book.asks.begin(); it != book.asks.end(); it++)
+            addOrder(it->second);
+    };
+
+    if (ptokenid != NULL) {
+        std::map<uint256, CAssetTokenBook>::const_iterator it = mapAssetBooks.find(*ptokenid);
+        if (it != mapAssetBooks.end())
+            addBook(it->second);
+    } else {
+        for (std::map<uint256, CAssetTokenBook>::const_iterator it = mapAssetBooks.begin(); it != mapAssetBooks.end(); it++)
+            addBook(it->second);
+    }
+    for (const COutPoint& outpoint : vGone)
+        EraseAssetOrder(outpoint);
+}
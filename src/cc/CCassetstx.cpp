@@ -27,130 +27,83 @@ UniValue AssetOrders(uint256 refassetid, CPubKey pk, uint8_t additionalEvalCode)
     cpAssets = CCinit(&assetsC, EVAL_ASSETS);
     cpTokens = CCinit(&tokensC, EVAL_TOKENS);
 
-	auto addOrders = [&](struct CCcontract_info *cp, std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator it)
+	auto addOrder = [&](const CAssetOrder &order)
 	{
-		uint256 txid, hashBlock, assetid, assetid2;
-		int64_t price;
-		std::vector<uint8_t> origpubkey;
-		CTransaction ordertx;
-		uint8_t funcid, evalCode;
 		char numstr[32], funcidstr[16], origaddr[64], origtokenaddr[64];
+        uint8_t funcid = order.funcid;
 
-        txid = it->first.txhash;
-        LOGSTREAM("ccassets", CCLOG_DEBUG2, stream << "addOrders() checking txid=" << txid.GetHex() << std::endl);
-        if ( myGetTransaction(txid, ordertx, hashBlock) != 0 )
+        if (pk != CPubKey() && (pk != pubkey2pk(order.origpubkey) || (funcid != 'S' && funcid != 's')))  // mytokenorders, returns only asks (is this correct?)
+            return;
+
+        UniValue item(UniValue::VOBJ);
+
+        funcidstr[0] = funcid;
+        funcidstr[1] = 0;
+        item.push_back(Pair("funcid", funcidstr));
+        item.push_back(Pair("txid", order.txid.GetHex()));
+        item.push_back(Pair("vout", (int64_t)order.vout));
+        if (funcid == 'b' || funcid == 'B')
         {
-			// for logging: funcid = DecodeAssetOpRet(vintx.vout[vintx.vout.size() - 1].scriptPubKey, evalCode, assetid, assetid2, price, origpubkey);
-            if (ordertx.vout.size() > 0 && (funcid = DecodeAssetTokenOpRet(ordertx.vout[ordertx.vout.size()-1].scriptPubKey, evalCode, assetid, assetid2, price, origpubkey)) != 0)
+            sprintf(numstr, "%.8f", (double)order.nValue / COIN);
+            item.push_back(Pair("amount", numstr));
+            sprintf(numstr, "%.8f", (double)order.nFirstValue / COIN);
+            item.push_back(Pair("bidamount", numstr));
+        }
+        else
+        {
+            sprintf(numstr, "%llu", (long long)order.nValue);
+            item.push_back(Pair("amount", numstr));
+            sprintf(numstr, "%llu", (long long)order.nFirstValue);
+            item.push_back(Pair("askamount", numstr));
+        }
+        if (order.origpubkey.size() == CPubKey::COMPRESSED_PUBLIC_KEY_SIZE)
+        {
+            GetCCaddress(cpAssets, origaddr, pubkey2pk(order.origpubkey));  
+            item.push_back(Pair("origaddress", origaddr));
+            GetTokensCCaddress(cpTokens, origtokenaddr, pubkey2pk(order.origpubkey));
+            item.push_back(Pair("origtokenaddress", origtokenaddr));
+        }
+        if (order.tokenid != zeroid)
+            item.push_back(Pair("tokenid", order.tokenid.GetHex()));
+        if (order.assetid2 != zeroid)
+            item.push_back(Pair("otherid", order.assetid2.GetHex()));
+        if (order.price > 0)
+        {
+            if (funcid == 's' || funcid == 'S' || funcid == 'e' || funcid == 'e')
             {
-                LOGSTREAM("ccassets", CCLOG_DEBUG2, stream << "addOrders() checking ordertx.vout.size()=" << ordertx.vout.size() << " funcid=" << (char)(funcid ? funcid : ' ') << " assetid=" << assetid.GetHex() << std::endl);
-
-                if (pk == CPubKey() && (refassetid == zeroid || assetid == refassetid)  // tokenorders
-                    || pk != CPubKey() && pk == pubkey2pk(origpubkey) && (funcid == 'S' || funcid == 's'))  // mytokenorders, returns only asks (is this correct?)
-                {
-
-                    LOGSTREAM("ccassets", CCLOG_DEBUG2, stream << "addOrders() it->first.index=" << it->first.index << " ordertx.vout[it->first.index].nValue=" << ordertx.vout[it->first.index].nValue << std::endl);
-                    if (ordertx.vout[it->first.index].nValue == 0) {
-                        LOGSTREAM("ccassets", CCLOG_DEBUG2, stream << "addOrders() order with value=0 skipped" << std::endl);
-                        return;
-                    }
-
-                    UniValue item(UniValue::VOBJ);
-
-                    funcidstr[0] = funcid;
-                    funcidstr[1] = 0;
-                    item.push_back(Pair("funcid", funcidstr));
-                    item.push_back(Pair("txid", txid.GetHex()));
-                    item.push_back(Pair("vout", (int64_t)it->first.index));
-                    if (funcid == 'b' || funcid == 'B')
-                    {
-                        sprintf(numstr, "%.8f", (double)ordertx.vout[it->first.index].nValue / COIN);
-                        item.push_back(Pair("amount", numstr));
-                        sprintf(numstr, "%.8f", (double)ordertx.vout[0].nValue / COIN);
-                        item.push_back(Pair("bidamount", numstr));
-                    }
-                    else
-                    {
-                        sprintf(numstr, "%llu", (long long)ordertx.vout[it->first.index].nValue);
-                        item.push_back(Pair("amount", numstr));
-                        sprintf(numstr, "%llu", (long long)ordertx.vout[0].nValue);
-                        item.push_back(Pair("askamount", numstr));
-                    }
-                    if (origpubkey.size() == CPubKey::COMPRESSED_PUBLIC_KEY_SIZE)
-                    {
-                        GetCCaddress(cp, origaddr, pubkey2pk(origpubkey));  
-                        item.push_back(Pair("origaddress", origaddr));
-                        GetTokensCCaddress(cpTokens, origtokenaddr, pubkey2pk(origpubkey));
-                        item.push_back(Pair("origtokenaddress", origtokenaddr));
-                    }
-                    if (assetid != zeroid)
-                        item.push_back(Pair("tokenid", assetid.GetHex()));
-                    if (assetid2 != zeroid)
-                        item.push_back(Pair("otherid", assetid2.GetHex()));
-                    if (price > 0)
-                    {
-                        if (funcid == 's' || funcid == 'S' || funcid == 'e' || funcid == 'e')
-                        {
-                            sprintf(numstr, "%.8f", (double)price / COIN);
-                            item.push_back(Pair("totalrequired", numstr));
-                            sprintf(numstr, "%.8f", (double)price / (COIN * ordertx.vout[0].nValue));
-                            item.push_back(Pair("price", numstr));
-                        }
-                        else
-                        {
-                            item.push_back(Pair("totalrequired", (int64_t)price));
-                            sprintf(numstr, "%.8f", (double)ordertx.vout[0].nValue / (price * COIN));
-                            item.push_back(Pair("price", numstr));
-                        }
-                    }
-                    result.push_back(item);
-                    LOGSTREAM("ccassets", CCLOG_DEBUG1, stream << "addOrders() added order funcId=" << (char)(funcid ? funcid : ' ') << " it->first.index=" << it->first.index << " ordertx.vout[it->first.index].nValue=" << ordertx.vout[it->first.index].nValue << " tokenid=" << assetid.GetHex() << std::endl);
-                }
+                sprintf(numstr, "%.8f", (double)order.price / COIN);
+                item.push_back(Pair("totalrequired", numstr));
+                sprintf(numstr, "%.8f", (double)order.price / (COIN * order.nFirstValue));
+                item.push_back(Pair("price", numstr));
+            }
+            else
+            {
+                item.push_back(Pair("totalrequired", (int64_t)order.price));
+                sprintf(numstr, "%.8f", (double)order.nFirstValue / (order.price * COIN));
+                item.push_back(Pair("price", numstr));
             }
         }
+        result.push_back(item);
+        LOGSTREAM("ccassets", CCLOG_DEBUG1, stream << "addOrder() added order funcId=" << (char)(funcid ? funcid : ' ') << " vout=" << order.vout << " nValue=" << order.nValue << " tokenid=" << order.tokenid.GetHex() << std::endl);
 	};
 
-    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > unspentOutputsTokens, unspentOutputsDualEvalTokens, unspentOutputsCoins;
-
-	char assetsUnspendableAddr[64];
-	GetCCaddress(cpAssets, assetsUnspendableAddr, GetUnspendable(cpAssets, NULL));
-	SetCCunspents(unspentOutputsCoins, assetsUnspendableAddr,true);
-
-	char assetsTokensUnspendableAddr[64];
+    // asks of a non-fungible token are on the tokens address with its evalcode
+    std::set<uint8_t> askEvalcodes2;
     std::vector<uint8_t> vopretNonfungible;
-    if (refassetid != zeroid) {
+    if (refassetid != zeroid)
         GetNonfungibleData(refassetid, vopretNonfungible);
-        if (vopretNonfungible.size() > 0)
-            cpAssets->additionalTokensEvalcode2 = vopretNonfungible.begin()[0];
-    }
-	GetTokensCCaddress(cpAssets, assetsTokensUnspendableAddr, GetUnspendable(cpAssets, NULL));
-	SetCCunspents(unspentOutputsTokens, assetsTokensUnspendableAddr,true);
-
-    // tokenbids:
-    for (std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator itCoins = unspentOutputsCoins.begin();
-        itCoins != unspentOutputsCoins.end();
-        itCoins++)
-        addOrders(cpAssets, itCoins);
-    
-    // tokenasks:
-    for (std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator itTokens = unspentOutputsTokens.begin();
-		itTokens != unspentOutputsTokens.end();
-		itTokens++)
-		addOrders(cpAssets, itTokens);
-
-    if (additionalEvalCode != 0) {  //this would be mytokenorders
-        char assetsDualEvalTokensUnspendableAddr[64];
-
-        // try also dual eval tokenasks (and we do not need bids):
-        cpAssets->additionalTokensEvalcode2 = additionalEvalCode;
-        GetTokensCCaddress(cpAssets, assetsDualEvalTokensUnspendableAddr, GetUnspendable(cpAssets, NULL));
-        SetCCunspents(unspentOutputsDualEvalTokens, assetsDualEvalTokensUnspendableAddr,true);
-
-        for (std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator itDualEvalTokens = unspentOutputsDualEvalTokens.begin();
-            itDualEvalTokens != unspentOutputsDualEvalTokens.end();
-            itDualEvalTokens++)
-            addOrders(cpAssets, itDualEvalTokens);
+    askEvalcodes2.insert(vopretNonfungible.size() > 0 ? vopretNonfungible.begin()[0] : 0);
+    if (additionalEvalCode != 0)  //this would be mytokenorders, try also dual eval tokenasks
+        askEvalcodes2.insert(additionalEvalCode);
+
+    // the order book has the orders sorted by price, the highest bid and the lowest ask first
+    std::vector<CAssetOrder> orders;
+    {
+        LOCK(cs_main);
+        GetAssetsOrders(refassetid != zeroid ? &refassetid : NULL, pk == CPubKey(), askEvalcodes2, orders);
     }
+    for (std::vector<CAssetOrder>::const_iterator it = orders.begin(); it != orders.end(); it++)
+        addOrder(*it);
     return(result);
 }
 
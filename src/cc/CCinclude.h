@@ -848,6 +848,15 @@ UniValue FinalizeCCTxExt(bool remote, uint64_t skipmask, struct CCcontract_info
 /// @param CCflag if true the function searches for cc outputs, otherwise for normal outputs
 void SetCCunspents(std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &unspentOutputs,char *coinaddr,bool CCflag = true);
 
+/// SetCCunspentsWithOpRet returns the unspent cc outputs on an address whose transaction opreturn has the evalcode, funcid and reference txid (the tokenid for tokens)
+/// With -ccindex only the matching outputs are read, otherwise it returns all the address' cc outputs like SetCCunspents, so the caller still checks the opreturn
+/// @param[out] unspentOutputs vector of pairs of address key and amount
+/// @param coinaddr cc address where unspent outputs are searched
+/// @param evalcode evalcode of the opreturn
+/// @param funcid funcid of the opreturn, or -1 for any
+/// @param refid reference txid of the opreturn, or zeroid for any
+void SetCCunspentsWithOpRet(std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &unspentOutputs,char *coinaddr,uint8_t evalcode,int32_t funcid,uint256 refid);
+
 /// SetCCtxids returns a vector of all outputs on an address
 /// @param[out] addressIndex vector of pairs of address index key and amount
 /// @param coinaddr address where the unspent outputs are searched
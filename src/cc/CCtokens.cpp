@@ -14,6 +14,7 @@
  ******************************************************************************/
 
 #include "CCtokens.h"
+#include "ccindex.h"
 #include "importcoin.h"
 
 /* TODO: correct this:
@@ -628,15 +629,51 @@ int64_t AddTokenCCInputs(struct CCcontract_info *cp, CMutableTransaction &mtx, C
         cp->additionalTokensEvalcode2 = vopretNonfungible.begin()[0];
 
 	GetTokensCCaddress(cp, tokenaddr, pk);
-	SetCCunspents(unspentOutputs, tokenaddr,true);
+	threshold = total / (maxinputs != 0 ? maxinputs : CC_MAXVINS);
+
+    // with -ccindex the token outputs of the address were validated when their block was connected
+    std::vector<std::pair<CTokenUnspentKey, CAddressUnspentValue> > tokenUnspents;
+    if (GetTokenUnspents(tokenid, tokenaddr, tokenUnspents))
+    {
+        for (std::vector<std::pair<CTokenUnspentKey, CAddressUnspentValue> >::const_iterator it = tokenUnspents.begin(); it != tokenUnspents.end(); it++)
+        {
+            uint256 vintxid = it->first.txhash;
+            int32_t vout = (int32_t)it->first.index;
+
+            if (it->second.satoshis < threshold)
+                continue;
+
+            int32_t ivin;
+            for (ivin = 0; ivin < mtx.vin.size(); ivin ++)
+                if (vintxid == mtx.vin[ivin].prevout.hash && vout == mtx.vin[ivin].prevout.n)
+                    break;
+            if (ivin != mtx.vin.size())
+                continue;
+
+            if (myIsutxo_spentinmempool(ignoretxid,ignorevin,vintxid, vout) != 0)
+                continue;
+
+            if (total != 0 && maxinputs != 0)
+                mtx.vin.push_back(CTxIn(vintxid, vout, CScript()));
+
+            nValue = it->second.satoshis;
+            totalinputs += nValue;
+            LOGSTREAM((char *)"cctokens", CCLOG_DEBUG1, stream << "AddTokenCCInputs() adding indexed input nValue=" << nValue  << std::endl);
+            n++;
+
+            if ((total > 0 && totalinputs >= total) || (maxinputs > 0 && n >= maxinputs))
+                break;
+        }
+        return(totalinputs);
+    }
+
+	SetCCunspentsWithOpRet(unspentOutputs, tokenaddr, EVAL_TOKENS, -1, tokenid);
 
 
     if (unspentOutputs.empty()) {
         LOGSTREAM((char *)"cctokens", CCLOG_INFO, stream << "AddTokenCCInputs() no utxos for token dual/three eval addr=" << tokenaddr << " evalcode=" << (int)cp->evalcode << " additionalTokensEvalcode2=" << (int)cp->additionalTokensEvalcode2 << std::endl);
     }
 
-	threshold = total / (maxinputs != 0 ? maxinputs : CC_MAXVINS);
-
 	for (std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator it = unspentOutputs.begin(); it != unspentOutputs.end(); it++)
 	{
         CTransaction vintx;
@@ -975,9 +1012,13 @@ UniValue TokenInfo(uint256 tokenid)
 	result.push_back(Pair("name", name));
 
     int64_t supply = 0, output;
-    for (int v = 0; v < tokenbaseTx.vout.size() - 1; v++)
-        if ((output = IsTokensvout(false, true, cpTokens, NULL, tokenbaseTx, v, tokenid)) > 0)
-            supply += output;
+    CTokenIndexInfo tokenIndexInfo;
+    if (GetTokenIndexInfo(tokenid, tokenIndexInfo))
+        supply = tokenIndexInfo.nSupply;
+    else
+        for (int v = 0; v < tokenbaseTx.vout.size() - 1; v++)
+            if ((output = IsTokensvout(false, true, cpTokens, NULL, tokenbaseTx, v, tokenid)) > 0)
+                supply += output;
 	result.push_back(Pair("supply", supply));
 	result.push_back(Pair("description", description));
 
@@ -1034,6 +1075,13 @@ UniValue TokenList()
 
 	cp = CCinit(&C, EVAL_TOKENS);
 
+    // with -ccindex every token creation has its record
+    if (GetTokenIds(txids)) {
+        for (std::vector<uint256>::const_iterator it = txids.begin(); it != txids.end(); it++)
+            result.push_back(it->GetHex());
+        return(result);
+    }
+
     auto addTokenId = [&](uint256 txid) {
         if (myGetTransaction(txid, vintx, hashBlock) != 0) {
             if (vintx.vout.size() > 0 && DecodeTokenCreateOpRet(vintx.vout[vintx.vout.size() - 1].scriptPubKey, origpubkey, name, description) != 0) {
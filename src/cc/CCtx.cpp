@@ -14,6 +14,8 @@
  ******************************************************************************/
 
 #include "CCinclude.h"
+#include "ccindex.h"
+#include "indexbuilder.h"
 #include "key_io.h"
 
 std::vector<CPubKey> NULL_pubkeys;
@@ -418,6 +420,25 @@ void SetCCunspents(std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValu
     }
 }
 
+void SetCCunspentsWithOpRet(std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &unspentOutputs,char *coinaddr,uint8_t evalcode,int32_t funcid,uint256 refid)
+{
+    int32_t type=0; uint160 hashBytes; char destaddr[64]; std::vector<std::pair<CCCUnspentKey, CAddressUnspentValue> > ccUnspents;
+    CBitcoinAddress address((std::string)coinaddr);
+    if ( KOMODO_NSPV_SUPERLITE || !fCCIndex || IsIndexBuilding(INDEX_BUILD_CC) || address.GetIndexKey(hashBytes, type, true) == 0 )
+    {
+        SetCCunspents(unspentOutputs,coinaddr,true);
+        return;
+    }
+    if ( GetCCUnspents(evalcode, funcid, refid.IsNull() ? NULL : &refid, ccUnspents) == 0 )
+        return;
+    // the index is by opreturn, the outputs of other addresses are left out here
+    for (std::vector<std::pair<CCCUnspentKey, CAddressUnspentValue> >::const_iterator it=ccUnspents.begin(); it!=ccUnspents.end(); it++)
+    {
+        if ( Getscriptaddress(destaddr,it->second.script) != 0 && strcmp(destaddr,coinaddr) == 0 )
+            unspentOutputs.push_back(std::make_pair(CAddressUnspentKey(type, hashBytes, it->first.txhash, it->first.index), it->second));
+    }
+}
+
 void SetCCtxids(std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,char *coinaddr,bool ccflag)
 {
     int32_t type=0,i,n; char *ptr; std::string addrstr; uint160 hashBytes; std::vector<std::pair<uint160, int> > addresses;
@@ -18,6 +18,7 @@
  */
 
 #include "CCinclude.h"
+#include "ccindex.h"
 #include "komodo_structs.h"
 #include "key_io.h"
 
@@ -145,11 +146,12 @@ CC* GetCryptoCondition(CScript const& scriptSig)
 
 bool IsCCInput(CScript const& scriptSig)
 {
-    CC *cond;
-    if ( (cond= GetCryptoCondition(scriptSig)) == 0 )
+    auto pc = scriptSig.begin();
+    opcodetype opcode;
+    std::vector<unsigned char> ffbin;
+    if (!scriptSig.GetOp(pc, opcode, ffbin) || ffbin.empty())
         return false;
-    cc_free(cond);
-    return true;
+    return cc_isFulfillmentBinary((uint8_t*)ffbin.data(), ffbin.size()-1) != 0;
 }
 
 bool CheckTxFee(const CTransaction &tx, uint64_t txfee, uint32_t height, uint64_t blocktime, int64_t &actualtxfee)
@@ -551,12 +553,37 @@ uint256 CCOraclesReverseScan(char const *logcategory,uint256 &txid,int32_t heigh
     CTransaction tx; uint256 hash,mhash,bhash,hashBlock,oracletxid; int32_t len,len2,numvouts;
     int64_t val,merkleht; CPubKey pk; std::vector<uint8_t>data; char str[65],str2[65];
     
+    std::map<uint256, COracleDataValue> indexed; bool fIndexRead = false; char batonaddr[64];
+    
     txid = zeroid;
     LogPrint(logcategory,"start reverse scan %s\n",uint256_str(str,batontxid));
-    while ( myGetTransaction(batontxid,tx,hashBlock) != 0 && (numvouts= tx.vout.size()) > 0 )
+    while ( true )
     {
+        // with -ccindex the confirmed hops come from one range read of the baton address
+        std::map<uint256, COracleDataValue>::const_iterator itIndexed = indexed.find(batontxid);
+        if ( itIndexed != indexed.end() )
+        {
+            oracletxid = reforacletxid;
+            bhash = itIndexed->second.prevbatontxid;
+            data = itIndexed->second.data;
+        }
+        else
+        {
+            if ( myGetTransaction(batontxid,tx,hashBlock) == 0 || (numvouts= tx.vout.size()) == 0 )
+                break;
+            if ( DecodeOraclesData(tx.vout[numvouts-1].scriptPubKey,oracletxid,bhash,pk,data) != 'D' )
+                break;
+            if ( !fIndexRead && numvouts > 1 && Getscriptaddress(batonaddr,tx.vout[1].scriptPubKey) != 0 )
+            {
+                std::vector<std::pair<COracleDataKey, COracleDataValue> > samples;
+                fIndexRead = true;
+                if ( GetOracleDataSamples(reforacletxid,batonaddr,0,samples) )
+                    for (std::vector<std::pair<COracleDataKey, COracleDataValue> >::const_iterator it=samples.begin(); it!=samples.end(); it++)
+                        indexed[it->first.txhash] = it->second;
+            }
+        }
         LogPrint(logcategory,"check %s\n",uint256_str(str,batontxid));
-        if ( DecodeOraclesData(tx.vout[numvouts-1].scriptPubKey,oracletxid,bhash,pk,data) == 'D' && oracletxid == reforacletxid )
+        if ( oracletxid == reforacletxid )
         {
             LogPrint(logcategory,"decoded %s\n",uint256_str(str,batontxid));
             if ( oracle_format(&hash,&merkleht,0,'I',(uint8_t *)data.data(),0,(int32_t)data.size()) == sizeof(int32_t) && merkleht == height )
@@ -590,29 +617,36 @@ int32_t NSPV_coinaddr_inmempool(char const *logcategory,char *coinaddr,uint8_t C
 
 int32_t myIs_coinaddr_inmempoolvout(char const *logcategory,char *coinaddr)
 {
-    int32_t i,n; char destaddr[64];
+    std::vector<std::pair<COutPoint,CTxOut> > outputs; uint160 hashBytes; int type;
     if ( KOMODO_NSPV_SUPERLITE )
         return(NSPV_coinaddr_inmempool(logcategory,coinaddr,1));
-    BOOST_FOREACH(const CTxMemPoolEntry &e,mempool.mapTx)
+    // CC and normal outputs of an address have the same index key
+    if ( CBitcoinAddress(coinaddr).GetIndexKey(hashBytes,type,false) == 0 )
+        return(0);
+    mempool.getAddressOutputs(hashBytes,outputs);
+    if ( outputs.size() > 0 )
     {
-        const CTransaction &tx = e.GetTx();
-        if ( (n= tx.vout.size()) > 0 )
-        {
-            const uint256 &txid = tx.GetHash();
-            for (i=0; i<n; i++)
-            {
-                Getscriptaddress(destaddr,tx.vout[i].scriptPubKey);
-                if ( strcmp(destaddr,coinaddr) == 0 )
-                {
-                    LogPrint(logcategory,"found (%s) vout in mempool\n",coinaddr);
-                    return(1);
-                }
-            }
-        }
+        LogPrint(logcategory,"found (%s) vout in mempool\n",coinaddr);
+        return(1);
     }
     return(0);
 }
 
+void CCMempoolEvalKeys(const CTransaction &tx,std::vector<std::pair<uint8_t,uint8_t> > &keys)
+{
+    std::vector<uint8_t> vopret; std::vector<std::pair<uint8_t, vscript_t> > oprets; std::vector<CPubKey> pubkeys; uint256 tokenid; uint8_t evalcode;
+    if ( tx.vout.size() == 0 || GetOpReturnData(tx.vout[tx.vout.size()-1].scriptPubKey,vopret) == 0 || vopret.size() < 2 )
+        return;
+    keys.push_back(std::make_pair(vopret[0],vopret[1]));
+    // modules that move tokens put their own evalcode and funcid in the data of the tokens opreturn
+    if ( vopret[0] == EVAL_TOKENS && DecodeTokenOpRet(tx.vout[tx.vout.size()-1].scriptPubKey,evalcode,tokenid,pubkeys,oprets) != 0 )
+    {
+        for (std::vector<std::pair<uint8_t, vscript_t> >::const_iterator it=oprets.begin(); it!=oprets.end(); it++)
+            if ( it->second.size() >= 2 && std::find(keys.begin(),keys.end(),std::make_pair(it->second[0],it->second[1])) == keys.end() )
+                keys.push_back(std::make_pair(it->second[0],it->second[1]));
+    }
+}
+
 extern struct NSPV_mempoolresp NSPV_mempoolresult;
 extern bool NSPV_evalcode_inmempool(uint8_t evalcode,uint8_t funcid);
 
@@ -631,12 +665,9 @@ int32_t myGet_mempool_txs(std::vector<CTransaction> &txs,uint8_t evalcode,uint8_
         }
         return (NSPV_mempoolresult.numtxids);
     }
-    BOOST_FOREACH(const CTxMemPoolEntry &e,mempool.mapTx)
-    {
-        txs.push_back(e.GetTx());
-        i++;
-    }
-    return(i);
+    i = (int32_t)txs.size();
+    mempool.getCCEvalTxs(evalcode,funcid,txs);
+    return((int32_t)txs.size() - i);
 }
 
 int32_t CCCointxidExists(char const *logcategory,uint256 cointxid)
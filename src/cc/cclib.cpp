@@ -652,6 +652,94 @@ int32_t cclib_parsehash(uint8_t *hash32,cJSON *item,int32_t len)
     } else return(-1);
 }
 
+// the player data a game ends with after replaying its keystrokes, by the hash of the library, the seed, the player it
+// starts with and the keystrokes. a replay is deterministic, so the validation of the highlander and bailout txs and
+// the rpcs share it, and it is appended to a file in the datadir with a checksum to be kept across restarts
+
+#define CCLIB_REPLAYS_VERSION 1
+#define CCLIB_MAXREPLAYS 10000
+
+CCriticalSection cs_cclibreplays;
+std::map<uint256,std::vector<uint8_t> > cclib_replays;
+bool cclib_replaysloaded;
+
+std::string cclib_replaysfname()
+{
+    return((GetDataDir() / (MYCCLIBNAME + "replays")).string());
+}
+
+uint256 cclib_replaykey(uint64_t seed,const void *player,int32_t playerlen,const void *keystrokes,int32_t keyslen)
+{
+    std::vector<uint8_t> buf; int32_t version = CCLIB_REPLAYS_VERSION;
+    buf.insert(buf.end(),MYCCLIBNAME.begin(),MYCCLIBNAME.end());
+    buf.insert(buf.end(),(uint8_t *)&version,(uint8_t *)&version + sizeof(version));
+    buf.insert(buf.end(),(uint8_t *)&seed,(uint8_t *)&seed + sizeof(seed));
+    buf.insert(buf.end(),(uint8_t *)&playerlen,(uint8_t *)&playerlen + sizeof(playerlen));
+    if ( playerlen > 0 )
+        buf.insert(buf.end(),(uint8_t *)player,(uint8_t *)player + playerlen);
+    if ( keyslen > 0 )
+        buf.insert(buf.end(),(uint8_t *)keystrokes,(uint8_t *)keystrokes + keyslen);
+    return(Hash(buf.begin(),buf.end()));
+}
+
+void cclib_replaysload()
+{
+    FILE *fp; uint256 key,checksum; int32_t len; std::vector<uint8_t> rec,newdata;
+    AssertLockHeld(cs_cclibreplays);
+    if ( cclib_replaysloaded )
+        return;
+    cclib_replaysloaded = true;
+    if ( (fp= fopen(cclib_replaysfname().c_str(),"rb")) == 0 )
+        return;
+    while ( fread(&key,1,sizeof(key),fp) == sizeof(key) && fread(&len,1,sizeof(len),fp) == sizeof(len) && len >= 0 && len <= 10000 )
+    {
+        newdata.resize(len);
+        if ( (len > 0 && fread(&newdata[0],1,len,fp) != len) || fread(&checksum,1,sizeof(checksum),fp) != sizeof(checksum) )
+            break;
+        rec.assign(key.begin(),key.end());
+        rec.insert(rec.end(),newdata.begin(),newdata.end());
+        if ( Hash(rec.begin(),rec.end()) != checksum )
+            break;
+        if ( cclib_replays.size() >= CCLIB_MAXREPLAYS )
+            cclib_replays.erase(cclib_replays.begin());
+        cclib_replays[key] = newdata;
+    }
+    fclose(fp);
+    fprintf(stderr,"loaded %d %s replays\n",(int32_t)cclib_replays.size(),MYCCLIBNAME.c_str());
+}
+
+bool cclib_replayfind(uint256 key,std::vector<uint8_t> &newdata)
+{
+    std::map<uint256,std::vector<uint8_t> >::iterator it;
+    LOCK(cs_cclibreplays);
+    cclib_replaysload();
+    if ( (it= cclib_replays.find(key)) == cclib_replays.end() )
+        return(false);
+    newdata = it->second;
+    return(true);
+}
+
+void cclib_replayadd(uint256 key,const std::vector<uint8_t> &newdata)
+{
+    FILE *fp; int32_t len = (int32_t)newdata.size(); std::vector<uint8_t> rec; uint256 checksum;
+    LOCK(cs_cclibreplays);
+    cclib_replaysload();
+    if ( cclib_replays.count(key) != 0 )
+        return;
+    if ( cclib_replays.size() >= CCLIB_MAXREPLAYS )
+        cclib_replays.erase(cclib_replays.begin());
+    cclib_replays[key] = newdata;
+    rec.assign(key.begin(),key.end());
+    rec.insert(rec.end(),newdata.begin(),newdata.end());
+    checksum = Hash(rec.begin(),rec.end());
+    if ( (fp= fopen(cclib_replaysfname().c_str(),"ab")) != 0 )
+    {
+        if ( fwrite(&key,1,sizeof(key),fp) != sizeof(key) || fwrite(&len,1,sizeof(len),fp) != sizeof(len) || (len > 0 && fwrite(&newdata[0],1,len,fp) != len) || fwrite(&checksum,1,sizeof(checksum),fp) != sizeof(checksum) )
+            fprintf(stderr,"error writing %s\n",cclib_replaysfname().c_str());
+        fclose(fp);
+    }
+}
+
 #ifdef BUILD_ROGUE
 #include "rogue_rpc.cpp"
 #include "rogue/cursesd.c"
@@ -1348,6 +1348,26 @@ UniValue games_keystrokes(uint64_t txfee,struct CCcontract_info *cp,cJSON *param
     } else return(cclib_error(result,"couldnt reparse params"));
 }
 
+// games_replay2 run once for each seed, starting player and keystrokes, see cclib_replayfind
+int32_t games_replay2cached(uint8_t *newdata,uint64_t seed,gamesevent *keystrokes,int32_t num,struct games_player *player)
+{
+    std::vector<uint8_t> result; uint256 key; int32_t n;
+    key = cclib_replaykey(seed,player,player != 0 ? sizeof(*player) : 0,keystrokes,num * sizeof(*keystrokes));
+    if ( cclib_replayfind(key,result) )
+    {
+        if ( result.size() > 0 )
+            memcpy(newdata,&result[0],result.size());
+        return((int32_t)result.size());
+    }
+    // an empty result can be a failure to save the player, it is not kept
+    if ( (n= games_replay2(newdata,seed,keystrokes,num,player,0)) > 0 )
+    {
+        result.assign(newdata,newdata + n);
+        cclib_replayadd(key,result);
+    }
+    return(n);
+}
+
 gamesevent *games_extractgame(int32_t makefiles,char *str,int32_t *numkeysp,std::vector<uint8_t> &newdata,uint64_t &seed,uint256 &playertxid,struct CCcontract_info *cp,uint256 gametxid,char *gamesaddr)
 {
     CPubKey gamespk; int32_t i,num,retval,maxplayers,gameheight,batonht,batonvout,numplayers,regslot,numkeys,err; std::string symbol,pname; CTransaction gametx; int64_t buyin,batonvalue; char fname[64]; gamesevent *keystrokes = 0; std::vector<uint8_t> playerdata; uint256 batontxid; FILE *fp; uint8_t newplayer[10000]; struct games_player P,endP;
@@ -1390,7 +1410,7 @@ gamesevent *games_extractgame(int32_t makefiles,char *str,int32_t *numkeysp,std:
                         fclose(fp);
                     }
                 }
-                num = games_replay2(newplayer,seed,keystrokes,numkeys,playerdata.size()==0?0:&P,0);
+                num = games_replay2cached(newplayer,seed,keystrokes,numkeys,playerdata.size()==0?0:&P);
                 newdata.resize(num);
                 for (i=0; i<num; i++)
                 {
@@ -1544,7 +1564,7 @@ UniValue games_finish(uint64_t txfee,struct CCcontract_info *cp,cJSON *params,ch
                     }
                     if ( keystrokes != 0 )
                     {
-                        num = games_replay2(player,seed,keystrokes,numkeys,playerdata.size()==0?0:&P,0);
+                        num = games_replay2cached(player,seed,keystrokes,numkeys,playerdata.size()==0?0:&P);
                         if ( keystrokes != 0 )
                             free(keystrokes), keystrokes = 0;
                     } else num = 0;
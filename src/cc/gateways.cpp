@@ -14,6 +14,7 @@
  ******************************************************************************/
 
 #include "CCGateways.h"
+#include "ccindex.h"
 #include "key_io.h"
 
 /*
@@ -412,6 +413,61 @@ bool GatewaysExactAmounts(struct CCcontract_info *cp,Eval* eval,const CTransacti
     else return(true);
 }
 
+/*
+ The merkleroot a publisher posted for a height is found walking back its batons, for every deposit in the mempool, the block
+ and the rpcs. The result only depends on the baton the walk starts from, so it is kept by that baton until the publisher posts again.
+ */
+static CCriticalSection cs_gatewaysmerkleroots;
+static std::map<std::pair<std::pair<uint256,uint256>,int32_t>,std::pair<uint256,uint256> > gatewaysmerkleroots;
+#define GATEWAYS_MAXMERKLEROOTS 10000
+
+static uint256 GatewaysMerkleRoot(uint256 &txid,int32_t height,uint256 oracletxid,uint256 batontxid)
+{
+    std::pair<std::pair<uint256,uint256>,int32_t> key(std::make_pair(oracletxid,batontxid),height); uint256 mhash;
+    {
+        LOCK(cs_gatewaysmerkleroots);
+        std::map<std::pair<std::pair<uint256,uint256>,int32_t>,std::pair<uint256,uint256> >::const_iterator it = gatewaysmerkleroots.find(key);
+        if ( it != gatewaysmerkleroots.end() )
+        {
+            txid = it->second.second;
+            return(it->second.first);
+        }
+    }
+    if ( (mhash= CCOraclesReverseScan("gatewayscc-2",txid,height,oracletxid,batontxid)) != zeroid )
+    {
+        LOCK(cs_gatewaysmerkleroots);
+        if ( gatewaysmerkleroots.size() >= GATEWAYS_MAXMERKLEROOTS )
+            gatewaysmerkleroots.clear();
+        gatewaysmerkleroots[key] = std::make_pair(mhash,txid);
+    }
+    return(mhash);
+}
+
+// with -ccindex the markers of the pending steps of refid come from the gateway entries, instead of every output on the CC address
+static bool GatewaysIndexedMarkers(uint256 refid,uint8_t funcid,std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &unspentOutputs)
+{
+    std::vector<std::pair<CGatewaysIndexKey, CAddressUnspentValue> > entries;
+    if ( GetGatewaysEntries(refid,funcid,true,entries) == 0 )
+        return(false);
+    for (std::vector<std::pair<CGatewaysIndexKey, CAddressUnspentValue> >::const_iterator it=entries.begin(); it!=entries.end(); it++)
+        unspentOutputs.push_back(std::make_pair(CAddressUnspentKey(1,uint160(),it->first.txhash,0),it->second));
+    return(true);
+}
+
+// pending withdraws of bindtxid and their partial signings, or the complete signings not yet marked done when processed is set
+static bool GatewaysIndexedWithdrawMarkers(uint256 bindtxid,int32_t processed,std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &unspentOutputs)
+{
+    std::vector<std::pair<CGatewaysIndexKey, CAddressUnspentValue> > withdraws;
+    if ( GetGatewaysEntries(bindtxid,'W',false,withdraws) == 0 )
+        return(false);
+    if ( processed == 0 && GatewaysIndexedMarkers(bindtxid,'W',unspentOutputs) == 0 )
+        return(false);
+    for (std::vector<std::pair<CGatewaysIndexKey, CAddressUnspentValue> >::const_iterator it=withdraws.begin(); it!=withdraws.end(); it++)
+        if ( GatewaysIndexedMarkers(it->first.txhash,processed != 0 ? 'S' : 'P',unspentOutputs) == 0 )
+            return(false);
+    return(true);
+}
+
 int64_t GatewaysVerify(char *refdepositaddr,uint256 oracletxid,int32_t claimvout,std::string refcoin,uint256 cointxid,const std::string deposithex,std::vector<uint8_t>proof,uint256 merkleroot,CPubKey destpub,uint8_t taddr,uint8_t prefix,uint8_t prefix2)
 {
     std::vector<uint256> txids; uint256 proofroot,hashBlock,txid = zeroid; CTransaction tx; std::string name,description,format;
@@ -654,7 +710,7 @@ bool GatewaysValidate(struct CCcontract_info *cp,Eval *eval,const CTransaction &
                             merkleroot = zeroid;
                             for (i=m=0; i<N; i++)
                             {
-                                if ( (mhash= CCOraclesReverseScan("gatewayscc-2",txid,height,oracletxid,OraclesBatontxid(oracletxid,pubkeys[i]))) != zeroid )
+                                if ( (mhash= GatewaysMerkleRoot(txid,height,oracletxid,OraclesBatontxid(oracletxid,pubkeys[i]))) != zeroid )
                                 {
                                     if ( merkleroot == zeroid )
                                         merkleroot = mhash, m = 1;
@@ -951,7 +1007,7 @@ UniValue GatewaysDeposit(const CPubKey& pk, uint64_t txfee,uint256 bindtxid,int3
     {
         pubkey33_str(str,(uint8_t *)&pubkeys[i]);
         LOGSTREAM("gatewayscc",CCLOG_INFO, stream << "pubkeys[" << i << "] " << str << std::endl);
-        if ( (mhash= CCOraclesReverseScan("gatewayscc-2",txid,height,oracletxid,OraclesBatontxid(oracletxid,pubkeys[i]))) != zeroid )
+        if ( (mhash= GatewaysMerkleRoot(txid,height,oracletxid,OraclesBatontxid(oracletxid,pubkeys[i]))) != zeroid )
         {
             if ( merkleroot == zeroid )
                 merkleroot = mhash, m = 1;
@@ -1038,7 +1094,8 @@ UniValue GatewaysWithdraw(const CPubKey& pk, uint64_t txfee,uint256 bindtxid,std
     if (komodo_txnotarizedconfirmed(bindtxid)==false)
         CCERR_RESULT("gatewayscc",CCLOG_INFO, stream << "gatewaysbind tx not yet confirmed/notarized");
     _GetCCaddress(coinaddr,EVAL_GATEWAYS,gatewayspk);
-    SetCCunspents(unspentOutputs,coinaddr,true);
+    if ( GatewaysIndexedWithdrawMarkers(bindtxid,0,unspentOutputs) == 0 )
+        SetCCunspents(unspentOutputs,coinaddr,true);
     for (std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator it=unspentOutputs.begin(); it!=unspentOutputs.end(); it++)
     {
         txid = it->first.txhash;
@@ -1242,7 +1299,8 @@ UniValue GatewaysPendingDeposits(const CPubKey& pk, uint256 bindtxid,std::string
         result.push_back(Pair("error",strprintf("invalid bindtxid %s coin.%s",uint256_str(str,bindtxid),coin.c_str())));     
         return(result);
     }  
-    SetCCunspents(unspentOutputs,coinaddr,true);
+    if ( GatewaysIndexedMarkers(bindtxid,'D',unspentOutputs) == 0 )
+        SetCCunspents(unspentOutputs,coinaddr,true);
     for (std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator it=unspentOutputs.begin(); it!=unspentOutputs.end(); it++)
     {
         txid = it->first.txhash;
@@ -1305,7 +1363,8 @@ UniValue GatewaysPendingWithdraws(const CPubKey& pk, uint256 bindtxid,std::strin
             queueflag = 1;
             break;
         }    
-    SetCCunspents(unspentOutputs,coinaddr,true);
+    if ( GatewaysIndexedWithdrawMarkers(bindtxid,0,unspentOutputs) == 0 )
+        SetCCunspents(unspentOutputs,coinaddr,true);
     for (std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator it=unspentOutputs.begin(); it!=unspentOutputs.end(); it++)
     {
         txid = it->first.txhash;
@@ -1393,7 +1452,8 @@ UniValue GatewaysProcessedWithdraws(const CPubKey& pk, uint256 bindtxid,std::str
             queueflag = 1;
             break;
         }    
-    SetCCunspents(unspentOutputs,coinaddr,true);
+    if ( GatewaysIndexedWithdrawMarkers(bindtxid,1,unspentOutputs) == 0 )
+        SetCCunspents(unspentOutputs,coinaddr,true);
     for (std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator it=unspentOutputs.begin(); it!=unspentOutputs.end(); it++)
     {
         txid = it->first.txhash;
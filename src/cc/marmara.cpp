@@ -137,12 +137,56 @@ uint8_t MarmaraDecodeLoopOpret(const CScript scriptPubKey,uint256 &createtxid,CP
     return(0);
 }
 
+/*
+ The opret of a loop transaction, decoded once per txid as a transaction never changes. Only the
+ transactions MarmaraGetCreditloops and MarmaraGetcreatetxid could decode are kept.
+ */
+struct MarmaraLoopTx
+{
+    uint8_t funcid;
+    uint256 createtxid;
+    CPubKey senderpk;
+    int64_t amount;
+    int32_t matures,numvouts;
+    std::string currency;
+    bool iscoinbase,lastvoutempty;
+};
+static CCriticalSection cs_marmaraloops;
+static std::map<uint256,MarmaraLoopTx> marmaralooptxs;
+#define MARMARA_MAXCACHED 100000
+
+static bool MarmaraGetLoopTx(uint256 txid,MarmaraLoopTx &looptx)
+{
+    CTransaction tx; uint256 hashBlock; int32_t numvouts;
+    {
+        LOCK(cs_marmaraloops);
+        std::map<uint256,MarmaraLoopTx>::const_iterator it = marmaralooptxs.find(txid);
+        if ( it != marmaralooptxs.end() )
+        {
+            looptx = it->second;
+            return(true);
+        }
+    }
+    if ( myGetTransaction(txid,tx,hashBlock) == 0 || (numvouts= tx.vout.size()) <= 1 )
+        return(false);
+    looptx.numvouts = numvouts;
+    looptx.iscoinbase = tx.IsCoinBase();
+    looptx.lastvoutempty = (tx.vout[numvouts-1].nValue == 0);
+    looptx.funcid = MarmaraDecodeLoopOpret(tx.vout[numvouts-1].scriptPubKey,looptx.createtxid,looptx.senderpk,looptx.amount,looptx.matures,looptx.currency);
+    LOCK(cs_marmaraloops);
+    if ( marmaralooptxs.size() >= MARMARA_MAXCACHED )
+        marmaralooptxs.clear();
+    marmaralooptxs[txid] = looptx;
+    return(true);
+}
+
 int32_t MarmaraGetcreatetxid(uint256 &createtxid,uint256 txid)
 {
-    CTransaction tx; uint256 hashBlock; uint8_t funcid; int32_t numvouts,matures; std::string currency; CPubKey senderpk; int64_t amount;
-    if ( myGetTransaction(txid,tx,hashBlock) != 0 && (numvouts= tx.vout.size()) > 1 )
+    MarmaraLoopTx looptx; uint8_t funcid;
+    if ( MarmaraGetLoopTx(txid,looptx) )
     {
-        if ( (funcid= MarmaraDecodeLoopOpret(tx.vout[numvouts-1].scriptPubKey,createtxid,senderpk,amount,matures,currency)) == 'I' || funcid == 'T' )
+        createtxid = looptx.createtxid;
+        if ( (funcid= looptx.funcid) == 'I' || funcid == 'T' )
             return(0);
         else if ( funcid == 'R' )
         {
@@ -154,16 +198,86 @@ int32_t MarmaraGetcreatetxid(uint256 &createtxid,uint256 txid)
     return(-1);
 }
 
+/*
+ The hops of each credit loop the baton is known to have passed for good: hop i was spent by hop i+1, or by next
+ for the last one, and that spend was itself spent, both in blocks. A later walk starts at next, so only the newest
+ links are looked up in the spent index. The hops are kept with the block the later of the two spends was in, and
+ cut at the first one that isn't in the active chain anymore.
+ */
+struct MarmaraLoopHops
+{
+    std::vector<uint256> hops;
+    std::vector<std::pair<int32_t,uint256> > blocks;
+    uint256 next;
+};
+static std::map<uint256,MarmaraLoopHops> marmaraloophops;
+
+static void MarmaraGetLoopHops(uint256 createtxid,MarmaraLoopHops &loophops)
+{
+    AssertLockHeld(cs_main);
+    LOCK(cs_marmaraloops);
+    std::map<uint256,MarmaraLoopHops>::iterator it = marmaraloophops.find(createtxid);
+    if ( it == marmaraloophops.end() )
+        return;
+    MarmaraLoopHops &cached = it->second;
+    for (size_t i=0; i<cached.hops.size(); i++)
+    {
+        CBlockIndex *pindex = chainActive[cached.blocks[i].first];
+        if ( pindex == 0 || pindex->GetBlockHash() != cached.blocks[i].second )
+        {
+            if ( i == 0 )
+            {
+                marmaraloophops.erase(it);
+                return;
+            }
+            cached.next = cached.hops[i];
+            cached.hops.resize(i);
+            cached.blocks.resize(i);
+            break;
+        }
+    }
+    loophops = cached;
+}
+
+static void MarmaraAddLoopHop(uint256 createtxid,uint256 txid,uint256 next,int32_t height)
+{
+    CBlockIndex *pindex;
+    AssertLockHeld(cs_main);
+    if ( (pindex= chainActive[height]) == 0 )
+        return;
+    LOCK(cs_marmaraloops);
+    if ( marmaraloophops.size() >= MARMARA_MAXCACHED && marmaraloophops.count(createtxid) == 0 )
+        marmaraloophops.clear();
+    MarmaraLoopHops &cached = marmaraloophops[createtxid];
+    // only extends the hops read at the start of the walk
+    if ( cached.hops.empty() ? txid != createtxid : cached.next != txid )
+        return;
+    cached.hops.push_back(txid);
+    cached.blocks.push_back(std::make_pair(height,pindex->GetBlockHash()));
+    cached.next = next;
+}
+
 int32_t MarmaraGetbatontxid(std::vector<uint256> &creditloop,uint256 &batontxid,uint256 txid)
 {
-    uint256 createtxid,spenttxid; int64_t value; int32_t vini,height,n=0,vout = 0;
+    uint256 createtxid,spenttxid,pendingtxid; int64_t value; int32_t vini,height,pendingheight=0,n=0,vout = 0; MarmaraLoopHops loophops;
     memset(&batontxid,0,sizeof(batontxid));
     if ( MarmaraGetcreatetxid(createtxid,txid) == 0 )
     {
+        LOCK(cs_main);
         txid = createtxid;
+        MarmaraGetLoopHops(createtxid,loophops);
+        if ( loophops.hops.size() > 0 )
+        {
+            creditloop = loophops.hops;
+            n = (int32_t)creditloop.size();
+            txid = loophops.next;
+        }
         //fprintf(stderr,"txid.%s -> createtxid %s\n",txid.GetHex().c_str(),createtxid.GetHex().c_str());
         while ( CCgetspenttxid(spenttxid,vini,height,txid,vout) == 0 )
         {
+            // the previous hop's spender was spent in a block too, the walk won't stop there again
+            if ( pendingheight > 0 && height > 0 )
+                MarmaraAddLoopHop(createtxid,pendingtxid,txid,std::max(pendingheight,height));
             creditloop.push_back(txid);
             //fprintf(stderr,"%d: %s\n",n,txid.GetHex().c_str());
             n++;
@@ -180,6 +294,8 @@ int32_t MarmaraGetbatontxid(std::vector<uint256> &creditloop,uint256 &batontxid,
                 return(n);
             }
             // get funcid
+            pendingtxid = txid;
+            pendingheight = height;
             txid = spenttxid;
         }
     }
@@ -663,7 +779,7 @@ UniValue MarmaraSettlement(uint64_t txfee,uint256 refbatontxid)
 
 int32_t MarmaraGetCreditloops(int64_t &totalamount,std::vector<uint256> &issuances,int64_t &totalclosed,std::vector<uint256> &closed,struct CCcontract_info *cp,int32_t firstheight,int32_t lastheight,int64_t minamount,int64_t maxamount,CPubKey refpk,std::string refcurrency)
 {
-    char coinaddr[64]; CPubKey Marmarapk,senderpk; int64_t amount; uint256 createtxid,txid,hashBlock; CTransaction tx; int32_t numvouts,vout,matures,n=0; std::string currency;
+    char coinaddr[64]; CPubKey Marmarapk; uint256 txid; MarmaraLoopTx looptx; int32_t vout,n=0;
     std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > unspentOutputs;
     Marmarapk = GetUnspendable(cp,0);
     GetCCaddress(cp,coinaddr,Marmarapk);
@@ -675,17 +791,17 @@ int32_t MarmaraGetCreditloops(int64_t &totalamount,std::vector<uint256> &issuanc
         txid = it->first.txhash;
         vout = (int32_t)it->first.index;
         //fprintf(stderr,"txid.%s/v%d\n",txid.GetHex().c_str(),vout);
-        if ( vout == 1 && myGetTransaction(txid,tx,hashBlock) != 0 )
+        if ( vout == 1 && MarmaraGetLoopTx(txid,looptx) )
         {
-            if ( tx.IsCoinBase() == 0 && (numvouts= tx.vout.size()) > 2 && tx.vout[numvouts - 1].nValue == 0 )
+            if ( looptx.iscoinbase == 0 && looptx.numvouts > 2 && looptx.lastvoutempty )
             {
-                if ( MarmaraDecodeLoopOpret(tx.vout[numvouts-1].scriptPubKey,createtxid,senderpk,amount,matures,currency) == 'I' )
+                if ( looptx.funcid == 'I' )
                 {
                     n++;
-                    if ( currency == refcurrency && matures >= firstheight && matures <= lastheight && amount >= minamount && amount <= maxamount && (refpk.size() == 0 || senderpk == refpk) )
+                    if ( looptx.currency == refcurrency && looptx.matures >= firstheight && looptx.matures <= lastheight && looptx.amount >= minamount && looptx.amount <= maxamount && (refpk.size() == 0 || looptx.senderpk == refpk) )
                     {
                         issuances.push_back(txid);
-                        totalamount += amount;
+                        totalamount += looptx.amount;
                     }
                 }
             }
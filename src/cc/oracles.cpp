@@ -14,6 +14,7 @@
  ******************************************************************************/
 
 #include "CCOracles.h"
+#include "ccindex.h"
 #include <secp256k1.h>
 
 /*
@@ -1101,6 +1102,22 @@ UniValue OracleDataSamples(uint256 reforacletxid,char* batonaddr,int32_t num)
                     }
                 }
             }
+            // with -ccindex the confirmed data of the baton address is a range read, the most recent first
+            std::vector<std::pair<COracleDataKey, COracleDataValue> > samples;
+            if (GetOracleDataSamples(reforacletxid,batonaddr,num != 0 ? num-n : 0,samples))
+            {
+                if ( (formatstr= (char *)format.c_str()) == 0 )
+                    formatstr = (char *)"";
+                for (std::vector<std::pair<COracleDataKey, COracleDataValue> >::const_iterator it=samples.begin(); it!=samples.end(); it++)
+                {
+                    UniValue a(UniValue::VOBJ);
+                    a.push_back(Pair("txid",it->first.txhash.GetHex()));
+                    a.push_back(Pair("data",OracleFormat((uint8_t *)it->second.data.data(),(int32_t)it->second.data.size(),formatstr,(int32_t)format.size())));
+                    b.push_back(a);
+                }
+                result.push_back(Pair("samples",b));
+                return(result);
+            }
             SetCCtxids(txids,batonaddr,true,EVAL_ORACLES,reforacletxid,'D');
             if (txids.size()>0)
             {
@@ -73,6 +73,8 @@ GetKomodoEarlytxidScriptPub is on line #2080 of komodo_bitcoind.h
 #include "CCPrices.h"
 
 #include <cstdlib>
+#include <functional>
+#include <map>
 #include <gmp.h>
 
 #define IS_CHARINSTR(c, str) (std::string(str).find((char)(c)) != std::string::npos)
@@ -966,11 +968,12 @@ int32_t prices_syntheticvec(std::vector<uint16_t> &vec, std::vector<std::string>
 }
 
 // calculates price for synthetic expression
-int64_t prices_syntheticprice(std::vector<uint16_t> vec, int32_t height, int32_t minmax, int16_t leverage)
+// evaluates the synthetic expression vec, getprice returns < 0 when there is no price for the index (yet)
+static int64_t prices_evalsynthetic(const std::vector<uint16_t> &vec, const std::function<int32_t(int32_t, int64_t &)> &getprice)
 {
     int32_t i, value, errcode, depth, retval = -1;
     uint16_t opcode;
-    int64_t *pricedata, pricestack[4], a, b, c;
+    int64_t pricestack[4], a, b, c;
 
     mpz_t mpzTotalPrice, mpzPriceValue, mpzDen, mpzA, mpzB, mpzC, mpzResult;
 
@@ -983,7 +986,6 @@ int64_t prices_syntheticprice(std::vector<uint16_t> vec, int32_t height, int32_t
     mpz_init(mpzC);
     mpz_init(mpzResult);
 
-    pricedata = (int64_t *)calloc(sizeof(*pricedata) * 3, 1 + PRICES_DAYWINDOW * 2 + PRICES_SMOOTHWIDTH);
     depth = errcode = 0;
     mpz_set_si(mpzTotalPrice, 0);
     mpz_set_si(mpzDen, 0);
@@ -1000,9 +1002,8 @@ int64_t prices_syntheticprice(std::vector<uint16_t> vec, int32_t height, int32_t
         {
         case 0: // indices 
             pricestack[depth] = 0;
-            if (komodo_priceget(pricedata, value, height, 1) >= 0)
+            if (getprice(value, pricestack[depth]) >= 0)
             {
-                //std::cerr << "prices_syntheticprice" << " pricedata[0]=" << pricedata[0] << " pricedata[1]=" << pricedata[1] << " pricedata[2]=" << pricedata[2] << std::endl;
                 // push price to the prices stack
                 /*if (!minmax)
                     pricestack[depth] = pricedata[2];   // use smoothed value if we are over 24h
@@ -1014,7 +1015,6 @@ int64_t prices_syntheticprice(std::vector<uint16_t> vec, int32_t height, int32_t
                     else
                         pricestack[depth] = (pricedata[1] < pricedata[2]) ? pricedata[1] : pricedata[2]; // MIN
                 }*/
-                pricestack[depth] = pricedata[2];
             }
             else
                 errcode = -1;
@@ -1183,7 +1183,6 @@ int64_t prices_syntheticprice(std::vector<uint16_t> vec, int32_t height, int32_t
  //           std::cerr << "prices_syntheticprice pricestack empty" << std::endl;
 
     }
-    free(pricedata);
     mpz_clear(mpzResult);
     mpz_clear(mpzA);
     mpz_clear(mpzB);
@@ -1232,6 +1231,130 @@ int64_t prices_syntheticprice(std::vector<uint16_t> vec, int32_t height, int32_t
     return priceIndex;
 }
 
+/*
+ Cache of the smoothed prices read from the PRICES files and of the synthetic prices computed from them, so the
+ scans over every open bet and every height since it was placed read and evaluate each (expression, height) once.
+ komodo_pricesupdate rewrites the prices of a height when its block is connected, also again after a reorg, and
+ drops everything cached for that height and above.
+ */
+static CCriticalSection cs_pricescache;
+static std::map<std::pair<int32_t, int32_t>, int64_t> pricescache;                        // (height, index) -> smoothed price
+static std::map<std::pair<int32_t, std::vector<uint16_t> >, int64_t> syntheticcache;     // (height, expression) -> synthetic price
+static const size_t PRICES_MAXCACHESIZE = 1000000;
+
+void prices_cacheinvalidate(int32_t height)
+{
+    LOCK(cs_pricescache);
+    pricescache.erase(pricescache.lower_bound(std::make_pair(height, 0)), pricescache.end());
+    syntheticcache.erase(syntheticcache.lower_bound(std::make_pair(height, std::vector<uint16_t>())), syntheticcache.end());
+}
+
+// the lowest heights go first, the scans move up towards the tip
+template <typename K>
+static void prices_cachestore(std::map<K, int64_t> &cache, const K &key, int64_t value)
+{
+    AssertLockHeld(cs_pricescache);
+    if (cache.size() >= PRICES_MAXCACHESIZE)
+        cache.erase(cache.begin());
+    cache[key] = value;
+}
+
+static int32_t prices_getcachedprice(int32_t ind, int32_t height, int64_t &price)
+{
+    {
+        LOCK(cs_pricescache);
+        std::map<std::pair<int32_t, int32_t>, int64_t>::const_iterator it = pricescache.find(std::make_pair(height, ind));
+        if (it != pricescache.end())
+        {
+            price = it->second;
+            return 0;
+        }
+    }
+    int64_t pricedata[PRICES_MAXDATAPOINTS];
+    if (komodo_priceget(pricedata, ind, height, 1) < 0)
+        return -1;
+    price = pricedata[2];
+    LOCK(cs_pricescache);
+    prices_cachestore(pricescache, std::make_pair(height, ind), price);
+    return 0;
+}
+
+static bool prices_getcachedsynthetic(const std::vector<uint16_t> &vec, int32_t height, int64_t &price)
+{
+    LOCK(cs_pricescache);
+    std::map<std::pair<int32_t, std::vector<uint16_t> >, int64_t>::const_iterator it = syntheticcache.find(std::make_pair(height, vec));
+    if (it == syntheticcache.end())
+        return false;
+    price = it->second;
+    return true;
+}
+
+static void prices_storesynthetic(const std::vector<uint16_t> &vec, int32_t height, int64_t price)
+{
+    // errors are not kept, the prices of the height may not be there yet
+    if (price < 0)
+        return;
+    LOCK(cs_pricescache);
+    prices_cachestore(syntheticcache, std::make_pair(height, vec), price);
+}
+
+int64_t prices_syntheticprice(std::vector<uint16_t> vec, int32_t height, int32_t minmax, int16_t leverage)
+{
+    int64_t price;
+    if (prices_getcachedsynthetic(vec, height, price))
+        return price;
+    price = prices_evalsynthetic(vec, [height](int32_t ind, int64_t &indprice) { return prices_getcachedprice(ind, height, indprice); });
+    prices_storesynthetic(vec, height, price);
+    return price;
+}
+
+// synthetic prices of vec for the heights firstheight to lastheight, reading the prices of each index for the range at once
+int32_t prices_syntheticprices(const std::vector<uint16_t> &vec, int32_t firstheight, int32_t lastheight, std::vector<int64_t> &prices)
+{
+    int32_t numblocks = lastheight - firstheight + 1;
+    std::map<int32_t, std::vector<int64_t> > rangedata;
+    prices.clear();
+    if (numblocks <= 0)
+        return 0;
+
+    for (std::vector<uint16_t>::const_iterator it = vec.begin(); it != vec.end(); it++)
+    {
+        int32_t ind = (*it & (KOMODO_MAXPRICES - 1));
+        if ((*it & KOMODO_PRICEMASK) != 0 || rangedata.count(ind) != 0)
+            continue;
+        std::vector<int64_t> &data = rangedata[ind];
+        data.resize(numblocks * PRICES_MAXDATAPOINTS);
+        if (komodo_priceget(data.data(), ind, firstheight, numblocks) < 0)
+        {
+            // the range goes past the prices written so far, read height by height until the first missing one
+            rangedata.clear();
+            break;
+        }
+    }
+
+    for (int32_t height = firstheight; height <= lastheight; height++)
+    {
+        int64_t price;
+        if (!prices_getcachedsynthetic(vec, height, price))
+        {
+            if (rangedata.empty())
+                price = prices_syntheticprice(vec, height, 0, 0);
+            else
+            {
+                price = prices_evalsynthetic(vec, [&rangedata, height, firstheight](int32_t ind, int64_t &indprice) {
+                    indprice = rangedata[ind][(height - firstheight) * PRICES_MAXDATAPOINTS + 2];
+                    return 0;
+                });
+                prices_storesynthetic(vec, height, price);
+            }
+        }
+        if (price < 0)
+            break;
+        prices.push_back(price);
+    }
+    return (int32_t)prices.size();
+}
+
 // calculates costbasis and profit/loss for the bet
 int32_t prices_syntheticprofits(int64_t &costbasis, int32_t firstheight, int32_t height, int16_t leverage, std::vector<uint16_t> vec, int64_t positionsize,  int64_t &profits, int64_t &outprice)
 {
@@ -1605,12 +1728,18 @@ int32_t prices_scanchain(std::vector<OneBetData> &bets, int16_t leverage, std::v
     if (bets.size() == 0)
         return -1;
 
+    const int32_t PRICES_SCANRANGE = 1000;
+    std::vector<int64_t> series;
     bool stop = false;
     for (int32_t height = bets[0].firstheight+1; ; height++)   // the last datum for 24h is the costbasis value
     {
         int64_t totalposition = 0;
         int64_t totalprofits = 0;
 
+        // the synthetic prices of the next heights are evaluated together, prices_syntheticprofits then finds them cached
+        if ((height - bets[0].firstheight - 1) % PRICES_SCANRANGE == 0)
+            prices_syntheticprices(vec, height, std::min(height + PRICES_SCANRANGE - 1, komodo_currentheight()), series);
+
         // scan upto the chain tip
         for (int i = 0; i < bets.size(); i++) {
 
@@ -971,6 +971,26 @@ UniValue rogue_keystrokes(uint64_t txfee,struct CCcontract_info *cp,cJSON *param
     } else return(cclib_error(result,"couldnt reparse params"));
 }
 
+// rogue_replay2 run once for each seed, starting player and keystrokes, see cclib_replayfind
+int32_t rogue_replay2cached(uint8_t *newdata,uint64_t seed,char *keystrokes,int32_t num,struct rogue_player *player)
+{
+    std::vector<uint8_t> result; uint256 key; int32_t n;
+    key = cclib_replaykey(seed,player,player != 0 ? sizeof(*player) : 0,keystrokes,num);
+    if ( cclib_replayfind(key,result) )
+    {
+        if ( result.size() > 0 )
+            memcpy(newdata,&result[0],result.size());
+        return((int32_t)result.size());
+    }
+    // an empty result can be a failure to save the player, it is not kept
+    if ( (n= rogue_replay2(newdata,seed,keystrokes,num,player,0)) > 0 )
+    {
+        result.assign(newdata,newdata + n);
+        cclib_replayadd(key,result);
+    }
+    return(n);
+}
+
 char *rogue_extractgame(int32_t makefiles,char *str,int32_t *numkeysp,std::vector<uint8_t> &newdata,uint64_t &seed,uint256 &playertxid,struct CCcontract_info *cp,uint256 gametxid,char *rogueaddr)
 {
     CPubKey roguepk; int32_t i,num,retval,maxplayers,gameheight,batonht,batonvout,numplayers,regslot,numkeys,err; std::string symbol,pname; CTransaction gametx; int64_t buyin,batonvalue; char fname[64],*keystrokes = 0; std::vector<uint8_t> playerdata; uint256 batontxid; FILE *fp; uint8_t newplayer[10000]; struct rogue_player P,endP;
@@ -1013,7 +1033,7 @@ char *rogue_extractgame(int32_t makefiles,char *str,int32_t *numkeysp,std::vecto
                     }
                 }
                 //fprintf(stderr,"call replay2\n");
-                num = rogue_replay2(newplayer,seed,keystrokes,numkeys,playerdata.size()==0?0:&P,0);
+                num = rogue_replay2cached(newplayer,seed,keystrokes,numkeys,playerdata.size()==0?0:&P);
                 newdata.resize(num);
                 for (i=0; i<num; i++)
                 {
@@ -1257,7 +1277,7 @@ UniValue rogue_finishgame(uint64_t txfee,struct CCcontract_info *cp,cJSON *param
                     }
                     if ( keystrokes != 0 )
                     {
-                        num = rogue_replay2(player,seed,keystrokes,numkeys,playerdata.size()==0?0:&P,0);
+                        num = rogue_replay2cached(player,seed,keystrokes,numkeys,playerdata.size()==0?0:&P);
                         if ( keystrokes != 0 )
                             free(keystrokes), keystrokes = 0;
                     } else num = 0;
@@ -0,0 +1,266 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "ccindex.h"
+
+#include "base58.h"
+#include "cc/CCGateways.h"
+#include "cc/CCinclude.h"
+#include "cc/CCtokens.h"
+#include "indexbuilder.h"
+#include "main.h"
+#include "txdb.h"
+#include "util.h"
+
+bool fCCIndex = DEFAULT_CCINDEX;
+
+//! Value of the baton output of oracle data transactions, CC_MARKER_VALUE of cc/oracles.cpp
+static const CAmount ORACLES_BATON_VALUE = 10000;
+//! Value of the marker output of gateway steps, CC_MARKER_VALUE of cc/gateways.cpp
+static const CAmount GATEWAYS_MARKER_VALUE = 10000;
+
+//! Key fields shared by the CC outputs of tx, false when it has no opreturn to read them from
+static bool GetCCIndexKeyFields(const CTransaction& tx, uint8_t& evalcode, uint8_t& funcid, uint256& refid)
+{
+    std::vector<unsigned char> vopret;
+    if (tx.vout.empty() || !GetOpReturnData(tx.vout.back().scriptPubKey, vopret) || vopret.size() < 2)
+        return false;
+
+    if (vopret[0] == EVAL_TOKENS) {
+        uint8_t evalCodeTokens;
+        uint256 tokenid;
+        std::vector<CPubKey> voutPubkeys;
+        std::vector<std::pair<uint8_t, vscript_t>> oprets;
+        uint8_t funcidTokens = DecodeTokenOpRet(tx.vout.back().scriptPubKey, evalCodeTokens, tokenid, voutPubkeys, oprets);
+        if (funcidTokens != 0) {
+            evalcode = EVAL_TOKENS;
+            funcid = funcidTokens;
+            // The token id of a token is the txid of its creation
+            refid = funcidTokens == 'c' ? tx.GetHash() : tokenid;
+            return true;
+        }
+    }
+
+    // Most modules serialize the txid of the instance right after the funcid
+    evalcode = vopret[0];
+    funcid = vopret[1];
+    if (vopret.size() >= 2 + 32)
+        refid = uint256(std::vector<unsigned char>(vopret.begin() + 2, vopret.begin() + 2 + 32));
+    else
+        refid = tx.GetHash();
+    return true;
+}
+
+void AddCCIndexOutputs(const CTransaction& tx, int nHeight, std::vector<std::pair<CCCUnspentKey, CAddressUnspentValue> >& vCreated)
+{
+    uint8_t evalcode, funcid;
+    uint256 refid;
+    bool fFields = false, fRead = false;
+    const uint256 txhash = tx.GetHash();
+    for (unsigned int k = 0; k < tx.vout.size(); k++) {
+        const CTxOut& out = tx.vout[k];
+        if (!out.scriptPubKey.IsPayToCryptoCondition())
+            continue;
+        // Only read the opreturn of transactions that have CC outputs
+        if (!fRead) {
+            fFields = GetCCIndexKeyFields(tx, evalcode, funcid, refid);
+            fRead = true;
+        }
+        if (!fFields)
+            return;
+        vCreated.push_back(std::make_pair(CCCUnspentKey(evalcode, funcid, refid, txhash, k), CAddressUnspentValue(out.nValue, out.scriptPubKey, nHeight)));
+    }
+}
+
+//! Index key of a CC output's address
+static bool GetCCAddressHash(const CScript& scriptPubKey, uint160& addressHash)
+{
+    char destaddr[64];
+    int type = 0;
+    if (Getscriptaddress(destaddr, scriptPubKey) == 0)
+        return false;
+    return CBitcoinAddress(std::string(destaddr)).GetIndexKey(addressHash, type, true);
+}
+
+void AddTokenIndexOutputs(const CTransaction& tx, int nHeight, std::vector<std::pair<CTokenUnspentKey, CAddressUnspentValue> >& vCreated,
+                          std::vector<std::pair<uint256, CTokenIndexInfo> >& vTokens)
+{
+    AssertLockHeld(cs_main);
+    // Undone through the CC entries, so only transactions with those are indexed
+    bool fCCOutputs = false;
+    for (const CTxOut& out : tx.vout)
+        fCCOutputs = fCCOutputs || out.scriptPubKey.IsPayToCryptoCondition();
+    uint8_t evalcode, funcid;
+    uint256 tokenid;
+    if (!fCCOutputs || !GetCCIndexKeyFields(tx, evalcode, funcid, tokenid) || evalcode != EVAL_TOKENS)
+        return;
+
+    struct CCcontract_info *cp, C;
+    cp = CCinit(&C, EVAL_TOKENS);
+    const uint256 txhash = tx.GetHash();
+    CAmount nSupply = 0;
+    // Same test as AddTokenCCInputs makes of each output it spends
+    for (int32_t v = 0; v < (int32_t)tx.vout.size() - 1; v++) {
+        const CTxOut& out = tx.vout[v];
+        uint160 addressHash;
+        if (!out.scriptPubKey.IsPayToCryptoCondition() || !GetCCAddressHash(out.scriptPubKey, addressHash))
+            continue;
+        CAmount nValue = IsTokensvout(true, true, cp, NULL, tx, v, tokenid);
+        if (nValue <= 0)
+            continue;
+        vCreated.push_back(std::make_pair(CTokenUnspentKey(tokenid, addressHash, txhash, v), CAddressUnspentValue(out.nValue, out.scriptPubKey, nHeight)));
+        nSupply += nValue;
+    }
+
+    if (funcid == 'c') {
+        CTokenIndexInfo info;
+        std::vector<std::pair<uint8_t, vscript_t> > oprets;
+        if (DecodeTokenCreateOpRet(tx.vout.back().scriptPubKey, info.vOrigPubkey, info.name, info.description, oprets) != 'c')
+            return;
+        info.nHeight = nHeight;
+        info.nSupply = nSupply;
+        GetOpretBlob(oprets, OPRETID_NONFUNGIBLEDATA, info.vNonfungibleData);
+        vTokens.push_back(std::make_pair(txhash, info));
+    }
+}
+
+bool IsTokenIndexAvailable()
+{
+    return fCCIndex && !IsIndexBuilding(INDEX_BUILD_CC);
+}
+
+bool GetTokenUnspents(const uint256& tokenid, const char* coinaddr, std::vector<std::pair<CTokenUnspentKey, CAddressUnspentValue> >& unspents)
+{
+    if (!IsTokenIndexAvailable())
+        return false;
+
+    uint160 addressHash;
+    if (coinaddr != NULL) {
+        int type = 0;
+        if (!CBitcoinAddress(std::string(coinaddr)).GetIndexKey(addressHash, type, true))
+            return error("%s: invalid address %s", __func__, coinaddr);
+    }
+    if (!pblocktree->ReadTokenUnspentIndex(tokenid, coinaddr != NULL ? &addressHash : NULL, unspents))
+        return error("unable to get token unspent outputs");
+
+    return true;
+}
+
+bool GetTokenIndexInfo(const uint256& tokenid, CTokenIndexInfo& info)
+{
+    if (!IsTokenIndexAvailable())
+        return false;
+    return pblocktree->ReadTokenInfo(tokenid, info);
+}
+
+bool GetTokenIds(std::vector<uint256>& vTokenIds)
+{
+    if (!IsTokenIndexAvailable())
+        return false;
+    if (!pblocktree->ReadTokenIds(vTokenIds))
+        return error("unable to get the token ids");
+    return true;
+}
+
+void AddOracleDataIndex(const CTransaction& tx, int nHeight, int nTxIndex, std::vector<std::pair<COracleDataKey, COracleDataValue> >& vData)
+{
+    std::vector<unsigned char> vopret;
+    if (tx.vout.size() < 3 || !GetOpReturnData(tx.vout.back().scriptPubKey, vopret) || vopret.size() < 2 || vopret[0] != EVAL_ORACLES || vopret[1] != 'D')
+        return;
+
+    // The baton is the marker output that the next data transaction spends
+    uint256 oracletxid;
+    CPubKey pk;
+    COracleDataValue value;
+    uint160 batonHash;
+    if (tx.vout[1].nValue != ORACLES_BATON_VALUE || !GetCCAddressHash(tx.vout[1].scriptPubKey, batonHash))
+        return;
+    if (DecodeOraclesData(tx.vout.back().scriptPubKey, oracletxid, value.prevbatontxid, pk, value.data) != 'D')
+        return;
+    vData.push_back(std::make_pair(COracleDataKey(oracletxid, batonHash, nHeight, nTxIndex, tx.GetHash()), value));
+}
+
+bool GetOracleDataSamples(const uint256& oracletxid, const char* batonaddr, int nMax, std::vector<std::pair<COracleDataKey, COracleDataValue> >& vData)
+{
+    if (!fCCIndex || IsIndexBuilding(INDEX_BUILD_CC))
+        return false;
+
+    uint160 batonHash;
+    int type = 0;
+    if (!CBitcoinAddress(std::string(batonaddr)).GetIndexKey(batonHash, type, true))
+        return error("%s: invalid address %s", __func__, batonaddr);
+    if (!pblocktree->ReadOracleDataIndex(oracletxid, batonHash, nMax, vData))
+        return error("unable to get oracle data");
+
+    return true;
+}
+
+void AddGatewaysIndex(const CTransaction& tx, int nHeight, std::vector<std::pair<CGatewaysIndexKey, CAddressUnspentValue> >& vEntries)
+{
+    if (tx.vout.size() < 2 || tx.vout[0].nValue != GATEWAYS_MARKER_VALUE || !tx.vout[0].scriptPubKey.IsPayToCryptoCondition())
+        return;
+
+    const CScript& opret = tx.vout.back().scriptPubKey;
+    uint8_t funcid = DecodeGatewaysOpRet(opret);
+    uint256 refid, tokenid, cointxid;
+    std::string refcoin, hex;
+    CPubKey pk;
+    int64_t amount;
+    uint8_t K;
+    switch (funcid) {
+    case 'D': {
+        std::vector<CPubKey> publishers;
+        std::vector<uint256> txids;
+        int32_t height, claimvout;
+        std::vector<uint8_t> proof;
+        if (DecodeGatewaysDepositOpRet(opret, refid, refcoin, publishers, txids, height, cointxid, claimvout, hex, proof, pk, amount) != 'D')
+            return;
+        break;
+    }
+    case 'W':
+        if (DecodeGatewaysWithdrawOpRet(opret, tokenid, refid, refcoin, pk, amount) != 'W')
+            return;
+        break;
+    case 'P':
+        if (DecodeGatewaysPartialOpRet(opret, refid, refcoin, K, pk, hex) != 'P')
+            return;
+        break;
+    case 'S':
+        if (DecodeGatewaysCompleteSigningOpRet(opret, refid, refcoin, K, hex) != 'S')
+            return;
+        break;
+    default:
+        // Binds, claims and mark dones leave no marker
+        return;
+    }
+    vEntries.push_back(std::make_pair(CGatewaysIndexKey(refid, funcid, tx.GetHash()), CAddressUnspentValue(tx.vout[0].nValue, tx.vout[0].scriptPubKey, nHeight)));
+}
+
+bool GetGatewaysEntries(const uint256& refid, uint8_t funcid, bool fPending, std::vector<std::pair<CGatewaysIndexKey, CAddressUnspentValue> >& vEntries)
+{
+    if (!fCCIndex || IsIndexBuilding(INDEX_BUILD_CC))
+        return false;
+
+    std::vector<std::pair<CGatewaysIndexKey, CAddressUnspentValue> > vAll;
+    if (!pblocktree->ReadGatewaysIndex(refid, funcid, vAll))
+        return error("unable to get gateway entries");
+    for (const std::pair<CGatewaysIndexKey, CAddressUnspentValue>& entry : vAll)
+        if (!fPending || pblocktree->IsCCOutputUnspent(COutPoint(entry.first.txhash, 0)))
+            vEntries.push_back(entry);
+
+    return true;
+}
+
+bool GetCCUnspents(uint8_t evalcode, int funcid, const uint256* prefid, std::vector<std::pair<CCCUnspentKey, CAddressUnspentValue> >& unspents)
+{
+    if (!fCCIndex)
+        return error("CC index not enabled");
+    if (IsIndexBuilding(INDEX_BUILD_CC))
+        return error("CC index is still being built");
+
+    if (!pblocktree->ReadCCUnspentIndex(evalcode, funcid, prefid, unspents))
+        return error("unable to get CC unspent outputs");
+
+    return true;
+}
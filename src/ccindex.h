@@ -0,0 +1,237 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CCINDEX_H
+#define BITCOIN_CCINDEX_H
+
+#include "amount.h"
+#include "serialize.h"
+#include "uint256.h"
+
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+class CTransaction;
+struct CAddressUnspentValue;
+
+//! Default for -ccindex
+static const bool DEFAULT_CCINDEX = false;
+
+/** Output a step of a gateway leaves for the next one to spend, by the bind or withdraw it belongs to */
+struct CGatewaysIndexKey
+{
+    //! Bind txid of deposits and withdraws, withdraw txid of the signings
+    uint256 refid;
+    uint8_t funcid;
+    uint256 txhash;
+
+    CGatewaysIndexKey() : funcid(0) {}
+    CGatewaysIndexKey(const uint256& refidIn, uint8_t funcidIn, const uint256& txhashIn) :
+        refid(refidIn), funcid(funcidIn), txhash(txhashIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(refid);
+        READWRITE(funcid);
+        READWRITE(txhash);
+    }
+};
+
+/** Unspent CC output, keyed by the evalcode, funcid and reference of its transaction's opreturn */
+struct CCCUnspentKey
+{
+    uint8_t evalcode;
+    uint8_t funcid;
+    //! Token id for tokens, else the txid following the funcid, or the transaction itself
+    uint256 refid;
+    uint256 txhash;
+    uint32_t index;
+
+    CCCUnspentKey() : evalcode(0), funcid(0), index(0) {}
+    CCCUnspentKey(uint8_t evalcodeIn, uint8_t funcidIn, const uint256& refidIn, const uint256& txhashIn, uint32_t indexIn) :
+        evalcode(evalcodeIn), funcid(funcidIn), refid(refidIn), txhash(txhashIn), index(indexIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(evalcode);
+        READWRITE(funcid);
+        READWRITE(refid);
+        READWRITE(txhash);
+        READWRITE(index);
+    }
+};
+
+/** Unspent output of a token, keyed by the CC address that holds it */
+struct CTokenUnspentKey
+{
+    uint256 tokenid;
+    uint160 addressHash;
+    uint256 txhash;
+    uint32_t index;
+
+    CTokenUnspentKey() : index(0) {}
+    CTokenUnspentKey(const uint256& tokenidIn, const uint160& addressHashIn, const uint256& txhashIn, uint32_t indexIn) :
+        tokenid(tokenidIn), addressHash(addressHashIn), txhash(txhashIn), index(indexIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(tokenid);
+        READWRITE(addressHash);
+        READWRITE(txhash);
+        READWRITE(index);
+    }
+};
+
+/** What the creation transaction of a token says about it */
+struct CTokenIndexInfo
+{
+    int nHeight;
+    std::vector<uint8_t> vOrigPubkey;
+    std::string name;
+    std::string description;
+    //! Sum of the valid token outputs of the creation
+    CAmount nSupply;
+    std::vector<uint8_t> vNonfungibleData;
+
+    CTokenIndexInfo() : nHeight(0), nSupply(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(nHeight);
+        READWRITE(vOrigPubkey);
+        READWRITE(name);
+        READWRITE(description);
+        READWRITE(nSupply);
+        READWRITE(vNonfungibleData);
+    }
+};
+
+/** Data transaction of an oracle publisher, by the address of its baton and its position in the chain */
+struct COracleDataKey
+{
+    uint256 oracletxid;
+    uint160 batonHash;
+    int blockHeight;
+    unsigned int txindex;
+    uint256 txhash;
+
+    COracleDataKey() : blockHeight(0), txindex(0) {}
+    COracleDataKey(const uint256& oracletxidIn, const uint160& batonHashIn, int blockHeightIn, unsigned int txindexIn, const uint256& txhashIn) :
+        oracletxid(oracletxidIn), batonHash(batonHashIn), blockHeight(blockHeightIn), txindex(txindexIn), txhash(txhashIn) {}
+
+    size_t GetSerializeSize(int nType, int nVersion) const {
+        return 32 + 20 + 4 + 4 + 32;
+    }
+    template<typename Stream>
+    void Serialize(Stream& s) const {
+        oracletxid.Serialize(s);
+        batonHash.Serialize(s);
+        // Heights are stored big-endian for key sorting in LevelDB
+        ser_writedata32be(s, blockHeight);
+        ser_writedata32be(s, txindex);
+        txhash.Serialize(s);
+    }
+    template<typename Stream>
+    void Unserialize(Stream& s) {
+        oracletxid.Unserialize(s);
+        batonHash.Unserialize(s);
+        blockHeight = ser_readdata32be(s);
+        txindex = ser_readdata32be(s);
+        txhash.Unserialize(s);
+    }
+};
+
+/** The data a publisher posted, and the baton it spent */
+struct COracleDataValue
+{
+    uint256 prevbatontxid;
+    std::vector<uint8_t> data;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(prevbatontxid);
+        READWRITE(data);
+    }
+};
+
+/**
+ * With -ccindex the unspent CC outputs are also kept by the evalcode, funcid
+ * and reference id read from the opreturn of the transaction that created
+ * them, so a module asks for the outputs of one token or one oracle instead
+ * of reading every output on its CC address and decoding each opreturn.
+ *
+ * An output is indexed when it pays to a crypto condition and the last
+ * output of its transaction is an opreturn. Tokens opreturns are decoded
+ * with DecodeTokenOpRet and give the token id; the others give the 32 bytes
+ * after the funcid, the transaction's own txid when the opreturn is shorter.
+ * A secondary entry per outpoint, kept until the block that created it is
+ * disconnected, finds the key of a spent output and of one to restore.
+ */
+extern bool fCCIndex;
+
+//! Appends the indexed outputs of tx to vCreated
+void AddCCIndexOutputs(const CTransaction& tx, int nHeight, std::vector<std::pair<CCCUnspentKey, CAddressUnspentValue> >& vCreated);
+
+//! Unspent outputs with evalcode; funcid < 0 and prefid NULL match any funcid and reference
+bool GetCCUnspents(uint8_t evalcode, int funcid, const uint256* prefid, std::vector<std::pair<CCCUnspentKey, CAddressUnspentValue> >& unspents);
+
+/**
+ * The CC index also keeps the token outputs that IsTokensvout, going one
+ * transaction deeper, finds valid, by token id and holding address, and one
+ * record per token from its creation. Whether an output is a valid token
+ * only depends on its transaction and the ones it spends, so it is decided
+ * once when the block is connected instead of on every balance query.
+ */
+
+//! Appends the valid token outputs of tx, and the token it creates. Requires cs_main, and the transactions it spends in the tx index.
+void AddTokenIndexOutputs(const CTransaction& tx, int nHeight, std::vector<std::pair<CTokenUnspentKey, CAddressUnspentValue> >& vCreated,
+                          std::vector<std::pair<uint256, CTokenIndexInfo> >& vTokens);
+
+//! Whether the token entries can be used, else the callers scan the token CC addresses
+bool IsTokenIndexAvailable();
+//! Unspent outputs of tokenid, only those held by coinaddr unless it is NULL
+bool GetTokenUnspents(const uint256& tokenid, const char* coinaddr, std::vector<std::pair<CTokenUnspentKey, CAddressUnspentValue> >& unspents);
+//! Record of tokenid, false if it is not a token
+bool GetTokenIndexInfo(const uint256& tokenid, CTokenIndexInfo& info);
+//! Ids of all tokens
+bool GetTokenIds(std::vector<uint256>& vTokenIds);
+
+/**
+ * The CC index also keeps every oracle data transaction confirmed on the
+ * chain of a publisher's batons, so sampling the data of an oracle is a
+ * range read of the entries under its baton address instead of one
+ * transaction read per hop back along the chain.
+ */
+
+//! Appends the entry of tx when it is an oracle data transaction, nTxIndex is its position in the block
+void AddOracleDataIndex(const CTransaction& tx, int nHeight, int nTxIndex, std::vector<std::pair<COracleDataKey, COracleDataValue> >& vData);
+//! Data posted on batonaddr for oracletxid, the most recent first and at most nMax unless it is 0; false without the index
+bool GetOracleDataSamples(const uint256& oracletxid, const char* batonaddr, int nMax, std::vector<std::pair<COracleDataKey, COracleDataValue> >& vData);
+
+/**
+ * The CC index also keeps the deposits, withdraws and the partial and
+ * complete signings of withdraws of every gateway. Each leaves a marker in
+ * its first output that the next step spends, a claim that of a deposit and
+ * a mark done that of a complete signing, so a step is pending while its
+ * marker is in the CC unspent entries.
+ */
+
+//! Appends the entry of tx when it is a step of a gateway
+void AddGatewaysIndex(const CTransaction& tx, int nHeight, std::vector<std::pair<CGatewaysIndexKey, CAddressUnspentValue> >& vEntries);
+//! Steps with funcid of refid, only those whose marker is unspent when fPending; false without the index
+bool GetGatewaysEntries(const uint256& refid, uint8_t funcid, bool fPending, std::vector<std::pair<CGatewaysIndexKey, CAddressUnspentValue> >& vEntries);
+
+#endif // BITCOIN_CCINDEX_H
@@ -20,6 +20,9 @@
 
 #include "chain.h"
 
+#include "main.h"
+#include "txdb.h"
+
 using namespace std;
 
 /**
@@ -177,3 +180,45 @@ void CBlockIndex::BuildSkip()
     if (pprev)
         pskip = pprev->GetAncestor(GetSkipHeight(GetHeight()));
 }
+
+bool CBlockIndex::HasValidSkip() const
+{
+    if (pprev == NULL)
+        return pskip == NULL;
+    return pskip != NULL && pskip == pprev->GetAncestor(GetSkipHeight(GetHeight()));
+}
+
+//! Guards nSolution and fSolutionTrimmed, which getblockheader reads without cs_main
+static CCriticalSection cs_blockSolution;
+
+void CBlockIndex::TrimSolution()
+{
+    if (ASSETCHAINS_LWMAPOS != 0)
+        return;
+    // Freed once out of the lock, readers copy the solution under it
+    std::vector<unsigned char> vTrimmed;
+    LOCK(cs_blockSolution);
+    if (fSolutionTrimmed)
+        return;
+    vTrimmed.swap(nSolution);
+    fSolutionTrimmed = true;
+}
+
+bool CBlockIndex::HasSolution() const
+{
+    LOCK(cs_blockSolution);
+    return !fSolutionTrimmed;
+}
+
+std::vector<unsigned char> CBlockIndex::GetSolution() const
+{
+    {
+        LOCK(cs_blockSolution);
+        if (!fSolutionTrimmed)
+            return nSolution;
+    }
+    CDiskBlockIndex dbindex;
+    if (pblocktree == NULL || !pblocktree->ReadDiskBlockIndex(GetBlockHash(), dbindex))
+        throw std::runtime_error(strprintf("%s: failed to read the solution of block %s", __func__, GetBlockHash().ToString()));
+    return dbindex.nSolution;
+}
@@ -29,6 +29,8 @@ class CChainPower;
 #include "tinyformat.h"
 #include "uint256.h"
 
+#include <iterator>
+#include <memory>
 #include <vector>
 
 #include <boost/foreach.hpp>
@@ -305,8 +307,12 @@ public:
     unsigned int nTime;
     unsigned int nBits;
     uint256 nNonce;
+    //! Empty once trimmed, see TrimSolution
     std::vector<unsigned char> nSolution;
 
+    //! (memory only) The solution was dropped, and is read from the block tree db
+    bool fSolutionTrimmed;
+
     //! (memory only) Sequential id assigned to distinguish order in which blocks are received.
     uint32_t nSequenceId;
     
@@ -341,6 +347,7 @@ public:
         nBits          = 0;
         nNonce         = uint256();
         nSolution.clear();
+        fSolutionTrimmed = false;
     }
 
     CBlockIndex()
@@ -400,10 +407,22 @@ public:
         block.nTime          = nTime;
         block.nBits          = nBits;
         block.nNonce         = nNonce;
-        block.nSolution      = nSolution;
+        block.nSolution      = GetSolution();
         return block;
     }
 
+    /**
+     * The Equihash solution is most of the size of an entry, and is only
+     * needed to serve or check the header again. Once the entry is in the
+     * block tree db it is dropped, and read back from there by GetSolution.
+     * Kept on chains with LWMAPOS, whose difficulty reads past headers.
+     * These take a lock of their own, so the solution can be read without
+     * cs_main; trimming itself is done under cs_main.
+     */
+    void TrimSolution();
+    bool HasSolution() const;
+    std::vector<unsigned char> GetSolution() const;
+
     uint256 GetBlockHash() const
     {
         return *phashBlock;
@@ -463,6 +482,8 @@ public:
 
     //! Build the skiplist pointer for this entry.
     void BuildSkip();
+    //! Whether pskip is the entry BuildSkip sets, which GetAncestor needs to stay O(log n)
+    bool HasValidSkip() const;
 
     //! Efficiently find an ancestor of this block.
     CBlockIndex* GetAncestor(int height);
@@ -481,6 +502,62 @@ public:
     }
 };
 
+/**
+ * Owns the entries of mapBlockIndex. They are allocated in chunks, so loading
+ * a large index does not go through the allocator once per block, and entries
+ * are only freed all at once by Clear. Not thread safe: threads loading the
+ * index fill arenas of their own, which are then spliced into the shared one.
+ */
+class CBlockIndexArena
+{
+private:
+    struct Chunk {
+        std::unique_ptr<CBlockIndex[]> entries;
+        size_t nSize;
+        size_t nUsed;
+    };
+
+    std::vector<Chunk> vChunks;
+
+public:
+    static const size_t DEFAULT_CHUNK_SIZE = 1024;
+
+    //! Makes room for n more entries in a single chunk
+    void Reserve(size_t n)
+    {
+        if (!vChunks.empty() && vChunks.back().nSize - vChunks.back().nUsed >= n)
+            return;
+        Chunk chunk;
+        chunk.entries.reset(new CBlockIndex[n]);
+        chunk.nSize = n;
+        chunk.nUsed = 0;
+        vChunks.push_back(std::move(chunk));
+    }
+
+    //! Returns a null entry that lives until Clear
+    CBlockIndex* Allocate()
+    {
+        if (vChunks.empty() || vChunks.back().nUsed == vChunks.back().nSize)
+            Reserve(DEFAULT_CHUNK_SIZE);
+        Chunk& chunk = vChunks.back();
+        return &chunk.entries[chunk.nUsed++];
+    }
+
+    //! Takes over the entries of other, which is left empty
+    void Splice(CBlockIndexArena& other)
+    {
+        // Our last chunk stays last, so Allocate keeps filling it
+        std::vector<Chunk>::iterator pos = vChunks.empty() ? vChunks.end() : vChunks.end() - 1;
+        vChunks.insert(pos, std::make_move_iterator(other.vChunks.begin()), std::make_move_iterator(other.vChunks.end()));
+        other.vChunks.clear();
+    }
+
+    void Clear()
+    {
+        vChunks.clear();
+    }
+};
+
 /** Used to marshal pointers into hashes for db storage. */
 class CDiskBlockIndex : public CBlockIndex
 {
@@ -493,6 +570,10 @@ public:
 
     explicit CDiskBlockIndex(const CBlockIndex* pindex) : CBlockIndex(*pindex) {
         hashPrev = (pprev ? pprev->GetBlockHash() : uint256());
+        if (!pindex->HasSolution()) {
+            nSolution = pindex->GetSolution();
+            fSolutionTrimmed = false;
+        }
     }
 
     ADD_SERIALIZE_METHODS;
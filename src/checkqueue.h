@@ -21,9 +21,12 @@
 #define BITCOIN_CHECKQUEUE_H
 
 #include <algorithm>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <utility>
 #include <vector>
 
-#include <boost/foreach.hpp>
 #include <boost/thread/condition_variable.hpp>
 #include <boost/thread/locks.hpp>
 #include <boost/thread/mutex.hpp>
@@ -31,21 +34,43 @@
 template <typename T>
 class CCheckQueueControl;
 
+//! Default number of worker threads a queue keeps a deque for, more of them share the deques
+static const unsigned int DEFAULT_CHECKQUEUE_WORKERS = 16;
+
 /** 
  * Queue for verifications that have to be performed.
   * The verifications are represented by a type T, which must provide an
-  * operator(), returning a bool.
+  * operator(), returning a bool, and a GetCost() weighing how long it takes
+  * against the other verifications of its type, at least 1.
   *
   * One thread (the master) is assumed to push batches of verifications
   * onto the queue, where they are processed by N-1 worker threads. When
   * the master is done adding work, it temporarily joins the worker pool
   * as an N'th worker, until all jobs are done.
+  *
+  * Each worker, and the master, has its own deque of verifications, so they
+  * don't all contend for one lock. A batch is spread over the deques from its
+  * most expensive verification down, each to the deque that was given the
+  * least cost, and a worker takes from the front of its own deque, so the
+  * expensive verifications are started first and on different threads. A
+  * worker whose deque is empty steals from the back of the others, starting
+  * with its neighbour.
   */
 template <typename T>
 class CCheckQueue
 {
 private:
-    //! Mutex to protect the inner state
+    //! Verifications of one worker, with their total cost
+    struct WorkerQueue
+    {
+        boost::mutex mutex;
+        std::deque<T> checks;
+        unsigned int nCost;
+
+        WorkerQueue() : nCost(0) {}
+    };
+
+    //! Mutex the workers and the master wait on
     boost::mutex mutex;
 
     //! Worker threads block on this when out of work
@@ -54,96 +79,128 @@ private:
     //! Master thread blocks on this when out of work
     boost::condition_variable condMaster;
 
-    //! The queue of elements to be processed.
-    //! As the order of booleans doesn't matter, it is used as a LIFO (stack)
-    std::vector<T> queue;
+    //! The deque of the master first, then those of the workers
+    std::vector<std::unique_ptr<WorkerQueue>> queues;
 
-    //! The number of workers (including the master) that are idle.
-    int nIdle;
-
-    //! The total number of workers (including the master).
-    int nTotal;
+    //! The number of worker threads that took a deque
+    std::atomic<unsigned int> nWorkers;
 
     //! The temporary evaluation result.
-    bool fAllOk;
+    std::atomic<bool> fAllOk;
 
     /**
      * Number of verifications that haven't completed yet.
      * This includes elements that are no longer queued, but still in the
      * worker's own batches.
      */
-    unsigned int nTodo;
+    std::atomic<unsigned int> nTodo;
+
+    //! Number of verifications still in the deques, counted before they are pushed and after they are taken
+    std::atomic<int> nQueued;
 
     //! Whether we're shutting down.
     bool fQuit;
 
-    //! The maximum number of elements to be processed in one batch
+    //! The maximum cost of the verifications processed in one batch
     unsigned int nBatchSize;
 
+    //! Deque the ties of the next batch go to first, so single verifications are spread too
+    unsigned int nNextQueue;
+
+    //! The deques in use: the master's and one for each worker thread, up to their number
+    unsigned int QueuesInUse() const
+    {
+        return std::min<unsigned int>(nWorkers + 1, queues.size());
+    }
+
+    /**
+     * Moves a batch to vChecks from the deque of the worker, or else from the
+     * first other deque with work. At most half the cost left in the deque is
+     * taken, so the batches get smaller as the work runs out and the rest can
+     * be stolen, but never less than one verification or more than
+     * nBatchSize. Returns the number of verifications taken.
+     */
+    unsigned int Take(unsigned int nSelf, std::vector<T>& vChecks)
+    {
+        const unsigned int nQueues = QueuesInUse();
+        for (unsigned int i = 0; i < nQueues && nQueued > 0; i++) {
+            WorkerQueue& queue = *queues[(nSelf + i) % nQueues];
+            const bool fOwn = i == 0;
+            boost::unique_lock<boost::mutex> lock(queue.mutex);
+            if (queue.checks.empty())
+                continue;
+            const unsigned int nBudget = std::max(1U, std::min(nBatchSize, queue.nCost / 2));
+            unsigned int nCost = 0;
+            while (!queue.checks.empty()) {
+                T& check = fOwn ? queue.checks.front() : queue.checks.back();
+                const unsigned int nCheckCost = check.GetCost();
+                if (!vChecks.empty() && nCost + nCheckCost > nBudget)
+                    break;
+                vChecks.push_back(T());
+                check.swap(vChecks.back());
+                if (fOwn)
+                    queue.checks.pop_front();
+                else
+                    queue.checks.pop_back();
+                nCost += nCheckCost;
+                queue.nCost -= nCheckCost;
+            }
+            nQueued -= vChecks.size();
+            return vChecks.size();
+        }
+        return 0;
+    }
+
     /** Internal function that does bulk of the verification work. */
     bool Loop(bool fMaster = false)
     {
         boost::condition_variable& cond = fMaster ? condMaster : condWorker;
         std::vector<T> vChecks;
         vChecks.reserve(nBatchSize);
-        unsigned int nNow = 0;
-        bool fOk = true;
+        const unsigned int nSelf = fMaster ? 0 : 1 + nWorkers++ % (queues.size() - 1);
         do {
-            {
+            if (Take(nSelf, vChecks) == 0) {
                 boost::unique_lock<boost::mutex> lock(mutex);
-                // first do the clean-up of the previous loop run (allowing us to do it in the same critsect)
-                if (nNow) {
-                    fAllOk &= fOk;
-                    nTodo -= nNow;
-                    if (nTodo == 0 && !fMaster)
-                        // We processed the last element; inform the master it can exit and return the result
-                        condMaster.notify_one();
-                } else {
-                    // first iteration
-                    nTotal++;
-                }
-                // logically, the do loop starts here
-                while (queue.empty()) {
-                    if ((fMaster || fQuit) && nTodo == 0) {
-                        nTotal--;
-                        bool fRet = fAllOk;
-                        // reset the status for new work later
-                        if (fMaster)
-                            fAllOk = true;
-                        // return the current status
-                        return fRet;
-                    }
-                    nIdle++;
-                    cond.wait(lock); // wait
-                    nIdle--;
+                // Checks being pushed or taken elsewhere, look again
+                if (nQueued > 0)
+                    continue;
+                if ((fMaster || fQuit) && nTodo == 0) {
+                    bool fRet = fAllOk;
+                    // reset the status for new work later
+                    if (fMaster)
+                        fAllOk = true;
+                    // return the current status
+                    return fRet;
                 }
-                // Decide how many work units to process now.
-                // * Do not try to do everything at once, but aim for increasingly smaller batches so
-                //   all workers finish approximately simultaneously.
-                // * Try to account for idle jobs which will instantly start helping.
-                // * Don't do batches smaller than 1 (duh), or larger than nBatchSize.
-                nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.size() / (nTotal + nIdle + 1)));
-                vChecks.resize(nNow);
-                for (unsigned int i = 0; i < nNow; i++) {
-                    // We want the lock on the mutex to be as short as possible, so swap jobs from the global
-                    // queue to the local batch vector instead of copying.
-                    vChecks[i].swap(queue.back());
-                    queue.pop_back();
-                }
-                // Check whether we need to do work at all
-                fOk = fAllOk;
+                cond.wait(lock); // wait
+                continue;
             }
+            // Check whether we need to do work at all
+            bool fOk = fAllOk;
             // execute work
-            BOOST_FOREACH (T& check, vChecks)
+            for (T& check : vChecks)
                 if (fOk)
                     fOk = check();
+            if (!fOk)
+                fAllOk = false;
+            const unsigned int nNow = vChecks.size();
             vChecks.clear();
+            if ((nTodo -= nNow) == 0 && !fMaster) {
+                // We processed the last element; inform the master it can exit and return the result
+                boost::unique_lock<boost::mutex> lock(mutex);
+                condMaster.notify_one();
+            }
         } while (true);
     }
 
 public:
     //! Create a new check queue
-    CCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), fQuit(false), nBatchSize(nBatchSizeIn) {}
+    CCheckQueue(unsigned int nBatchSizeIn, unsigned int nMaxWorkers = DEFAULT_CHECKQUEUE_WORKERS) :
+        nWorkers(0), fAllOk(true), nTodo(0), nQueued(0), fQuit(false), nBatchSize(nBatchSizeIn), nNextQueue(0)
+    {
+        for (unsigned int i = 0; i < std::max(1U, nMaxWorkers) + 1; i++)
+            queues.push_back(std::unique_ptr<WorkerQueue>(new WorkerQueue()));
+    }
 
     //! Worker thread
     void Thread()
@@ -160,15 +217,50 @@ public:
     //! Add a batch of checks to the queue
     void Add(std::vector<T>& vChecks)
     {
-        boost::unique_lock<boost::mutex> lock(mutex);
-        BOOST_FOREACH (T& check, vChecks) {
-            queue.push_back(T());
-            check.swap(queue.back());
+        if (vChecks.empty())
+            return;
+        const unsigned int nQueues = QueuesInUse();
+        std::vector<std::pair<unsigned int, size_t>> vOrder;
+        vOrder.reserve(vChecks.size());
+        for (size_t i = 0; i < vChecks.size(); i++)
+            vOrder.push_back(std::make_pair(vChecks[i].GetCost(), i));
+        std::stable_sort(vOrder.begin(), vOrder.end(), [](const std::pair<unsigned int, size_t>& a, const std::pair<unsigned int, size_t>& b) {
+            return a.first > b.first;
+        });
+
+        // Each check goes to the deque given the least cost of this batch so far
+        std::vector<unsigned int> vCost(nQueues, 0);
+        std::vector<std::vector<size_t>> vAssigned(nQueues);
+        for (const std::pair<unsigned int, size_t>& order : vOrder) {
+            unsigned int nBest = nNextQueue % nQueues;
+            for (unsigned int i = 1; i < nQueues; i++) {
+                const unsigned int q = (nNextQueue + i) % nQueues;
+                if (vCost[q] < vCost[nBest])
+                    nBest = q;
+            }
+            vCost[nBest] += order.first;
+            vAssigned[nBest].push_back(order.second);
         }
+        nNextQueue += vChecks.size();
+
         nTodo += vChecks.size();
+        nQueued += vChecks.size();
+        for (unsigned int q = 0; q < nQueues; q++) {
+            if (vAssigned[q].empty())
+                continue;
+            WorkerQueue& queue = *queues[q];
+            boost::unique_lock<boost::mutex> lock(queue.mutex);
+            for (size_t i : vAssigned[q]) {
+                queue.checks.push_back(T());
+                vChecks[i].swap(queue.checks.back());
+            }
+            queue.nCost += vCost[q];
+        }
+
+        boost::unique_lock<boost::mutex> lock(mutex);
         if (vChecks.size() == 1)
             condWorker.notify_one();
-        else if (vChecks.size() > 1)
+        else
             condWorker.notify_all();
     }
 
@@ -176,10 +268,10 @@ public:
     {
     }
 
+    //! Whether no verification is left, a worker that took the last ones may still be on its way to wait
     bool IsIdle()
     {
-        boost::unique_lock<boost::mutex> lock(mutex);
-        return (nTotal == nIdle && nTodo == 0 && fAllOk == true);
+        return (nTodo == 0 && nQueued == 0 && fAllOk == true);
     }
 
 };
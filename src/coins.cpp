@@ -21,6 +21,7 @@
 
 #include "memusage.h"
 #include "random.h"
+#include "util.h"
 #include "version.h"
 #include "policy/fees.h"
 #include "komodo_defs.h"
@@ -61,6 +62,13 @@ bool CCoins::Spend(uint32_t nPos)
 }
 bool CCoinsView::GetSproutAnchorAt(const uint256 &rt, SproutMerkleTree &tree) const { return false; }
 bool CCoinsView::GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree) const { return false; }
+std::shared_ptr<const SaplingMerkleTree> CCoinsView::GetSharedSaplingAnchorAt(const uint256 &rt) const
+{
+    std::shared_ptr<SaplingMerkleTree> tree = std::make_shared<SaplingMerkleTree>();
+    if (!GetSaplingAnchorAt(rt, *tree))
+        return nullptr;
+    return tree;
+}
 bool CCoinsView::GetNullifier(const uint256 &nullifier, ShieldedType type) const { return false; }
 bool CCoinsView::GetCoins(const uint256 &txid, CCoins &coins) const { return false; }
 bool CCoinsView::HaveCoins(const uint256 &txid) const { return false; }
@@ -75,12 +83,14 @@ bool CCoinsView::BatchWrite(CCoinsMap &mapCoins,
                             CNullifiersMap &mapSproutNullifiers,
                             CNullifiersMap &mapSaplingNullifiers) { return false; }
 bool CCoinsView::GetStats(CCoinsStats &stats) const { return false; }
+bool CCoinsView::WriteSnapshot(CAutoFile &file, CCoinsSnapshotMetadata &metadata, uint256 &hashChecksum) const { return false; }
 
 
 CCoinsViewBacked::CCoinsViewBacked(CCoinsView *viewIn) : base(viewIn) { }
 
 bool CCoinsViewBacked::GetSproutAnchorAt(const uint256 &rt, SproutMerkleTree &tree) const { return base->GetSproutAnchorAt(rt, tree); }
 bool CCoinsViewBacked::GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree) const { return base->GetSaplingAnchorAt(rt, tree); }
+std::shared_ptr<const SaplingMerkleTree> CCoinsViewBacked::GetSharedSaplingAnchorAt(const uint256 &rt) const { return base->GetSharedSaplingAnchorAt(rt); }
 bool CCoinsViewBacked::GetNullifier(const uint256 &nullifier, ShieldedType type) const { return base->GetNullifier(nullifier, type); }
 bool CCoinsViewBacked::GetCoins(const uint256 &txid, CCoins &coins) const { return base->GetCoins(txid, coins); }
 bool CCoinsViewBacked::HaveCoins(const uint256 &txid) const { return base->HaveCoins(txid); }
@@ -96,10 +106,17 @@ bool CCoinsViewBacked::BatchWrite(CCoinsMap &mapCoins,
                                   CNullifiersMap &mapSproutNullifiers,
                                   CNullifiersMap &mapSaplingNullifiers) { return base->BatchWrite(mapCoins, hashBlock, hashSproutAnchor, hashSaplingAnchor, mapSproutAnchors, mapSaplingAnchors, mapSproutNullifiers, mapSaplingNullifiers); }
 bool CCoinsViewBacked::GetStats(CCoinsStats &stats) const { return base->GetStats(stats); }
+bool CCoinsViewBacked::WriteSnapshot(CAutoFile &file, CCoinsSnapshotMetadata &metadata, uint256 &hashChecksum) const { return base->WriteSnapshot(file, metadata, hashChecksum); }
 
 CCoinsKeyHasher::CCoinsKeyHasher() : salt(GetRandHash()) {}
 
-CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn), hasModifier(false), cachedCoinsUsage(0) { }
+CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn), hasModifier(false),
+    cacheCoins(0, CCoinsKeyHasher(), CCoinsMap::key_equal(), CCoinsMap::allocator_type(&cachePool)),
+    cacheSproutAnchors(0, CCoinsKeyHasher(), CAnchorsSproutMap::key_equal(), CAnchorsSproutMap::allocator_type(&cachePool)),
+    cacheSaplingAnchors(0, CCoinsKeyHasher(), CAnchorsSaplingMap::key_equal(), CAnchorsSaplingMap::allocator_type(&cachePool)),
+    cacheSproutNullifiers(0, CCoinsKeyHasher(), CNullifiersMap::key_equal(), CNullifiersMap::allocator_type(&cachePool)),
+    cacheSaplingNullifiers(0, CCoinsKeyHasher(), CNullifiersMap::key_equal(), CNullifiersMap::allocator_type(&cachePool)),
+    cachedCoinsUsage(0) { }
 
 CCoinsViewCache::~CCoinsViewCache()
 {
@@ -107,12 +124,8 @@ CCoinsViewCache::~CCoinsViewCache()
 }
 
 size_t CCoinsViewCache::DynamicMemoryUsage() const {
-    return memusage::DynamicUsage(cacheCoins) +
-           memusage::DynamicUsage(cacheSproutAnchors) +
-           memusage::DynamicUsage(cacheSaplingAnchors) +
-           memusage::DynamicUsage(cacheSproutNullifiers) +
-           memusage::DynamicUsage(cacheSaplingNullifiers) +
-           cachedCoinsUsage;
+    // The pool holds every node and bucket array of the cache maps
+    return cachePool.DynamicMemoryUsage() + cachedCoinsUsage;
 }
 
 CCoinsMap::const_iterator CCoinsViewCache::FetchCoins(const uint256 &txid) const {
@@ -180,6 +193,19 @@ bool CCoinsViewCache::GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &t
     return true;
 }
 
+std::shared_ptr<const SaplingMerkleTree> CCoinsViewCache::GetSharedSaplingAnchorAt(const uint256 &rt) const {
+    CAnchorsSaplingMap::const_iterator it = cacheSaplingAnchors.find(rt);
+    if (it != cacheSaplingAnchors.end()) {
+        if (it->second.entered) {
+            return std::make_shared<SaplingMerkleTree>(it->second.tree);
+        } else {
+            return nullptr;
+        }
+    }
+
+    return base->GetSharedSaplingAnchorAt(rt);
+}
+
 bool CCoinsViewCache::GetNullifier(const uint256 &nullifier, ShieldedType type) const {
     CNullifiersMap* cacheToUse;
     switch (type) {
@@ -551,9 +577,43 @@ bool CCoinsViewCache::Flush() {
     cacheSproutNullifiers.clear();
     cacheSaplingNullifiers.clear();
     cachedCoinsUsage = 0;
+    ReallocateCache();
     return fOk;
 }
 
+void CCoinsViewCache::VisitChanges(const std::function<void(const uint256&, const CCoins&, const CCoins&)>& visit) const {
+    CCoins coinsBase;
+    for (CCoinsMap::const_iterator it = cacheCoins.begin(); it != cacheCoins.end(); ++it) {
+        if (!(it->second.flags & CCoinsCacheEntry::DIRTY))
+            continue;
+        if (!base->GetCoins(it->first, coinsBase))
+            coinsBase.Clear();
+        visit(it->first, coinsBase, it->second.coins);
+    }
+}
+
+void CCoinsViewCache::ReallocateCache()
+{
+    assert(!hasModifier);
+    assert(cacheCoins.empty() && cacheSproutAnchors.empty() && cacheSaplingAnchors.empty() &&
+           cacheSproutNullifiers.empty() && cacheSaplingNullifiers.empty());
+
+    // The maps still hold their bucket arrays, so they go before the pool does
+    cacheCoins.~CCoinsMap();
+    cacheSproutAnchors.~CAnchorsSproutMap();
+    cacheSaplingAnchors.~CAnchorsSaplingMap();
+    cacheSproutNullifiers.~CNullifiersMap();
+    cacheSaplingNullifiers.~CNullifiersMap();
+    cachePool.~PoolResource();
+
+    ::new (&cachePool) PoolResource();
+    ::new (&cacheCoins) CCoinsMap(0, CCoinsKeyHasher(), CCoinsMap::key_equal(), CCoinsMap::allocator_type(&cachePool));
+    ::new (&cacheSproutAnchors) CAnchorsSproutMap(0, CCoinsKeyHasher(), CAnchorsSproutMap::key_equal(), CAnchorsSproutMap::allocator_type(&cachePool));
+    ::new (&cacheSaplingAnchors) CAnchorsSaplingMap(0, CCoinsKeyHasher(), CAnchorsSaplingMap::key_equal(), CAnchorsSaplingMap::allocator_type(&cachePool));
+    ::new (&cacheSproutNullifiers) CNullifiersMap(0, CCoinsKeyHasher(), CNullifiersMap::key_equal(), CNullifiersMap::allocator_type(&cachePool));
+    ::new (&cacheSaplingNullifiers) CNullifiersMap(0, CCoinsKeyHasher(), CNullifiersMap::key_equal(), CNullifiersMap::allocator_type(&cachePool));
+}
+
 unsigned int CCoinsViewCache::GetCacheSize() const {
     return cacheCoins.size();
 }
@@ -739,3 +799,229 @@ CCoinsModifier::~CCoinsModifier()
         cache.cachedCoinsUsage += it->second.coins.DynamicMemoryUsage();
     }
 }
+
+CCoinsViewAsyncFlush::CCoinsViewAsyncFlush(CCoinsView *viewIn) : CCoinsViewBacked(viewIn), fWriting(false), fWriteFailed(false) { }
+
+CCoinsViewAsyncFlush::~CCoinsViewAsyncFlush()
+{
+    Sync();
+}
+
+bool CCoinsViewAsyncFlush::GetSproutAnchorAt(const uint256 &rt, SproutMerkleTree &tree) const {
+    {
+        LOCK(cs);
+        if (fWriting) {
+            CAnchorsSproutMap::const_iterator it = frozenSproutAnchors.find(rt);
+            if (it != frozenSproutAnchors.end()) {
+                if (!it->second.entered)
+                    return false;
+                tree = it->second.tree;
+                return true;
+            }
+        }
+    }
+    return base->GetSproutAnchorAt(rt, tree);
+}
+
+bool CCoinsViewAsyncFlush::GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree) const {
+    {
+        LOCK(cs);
+        if (fWriting) {
+            CAnchorsSaplingMap::const_iterator it = frozenSaplingAnchors.find(rt);
+            if (it != frozenSaplingAnchors.end()) {
+                if (!it->second.entered)
+                    return false;
+                tree = it->second.tree;
+                return true;
+            }
+        }
+    }
+    return base->GetSaplingAnchorAt(rt, tree);
+}
+
+std::shared_ptr<const SaplingMerkleTree> CCoinsViewAsyncFlush::GetSharedSaplingAnchorAt(const uint256 &rt) const {
+    {
+        LOCK(cs);
+        if (fWriting) {
+            CAnchorsSaplingMap::const_iterator it = frozenSaplingAnchors.find(rt);
+            if (it != frozenSaplingAnchors.end()) {
+                if (!it->second.entered)
+                    return nullptr;
+                return std::make_shared<const SaplingMerkleTree>(it->second.tree);
+            }
+        }
+    }
+    return base->GetSharedSaplingAnchorAt(rt);
+}
+
+bool CCoinsViewAsyncFlush::GetNullifier(const uint256 &nullifier, ShieldedType type) const {
+    {
+        LOCK(cs);
+        if (fWriting) {
+            const CNullifiersMap* frozenNullifiers = NULL;
+            switch (type) {
+                case SPROUT:
+                    frozenNullifiers = &frozenSproutNullifiers;
+                    break;
+                case SAPLING:
+                    frozenNullifiers = &frozenSaplingNullifiers;
+                    break;
+                default:
+                    throw std::runtime_error("Unknown shielded type");
+            }
+            CNullifiersMap::const_iterator it = frozenNullifiers->find(nullifier);
+            if (it != frozenNullifiers->end())
+                return it->second.entered;
+        }
+    }
+    return base->GetNullifier(nullifier, type);
+}
+
+bool CCoinsViewAsyncFlush::GetCoins(const uint256 &txid, CCoins &coins) const {
+    {
+        LOCK(cs);
+        if (fWriting) {
+            CCoinsMap::const_iterator it = frozenCoins.find(txid);
+            if (it != frozenCoins.end()) {
+                // Pruned entries are erased from the base view
+                if (it->second.coins.IsPruned())
+                    return false;
+                coins = it->second.coins;
+                return true;
+            }
+        }
+    }
+    return base->GetCoins(txid, coins);
+}
+
+bool CCoinsViewAsyncFlush::HaveCoins(const uint256 &txid) const {
+    {
+        LOCK(cs);
+        if (fWriting) {
+            CCoinsMap::const_iterator it = frozenCoins.find(txid);
+            if (it != frozenCoins.end())
+                return !it->second.coins.IsPruned();
+        }
+    }
+    return base->HaveCoins(txid);
+}
+
+uint256 CCoinsViewAsyncFlush::GetBestBlock() const {
+    {
+        LOCK(cs);
+        if (fWriting && !hashBlock.IsNull())
+            return hashBlock;
+    }
+    return base->GetBestBlock();
+}
+
+uint256 CCoinsViewAsyncFlush::GetBestAnchor(ShieldedType type) const {
+    {
+        LOCK(cs);
+        if (fWriting) {
+            switch (type) {
+                case SPROUT:
+                    if (!hashSproutAnchor.IsNull())
+                        return hashSproutAnchor;
+                    break;
+                case SAPLING:
+                    if (!hashSaplingAnchor.IsNull())
+                        return hashSaplingAnchor;
+                    break;
+                default:
+                    throw std::runtime_error("Unknown shielded type");
+            }
+        }
+    }
+    return base->GetBestAnchor(type);
+}
+
+template<typename Map>
+static void FreezeDirtyEntries(Map &mapFrom, Map &mapFrozen)
+{
+    for (typename Map::iterator it = mapFrom.begin(); it != mapFrom.end(); ++it) {
+        if (it->second.flags & Map::mapped_type::DIRTY)
+            mapFrozen.emplace(it->first, std::move(it->second));
+    }
+}
+
+bool CCoinsViewAsyncFlush::BatchWrite(CCoinsMap &mapCoins,
+                                      const uint256 &hashBlockIn,
+                                      const uint256 &hashSproutAnchorIn,
+                                      const uint256 &hashSaplingAnchorIn,
+                                      CAnchorsSproutMap &mapSproutAnchors,
+                                      CAnchorsSaplingMap &mapSaplingAnchors,
+                                      CNullifiersMap &mapSproutNullifiers,
+                                      CNullifiersMap &mapSaplingNullifiers) {
+    LOCK(cs_writer);
+    // Only one set of entries is frozen at a time
+    if (!Sync())
+        return false;
+
+    {
+        LOCK(cs);
+        FreezeDirtyEntries(mapCoins, frozenCoins);
+        FreezeDirtyEntries(mapSproutAnchors, frozenSproutAnchors);
+        FreezeDirtyEntries(mapSaplingAnchors, frozenSaplingAnchors);
+        FreezeDirtyEntries(mapSproutNullifiers, frozenSproutNullifiers);
+        FreezeDirtyEntries(mapSaplingNullifiers, frozenSaplingNullifiers);
+        hashBlock = hashBlockIn;
+        hashSproutAnchor = hashSproutAnchorIn;
+        hashSaplingAnchor = hashSaplingAnchorIn;
+        fWriting = true;
+    }
+
+    writer = std::thread(&CCoinsViewAsyncFlush::WriteFrozen, this);
+    return true;
+}
+
+void CCoinsViewAsyncFlush::WriteFrozen()
+{
+    bool fOk;
+    try {
+        fOk = base->BatchWrite(frozenCoins, hashBlock, hashSproutAnchor, hashSaplingAnchor,
+                               frozenSproutAnchors, frozenSaplingAnchors, frozenSproutNullifiers, frozenSaplingNullifiers);
+    } catch (const std::exception& e) {
+        LogPrintf("%s: error writing to coin database: %s\n", __func__, e.what());
+        fOk = false;
+    }
+
+    // Freed outside the lock, readers only need the entries gone
+    CCoinsMap coins;
+    CAnchorsSproutMap sproutAnchors;
+    CAnchorsSaplingMap saplingAnchors;
+    CNullifiersMap sproutNullifiers;
+    CNullifiersMap saplingNullifiers;
+    {
+        LOCK(cs);
+        coins.swap(frozenCoins);
+        sproutAnchors.swap(frozenSproutAnchors);
+        saplingAnchors.swap(frozenSaplingAnchors);
+        sproutNullifiers.swap(frozenSproutNullifiers);
+        saplingNullifiers.swap(frozenSaplingNullifiers);
+        fWriting = false;
+        if (!fOk)
+            fWriteFailed = true;
+    }
+}
+
+bool CCoinsViewAsyncFlush::Sync() const
+{
+    {
+        LOCK(cs_writer);
+        if (writer.joinable())
+            writer.join();
+    }
+    LOCK(cs);
+    return !fWriteFailed;
+}
+
+bool CCoinsViewAsyncFlush::GetStats(CCoinsStats &stats) const {
+    Sync();
+    return base->GetStats(stats);
+}
+
+bool CCoinsViewAsyncFlush::WriteSnapshot(CAutoFile &file, CCoinsSnapshotMetadata &metadata, uint256 &hashChecksum) const {
+    Sync();
+    return base->WriteSnapshot(file, metadata, hashChecksum);
+}
@@ -29,10 +29,15 @@
 #include "serialize.h"
 #include "uint256.h"
 #include "base58.h"
+#include "support/allocators/pool.h"
+#include "sync.h"
 #include "pubkey.h"
 
 #include <assert.h>
 #include <stdint.h>
+#include <functional>
+#include <memory>
+#include <thread>
 #include <vector>
 #include <unordered_map>
 
@@ -349,10 +354,15 @@ enum ShieldedType
     SAPLING,
 };
 
-typedef boost::unordered_map<uint256, CCoinsCacheEntry, CCoinsKeyHasher> CCoinsMap;
-typedef boost::unordered_map<uint256, CAnchorsSproutCacheEntry, CCoinsKeyHasher> CAnchorsSproutMap;
-typedef boost::unordered_map<uint256, CAnchorsSaplingCacheEntry, CCoinsKeyHasher> CAnchorsSaplingMap;
-typedef boost::unordered_map<uint256, CNullifiersCacheEntry, CCoinsKeyHasher> CNullifiersMap;
+// Map nodes are drawn from the PoolResource of the owning CCoinsViewCache
+typedef boost::unordered_map<uint256, CCoinsCacheEntry, CCoinsKeyHasher, std::equal_to<uint256>,
+    pool_allocator<std::pair<const uint256, CCoinsCacheEntry>>> CCoinsMap;
+typedef boost::unordered_map<uint256, CAnchorsSproutCacheEntry, CCoinsKeyHasher, std::equal_to<uint256>,
+    pool_allocator<std::pair<const uint256, CAnchorsSproutCacheEntry>>> CAnchorsSproutMap;
+typedef boost::unordered_map<uint256, CAnchorsSaplingCacheEntry, CCoinsKeyHasher, std::equal_to<uint256>,
+    pool_allocator<std::pair<const uint256, CAnchorsSaplingCacheEntry>>> CAnchorsSaplingMap;
+typedef boost::unordered_map<uint256, CNullifiersCacheEntry, CCoinsKeyHasher, std::equal_to<uint256>,
+    pool_allocator<std::pair<const uint256, CNullifiersCacheEntry>>> CNullifiersMap;
 
 struct CCoinsStats
 {
@@ -367,6 +377,67 @@ struct CCoinsStats
     CCoinsStats() : nHeight(0), nTransactions(0), nTransactionOutputs(0), nSerializedSize(0), nTotalAmount(0) {}
 };
 
+//! Start of a chainstate snapshot file ("psnp" on disk)
+static const uint32_t COINS_SNAPSHOT_MAGIC = 0x706e7370;
+
+/**
+ * Layout of a chainstate snapshot, as written by dumptxoutset:
+ *
+ *   CCoinsSnapshotMetadata
+ *   records, each a CoinsSnapshotRecordType followed by key and value:
+ *     SNAPSHOT_RECORD_COINS              txid, CCoins
+ *     SNAPSHOT_RECORD_SPROUT_ANCHOR      root, SproutMerkleTree
+ *     SNAPSHOT_RECORD_SAPLING_ANCHOR     root, SaplingMerkleTree
+ *     SNAPSHOT_RECORD_SPROUT_NULLIFIER   nullifier
+ *     SNAPSHOT_RECORD_SAPLING_NULLIFIER  nullifier
+ *   SNAPSHOT_RECORD_END
+ *   uint256 double SHA-256 of everything before it
+ */
+enum CoinsSnapshotRecordType {
+    SNAPSHOT_RECORD_END = 0,
+    SNAPSHOT_RECORD_COINS = 1,
+    SNAPSHOT_RECORD_SPROUT_ANCHOR = 2,
+    SNAPSHOT_RECORD_SAPLING_ANCHOR = 3,
+    SNAPSHOT_RECORD_SPROUT_NULLIFIER = 4,
+    SNAPSHOT_RECORD_SAPLING_NULLIFIER = 5,
+};
+
+/** The chain state a snapshot was taken at */
+struct CCoinsSnapshotMetadata
+{
+    static const uint32_t CURRENT_VERSION = 1;
+
+    uint32_t nVersion;
+    uint256 hashBlock;
+    int nHeight;
+    //! Number of transactions in the chain up to and including hashBlock
+    uint64_t nChainTx;
+    uint256 hashSproutAnchor;
+    uint256 hashSaplingAnchor;
+
+    CCoinsSnapshotMetadata() : nVersion(CURRENT_VERSION), nHeight(0), nChainTx(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        uint32_t nMagic = COINS_SNAPSHOT_MAGIC;
+        READWRITE(nMagic);
+        if (nMagic != COINS_SNAPSHOT_MAGIC)
+            throw std::ios_base::failure("CCoinsSnapshotMetadata: not a chainstate snapshot");
+        READWRITE(nVersion);
+        if (nVersion != CURRENT_VERSION)
+            throw std::ios_base::failure("CCoinsSnapshotMetadata: unsupported snapshot version");
+        READWRITE(hashBlock);
+        READWRITE(nHeight);
+        READWRITE(nChainTx);
+        READWRITE(hashSproutAnchor);
+        READWRITE(hashSaplingAnchor);
+    }
+};
+
+class CAutoFile;
+
 
 /** Abstract view on the open txout dataset. */
 class CCoinsView
@@ -378,6 +449,10 @@ public:
     //! Retrieve the tree (Sapling) at a particular anchored root in the chain
     virtual bool GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree) const;
 
+    //! Retrieve the tree (Sapling) at a particular anchored root without copying it, or nullptr.
+    //! The tree is shared and must be copied before it is modified.
+    virtual std::shared_ptr<const SaplingMerkleTree> GetSharedSaplingAnchorAt(const uint256 &rt) const;
+
     //! Determine whether a nullifier is spent or not
     virtual bool GetNullifier(const uint256 &nullifier, ShieldedType type) const;
 
@@ -408,6 +483,9 @@ public:
     //! Calculate statistics about the unspent transaction output set
     virtual bool GetStats(CCoinsStats &stats) const;
 
+    //! Write the whole state to a snapshot file, returning its metadata and checksum
+    virtual bool WriteSnapshot(CAutoFile &file, CCoinsSnapshotMetadata &metadata, uint256 &hashChecksum) const;
+
     //! As we use CCoinsViews polymorphically, have a virtual destructor
     virtual ~CCoinsView() {}
 };
@@ -423,6 +501,7 @@ public:
     CCoinsViewBacked(CCoinsView *viewIn);
     bool GetSproutAnchorAt(const uint256 &rt, SproutMerkleTree &tree) const;
     bool GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree) const;
+    std::shared_ptr<const SaplingMerkleTree> GetSharedSaplingAnchorAt(const uint256 &rt) const;
     bool GetNullifier(const uint256 &nullifier, ShieldedType type) const;
     bool GetCoins(const uint256 &txid, CCoins &coins) const;
     bool HaveCoins(const uint256 &txid) const;
@@ -438,6 +517,7 @@ public:
                     CNullifiersMap &mapSproutNullifiers,
                     CNullifiersMap &mapSaplingNullifiers);
     bool GetStats(CCoinsStats &stats) const;
+    bool WriteSnapshot(CAutoFile &file, CCoinsSnapshotMetadata &metadata, uint256 &hashChecksum) const;
 };
 
 
@@ -501,6 +581,9 @@ protected:
     /* Whether this cache has an active modifier. */
     bool hasModifier;
 
+    /* Pool the entries of all cache maps are allocated from, recreated on Flush. */
+    mutable PoolResource cachePool;
+
     /**
      * Make mutable so that we can "fill the cache" even from Get-methods
      * declared as "const". 
@@ -525,6 +608,8 @@ public:
     //static CLaunchMap &LaunchMap() { return launchMap; }
     bool GetSproutAnchorAt(const uint256 &rt, SproutMerkleTree &tree) const;
     bool GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree) const;
+    //! Does not add trees read from the base view to this cache
+    std::shared_ptr<const SaplingMerkleTree> GetSharedSaplingAnchorAt(const uint256 &rt) const;
     bool GetNullifier(const uint256 &nullifier, ShieldedType type) const;
     bool GetCoins(const uint256 &txid, CCoins &coins) const;
     bool HaveCoins(const uint256 &txid) const;
@@ -573,6 +658,13 @@ public:
      */
     bool Flush();
 
+    /**
+     * Calls visit with the coins in the base view and in this cache of every
+     * transaction modified here and not flushed yet. For a cache holding one
+     * block, these are the changes the block makes to the UTXO set.
+     */
+    void VisitChanges(const std::function<void(const uint256&, const CCoins&, const CCoins&)>& visit) const;
+
     //! Calculate the size of the cache (in number of transactions)
     unsigned int GetCacheSize() const;
 
@@ -613,6 +705,9 @@ private:
      */
     CCoinsViewCache(const CCoinsViewCache &);
 
+    //! Returns the memory of the (empty) cache maps by recreating them and their pool
+    void ReallocateCache();
+
     //! Generalized interface for popping anchors
     template<typename Tree, typename Cache, typename CacheEntry>
     void AbstractPopAnchor(
@@ -639,4 +734,69 @@ private:
     );
 };
 
+/**
+ * CCoinsView that writes the changes flushed into it to its base view on a
+ * background thread. BatchWrite freezes the dirty entries it is given and
+ * returns once the write of the previously frozen ones has finished, so a
+ * cache flushing into this view only waits for the database when flushes
+ * come faster than they are written. Until written, the frozen entries are
+ * served to readers ahead of the base view.
+ *
+ * The base view's BatchWrite must leave the maps it is given unchanged, as
+ * CCoinsViewDB does, since readers use them while they are written. Like the
+ * cache above it, this view is only modified under the caller's lock.
+ */
+class CCoinsViewAsyncFlush : public CCoinsViewBacked
+{
+private:
+    //! Guards the writer thread handle
+    mutable CCriticalSection cs_writer;
+    mutable std::thread writer;
+    //! Guards the frozen entries, which the writer thread only reads
+    mutable CCriticalSection cs;
+    //! Whether frozen entries are being written
+    bool fWriting;
+    //! Whether a write has failed; the base view is then out of date
+    bool fWriteFailed;
+
+    uint256 hashBlock;
+    uint256 hashSproutAnchor;
+    uint256 hashSaplingAnchor;
+    CCoinsMap frozenCoins;
+    CAnchorsSproutMap frozenSproutAnchors;
+    CAnchorsSaplingMap frozenSaplingAnchors;
+    CNullifiersMap frozenSproutNullifiers;
+    CNullifiersMap frozenSaplingNullifiers;
+
+    void WriteFrozen();
+
+    CCoinsViewAsyncFlush(const CCoinsViewAsyncFlush &);
+
+public:
+    CCoinsViewAsyncFlush(CCoinsView *viewIn);
+    ~CCoinsViewAsyncFlush();
+
+    bool GetSproutAnchorAt(const uint256 &rt, SproutMerkleTree &tree) const;
+    bool GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree) const;
+    std::shared_ptr<const SaplingMerkleTree> GetSharedSaplingAnchorAt(const uint256 &rt) const;
+    bool GetNullifier(const uint256 &nullifier, ShieldedType type) const;
+    bool GetCoins(const uint256 &txid, CCoins &coins) const;
+    bool HaveCoins(const uint256 &txid) const;
+    uint256 GetBestBlock() const;
+    uint256 GetBestAnchor(ShieldedType type) const;
+    bool BatchWrite(CCoinsMap &mapCoins,
+                    const uint256 &hashBlock,
+                    const uint256 &hashSproutAnchor,
+                    const uint256 &hashSaplingAnchor,
+                    CAnchorsSproutMap &mapSproutAnchors,
+                    CAnchorsSaplingMap &mapSaplingAnchors,
+                    CNullifiersMap &mapSproutNullifiers,
+                    CNullifiersMap &mapSaplingNullifiers);
+    bool GetStats(CCoinsStats &stats) const;
+    bool WriteSnapshot(CAutoFile &file, CCoinsSnapshotMetadata &metadata, uint256 &hashChecksum) const;
+
+    //! Waits until everything passed to BatchWrite is in the base view; false if a write failed
+    bool Sync() const;
+};
+
 #endif // BITCOIN_COINS_H
@@ -0,0 +1,251 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coinstats.h"
+
+#include "coins.h"
+#include "crypto/muhash.h"
+#include "main.h"
+#include "streams.h"
+#include "txdb.h"
+#include "util.h"
+#include "utiltime.h"
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+
+#include <boost/thread.hpp>
+
+int64_t komodo_newcoins(int64_t *zfundsp,int64_t *sproutfundsp,int32_t nHeight,CBlock *pblock,const CCoinsViewCache *pspent);
+int64_t komodo_coinsupply(int64_t *zfundsp,int64_t *sproutfundsp,int32_t height);
+
+bool fCoinStatsIndex = DEFAULT_COINSTATSINDEX;
+
+//! Seconds between the checks of ThreadCoinsStats for a tip without a record
+static const int COINSTATS_SEED_INTERVAL = 60;
+
+/** Changes a block makes to the UTXO set statistics */
+struct CCoinsStatsDelta
+{
+    CCoinsStatsRecord stats;
+    MuHash3072 muhash;
+};
+
+//! Changes of the recently connected blocks, to catch a seeded record up to the tip. Requires cs_main.
+static std::map<uint256, CCoinsStatsDelta> mapDeltas;
+//! Set while ThreadCoinsStats scans the chainstate, the changes are then all kept
+static std::atomic<bool> fSeeding(false);
+
+//! Last record written, the parent of the next block. Requires cs_main.
+static uint256 hashLastRecord;
+static CCoinsStatsRecord lastRecord;
+static MuHash3072 lastMuHash;
+static bool fLastHash = false;
+
+CCoinsStatsRecord& CCoinsStatsRecord::operator+=(const CCoinsStatsRecord& delta)
+{
+    nHeight = delta.nHeight;
+    nTransactions += delta.nTransactions;
+    nTransactionOutputs += delta.nTransactionOutputs;
+    nTotalAmount += delta.nTotalAmount;
+    fSupply = fSupply && delta.fSupply;
+    nSupply += delta.nSupply;
+    nZFunds += delta.nZFunds;
+    nSproutFunds += delta.nSproutFunds;
+    return *this;
+}
+
+static void AddOutput(CCoinsStatsRecord& stats, MuHash3072& muhash, const uint256& txid, unsigned int n, const CCoins& coins, bool fAdd)
+{
+    const CTxOut& out = coins.vout[n];
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << COutPoint(txid, n) << VARINT(coins.nHeight * 2 + (coins.fCoinBase ? 1 : 0)) << out;
+    if (fAdd) {
+        muhash.Insert((const unsigned char*)&ss[0], ss.size());
+        stats.nTransactionOutputs++;
+        stats.nTotalAmount += out.nValue;
+    } else {
+        muhash.Remove((const unsigned char*)&ss[0], ss.size());
+        stats.nTransactionOutputs--;
+        stats.nTotalAmount -= out.nValue;
+    }
+}
+
+//! Adds the change of a transaction's unspent outputs from coinsOld to coinsNew
+static void AddCoinsChange(CCoinsStatsRecord& stats, MuHash3072& muhash, const uint256& txid, const CCoins& coinsOld, const CCoins& coinsNew)
+{
+    // Outputs that did not change would cancel out, so they are not hashed
+    bool fSameMeta = coinsOld.nHeight == coinsNew.nHeight && coinsOld.fCoinBase == coinsNew.fCoinBase;
+    for (unsigned int i = 0; i < std::max(coinsOld.vout.size(), coinsNew.vout.size()); i++) {
+        bool fOld = i < coinsOld.vout.size() && !coinsOld.vout[i].IsNull();
+        bool fNew = i < coinsNew.vout.size() && !coinsNew.vout[i].IsNull();
+        if (fOld && fNew && fSameMeta && coinsOld.vout[i] == coinsNew.vout[i])
+            continue;
+        if (fOld)
+            AddOutput(stats, muhash, txid, i, coinsOld, false);
+        if (fNew)
+            AddOutput(stats, muhash, txid, i, coinsNew, true);
+    }
+    stats.nTransactions += (coinsNew.IsPruned() ? 0 : 1) - (coinsOld.IsPruned() ? 0 : 1);
+}
+
+static bool ReadRecord(const uint256& hash, CCoinsStatsRecord& record, MuHash3072& muhash, bool& fHash)
+{
+    if (!hashLastRecord.IsNull() && hash == hashLastRecord) {
+        record = lastRecord;
+        muhash = lastMuHash;
+        fHash = fLastHash;
+        return true;
+    }
+    if (!pblocktree->ReadCoinsStats(hash, record))
+        return false;
+    fHash = pblocktree->ReadCoinsStatsHash(hash, muhash);
+    return true;
+}
+
+static bool WriteRecord(const CBlockIndex* pindex, const CCoinsStatsRecord& record, const MuHash3072& muhash, bool fHash)
+{
+    if (!pblocktree->WriteCoinsStats(pindex->GetBlockHash(), record, fHash ? &muhash : NULL))
+        return error("%s: failed to write the record of block %s", __func__, pindex->GetBlockHash().ToString());
+    hashLastRecord = pindex->GetBlockHash();
+    lastRecord = record;
+    lastMuHash = muhash;
+    fLastHash = fHash;
+
+    // The set hash is only kept for the recent blocks
+    if (fHash && pindex->GetHeight() >= COINSTATS_HASH_DEPTH) {
+        const CBlockIndex* pindexOld = pindex->GetAncestor(pindex->GetHeight() - COINSTATS_HASH_DEPTH);
+        if (pindexOld && !pblocktree->EraseCoinsStatsHash(pindexOld->GetBlockHash()))
+            return error("%s: failed to erase the set hash of block %s", __func__, pindexOld->GetBlockHash().ToString());
+    }
+    return true;
+}
+
+static void PruneDeltas(int nTipHeight)
+{
+    if (fSeeding || mapDeltas.size() <= 2 * (size_t)COINSTATS_HASH_DEPTH)
+        return;
+    for (std::map<uint256, CCoinsStatsDelta>::iterator it = mapDeltas.begin(); it != mapDeltas.end(); ) {
+        if (it->second.stats.nHeight < nTipHeight - COINSTATS_HASH_DEPTH)
+            mapDeltas.erase(it++);
+        else
+            ++it;
+    }
+}
+
+bool ConnectCoinsStats(const CBlock& block, const CBlockIndex* pindex, const CCoinsViewCache& view)
+{
+    AssertLockHeld(cs_main);
+    if (!fCoinStatsIndex)
+        return true;
+
+    CCoinsStatsDelta& delta = mapDeltas[pindex->GetBlockHash()];
+    delta = CCoinsStatsDelta();
+    delta.stats.nHeight = pindex->GetHeight();
+    view.VisitChanges([&delta](const uint256& txid, const CCoins& coinsOld, const CCoins& coinsNew) {
+        AddCoinsChange(delta.stats, delta.muhash, txid, coinsOld, coinsNew);
+    });
+    // The tip under the view still has the inputs of the block unspent
+    delta.stats.nSupply = komodo_newcoins(&delta.stats.nZFunds, &delta.stats.nSproutFunds, pindex->GetHeight(), const_cast<CBlock*>(&block), pcoinsTip);
+    PruneDeltas(pindex->GetHeight());
+
+    // Without a record of the parent, ThreadCoinsStats seeds one and catches up
+    CCoinsStatsRecord record;
+    MuHash3072 muhash;
+    bool fHash = false;
+    if (pindex->pprev == NULL || !ReadRecord(pindex->pprev->GetBlockHash(), record, muhash, fHash))
+        return true;
+    record += delta.stats;
+    if (fHash)
+        muhash *= delta.muhash;
+    return WriteRecord(pindex, record, muhash, fHash);
+}
+
+bool GetCoinsStatsAt(const CBlockIndex* pindex, CCoinsStatsRecord& record, uint256* phashMuHash)
+{
+    if (!fCoinStatsIndex || !pblocktree->ReadCoinsStats(pindex->GetBlockHash(), record))
+        return false;
+    if (phashMuHash) {
+        MuHash3072 muhash;
+        if (pblocktree->ReadCoinsStatsHash(pindex->GetBlockHash(), muhash))
+            muhash.Finalize(phashMuHash->begin());
+        else
+            phashMuHash->SetNull();
+    }
+    return true;
+}
+
+//! Writes the record of the block the chainstate is at from a scan of it, then catches up to the tip
+static bool SeedCoinsStats(CCoinsViewDB* pcoinsdb)
+{
+    int64_t nStart = GetTimeMillis();
+    {
+        LOCK(cs_main);
+        FlushStateToDisk();
+    }
+    if (!pcoinsAsyncFlush->Sync())
+        return error("%s: failed to write the chainstate", __func__);
+
+    CCoinsStatsRecord record;
+    MuHash3072 muhash;
+    uint256 hashBlock;
+    if (!pcoinsdb->ForEachCoins(hashBlock, [&record, &muhash](const uint256& txid, const CCoins& coins) {
+            AddCoinsChange(record, muhash, txid, CCoins(), coins);
+        }))
+        return false;
+
+    CBlockIndex* pindex;
+    {
+        LOCK(cs_main);
+        BlockMap::const_iterator it = mapBlockIndex.find(hashBlock);
+        if (it == mapBlockIndex.end() || !chainActive.Contains(it->second))
+            return error("%s: chainstate block %s is not on the active chain", __func__, hashBlock.ToString());
+        pindex = it->second;
+    }
+    // Same totals as coinsupply computes from the blocks
+    record.nHeight = pindex->GetHeight();
+    record.nSupply = komodo_coinsupply(&record.nZFunds, &record.nSproutFunds, pindex->GetHeight());
+    record.fSupply = record.nSupply != 0 || pindex->GetHeight() == 0;
+
+    LOCK(cs_main);
+    if (!chainActive.Contains(pindex))
+        return error("%s: block %s was disconnected during the scan", __func__, hashBlock.ToString());
+    if (!WriteRecord(pindex, record, muhash, true))
+        return false;
+    for (pindex = chainActive.Next(pindex); pindex != NULL; pindex = chainActive.Next(pindex)) {
+        std::map<uint256, CCoinsStatsDelta>::const_iterator it = mapDeltas.find(pindex->GetBlockHash());
+        if (it == mapDeltas.end())
+            return error("%s: changes of block %s were not kept", __func__, pindex->GetBlockHash().ToString());
+        record += it->second.stats;
+        muhash *= it->second.muhash;
+        if (!WriteRecord(pindex, record, muhash, true))
+            return false;
+    }
+    LogPrintf("%s: UTXO set statistics seeded at height %d in %dms, %u transactions with unspent outputs\n", __func__,
+        record.nHeight, GetTimeMillis() - nStart, record.nTransactions);
+    return true;
+}
+
+void ThreadCoinsStats(CCoinsViewDB* pcoinsdb)
+{
+    RenameThread("pirate-coinstats");
+    while (true) {
+        bool fSeed;
+        {
+            LOCK(cs_main);
+            const CBlockIndex* pindexTip = chainActive.Tip();
+            MuHash3072 muhash;
+            fSeed = pindexTip != NULL && !(pindexTip->GetBlockHash() == hashLastRecord && fLastHash) &&
+                !pblocktree->ReadCoinsStatsHash(pindexTip->GetBlockHash(), muhash);
+        }
+        if (fSeed) {
+            fSeeding = true;
+            if (!SeedCoinsStats(pcoinsdb))
+                LogPrintf("%s: no UTXO set statistics for the tip yet, retrying in %ds\n", __func__, COINSTATS_SEED_INTERVAL);
+            fSeeding = false;
+        }
+        MilliSleep(COINSTATS_SEED_INTERVAL * 1000);
+    }
+}
@@ -0,0 +1,82 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_COINSTATS_H
+#define BITCOIN_COINSTATS_H
+
+#include "amount.h"
+#include "serialize.h"
+#include "uint256.h"
+
+#include <stdint.h>
+
+class CBlock;
+class CBlockIndex;
+class CCoinsViewCache;
+class CCoinsViewDB;
+
+//! Default for -coinstatsindex
+static const bool DEFAULT_COINSTATSINDEX = false;
+//! Blocks below the tip the UTXO set hash is kept for
+static const int COINSTATS_HASH_DEPTH = 1440;
+
+/** UTXO set totals after a block, or the changes a block makes to them */
+class CCoinsStatsRecord
+{
+public:
+    int nHeight;
+    //! Transactions with unspent outputs
+    int64_t nTransactions;
+    int64_t nTransactionOutputs;
+    CAmount nTotalAmount;
+    //! Whether the coinsupply totals below are known
+    bool fSupply;
+    CAmount nSupply;
+    CAmount nZFunds;
+    CAmount nSproutFunds;
+
+    CCoinsStatsRecord() : nHeight(0), nTransactions(0), nTransactionOutputs(0), nTotalAmount(0),
+        fSupply(true), nSupply(0), nZFunds(0), nSproutFunds(0) {}
+
+    //! Applies the changes of the next block
+    CCoinsStatsRecord& operator+=(const CCoinsStatsRecord& delta);
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(nHeight);
+        READWRITE(nTransactions);
+        READWRITE(nTransactionOutputs);
+        READWRITE(nTotalAmount);
+        READWRITE(fSupply);
+        READWRITE(nSupply);
+        READWRITE(nZFunds);
+        READWRITE(nSproutFunds);
+    }
+};
+
+/**
+ * With -coinstatsindex the UTXO set statistics of gettxoutsetinfo and the
+ * coinsupply totals are kept for every block of the active chain, together
+ * with a MuHash3072 set hash of the unspent outputs for the recent blocks.
+ *
+ * ConnectTip applies the changes of each block, read from its view before
+ * the view is flushed, to the record of the previous block. Records are
+ * keyed by block hash, so a disconnected block leaves the record of its
+ * parent in place and nothing needs undoing. A node without a record for
+ * its tip, such as one that just enabled the index, gets one from a single
+ * scan of the chainstate by ThreadCoinsStats; the blocks connected during
+ * the scan are caught up from the changes kept in memory.
+ */
+extern bool fCoinStatsIndex;
+
+//! Writes the record of a block connected by ConnectTip, view holds its changes. Requires cs_main.
+bool ConnectCoinsStats(const CBlock& block, const CBlockIndex* pindex, const CCoinsViewCache& view);
+//! Record after pindex; the set hash, if asked for, is null when it is no longer kept for the block
+bool GetCoinsStatsAt(const CBlockIndex* pindex, CCoinsStatsRecord& record, uint256* phashMuHash = NULL);
+
+void ThreadCoinsStats(CCoinsViewDB* pcoinsdb);
+
+#endif // BITCOIN_COINSTATS_H
@@ -0,0 +1,223 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_COMPACTBLOCKINDEX_H
+#define BITCOIN_COMPACTBLOCKINDEX_H
+
+#include "primitives/block.h"
+#include "primitives/txview.h"
+#include "serialize.h"
+#include "uint256.h"
+#include "zcash/IncrementalMerkleTree.hpp"
+
+#include <array>
+#include <string.h>
+#include <vector>
+
+//! Leading bytes of a Sapling note ciphertext a light client needs for trial decryption
+static const size_t COMPACT_NOTE_CIPHERTEXT_SIZE = 52;
+//! Blocks between the Sapling commitment trees kept with the commitment lists
+static const int SAPLING_TREE_CHECKPOINT_INTERVAL = 1000;
+
+struct CCompactBlockIndexKey {
+    int height;
+
+    size_t GetSerializeSize(int nType, int nVersion) const {
+        return 4;
+    }
+    template<typename Stream>
+    void Serialize(Stream& s) const {
+        // Big endian so the database iterates the index in height order
+        ser_writedata32be(s, height);
+    }
+    template<typename Stream>
+    void Unserialize(Stream& s) {
+        height = ser_readdata32be(s);
+    }
+
+    CCompactBlockIndexKey(int h) {
+        height = h;
+    }
+
+    CCompactBlockIndexKey() {
+        SetNull();
+    }
+
+    void SetNull() {
+        height = 0;
+    }
+};
+
+struct CCompactSaplingSpend {
+    uint256 nullifier;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(nullifier);
+    }
+
+    CCompactSaplingSpend() {}
+    CCompactSaplingSpend(const SpendDescription& spend) : nullifier(spend.nullifier) {}
+};
+
+struct CCompactSaplingOutput {
+    uint256 cmu;
+    uint256 ephemeralKey;
+    std::array<unsigned char, COMPACT_NOTE_CIPHERTEXT_SIZE> ciphertext;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(cmu);
+        READWRITE(ephemeralKey);
+        READWRITE(ciphertext);
+    }
+
+    CCompactSaplingOutput() {
+        ciphertext.fill(0);
+    }
+
+    CCompactSaplingOutput(const OutputDescription& output) : cmu(output.cm), ephemeralKey(output.ephemeralKey) {
+        memcpy(ciphertext.data(), output.encCiphertext.data(), COMPACT_NOTE_CIPHERTEXT_SIZE);
+    }
+};
+
+struct CCompactTx {
+    uint32_t index;
+    uint256 txid;
+    std::vector<CCompactSaplingSpend> spends;
+    std::vector<CCompactSaplingOutput> outputs;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(index);
+        READWRITE(txid);
+        READWRITE(spends);
+        READWRITE(outputs);
+    }
+
+    CCompactTx() : index(0) {}
+};
+
+/**
+ * Sapling data of one block reduced to what a light client needs to detect
+ * and spend its notes. Only transactions with Sapling spends or outputs are
+ * included.
+ */
+struct CCompactBlock {
+    int height;
+    uint256 hash;
+    uint256 hashPrevBlock;
+    uint32_t nTime;
+    std::vector<CCompactTx> vtx;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(height);
+        READWRITE(hash);
+        READWRITE(hashPrevBlock);
+        READWRITE(nTime);
+        READWRITE(vtx);
+    }
+
+    CCompactBlock() : height(0), nTime(0) {}
+
+    CCompactBlock(const CBlock& block, int nHeight) : height(nHeight), hash(block.GetHash()),
+        hashPrevBlock(block.hashPrevBlock), nTime(block.nTime)
+    {
+        for (uint32_t i = 0; i < block.vtx.size(); i++) {
+            const CTransaction& tx = block.vtx[i];
+            if (tx.vShieldedSpend.empty() && tx.vShieldedOutput.empty())
+                continue;
+
+            CCompactTx ctx;
+            ctx.index = i;
+            ctx.txid = tx.GetHash();
+            ctx.spends.assign(tx.vShieldedSpend.begin(), tx.vShieldedSpend.end());
+            ctx.outputs.assign(tx.vShieldedOutput.begin(), tx.vShieldedOutput.end());
+            vtx.push_back(ctx);
+        }
+    }
+};
+
+struct CSaplingTxCommitments {
+    uint256 txid;
+    std::vector<uint256> cmus;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(txid);
+        READWRITE(cmus);
+    }
+};
+
+/**
+ * The note commitments of a block's Sapling outputs, by transaction, kept
+ * for every block (by height, like the compact blocks) so that witnesses are
+ * built without reading blocks. Every SAPLING_TREE_CHECKPOINT_INTERVAL
+ * blocks the tree after the block is kept with them, so a tree whose anchor
+ * the chainstate doesn't have is at most that many lists away.
+ */
+struct CSaplingBlockCommitments {
+    uint256 hash;
+    std::vector<CSaplingTxCommitments> vtx;
+    boost::optional<SaplingMerkleTree> checkpoint;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(hash);
+        READWRITE(vtx);
+        READWRITE(checkpoint);
+    }
+
+    CSaplingBlockCommitments() {}
+
+    explicit CSaplingBlockCommitments(const CBlock& block) : hash(block.GetHash())
+    {
+        for (const CTransaction& tx : block.vtx) {
+            if (tx.vShieldedOutput.empty())
+                continue;
+            CSaplingTxCommitments ctx;
+            ctx.txid = tx.GetHash();
+            for (const OutputDescription& output : tx.vShieldedOutput)
+                ctx.cmus.push_back(output.cm);
+            vtx.push_back(ctx);
+        }
+    }
+
+    explicit CSaplingBlockCommitments(const CBlockView& block) : hash(block.GetHash())
+    {
+        for (const CTransactionView& tx : block.GetTransactions()) {
+            if (tx.GetShieldedOutputCount() == 0)
+                continue;
+            CSaplingTxCommitments ctx;
+            ctx.txid = tx.GetHash();
+            for (size_t i = 0; i < tx.GetShieldedOutputCount(); i++)
+                ctx.cmus.push_back(tx.GetShieldedOutputCmu(i));
+            vtx.push_back(ctx);
+        }
+    }
+
+    //! All the commitments of the block, in the order they are appended to the tree
+    std::vector<uint256> GetCommitments() const
+    {
+        std::vector<uint256> vCommitments;
+        for (const CSaplingTxCommitments& ctx : vtx)
+            vCommitments.insert(vCommitments.end(), ctx.cmus.begin(), ctx.cmus.end());
+        return vCommitments;
+    }
+};
+
+#endif // BITCOIN_COMPACTBLOCKINDEX_H
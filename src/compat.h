@@ -108,8 +108,18 @@ typedef u_int SOCKET;
 size_t strnlen( const char *start, size_t max_len);
 #endif // HAVE_DECL_STRNLEN
 
+// The socket event loop uses epoll or kqueue where available, which unlike
+// select() are not limited to descriptors below FD_SETSIZE
+#if !defined(_WIN32)
+#if defined(HAVE_SYS_EPOLL_H)
+#define USE_EPOLL
+#elif defined(HAVE_SYS_EVENT_H)
+#define USE_KQUEUE
+#endif
+#endif
+
 bool static inline IsSelectableSocket(SOCKET s) {
-#ifdef _WIN32
+#if defined(_WIN32) || defined(USE_EPOLL) || defined(USE_KQUEUE)
     return true;
 #else
     return (s < FD_SETSIZE);
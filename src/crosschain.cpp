@@ -22,6 +22,10 @@
 
 #include "cc/CCinclude.h"
 
+#include <map>
+#include <memory>
+#include <tuple>
+
 /*
  * The crosschain workflow.
  *
@@ -46,8 +50,37 @@ int NOTARISATION_SCAN_LIMIT_BLOCKS = 1440;
 CBlockIndex *komodo_getblockindex(uint256 hash);
 
 
-/* On KMD */
-uint256 CalculateProofRoot(const char* symbol, uint32_t targetCCid, int kmdHeight,
+/*
+ * A MoMoM computed by CalculateProofRoot, with its merkle tree so proofs of
+ * many MoMs against it need no rehashing.
+ */
+struct ProofRoot {
+    uint256 blockHash; // chainActive[kmdHeight] when computed
+    uint256 MoMoM;
+    uint256 destNotarisationTxid;
+    std::vector<uint256> moms;
+    std::vector<uint256> vMerkleTree;
+};
+
+/*
+ * Proof roots by (kmd height, target CCid, symbol). Entries are dropped when
+ * a block at or below their height is disconnected, and the lowest heights
+ * go first when the cache is full.
+ */
+typedef std::tuple<int, uint32_t, std::string> ProofRootKey;
+static const size_t MAX_PROOF_ROOT_CACHE = 1000;
+static CCriticalSection cs_proofRootCache;
+static std::map<ProofRootKey, std::shared_ptr<const ProofRoot> > proofRootCache;
+
+
+void InvalidateProofRootCache(int kmdHeight)
+{
+    LOCK(cs_proofRootCache);
+    proofRootCache.erase(proofRootCache.lower_bound(ProofRootKey(kmdHeight, 0, "")), proofRootCache.end());
+}
+
+
+static uint256 ScanProofRoot(const char* symbol, uint32_t targetCCid, int kmdHeight,
         std::vector<uint256> &moms, uint256 &destNotarisationTxid)
 {
     /*
@@ -117,6 +150,59 @@ end:
 }
 
 
+/*
+ * Get the proof root for kmdHeight from the cache, or scan for it.
+ * Returns null if there is no determinate MoMoM.
+ */
+static std::shared_ptr<const ProofRoot> GetProofRoot(const char* symbol, uint32_t targetCCid, int kmdHeight)
+{
+    if (targetCCid < 2)
+        return nullptr;
+
+    if (kmdHeight < 0 || kmdHeight > chainActive.Height())
+        return nullptr;
+
+    uint256 blockHash = chainActive[kmdHeight]->GetBlockHash();
+    ProofRootKey key(kmdHeight, targetCCid, symbol);
+    {
+        LOCK(cs_proofRootCache);
+        auto it = proofRootCache.find(key);
+        if (it != proofRootCache.end() && it->second->blockHash == blockHash)
+            return it->second;
+    }
+
+    std::shared_ptr<ProofRoot> root = std::make_shared<ProofRoot>();
+    root->blockHash = blockHash;
+    root->MoMoM = ScanProofRoot(symbol, targetCCid, kmdHeight, root->moms, root->destNotarisationTxid);
+    if (root->MoMoM.IsNull())
+        return nullptr;
+    bool fMutated;
+    BuildMerkleTree(&fMutated, root->moms, root->vMerkleTree);
+
+    LOCK(cs_proofRootCache);
+    if (proofRootCache.size() >= MAX_PROOF_ROOT_CACHE)
+        proofRootCache.erase(proofRootCache.begin());
+    proofRootCache[key] = root;
+    return root;
+}
+
+
+/* On KMD */
+uint256 CalculateProofRoot(const char* symbol, uint32_t targetCCid, int kmdHeight,
+        std::vector<uint256> &moms, uint256 &destNotarisationTxid)
+{
+    std::shared_ptr<const ProofRoot> root = GetProofRoot(symbol, targetCCid, kmdHeight);
+    if (!root) {
+        destNotarisationTxid = uint256();
+        moms.clear();
+        return uint256();
+    }
+    moms = root->moms;
+    destNotarisationTxid = root->destNotarisationTxid;
+    return root->MoMoM;
+}
+
+
 /*
  * Get a notarisation from a given height
  *
@@ -144,26 +230,20 @@ int ScanNotarisationsFromHeight(int nHeight, const IsTarget f, Notarisation &fou
 }
 
 
-/* On KMD */
-TxProof GetCrossChainProof(const uint256 txid, const char* targetSymbol, uint32_t targetCCid,
-        const TxProof assetChainProof, int32_t offset)
+/*
+ * Get the kmd height of the first notarisation of targetSymbol at or after
+ * the notarisation of the source chain.
+ */
+static int GetTargetNotarisationHeight(const uint256 &sourceNotarisationTxid, const char* targetSymbol)
 {
-    /*
-     * Here we are given a proof generated by an assetchain A which goes from given txid to
-     * an assetchain MoM. We need to go from the notarisationTxid for A to the MoMoM range of the
-     * backnotarisation for B (given by kmdheight of notarisation), find the MoM within the MoMs for
-     * that range, and finally extend the proof to lead to the MoMoM (proof root).
-     */
     EvalRef eval;
-    uint256 MoM = assetChainProof.second.Exec(txid);
 
     // Get a kmd height for given notarisation Txid
     int kmdHeight;
     {
         CTransaction sourceNotarisation;
-        uint256 hashBlock;
         CBlockIndex blockIdx;
-        if (!eval->GetTxConfirmed(assetChainProof.first, sourceNotarisation, blockIdx))
+        if (!eval->GetTxConfirmed(sourceNotarisationTxid, sourceNotarisation, blockIdx))
             throw std::runtime_error("Notarisation not found");
         kmdHeight = blockIdx.GetHeight();
     }
@@ -181,48 +261,58 @@ TxProof GetCrossChainProof(const uint256 txid, const char* targetSymbol, uint32_
     kmdHeight = ScanNotarisationsFromHeight(kmdHeight, isTarget, nota);
     if (!kmdHeight)
         throw std::runtime_error("Cannot find notarisation for target inclusive of source");
-        
-    if ( offset != 0 )
-        kmdHeight += offset;
+    return kmdHeight;
+}
+
+
+/*
+ * Extend a proof from txid to the source MoM up to the MoMoM at kmdHeight
+ */
+static TxProof ExtendToProofRoot(const uint256 txid, const char* targetSymbol, uint32_t targetCCid,
+        const TxProof &assetChainProof, int kmdHeight)
+{
+    uint256 MoM = assetChainProof.second.Exec(txid);
 
     // Get MoMs for kmd height and symbol
-    std::vector<uint256> moms;
-    uint256 targetChainNotarisationTxid;
-    uint256 MoMoM = CalculateProofRoot(targetSymbol, targetCCid, kmdHeight, moms, targetChainNotarisationTxid);
-    if (MoMoM.IsNull())
+    std::shared_ptr<const ProofRoot> root = GetProofRoot(targetSymbol, targetCCid, kmdHeight);
+    if (!root)
         throw std::runtime_error("No MoMs found");
 
     // Find index of source MoM in MoMoM
     int nIndex;
-    for (nIndex=0; nIndex<moms.size(); nIndex++) {
-        if (moms[nIndex] == MoM)
+    for (nIndex=0; nIndex<root->moms.size(); nIndex++) {
+        if (root->moms[nIndex] == MoM)
             goto cont;
     }
     throw std::runtime_error("Couldn't find MoM within MoMoM set");
 cont:
 
-    // Create a branch
-    std::vector<uint256> vBranch;
-    {
-        CBlock fakeBlock;
-        for (int i=0; i<moms.size(); i++) {
-            CTransaction fakeTx;
-            // first value in CTransaction memory is it's hash
-            memcpy((void*)&fakeTx, moms[i].begin(), 32);
-            fakeBlock.vtx.push_back(fakeTx);
-        }
-        vBranch = fakeBlock.GetMerkleBranch(nIndex);
-    }
-
     // Concatenate branches
     MerkleBranch newBranch = assetChainProof.second;
-    newBranch << MerkleBranch(nIndex, vBranch);
+    newBranch << MerkleBranch(nIndex, GetMerkleBranch(nIndex, root->moms.size(), root->vMerkleTree));
 
     // Check proof
-    if (newBranch.Exec(txid) != MoMoM)
+    if (newBranch.Exec(txid) != root->MoMoM)
         throw std::runtime_error("Proof check failed");
 
-    return std::make_pair(targetChainNotarisationTxid,newBranch);
+    return std::make_pair(root->destNotarisationTxid,newBranch);
+}
+
+
+/* On KMD */
+TxProof GetCrossChainProof(const uint256 txid, const char* targetSymbol, uint32_t targetCCid,
+        const TxProof assetChainProof, int32_t offset)
+{
+    /*
+     * Here we are given a proof generated by an assetchain A which goes from given txid to
+     * an assetchain MoM. We need to go from the notarisationTxid for A to the MoMoM range of the
+     * backnotarisation for B (given by kmdheight of notarisation), find the MoM within the MoMs for
+     * that range, and finally extend the proof to lead to the MoMoM (proof root).
+     */
+    int kmdHeight = GetTargetNotarisationHeight(assetChainProof.first, targetSymbol);
+    if ( offset != 0 )
+        kmdHeight += offset;
+    return ExtendToProofRoot(txid, targetSymbol, targetCCid, assetChainProof, kmdHeight);
 }
 
 
@@ -251,6 +341,47 @@ void CompleteImportTransaction(CTransaction &importTx, int32_t offset)
     importTx = MakeImportCoinTransaction(newProof, burnTx, payouts);
 }
 
+
+/*
+ * CompleteImportTransaction for many importTxs. Txs of the same source
+ * notarisation and target share the scans for the target notarisation and
+ * proof root. Returns the error for each tx, empty if it was completed.
+ */
+std::vector<std::string> CompleteImportTransactions(std::vector<CTransaction> &importTxs, int32_t offset)
+{
+    std::vector<std::string> errors(importTxs.size());
+    std::map<std::pair<uint256, std::string>, int> targetHeights;
+
+    for (size_t i = 0; i < importTxs.size(); i++) {
+        try {
+            ImportProof proof; CTransaction burnTx; std::vector<CTxOut> payouts; std::vector<uint8_t> rawproof;
+            if (!UnmarshalImportTx(importTxs[i], proof, burnTx, payouts))
+                throw std::runtime_error("Couldn't unmarshal importTx");
+
+            std::string targetSymbol;
+            uint32_t targetCCid;
+            uint256 payoutsHash;
+            if (!UnmarshalBurnTx(burnTx, targetSymbol, &targetCCid, payoutsHash, rawproof))
+                throw std::runtime_error("Couldn't unmarshal burnTx");
+
+            TxProof merkleBranch;
+            if( !proof.IsMerkleBranch(merkleBranch) )
+                throw std::runtime_error("Incorrect import tx proof");
+
+            std::pair<uint256, std::string> target(merkleBranch.first, targetSymbol);
+            auto it = targetHeights.find(target);
+            if (it == targetHeights.end())
+                it = targetHeights.insert(std::make_pair(target, GetTargetNotarisationHeight(merkleBranch.first, targetSymbol.data()))).first;
+
+            TxProof newMerkleBranch = ExtendToProofRoot(burnTx.GetHash(), targetSymbol.data(), targetCCid, merkleBranch, it->second + offset);
+            importTxs[i] = MakeImportCoinTransaction(ImportProof(newMerkleBranch), burnTx, payouts);
+        } catch (const std::runtime_error &e) {
+            errors[i] = e.what();
+        }
+    }
+    return errors;
+}
+
 bool IsSameAssetChain(const Notarisation &nota) {
     return strcmp(nota.second.symbol, ASSETCHAINS_SYMBOL) == 0;
 };
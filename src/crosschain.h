@@ -40,6 +40,8 @@ uint256 CalculateProofRoot(const char* symbol, uint32_t targetCCid, int kmdHeigh
 TxProof GetCrossChainProof(const uint256 txid, const char* targetSymbol, uint32_t targetCCid,
         const TxProof assetChainProof,int32_t offset);
 void CompleteImportTransaction(CTransaction &importTx,int32_t offset);
+std::vector<std::string> CompleteImportTransactions(std::vector<CTransaction> &importTxs, int32_t offset);
+void InvalidateProofRootCache(int kmdHeight);
 
 /* On assetchain */
 bool CheckMoMoM(uint256 kmdNotarisationHash, uint256 momom);
@@ -17,6 +17,7 @@
 #endif
 
 #include "compat/endian.h"
+#include "crypto/common.h"
 #include "crypto/equihash.h"
 #include "util.h"
 #ifndef __linux__
@@ -74,19 +75,24 @@ int8_t ZeroizeUnusedBits(size_t N, unsigned char* hash, size_t hLen)
 }
 
 
-template<unsigned int N, unsigned int K>
-int Equihash<N,K>::InitialiseState(eh_HashState& base_state)
+static void EhPersonalization(unsigned int N, unsigned int K, unsigned char* personalization)
 {
     uint32_t le_N = htole32(N);
     uint32_t le_K = htole32(K);
 
-    unsigned char personalization[crypto_generichash_blake2b_PERSONALBYTES] = {};
     if ( ASSETCHAINS_NK[0] == 0 && ASSETCHAINS_NK[1] == 0 )
         memcpy(personalization, "ZcashPoW", 8);
     else 
         memcpy(personalization, "NandKPoW", 8);
     memcpy(personalization+8,  &le_N, 4);
     memcpy(personalization+12, &le_K, 4);
+}
+
+template<unsigned int N, unsigned int K>
+int Equihash<N,K>::InitialiseState(eh_HashState& base_state)
+{
+    unsigned char personalization[crypto_generichash_blake2b_PERSONALBYTES] = {};
+    EhPersonalization(N, K, personalization);
 
     const uint8_t outlen = (512 / N) * GetSizeInBytes(N);
 
@@ -134,6 +140,181 @@ void GenerateHash(const eh_HashState& base_state, eh_index g,
     }
 }
 
+static const uint64_t blake2b_IV[8] = {
+    0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL, 0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+    0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL, 0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL
+};
+
+static const uint8_t blake2b_sigma[12][16] = {
+    { 0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15},
+    {14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3},
+    {11,  8, 12,  0,  5,  2, 15, 13, 10, 14,  3,  6,  7,  1,  9,  4},
+    { 7,  9,  3,  1, 13, 12, 11, 14,  2,  6,  5, 10,  4,  0, 15,  8},
+    { 9,  0,  5,  7,  2,  4, 10, 15, 14,  1, 11, 12,  6,  8,  3, 13},
+    { 2, 12,  6, 10,  0, 11,  8,  3,  4, 13,  7,  5, 15, 14,  1,  9},
+    {12,  5,  1, 15, 14, 13,  4, 10,  0,  7,  6,  3,  9,  2,  8, 11},
+    {13, 11,  7, 14, 12,  1,  3,  9,  5,  0, 15,  4,  8,  6,  2, 10},
+    { 6, 15, 14,  9, 11,  3,  0,  8, 12,  2, 13,  7,  1,  4, 10,  5},
+    {10,  2,  8,  4,  7,  6,  1,  5, 15, 11,  9, 14,  3, 12, 13,  0},
+    { 0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15},
+    {14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3}
+};
+
+// Blake2b compression of W-wide lanes of words, W the scalar or vector type
+template<typename W>
+static inline __attribute__((always_inline)) void Blake2bRounds(W v[16], const W m[16])
+{
+#define EH_ROTR64(x, n) (((x) >> (n)) | ((x) << (64 - (n))))
+#define EH_G(r, i, a, b, c, d)                      \
+    do {                                            \
+        a = a + b + m[blake2b_sigma[r][2*i]];       \
+        d = EH_ROTR64(d ^ a, 32);                   \
+        c = c + d;                                  \
+        b = EH_ROTR64(b ^ c, 24);                   \
+        a = a + b + m[blake2b_sigma[r][2*i+1]];     \
+        d = EH_ROTR64(d ^ a, 16);                   \
+        c = c + d;                                  \
+        b = EH_ROTR64(b ^ c, 63);                   \
+    } while (0)
+    for (int r = 0; r < 12; r++) {
+        EH_G(r, 0, v[0], v[4], v[8], v[12]);
+        EH_G(r, 1, v[1], v[5], v[9], v[13]);
+        EH_G(r, 2, v[2], v[6], v[10], v[14]);
+        EH_G(r, 3, v[3], v[7], v[11], v[15]);
+        EH_G(r, 4, v[0], v[5], v[10], v[15]);
+        EH_G(r, 5, v[1], v[6], v[11], v[12]);
+        EH_G(r, 6, v[2], v[7], v[8], v[13]);
+        EH_G(r, 7, v[3], v[4], v[9], v[14]);
+    }
+#undef EH_G
+#undef EH_ROTR64
+}
+
+static void Blake2bCompress(uint64_t h[8], const unsigned char block[128], uint64_t t, bool fLast)
+{
+    uint64_t m[16], v[16];
+    for (int i = 0; i < 16; i++)
+        m[i] = ReadLE64(block + 8 * i);
+    for (int i = 0; i < 8; i++) {
+        v[i] = h[i];
+        v[i + 8] = blake2b_IV[i];
+    }
+    v[12] ^= t;
+    if (fLast)
+        v[14] = ~v[14];
+    Blake2bRounds(v, m);
+    for (int i = 0; i < 8; i++)
+        h[i] ^= v[i] ^ v[i + 8];
+}
+
+typedef uint64_t eh_lanes4 __attribute__((vector_size(32)));
+
+//! Last compression of four leaves, whose words are in lanes
+static inline __attribute__((always_inline)) void Blake2bLast4Body(const uint64_t h[8], const uint64_t lanes[16][4], uint64_t t, uint64_t out[8][4])
+{
+    eh_lanes4 m[16], v[16];
+    for (int i = 0; i < 16; i++)
+        m[i] = (eh_lanes4){lanes[i][0], lanes[i][1], lanes[i][2], lanes[i][3]};
+    for (int i = 0; i < 8; i++) {
+        v[i] = (eh_lanes4){h[i], h[i], h[i], h[i]};
+        uint64_t iv = blake2b_IV[i];
+        if (i == 4)
+            iv ^= t;
+        else if (i == 6)
+            iv = ~iv;
+        v[i + 8] = (eh_lanes4){iv, iv, iv, iv};
+    }
+    Blake2bRounds(v, m);
+    for (int i = 0; i < 8; i++) {
+        eh_lanes4 hi = (eh_lanes4){h[i], h[i], h[i], h[i]} ^ v[i] ^ v[i + 8];
+        for (int j = 0; j < 4; j++)
+            out[i][j] = hi[j];
+    }
+}
+
+static void Blake2bLast4(const uint64_t h[8], const uint64_t lanes[16][4], uint64_t t, uint64_t out[8][4])
+{
+    Blake2bLast4Body(h, lanes, t, out);
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+__attribute__((target("avx2")))
+static void Blake2bLast4AVX2(const uint64_t h[8], const uint64_t lanes[16][4], uint64_t t, uint64_t out[8][4])
+{
+    Blake2bLast4Body(h, lanes, t, out);
+}
+#endif
+
+bool EhLeafHasher::Initialise(unsigned int N, unsigned int K, const unsigned char* input, size_t len)
+{
+    // Chains with their own N and K sum several hashes per leaf
+    if (ASSETCHAINS_NK[0] != 0 || ASSETCHAINS_NK[1] != 0)
+        return false;
+
+    // The index has to fit in the last block
+    const size_t nBlocks = (len + sizeof(eh_index) - 1) / 128;
+    if (nBlocks * 128 > len)
+        return false;
+
+    unsigned char personalization[crypto_generichash_blake2b_PERSONALBYTES] = {};
+    EhPersonalization(N, K, personalization);
+    outLen = (512 / N) * GetSizeInBytes(N);
+    for (int i = 0; i < 8; i++)
+        h[i] = blake2b_IV[i];
+    // Digest length, no key, fanout and depth of 1
+    h[0] ^= 0x01010000ULL ^ outLen;
+    h[6] ^= ReadLE64(personalization);
+    h[7] ^= ReadLE64(personalization + 8);
+    for (size_t b = 0; b < nBlocks; b++)
+        Blake2bCompress(h, input + 128 * b, 128 * (b + 1), false);
+
+    unsigned char block[128] = {};
+    tailLen = len - 128 * nBlocks;
+    memcpy(block, input + 128 * nBlocks, tailLen);
+    for (int i = 0; i < 16; i++)
+        lastBlock[i] = ReadLE64(block + 8 * i);
+    inputLen = len;
+    return true;
+}
+
+void EhLeafHasher::Hash(const eh_index* g, size_t n, unsigned char* out) const
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    static const bool fAVX2 = __builtin_cpu_supports("avx2");
+#endif
+    // The index lands in one or two words of the last block
+    const size_t w = tailLen / 8;
+    const size_t shift = 8 * (tailLen % 8);
+    for (size_t j = 0; j < n; j += 4) {
+        const size_t nLanes = std::min<size_t>(4, n - j);
+        uint64_t lanes[16][4];
+        for (size_t l = 0; l < 4; l++) {
+            // Spare lanes hash the last index again
+            const uint64_t index = g[j + std::min(l, nLanes - 1)];
+            for (int i = 0; i < 16; i++)
+                lanes[i][l] = lastBlock[i];
+            lanes[w][l] |= index << shift;
+            if (shift > 32)
+                lanes[w + 1][l] |= index >> (64 - shift);
+        }
+
+        uint64_t hashes[8][4];
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+        if (fAVX2)
+            Blake2bLast4AVX2(h, lanes, inputLen + sizeof(eh_index), hashes);
+        else
+#endif
+            Blake2bLast4(h, lanes, inputLen + sizeof(eh_index), hashes);
+
+        for (size_t l = 0; l < nLanes; l++) {
+            unsigned char hash[BLAKE2B_OUTBYTES];
+            for (int i = 0; i < 8; i++)
+                WriteLE64(hash + 8 * i, hashes[i][l]);
+            memcpy(out + (j + l) * outLen, hash, outLen);
+        }
+    }
+}
+
 void ExpandArray(const unsigned char* in, size_t in_len,
                  unsigned char* out, size_t out_len,
                  size_t bit_len, size_t byte_pad)
@@ -814,12 +995,42 @@ bool Equihash<N,K>::IsValidSolution(const eh_HashState& base_state, std::vector<
         return false;
     }
 
+    std::vector<eh_index> indices = GetIndicesFromMinimal(soln, CollisionBitLength);
+    std::vector<unsigned char> hashes(indices.size() * HashOutput);
+    for (size_t j = 0; j < indices.size(); j++) {
+        GenerateHash(base_state, indices[j]/IndicesPerHashOutput, &hashes[j * HashOutput], HashOutput, N);
+    }
+    return IsValidLeaves(indices, &hashes[0]);
+}
+
+template<unsigned int N, unsigned int K>
+bool Equihash<N,K>::IsValidSolution(const EhLeafHasher& leaves, std::vector<unsigned char> soln)
+{
+    if (soln.size() != SolutionWidth) {
+        LogPrint("pow", "Invalid solution length: %d (expected %d)\n",
+                 soln.size(), SolutionWidth);
+        return false;
+    }
+    assert(leaves.OutputLength() == HashOutput);
+
+    std::vector<eh_index> indices = GetIndicesFromMinimal(soln, CollisionBitLength);
+    std::vector<eh_index> g(indices.size());
+    for (size_t j = 0; j < indices.size(); j++) {
+        g[j] = indices[j]/IndicesPerHashOutput;
+    }
+    std::vector<unsigned char> hashes(indices.size() * HashOutput);
+    leaves.Hash(&g[0], g.size(), &hashes[0]);
+    return IsValidLeaves(indices, &hashes[0]);
+}
+
+template<unsigned int N, unsigned int K>
+bool Equihash<N,K>::IsValidLeaves(const std::vector<eh_index>& indices, const unsigned char* hashes)
+{
     std::vector<FullStepRow<FinalFullWidth>> X;
     X.reserve(1 << K);
-    unsigned char tmpHash[HashOutput];
-    for (eh_index i : GetIndicesFromMinimal(soln, CollisionBitLength)) {
-        GenerateHash(base_state, i/IndicesPerHashOutput, tmpHash, HashOutput, N);
-        X.emplace_back(tmpHash+((i % IndicesPerHashOutput) * GetSizeInBytes(N)),
+    for (size_t j = 0; j < indices.size(); j++) {
+        eh_index i = indices[j];
+        X.emplace_back(hashes + j * HashOutput + ((i % IndicesPerHashOutput) * GetSizeInBytes(N)),
                        GetSizeInBytes(N), HashLength, CollisionBitLength, i);
     }
 
@@ -864,6 +1075,7 @@ template bool Equihash<200,9>::OptimisedSolve(const eh_HashState& base_state,
                                               const std::function<bool(EhSolverCancelCheck)> cancelled);
 #endif
 template bool Equihash<200,9>::IsValidSolution(const eh_HashState& base_state, std::vector<unsigned char> soln);
+template bool Equihash<200,9>::IsValidSolution(const EhLeafHasher& leaves, std::vector<unsigned char> soln);
                                               
 // Explicit instantiations for Equihash<96,3>
 template int Equihash<150,5>::InitialiseState(eh_HashState& base_state);
@@ -876,6 +1088,7 @@ template bool Equihash<150,5>::OptimisedSolve(const eh_HashState& base_state,
                                              const std::function<bool(EhSolverCancelCheck)> cancelled);
 #endif
 template bool Equihash<150,5>::IsValidSolution(const eh_HashState& base_state, std::vector<unsigned char> soln);
+template bool Equihash<150,5>::IsValidSolution(const EhLeafHasher& leaves, std::vector<unsigned char> soln);
 
 // Explicit instantiations for Equihash<48,5>
 template int Equihash<144,5>::InitialiseState(eh_HashState& base_state);
@@ -888,6 +1101,7 @@ template bool Equihash<144,5>::OptimisedSolve(const eh_HashState& base_state,
                                              const std::function<bool(EhSolverCancelCheck)> cancelled);
 #endif
 template bool Equihash<144,5>::IsValidSolution(const eh_HashState& base_state, std::vector<unsigned char> soln);
+template bool Equihash<144,5>::IsValidSolution(const EhLeafHasher& leaves, std::vector<unsigned char> soln);
 
 // Explicit instantiations for Equihash<96,5>
 template int Equihash<ASSETCHAINS_N,ASSETCHAINS_K>::InitialiseState(eh_HashState& base_state);
@@ -900,6 +1114,7 @@ template bool Equihash<ASSETCHAINS_N,ASSETCHAINS_K>::OptimisedSolve(const eh_Has
                                              const std::function<bool(EhSolverCancelCheck)> cancelled);
 #endif
 template bool Equihash<ASSETCHAINS_N,ASSETCHAINS_K>::IsValidSolution(const eh_HashState& base_state, std::vector<unsigned char> soln);
+template bool Equihash<ASSETCHAINS_N,ASSETCHAINS_K>::IsValidSolution(const EhLeafHasher& leaves, std::vector<unsigned char> soln);
 
 // Explicit instantiations for Equihash<96,5>
 template int Equihash<48,5>::InitialiseState(eh_HashState& base_state);
@@ -912,6 +1127,7 @@ template bool Equihash<48,5>::OptimisedSolve(const eh_HashState& base_state,
                                              const std::function<bool(EhSolverCancelCheck)> cancelled);
 #endif
 template bool Equihash<48,5>::IsValidSolution(const eh_HashState& base_state, std::vector<unsigned char> soln);
+template bool Equihash<48,5>::IsValidSolution(const EhLeafHasher& leaves, std::vector<unsigned char> soln);
 
 // Explicit instantiations for Equihash<48,5>
 template int Equihash<210,9>::InitialiseState(eh_HashState& base_state);
@@ -924,3 +1140,4 @@ template bool Equihash<210,9>::OptimisedSolve(const eh_HashState& base_state,
                                              const std::function<bool(EhSolverCancelCheck)> cancelled);
 #endif
 template bool Equihash<210,9>::IsValidSolution(const eh_HashState& base_state, std::vector<unsigned char> soln);
+template bool Equihash<210,9>::IsValidSolution(const EhLeafHasher& leaves, std::vector<unsigned char> soln);
@@ -169,6 +169,33 @@ constexpr uint8_t GetSizeInBytes(size_t N)
     return static_cast<uint8_t>((N + 7) / 8);
 }
 
+/**
+ * Hashes the leaves of a solution, the Blake2b of the Equihash input
+ * followed by an index, from the chaining value after the blocks of the
+ * input that don't hold the index. Only the last block depends on the
+ * index, so the leaves are compressed four at a time in the lanes of vector
+ * registers, with AVX2 where the CPU has it.
+ */
+class EhLeafHasher
+{
+private:
+    uint64_t h[8];
+    //! Words of the last block, the index bytes left zero
+    uint64_t lastBlock[16];
+    size_t tailLen;
+    uint64_t inputLen;
+    size_t outLen;
+
+public:
+    EhLeafHasher() : tailLen(0), inputLen(0), outLen(0) {}
+
+    //! False when the leaves of these parameters and input need the generic hasher
+    bool Initialise(unsigned int N, unsigned int K, const unsigned char* input, size_t len);
+    //! Leaves of the n indices in g, written to out one after the other
+    void Hash(const eh_index* g, size_t n, unsigned char* out) const;
+    size_t OutputLength() const { return outLen; }
+};
+
 template<unsigned int N, unsigned int K>
 class Equihash
 {
@@ -201,6 +228,10 @@ public:
                         const std::function<bool(EhSolverCancelCheck)> cancelled);
 #endif
     bool IsValidSolution(const eh_HashState& base_state, std::vector<unsigned char> soln);
+    bool IsValidSolution(const EhLeafHasher& leaves, std::vector<unsigned char> soln);
+
+private:
+    bool IsValidLeaves(const std::vector<eh_index>& indices, const unsigned char* hashes);
 };
 
 #include "equihash.tcc"
@@ -311,4 +342,21 @@ inline bool EhOptimisedSolveUncancellable(unsigned int n, unsigned int k, const
         throw std::invalid_argument("Unsupported Equihash parameters"); \
     }
 
+#define EhIsValidSolutionLeaves(n, k, leaves, soln, ret)   \
+    if (n == 200 && k == 9) {                               \
+        ret = Eh200_9.IsValidSolution(leaves, soln);        \
+    } else if (n == 150 && k == 5) {                       \
+        ret = Eh150_5.IsValidSolution(leaves, soln);        \
+    } else if (n == 144 && k == 5) {                        \
+        ret = Eh144_5.IsValidSolution(leaves, soln);        \
+    } else if (n == ASSETCHAINS_N && k == ASSETCHAINS_K) { \
+        ret = Eh96_5.IsValidSolution(leaves, soln);         \
+    } else if (n == 48 && k == 5) {                        \
+        ret = Eh48_5.IsValidSolution(leaves, soln);         \
+    } else if (n == 210 && k == 9) {                       \
+        ret = Eh210_9.IsValidSolution(leaves, soln);        \
+    } else {                                               \
+        throw std::invalid_argument("Unsupported Equihash parameters"); \
+    }
+
 #endif // BITCOIN_EQUIHASH_H
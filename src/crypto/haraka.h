@@ -88,6 +88,12 @@ extern u128 rc[40];
   AES4(s2[0], s2[1], s2[2], s2[3], rci); \
   AES4(s3[0], s3[1], s3[2], s3[3], rci);
 
+#define AES4_zero_4x(s0, s1, s2, s3, rci) \
+  AES4_zero(s0[0], s0[1], s0[2], s0[3], rci); \
+  AES4_zero(s1[0], s1[1], s1[2], s1[3], rci); \
+  AES4_zero(s2[0], s2[1], s2[2], s2[3], rci); \
+  AES4_zero(s3[0], s3[1], s3[2], s3[3], rci);
+
 #define AES4_8x(s0, s1, s2, s3, s4, s5, s6, s7, rci) \
   AES4_4x(s0, s1, s2, s3, rci); \
   AES4_4x(s4, s5, s6, s7, rci);
@@ -128,5 +134,7 @@ void haraka512_zero(unsigned char *out, const unsigned char *in);
 void haraka512_keyed(unsigned char *out, const unsigned char *in, const u128 *rc);
 void haraka512_4x(unsigned char *out, const unsigned char *in);
 void haraka512_8x(unsigned char *out, const unsigned char *in);
+void haraka512_zero_4x(unsigned char *out, const unsigned char *in);
+void haraka512_zero_8x(unsigned char *out, const unsigned char *in);
 
 #endif
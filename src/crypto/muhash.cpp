@@ -0,0 +1,161 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "crypto/muhash.h"
+
+#include "crypto/common.h"
+#include "crypto/sha256.h"
+#include "crypto/sha512.h"
+
+#include <string.h>
+
+namespace
+{
+//! 2^3072 - MAX_PRIME_DIFF is the largest 3072 bit prime
+const uint32_t MAX_PRIME_DIFF = 1103717;
+
+//! Adds extra * 2^3072 to the number, which is extra * MAX_PRIME_DIFF modulo the prime
+void FoldHigh(uint32_t* limbs, uint64_t extra)
+{
+    while (extra != 0) {
+        uint64_t carry = extra * MAX_PRIME_DIFF;
+        for (int i = 0; i < Num3072::LIMBS && carry != 0; i++) {
+            uint64_t cur = (uint64_t)limbs[i] + (carry & 0xffffffff);
+            limbs[i] = (uint32_t)cur;
+            carry = (carry >> 32) + (cur >> 32);
+        }
+        extra = carry;
+    }
+}
+
+//! Subtracts the prime if the number is not below it
+void FinalReduce(uint32_t* limbs)
+{
+    // The number is at least the prime exactly when adding MAX_PRIME_DIFF carries out of 3072 bits
+    uint32_t tmp[Num3072::LIMBS];
+    uint64_t carry = MAX_PRIME_DIFF;
+    for (int i = 0; i < Num3072::LIMBS; i++) {
+        uint64_t cur = (uint64_t)limbs[i] + carry;
+        tmp[i] = (uint32_t)cur;
+        carry = cur >> 32;
+    }
+    if (carry != 0)
+        memcpy(limbs, tmp, sizeof(tmp));
+}
+} // namespace
+
+Num3072::Num3072(const unsigned char data[BYTE_SIZE])
+{
+    for (int i = 0; i < LIMBS; i++)
+        limbs[i] = ReadLE32(data + 4 * i);
+    FinalReduce(limbs);
+}
+
+void Num3072::SetToOne()
+{
+    limbs[0] = 1;
+    for (int i = 1; i < LIMBS; i++)
+        limbs[i] = 0;
+}
+
+void Num3072::Multiply(const Num3072& a)
+{
+    uint32_t t[2 * LIMBS];
+    memset(t, 0, sizeof(t));
+    for (int i = 0; i < LIMBS; i++) {
+        uint64_t carry = 0;
+        for (int j = 0; j < LIMBS; j++) {
+            uint64_t cur = (uint64_t)t[i + j] + (uint64_t)limbs[i] * a.limbs[j] + carry;
+            t[i + j] = (uint32_t)cur;
+            carry = cur >> 32;
+        }
+        t[i + LIMBS] = (uint32_t)carry;
+    }
+
+    // The product is low + high * 2^3072, that is low + high * MAX_PRIME_DIFF
+    uint64_t carry = 0;
+    for (int i = 0; i < LIMBS; i++) {
+        uint64_t cur = (uint64_t)t[i] + (uint64_t)t[i + LIMBS] * MAX_PRIME_DIFF + carry;
+        limbs[i] = (uint32_t)cur;
+        carry = cur >> 32;
+    }
+    FoldHigh(limbs, carry);
+    FinalReduce(limbs);
+}
+
+Num3072 Num3072::GetInverse() const
+{
+    // Fermat: the inverse is the number to the power prime - 2 = 2^3072 - (MAX_PRIME_DIFF + 2)
+    uint32_t exponent[LIMBS];
+    exponent[0] = (uint32_t)(0 - (MAX_PRIME_DIFF + 2));
+    for (int i = 1; i < LIMBS; i++)
+        exponent[i] = 0xffffffff;
+
+    Num3072 result;
+    for (int i = LIMBS * 32 - 1; i >= 0; i--) {
+        result.Multiply(result);
+        if ((exponent[i / 32] >> (i % 32)) & 1)
+            result.Multiply(*this);
+    }
+    return result;
+}
+
+void Num3072::ToBytes(unsigned char out[BYTE_SIZE]) const
+{
+    for (int i = 0; i < LIMBS; i++)
+        WriteLE32(out + 4 * i, limbs[i]);
+}
+
+Num3072 MuHash3072::ToNum3072(const unsigned char* data, size_t len)
+{
+    // The element is hashed to a key, which is expanded to 3072 bits with SHA-512 in counter mode
+    unsigned char key[CSHA256::OUTPUT_SIZE];
+    CSHA256().Write(data, len).Finalize(key);
+
+    unsigned char bytes[Num3072::BYTE_SIZE];
+    for (unsigned char i = 0; i < Num3072::BYTE_SIZE / CSHA512::OUTPUT_SIZE; i++)
+        CSHA512().Write(key, sizeof(key)).Write(&i, 1).Finalize(bytes + i * CSHA512::OUTPUT_SIZE);
+    return Num3072(bytes);
+}
+
+MuHash3072& MuHash3072::Insert(const unsigned char* data, size_t len)
+{
+    numerator.Multiply(ToNum3072(data, len));
+    return *this;
+}
+
+MuHash3072& MuHash3072::Remove(const unsigned char* data, size_t len)
+{
+    denominator.Multiply(ToNum3072(data, len));
+    return *this;
+}
+
+MuHash3072& MuHash3072::operator*=(const MuHash3072& mul)
+{
+    numerator.Multiply(mul.numerator);
+    denominator.Multiply(mul.denominator);
+    return *this;
+}
+
+void MuHash3072::Finalize(unsigned char hash[OUTPUT_SIZE]) const
+{
+    Num3072 result = numerator;
+    result.Multiply(denominator.GetInverse());
+
+    unsigned char bytes[Num3072::BYTE_SIZE];
+    result.ToBytes(bytes);
+    CSHA256().Write(bytes, sizeof(bytes)).Finalize(hash);
+}
+
+void MuHash3072::ToBytes(unsigned char out[SERIALIZED_SIZE]) const
+{
+    numerator.ToBytes(out);
+    denominator.ToBytes(out + Num3072::BYTE_SIZE);
+}
+
+void MuHash3072::FromBytes(const unsigned char in[SERIALIZED_SIZE])
+{
+    numerator = Num3072(in);
+    denominator = Num3072(in + Num3072::BYTE_SIZE);
+}
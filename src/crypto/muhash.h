@@ -0,0 +1,66 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CRYPTO_MUHASH_H
+#define BITCOIN_CRYPTO_MUHASH_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/** A number modulo the prime 2^3072 - 1103717, in little endian 32 bit limbs */
+class Num3072
+{
+public:
+    static const int LIMBS = 96;
+    static const size_t BYTE_SIZE = 384;
+
+    uint32_t limbs[LIMBS];
+
+    Num3072() { SetToOne(); }
+    //! Reads a little endian number, reduced modulo the prime
+    explicit Num3072(const unsigned char data[BYTE_SIZE]);
+
+    void SetToOne();
+    void Multiply(const Num3072& a);
+    Num3072 GetInverse() const;
+    void ToBytes(unsigned char out[BYTE_SIZE]) const;
+};
+
+/**
+ * A hash of a set of byte strings that can be updated one element at a time,
+ * in any order: elements are mapped to numbers modulo a 3072 bit prime and
+ * the set hash is their product. Removing an element multiplies a separate
+ * denominator, so no inverse is needed until the hash is finalized.
+ *
+ * Inserting and removing the same element cancel out, which makes it
+ * suitable to follow the UTXO set as blocks are connected and disconnected.
+ */
+class MuHash3072
+{
+private:
+    Num3072 numerator;
+    Num3072 denominator;
+
+    static Num3072 ToNum3072(const unsigned char* data, size_t len);
+
+public:
+    static const size_t OUTPUT_SIZE = 32;
+    static const size_t SERIALIZED_SIZE = 2 * Num3072::BYTE_SIZE;
+
+    //! The hash of the empty set
+    MuHash3072() {}
+
+    MuHash3072& Insert(const unsigned char* data, size_t len);
+    MuHash3072& Remove(const unsigned char* data, size_t len);
+    //! Adds the elements of another set hash
+    MuHash3072& operator*=(const MuHash3072& mul);
+
+    //! Hash of the set. Computes an inverse, which takes a few milliseconds.
+    void Finalize(unsigned char hash[OUTPUT_SIZE]) const;
+
+    void ToBytes(unsigned char out[SERIALIZED_SIZE]) const;
+    void FromBytes(const unsigned char in[SERIALIZED_SIZE]);
+};
+
+#endif // BITCOIN_CRYPTO_MUHASH_H
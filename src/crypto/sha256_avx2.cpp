@@ -0,0 +1,45 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+//
+// 8-way double SHA-256 of 64 byte messages, built with -mavx -mavx2.
+
+#ifdef ENABLE_AVX2
+
+#include <stdint.h>
+#include <immintrin.h>
+
+#include "crypto/sha256_multiway.h"
+
+namespace sha256d64_avx2
+{
+namespace
+{
+
+struct Vec8 {
+    typedef __m256i type;
+    static const int N = 8;
+
+    static inline __m256i Set1(uint32_t x) { return _mm256_set1_epi32(x); }
+    static inline __m256i Add(__m256i x, __m256i y) { return _mm256_add_epi32(x, y); }
+    static inline __m256i Xor(__m256i x, __m256i y) { return _mm256_xor_si256(x, y); }
+    static inline __m256i Or(__m256i x, __m256i y) { return _mm256_or_si256(x, y); }
+    static inline __m256i And(__m256i x, __m256i y) { return _mm256_and_si256(x, y); }
+    template <int n>
+    static inline __m256i ShR(__m256i x) { return _mm256_srli_epi32(x, n); }
+    template <int n>
+    static inline __m256i ShL(__m256i x) { return _mm256_slli_epi32(x, n); }
+    static inline __m256i Load(const uint32_t* lanes) { return _mm256_loadu_si256((const __m256i*)lanes); }
+    static inline void Store(uint32_t* lanes, __m256i x) { _mm256_storeu_si256((__m256i*)lanes, x); }
+};
+
+} // namespace
+
+void Transform_8way(unsigned char* out, const unsigned char* in)
+{
+    sha256_multiway::TransformD64<Vec8>(out, in);
+}
+
+} // namespace sha256d64_avx2
+
+#endif
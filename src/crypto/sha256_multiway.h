@@ -0,0 +1,156 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CRYPTO_SHA256_MULTIWAY_H
+#define BITCOIN_CRYPTO_SHA256_MULTIWAY_H
+
+#include "crypto/common.h"
+
+#include <stdint.h>
+
+/**
+ * Double SHA-256 of several 64 byte messages at once, one message per lane of
+ * a SIMD vector. Only included by the translation units built for a specific
+ * instruction set (sha256_sse41.cpp, sha256_avx2.cpp). Everything is in an
+ * anonymous namespace so code compiled with those flags can never be picked
+ * by the linker for a caller built without them.
+ *
+ * Vec provides the lane type and operations:
+ *   typedef ... type;   static const int N;   (lanes)
+ *   Set1, Add, Xor, Or, And, ShR<n>, ShL<n>, Load(const uint32_t*), Store(uint32_t*, type)
+ */
+namespace
+{
+namespace sha256_multiway
+{
+
+const uint32_t K[64] = {
+    0x428a2f98ul, 0x71374491ul, 0xb5c0fbcful, 0xe9b5dba5ul, 0x3956c25bul, 0x59f111f1ul, 0x923f82a4ul, 0xab1c5ed5ul,
+    0xd807aa98ul, 0x12835b01ul, 0x243185beul, 0x550c7dc3ul, 0x72be5d74ul, 0x80deb1feul, 0x9bdc06a7ul, 0xc19bf174ul,
+    0xe49b69c1ul, 0xefbe4786ul, 0x0fc19dc6ul, 0x240ca1ccul, 0x2de92c6ful, 0x4a7484aaul, 0x5cb0a9dcul, 0x76f988daul,
+    0x983e5152ul, 0xa831c66dul, 0xb00327c8ul, 0xbf597fc7ul, 0xc6e00bf3ul, 0xd5a79147ul, 0x06ca6351ul, 0x14292967ul,
+    0x27b70a85ul, 0x2e1b2138ul, 0x4d2c6dfcul, 0x53380d13ul, 0x650a7354ul, 0x766a0abbul, 0x81c2c92eul, 0x92722c85ul,
+    0xa2bfe8a1ul, 0xa81a664bul, 0xc24b8b70ul, 0xc76c51a3ul, 0xd192e819ul, 0xd6990624ul, 0xf40e3585ul, 0x106aa070ul,
+    0x19a4c116ul, 0x1e376c08ul, 0x2748774cul, 0x34b0bcb5ul, 0x391c0cb3ul, 0x4ed8aa4aul, 0x5b9cca4ful, 0x682e6ff3ul,
+    0x748f82eeul, 0x78a5636ful, 0x84c87814ul, 0x8cc70208ul, 0x90befffaul, 0xa4506cebul, 0xbef9a3f7ul, 0xc67178f2ul};
+
+const uint32_t INIT[8] = {0x6a09e667ul, 0xbb67ae85ul, 0x3c6ef372ul, 0xa54ff53aul, 0x510e527ful, 0x9b05688cul, 0x1f83d9abul, 0x5be0cd19ul};
+
+/** Round constants plus message schedule of the padding block that follows a 64 byte message. */
+struct PaddingSchedule {
+    uint32_t wk[64];
+
+    PaddingSchedule() {
+        uint32_t w[64] = {0x80000000ul, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 512};
+        for (int i = 16; i < 64; i++) {
+            uint32_t s0 = (w[i - 15] >> 7 | w[i - 15] << 25) ^ (w[i - 15] >> 18 | w[i - 15] << 14) ^ (w[i - 15] >> 3);
+            uint32_t s1 = (w[i - 2] >> 17 | w[i - 2] << 15) ^ (w[i - 2] >> 19 | w[i - 2] << 13) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        for (int i = 0; i < 64; i++) {
+            wk[i] = w[i] + K[i];
+        }
+    }
+};
+
+template <typename Vec>
+struct Ops {
+    typedef typename Vec::type V;
+
+    template <int n>
+    static inline V Rotr(V x) { return Vec::Or(Vec::template ShR<n>(x), Vec::template ShL<32 - n>(x)); }
+
+    static inline V Ch(V x, V y, V z) { return Vec::Xor(z, Vec::And(x, Vec::Xor(y, z))); }
+    static inline V Maj(V x, V y, V z) { return Vec::Or(Vec::And(x, y), Vec::And(z, Vec::Or(x, y))); }
+    static inline V Sigma0(V x) { return Vec::Xor(Vec::Xor(Rotr<2>(x), Rotr<13>(x)), Rotr<22>(x)); }
+    static inline V Sigma1(V x) { return Vec::Xor(Vec::Xor(Rotr<6>(x), Rotr<11>(x)), Rotr<25>(x)); }
+    static inline V sigma0(V x) { return Vec::Xor(Vec::Xor(Rotr<7>(x), Rotr<18>(x)), Vec::template ShR<3>(x)); }
+    static inline V sigma1(V x) { return Vec::Xor(Vec::Xor(Rotr<17>(x), Rotr<19>(x)), Vec::template ShR<10>(x)); }
+
+    static inline void Expand(V* w) {
+        for (int i = 16; i < 64; i++) {
+            w[i] = Vec::Add(Vec::Add(w[i - 16], sigma0(w[i - 15])), Vec::Add(w[i - 7], sigma1(w[i - 2])));
+        }
+    }
+
+    //! 64 rounds on s, with wk[i] the round constant plus message word of round i
+    static inline void Rounds(V* s, const V* wk) {
+        V a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+        for (int i = 0; i < 64; i++) {
+            V t1 = Vec::Add(Vec::Add(h, Sigma1(e)), Vec::Add(Ch(e, f, g), wk[i]));
+            V t2 = Vec::Add(Sigma0(a), Maj(a, b, c));
+            h = g; g = f; f = e; e = Vec::Add(d, t1);
+            d = c; c = b; b = a; a = Vec::Add(t1, t2);
+        }
+        s[0] = Vec::Add(s[0], a); s[1] = Vec::Add(s[1], b); s[2] = Vec::Add(s[2], c); s[3] = Vec::Add(s[3], d);
+        s[4] = Vec::Add(s[4], e); s[5] = Vec::Add(s[5], f); s[6] = Vec::Add(s[6], g); s[7] = Vec::Add(s[7], h);
+    }
+
+    static inline void AddK(V* w) {
+        for (int i = 0; i < 64; i++) {
+            w[i] = Vec::Add(w[i], Vec::Set1(K[i]));
+        }
+    }
+};
+
+/** Writes the double SHA-256 of the Vec::N 64 byte messages at in to the Vec::N 32 byte hashes at out. */
+template <typename Vec>
+void TransformD64(unsigned char* out, const unsigned char* in)
+{
+    typedef typename Vec::type V;
+    typedef Ops<Vec> O;
+    static const PaddingSchedule padding;
+
+    uint32_t lanes[Vec::N];
+    V w[64];
+    V s[8];
+
+    // First hash, block 1: the messages
+    for (int i = 0; i < 16; i++) {
+        for (int j = 0; j < Vec::N; j++) {
+            lanes[j] = ReadBE32(in + 64 * j + 4 * i);
+        }
+        w[i] = Vec::Load(lanes);
+    }
+    O::Expand(w);
+    O::AddK(w);
+    for (int i = 0; i < 8; i++) {
+        s[i] = Vec::Set1(INIT[i]);
+    }
+    O::Rounds(s, w);
+
+    // First hash, block 2: padding, the same for every lane
+    for (int i = 0; i < 64; i++) {
+        w[i] = Vec::Set1(padding.wk[i]);
+    }
+    O::Rounds(s, w);
+
+    // Second hash of the 32 byte first hash, one padded block
+    for (int i = 0; i < 8; i++) {
+        w[i] = s[i];
+    }
+    w[8] = Vec::Set1(0x80000000ul);
+    for (int i = 9; i < 15; i++) {
+        w[i] = Vec::Set1(0);
+    }
+    w[15] = Vec::Set1(256);
+    O::Expand(w);
+    O::AddK(w);
+    for (int i = 0; i < 8; i++) {
+        s[i] = Vec::Set1(INIT[i]);
+    }
+    O::Rounds(s, w);
+
+    for (int i = 0; i < 8; i++) {
+        Vec::Store(lanes, s[i]);
+        for (int j = 0; j < Vec::N; j++) {
+            WriteBE32(out + 32 * j + 4 * i, lanes[j]);
+        }
+    }
+}
+
+} // namespace sha256_multiway
+} // namespace
+
+#endif // BITCOIN_CRYPTO_SHA256_MULTIWAY_H
@@ -0,0 +1,205 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+//
+// SHA-256 using the x86 SHA extensions, built with -msse4 -msha. Follows the
+// structure of Intel's reference code: the state is kept as ABEF/CDGH and
+// every SHA256RNDS2 instruction performs two rounds.
+
+#ifdef ENABLE_SHANI
+
+#include <stdint.h>
+#include <string.h>
+#include <immintrin.h>
+
+#include "crypto/common.h"
+
+namespace
+{
+
+const uint32_t K[64] = {
+    0x428a2f98ul, 0x71374491ul, 0xb5c0fbcful, 0xe9b5dba5ul, 0x3956c25bul, 0x59f111f1ul, 0x923f82a4ul, 0xab1c5ed5ul,
+    0xd807aa98ul, 0x12835b01ul, 0x243185beul, 0x550c7dc3ul, 0x72be5d74ul, 0x80deb1feul, 0x9bdc06a7ul, 0xc19bf174ul,
+    0xe49b69c1ul, 0xefbe4786ul, 0x0fc19dc6ul, 0x240ca1ccul, 0x2de92c6ful, 0x4a7484aaul, 0x5cb0a9dcul, 0x76f988daul,
+    0x983e5152ul, 0xa831c66dul, 0xb00327c8ul, 0xbf597fc7ul, 0xc6e00bf3ul, 0xd5a79147ul, 0x06ca6351ul, 0x14292967ul,
+    0x27b70a85ul, 0x2e1b2138ul, 0x4d2c6dfcul, 0x53380d13ul, 0x650a7354ul, 0x766a0abbul, 0x81c2c92eul, 0x92722c85ul,
+    0xa2bfe8a1ul, 0xa81a664bul, 0xc24b8b70ul, 0xc76c51a3ul, 0xd192e819ul, 0xd6990624ul, 0xf40e3585ul, 0x106aa070ul,
+    0x19a4c116ul, 0x1e376c08ul, 0x2748774cul, 0x34b0bcb5ul, 0x391c0cb3ul, 0x4ed8aa4aul, 0x5b9cca4ful, 0x682e6ff3ul,
+    0x748f82eeul, 0x78a5636ful, 0x84c87814ul, 0x8cc70208ul, 0x90befffaul, 0xa4506cebul, 0xbef9a3f7ul, 0xc67178f2ul};
+
+const uint32_t INIT[8] = {0x6a09e667ul, 0xbb67ae85ul, 0x3c6ef372ul, 0xa54ff53aul, 0x510e527ful, 0x9b05688cul, 0x1f83d9abul, 0x5be0cd19ul};
+
+//! The padding block following a 64 byte message, and the one completing a 32 byte message
+const unsigned char PAD64[64] = {0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 0};
+const unsigned char PAD32[32] = {0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0};
+
+inline __m128i Load(const unsigned char* in)
+{
+    const __m128i MASK = _mm_set_epi64x(0x0c0d0e0f08090a0bull, 0x0405060700010203ull);
+    return _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)in), MASK);
+}
+
+inline void QuadRound(__m128i& s0, __m128i& s1, __m128i m, int i)
+{
+    const __m128i msg = _mm_add_epi32(m, _mm_loadu_si128((const __m128i*)(K + 4 * i)));
+    s1 = _mm_sha256rnds2_epu32(s1, s0, msg);
+    s0 = _mm_sha256rnds2_epu32(s0, s1, _mm_shuffle_epi32(msg, 0x0e));
+}
+
+//! Partial message schedule: m0 is prepared for the computation of the word four quads later
+inline void ShiftMessageA(__m128i& m0, __m128i m1)
+{
+    m0 = _mm_sha256msg1_epu32(m0, m1);
+}
+
+//! Completes m2 from the partial schedule in m0 and the words in m1
+inline void ShiftMessageC(__m128i m0, __m128i m1, __m128i& m2)
+{
+    m2 = _mm_sha256msg2_epu32(_mm_add_epi32(m2, _mm_alignr_epi8(m1, m0, 4)), m1);
+}
+
+inline void ShiftMessageB(__m128i& m0, __m128i m1, __m128i& m2)
+{
+    ShiftMessageC(m0, m1, m2);
+    ShiftMessageA(m0, m1);
+}
+
+//! From ABCD/EFGH to the ABEF/CDGH layout the instructions use
+inline void Shuffle(__m128i& s0, __m128i& s1)
+{
+    const __m128i t1 = _mm_shuffle_epi32(s0, 0xB1);
+    const __m128i t2 = _mm_shuffle_epi32(s1, 0x1B);
+    s0 = _mm_alignr_epi8(t1, t2, 0x08);
+    s1 = _mm_blend_epi16(t2, t1, 0xF0);
+}
+
+inline void Unshuffle(__m128i& s0, __m128i& s1)
+{
+    const __m128i t1 = _mm_shuffle_epi32(s0, 0x1B);
+    const __m128i t2 = _mm_shuffle_epi32(s1, 0xB1);
+    s0 = _mm_blend_epi16(t1, t2, 0xF0);
+    s1 = _mm_alignr_epi8(t2, t1, 0x08);
+}
+
+//! Processes one 64 byte block for each of the N states, interleaving the independent streams
+template <int N>
+inline __attribute__((always_inline)) void ProcessBlocks(__m128i* s0, __m128i* s1, const unsigned char* const* chunks)
+{
+    __m128i m0[N], m1[N], m2[N], m3[N], so0[N], so1[N];
+    for (int j = 0; j < N; j++) {
+        so0[j] = s0[j];
+        so1[j] = s1[j];
+        m0[j] = Load(chunks[j]);
+        m1[j] = Load(chunks[j] + 16);
+        m2[j] = Load(chunks[j] + 32);
+        m3[j] = Load(chunks[j] + 48);
+    }
+
+    for (int j = 0; j < N; j++) QuadRound(s0[j], s1[j], m0[j], 0);
+    for (int j = 0; j < N; j++) QuadRound(s0[j], s1[j], m1[j], 1);
+    for (int j = 0; j < N; j++) ShiftMessageA(m0[j], m1[j]);
+    for (int j = 0; j < N; j++) QuadRound(s0[j], s1[j], m2[j], 2);
+    for (int j = 0; j < N; j++) ShiftMessageA(m1[j], m2[j]);
+    for (int j = 0; j < N; j++) QuadRound(s0[j], s1[j], m3[j], 3);
+    for (int i = 4; i < 16; i += 4) {
+        for (int j = 0; j < N; j++) ShiftMessageB(m2[j], m3[j], m0[j]);
+        for (int j = 0; j < N; j++) QuadRound(s0[j], s1[j], m0[j], i);
+        for (int j = 0; j < N; j++) ShiftMessageB(m3[j], m0[j], m1[j]);
+        for (int j = 0; j < N; j++) QuadRound(s0[j], s1[j], m1[j], i + 1);
+        if (i < 12) {
+            for (int j = 0; j < N; j++) ShiftMessageB(m0[j], m1[j], m2[j]);
+            for (int j = 0; j < N; j++) QuadRound(s0[j], s1[j], m2[j], i + 2);
+            for (int j = 0; j < N; j++) ShiftMessageB(m1[j], m2[j], m3[j]);
+        } else {
+            // The last words need no further schedule
+            for (int j = 0; j < N; j++) ShiftMessageC(m0[j], m1[j], m2[j]);
+            for (int j = 0; j < N; j++) QuadRound(s0[j], s1[j], m2[j], i + 2);
+            for (int j = 0; j < N; j++) ShiftMessageC(m1[j], m2[j], m3[j]);
+        }
+        for (int j = 0; j < N; j++) QuadRound(s0[j], s1[j], m3[j], i + 3);
+    }
+
+    for (int j = 0; j < N; j++) {
+        s0[j] = _mm_add_epi32(s0[j], so0[j]);
+        s1[j] = _mm_add_epi32(s1[j], so1[j]);
+    }
+}
+
+inline void LoadState(__m128i& s0, __m128i& s1, const uint32_t* s)
+{
+    s0 = _mm_loadu_si128((const __m128i*)s);
+    s1 = _mm_loadu_si128((const __m128i*)(s + 4));
+    Shuffle(s0, s1);
+}
+
+inline void StoreState(uint32_t* s, __m128i s0, __m128i s1)
+{
+    Unshuffle(s0, s1);
+    _mm_storeu_si128((__m128i*)s, s0);
+    _mm_storeu_si128((__m128i*)(s + 4), s1);
+}
+
+//! Double SHA-256 of N 64 byte messages
+template <int N>
+inline __attribute__((always_inline)) void TransformD64(unsigned char* out, const unsigned char* in)
+{
+    __m128i s0[N], s1[N];
+    const unsigned char* chunks[N];
+    unsigned char buf[N][64];
+    uint32_t s[8];
+
+    for (int j = 0; j < N; j++) {
+        LoadState(s0[j], s1[j], INIT);
+        chunks[j] = in + 64 * j;
+    }
+    ProcessBlocks<N>(s0, s1, chunks);
+    for (int j = 0; j < N; j++) {
+        chunks[j] = PAD64;
+    }
+    ProcessBlocks<N>(s0, s1, chunks);
+
+    for (int j = 0; j < N; j++) {
+        StoreState(s, s0[j], s1[j]);
+        for (int i = 0; i < 8; i++) {
+            WriteBE32(buf[j] + 4 * i, s[i]);
+        }
+        memcpy(buf[j] + 32, PAD32, 32);
+        LoadState(s0[j], s1[j], INIT);
+        chunks[j] = buf[j];
+    }
+    ProcessBlocks<N>(s0, s1, chunks);
+
+    for (int j = 0; j < N; j++) {
+        StoreState(s, s0[j], s1[j]);
+        for (int i = 0; i < 8; i++) {
+            WriteBE32(out + 32 * j + 4 * i, s[i]);
+        }
+    }
+}
+
+} // namespace
+
+namespace sha256_shani
+{
+void Transform(uint32_t* s, const unsigned char* chunk, size_t blocks)
+{
+    __m128i s0, s1;
+    LoadState(s0, s1, s);
+    while (blocks--) {
+        ProcessBlocks<1>(&s0, &s1, &chunk);
+        chunk += 64;
+    }
+    StoreState(s, s0, s1);
+}
+}
+
+namespace sha256d64_shani
+{
+void Transform_2way(unsigned char* out, const unsigned char* in)
+{
+    TransformD64<2>(out, in);
+}
+}
+
+#endif
@@ -0,0 +1,45 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+//
+// 4-way double SHA-256 of 64 byte messages, built with -msse4.1.
+
+#ifdef ENABLE_SSE41
+
+#include <stdint.h>
+#include <immintrin.h>
+
+#include "crypto/sha256_multiway.h"
+
+namespace sha256d64_sse41
+{
+namespace
+{
+
+struct Vec4 {
+    typedef __m128i type;
+    static const int N = 4;
+
+    static inline __m128i Set1(uint32_t x) { return _mm_set1_epi32(x); }
+    static inline __m128i Add(__m128i x, __m128i y) { return _mm_add_epi32(x, y); }
+    static inline __m128i Xor(__m128i x, __m128i y) { return _mm_xor_si128(x, y); }
+    static inline __m128i Or(__m128i x, __m128i y) { return _mm_or_si128(x, y); }
+    static inline __m128i And(__m128i x, __m128i y) { return _mm_and_si128(x, y); }
+    template <int n>
+    static inline __m128i ShR(__m128i x) { return _mm_srli_epi32(x, n); }
+    template <int n>
+    static inline __m128i ShL(__m128i x) { return _mm_slli_epi32(x, n); }
+    static inline __m128i Load(const uint32_t* lanes) { return _mm_loadu_si128((const __m128i*)lanes); }
+    static inline void Store(uint32_t* lanes, __m128i x) { _mm_storeu_si128((__m128i*)lanes, x); }
+};
+
+} // namespace
+
+void Transform_4way(unsigned char* out, const unsigned char* in)
+{
+    sha256_multiway::TransformD64<Vec4>(out, in);
+}
+
+} // namespace sha256d64_sse41
+
+#endif
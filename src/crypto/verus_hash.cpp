@@ -13,6 +13,20 @@ bit output.
 #include "crypto/verus_hash.h"
 
 void (*CVerusHash::haraka512Function)(unsigned char *out, const unsigned char *in);
+void (*CVerusHash::haraka512BatchFunction)(unsigned char *out, const unsigned char *in);
+
+// Without AES-NI there is nothing to interleave, the lanes are hashed one by one
+static void haraka512_port_zero_batch(unsigned char *out, const unsigned char *in)
+{
+    for (int i = 0; i < VERUSHASH_EXTRA_BATCH; i++)
+        haraka512_port_zero(out + 32 * i, in + 64 * i);
+}
+
+static void haraka512_port_batch(unsigned char *out, const unsigned char *in)
+{
+    for (int i = 0; i < VERUSHASH_EXTRA_BATCH; i++)
+        haraka512_port(out + 32 * i, in + 64 * i);
+}
 
 void CVerusHash::Hash(void *result, const void *data, size_t _len)
 {
@@ -52,10 +66,12 @@ void CVerusHash::init()
     if (IsCPUVerusOptimized())
     {
         haraka512Function = &haraka512_zero;
+        haraka512BatchFunction = &haraka512_zero_8x;
     }
     else
     {
         haraka512Function = &haraka512_port_zero;
+        haraka512BatchFunction = &haraka512_port_zero_batch;
     }
 }
 
@@ -96,6 +112,7 @@ void verus_hash(void *result, const void *data, size_t len)
 }
 
 void (*CVerusHashV2::haraka512Function)(unsigned char *out, const unsigned char *in);
+void (*CVerusHashV2::haraka512BatchFunction)(unsigned char *out, const unsigned char *in);
 void (*CVerusHashV2::haraka512KeyedFunction)(unsigned char *out, const unsigned char *in, const u128 *rc);
 void (*CVerusHashV2::haraka256Function)(unsigned char *out, const unsigned char *in);
 
@@ -105,6 +122,7 @@ void CVerusHashV2::init()
     {
         load_constants();
         haraka512Function = &haraka512;
+        haraka512BatchFunction = &haraka512_8x;
         haraka512KeyedFunction = &haraka512_keyed;
         haraka256Function = &haraka256;
     }
@@ -113,6 +131,7 @@ void CVerusHashV2::init()
         // load the haraka constants
         load_constants_port();
         haraka512Function = &haraka512_port;
+        haraka512BatchFunction = &haraka512_port_batch;
         haraka512KeyedFunction = &haraka512_port_keyed;
         haraka256Function = &haraka256_port;
     }
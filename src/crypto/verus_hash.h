@@ -23,11 +23,15 @@ extern "C"
 #include "crypto/haraka_portable.h"
 }
 
+//! Extra nonces ExtraHashBatch hashes per call, one per interleaved Haraka lane
+static const int VERUSHASH_EXTRA_BATCH = 8;
+
 class CVerusHash
 {
     public:
         static void Hash(void *result, const void *data, size_t len);
         static void (*haraka512Function)(unsigned char *out, const unsigned char *in);
+        static void (*haraka512BatchFunction)(unsigned char *out, const unsigned char *in);
 
         static void init();
 
@@ -54,6 +58,19 @@ class CVerusHash
         }
         void ExtraHash(unsigned char hash[32]) { (*haraka512Function)(hash, curBuf); }
 
+        //! ExtraHash with VERUSHASH_EXTRA_BATCH consecutive extra nonces from nonce, the 32 byte hashes one after another
+        void ExtraHashBatch(unsigned char *hashes, int64_t nonce)
+        {
+            alignas(16) unsigned char lanes[VERUSHASH_EXTRA_BATCH * 64];
+            for (int i = 0; i < VERUSHASH_EXTRA_BATCH; i++)
+            {
+                int64_t laneNonce = nonce + i;
+                std::memcpy(lanes + 64 * i, curBuf, 64);
+                std::memcpy(lanes + 64 * i + 32, &laneNonce, sizeof(laneNonce));
+            }
+            (*haraka512BatchFunction)(hashes, lanes);
+        }
+
         void Finalize(unsigned char hash[32])
         {
             if (curPos)
@@ -77,6 +94,7 @@ class CVerusHashV2
     public:
         static void Hash(void *result, const void *data, size_t len);
         static void (*haraka512Function)(unsigned char *out, const unsigned char *in);
+        static void (*haraka512BatchFunction)(unsigned char *out, const unsigned char *in);
         static void (*haraka512KeyedFunction)(unsigned char *out, const unsigned char *in, const u128 *rc);
         static void (*haraka256Function)(unsigned char *out, const unsigned char *in);
 
@@ -130,6 +148,19 @@ class CVerusHashV2
         inline void ExtraHash(unsigned char hash[32]) { (*haraka512Function)(hash, curBuf); }
         inline void ExtraHashKeyed(unsigned char hash[32], u128 *key) { (*haraka512KeyedFunction)(hash, curBuf, key); }
 
+        //! ExtraHash with VERUSHASH_EXTRA_BATCH consecutive extra nonces from nonce, the 32 byte hashes one after another
+        inline void ExtraHashBatch(unsigned char *hashes, int64_t nonce)
+        {
+            alignas(16) unsigned char lanes[VERUSHASH_EXTRA_BATCH * 64];
+            for (int i = 0; i < VERUSHASH_EXTRA_BATCH; i++)
+            {
+                int64_t laneNonce = nonce + i;
+                std::memcpy(lanes + 64 * i, curBuf, 64);
+                std::memcpy(lanes + 64 * i + 32, &laneNonce, sizeof(laneNonce));
+            }
+            (*haraka512BatchFunction)(hashes, lanes);
+        }
+
         void Finalize(unsigned char hash[32])
         {
             if (curPos)
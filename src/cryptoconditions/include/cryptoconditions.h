@@ -47,6 +47,14 @@ enum CCTypeId {
 typedef int (*VerifyEval)(struct CC *cond, void *context);
 
 
+/*
+ * Secp256k1 signature verification callback, returns 1 if signature is a
+ * valid compact signature of msg32 by the compressed publicKey
+ */
+typedef int (*VerifySecp256k1)(const uint8_t *publicKey, const uint8_t *signature,
+                               const uint8_t *msg32, void *context);
+
+
 
 /*
  * Crypto Condition
@@ -69,6 +77,9 @@ typedef struct CC {
         struct { uint8_t fingerprint[32]; uint32_t subtypes; unsigned long cost; 
                  struct CCType *conditionType; };
     };
+    // fingerprint of a decoded condition, computed once by the first encoding
+    uint8_t cachedFingerprint[32];
+    int cacheFingerprint, hasCachedFingerprint;
 } CC;
 
 /*
@@ -89,11 +100,18 @@ int             cc_isFulfilled(const CC *cond);
 int             cc_verify(const struct CC *cond, const uint8_t *msg, size_t msgLength,
                         int doHashMessage, const uint8_t *condBin, size_t condBinLength,
                         VerifyEval verifyEval, void *evalContext);
+int             cc_verifyExt(const struct CC *cond, const uint8_t *msg, size_t msgLength,
+                        int doHashMessage, const uint8_t *condBin, size_t condBinLength,
+                        VerifyEval verifyEval, void *evalContext,
+                        VerifySecp256k1 verifySecp256k1, void *secp256k1Context);
 int             cc_visit(CC *cond, struct CCVisitor visitor);
+int             cc_verifyEval(const CC *cond, VerifyEval verify, void *context);
 int             cc_signTreeEd25519(CC *cond, const uint8_t *privateKey, const uint8_t *msg,
                         const size_t msgLength);
 int             cc_signTreeSecp256k1Msg32(CC *cond, const uint8_t *privateKey, const uint8_t *msg32);
 int             cc_secp256k1VerifyTreeMsg32(const CC *cond, const uint8_t *msg32);
+int             cc_secp256k1VerifyMsg32(const uint8_t *publicKey, const uint8_t *signature,
+                        const uint8_t *msg32);
 size_t          cc_conditionBinary(const CC *cond, uint8_t *buf);
 size_t          cc_fulfillmentBinary(const CC *cond, uint8_t *buf, size_t bufLength);
 struct CC*      cc_conditionFromJSON(cJSON *params, char *err);
@@ -101,6 +119,7 @@ struct CC*      cc_conditionFromJSONString(const char *json, char *err);
 struct CC*      cc_readConditionBinary(const uint8_t *cond_bin, size_t cond_bin_len);
 struct CC*      cc_readFulfillmentBinary(const uint8_t *ffill_bin, size_t ffill_bin_len);
 int             cc_readFulfillmentBinaryExt(const unsigned char *ffill_bin, size_t ffill_bin_len, CC **ppcc);
+int             cc_isFulfillmentBinary(const uint8_t *ffill_bin, size_t ffill_bin_len);
 struct CC*      cc_new(int typeId);
 struct cJSON*   cc_conditionToJSON(const CC *cond);
 char*           cc_conditionToJSONString(const CC *cond);
@@ -63,7 +63,7 @@ void appendUriSubtypes(uint32_t mask, unsigned char *buf) {
 
 char *cc_conditionUri(const CC *cond) {
     unsigned char *fp = calloc(1, 32);
-    cond->type->fingerprint(cond, fp);
+    ccFingerprint(cond, fp);
 
     unsigned char *encoded = base64_encode(fp, 32);
 
@@ -149,11 +149,33 @@ void asnCondition(const CC *cond, Condition_t *asn) {
     choice->cost = cc_getCost(cond);
     choice->fingerprint.size = 32;
     choice->fingerprint.buf = calloc(1, 32);
-    cond->type->fingerprint(cond, choice->fingerprint.buf);
+    ccFingerprint(cond, choice->fingerprint.buf);
     choice->subtypes = asnSubtypes(cond->type->getSubtypes(cond));
 }
 
 
+/*
+ * The fingerprint of a node only depends on its public parts, not on the
+ * signatures, so the one of a condition read from a fulfillment, which is
+ * only verified, is kept on the node once computed. A threshold hashes the
+ * conditions of all its children, so without this every encoding of the
+ * tree, for the signature hash and then in cc_verify, hashes it all again.
+ * Conditions built by the caller may still be changed, so they are not kept.
+ */
+void ccFingerprint(const CC *cond, uint8_t *fp) {
+    CC *node = (CC*) cond;
+    if (!node->cacheFingerprint) {
+        cond->type->fingerprint(cond, fp);
+        return;
+    }
+    if (!node->hasCachedFingerprint) {
+        cond->type->fingerprint(cond, node->cachedFingerprint);
+        node->hasCachedFingerprint = 1;
+    }
+    memcpy(fp, node->cachedFingerprint, 32);
+}
+
+
 Condition_t *asnConditionNew(const CC *cond) {
     Condition_t *asn = calloc(1, sizeof(Condition_t));
     asnCondition(cond, asn);
@@ -191,61 +213,94 @@ CC *fulfillmentToCC(Fulfillment_t *ffill) {
 }
 
 
-CC *cc_readFulfillmentBinary(const unsigned char *ffill_bin, size_t ffill_bin_len) {
-    CC *cond = 0;
-    unsigned char *buf = calloc(1,ffill_bin_len);
+/*
+ * Decodes a fulfillment and checks that it is in its DER encoding, so that a
+ * fulfillment has a single binary. Returns 0 and sets *pffill, which the caller
+ * frees, else the same error codes as cc_readFulfillmentBinaryExt.
+ */
+static int decodeFulfillment(const unsigned char *ffill_bin, size_t ffill_bin_len, Fulfillment_t **pffill) {
+    int error = 0;
+    unsigned char stackbuf[BUF_SIZE];
+    // Fulfillments of transaction inputs fit the stack buffer
+    unsigned char *buf = ffill_bin_len <= BUF_SIZE ? stackbuf : calloc(1,ffill_bin_len);
     Fulfillment_t *ffill = 0;
     asn_dec_rval_t rval = ber_decode(0, &asn_DEF_Fulfillment, (void **)&ffill, ffill_bin, ffill_bin_len);
     if (rval.code != RC_OK) {
+        error = rval.code;
         goto end;
     }
     // Do malleability check
     asn_enc_rval_t rc = der_encode_to_buffer(&asn_DEF_Fulfillment, ffill, buf, ffill_bin_len);
     if (rc.encoded == -1) {
         fprintf(stderr, "FULFILLMENT NOT ENCODED\n");
+        error = -1;
         goto end;
     }
     if (rc.encoded != ffill_bin_len || 0 != memcmp(ffill_bin, buf, rc.encoded)) {
+        error = (rc.encoded == ffill_bin_len) ? -3 : -2;
         goto end;
     }
-    
-    cond = fulfillmentToCC(ffill);
 end:
-    free(buf);
-    if (ffill) ASN_STRUCT_FREE(asn_DEF_Fulfillment, ffill);
+    if (buf != stackbuf) free(buf);
+    if (error && ffill) {
+        ASN_STRUCT_FREE(asn_DEF_Fulfillment, ffill);
+        ffill = 0;
+    }
+    *pffill = ffill;
+    return error;
+}
+
+
+static int markFingerprintCached(CC *cond, CCVisitor visitor) {
+    cond->cacheFingerprint = 1;
+    return 1;
+}
+
+
+static CC *decodedFulfillmentToCC(Fulfillment_t *ffill) {
+    CC *cond = fulfillmentToCC(ffill);
+    if (cond) {
+        CCVisitor visitor = {&markFingerprintCached, NULL, 0, NULL};
+        cc_visit(cond, visitor);
+    }
     return cond;
 }
 
-int cc_readFulfillmentBinaryExt(const unsigned char *ffill_bin, size_t ffill_bin_len, CC **ppcc) {
 
-    int error = 0;
-    unsigned char *buf = calloc(1,ffill_bin_len);
+CC *cc_readFulfillmentBinary(const unsigned char *ffill_bin, size_t ffill_bin_len) {
+    CC *cond = 0;
     Fulfillment_t *ffill = 0;
-    asn_dec_rval_t rval = ber_decode(0, &asn_DEF_Fulfillment, (void **)&ffill, ffill_bin, ffill_bin_len);
-    if (rval.code != RC_OK) {
-        error = rval.code;
-        goto end;
-    }
-    // Do malleability check
-    asn_enc_rval_t rc = der_encode_to_buffer(&asn_DEF_Fulfillment, ffill, buf, ffill_bin_len);
-    if (rc.encoded == -1) {
-        fprintf(stderr, "FULFILLMENT NOT ENCODED\n");
-        error = -1;
-        goto end;
+    if (decodeFulfillment(ffill_bin, ffill_bin_len, &ffill) == 0) {
+        cond = decodedFulfillmentToCC(ffill);
+        ASN_STRUCT_FREE(asn_DEF_Fulfillment, ffill);
     }
-    if (rc.encoded != ffill_bin_len || 0 != memcmp(ffill_bin, buf, rc.encoded)) {
-        error = (rc.encoded == ffill_bin_len) ? -3 : -2;
-        goto end;
+    return cond;
+}
+
+int cc_readFulfillmentBinaryExt(const unsigned char *ffill_bin, size_t ffill_bin_len, CC **ppcc) {
+    Fulfillment_t *ffill = 0;
+    int error = decodeFulfillment(ffill_bin, ffill_bin_len, &ffill);
+    if (error == 0) {
+        *ppcc = decodedFulfillmentToCC(ffill);
+        ASN_STRUCT_FREE(asn_DEF_Fulfillment, ffill);
     }
-    
-    *ppcc = fulfillmentToCC(ffill);
-end:
-    free(buf);
-    if (ffill) ASN_STRUCT_FREE(asn_DEF_Fulfillment, ffill);
     return error;
 }
 
 
+/*
+ * Whether ffill_bin is a fulfillment cc_readFulfillmentBinary would read,
+ * for callers that only test an input and don't keep the condition.
+ */
+int cc_isFulfillmentBinary(const unsigned char *ffill_bin, size_t ffill_bin_len) {
+    CC *cond = cc_readFulfillmentBinary(ffill_bin, ffill_bin_len);
+    if (!cond)
+        return 0;
+    cc_free(cond);
+    return 1;
+}
+
+
 int cc_visit(CC *cond, CCVisitor visitor) {
     int out = visitor.visit(cond, visitor);
     if (out && cond->type->visitChildren) {
@@ -257,6 +312,19 @@ int cc_visit(CC *cond, CCVisitor visitor) {
 int cc_verify(const struct CC *cond, const unsigned char *msg, size_t msgLength, int doHashMsg,
               const unsigned char *condBin, size_t condBinLength,
               VerifyEval verifyEval, void *evalContext) {
+    return cc_verifyExt(cond, msg, msgLength, doHashMsg, condBin, condBinLength,
+                        verifyEval, evalContext, NULL, NULL);
+}
+
+
+/*
+ * As cc_verify, with the secp256k1 signatures of the tree checked by
+ * verifySecp256k1 unless it is NULL
+ */
+int cc_verifyExt(const struct CC *cond, const unsigned char *msg, size_t msgLength, int doHashMsg,
+                 const unsigned char *condBin, size_t condBinLength,
+                 VerifyEval verifyEval, void *evalContext,
+                 VerifySecp256k1 verifySecp256k1, void *secp256k1Context) {
     unsigned char targetBinary[1000];
     //fprintf(stderr,"in cc_verify cond.%p msg.%p[%d] dohash.%d condbin.%p[%d]\n",cond,msg,(int32_t)msgLength,doHashMsg,condBin,(int32_t)condBinLength);
     const size_t binLength = cc_conditionBinary(cond, targetBinary);
@@ -277,7 +345,7 @@ int cc_verify(const struct CC *cond, const unsigned char *msg, size_t msgLength,
     //    fprintf(stderr,"%02x",msgHash[z]);
     //fprintf(stderr," msgHash msglen.%d\n",(int32_t)msgLength);
 
-    if (!cc_secp256k1VerifyTreeMsg32(cond, msgHash)) {
+    if (!cc_secp256k1VerifyTreeMsg32Ext(cond, msgHash, verifySecp256k1, secp256k1Context)) {
         fprintf(stderr," cc_verify error C\n");
         return 0;
     }
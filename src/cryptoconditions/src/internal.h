@@ -65,6 +65,7 @@ uint32_t fromAsnSubtypes(ConditionTypes_t types);
 CC *mkAnon(const Condition_t *asnCond);
 void asnCondition(const CC *cond, Condition_t *asn);
 Condition_t *asnConditionNew(const CC *cond);
+void ccFingerprint(const CC *cond, uint8_t *fp);
 Fulfillment_t *asnFulfillmentNew(const CC *cond);
 struct CC *fulfillmentToCC(Fulfillment_t *ffill);
 struct CCType *getTypeByAsnEnum(Condition_PR present);
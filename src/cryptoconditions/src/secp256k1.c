@@ -95,30 +95,52 @@ static void secp256k1Fingerprint(const CC *cond, uint8_t *out) {
 }
 
 
-int secp256k1Verify(CC *cond, CCVisitor visitor) {
-    if (cond->type->typeId != CC_Secp256k1Type.typeId) return 1;
+int cc_secp256k1VerifyMsg32(const unsigned char *publicKey, const unsigned char *signature,
+                            const unsigned char *msg32) {
     initVerify();
 
     int rc;
 
     // parse pubkey
     secp256k1_pubkey pk;
-    rc = secp256k1_ec_pubkey_parse(ec_ctx_verify, &pk, cond->publicKey, SECP256K1_PK_SIZE);
+    rc = secp256k1_ec_pubkey_parse(ec_ctx_verify, &pk, publicKey, SECP256K1_PK_SIZE);
     if (rc != 1) return 0;
 
     // parse siganature
     secp256k1_ecdsa_signature sig;
-    rc = secp256k1_ecdsa_signature_parse_compact(ec_ctx_verify, &sig, cond->signature);
+    rc = secp256k1_ecdsa_signature_parse_compact(ec_ctx_verify, &sig, signature);
     if (rc != 1) return 0;
 
     // Only accepts lower S signatures
-    rc = secp256k1_ecdsa_verify(ec_ctx_verify, &sig, visitor.msg, &pk);
+    rc = secp256k1_ecdsa_verify(ec_ctx_verify, &sig, msg32, &pk);
     if (rc != 1) return 0;
 
     return 1;
 }
 
 
+/*
+ * Visitor context of a tree verification that hands each signature to a
+ * callback of the caller, such as a cache of the signatures already checked
+ */
+typedef struct Secp256k1VerifyContext {
+    VerifySecp256k1 verify;
+    void *context;
+} Secp256k1VerifyContext;
+
+
+int secp256k1Verify(CC *cond, CCVisitor visitor) {
+    if (cond->type->typeId != CC_Secp256k1Type.typeId) return 1;
+    if (!cond->signature) return 0;
+
+    if (visitor.context) {
+        Secp256k1VerifyContext *ctx = visitor.context;
+        return ctx->verify(cond->publicKey, cond->signature, visitor.msg, ctx->context) == 1;
+    }
+    return cc_secp256k1VerifyMsg32(cond->publicKey, cond->signature, visitor.msg);
+}
+
+
 int cc_secp256k1VerifyTreeMsg32(const CC *cond, const unsigned char *msg32) {
     int subtypes = cc_typeMask(cond);
     if (subtypes & (1 << CC_PrefixType.typeId) &&
@@ -133,6 +155,21 @@ int cc_secp256k1VerifyTreeMsg32(const CC *cond, const unsigned char *msg32) {
 }
 
 
+int cc_secp256k1VerifyTreeMsg32Ext(const CC *cond, const unsigned char *msg32,
+                                   VerifySecp256k1 verify, void *context) {
+    if (!verify)
+        return cc_secp256k1VerifyTreeMsg32(cond, msg32);
+    int subtypes = cc_typeMask(cond);
+    if (subtypes & (1 << CC_PrefixType.typeId) &&
+        subtypes & (1 << CC_Secp256k1Type.typeId)) {
+        return 0;
+    }
+    Secp256k1VerifyContext ctx = {verify, context};
+    CCVisitor visitor = {&secp256k1Verify, msg32, 0, &ctx};
+    return cc_visit((CC*)cond, visitor);
+}
+
+
 /*
  * Signing data
  */
@@ -0,0 +1,124 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CUCKOOCACHE_H
+#define BITCOIN_CUCKOOCACHE_H
+
+#include "crypto/common.h"
+#include "crypto/sha256.h"
+#include "random.h"
+#include "uint256.h"
+
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#ifdef _WIN32
+#undef __cpuid
+#endif
+#include <boost/thread.hpp>
+
+/**
+ * Fixed size set of 256 bit keys, used by the caches of checks found valid.
+ * The table is allocated once for nEntries keys, and a key can sit in one of
+ * CUCKOO_WAYS slots taken from its own words. A key whose slots are all
+ * taken pushes one of their keys on to another of its slots, and so on for
+ * a bounded number of moves; the last key moved is dropped when it finds no
+ * free slot, which with keys a peer can't predict is a random eviction.
+ *
+ * Keys have to be uniformly distributed, so they are the SHA256 of the data
+ * salted with the random salt of the cache, from Hasher(). Nothing is
+ * allocated on insertion, and lookups only take the lock shared.
+ */
+class CCuckooCache
+{
+public:
+    static const unsigned int CUCKOO_WAYS = 8;
+
+private:
+    std::vector<uint256> table;
+    uint256 salt;
+    unsigned int nMaxMoves;
+    unsigned int nInsertions;
+    //! Slots taken, read without the lock
+    std::atomic<size_t> nEntries;
+    boost::shared_mutex cs_cuckoocache;
+
+    void Slots(const uint256& key, uint32_t slots[CUCKOO_WAYS]) const
+    {
+        for (unsigned int i = 0; i < CUCKOO_WAYS; i++)
+            slots[i] = (uint64_t)ReadLE32(key.begin() + 4 * i) * table.size() >> 32;
+    }
+
+public:
+    //! A size of 0 or less disables the cache
+    explicit CCuckooCache(int64_t nEntries) : salt(GetRandHash()), nMaxMoves(1), nInsertions(0), nEntries(0)
+    {
+        if (nEntries <= 0)
+            return;
+        table.resize(std::min<int64_t>(nEntries, (int64_t)1 << 32));
+        while (((size_t)1 << nMaxMoves) < table.size())
+            nMaxMoves++;
+    }
+
+    //! SHA256 hasher of the keys of this cache
+    CSHA256 Hasher() const
+    {
+        CSHA256 hasher;
+        hasher.Write(salt.begin(), 32);
+        return hasher;
+    }
+
+    size_t Size() const { return nEntries.load(std::memory_order_relaxed); }
+    size_t Capacity() const { return table.size(); }
+
+    bool Contains(const uint256& key)
+    {
+        if (table.empty() || key.IsNull())
+            return false;
+        uint32_t slots[CUCKOO_WAYS];
+        Slots(key, slots);
+        boost::shared_lock<boost::shared_mutex> lock(cs_cuckoocache);
+        for (unsigned int i = 0; i < CUCKOO_WAYS; i++)
+            if (table[slots[i]] == key)
+                return true;
+        return false;
+    }
+
+    void Insert(uint256 key)
+    {
+        // The null key marks a free slot
+        if (table.empty() || key.IsNull())
+            return;
+        uint32_t slots[CUCKOO_WAYS];
+        Slots(key, slots);
+        boost::unique_lock<boost::shared_mutex> lock(cs_cuckoocache);
+        for (unsigned int i = 0; i < CUCKOO_WAYS; i++)
+            if (table[slots[i]] == key)
+                return;
+
+        uint32_t slot = slots[nInsertions++ % CUCKOO_WAYS];
+        for (unsigned int nMoves = 0; ; nMoves++) {
+            for (unsigned int i = 0; i < CUCKOO_WAYS; i++) {
+                if (table[slots[i]].IsNull()) {
+                    table[slots[i]] = key;
+                    nEntries.fetch_add(1, std::memory_order_relaxed);
+                    return;
+                }
+            }
+            if (nMoves == nMaxMoves)
+                return;
+            // Take the slot, and move its key on to the one after it
+            std::swap(table[slot], key);
+            Slots(key, slots);
+            unsigned int i = 0;
+            while (i < CUCKOO_WAYS - 1 && slots[i] != slot)
+                i++;
+            slot = slots[(i + 1) % CUCKOO_WAYS];
+        }
+    }
+};
+
+#endif // BITCOIN_CUCKOOCACHE_H
@@ -45,12 +45,31 @@ class CDBBatch
 private:
     const CDBWrapper &parent;
     leveldb::WriteBatch batch;
+    //! Bytes the queued changes take in the LevelDB log
+    size_t size_estimate;
+
+    //! Length prefix LevelDB writes in front of a key or value of nSize bytes
+    static size_t VarIntSize(size_t nSize)
+    {
+        size_t nLen = 1;
+        while (nSize >>= 7)
+            nLen++;
+        return nLen;
+    }
 
 public:
     /**
      * @param[in] _parent   CDBWrapper that this batch is to be submitted to
      */
-    CDBBatch(const CDBWrapper &_parent) : parent(_parent) { };
+    CDBBatch(const CDBWrapper &_parent) : parent(_parent), size_estimate(0) { };
+
+    void Clear()
+    {
+        batch.Clear();
+        size_estimate = 0;
+    }
+
+    size_t SizeEstimate() const { return size_estimate; }
 
     template <typename K, typename V>
     void Write(const K& key, const V& value)
@@ -66,6 +85,8 @@ public:
         leveldb::Slice slValue(&ssValue[0], ssValue.size());
 
         batch.Put(slKey, slValue);
+        // One byte of type, the length prefixes, the key and the value
+        size_estimate += 1 + VarIntSize(slKey.size()) + slKey.size() + VarIntSize(slValue.size()) + slValue.size();
     }
 
     template <typename K>
@@ -77,6 +98,20 @@ public:
         leveldb::Slice slKey(&ssKey[0], ssKey.size());
 
         batch.Delete(slKey);
+        size_estimate += 1 + VarIntSize(slKey.size()) + slKey.size();
+    }
+
+    //! Queues an already serialized entry, to move entries between databases
+    void WriteRaw(const std::string& strKey, const std::string& strValue)
+    {
+        batch.Put(strKey, strValue);
+        size_estimate += 1 + VarIntSize(strKey.size()) + strKey.size() + VarIntSize(strValue.size()) + strValue.size();
+    }
+
+    void EraseRaw(const std::string& strKey)
+    {
+        batch.Delete(strKey);
+        size_estimate += 1 + VarIntSize(strKey.size()) + strKey.size();
     }
 };
 
@@ -152,6 +187,12 @@ public:
         return piter->value().size();
     }
 
+    //! Copies the serialized key and value of the entry
+    void GetRaw(std::string& strKey, std::string& strValue) {
+        strKey = piter->key().ToString();
+        strValue = piter->value().ToString();
+    }
+
 };
 
 class CDBWrapper
@@ -267,6 +308,25 @@ public:
         return new CDBIterator(*this, pdb->NewIterator(iteroptions));
     }
 
+    //! Iterator over the database as it was when snapshot was taken
+    CDBIterator *NewIterator(const leveldb::Snapshot* snapshot)
+    {
+        leveldb::ReadOptions options = iteroptions;
+        options.snapshot = snapshot;
+        return new CDBIterator(*this, pdb->NewIterator(options));
+    }
+
+    //! A consistent view for several iterators, released with ReleaseSnapshot
+    const leveldb::Snapshot* GetSnapshot()
+    {
+        return pdb->GetSnapshot();
+    }
+
+    void ReleaseSnapshot(const leveldb::Snapshot* snapshot)
+    {
+        pdb->ReleaseSnapshot(snapshot);
+    }
+
     /**
      * Return true if the database managed by this class contains no entries.
      */
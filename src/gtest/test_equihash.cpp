@@ -81,6 +81,43 @@ TEST(equihash_tests, is_probably_duplicate) {
 }
 
 #ifdef ENABLE_MINING
+TEST(equihash_tests, leaf_hasher) {
+    // Input lengths with the index in one word of the last block, across two, and at its start
+    for (size_t len : {0, 108, 109, 123, 140, 256}) {
+        std::vector<unsigned char> input(len);
+        for (size_t i = 0; i < len; i++) {
+            input[i] = i * 7 + 3;
+        }
+
+        Equihash<200,9> Eh200_9;
+        crypto_generichash_blake2b_state base_state;
+        Eh200_9.InitialiseState(base_state);
+        crypto_generichash_blake2b_update(&base_state, input.data(), input.size());
+
+        EhLeafHasher leaves;
+        ASSERT_TRUE(leaves.Initialise(200, 9, input.data(), input.size()));
+        ASSERT_EQ(leaves.OutputLength(), 50u);
+
+        // Not a multiple of the four lanes
+        std::vector<eh_index> g = {0, 1, 2, 12345, 0xdeadbeef, 1048575, 7};
+        std::vector<unsigned char> hashes(g.size() * leaves.OutputLength());
+        leaves.Hash(g.data(), g.size(), hashes.data());
+        for (size_t j = 0; j < g.size(); j++) {
+            crypto_generichash_blake2b_state state = base_state;
+            eh_index lei = htole32(g[j]);
+            crypto_generichash_blake2b_update(&state, (const unsigned char*) &lei, sizeof(eh_index));
+            std::vector<unsigned char> expected(leaves.OutputLength());
+            crypto_generichash_blake2b_final(&state, expected.data(), expected.size());
+            EXPECT_EQ(expected, std::vector<unsigned char>(hashes.begin() + j * expected.size(), hashes.begin() + (j + 1) * expected.size()));
+        }
+    }
+
+    // The index would not be in the last block
+    EhLeafHasher leaves;
+    std::vector<unsigned char> input(125);
+    EXPECT_FALSE(leaves.Initialise(200, 9, input.data(), input.size()));
+}
+
 TEST(equihash_tests, check_basic_solver_cancelled) {
     Equihash<48,5> Eh48_5;
     crypto_generichash_blake2b_state state;
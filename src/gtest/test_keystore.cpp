@@ -296,6 +296,43 @@ TEST(keystore_tests, StoreAndRetrieveHDSeedInEncryptedStore) {
     EXPECT_EQ(seed3, seedOut);
 }
 
+TEST(keystore_tests, UnlockWithBackgroundKeyCheck) {
+    bool fSaved = fBackgroundKeyCheck;
+    for (bool fBackground : {false, true}) {
+        fBackgroundKeyCheck = fBackground;
+        TestCCryptoKeyStore keyStore;
+        CKeyingMaterial vMasterKey(32, 0);
+        GetRandBytes(vMasterKey.data(), 32);
+
+        // Enough keys for the thorough check to use several threads
+        std::vector<CKey> keys;
+        for (int i = 0; i < 600; i++) {
+            CKey key;
+            key.MakeNewKey(true);
+            ASSERT_TRUE(keyStore.AddKeyPubKey(key, key.GetPubKey()));
+            keys.push_back(key);
+        }
+        ASSERT_TRUE(keyStore.EncryptKeys(vMasterKey));
+
+        CKeyingMaterial vModifiedKey(vMasterKey);
+        vModifiedKey[0] += 1;
+        EXPECT_FALSE(keyStore.Unlock(vModifiedKey));
+        EXPECT_TRUE(keyStore.IsLocked());
+
+        ASSERT_TRUE(keyStore.Unlock(vMasterKey));
+        for (const CKey& key : keys) {
+            CKey keyOut;
+            ASSERT_TRUE(keyStore.GetKey(key.GetPubKey().GetID(), keyOut));
+            EXPECT_TRUE(key == keyOut);
+        }
+
+        // Unlocking again while the background check may still run
+        ASSERT_TRUE(keyStore.Lock());
+        ASSERT_TRUE(keyStore.Unlock(vMasterKey));
+    }
+    fBackgroundKeyCheck = fSaved;
+}
+
 TEST(keystore_tests, store_and_retrieve_spending_key_in_encrypted_store) {
     TestCCryptoKeyStore keyStore;
     uint256 r {GetRandHash()};
@@ -370,4 +407,34 @@ TEST(keystore_tests, store_and_retrieve_spending_key_in_encrypted_store) {
     ASSERT_EQ(1, addrs.count(addr));
     ASSERT_EQ(1, addrs.count(addr2));
 }
+
+TEST(keystore_tests, MasterKeyArgon2idDerivation) {
+    SecureString strPassphrase("passphrase");
+    CMasterKey kMasterKey;
+    kMasterKey.vchSalt.assign(WALLET_CRYPTO_SALT_SIZE, 7);
+    mapArgs["-walletkdfmemory"] = "1";
+    mapArgs["-walletkdftime"] = "10";
+    ASSERT_TRUE(CalibrateMasterKeyDerivation(kMasterKey, strPassphrase));
+    EXPECT_EQ(WALLET_KDF_ARGON2ID_LANES, kMasterKey.nDerivationMethod);
+    EXPECT_GE(kMasterKey.nDeriveIterations, 1);
+
+    // The master key encrypted with the derived key decrypts with the same passphrase only
+    CKeyingMaterial vMasterKey(WALLET_CRYPTO_KEY_SIZE, 3), vDecrypted;
+    CCrypter crypter;
+    ASSERT_TRUE(crypter.SetKeyFromPassphrase(strPassphrase, kMasterKey));
+    ASSERT_TRUE(crypter.Encrypt(vMasterKey, kMasterKey.vchCryptedKey));
+    CCrypter crypter2;
+    ASSERT_TRUE(crypter2.SetKeyFromPassphrase(strPassphrase, kMasterKey));
+    ASSERT_TRUE(crypter2.Decrypt(kMasterKey.vchCryptedKey, vDecrypted));
+    EXPECT_TRUE(vDecrypted == vMasterKey);
+    ASSERT_TRUE(crypter2.SetKeyFromPassphrase(SecureString("other"), kMasterKey));
+    EXPECT_FALSE(crypter2.Decrypt(kMasterKey.vchCryptedKey, vDecrypted) && vDecrypted == vMasterKey);
+
+    // Parameters outside the limits are refused
+    CMasterKey kBad = kMasterKey;
+    kBad.vchOtherDerivationParameters.clear();
+    EXPECT_FALSE(crypter2.SetKeyFromPassphrase(strPassphrase, kBad));
+    mapArgs.erase("-walletkdfmemory");
+    mapArgs.erase("-walletkdftime");
+}
 #endif
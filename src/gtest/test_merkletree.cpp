@@ -342,3 +342,62 @@ TEST(merkletree, testZeroElements) {
         ASSERT_TRUE(newTree.root() == oldroot);
     }
 }
+
+TEST(merkletree, appendBatch) {
+    // Small values are valid Jubjub base field elements
+    auto commitment = [](size_t i) {
+        uint256 cm;
+        *cm.begin() = i & 0xff;
+        *(cm.begin() + 1) = i >> 8;
+        return libzcash::PedersenHash(cm);
+    };
+
+    const size_t batchSizes[] = {0, 1, 2, 3, 4, 5, 7, 8, 13, 40, 100};
+    for (size_t start = 0; start < 9; start++) {
+        for (size_t n : batchSizes) {
+            SaplingMerkleTree sequential, batched;
+            for (size_t i = 0; i < start; i++) {
+                sequential.append(commitment(i));
+                batched.append(commitment(i));
+            }
+            boost::optional<SaplingWitness> witnessSequential, witnessBatched;
+            if (start > 0) {
+                witnessSequential = sequential.witness();
+                witnessBatched = batched.witness();
+            }
+
+            std::vector<libzcash::PedersenHash> objs;
+            for (size_t i = start; i < start + n; i++) {
+                objs.push_back(commitment(i));
+                sequential.append(objs.back());
+                if (witnessSequential) {
+                    witnessSequential->append(objs.back());
+                }
+            }
+            batched.append_batch(objs);
+            if (witnessBatched) {
+                witnessBatched->append_batch(objs);
+            }
+
+            ASSERT_TRUE(batched == sequential);
+            ASSERT_TRUE(batched.root() == sequential.root());
+            if (witnessBatched) {
+                ASSERT_TRUE(*witnessBatched == *witnessSequential);
+                ASSERT_TRUE(witnessBatched->root() == batched.root());
+            }
+        }
+    }
+
+    // A batch that doesn't fit leaves the tree as it was
+    SaplingTestingMerkleTree tree;
+    std::vector<libzcash::PedersenHash> objs;
+    for (size_t i = 0; i < 17; i++) {
+        objs.push_back(commitment(i));
+    }
+    ASSERT_THROW(tree.append_batch(objs), std::runtime_error);
+    ASSERT_TRUE(tree.size() == 0);
+    objs.pop_back();
+    tree.append_batch(objs);
+    ASSERT_TRUE(tree.size() == 16);
+    ASSERT_THROW(tree.append(commitment(16)), std::runtime_error);
+}
@@ -277,6 +277,20 @@ TEST(noteencryption, SaplingApi)
     );
     ASSERT_TRUE(message == plaintext_2);
 
+    // Try to decrypt with several keys at once
+    {
+        std::vector<uint256> ivks = {uint256(), ivk, uint256S("1"), ivk};
+        auto matches = AttemptSaplingEncDecryption(ciphertext_1, ivks, epk_1);
+        ASSERT_EQ(2u, matches.size());
+        ASSERT_EQ(1u, matches[0].first);
+        ASSERT_EQ(3u, matches[1].first);
+        ASSERT_TRUE(message == matches[0].second);
+        ASSERT_TRUE(message == matches[1].second);
+
+        ASSERT_TRUE(AttemptSaplingEncDecryption(ciphertext_1, std::vector<uint256>{uint256S("1")}, epk_1).empty());
+        ASSERT_TRUE(AttemptSaplingEncDecryption(ciphertext_1, std::vector<uint256>(), epk_1).empty());
+    }
+
     auto small_plaintext_2 = *AttemptSaplingOutDecryption(
         out_ciphertext_2,
         sk.ovk,
@@ -8,6 +8,7 @@
 #include "wallet/wallet.h"
 #include "amount.h"
 
+#include <algorithm>
 #include <array>
 #include <memory>
 #include <string>
@@ -209,3 +210,50 @@ TEST(paymentdisclosure, mainnet) {
     mydb.DebugDumpAllStdout();
 #endif
 }
+
+// Entries written in one batch are read back together by txid, other transactions' entries aren't
+TEST(paymentdisclosure, batchbytxid) {
+    SelectParams(CBaseChainParams::MAIN);
+
+    boost::filesystem::path pathTemp = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    boost::filesystem::create_directories(pathTemp);
+    mapArgs["-datadir"] = pathTemp.string();
+
+    PaymentDisclosureDBTest mydb(pathTemp);
+
+    uint256 txid = random_uint256();
+    std::vector<PaymentDisclosureKeyInfo> entries;
+    for (uint64_t js = 0; js < 300; js += 100) {
+        for (uint8_t n = 0; n < 2; n++) {
+            PaymentDisclosureInfo info;
+            info.esk = random_uint256();
+            info.joinSplitPrivKey = random_uint256();
+            info.zaddr = libzcash::SproutSpendingKey::random().address();
+            entries.push_back(PaymentDisclosureKeyInfo(PaymentDisclosureKey{txid, js, n}, info));
+        }
+    }
+    // Inserted out of order
+    std::reverse(entries.begin(), entries.end());
+    ASSERT_TRUE(mydb.PutBatch(entries));
+
+    PaymentDisclosureInfo other;
+    other.esk = random_uint256();
+    other.zaddr = libzcash::SproutSpendingKey::random().address();
+    ASSERT_TRUE(mydb.Put(PaymentDisclosureKey{random_uint256(), 0, 0}, other));
+
+    std::vector<PaymentDisclosureKeyInfo> read;
+    ASSERT_TRUE(mydb.GetByTxid(txid, read));
+    ASSERT_EQ(entries.size(), read.size());
+    std::reverse(entries.begin(), entries.end());
+    for (size_t i = 0; i < entries.size(); i++) {
+        EXPECT_EQ(entries[i].first, read[i].first);
+        EXPECT_EQ(entries[i].second, read[i].second);
+
+        PaymentDisclosureInfo info;
+        ASSERT_TRUE(mydb.Get(entries[i].first, info));
+        EXPECT_EQ(entries[i].second, info);
+    }
+
+    ASSERT_TRUE(mydb.GetByTxid(random_uint256(), read));
+    EXPECT_TRUE(read.empty());
+}
@@ -132,3 +132,23 @@ TEST(ZIP32, TestVectors) {
         m_1_2hv_3.DefaultAddress().d,
         testing::ElementsAreArray({ 0x03, 0x0f, 0xfb, 0x26, 0x3a, 0x93, 0x9e, 0x23, 0x0e, 0x96, 0xdd }));
 }
+
+TEST(ZIP32, DeriveRange) {
+    std::vector<unsigned char, secure_allocator<unsigned char>> rawSeed(32, 1);
+    HDSeed seed(rawSeed);
+    auto m = libzcash::SaplingExtendedSpendingKey::Master(seed);
+
+    // Any number of threads gives the children Derive gives, in order
+    for (int nThreads : {1, 3, 16}) {
+        std::vector<libzcash::SaplingPaymentAddress> vAddrs;
+        auto vKeys = m.DeriveRange(5 | ZIP32_HARDENED_KEY_LIMIT, 7, nThreads, &vAddrs);
+        ASSERT_EQ(vKeys.size(), 7);
+        ASSERT_EQ(vAddrs.size(), 7);
+        for (uint32_t n = 0; n < 7; n++) {
+            auto xsk = m.Derive((5 + n) | ZIP32_HARDENED_KEY_LIMIT);
+            EXPECT_EQ(vKeys[n], xsk);
+            EXPECT_EQ(vAddrs[n], xsk.DefaultAddress());
+        }
+    }
+    EXPECT_EQ(m.DeriveRange(0, 0, 4).size(), 0);
+}
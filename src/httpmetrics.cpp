@@ -0,0 +1,256 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#if defined(HAVE_CONFIG_H)
+#include "config/bitcoin-config.h"
+#endif
+
+#include "httpmetrics.h"
+
+#include "blockconnectstats.h"
+#include "httpserver.h"
+#include "init.h"
+#include "main.h"
+#include "metrics.h"
+#include "net.h"
+#include "proofcache.h"
+#include "rpc/protocol.h"
+#include "rpc/stats.h"
+#include "scheduler.h"
+#include "script/sigcache.h"
+#include "tinyformat.h"
+#ifdef ENABLE_WALLET
+#include "wallet/wallet.h"
+#endif
+#if ENABLE_PROTON
+#include "amqp/amqpnotificationinterface.h"
+#endif
+
+#include <map>
+
+static const char* METRICS_PATH = "/metrics";
+
+namespace {
+
+/** Text exposition format 0.0.4: a HELP and a TYPE line per family, then its samples */
+class CMetricsWriter
+{
+    std::string str;
+
+public:
+    void Family(const std::string& name, const char* type, const char* help)
+    {
+        str += strprintf("# HELP pirate_%s %s\n# TYPE pirate_%s %s\n", name, help, name, type);
+    }
+
+    void Sample(const std::string& name, const std::string& labels, double value)
+    {
+        str += "pirate_" + name;
+        if (!labels.empty())
+            str += "{" + labels + "}";
+        str += strprintf(" %.17g\n", value);
+    }
+
+    void Gauge(const std::string& name, const char* help, double value)
+    {
+        Family(name, "gauge", help);
+        Sample(name, "", value);
+    }
+
+    void Counter(const std::string& name, const char* help, double value)
+    {
+        Family(name, "counter", help);
+        Sample(name, "", value);
+    }
+
+    const std::string& Get() const { return str; }
+};
+
+std::string Label(const std::string& name, const std::string& value)
+{
+    std::string escaped;
+    for (char c : value) {
+        if (c == '\\' || c == '"')
+            escaped += '\\';
+        if (c == '\n')
+            escaped += "\\n";
+        else
+            escaped += c;
+    }
+    return name + "=\"" + escaped + "\"";
+}
+
+void WriteChainMetrics(CMetricsWriter& writer)
+{
+    std::shared_ptr<const CChainTipSnapshot> snapshot = GetChainTipSnapshot();
+    CChainTipSnapshot empty;
+    const CChainTipSnapshot& tip = snapshot ? *snapshot : empty;
+    writer.Gauge("chain_height", "Height of the tip of the active chain", tip.nHeight);
+    writer.Gauge("chain_headers_height", "Height of the best header", tip.nHeadersHeight);
+    writer.Gauge("chain_notarized_height", "Height of the last notarization", tip.nNotarizedHeight);
+    writer.Gauge("chain_difficulty", "Network difficulty at the tip", tip.dNetworkDifficulty);
+    writer.Counter("blocks_connected_total", "Blocks connected since startup", blocksConnected.get());
+    writer.Counter("transactions_validated_total", "Transactions validated since startup", transactionsValidated.get());
+    writer.Gauge("coins_cache_bytes", "Memory used by the coins cache, as of the last tip", tip.nCoinsCacheUsage);
+}
+
+void WriteMempoolMetrics(CMetricsWriter& writer)
+{
+    writer.Gauge("mempool_transactions", "Transactions in the mempool", nStatsMempoolTxs.load());
+    writer.Gauge("mempool_bytes", "Serialized size of the transactions in the mempool", nStatsMempoolBytes.load());
+    writer.Gauge("mempool_usage_bytes", "Memory used by the mempool", nStatsMempoolUsage.load());
+}
+
+void WriteNetMetrics(CMetricsWriter& writer)
+{
+    writer.Family("peers", "gauge", "Connected peers");
+    writer.Sample("peers", Label("direction", "inbound"), nStatsPeersInbound.load());
+    writer.Sample("peers", Label("direction", "outbound"), nStatsPeersOutbound.load());
+
+    writer.Family("net_bytes_total", "counter", "Bytes received and sent over all connections");
+    writer.Sample("net_bytes_total", Label("direction", "recv"), CNode::GetTotalBytesRecv());
+    writer.Sample("net_bytes_total", Label("direction", "sent"), CNode::GetTotalBytesSent());
+
+    mapMsgStats_t mapStats;
+    CNode::GetTotalMsgStats(mapStats);
+    writer.Family("net_message_bytes_total", "counter", "Bytes of the messages received and sent, by command");
+    for (const mapMsgStats_t::value_type& entry : mapStats) {
+        writer.Sample("net_message_bytes_total", Label("command", entry.first) + "," + Label("direction", "recv"), entry.second.nBytesRecv);
+        writer.Sample("net_message_bytes_total", Label("command", entry.first) + "," + Label("direction", "sent"), entry.second.nBytesSent);
+    }
+    writer.Family("net_messages_total", "counter", "Messages received and sent, by command");
+    for (const mapMsgStats_t::value_type& entry : mapStats) {
+        writer.Sample("net_messages_total", Label("command", entry.first) + "," + Label("direction", "recv"), entry.second.nMsgsRecv);
+        writer.Sample("net_messages_total", Label("command", entry.first) + "," + Label("direction", "sent"), entry.second.nMsgsSent);
+    }
+    writer.Family("net_message_handler_seconds_total", "counter", "Time spent handling the received messages, by command");
+    for (const mapMsgStats_t::value_type& entry : mapStats)
+        writer.Sample("net_message_handler_seconds_total", Label("command", entry.first), entry.second.nHandlerUsec / 1e6);
+}
+
+void WriteRPCMetrics(CMetricsWriter& writer)
+{
+    std::map<std::string, CRPCStats::MethodStats> mapMethods = rpcStats.GetMethods();
+    writer.Family("rpc_duration_seconds", "histogram", "Time the RPC calls took, by method");
+    for (const std::pair<const std::string, CRPCStats::MethodStats>& entry : mapMethods) {
+        const std::string method = Label("method", entry.first);
+        // Bucket b holds the calls that took less than 2^b us, the last one the rest
+        uint64_t nCumulative = 0;
+        for (int b = 0; b < CRPCStats::LATENCY_BUCKETS - 1; b++) {
+            nCumulative += entry.second.vLatency[b];
+            writer.Sample("rpc_duration_seconds_bucket", method + "," + Label("le", strprintf("%g", ((uint64_t)1 << b) / 1e6)), nCumulative);
+        }
+        writer.Sample("rpc_duration_seconds_bucket", method + "," + Label("le", "+Inf"), entry.second.nCalls);
+        writer.Sample("rpc_duration_seconds_sum", method, entry.second.nTotalMicros / 1e6);
+        writer.Sample("rpc_duration_seconds_count", method, entry.second.nCalls);
+    }
+    writer.Family("rpc_errors_total", "counter", "RPC calls that failed, by method");
+    for (const std::pair<const std::string, CRPCStats::MethodStats>& entry : mapMethods)
+        writer.Sample("rpc_errors_total", Label("method", entry.first), entry.second.nErrors);
+}
+
+void WriteBlockConnectMetrics(CMetricsWriter& writer)
+{
+    CBlockConnectStats totals;
+    GetBlockConnectStats(0, totals);
+    writer.Counter("block_connect_profiled_total", "Blocks connected while -blockprofile was on", totals.nBlocks);
+    writer.Family("block_connect_stage_seconds_total", "counter", "Time spent connecting the profiled blocks, by stage");
+    for (int stage = 0; stage < CONNECT_STAGE_COUNT; stage++)
+        writer.Sample("block_connect_stage_seconds_total", Label("stage", GetBlockConnectStageName(stage)), totals.nStageMicros[stage] / 1e6);
+}
+
+void WriteCacheMetrics(CMetricsWriter& writer)
+{
+    size_t nSigEntries, nSigCapacity, nProofEntries, nProofCapacity;
+    GetSignatureCacheSize(nSigEntries, nSigCapacity);
+    GetProofCacheSize(nProofEntries, nProofCapacity);
+    writer.Family("cache_entries", "gauge", "Entries in the validation caches");
+    writer.Sample("cache_entries", Label("cache", "signature"), nSigEntries);
+    writer.Sample("cache_entries", Label("cache", "proof"), nProofEntries);
+    writer.Family("cache_capacity", "gauge", "Entries the validation caches hold at most");
+    writer.Sample("cache_capacity", Label("cache", "signature"), nSigCapacity);
+    writer.Sample("cache_capacity", Label("cache", "proof"), nProofCapacity);
+}
+
+void WriteSchedulerMetrics(CMetricsWriter& writer)
+{
+    if (pschedulerMain == NULL)
+        return;
+    std::map<std::string, CScheduler::QueueStats> mapQueues = pschedulerMain->getQueueStats();
+    writer.Family("scheduler_due_tasks", "gauge", "Scheduled jobs past their time, by queue");
+    for (const std::pair<const std::string, CScheduler::QueueStats>& entry : mapQueues)
+        writer.Sample("scheduler_due_tasks", Label("queue", entry.first), entry.second.nDue);
+    writer.Family("scheduler_runs_total", "counter", "Scheduled jobs run, by queue");
+    for (const std::pair<const std::string, CScheduler::QueueStats>& entry : mapQueues)
+        writer.Sample("scheduler_runs_total", Label("queue", entry.first), entry.second.nRuns);
+    writer.Family("scheduler_run_seconds_total", "counter", "Time the scheduled jobs took, by queue");
+    for (const std::pair<const std::string, CScheduler::QueueStats>& entry : mapQueues)
+        writer.Sample("scheduler_run_seconds_total", Label("queue", entry.first), entry.second.nRunMicros / 1e6);
+}
+
+#if ENABLE_PROTON
+void WriteAMQPMetrics(CMetricsWriter& writer)
+{
+    std::vector<AMQPSenderStats> vStats = GetAMQPSenderStats();
+    writer.Family("amqp_connected", "gauge", "Whether the broker is connected, by address");
+    for (const AMQPSenderStats& stats : vStats)
+        writer.Sample("amqp_connected", Label("address", stats.address), stats.fConnected ? 1 : 0);
+    writer.Family("amqp_queued_messages", "gauge", "Messages waiting to be sent to the broker, by address");
+    for (const AMQPSenderStats& stats : vStats)
+        writer.Sample("amqp_queued_messages", Label("address", stats.address), stats.nQueued);
+    writer.Family("amqp_messages_total", "counter", "Messages sent to the broker and dropped from a full queue, by address");
+    for (const AMQPSenderStats& stats : vStats) {
+        writer.Sample("amqp_messages_total", Label("address", stats.address) + "," + Label("outcome", "sent"), stats.nSent);
+        writer.Sample("amqp_messages_total", Label("address", stats.address) + "," + Label("outcome", "dropped"), stats.nDropped);
+    }
+    writer.Family("amqp_reconnects_total", "counter", "Connections to the broker lost and retried, by address");
+    for (const AMQPSenderStats& stats : vStats)
+        writer.Sample("amqp_reconnects_total", Label("address", stats.address), stats.nReconnects);
+}
+#endif
+
+} // anon namespace
+
+std::string GetPrometheusMetrics()
+{
+    CMetricsWriter writer;
+    WriteChainMetrics(writer);
+    WriteMempoolMetrics(writer);
+    WriteNetMetrics(writer);
+    WriteRPCMetrics(writer);
+    WriteBlockConnectMetrics(writer);
+    WriteCacheMetrics(writer);
+    WriteSchedulerMetrics(writer);
+#if ENABLE_PROTON
+    WriteAMQPMetrics(writer);
+#endif
+#ifdef ENABLE_WALLET
+    writer.Gauge("wallet_rescan_height", "Block the wallet rescan is at, -1 when none is running", nWalletRescanHeight.load());
+    writer.Gauge("wallet_witness_height", "Block the witness cache rebuild is at, -1 when none is running", nWalletWitnessHeight.load());
+#endif
+    writer.Gauge("mining_solutions_per_second", "Equihash solutions per second of the local miner", GetLocalSolPS());
+    return writer.Get();
+}
+
+static bool http_metrics(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (req->GetRequestMethod() != HTTPRequest::GET) {
+        req->WriteReply(HTTP_BAD_METHOD, "Only GET requests allowed\n");
+        return false;
+    }
+    req->WriteHeader("Content-Type", "text/plain; version=0.0.4");
+    req->WriteReply(HTTP_OK, GetPrometheusMetrics());
+    return true;
+}
+
+bool StartHTTPMetrics()
+{
+    RegisterHTTPHandler(METRICS_PATH, true, http_metrics, HTTP_LANE_PRIORITY);
+    return true;
+}
+
+void StopHTTPMetrics()
+{
+    UnregisterHTTPHandler(METRICS_PATH, true);
+}
@@ -0,0 +1,29 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_HTTPMETRICS_H
+#define BITCOIN_HTTPMETRICS_H
+
+#include <string>
+
+//! -httpmetrics default
+static const bool DEFAULT_HTTP_METRICS = false;
+
+/**
+ * The metrics of the node in the Prometheus text exposition format, as served
+ * at /metrics. Only reads atomics and the stats' own locks, never cs_main or
+ * cs_wallet, so a scrape isn't held up by a block being connected.
+ */
+std::string GetPrometheusMetrics();
+
+/** Start serving /metrics.
+ * Precondition; HTTP has been started.
+ */
+bool StartHTTPMetrics();
+/** Stop serving /metrics.
+ * Precondition; HTTP has been stopped.
+ */
+void StopHTTPMetrics();
+
+#endif // BITCOIN_HTTPMETRICS_H
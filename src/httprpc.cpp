@@ -18,6 +18,7 @@
 #include "chainparams.h"
 #include "httpserver.h"
 #include "key_io.h"
+#include "rpc/jsonstream.h"
 #include "rpc/protocol.h"
 #include "rpc/server.h"
 #include "random.h"
@@ -26,6 +27,8 @@
 #include "utilstrencodings.h"
 #include "ui_interface.h"
 
+#include <memory>
+
 #include <boost/algorithm/string.hpp> // boost::trim
 
 // WWW-Authenticate to present with 401 Unauthorized response
@@ -67,13 +70,55 @@ private:
     struct event_base* base;
 };
 
+HTTPJSONReplyStream::HTTPJSONReplyStream(HTTPRequest* req, JSONStreamWriter::Format format) :
+    req(req), fStarted(false),
+    writer([this](std::string& chunk, bool fLast) { Flush(chunk, fLast); }, DEFAULT_JSON_STREAM_CHUNK_SIZE, format)
+{
+}
+
+bool HTTPJSONReplyStream::Abandon(const std::string& strWhat)
+{
+    if (!fStarted)
+        return false;
+    LogPrintf("HTTP: reply to %s abandoned after it was partly sent\n", SanitizeString(strWhat));
+    req->WriteReplyEnd();
+    return true;
+}
+
+void HTTPJSONReplyStream::Flush(std::string& chunk, bool fLast)
+{
+    if (!fStarted) {
+        req->WriteHeader("Content-Type", writer.GetFormat() == JSONStreamWriter::FORMAT_CBOR ? "application/cbor" : "application/json");
+        if (fLast) {
+            req->WriteReply(HTTP_OK, chunk);
+            return;
+        }
+        req->WriteReplyStart(HTTP_OK);
+        fStarted = true;
+    }
+    if (!req->WriteReplyChunk(chunk))
+        throw std::runtime_error("Client stopped reading the reply");
+    if (fLast)
+        req->WriteReplyEnd();
+}
 
 /* Pre-base64-encoded authentication token */
 static std::string strRPCUserColonPass;
 /* Stored RPC timer interface (for unregistration) */
 static HTTPRPCTimerInterface* httpRPCTimerInterface = 0;
+/* Number of RPC threads, besides its own, a batch request may use */
+static int nRPCBatchThreads = 0;
 
-static void JSONErrorReply(HTTPRequest* req, const UniValue& objError, const UniValue& id)
+/** Replies are CBOR encoded for clients that accept it */
+static JSONStreamWriter::Format ReplyFormat(HTTPRequest* req)
+{
+    std::pair<bool, std::string> accept = req->GetHeader("accept");
+    if (accept.first && accept.second.find("application/cbor") != std::string::npos)
+        return JSONStreamWriter::FORMAT_CBOR;
+    return JSONStreamWriter::FORMAT_TEXT;
+}
+
+static void JSONErrorReply(HTTPRequest* req, const UniValue& objError, const UniValue& id, JSONStreamWriter::Format format = JSONStreamWriter::FORMAT_TEXT)
 {
     // Send error reply from json-rpc error object
     int nStatus = HTTP_INTERNAL_SERVER_ERROR;
@@ -84,6 +129,16 @@ static void JSONErrorReply(HTTPRequest* req, const UniValue& objError, const Uni
     else if (code == RPC_METHOD_NOT_FOUND)
         nStatus = HTTP_NOT_FOUND;
 
+    if (format == JSONStreamWriter::FORMAT_CBOR) {
+        std::string strReply;
+        JSONStreamWriter writer([&strReply](std::string& chunk, bool) { strReply += chunk; }, DEFAULT_JSON_STREAM_CHUNK_SIZE, format);
+        writer.Value(JSONRPCReplyObj(NullUniValue, objError, id));
+        writer.Finish();
+        req->WriteHeader("Content-Type", "application/cbor");
+        req->WriteReply(nStatus, strReply);
+        return;
+    }
+
     std::string strReply = JSONRPCReply(NullUniValue, objError, id);
 
     req->WriteHeader("Content-Type", "application/json");
@@ -102,6 +157,50 @@ static bool RPCAuthorized(const std::string& strAuth)
     return TimingResistantEqual(strUserPass, strRPCUserColonPass);
 }
 
+/** Calls that only report cached state, served in the priority lane */
+static const char* const vRPCPriorityCommands[] = {
+    "getblockcount", "getbestblockhash", "getblockhash", "getblockheader", "getdifficulty", "getinfo",
+    "getblockchaininfo", "getconnectioncount", "getnetworkinfo", "getmempoolinfo", "getrpcstats", "ping",
+};
+
+/** Calls that scan the chain, the indexes or the wallet, served by the slow threads */
+static const char* const vRPCSlowCommands[] = {
+    "gettxoutsetinfo", "verifychain", "getsnapshot", "getaddressdeltas", "getaddresstxids", "getaddressutxos",
+    "getblockdeltas", "dumpwallet", "z_exportwallet", "importwallet", "z_importwallet", "importprivkey",
+    "importaddress", "z_importkey", "z_importviewingkey", "listtransactions", "zs_listtransactions",
+    "listunspent", "z_listunspent", "z_getbalances", "cleanwallettransactions",
+};
+
+//! Larger bodies are not parsed on the event loop thread to pick their lane
+static const size_t MAX_LANE_CLASSIFY_BODY = 4096;
+
+static bool IsRPCCommandIn(const std::string& strMethod, const char* const* begin, const char* const* end)
+{
+    for (const char* const* it = begin; it != end; ++it) {
+        if (strMethod == *it)
+            return true;
+    }
+    return false;
+}
+
+/** Lane of a JSON-RPC request by its method. Batches go to the normal lane. */
+static HTTPWorkLane JSONRPCLane(HTTPRequest* req, const std::string &)
+{
+    std::string strBody;
+    UniValue valRequest;
+    if (!req->PeekBody(MAX_LANE_CLASSIFY_BODY, strBody) || !valRequest.read(strBody) || !valRequest.isObject())
+        return HTTP_LANE_NORMAL;
+    const UniValue& valMethod = find_value(valRequest, "method");
+    if (!valMethod.isStr())
+        return HTTP_LANE_NORMAL;
+    const std::string& strMethod = valMethod.get_str();
+    if (IsRPCCommandIn(strMethod, vRPCPriorityCommands, vRPCPriorityCommands + ARRAYLEN(vRPCPriorityCommands)))
+        return HTTP_LANE_PRIORITY;
+    if (IsRPCCommandIn(strMethod, vRPCSlowCommands, vRPCSlowCommands + ARRAYLEN(vRPCSlowCommands)))
+        return HTTP_LANE_SLOW;
+    return HTTP_LANE_NORMAL;
+}
+
 static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
 {
     // JSONRPC handles only POST
@@ -131,13 +230,14 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
     }
 
     JSONRequest jreq;
+    JSONStreamWriter::Format format = ReplyFormat(req);
+    std::unique_ptr<HTTPJSONReplyStream> stream;
     try {
         // Parse request
         UniValue valRequest;
         if (!valRequest.read(req->ReadBody()))
             throw JSONRPCError(RPC_PARSE_ERROR, "Parse error");
 
-        std::string strReply;
         // singleton request
         if (valRequest.isObject()) {
             jreq.parse(valRequest);
@@ -151,24 +251,44 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
                 return false;
             }
 
-            UniValue result = tableRPC.execute(jreq.strMethod, jreq.params);
-
-            // Send reply
-            strReply = JSONRPCReply(result, NullUniValue, jreq.id);
+            // Send the reply while it is written, the same as JSONRPCReply
+            stream.reset(new HTTPJSONReplyStream(req, format));
+            JSONStreamWriter& writer = stream->Writer();
+            writer.BeginObject();
+            writer.Key("result");
+            {
+                RPCReplyStreamScope scope(jreq.strMethod, &writer);
+                UniValue result = tableRPC.execute(jreq.strMethod, jreq.params);
+                if (!scope.Taken())
+                    writer.Value(result);
+                else if (writer.ExpectsValue())
+                    writer.Value(NullUniValue);
+            }
+            writer.KeyValue("error", NullUniValue);
+            writer.KeyValue("id", jreq.id);
+            writer.EndObject();
+            if (format == JSONStreamWriter::FORMAT_TEXT)
+                writer.WriteRaw("\n");
+            writer.Finish();
+            return true;
 
         // array of requests
-        } else if (valRequest.isArray())
-            strReply = JSONRPCExecBatch(valRequest.get_array());
-        else
+        } else if (valRequest.isArray()) {
+            UniValue replies = JSONRPCExecBatchReplies(valRequest.get_array(), nRPCBatchThreads, HTTPEnqueueTask);
+            stream.reset(new HTTPJSONReplyStream(req, format));
+            stream->Writer().Value(replies);
+            if (format == JSONStreamWriter::FORMAT_TEXT)
+                stream->Writer().WriteRaw("\n");
+            stream->Writer().Finish();
+        } else
             throw JSONRPCError(RPC_PARSE_ERROR, "Top-level object parse error");
-
-        req->WriteHeader("Content-Type", "application/json");
-        req->WriteReply(HTTP_OK, strReply);
     } catch (const UniValue& objError) {
-        JSONErrorReply(req, objError, jreq.id);
+        if (!stream || !stream->Abandon(jreq.strMethod))
+            JSONErrorReply(req, objError, jreq.id, format);
         return false;
     } catch (const std::exception& e) {
-        JSONErrorReply(req, JSONRPCError(RPC_PARSE_ERROR, e.what()), jreq.id);
+        if (!stream || !stream->Abandon(jreq.strMethod))
+            JSONErrorReply(req, JSONRPCError(RPC_PARSE_ERROR, e.what()), jreq.id, format);
         return false;
     }
     return true;
@@ -197,7 +317,13 @@ bool StartHTTPRPC()
     if (!InitRPCAuthentication())
         return false;
 
-    RegisterHTTPHandler("/", true, HTTPReq_JSONRPC);
+    RegisterHTTPHandler("/", true, HTTPReq_JSONRPC, JSONRPCLane);
+
+    // Leave at least one RPC thread to the other clients
+    int rpcThreads = std::max((int)GetArg("-rpcthreads", DEFAULT_HTTP_THREADS), 1);
+    nRPCBatchThreads = std::max(0, std::min((int)GetArg("-rpcbatchthreads", DEFAULT_RPC_BATCH_THREADS), rpcThreads - 2));
+    if (nRPCBatchThreads > 0)
+        LogPrintf("HTTP RPC: batch requests run on up to %d additional threads\n", nRPCBatchThreads);
 
     assert(EventBase());
     httpRPCTimerInterface = new HTTPRPCTimerInterface(EventBase());
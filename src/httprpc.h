@@ -20,11 +20,36 @@
 #ifndef BITCOIN_HTTPRPC_H
 #define BITCOIN_HTTPRPC_H
 
+#include "rpc/jsonstream.h"
+
 #include <string>
 #include <map>
 
 class HTTPRequest;
 
+/**
+ * Sends a JSON reply while it is written. A reply that fits in one chunk
+ * goes out as a plain reply, a larger one chunked. Flushing throws when the
+ * client went away.
+ */
+class HTTPJSONReplyStream
+{
+public:
+    HTTPJSONReplyStream(HTTPRequest* req, JSONStreamWriter::Format format = JSONStreamWriter::FORMAT_TEXT);
+
+    JSONStreamWriter& Writer() { return writer; }
+
+    /** Ends a reply that failed after part of it was sent, returns false if nothing was sent */
+    bool Abandon(const std::string& strWhat);
+
+private:
+    HTTPRequest* req;
+    bool fStarted;
+    JSONStreamWriter writer;
+
+    void Flush(std::string& chunk, bool fLast);
+};
+
 /** Start HTTP RPC subsystem.
  * Precondition; HTTP and RPC has been started.
  */
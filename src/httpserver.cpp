@@ -13,6 +13,9 @@
 #include "ui_interface.h"
 #include "utilstrencodings.h"
 
+#include <algorithm>
+#include <deque>
+#include <map>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -40,6 +43,22 @@
 #include <boost/foreach.hpp>
 #include <boost/scoped_ptr.hpp>
 
+/** Work item running a task on behalf of a request already being handled */
+class HTTPTaskItem : public HTTPClosure
+{
+public:
+    HTTPTaskItem(const boost::function<void(void)>& func): func(func)
+    {
+    }
+    void operator()()
+    {
+        func();
+    }
+
+private:
+    boost::function<void(void)> func;
+};
+
 /** HTTP request work item */
 class HTTPWorkItem : public HTTPClosure
 {
@@ -60,18 +79,92 @@ private:
     HTTPRequestHandler func;
 };
 
-/** Simple work queue for distributing work over multiple threads.
+/** Work queue for distributing work over multiple threads.
  * Work items are simply callable objects.
+ *
+ * Items are kept per client (the remote address of the request) and the
+ * clients are served round robin, so a client that queues many requests
+ * only delays its own. Items in the priority lane are served before all
+ * others. When the queue is full, a request from a client with fewer queued
+ * items than the busiest client takes the place of that client's newest
+ * request, which is handed back to be rejected. Items of the empty client,
+ * tasks queued by the server itself, are never evicted.
+ *
+ * Every operation is a few pointer updates under the mutex; the waiting is
+ * done on the condition variable, not for the lock.
  */
 template <typename WorkItem>
 class WorkQueue
 {
 private:
+    /** Queued items of one priority, per client in round robin order */
+    class FairLane
+    {
+    private:
+        std::map<std::string, std::deque<WorkItem*> > mapClients;
+        //! Clients with queued items, the next one to be served first
+        std::deque<std::string> vRoundRobin;
+
+    public:
+        bool Empty() const { return vRoundRobin.empty(); }
+
+        void Push(const std::string& strClient, WorkItem* item)
+        {
+            std::deque<WorkItem*>& items = mapClients[strClient];
+            if (items.empty())
+                vRoundRobin.push_back(strClient);
+            items.push_back(item);
+        }
+
+        //! Precondition: !Empty()
+        WorkItem* Pop(std::string& strClient)
+        {
+            strClient = vRoundRobin.front();
+            vRoundRobin.pop_front();
+            typename std::map<std::string, std::deque<WorkItem*> >::iterator it = mapClients.find(strClient);
+            WorkItem* item = it->second.front();
+            it->second.pop_front();
+            if (it->second.empty())
+                mapClients.erase(it);
+            else
+                vRoundRobin.push_back(strClient);
+            return item;
+        }
+
+        //! Removes the newest item of the client, NULL if it has none here
+        WorkItem* PopNewest(const std::string& strClient)
+        {
+            typename std::map<std::string, std::deque<WorkItem*> >::iterator it = mapClients.find(strClient);
+            if (it == mapClients.end())
+                return NULL;
+            WorkItem* item = it->second.back();
+            it->second.pop_back();
+            if (it->second.empty()) {
+                mapClients.erase(it);
+                vRoundRobin.erase(std::find(vRoundRobin.begin(), vRoundRobin.end(), strClient));
+            }
+            return item;
+        }
+
+        void Clear()
+        {
+            for (typename std::map<std::string, std::deque<WorkItem*> >::iterator it = mapClients.begin(); it != mapClients.end(); ++it) {
+                for (size_t i = 0; i < it->second.size(); i++)
+                    delete it->second[i];
+            }
+            mapClients.clear();
+            vRoundRobin.clear();
+        }
+    };
+
     /** Mutex protects entire object */
     CWaitableCriticalSection cs;
     CConditionVariable cond;
-    /* XXX in C++11 we can use std::unique_ptr here and avoid manual cleanup */
-    std::deque<WorkItem*> queue;
+    FairLane priority;
+    FairLane normal;
+    //! Queued items per client, over both lanes
+    std::map<std::string, size_t> mapClientDepth;
+    size_t depth;
     bool running;
     size_t maxDepth;
     int numThreads;
@@ -94,8 +187,39 @@ private:
         }
     };
 
+    void Dequeued(const std::string& strClient)
+    {
+        std::map<std::string, size_t>::iterator it = mapClientDepth.find(strClient);
+        if (--it->second == 0)
+            mapClientDepth.erase(it);
+        depth--;
+    }
+
+    /** Makes room for an item of strClient by evicting the newest item of the busiest client */
+    WorkItem* Evict(const std::string& strClient)
+    {
+        std::map<std::string, size_t>::const_iterator itClient = mapClientDepth.find(strClient);
+        size_t nClientDepth = itClient == mapClientDepth.end() ? 0 : itClient->second;
+        std::string strBusiest;
+        size_t nBusiest = 0;
+        for (std::map<std::string, size_t>::const_iterator it = mapClientDepth.begin(); it != mapClientDepth.end(); ++it) {
+            if (!it->first.empty() && it->second > nBusiest) {
+                strBusiest = it->first;
+                nBusiest = it->second;
+            }
+        }
+        if (nBusiest <= nClientDepth + 1)
+            return NULL;
+        WorkItem* item = normal.PopNewest(strBusiest);
+        if (item == NULL)
+            item = priority.PopNewest(strBusiest);
+        Dequeued(strBusiest);
+        return item;
+    }
+
 public:
-    WorkQueue(size_t maxDepth) : running(true),
+    WorkQueue(size_t maxDepth) : depth(0),
+                                 running(true),
                                  maxDepth(maxDepth),
                                  numThreads(0)
     {
@@ -105,19 +229,25 @@ public:
      */
     ~WorkQueue()
     {
-        while (!queue.empty()) {
-            delete queue.front();
-            queue.pop_front();
-        }
+        priority.Clear();
+        normal.Clear();
     }
-    /** Enqueue a work item */
-    bool Enqueue(WorkItem* item)
+    /** Enqueue a work item of a client. If ppEvicted is given, a full queue
+     * may make room by evicting a queued item of a busier client, which is
+     * then returned there for the caller to reject.
+     */
+    bool Enqueue(WorkItem* item, const std::string& strClient = std::string(), bool fPriority = false, WorkItem** ppEvicted = NULL)
     {
         boost::unique_lock<boost::mutex> lock(cs);
-        if (queue.size() >= maxDepth) {
-            return false;
+        if (depth >= maxDepth) {
+            WorkItem* evicted = (ppEvicted != NULL && !strClient.empty()) ? Evict(strClient) : NULL;
+            if (evicted == NULL)
+                return false;
+            *ppEvicted = evicted;
         }
-        queue.push_back(item);
+        (fPriority ? priority : normal).Push(strClient, item);
+        mapClientDepth[strClient]++;
+        depth++;
         cond.notify_one();
         return true;
     }
@@ -129,12 +259,13 @@ public:
             WorkItem* i = 0;
             {
                 boost::unique_lock<boost::mutex> lock(cs);
-                while (running && queue.empty())
+                while (running && depth == 0)
                     cond.wait(lock);
                 if (!running)
                     break;
-                i = queue.front();
-                queue.pop_front();
+                std::string strClient;
+                i = priority.Empty() ? normal.Pop(strClient) : priority.Pop(strClient);
+                Dequeued(strClient);
             }
             (*i)();
             delete i;
@@ -159,20 +290,23 @@ public:
     size_t Depth()
     {
         boost::unique_lock<boost::mutex> lock(cs);
-        return queue.size();
+        return depth;
     }
 };
 
 struct HTTPPathHandler
 {
     HTTPPathHandler() {}
-    HTTPPathHandler(std::string prefix, bool exactMatch, HTTPRequestHandler handler):
-        prefix(prefix), exactMatch(exactMatch), handler(handler)
+    HTTPPathHandler(std::string prefix, bool exactMatch, HTTPRequestHandler handler, HTTPWorkLane lane, HTTPLaneClassifier classify):
+        prefix(prefix), exactMatch(exactMatch), handler(handler), lane(lane), classify(classify)
     {
     }
     std::string prefix;
     bool exactMatch;
     HTTPRequestHandler handler;
+    //! Lane of the requests, unless classify is set
+    HTTPWorkLane lane;
+    HTTPLaneClassifier classify;
 };
 
 /** HTTP module state */
@@ -185,6 +319,10 @@ struct evhttp* eventHTTP = 0;
 static std::vector<CSubNet> rpc_allow_subnets;
 //! Work queue for handling longer requests off the event loop thread
 static WorkQueue<HTTPClosure>* workQueue = 0;
+//! Work queue of the requests in the slow lane, NULL to serve them from workQueue
+static WorkQueue<HTTPClosure>* slowWorkQueue = 0;
+//! Seconds a chunked reply may wait for a client that does not read
+static int64_t nReplyTimeout = DEFAULT_HTTP_SERVER_TIMEOUT;
 //! Handlers for (sub)paths
 std::vector<HTTPPathHandler> pathHandlers;
 //! Bound listening sockets
@@ -301,12 +439,23 @@ static void http_request_cb(struct evhttp_request* req, void* arg)
 
     // Dispatch to worker thread
     if (i != iend) {
+        HTTPWorkLane lane = i->classify ? i->classify(hreq.get(), path) : i->lane;
+        // Fair scheduling is per remote address, whatever the port
+        std::string strClient = hreq->GetPeer().ToStringIP();
         std::unique_ptr<HTTPWorkItem> item(new HTTPWorkItem(hreq.release(), path, i->handler));
         assert(workQueue);
-        if (workQueue->Enqueue(item.get()))
+        WorkQueue<HTTPClosure>* queue = (lane == HTTP_LANE_SLOW && slowWorkQueue) ? slowWorkQueue : workQueue;
+        HTTPClosure* evicted = NULL;
+        if (queue->Enqueue(item.get(), strClient, lane == HTTP_LANE_PRIORITY, &evicted))
             item.release(); /* if true, queue took ownership */
         else
             item->req->WriteReply(HTTP_INTERNAL, "Work queue depth exceeded");
+        if (evicted) {
+            // Only requests are queued with a client, so this is an HTTPWorkItem
+            std::unique_ptr<HTTPWorkItem> evictedItem(static_cast<HTTPWorkItem*>(evicted));
+            LogPrint("http", "Work queue full, dropping a request from %s\n", evictedItem->req->GetPeer().ToString());
+            evictedItem->req->WriteReply(HTTP_INTERNAL, "Work queue depth exceeded");
+        }
     } else {
         hreq->WriteReply(HTTP_NOTFOUND);
     }
@@ -433,6 +582,7 @@ bool InitHTTPServer()
         return false;
     }
 
+    nReplyTimeout = std::max(GetArg("-rpcservertimeout", DEFAULT_HTTP_SERVER_TIMEOUT), (int64_t)1);
     evhttp_set_timeout(http, GetArg("-rpcservertimeout", DEFAULT_HTTP_SERVER_TIMEOUT));
     evhttp_set_max_body_size(http, MAX_SIZE);
     evhttp_set_gencb(http, http_request_cb, NULL);
@@ -449,6 +599,8 @@ bool InitHTTPServer()
     LogPrintf("HTTP: creating work queue of depth %d\n", workQueueDepth);
 
     workQueue = new WorkQueue<HTTPClosure>(workQueueDepth);
+    if (GetArg("-rpcslowthreads", DEFAULT_HTTP_SLOW_THREADS) > 0)
+        slowWorkQueue = new WorkQueue<HTTPClosure>(workQueueDepth);
     eventBase = base;
     eventHTTP = http;
     return true;
@@ -467,6 +619,14 @@ bool StartHTTPServer()
         boost::thread rpc_worker(HTTPWorkQueueRun, workQueue);
         rpc_worker.detach();
     }
+    if (slowWorkQueue) {
+        int slowThreads = GetArg("-rpcslowthreads", DEFAULT_HTTP_SLOW_THREADS);
+        LogPrintf("HTTP: starting %d worker threads for slow requests\n", slowThreads);
+        for (int i = 0; i < slowThreads; i++) {
+            boost::thread rpc_worker(HTTPWorkQueueRun, slowWorkQueue);
+            rpc_worker.detach();
+        }
+    }
     return true;
 }
 
@@ -483,6 +643,8 @@ void InterruptHTTPServer()
     }
     if (workQueue)
         workQueue->Interrupt();
+    if (slowWorkQueue)
+        slowWorkQueue->Interrupt();
 }
 
 void StopHTTPServer()
@@ -492,6 +654,12 @@ void StopHTTPServer()
         LogPrint("http", "Waiting for HTTP worker threads to exit\n");
         workQueue->WaitExit();
         delete workQueue;
+        workQueue = 0;
+    }
+    if (slowWorkQueue) {
+        slowWorkQueue->WaitExit();
+        delete slowWorkQueue;
+        slowWorkQueue = 0;
     }
     if (eventBase) {
         LogPrint("http", "Waiting for HTTP event thread to exit\n");
@@ -520,6 +688,17 @@ void StopHTTPServer()
     LogPrint("http", "Stopped HTTP server\n");
 }
 
+bool HTTPEnqueueTask(const boost::function<void(void)>& task)
+{
+    if (!workQueue)
+        return false;
+    std::unique_ptr<HTTPTaskItem> item(new HTTPTaskItem(task));
+    if (!workQueue->Enqueue(item.get()))
+        return false;
+    item.release(); /* queue took ownership */
+    return true;
+}
+
 struct event_base* EventBase()
 {
     return eventBase;
@@ -557,7 +736,10 @@ HTTPRequest::HTTPRequest(struct evhttp_request* req) : req(req),
 }
 HTTPRequest::~HTTPRequest()
 {
-    if (!replySent) {
+    if (!replySent && chunks) {
+        LogPrintf("%s: Unfinished chunked reply\n", __func__);
+        WriteReplyEnd();
+    } else if (!replySent) {
         // Keep track of whether reply was sent to avoid request leaks
         LogPrintf("%s: Unhandled request\n", __func__);
         WriteReply(HTTP_INTERNAL, "Unhandled request");
@@ -596,6 +778,23 @@ std::string HTTPRequest::ReadBody()
     return rv;
 }
 
+bool HTTPRequest::PeekBody(size_t nMaxSize, std::string& body)
+{
+    body.clear();
+    struct evbuffer* buf = evhttp_request_get_input_buffer(req);
+    if (!buf)
+        return true;
+    size_t size = evbuffer_get_length(buf);
+    if (size > nMaxSize)
+        return false;
+    body.resize(size);
+    if (size > 0 && evbuffer_copyout(buf, &body[0], size) != (ev_ssize_t)size) {
+        body.clear();
+        return false;
+    }
+    return true;
+}
+
 void HTTPRequest::WriteHeader(const std::string& hdr, const std::string& value)
 {
     struct evkeyvalq* headers = evhttp_request_get_output_headers(req);
@@ -603,6 +802,21 @@ void HTTPRequest::WriteHeader(const std::string& hdr, const std::string& value)
     evhttp_add_header(headers, hdr.c_str(), value.c_str());
 }
 
+/** Re-enable reading from the socket. This is the second part of the libevent
+ * workaround in http_request_cb.
+ */
+static void ReenableReading(evhttp_connection* conn)
+{
+    if (event_get_version_number() >= 0x02010600 && event_get_version_number() < 0x02020001) {
+        if (conn) {
+            bufferevent* bev = evhttp_connection_get_bufferevent(conn);
+            if (bev) {
+                bufferevent_enable(bev, EV_READ | EV_WRITE);
+            }
+        }
+    }
+}
+
 /** Closure sent to main thread to request a reply to be sent to
  * a HTTP request.
  * Replies must be sent in the main loop in the main http thread,
@@ -617,18 +831,117 @@ void HTTPRequest::WriteReply(int nStatus, const std::string& strReply)
     evbuffer_add(evb, strReply.data(), strReply.size());
     auto req_copy = req;
     HTTPEvent* ev = new HTTPEvent(eventBase, true, [req_copy, nStatus]{
+        // Sending may free the request, look up the connection before
+        evhttp_connection* conn = evhttp_request_get_connection(req_copy);
         evhttp_send_reply(req_copy, nStatus, (const char*)NULL, (struct evbuffer *)NULL);
-        // Re-enable reading from the socket. This is the second part of the libevent
-        // workaround above.
-        if (event_get_version_number() >= 0x02010600 && event_get_version_number() < 0x02020001) {
-            evhttp_connection* conn = evhttp_request_get_connection(req_copy);
-            if (conn) {
-                bufferevent* bev = evhttp_connection_get_bufferevent(conn);
-                if (bev) {
-                    bufferevent_enable(bev, EV_READ | EV_WRITE);
-                }
+        ReenableReading(conn);
+    });
+    ev->trigger(0);
+    replySent = true;
+    req = 0; // transferred back to main thread
+}
+
+/** Flow control of a chunked reply, shared by the worker producing it and the main http thread sending it */
+struct HTTPReplyChunks
+{
+    boost::mutex cs;
+    boost::condition_variable cond;
+    //! Bytes queued by the worker and not yet written to the socket
+    size_t nPending;
+    //! Part of nPending handed to libevent since its output buffer last drained
+    size_t nInBuffer;
+    bool fAborted;
+
+    HTTPReplyChunks() : nPending(0), nInBuffer(0), fAborted(false) {}
+};
+
+/** Called by libevent whenever the output buffer of the connection drained */
+static void http_reply_chunk_sent_cb(struct evhttp_connection*, void* arg)
+{
+    HTTPReplyChunks* chunks = (HTTPReplyChunks*)arg;
+    boost::unique_lock<boost::mutex> lock(chunks->cs);
+    chunks->nPending -= chunks->nInBuffer;
+    chunks->nInBuffer = 0;
+    chunks->cond.notify_all();
+}
+
+static void http_reply_chunk_free_cb(const void*, size_t, void* arg)
+{
+    delete (std::string*)arg;
+}
+
+void HTTPRequest::WriteReplyStart(int nStatus)
+{
+    assert(!replySent && !chunks && req);
+    chunks.reset(new HTTPReplyChunks());
+    auto req_copy = req;
+    HTTPEvent* ev = new HTTPEvent(eventBase, true, [req_copy, nStatus]{
+        // Without a connection the chunks are dropped and the end frees the request
+        if (evhttp_request_get_connection(req_copy) != NULL)
+            evhttp_send_reply_start(req_copy, nStatus, (const char*)NULL);
+    });
+    ev->trigger(0);
+}
+
+bool HTTPRequest::WriteReplyChunk(std::string& chunk)
+{
+    assert(!replySent && chunks && req);
+    if (chunk.empty())
+        return true;
+    {
+        boost::unique_lock<boost::mutex> lock(chunks->cs);
+        while (!chunks->fAborted && chunks->nPending > HTTP_REPLY_MAX_PENDING) {
+            size_t nPendingBefore = chunks->nPending;
+            boost::system_time deadline = boost::get_system_time() + boost::posix_time::seconds(nReplyTimeout);
+            if (!chunks->cond.timed_wait(lock, deadline) && chunks->nPending == nPendingBefore) {
+                LogPrint("http", "Client stopped reading the reply to %s\n", GetURI());
+                chunks->fAborted = true;
+            }
+        }
+        if (chunks->fAborted)
+            return false;
+        chunks->nPending += chunk.size();
+    }
+
+    // The data is referenced, not copied, and freed once written to the socket
+    std::string* pData = new std::string();
+    pData->swap(chunk);
+    struct evbuffer* evb = evbuffer_new();
+    assert(evb);
+    evbuffer_add_reference(evb, pData->data(), pData->size(), http_reply_chunk_free_cb, pData);
+
+    auto req_copy = req;
+    boost::shared_ptr<HTTPReplyChunks> chunks_copy = chunks;
+    HTTPEvent* ev = new HTTPEvent(eventBase, true, [req_copy, chunks_copy, evb]{
+        size_t nSize = evbuffer_get_length(evb);
+        if (evhttp_request_get_connection(req_copy) == NULL) {
+            // The connection was closed, libevent drops the chunks
+            boost::unique_lock<boost::mutex> lock(chunks_copy->cs);
+            chunks_copy->fAborted = true;
+            chunks_copy->cond.notify_all();
+        } else {
+            {
+                boost::unique_lock<boost::mutex> lock(chunks_copy->cs);
+                chunks_copy->nInBuffer += nSize;
             }
+            evhttp_send_reply_chunk_with_cb(req_copy, evb, http_reply_chunk_sent_cb, chunks_copy.get());
         }
+        evbuffer_free(evb);
+    });
+    ev->trigger(0);
+    return true;
+}
+
+void HTTPRequest::WriteReplyEnd()
+{
+    assert(!replySent && chunks && req);
+    auto req_copy = req;
+    // Keeps the flow control state alive until libevent stopped using it
+    boost::shared_ptr<HTTPReplyChunks> chunks_copy = chunks;
+    HTTPEvent* ev = new HTTPEvent(eventBase, true, [req_copy, chunks_copy]{
+        evhttp_connection* conn = evhttp_request_get_connection(req_copy);
+        evhttp_send_reply_end(req_copy);
+        ReenableReading(conn);
     });
     ev->trigger(0);
     replySent = true;
@@ -675,10 +988,16 @@ HTTPRequest::RequestMethod HTTPRequest::GetRequestMethod()
     }
 }
 
-void RegisterHTTPHandler(const std::string &prefix, bool exactMatch, const HTTPRequestHandler &handler)
+void RegisterHTTPHandler(const std::string &prefix, bool exactMatch, const HTTPRequestHandler &handler, HTTPWorkLane lane)
+{
+    LogPrint("http", "Registering HTTP handler for %s (exactmatch %d, lane %d)\n", prefix, exactMatch, lane);
+    pathHandlers.push_back(HTTPPathHandler(prefix, exactMatch, handler, lane, HTTPLaneClassifier()));
+}
+
+void RegisterHTTPHandler(const std::string &prefix, bool exactMatch, const HTTPRequestHandler &handler, const HTTPLaneClassifier &classify)
 {
-    LogPrint("http", "Registering HTTP handler for %s (exactmatch %d)\n", prefix, exactMatch);
-    pathHandlers.push_back(HTTPPathHandler(prefix, exactMatch, handler));
+    LogPrint("http", "Registering HTTP handler for %s (exactmatch %d, lane per request)\n", prefix, exactMatch);
+    pathHandlers.push_back(HTTPPathHandler(prefix, exactMatch, handler, HTTP_LANE_NORMAL, classify));
 }
 
 void UnregisterHTTPHandler(const std::string &prefix, bool exactMatch)
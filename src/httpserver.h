@@ -12,16 +12,22 @@
 #endif
 #include <boost/thread.hpp>
 #include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/function.hpp>
 
 static const int DEFAULT_HTTP_THREADS=4;
+static const int DEFAULT_HTTP_SLOW_THREADS=2;
 static const int DEFAULT_HTTP_WORKQUEUE=16;
 static const int DEFAULT_HTTP_SERVER_TIMEOUT=30;
+static const int DEFAULT_RPC_BATCH_THREADS=0;
+//! Bytes of a chunked reply that may be queued for a client before the producer waits
+static const size_t HTTP_REPLY_MAX_PENDING=1024*1024;
 
 struct evhttp_request;
 struct event_base;
 class CService;
 class HTTPRequest;
+struct HTTPReplyChunks;
 
 /** Initialize HTTP server.
  * Call this before RegisterHTTPHandler or EventBase().
@@ -39,14 +45,33 @@ void StopHTTPServer();
 
 /** Handler for requests to a certain HTTP path */
 typedef boost::function<void(HTTPRequest* req, const std::string &)> HTTPRequestHandler;
+
+/** Where a request waits for a worker thread */
+enum HTTPWorkLane {
+    //! Cheap requests, served before the others
+    HTTP_LANE_PRIORITY,
+    HTTP_LANE_NORMAL,
+    //! Requests that can take long, served by their own threads (-rpcslowthreads)
+    HTTP_LANE_SLOW,
+};
+/** Picks the lane of a request before it is queued, called on the event
+ * loop thread, so it must be quick and must not consume the body.
+ */
+typedef boost::function<HTTPWorkLane(HTTPRequest* req, const std::string &)> HTTPLaneClassifier;
+
 /** Register handler for prefix.
  * If multiple handlers match a prefix, the first-registered one will
  * be invoked.
  */
-void RegisterHTTPHandler(const std::string &prefix, bool exactMatch, const HTTPRequestHandler &handler);
+void RegisterHTTPHandler(const std::string &prefix, bool exactMatch, const HTTPRequestHandler &handler, HTTPWorkLane lane = HTTP_LANE_NORMAL);
+/** Register handler for prefix, with the lane chosen per request */
+void RegisterHTTPHandler(const std::string &prefix, bool exactMatch, const HTTPRequestHandler &handler, const HTTPLaneClassifier &classify);
 /** Unregister handler for prefix */
 void UnregisterHTTPHandler(const std::string &prefix, bool exactMatch);
 
+/** Queue a task on the RPC worker threads, returns false if the work queue is full */
+bool HTTPEnqueueTask(const boost::function<void(void)>& task);
+
 /** Return evhttp event base. This can be used by submodules to
  * queue timers or custom events.
  */
@@ -59,6 +84,8 @@ class HTTPRequest
 {
 private:
     struct evhttp_request* req;
+    //! Set once a chunked reply was started
+    boost::shared_ptr<HTTPReplyChunks> chunks;
 
     // For test access
 protected:
@@ -102,6 +129,12 @@ public:
      */
     std::string ReadBody();
 
+    /**
+     * Copy the request body without consuming it. Returns false, leaving
+     * body empty, if it is longer than nMaxSize.
+     */
+    bool PeekBody(size_t nMaxSize, std::string& body);
+
     /**
      * Write output header.
      *
@@ -118,6 +151,30 @@ public:
      * main thread, do not call any other HTTPRequest methods after calling this.
      */
     virtual void WriteReply(int nStatus, const std::string& strReply = "");
+
+    /**
+     * Start a chunked reply, for a body that is sent while it is generated.
+     * The body follows in WriteReplyChunk calls and ends with WriteReplyEnd.
+     *
+     * @note call WriteHeader before, and none of WriteReply or WriteReplyStart after.
+     */
+    void WriteReplyStart(int nStatus);
+
+    /**
+     * Queue the next part of a chunked reply, chunk is consumed. Waits while
+     * more than HTTP_REPLY_MAX_PENDING bytes are not yet written to the client.
+     * Returns false if the client went away or stopped reading, the reply
+     * then only has to be ended.
+     */
+    bool WriteReplyChunk(std::string& chunk);
+
+    /**
+     * End a chunked reply.
+     *
+     * @note As this gives the request back to the main thread, do not call
+     * any other HTTPRequest methods after calling this.
+     */
+    void WriteReplyEnd();
 };
 
 /** Event handler closure.
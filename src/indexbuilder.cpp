@@ -0,0 +1,350 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "indexbuilder.h"
+
+#include "cc/eval.h"
+#include "ccindex.h"
+#include "main.h"
+#include "txdb.h"
+#include "undo.h"
+#include "util.h"
+#include "utiltime.h"
+
+#include <atomic>
+
+#include <boost/algorithm/string/join.hpp>
+#include <boost/thread.hpp>
+
+//! Families being built, changed under cs_main
+static std::atomic<int> nBuildFamilies(0);
+//! Height of pindexBuilt, -1 before genesis
+static std::atomic<int> nBuildHeight(-1);
+//! Last block the builder wrote the entries for, NULL when it starts from genesis. Requires cs_main.
+static const CBlockIndex* pindexBuilt = NULL;
+
+static CCriticalSection csBuildError;
+//! Why the builder stopped before reaching the tip
+static std::string strBuildError;
+
+static void SetBuilt(const CBlockIndex* pindex)
+{
+    pindexBuilt = pindex;
+    nBuildHeight = pindex ? pindex->GetHeight() : -1;
+}
+
+static void SetBuildError(const std::string& strError)
+{
+    LogPrintf("Index build stopped: %s\n", strError);
+    LOCK(csBuildError);
+    strBuildError = strError;
+}
+
+static bool WriteBuildState()
+{
+    CIndexBuildState buildState;
+    buildState.nFamilies = nBuildFamilies;
+    if (pindexBuilt)
+        buildState.hashBest = pindexBuilt->GetBlockHash();
+    return pblocktree->WriteIndexBuildState(buildState);
+}
+
+std::vector<std::string> IndexBuildFamilyNames(int nFamilies)
+{
+    std::vector<std::string> vNames;
+    if (nFamilies & INDEX_BUILD_ADDRESS)
+        vNames.push_back("addressindex");
+    if (nFamilies & INDEX_BUILD_SPENT)
+        vNames.push_back("spentindex");
+    if (nFamilies & INDEX_BUILD_TIMESTAMP)
+        vNames.push_back("timestampindex");
+    if (nFamilies & INDEX_BUILD_CC)
+        vNames.push_back("ccindex");
+    return vNames;
+}
+
+bool ScheduleIndexBuild(CBlockTreeDB* pdb, int nFamilies)
+{
+    CIndexBuildState buildState;
+    pdb->ReadIndexBuildState(buildState);
+    buildState.nFamilies |= nFamilies;
+    // The new families have no entries at all, replaying the blocks for the others does no harm
+    buildState.hashBest.SetNull();
+    LogPrintf("%s: will build %s online\n", __func__, boost::algorithm::join(IndexBuildFamilyNames(buildState.nFamilies), ", "));
+    return pdb->WriteIndexBuildState(buildState);
+}
+
+void LoadIndexBuildState()
+{
+    CIndexBuildState buildState;
+    pblocktree->ReadIndexBuildState(buildState);
+
+    const CBlockIndex* pindex = NULL;
+    if (!buildState.hashBest.IsNull()) {
+        BlockMap::const_iterator mi = mapBlockIndex.find(buildState.hashBest);
+        if (mi != mapBlockIndex.end())
+            pindex = mi->second;
+    }
+    nBuildFamilies = buildState.nFamilies;
+    SetBuilt(pindex);
+    {
+        LOCK(csBuildError);
+        strBuildError.clear();
+    }
+    if (buildState.nFamilies != 0)
+        LogPrintf("%s: building %s online, at height %d\n", __func__, boost::algorithm::join(IndexBuildFamilyNames(buildState.nFamilies), ", "), nBuildHeight);
+}
+
+bool IsIndexBuilding(int nFamily)
+{
+    return (nBuildFamilies & nFamily) != 0;
+}
+
+bool IndexBuildCoversBlock(int nFamily, const CBlockIndex* pindex)
+{
+    AssertLockHeld(cs_main);
+    return !IsIndexBuilding(nFamily) || pindex == pindexBuilt;
+}
+
+void IndexBuildBlockDisconnected(const CBlockIndex* pindex)
+{
+    AssertLockHeld(cs_main);
+    if (nBuildFamilies == 0 || pindex != pindexBuilt)
+        return;
+    SetBuilt(pindex->pprev);
+    if (!WriteBuildState())
+        LogPrintf("%s: failed to write the index build state\n", __func__);
+}
+
+void GetIndexBuildProgress(int& nFamiliesOut, int& nHeightOut, std::string& strErrorOut)
+{
+    nFamiliesOut = nBuildFamilies;
+    nHeightOut = nBuildHeight;
+    LOCK(csBuildError);
+    strErrorOut = strBuildError;
+}
+
+/** Index entries of a block, as ConnectBlock writes them */
+struct CIndexBuildEntries
+{
+    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > addressUnspentIndex;
+    std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > spentIndex;
+    std::vector<std::pair<CCCUnspentKey, CAddressUnspentValue> > ccUnspentIndex;
+    std::vector<COutPoint> ccSpentIndex;
+    std::vector<std::pair<CTokenUnspentKey, CAddressUnspentValue> > tokenUnspentIndex;
+    std::vector<std::pair<uint256, CTokenIndexInfo> > tokenIndex;
+    std::vector<std::pair<COracleDataKey, COracleDataValue> > oracleDataIndex;
+    std::vector<std::pair<CGatewaysIndexKey, CAddressUnspentValue> > gatewaysIndex;
+};
+
+/** Collects the entries of a block, the outputs it spends are taken from its undo data */
+static bool CollectBlockEntries(const CBlock& block, const CBlockUndo& blockundo, int nHeight, int nFamilies, CIndexBuildEntries& entries)
+{
+    if (blockundo.vtxundo.size() + 1 != block.vtx.size())
+        return error("%s: block and undo data inconsistent", __func__);
+
+    const bool fAddress = (nFamilies & INDEX_BUILD_ADDRESS) != 0;
+    const bool fSpent = (nFamilies & INDEX_BUILD_SPENT) != 0;
+    const bool fCC = (nFamilies & INDEX_BUILD_CC) != 0;
+    for (size_t i = 0; i < block.vtx.size(); i++) {
+        const CTransaction& tx = block.vtx[i];
+        const uint256 txhash = tx.GetHash();
+
+        if (!tx.IsMint()) {
+            const CTxUndo& txundo = blockundo.vtxundo[i - 1];
+            // The first input of a pegs import has no undo data
+            const size_t nSkip = tx.IsPegsImport() ? 1 : 0;
+            if (txundo.vprevout.size() + nSkip != tx.vin.size())
+                return error("%s: transaction and undo data inconsistent", __func__);
+            for (size_t j = nSkip; j < tx.vin.size(); j++) {
+                const CTxIn& input = tx.vin[j];
+                const CTxOut& prevout = txundo.vprevout[j - nSkip].txout;
+                if (fCC && prevout.scriptPubKey.IsPayToCryptoCondition())
+                    entries.ccSpentIndex.push_back(input.prevout);
+
+                std::vector<std::vector<unsigned char>> vSols;
+                CTxDestination vDest;
+                txnouttype txType = TX_PUBKEYHASH;
+                int keyType = GetAddressType(prevout.scriptPubKey, vDest, txType, vSols);
+                if (keyType == 0)
+                    continue;
+                uint160 addrHash;
+                for (const std::vector<unsigned char>& addr : vSols) {
+                    addrHash = addr.size() == 20 ? uint160(addr) : Hash160(addr);
+                    if (fAddress) {
+                        entries.addressIndex.push_back(std::make_pair(CAddressIndexKey(keyType, addrHash, nHeight, i, txhash, j, true), prevout.nValue * -1));
+                        entries.addressUnspentIndex.push_back(std::make_pair(CAddressUnspentKey(keyType, addrHash, input.prevout.hash, input.prevout.n), CAddressUnspentValue()));
+                    }
+                }
+                if (fSpent)
+                    entries.spentIndex.push_back(std::make_pair(CSpentIndexKey(input.prevout.hash, input.prevout.n), CSpentIndexValue(txhash, j, nHeight, prevout.nValue, keyType, addrHash)));
+            }
+        }
+
+        if (fAddress) {
+            for (size_t k = 0; k < tx.vout.size(); k++) {
+                const CTxOut& out = tx.vout[k];
+
+                std::vector<std::vector<unsigned char>> vSols;
+                CTxDestination vDest;
+                txnouttype txType = TX_PUBKEYHASH;
+                int keyType = GetAddressType(out.scriptPubKey, vDest, txType, vSols);
+                if (keyType == 0)
+                    continue;
+                for (const std::vector<unsigned char>& addr : vSols) {
+                    uint160 addrHash = addr.size() == 20 ? uint160(addr) : Hash160(addr);
+                    entries.addressIndex.push_back(std::make_pair(CAddressIndexKey(keyType, addrHash, nHeight, i, txhash, k, false), out.nValue));
+                    entries.addressUnspentIndex.push_back(std::make_pair(CAddressUnspentKey(keyType, addrHash, txhash, k), CAddressUnspentValue(out.nValue, out.scriptPubKey, nHeight)));
+                }
+            }
+        }
+        if (fCC) {
+            AddCCIndexOutputs(tx, nHeight, entries.ccUnspentIndex);
+            AddOracleDataIndex(tx, nHeight, i, entries.oracleDataIndex);
+            AddGatewaysIndex(tx, nHeight, entries.gatewaysIndex);
+        }
+    }
+
+    // Checking the token outputs reads the transactions they spend, which needs cs_main
+    bool fTokens = false;
+    for (const std::pair<CCCUnspentKey, CAddressUnspentValue>& created : entries.ccUnspentIndex)
+        fTokens = fTokens || created.first.evalcode == EVAL_TOKENS;
+    if (fTokens) {
+        LOCK(cs_main);
+        for (const CTransaction& tx : block.vtx)
+            AddTokenIndexOutputs(tx, nHeight, entries.tokenUnspentIndex, entries.tokenIndex);
+    }
+    return true;
+}
+
+static bool WriteBlockEntries(const std::vector<CIndexBuildEntries>& vEntries, const std::vector<const CBlockIndex*>& vIndex, size_t nBlocks, int nFamilies)
+{
+    CIndexBuildEntries all;
+    for (size_t i = 0; i < nBlocks; i++) {
+        // Kept in block order, a later block may spend what an earlier one created
+        all.addressIndex.insert(all.addressIndex.end(), vEntries[i].addressIndex.begin(), vEntries[i].addressIndex.end());
+        all.addressUnspentIndex.insert(all.addressUnspentIndex.end(), vEntries[i].addressUnspentIndex.begin(), vEntries[i].addressUnspentIndex.end());
+        all.spentIndex.insert(all.spentIndex.end(), vEntries[i].spentIndex.begin(), vEntries[i].spentIndex.end());
+        all.ccUnspentIndex.insert(all.ccUnspentIndex.end(), vEntries[i].ccUnspentIndex.begin(), vEntries[i].ccUnspentIndex.end());
+        all.ccSpentIndex.insert(all.ccSpentIndex.end(), vEntries[i].ccSpentIndex.begin(), vEntries[i].ccSpentIndex.end());
+        all.tokenUnspentIndex.insert(all.tokenUnspentIndex.end(), vEntries[i].tokenUnspentIndex.begin(), vEntries[i].tokenUnspentIndex.end());
+        all.tokenIndex.insert(all.tokenIndex.end(), vEntries[i].tokenIndex.begin(), vEntries[i].tokenIndex.end());
+        all.oracleDataIndex.insert(all.oracleDataIndex.end(), vEntries[i].oracleDataIndex.begin(), vEntries[i].oracleDataIndex.end());
+        all.gatewaysIndex.insert(all.gatewaysIndex.end(), vEntries[i].gatewaysIndex.begin(), vEntries[i].gatewaysIndex.end());
+    }
+
+    if (nFamilies & INDEX_BUILD_ADDRESS) {
+        if (!pblocktree->WriteAddressIndex(all.addressIndex) || !pblocktree->UpdateAddressUnspentIndex(all.addressUnspentIndex))
+            return error("%s: failed to write address index", __func__);
+    }
+    if (nFamilies & INDEX_BUILD_SPENT) {
+        if (!pblocktree->UpdateSpentIndex(all.spentIndex))
+            return error("%s: failed to write spent index", __func__);
+    }
+    if (nFamilies & INDEX_BUILD_CC) {
+        if (!pblocktree->UpdateCCUnspentIndex(all.ccUnspentIndex, all.ccSpentIndex, all.tokenUnspentIndex, all.tokenIndex) ||
+            !pblocktree->WriteOracleDataIndex(all.oracleDataIndex) || !pblocktree->WriteGatewaysIndex(all.gatewaysIndex))
+            return error("%s: failed to write CC index", __func__);
+    }
+    if (nFamilies & INDEX_BUILD_TIMESTAMP) {
+        for (size_t i = 0; i < nBlocks; i++)
+            if (!WriteBlockTimestampIndex(vIndex[i]))
+                return false;
+    }
+    return true;
+}
+
+void ThreadIndexBuild()
+{
+    RenameThread("pirate-indexbuild");
+    const int64_t nSleep = std::max<int64_t>(0, GetArg("-indexbuildsleep", DEFAULT_INDEX_BUILD_SLEEP));
+
+    {
+        LOCK(cs_main);
+        if (nBuildFamilies == 0)
+            return;
+        // After a crash the builder can be ahead of the active chain or on a
+        // fork of it. The entries of the blocks connected again are rewritten.
+        if (pindexBuilt != NULL && !chainActive.Contains(pindexBuilt))
+            SetBuilt(chainActive.FindFork(pindexBuilt));
+        LogPrintf("%s: building %s from height %d to %d\n", __func__, boost::algorithm::join(IndexBuildFamilyNames(nBuildFamilies), ", "), nBuildHeight, chainActive.Height());
+    }
+
+    int64_t nLastLog = GetTime();
+    while (true) {
+        boost::this_thread::interruption_point();
+
+        // Take the next blocks of the active chain
+        std::vector<const CBlockIndex*> vIndex;
+        const CBlockIndex* pindexStart;
+        int nFamilies;
+        {
+            LOCK(cs_main);
+            nFamilies = nBuildFamilies;
+            pindexStart = pindexBuilt;
+            // The genesis block has no entries
+            const CBlockIndex* pindex = pindexStart ? chainActive.Next(pindexStart) : chainActive[1];
+            if (pindex == NULL) {
+                // At the tip: from here on ConnectBlock writes the entries
+                nBuildFamilies = 0;
+                SetBuilt(NULL);
+                if (!pblocktree->EraseIndexBuildState())
+                    LogPrintf("%s: failed to erase the index build state\n", __func__);
+                LogPrintf("%s: finished building %s at height %d\n", __func__, boost::algorithm::join(IndexBuildFamilyNames(nFamilies), ", "), chainActive.Height());
+                return;
+            }
+            for (; pindex != NULL && vIndex.size() < INDEX_BUILD_BATCH_BLOCKS; pindex = chainActive.Next(pindex)) {
+                if (!(pindex->nStatus & BLOCK_HAVE_DATA) || !(pindex->nStatus & BLOCK_HAVE_UNDO)) {
+                    SetBuildError(strprintf("block %d is not on disk, the index needs a -reindex", pindex->GetHeight()));
+                    return;
+                }
+                vIndex.push_back(pindex);
+            }
+        }
+
+        // Read and decode without holding cs_main
+        std::vector<CIndexBuildEntries> vEntries(vIndex.size());
+        for (size_t i = 0; i < vIndex.size(); i++) {
+            CBlock block;
+            CBlockUndo blockundo;
+            if (!ReadBlockFromDisk(block, vIndex[i], false) || !ReadBlockUndoFromDisk(blockundo, vIndex[i]) ||
+                !CollectBlockEntries(block, blockundo, vIndex[i]->GetHeight(), nFamilies, vEntries[i])) {
+                SetBuildError(strprintf("failed to read block %d", vIndex[i]->GetHeight()));
+                return;
+            }
+            boost::this_thread::interruption_point();
+        }
+
+        {
+            LOCK(cs_main);
+            // A disconnect moved the builder back meanwhile, carry on from there
+            if (pindexBuilt != pindexStart)
+                continue;
+            // Only the blocks still on the active chain are written
+            size_t nBlocks = 0;
+            while (nBlocks < vIndex.size() && chainActive.Contains(vIndex[nBlocks]))
+                nBlocks++;
+            if (nBlocks == 0)
+                continue;
+            if (!WriteBlockEntries(vEntries, vIndex, nBlocks, nFamilies)) {
+                SetBuildError(strprintf("failed to write the entries of block %d", vIndex[0]->GetHeight()));
+                return;
+            }
+            SetBuilt(vIndex[nBlocks - 1]);
+            if (!WriteBuildState()) {
+                SetBuildError("failed to write the index build state");
+                return;
+            }
+            if (GetTime() - nLastLog >= 60) {
+                LogPrintf("%s: built up to height %d of %d\n", __func__, nBuildHeight, chainActive.Height());
+                nLastLog = GetTime();
+            }
+        }
+
+        // Leave the disk and cs_main to validation for a while
+        if (nSleep > 0)
+            MilliSleep(nSleep);
+    }
+}
@@ -0,0 +1,80 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_INDEXBUILDER_H
+#define BITCOIN_INDEXBUILDER_H
+
+#include "serialize.h"
+#include "uint256.h"
+
+#include <string>
+#include <vector>
+
+class CBlockIndex;
+class CBlockTreeDB;
+
+/** Indexes the online builder can build */
+enum IndexBuildFamily {
+    INDEX_BUILD_ADDRESS = 1,
+    INDEX_BUILD_SPENT = 2,
+    INDEX_BUILD_TIMESTAMP = 4,
+    INDEX_BUILD_CC = 8,
+};
+
+//! Default for -indexbuildsleep, in milliseconds
+static const int DEFAULT_INDEX_BUILD_SLEEP = 10;
+//! Blocks read and written by the builder per round
+static const unsigned int INDEX_BUILD_BATCH_BLOCKS = 50;
+
+/** Progress of an online index build, persisted in the block tree database */
+class CIndexBuildState
+{
+public:
+    //! Families still being built
+    int nFamilies;
+    //! Last block of the active chain the entries are written for
+    uint256 hashBest;
+
+    CIndexBuildState() : nFamilies(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(nFamilies);
+        READWRITE(hashBest);
+    }
+};
+
+/**
+ * Indexes enabled on a node that already has a chain are built by a
+ * background thread from the block and undo files, instead of a -reindex.
+ *
+ * While a family is being built, ConnectBlock does not write it and the
+ * builder walks the active chain up from genesis in batches. A block the
+ * builder already covered is still undone by DisconnectBlock, which moves the
+ * builder back by one block. Once the builder reaches the tip it hands the
+ * family over to ConnectBlock, under cs_main, so no block is missed or
+ * written twice. Entries are plain key writes, so a batch replayed after a
+ * crash gives the same index.
+ */
+
+//! Adds families to the build, which starts over from genesis. Called before the block index is loaded.
+bool ScheduleIndexBuild(CBlockTreeDB* pdb, int nFamilies);
+//! Loads the build state with the block index
+void LoadIndexBuildState();
+//! Whether a family is still being built, its queries are refused until then
+bool IsIndexBuilding(int nFamily);
+//! Whether DisconnectBlock undoes the family for pindex. Requires cs_main.
+bool IndexBuildCoversBlock(int nFamily, const CBlockIndex* pindex);
+//! Moves the builder back when DisconnectBlock undid its last block. Requires cs_main.
+void IndexBuildBlockDisconnected(const CBlockIndex* pindex);
+//! Names of the families in the mask
+std::vector<std::string> IndexBuildFamilyNames(int nFamilies);
+//! Families being built, the height they reached and why the build stopped, if it did
+void GetIndexBuildProgress(int& nFamiliesOut, int& nHeightOut, std::string& strErrorOut);
+
+void ThreadIndexBuild();
+
+#endif // BITCOIN_INDEXBUILDER_H
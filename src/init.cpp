@@ -27,13 +27,21 @@
 #include "primitives/block.h"
 #include "addrman.h"
 #include "amount.h"
+#include "asyncrpcqueue.h"
+#include "blockcompress.h"
+#include "blockconnectstats.h"
+#include "ccindex.h"
 #include "checkpoints.h"
+#include "coinstats.h"
 #include "compat/sanity.h"
 #include "consensus/upgrades.h"
 #include "consensus/validation.h"
 #include "httpserver.h"
+#include "httpmetrics.h"
 #include "httprpc.h"
+#include "indexbuilder.h"
 #include "key.h"
+#include "kvindex.h"
 #include "notarisationdb.h"
 #include "params.h"
 
@@ -44,6 +52,10 @@
 #include "metrics.h"
 #include "miner.h"
 #include "net.h"
+#include "nspvcache.h"
+#include "proofcache.h"
+#include "replaybench.h"
+#include "rpc/cache.h"
 #include "rpc/server.h"
 #include "rpc/register.h"
 #include "script/standard.h"
@@ -57,6 +69,9 @@
 #ifdef ENABLE_WALLET
 #include "wallet/wallet.h"
 #include "wallet/walletdb.h"
+#include "wallet/rescan.h"
+#include "wallet/vkscanner.h"
+#include "wallet/walletarchivedb.h"
 #include "wallet/asyncrpcoperation_saplingconsolidation.h"
 #include "wallet/asyncrpcoperation_sweeptoaddress.h"
 #endif
@@ -84,10 +99,12 @@
 
 #if ENABLE_ZMQ
 #include "zmq/zmqnotificationinterface.h"
+#include "zmq/zmqsender.h"
 #endif
 
 #if ENABLE_PROTON
 #include "amqp/amqpnotificationinterface.h"
+#include "amqp/amqpsender.h"
 #endif
 
 #include "librustzcash.h"
@@ -105,6 +122,7 @@ extern int32_t KOMODO_SNAPSHOT_INTERVAL;
 extern void komodo_init(int32_t height);
 
 ZCJoinSplit* pzcashParams = NULL;
+CScheduler* pschedulerMain = NULL;
 
 #ifdef ENABLE_WALLET
 CWallet* pwalletMain = NULL;
@@ -233,6 +251,7 @@ void Shutdown()
 
     StopHTTPRPC();
     StopREST();
+    StopHTTPMetrics();
     StopRPC();
     StopHTTPServer();
 #ifdef ENABLE_WALLET
@@ -268,6 +287,8 @@ void Shutdown()
         }
         delete pcoinsTip;
         pcoinsTip = NULL;
+        delete pcoinsAsyncFlush;
+        pcoinsAsyncFlush = NULL;
         delete pcoinscatcher;
         pcoinscatcher = NULL;
         delete pcoinsdbview;
@@ -280,9 +301,12 @@ void Shutdown()
         pwalletMain->Flush(true);
 #endif
 
+    // Runs the notifications still queued before their listeners go
+    StopValidationInterfaceQueue();
+
 #if ENABLE_ZMQ
     if (pzmqNotificationInterface) {
-        UnregisterValidationInterface(pzmqNotificationInterface);
+        UnregisterAsyncValidationInterface(pzmqNotificationInterface);
         delete pzmqNotificationInterface;
         pzmqNotificationInterface = NULL;
     }
@@ -290,12 +314,20 @@ void Shutdown()
 
 #if ENABLE_PROTON
     if (pAMQPNotificationInterface) {
-        UnregisterValidationInterface(pAMQPNotificationInterface);
+        UnregisterAsyncValidationInterface(pAMQPNotificationInterface);
         delete pAMQPNotificationInterface;
         pAMQPNotificationInterface = NULL;
     }
 #endif
 
+#ifdef ENABLE_WALLET
+    if (pviewingKeyScanner) {
+        UnregisterAsyncValidationInterface(pviewingKeyScanner);
+        delete pviewingKeyScanner;
+        pviewingKeyScanner = NULL;
+    }
+#endif
+
 #ifndef WIN32
     try {
         boost::filesystem::remove(GetPidFile());
@@ -307,6 +339,8 @@ void Shutdown()
 #ifdef ENABLE_WALLET
     delete pwalletMain;
     pwalletMain = NULL;
+    delete pwalletArchiveDB;
+    pwalletArchiveDB = NULL;
 #endif
     delete pzcashParams;
     pzcashParams = NULL;
@@ -378,6 +412,8 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-?", _("This help message"));
     strUsage += HelpMessageOpt("-alerts", strprintf(_("Receive and display P2P network alerts (default: %u)"), DEFAULT_ALERTS));
     strUsage += HelpMessageOpt("-alertnotify=<cmd>", _("Execute command when a relevant alert is received or we see a really long fork (%s in cmd is replaced by message)"));
+    strUsage += HelpMessageOpt("-assumenotarized=<hash>", _("During initial block download, skip proof and script verification of blocks buried under the notarized block <hash>, or under the latest known notarization if 1 (default: 0)"));
+    strUsage += HelpMessageOpt("-blockcompression=<n>", strprintf(_("Compress new blocks and undo data with zlib at level <n> (1-9), with a dictionary trained on recent blocks; 0 writes them uncompressed. Compressed block files can only be read by releases with this option (default: %u)"), DEFAULT_BLOCK_COMPRESSION));
     strUsage += HelpMessageOpt("-blocknotify=<cmd>", _("Execute command when the best block changes (%s in cmd is replaced by block hash)"));
     strUsage += HelpMessageOpt("-checkblocks=<n>", strprintf(_("How many blocks to check at startup (default: %u, 0 = all)"), 288));
     strUsage += HelpMessageOpt("-checklevel=<n>", strprintf(_("How thorough the block verification of -checkblocks is (0-4, default: %u)"), 3));
@@ -394,15 +430,28 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-dbcache=<n>", strprintf(_("Set database cache size in megabytes (%d to %d, default: %d)"), nMinDbCache, nMaxDbCache, nDefaultDbCache));
     strUsage += HelpMessageOpt("-loadblock=<file>", _("Imports blocks from external blk000??.dat file") + " " + _("on startup"));
     strUsage += HelpMessageOpt("-maxorphantx=<n>", strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS));
+    strUsage += HelpMessageOpt("-maxmempool=<n>", strprintf(_("Keep the transaction memory pool below <n> megabytes (default: %u)"), DEFAULT_MAX_MEMPOOL_SIZE));
     strUsage += HelpMessageOpt("-mempooltxinputlimit=<n>", _("[DEPRECATED FROM OVERWINTER] Set the maximum number of transparent inputs in a transaction that the mempool will accept (default: 0 = no limit applied)"));
+    strUsage += HelpMessageOpt("-schedulerthreads=<n>", strprintf(_("Set the number of threads running the periodic jobs (1 to %d, default: %d)"), MAX_SCHEDULER_THREADS, DEFAULT_SCHEDULER_THREADS));
     strUsage += HelpMessageOpt("-par=<n>", strprintf(_("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"),
         -(int)boost::thread::hardware_concurrency(), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS));
+#ifdef ENABLE_WALLET
+    strUsage += HelpMessageOpt("-zdecryptthreads=<n>", strprintf(_("Set the number of Sapling note trial decryption threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"),
+        -(int)boost::thread::hardware_concurrency(), MAX_SAPLING_DECRYPT_THREADS, DEFAULT_SAPLING_DECRYPT_THREADS));
+    strUsage += HelpMessageOpt("-witnessthreads=<n>", strprintf(_("Set the number of threads used to update note witnesses (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"),
+        -(int)boost::thread::hardware_concurrency(), MAX_WITNESS_CACHE_THREADS, DEFAULT_WITNESS_CACHE_THREADS));
+#endif
 #ifndef _WIN32
     strUsage += HelpMessageOpt("-pid=<file>", strprintf(_("Specify pid file (default: %s)"), "komodod.pid"));
 #endif
-    // strUsage += HelpMessageOpt("-prune=<n>", strprintf(_("Reduce storage requirements by pruning (deleting) old blocks. This mode disables wallet support and is incompatible with -txindex. "
-    //         "Warning: Reverting this setting requires re-downloading the entire blockchain. "
-    //         "(default: 0 = disable pruning blocks, >%u = target size in MiB to use for block files)"), MIN_DISK_SPACE_FOR_BLOCK_FILES / 1024 / 1024));
+    strUsage += HelpMessageOpt("-prune=<n>", strprintf(_("Reduce storage requirements by pruning (deleting) old blocks. This mode enables -compactblockindex, "
+            "which keeps the Sapling note commitments of the pruned blocks for the wallet's witnesses. Transactions of pruned blocks can no longer be "
+            "returned by getrawtransaction or found by a rescan. Warning: Reverting this setting requires re-downloading the entire blockchain. "
+            "(default: 0 = disable pruning blocks, >%u = target size in MiB to use for block files)"), MIN_DISK_SPACE_FOR_BLOCK_FILES / 1024 / 1024));
+    strUsage += HelpMessageOpt("-coldblocksdir=<dir>", _("Move the block and undo files of old blocks to this directory, such as one on a slower volume, "
+            "and read them from there. Incompatible with -prune"));
+    strUsage += HelpMessageOpt("-coldblocksdepth=<n>", strprintf(_("Move a block file to -coldblocksdir once all its blocks are more than <n> blocks below the tip (%u or more, default: %u)"),
+            MIN_COLD_BLOCKS_DEPTH, DEFAULT_COLD_BLOCKS_DEPTH));
     strUsage += HelpMessageOpt("-bootstrap", _("Download and install bootstrap on startup (1 to show GUI prompt, 2 to force download when using CLI)"));
     strUsage += HelpMessageOpt("-reindex", _("Rebuild block chain index from current blk000??.dat files on startup"));
 #if !defined(WIN32)
@@ -412,6 +461,10 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-addressindex", strprintf(_("Maintain a full address index, used to query for the balance, txids and unspent outputs for addresses (default: %u)"), DEFAULT_ADDRESSINDEX));
     strUsage += HelpMessageOpt("-timestampindex", strprintf(_("Maintain a timestamp index for block hashes, used to query blocks hashes by a range of timestamps (default: %u)"), DEFAULT_TIMESTAMPINDEX));
     strUsage += HelpMessageOpt("-spentindex", strprintf(_("Maintain a full spent index, used to query the spending txid and input index for an outpoint (default: %u)"), DEFAULT_SPENTINDEX));
+    strUsage += HelpMessageOpt("-ccindex", strprintf(_("Maintain an index of the unspent CryptoCondition outputs by evalcode, funcid and reference txid, used by the CC modules to find their outputs (default: %u)"), DEFAULT_CCINDEX));
+    strUsage += HelpMessageOpt("-indexbuildsleep=<n>", strprintf(_("When one of the indexes above is enabled on an existing chain, it is built in the background; pause <n> milliseconds between batches of blocks (default: %u)"), DEFAULT_INDEX_BUILD_SLEEP));
+    strUsage += HelpMessageOpt("-coinstatsindex", strprintf(_("Maintain the UTXO set statistics and coin supply of every block, so gettxoutsetinfo and coinsupply do not scan (default: %u)"), DEFAULT_COINSTATSINDEX));
+    strUsage += HelpMessageOpt("-compactblockindex", strprintf(_("Maintain a compact Sapling record of every block, served to light clients by the REST interface (default: %u)"), DEFAULT_COMPACTBLOCKINDEX));
     strUsage += HelpMessageGroup(_("Connection options:"));
     strUsage += HelpMessageOpt("-addnode=<ip>", _("Add a node to connect to and attempt to keep the connection open"));
     strUsage += HelpMessageOpt("-asmap=<file>", strprintf("Specify asn mapping used for bucketing of the peers (default: %s). Relative paths will be prefixed by the net-specific datadir location.", DEFAULT_ASMAP_FILENAME));
@@ -429,11 +482,13 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-maxconnections=<n>", strprintf(_("Maintain at most <n> connections to peers (default: %u)"), DEFAULT_MAX_PEER_CONNECTIONS));
     strUsage += HelpMessageOpt("-maxreceivebuffer=<n>", strprintf(_("Maximum per-connection receive buffer, <n>*1000 bytes (default: %u)"), 5000));
     strUsage += HelpMessageOpt("-maxsendbuffer=<n>", strprintf(_("Maximum per-connection send buffer, <n>*1000 bytes (default: %u)"), 1000));
+    strUsage += HelpMessageOpt("-msgworkers=<n>", strprintf(_("Number of threads serving block, header and nSPV requests of peers, 0 to serve them on the message handler thread (default: %u)"), DEFAULT_MESSAGE_WORKERS));
     strUsage += HelpMessageOpt("-onion=<ip:port>", strprintf(_("Use separate SOCKS5 proxy to reach peers via Tor hidden services (default: %s)"), "-proxy"));
     strUsage += HelpMessageOpt("-onlynet=<net>", _("Only connect to nodes in network <net> (ipv4, ipv6 or onion)"));
     strUsage += HelpMessageOpt("-permitbaremultisig", strprintf(_("Relay non-P2SH multisig (default: %u)"), 1));
     strUsage += HelpMessageOpt("-peerbloomfilters", strprintf(_("Support filtering of blocks and transaction with Bloom filters (default: %u)"), 1));
     strUsage += HelpMessageOpt("-nspv_msg", strprintf(_("Enable NSPV messages processing (default: %u)"), DEFAULT_NSPV_PROCESSING));
+    strUsage += HelpMessageOpt("-nspvcachesize=<n>", strprintf(_("Maximum size of the cache of answers to NSPV requests in megabytes, 0 to disable (default: %u)"), DEFAULT_NSPV_CACHE_SIZE));
     if (showDebug)
         strUsage += HelpMessageOpt("-enforcenodebloom", strprintf("Enforce minimum protocol version to limit use of Bloom filters (default: %u)", 0));
     strUsage += HelpMessageOpt("-port=<port>", strprintf(_("Listen for connections on <port> (default: %u or testnet: %u)"), 7770, 17770));
@@ -449,16 +504,19 @@ std::string HelpMessage(HelpMessageMode mode)
 
 #ifdef ENABLE_WALLET
     strUsage += HelpMessageGroup(_("Wallet options:"));
+    strUsage += HelpMessageOpt("-backgroundkeycheck", strprintf(_("Unlock an encrypted wallet after decrypting one key of each kind, and check that all others decrypt in the background (default: %u)"), DEFAULT_BACKGROUND_KEY_CHECK));
     strUsage += HelpMessageOpt("-disablewallet", _("Do not load the wallet and disable wallet RPC calls"));
     strUsage += HelpMessageOpt("-keypool=<n>", strprintf(_("Set key pool size to <n> (default: %u)"), 100));
     strUsage += HelpMessageOpt("-consolidation", _("Enable auto Sapling note consolidation"));
     strUsage += HelpMessageOpt("-consolidatesaplingaddress=<zaddr>", _("Specify Sapling Address to Consolidate. Consolidation address must be the same as sweep  (default: all)"));
     strUsage += HelpMessageOpt("-consolidationtxfee", strprintf(_("Fee amount in Satoshis used send consolidation transactions. (default %i)"), DEFAULT_CONSOLIDATION_FEE));
+    strUsage += HelpMessageOpt("-consolidationthreads=<n>", strprintf(_("Set the number of consolidation and sweep transactions built in parallel (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"),
+        -(int)boost::thread::hardware_concurrency(), MAX_CONSOLIDATION_THREADS, DEFAULT_CONSOLIDATION_THREADS));
     strUsage += HelpMessageOpt("-sweep", _("Enable auto Sapling note sweep, automatically move all funds to a sigle address periodocally."));
     strUsage += HelpMessageOpt("-sweepsaplingaddress=<zaddr>", _("Specify Sapling Address to Sweep funds to. (default: all)"));
     strUsage += HelpMessageOpt("-sweeptxfee", strprintf(_("Fee amount in Satoshis used send sweep transactions. (default %i)"), DEFAULT_SWEEP_FEE));
     strUsage += HelpMessageOpt("-deletetx", _("Enable Old Transaction Deletion"));
-    strUsage += HelpMessageOpt("-deleteinterval", strprintf(_("Delete transaction every <n> blocks during inital block download (default: %i)"), DEFAULT_TX_DELETE_INTERVAL));
+    strUsage += HelpMessageOpt("-deleteinterval", strprintf(_("Compact the wallet after deleting transactions, and delete in bulk during a rescan, every <n> blocks (default: %i)"), DEFAULT_TX_DELETE_INTERVAL));
     strUsage += HelpMessageOpt("-keeptxnum", strprintf(_("Keep the last <n> transactions (default: %i)"), DEFAULT_TX_RETENTION_LASTTX));
     strUsage += HelpMessageOpt("-keeptxfornblocks", strprintf(_("Keep transactions for at least <n> blocks (default: %i)"), DEFAULT_TX_RETENTION_BLOCKS));
     if (showDebug)
@@ -468,6 +526,9 @@ std::string HelpMessage(HelpMessageMode mode)
         CURRENCY_UNIT, FormatMoney(payTxFee.GetFeePerK())));
     strUsage += HelpMessageOpt("-rescan", _("Rescan the block chain for missing wallet transactions") + " " + _("on startup"));
     strUsage += HelpMessageOpt("-rescanheight", _("Rescan the block chain from the specified height when rescan=1 on startup"));
+    strUsage += HelpMessageOpt("-rescanthreads=<n>", strprintf(_("Set the number of threads reading and trial decrypting blocks ahead of a rescan (0 = all cores, <0 = leave that many cores free, default: %d)"),
+        DEFAULT_RESCAN_PREFETCH_THREADS));
+    strUsage += HelpMessageOpt("-rebuildwallet", _("Rescan the wallet from the genesis on all cores without connecting to the network, then shut down. Used on a wallet written by wallet-utility -rebuild, implies -rescan=1 and -rescanthreads=0"));
     strUsage += HelpMessageOpt("-salvagewallet", _("Attempt to recover private keys from a corrupt wallet.dat") + " " + _("on startup"));
     strUsage += HelpMessageOpt("-sendfreetransactions", strprintf(_("Send transactions as zero-fee transactions if possible (default: %u)"), 0));
     strUsage += HelpMessageOpt("-spendzeroconfchange", strprintf(_("Spend unconfirmed change when sending transactions (default: %u)"), 1));
@@ -476,8 +537,13 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-maxtxfee=<amt>", strprintf(_("Maximum total fees (in %s) to use in a single wallet transaction; setting this too low may abort large transactions (default: %s)"),
         CURRENCY_UNIT, FormatMoney(maxTxFee)));
     strUsage += HelpMessageOpt("-upgradewallet", _("Upgrade wallet to latest format") + " " + _("on startup"));
+    strUsage += HelpMessageOpt("-vkscanner", strprintf(_("Scan the chain for the Sapling viewing keys of the vkscanner_* RPC tenants, outside of the wallet, with their notes kept in vkscanner/ (default: %u)"), DEFAULT_VKSCANNER));
     strUsage += HelpMessageOpt("-wallet=<file>", _("Specify wallet file (within data directory)") + " " + strprintf(_("(default: %s)"), "wallet.dat"));
+    strUsage += HelpMessageOpt("-walletarchivedb", strprintf(_("Keep archived wallet transaction records in a LevelDB database (walletarchive/, or walletarchive-<file>/ for another -wallet) instead of the wallet file, they are moved on startup and rebuilt by a rescan when this is turned off again (default: %u)"), DEFAULT_WALLET_ARCHIVE_DB));
     strUsage += HelpMessageOpt("-walletbroadcast", _("Make the wallet broadcast transactions") + " " + strprintf(_("(default: %u)"), true));
+    strUsage += HelpMessageOpt("-walletkdfmemory=<n>", strprintf(_("Memory in MiB the key of a wallet passphrase is derived over, when the wallet is encrypted or its passphrase changed (default: %u)"), DEFAULT_WALLET_KDF_MEMORY));
+    strUsage += HelpMessageOpt("-walletkdftime=<n>", strprintf(_("Milliseconds the key of a wallet passphrase takes to derive on this machine, when the wallet is encrypted or its passphrase changed (default: %u)"), DEFAULT_WALLET_KDF_TIME));
+    strUsage += HelpMessageOpt("-walletmemorybudget=<n>", strprintf(_("Keep fully spent wallet history on disk only, until the resident wallet transactions fit in <n> MiB (0 = keep all resident, default: %u)"), DEFAULT_WALLET_MEMORY_BUDGET));
     strUsage += HelpMessageOpt("-walletnotify=<cmd>", _("Execute command when a wallet transaction changes (%s in cmd is replaced by TxID)"));
     strUsage += HelpMessageOpt("-whitelistaddress=<Raddress>", _("Enable the wallet filter for notary nodes and add one Raddress to the whitelist of the wallet filter. If -whitelistaddress= is used, then the wallet filter is automatically activated. Several Raddresses can be defined using several -whitelistaddress= (similar to -addnode). The wallet filter will filter the utxo to only ones coming from my own Raddress (derived from pubkey) and each Raddress defined using -whitelistaddress= this option is mostly for Notary Nodes)."));
     strUsage += HelpMessageOpt("-zapwallettxes=<mode>", _("Delete all wallet transactions and only recover those parts of the blockchain through -rescan on startup") +
@@ -490,6 +556,12 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-zmqpubhashtx=<address>", _("Enable publish hash transaction in <address>"));
     strUsage += HelpMessageOpt("-zmqpubrawblock=<address>", _("Enable publish raw block in <address>"));
     strUsage += HelpMessageOpt("-zmqpubrawtx=<address>", _("Enable publish raw transaction in <address>"));
+#ifdef ENABLE_WALLET
+    strUsage += HelpMessageOpt("-zmqpubwalletnote=<address>", _("Enable publish the Sapling notes received by the wallet in <address>"));
+    strUsage += HelpMessageOpt("-zmqpubwalletspend=<address>", _("Enable publish the spends of the wallet's Sapling notes in <address>"));
+    strUsage += HelpMessageOpt("-zmqpubwalletconfirm=<address>", _("Enable publish the confirmations of wallet transactions in <address>"));
+#endif
+    strUsage += HelpMessageOpt("-zmqhwm=<n>", strprintf(_("Queue at most <n> messages for the ZMQ sender thread, dropping the oldest past that (default: %u)"), DEFAULT_ZMQ_HWM));
 #endif
 
 #if ENABLE_PROTON
@@ -498,12 +570,15 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-amqppubhashtx=<address>", _("Enable publish hash transaction in <address>"));
     strUsage += HelpMessageOpt("-amqppubrawblock=<address>", _("Enable publish raw block in <address>"));
     strUsage += HelpMessageOpt("-amqppubrawtx=<address>", _("Enable publish raw transaction in <address>"));
+    strUsage += HelpMessageOpt("-amqpqueuesize=<n>", strprintf(_("Queue at most <n> messages per broker address while the broker is slow or unreachable (default: %u)"), DEFAULT_AMQP_QUEUE_SIZE));
+    strUsage += HelpMessageOpt("-amqpdroppolicy=<policy>", strprintf(_("Message a full queue drops: oldest or newest (default: %s)"), DEFAULT_AMQP_DROP_POLICY));
 #endif
 
     strUsage += HelpMessageGroup(_("Debugging/Testing options:"));
     if (showDebug)
     {
         strUsage += HelpMessageOpt("-checkpoints", strprintf("Disable expensive verification for known chain history (default: %u)", 1));
+        strUsage += HelpMessageOpt("-dbbatchsize=<n>", strprintf("Maximum database write batch size in bytes (default: %u)", nDefaultDbBatchSize));
         strUsage += HelpMessageOpt("-dblogsize=<n>", strprintf("Flush database activity from memory pool to disk log every <n> megabytes (default: %u)", 100));
         strUsage += HelpMessageOpt("-disablesafemode", strprintf("Disable safemode, override a real safe mode event (default: %u)", 0));
         strUsage += HelpMessageOpt("-testsafemode", strprintf("Force safe mode (default: %u)", 0));
@@ -521,11 +596,17 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-help-debug", _("Show all debugging options (usage: --help -help-debug)"));
     strUsage += HelpMessageOpt("-logips", strprintf(_("Include IP addresses in debug output (default: %u)"), 0));
     strUsage += HelpMessageOpt("-logtimestamps", strprintf(_("Prepend debug output with timestamp (default: %u)"), 1));
+    strUsage += HelpMessageOpt("-blockprofile", strprintf(_("Log the time each stage of connecting a block takes (default: %u)"), DEFAULT_BLOCKPROFILE));
+    strUsage += HelpMessageOpt("-lockprofile", strprintf(_("Collect the lock contention profile of getlockstats from startup (default: %u)"), DEFAULT_LOCKPROFILE));
+    strUsage += HelpMessageOpt("-replaybench=<start>:<end>", _("Replay the blocks after <start> up to <end> of the active chain through block validation on a memory only copy of the chainstate, report the throughput of each stage and exit"));
+    strUsage += HelpMessageOpt("-replaybenchskip=<features>", _("Comma separated work -replaybench leaves out: proofs, scripts, cc, komodo, wallet (default: none)"));
     if (showDebug)
     {
         strUsage += HelpMessageOpt("-limitfreerelay=<n>", strprintf("Continuously rate-limit free transactions to <n>*1000 bytes per minute (default: %u)", 15));
         strUsage += HelpMessageOpt("-relaypriority", strprintf("Require high priority for relaying free or low-fee transactions (default: %u)", 0));
         strUsage += HelpMessageOpt("-maxsigcachesize=<n>", strprintf("Limit size of signature cache to <n> entries (default: %u)", 50000));
+        strUsage += HelpMessageOpt("-maxccevalcachesize=<n>", strprintf("Limit size of the cache of valid crypto-condition evals to <n> entries (default: %u)", DEFAULT_MAX_CCEVAL_CACHE_SIZE));
+        strUsage += HelpMessageOpt("-maxproofcachesize=<n>", strprintf("Limit size of the cache of transactions with verified shielded proofs to <n> entries (default: %u)", DEFAULT_MAX_PROOF_CACHE_SIZE));
         strUsage += HelpMessageOpt("-maxtipage=<n>", strprintf("Maximum tip age in seconds to consider node in initial block download (default: %u)", DEFAULT_MAX_TIP_AGE));
     }
     strUsage += HelpMessageOpt("-minrelaytxfee=<amt>", strprintf(_("Fees (in %s/kB) smaller than this are considered zero fee for relaying (default: %s)"),
@@ -557,7 +638,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-mint", strprintf(_("Mint/stake coins automatically (default: %u)"), 0));
     strUsage += HelpMessageOpt("-gen", strprintf(_("Mine/generate coins (default: %u)"), 0));
     strUsage += HelpMessageOpt("-genproclimit=<n>", strprintf(_("Set the number of threads for coin mining if enabled (-1 = all cores, default: %d)"), 0));
-    strUsage += HelpMessageOpt("-equihashsolver=<name>", _("Specify the Equihash solver to be used if enabled (default: \"default\")"));
+    strUsage += HelpMessageOpt("-equihashsolver=<name>", _("Specify the Equihash solver to be used if enabled, \"tromp\" or \"default\" (default: \"tromp\" where it supports the chain's n and k)"));
     strUsage += HelpMessageOpt("-mineraddress=<addr>", _("Send mined coins to a specific single address"));
     strUsage += HelpMessageOpt("-minetolocalwallet", strprintf(
             _("Require that mined blocks use a coinbase address in the local wallet (default: %u)"),
@@ -572,19 +653,23 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageGroup(_("RPC server options:"));
     strUsage += HelpMessageOpt("-server", _("Accept command line and JSON-RPC commands"));
     strUsage += HelpMessageOpt("-rest", strprintf(_("Accept public REST requests (default: %u)"), 0));
+    strUsage += HelpMessageOpt("-httpmetrics", strprintf(_("Serve the node metrics for Prometheus at /metrics of the RPC port (default: %u)"), DEFAULT_HTTP_METRICS));
     strUsage += HelpMessageOpt("-rpcbind=<addr>", _("Bind to given address to listen for JSON-RPC connections. Use [host]:port notation for IPv6. This option can be specified multiple times (default: bind to all interfaces)"));
     strUsage += HelpMessageOpt("-rpcuser=<user>", _("Username for JSON-RPC connections"));
     strUsage += HelpMessageOpt("-rpcpassword=<pw>", _("Password for JSON-RPC connections"));
     strUsage += HelpMessageOpt("-rpcport=<port>", strprintf(_("Listen for JSON-RPC connections on <port> (default: %u or testnet: %u)"), 7771, 17771));
     strUsage += HelpMessageOpt("-rpcallowip=<ip>", _("Allow JSON-RPC connections from specified source. Valid for <ip> are a single IP (e.g. 1.2.3.4), a network/netmask (e.g. 1.2.3.4/255.255.255.0) or a network/CIDR (e.g. 1.2.3.4/24). This option can be specified multiple times"));
     strUsage += HelpMessageOpt("-rpcthreads=<n>", strprintf(_("Set the number of threads to service RPC calls (default: %d)"), DEFAULT_HTTP_THREADS));
+    strUsage += HelpMessageOpt("-rpcslowthreads=<n>", strprintf(_("Set the number of threads to service RPC calls that can take long, like wallet scans and block dumps, 0 to serve them on the -rpcthreads threads (default: %d)"), DEFAULT_HTTP_SLOW_THREADS));
+    strUsage += HelpMessageOpt("-rpccachesize=<n>", strprintf(_("Keep replies about notarized blocks and their transactions (getblock, getblockheader, getrawtransaction) in a cache of up to <n> megabytes, 0 to disable (default: %u)"), DEFAULT_RPC_CACHE_SIZE));
+    strUsage += HelpMessageOpt("-rpcbatchthreads=<n>", strprintf(_("Execute the requests of a JSON-RPC batch on up to <n> additional RPC threads, at most two less than -rpcthreads (default: %d)"), DEFAULT_RPC_BATCH_THREADS));
     if (showDebug) {
         strUsage += HelpMessageOpt("-rpcworkqueue=<n>", strprintf("Set the depth of the work queue to service RPC calls (default: %d)", DEFAULT_HTTP_WORKQUEUE));
         strUsage += HelpMessageOpt("-rpcservertimeout=<n>", strprintf("Timeout during HTTP requests (default: %d)", DEFAULT_HTTP_SERVER_TIMEOUT));
     }
 
-    // Disabled until we can lock notes and also tune performance of libsnark which by default uses multiple threads
-    //strUsage += HelpMessageOpt("-rpcasyncthreads=<n>", strprintf(_("Set the number of threads to service Async RPC calls (default: %d)"), 1));
+    strUsage += HelpMessageOpt("-rpcasyncthreads=<n>", strprintf(_("Set the number of threads to run asynchronous wallet operations like z_sendmany on, operations of the same kind never run at the same time (default: %d)"), DEFAULT_ASYNC_RPC_THREADS));
+    strUsage += HelpMessageOpt("-rpcasyncprovers=<n>", _("Maximum number of proof heavy background operations (z_mergetoaddress, z_shieldcoinbase, consolidation and sweeps) running at the same time, so they leave threads for payments (default: one less than -rpcasyncthreads, at least 1)"));
 
     if (mode == HMM_BITCOIND) {
         strUsage += HelpMessageGroup(_("Metrics Options (only if -daemon and -printtoconsole are not set):"));
@@ -945,6 +1030,8 @@ bool AppInitServers(boost::thread_group& threadGroup)
         return false;
     if (GetBoolArg("-rest", false) && !StartREST())
         return false;
+    if (GetBoolArg("-httpmetrics", DEFAULT_HTTP_METRICS) && !StartHTTPMetrics())
+        return false;
     if (!StartHTTPServer())
         return false;
     return true;
@@ -1037,6 +1124,8 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     fPrintToConsole = GetBoolArg("-printtoconsole", false);
     fLogTimestamps = GetBoolArg("-logtimestamps", true);
     fLogIPs = GetBoolArg("-logips", false);
+    fBlockProfile = GetBoolArg("-blockprofile", DEFAULT_BLOCKPROFILE);
+    fLockProfile = GetBoolArg("-lockprofile", DEFAULT_LOCKPROFILE);
 
     LogPrintf("\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n");
     LogPrintf("Zcash version %s (%s)\n", FormatFullVersion(), CLIENT_DATE);
@@ -1114,6 +1203,13 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
             LogPrintf("%s: parameter interaction: -salvagewallet=1 -> setting -rescan=1\n", __func__);
     }
 
+    if (GetBoolArg("-rebuildwallet", false)) {
+        if (SoftSetBoolArg("-rescan", true))
+            LogPrintf("%s: parameter interaction: -rebuildwallet=1 -> setting -rescan=1\n", __func__);
+        if (SoftSetArg("-rescanthreads", "0"))
+            LogPrintf("%s: parameter interaction: -rebuildwallet=1 -> setting -rescanthreads=0\n", __func__);
+    }
+
     // -zapwallettx implies a rescan
     if (GetBoolArg("-zapwallettxes", false)) {
         if (SoftSetBoolArg("-rescan", true))
@@ -1124,7 +1220,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     int nBind = std::max((int)mapArgs.count("-bind") + (int)mapArgs.count("-whitebind"), 1);
     nMaxConnections = GetArg("-maxconnections", DEFAULT_MAX_PEER_CONNECTIONS);
     //fprintf(stderr,"nMaxConnections %d\n",nMaxConnections);
-    nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS)), 0);
+    nMaxConnections = std::max(std::min(nMaxConnections, GetSocketEventsLimit() - nBind - MIN_CORE_FILEDESCRIPTORS), 0);
     int nFD = RaiseFileDescriptorLimit(nMaxConnections + MIN_CORE_FILEDESCRIPTORS);
     //fprintf(stderr,"nMaxConnections %d FD_SETSIZE.%d nBind.%d expr.%d \n",nMaxConnections,FD_SETSIZE,nBind,(int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS));
     if (nFD < MIN_CORE_FILEDESCRIPTORS)
@@ -1132,20 +1228,14 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     if (nFD - MIN_CORE_FILEDESCRIPTORS < nMaxConnections)
         nMaxConnections = nFD - MIN_CORE_FILEDESCRIPTORS;
     fprintf(stderr,"nMaxConnections %d\n",nMaxConnections);
-    // if using block pruning, then disable txindex
-    // also disable the wallet (for now, until SPV support is implemented in wallet)
-//     if (GetArg("-prune", 0)) {
-//         if (GetBoolArg("-txindex", true))
-//             return InitError(_("Prune mode is incompatible with -txindex."));
-// #ifdef ENABLE_WALLET
-//         if (!GetBoolArg("-disablewallet", false)) {
-//             if (SoftSetBoolArg("-disablewallet", true))
-//                 LogPrintf("%s : parameter interaction: -prune -> setting -disablewallet=1\n", __func__);
-//             else
-//                 return InitError(_("Can't run with a wallet in prune mode."));
-//         }
-// #endif
-//     }
+    // if using block pruning, keep the compact block index, the wallet builds its
+    // witnesses over pruned blocks from the note commitments in it
+    if (GetArg("-prune", 0)) {
+        if (SoftSetBoolArg("-compactblockindex", true))
+            LogPrintf("%s : parameter interaction: -prune -> setting -compactblockindex=1\n", __func__);
+        else if (!GetBoolArg("-compactblockindex", DEFAULT_COMPACTBLOCKINDEX))
+            return InitError(_("Prune mode requires -compactblockindex."));
+    }
 
     // ********************************************************* Step 3: parameter-to-internal-flags
 
@@ -1185,6 +1275,26 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     fCheckBlockIndex = GetBoolArg("-checkblockindex", chainparams.DefaultConsistencyChecks());
     fCheckpointsEnabled = GetBoolArg("-checkpoints", true);
 
+    std::string strAssumeNotarized = GetArg("-assumenotarized", "0");
+    if (strAssumeNotarized == "1" || strAssumeNotarized.empty()) {
+        fAssumeNotarized = true;
+    } else if (strAssumeNotarized != "0") {
+        if (!IsHex(strAssumeNotarized) || strAssumeNotarized.size() != 64)
+            return InitError(strprintf(_("Invalid block hash for -assumenotarized: '%s'"), strAssumeNotarized));
+        fAssumeNotarized = true;
+        hashAssumeNotarized = uint256S(strAssumeNotarized);
+    }
+    if (fAssumeNotarized)
+        LogPrintf("Proof and script checks of notarized blocks are skipped during initial block download\n");
+
+    int nReplayStart = -1, nReplayEnd = -1;
+    unsigned int nReplayBenchSkip = 0;
+    if (mapArgs.count("-replaybench")) {
+        std::string strReplayError;
+        if (!ParseReplayBench(GetArg("-replaybench", ""), GetArg("-replaybenchskip", ""), nReplayStart, nReplayEnd, nReplayBenchSkip, strReplayError))
+            return InitError(strReplayError);
+    }
+
     // -par=0 means autodetect, but nScriptCheckThreads==0 means no concurrency
     nScriptCheckThreads = GetArg("-par", DEFAULT_SCRIPTCHECK_THREADS);
     if (nScriptCheckThreads <= 0)
@@ -1194,21 +1304,56 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     else if (nScriptCheckThreads > MAX_SCRIPTCHECK_THREADS)
         nScriptCheckThreads = MAX_SCRIPTCHECK_THREADS;
 
+#ifdef ENABLE_WALLET
+    fBackgroundKeyCheck = GetBoolArg("-backgroundkeycheck", DEFAULT_BACKGROUND_KEY_CHECK);
+
+    // -zdecryptthreads=0 means autodetect, nSaplingDecryptThreads<=1 means decrypt on the calling thread
+    nSaplingDecryptThreads = GetArg("-zdecryptthreads", DEFAULT_SAPLING_DECRYPT_THREADS);
+    if (nSaplingDecryptThreads <= 0)
+        nSaplingDecryptThreads += GetNumCores();
+    if (nSaplingDecryptThreads <= 1)
+        nSaplingDecryptThreads = 1;
+    else if (nSaplingDecryptThreads > MAX_SAPLING_DECRYPT_THREADS)
+        nSaplingDecryptThreads = MAX_SAPLING_DECRYPT_THREADS;
+
+    nWitnessCacheThreads = GetArg("-witnessthreads", DEFAULT_WITNESS_CACHE_THREADS);
+    if (nWitnessCacheThreads <= 0)
+        nWitnessCacheThreads += GetNumCores();
+    if (nWitnessCacheThreads <= 1)
+        nWitnessCacheThreads = 1;
+    else if (nWitnessCacheThreads > MAX_WITNESS_CACHE_THREADS)
+        nWitnessCacheThreads = MAX_WITNESS_CACHE_THREADS;
+
+    nWalletMemoryBudget = std::max((int64_t)0, GetArg("-walletmemorybudget", DEFAULT_WALLET_MEMORY_BUDGET));
+#endif
+
     fServer = GetBoolArg("-server", false);
 
     // block pruning; get the amount of disk space (in MB) to allot for block & undo files
-    // int64_t nSignedPruneTarget = GetArg("-prune", 0) * 1024 * 1024;
-    // if (nSignedPruneTarget < 0) {
-    //     return InitError(_("Prune cannot be configured with a negative value."));
-    // }
-    // nPruneTarget = (uint64_t) nSignedPruneTarget;
-    // if (nPruneTarget) {
-    //     if (nPruneTarget < MIN_DISK_SPACE_FOR_BLOCK_FILES) {
-    //         return InitError(strprintf(_("Prune configured below the minimum of %d MB.  Please use a higher number."), MIN_DISK_SPACE_FOR_BLOCK_FILES / 1024 / 1024));
-    //     }
-    //     LogPrintf("Prune configured to target %uMiB on disk for block and undo files.\n", nPruneTarget / 1024 / 1024);
-    //     fPruneMode = true;
-    // }
+    int64_t nSignedPruneTarget = GetArg("-prune", 0) * 1024 * 1024;
+    if (nSignedPruneTarget < 0) {
+        return InitError(_("Prune cannot be configured with a negative value."));
+    }
+    nPruneTarget = (uint64_t) nSignedPruneTarget;
+    if (nPruneTarget) {
+        if (nPruneTarget < MIN_DISK_SPACE_FOR_BLOCK_FILES) {
+            return InitError(strprintf(_("Prune configured below the minimum of %d MB.  Please use a higher number."), MIN_DISK_SPACE_FOR_BLOCK_FILES / 1024 / 1024));
+        }
+        LogPrintf("Prune configured to target %uMiB on disk for block and undo files.\n", nPruneTarget / 1024 / 1024);
+        fPruneMode = true;
+    }
+
+    // block file tiering; the files of old blocks move to another directory
+    if (!GetArg("-coldblocksdir", "").empty()) {
+        if (fPruneMode)
+            return InitError(_("-coldblocksdir is incompatible with -prune."));
+        int64_t nDepth = GetArg("-coldblocksdepth", DEFAULT_COLD_BLOCKS_DEPTH);
+        if (nDepth < MIN_COLD_BLOCKS_DEPTH)
+            return InitError(strprintf(_("-coldblocksdepth cannot be below %u."), MIN_COLD_BLOCKS_DEPTH));
+        pathColdBlocks = boost::filesystem::system_complete(GetArg("-coldblocksdir", ""));
+        nColdBlocksDepth = nDepth;
+        LogPrintf("Block files more than %u blocks deep are moved to %s\n", nColdBlocksDepth, pathColdBlocks.string());
+    }
 
     RegisterAllCoreRPCCommands(tableRPC);
 #ifdef ENABLE_WALLET
@@ -1220,6 +1365,8 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     }
     if (!fDisableWallet)
         RegisterWalletRPCCommands(tableRPC);
+    if (GetBoolArg("-vkscanner", DEFAULT_VKSCANNER))
+        RegisterViewingKeyScannerRPCCommands(tableRPC);
 #endif
 
     nConnectTimeout = GetArg("-timeout", DEFAULT_CONNECT_TIMEOUT);
@@ -1298,7 +1445,9 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     {
         if (GetBoolArg("-peerbloomfilters", true))
             nLocalServices |= NODE_BLOOM;
+        nspvResponseCache.SetMaxBytes(std::max<int64_t>(0, GetArg("-nspvcachesize", DEFAULT_NSPV_CACHE_SIZE)) << 20);
     }
+    rpcResponseCache.SetMaxBytes(std::max<int64_t>(0, GetArg("-rpccachesize", DEFAULT_RPC_CACHE_SIZE)) << 20);
     nMaxTipAge = GetArg("-maxtipage", DEFAULT_MAX_TIP_AGE);
 
 #ifdef ENABLE_MINING
@@ -1429,15 +1578,29 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     LogPrintf("Using at most %i connections (%i file descriptors available)\n", nMaxConnections, nFD);
     std::ostringstream strErrors;
 
-    LogPrintf("Using %u threads for script verification\n", nScriptCheckThreads);
+    LogPrintf("Using %u threads for script, Sapling proof, mempool proof and Equihash solution verification, and for parsing blocks on import\n", nScriptCheckThreads);
     if (nScriptCheckThreads) {
-        for (int i=0; i<nScriptCheckThreads-1; i++)
+        for (int i=0; i<nScriptCheckThreads-1; i++) {
             threadGroup.create_thread(&ThreadScriptCheck);
+            threadGroup.create_thread(&ThreadSaplingCheck);
+            threadGroup.create_thread(&ThreadEquihashCheck);
+            threadGroup.create_thread(&ThreadShieldedProofCheck);
+            threadGroup.create_thread(&ThreadBlockParse);
+        }
     }
 
-    // Start the lightweight task scheduler thread
+    // Start the lightweight task scheduler threads, shared by its queues
+    pschedulerMain = &scheduler;
+    int nSchedulerThreads = std::max(1, std::min((int)GetArg("-schedulerthreads", DEFAULT_SCHEDULER_THREADS), MAX_SCHEDULER_THREADS));
     CScheduler::Function serviceLoop = boost::bind(&CScheduler::serviceQueue, &scheduler);
-    threadGroup.create_thread(boost::bind(&TraceThread<CScheduler::Function>, "scheduler", serviceLoop));
+    for (int i = 0; i < nSchedulerThreads; i++)
+        threadGroup.create_thread(boost::bind(&TraceThread<CScheduler::Function>, "scheduler", serviceLoop));
+    scheduler.scheduleEvery(&SampleNodeStats, 1, "stats");
+    if (!pathColdBlocks.empty())
+        scheduler.scheduleEvery(&MoveBlockFilesToColdStorage, COLD_BLOCKS_INTERVAL, "coldblocks");
+
+    // Prepare the next block template as soon as a new tip arrives
+    threadGroup.create_thread(&ThreadPrebuildBlockTemplate);
 
     // Count uptime
     MarkStartTime();
@@ -1455,6 +1618,10 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     libsnark::inhibit_profiling_info = true;
     libsnark::inhibit_profiling_counters = true;
 
+    // The circuit parameters are loaded while the wallet is verified, the
+    // network is set up and the block index is read, and joined before the
+    // blocks are checked
+    boost::thread threadLoadParams;
     if ( KOMODO_NSPV_FULLNODE )
     {
         // Initialize Zcash circuit parameters
@@ -1470,7 +1637,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
             return false;
         }
 
-        ZC_LoadParams(chainparams, paramsVerified);
+        threadLoadParams = boost::thread(ZC_LoadParams, boost::cref(chainparams), paramsVerified);
     }
 
     if (fRequestShutdown)
@@ -1632,11 +1799,14 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     BOOST_FOREACH(const std::string& strDest, mapMultiArgs["-seednode"])
         AddOneShot(strDest);
 
+    // Publishers are notified from the validation queue thread, outside cs_main
+    StartValidationInterfaceQueue();
+
 #if ENABLE_ZMQ
     pzmqNotificationInterface = CZMQNotificationInterface::CreateWithArguments(mapArgs);
 
     if (pzmqNotificationInterface) {
-        RegisterValidationInterface(pzmqNotificationInterface);
+        RegisterAsyncValidationInterface(pzmqNotificationInterface);
     }
 #endif
 
@@ -1651,7 +1821,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
             return InitError(_("AMQP support requires -experimentalfeatures."));
         }
 
-        RegisterValidationInterface(pAMQPNotificationInterface);
+        RegisterAsyncValidationInterface(pAMQPNotificationInterface);
     }
 #endif
 
@@ -1706,6 +1876,14 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         //wipe transactions from wallet to create a clean slate
         OverrideSetArg("-zappwallettxes","2");
         boost::filesystem::remove_all(GetDataDir() / "blocks");
+        // The block files moved to -coldblocksdir are of the chain replaced too
+        if (!pathColdBlocks.empty() && boost::filesystem::is_directory(pathColdBlocks)) {
+            for (boost::filesystem::directory_iterator it(pathColdBlocks); it != boost::filesystem::directory_iterator(); it++) {
+                std::string strName = it->path().filename().string();
+                if (strName.length() == 12 && (strName.substr(0, 3) == "blk" || strName.substr(0, 3) == "rev") && strName.substr(8) == ".dat")
+                    boost::filesystem::remove(it->path());
+            }
+        }
         boost::filesystem::remove_all(GetDataDir() / "chainstate");
         boost::filesystem::remove_all(GetDataDir() / "notarisations");
         boost::filesystem::remove(GetDataDir() / "komodostate");
@@ -1762,24 +1940,69 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     LogPrintf("* Using %.1fMiB for chain state database\n", nCoinDBCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for in-memory UTXO set\n", nCoinCacheUsage * (1.0 / 1024 / 1024));
 
+    nBlockCompressionLevel = GetArg("-blockcompression", DEFAULT_BLOCK_COMPRESSION);
+    if (nBlockCompressionLevel < 0 || nBlockCompressionLevel > 9)
+        return InitError(_("-blockcompression must be between 0 and 9"));
+    // Records may have been compressed before, so the dictionaries are found either way
+    InitBlockDictionaries();
+
+    fCoinStatsIndex = GetBoolArg("-coinstatsindex", DEFAULT_COINSTATSINDEX);
+    // The block index and each index have their own database, the txindex is always on here
+    CBlockTreeDBSizes blockTreeSizes = CBlockTreeDBSizes::Split(nBlockTreeDBCache, dbMaxOpenFiles, true,
+        GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX), GetBoolArg("-spentindex", DEFAULT_SPENTINDEX),
+        GetBoolArg("-timestampindex", DEFAULT_TIMESTAMPINDEX), fCoinStatsIndex, GetBoolArg("-ccindex", DEFAULT_CCINDEX));
+    LogPrintf("Block index database shares:\n");
+    LogPrintf("* blocks/index: %.1fMiB, %d files\n", blockTreeSizes.nBlockIndexCache * (1.0 / 1024 / 1024), blockTreeSizes.nBlockIndexFiles);
+    for (int i = 0; i < BLOCKTREE_INDEX_COUNT; i++)
+        LogPrintf("* blocks/%s: %.1fMiB, %d files\n", BlockTreeIndexName((BlockTreeIndex)i), blockTreeSizes.vIndexCache[i] * (1.0 / 1024 / 1024), blockTreeSizes.vIndexFiles[i]);
+
     if ( fReindex == 0 )
     {
-        bool checkval,fAddressIndex,fSpentIndex;
-        pblocktree = new CBlockTreeDB(nBlockTreeDBCache, false, fReindex, dbCompression, dbMaxOpenFiles);
+        bool checkval,fAddressIndex,fSpentIndex,fTimestampIndex,fCCIndex,fCompactBlockIndex;
+        int nBuildIndexes = 0;
+        pblocktree = new CBlockTreeDB(blockTreeSizes, false, fReindex, dbCompression);
+        // Newly enabled address, spent, timestamp and CC indexes are built online by ThreadIndexBuild
         fAddressIndex = GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX);
+        checkval = false;
         pblocktree->ReadFlag("addressindex", checkval);
         if ( checkval != fAddressIndex && fAddressIndex != 0 )
         {
             pblocktree->WriteFlag("addressindex", fAddressIndex);
-            fprintf(stderr,"set addressindex, will reindex. could take a while.\n");
-            fReindex = true;
+            nBuildIndexes |= INDEX_BUILD_ADDRESS;
         }
         fSpentIndex = GetBoolArg("-spentindex", DEFAULT_SPENTINDEX);
+        checkval = false;
         pblocktree->ReadFlag("spentindex", checkval);
         if ( checkval != fSpentIndex && fSpentIndex != 0 )
         {
             pblocktree->WriteFlag("spentindex", fSpentIndex);
-            fprintf(stderr,"set spentindex, will reindex. could take a while.\n");
+            nBuildIndexes |= INDEX_BUILD_SPENT;
+        }
+        fTimestampIndex = GetBoolArg("-timestampindex", DEFAULT_TIMESTAMPINDEX);
+        checkval = false;
+        pblocktree->ReadFlag("timestampindex", checkval);
+        if ( checkval != fTimestampIndex && fTimestampIndex != 0 )
+        {
+            pblocktree->WriteFlag("timestampindex", fTimestampIndex);
+            nBuildIndexes |= INDEX_BUILD_TIMESTAMP;
+        }
+        fCCIndex = GetBoolArg("-ccindex", DEFAULT_CCINDEX);
+        checkval = false;
+        pblocktree->ReadFlag("ccindex", checkval);
+        if ( checkval != fCCIndex && fCCIndex != 0 )
+        {
+            pblocktree->WriteFlag("ccindex", fCCIndex);
+            nBuildIndexes |= INDEX_BUILD_CC;
+        }
+        if (nBuildIndexes != 0 && !ScheduleIndexBuild(pblocktree, nBuildIndexes))
+            return InitError(_("Failed to write the index build state to the block database"));
+        fCompactBlockIndex = GetBoolArg("-compactblockindex", DEFAULT_COMPACTBLOCKINDEX);
+        checkval = false;
+        pblocktree->ReadFlag("compactblockindex", checkval);
+        if ( checkval != fCompactBlockIndex && fCompactBlockIndex != 0 )
+        {
+            pblocktree->WriteFlag("compactblockindex", fCompactBlockIndex);
+            fprintf(stderr,"set compactblockindex, will reindex. could take a while.\n");
             fReindex = true;
         }
         //One time reindex to enable transaction archiving.
@@ -1790,6 +2013,14 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
             LogPrintf("Transaction archive not set, will reindex. could take a while.\n");
             fReindex = true;
         }
+        //One time reindex to build the KV index of an asset chain, it used to be replayed from komodostate.
+        checkval = false;
+        pblocktree->ReadFlag("kvindex", checkval);
+        if (ASSETCHAINS_SYMBOL[0] != 0 && !checkval)
+        {
+            LogPrintf("KV index not built, will reindex. could take a while.\n");
+            fReindex = true;
+        }
     }
 
     bool clearWitnessCaches = false;
@@ -1806,15 +2037,17 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
             try {
                 UnloadBlockIndex();
                 delete pcoinsTip;
+                delete pcoinsAsyncFlush;
                 delete pcoinsdbview;
                 delete pcoinscatcher;
                 delete pblocktree;
                 delete pnotarisations;
 
-                pblocktree = new CBlockTreeDB(nBlockTreeDBCache, false, fReindex, dbCompression, dbMaxOpenFiles);
+                pblocktree = new CBlockTreeDB(blockTreeSizes, false, fReindex, dbCompression);
                 pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false, fReindex);
                 pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsdbview);
-                pcoinsTip = new CCoinsViewCache(pcoinscatcher);
+                pcoinsAsyncFlush = new CCoinsViewAsyncFlush(pcoinscatcher);
+                pcoinsTip = new CCoinsViewCache(pcoinsAsyncFlush);
                 pnotarisations = new NotarisationDB(100*1024*1024, false, fReindex);
 
 
@@ -1843,6 +2076,13 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                     break;
                 }
                 KOMODO_LOADINGBLOCKS = 0;
+                {
+                    LOCK(cs_main);
+                    if (!BuildNotarisationSymbolIndex()) {
+                        strLoadError = _("Error building the notarisations index");
+                        break;
+                    }
+                }
                 // Check for changed -txindex state
                 // if (fTxIndex != GetBoolArg("-txindex", true)) {
                 //     strLoadError = _("You need to rebuild the database using -reindex to change -txindex");
@@ -1856,6 +2096,20 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                     break;
                 }
 
+                bool fSnapshotLoading = false;
+                pblocktree->ReadFlag("txoutsetloading", fSnapshotLoading);
+                if (fSnapshotLoading) {
+                    strLoadError = _("Loading a chain state snapshot was interrupted. You need to rebuild the database using -reindex and load the snapshot again");
+                    break;
+                }
+
+                // A flush written in several batches that did not finish leaves
+                // the chainstate between two blocks
+                if (!fReindex && !pcoinsdbview->GetHeadBlocks().empty()) {
+                    strLoadError = _("Writing the chain state to disk was interrupted. You need to rebuild the database using -reindex");
+                    break;
+                }
+
                 if ( ASSETCHAINS_CC != 0 && KOMODO_SNAPSHOT_INTERVAL != 0 && chainActive.Height() >= KOMODO_SNAPSHOT_INTERVAL )
                 {
                     if ( !komodo_dailysnapshot(chainActive.Height()) )
@@ -1865,6 +2119,14 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                     }
                 }
 
+                if (threadLoadParams.joinable()) {
+                    threadLoadParams.join();
+                    if (fRequestShutdown) {
+                        LogPrintf("Shutdown requested. Exiting.\n");
+                        return false;
+                    }
+                }
+
                 if (!fReindex) {
                     uiInterface.InitMessage(_("Rewinding blocks if needed..."));
                     if (!RewindBlockIndex(chainparams, clearWitnessCaches)) {
@@ -1880,12 +2142,22 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                 }
                 if ( KOMODO_REWIND == 0 )
                 {
+                    // VerifyDB reads the coin database directly
+                    pcoinsAsyncFlush->Sync();
                     if (!CVerifyDB().VerifyDB(pcoinsdbview, GetArg("-checklevel", 3),
                                               GetArg("-checkblocks", 288))) {
                         strLoadError = _("Corrupted block database detected");
                         break;
                     }
                 }
+
+                {
+                    LOCK(cs_main);
+                    if (!kvIndex.Load(chainActive)) {
+                        strLoadError = _("Error loading the KV index");
+                        break;
+                    }
+                }
             } catch (const std::exception& e) {
                 if (fDebug) LogPrintf("%s\n", e.what());
                 strLoadError = _("Error opening block database");
@@ -1932,6 +2204,15 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         mempool.ReadFeeEstimates(est_filein);
     fFeeEstimatesInitialized = true;
 
+    // Nullifier lookups go to disk until the filters are loaded
+    threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, "nullfilter",
+        boost::function<void()>(boost::bind(&CCoinsViewDB::LoadNullifierFilters, pcoinsdbview))));
+
+    // Seeds the UTXO set statistics of a chain that has none for its tip
+    if (fCoinStatsIndex)
+        threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, "coinstats",
+            boost::function<void()>(boost::bind(&ThreadCoinsStats, pcoinsdbview))));
+
 
     // ********************************************************* Step 8: load wallet
 #ifdef ENABLE_WALLET
@@ -1943,6 +2224,14 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         // needed to restore wallet transaction meta data after -zapwallettxes
         std::vector<CWalletTx> vWtx;
 
+        if (GetBoolArg("-walletarchivedb", DEFAULT_WALLET_ARCHIVE_DB)) {
+            try {
+                pwalletArchiveDB = new CWalletArchiveDB(strWalletFile, WALLET_ARCHIVE_DB_CACHE);
+            } catch (const std::exception& e) {
+                return InitError(strprintf(_("Error opening the wallet archive database: %s"), e.what()));
+            }
+        }
+
         if (GetBoolArg("-zapwallettxes", false)) {
             uiInterface.InitMessage(_("Zapping all transactions from wallet..."));
 
@@ -2065,6 +2354,18 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         //Set Sapling Consolidation
         pwalletMain->fSaplingConsolidationEnabled = GetBoolArg("-consolidation", false);
         fConsolidationTxFee  = GetArg("-consolidationtxfee", DEFAULT_CONSOLIDATION_FEE);
+        nConsolidationThreads = GetArg("-consolidationthreads", DEFAULT_CONSOLIDATION_THREADS);
+        if (nConsolidationThreads <= 0)
+            nConsolidationThreads += GetNumCores();
+        if (nConsolidationThreads < 1)
+            nConsolidationThreads = 1;
+        else if (nConsolidationThreads > MAX_CONSOLIDATION_THREADS)
+            nConsolidationThreads = MAX_CONSOLIDATION_THREADS;
+        nRescanPrefetchThreads = GetArg("-rescanthreads", DEFAULT_RESCAN_PREFETCH_THREADS);
+        if (nRescanPrefetchThreads <= 0)
+            nRescanPrefetchThreads += GetNumCores();
+        if (nRescanPrefetchThreads < 1)
+            nRescanPrefetchThreads = 1;
         fConsolidationMapUsed = !mapMultiArgs["-consolidatesaplingaddress"].empty();
 
         //Validate Sapling Addresses
@@ -2157,6 +2458,10 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         LogPrintf(" wallet      %15dms\n", GetTimeMillis() - nStart);
 
         RegisterValidationInterface(pwalletMain);
+#if ENABLE_ZMQ
+        if (pzmqNotificationInterface)
+            pzmqNotificationInterface->RegisterWallet(pwalletMain);
+#endif
 
         CBlockIndex *pindexRescan = chainActive.Tip();
         if (clearWitnessCaches || GetBoolArg("-rescan", false) || !fInitializeArcTx || useBootstrap)
@@ -2219,9 +2524,25 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
             }
         }
         pwalletMain->SetBroadcastTransactions(GetBoolArg("-walletbroadcast", true));
+        pwalletMain->PageOutSpentHistory();
 
         vpwallets.push_back(pwalletMain);
     } // (!fDisableWallet)
+
+    if (GetBoolArg("-vkscanner", DEFAULT_VKSCANNER)) {
+        uiInterface.InitMessage(_("Loading viewing key scanner..."));
+        try {
+            pviewingKeyScanner = new CViewingKeyScanner(VKSCANNER_DB_CACHE);
+        } catch (const std::exception& e) {
+            return InitError(strprintf(_("Error opening the viewing key scanner database: %s"), e.what()));
+        }
+        // Registered before cs_main is released, so it gets every block after the ones it scanned
+        LOCK(cs_main);
+        std::string strError;
+        if (!pviewingKeyScanner->Load(strError))
+            return InitError(strprintf(_("Error loading the viewing key scanner: %s"), strError));
+        RegisterAsyncValidationInterface(pviewingKeyScanner);
+    }
 #else // ENABLE_WALLET
     LogPrintf("No wallet support compiled in!\n");
 #endif // !ENABLE_WALLET
@@ -2252,6 +2573,24 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     }
 #endif // ENABLE_MINING
 
+    if (nReplayEnd >= 0) {
+        std::string strReplayError;
+        if (!RunReplayBench(nReplayStart, nReplayEnd, nReplayBenchSkip, strReplayError))
+            return InitError(strReplayError);
+        // Nothing was changed, leave before the node connects the best chain or starts the network
+        StartShutdown();
+        return true;
+    }
+
+#ifdef ENABLE_WALLET
+    if (GetBoolArg("-rebuildwallet", false)) {
+        // The wallet was rescanned above and is written out by the shutdown
+        LogPrintf("Wallet rebuilt, shutting down\n");
+        StartShutdown();
+        return true;
+    }
+#endif
+
     // ********************************************************* Step 9: data directory maintenance
 
     // if pruning, unset the service bit and perform the initial blockstore prune
@@ -2323,6 +2662,9 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     // Start the thread that updates komodo internal structures
     threadGroup.create_thread(&ThreadUpdateKomodoInternals);
 
+    // Build the indexes that were enabled without a reindex
+    threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "indexbuild", &ThreadIndexBuild));
+
     if (GetBoolArg("-listenonion", DEFAULT_LISTEN_ONION))
         StartTorControl(threadGroup, scheduler);
 
@@ -35,6 +35,8 @@ class thread_group;
 
 extern CWallet* pwalletMain;
 extern ZCJoinSplit* pzcashParams;
+//! The scheduler AppInit2 started, for the RPCs that report on its queues
+extern CScheduler* pschedulerMain;
 
 void StartShutdown();
 bool ShutdownRequested();
@@ -7,6 +7,7 @@
 
 #include <base58.h>
 #include <bech32.h>
+#include <crypto/common.h>
 #include <script/script.h>
 #include <utilstrencodings.h>
 
@@ -16,9 +17,62 @@
 #include <assert.h>
 #include <string.h>
 #include <algorithm>
+#include <mutex>
 
 namespace
 {
+/**
+ * Direct mapped cache of encoded addresses by the bytes they encode, their
+ * prefix or HRP included so another network never hits. RPCs listing
+ * outputs or transactions encode the same wallet and notary addresses over
+ * and over, each time with a base58 or bech32 conversion and a checksum.
+ * A slot is taken from the last bytes of the payload, which are hash or key
+ * bytes. Only addresses are cached, never keys.
+ */
+class AddressEncodingCache
+{
+private:
+    static const size_t SLOTS = 1 << 14;
+
+    struct Entry {
+        std::vector<unsigned char> payload;
+        std::string encoded;
+    };
+
+    std::mutex cs;
+    std::vector<Entry> table;
+
+public:
+    template <typename Encoder>
+    std::string Encode(const std::vector<unsigned char>& payload, Encoder encode)
+    {
+        size_t slot = payload.size() >= 4 ? ReadLE32(payload.data() + payload.size() - 4) % SLOTS : 0;
+        {
+            std::lock_guard<std::mutex> lock(cs);
+            if (table.empty())
+                table.resize(SLOTS);
+            if (table[slot].payload == payload)
+                return table[slot].encoded;
+        }
+        std::string encoded = encode();
+        std::lock_guard<std::mutex> lock(cs);
+        table[slot].payload = payload;
+        table[slot].encoded = encoded;
+        return encoded;
+    }
+};
+
+AddressEncodingCache& AddressCache()
+{
+    static AddressEncodingCache cache;
+    return cache;
+}
+
+std::string EncodeBase58CheckAddress(const std::vector<unsigned char>& data)
+{
+    return AddressCache().Encode(data, [&]() { return EncodeBase58Check(data); });
+}
+
 class DestinationEncoder : public boost::static_visitor<std::string>
 {
 private:
@@ -31,7 +85,7 @@ public:
     {
         std::vector<unsigned char> data = m_params.Base58Prefix(CChainParams::PUBKEY_ADDRESS);
         data.insert(data.end(), id.begin(), id.end());
-        return EncodeBase58Check(data);
+        return EncodeBase58CheckAddress(data);
     }
 
     std::string operator()(const CPubKey& key) const
@@ -39,14 +93,14 @@ public:
         std::vector<unsigned char> data = m_params.Base58Prefix(CChainParams::PUBKEY_ADDRESS);
         CKeyID id = key.GetID();
         data.insert(data.end(), id.begin(), id.end());
-        return EncodeBase58Check(data);
+        return EncodeBase58CheckAddress(data);
     }
 
     std::string operator()(const CScriptID& id) const
     {
         std::vector<unsigned char> data = m_params.Base58Prefix(CChainParams::SCRIPT_ADDRESS);
         data.insert(data.end(), id.begin(), id.end());
-        return EncodeBase58Check(data);
+        return EncodeBase58CheckAddress(data);
     }
 
     std::string operator()(const CNoDestination& no) const { return {}; }
@@ -90,20 +144,26 @@ public:
         ss << zaddr;
         std::vector<unsigned char> data = m_params.Base58Prefix(CChainParams::ZCPAYMENT_ADDRRESS);
         data.insert(data.end(), ss.begin(), ss.end());
-        return EncodeBase58Check(data);
+        return EncodeBase58CheckAddress(data);
     }
 
     std::string operator()(const libzcash::SaplingPaymentAddress& zaddr) const
     {
         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
         ss << zaddr;
-        // ConvertBits requires unsigned char, but CDataStream uses char
-        std::vector<unsigned char> seraddr(ss.begin(), ss.end());
-        std::vector<unsigned char> data;
-        // See calculation comment below
-        data.reserve((seraddr.size() * 8 + 4) / 5);
-        ConvertBits<8, 5, true>([&](unsigned char c) { data.push_back(c); }, seraddr.begin(), seraddr.end());
-        return bech32::Encode(m_params.Bech32HRP(CChainParams::SAPLING_PAYMENT_ADDRESS), data);
+        const std::string& hrp = m_params.Bech32HRP(CChainParams::SAPLING_PAYMENT_ADDRESS);
+        // Keyed by the HRP followed by the serialized address
+        std::vector<unsigned char> payload(hrp.begin(), hrp.end());
+        payload.insert(payload.end(), ss.begin(), ss.end());
+        return AddressCache().Encode(payload, [&]() {
+            // ConvertBits requires unsigned char, but CDataStream uses char
+            std::vector<unsigned char> seraddr(ss.begin(), ss.end());
+            std::vector<unsigned char> data;
+            // See calculation comment below
+            data.reserve((seraddr.size() * 8 + 4) / 5);
+            ConvertBits<8, 5, true>([&](unsigned char c) { data.push_back(c); }, seraddr.begin(), seraddr.end());
+            return bech32::Encode(hrp, data);
+        });
     }
 
     std::string operator()(const libzcash::InvalidEncoding& no) const { return {}; }
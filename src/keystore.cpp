@@ -197,6 +197,7 @@ bool CBasicKeyStore::AddSaplingFullViewingKey(
     auto ivk = extfvk.fvk.in_viewing_key();
     mapSaplingFullViewingKeys[ivk] = extfvk;
     setSaplingOutgoingViewingKeys.insert(extfvk.fvk.ovk);
+    pSaplingIvkTable.reset();
 
     return CBasicKeyStore::AddSaplingIncomingViewingKey(ivk, extfvk.DefaultAddress());
 }
@@ -212,11 +213,32 @@ bool CBasicKeyStore::AddSaplingIncomingViewingKey(
 
     // Add addr -> SaplingIncomingViewing to SaplingIncomingViewingKeyMap
     mapSaplingIncomingViewingKeys[addr] = ivk;
-    setSaplingIncomingViewingKeys.insert(ivk);
+    if (setSaplingIncomingViewingKeys.insert(ivk).second)
+        pSaplingIvkTable.reset();
 
     return true;
 }
 
+std::shared_ptr<const std::vector<libzcash::SaplingIncomingViewingKey>> CBasicKeyStore::GetSaplingIvkTable() const
+{
+    LOCK(cs_SpendingKeyStore);
+    if (pSaplingIvkTable)
+        return pSaplingIvkTable;
+
+    // Keys from full viewing keys first, followed by the remaining incoming viewing keys
+    auto pTable = std::make_shared<std::vector<libzcash::SaplingIncomingViewingKey>>();
+    pTable->reserve(setSaplingIncomingViewingKeys.size());
+    for (auto it = mapSaplingFullViewingKeys.begin(); it != mapSaplingFullViewingKeys.end(); ++it) {
+        pTable->push_back(it->first);
+    }
+    for (auto it = setSaplingIncomingViewingKeys.begin(); it != setSaplingIncomingViewingKeys.end(); ++it) {
+        if (mapSaplingFullViewingKeys.count(*it) == 0)
+            pTable->push_back(*it);
+    }
+    pSaplingIvkTable = pTable;
+    return pSaplingIvkTable;
+}
+
 bool CBasicKeyStore::AddSaplingDiversifiedAddess(
     const libzcash::SaplingPaymentAddress &addr,
     const libzcash::SaplingIncomingViewingKey &ivk,
@@ -34,6 +34,8 @@
 #include <boost/signals2/signal.hpp>
 #include <boost/variant.hpp>
 
+#include <memory>
+
 /** A virtual base class for key stores */
 class CKeyStore
 {
@@ -171,6 +173,9 @@ protected:
     SaplingPaymentAddresses mapSaplingPaymentAddresses;
     LastDiversifierPath mapLastDiversifierPath;
 
+    //! Every Sapling ivk once, those of full viewing keys first; reset when a new ivk is added
+    mutable std::shared_ptr<const std::vector<libzcash::SaplingIncomingViewingKey>> pSaplingIvkTable;
+
 public:
     bool SetHDSeed(const HDSeed& seed);
     bool HaveHDSeed() const;
@@ -339,6 +344,13 @@ public:
         const libzcash::SaplingPaymentAddress &addr,
         libzcash::SaplingExtendedSpendingKey &extskOut) const;
 
+    /**
+     * The keys to trial decrypt Sapling outputs with, without duplicates and in
+     * the order they are tried. The table is only rebuilt after keys have been
+     * added, and a snapshot stays valid while it is in use.
+     */
+    std::shared_ptr<const std::vector<libzcash::SaplingIncomingViewingKey>> GetSaplingIvkTable() const;
+
     void GetSaplingPaymentAddresses(std::set<libzcash::SaplingPaymentAddress> &setAddress) const
     {
         setAddress.clear();
@@ -54,6 +54,7 @@ bool check_pprevnotarizedht();
 #include "komodo_notary.h"
 
 int32_t komodo_parsestatefile(struct komodo_state *sp,FILE *fp,char *symbol,char *dest);
+void komodo_events_reserve(struct komodo_state *sp,int32_t n);
 #include "komodo_kv.h"
 #include "komodo_jumblr.h"
 #include "komodo_gateway.h"
@@ -226,6 +227,14 @@ int32_t memread(void *dest,int32_t size,uint8_t *filedata,long *fposp,long datal
     return(-1);
 }
 
+// one byte, 0 past the end, which a mapped file has no terminator for
+uint8_t memreadbyte(uint8_t *filedata,long *fposp,long datalen)
+{
+    uint8_t c = (*fposp < datalen) ? filedata[*fposp] : 0;
+    (*fposp)++;
+    return(c);
+}
+
 int32_t komodo_parsestatefiledata(struct komodo_state *sp,uint8_t *filedata,long *fposp,long datalen,char *symbol,char *dest)
 {
     static int32_t errs;
@@ -240,7 +249,7 @@ int32_t komodo_parsestatefiledata(struct komodo_state *sp,uint8_t *filedata,long
             errs++;
         if ( func == 'P' )
         {
-            if ( (num= filedata[fpos++]) <= 64 )
+            if ( (num= memreadbyte(filedata,&fpos,datalen)) <= 64 )
             {
                 if ( memread(pubkeys,33*num,filedata,&fpos,datalen) != 33*num )
                     errs++;
@@ -279,8 +288,8 @@ int32_t komodo_parsestatefiledata(struct komodo_state *sp,uint8_t *filedata,long
         else if ( func == 'U' ) // deprecated
         {
             uint8_t n,nid; uint256 hash; uint64_t mask;
-            n = filedata[fpos++];
-            nid = filedata[fpos++];
+            n = memreadbyte(filedata,&fpos,datalen);
+            nid = memreadbyte(filedata,&fpos,datalen);
             //printf("U %d %d\n",n,nid);
             if ( memread(&mask,sizeof(mask),filedata,&fpos,datalen) != sizeof(mask) )
                 errs++;
@@ -329,9 +338,7 @@ int32_t komodo_parsestatefiledata(struct komodo_state *sp,uint8_t *filedata,long
                 komodo_eventadd_opreturn(sp,symbol,ht,txid,ovalue,v,opret,olen); // global shared state -> global PAX
             } else
             {
-                int32_t i;
-                for (i=0; i<olen; i++)
-                    filedata[fpos++];
+                fpos += olen;
                 //printf("illegal olen.%u\n",olen);
             }
         }
@@ -342,7 +349,7 @@ int32_t komodo_parsestatefiledata(struct komodo_state *sp,uint8_t *filedata,long
         else if ( func == 'V' )
         {
             int32_t numpvals; uint32_t pvals[128];
-            numpvals = filedata[fpos++];
+            numpvals = memreadbyte(filedata,&fpos,datalen);
             if ( numpvals*sizeof(uint32_t) <= sizeof(pvals) && memread(pvals,(int32_t)(sizeof(uint32_t)*numpvals),filedata,&fpos,datalen) == numpvals*sizeof(uint32_t) )
             {
                 //if ( matched != 0 ) global shared state -> global PVALS
@@ -363,7 +370,6 @@ void komodo_stateupdate(int32_t height,uint8_t notarypubs[][33],uint8_t numnotar
     struct komodo_state *sp; char fname[512],symbol[KOMODO_ASSETCHAIN_MAXLEN],dest[KOMODO_ASSETCHAIN_MAXLEN]; int32_t retval,ht,func; uint8_t num,pubkeys[64][33];
     if ( didinit == 0 )
     {
-        portable_mutex_init(&KOMODO_KV_mutex);
         portable_mutex_init(&KOMODO_CC_mutex);
         didinit = 1;
     }
@@ -794,6 +800,24 @@ int32_t komodo_voutupdate(bool fJustCheck,int32_t *isratificationp,int32_t notar
 
 int32_t gettxout_scriptPubKey(uint8_t *scriptPubKey,int32_t maxsize,uint256 txid,int32_t n);
 
+// komodo_voutupdate only acts on pay to pubkey and opreturn scripts
+bool komodo_voutcandidate(const CScript &scriptPubKey)
+{
+    int32_t len = scriptPubKey.size();
+    if ( len < sizeof(uint32_t) || len > 10001 )
+        return(false);
+    return(scriptPubKey[0] == 0x6a || (len == 35 && scriptPubKey[0] == 33 && scriptPubKey[34] == 0xac));
+}
+
+// a tx without such vouts cannot be a notarisation or ratification, so its vins need not be looked up
+bool komodo_txcandidate(const CTransaction &tx)
+{
+    for (int32_t j=0; j<tx.vout.size(); j++)
+        if ( komodo_voutcandidate(tx.vout[j].scriptPubKey) )
+            return(true);
+    return(false);
+}
+
 int32_t komodo_notarycmp(uint8_t *scriptPubKey,int32_t scriptlen,uint8_t pubkeys[64][33],int32_t numnotaries,uint8_t rmd160[20])
 {
     int32_t i;
@@ -886,7 +910,8 @@ int32_t komodo_connectblock(bool fJustCheck, CBlockIndex *pindex,CBlock& block)
             voutmask = specialtx = notarizedheight = isratification = notarized = 0;
             signedmask = (height < 91400) ? 1 : 0;
             numvins = block.vtx[i].vin.size();
-            for (j=0; j<numvins; j++)
+            bool candidate = komodo_txcandidate(block.vtx[i]);
+            for (j=0; candidate && j<numvins; j++)
             {
                 if ( i == 0 && j == 0 )
                     continue;
@@ -939,7 +964,7 @@ int32_t komodo_connectblock(bool fJustCheck, CBlockIndex *pindex,CBlock& block)
             }
             //if ( IS_KOMODO_NOTARY != 0 && ASSETCHAINS_SYMBOL[0] == 0 )
               //  printf("(tx.%d: ",i);
-            for (j=0; j<numvouts; j++)
+            for (j=0; candidate && j<numvouts; j++)
             {
                 /*if ( i == 0 && j == 0 )
                 {
@@ -959,7 +984,7 @@ int32_t komodo_connectblock(bool fJustCheck, CBlockIndex *pindex,CBlock& block)
                   //  printf("%.8f ",dstr(block.vtx[i].vout[j].nValue));
                 len = block.vtx[i].vout[j].scriptPubKey.size();
                 
-                if ( len >= sizeof(uint32_t) && len <= sizeof(scriptbuf) )
+                if ( komodo_voutcandidate(block.vtx[i].vout[j].scriptPubKey) )
                 {
                     memcpy(scriptbuf,(uint8_t *)&block.vtx[i].vout[j].scriptPubKey[0],len);
                     notaryid = komodo_voutupdate(fJustCheck,&isratification,notaryid,scriptbuf,len,height,txhash,i,j,&voutmask,&specialtx,&notarizedheight,(uint64_t)block.vtx[i].vout[j].nValue,notarized,signedmask,(uint32_t)chainActive.LastTip()->GetBlockTime());
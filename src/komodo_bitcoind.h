@@ -17,6 +17,11 @@
 
 #include <curl/curl.h>
 #include <curl/easy.h>
+#include <future>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
 #include "primitives/nonce.h"
 #include "consensus/params.h"
 #include "komodo_defs.h"
@@ -165,6 +170,45 @@ char *post_process_bitcoind_RPC(char *debugstr,char *command,char *rpcstr,char *
 }
 #endif
 
+/************************************************************************
+ *
+ * idle curl handles, reused so the connections to the daemons are kept alive
+ *
+ ************************************************************************/
+
+#define KOMODO_CURLPOOL_MAX 8
+static std::mutex komodo_curlpool_mutex;
+static std::vector<CURL *> komodo_curlpool;
+
+CURL *komodo_curlhandle_get()
+{
+    CURL *curl_handle;
+    {
+        std::lock_guard<std::mutex> lock(komodo_curlpool_mutex);
+        if ( komodo_curlpool.empty() == 0 )
+        {
+            curl_handle = komodo_curlpool.back();
+            komodo_curlpool.pop_back();
+            curl_easy_reset(curl_handle); // keeps the open connections
+            return(curl_handle);
+        }
+    }
+    return(curl_easy_init());
+}
+
+void komodo_curlhandle_put(CURL *curl_handle)
+{
+    {
+        std::lock_guard<std::mutex> lock(komodo_curlpool_mutex);
+        if ( komodo_curlpool.size() < KOMODO_CURLPOOL_MAX )
+        {
+            komodo_curlpool.push_back(curl_handle);
+            return;
+        }
+    }
+    curl_easy_cleanup(curl_handle);
+}
+
 /************************************************************************
  *
  * perform the query
@@ -193,7 +237,7 @@ try_again:
     if ( retstrp != 0 )
         *retstrp = 0;
     starttime = OS_milliseconds();
-    curl_handle = curl_easy_init();
+    curl_handle = komodo_curlhandle_get();
     init_string(&s);
     headers = curl_slist_append(0,"Expect:");
 
@@ -245,7 +289,9 @@ try_again:
     //laststart = milliseconds();
     res = curl_easy_perform(curl_handle);
     curl_slist_free_all(headers);
-    curl_easy_cleanup(curl_handle);
+    if ( res == CURLE_OK )
+        komodo_curlhandle_put(curl_handle);
+    else curl_easy_cleanup(curl_handle); // dont reuse a broken connection
     if ( databuf != 0 ) // clean up temporary buffer
     {
         free(databuf);
@@ -385,6 +431,45 @@ char *komodo_issuemethod(char *userpass,char *method,char *params,uint16_t port)
     return(retstr2);
 }
 
+// the request is issued on its own thread, get() the result (to be freed) when it is needed
+std::future<char *> komodo_issuemethod_async(char *userpass,const char *method,std::string params,uint16_t port)
+{
+    std::string userpassstr(userpass != 0 ? userpass : ""),methodstr(method);
+    return(std::async(std::launch::async,[userpassstr,methodstr,params,port]() {
+        return(komodo_issuemethod((char *)userpassstr.c_str(),(char *)methodstr.c_str(),(char *)params.c_str(),port));
+    }));
+}
+
+/************************************************************************
+ *
+ * results of requests for immutable data, like the vouts of a
+ * getrawtransaction, by (port, method, params)
+ *
+ ************************************************************************/
+
+#define KOMODO_RPCCACHE_MAX 1024
+static std::mutex komodo_rpccache_mutex;
+static std::map<std::string,std::string> komodo_rpccache;
+
+char *komodo_issuemethod_cached(char *userpass,char *method,char *params,uint16_t port)
+{
+    char *retstr; std::string key = std::to_string(port) + " " + method + " " + (params != 0 ? params : "");
+    {
+        std::lock_guard<std::mutex> lock(komodo_rpccache_mutex);
+        auto it = komodo_rpccache.find(key);
+        if ( it != komodo_rpccache.end() )
+            return(clonestr((char *)it->second.c_str()));
+    }
+    if ( (retstr= komodo_issuemethod(userpass,method,params,port)) != 0 && strstr(retstr,"\"error\":null") != 0 )
+    {
+        std::lock_guard<std::mutex> lock(komodo_rpccache_mutex);
+        if ( komodo_rpccache.size() >= KOMODO_RPCCACHE_MAX )
+            komodo_rpccache.erase(komodo_rpccache.begin());
+        komodo_rpccache[key] = retstr;
+    }
+    return(retstr);
+}
+
 int32_t notarizedtxid_height(char *dest,char *txidstr,int32_t *kmdnotarized_heightp)
 {
     char *jsonstr,params[256],*userpass; uint16_t port; cJSON *json,*item; int32_t height = 0,txid_height = 0,txid_confirmations = 0;
@@ -403,40 +488,25 @@ int32_t notarizedtxid_height(char *dest,char *txidstr,int32_t *kmdnotarized_heig
     else return(0);
     if ( userpass[0] != 0 )
     {
-        if ( strcmp("BTC",dest) != 0 )
+        // the height and the tx are independent lookups, pipeline them
+        std::future<char *> heightreq = komodo_issuemethod_async(userpass,strcmp("BTC",dest) != 0 ? "getinfo" : "getblockchaininfo",params,port);
+        sprintf(params,"[\"%s\", 1]",txidstr);
+        char *txjsonstr = komodo_issuemethod(userpass,(char *)"getrawtransaction",params,port);
+        if ( (jsonstr= heightreq.get()) != 0 )
         {
-            if ( (jsonstr= komodo_issuemethod(userpass,(char *)"getinfo",params,port)) != 0 )
-            {
-                //printf("(%s)\n",jsonstr);
-                if ( (json= cJSON_Parse(jsonstr)) != 0 )
-                {
-                    if ( (item= jobj(json,(char *)"result")) != 0 )
-                    {
-                        height = jint(item,(char *)"blocks");
-                        *kmdnotarized_heightp = height;
-                    }
-                    free_json(json);
-                }
-                free(jsonstr);
-            }
-        } else {
-            if ( (jsonstr= komodo_issuemethod(userpass,(char *)"getblockchaininfo",params,port)) != 0 )
+            //printf("(%s)\n",jsonstr);
+            if ( (json= cJSON_Parse(jsonstr)) != 0 )
             {
-                //printf("(%s)\n",jsonstr);
-                if ( (json= cJSON_Parse(jsonstr)) != 0 )
+                if ( (item= jobj(json,(char *)"result")) != 0 )
                 {
-                    if ( (item= jobj(json,(char *)"result")) != 0 )
-                    {
-                        height = jint(item,(char *)"blocks");
-                        *kmdnotarized_heightp = strcmp(dest,"KMD") == 0 ? jint(item,(char *)"notarized") : height;
-                    }
-                    free_json(json);
+                    height = jint(item,(char *)"blocks");
+                    *kmdnotarized_heightp = height;
                 }
-                free(jsonstr);
+                free_json(json);
             }
+            free(jsonstr);
         }
-        sprintf(params,"[\"%s\", 1]",txidstr);
-        if ( (jsonstr= komodo_issuemethod(userpass,(char *)"getrawtransaction",params,port)) != 0 )
+        if ( (jsonstr= txjsonstr) != 0 )
         {
             //printf("(%s)\n",jsonstr);
             if ( (json= cJSON_Parse(jsonstr)) != 0 )
@@ -505,7 +575,7 @@ int32_t komodo_verifynotarization(char *symbol,char *dest,int32_t height,int32_t
         {
             if ( ASSETCHAINS_SYMBOL[0] != 0 )
             {
-                jsonstr = komodo_issuemethod(KMDUSERPASS,(char *)"getrawtransaction",params,KMD_PORT);
+                jsonstr = komodo_issuemethod_cached(KMDUSERPASS,(char *)"getrawtransaction",params,KMD_PORT);
                 //printf("userpass.(%s) got (%s)\n",KMDUSERPASS,jsonstr);
             }
         }//else jsonstr = _dex_getrawtransaction();
@@ -515,7 +585,7 @@ int32_t komodo_verifynotarization(char *symbol,char *dest,int32_t height,int32_t
     {
         if ( BTCUSERPASS[0] != 0 )
         {
-            jsonstr = komodo_issuemethod(BTCUSERPASS,(char *)"getrawtransaction",params,DEST_PORT);
+            jsonstr = komodo_issuemethod_cached(BTCUSERPASS,(char *)"getrawtransaction",params,DEST_PORT);
         }
         //else jsonstr = _dex_getrawtransaction();
         else return(0);
@@ -904,18 +974,9 @@ int32_t komodo_block2pubkey33(uint8_t *pubkey33,CBlock *block)
 
 int32_t komodo_blockload(CBlock& block,CBlockIndex *pindex)
 {
-    block.SetNull();
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pindex->GetBlockPos(),true),SER_DISK,CLIENT_VERSION);
-    if (filein.IsNull())
-        return(-1);
-    // Read block
-    try { filein >> block; }
-    catch (const std::exception& e)
-    {
-        fprintf(stderr,"readblockfromdisk err B\n");
+    // Read block, it may be stored compressed
+    if ( !ReadBlockFromDisk(block,pindex,false) )
         return(-1);
-    }
     return(0);
 }
 
@@ -988,15 +1049,70 @@ uint32_t komodo_heightstamp(int32_t height)
     }
 }*/
 
-void komodo_index2pubkey33(uint8_t *pubkey33,CBlockIndex *pindex,int32_t height)
+// miner pubkey33 of the recent blocks by height, filled by ConnectTip, so the notary mining checks need no block reads
+#define KOMODO_MINERS_WINDOW 128
+struct komodo_minerslot { uint256 blockhash; int32_t height; uint8_t pubkey33[33]; };
+static std::mutex komodo_miners_mutex;
+static struct komodo_minerslot komodo_miners[KOMODO_MINERS_WINDOW];
+
+void komodo_miners_set(CBlockIndex *pindex,uint8_t *pubkey33)
 {
-    int32_t num,i; CBlock block;
-    memset(pubkey33,0,33);
-    if ( pindex != 0 )
+    int32_t height = pindex->GetHeight(); struct komodo_minerslot *slot;
+    if ( height < 0 )
+        return;
+    std::lock_guard<std::mutex> lock(komodo_miners_mutex);
+    slot = &komodo_miners[height % KOMODO_MINERS_WINDOW];
+    if ( slot->blockhash.IsNull() == 0 && slot->height > height ) // dont replace a newer block
+        return;
+    slot->blockhash = pindex->GetBlockHash();
+    slot->height = height;
+    memcpy(slot->pubkey33,pubkey33,33);
+}
+
+void komodo_miners_connect(CBlockIndex *pindex,CBlock *block)
+{
+    uint8_t pubkey33[33];
+    komodo_block2pubkey33(pubkey33,block);
+    komodo_miners_set(pindex,pubkey33);
+}
+
+void komodo_miners_disconnect(CBlockIndex *pindex)
+{
+    int32_t height = pindex->GetHeight(); struct komodo_minerslot *slot;
+    if ( height < 0 )
+        return;
+    std::lock_guard<std::mutex> lock(komodo_miners_mutex);
+    slot = &komodo_miners[height % KOMODO_MINERS_WINDOW];
+    if ( slot->blockhash == pindex->GetBlockHash() )
+        slot->blockhash.SetNull();
+}
+
+// the miner pubkey33 of the block at pindex, from the window or else its block, -1 if the block cant be loaded
+int32_t komodo_minerpubkey33(uint8_t *pubkey33,CBlockIndex *pindex)
+{
+    CBlock block; int32_t height = pindex->GetHeight();
+    if ( height >= 0 )
     {
-        if ( komodo_blockload(block,pindex) == 0 )
-            komodo_block2pubkey33(pubkey33,&block);
+        std::lock_guard<std::mutex> lock(komodo_miners_mutex);
+        struct komodo_minerslot *slot = &komodo_miners[height % KOMODO_MINERS_WINDOW];
+        if ( slot->blockhash == pindex->GetBlockHash() )
+        {
+            memcpy(pubkey33,slot->pubkey33,33);
+            return(0);
+        }
     }
+    if ( komodo_blockload(block,pindex) != 0 )
+        return(-1);
+    komodo_block2pubkey33(pubkey33,&block);
+    komodo_miners_set(pindex,pubkey33);
+    return(0);
+}
+
+void komodo_index2pubkey33(uint8_t *pubkey33,CBlockIndex *pindex,int32_t height)
+{
+    memset(pubkey33,0,33);
+    if ( pindex != 0 && komodo_minerpubkey33(pubkey33,pindex) != 0 )
+        memset(pubkey33,0,33);
 }
 
 /*int8_t komodo_minerid(int32_t height,uint8_t *destpubkey33)
@@ -1030,24 +1146,35 @@ void komodo_index2pubkey33(uint8_t *pubkey33,CBlockIndex *pindex,int32_t height)
 int32_t komodo_eligiblenotary(uint8_t pubkeys[66][33],int32_t *mids,uint32_t blocktimes[66],int32_t *nonzpkeysp,int32_t height)
 {
     // after the season HF block ALL new notaries instantly become elegible. 
-    int32_t i,j,n,duplicate; CBlock block; CBlockIndex *pindex; uint8_t notarypubs33[64][33];
+    int32_t i,j,n,duplicate; CBlockIndex *pindex; uint8_t notarypubs33[64][33]; const struct komodo_notaryset *set;
     memset(mids,-1,sizeof(*mids)*66);
-    n = komodo_notaries(notarypubs33,height,0);
+    if ( (set= komodo_notaryset_get(height,0)) == 0 )
+        n = komodo_notaries(notarypubs33,height,0);
     for (i=duplicate=0; i<66; i++)
     {
         if ( (pindex= komodo_chainactive(height-i)) != 0 )
         {
             blocktimes[i] = pindex->nTime;
-            if ( komodo_blockload(block,pindex) == 0 )
+            if ( komodo_minerpubkey33(pubkeys[i],pindex) == 0 )
             {
-                komodo_block2pubkey33(pubkeys[i],&block);
-                for (j=0; j<n; j++)
+                if ( set != 0 )
                 {
-                    if ( memcmp(notarypubs33[j],pubkeys[i],33) == 0 )
+                    if ( (j= komodo_notaryset_find(set,pubkeys[i])) >= 0 )
                     {
                         mids[i] = j;
                         (*nonzpkeysp)++;
-                        break;
+                    }
+                }
+                else
+                {
+                    for (j=0; j<n; j++)
+                    {
+                        if ( memcmp(notarypubs33[j],pubkeys[i],33) == 0 )
+                        {
+                            mids[i] = j;
+                            (*nonzpkeysp)++;
+                            break;
+                        }
                     }
                 }
             } else fprintf(stderr,"couldnt load block.%d\n",height);
@@ -1062,27 +1189,28 @@ int32_t komodo_eligiblenotary(uint8_t pubkeys[66][33],int32_t *mids,uint32_t blo
 
 int32_t komodo_minerids(uint8_t *minerids,int32_t height,int32_t width)
 {
-    int32_t i,j,nonz,numnotaries; CBlock block; CBlockIndex *pindex; uint8_t notarypubs33[64][33],pubkey33[33];
+    int32_t i,j,nonz,numnotaries; CBlockIndex *pindex; uint8_t notarypubs33[64][33],pubkey33[33]; const struct komodo_notaryset *set;
     numnotaries = komodo_notaries(notarypubs33,height,0);
+    set = komodo_notaryset_get(height,0);
     for (i=nonz=0; i<width; i++)
     {
         if ( height-i <= 0 )
             continue;
         if ( (pindex= komodo_chainactive(height-width+i+1)) != 0 )
         {
-            if ( komodo_blockload(block,pindex) == 0 )
+            if ( komodo_minerpubkey33(pubkey33,pindex) == 0 )
             {
-                komodo_block2pubkey33(pubkey33,&block);
-                for (j=0; j<numnotaries; j++)
+                if ( set != 0 )
+                    j = komodo_notaryset_find(set,pubkey33);
+                else
                 {
-                    if ( memcmp(notarypubs33[j],pubkey33,33) == 0 )
-                    {
-                        minerids[nonz++] = j;
-                        break;
-                    }
+                    for (j=0; j<numnotaries; j++)
+                        if ( memcmp(notarypubs33[j],pubkey33,33) == 0 )
+                            break;
                 }
-                if ( j == numnotaries )
-                    minerids[nonz++] = j;
+                if ( j < 0 || j == numnotaries )
+                    j = numnotaries;
+                minerids[nonz++] = j;
             } else fprintf(stderr,"couldnt load block.%d\n",height);
         }
     }
@@ -1249,16 +1377,71 @@ uint32_t komodo_interest_args(uint32_t *txheighttimep,int32_t *txheightp,uint32_
 
 uint64_t komodo_interest(int32_t txheight,uint64_t nValue,uint32_t nLockTime,uint32_t tiptime);
 
+/*
+ * What komodo_accrued_interest read from the transaction of an output and the interest at the tip time it was last
+ * asked for, so the wallet polls asking for every output don't look the transactions up again. The interest is
+ * recomputed when the tip time changes and an entry is dropped when the block of its transaction left the chain.
+ */
+struct komodo_interestcache_entry
+{
+    uint256 hashBlock;
+    int32_t txheight;
+    uint32_t locktime,tiptime;
+    uint64_t value,interest;
+};
+static std::mutex komodo_interestcache_mutex;
+static std::map<std::pair<uint256,int32_t>,struct komodo_interestcache_entry> komodo_interestcache;
+#define KOMODO_INTERESTCACHE_MAXSIZE 200000
+
 uint64_t komodo_accrued_interest(int32_t *txheightp,uint32_t *locktimep,uint256 hash,int32_t n,int32_t checkheight,uint64_t checkvalue,int32_t tipheight)
 {
-    uint64_t value; uint32_t tiptime=0,txheighttimep; CBlockIndex *pindex;
+    uint64_t value; uint32_t tiptime=0,txheighttimep; CBlockIndex *pindex; struct komodo_interestcache_entry *entry = 0;
+    std::map<std::pair<uint256,int32_t>,struct komodo_interestcache_entry>::iterator it; std::pair<uint256,int32_t> key(hash,n);
+    LOCK(cs_main);
     if ( (pindex= chainActive[tipheight]) != 0 )
         tiptime = (uint32_t)pindex->nTime;
     else fprintf(stderr,"cant find height[%d]\n",tipheight);
-    if ( (*locktimep= komodo_interest_args(&txheighttimep,txheightp,&tiptime,&value,hash,n)) != 0 )
+    std::lock_guard<std::mutex> lock(komodo_interestcache_mutex);
+    if ( (it= komodo_interestcache.find(key)) != komodo_interestcache.end() )
+    {
+        if ( (pindex= chainActive[it->second.txheight]) != 0 && pindex->GetBlockHash() == it->second.hashBlock )
+        {
+            entry = &it->second;
+            if ( tiptime == 0 && (pindex= chainActive.LastTip()) != 0 )
+                tiptime = (uint32_t)pindex->nTime;
+            *txheightp = entry->txheight;
+            *locktimep = entry->locktime;
+            value = entry->value;
+        } else komodo_interestcache.erase(it);
+    }
+    if ( entry == 0 )
+    {
+        *locktimep = komodo_interest_args(&txheighttimep,txheightp,&tiptime,&value,hash,n);
+        if ( *txheightp > 0 && (pindex= chainActive[*txheightp]) != 0 )
+        {
+            if ( komodo_interestcache.size() >= KOMODO_INTERESTCACHE_MAXSIZE )
+                komodo_interestcache.clear();
+            entry = &komodo_interestcache[key];
+            entry->hashBlock = pindex->GetBlockHash();
+            entry->txheight = *txheightp;
+            entry->locktime = *locktimep;
+            entry->value = value;
+            entry->tiptime = entry->interest = 0;
+        }
+    }
+    if ( *locktimep != 0 )
     {
         if ( (checkvalue == 0 || value == checkvalue) && (checkheight == 0 || *txheightp == checkheight) )
-            return(komodo_interest(*txheightp,value,*locktimep,tiptime));
+        {
+            if ( entry == 0 )
+                return(komodo_interest(*txheightp,value,*locktimep,tiptime));
+            if ( entry->tiptime != tiptime || tiptime == 0 )
+            {
+                entry->interest = komodo_interest(*txheightp,value,*locktimep,tiptime);
+                entry->tiptime = tiptime;
+            }
+            return(entry->interest);
+        }
         //fprintf(stderr,"nValue %llu lock.%u:%u nTime.%u -> %llu\n",(long long)coins.vout[n].nValue,coins.nLockTime,timestamp,pindex->nTime,(long long)interest);
         else fprintf(stderr,"komodo_accrued_interest value mismatch %llu vs %llu or height mismatch %d vs %d\n",(long long)value,(long long)checkvalue,*txheightp,checkheight);
     }
@@ -1455,35 +1638,55 @@ int8_t komodo_segid(int32_t nocache,int32_t height)
 
 void komodo_segids(uint8_t *hashbuf,int32_t height,int32_t n)
 {
-    static uint8_t prevhashbuf[100]; static int32_t prevheight;
-    int32_t i;
-    if ( height == prevheight && n == 100 )
-        memcpy(hashbuf,prevhashbuf,100);
-    else
+    // the window of 100 is kept for the chain ending at its last block, and rolled forward one block on a new tip
+    static std::mutex segidsmutex; static uint8_t prevhashbuf[100]; static int32_t prevheight; static uint256 prevlasthash;
+    int32_t i; CBlockIndex *pindex = 0; uint256 lasthash;
+    if ( n == 100 && (pindex= komodo_chainactive(height+n-1)) != 0 )
     {
-        memset(hashbuf,0xff,n);
-        for (i=0; i<n; i++)
+        lasthash = pindex->GetBlockHash();
+        std::lock_guard<std::mutex> lock(segidsmutex);
+        if ( height == prevheight && lasthash == prevlasthash )
         {
-            hashbuf[i] = (uint8_t)komodo_segid(0,height+i);
-            //fprintf(stderr,"%02x ",hashbuf[i]);
+            memcpy(hashbuf,prevhashbuf,100);
+            return;
         }
-        if ( n == 100 )
+        if ( height == prevheight+1 && pindex->pprev != 0 && pindex->pprev->GetBlockHash() == prevlasthash )
+        {
+            memmove(prevhashbuf,&prevhashbuf[1],99);
+            prevhashbuf[99] = (uint8_t)komodo_segid(0,height+99);
+        }
+        else
         {
-            memcpy(prevhashbuf,hashbuf,100);
-            prevheight = height;
-            //fprintf(stderr,"prevsegids.%d\n",height+n);
+            for (i=0; i<n; i++)
+                prevhashbuf[i] = (uint8_t)komodo_segid(0,height+i);
         }
+        prevheight = height;
+        prevlasthash = lasthash;
+        memcpy(hashbuf,prevhashbuf,100);
+        return;
+    }
+    memset(hashbuf,0xff,n);
+    for (i=0; i<n; i++)
+    {
+        hashbuf[i] = (uint8_t)komodo_segid(0,height+i);
+        //fprintf(stderr,"%02x ",hashbuf[i]);
     }
 }
 
-uint32_t komodo_stakehash(uint256 *hashp,char *address,uint8_t *hashbuf,uint256 txid,int32_t vout)
+// stake hash of a utxo whose address hash is known, with the segids of the staking height in hashbuf
+void komodo_stakehash_addrhash(uint256 *hashp,bits256 addrhash,uint8_t *hashbuf,uint256 txid,int32_t vout)
 {
-    bits256 addrhash;
-    vcalc_sha256(0,(uint8_t *)&addrhash,(uint8_t *)address,(int32_t)strlen(address));
     memcpy(&hashbuf[100],&addrhash,sizeof(addrhash));
     memcpy(&hashbuf[100+sizeof(addrhash)],&txid,sizeof(txid));
     memcpy(&hashbuf[100+sizeof(addrhash)+sizeof(txid)],&vout,sizeof(vout));
     vcalc_sha256(0,(uint8_t *)hashp,hashbuf,100 + (int32_t)sizeof(uint256)*2 + sizeof(vout));
+}
+
+uint32_t komodo_stakehash(uint256 *hashp,char *address,uint8_t *hashbuf,uint256 txid,int32_t vout)
+{
+    bits256 addrhash;
+    vcalc_sha256(0,(uint8_t *)&addrhash,(uint8_t *)address,(int32_t)strlen(address));
+    komodo_stakehash_addrhash(hashp,addrhash,hashbuf,txid,vout);
     return(addrhash.uints[0]);
 }
 
@@ -1630,10 +1833,10 @@ arith_uint256 komodo_PoWtarget(int32_t *percPoSp,arith_uint256 target,int32_t he
     return(bnTarget);
 }
 
-uint32_t komodo_stake(int32_t validateflag,arith_uint256 bnTarget,int32_t nHeight,uint256 txid,int32_t vout,uint32_t blocktime,uint32_t prevtime,char *destaddr,int32_t PoSperc)
+// komodo_stake for a utxo whose value, txtime and address hash are already known, with the segids of nHeight in hashbuf
+uint32_t komodo_stake_utxo(int32_t validateflag,arith_uint256 bnTarget,int32_t nHeight,uint256 txid,int32_t vout,uint32_t blocktime,uint32_t prevtime,int32_t PoSperc,uint64_t value,uint32_t txtime,bits256 addrhash,uint8_t *hashbuf)
 {
-    bool fNegative,fOverflow; uint8_t hashbuf[256]; char address[64]; bits256 addrhash; arith_uint256 hashval,mindiff,ratio,coinage256; uint256 hash,pasthash; int32_t segid,minage,i,iter=0; int64_t diff=0; uint32_t txtime,segid32,winner = 0 ; uint64_t value,coinage;
-    txtime = komodo_txtime2(&value,txid,vout,address);
+    bool fNegative,fOverflow; arith_uint256 hashval,mindiff,ratio,coinage256; uint256 hash; int32_t segid,minage,i,iter=0; int64_t diff=0; uint32_t winner = 0 ; uint64_t coinage;
     if ( validateflag == 0 )
     {
         //fprintf(stderr,"blocktime.%u -> ",blocktime);
@@ -1655,9 +1858,8 @@ uint32_t komodo_stake(int32_t validateflag,arith_uint256 bnTarget,int32_t nHeigh
     ratio = (mindiff / bnTarget);
     if ( (minage= nHeight*3) > 6000 ) // about 100 blocks
         minage = 6000;
-    komodo_segids(hashbuf,nHeight-101,100);
-    segid32 = komodo_stakehash(&hash,address,hashbuf,txid,vout);
-    segid = ((nHeight + segid32) & 0x3f);
+    komodo_stakehash_addrhash(&hash,addrhash,hashbuf,txid,vout);
+    segid = ((nHeight + addrhash.uints[0]) & 0x3f);
     for (iter=0; iter<600; iter++)
     {
         if ( blocktime+iter+segid*2 < txtime+minage )
@@ -1744,6 +1946,18 @@ uint32_t komodo_stake(int32_t validateflag,arith_uint256 bnTarget,int32_t nHeigh
     return(blocktime * winner);
 }
 
+uint32_t komodo_stake(int32_t validateflag,arith_uint256 bnTarget,int32_t nHeight,uint256 txid,int32_t vout,uint32_t blocktime,uint32_t prevtime,char *destaddr,int32_t PoSperc)
+{
+    uint8_t hashbuf[256]; char address[64]; bits256 addrhash; uint32_t txtime; uint64_t value;
+    address[0] = 0;
+    txtime = komodo_txtime2(&value,txid,vout,address);
+    if ( value == 0 || txtime == 0 )
+        return(0);
+    komodo_segids(hashbuf,nHeight-101,100);
+    vcalc_sha256(0,(uint8_t *)&addrhash,(uint8_t *)address,(int32_t)strlen(address));
+    return(komodo_stake_utxo(validateflag,bnTarget,nHeight,txid,vout,blocktime,prevtime,PoSperc,value,txtime,addrhash,hashbuf));
+}
+
 int32_t komodo_is_PoSblock(int32_t slowflag,int32_t height,CBlock *pblock,arith_uint256 bnTarget,arith_uint256 bhash)
 {
     CBlockIndex *previndex,*pindex; char voutaddr[64],destaddr[64]; uint256 txid, merkleroot; uint32_t txtime,prevtime=0; int32_t ret,vout,PoSperc,txn_count,eligible=0,isPoS = 0,segid; uint64_t value; arith_uint256 POWTarget;
@@ -2357,7 +2571,10 @@ int32_t komodo_checkPOW(int64_t stakeTxValue, int32_t slowflag,CBlock *pblock,in
         failed = 1;
         if ( height > 0 && ASSETCHAINS_SYMBOL[0] == 0 ) // for the fast case
         {
-            if ( (n= komodo_notaries(pubkeys,height,pblock->nTime)) > 0 )
+            const struct komodo_notaryset *set;
+            if ( (set= komodo_notaryset_get(height,pblock->nTime)) != 0 )
+                notaryid = komodo_notaryset_find(set,pubkey33);
+            else if ( (n= komodo_notaries(pubkeys,height,pblock->nTime)) > 0 )
             {
                 for (i=0; i<n; i++)
                     if ( memcmp(pubkey33,pubkeys[i],33) == 0 )
@@ -2538,8 +2755,10 @@ int32_t komodo_acpublic(uint32_t tiptime)
     return(acpublic);
 }
 
-int64_t komodo_newcoins(int64_t *zfundsp,int64_t *sproutfundsp,int32_t nHeight,CBlock *pblock)
+int64_t komodo_newcoins(int64_t *zfundsp,int64_t *sproutfundsp,int32_t nHeight,CBlock *pblock,const CCoinsViewCache *pspent)
 {
+    // pspent, when given, still has the inputs of the block unspent and saves the transaction lookups
+    const CCoins *coins;
     CTxDestination address; int32_t i,j,m,n,vout; uint8_t *script; uint256 txid,hashBlock; int64_t zfunds=0,vinsum=0,voutsum=0,sproutfunds=0;
     n = pblock->vtx.size();
     for (i=0; i<n; i++)
@@ -2553,6 +2772,11 @@ int64_t komodo_newcoins(int64_t *zfundsp,int64_t *sproutfundsp,int32_t nHeight,C
                     continue;
                 txid = tx.vin[j].prevout.hash;
                 vout = tx.vin[j].prevout.n;
+                if ( pspent != 0 && (coins= pspent->AccessCoins(txid)) != 0 && vout < coins->vout.size() && !coins->vout[vout].IsNull() )
+                {
+                    vinsum += coins->vout[vout].nValue;
+                    continue;
+                }
                 if ( !GetTransaction(txid,vintx,hashBlock, false) || vout >= vintx.vout.size() )
                 {
                     fprintf(stderr,"ERROR: %s/v%d cant find\n",txid.ToString().c_str(),vout);
@@ -2567,7 +2791,7 @@ int64_t komodo_newcoins(int64_t *zfundsp,int64_t *sproutfundsp,int32_t nHeight,C
             {
                 if ( ExtractDestination(tx.vout[j].scriptPubKey,address) != 0 && strcmp("RD6GgnrMpPaTSMn8vai6yiGA7mN4QGPVMY",CBitcoinAddress(address).ToString().c_str()) != 0 )
                     voutsum += tx.vout[j].nValue;
-                else printf("skip %.8f -> %s\n",dstr(tx.vout[j].nValue),CBitcoinAddress(address).ToString().c_str());
+                else if ( pspent == 0 ) printf("skip %.8f -> %s\n",dstr(tx.vout[j].nValue),CBitcoinAddress(address).ToString().c_str());
             }
             script = (uint8_t *)&tx.vout[j].scriptPubKey[0];
             if ( script == 0 || script[0] != 0x6a )
@@ -2596,17 +2820,24 @@ int64_t komodo_newcoins(int64_t *zfundsp,int64_t *sproutfundsp,int32_t nHeight,C
 
 int64_t komodo_coinsupply(int64_t *zfundsp,int64_t *sproutfundsp,int32_t height)
 {
-    CBlockIndex *pindex; CBlock block; int64_t zfunds=0,sproutfunds=0,supply = 0;
+    CBlockIndex *pindex; CBlock block; CCoinsStatsRecord record; int64_t zfunds=0,sproutfunds=0,supply = 0;
     //fprintf(stderr,"coinsupply %d\n",height);
     *zfundsp = *sproutfundsp = 0;
     if ( (pindex= komodo_chainactive(height)) != 0 )
     {
+        // -coinstatsindex keeps the totals for every block
+        if ( GetCoinsStatsAt(pindex,record) != 0 && record.fSupply != 0 )
+        {
+            *zfundsp = record.nZFunds;
+            *sproutfundsp = record.nSproutFunds;
+            return(record.nSupply);
+        }
         while ( pindex != 0 && pindex->GetHeight() > 0 )
         {
             if ( pindex->newcoins == 0 && pindex->zfunds == 0 )
             {
                 if ( komodo_blockload(block,pindex) == 0 )
-                    pindex->newcoins = komodo_newcoins(&pindex->zfunds,&pindex->sproutfunds,pindex->GetHeight(),&block);
+                    pindex->newcoins = komodo_newcoins(&pindex->zfunds,&pindex->sproutfunds,pindex->GetHeight(),&block,0);
                 else
                 {
                     fprintf(stderr,"error loading block.%d\n",pindex->GetHeight());
@@ -2633,7 +2864,25 @@ struct komodo_staking
     uint32_t segid32,txtime;
     int32_t vout;
     CScript scriptPubKey;
+    bits256 addrhash; // of the address komodo_stake would extract from the vout
+    int32_t precomputed; // addrhash is set, komodo_stake_utxo can be used
+    uint32_t eligible; // komodo_stake result for the tip in komodo_staked
 };
+#define KOMODO_STAKING_REBUILD 3600 // seconds between the rebuilds from AvailableCoins that catch what no notification tells
+
+/*
+ * The wallet transactions added, updated or removed since komodo_staked last brought its staking utxos up to date, so
+ * it only looks at those instead of going through AvailableCoins again. Filled by the NotifyTransactionChanged signal
+ * of the wallet, which is raised with cs_wallet held.
+ */
+static std::mutex komodo_stakingtxids_mutex;
+static std::set<uint256> komodo_stakingtxids;
+
+void komodo_stakingnotify(CWallet *wallet,const uint256 &hashTx,ChangeType status)
+{
+    std::lock_guard<std::mutex> lock(komodo_stakingtxids_mutex);
+    komodo_stakingtxids.insert(hashTx);
+}
 
 struct komodo_staking *komodo_addutxo(struct komodo_staking *array,int32_t *numkp,int32_t *maxkp,uint32_t txtime,uint64_t nValue,uint256 txid,int32_t vout,char *address,uint8_t *hashbuf,CScript pk)
 {
@@ -2656,12 +2905,106 @@ struct komodo_staking *komodo_addutxo(struct komodo_staking *array,int32_t *numk
     kp->segid32 = segid32;
     kp->nValue = nValue;
     kp->scriptPubKey = pk;
+    CTxDestination dest;
+    if ( ExtractDestination(pk,dest) != 0 )
+    {
+        std::string stakeaddr = CBitcoinAddress(dest).ToString();
+        vcalc_sha256(0,(uint8_t *)&kp->addrhash,(uint8_t *)stakeaddr.c_str(),(int32_t)stakeaddr.size());
+        kp->precomputed = 1;
+    }
+    return(array);
+}
+
+void komodo_removeutxo(struct komodo_staking *array,int32_t *numkp,std::map<COutPoint,int32_t> &indices,std::map<COutPoint,int32_t>::iterator it)
+{
+    int32_t i = it->second;
+    indices.erase(it);
+    if ( i != --(*numkp) )
+    {
+        array[i] = array[*numkp];
+        indices[COutPoint(array[i].txid,array[i].vout)] = i;
+    }
+    array[*numkp].scriptPubKey.~CScript(); // komodo_addutxo memsets the slot when it is reused
+}
+
+void komodo_freeutxos(struct komodo_staking *array,int32_t numkp)
+{
+    int32_t i;
+    for (i=0; i<numkp; i++)
+        array[i].scriptPubKey.~CScript();
+    free(array);
+}
+
+// adds the outputs of the changed wallet transactions that can stake and removes the ones that no longer can, sets *changedp to how many
+struct komodo_staking *komodo_updateutxos(struct komodo_staking *array,int32_t *numkp,int32_t *maxkp,std::map<COutPoint,int32_t> &indices,std::set<uint256> &immature,bool newtip,uint8_t *hashbuf,int32_t *changedp)
+{
+    std::set<uint256> txids; std::map<COutPoint,int32_t>::iterator it; std::map<uint256,CWalletTx>::const_iterator wit; CTxDestination address; CBlockIndex *pindex; int32_t i,nDepth; bool stakeable;
+    *changedp = 0;
+    {
+        std::lock_guard<std::mutex> lock(komodo_stakingtxids_mutex);
+        txids.swap(komodo_stakingtxids);
+    }
+    // nothing in the wallet changes when a coinbase matures, so they are looked at again at each tip until they do
+    if ( newtip )
+        txids.insert(immature.begin(),immature.end());
+    if ( txids.empty() )
+        return(array);
+    LOCK2(cs_main, pwalletMain->cs_wallet);
+    BOOST_FOREACH(const uint256 &txid,txids)
+    {
+        immature.erase(txid);
+        if ( (wit= pwalletMain->mapWallet.find(txid)) == pwalletMain->mapWallet.end() )
+        {
+            while ( (it= indices.lower_bound(COutPoint(txid,0))) != indices.end() && it->first.hash == txid )
+            {
+                komodo_removeutxo(array,numkp,indices,it);
+                (*changedp)++;
+            }
+            continue;
+        }
+        const CWalletTx &wtx = wit->second;
+        BOOST_FOREACH(const CTxIn &txin,wtx.vin)
+        {
+            if ( (it= indices.find(txin.prevout)) != indices.end() && pwalletMain->IsSpent(txin.prevout.hash,txin.prevout.n) )
+            {
+                komodo_removeutxo(array,numkp,indices,it);
+                (*changedp)++;
+            }
+        }
+        nDepth = wtx.GetDepthInMainChain();
+        if ( wtx.IsCoinBase() && nDepth >= 1 && wtx.GetBlocksToMaturity() > 0 )
+        {
+            immature.insert(txid);
+            continue;
+        }
+        pindex = nDepth >= 1 ? komodo_getblockindex(wtx.hashBlock) : 0;
+        for (i=0; i<wtx.vout.size(); i++)
+        {
+            // what the AvailableCoins loop of komodo_staked keeps
+            const CScript &pk = wtx.vout[i].scriptPubKey;
+            stakeable = pindex != 0 && wtx.vout[i].nValue >= COIN && CheckFinalTx(wtx) && !pwalletMain->IsSpent(txid,i) && !pwalletMain->IsLockedCoin(txid,i) && (pwalletMain->IsMine(wtx.vout[i]) & ISMINE_SPENDABLE) != ISMINE_NO && ExtractDestination(pk,address) != 0 && IsMine(*pwalletMain,address) != 0;
+            it = indices.find(COutPoint(txid,i));
+            if ( stakeable && it == indices.end() )
+            {
+                indices[COutPoint(txid,i)] = *numkp;
+                array = komodo_addutxo(array,numkp,maxkp,(uint32_t)pindex->nTime,(uint64_t)wtx.vout[i].nValue,txid,i,(char *)CBitcoinAddress(address).ToString().c_str(),hashbuf,(CScript)pk);
+                (*changedp)++;
+            }
+            else if ( !stakeable && it != indices.end() )
+            {
+                komodo_removeutxo(array,numkp,indices,it);
+                (*changedp)++;
+            }
+        }
+    }
     return(array);
 }
 
 int32_t komodo_staked(CMutableTransaction &txNew,uint32_t nBits,uint32_t *blocktimep,uint32_t *txtimep,uint256 *utxotxidp,int32_t *utxovoutp,uint64_t *utxovaluep,uint8_t *utxosig, uint256 merkleroot)
 {
     static struct komodo_staking *array; static int32_t numkp,maxkp; static uint32_t lasttime;
+    static std::map<COutPoint,int32_t> indices; static std::set<uint256> immature; static CBlockIndex *stakingtip; static bool notified; // what komodo_updateutxos keeps up to date
+    static uint256 eligibletip; static uint32_t eligiblenbits,eligiblestart; // what the kp->eligible are valid for
     int32_t PoSperc = 0, newStakerActive; 
     set<CBitcoinAddress> setAddress; struct komodo_staking *kp; int32_t winners,segid,minage,nHeight,counter=0,i,m,siglen=0,nMinDepth = 1,nMaxDepth = 99999999; vector<COutput> vecOutputs; uint32_t block_from_future_rejecttime,besttime,eligible,earliest = 0; CScript best_scriptPubKey; arith_uint256 mindiff,ratio,bnTarget,tmpTarget; CBlockIndex *tipindex,*pindex; CTxDestination address; bool fNegative,fOverflow; uint8_t hashbuf[256]; CTransaction tx; uint256 hashBlock;
     uint64_t cbPerc = *utxovaluep, tocoinbase = 0;
@@ -2685,33 +3028,42 @@ int32_t komodo_staked(CMutableTransaction &txNew,uint32_t nBits,uint32_t *blockt
     // this was for VerusHash PoS64
     //tmpTarget = komodo_PoWtarget(&PoSperc,bnTarget,nHeight,ASSETCHAINS_STAKED);
     bool resetstaker = false;
-    if ( array != 0 )
+    if ( !notified )
+    {
+        pwalletMain->NotifyTransactionChanged.connect(&komodo_stakingnotify);
+        notified = true;
+    }
     {
+        // the wallet isn't told when its transactions leave the chain, nor is it for the Marmara unspents
         LOCK(cs_main);
-        CBlockIndex* pblockindex = chainActive[tipindex->GetHeight()];
-        CBlock block; CTxDestination addressout;
-        if ( ASSETCHAINS_MARMARA != 0 )
+        if ( ASSETCHAINS_MARMARA != 0 || lasttime == 0 || stakingtip == 0 || !chainActive.Contains(stakingtip) || time(NULL) > lasttime+KOMODO_STAKING_REBUILD )
             resetstaker = true;
-         else if ( ReadBlockFromDisk(block, pblockindex, 1) && komodo_isPoS(&block, nHeight, &addressout) != 0 && IsMine(*pwalletMain,addressout) != 0 )
-        {
-              resetstaker = true;
-              fprintf(stderr, "[%s:%d] Reset ram staker after mining a block!\n",ASSETCHAINS_SYMBOL,nHeight);
-        }
     }
 
-    if ( resetstaker || array == 0 || time(NULL) > lasttime+600 )
+    if ( resetstaker )
     {
         LOCK2(cs_main, pwalletMain->cs_wallet);
+        {
+            // what changed until now is in AvailableCoins
+            std::lock_guard<std::mutex> lock(komodo_stakingtxids_mutex);
+            komodo_stakingtxids.clear();
+        }
         pwalletMain->AvailableCoins(vecOutputs, false, NULL, true);
         if ( array != 0 )
         {
-            free(array);
+            komodo_freeutxos(array,numkp);
             array = 0;
             maxkp = numkp = 0;
             lasttime = 0;
         }
+        indices.clear();
+        immature.clear();
+        eligibletip.SetNull();
         if ( ASSETCHAINS_MARMARA == 0 )
         {
+            for (std::map<uint256,CWalletTx>::const_iterator it=pwalletMain->mapWallet.begin(); it!=pwalletMain->mapWallet.end(); it++)
+                if ( it->second.IsCoinBase() && it->second.GetBlocksToMaturity() > 0 && it->second.GetDepthInMainChain() >= 1 )
+                    immature.insert(it->first);
             BOOST_FOREACH(const COutput& out, vecOutputs)
             {
                 if ( (tipindex= chainActive.Tip()) == 0 || tipindex->GetHeight()+1 > nHeight )
@@ -2767,10 +3119,26 @@ int32_t komodo_staked(CMutableTransaction &txNew,uint32_t nBits,uint32_t *blockt
                 }
             }
         }
+        for (i=0; i<numkp; i++)
+            indices[COutPoint(array[i].txid,array[i].vout)] = i;
         lasttime = (uint32_t)time(NULL);
         //fprintf(stderr,"finished kp data of utxo for staking %u ht.%d numkp.%d maxkp.%d\n",(uint32_t)time(NULL),nHeight,numkp,maxkp);
     }
+    else
+    {
+        int32_t changed;
+        array = komodo_updateutxos(array,&numkp,&maxkp,indices,immature,tipindex != stakingtip,hashbuf,&changed);
+        if ( changed != 0 )
+            eligibletip.SetNull();
+    }
+    stakingtip = tipindex;
     block_from_future_rejecttime = (uint32_t)GetTime() + ASSETCHAINS_STAKED_BLOCK_FUTURE_MAX;    
+    // the eligibility of a utxo only depends on the tip, nBits and the earliest blocktime, so it is computed once for them
+    uint32_t prevtime = (uint32_t)tipindex->nTime+ASSETCHAINS_STAKED_BLOCK_FUTURE_HALF, starttime = prevtime+3;
+    if ( starttime < GetTime()-60 )
+        starttime = GetTime()+30;
+    bool refresh = !(tipindex->GetBlockHash() == eligibletip && nBits == eligiblenbits && starttime == eligiblestart);
+    eligibletip.SetNull();
     for (i=winners=0; i<numkp; i++)
     {
         if ( fRequestShutdown || !GetBoolArg("-gen",false) )
@@ -2781,11 +3149,29 @@ int32_t komodo_staked(CMutableTransaction &txNew,uint32_t nBits,uint32_t *blockt
             return(0);
         }
         kp = &array[i];
-        eligible = komodo_stake(0,bnTarget,nHeight,kp->txid,kp->vout,0,(uint32_t)tipindex->nTime+ASSETCHAINS_STAKED_BLOCK_FUTURE_HALF,kp->address,PoSperc);
+        if ( refresh )
+        {
+            // no iteration of komodo_stake_utxo gets past the minage of a younger utxo, whatever its hash
+            if ( kp->precomputed != 0 && nHeight >= 10 && kp->txtime+minage > std::max(starttime,(uint32_t)GetTime()+30)+599+((nHeight + kp->addrhash.uints[0]) & 0x3f)*2 )
+                eligible = 0;
+            else if ( kp->precomputed != 0 )
+            {
+                eligible = komodo_stake_utxo(0,bnTarget,nHeight,kp->txid,kp->vout,starttime,prevtime,PoSperc,kp->nValue,kp->txtime,kp->addrhash,hashbuf);
+                if ( eligible > 0 && eligible != komodo_stake_utxo(1,bnTarget,nHeight,kp->txid,kp->vout,eligible,prevtime,PoSperc,kp->nValue,kp->txtime,kp->addrhash,hashbuf) )
+                    eligible = 0;
+            }
+            else
+            {
+                eligible = komodo_stake(0,bnTarget,nHeight,kp->txid,kp->vout,starttime,prevtime,kp->address,PoSperc);
+                if ( eligible > 0 && eligible != komodo_stake(1,bnTarget,nHeight,kp->txid,kp->vout,eligible,prevtime,kp->address,PoSperc) )
+                    eligible = 0;
+            }
+            kp->eligible = eligible;
+        }
+        else eligible = kp->eligible;
         if ( eligible > 0 )
         {
             besttime = 0;
-            if ( eligible == komodo_stake(1,bnTarget,nHeight,kp->txid,kp->vout,eligible,(uint32_t)tipindex->nTime+ASSETCHAINS_STAKED_BLOCK_FUTURE_HALF,kp->address,PoSperc) )
             {
                 // have elegible utxo to stake with. 
                 if ( earliest == 0 || eligible < earliest || (eligible == earliest && (*utxovaluep == 0 || kp->nValue < *utxovaluep)) )
@@ -2807,13 +3193,9 @@ int32_t komodo_staked(CMutableTransaction &txNew,uint32_t nBits,uint32_t *blockt
             }
         }
     }
-    if ( numkp < 500 && array != 0 )
-    {
-        free(array);
-        array = 0;
-        maxkp = numkp = 0;
-        lasttime = 0;
-    }
+    eligibletip = tipindex->GetBlockHash();
+    eligiblenbits = nBits;
+    eligiblestart = starttime;
     if ( earliest != 0 )
     {
         bool signSuccess; SignatureData sigdata; uint64_t txfee; uint8_t *ptr; uint256 revtxid,utxotxid;
@@ -537,6 +537,9 @@ int32_t getkmdseason(int32_t height);
 uint64_t komodo_paxprice(uint64_t *seedp,int32_t height,char *base,char *rel,uint64_t basevolume);
 int32_t komodo_paxprices(int32_t *heights,uint64_t *prices,int32_t max,char *base,char *rel);
 int32_t komodo_notaries(uint8_t pubkeys[64][33],int32_t height,uint32_t timestamp);
+const struct komodo_notaryset *komodo_notaryset_get(int32_t height,uint32_t timestamp);
+int32_t komodo_notaryset_find(const struct komodo_notaryset *set,const uint8_t *pubkey33);
+int32_t komodo_notaryset_findaddr(const struct komodo_notaryset *set,const char *coinaddr);
 char *bitcoin_address(char *coinaddr,uint8_t addrtype,uint8_t *pubkey_or_rmd160,int32_t len);
 int32_t komodo_minerids(uint8_t *minerids,int32_t height,int32_t width);
 int32_t komodo_kvsearch(uint256 *refpubkeyp,int32_t current_height,uint32_t *flagsp,int32_t *heightp,uint8_t value[IGUANA_MAXSCRIPTSIZE],uint8_t *key,int32_t keylen);
@@ -544,6 +547,8 @@ int32_t komodo_kvsearch(uint256 *refpubkeyp,int32_t current_height,uint32_t *fla
 uint32_t komodo_blocktime(uint256 hash);
 int32_t komodo_longestchain();
 int32_t komodo_dpowconfs(int32_t height,int32_t numconfs);
+int32_t komodo_dpownotarizedheight();
+int32_t komodo_dpowconfs_notarized(int32_t notarizedheight,int32_t txheight,int32_t numconfs);
 int8_t komodo_segid(int32_t nocache,int32_t height);
 int32_t komodo_heightpricebits(uint64_t *seedp,uint32_t *heightbits,int32_t nHeight);
 char *komodo_pricename(char *name,int32_t ind);
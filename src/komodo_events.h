@@ -17,6 +17,16 @@
 #define H_KOMODOEVENTS_H
 #include "komodo_defs.h"
 
+// grows Komodo_events to hold at least n events, called with komodo_mutex held
+void komodo_events_reserve(struct komodo_state *sp,int32_t n)
+{
+    if ( n > sp->Komodo_maxevents )
+    {
+        sp->Komodo_events = (struct komodo_event **)realloc(sp->Komodo_events,n * sizeof(*sp->Komodo_events));
+        sp->Komodo_maxevents = n;
+    }
+}
+
 struct komodo_event *komodo_eventadd(struct komodo_state *sp,int32_t height,char *symbol,uint8_t type,uint8_t *data,uint16_t datalen)
 {
     struct komodo_event *ep=0; uint16_t len = (uint16_t)(sizeof(*ep) + datalen);
@@ -30,7 +40,8 @@ struct komodo_event *komodo_eventadd(struct komodo_state *sp,int32_t height,char
         strcpy(ep->symbol,symbol);
         if ( datalen != 0 )
             memcpy(ep->space,data,datalen);
-        sp->Komodo_events = (struct komodo_event **)realloc(sp->Komodo_events,(1 + sp->Komodo_numevents) * sizeof(*sp->Komodo_events));
+        if ( sp->Komodo_numevents >= sp->Komodo_maxevents )
+            komodo_events_reserve(sp,sp->Komodo_maxevents < 1024 ? 1024 : sp->Komodo_maxevents * 2);
         sp->Komodo_events[sp->Komodo_numevents++] = ep;
         portable_mutex_unlock(&komodo_mutex);
     }
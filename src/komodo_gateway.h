@@ -15,6 +15,14 @@
 
 // paxdeposit equivalent in reverse makes opreturn and KMD does the same in reverse
 #include "komodo_defs.h"
+#include "blockfilemap.h"
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
 
 /*#include "secp256k1/include/secp256k1.h"
 #include "secp256k1/include/secp256k1_schnorrsig.h"
@@ -82,6 +90,85 @@ struct pax_transaction *komodo_paxfinds(uint256 txid,uint16_t vout)
     return(0);
 }
 
+/*
+ * The unmarked deposits ('D' and 'A') of each base and withdraws ('W') in height order, kept as
+ * entries are created and marked so the miner doesn't iterate and sort all of PAX for each block.
+ * Entries are also changed in place by komodo_opreturn, those moved or marked since they were
+ * queued are requeued when the pending entries are read. All under komodo_mutex.
+ */
+typedef std::pair<int32_t,std::string> komodo_paxqueue_key; // height, then the key bytes of the entry
+typedef std::map<komodo_paxqueue_key,struct pax_transaction *> komodo_paxqueue;
+static std::map<std::string,komodo_paxqueue> PAX_DEPOSITQUEUES;
+static komodo_paxqueue PAX_WITHDRAWQUEUE;
+static std::map<struct pax_transaction *,std::pair<komodo_paxqueue *,komodo_paxqueue_key> > PAX_QUEUED;
+
+static komodo_paxqueue *komodo_paxqueue_get(struct pax_transaction *pax)
+{
+    if ( pax->marked != 0 )
+        return(0);
+    else if ( pax->type == 'W' )
+        return(&PAX_WITHDRAWQUEUE);
+    else if ( pax->type == 'D' || pax->type == 'A' )
+        return(&PAX_DEPOSITQUEUES[pax->symbol]);
+    return(0);
+}
+
+static komodo_paxqueue_key komodo_paxqueue_keyget(struct pax_transaction *pax)
+{
+    return(komodo_paxqueue_key(pax->height,std::string((char *)pax->buf,sizeof(pax->buf))));
+}
+
+static bool komodo_paxqueue_current(struct pax_transaction *pax,const std::pair<komodo_paxqueue *,komodo_paxqueue_key> &queued)
+{
+    return(pax->marked == 0 && queued.first == komodo_paxqueue_get(pax) && queued.second == komodo_paxqueue_keyget(pax));
+}
+
+static void komodo_paxqueue_update(struct pax_transaction *pax)
+{
+    std::map<struct pax_transaction *,std::pair<komodo_paxqueue *,komodo_paxqueue_key> >::iterator it; komodo_paxqueue *queue;
+    if ( (it= PAX_QUEUED.find(pax)) != PAX_QUEUED.end() )
+    {
+        if ( komodo_paxqueue_current(pax,it->second) )
+            return;
+        it->second.first->erase(it->second.second);
+        PAX_QUEUED.erase(it);
+    }
+    if ( (queue= komodo_paxqueue_get(pax)) != 0 )
+    {
+        komodo_paxqueue_key key = komodo_paxqueue_keyget(pax);
+        (*queue)[key] = pax;
+        PAX_QUEUED[pax] = std::make_pair(queue,key);
+    }
+}
+
+// the pending withdraws, or deposits of base (of every base if it is null), entries are never freed
+static void komodo_paxqueue_pending(std::vector<struct pax_transaction *> &paxes,uint8_t type,const char *base)
+{
+    std::map<struct pax_transaction *,std::pair<komodo_paxqueue *,komodo_paxqueue_key> >::iterator it; std::map<std::string,komodo_paxqueue>::iterator qit;
+    std::vector<struct pax_transaction *> changed; std::map<komodo_paxqueue_key,struct pax_transaction *> merged; int32_t i;
+    paxes.clear();
+    pthread_mutex_lock(&komodo_mutex);
+    for (it=PAX_QUEUED.begin(); it!=PAX_QUEUED.end(); it++)
+        if ( komodo_paxqueue_current(it->first,it->second) == 0 )
+            changed.push_back(it->first);
+    for (i=0; i<changed.size(); i++)
+        komodo_paxqueue_update(changed[i]);
+    if ( type == 'W' )
+    {
+        for (komodo_paxqueue::iterator pit=PAX_WITHDRAWQUEUE.begin(); pit!=PAX_WITHDRAWQUEUE.end(); pit++)
+            paxes.push_back(pit->second);
+    }
+    else
+    {
+        for (qit=PAX_DEPOSITQUEUES.begin(); qit!=PAX_DEPOSITQUEUES.end(); qit++)
+            if ( base == 0 || qit->first == base )
+                merged.insert(qit->second.begin(),qit->second.end());
+        for (komodo_paxqueue::iterator pit=merged.begin(); pit!=merged.end(); pit++)
+            paxes.push_back(pit->second);
+    }
+    pthread_mutex_unlock(&komodo_mutex);
+}
+
 struct pax_transaction *komodo_paxmark(int32_t height,uint256 txid,uint16_t vout,uint8_t type,int32_t mark)
 {
     struct pax_transaction *pax; uint8_t buf[35];
@@ -101,6 +188,7 @@ struct pax_transaction *komodo_paxmark(int32_t height,uint256 txid,uint16_t vout
     if ( pax != 0 )
     {
         pax->marked = mark;
+        komodo_paxqueue_update(pax);
         //if ( height > 214700 || pax->height > 214700 )
         //    printf("mark ht.%d %.8f %.8f\n",pax->height,dstr(pax->komodoshis),dstr(pax->fiatoshis));
 
@@ -144,7 +232,6 @@ void komodo_gateway_deposit(char *coinaddr,uint64_t value,char *symbol,uint64_t
             printf(" v.%d [%s] kht.%d ht.%d create pax.%p symbol.%s source.%s\n",vout,ASSETCHAINS_SYMBOL,height,otherheight,pax,symbol,source);
         }
     }
-    pthread_mutex_unlock(&komodo_mutex);
     if ( coinaddr != 0 )
     {
         strcpy(pax->coinaddr,coinaddr);
@@ -168,6 +255,8 @@ void komodo_gateway_deposit(char *coinaddr,uint64_t value,char *symbol,uint64_t
         pax->marked = height;
         //printf("pax.%p MARK DEPOSIT ht.%d other.%d\n",pax,height,otherheight);
     }
+    komodo_paxqueue_update(pax);
+    pthread_mutex_unlock(&komodo_mutex);
 }
 
 int32_t komodo_rwapproval(int32_t rwflag,uint8_t *opretbuf,struct pax_transaction *pax)
@@ -411,33 +500,18 @@ uint64_t komodo_paxtotal()
     return(total);
 }
 
-static int _paxorder(const void *a,const void *b)
-{
-#define pax_a (*(struct pax_transaction **)a)
-#define pax_b (*(struct pax_transaction **)b)
-    uint64_t aval,bval;
-    aval = pax_a->fiatoshis + pax_a->komodoshis + pax_a->height;
-    bval = pax_b->fiatoshis + pax_b->komodoshis + pax_b->height;
-	if ( bval > aval )
-		return(-1);
-	else if ( bval < aval )
-		return(1);
-	return(0);
-#undef pax_a
-#undef pax_b
-}
-
-int32_t komodo_pending_withdraws(char *opretstr) // todo: enforce deterministic order
+int32_t komodo_pending_withdraws(char *opretstr) // in height order
 {
-    struct pax_transaction *pax,*pax2,*tmp,*paxes[64]; uint8_t opretbuf[16384*4]; int32_t i,n,ht,len=0; uint64_t total = 0;
+    struct pax_transaction *pax,*pax2,*paxes[64]; uint8_t opretbuf[16384*4]; int32_t i,n,ht,len=0; uint64_t total = 0; std::vector<struct pax_transaction *> pending;
     if ( KOMODO_PAX == 0 || KOMODO_PASSPORT_INITDONE == 0 )
         return(0);
     if ( komodo_isrealtime(&ht) == 0 || ASSETCHAINS_SYMBOL[0] != 0 )
         return(0);
     n = 0;
-    HASH_ITER(hh,PAX,pax,tmp)
+    komodo_paxqueue_pending(pending,'W',0);
+    for (i=0; i<pending.size(); i++)
     {
-        if ( pax->type == 'W' )
+        pax = pending[i];
         {
             if ( (pax2= komodo_paxfind(pax->txid,pax->vout,'A')) != 0 )
             {
@@ -463,7 +537,6 @@ int32_t komodo_pending_withdraws(char *opretstr) // todo: enforce deterministic
     if ( n > 0 )
     {
         opretbuf[len++] = 'A';
-        qsort(paxes,n,sizeof(*paxes),_paxorder);
         for (i=0; i<n; i++)
         {
             if ( len < (sizeof(opretbuf)>>3)*7 )
@@ -478,7 +551,7 @@ int32_t komodo_pending_withdraws(char *opretstr) // todo: enforce deterministic
 
 int32_t komodo_gateway_deposits(CMutableTransaction *txNew,char *base,int32_t tokomodo)
 {
-    struct pax_transaction *pax,*tmp; char symbol[KOMODO_ASSETCHAIN_MAXLEN],dest[KOMODO_ASSETCHAIN_MAXLEN]; uint8_t *script,opcode,opret[16384*4],data[16384*4]; int32_t i,baseid,ht,len=0,opretlen=0,numvouts=1; struct komodo_state *sp; uint64_t available,deposited,issued,withdrawn,approved,redeemed,mask,sum = 0;
+    struct pax_transaction *pax; std::vector<struct pax_transaction *> pending; char symbol[KOMODO_ASSETCHAIN_MAXLEN],dest[KOMODO_ASSETCHAIN_MAXLEN]; uint8_t *script,opcode,opret[16384*4],data[16384*4]; int32_t i,baseid,ht,len=0,opretlen=0,numvouts=1; struct komodo_state *sp; uint64_t available,deposited,issued,withdrawn,approved,redeemed,mask,sum = 0;
     if ( KOMODO_PASSPORT_INITDONE == 0 )//KOMODO_PAX == 0 ||
         return(0);
     struct komodo_state *kmdsp = komodo_stateptrget((char *)"KMD");
@@ -509,10 +582,10 @@ int32_t komodo_gateway_deposits(CMutableTransaction *txNew,char *base,int32_t to
         if ( 1 || komodo_paxtotal() == 0 )
             return(0);
     }
-    HASH_ITER(hh,PAX,pax,tmp)
+    komodo_paxqueue_pending(pending,'D',ASSETCHAINS_SYMBOL[0] != 0 ? symbol : 0);
+    for (int32_t p=0; p<pending.size(); p++)
     {
-        if ( pax->type != 'D' && pax->type != 'A' )
-            continue;
+        pax = pending[p];
         {
 #ifdef KOMODO_ASSETCHAINS_WAITNOTARIZE
             if ( pax->height > 236000 )
@@ -548,7 +621,10 @@ int32_t komodo_gateway_deposits(CMutableTransaction *txNew,char *base,int32_t to
         {
             if ( strcmp(pax->symbol,ASSETCHAINS_SYMBOL) == 0 )
                 printf("pax->symbol.%s != %s or null pax->validated %.8f ready.%d ht.(%d %d)\n",pax->symbol,symbol,dstr(pax->validated),pax->ready,kmdsp->CURRENT_HEIGHT,pax->height);
+            pthread_mutex_lock(&komodo_mutex);
             pax->marked = pax->height;
+            komodo_paxqueue_update(pax);
+            pthread_mutex_unlock(&komodo_mutex);
             continue;
         }
         if ( pax->ready == 0 )
@@ -856,7 +932,7 @@ const char *komodo_opreturn(int32_t height,uint64_t value,uint8_t *opretbuf,int3
     tokomodo = (komodo_is_issuer() == 0);
     if ( opretbuf[0] == 'K' && opretlen != 40 )
     {
-        komodo_kvupdate(opretbuf,opretlen,value);
+        // applied to the KV index by komodo_kvconnect, so the komodostate replay doesn't redo them
         return("kv");
     }
     else if ( ASSETCHAINS_SYMBOL[0] == 0 && KOMODO_PAX == 0 )
@@ -1371,12 +1447,31 @@ long komodo_indfile_update(FILE *indfp,uint32_t *prevpos100p,long lastfpos,long
 
 int32_t komodo_faststateinit(struct komodo_state *sp,char *fname,char *symbol,char *dest)
 {
-    FILE *indfp; char indfname[1024]; uint8_t *filedata; long validated=-1,datalen,fpos,lastfpos; uint32_t tmp,prevpos100,indcounter,starttime; int32_t func,finished = 0;
+    FILE *indfp; char indfname[1024]; uint8_t *filedata; long validated=-1,datalen,fpos,lastfpos,indsize; uint32_t tmp,prevpos100,indcounter,starttime; int32_t func,finished = 0;
     starttime = (uint32_t)time(NULL);
     safecopy(indfname,fname,sizeof(indfname)-4);
     strcat(indfname,".ind");
-    if ( (filedata= OS_fileptr(&datalen,fname)) != 0 )
+    // replay straight from a read-only mapping of the file instead of a copy of it in memory
+    std::shared_ptr<const CMappedFile> mapped = MapFileReadOnly(fname);
+    if ( mapped != 0 )
     {
+        filedata = (uint8_t *)mapped->data();
+        datalen = (long)mapped->size();
+    } else filedata = OS_fileptr(&datalen,fname);
+    if ( filedata != 0 )
+    {
+        // the index of the last run has an entry per record, so the events can be allocated up front
+        if ( sp != 0 && ASSETCHAINS_SYMBOL[0] != 0 && (indfp= fopen(indfname,"rb")) != 0 )
+        {
+            fseek(indfp,0,SEEK_END);
+            if ( (indsize= ftell(indfp)) > 0 && indsize/sizeof(uint32_t) < INT32_MAX )
+            {
+                portable_mutex_lock(&komodo_mutex);
+                komodo_events_reserve(sp,(int32_t)(indsize / sizeof(uint32_t)));
+                portable_mutex_unlock(&komodo_mutex);
+            }
+            fclose(indfp);
+        }
         if ( 1 )//datalen >= (1LL << 32) || GetArg("-genind",0) != 0 || (validated= komodo_stateind_validate(0,indfname,filedata,datalen,&prevpos100,&indcounter,symbol,dest)) < 0 )
         {
             lastfpos = fpos = 0;
@@ -1427,7 +1522,8 @@ int32_t komodo_faststateinit(struct komodo_state *sp,char *fname,char *symbol,ch
                 }
             }
         } else printf("komodo_faststateinit unexpected case\n");
-        free(filedata);
+        if ( mapped == 0 )
+            free(filedata);
         return(finished == 1);
     }
     return(-1);
@@ -1616,18 +1712,33 @@ struct komodo_priceinfo
 {
     FILE *fp;
     char symbol[64];
+    std::mutex mutex; // of fp, so the readers of different prices don't wait on each other
 } PRICES[KOMODO_MAXPRICES];
 
-uint32_t PriceCache[KOMODO_LOCALPRICE_CACHESIZE][KOMODO_MAXPRICES];//4+sizeof(Cryptos)/sizeof(*Cryptos)+sizeof(Forex)/sizeof(*Forex)];
+// The local prices of the last KOMODO_LOCALPRICE_CACHESIZE updates, from the most recent one at PriceCacheHead, with a
+// spare row the next update is built in before it is published, so the readers see the rows of an update without a lock
+uint32_t PriceCacheRing[KOMODO_LOCALPRICE_CACHESIZE+1][KOMODO_MAXPRICES];//4+sizeof(Cryptos)/sizeof(*Cryptos)+sizeof(Forex)/sizeof(*Forex)];
+std::atomic<int32_t> PriceCacheHead(0);
 int64_t PriceMult[KOMODO_MAXPRICES];
 int32_t komodo_cbopretsize(uint64_t flags);
 
-void komodo_PriceCache_shift()
+// the prices of the j-th most recent update as of head, j == -1 is the one being built
+uint32_t *komodo_PriceCache(int32_t head,int32_t j)
 {
-    int32_t i;
-    for (i=KOMODO_LOCALPRICE_CACHESIZE-1; i>0; i--)
-        memcpy(PriceCache[i],PriceCache[i-1],sizeof(PriceCache[i]));
-    memcpy(PriceCache[0],Mineropret.data(),Mineropret.size());
+    return(PriceCacheRing[(head + j + KOMODO_LOCALPRICE_CACHESIZE+1) % (KOMODO_LOCALPRICE_CACHESIZE+1)]);
+}
+
+// starts the next update from the current prices, komodo_PriceCache_publish makes it the most recent
+uint32_t *komodo_PriceCache_shift()
+{
+    uint32_t *next = komodo_PriceCache(PriceCacheHead.load(),-1);
+    memcpy(next,Mineropret.data(),Mineropret.size());
+    return(next);
+}
+
+void komodo_PriceCache_publish()
+{
+    PriceCacheHead.store((PriceCacheHead.load() + KOMODO_LOCALPRICE_CACHESIZE) % (KOMODO_LOCALPRICE_CACHESIZE+1));
 }
 
 int32_t _komodo_heightpricebits(uint64_t *seedp,uint32_t *heightbits,CBlock *block)
@@ -1867,6 +1978,7 @@ int32_t komodo_opretvalidate(const CBlock *block,CBlockIndex * const previndex,i
                             if ( localbits[i] == 0 )
                                 localbits[i] = prevbits[i];
                     }
+                    int32_t pricehead = PriceCacheHead.load();
                     for (iter=0; iter<2; iter++) // first iter should just refresh prices if out of tolerance
                     {
                         for (i=1; i<n; i++)
@@ -1881,9 +1993,9 @@ int32_t komodo_opretvalidate(const CBlock *block,CBlockIndex * const previndex,i
                                         break;
                                     // second iteration checks recent prices to see if within local volatility
                                     for (j=0; j<KOMODO_LOCALPRICE_CACHESIZE; j++)
-                                        if ( PriceCache[j][i] >= prevbits[i] )
+                                        if ( komodo_PriceCache(pricehead,j)[i] >= prevbits[i] )
                                         {
-                                            fprintf(stderr,"i.%d within recent localprices[%d] %u >= %u\n",i,j,PriceCache[j][i],prevbits[i]);
+                                            fprintf(stderr,"i.%d within recent localprices[%d] %u >= %u\n",i,j,komodo_PriceCache(pricehead,j)[i],prevbits[i]);
                                             break;
                                         }
                                     if ( j == KOMODO_LOCALPRICE_CACHESIZE )
@@ -1897,9 +2009,9 @@ int32_t komodo_opretvalidate(const CBlock *block,CBlockIndex * const previndex,i
                                     if ( iter == 0 )
                                         break;
                                     for (j=0; j<KOMODO_LOCALPRICE_CACHESIZE; j++)
-                                        if ( PriceCache[j][i] <= prevbits[i] )
+                                        if ( komodo_PriceCache(pricehead,j)[i] <= prevbits[i] )
                                         {
-                                            fprintf(stderr,"i.%d within recent localprices[%d] %u <= prev %u\n",i,j,PriceCache[j][i],prevbits[i]);
+                                            fprintf(stderr,"i.%d within recent localprices[%d] %u <= prev %u\n",i,j,komodo_PriceCache(pricehead,j)[i],prevbits[i]);
                                             break;
                                         }
                                     if ( j == KOMODO_LOCALPRICE_CACHESIZE )
@@ -2251,7 +2363,7 @@ void komodo_cbopretupdate(int32_t forceflag)
 {
     static uint32_t lasttime,lastbtc,pending;
     static uint32_t pricebits[4],pricebuf[KOMODO_MAXPRICES],forexprices[sizeof(Forex)/sizeof(*Forex)];
-    int32_t size; uint32_t flags=0,now; CBlockIndex *pindex;
+    int32_t size; uint32_t flags=0,now,*nextprices=0,*prices; CBlockIndex *pindex;
     if ( Queued_reconsiderblock != zeroid )
     {
         fprintf(stderr,"Queued_reconsiderblock %s\n",Queued_reconsiderblock.GetHex().c_str());
@@ -2277,8 +2389,8 @@ void komodo_cbopretupdate(int32_t forceflag)
         if ( (forceflag != 0 || now > lastbtc+120) && get_btcusd(pricebits) == 0 )
         {
             if ( flags == 0 )
-                komodo_PriceCache_shift();
-            memcpy(PriceCache[0],pricebits,PRICES_SIZEBIT0);
+                nextprices = komodo_PriceCache_shift();
+            memcpy(nextprices,pricebits,PRICES_SIZEBIT0);
             flags |= 1;
         }
         if ( (ASSETCHAINS_CBOPRET & 2) != 0 )
@@ -2287,9 +2399,9 @@ void komodo_cbopretupdate(int32_t forceflag)
             {
                 get_dailyfx(forexprices);
                 if ( flags == 0 )
-                    komodo_PriceCache_shift();
+                    nextprices = komodo_PriceCache_shift();
                 flags |= 2;
-                memcpy(&PriceCache[0][size/sizeof(uint32_t)],forexprices,sizeof(forexprices));
+                memcpy(&nextprices[size/sizeof(uint32_t)],forexprices,sizeof(forexprices));
             }
             size += (sizeof(Forex)/sizeof(*Forex)) * sizeof(uint32_t);
         }
@@ -2299,8 +2411,8 @@ void komodo_cbopretupdate(int32_t forceflag)
             {
                 get_cryptoprices(pricebuf,Cryptos,(int32_t)(sizeof(Cryptos)/sizeof(*Cryptos)),ASSETCHAINS_PRICES);
                 if ( flags == 0 )
-                    komodo_PriceCache_shift();
-                memcpy(&PriceCache[0][size/sizeof(uint32_t)],pricebuf,(sizeof(Cryptos)/sizeof(*Cryptos)+ASSETCHAINS_PRICES.size()) * sizeof(uint32_t));
+                    nextprices = komodo_PriceCache_shift();
+                memcpy(&nextprices[size/sizeof(uint32_t)],pricebuf,(sizeof(Cryptos)/sizeof(*Cryptos)+ASSETCHAINS_PRICES.size()) * sizeof(uint32_t));
                 flags |= 4; // very rarely we can see flags == 6 case
             }
             size += (sizeof(Cryptos)/sizeof(*Cryptos)+ASSETCHAINS_PRICES.size()) * sizeof(uint32_t);
@@ -2313,8 +2425,8 @@ void komodo_cbopretupdate(int32_t forceflag)
                 if ( get_stockprices(now,pricebuf,ASSETCHAINS_STOCKS) == ASSETCHAINS_STOCKS.size() )
                 {
                     if ( flags == 0 )
-                        komodo_PriceCache_shift();
-                    memcpy(&PriceCache[0][size/sizeof(uint32_t)],pricebuf,ASSETCHAINS_STOCKS.size() * sizeof(uint32_t));
+                        nextprices = komodo_PriceCache_shift();
+                    memcpy(&nextprices[size/sizeof(uint32_t)],pricebuf,ASSETCHAINS_STOCKS.size() * sizeof(uint32_t));
                     flags |= 8; // very rarely we can see flags == 10 case
                 }
             }
@@ -2326,13 +2438,15 @@ void komodo_cbopretupdate(int32_t forceflag)
                 lastbtc = now;
             if ( (flags & 2) != 0 )
                 lasttime = now;
-            memcpy(Mineropret.data(),PriceCache[0],size);
+            komodo_PriceCache_publish();
+            prices = komodo_PriceCache(PriceCacheHead.load(),0);
+            memcpy(Mineropret.data(),prices,size);
             if ( ExtremePrice.dir != 0 && ExtremePrice.ind > 0 && ExtremePrice.ind < size/sizeof(uint32_t) && now < ExtremePrice.timestamp+3600 )
             {
-                fprintf(stderr,"cmp dir.%d PriceCache[0][ExtremePrice.ind] %u >= %u ExtremePrice.pricebits\n",ExtremePrice.dir,PriceCache[0][ExtremePrice.ind],ExtremePrice.pricebits);
-                if ( (ExtremePrice.dir > 0 && PriceCache[0][ExtremePrice.ind] >= ExtremePrice.pricebits) || (ExtremePrice.dir < 0 && PriceCache[0][ExtremePrice.ind] <= ExtremePrice.pricebits) )
+                fprintf(stderr,"cmp dir.%d PriceCache[0][ExtremePrice.ind] %u >= %u ExtremePrice.pricebits\n",ExtremePrice.dir,prices[ExtremePrice.ind],ExtremePrice.pricebits);
+                if ( (ExtremePrice.dir > 0 && prices[ExtremePrice.ind] >= ExtremePrice.pricebits) || (ExtremePrice.dir < 0 && prices[ExtremePrice.ind] <= ExtremePrice.pricebits) )
                 {
-                    fprintf(stderr,"future price is close enough to allow approving previously rejected block ind.%d %u vs %u\n",ExtremePrice.ind,PriceCache[0][ExtremePrice.ind],ExtremePrice.pricebits);
+                    fprintf(stderr,"future price is close enough to allow approving previously rejected block ind.%d %u vs %u\n",ExtremePrice.ind,prices[ExtremePrice.ind],ExtremePrice.pricebits);
                     if ( (pindex= komodo_blockindex(ExtremePrice.blockhash)) != 0 )
                         pindex->nStatus &= ~BLOCK_FAILED_MASK;
                     else fprintf(stderr,"couldnt find block.%s\n",ExtremePrice.blockhash.GetHex().c_str());
@@ -2748,26 +2862,97 @@ int32_t komodo_pricesinit()
     return(0);
 }
 
-pthread_mutex_t pricemutex;
-
 // PRICES file layouts
 // [0] rawprice32 / timestamp
 // [1] correlated
 // [2] 24hr ave
 // [3] to [7] reserved
 
+void prices_cacheinvalidate(int32_t height);
+
+// The raw prices and correlated prices komodo_pricesupdate wrote for the last rows heights, at height % rows, so the
+// day before each block is read from memory. A row is read back from the files when it isn't the height asked for.
+struct komodo_pricewindow
+{
+    int32_t rows,numprices;
+    std::vector<int32_t> rawheights,corrheights;
+    std::vector<uint32_t> rawprices;
+    std::vector<int64_t> correlated;
+};
+
+void komodo_pricewindow_init(struct komodo_pricewindow &window,int32_t rows,int32_t numprices)
+{
+    window.rows = rows;
+    window.numprices = numprices;
+    window.rawheights.assign(rows,-1);
+    window.rawprices.assign(rows * numprices,0);
+    window.corrheights.assign(rows * numprices,-1);
+    window.correlated.assign(rows * numprices,0);
+}
+
+// the raw prices of the width heights up to height, in height order
+int32_t komodo_pricewindow_raw(struct komodo_pricewindow &window,uint32_t *ptr32,int32_t height,int32_t width)
+{
+    int32_t h,row,n = window.numprices;
+    for (h=height-width+1; h<=height; h++)
+        if ( window.rawheights[h % window.rows] != h )
+            break;
+    if ( h <= height )
+    {
+        std::lock_guard<std::mutex> lock(PRICES[0].mutex);
+        fseek(PRICES[0].fp,(height-width+1) * n * sizeof(uint32_t),SEEK_SET);
+        if ( fread(ptr32,sizeof(uint32_t),width*n,PRICES[0].fp) != width*n )
+            return(-1);
+        for (h=height-width+1; h<=height; h++)
+        {
+            row = h % window.rows;
+            memcpy(&window.rawprices[row * n],&ptr32[(h-(height-width+1)) * n],n * sizeof(uint32_t));
+            window.rawheights[row] = h;
+        }
+        return(0);
+    }
+    for (h=height-width+1; h<=height; h++)
+        memcpy(&ptr32[(h-(height-width+1)) * n],&window.rawprices[(h % window.rows) * n],n * sizeof(uint32_t));
+    return(0);
+}
+
+// the correlated prices of ind for the width heights up to height, in height order, ptr64 holds width rows of its file
+int32_t komodo_pricewindow_correlated(struct komodo_pricewindow &window,int64_t *corr64,int64_t *ptr64,int32_t ind,int32_t height,int32_t width)
+{
+    int32_t h,k,n = window.numprices;
+    for (h=height-width+1; h<=height; h++)
+        if ( window.corrheights[(h % window.rows) * n + ind] != h )
+            break;
+    if ( h <= height )
+    {
+        std::lock_guard<std::mutex> lock(PRICES[ind].mutex);
+        fseek(PRICES[ind].fp,(height-width+1) * PRICES_MAXDATAPOINTS * sizeof(int64_t),SEEK_SET);
+        if ( fread(ptr64,sizeof(int64_t),width*PRICES_MAXDATAPOINTS,PRICES[ind].fp) != width*PRICES_MAXDATAPOINTS )
+            return(-1);
+        for (h=height-width+1,k=0; h<=height; h++,k++)
+        {
+            window.correlated[(h % window.rows) * n + ind] = ptr64[k*PRICES_MAXDATAPOINTS + 1];
+            window.corrheights[(h % window.rows) * n + ind] = h;
+        }
+    }
+    for (h=height-width+1,k=0; h<=height; h++,k++)
+        corr64[k] = window.correlated[(h % window.rows) * n + ind];
+    return(0);
+}
+
 void komodo_pricesupdate(int32_t height,CBlock *pblock)
 {
-    static int numprices; static uint32_t *ptr32; static int64_t *ptr64,*tmpbuf;
-    int32_t ind,offset,width; int64_t correlated,smoothed; uint64_t seed,rngval; uint32_t rawprices[KOMODO_MAXPRICES],buf[PRICES_MAXDATAPOINTS*2];
+    static int numprices; static uint32_t *ptr32; static int64_t *ptr64,*tmpbuf,*corr64; static struct komodo_pricewindow window;
+    int32_t ind,offset,width,row,written; int64_t correlated,smoothed; uint64_t seed,rngval; uint32_t rawprices[KOMODO_MAXPRICES],buf[PRICES_MAXDATAPOINTS*2];
     width = PRICES_DAYWINDOW;//(2*PRICES_DAYWINDOW + PRICES_SMOOTHWIDTH);
     if ( numprices == 0 )
     {
-        pthread_mutex_init(&pricemutex,0);
         numprices = (int32_t)(komodo_cbopretsize(ASSETCHAINS_CBOPRET) / sizeof(uint32_t));
         ptr32 = (uint32_t *)calloc(sizeof(uint32_t),numprices * width);
         ptr64 = (int64_t *)calloc(sizeof(int64_t),PRICES_DAYWINDOW*PRICES_MAXDATAPOINTS);
         tmpbuf = (int64_t *)calloc(sizeof(int64_t),2*PRICES_DAYWINDOW);
+        corr64 = (int64_t *)calloc(sizeof(int64_t),PRICES_DAYWINDOW);
+        komodo_pricewindow_init(window,width,numprices);
         fprintf(stderr,"prices update: numprices.%d %p %p\n",numprices,ptr32,ptr64);
     }
     if ( _komodo_heightpricebits(&seed,rawprices,pblock) == numprices )
@@ -2777,15 +2962,19 @@ void komodo_pricesupdate(int32_t height,CBlock *pblock)
         //fprintf(stderr,"numprices.%d\n",numprices);
         if ( PRICES[0].fp != 0 )
         {
-            pthread_mutex_lock(&pricemutex);
-            fseek(PRICES[0].fp,height * numprices * sizeof(uint32_t),SEEK_SET);
-            if ( fwrite(rawprices,sizeof(uint32_t),numprices,PRICES[0].fp) != numprices )
-                fprintf(stderr,"error writing rawprices for ht.%d\n",height);
-            else fflush(PRICES[0].fp);
+            row = height % width;
+            {
+                std::lock_guard<std::mutex> lock(PRICES[0].mutex);
+                fseek(PRICES[0].fp,height * numprices * sizeof(uint32_t),SEEK_SET);
+                if ( (written= (fwrite(rawprices,sizeof(uint32_t),numprices,PRICES[0].fp) == numprices)) == 0 )
+                    fprintf(stderr,"error writing rawprices for ht.%d\n",height);
+                else fflush(PRICES[0].fp);
+            }
+            memcpy(&window.rawprices[row * numprices],rawprices,numprices * sizeof(uint32_t));
+            window.rawheights[row] = written != 0 ? height : -1;
             if ( height > PRICES_DAYWINDOW )
             {
-                fseek(PRICES[0].fp,(height-width+1) * numprices * sizeof(uint32_t),SEEK_SET);
-                if ( fread(ptr32,sizeof(uint32_t),width*numprices,PRICES[0].fp) == width*numprices )
+                if ( komodo_pricewindow_raw(window,ptr32,height,width) == 0 )
                 {
                     rngval = seed;
                     for (ind=1; ind<numprices; ind++)
@@ -2799,20 +2988,26 @@ void komodo_pricesupdate(int32_t height,CBlock *pblock)
                         rngval = (rngval*11109 + 13849);
                         if ( (correlated= komodo_pricecorrelated(rngval,ind,&ptr32[offset],-numprices,0,PRICES_SMOOTHWIDTH)) > 0 )
                         {
-                            fseek(PRICES[ind].fp,height * sizeof(int64_t) * PRICES_MAXDATAPOINTS,SEEK_SET);
                             memset(buf,0,sizeof(buf));
                             buf[0] = rawprices[ind];
                             buf[1] = rawprices[0]; // timestamp
                             memcpy(&buf[2],&correlated,sizeof(correlated));
-                            if ( fwrite(buf,1,sizeof(buf),PRICES[ind].fp) != sizeof(buf) )
+                            {
+                                std::lock_guard<std::mutex> lock(PRICES[ind].mutex);
+                                fseek(PRICES[ind].fp,height * sizeof(int64_t) * PRICES_MAXDATAPOINTS,SEEK_SET);
+                                written = (fwrite(buf,1,sizeof(buf),PRICES[ind].fp) == sizeof(buf));
+                            }
+                            window.correlated[row * numprices + ind] = correlated;
+                            window.corrheights[row * numprices + ind] = written != 0 ? height : -1;
+                            if ( written == 0 )
                                 fprintf(stderr,"error fwrite buf for ht.%d ind.%d\n",height,ind);
                             else if ( height > PRICES_DAYWINDOW*2 )
                             {
-                                fseek(PRICES[ind].fp,(height-PRICES_DAYWINDOW+1) * PRICES_MAXDATAPOINTS * sizeof(int64_t),SEEK_SET);
-                                if ( fread(ptr64,sizeof(int64_t),PRICES_DAYWINDOW*PRICES_MAXDATAPOINTS,PRICES[ind].fp) == PRICES_DAYWINDOW*PRICES_MAXDATAPOINTS )
+                                if ( komodo_pricewindow_correlated(window,corr64,ptr64,ind,height,PRICES_DAYWINDOW) == 0 )
                                 {
-                                    if ( (smoothed= komodo_priceave(tmpbuf,&ptr64[(PRICES_DAYWINDOW-1)*PRICES_MAXDATAPOINTS+1],-PRICES_MAXDATAPOINTS)) > 0 )
+                                    if ( (smoothed= komodo_priceave(tmpbuf,&corr64[PRICES_DAYWINDOW-1],-1)) > 0 )
                                     {
+                                        std::lock_guard<std::mutex> lock(PRICES[ind].mutex);
                                         fseek(PRICES[ind].fp,(height * PRICES_MAXDATAPOINTS + 2) * sizeof(int64_t),SEEK_SET);
                                         if ( fwrite(&smoothed,1,sizeof(smoothed),PRICES[ind].fp) != sizeof(smoothed) )
                                             fprintf(stderr,"error fwrite smoothed for ht.%d ind.%d\n",height,ind);
@@ -2825,7 +3020,7 @@ void komodo_pricesupdate(int32_t height,CBlock *pblock)
                     fprintf(stderr,"height.%d\n",height);
                 } else fprintf(stderr,"error reading rawprices for ht.%d\n",height);
             } else fprintf(stderr,"height.%d <= width.%d\n",height,width);
-            pthread_mutex_unlock(&pricemutex);
+            prices_cacheinvalidate(height);
         } else fprintf(stderr,"null PRICES[0].fp\n");
     } else fprintf(stderr,"numprices mismatch, height.%d\n",height);
 }
@@ -2833,13 +3028,12 @@ void komodo_pricesupdate(int32_t height,CBlock *pblock)
 int32_t komodo_priceget(int64_t *buf64,int32_t ind,int32_t height,int32_t numblocks)
 {
     FILE *fp; int32_t retval = PRICES_MAXDATAPOINTS;
-    pthread_mutex_lock(&pricemutex);
     if ( ind < KOMODO_MAXPRICES && (fp= PRICES[ind].fp) != 0 )
     {
+        std::lock_guard<std::mutex> lock(PRICES[ind].mutex);
         fseek(fp,height * PRICES_MAXDATAPOINTS * sizeof(int64_t),SEEK_SET);
         if ( fread(buf64,sizeof(int64_t),numblocks*PRICES_MAXDATAPOINTS,fp) != numblocks*PRICES_MAXDATAPOINTS )
             retval = -1;
     }
-    pthread_mutex_unlock(&pricemutex);
     return(retval);
 }
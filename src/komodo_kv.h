@@ -17,6 +17,7 @@
 #define H_KOMODOKV_H
 
 #include "komodo_defs.h"
+#include "kvindex.h"
 
 int32_t komodo_kvcmp(uint8_t *refvalue,uint16_t refvaluesize,uint8_t *value,uint16_t valuesize)
 {
@@ -55,41 +56,19 @@ uint64_t komodo_kvfee(uint32_t flags,int32_t opretlen,int32_t keylen)
 
 int32_t komodo_kvsearch(uint256 *pubkeyp,int32_t current_height,uint32_t *flagsp,int32_t *heightp,uint8_t value[IGUANA_MAXSCRIPTSIZE],uint8_t *key,int32_t keylen)
 {
-    struct komodo_kv *ptr; int32_t duration,retval = -1;
+    CKVEntry entry; int32_t retval = -1;
     *heightp = -1;
     *flagsp = 0;
     memset(pubkeyp,0,sizeof(*pubkeyp));
-    portable_mutex_lock(&KOMODO_KV_mutex);
-    HASH_FIND(hh,KOMODO_KV,key,keylen,ptr);
-    if ( ptr != 0 )
+    // expired entries are only skipped, a reorg below their expiration brings them back
+    if ( kvIndex.Search(std::vector<unsigned char>(key,key+keylen),current_height,entry) )
     {
-        duration = komodo_kvduration(ptr->flags);
-        //fprintf(stderr,"duration.%d flags.%d current.%d ht.%d keylen.%d valuesize.%d\n",duration,ptr->flags,current_height,ptr->height,ptr->keylen,ptr->valuesize);
-        if ( current_height > (ptr->height + duration) )
-        {
-            HASH_DELETE(hh,KOMODO_KV,ptr);
-            if ( ptr->value != 0 )
-                free(ptr->value);
-            if ( ptr->key != 0 )
-                free(ptr->key);
-            free(ptr);
-        }
-        else
-        {
-            *heightp = ptr->height;
-            *flagsp = ptr->flags;
-            int32_t i; for (i=0; i<32; i++)
-            {
-                //printf("%02x",((uint8_t *)&ptr->pubkey)[31-i]);
-                ((uint8_t *)pubkeyp)[i] = ((uint8_t *)&ptr->pubkey)[31-i];
-            }
-            //printf(" ptr->pubkey\n");
-            memcpy(pubkeyp,&ptr->pubkey,sizeof(*pubkeyp));
-            if ( (retval= ptr->valuesize) > 0 )
-                memcpy(value,ptr->value,retval);
-        }
+        *heightp = entry.nHeight;
+        *flagsp = entry.nFlags;
+        memcpy(pubkeyp,&entry.pubkey,sizeof(*pubkeyp));
+        if ( (retval= (int32_t)entry.vchValue.size()) > 0 )
+            memcpy(value,entry.vchValue.data(),retval);
     } //else fprintf(stderr,"couldnt find (%s)\n",(char *)key);
-    portable_mutex_unlock(&KOMODO_KV_mutex);
     if ( retval < 0 )
     {
         // search rawmempool
@@ -100,7 +79,7 @@ int32_t komodo_kvsearch(uint256 *pubkeyp,int32_t current_height,uint32_t *flagsp
 void komodo_kvupdate(uint8_t *opretbuf,int32_t opretlen,uint64_t value)
 {
     static uint256 zeroes;
-    uint32_t flags; uint256 pubkey,refpubkey,sig; int32_t i,refvaluesize,hassig,coresize,haspubkey,height,kvheight; uint16_t keylen,valuesize,newflag = 0; uint8_t *key,*valueptr,keyvalue[IGUANA_MAXSCRIPTSIZE*8]; struct komodo_kv *ptr; char *transferpubstr,*tstr; uint64_t fee;
+    uint32_t flags; uint256 pubkey,refpubkey,sig; int32_t i,refvaluesize,hassig,coresize,haspubkey,height,kvheight; uint16_t keylen,valuesize,newflag = 0; uint8_t *key,*valueptr,keyvalue[IGUANA_MAXSCRIPTSIZE*8]; CKVEntry entry; bool found; char *transferpubstr,*tstr; uint64_t fee;
     if ( ASSETCHAINS_SYMBOL[0] == 0 ) // disable KV for KMD
         return;
     iguana_rwnum(0,&opretbuf[1],sizeof(keylen),&keylen);
@@ -147,12 +126,10 @@ void komodo_kvupdate(uint8_t *opretbuf,int32_t opretlen,uint64_t value)
                     }
                 }
             }
-            portable_mutex_lock(&KOMODO_KV_mutex);
-            HASH_FIND(hh,KOMODO_KV,key,keylen,ptr);
-            if ( ptr != 0 )
+            if ( (found= kvIndex.Search(std::vector<unsigned char>(key,key+keylen),height,entry)) )
             {
                 //fprintf(stderr,"(%s) already there\n",(char *)key);
-                //if ( (ptr->flags & KOMODO_KVPROTECTED) != 0 )
+                //if ( (entry.nFlags & KOMODO_KVPROTECTED) != 0 )
                 {
                     tstr = (char *)"transfer:";
                     transferpubstr = (char *)&valueptr[strlen(tstr)];
@@ -164,38 +141,64 @@ void komodo_kvupdate(uint8_t *opretbuf,int32_t opretlen,uint64_t value)
                     }
                 }
             }
-            else if ( ptr == 0 )
+            else
             {
-                ptr = (struct komodo_kv *)calloc(1,sizeof(*ptr));
-                ptr->key = (uint8_t *)calloc(1,keylen);
-                ptr->keylen = keylen;
-                memcpy(ptr->key,key,keylen);
                 newflag = 1;
-                HASH_ADD_KEYPTR(hh,KOMODO_KV,ptr->key,ptr->keylen,ptr);
-                //fprintf(stderr,"KV add.(%s) (%s)\n",ptr->key,valueptr);
+                //fprintf(stderr,"KV add.(%s) (%s)\n",key,valueptr);
             }
-            if ( newflag != 0 || (ptr->flags & KOMODO_KVPROTECTED) == 0 )
-            {
-                if ( ptr->value != 0 )
-                    free(ptr->value), ptr->value = 0;
-                if ( (ptr->valuesize= valuesize) != 0 )
-                {
-                    ptr->value = (uint8_t *)calloc(1,valuesize);
-                    memcpy(ptr->value,valueptr,valuesize);
-                }
-            } else fprintf(stderr,"newflag.%d zero or protected %d\n",newflag,(ptr->flags & KOMODO_KVPROTECTED));
+            if ( newflag != 0 || (entry.nFlags & KOMODO_KVPROTECTED) == 0 )
+                entry.vchValue.assign(valueptr,valueptr+valuesize);
+            else fprintf(stderr,"newflag.%d zero or protected %d\n",newflag,(entry.nFlags & KOMODO_KVPROTECTED));
             /*for (i=0; i<32; i++)
-                printf("%02x",((uint8_t *)&ptr->pubkey)[i]);
+                printf("%02x",((uint8_t *)&entry.pubkey)[i]);
             printf(" <- ");
             for (i=0; i<32; i++)
                 printf("%02x",((uint8_t *)&pubkey)[i]);
             printf(" new pubkey\n");*/
-            memcpy(&ptr->pubkey,&pubkey,sizeof(ptr->pubkey));
-            ptr->height = height;
-            ptr->flags = flags; // jl777 used to or in KVPROTECTED
-            portable_mutex_unlock(&KOMODO_KV_mutex);
+            memcpy(&entry.pubkey,&pubkey,sizeof(entry.pubkey));
+            entry.nHeight = height;
+            entry.nFlags = flags; // jl777 used to or in KVPROTECTED
+            // written with the block's other updates by komodo_kvconnect
+            kvIndex.Update(std::vector<unsigned char>(key,key+keylen),entry);
         } else fprintf(stderr,"KV update size mismatch %d vs %d\n",opretlen,coresize);
     } else fprintf(stderr,"not enough fee\n");
 }
 
+// applies the 'K' opreturns of a block connected to the tip, komodo_opreturn leaves them to this
+bool komodo_kvconnect(CBlockIndex *pindex,const CBlock& block)
+{
+    int32_t i,j,len,opretlen; const uint8_t *script;
+    if ( ASSETCHAINS_SYMBOL[0] != 0 )
+    {
+        for (i=0; i<block.vtx.size(); i++)
+        {
+            for (j=0; j<block.vtx[i].vout.size(); j++)
+            {
+                const CScript &scriptPubKey = block.vtx[i].vout[j].scriptPubKey;
+                if ( scriptPubKey.size() < sizeof(uint32_t) || scriptPubKey.size() > 10001 || scriptPubKey[0] != 0x6a )
+                    continue;
+                // same push decoding as komodo_voutupdate
+                script = &scriptPubKey[0];
+                len = 1;
+                if ( (opretlen= script[len++]) == 0x4c )
+                    opretlen = script[len++];
+                else if ( opretlen == 0x4d )
+                {
+                    opretlen = script[len++];
+                    opretlen += (script[len++] << 8);
+                }
+                if ( opretlen < 13 || len+opretlen > scriptPubKey.size() || script[len] != 'K' || opretlen == 40 )
+                    continue;
+                komodo_kvupdate((uint8_t *)&script[len],opretlen,(uint64_t)block.vtx[i].vout[j].nValue);
+            }
+        }
+    }
+    return(kvIndex.ConnectBlock(pindex));
+}
+
+bool komodo_kvdisconnect(CBlockIndex *pindex)
+{
+    return(kvIndex.DisconnectBlock(pindex));
+}
+
 #endif
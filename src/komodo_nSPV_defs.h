@@ -17,10 +17,20 @@
 #ifndef KOMODO_NSPV_DEFSH
 #define KOMODO_NSPV_DEFSH
 
-#define NSPV_PROTOCOL_VERSION 0x00000004
+#define NSPV_PROTOCOL_VERSION 0x00000005
+#define NSPV_PIPELINE_VERSION 0x00000005 // first version answering NSPV_REQID envelopes
 #define NSPV_POLLITERS 200
 #define NSPV_POLLMICROS 50000
 #define NSPV_MAXVINS 64
+#define NSPV_MAXINFLIGHT 16 // pipelined requests outstanding per peer
+#define NSPV_MAXREQSPERSEC 64 // pipelined requests a full node answers per peer and second
+#define NSPV_REQTIMEOUT (3 * 1000000) // micros before a pipelined request is sent to another peer
+#define NSPV_MAXATTEMPTS 3
+#define NSPV_CACHE_NTZS 1024
+#define NSPV_CACHE_NTZSPROOFS 256
+#define NSPV_CACHE_TXPROOFS 1024
+#define NSPV_CACHE_UTXOS 64
+#define NSPV_CACHE_VALIDATED 4096
 #define NSPV_AUTOLOGOUT 777
 #define NSPV_BRANCHID 0x76b809bb
 
@@ -54,6 +64,8 @@
 #define NSPV_CC_TXIDS 16
 #define NSPV_REMOTERPC 0x14
 #define NSPV_REMOTERPCRESP 0x15
+#define NSPV_REQID 0x16 // [NSPV_REQID] [uint32 reqid] [request], answered with the response in the same envelope
+#define NSPV_REQIDRESP 0x17
 
 int32_t NSPV_gettransaction(int32_t skipvalidation,int32_t vout,uint256 txid,int32_t height,CTransaction &tx,uint256 &hashblock,int32_t &txheight,int32_t &currentheight,int64_t extradata,uint32_t tiptime,int64_t &rewardsum);
 UniValue NSPV_spend(char *srcaddr,char *destaddr,int64_t satoshis);
@@ -20,6 +20,7 @@
 // NSPV_get... functions need to return the exact serialized length, which is the size of the structure minus size of pointers, plus size of allocated data
 
 #include "notarisationdb.h"
+#include "nspvcache.h"
 #include "rpc/server.h"
 
 static std::map<std::string,bool> nspv_remote_commands =  {{"channelsopen", true},{"channelspayment", true},{"channelsclose", true},{"channelsrefund", true},
@@ -123,7 +124,10 @@ int32_t NSPV_setequihdr(struct NSPV_equihdr *hdr,int32_t height)
         hdr->nTime = pindex->nTime;
         hdr->nBits = pindex->nBits;
         hdr->nNonce = pindex->nNonce;
-        memcpy(hdr->nSolution,&pindex->nSolution[0],sizeof(hdr->nSolution));
+        std::vector<unsigned char> solution = pindex->GetSolution();
+        if ( solution.size() != sizeof(hdr->nSolution) )
+            return(-1);
+        memcpy(hdr->nSolution,&solution[0],sizeof(hdr->nSolution));
         return(sizeof(*hdr));
     }
     return(-1);
@@ -485,7 +489,7 @@ int32_t NSPV_getaddresstxids(struct NSPV_txidsresp *ptr,char *coinaddr,bool isCC
 
 int32_t NSPV_mempoolfuncs(bits256 *satoshisp,int32_t *vindexp,std::vector<uint256> &txids,char *coinaddr,bool isCC,uint8_t funcid,uint256 txid,int32_t vout)
 {
-    int32_t num = 0,vini = 0,vouti = 0; uint8_t evalcode=0,func=0;  std::vector<uint8_t> vopret; char destaddr[64];
+    int32_t num = 0; uint8_t evalcode=0,func=0;  std::vector<uint8_t> vopret;
     *vindexp = -1;
     memset(satoshisp,0,sizeof(*satoshisp));
     if ( funcid == NSPV_CC_TXIDS)
@@ -546,77 +550,66 @@ int32_t NSPV_mempoolfuncs(bits256 *satoshisp,int32_t *vindexp,std::vector<uint25
         isCC = true;
         evalcode = vout & 0xff;
         func = (vout >> 8) & 0xff;
-    }
-    LOCK(mempool.cs);
-    BOOST_FOREACH(const CTxMemPoolEntry &e,mempool.mapTx)
-    {
-        const CTransaction &tx = e.GetTx();
-        const uint256 &hash = tx.GetHash();
-        if ( funcid == NSPV_MEMPOOL_ALL )
-        {
-            txids.push_back(hash);
-            num++;
-            continue;
-        }
-        else if ( funcid == NSPV_MEMPOOL_INMEMPOOL )
+        // the mempool keeps the CC transactions by evalcode and funcid, only the opreturn of the tx itself counts here
+        std::vector<CTransaction> evaltxs;
+        mempool.getCCEvalTxs(evalcode,func,evaltxs);
+        for (std::vector<CTransaction>::const_iterator it=evaltxs.begin(); it!=evaltxs.end(); it++)
         {
-            if ( hash == txid )
+            if ( it->vout.size() > 1 && GetOpReturnData(it->vout[it->vout.size()-1].scriptPubKey,vopret) != 0 && vopret.size() > 1 && vopret[0] == evalcode && vopret[1] == func )
             {
-                txids.push_back(hash);
-                return(++num);
+                txids.push_back(it->GetHash());
+                num++;
             }
-            continue;
         }
-        else if ( funcid == NSPV_MEMPOOL_CCEVALCODE )
+        return(num);
+    }
+    else if ( funcid == NSPV_MEMPOOL_ADDRESS )
+    {
+        std::vector<std::pair<COutPoint,CTxOut> > outputs; uint160 hashBytes; int type;
+        if ( CBitcoinAddress(coinaddr).GetIndexKey(hashBytes,type,isCC) == 0 )
+            return(0);
+        mempool.getAddressOutputs(hashBytes,outputs);
+        for (std::vector<std::pair<COutPoint,CTxOut> >::const_iterator it=outputs.begin(); it!=outputs.end(); it++)
         {
-            if ( tx.vout.size() > 1 )
+            if ( it->second.scriptPubKey.IsPayToCryptoCondition() == isCC )
             {
-                CScript scriptPubKey = tx.vout[tx.vout.size()-1].scriptPubKey;
-                if ( GetOpReturnData(scriptPubKey,vopret) != 0 )
-                {
-                    if ( vopret[0] == evalcode && vopret[1] == func )
-                    {
-                        txids.push_back(hash);
-                        num++;
-                    }
-                }
+                txids.push_back(it->first.hash);
+                *vindexp = it->first.n;
+                if ( num < 4 )
+                    satoshisp->ulongs[num] = it->second.nValue;
+                num++;
             }
-            continue;
         }
-        if ( funcid == NSPV_MEMPOOL_ISSPENT )
+        return(num);
+    }
+    LOCK(mempool.cs);
+    if ( funcid == NSPV_MEMPOOL_INMEMPOOL )
+    {
+        if ( mempool.mapTx.count(txid) != 0 )
         {
-            BOOST_FOREACH(const CTxIn &txin,tx.vin)
-            {
-                //fprintf(stderr,"%s/v%d ",uint256_str(str,txin.prevout.hash),txin.prevout.n);
-                if ( txin.prevout.n == vout && txin.prevout.hash == txid )
-                {
-                    txids.push_back(hash);
-                    *vindexp = vini;
-                    return(++num);
-                }
-                vini++;
-            }
+            txids.push_back(txid);
+            num++;
         }
-        else if ( funcid == NSPV_MEMPOOL_ADDRESS )
+        return(num);
+    }
+    else if ( funcid == NSPV_MEMPOOL_ISSPENT )
+    {
+        CTxMemPool::nextTxMap::const_iterator it = mempool.mapNextTx.find(COutPoint(txid,vout));
+        if ( it != mempool.mapNextTx.end() )
         {
-            BOOST_FOREACH(const CTxOut &txout,tx.vout)
-            {
-                if ( txout.scriptPubKey.IsPayToCryptoCondition() == isCC )
-                {
-                    Getscriptaddress(destaddr,txout.scriptPubKey);
-                    if ( strcmp(destaddr,coinaddr) == 0 )
-                    {
-                        txids.push_back(hash);
-                        *vindexp = vouti;
-                        if ( num < 4 )
-                            satoshisp->ulongs[num] = txout.nValue;
-                        num++;
-                    }
-                }
-                vouti++;
-            }
+            txids.push_back(it->second.ptx->GetHash());
+            *vindexp = it->second.n;
+            num++;
+        }
+        return(num);
+    }
+    else if ( funcid == NSPV_MEMPOOL_ALL )
+    {
+        BOOST_FOREACH(const CTxMemPoolEntry &e,mempool.mapTx)
+        {
+            txids.push_back(e.GetTx().GetHash());
+            num++;
         }
-        //fprintf(stderr,"are vins for %s\n",uint256_str(str,hash));
     }
     return(num);
 }
@@ -870,19 +863,72 @@ int32_t NSPV_getspentinfo(struct NSPV_spentinfo *ptr,uint256 txid,int32_t vout)
     return(len);
 }
 
+// answers to these only depend on the chain, mempool, spent info and broadcast results can change without a new tip
+static bool NSPV_iscacheable(uint8_t reqtype)
+{
+    return reqtype == NSPV_INFO || reqtype == NSPV_UTXOS || reqtype == NSPV_TXIDS || reqtype == NSPV_NTZS ||
+        reqtype == NSPV_NTZSPROOF || reqtype == NSPV_TXPROOF || reqtype == NSPV_CCMODULEUTXOS;
+}
+
+// responses to requests with an id go back in the same envelope, so the client can match them with its request
+static void NSPV_sendresp(CNode *pfrom,uint32_t reqid,std::vector<uint8_t> &response)
+{
+    if ( reqid == 0 )
+        pfrom->PushMessage("nSPV",response);
+    else
+    {
+        std::vector<uint8_t> envelope(1 + sizeof(reqid) + response.size());
+        envelope[0] = NSPV_REQIDRESP;
+        iguana_rwnum(1,&envelope[1],sizeof(reqid),&reqid);
+        memcpy(&envelope[1 + sizeof(reqid)],&response[0],response.size());
+        pfrom->PushMessage("nSPV",envelope);
+    }
+}
+
 void komodo_nSPVreq(CNode *pfrom,std::vector<uint8_t> request) // received a request
 {
     int32_t len,slen,ind,reqheight,n; std::vector<uint8_t> response; uint32_t timestamp = (uint32_t)time(NULL);
-    if ( (len= request.size()) > 0 )
+    bool cacheable,pipelined; uint64_t cachegeneration; uint32_t reqid = 0;
+    if ( (len= request.size()) > 0 && request[0] == NSPV_REQID )
+    {
+        // pipelined requests are not limited to one of each type per second, but to NSPV_MAXREQSPERSEC in total
+        if ( len <= 1+sizeof(reqid) || request[1+sizeof(reqid)] == NSPV_REQID )
+            return;
+        if ( pfrom->nNSPVReqSecond != timestamp )
+        {
+            pfrom->nNSPVReqSecond = timestamp;
+            pfrom->nNSPVReqCount = 0;
+        }
+        if ( ++pfrom->nNSPVReqCount > NSPV_MAXREQSPERSEC )
+            return;
+        iguana_rwnum(0,&request[1],sizeof(reqid),&reqid);
+        request.erase(request.begin(),request.begin() + 1 + sizeof(reqid));
+        len = request.size();
+    }
+    if ( len > 0 )
     {
         if ( (ind= request[0]>>1) >= sizeof(pfrom->prevtimes)/sizeof(*pfrom->prevtimes) )
             ind = (int32_t)(sizeof(pfrom->prevtimes)/sizeof(*pfrom->prevtimes)) - 1;
         if ( pfrom->prevtimes[ind] > timestamp )
             pfrom->prevtimes[ind] = 0;
+        // only the chain queries can be pipelined, mempool, broadcast and remote rpc keep their limit
+        cacheable = NSPV_iscacheable(request[0]);
+        pipelined = reqid != 0 && cacheable;
+        if ( cacheable != 0 && ( pipelined != 0 || timestamp > pfrom->prevtimes[ind] ) )
+        {
+            if ( nspvResponseCache.Lookup(request,response) )
+            {
+                NSPV_sendresp(pfrom,reqid,response);
+                pfrom->prevtimes[ind] = timestamp;
+                return;
+            }
+        }
+        // read before computing, so a tip change meanwhile keeps the response out of the cache
+        cachegeneration = nspvResponseCache.GetGeneration();
         if ( request[0] == NSPV_INFO ) // info
         {
             //fprintf(stderr,"check info %u vs %u, ind.%d\n",timestamp,pfrom->prevtimes[ind],ind);
-            if ( timestamp > pfrom->prevtimes[ind] )
+            if ( ( pipelined != 0 || timestamp > pfrom->prevtimes[ind] ) )
             {
                 struct NSPV_inforesp I;
                 if ( len == 1+sizeof(reqheight) )
@@ -898,7 +944,7 @@ void komodo_nSPVreq(CNode *pfrom,std::vector<uint8_t> request) // received a req
                     if ( NSPV_rwinforesp(1,&response[1],&I) == slen )
                     {
                         //fprintf(stderr,"send info resp to id %d\n",(int32_t)pfrom->id);
-                        pfrom->PushMessage("nSPV",response);
+                        NSPV_sendresp(pfrom,reqid,response);
                         pfrom->prevtimes[ind] = timestamp;
                     }
                     NSPV_inforesp_purge(&I);
@@ -908,7 +954,7 @@ void komodo_nSPVreq(CNode *pfrom,std::vector<uint8_t> request) // received a req
         else if ( request[0] == NSPV_UTXOS )
         {
             //fprintf(stderr,"utxos: %u > %u, ind.%d, len.%d\n",timestamp,pfrom->prevtimes[ind],ind,len);
-            if ( timestamp > pfrom->prevtimes[ind] )
+            if ( ( pipelined != 0 || timestamp > pfrom->prevtimes[ind] ) )
             {
                 struct NSPV_utxosresp U;
                 if ( len < 64+5 && (request[1] == len-3 || request[1] == len-7 || request[1] == len-11) )
@@ -938,7 +984,7 @@ void komodo_nSPVreq(CNode *pfrom,std::vector<uint8_t> request) // received a req
                         response[0] = NSPV_UTXOSRESP;
                         if ( NSPV_rwutxosresp(1,&response[1],&U) == slen )
                         {
-                            pfrom->PushMessage("nSPV",response);
+                            NSPV_sendresp(pfrom,reqid,response);
                             pfrom->prevtimes[ind] = timestamp;
                         }
                         NSPV_utxosresp_purge(&U);
@@ -948,7 +994,7 @@ void komodo_nSPVreq(CNode *pfrom,std::vector<uint8_t> request) // received a req
         }
         else if ( request[0] == NSPV_TXIDS )
         {
-            if ( timestamp > pfrom->prevtimes[ind] )
+            if ( ( pipelined != 0 || timestamp > pfrom->prevtimes[ind] ) )
             {
                 struct NSPV_txidsresp T;
                 if ( len < 64+5 && (request[1] == len-3 || request[1] == len-7 || request[1] == len-11) )
@@ -979,7 +1025,7 @@ void komodo_nSPVreq(CNode *pfrom,std::vector<uint8_t> request) // received a req
                         response[0] = NSPV_TXIDSRESP;
                         if ( NSPV_rwtxidsresp(1,&response[1],&T) == slen )
                         {
-                            pfrom->PushMessage("nSPV",response);
+                            NSPV_sendresp(pfrom,reqid,response);
                             pfrom->prevtimes[ind] = timestamp;
                         }
                         NSPV_txidsresp_purge(&T);
@@ -989,7 +1035,7 @@ void komodo_nSPVreq(CNode *pfrom,std::vector<uint8_t> request) // received a req
         }
         else if ( request[0] == NSPV_MEMPOOL )
         {
-            if ( timestamp > pfrom->prevtimes[ind] )
+            if ( ( pipelined != 0 || timestamp > pfrom->prevtimes[ind] ) )
             {
                 struct NSPV_mempoolresp M; char coinaddr[64];
                 if ( len < sizeof(M)+64 )
@@ -1015,7 +1061,7 @@ void komodo_nSPVreq(CNode *pfrom,std::vector<uint8_t> request) // received a req
                             response[0] = NSPV_MEMPOOLRESP;
                             if ( NSPV_rwmempoolresp(1,&response[1],&M) == slen )
                             {
-                                pfrom->PushMessage("nSPV",response);
+                                NSPV_sendresp(pfrom,reqid,response);
                                 pfrom->prevtimes[ind] = timestamp;
                             }
                             NSPV_mempoolresp_purge(&M);
@@ -1026,7 +1072,7 @@ void komodo_nSPVreq(CNode *pfrom,std::vector<uint8_t> request) // received a req
         }
         else if ( request[0] == NSPV_NTZS )
         {
-            if ( timestamp > pfrom->prevtimes[ind] )
+            if ( ( pipelined != 0 || timestamp > pfrom->prevtimes[ind] ) )
             {
                 struct NSPV_ntzsresp N; int32_t height;
                 if ( len == 1+sizeof(height) )
@@ -1039,7 +1085,7 @@ void komodo_nSPVreq(CNode *pfrom,std::vector<uint8_t> request) // received a req
                         response[0] = NSPV_NTZSRESP;
                         if ( NSPV_rwntzsresp(1,&response[1],&N) == slen )
                         {
-                            pfrom->PushMessage("nSPV",response);
+                            NSPV_sendresp(pfrom,reqid,response);
                             pfrom->prevtimes[ind] = timestamp;
                         }
                         NSPV_ntzsresp_purge(&N);
@@ -1049,7 +1095,7 @@ void komodo_nSPVreq(CNode *pfrom,std::vector<uint8_t> request) // received a req
         }
         else if ( request[0] == NSPV_NTZSPROOF )
         {
-            if ( timestamp > pfrom->prevtimes[ind] )
+            if ( ( pipelined != 0 || timestamp > pfrom->prevtimes[ind] ) )
             {
                 struct NSPV_ntzsproofresp P; uint256 prevntz,nextntz;
                 if ( len == 1+sizeof(prevntz)+sizeof(nextntz) )
@@ -1064,7 +1110,7 @@ void komodo_nSPVreq(CNode *pfrom,std::vector<uint8_t> request) // received a req
                         response[0] = NSPV_NTZSPROOFRESP;
                         if ( NSPV_rwntzsproofresp(1,&response[1],&P) == slen )
                         {
-                            pfrom->PushMessage("nSPV",response);
+                            NSPV_sendresp(pfrom,reqid,response);
                             pfrom->prevtimes[ind] = timestamp;
                         }
                         NSPV_ntzsproofresp_purge(&P);
@@ -1074,7 +1120,7 @@ void komodo_nSPVreq(CNode *pfrom,std::vector<uint8_t> request) // received a req
         }
         else if ( request[0] == NSPV_TXPROOF )
         {
-            if ( timestamp > pfrom->prevtimes[ind] )
+            if ( ( pipelined != 0 || timestamp > pfrom->prevtimes[ind] ) )
             {
                 struct NSPV_txproof P; uint256 txid; int32_t height,vout;
                 if ( len == 1+sizeof(txid)+sizeof(height)+sizeof(vout) )
@@ -1092,7 +1138,7 @@ void komodo_nSPVreq(CNode *pfrom,std::vector<uint8_t> request) // received a req
                         if ( NSPV_rwtxproof(1,&response[1],&P) == slen )
                         {
                             //fprintf(stderr,"send response\n");
-                            pfrom->PushMessage("nSPV",response);
+                            NSPV_sendresp(pfrom,reqid,response);
                             pfrom->prevtimes[ind] = timestamp;
                         }
                         NSPV_txproof_purge(&P);
@@ -1102,7 +1148,7 @@ void komodo_nSPVreq(CNode *pfrom,std::vector<uint8_t> request) // received a req
         }
         else if ( request[0] == NSPV_SPENTINFO )
         {
-            if ( timestamp > pfrom->prevtimes[ind] )
+            if ( ( pipelined != 0 || timestamp > pfrom->prevtimes[ind] ) )
             {
                 struct NSPV_spentinfo S; int32_t vout; uint256 txid;
                 if ( len == 1+sizeof(txid)+sizeof(vout) )
@@ -1116,7 +1162,7 @@ void komodo_nSPVreq(CNode *pfrom,std::vector<uint8_t> request) // received a req
                         response[0] = NSPV_SPENTINFORESP;
                         if ( NSPV_rwspentinfo(1,&response[1],&S) == slen )
                         {
-                            pfrom->PushMessage("nSPV",response);
+                            NSPV_sendresp(pfrom,reqid,response);
                             pfrom->prevtimes[ind] = timestamp;
                         }
                         NSPV_spentinfo_purge(&S);
@@ -1126,7 +1172,7 @@ void komodo_nSPVreq(CNode *pfrom,std::vector<uint8_t> request) // received a req
         }
         else if ( request[0] == NSPV_BROADCAST )
         {
-            if ( timestamp > pfrom->prevtimes[ind] )
+            if ( ( pipelined != 0 || timestamp > pfrom->prevtimes[ind] ) )
             {
                 struct NSPV_broadcastresp B; uint32_t n,offset; uint256 txid;
                 if ( len > 1+sizeof(txid)+sizeof(n) )
@@ -1141,7 +1187,7 @@ void komodo_nSPVreq(CNode *pfrom,std::vector<uint8_t> request) // received a req
                         response[0] = NSPV_BROADCASTRESP;
                         if ( NSPV_rwbroadcastresp(1,&response[1],&B) == slen )
                         {
-                            pfrom->PushMessage("nSPV",response);
+                            NSPV_sendresp(pfrom,reqid,response);
                             pfrom->prevtimes[ind] = timestamp;
                         }
                         NSPV_broadcast_purge(&B);
@@ -1151,7 +1197,7 @@ void komodo_nSPVreq(CNode *pfrom,std::vector<uint8_t> request) // received a req
         }
         else if ( request[0] == NSPV_REMOTERPC )
         {
-            if ( timestamp > pfrom->prevtimes[ind] )
+            if ( ( pipelined != 0 || timestamp > pfrom->prevtimes[ind] ) )
             {
                 struct NSPV_remoterpcresp R; int32_t p;
                 p = 1;
@@ -1162,7 +1208,7 @@ void komodo_nSPVreq(CNode *pfrom,std::vector<uint8_t> request) // received a req
                     response.resize(1 + slen);
                     response[0] = NSPV_REMOTERPCRESP;
                     NSPV_rwremoterpcresp(1,&response[1],&R,slen);
-                    pfrom->PushMessage("nSPV",response);
+                    NSPV_sendresp(pfrom,reqid,response);
                     pfrom->prevtimes[ind] = timestamp;
                     NSPV_remoterpc_purge(&R);
                 }                
@@ -1171,7 +1217,7 @@ void komodo_nSPVreq(CNode *pfrom,std::vector<uint8_t> request) // received a req
         else if (request[0] == NSPV_CCMODULEUTXOS)  // get cc module utxos from coinaddr for the requested amount, evalcode, funcid list and txid
         {
             //fprintf(stderr,"utxos: %u > %u, ind.%d, len.%d\n",timestamp,pfrom->prevtimes[ind],ind,len);
-            if (timestamp > pfrom->prevtimes[ind])
+            if ( pipelined != 0 || timestamp > pfrom->prevtimes[ind] )
             {
                 struct NSPV_utxosresp U;
                 char coinaddr[64];
@@ -1216,7 +1262,7 @@ void komodo_nSPVreq(CNode *pfrom,std::vector<uint8_t> request) // received a req
                                 response[0] = NSPV_CCMODULEUTXOSRESP;
                                 if (NSPV_rwutxosresp(1, &response[1], &U) == slen)
                                 {
-                                    pfrom->PushMessage("nSPV", response);
+                                    NSPV_sendresp(pfrom,reqid,response);
                                     pfrom->prevtimes[ind] = timestamp;
                                     std::cerr << __func__ << " " << "returned nSPV response" << std::endl;
                                 }
@@ -1227,6 +1273,8 @@ void komodo_nSPVreq(CNode *pfrom,std::vector<uint8_t> request) // received a req
                 }
             }
         }
+        if ( cacheable != 0 && response.size() > 0 && pfrom->prevtimes[ind] == timestamp )
+            nspvResponseCache.Store(request,response,cachegeneration);
     }
 }
 
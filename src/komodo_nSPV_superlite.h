@@ -39,101 +39,323 @@ struct NSPV_ntzsproofresp NSPV_ntzsproofresult;
 struct NSPV_txproof NSPV_txproofresult;
 struct NSPV_broadcastresp NSPV_broadcastresult;
 
-struct NSPV_ntzsresp NSPV_ntzsresp_cache[NSPV_MAXVINS];
-struct NSPV_ntzsproofresp NSPV_ntzsproofresp_cache[NSPV_MAXVINS * 2];
-struct NSPV_txproof NSPV_txproof_cache[NSPV_MAXVINS * 4];
+// hash indexed caches of the responses, the least recently used entries are purged when they are full.
+// pointers returned stay valid until the entry is evicted, as callers copy what they need right away
+
+template <typename K,typename T>
+class NSPV_lrucache
+{
+    typedef std::list<K> lru_t;
+    typedef std::map<K,std::pair<T,typename lru_t::iterator> > map_t;
+    map_t entries;
+    lru_t lru; // most recently used first
+    size_t maxentries;
+    void (*purgefn)(T *);
+    void (*copyfn)(T *,T *);
+public:
+    NSPV_lrucache(size_t maxentriesIn,void (*purgefnIn)(T *),void (*copyfnIn)(T *,T *)) : maxentries(maxentriesIn),purgefn(purgefnIn),copyfn(copyfnIn) {}
+
+    T *find(const K &key)
+    {
+        typename map_t::iterator it = entries.find(key);
+        if ( it == entries.end() )
+            return(0);
+        lru.splice(lru.begin(),lru,it->second.second);
+        return(&it->second.first);
+    }
+
+    T *add(const K &key,T *ptr)
+    {
+        typename map_t::iterator it = entries.find(key);
+        if ( it == entries.end() )
+        {
+            while ( entries.size() >= maxentries && lru.size() > 0 )
+            {
+                typename map_t::iterator oldest = entries.find(lru.back());
+                purgefn(&oldest->second.first);
+                entries.erase(oldest);
+                lru.pop_back();
+            }
+            T empty;
+            memset(&empty,0,sizeof(empty));
+            lru.push_front(key);
+            it = entries.insert(std::make_pair(key,std::make_pair(empty,lru.begin()))).first;
+        }
+        else
+        {
+            purgefn(&it->second.first);
+            lru.splice(lru.begin(),lru,it->second.second);
+        }
+        copyfn(&it->second.first,ptr);
+        return(&it->second.first);
+    }
+
+    void clear()
+    {
+        for (typename map_t::iterator it=entries.begin(); it!=entries.end(); it++)
+            purgefn(&it->second.first);
+        entries.clear();
+        lru.clear();
+    }
+
+    std::vector<T *> values()
+    {
+        std::vector<T *> ptrs;
+        for (typename map_t::iterator it=entries.begin(); it!=entries.end(); it++)
+            ptrs.push_back(&it->second.first);
+        return(ptrs);
+    }
+};
+
+CCriticalSection cs_NSPV; // the caches and the pending requests, responses arrive on the message handler thread
+NSPV_lrucache<int32_t,struct NSPV_ntzsresp> NSPV_ntzsresp_cache(NSPV_CACHE_NTZS,NSPV_ntzsresp_purge,NSPV_ntzsresp_copy);
+NSPV_lrucache<std::pair<uint256,uint256>,struct NSPV_ntzsproofresp> NSPV_ntzsproofresp_cache(NSPV_CACHE_NTZSPROOFS,NSPV_ntzsproofresp_purge,NSPV_ntzsproofresp_copy);
+NSPV_lrucache<uint256,struct NSPV_txproof> NSPV_txproof_cache(NSPV_CACHE_TXPROOFS,NSPV_txproof_purge,NSPV_txproof_copy);
 
 struct NSPV_ntzsresp *NSPV_ntzsresp_find(int32_t reqheight)
 {
-    int32_t i;
-    for (i=0; i<sizeof(NSPV_ntzsresp_cache)/sizeof(*NSPV_ntzsresp_cache); i++)
-        if ( NSPV_ntzsresp_cache[i].reqheight == reqheight )
-            return(&NSPV_ntzsresp_cache[i]);
-    return(0);
+    LOCK(cs_NSPV);
+    return(NSPV_ntzsresp_cache.find(reqheight));
 }
 
 struct NSPV_ntzsresp *NSPV_ntzsresp_add(struct NSPV_ntzsresp *ptr)
 {
-    int32_t i;
-    for (i=0; i<sizeof(NSPV_ntzsresp_cache)/sizeof(*NSPV_ntzsresp_cache); i++)
-        if ( NSPV_ntzsresp_cache[i].reqheight == 0 )
-            break;
-    if ( i == sizeof(NSPV_ntzsresp_cache)/sizeof(*NSPV_ntzsresp_cache) )
-        i = (rand() % (sizeof(NSPV_ntzsresp_cache)/sizeof(*NSPV_ntzsresp_cache)));
-    NSPV_ntzsresp_purge(&NSPV_ntzsresp_cache[i]);
-    NSPV_ntzsresp_copy(&NSPV_ntzsresp_cache[i],ptr);
+    LOCK(cs_NSPV);
     fprintf(stderr,"ADD CACHE ntzsresp req.%d\n",ptr->reqheight);
-    return(&NSPV_ntzsresp_cache[i]);
+    return(NSPV_ntzsresp_cache.add(ptr->reqheight,ptr));
 }
 
 struct NSPV_txproof *NSPV_txproof_find(uint256 txid)
 {
-    int32_t i; struct NSPV_txproof *backup = 0;
-    for (i=0; i<sizeof(NSPV_txproof_cache)/sizeof(*NSPV_txproof_cache); i++)
-        if ( NSPV_txproof_cache[i].txid == txid )
-        {
-            if ( NSPV_txproof_cache[i].txprooflen != 0 )
-                return(&NSPV_txproof_cache[i]);
-            else backup = &NSPV_txproof_cache[i];
-        }
-    return(backup);
+    LOCK(cs_NSPV);
+    return(NSPV_txproof_cache.find(txid));
 }
 
 struct NSPV_txproof *NSPV_txproof_add(struct NSPV_txproof *ptr)
 {
-    int32_t i;
-    for (i=0; i<sizeof(NSPV_txproof_cache)/sizeof(*NSPV_txproof_cache); i++)
-        if ( NSPV_txproof_cache[i].txid == ptr->txid )
-        {
-            if ( NSPV_txproof_cache[i].txprooflen == 0 && ptr->txprooflen != 0 )
-            {
-                NSPV_txproof_purge(&NSPV_txproof_cache[i]);
-                NSPV_txproof_copy(&NSPV_txproof_cache[i],ptr);
-                return(&NSPV_txproof_cache[i]);
-            }
-            else if ( NSPV_txproof_cache[i].txprooflen != 0 || ptr->txprooflen == 0 )
-                return(&NSPV_txproof_cache[i]);
-        }
-    for (i=0; i<sizeof(NSPV_txproof_cache)/sizeof(*NSPV_txproof_cache); i++)
-        if ( NSPV_txproof_cache[i].txlen == 0 )
-            break;
-    if ( i == sizeof(NSPV_txproof_cache)/sizeof(*NSPV_txproof_cache) )
-        i = (rand() % (sizeof(NSPV_txproof_cache)/sizeof(*NSPV_txproof_cache)));
-    NSPV_txproof_purge(&NSPV_txproof_cache[i]);
-    NSPV_txproof_copy(&NSPV_txproof_cache[i],ptr);
+    struct NSPV_txproof *cached;
+    LOCK(cs_NSPV);
+    // an entry without proof is only replaced by one with a proof
+    if ( (cached= NSPV_txproof_cache.find(ptr->txid)) != 0 && (cached->txprooflen != 0 || ptr->txprooflen == 0) )
+        return(cached);
     fprintf(stderr,"ADD CACHE txproof %s\n",ptr->txid.GetHex().c_str());
-    return(&NSPV_txproof_cache[i]);
+    return(NSPV_txproof_cache.add(ptr->txid,ptr));
 }
 
 struct NSPV_ntzsproofresp *NSPV_ntzsproof_find(uint256 prevtxid,uint256 nexttxid)
 {
-    int32_t i;
-    for (i=0; i<sizeof(NSPV_ntzsproofresp_cache)/sizeof(*NSPV_ntzsproofresp_cache); i++)
-        if ( NSPV_ntzsproofresp_cache[i].prevtxid == prevtxid && NSPV_ntzsproofresp_cache[i].nexttxid == nexttxid )
-            return(&NSPV_ntzsproofresp_cache[i]);
-    return(0);
+    LOCK(cs_NSPV);
+    return(NSPV_ntzsproofresp_cache.find(std::make_pair(prevtxid,nexttxid)));
 }
 
 struct NSPV_ntzsproofresp *NSPV_ntzsproof_add(struct NSPV_ntzsproofresp *ptr)
 {
-    int32_t i;
-    for (i=0; i<sizeof(NSPV_ntzsproofresp_cache)/sizeof(*NSPV_ntzsproofresp_cache); i++)
-        if ( NSPV_ntzsproofresp_cache[i].common.hdrs == 0 )
-            break;
-    if ( i == sizeof(NSPV_ntzsproofresp_cache)/sizeof(*NSPV_ntzsproofresp_cache) )
-        i = (rand() % (sizeof(NSPV_ntzsproofresp_cache)/sizeof(*NSPV_ntzsproofresp_cache)));
-    NSPV_ntzsproofresp_purge(&NSPV_ntzsproofresp_cache[i]);
-    NSPV_ntzsproofresp_copy(&NSPV_ntzsproofresp_cache[i],ptr);
+    LOCK(cs_NSPV);
     fprintf(stderr,"ADD CACHE ntzsproof %s %s\n",ptr->prevtxid.GetHex().c_str(),ptr->nexttxid.GetHex().c_str());
-    return(&NSPV_ntzsproofresp_cache[i]);
+    return(NSPV_ntzsproofresp_cache.add(std::make_pair(ptr->prevtxid,ptr->nexttxid),ptr));
+}
+
+// the utxos of an address as of the node height they were fetched at. they are used until a block or a notarization
+// arrives, the ones a broadcast tx spends are removed meanwhile
+
+NSPV_lrucache<std::string,struct NSPV_utxosresp> NSPV_utxosresp_cache(NSPV_CACHE_UTXOS,NSPV_utxosresp_purge,NSPV_utxosresp_copy);
+int32_t NSPV_utxosntzheight; // notarization the cached utxos were fetched under
+
+std::string NSPV_utxoskey(char *coinaddr,int32_t CCflag,int32_t skipcount,int32_t filter)
+{
+    char keystr[128];
+    snprintf(keystr,sizeof(keystr),"%s/%d/%d/%d",coinaddr,CCflag != 0,skipcount,filter);
+    return(std::string(keystr));
+}
+
+struct NSPV_utxosresp *NSPV_utxosresp_find(const std::string &key)
+{
+    struct NSPV_utxosresp *ptr;
+    LOCK(cs_NSPV);
+    if ( NSPV_inforesult.notarization.height != NSPV_utxosntzheight )
+    {
+        NSPV_utxosresp_cache.clear();
+        NSPV_utxosntzheight = NSPV_inforesult.notarization.height;
+    }
+    if ( NSPV_inforesult.height == 0 || (ptr= NSPV_utxosresp_cache.find(key)) == 0 || ptr->nodeheight < NSPV_inforesult.height )
+        return(0);
+    return(ptr);
+}
+
+struct NSPV_utxosresp *NSPV_utxosresp_add(const std::string &key,struct NSPV_utxosresp *ptr)
+{
+    LOCK(cs_NSPV);
+    return(NSPV_utxosresp_cache.add(key,ptr));
+}
+
+// drops the utxos spent by a broadcast tx from the cached lists, so the next spend does not select them again
+void NSPV_utxos_spend(struct NSPV_utxosresp *ptr,const CTransaction &tx)
+{
+    int32_t i,j;
+    for (i=0; i<ptr->numutxos; i++)
+    {
+        for (j=0; j<tx.vin.size(); j++)
+            if ( tx.vin[j].prevout.hash == ptr->utxos[i].txid && tx.vin[j].prevout.n == ptr->utxos[i].vout )
+                break;
+        if ( j == tx.vin.size() )
+            continue;
+        ptr->total -= ptr->utxos[i].satoshis;
+        ptr->interest -= ptr->utxos[i].extradata;
+        ptr->utxos[i--] = ptr->utxos[--ptr->numutxos];
+    }
+}
+
+void NSPV_utxosresp_spend(const CTransaction &tx)
+{
+    std::vector<struct NSPV_utxosresp *> ptrs; int32_t i;
+    LOCK(cs_NSPV);
+    ptrs = NSPV_utxosresp_cache.values();
+    for (i=0; i<ptrs.size(); i++)
+        NSPV_utxos_spend(ptrs[i],tx);
+    NSPV_utxos_spend(&NSPV_utxosresult,tx);
+}
+
+// the txproofs NSPV_gettransaction validated against the notarizations bracketing them. a notarized tx stays valid,
+// so they are kept across logouts and restarts, appended to a file in the datadir with a checksum each
+
+NSPV_lrucache<uint256,struct NSPV_txproof> NSPV_validated_cache(NSPV_CACHE_VALIDATED,NSPV_txproof_purge,NSPV_txproof_copy);
+bool NSPV_validated_loaded;
+
+std::string NSPV_validated_fname()
+{
+    return((GetDataDir() / "nspvvalidated").string());
+}
+
+int32_t NSPV_validated_write(FILE *fp,struct NSPV_txproof *ptr)
+{
+    std::vector<uint8_t> buf(sizeof(*ptr) + ptr->txlen + ptr->txprooflen + 64); int32_t len; uint256 checksum;
+    len = NSPV_rwtxproof(1,&buf[0],ptr);
+    checksum = Hash(buf.begin(),buf.begin() + len);
+    if ( fwrite(&len,1,sizeof(len),fp) != sizeof(len) || fwrite(&buf[0],1,len,fp) != len || fwrite(&checksum,1,sizeof(checksum),fp) != sizeof(checksum) )
+        return(-1);
+    return(0);
+}
+
+void NSPV_validated_load()
+{
+    FILE *fp; int32_t i,len,n = 0; std::vector<uint8_t> buf; uint256 checksum; struct NSPV_txproof P; std::vector<struct NSPV_txproof *> ptrs;
+    AssertLockHeld(cs_NSPV);
+    if ( NSPV_validated_loaded )
+        return;
+    NSPV_validated_loaded = true;
+    if ( (fp= fopen(NSPV_validated_fname().c_str(),"rb")) == 0 )
+        return;
+    while ( fread(&len,1,sizeof(len),fp) == sizeof(len) && len > 0 && len < 2*MAX_TX_SIZE_AFTER_SAPLING )
+    {
+        buf.resize(len);
+        if ( fread(&buf[0],1,len,fp) != len || fread(&checksum,1,sizeof(checksum),fp) != sizeof(checksum) || Hash(buf.begin(),buf.end()) != checksum )
+            break;
+        memset(&P,0,sizeof(P));
+        if ( NSPV_rwtxproof(0,&buf[0],&P) == len )
+            NSPV_validated_cache.add(P.txid,&P);
+        NSPV_txproof_purge(&P);
+        n++;
+    }
+    fclose(fp);
+    fprintf(stderr,"loaded %d of %d validated txproofs\n",(int32_t)NSPV_validated_cache.values().size(),n);
+    // the evicted and duplicate records are dropped once they outnumber the others
+    if ( n > 2*NSPV_CACHE_VALIDATED && (fp= fopen(NSPV_validated_fname().c_str(),"wb")) != 0 )
+    {
+        ptrs = NSPV_validated_cache.values();
+        for (i=0; i<ptrs.size(); i++)
+            if ( NSPV_validated_write(fp,ptrs[i]) < 0 )
+                break;
+        fclose(fp);
+    }
+}
+
+struct NSPV_txproof *NSPV_validated_find(uint256 txid)
+{
+    LOCK(cs_NSPV);
+    NSPV_validated_load();
+    return(NSPV_validated_cache.find(txid));
+}
+
+void NSPV_validated_add(struct NSPV_txproof *ptr)
+{
+    FILE *fp;
+    LOCK(cs_NSPV);
+    NSPV_validated_load();
+    if ( NSPV_validated_cache.find(ptr->txid) != 0 )
+        return;
+    NSPV_validated_cache.add(ptr->txid,ptr);
+    if ( (fp= fopen(NSPV_validated_fname().c_str(),"ab")) != 0 )
+    {
+        if ( NSPV_validated_write(fp,ptr) < 0 )
+            fprintf(stderr,"error writing validated txproof %s\n",ptr->txid.GetHex().c_str());
+        fclose(fp);
+    }
+}
+
+// pipelined requests: each gets an id and is matched with its response, by the id echoed in a NSPV_REQIDRESP
+// envelope, or by the key of the response contents for peers predating NSPV_PIPELINE_VERSION
+
+struct NSPV_pendingreq
+{
+    std::vector<uint8_t> request,key;
+    uint64_t mask;
+    NodeId peer;
+    int64_t senttime;
+    int32_t attempts;
+    bool done;
+};
+
+std::map<uint32_t,struct NSPV_pendingreq> NSPV_pendingreqs;
+uint32_t NSPV_lastreqid;
+
+std::vector<uint8_t> NSPV_respkey(uint8_t resptype,const uint8_t *serialized,int32_t len)
+{
+    std::vector<uint8_t> key(1 + len);
+    key[0] = resptype;
+    if ( len > 0 )
+        memcpy(&key[1],serialized,len);
+    return(key);
+}
+
+// the key of the response a request is answered with: its type and, for the proofs, what it is about
+std::vector<uint8_t> NSPV_reqkey(const std::vector<uint8_t> &request)
+{
+    if ( request[0] == NSPV_NTZS && request.size() == 1 + sizeof(int32_t) )
+        return(NSPV_respkey(NSPV_NTZSRESP,&request[1],sizeof(int32_t)));
+    else if ( request[0] == NSPV_NTZSPROOF && request.size() == 1 + 2*sizeof(uint256) )
+        return(NSPV_respkey(NSPV_NTZSPROOFRESP,&request[1],2*sizeof(uint256)));
+    else if ( request[0] == NSPV_TXPROOF && request.size() == 1 + 2*sizeof(int32_t) + sizeof(uint256) )
+        return(NSPV_respkey(NSPV_TXPROOFRESP,&request[1 + 2*sizeof(int32_t)],sizeof(uint256)));
+    return(NSPV_respkey(request[0] + 1,0,0));
+}
+
+// marks the request answered, by its id if the response came in an envelope, else every one waiting for this key
+void NSPV_reqdone(uint32_t reqid,const std::vector<uint8_t> &key)
+{
+    std::map<uint32_t,struct NSPV_pendingreq>::iterator it;
+    LOCK(cs_NSPV);
+    if ( reqid != 0 )
+    {
+        if ( (it= NSPV_pendingreqs.find(reqid)) != NSPV_pendingreqs.end() && it->second.key == key )
+            it->second.done = true;
+        return;
+    }
+    for (it=NSPV_pendingreqs.begin(); it!=NSPV_pendingreqs.end(); it++)
+        if ( it->second.key == key )
+            it->second.done = true;
 }
 
 // komodo_nSPVresp is called from async message processing
 
 void komodo_nSPVresp(CNode *pfrom,std::vector<uint8_t> response) // received a response
 {
-    struct NSPV_inforesp I; int32_t len; uint32_t timestamp = (uint32_t)time(NULL);
+    struct NSPV_inforesp I; int32_t len; uint32_t timestamp = (uint32_t)time(NULL),reqid = 0; uint8_t key[2*sizeof(uint256)];
     strncpy(NSPV_lastpeer,pfrom->addr.ToString().c_str(),sizeof(NSPV_lastpeer)-1);
+    if ( response.size() > 1+sizeof(reqid) && response[0] == NSPV_REQIDRESP )
+    {
+        iguana_rwnum(0,&response[1],sizeof(reqid),&reqid);
+        response.erase(response.begin(),response.begin() + 1 + sizeof(reqid));
+    }
     if ( (len= response.size()) > 0 )
     {
         switch ( response[0] )
@@ -143,6 +365,7 @@ void komodo_nSPVresp(CNode *pfrom,std::vector<uint8_t> response) // received a r
                 I = NSPV_inforesult;
                 NSPV_inforesp_purge(&NSPV_inforesult);
                 NSPV_rwinforesp(0,&response[1],&NSPV_inforesult);
+                pfrom->nNSPVVersion = NSPV_inforesult.version;
                 if ( NSPV_inforesult.height < I.height )
                 {
                     fprintf(stderr,"got old info response %u size.%d height.%d\n",timestamp,(int32_t)response.size(),NSPV_inforesult.height); // update current height and ntrz status
@@ -177,6 +400,8 @@ void komodo_nSPVresp(CNode *pfrom,std::vector<uint8_t> response) // received a r
                 NSPV_rwntzsresp(0,&response[1],&NSPV_ntzsresult);
                 if ( NSPV_ntzsresp_find(NSPV_ntzsresult.reqheight) == 0 )
                     NSPV_ntzsresp_add(&NSPV_ntzsresult);
+                iguana_rwnum(1,key,sizeof(NSPV_ntzsresult.reqheight),&NSPV_ntzsresult.reqheight);
+                NSPV_reqdone(reqid,NSPV_respkey(response[0],key,sizeof(NSPV_ntzsresult.reqheight)));
                 fprintf(stderr,"got ntzs response %u size.%d %s prev.%d, %s next.%d\n",timestamp,(int32_t)response.size(),NSPV_ntzsresult.prevntz.txid.GetHex().c_str(),NSPV_ntzsresult.prevntz.height,NSPV_ntzsresult.nextntz.txid.GetHex().c_str(),NSPV_ntzsresult.nextntz.height);
                 break;
             case NSPV_NTZSPROOFRESP:
@@ -184,13 +409,17 @@ void komodo_nSPVresp(CNode *pfrom,std::vector<uint8_t> response) // received a r
                 NSPV_rwntzsproofresp(0,&response[1],&NSPV_ntzsproofresult);
                 if ( NSPV_ntzsproof_find(NSPV_ntzsproofresult.prevtxid,NSPV_ntzsproofresult.nexttxid) == 0 )
                     NSPV_ntzsproof_add(&NSPV_ntzsproofresult);
+                iguana_rwbignum(1,key,sizeof(uint256),(uint8_t *)&NSPV_ntzsproofresult.prevtxid);
+                iguana_rwbignum(1,&key[sizeof(uint256)],sizeof(uint256),(uint8_t *)&NSPV_ntzsproofresult.nexttxid);
+                NSPV_reqdone(reqid,NSPV_respkey(response[0],key,2*sizeof(uint256)));
                 fprintf(stderr,"got ntzproof response %u size.%d prev.%d next.%d\n",timestamp,(int32_t)response.size(),NSPV_ntzsproofresult.common.prevht,NSPV_ntzsproofresult.common.nextht);
                 break;
             case NSPV_TXPROOFRESP:
                 NSPV_txproof_purge(&NSPV_txproofresult);
                 NSPV_rwtxproof(0,&response[1],&NSPV_txproofresult);
-                if ( NSPV_txproof_find(NSPV_txproofresult.txid) == 0 )
-                    NSPV_txproof_add(&NSPV_txproofresult);
+                NSPV_txproof_add(&NSPV_txproofresult);
+                iguana_rwbignum(1,key,sizeof(uint256),(uint8_t *)&NSPV_txproofresult.txid);
+                NSPV_reqdone(reqid,NSPV_respkey(response[0],key,sizeof(uint256)));
                 fprintf(stderr,"got txproof response %u size.%d %s ht.%d\n",timestamp,(int32_t)response.size(),NSPV_txproofresult.txid.GetHex().c_str(),NSPV_txproofresult.height);
                 break;
             case NSPV_SPENTINFORESP:
@@ -212,6 +441,8 @@ void komodo_nSPVresp(CNode *pfrom,std::vector<uint8_t> response) // received a r
             default: fprintf(stderr,"unexpected response %02x size.%d at %u\n",response[0],(int32_t)response.size(),timestamp);
                 break;
         }
+        if ( response[0] != NSPV_NTZSRESP && response[0] != NSPV_NTZSPROOFRESP && response[0] != NSPV_TXPROOFRESP )
+            NSPV_reqdone(reqid,NSPV_respkey(response[0],0,0));
     }
 }
 
@@ -258,6 +489,113 @@ CNode *NSPV_req(CNode *pnode,uint8_t *msg,int32_t len,uint64_t mask,int32_t ind)
     return(0);
 }
 
+// sends the pending requests not yet sent, or timed out, to the least loaded peer with the services needed.
+// a retry goes to another peer when there is one. peers without pipelining get one request of a type per second
+void NSPV_reqdispatch(const std::vector<uint32_t> &reqids)
+{
+    std::map<NodeId,int32_t> inflight; std::map<uint32_t,struct NSPV_pendingreq>::iterator it;
+    int32_t i,ind,load,bestload; CNode *pbest; int64_t now = GetTimeMicros(); uint32_t timestamp = (uint32_t)time(NULL);
+    LOCK2(cs_vNodes,cs_NSPV);
+    for (i=0; i<reqids.size(); i++)
+        if ( (it= NSPV_pendingreqs.find(reqids[i])) != NSPV_pendingreqs.end() && !it->second.done && it->second.senttime != 0 && now < it->second.senttime + NSPV_REQTIMEOUT )
+            inflight[it->second.peer]++;
+    for (i=0; i<reqids.size(); i++)
+    {
+        if ( (it= NSPV_pendingreqs.find(reqids[i])) == NSPV_pendingreqs.end() )
+            continue;
+        struct NSPV_pendingreq &req = it->second;
+        if ( req.done || (req.senttime != 0 && now < req.senttime + NSPV_REQTIMEOUT) || req.attempts >= NSPV_MAXATTEMPTS )
+            continue;
+        ind = req.request[0]>>1;
+        pbest = 0;
+        bestload = 0;
+        BOOST_FOREACH(CNode *pnode,vNodes)
+        {
+            if ( pnode->hSocket == INVALID_SOCKET || pnode->fDisconnect || (pnode->nServices & req.mask) != req.mask )
+                continue;
+            if ( pnode->prevtimes[ind] > timestamp )
+                pnode->prevtimes[ind] = 0;
+            if ( pnode->nNSPVVersion < NSPV_PIPELINE_VERSION && timestamp <= pnode->prevtimes[ind] )
+                continue;
+            if ( (load= inflight[pnode->GetId()]) >= NSPV_MAXINFLIGHT )
+                continue;
+            if ( pnode->GetId() == req.peer )
+                load += NSPV_MAXINFLIGHT;
+            if ( pbest == 0 || load < bestload )
+            {
+                pbest = pnode;
+                bestload = load;
+            }
+        }
+        if ( pbest == 0 )
+            continue;
+        if ( pbest->nNSPVVersion >= NSPV_PIPELINE_VERSION )
+        {
+            std::vector<uint8_t> envelope(1 + sizeof(reqids[i]) + req.request.size());
+            envelope[0] = NSPV_REQID;
+            iguana_rwnum(1,&envelope[1],sizeof(reqids[i]),(void *)&reqids[i]);
+            memcpy(&envelope[1 + sizeof(reqids[i])],&req.request[0],req.request.size());
+            pbest->PushMessage("getnSPV",envelope);
+        } else pbest->PushMessage("getnSPV",req.request);
+        pbest->prevtimes[ind] = timestamp;
+        req.peer = pbest->GetId();
+        req.senttime = now;
+        req.attempts++;
+        inflight[req.peer]++;
+    }
+}
+
+// issues all the requests at once over the peers with the mask services and waits until they are answered, or
+// NSPV_POLLITERS polls. the responses are handled as usual by komodo_nSPVresp. returns the number answered
+int32_t NSPV_reqbatch(const std::vector<std::vector<uint8_t> > &requests,uint64_t mask)
+{
+    std::vector<uint32_t> reqids; int32_t i,iter,numdone = 0,numwaiting = 1; int64_t now;
+    if ( KOMODO_NSPV_FULLNODE || requests.size() == 0 )
+        return(0);
+    {
+        LOCK(cs_NSPV);
+        for (i=0; i<requests.size(); i++)
+        {
+            struct NSPV_pendingreq req;
+            if ( requests[i].size() == 0 )
+                continue;
+            req.request = requests[i];
+            req.key = NSPV_reqkey(requests[i]);
+            req.mask = mask;
+            req.peer = -1;
+            req.senttime = 0;
+            req.attempts = 0;
+            req.done = false;
+            if ( ++NSPV_lastreqid == 0 )
+                NSPV_lastreqid = 1;
+            NSPV_pendingreqs[NSPV_lastreqid] = req;
+            reqids.push_back(NSPV_lastreqid);
+        }
+    }
+    for (iter=0; iter<NSPV_POLLITERS && numwaiting>0; iter++)
+    {
+        NSPV_reqdispatch(reqids);
+        usleep(NSPV_POLLMICROS);
+        now = GetTimeMicros();
+        LOCK(cs_NSPV);
+        for (numdone=numwaiting=i=0; i<reqids.size(); i++)
+        {
+            struct NSPV_pendingreq &req = NSPV_pendingreqs[reqids[i]];
+            if ( req.done )
+                numdone++;
+            else if ( req.attempts < NSPV_MAXATTEMPTS || now < req.senttime + NSPV_REQTIMEOUT )
+                numwaiting++;
+        }
+    }
+    {
+        LOCK(cs_NSPV);
+        for (i=0; i<reqids.size(); i++)
+            NSPV_pendingreqs.erase(reqids[i]);
+    }
+    fprintf(stderr,"NSPV_reqbatch %d of %d answered after %d polls\n",numdone,(int32_t)reqids.size(),iter);
+    return(numdone);
+}
+
 UniValue NSPV_logout()
 {
     UniValue result(UniValue::VOBJ);
@@ -265,9 +603,13 @@ UniValue NSPV_logout()
     if ( NSPV_logintime != 0 )
         fprintf(stderr,"scrub wif and privkey from NSPV memory\n");
     else result.push_back(Pair("status","wasnt logged in"));
-    memset(NSPV_ntzsproofresp_cache,0,sizeof(NSPV_ntzsproofresp_cache));
-    memset(NSPV_txproof_cache,0,sizeof(NSPV_txproof_cache));
-    memset(NSPV_ntzsresp_cache,0,sizeof(NSPV_ntzsresp_cache));
+    {
+        LOCK(cs_NSPV);
+        NSPV_ntzsproofresp_cache.clear();
+        NSPV_txproof_cache.clear();
+        NSPV_ntzsresp_cache.clear();
+        NSPV_utxosresp_cache.clear();
+    }
     memset(NSPV_wifstr,0,sizeof(NSPV_wifstr));
     memset(&NSPV_key,0,sizeof(NSPV_key));
     NSPV_logintime = 0;
@@ -591,13 +933,21 @@ uint32_t NSPV_blocktime(int32_t hdrheight)
 
 UniValue NSPV_addressutxos(char *coinaddr,int32_t CCflag,int32_t skipcount,int32_t filter)
 {
-    UniValue result(UniValue::VOBJ); uint8_t msg[512]; int32_t i,iter,slen,len = 0;
+    UniValue result(UniValue::VOBJ); uint8_t msg[512]; int32_t i,iter,slen,len = 0; std::string key; struct NSPV_utxosresp *ptr;
     //fprintf(stderr,"utxos %s NSPV addr %s\n",coinaddr,NSPV_address.c_str());
-    //if ( NSPV_utxosresult.nodeheight >= NSPV_inforesult.height && strcmp(coinaddr,NSPV_utxosresult.coinaddr) == 0 && CCflag == NSPV_utxosresult.CCflag  && skipcount == NSPV_utxosresult.skipcount && filter == NSPV_utxosresult.filter )
-    //    return(NSPV_utxosresp_json(&NSPV_utxosresult));
     if ( skipcount < 0 )
         skipcount = 0;
+    key = NSPV_utxoskey(coinaddr,CCflag,skipcount,filter);
     NSPV_utxosresp_purge(&NSPV_utxosresult);
+    {
+        LOCK(cs_NSPV);
+        if ( (ptr= NSPV_utxosresp_find(key)) != 0 )
+        {
+            fprintf(stderr,"FROM CACHE NSPV_addressutxos %s ht.%d\n",coinaddr,ptr->nodeheight);
+            NSPV_utxosresp_copy(&NSPV_utxosresult,ptr);
+            return(NSPV_utxosresp_json(&NSPV_utxosresult));
+        }
+    }
     if ( bitcoin_base58decode(msg,coinaddr) != 25 )
     {
         result.push_back(Pair("result","error"));
@@ -618,7 +968,11 @@ UniValue NSPV_addressutxos(char *coinaddr,int32_t CCflag,int32_t skipcount,int32
         {
             usleep(NSPV_POLLMICROS);
             if ( (NSPV_inforesult.height == 0 || NSPV_utxosresult.nodeheight >= NSPV_inforesult.height) && strcmp(coinaddr,NSPV_utxosresult.coinaddr) == 0 && CCflag == NSPV_utxosresult.CCflag )
+            {
+                if ( NSPV_inforesult.height != 0 && NSPV_utxosresult.skipcount == skipcount && NSPV_utxosresult.filter == filter )
+                    NSPV_utxosresp_add(key,&NSPV_utxosresult);
                 return(NSPV_utxosresp_json(&NSPV_utxosresult));
+            }
         }
     } else sleep(1);
     result.push_back(Pair("result","error"));
@@ -781,9 +1135,17 @@ bool NSPV_evalcode_inmempool(uint8_t evalcode,uint8_t funcid)
     else return(false);
 }
 
+std::vector<uint8_t> NSPV_notarizations_req(int32_t reqheight)
+{
+    std::vector<uint8_t> request(1 + sizeof(reqheight));
+    request[0] = NSPV_NTZS;
+    iguana_rwnum(1,&request[1],sizeof(reqheight),&reqheight);
+    return(request);
+}
+
 UniValue NSPV_notarizations(int32_t reqheight)
 {
-    uint8_t msg[512]; int32_t i,iter,len = 0; struct NSPV_ntzsresp N,*ptr;
+    std::vector<uint8_t> request; int32_t i,iter; struct NSPV_ntzsresp N,*ptr;
     if ( (ptr= NSPV_ntzsresp_find(reqheight)) != 0 )
     {
         fprintf(stderr,"FROM CACHE NSPV_notarizations.%d\n",reqheight);
@@ -791,10 +1153,9 @@ UniValue NSPV_notarizations(int32_t reqheight)
         NSPV_ntzsresp_copy(&NSPV_ntzsresult,ptr);
         return(NSPV_ntzsresp_json(ptr));
     }
-    msg[len++] = NSPV_NTZS;
-    len += iguana_rwnum(1,&msg[len],sizeof(reqheight),&reqheight);
+    request = NSPV_notarizations_req(reqheight);
     for (iter=0; iter<3; iter++)
-    if ( NSPV_req(0,msg,len,NODE_NSPV,msg[0]>>1) != 0 )
+    if ( NSPV_req(0,&request[0],request.size(),NODE_NSPV,request[0]>>1) != 0 )
     {
         for (i=0; i<NSPV_POLLITERS; i++)
         {
@@ -807,9 +1168,18 @@ UniValue NSPV_notarizations(int32_t reqheight)
     return(NSPV_ntzsresp_json(&N));
 }
 
+std::vector<uint8_t> NSPV_txidhdrsproof_req(uint256 prevtxid,uint256 nexttxid)
+{
+    std::vector<uint8_t> request(1 + 2*sizeof(uint256));
+    request[0] = NSPV_NTZSPROOF;
+    iguana_rwbignum(1,&request[1],sizeof(prevtxid),(uint8_t *)&prevtxid);
+    iguana_rwbignum(1,&request[1 + sizeof(prevtxid)],sizeof(nexttxid),(uint8_t *)&nexttxid);
+    return(request);
+}
+
 UniValue NSPV_txidhdrsproof(uint256 prevtxid,uint256 nexttxid)
 {
-    uint8_t msg[512]; int32_t i,iter,len = 0; struct NSPV_ntzsproofresp P,*ptr;
+    std::vector<uint8_t> request; int32_t i,iter; struct NSPV_ntzsproofresp P,*ptr;
     if ( (ptr= NSPV_ntzsproof_find(prevtxid,nexttxid)) != 0 )
     {
         fprintf(stderr,"FROM CACHE NSPV_txidhdrsproof %s %s\n",ptr->prevtxid.GetHex().c_str(),ptr->nexttxid.GetHex().c_str());
@@ -818,11 +1188,9 @@ UniValue NSPV_txidhdrsproof(uint256 prevtxid,uint256 nexttxid)
         return(NSPV_ntzsproof_json(ptr));
     }
     NSPV_ntzsproofresp_purge(&NSPV_ntzsproofresult);
-    msg[len++] = NSPV_NTZSPROOF;
-    len += iguana_rwbignum(1,&msg[len],sizeof(prevtxid),(uint8_t *)&prevtxid);
-    len += iguana_rwbignum(1,&msg[len],sizeof(nexttxid),(uint8_t *)&nexttxid);
+    request = NSPV_txidhdrsproof_req(prevtxid,nexttxid);
     for (iter=0; iter<3; iter++)
-    if ( NSPV_req(0,msg,len,NODE_NSPV,msg[0]>>1) != 0 )
+    if ( NSPV_req(0,&request[0],request.size(),NODE_NSPV,request[0]>>1) != 0 )
     {
         for (i=0; i<NSPV_POLLITERS; i++)
         {
@@ -845,9 +1213,19 @@ UniValue NSPV_hdrsproof(int32_t prevht,int32_t nextht)
     return(NSPV_txidhdrsproof(prevtxid,nexttxid));
 }
 
+std::vector<uint8_t> NSPV_txproof_req(int32_t vout,uint256 txid,int32_t height)
+{
+    std::vector<uint8_t> request(1 + sizeof(height) + sizeof(vout) + sizeof(txid));
+    request[0] = NSPV_TXPROOF;
+    iguana_rwnum(1,&request[1],sizeof(height),&height);
+    iguana_rwnum(1,&request[1 + sizeof(height)],sizeof(vout),&vout);
+    iguana_rwbignum(1,&request[1 + sizeof(height) + sizeof(vout)],sizeof(txid),(uint8_t *)&txid);
+    return(request);
+}
+
 UniValue NSPV_txproof(int32_t vout,uint256 txid,int32_t height)
 {
-    uint8_t msg[512]; int32_t i,iter,len = 0; struct NSPV_txproof P,*ptr;
+    std::vector<uint8_t> request; int32_t i,iter; struct NSPV_txproof P,*ptr;
     if ( (ptr= NSPV_txproof_find(txid)) != 0 )
     {
         fprintf(stderr,"FROM CACHE NSPV_txproof %s\n",txid.GetHex().c_str());
@@ -856,13 +1234,10 @@ UniValue NSPV_txproof(int32_t vout,uint256 txid,int32_t height)
         return(NSPV_txproof_json(ptr));
     }
     NSPV_txproof_purge(&NSPV_txproofresult);
-    msg[len++] = NSPV_TXPROOF;
-    len += iguana_rwnum(1,&msg[len],sizeof(height),&height);
-    len += iguana_rwnum(1,&msg[len],sizeof(vout),&vout);
-    len += iguana_rwbignum(1,&msg[len],sizeof(txid),(uint8_t *)&txid);
+    request = NSPV_txproof_req(vout,txid,height);
     fprintf(stderr,"req txproof %s/v%d at height.%d\n",txid.GetHex().c_str(),vout,height);
     for (iter=0; iter<3; iter++)
-    if ( NSPV_req(0,msg,len,NODE_NSPV,msg[0]>>1) != 0 )
+    if ( NSPV_req(0,&request[0],request.size(),NODE_NSPV,request[0]>>1) != 0 )
     {
         for (i=0; i<NSPV_POLLITERS; i++)
         {
@@ -920,7 +1295,10 @@ UniValue NSPV_broadcast(char *hex)
             usleep(NSPV_POLLMICROS);
             if ( NSPV_broadcastresult.txid == txid )
             {
+                CTransaction tx;
                 free(msg);
+                if ( NSPV_broadcastresult.retcode >= 0 && DecodeHexTx(tx,hex) != 0 )
+                    NSPV_utxosresp_spend(tx);
                 return(NSPV_broadcast_json(&NSPV_broadcastresult,txid));
             }
         }
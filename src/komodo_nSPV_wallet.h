@@ -60,11 +60,13 @@ int32_t NSPV_validatehdrs(struct NSPV_ntzsproofresp *ptr)
 
 int32_t NSPV_gettransaction(int32_t skipvalidation,int32_t vout,uint256 txid,int32_t height,CTransaction &tx,uint256 &hashblock,int32_t &txheight,int32_t &currentheight,int64_t extradata,uint32_t tiptime,int64_t &rewardsum)
 {
-    struct NSPV_txproof *ptr; int32_t i,offset,retval; int64_t rewards = 0; uint32_t nLockTime; std::vector<uint8_t> proof;
+    struct NSPV_txproof *ptr; int32_t i,offset,retval; int64_t rewards = 0; uint32_t nLockTime; std::vector<uint8_t> proof; bool validated = false;
     retval = skipvalidation != 0 ? 0 : -1;
 
     //fprintf(stderr,"NSPV_gettx %s/v%d ht.%d\n",txid.GetHex().c_str(),vout,height);
-    if ( (ptr= NSPV_txproof_find(txid)) == 0 )
+    if ( (ptr= NSPV_validated_find(txid)) != 0 && ptr->height == height )
+        validated = true;
+    else if ( (ptr= NSPV_txproof_find(txid)) == 0 )
     {
         NSPV_txproof(vout,txid,height);
         ptr = &NSPV_txproofresult;
@@ -94,7 +96,12 @@ int32_t NSPV_gettransaction(int32_t skipvalidation,int32_t vout,uint256 txid,int
     //Getscriptaddress(coinaddr,tx.vout[0].scriptPubKey);  causes crash??
     //fprintf(stderr,"%s txid.%s vs hash.%s\n",coinaddr,txid.GetHex().c_str(),tx.GetHash().GetHex().c_str());
     
-    if ( skipvalidation == 0 )
+    if ( skipvalidation == 0 && validated )
+    {
+        fprintf(stderr,"FROM CACHE validated %s ht.%d\n",txid.GetHex().c_str(),height);
+        retval = 0;
+    }
+    else if ( skipvalidation == 0 )
     {
         if ( ptr->txprooflen > 0 )
         {
@@ -127,7 +134,14 @@ int32_t NSPV_gettransaction(int32_t skipvalidation,int32_t vout,uint256 txid,int
                         fprintf(stderr,"txid.%s vs txids[0] %s\n",txid.GetHex().c_str(),txids[0].GetHex().c_str());
                         fprintf(stderr,"prooflen.%d proofroot.%s vs %s\n",(int32_t)proof.size(),proofroot.GetHex().c_str(),NSPV_ntzsproofresult.common.hdrs[offset].hashMerkleRoot.GetHex().c_str());
                         retval = -2003;
-                    } else retval = 0;
+                    }
+                    else
+                    {
+                        retval = 0;
+                        // bracketed by notarizations, it can be reused until it is spent
+                        if ( (ptr= NSPV_txproof_find(txid)) != 0 && ptr->txid == txid && ptr->height == height )
+                            NSPV_validated_add(ptr);
+                    }
                 }
             } else retval = -2005;
         } else retval = -2004;
@@ -259,6 +273,35 @@ bool NSPV_SignTx(CMutableTransaction &mtx,int32_t vini,int64_t utxovalue,const C
     return(false);
 }
 
+// requests the proofs of all inputs at once, so NSPV_gettransaction validates them one by one from the caches
+void NSPV_prefetchproofs(CMutableTransaction &mtx,struct NSPV_utxoresp used[])
+{
+    std::vector<std::vector<uint8_t> > requests; std::set<int32_t> heights; std::set<std::pair<uint256,uint256> > ntzpairs;
+    std::set<int32_t>::iterator hit; std::set<std::pair<uint256,uint256> >::iterator pit; struct NSPV_ntzsresp *ptr; int32_t i;
+    for (i=0; i<mtx.vin.size(); i++)
+    {
+        if ( NSPV_txproof_find(mtx.vin[i].prevout.hash) == 0 )
+            requests.push_back(NSPV_txproof_req(mtx.vin[i].prevout.n,mtx.vin[i].prevout.hash,used[i].height));
+        if ( heights.insert(used[i].height).second && NSPV_ntzsresp_find(used[i].height) == 0 )
+            requests.push_back(NSPV_notarizations_req(used[i].height));
+    }
+    if ( requests.size() > 0 )
+        NSPV_reqbatch(requests,NODE_NSPV);
+    // the headers between the notarizations bracketing each input, once per pair
+    requests.clear();
+    for (hit=heights.begin(); hit!=heights.end(); hit++)
+    {
+        if ( (ptr= NSPV_ntzsresp_find(*hit)) == 0 || ptr->prevntz.height == 0 || ptr->prevntz.height > ptr->nextntz.height )
+            continue;
+        if ( NSPV_ntzsproof_find(ptr->prevntz.txid,ptr->nextntz.txid) == 0 )
+            ntzpairs.insert(std::make_pair(ptr->prevntz.txid,ptr->nextntz.txid));
+    }
+    for (pit=ntzpairs.begin(); pit!=ntzpairs.end(); pit++)
+        requests.push_back(NSPV_txidhdrsproof_req(pit->first,pit->second));
+    if ( requests.size() > 0 )
+        NSPV_reqbatch(requests,NODE_NSPV);
+}
+
 std::string NSPV_signtx(int64_t &rewardsum,int64_t &interestsum,UniValue &retcodes,CMutableTransaction &mtx,uint64_t txfee,CScript opret,struct NSPV_utxoresp used[])
 {
     CTransaction vintx; std::string hex; uint256 hashBlock; int64_t interest=0,change,totaloutputs=0,totalinputs=0; int32_t i,utxovout,n,validation,txheight,currentheight;
@@ -279,10 +322,11 @@ std::string NSPV_signtx(int64_t &rewardsum,int64_t &interestsum,UniValue &retcod
     }
     if ( opret.size() > 0 )
         mtx.vout.push_back(CTxOut(0,opret));
+    NSPV_prefetchproofs(mtx,used);
     for (i=0; i<n; i++)
     {
         utxovout = mtx.vin[i].prevout.n;
-        if ( i > 0 )
+        if ( i > 0 && NSPV_txproof_find(mtx.vin[i].prevout.hash) == 0 ) // the full node answers one request of a type per second
             sleep(1);
         validation = NSPV_gettransaction(0,utxovout,mtx.vin[i].prevout.hash,used[i].height,vintx,hashBlock,txheight,currentheight,used[i].extradata,NSPV_tiptime,rewardsum);
         retcodes.push_back(validation);
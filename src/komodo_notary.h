@@ -87,10 +87,79 @@ int32_t getacseason(uint32_t timestamp)
     return(0);
 }
 
+struct komodo_notaryset *komodo_notarysets_init()
+{
+    int32_t i,season; struct komodo_notaryset *sets = new struct komodo_notaryset[NUM_KMD_SEASONS];
+    for (season=0; season<NUM_KMD_SEASONS; season++)
+    {
+        struct komodo_notaryset *set = &sets[season];
+        set->numnotaries = NUM_KMD_NOTARIES;
+        memset(set->pubkeys,0,sizeof(set->pubkeys));
+        memset(set->addresses,0,sizeof(set->addresses));
+        for (i=0; i<NUM_KMD_NOTARIES; i++)
+        {
+            std::array<uint8_t,33> pubkey33;
+            decode_hex(set->pubkeys[i],33,(char *)notaries_elected[season][i][1]);
+            memcpy(pubkey33.data(),set->pubkeys[i],33);
+            set->pubkeyids.insert(std::make_pair(pubkey33,i)); // the first of duplicate pubkeys wins, as with a linear scan
+        }
+        if ( ASSETCHAINS_PRIVATE != 0 )
+        {
+            // this is PIRATE, we need to populate the address array for the notary exemptions. 
+            for (i=0; i<NUM_KMD_NOTARIES; i++)
+            {
+                pubkey2addr(set->addresses[i],set->pubkeys[i]);
+                set->addressids.insert(std::make_pair(std::string(set->addresses[i]),i));
+            }
+            memcpy(NOTARY_ADDRESSES[season],set->addresses,sizeof(set->addresses));
+        }
+    }
+    return(sets);
+}
+
+// hardcoded notaries of the KMD season for height (KMD) or timestamp (assetchains), 0 for LABS chains and the elected KMD notaries
+const struct komodo_notaryset *komodo_notaryset_get(int32_t height,uint32_t timestamp)
+{
+    static struct komodo_notaryset *kmd_notarysets = komodo_notarysets_init();
+    int32_t kmd_season = 0;
+    if ( is_STAKED(ASSETCHAINS_SYMBOL) != 0 )
+        return(0);
+    if ( ASSETCHAINS_SYMBOL[0] == 0 )
+    {
+        // This is KMD, use block heights to determine the KMD notary season.. 
+        if ( height >= KOMODO_NOTARIES_HARDCODED )
+            kmd_season = getkmdseason(height);
+    }
+    else 
+    {
+        // This is a non LABS assetchain, use timestamp to detemine notary pubkeys. 
+        if ( timestamp == 0 )
+            timestamp = komodo_heightstamp(height);
+        kmd_season = getacseason(timestamp);
+    }
+    if ( kmd_season == 0 )
+        return(0);
+    return(&kmd_notarysets[kmd_season-1]);
+}
+
+int32_t komodo_notaryset_find(const struct komodo_notaryset *set,const uint8_t *pubkey33)
+{
+    std::array<uint8_t,33> key;
+    memcpy(key.data(),pubkey33,33);
+    auto it = set->pubkeyids.find(key);
+    return(it == set->pubkeyids.end() ? -1 : it->second);
+}
+
+// only ac_private chains have the addresses
+int32_t komodo_notaryset_findaddr(const struct komodo_notaryset *set,const char *coinaddr)
+{
+    auto it = set->addressids.find(coinaddr);
+    return(it == set->addressids.end() ? -1 : it->second);
+}
+
 int32_t komodo_notaries(uint8_t pubkeys[64][33],int32_t height,uint32_t timestamp)
 {
-    int32_t i,htind,n; uint64_t mask = 0; struct knotary_entry *kp,*tmp;
-    static uint8_t kmd_pubkeys[NUM_KMD_SEASONS][64][33],didinit[NUM_KMD_SEASONS];
+    int32_t i,htind,n; uint64_t mask = 0; struct knotary_entry *kp,*tmp; const struct komodo_notaryset *set;
     
     if ( timestamp == 0 && ASSETCHAINS_SYMBOL[0] != 0 )
         timestamp = komodo_heightstamp(height);
@@ -100,34 +169,10 @@ int32_t komodo_notaries(uint8_t pubkeys[64][33],int32_t height,uint32_t timestam
     // If this chain is not a staked chain, use the normal Komodo logic to determine notaries. This allows KMD to still sync and use its proper pubkeys for dPoW.
     if ( is_STAKED(ASSETCHAINS_SYMBOL) == 0 )
     {
-        int32_t kmd_season = 0;
-        if ( ASSETCHAINS_SYMBOL[0] == 0 )
+        if ( (set= komodo_notaryset_get(height,timestamp)) != 0 )
         {
-            // This is KMD, use block heights to determine the KMD notary season.. 
-            if ( height >= KOMODO_NOTARIES_HARDCODED )
-                kmd_season = getkmdseason(height);
-        }
-        else 
-        {
-            // This is a non LABS assetchain, use timestamp to detemine notary pubkeys. 
-            kmd_season = getacseason(timestamp);
-        }
-        if ( kmd_season != 0 )
-        {
-            if ( didinit[kmd_season-1] == 0 )
-            {
-                for (i=0; i<NUM_KMD_NOTARIES; i++) 
-                    decode_hex(kmd_pubkeys[kmd_season-1][i],33,(char *)notaries_elected[kmd_season-1][i][1]);
-                if ( ASSETCHAINS_PRIVATE != 0 )
-                {
-                    // this is PIRATE, we need to populate the address array for the notary exemptions. 
-                    for (i = 0; i<NUM_KMD_NOTARIES; i++)
-                        pubkey2addr((char *)NOTARY_ADDRESSES[kmd_season-1][i],(uint8_t *)kmd_pubkeys[kmd_season-1][i]);
-                }
-                didinit[kmd_season-1] = 1;
-            }
-            memcpy(pubkeys,kmd_pubkeys[kmd_season-1],NUM_KMD_NOTARIES * 33);
-            return(NUM_KMD_NOTARIES);
+            memcpy(pubkeys,set->pubkeys,set->numnotaries * 33);
+            return(set->numnotaries);
         }
     }
     else if ( timestamp != 0 )
@@ -170,7 +215,12 @@ int32_t komodo_notaries(uint8_t pubkeys[64][33],int32_t height,uint32_t timestam
 
 int32_t komodo_electednotary(int32_t *numnotariesp,uint8_t *pubkey33,int32_t height,uint32_t timestamp)
 {
-    int32_t i,n; uint8_t pubkeys[64][33];
+    int32_t i,n; uint8_t pubkeys[64][33]; const struct komodo_notaryset *set;
+    if ( (set= komodo_notaryset_get(height,timestamp)) != 0 )
+    {
+        *numnotariesp = set->numnotaries;
+        return(komodo_notaryset_find(set,pubkey33));
+    }
     n = komodo_notaries(pubkeys,height,timestamp);
     *numnotariesp = n;
     for (i=0; i<n; i++)
@@ -290,19 +340,20 @@ int32_t komodo_chosennotary(int32_t *notaryidp,int32_t height,uint8_t *pubkey33,
 
 struct notarized_checkpoint *komodo_npptr_for_height(int32_t height, int *idx)
 {
-    char symbol[KOMODO_ASSETCHAIN_MAXLEN],dest[KOMODO_ASSETCHAIN_MAXLEN]; int32_t i; struct komodo_state *sp; struct notarized_checkpoint *np = 0;
+    char symbol[KOMODO_ASSETCHAIN_MAXLEN],dest[KOMODO_ASSETCHAIN_MAXLEN]; struct komodo_state *sp; struct notarized_checkpoint *np = 0;
+    *idx = -1;
     if ( (sp= komodo_stateptr(symbol,dest)) != 0 )
     {
-        for (i=sp->NUM_NPOINTS-1; i>=0; i--)
+        portable_mutex_lock(&komodo_mutex);
+        std::map<int32_t,struct notarized_range>::iterator it = sp->NPOINTS_RANGES.upper_bound(height);
+        if ( it != sp->NPOINTS_RANGES.begin() && height <= (--it)->second.endheight )
         {
-            *idx = i;
-            np = &sp->NPOINTS[i];
-            if ( np->MoMdepth != 0 && height > np->notarized_height-(np->MoMdepth&0xffff) && height <= np->notarized_height )
-                return(np);
+            *idx = it->second.idx;
+            np = &sp->NPOINTS[*idx];
         }
+        portable_mutex_unlock(&komodo_mutex);
     }
-    *idx = -1;
-    return(0);
+    return(np);
 }
 
 struct notarized_checkpoint *komodo_npptr(int32_t height)
@@ -362,25 +413,48 @@ int32_t komodo_notarized_height(int32_t *prevMoMheightp,uint256 *hashp,uint256 *
     } else return(0);
 }
 
-int32_t komodo_dpowconfs(int32_t txheight,int32_t numconfs)
+static int32_t komodo_hadnotarization;
+
+/**
+ * The notarized height komodo_dpowconfs counts confirmations against, 0 when a
+ * notarization was seen before but none is known now, -1 when confirmations
+ * are not dPoW adjusted. Callers converting the depth of many transactions
+ * look it up once and use komodo_dpowconfs_notarized.
+ */
+int32_t komodo_dpownotarizedheight()
 {
-    static int32_t hadnotarization;
     char symbol[KOMODO_ASSETCHAIN_MAXLEN],dest[KOMODO_ASSETCHAIN_MAXLEN]; struct komodo_state *sp;
-    if ( KOMODO_DPOWCONFS != 0 && txheight > 0 && numconfs > 0 && (sp= komodo_stateptr(symbol,dest)) != 0 )
+    if ( KOMODO_DPOWCONFS != 0 && (sp= komodo_stateptr(symbol,dest)) != 0 )
     {
         if ( sp->NOTARIZED_HEIGHT > 0 )
         {
-            hadnotarization = 1;
-            if ( txheight < sp->NOTARIZED_HEIGHT )
-                return(numconfs);
-            else return(1);
+            komodo_hadnotarization = 1;
+            return(sp->NOTARIZED_HEIGHT);
         }
-        else if ( hadnotarization != 0 )
-            return(1);
+        else if ( komodo_hadnotarization != 0 )
+            return(0);
+    }
+    return(-1);
+}
+
+int32_t komodo_dpowconfs_notarized(int32_t notarizedheight,int32_t txheight,int32_t numconfs)
+{
+    if ( notarizedheight >= 0 && txheight > 0 && numconfs > 0 )
+    {
+        if ( txheight < notarizedheight )
+            return(numconfs);
+        else return(1);
     }
     return(numconfs);
 }
 
+int32_t komodo_dpowconfs(int32_t txheight,int32_t numconfs)
+{
+    if ( KOMODO_DPOWCONFS == 0 || txheight <= 0 || numconfs <= 0 )
+        return(numconfs);
+    return(komodo_dpowconfs_notarized(komodo_dpownotarizedheight(),txheight,numconfs));
+}
+
 int32_t komodo_MoMdata(int32_t *notarized_htp,uint256 *MoMp,uint256 *kmdtxidp,int32_t height,uint256 *MoMoMp,int32_t *MoMoMoffsetp,int32_t *MoMoMdepthp,int32_t *kmdstartip,int32_t *kmdendip)
 {
     struct notarized_checkpoint *np = 0;
@@ -459,6 +533,34 @@ int32_t komodo_notarizeddata(int32_t nHeight,uint256 *notarized_hashp,uint256 *n
     return(0);
 }
 
+// makes NPOINTS[idx] the checkpoint for heights startheight .. endheight, cutting the older ranges it overlaps
+void komodo_npoints_addrange(struct komodo_state *sp,int32_t startheight,int32_t endheight,int32_t idx)
+{
+    std::map<int32_t,struct notarized_range> &ranges = sp->NPOINTS_RANGES;
+    std::map<int32_t,struct notarized_range>::iterator it = ranges.lower_bound(startheight);
+    if ( it != ranges.begin() )
+    {
+        std::map<int32_t,struct notarized_range>::iterator prev = it;
+        --prev;
+        if ( prev->second.endheight >= startheight )
+        {
+            if ( prev->second.endheight > endheight )
+                ranges[endheight+1] = prev->second;
+            prev->second.endheight = startheight - 1;
+        }
+    }
+    while ( it != ranges.end() && it->first <= endheight )
+    {
+        if ( it->second.endheight > endheight )
+            ranges[endheight+1] = it->second;
+        ranges.erase(it++);
+    }
+    struct notarized_range range;
+    range.endheight = endheight;
+    range.idx = idx;
+    ranges[startheight] = range;
+}
+
 void komodo_notarized_update(struct komodo_state *sp,int32_t nHeight,int32_t notarized_height,uint256 notarized_hash,uint256 notarized_desttxid,uint256 MoM,int32_t MoMdepth)
 {
     struct notarized_checkpoint *np;
@@ -470,7 +572,11 @@ void komodo_notarized_update(struct komodo_state *sp,int32_t nHeight,int32_t not
     if ( 0 && ASSETCHAINS_SYMBOL[0] != 0 )
         fprintf(stderr,"[%s] komodo_notarized_update nHeight.%d notarized_height.%d\n",ASSETCHAINS_SYMBOL,nHeight,notarized_height);
     portable_mutex_lock(&komodo_mutex);
-    sp->NPOINTS = (struct notarized_checkpoint *)realloc(sp->NPOINTS,(sp->NUM_NPOINTS+1) * sizeof(*sp->NPOINTS));
+    if ( sp->NUM_NPOINTS >= sp->max_NPOINTS )
+    {
+        sp->max_NPOINTS = sp->max_NPOINTS < 1024 ? 1024 : sp->max_NPOINTS * 2;
+        sp->NPOINTS = (struct notarized_checkpoint *)realloc(sp->NPOINTS,sp->max_NPOINTS * sizeof(*sp->NPOINTS));
+    }
     np = &sp->NPOINTS[sp->NUM_NPOINTS++];
     memset(np,0,sizeof(*np));
     np->nHeight = nHeight;
@@ -479,6 +585,8 @@ void komodo_notarized_update(struct komodo_state *sp,int32_t nHeight,int32_t not
     sp->NOTARIZED_DESTTXID = np->notarized_desttxid = notarized_desttxid;
     sp->MoM = np->MoM = MoM;
     sp->MoMdepth = np->MoMdepth = MoMdepth;
+    if ( (MoMdepth & 0xffff) != 0 )
+        komodo_npoints_addrange(sp,notarized_height - (MoMdepth & 0xffff) + 1,notarized_height,sp->NUM_NPOINTS - 1);
     portable_mutex_unlock(&komodo_mutex);
 }
 
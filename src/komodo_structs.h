@@ -18,6 +18,11 @@
 #include "uthash.h"
 #include "utlist.h"
 
+#include <array>
+#include <map>
+#include <string>
+#include <unordered_map>
+
 /*#ifdef _WIN32
 #define PACKED
 #else
@@ -57,8 +62,6 @@
 union _bits320 { uint8_t bytes[40]; uint16_t ushorts[20]; uint32_t uints[10]; uint64_t ulongs[5]; uint64_t txid; };
 typedef union _bits320 bits320;
 
-struct komodo_kv { UT_hash_handle hh; bits256 pubkey; uint8_t *key,*value; int32_t height; uint32_t flags; uint16_t keylen,valuesize; };
-
 struct komodo_event_notarized { uint256 blockhash,desttxid,MoM; int32_t notarizedheight,MoMdepth; char dest[16]; };
 struct komodo_event_pubkeys { uint8_t num; uint8_t pubkeys[64][33]; };
 struct komodo_event_opreturn { uint256 txid; uint64_t value; uint16_t vout,oplen; uint8_t opret[]; };
@@ -92,6 +95,25 @@ struct notarized_checkpoint
     int32_t nHeight,notarized_height,MoMdepth,MoMoMdepth,MoMoMoffset,kmdstarti,kmdendi;
 };
 
+// blocks endheight-MoMdepth+1 .. endheight covered by the MoM of NPOINTS[idx], keyed by the first of them in NPOINTS_RANGES
+struct notarized_range { int32_t endheight,idx; };
+
+struct komodo_pubkey33_hash
+{
+    // pubkeys are uniformly distributed after the parity byte
+    size_t operator()(const std::array<uint8_t,33> &pubkey33) const { size_t h; memcpy(&h,&pubkey33[1],sizeof(h)); return(h); }
+};
+
+// the notaries of a season, built once and never modified
+struct komodo_notaryset
+{
+    int32_t numnotaries;
+    uint8_t pubkeys[64][33];
+    char addresses[64][64];
+    std::unordered_map<std::array<uint8_t,33>,int32_t,komodo_pubkey33_hash> pubkeyids;
+    std::unordered_map<std::string,int32_t> addressids;
+};
+
 struct komodo_ccdataMoM
 {
     uint256 MoM;
@@ -122,8 +144,9 @@ struct komodo_state
     int32_t SAVEDHEIGHT,CURRENT_HEIGHT,NOTARIZED_HEIGHT,MoMdepth;
     uint32_t SAVEDTIMESTAMP;
     uint64_t deposited,issued,withdrawn,approved,redeemed,shorted;
-    struct notarized_checkpoint *NPOINTS; int32_t NUM_NPOINTS,last_NPOINTSi;
-    struct komodo_event **Komodo_events; int32_t Komodo_numevents;
+    struct notarized_checkpoint *NPOINTS; int32_t NUM_NPOINTS,last_NPOINTSi,max_NPOINTS;
+    std::map<int32_t,struct notarized_range> NPOINTS_RANGES; // disjoint, the newest checkpoint covering a height wins
+    struct komodo_event **Komodo_events; int32_t Komodo_numevents,Komodo_maxevents;
     uint32_t RTbufs[64][3]; uint64_t RTmask;
 };
 
@@ -0,0 +1,146 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "kvindex.h"
+
+#include "chain.h"
+#include "main.h"
+#include "txdb.h"
+#include "util.h"
+
+#include <algorithm>
+
+int32_t komodo_kvduration(uint32_t flags);
+
+CKVIndex kvIndex;
+
+bool IsKVEntryExpired(const CKVEntry& entry, int nCurrentHeight)
+{
+    return nCurrentHeight > entry.nHeight + komodo_kvduration(entry.nFlags);
+}
+
+bool CKVIndex::Load(const CChain& chain)
+{
+    const int nChainHeight = chain.Height();
+    std::vector<std::pair<int, CKVBlockUndo>> vUndo;
+    if (!pblocktree->ReadKVBlockUndos(std::max(0, nChainHeight - (int)MAX_REORG_LENGTH), vUndo))
+        return error("%s: failed to read the KV index undo records", __func__);
+    // From the top, a block left by a crash can be above the tip or on a fork of it
+    for (std::vector<std::pair<int, CKVBlockUndo>>::reverse_iterator it = vUndo.rbegin(); it != vUndo.rend(); ++it) {
+        if (it->first <= nChainHeight && chain[it->first]->GetBlockHash() == it->second.hashBlock)
+            continue;
+        LogPrintf("%s: undoing the KV updates of block %s at height %d\n", __func__, it->second.hashBlock.ToString(), it->first);
+        if (!Undo(it->first, it->second))
+            return false;
+    }
+
+    std::map<std::vector<unsigned char>, CKVEntry> mapLoaded;
+    if (!pblocktree->ReadKVEntries(mapLoaded))
+        return error("%s: failed to read the KV index", __func__);
+
+    boost::unique_lock<boost::shared_mutex> lock(cs_kvindex);
+    mapEntries.swap(mapLoaded);
+    mapPending.clear();
+    nTipHeight = nChainHeight;
+    LogPrintf("%s: loaded %u KV entries at height %d\n", __func__, mapEntries.size(), nTipHeight);
+    return true;
+}
+
+bool CKVIndex::Search(const std::vector<unsigned char>& vchKey, int nCurrentHeight, CKVEntry& entry) const
+{
+    boost::shared_lock<boost::shared_mutex> lock(cs_kvindex);
+    std::map<std::vector<unsigned char>, CKVEntry>::const_iterator it = mapPending.find(vchKey);
+    if (it == mapPending.end()) {
+        it = mapEntries.find(vchKey);
+        if (it == mapEntries.end())
+            return false;
+    }
+    if (IsKVEntryExpired(it->second, nCurrentHeight))
+        return false;
+    entry = it->second;
+    return true;
+}
+
+bool CKVIndex::SearchTip(const std::vector<unsigned char>& vchKey, CKVEntry& entry, int& nHeight) const
+{
+    boost::shared_lock<boost::shared_mutex> lock(cs_kvindex);
+    nHeight = nTipHeight;
+    std::map<std::vector<unsigned char>, CKVEntry>::const_iterator it = mapEntries.find(vchKey);
+    if (it == mapEntries.end() || IsKVEntryExpired(it->second, nTipHeight))
+        return false;
+    entry = it->second;
+    return true;
+}
+
+void CKVIndex::Update(const std::vector<unsigned char>& vchKey, const CKVEntry& entry)
+{
+    boost::unique_lock<boost::shared_mutex> lock(cs_kvindex);
+    mapPending[vchKey] = entry;
+}
+
+bool CKVIndex::ConnectBlock(const CBlockIndex* pindex)
+{
+    AssertLockHeld(cs_main);
+    // Only written to under cs_main, so the pending updates can be read without the lock
+    if (!mapPending.empty()) {
+        CKVBlockUndo undo;
+        undo.hashBlock = pindex->GetBlockHash();
+        for (const std::pair<const std::vector<unsigned char>, CKVEntry>& pending : mapPending)
+            undo.vKeys.push_back(pending.first);
+        if (!pblocktree->WriteKVBlock(pindex->GetHeight(), undo, mapPending))
+            return error("%s: failed to write the KV updates of block %s", __func__, pindex->GetBlockHash().ToString());
+    }
+
+    boost::unique_lock<boost::shared_mutex> lock(cs_kvindex);
+    for (const std::pair<const std::vector<unsigned char>, CKVEntry>& pending : mapPending)
+        mapEntries[pending.first] = pending.second;
+    mapPending.clear();
+    nTipHeight = pindex->GetHeight();
+    return true;
+}
+
+bool CKVIndex::DisconnectBlock(const CBlockIndex* pindex)
+{
+    AssertLockHeld(cs_main);
+    CKVBlockUndo undo;
+    if (pblocktree->ReadKVBlockUndo(pindex->GetHeight(), undo)) {
+        if (undo.hashBlock != pindex->GetBlockHash())
+            return error("%s: the KV updates at height %d are of block %s, not %s", __func__, pindex->GetHeight(),
+                         undo.hashBlock.ToString(), pindex->GetBlockHash().ToString());
+        if (!Undo(pindex->GetHeight(), undo))
+            return false;
+    }
+
+    boost::unique_lock<boost::shared_mutex> lock(cs_kvindex);
+    nTipHeight = pindex->GetHeight() - 1;
+    return true;
+}
+
+bool CKVIndex::Undo(int nBlockHeight, const CKVBlockUndo& undo)
+{
+    std::map<std::vector<unsigned char>, CKVEntry> mapRestored;
+    for (const std::vector<unsigned char>& vchKey : undo.vKeys) {
+        CKVEntry entry;
+        if (pblocktree->ReadKVEntry(vchKey, nBlockHeight - 1, entry))
+            mapRestored[vchKey] = entry;
+    }
+    if (!pblocktree->EraseKVBlock(nBlockHeight, undo))
+        return error("%s: failed to erase the KV updates of block %s", __func__, undo.hashBlock.ToString());
+
+    boost::unique_lock<boost::shared_mutex> lock(cs_kvindex);
+    for (const std::vector<unsigned char>& vchKey : undo.vKeys) {
+        std::map<std::vector<unsigned char>, CKVEntry>::iterator it = mapRestored.find(vchKey);
+        if (it == mapRestored.end())
+            mapEntries.erase(vchKey);
+        else
+            mapEntries[vchKey] = it->second;
+    }
+    return true;
+}
+
+size_t CKVIndex::Size() const
+{
+    boost::shared_lock<boost::shared_mutex> lock(cs_kvindex);
+    return mapEntries.size();
+}
@@ -0,0 +1,134 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_KVINDEX_H
+#define BITCOIN_KVINDEX_H
+
+#include "serialize.h"
+#include "uint256.h"
+
+#include <map>
+#include <vector>
+
+#include <boost/thread/shared_mutex.hpp>
+
+class CBlockIndex;
+class CChain;
+
+/** Value of a key of the on-chain key/value store, as written by a 'K' opreturn */
+struct CKVEntry
+{
+    uint256 pubkey;
+    //! Height given in the opreturn, the expiration is counted from it
+    int32_t nHeight;
+    uint32_t nFlags;
+    std::vector<unsigned char> vchValue;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(pubkey);
+        READWRITE(nHeight);
+        READWRITE(nFlags);
+        READWRITE(vchValue);
+    }
+
+    CKVEntry() : nHeight(0), nFlags(0) {}
+};
+
+/** Database key of the version of an entry written by a block: the key, then the big endian block height */
+struct CKVIndexKey
+{
+    std::vector<unsigned char> vchKey;
+    int nBlockHeight;
+
+    size_t GetSerializeSize(int nType, int nVersion) const {
+        return ::GetSerializeSize(vchKey, nType, nVersion) + 4;
+    }
+    template<typename Stream>
+    void Serialize(Stream& s) const {
+        ::Serialize(s, vchKey);
+        // Big endian so the versions of a key are iterated in height order
+        ser_writedata32be(s, nBlockHeight);
+    }
+    template<typename Stream>
+    void Unserialize(Stream& s) {
+        ::Unserialize(s, vchKey);
+        nBlockHeight = ser_readdata32be(s);
+    }
+
+    CKVIndexKey() : nBlockHeight(0) {}
+    CKVIndexKey(const std::vector<unsigned char>& vchKeyIn, int nBlockHeightIn) : vchKey(vchKeyIn), nBlockHeight(nBlockHeightIn) {}
+};
+
+/** The keys a block wrote a version of, to erase them when it is disconnected */
+struct CKVBlockUndo
+{
+    uint256 hashBlock;
+    std::vector<std::vector<unsigned char>> vKeys;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(hashBlock);
+        READWRITE(vKeys);
+    }
+};
+
+/**
+ * The key/value store of an asset chain, persisted in the block tree
+ * database with a version of an entry for each block that updated it, so a
+ * disconnected block restores the previous versions and a restart doesn't
+ * need the komodostate replay.
+ *
+ * Expired entries are kept and only hidden from the searches, an entry that
+ * expired can come back when the chain is reorganized below its expiration.
+ * The updates of the block being connected are only seen by the searches of
+ * that block's own updates until it is connected as a whole. Searches take a
+ * shared lock, the updates (under cs_main) an exclusive one.
+ */
+class CKVIndex
+{
+public:
+    CKVIndex() : nTipHeight(-1) {}
+
+    /**
+     * Loads the latest version of each entry, undoing first the blocks the
+     * database is ahead of the chain with, which a crash before the chain
+     * state was flushed can leave.
+     */
+    bool Load(const CChain& chain);
+
+    //! Searches an entry still alive at nCurrentHeight, including the updates of the block being connected
+    bool Search(const std::vector<unsigned char>& vchKey, int nCurrentHeight, CKVEntry& entry) const;
+    //! Searches an entry alive at the last block connected, returned in nHeight
+    bool SearchTip(const std::vector<unsigned char>& vchKey, CKVEntry& entry, int& nHeight) const;
+
+    //! Updates an entry for the block being connected
+    void Update(const std::vector<unsigned char>& vchKey, const CKVEntry& entry);
+    //! Writes the updates of the block, and makes them visible
+    bool ConnectBlock(const CBlockIndex* pindex);
+    //! Restores the entries the block updated to their previous versions
+    bool DisconnectBlock(const CBlockIndex* pindex);
+
+    size_t Size() const;
+
+private:
+    mutable boost::shared_mutex cs_kvindex;
+    std::map<std::vector<unsigned char>, CKVEntry> mapEntries;
+    //! Updates of the block being connected
+    std::map<std::vector<unsigned char>, CKVEntry> mapPending;
+    int nTipHeight;
+
+    bool Undo(int nBlockHeight, const CKVBlockUndo& undo);
+};
+
+extern CKVIndex kvIndex;
+
+//! Whether the entry is expired at nCurrentHeight, see komodo_kvduration
+bool IsKVEntryExpired(const CKVEntry& entry, int nCurrentHeight);
+
+#endif // BITCOIN_KVINDEX_H
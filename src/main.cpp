@@ -26,19 +26,32 @@
 #include "addrman.h"
 #include "alert.h"
 #include "arith_uint256.h"
+#include "blockconnectstats.h"
+#include "blockencodings.h"
+#include "blockcompress.h"
+#include "blockfilemap.h"
 #include "importcoin.h"
+#include "ccindex.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
+#include "coinstats.h"
+#include "compactblockindex.h"
 #include "consensus/upgrades.h"
 #include "consensus/validation.h"
+#include "crosschain.h"
 #include "deprecation.h"
+#include "indexbuilder.h"
 #include "init.h"
 #include "merkleblock.h"
 #include "metrics.h"
 #include "notarisationdb.h"
+#include "nspvcache.h"
 #include "net.h"
 #include "pow.h"
+#include "primitives/txview.h"
+#include "proofcache.h"
+#include "script/cc.h"
 #include "script/interpreter.h"
 #include "txdb.h"
 #include "txmempool.h"
@@ -46,11 +59,13 @@
 #include "undo.h"
 #include "util.h"
 #include "utilmoneystr.h"
+#include "util/trace.h"
 #include "validationinterface.h"
 #include "wallet/asyncrpcoperation_sendmany.h"
 #include "wallet/asyncrpcoperation_shieldcoinbase.h"
 #include "policy/fees.h"
 #include "notaries_staked.h"
+#include "replaybench.h"
 
 #include <cstring>
 #include <algorithm>
@@ -89,9 +104,15 @@ int32_t komodo_block2pubkey33(uint8_t *pubkey33,CBlock *block);
 bool Getscriptaddress(char *destaddr,const CScript &scriptPubKey);
 void komodo_setactivation(int32_t height);
 void komodo_pricesupdate(int32_t height,CBlock *pblock);
+void AssetsOrderBookConnect(const CBlock& block);
+void AssetsOrderBookDisconnect(const CBlock& block);
+void AssetsOrderBookAddMempool(const CTransaction& tx);
 
 BlockMap mapBlockIndex;
+CBlockIndexArena blockIndexArena;
 CChain chainActive;
+//! Only accessed through std::atomic_load and std::atomic_store
+static std::shared_ptr<const CChainTipSnapshot> chainTipSnapshot = std::make_shared<const CChainTipSnapshot>();
 CBlockIndex *pindexBestHeader = NULL;
 static int64_t nTimeBestReceived = 0;
 CWaitableCriticalSection csBestBlock;
@@ -105,14 +126,21 @@ bool fArchive = true;
 bool fAddressIndex = false;
 bool fTimestampIndex = false;
 bool fSpentIndex = false;
+bool fCompactBlockIndex = false;
 bool fHavePruned = false;
 bool fPruneMode = false;
 bool fIsBareMultisigStd = true;
 bool fCheckBlockIndex = false;
 bool fCheckpointsEnabled = true;
+bool fAssumeNotarized = false;
+uint256 hashAssumeNotarized;
+//! The block the chainstate was loaded from a snapshot at, if any; blocks before it were never connected here
+static CBlockIndex* pindexSnapshotBase = NULL;
 bool fCoinbaseEnforcedProtectionEnabled = true;
 size_t nCoinCacheUsage = 5000 * 300;
 uint64_t nPruneTarget = 0;
+boost::filesystem::path pathColdBlocks;
+unsigned int nColdBlocksDepth = DEFAULT_COLD_BLOCKS_DEPTH;
 bool fAlerts = DEFAULT_ALERTS;
 /* If the tip is older than this (in seconds), the node is considered to be in initial block download.
  */
@@ -216,6 +244,9 @@ namespace {
     int nLastTmpFile = 0;
     unsigned int maxTempFileSize0 = MAX_TEMPFILE_SIZE;
     unsigned int maxTempFileSize1 = MAX_TEMPFILE_SIZE;
+    /** The block files in pathColdBlocks, so their paths are known without cs_LastBlockFile */
+    CCriticalSection cs_ColdBlockFiles;
+    std::set<int> setColdBlockFiles;
     /** Global flag to indicate we should check to see if there are
      *  block/undo files that should be deleted.  Set on startup
      *  or if we allocate more file space when we're in prune mode
@@ -267,9 +298,13 @@ namespace {
         int64_t nTime;  //! Time of "getdata" request in microseconds.
         bool fValidatedHeaders;  //! Whether this block has validated headers at the time of request.
         int64_t nTimeDisconnect; //! The timeout for this block request (for disconnecting a slow peer)
+        std::shared_ptr<PartiallyDownloadedBlock> partialBlock;  //! Optional, set while reconstructing a cmpctblock.
     };
     map<uint256, pair<NodeId, list<QueuedBlock>::iterator> > mapBlocksInFlight;
 
+    /** Blocks holding up the download window that were asked for again from a second peer, with the time of that request. */
+    map<uint256, pair<NodeId, int64_t> > mapBlocksRedundant;
+
     /** Number of blocks in flight with validated headers. */
     int nQueuedValidatedHeaders = 0;
 
@@ -330,6 +365,20 @@ namespace {
         int nBlocksInFlightValidHeaders;
         //! Whether we consider this a preferred download peer.
         bool fPreferredDownload;
+        //! Whether this peer sent sendcmpct with our version, so it understands cmpctblock.
+        bool fProvidesHeaderAndIDs;
+        //! Whether this peer wants new blocks announced as cmpctblock without an inv.
+        bool fPreferHeaderAndIDs;
+        //! Smoothed download rate (bytes per second) and block size of the blocks we requested from this peer.
+        double dDownloadRate;
+        double dAvgBlockBytes;
+        int nBlocksDownloaded;
+        //! When the last requested block from this peer arrived (in microseconds), or 0.
+        int64_t nLastBlockReceived;
+        //! Number of entries for this peer in mapBlocksRedundant.
+        int nBlocksRedundant;
+        //! Number of blocks we allow in flight from this peer, see GetBlocksInTransitLimit.
+        int nBlocksInFlightLimit;
 
         CNodeState() {
             fCurrentlyConnected = false;
@@ -343,12 +392,23 @@ namespace {
             nBlocksInFlight = 0;
             nBlocksInFlightValidHeaders = 0;
             fPreferredDownload = false;
+            fProvidesHeaderAndIDs = false;
+            fPreferHeaderAndIDs = false;
+            dDownloadRate = 0;
+            dAvgBlockBytes = 0;
+            nBlocksDownloaded = 0;
+            nLastBlockReceived = 0;
+            nBlocksRedundant = 0;
+            nBlocksInFlightLimit = MAX_BLOCKS_IN_TRANSIT_PER_PEER;
         }
     };
 
     /** Map maintaining per-node state. Requires cs_main. */
     map<NodeId, CNodeState> mapNodeState;
 
+    /** Peers we asked to announce new blocks as cmpctblock, oldest first. Requires cs_main. */
+    list<NodeId> lNodesAnnouncingHeaderAndIDs;
+
     // Requires cs_main.
     CNodeState *State(NodeId pnode) {
         map<NodeId, CNodeState>::iterator it = mapNodeState.find(pnode);
@@ -401,8 +461,15 @@ namespace {
 
         BOOST_FOREACH(const QueuedBlock& entry, state->vBlocksInFlight)
         mapBlocksInFlight.erase(entry.hash);
+        for (map<uint256, pair<NodeId, int64_t> >::iterator it = mapBlocksRedundant.begin(); it != mapBlocksRedundant.end(); ) {
+            if (it->second.first == nodeid)
+                mapBlocksRedundant.erase(it++);
+            else
+                ++it;
+        }
         EraseOrphansFor(nodeid);
         nPreferredDownload -= state->fPreferredDownload;
+        lNodesAnnouncingHeaderAndIDs.remove(nodeid);
 
         mapNodeState.erase(nodeid);
     }
@@ -422,6 +489,11 @@ namespace {
     // Requires cs_main.
     // Returns a bool indicating whether we requested this block.
     bool MarkBlockAsReceived(const uint256& hash) {
+        map<uint256, pair<NodeId, int64_t> >::iterator itRedundant = mapBlocksRedundant.find(hash);
+        if (itRedundant != mapBlocksRedundant.end()) {
+            State(itRedundant->second.first)->nBlocksRedundant--;
+            mapBlocksRedundant.erase(itRedundant);
+        }
         map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
         if (itInFlight != mapBlocksInFlight.end()) {
             CNodeState *state = State(itInFlight->second.first);
@@ -437,7 +509,7 @@ namespace {
     }
 
     // Requires cs_main.
-    void MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, const Consensus::Params& consensusParams, CBlockIndex *pindex = NULL) {
+    void MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, const Consensus::Params& consensusParams, CBlockIndex *pindex = NULL, list<QueuedBlock>::iterator *pit = NULL) {
         CNodeState *state = State(nodeid);
         assert(state != NULL);
 
@@ -451,6 +523,57 @@ namespace {
         state->nBlocksInFlight++;
         state->nBlocksInFlightValidHeaders += newentry.fValidatedHeaders;
         mapBlocksInFlight[hash] = std::make_pair(nodeid, it);
+        if (pit)
+            *pit = it;
+    }
+
+    /**
+     * Update the download rate of a peer with a block it sent us, if we asked for it.
+     * Blocks are requested in batches and arrive one after another, so a block took from
+     * when it was requested or the previous one arrived, whichever is later.
+     * Requires cs_main.
+     */
+    void RecordBlockDelivery(NodeId nodeid, const uint256& hash, size_t nBytes, int64_t nTimeReceived) {
+        CNodeState *state = State(nodeid);
+        assert(state != NULL);
+
+        int64_t nTimeRequested;
+        map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
+        map<uint256, pair<NodeId, int64_t> >::iterator itRedundant = mapBlocksRedundant.find(hash);
+        if (itInFlight != mapBlocksInFlight.end() && itInFlight->second.first == nodeid)
+            nTimeRequested = itInFlight->second.second->nTime;
+        else if (itRedundant != mapBlocksRedundant.end() && itRedundant->second.first == nodeid)
+            nTimeRequested = itRedundant->second.second;
+        else
+            return;
+
+        int64_t nElapsed = std::max<int64_t>(nTimeReceived - std::max(nTimeRequested, state->nLastBlockReceived), 1000);
+        double dRate = nBytes * 1000000.0 / nElapsed;
+        if (state->nBlocksDownloaded == 0) {
+            state->dDownloadRate = dRate;
+            state->dAvgBlockBytes = nBytes;
+        } else {
+            state->dDownloadRate += BLOCK_DOWNLOAD_RATE_WEIGHT * (dRate - state->dDownloadRate);
+            state->dAvgBlockBytes += BLOCK_DOWNLOAD_RATE_WEIGHT * (nBytes - state->dAvgBlockBytes);
+        }
+        state->nBlocksDownloaded++;
+        state->nLastBlockReceived = nTimeReceived;
+    }
+
+    /**
+     * Number of blocks to keep in flight from a peer: enough to cover its ping time and
+     * BLOCK_DOWNLOAD_TARGET_SECONDS at its measured rate, so fast peers get a deep pipeline
+     * and slow ones do not hold on to much of the download window.
+     * Requires cs_main.
+     */
+    int GetBlocksInTransitLimit(const CNodeState* state, int64_t nPingUsecTime) {
+        if (state->nBlocksDownloaded == 0 || state->dAvgBlockBytes <= 0)
+            return MAX_BLOCKS_IN_TRANSIT_PER_PEER;
+        double dSeconds = BLOCK_DOWNLOAD_TARGET_SECONDS + nPingUsecTime / 1000000.0;
+        double dBlocks = 1 + state->dDownloadRate * dSeconds / state->dAvgBlockBytes;
+        if (dBlocks > MAX_ADAPTIVE_BLOCKS_IN_TRANSIT)
+            return MAX_ADAPTIVE_BLOCKS_IN_TRANSIT;
+        return std::max(MIN_ADAPTIVE_BLOCKS_IN_TRANSIT, (int)dBlocks);
     }
 
     /** Check whether the last unknown block a peer advertized is not yet known. */
@@ -488,6 +611,40 @@ namespace {
         }
     }
 
+    /**
+     * Ask a peer that just gave us a new tip to announce the next blocks as
+     * cmpctblock, so they arrive without an inv/getdata round trip. Only the
+     * MAX_HB_CMPCTBLOCK_PEERS most recent of them are kept in that mode.
+     * Requires cs_main.
+     */
+    void MaybeSetPeerAsAnnouncingHeaderAndIDs(const CNodeState* nodestate, CNode* pfrom) {
+        if (!nodestate->fProvidesHeaderAndIDs)
+            return;
+        for (list<NodeId>::iterator it = lNodesAnnouncingHeaderAndIDs.begin(); it != lNodesAnnouncingHeaderAndIDs.end(); it++) {
+            if (*it == pfrom->GetId()) {
+                lNodesAnnouncingHeaderAndIDs.erase(it);
+                lNodesAnnouncingHeaderAndIDs.push_back(pfrom->GetId());
+                return;
+            }
+        }
+        bool fAnnounceUsingCMPCTBLOCK = false;
+        uint64_t nCMPCTBLOCKVersion = CMPCTBLOCK_VERSION;
+        if (lNodesAnnouncingHeaderAndIDs.size() >= MAX_HB_CMPCTBLOCK_PEERS) {
+            // As per the protocol, the oldest peer goes back to announcing with inv
+            LOCK(cs_vNodes);
+            BOOST_FOREACH(CNode* pnode, vNodes) {
+                if (pnode->GetId() == lNodesAnnouncingHeaderAndIDs.front()) {
+                    pnode->PushMessage("sendcmpct", fAnnounceUsingCMPCTBLOCK, nCMPCTBLOCKVersion);
+                    break;
+                }
+            }
+            lNodesAnnouncingHeaderAndIDs.pop_front();
+        }
+        fAnnounceUsingCMPCTBLOCK = true;
+        pfrom->PushMessage("sendcmpct", fAnnounceUsingCMPCTBLOCK, nCMPCTBLOCKVersion);
+        lNodesAnnouncingHeaderAndIDs.push_back(pfrom->GetId());
+    }
+
     /** Find the last common ancestor two blocks have.
      *  Both pa and pb must be non-NULL. */
     CBlockIndex* LastCommonAncestor(CBlockIndex* pa, CBlockIndex* pb) {
@@ -508,8 +665,9 @@ namespace {
     }
 
     /** Update pindexLastCommonBlock and add not-in-flight missing successors to vBlocks, until it has
-     *  at most count entries. */
-    void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBlockIndex*>& vBlocks, NodeId& nodeStaller) {
+     *  at most count entries. If nothing can be fetched because of the window, nodeStaller is the peer
+     *  holding it up and *ppindexStalled the block it has in flight at the head of the window. */
+    void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBlockIndex*>& vBlocks, NodeId& nodeStaller, CBlockIndex** ppindexStalled = NULL) {
         if (count == 0)
             return;
 
@@ -547,6 +705,7 @@ namespace {
         int nWindowEnd = state->pindexLastCommonBlock->GetHeight() + BLOCK_DOWNLOAD_WINDOW;
         int nMaxHeight = std::min<int>(state->pindexBestKnownBlock->GetHeight(), nWindowEnd + 1);
         NodeId waitingfor = -1;
+        CBlockIndex* pindexWaitingFor = NULL;
         while (pindexWalk->GetHeight() < nMaxHeight) {
             // Read up to 128 (or more, if more blocks than that are needed) successors of pindexWalk (towards
             // pindexBestKnownBlock) into vToFetch. We fetch 128, because CBlockIndex::GetAncestor may be as expensive
@@ -578,6 +737,8 @@ namespace {
                         if (vBlocks.size() == 0 && waitingfor != nodeid) {
                             // We aren't able to fetch anything, but we would be if the download window was one larger.
                             nodeStaller = waitingfor;
+                            if (ppindexStalled)
+                                *ppindexStalled = pindexWaitingFor;
                         }
                         return;
                     }
@@ -588,6 +749,7 @@ namespace {
                 } else if (waitingfor == -1) {
                     // This is the first already-in-flight block.
                     waitingfor = mapBlocksInFlight[pindex->GetBlockHash()].first;
+                    pindexWaitingFor = pindex;
                 }
             }
         }
@@ -607,6 +769,9 @@ bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats) {
         if (queue.pindex)
             stats.vHeightInFlight.push_back(queue.pindex->GetHeight());
     }
+    stats.dDownloadRate = state->nBlocksDownloaded ? state->dDownloadRate : 0;
+    stats.nBlocksInFlightLimit = state->nBlocksInFlightLimit;
+    stats.nBlocksDownloaded = state->nBlocksDownloaded;
     return true;
 }
 
@@ -647,6 +812,7 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 }
 
 CCoinsViewCache *pcoinsTip = NULL;
+CCoinsViewAsyncFlush *pcoinsAsyncFlush = NULL;
 CBlockTreeDB *pblocktree = NULL;
 
 // Komodo globals
@@ -656,7 +822,6 @@ CBlockTreeDB *pblocktree = NULL;
 
 UniValue komodo_snapshot(int top)
 {
-    LOCK(cs_main);
     int64_t total = -1;
     UniValue result(UniValue::VOBJ);
 
@@ -1176,6 +1341,84 @@ bool ContextualCheckCoinbaseTransaction(int32_t slowflag,const CBlock *block,CBl
     return(true);
 }
 
+bool CEquihashCheck::operator()() {
+    return CheckEquihashSolution(pheader, Params());
+}
+
+bool CBlockParseCheck::operator()() {
+    CBlockFileRecord& rec = *prec;
+    try {
+        UnserializeRecord(begin_ptr(rec.vRecord), rec.vRecord.size(), rec.block);
+    } catch (const std::exception& e) {
+        rec.strError = strprintf("Deserialize or I/O error - %s", e.what());
+        rec.fCorrupt = true;
+        return true;
+    }
+    rec.hash = rec.block.GetHash();
+
+    bool mutated;
+    if (rec.block.BuildMerkleTree(&mutated) != rec.block.hashMerkleRoot || mutated) {
+        rec.strError = strprintf("block %s does not match its merkle root", rec.hash.ToString());
+        return true;
+    }
+    // The checks in ProcessNewBlock decide about an invalid solution
+    CheckEquihashSolution(&rec.block, Params());
+    return true;
+}
+
+bool CSaplingCheck::operator()() {
+    const CTransaction& tx = *ptx;
+    auto ctx = librustzcash_sapling_verification_ctx_init();
+
+    for (const SpendDescription &spend : tx.vShieldedSpend) {
+        if (!librustzcash_sapling_check_spend(
+            ctx,
+            spend.cv.begin(),
+            spend.anchor.begin(),
+            spend.nullifier.begin(),
+            spend.rk.begin(),
+            spend.zkproof.begin(),
+            spend.spendAuthSig.begin(),
+            dataToBeSigned.begin()
+        ))
+        {
+            librustzcash_sapling_verification_ctx_free(ctx);
+            strRejectReason = "bad-txns-sapling-spend-description-invalid";
+            return false;
+        }
+    }
+
+    for (const OutputDescription &output : tx.vShieldedOutput) {
+        if (!librustzcash_sapling_check_output(
+            ctx,
+            output.cv.begin(),
+            output.cm.begin(),
+            output.ephemeralKey.begin(),
+            output.zkproof.begin()
+        ))
+        {
+            librustzcash_sapling_verification_ctx_free(ctx);
+            strRejectReason = "bad-txns-sapling-output-description-invalid";
+            return false;
+        }
+    }
+
+    if (!librustzcash_sapling_final_check(
+        ctx,
+        tx.valueBalance,
+        tx.bindingSig.begin(),
+        dataToBeSigned.begin()
+    ))
+    {
+        librustzcash_sapling_verification_ctx_free(ctx);
+        strRejectReason = "bad-txns-sapling-binding-signature-invalid";
+        return false;
+    }
+
+    librustzcash_sapling_verification_ctx_free(ctx);
+    return true;
+}
+
 /**
  * Check a transaction contextually against a set of consensus rules valid at a given block height.
  *
@@ -1190,7 +1433,8 @@ bool ContextualCheckTransaction(int32_t slowflag,const CBlock *block, CBlockInde
         CValidationState &state,
         const int nHeight,
         const int dosLevel,
-        bool (*isInitBlockDownload)(),int32_t validateprices)
+        bool (*isInitBlockDownload)(),int32_t validateprices,
+        std::vector<CSaplingCheck> *pvSaplingChecks)
 {
     bool overwinterActive = NetworkUpgradeActive(nHeight, Params().GetConsensus(), Consensus::UPGRADE_OVERWINTER);
     bool saplingActive = NetworkUpgradeActive(nHeight, Params().GetConsensus(), Consensus::UPGRADE_SAPLING);
@@ -1290,6 +1534,7 @@ bool ContextualCheckTransaction(int32_t slowflag,const CBlock *block, CBlockInde
     }
 
     uint256 dataToBeSigned;
+    bool fProofsCached = false;
 
     if (!tx.IsMint() &&
         (!tx.vjoinsplit.empty() ||
@@ -1297,6 +1542,8 @@ bool ContextualCheckTransaction(int32_t slowflag,const CBlock *block, CBlockInde
          !tx.vShieldedOutput.empty()))
     {
         auto consensusBranchId = CurrentEpochBranchId(nHeight, Params().GetConsensus());
+        // Verified when the transaction entered the mempool
+        fProofsCached = ProofCacheContains(tx.GetHash(), consensusBranchId);
         // Empty output script.
         CScript scriptCode;
         try {
@@ -1308,7 +1555,7 @@ bool ContextualCheckTransaction(int32_t slowflag,const CBlock *block, CBlockInde
 
     }
 
-    if (!(tx.IsMint() || tx.vjoinsplit.empty()))
+    if (!(tx.IsMint() || tx.vjoinsplit.empty()) && !fProofsCached)
     {
         BOOST_STATIC_ASSERT(crypto_sign_PUBLICKEYBYTES == 32);
 
@@ -1331,57 +1578,17 @@ bool ContextualCheckTransaction(int32_t slowflag,const CBlock *block, CBlockInde
                                 REJECT_INVALID, "bad-txns-invalid-script-data-for-coinbase-time-lock");
     }
 
-    if (!tx.vShieldedSpend.empty() ||
-        !tx.vShieldedOutput.empty())
+    if ((!tx.vShieldedSpend.empty() ||
+         !tx.vShieldedOutput.empty()) && !fProofsCached)
     {
-        auto ctx = librustzcash_sapling_verification_ctx_init();
-
-        for (const SpendDescription &spend : tx.vShieldedSpend) {
-            if (!librustzcash_sapling_check_spend(
-                ctx,
-                spend.cv.begin(),
-                spend.anchor.begin(),
-                spend.nullifier.begin(),
-                spend.rk.begin(),
-                spend.zkproof.begin(),
-                spend.spendAuthSig.begin(),
-                dataToBeSigned.begin()
-            ))
-            {
-                librustzcash_sapling_verification_ctx_free(ctx);
-                return state.DoS(100, error("ContextualCheckTransaction(): Sapling spend description invalid"),
-                                      REJECT_INVALID, "bad-txns-sapling-spend-description-invalid");
-            }
-        }
-
-        for (const OutputDescription &output : tx.vShieldedOutput) {
-            if (!librustzcash_sapling_check_output(
-                ctx,
-                output.cv.begin(),
-                output.cm.begin(),
-                output.ephemeralKey.begin(),
-                output.zkproof.begin()
-            ))
-            {
-                librustzcash_sapling_verification_ctx_free(ctx);
-                return state.DoS(100, error("ContextualCheckTransaction(): Sapling output description invalid"),
-                                      REJECT_INVALID, "bad-txns-sapling-output-description-invalid");
-            }
-        }
-
-        if (!librustzcash_sapling_final_check(
-            ctx,
-            tx.valueBalance,
-            tx.bindingSig.begin(),
-            dataToBeSigned.begin()
-        ))
-        {
-            librustzcash_sapling_verification_ctx_free(ctx);
-            return state.DoS(100, error("ContextualCheckTransaction(): Sapling binding signature invalid"),
-                                  REJECT_INVALID, "bad-txns-sapling-binding-signature-invalid");
+        CSaplingCheck check(tx, dataToBeSigned);
+        if (pvSaplingChecks) {
+            pvSaplingChecks->push_back(CSaplingCheck());
+            check.swap(pvSaplingChecks->back());
+        } else if (!check()) {
+            return state.DoS(100, error("ContextualCheckTransaction(): %s", check.GetRejectReason()),
+                                  REJECT_INVALID, check.GetRejectReason());
         }
-
-        librustzcash_sapling_verification_ctx_free(ctx);
     }
     return true;
 }
@@ -1428,6 +1635,10 @@ bool CheckTransaction(uint32_t tiptime,const CTransaction& tx, CValidationState
     if (!CheckTransactionWithoutProofVerification(tiptime,tx, state)) {
         return false;
     } else {
+        // The proofs do not depend on the branch, but the cache entry is for the branch of the next block
+        if (!tx.vjoinsplit.empty() && chainActive.Tip() != 0 &&
+            ProofCacheContains(tx.GetHash(), CurrentEpochBranchId(chainActive.Tip()->GetHeight() + 1, Params().GetConsensus())))
+            return true;
         // Ensure that zk-SNARKs v|| y
         BOOST_FOREACH(const JSDescription &joinsplit, tx.vjoinsplit) {
             if (!joinsplit.Verify(*pzcashParams, verifier, tx.joinSplitPubKey)) {
@@ -1442,22 +1653,11 @@ bool CheckTransaction(uint32_t tiptime,const CTransaction& tx, CValidationState
 // ARRR notary exception
 int32_t komodo_isnotaryvout(char *coinaddr,uint32_t tiptime) // from ac_private chains only
 {
-    int32_t season = getacseason(tiptime);
-    if ( NOTARY_ADDRESSES[season-1][0][0] == 0 )
-    {
-        uint8_t pubkeys[64][33];
-        komodo_notaries(pubkeys,0,tiptime);
-    }
+    const struct komodo_notaryset *set;
     if ( strcmp(coinaddr,CRYPTO777_KMDADDR) == 0 )
         return(1);
-    for (int32_t i = 0; i < NUM_KMD_NOTARIES; i++)
-    {
-        if ( strcmp(coinaddr,NOTARY_ADDRESSES[season-1][i]) == 0 )
-        {
-            //fprintf(stderr, "coinaddr.%s notaryaddress[%i].%s\n",coinaddr,i,NOTARY_ADDRESSES[season-1][i]);
-            return(1);
-        }
-    }
+    if ( (set= komodo_notaryset_get(0,tiptime)) != 0 && komodo_notaryset_findaddr(set,coinaddr) >= 0 )
+        return(1);
     return(0);
 }
 
@@ -1808,7 +2008,7 @@ CAmount GetMinRelayFee(const CTransaction& tx, unsigned int nBytes, bool fAllowF
 }
 
 
-bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,bool* pfMissingInputs, bool fRejectAbsurdFee, int dosLevel)
+static bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,bool* pfMissingInputs, bool fRejectAbsurdFee, int dosLevel)
 {
     AssertLockHeld(cs_main);
     if (pfMissingInputs)
@@ -1852,6 +2052,9 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
     {
         return error("AcceptToMemoryPool: ContextualCheckTransaction failed");
     }
+    // Both checks above verified the proofs with a strict verifier, so the block holding this tx need not
+    if (!tx.IsMint() && (!tx.vjoinsplit.empty() || !tx.vShieldedSpend.empty() || !tx.vShieldedOutput.empty()))
+        ProofCacheAdd(tx.GetHash(), CurrentEpochBranchId(nextBlockHeight, Params().GetConsensus()));
 //fprintf(stderr,"addmempool 2\n");
   // Coinbase is only valid in a block, not as a loose transaction
     if (tx.IsCoinBase())
@@ -2036,6 +2239,13 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
             }
         }
 
+        // A full mempool only takes transactions paying more than the ones it evicted
+        CAmount mempoolRejectFee = pool.GetMinFee(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFee(nSize);
+        if (fLimitFree && mempoolRejectFee > 0 && nFees < mempoolRejectFee && !tx.IsCoinImport() && !tx.IsPegsImport())
+        {
+            return state.DoS(0, error("AcceptToMemoryPool: mempool min fee not met %s, %d < %d",hash.ToString(), nFees, mempoolRejectFee),REJECT_INSUFFICIENTFEE, "mempool min fee not met");
+        }
+
         // Require that free transactions have sufficient priority to be mined in the next block.
         if (GetBoolArg("-relaypriority", false) && nFees < ::minRelayTxFee.GetFee(nSize) && !AllowFree(view.GetPriority(tx, chainActive.Height() + 1))) {
             fprintf(stderr,"accept failure.6\n");
@@ -2117,6 +2327,7 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
             LOCK(pool.cs);
             // Store transaction in memory
             pool.addUnchecked(hash, entry, !IsInitialBlockDownload());
+            TRACE3(mempool, added, hash.begin(), entry.GetTxSize(), entry.GetFee());
             if (!tx.IsCoinImport())
             {
                 // Add memory address index
@@ -2129,13 +2340,28 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
                     pool.addSpentIndex(entry, view);
                 }
             }
+
+            // Keep the pool within -maxmempool, which may evict this transaction again
+            pool.TrimToSize(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000);
+            if (!pool.exists(hash))
+                return state.DoS(0, error("AcceptToMemoryPool: mempool full"), REJECT_INSUFFICIENTFEE, "mempool full");
         }
+        if (&pool == &mempool)
+            AssetsOrderBookAddMempool(tx);
     }
     // This should be here still?
     //SyncWithWallets(tx, NULL);
     return true;
 }
 
+bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,bool* pfMissingInputs, bool fRejectAbsurdFee, int dosLevel)
+{
+    if (AcceptToMemoryPoolWorker(pool, state, tx, fLimitFree, pfMissingInputs, fRejectAbsurdFee, dosLevel))
+        return true;
+    TRACE3(mempool, rejected, tx.GetHash().begin(), state.GetRejectReason().c_str(), state.GetRejectCode());
+    return false;
+}
+
 bool CCTxFixAcceptToMemPoolUnchecked(CTxMemPool& pool, const CTransaction &tx)
 {
     // called from CheckBlock which is in cs_main and mempool.cs locks already.
@@ -2150,8 +2376,41 @@ bool GetTimestampIndex(const unsigned int &high, const unsigned int &low, const
 {
     if (!fTimestampIndex)
         return error("Timestamp index not enabled");
+    if (IsIndexBuilding(INDEX_BUILD_TIMESTAMP))
+        return error("Timestamp index is still being built");
+
+    return GetTimestampIndex(CTimestampIndexKey(low, uint256()), high, fActiveOnly, [&hashes](const CTimestampIndexKey& key, int nHeight) {
+        hashes.push_back(std::make_pair(key.blockHash, key.timestamp));
+        return true;
+    });
+}
+
+//! Whether the block of a timestamp index entry is on the chain of the snapshot
+static bool IsTimestampEntryActive(const CChainTipSnapshot& tip, const CTimestampIndexKey& key, int nHeight)
+{
+    if (nHeight > 0) {
+        const CBlockIndex* pindex = tip[nHeight];
+        return pindex != NULL && pindex->GetBlockHash() == key.blockHash;
+    }
+    // Entries written before the height was stored need the block index
+    LOCK(cs_main);
+    BlockMap::const_iterator it = mapBlockIndex.find(key.blockHash);
+    return it != mapBlockIndex.end() && tip.Contains(it->second);
+}
+
+bool GetTimestampIndex(const CTimestampIndexKey& start, unsigned int high, bool fActiveOnly, const TimestampIndexVisitor& visit)
+{
+    if (!fTimestampIndex)
+        return error("Timestamp index not enabled");
+    if (IsIndexBuilding(INDEX_BUILD_TIMESTAMP))
+        return error("Timestamp index is still being built");
 
-    if (!pblocktree->ReadTimestampIndex(high, low, fActiveOnly, hashes))
+    std::shared_ptr<const CChainTipSnapshot> tip = GetChainTipSnapshot();
+    if (!pblocktree->ReadTimestampIndex(start, high, [fActiveOnly, &tip, &visit](const CTimestampIndexKey& key, int nHeight) {
+            if (fActiveOnly && !IsTimestampEntryActive(*tip, key, nHeight))
+                return true;
+            return visit(key, nHeight);
+        }))
         return error("Unable to get hashes for timestamps");
 
     return true;
@@ -2159,7 +2418,7 @@ bool GetTimestampIndex(const unsigned int &high, const unsigned int &low, const
 
 bool GetSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value)
 {
-    if (!fSpentIndex)
+    if (!fSpentIndex || IsIndexBuilding(INDEX_BUILD_SPENT))
         return false;
 
     if (mempool.getSpentIndex(key, value))
@@ -2176,6 +2435,8 @@ bool GetAddressIndex(uint160 addressHash, int type,
 {
     if (!fAddressIndex)
         return error("address index not enabled");
+    if (IsIndexBuilding(INDEX_BUILD_ADDRESS))
+        return error("address index is still being built");
 
     if (!pblocktree->ReadAddressIndex(addressHash, type, addressIndex, start, end))
         return error("unable to get txids for address");
@@ -2188,6 +2449,8 @@ bool GetAddressUnspent(uint160 addressHash, int type,
 {
     if (!fAddressIndex)
         return error("address index not enabled");
+    if (IsIndexBuilding(INDEX_BUILD_ADDRESS))
+        return error("address index is still being built");
 
     if (!pblocktree->ReadAddressUnspentIndex(addressHash, type, unspentOutputs))
         return error("unable to get txids for address");
@@ -2195,6 +2458,32 @@ bool GetAddressUnspent(uint160 addressHash, int type,
     return true;
 }
 
+bool GetAddressIndex(const CAddressIndexKey& start, int end, const AddressIndexVisitor& visit)
+{
+    if (!fAddressIndex)
+        return error("address index not enabled");
+    if (IsIndexBuilding(INDEX_BUILD_ADDRESS))
+        return error("address index is still being built");
+
+    if (!pblocktree->ReadAddressIndex(start, end, visit))
+        return error("unable to get txids for address");
+
+    return true;
+}
+
+bool GetAddressUnspent(const CAddressUnspentKey& start, const AddressUnspentVisitor& visit)
+{
+    if (!fAddressIndex)
+        return error("address index not enabled");
+    if (IsIndexBuilding(INDEX_BUILD_ADDRESS))
+        return error("address index is still being built");
+
+    if (!pblocktree->ReadAddressUnspentIndex(start, visit))
+        return error("unable to get txids for address");
+
+    return true;
+}
+
 struct CompareBlocksByHeightMain
 {
     bool operator()(const CBlockIndex* a, const CBlockIndex* b) const
@@ -2237,6 +2526,8 @@ bool myAddtomempool(CTransaction &tx, CValidationState *pstate, bool fSkipExpiry
     else return(true);
 }
 
+static bool ReadTxFromDisk(const CDiskTxPos& postx, CBlockHeader& header, CTransaction& txOut);
+
 bool myGetTransaction(const uint256 &hash, CTransaction &txOut, uint256 &hashBlock)
 {
     memset(&hashBlock,0,sizeof(hashBlock));
@@ -2267,19 +2558,9 @@ bool myGetTransaction(const uint256 &hash, CTransaction &txOut, uint256 &hashBlo
         CDiskTxPos postx;
         //fprintf(stderr,"ReadTxIndex\n");
         if (pblocktree->ReadTxIndex(hash, postx)) {
-            //fprintf(stderr,"OpenBlockFile\n");
-            CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
-            if (file.IsNull())
-                return error("%s: OpenBlockFile failed", __func__);
             CBlockHeader header;
-            //fprintf(stderr,"seek and read\n");
-            try {
-                file >> header;
-                fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
-                file >> txOut;
-            } catch (const std::exception& e) {
-                return error("%s: Deserialize or I/O error - %s", __func__, e.what());
-            }
+            if (!ReadTxFromDisk(postx, header, txOut))
+                return false;
             hashBlock = header.GetHash();
             if (txOut.GetHash() != hash)
                 return error("%s: txid mismatch", __func__);
@@ -2325,17 +2606,9 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, uint256 &hashBlock
     if (fTxIndex) {
         CDiskTxPos postx;
         if (pblocktree->ReadTxIndex(hash, postx)) {
-            CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
-            if (file.IsNull())
-                return error("%s: OpenBlockFile failed", __func__);
             CBlockHeader header;
-            try {
-                file >> header;
-                fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
-                file >> txOut;
-            } catch (const std::exception& e) {
-                return error("%s: Deserialize or I/O error - %s", __func__, e.what());
-            }
+            if (!ReadTxFromDisk(postx, header, txOut))
+                return false;
             hashBlock = header.GetHash();
             if (txOut.GetHash() != hash)
                 return error("%s: txid mismatch", __func__);
@@ -2391,43 +2664,110 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, uint256 &hashBlock
 // CBlock and CBlockIndex
 //
 
-bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
+//! Mappings of the blk and rev files blocks and undo data are read from
+static CBlockFileMapper blockFileMapper;
+
+/**
+ * Reads the record at pos of a blk or rev file, as stored and followed by nTrailer
+ * bytes, as a span of the mapped file if it can be mapped and into vBuf otherwise.
+ */
+static bool ReadRecordFromDisk(const CDiskBlockPos& pos, const char* prefix, size_t nTrailer, CMappedSpan& span, std::vector<char>& vBuf)
 {
-    // Open history file to append
-    CAutoFile fileout(OpenBlockFile(pos), SER_DISK, CLIENT_VERSION);
-    if (fileout.IsNull())
-        return error("WriteBlockToDisk: OpenBlockFile failed");
+    span = CMappedSpan();
+    vBuf.clear();
+    if (blockFileMapper.Read(pos, prefix, nTrailer, span))
+        return true;
+
+    // Read the size stored in front of the record, then the record itself
+    if (pos.nPos < 4)
+        return error("%s: invalid position %s", __func__, pos.ToString());
+    CDiskBlockPos posSize(pos.nFile, pos.nPos - 4);
+    CAutoFile filein(strcmp(prefix, "rev") == 0 ? OpenUndoFile(posSize, true) : OpenBlockFile(posSize, true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return error("%s: failed to open %s file for %s", __func__, prefix, pos.ToString());
+    unsigned int nSize;
+    filein >> nSize;
+    if (nSize > MAX_SIZE)
+        return error("%s: invalid record size %u at %s", __func__, nSize, pos.ToString());
+    vBuf.resize(nSize + nTrailer);
+    filein.read(begin_ptr(vBuf), vBuf.size());
+    span.data = begin_ptr(vBuf);
+    span.size = vBuf.size();
+    return true;
+}
+
+static bool ReadTxFromDisk(const CDiskTxPos& postx, CBlockHeader& header, CTransaction& txOut)
+{
+    try {
+        CMappedSpan span;
+        std::vector<char> vBuf, vRaw;
+        if (!ReadRecordFromDisk(postx, "blk", 0, span, vBuf))
+            return false;
+        // The offset is into the block as serialized, so a compressed one is inflated first
+        const char* pData = span.data;
+        size_t nSize = span.size;
+        if (IsCompressedRecord(pData, nSize)) {
+            DecompressRecordFromDisk(pData, nSize, vRaw);
+            pData = begin_ptr(vRaw);
+            nSize = vRaw.size();
+        }
+        CSpanReader reader(SER_DISK, CLIENT_VERSION, pData, nSize);
+        reader >> header;
+        reader.ignore(postx.nTxOffset);
+        reader >> txOut;
+    } catch (const std::exception& e) {
+        return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+    }
+    return true;
+}
 
+//! Appends a record serialized by SerializeRecord to the file at pos, and sets pos to it
+static bool WriteRecordToDisk(CAutoFile& fileout, const std::vector<char>& vRecord, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
+{
     // Write index header
-    unsigned int nSize = GetSerializeSize(fileout, block);
+    unsigned int nSize = vRecord.size();
     fileout << FLATDATA(messageStart) << nSize;
 
-    // Write block
+    // Write record
     long fileOutPos = ftell(fileout.Get());
     if (fileOutPos < 0)
-        return error("WriteBlockToDisk: ftell failed");
+        return error("%s: ftell failed", __func__);
     pos.nPos = (unsigned int)fileOutPos;
-    fileout << block;
-
+    fileout.write(begin_ptr(vRecord), vRecord.size());
     return true;
 }
 
+bool WriteBlockToDisk(const std::vector<char>& vRecord, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
+{
+    // Open history file to append
+    CAutoFile fileout(OpenBlockFile(pos), SER_DISK, CLIENT_VERSION);
+    if (fileout.IsNull())
+        return error("WriteBlockToDisk: OpenBlockFile failed");
+    return WriteRecordToDisk(fileout, vRecord, pos, messageStart);
+}
+
+bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
+{
+    std::vector<char> vRecord;
+    SerializeRecord(block, vRecord);
+    return WriteBlockToDisk(vRecord, pos, messageStart);
+}
+
 bool ReadBlockFromDisk(int32_t height,CBlock& block, const CDiskBlockPos& pos,bool checkPOW)
 {
     uint8_t pubkey33[33];
     block.SetNull();
 
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-    {
-        //fprintf(stderr,"readblockfromdisk err A\n");
-        return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
-    }
-
-    // Read block
+    // Read block, straight from a mapping of the history file if possible
     try {
-        filein >> block;
+        CMappedSpan span;
+        std::vector<char> vBuf;
+        if (!ReadRecordFromDisk(pos, "blk", 0, span, vBuf))
+        {
+            //fprintf(stderr,"readblockfromdisk err A\n");
+            return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
+        }
+        UnserializeRecord(span.data, span.size, block);
     }
     catch (const std::exception& e) {
         fprintf(stderr,"readblockfromdisk err B\n");
@@ -2461,6 +2801,55 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex,bool checkPOW)
     return true;
 }
 
+bool ReadRawBlockFromDisk(CMappedSpan& span, std::vector<char>& vRaw, const CDiskBlockPos& pos, const uint256& hash)
+{
+    try {
+        if (!ReadRecordFromDisk(pos, "blk", 0, span, vRaw))
+            return false;
+        if (span.file == NULL) {
+            // Read into vRaw
+            span = CMappedSpan();
+            if (vRaw.size() > MAX_PROTOCOL_MESSAGE_LENGTH)
+                return error("%s: invalid block size %u at %s", __func__, vRaw.size(), pos.ToString());
+        }
+        if (span.data != NULL ? IsCompressedRecord(span.data, span.size) : IsCompressedRecord(begin_ptr(vRaw), vRaw.size())) {
+            // A compressed block is served in its uncompressed serialization
+            std::vector<char> vFrame;
+            vFrame.swap(vRaw);
+            DecompressRecordFromDisk(span.data != NULL ? span.data : begin_ptr(vFrame), span.data != NULL ? span.size : vFrame.size(), vRaw);
+            span = CMappedSpan();
+        }
+
+        const char* pData = span.data != NULL ? span.data : begin_ptr(vRaw);
+        size_t nSize = span.data != NULL ? span.size : vRaw.size();
+        CBlockHeader header;
+        CSpanReader reader(SER_DISK, CLIENT_VERSION, pData, nSize);
+        reader >> header;
+        if (header.GetHash() != hash)
+            return error("%s: block at %s does not match %s", __func__, pos.ToString(), hash.ToString());
+    }
+    catch (const std::exception& e) {
+        return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
+    }
+    return true;
+}
+
+bool ReadBlockViewFromDisk(CMappedSpan& span, std::vector<char>& vRaw, const CBlockIndex* pindex, CBlockView& view)
+{
+    if (!ReadRawBlockFromDisk(span, vRaw, pindex->GetBlockPos(), pindex->GetBlockHash()))
+        return false;
+    try {
+        if (span.data != NULL)
+            view = CBlockView(span.data, span.size);
+        else
+            view = CBlockView(begin_ptr(vRaw), vRaw.size());
+    }
+    catch (const std::exception& e) {
+        return error("%s: Deserialize error - %s at %s", __func__, e.what(), pindex->GetBlockPos().ToString());
+    }
+    return true;
+}
+
 //uint64_t komodo_moneysupply(int32_t height);
 extern char ASSETCHAINS_SYMBOL[KOMODO_ASSETCHAIN_MAXLEN];
 extern uint64_t ASSETCHAINS_ENDSUBSIDY[ASSETCHAINS_MAX_ERAS+1], ASSETCHAINS_REWARD[ASSETCHAINS_MAX_ERAS+1], ASSETCHAINS_HALVING[ASSETCHAINS_MAX_ERAS+1];
@@ -2782,13 +3171,33 @@ void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, int nHeight)
 
 bool CScriptCheck::operator()() {
     const CScript &scriptSig = ptxTo->vin[nIn].scriptSig;
-    ServerTransactionSignatureChecker checker(ptxTo, nIn, amount, cacheStore, *txdata);
+    ServerTransactionSignatureChecker checker(ptxTo, nIn, amount, cacheStore, *txdata, fSkipEval);
     if (!VerifyScript(scriptSig, scriptPubKey, nFlags, checker, consensusBranchId, &error)) {
         return ::error("CScriptCheck(): %s:%d VerifySignature failed: %s", ptxTo->GetHash().ToString(), nIn, ScriptErrorString(error));
     }
     return true;
 }
 
+bool CCCEvalCheck::operator()() {
+    std::vector<unsigned char> ffillBin;
+    if (!GetPushData(ptxTo->vin[nIn].scriptSig, ffillBin) || ffillBin.empty())
+        return ::error("CCCEvalCheck(): %s:%d no fulfillment", ptxTo->GetHash().ToString(), nIn);
+    // Hash type is one byte tacked on to the end of the fulfillment
+    CC *cond = cc_readFulfillmentBinary(ffillBin.data(), ffillBin.size() - 1);
+    if (!cond)
+        return ::error("CCCEvalCheck(): %s:%d invalid fulfillment", ptxTo->GetHash().ToString(), nIn);
+
+    ServerTransactionSignatureChecker checker(ptxTo, nIn, amount, cacheStore, *txdata);
+    VerifyEval eval = [] (CC *cond, void *checker) {
+        return ((ServerTransactionSignatureChecker*)checker)->CheckEvalCondition(cond);
+    };
+    bool fValid = cc_verifyEval(cond, eval, &checker) == 1;
+    cc_free(cond);
+    if (!fValid)
+        return ::error("CCCEvalCheck(): %s:%d Eval condition failed", ptxTo->GetHash().ToString(), nIn);
+    return true;
+}
+
 int GetSpendHeight(const CCoinsViewCache& inputs)
 {
     LOCK(cs_main);
@@ -2908,7 +3317,8 @@ bool ContextualCheckInputs(
                            PrecomputedTransactionData& txdata,
                            const Consensus::Params& consensusParams,
                            uint32_t consensusBranchId,
-                           std::vector<CScriptCheck> *pvChecks)
+                           std::vector<CScriptCheck> *pvChecks,
+                           std::vector<CCCEvalCheck> *pvEvalChecks)
 {
     if (!tx.IsMint())
     {
@@ -2934,7 +3344,10 @@ bool ContextualCheckInputs(
                 assert(coins);
 
                 // Verify signature
-                CScriptCheck check(*coins, tx, i, flags, cacheStore, consensusBranchId, &txdata);
+                const bool fDeferEval = pvChecks && pvEvalChecks && coins->vout[prevout.n].scriptPubKey.IsPayToCryptoCondition();
+                CScriptCheck check(*coins, tx, i, flags, cacheStore, consensusBranchId, &txdata, fDeferEval);
+                if (fDeferEval)
+                    pvEvalChecks->push_back(CCCEvalCheck(tx, i, coins->vout[prevout.n].nValue, cacheStore, &txdata));
                 if (pvChecks) {
                     pvChecks->push_back(CScriptCheck());
                     check.swap(pvChecks->back());
@@ -3015,23 +3428,17 @@ bool ContextualCheckInputs(
 
 namespace {
 
-    bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint256& hashBlock, const CMessageHeader::MessageStartChars& messageStart)
+    //! Writes vRecord, blockundo as serialized by SerializeRecord, followed by its checksum
+    bool UndoWriteToDisk(const CBlockUndo& blockundo, const std::vector<char>& vRecord, CDiskBlockPos& pos, const uint256& hashBlock, const CMessageHeader::MessageStartChars& messageStart)
     {
         // Open history file to append
         CAutoFile fileout(OpenUndoFile(pos), SER_DISK, CLIENT_VERSION);
         if (fileout.IsNull())
             return error("%s: OpenUndoFile failed", __func__);
 
-        // Write index header
-        unsigned int nSize = GetSerializeSize(fileout, blockundo);
-        fileout << FLATDATA(messageStart) << nSize;
-
-        // Write undo data
-        long fileOutPos = ftell(fileout.Get());
-        if (fileOutPos < 0)
-            return error("%s: ftell failed", __func__);
-        pos.nPos = (unsigned int)fileOutPos;
-        fileout << blockundo;
+        // Write index header and undo data
+        if (!WriteRecordToDisk(fileout, vRecord, pos, messageStart))
+            return false;
 
         // calculate & write checksum
         CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
@@ -3044,16 +3451,17 @@ namespace {
 
     bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock)
     {
-        // Open history file to read
-        CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
-        if (filein.IsNull())
-            return error("%s: OpenBlockFile failed", __func__);
-
-        // Read block
+        // Read block, from a mapping of the undo file if possible
         uint256 hashChecksum;
         try {
-            filein >> blockundo;
-            filein >> hashChecksum;
+            CMappedSpan span;
+            std::vector<char> vBuf;
+            if (!ReadRecordFromDisk(pos, "rev", sizeof(hashChecksum), span, vBuf))
+                return error("%s: OpenUndoFile failed", __func__);
+            // The checksum follows the undo data as stored
+            size_t nRecord = UnserializeRecord(span.data, span.size, blockundo);
+            CSpanReader reader(SER_DISK, CLIENT_VERSION, span.data + nRecord, span.size - nRecord);
+            reader >> hashChecksum;
         }
         catch (const std::exception& e) {
             return error("%s: Deserialize or I/O error - %s", __func__, e.what());
@@ -3088,48 +3496,189 @@ namespace {
 
 } // anon namespace
 
-/**
- * Apply the undo operation of a CTxInUndo to the given chain state.
- * @param undo The undo object.
- * @param view The coins view to which to apply the changes.
- * @param out The out point that corresponds to the tx input.
- * @return True on success.
- */
-static bool ApplyTxInUndo(const CTxInUndo& undo, CCoinsViewCache& view, const COutPoint& out)
+bool ReadBlockUndoFromDisk(CBlockUndo& blockundo, const CBlockIndex* pindex)
 {
-    bool fClean = true;
-
-    CCoinsModifier coins = view.ModifyCoins(out.hash);
-    if (undo.nHeight != 0) {
-        // undo data contains height: this is the last output of the prevout tx being spent
-        if (!coins->IsPruned())
-            fClean = fClean && error("%s: undo data overwriting existing transaction", __func__);
-        coins->Clear();
-        coins->fCoinBase = undo.fCoinBase;
-        coins->nHeight = undo.nHeight;
-        coins->nVersion = undo.nVersion;
-    } else {
-        if (coins->IsPruned())
-            fClean = fClean && error("%s: undo data adding output to missing transaction", __func__);
-    }
-    if (coins->IsAvailable(out.n))
-        fClean = fClean && error("%s: undo data overwriting existing output", __func__);
-    if (coins->vout.size() < out.n+1)
-        coins->vout.resize(out.n+1);
-    coins->vout[out.n] = undo.txout;
-
-    return fClean;
+    CDiskBlockPos pos = pindex->GetUndoPos();
+    if (pos.IsNull() || pindex->pprev == NULL)
+        return error("%s: no undo data available", __func__);
+    return UndoReadFromDisk(blockundo, pos, pindex->pprev->GetBlockHash());
 }
 
+bool ReadCompactBlock(const CBlockIndex* pindex, CCompactBlock& compact)
+{
+    if (!fCompactBlockIndex)
+        return error("%s: compact block index not enabled", __func__);
+    std::vector<std::vector<unsigned char> > vCompactBlocks;
+    if (!pblocktree->ReadCompactBlockIndex(pindex->GetHeight(), 1, 1, vCompactBlocks) || vCompactBlocks.empty())
+        return error("%s: no compact block at height %d", __func__, pindex->GetHeight());
+    try {
+        CDataStream ss(vCompactBlocks[0], SER_DISK, CLIENT_VERSION);
+        ss >> compact;
+    } catch (const std::exception& e) {
+        return error("%s: Deserialize error - %s at height %d", __func__, e.what(), pindex->GetHeight());
+    }
+    // Records are kept by height, for the blocks of the active chain
+    if (compact.hash != pindex->GetBlockHash())
+        return error("%s: compact block at height %d is not of block %s", __func__, pindex->GetHeight(), pindex->GetBlockHash().ToString());
+    return true;
+}
 
-void ConnectNotarisations(const CBlock &block, int height)
+//! The Sapling commitments of a block read from the block itself, or from its compact block once it is pruned
+static bool ReadBlockSaplingCommitments(const CBlockIndex* pindex, CSaplingBlockCommitments& commitments)
 {
-    // Record Notarisations
-    NotarisationsInBlock notarisations = ScanBlockNotarisations(block, height);
-    if (notarisations.size() > 0) {
-        CDBBatch batch = CDBBatch(*pnotarisations);
-        batch.Write(block.GetHash(), notarisations);
-        WriteBackNotarisations(notarisations, batch);
+    if (fHavePruned && !(pindex->nStatus & BLOCK_HAVE_DATA)) {
+        CCompactBlock compact;
+        if (!ReadCompactBlock(pindex, compact))
+            return false;
+        commitments = CSaplingBlockCommitments();
+        commitments.hash = compact.hash;
+        for (const CCompactTx& ctx : compact.vtx) {
+            if (ctx.outputs.empty())
+                continue;
+            CSaplingTxCommitments txCommitments;
+            txCommitments.txid = ctx.txid;
+            for (const CCompactSaplingOutput& output : ctx.outputs)
+                txCommitments.cmus.push_back(output.cmu);
+            commitments.vtx.push_back(txCommitments);
+        }
+        return true;
+    }
+    // Only the commitments are needed, so the block isn't deserialized
+    CMappedSpan span;
+    std::vector<char> vRaw;
+    CBlockView view;
+    if (!ReadBlockViewFromDisk(span, vRaw, pindex, view))
+        return error("%s: failed to read block %d", __func__, pindex->GetHeight());
+    commitments = CSaplingBlockCommitments(view);
+    return true;
+}
+
+bool ReadSaplingCommitments(const CBlockIndex* pindexStart, int nCount, std::vector<CSaplingBlockCommitments>& vCommitments)
+{
+    AssertLockHeld(cs_main);
+
+    vCommitments.clear();
+    if (pindexStart == NULL || !chainActive.Contains(pindexStart))
+        return error("%s: block not in the active chain", __func__);
+    const int nStartHeight = pindexStart->GetHeight();
+    nCount = std::min(nCount, chainActive.Height() - nStartHeight + 1);
+    while ((int)vCommitments.size() < nCount) {
+        // Records are kept by height, one of another chain is as good as missing
+        std::vector<CSaplingBlockCommitments> vRead;
+        if (!pblocktree->ReadSaplingCommitments(nStartHeight + vCommitments.size(), nCount - vCommitments.size(), vRead))
+            return false;
+        for (CSaplingBlockCommitments& commitments : vRead) {
+            if (commitments.hash != chainActive[nStartHeight + vCommitments.size()]->GetBlockHash())
+                break;
+            vCommitments.push_back(std::move(commitments));
+        }
+        if ((int)vCommitments.size() == nCount)
+            break;
+
+        // Blocks connected before the records were kept
+        CSaplingBlockCommitments commitments;
+        if (!ReadBlockSaplingCommitments(chainActive[nStartHeight + vCommitments.size()], commitments))
+            return false;
+        vCommitments.push_back(std::move(commitments));
+    }
+    return true;
+}
+
+bool GetSaplingTreeAfter(const CBlockIndex* pindex, SaplingMerkleTree& tree)
+{
+    AssertLockHeld(cs_main);
+
+    tree = SaplingMerkleTree();
+    if (pindex == NULL)
+        return true;
+    if (pcoinsTip->GetSaplingAnchorAt(pindex->hashFinalSaplingRoot, tree))
+        return true;
+
+    // Without the anchor, from the nearest checkpoint at or below the block
+    int nCheckpoint = pindex->GetHeight() - pindex->GetHeight() % SAPLING_TREE_CHECKPOINT_INTERVAL;
+    std::vector<CSaplingBlockCommitments> vCommitments;
+    if (!ReadSaplingCommitments(pindex->GetAncestor(nCheckpoint), 1, vCommitments) || vCommitments.empty() || !vCommitments[0].checkpoint)
+        return error("%s: no Sapling tree for block %d", __func__, pindex->GetHeight());
+    tree = *vCommitments[0].checkpoint;
+    if (nCheckpoint < pindex->GetHeight()) {
+        if (!ReadSaplingCommitments(pindex->GetAncestor(nCheckpoint + 1), pindex->GetHeight() - nCheckpoint, vCommitments))
+            return false;
+        for (const CSaplingBlockCommitments& commitments : vCommitments) {
+            std::vector<uint256> vBlockCommitments = commitments.GetCommitments();
+            tree.append_batch(std::vector<libzcash::PedersenHash>(vBlockCommitments.begin(), vBlockCommitments.end()));
+        }
+    }
+    if (tree.root() != pindex->hashFinalSaplingRoot)
+        return error("%s: Sapling tree of block %d does not match its root", __func__, pindex->GetHeight());
+    return true;
+}
+
+bool WriteBlockTimestampIndex(const CBlockIndex* pindex)
+{
+    unsigned int logicalTS = pindex->nTime;
+    unsigned int prevLogicalTS = 0;
+
+    // retrieve logical timestamp of the previous block
+    if (pindex->pprev)
+        if (!pblocktree->ReadTimestampBlockIndex(pindex->pprev->GetBlockHash(), prevLogicalTS))
+            LogPrintf("%s: Failed to read previous block's logical timestamp\n", __func__);
+
+    if (logicalTS <= prevLogicalTS) {
+        logicalTS = prevLogicalTS + 1;
+        LogPrintf("%s: Previous logical timestamp is newer Actual[%d] prevLogical[%d] Logical[%d]\n", __func__, pindex->nTime, prevLogicalTS, logicalTS);
+    }
+
+    if (!pblocktree->WriteTimestampIndex(CTimestampIndexKey(logicalTS, pindex->GetBlockHash()), pindex->GetHeight()))
+        return error("%s: Failed to write timestamp index", __func__);
+
+    if (!pblocktree->WriteTimestampBlockIndex(CTimestampBlockIndexKey(pindex->GetBlockHash()), CTimestampBlockIndexValue(logicalTS)))
+        return error("%s: Failed to write blockhash index", __func__);
+    return true;
+}
+
+/**
+ * Apply the undo operation of a CTxInUndo to the given chain state.
+ * @param undo The undo object.
+ * @param view The coins view to which to apply the changes.
+ * @param out The out point that corresponds to the tx input.
+ * @return True on success.
+ */
+static bool ApplyTxInUndo(const CTxInUndo& undo, CCoinsViewCache& view, const COutPoint& out)
+{
+    bool fClean = true;
+
+    CCoinsModifier coins = view.ModifyCoins(out.hash);
+    if (undo.nHeight != 0) {
+        // undo data contains height: this is the last output of the prevout tx being spent
+        if (!coins->IsPruned())
+            fClean = fClean && error("%s: undo data overwriting existing transaction", __func__);
+        coins->Clear();
+        coins->fCoinBase = undo.fCoinBase;
+        coins->nHeight = undo.nHeight;
+        coins->nVersion = undo.nVersion;
+    } else {
+        if (coins->IsPruned())
+            fClean = fClean && error("%s: undo data adding output to missing transaction", __func__);
+    }
+    if (coins->IsAvailable(out.n))
+        fClean = fClean && error("%s: undo data overwriting existing output", __func__);
+    if (coins->vout.size() < out.n+1)
+        coins->vout.resize(out.n+1);
+    coins->vout[out.n] = undo.txout;
+
+    return fClean;
+}
+
+
+void ConnectNotarisations(const CBlock &block, int height)
+{
+    // Record Notarisations
+    NotarisationsInBlock notarisations = ScanBlockNotarisations(block, height);
+    if (notarisations.size() > 0) {
+        CDBBatch batch = CDBBatch(*pnotarisations);
+        batch.Write(block.GetHash(), notarisations);
+        WriteBackNotarisations(notarisations, batch);
+        WriteSymbolNotarisations(notarisations, height, batch);
         pnotarisations->WriteBatch(batch, true);
         LogPrintf("ConnectBlock: wrote %i block notarisations in block: %s\n",
                 notarisations.size(), block.GetHash().GetHex().data());
@@ -3137,14 +3686,18 @@ void ConnectNotarisations(const CBlock &block, int height)
 }
 
 
-void DisconnectNotarisations(const CBlock &block)
+void DisconnectNotarisations(const CBlock &block, int height)
 {
+    // MoMoMs of this and later heights may have changed
+    InvalidateProofRootCache(height);
+
     // Delete from notarisations cache
     NotarisationsInBlock nibs;
     if (GetBlockNotarisations(block.GetHash(), nibs)) {
         CDBBatch batch = CDBBatch(*pnotarisations);
         batch.Erase(block.GetHash());
         EraseBackNotarisations(nibs, batch);
+        EraseSymbolNotarisations(nibs, height, batch);
         pnotarisations->WriteBatch(batch, true);
         LogPrintf("DisconnectTip: deleted %i block notarisations in block: %s\n",
             nibs.size(), block.GetHash().GetHex().data());
@@ -3197,15 +3750,23 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
 
     if (blockUndo.vtxundo.size() + 1 != block.vtx.size())
         return error("DisconnectBlock(): block and undo data inconsistent");
+    // Blocks above an index being built online have no entries yet
+    const bool fUndoAddressIndex = fAddressIndex && IndexBuildCoversBlock(INDEX_BUILD_ADDRESS, pindex);
+    const bool fUndoSpentIndex = fSpentIndex && IndexBuildCoversBlock(INDEX_BUILD_SPENT, pindex);
+    const bool fUndoCCIndex = fCCIndex && IndexBuildCoversBlock(INDEX_BUILD_CC, pindex);
     std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
     std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > addressUnspentIndex;
     std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > spentIndex;
+    std::vector<std::pair<CCCUnspentKey, CAddressUnspentValue> > ccUnspentIndex;
+    std::vector<std::pair<COutPoint, CAddressUnspentValue> > ccRestoredIndex;
+    std::vector<std::pair<COracleDataKey, COracleDataValue> > oracleDataIndex;
+    std::vector<std::pair<CGatewaysIndexKey, CAddressUnspentValue> > gatewaysIndex;
 
     // undo transactions in reverse order
     for (int i = block.vtx.size() - 1; i >= 0; i--) {
         const CTransaction &tx = block.vtx[i];
         uint256 hash = tx.GetHash();
-        if (fAddressIndex) {
+        if (fUndoAddressIndex) {
 
             for (unsigned int k = tx.vout.size(); k-- > 0;) {
                 const CTxOut &out = tx.vout[k];
@@ -3225,6 +3786,11 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
                 }
             }
         }
+        if (fUndoCCIndex) {
+            AddCCIndexOutputs(tx, pindex->GetHeight(), ccUnspentIndex);
+            AddOracleDataIndex(tx, pindex->GetHeight(), i, oracleDataIndex);
+            AddGatewaysIndex(tx, pindex->GetHeight(), gatewaysIndex);
+        }
 
         // Check that all outputs are available and match the outputs in the block itself
         // exactly.
@@ -3263,12 +3829,15 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
 
                 const CTxIn input = tx.vin[j];
 
-                if (fSpentIndex) {
+                if (fUndoSpentIndex) {
                     // undo and delete the spent index
                     spentIndex.push_back(make_pair(CSpentIndexKey(input.prevout.hash, input.prevout.n), CSpentIndexValue()));
                 }
 
-                if (fAddressIndex) {
+                if (fUndoCCIndex && undo.txout.scriptPubKey.IsPayToCryptoCondition())
+                    ccRestoredIndex.push_back(make_pair(input.prevout, CAddressUnspentValue(undo.txout.nValue, undo.txout.scriptPubKey, undo.nHeight)));
+
+                if (fUndoAddressIndex) {
                     const CTxOut &prevout = view.GetOutputFor(tx.vin[j]);
 
                     vector<vector<unsigned char>> vSols;
@@ -3317,7 +3886,7 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
         return true;
     }
 
-    if (fAddressIndex) {
+    if (fUndoAddressIndex) {
         if (!pblocktree->EraseAddressIndex(addressIndex)) {
             return AbortNode(state, "Failed to delete address index");
         }
@@ -3326,6 +3895,23 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
         }
     }
 
+    if (fUndoCCIndex && !pblocktree->UndoCCUnspentIndex(ccUnspentIndex, ccRestoredIndex))
+        return AbortNode(state, "Failed to undo CC unspent index");
+    if (fUndoCCIndex && !pblocktree->EraseOracleDataIndex(oracleDataIndex))
+        return AbortNode(state, "Failed to delete oracle data index");
+    if (fUndoCCIndex && !pblocktree->EraseGatewaysIndex(gatewaysIndex))
+        return AbortNode(state, "Failed to delete gateways index");
+
+    IndexBuildBlockDisconnected(pindex);
+
+    if (fCompactBlockIndex) {
+        if (!pblocktree->EraseCompactBlockIndex(CCompactBlockIndexKey(pindex->GetHeight()))) {
+            return AbortNode(state, "Failed to delete compact block index");
+        }
+    }
+    if (!pblocktree->EraseSaplingCommitments(pindex->GetHeight()))
+        return AbortNode(state, "Failed to delete Sapling commitments");
+
     return fClean;
 }
 
@@ -3334,6 +3920,8 @@ void static FlushBlockFile(bool fFinalize = false)
     LOCK(cs_LastBlockFile);
 
     CDiskBlockPos posOld(nLastBlockFile, 0);
+    if (fFinalize)
+        blockFileMapper.Invalidate(nLastBlockFile);
 
     FILE *fileOld = OpenBlockFile(posOld);
     if (fileOld) {
@@ -3355,12 +3943,132 @@ void static FlushBlockFile(bool fFinalize = false)
 bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigned int nAddSize);
 
 static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
+static CCheckQueue<CSaplingCheck> saplingcheckqueue(16);
+static CCheckQueue<CEquihashCheck> equihashcheckqueue(8);
+static CCheckQueue<CShieldedProofCheck> shieldedproofcheckqueue(4);
+static CCheckQueue<CBlockParseCheck> blockparsecheckqueue(1);
 
 void ThreadScriptCheck() {
     RenameThread("zcash-scriptch");
     scriptcheckqueue.Thread();
 }
 
+void ThreadSaplingCheck() {
+    RenameThread("zcash-saplingch");
+    saplingcheckqueue.Thread();
+}
+
+void ThreadEquihashCheck() {
+    RenameThread("zcash-equihashch");
+    equihashcheckqueue.Thread();
+}
+
+void ThreadShieldedProofCheck() {
+    RenameThread("zcash-proofch");
+    shieldedproofcheckqueue.Thread();
+}
+
+void ThreadBlockParse() {
+    RenameThread("zcash-blockparse");
+    blockparsecheckqueue.Thread();
+}
+
+bool CheckEquihashSolutions(const std::vector<const CBlockHeader*>& vHeaders)
+{
+    // The queue has a single master, while headers messages and benchmarks may come from different threads
+    static CCriticalSection cs_equihashcheck;
+    LOCK(cs_equihashcheck);
+
+    if (!nScriptCheckThreads) {
+        for (const CBlockHeader* pheader : vHeaders) {
+            if (!CheckEquihashSolution(pheader, Params()))
+                return false;
+        }
+        return true;
+    }
+
+    CCheckQueueControl<CEquihashCheck> control(&equihashcheckqueue);
+    std::vector<CEquihashCheck> vChecks;
+    vChecks.reserve(vHeaders.size());
+    for (const CBlockHeader* pheader : vHeaders) {
+        vChecks.push_back(CEquihashCheck(*pheader));
+    }
+    control.Add(vChecks);
+    return control.Wait();
+}
+
+bool CShieldedProofCheck::operator()() {
+    const CTransaction& tx = *ptx;
+    uint256 dataToBeSigned;
+    try {
+        dataToBeSigned = SignatureHash(CScript(), tx, NOT_AN_INPUT, SIGHASH_ALL, 0, consensusBranchId);
+    } catch (std::logic_error ex) {
+        return true;
+    }
+
+    if (!tx.vjoinsplit.empty()) {
+        if (crypto_sign_verify_detached(&tx.joinSplitSig[0], dataToBeSigned.begin(), 32, tx.joinSplitPubKey.begin()) != 0)
+            return true;
+        auto verifier = libzcash::ProofVerifier::Strict();
+        BOOST_FOREACH(const JSDescription &joinsplit, tx.vjoinsplit) {
+            if (!joinsplit.Verify(*pzcashParams, verifier, tx.joinSplitPubKey))
+                return true;
+        }
+    }
+
+    if (!tx.vShieldedSpend.empty() || !tx.vShieldedOutput.empty()) {
+        CSaplingCheck check(tx, dataToBeSigned);
+        if (!check())
+            return true;
+    }
+
+    ProofCacheAdd(tx.GetHash(), consensusBranchId);
+    return true;
+}
+
+void PreverifyShieldedTransactions(const std::vector<const CTransaction*>& vtx)
+{
+    uint32_t tiptime;
+    int nextBlockHeight;
+    {
+        LOCK(cs_main);
+        if (chainActive.LastTip() == 0)
+            return;
+        tiptime = chainActive.LastTip()->nTime;
+        nextBlockHeight = chainActive.Height() + 1;
+    }
+    uint32_t consensusBranchId = CurrentEpochBranchId(nextBlockHeight, Params().GetConsensus());
+
+    // The cheap context free checks first, so malformed transactions do not cost a proof verification
+    std::vector<CShieldedProofCheck> vChecks;
+    for (const CTransaction* ptx : vtx) {
+        const CTransaction& tx = *ptx;
+        if (tx.IsMint() || (tx.vjoinsplit.empty() && tx.vShieldedSpend.empty() && tx.vShieldedOutput.empty()))
+            continue;
+        if (ProofCacheContains(tx.GetHash(), consensusBranchId))
+            continue;
+        CValidationState state;
+        if (!CheckTransactionWithoutProofVerification(tiptime, tx, state))
+            continue;
+        vChecks.push_back(CShieldedProofCheck(tx, consensusBranchId));
+    }
+    if (vChecks.empty())
+        return;
+
+    if (!nScriptCheckThreads || vChecks.size() == 1) {
+        for (CShieldedProofCheck& check : vChecks)
+            check();
+        return;
+    }
+
+    // The queue has a single master, like the Equihash queue
+    static CCriticalSection cs_shieldedproofcheck;
+    LOCK(cs_shieldedproofcheck);
+    CCheckQueueControl<CShieldedProofCheck> control(&shieldedproofcheckqueue);
+    control.Add(vChecks);
+    control.Wait();
+}
+
 //
 // Called periodically asynchronously; alerts if it smells like
 // we're being fed a bad chain (blocks being generated much
@@ -3427,6 +4135,38 @@ void PartitionCheck(bool (*initialDownloadCheck)(), CCriticalSection& cs, const
 }
 
 
+bool IsNotarizedAncestor(int nHeight, const uint256& hashBlock)
+{
+    AssertLockHeld(cs_main);
+    uint256 hashNotarized = hashAssumeNotarized;
+    if (hashNotarized.IsNull()) {
+        int32_t prevMoMheight;
+        uint256 notarizedDestTxid;
+        komodo_notarized_height(&prevMoMheight, &hashNotarized, &notarizedDestTxid);
+        if (hashNotarized.IsNull())
+            return false;
+    }
+
+    BlockMap::iterator mi = mapBlockIndex.find(hashNotarized);
+    if (mi == mapBlockIndex.end() || mi->second == NULL || mi->second->GetHeight() < nHeight)
+        return false;
+    CBlockIndex* pindexAncestor = mi->second->GetAncestor(nHeight);
+    return pindexAncestor != NULL && pindexAncestor->GetBlockHash() == hashBlock;
+}
+
+/**
+ * Whether proofs and scripts of the block at nHeight can be skipped because of
+ * -assumenotarized. Such blocks are buried under a notarization, so during
+ * initial block download they are not verified again. Everything that depends
+ * on the UTXO set, the nullifiers and the anchors still is.
+ */
+static bool IsAssumedNotarized(int nHeight, const uint256& hashBlock)
+{
+    if (!fAssumeNotarized || !IsInitialBlockDownload())
+        return false;
+    return IsNotarizedAncestor(nHeight, hashBlock);
+}
+
 static int64_t nTimeVerify = 0;
 static int64_t nTimeConnect = 0;
 static int64_t nTimeIndex = 0;
@@ -3445,6 +4185,11 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         return(false);
     //fprintf(stderr,"connectblock ht.%d\n",(int32_t)pindex->GetHeight());
     AssertLockHeld(cs_main);
+    // Indexes being built online are written by the index builder
+    const bool fWriteAddressIndex = fAddressIndex && !IsIndexBuilding(INDEX_BUILD_ADDRESS);
+    const bool fWriteSpentIndex = fSpentIndex && !IsIndexBuilding(INDEX_BUILD_SPENT);
+    const bool fWriteTimestampIndex = fTimestampIndex && !IsIndexBuilding(INDEX_BUILD_TIMESTAMP);
+    const bool fWriteCCIndex = fCCIndex && !IsIndexBuilding(INDEX_BUILD_CC);
     bool fExpensiveChecks = true;
     if (fCheckpointsEnabled) {
         CBlockIndex *pindexLastCheckpoint = Checkpoints::GetLastCheckpoint(chainparams.Checkpoints());
@@ -3453,13 +4198,19 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             fExpensiveChecks = false;
         }
     }
+    if (fExpensiveChecks && IsAssumedNotarized(pindex->GetHeight(), pindex->GetBlockHash())) {
+        // Buried under a notarization: disable proof and script checks
+        fExpensiveChecks = false;
+    }
     auto verifier = libzcash::ProofVerifier::Strict();
     auto disabledVerifier = libzcash::ProofVerifier::Disabled();
     int32_t futureblock;
     CAmount blockReward = GetBlockSubsidy(pindex->GetHeight(), chainparams.GetConsensus());
     uint64_t notarypaycheque = 0;
+    int64_t nTimeChecks = GetTimeMicros();
     // Check it again to verify JoinSplit proofs, and in case a previous version let a bad block in
-    if ( !CheckBlock(&futureblock,pindex->GetHeight(),pindex,block, state, fExpensiveChecks ? verifier : disabledVerifier, fCheckPOW, !fJustCheck) || futureblock != 0 )
+    const bool fProofChecks = fExpensiveChecks && !(nReplaySkip & REPLAY_PROOFS);
+    if ( !CheckBlock(&futureblock,pindex->GetHeight(),pindex,block, state, fProofChecks ? verifier : disabledVerifier, fCheckPOW, !fJustCheck) || futureblock != 0 )
     {
         //fprintf(stderr,"checkblock failure in connectblock futureblock.%d\n",futureblock);
         return false;
@@ -3474,6 +4225,8 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             fprintf(stderr,"grandfathered exception, until jan 15th 2019\n");
         } else pindex->nStatus |= BLOCK_VALID_CONTEXT;
     }
+    int64_t nTimeNotaryPay = GetTimeMicros();
+    AddBlockConnectTime(CONNECT_STAGE_PROOFS, nTimeNotaryPay - nTimeChecks);
 
     // Do this here before the block is moved to the main block files.
     if ( ASSETCHAINS_NOTARY_PAY[0] != 0 && pindex->GetHeight() > 10 )
@@ -3504,13 +4257,16 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
                                 REJECT_INVALID, "bad-cb-amount");
         }
     }
+    int64_t nTimeBlockFile = GetTimeMicros();
+    AddBlockConnectTime(CONNECT_STAGE_KOMODO, nTimeBlockFile - nTimeNotaryPay);
     // Move the block to the main block file, we need this to create the TxIndex in the following loop.
     if ( (pindex->nStatus & BLOCK_IN_TMPFILE) != 0 )
     {
-        unsigned int nBlockSize = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
-        if (!FindBlockPos(0,state, blockPos, nBlockSize+8, pindex->GetHeight(), block.GetBlockTime(),false))
+        std::vector<char> vRecord;
+        SerializeRecord(block, vRecord);
+        if (!FindBlockPos(0,state, blockPos, vRecord.size()+8, pindex->GetHeight(), block.GetBlockTime(),false))
             return error("ConnectBlock(): FindBlockPos failed");
-        if (!WriteBlockToDisk(block, blockPos, chainparams.MessageStart()))
+        if (!WriteBlockToDisk(vRecord, blockPos, chainparams.MessageStart()))
             return error("ConnectBlock(): FindBlockPos failed");
         pindex->nStatus &= (~BLOCK_IN_TMPFILE);
         pindex->nFile = blockPos.nFile;
@@ -3570,9 +4326,13 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             sleep(1);
         }
     }
-    CCheckQueueControl<CScriptCheck> control(fExpensiveChecks && nScriptCheckThreads ? &scriptcheckqueue : NULL);
+    const bool fInputScriptChecks = fExpensiveChecks && !(nReplaySkip & REPLAY_SCRIPTS);
+    CCheckQueueControl<CScriptCheck> control(fInputScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : NULL);
 
     int64_t nTimeStart = GetTimeMicros();
+    // Moving the block out of the temporary file and the BIP30 checks
+    AddBlockConnectTime(CONNECT_STAGE_INPUTS, nTimeStart - nTimeBlockFile);
+    int64_t nTimeCCEval = 0;
     CAmount nFees = 0;
     int nInputs = 0;
     uint64_t valueout;
@@ -3585,6 +4345,10 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
     std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > addressUnspentIndex;
     std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > spentIndex;
+    std::vector<std::pair<CCCUnspentKey, CAddressUnspentValue> > ccUnspentIndex;
+    std::vector<COutPoint> ccSpentIndex;
+    std::vector<std::pair<COracleDataKey, COracleDataValue> > oracleDataIndex;
+    std::vector<std::pair<CGatewaysIndexKey, CAddressUnspentValue> > gatewaysIndex;
     // Construct the incremental merkle tree at the current
     // block position,
     auto old_sprout_tree_root = view.GetBestAnchor(SPROUT);
@@ -3607,6 +4371,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     SaplingMerkleTree sapling_tree;
     assert(view.GetSaplingAnchorAt(view.GetBestAnchor(SAPLING), sapling_tree));
+    std::vector<libzcash::PedersenHash> vSaplingCommitments;
 
     // Grab the consensus branch ID for the block's height
     auto consensusBranchId = CurrentEpochBranchId(pindex->GetHeight(), Params().GetConsensus());
@@ -3636,7 +4401,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
                 return state.DoS(100, error("ConnectBlock(): JoinSplit requirements not met"),
                                  REJECT_INVALID, "bad-txns-joinsplit-requirements-not-met");
 
-            if (fAddressIndex || fSpentIndex)
+            if (fWriteAddressIndex || fWriteSpentIndex)
             {
                 for (size_t j = 0; j < tx.vin.size(); j++)
                 {
@@ -3661,7 +4426,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
                             addressUnspentIndex.push_back(make_pair(CAddressUnspentKey(keyType, addrHash, input.prevout.hash, input.prevout.n), CAddressUnspentValue()));
                         }
 
-                        if (fSpentIndex) {
+                        if (fWriteSpentIndex) {
                             // add the spent index to determine the txid and input that spent an output
                             // and to find the amount and address from an input
                             spentIndex.push_back(make_pair(CSpentIndexKey(input.prevout.hash, input.prevout.n), CSpentIndexValue(txhash, j, pindex->GetHeight(), prevout.nValue, keyType, addrHash)));
@@ -3669,6 +4434,15 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
                     }
                 }
             }
+            if (fWriteCCIndex)
+            {
+                for (size_t j = 0; j < tx.vin.size(); j++)
+                {
+                    if (tx.IsPegsImport() && j==0) continue;
+                    if (view.GetOutputFor(tx.vin[j]).scriptPubKey.IsPayToCryptoCondition())
+                        ccSpentIndex.push_back(tx.vin[j].prevout);
+                }
+            }
             // Add in sigops done by pay-to-script-hash inputs;
             // this is to prevent a "rogue miner" from creating
             // an incredibly-expensive-to-validate block.
@@ -3703,12 +4477,21 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             //fprintf(stderr, "tx.%s nFees.%li interest.%li\n", tx.GetHash().ToString().c_str(), stakeTxValue, interest);
 
             std::vector<CScriptCheck> vChecks;
-            if (!ContextualCheckInputs(tx, state, view, fExpensiveChecks, flags, false, txdata[i], chainparams.GetConsensus(), consensusBranchId, nScriptCheckThreads ? &vChecks : NULL))
+            std::vector<CCCEvalCheck> vEvalChecks;
+            if (!ContextualCheckInputs(tx, state, view, fInputScriptChecks, flags, false, txdata[i], chainparams.GetConsensus(), consensusBranchId, nScriptCheckThreads ? &vChecks : NULL, &vEvalChecks))
                 return false;
             control.Add(vChecks);
+            // The queue works on the signatures of the transaction meanwhile
+            if (!vEvalChecks.empty() && !(nReplaySkip & REPLAY_CC)) {
+                int64_t nTimeEval = GetTimeMicros();
+                for (CCCEvalCheck& check : vEvalChecks)
+                    if (!check())
+                        return state.DoS(100, false);
+                nTimeCCEval += GetTimeMicros() - nTimeEval;
+            }
         }
 
-        if (fAddressIndex) {
+        if (fWriteAddressIndex) {
             for (unsigned int k = 0; k < tx.vout.size(); k++) {
                 const CTxOut &out = tx.vout[k];
 
@@ -3733,6 +4516,12 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             }
         }
 
+        if (fWriteCCIndex) {
+            AddCCIndexOutputs(tx, pindex->GetHeight(), ccUnspentIndex);
+            AddOracleDataIndex(tx, pindex->GetHeight(), i, oracleDataIndex);
+            AddGatewaysIndex(tx, pindex->GetHeight(), gatewaysIndex);
+        }
+
         //if ( ASSETCHAINS_SYMBOL[0] == 0 )
         //    komodo_earned_interest(pindex->GetHeight(),sum);
         CTxUndo undoDummy;
@@ -3750,7 +4539,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         }
 
         BOOST_FOREACH(const OutputDescription &outputDescription, tx.vShieldedOutput) {
-            sapling_tree.append(outputDescription.cm);
+            vSaplingCommitments.push_back(outputDescription.cm);
         }
 
         vPos.push_back(std::make_pair(tx.GetHash(), pos));
@@ -3762,6 +4551,10 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     if ( ASSETCHAINS_STAKED != 0 && fCheckPOW && komodo_checkPOW(blockReward+stakeTxValue-notarypaycheque,1,(CBlock *)&block,pindex->GetHeight()) < 0 )
         return state.DoS(100, error("ConnectBlock: ac_staked chain failed slow komodo_checkPOW"),REJECT_INVALID, "failed-slow_checkPOW");
 
+    // The commitments of the whole block are added at once, so each level of
+    // the new nodes is hashed as one row
+    sapling_tree.append_batch(vSaplingCommitments);
+
     view.PushAnchor(sprout_tree);
     view.PushAnchor(sapling_tree);
     if (!fJustCheck) {
@@ -3779,6 +4572,8 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         }
     }
     int64_t nTime1 = GetTimeMicros(); nTimeConnect += nTime1 - nTimeStart;
+    AddBlockConnectTime(CONNECT_STAGE_INPUTS, nTime1 - nTimeStart - nTimeCCEval);
+    AddBlockConnectTime(CONNECT_STAGE_CCEVAL, nTimeCCEval);
     LogPrint("bench", "      - Connect %u transactions: %.2fms (%.3fms/tx, %.3fms/txin) [%.2fs]\n", (unsigned)block.vtx.size(), 0.001 * (nTime1 - nTimeStart), 0.001 * (nTime1 - nTimeStart) / block.vtx.size(), nInputs <= 1 ? 0 : 0.001 * (nTime1 - nTimeStart) / (nInputs-1), nTimeConnect * 0.000001);
 
     blockReward += nFees + sum;
@@ -3814,6 +4609,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     if (!control.Wait())
         return state.DoS(100, false);
     int64_t nTime2 = GetTimeMicros(); nTimeVerify += nTime2 - nTimeStart;
+    AddBlockConnectTime(CONNECT_STAGE_SCRIPTS, nTime2 - nTime1);
     LogPrint("bench", "    - Verify %u txins: %.2fms (%.3fms/txin) [%.2fs]\n", nInputs - 1, 0.001 * (nTime2 - nTimeStart), nInputs <= 1 ? 0 : 0.001 * (nTime2 - nTimeStart) / (nInputs-1), nTimeVerify * 0.000001);
 
     if (fJustCheck)
@@ -3826,11 +4622,13 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         if (pindex->GetUndoPos().IsNull())
         {
             CDiskBlockPos pos;
-            if (!FindUndoPos(state, pindex->nFile, pos, ::GetSerializeSize(blockundo, SER_DISK, CLIENT_VERSION) + 40))
+            std::vector<char> vRecord;
+            SerializeRecord(blockundo, vRecord);
+            if (!FindUndoPos(state, pindex->nFile, pos, vRecord.size() + 40))
                 return error("ConnectBlock(): FindUndoPos failed");
             if ( pindex->pprev == 0 )
                 fprintf(stderr,"ConnectBlock: unexpected null pprev\n");
-            if (!UndoWriteToDisk(blockundo, pos, pindex->pprev->GetBlockHash(), chainparams.MessageStart()))
+            if (!UndoWriteToDisk(blockundo, vRecord, pos, pindex->pprev->GetBlockHash(), chainparams.MessageStart()))
                 return AbortNode(state, "Failed to write undo data");
             // update nUndoPos in block index
             pindex->nUndoPos = pos.nPos;
@@ -3857,7 +4655,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     if (fTxIndex)
         if (!pblocktree->WriteTxIndex(vPos))
             return AbortNode(state, "Failed to write transaction index");
-    if (fAddressIndex) {
+    if (fWriteAddressIndex) {
         if (!pblocktree->WriteAddressIndex(addressIndex)) {
             return AbortNode(state, "Failed to write address index");
         }
@@ -3867,36 +4665,50 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         }
     }
 
-    if (fSpentIndex)
+    if (fWriteSpentIndex)
         if (!pblocktree->UpdateSpentIndex(spentIndex))
             return AbortNode(state, "Failed to write transaction index");
 
-    if (fTimestampIndex)
-    {
-        unsigned int logicalTS = pindex->nTime;
-        unsigned int prevLogicalTS = 0;
-
-        // retrieve logical timestamp of the previous block
-        if (pindex->pprev)
-            if (!pblocktree->ReadTimestampBlockIndex(pindex->pprev->GetBlockHash(), prevLogicalTS))
-                LogPrintf("%s: Failed to read previous block's logical timestamp\n", __func__);
-
-        if (logicalTS <= prevLogicalTS) {
-            logicalTS = prevLogicalTS + 1;
-            LogPrintf("%s: Previous logical timestamp is newer Actual[%d] prevLogical[%d] Logical[%d]\n", __func__, pindex->nTime, prevLogicalTS, logicalTS);
-        }
+    if (fWriteCCIndex) {
+        // Token outputs are checked against the transactions they spend, so after the tx index has this block
+        std::vector<std::pair<CTokenUnspentKey, CAddressUnspentValue> > tokenUnspentIndex;
+        std::vector<std::pair<uint256, CTokenIndexInfo> > tokenIndex;
+        for (const CTransaction& tx : block.vtx)
+            AddTokenIndexOutputs(tx, pindex->GetHeight(), tokenUnspentIndex, tokenIndex);
+        if (!pblocktree->UpdateCCUnspentIndex(ccUnspentIndex, ccSpentIndex, tokenUnspentIndex, tokenIndex))
+            return AbortNode(state, "Failed to write CC unspent index");
+        if (!pblocktree->WriteOracleDataIndex(oracleDataIndex))
+            return AbortNode(state, "Failed to write oracle data index");
+        if (!pblocktree->WriteGatewaysIndex(gatewaysIndex))
+            return AbortNode(state, "Failed to write gateways index");
+    }
 
-        if (!pblocktree->WriteTimestampIndex(CTimestampIndexKey(logicalTS, pindex->GetBlockHash())))
-            return AbortNode(state, "Failed to write timestamp index");
+    {
+        // Kept for every block, witnesses are built from them rather than from the blocks
+        CSaplingBlockCommitments saplingCommitments(block);
+        if (pindex->GetHeight() % SAPLING_TREE_CHECKPOINT_INTERVAL == 0)
+            saplingCommitments.checkpoint = sapling_tree;
+        if (!pblocktree->WriteSaplingCommitments(pindex->GetHeight(), saplingCommitments))
+            return AbortNode(state, "Failed to write Sapling commitments");
+    }
 
-        if (!pblocktree->WriteTimestampBlockIndex(CTimestampBlockIndexKey(pindex->GetBlockHash()), CTimestampBlockIndexValue(logicalTS)))
-            return AbortNode(state, "Failed to write blockhash index");
+    if (fCompactBlockIndex)
+    {
+        CDataStream ssCompactBlock(SER_DISK, CLIENT_VERSION);
+        ssCompactBlock << CCompactBlock(block, pindex->GetHeight());
+        std::vector<unsigned char> vchCompactBlock(ssCompactBlock.begin(), ssCompactBlock.end());
+        if (!pblocktree->WriteCompactBlockIndex(CCompactBlockIndexKey(pindex->GetHeight()), vchCompactBlock))
+            return AbortNode(state, "Failed to write compact block index");
     }
 
+    if (fWriteTimestampIndex && !WriteBlockTimestampIndex(pindex))
+        return AbortNode(state, "Failed to write timestamp index");
+
     // add this block to the view's block chain
     view.SetBestBlock(pindex->GetBlockHash());
 
     int64_t nTime3 = GetTimeMicros(); nTimeIndex += nTime3 - nTime2;
+    AddBlockConnectTime(CONNECT_STAGE_INDEX, nTime3 - nTime2);
     LogPrint("bench", "    - Index writing: %.2fms [%.2fs]\n", 0.001 * (nTime3 - nTime2), nTimeIndex * 0.000001);
 
     // Watch for changes to the previous coinbase transaction.
@@ -3905,10 +4717,14 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     hashPrevBestCoinBase = block.vtx[0].GetHash();
 
     int64_t nTime4 = GetTimeMicros(); nTimeCallbacks += nTime4 - nTime3;
+    AddBlockConnectTime(CONNECT_STAGE_WALLET, nTime4 - nTime3);
     LogPrint("bench", "    - Callbacks: %.2fms [%.2fs]\n", 0.001 * (nTime4 - nTime3), nTimeCallbacks * 0.000001);
 
     //FlushStateToDisk();
     komodo_connectblock(false,pindex,*(CBlock *)&block);  // dPoW state update.
+    int64_t nTimeKomodo = GetTimeMicros();
+    AddBlockConnectTime(CONNECT_STAGE_KOMODO, nTimeKomodo - nTime4);
+    TRACE3(komodo, connectblock, pindex->GetHeight(), block.vtx.size(), nTimeKomodo - nTime4);
     if ( ASSETCHAINS_NOTARY_PAY[0] != 0 )
     {
       // Update the notary pay with the latest payment.
@@ -3988,15 +4804,15 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
                         vFiles.push_back(make_pair(*it, &vinfoBlockFile[*it]));
                     setDirtyFileInfo.erase(it++);
                 }
-                std::vector<const CBlockIndex*> vBlocks;
-                vBlocks.reserve(setDirtyBlockIndex.size());
-                for (set<CBlockIndex*>::iterator it = setDirtyBlockIndex.begin(); it != setDirtyBlockIndex.end(); ) {
-                    vBlocks.push_back(*it);
-                    setDirtyBlockIndex.erase(it++);
-                }
+                std::vector<const CBlockIndex*> vBlocks(setDirtyBlockIndex.begin(), setDirtyBlockIndex.end());
                 if (!pblocktree->WriteBatchSync(vFiles, nLastBlockFile, vBlocks)) {
+                    setDirtyBlockIndex.clear();
                     return AbortNode(state, "Files to write to block index database");
                 }
+                // The entries are on disk now, so their solutions can be read back from there
+                for (CBlockIndex* pindex : setDirtyBlockIndex)
+                    pindex->TrimSolution();
+                setDirtyBlockIndex.clear();
             }
             // Finally remove any pruned files
             if (fFlushForPrune)
@@ -4013,10 +4829,16 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
             if (!CheckDiskSpace(128 * 2 * 2 * pcoinsTip->GetCacheSize()))
                 return state.Error("out of disk space");
             // Flush the chainstate (which may refer to block index entries).
+            // It is written in the background, after the block files and
+            // block index above, unless everything has to be on disk now.
             if (!pcoinsTip->Flush())
                 return AbortNode(state, "Failed to write to coin database");
+            if (mode == FLUSH_STATE_ALWAYS && pcoinsAsyncFlush != NULL && !pcoinsAsyncFlush->Sync())
+                return AbortNode(state, "Failed to write to coin database");
             nLastFlush = nNow;
         }
+        if (fDoFullFlush || fPeriodicWrite)
+            TRACE4(validation, flush_state, (int)mode, fDoFullFlush, cacheSize, GetTimeMicros() - nNow);
         if ((mode == FLUSH_STATE_ALWAYS || mode == FLUSH_STATE_PERIODIC) && nNow > nLastSetChain + (int64_t)DATABASE_WRITE_INTERVAL * 1000000) {
             // Update best block in wallet (so we can detect restored wallets).
             GetMainSignals().SetBestChain(chainActive.GetLocator());
@@ -4044,6 +4866,8 @@ void PruneAndFlush() {
 void static UpdateTip(CBlockIndex *pindexNew) {
     const CChainParams& chainParams = Params();
     chainActive.SetTip(pindexNew);
+    nStatsTipHeight = pindexNew->GetHeight();
+    nspvResponseCache.Invalidate();
 
     // New best block
     nTimeBestReceived = GetTime();
@@ -4126,8 +4950,12 @@ bool static DisconnectTip(CValidationState &state, bool fBare = false) {
         if (!DisconnectBlock(block, state, pindexDelete, view))
             return error("DisconnectTip(): DisconnectBlock %s failed", pindexDelete->GetBlockHash().ToString());
         assert(view.Flush());
-        DisconnectNotarisations(block);
+        DisconnectNotarisations(block, pindexDelete->GetHeight());
     }
+    AssetsOrderBookDisconnect(block);
+    komodo_miners_disconnect(pindexDelete);
+    if (!komodo_kvdisconnect(pindexDelete))
+        return AbortNode(state, "Failed to undo the KV index");
     pindexDelete->segid = -2;
     pindexDelete->nNotaryPay = 0;
     pindexDelete->newcoins = 0;
@@ -4141,7 +4969,11 @@ bool static DisconnectTip(CValidationState &state, bool fBare = false) {
         return false;
 
     if (!fBare) {
-        // resurrect mempool transactions from the disconnected block.
+        // resurrect mempool transactions from the disconnected block, verifying their proofs in parallel first
+        std::vector<const CTransaction*> vResurrect;
+        for (const CTransaction& tx : block.vtx)
+            vResurrect.push_back(&tx);
+        PreverifyShieldedTransactions(vResurrect);
         for (int i = 0; i < block.vtx.size(); i++)
         {
             // ignore validation errors in resurrected transactions
@@ -4276,6 +5108,7 @@ bool static ConnectTip(CValidationState &state, CBlockIndex *pindexNew, CBlock *
     assert(pindexNew->pprev == chainActive.Tip());
     // Read block from disk.
     int64_t nTime1 = GetTimeMicros();
+    StartBlockConnectStats();
     CBlock block;
     if (!pblock) {
         if (!ReadBlockFromDisk(block, pindexNew,1))
@@ -4295,6 +5128,7 @@ bool static ConnectTip(CValidationState &state, CBlockIndex *pindexNew, CBlock *
     // Apply the block atomically to the chain state.
     int64_t nTime2 = GetTimeMicros(); nTimeReadFromDisk += nTime2 - nTime1;
     int64_t nTime3;
+    AddBlockConnectTime(CONNECT_STAGE_READ, nTime2 - nTime1);
     LogPrint("bench", "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * 0.001, nTimeReadFromDisk * 0.000001);
     {
         CCoinsViewCache view(pcoinsTip);
@@ -4314,12 +5148,24 @@ bool static ConnectTip(CValidationState &state, CBlockIndex *pindexNew, CBlock *
             return error("ConnectTip(): ConnectBlock %s failed", pindexNew->GetBlockHash().ToString());
         }
         mapBlockSource.erase(pindexNew->GetBlockHash());
+        int64_t nTimeKomodo = GetTimeMicros();
+        komodo_miners_connect(pindexNew, pblock);
+        AssetsOrderBookConnect(*pblock);
+        if (!komodo_kvconnect(pindexNew, *pblock))
+            return AbortNode(state, "Failed to write the KV index");
         nTime3 = GetTimeMicros(); nTimeConnectTotal += nTime3 - nTime2;
+        AddBlockConnectTime(CONNECT_STAGE_KOMODO, nTime3 - nTimeKomodo);
         LogPrint("bench", "  - Connect total: %.2fms [%.2fs]\n", (nTime3 - nTime2) * 0.001, nTimeConnectTotal * 0.000001);
         if ( KOMODO_NSPV_FULLNODE )
+        {
+            // The view only holds this block, its changes go to the UTXO set statistics
+            if (!ConnectCoinsStats(*pblock, pindexNew, view))
+                return AbortNode(state, "Failed to write UTXO set statistics");
             assert(view.Flush());
+        }
     }
     int64_t nTime4 = GetTimeMicros(); nTimeFlush += nTime4 - nTime3;
+    AddBlockConnectTime(CONNECT_STAGE_FLUSH, nTime4 - nTime3);
     LogPrint("bench", "  - Flush: %.2fms [%.2fs]\n", (nTime4 - nTime3) * 0.001, nTimeFlush * 0.000001);
     // Write the chain state to disk, if necessary.
     if ( KOMODO_NSPV_FULLNODE )
@@ -4328,6 +5174,7 @@ bool static ConnectTip(CValidationState &state, CBlockIndex *pindexNew, CBlock *
             return false;
     }
     int64_t nTime5 = GetTimeMicros(); nTimeChainState += nTime5 - nTime4;
+    AddBlockConnectTime(CONNECT_STAGE_CHAINSTATE, nTime5 - nTime4);
     LogPrint("bench", "  - Writing chainstate: %.2fms [%.2fs]\n", (nTime5 - nTime4) * 0.001, nTimeChainState * 0.000001);
     // Remove conflicting transactions from the mempool.
     list<CTransaction> txConflicted;
@@ -4335,9 +5182,14 @@ bool static ConnectTip(CValidationState &state, CBlockIndex *pindexNew, CBlock *
 
     // Remove transactions that expire at new block height from mempool
     mempool.removeExpired(pindexNew->GetHeight());
+    int64_t nTimeMempool = GetTimeMicros();
+    AddBlockConnectTime(CONNECT_STAGE_MEMPOOL, nTimeMempool - nTime5);
 
     // Update chainActive & related variables.
     UpdateTip(pindexNew);
+    blocksConnected.increment();
+    int64_t nTimeUpdateTip = GetTimeMicros();
+    AddBlockConnectTime(CONNECT_STAGE_UPDATETIP, nTimeUpdateTip - nTimeMempool);
     if ( KOMODO_NSPV_FULLNODE )
     {
         // Tell wallet about transactions that went from mempool
@@ -4350,14 +5202,18 @@ bool static ConnectTip(CValidationState &state, CBlockIndex *pindexNew, CBlock *
             SyncWithWallets(tx, pblock);
         }
     }
+    int64_t nTimeWallet = GetTimeMicros();
+    AddBlockConnectTime(CONNECT_STAGE_WALLET, nTimeWallet - nTimeUpdateTip);
     // Update cached incremental witnesses
     GetMainSignals().ChainTip(pindexNew, pblock, oldSproutTree, oldSaplingTree, true);
+    AddBlockConnectTime(CONNECT_STAGE_CHAINTIP, GetTimeMicros() - nTimeWallet);
 
     EnforceNodeDeprecation(pindexNew->GetHeight());
 
     int64_t nTime6 = GetTimeMicros(); nTimePostConnect += nTime6 - nTime5; nTimeTotal += nTime6 - nTime1;
     LogPrint("bench", "  - Connect postprocess: %.2fms [%.2fs]\n", (nTime6 - nTime5) * 0.001, nTimePostConnect * 0.000001);
     LogPrint("bench", "- Connect block: %.2fms [%.2fs]\n", (nTime6 - nTime1) * 0.001, nTimeTotal * 0.000001);
+    FinishBlockConnectStats(pindexNew, pblock->vtx.size(), nTime6 - nTime1);
     if ( KOMODO_LONGESTCHAIN != 0 && (pindexNew->GetHeight() == KOMODO_LONGESTCHAIN || pindexNew->GetHeight() == KOMODO_LONGESTCHAIN+1) )
         KOMODO_INSYNC = (int32_t)pindexNew->GetHeight();
     else KOMODO_INSYNC = 0;
@@ -4618,6 +5474,35 @@ static bool ActivateBestChainStep(bool fSkipdpow, CValidationState &state, CBloc
     return true;
 }
 
+double GetNetworkDifficulty(const CBlockIndex* blockindex);
+
+void PublishChainTipSnapshot()
+{
+    AssertLockHeld(cs_main);
+    std::shared_ptr<CChainTipSnapshot> snapshot = std::make_shared<CChainTipSnapshot>();
+    CBlockIndex* pindexTip = chainActive.Tip();
+    snapshot->nHeadersHeight = pindexBestHeader ? pindexBestHeader->GetHeight() : -1;
+    if (pindexTip != NULL) {
+        snapshot->pindexTip = pindexTip;
+        snapshot->nHeight = pindexTip->GetHeight();
+        snapshot->nMedianTimePast = pindexTip->GetMedianTimePast();
+        snapshot->dNetworkDifficulty = GetNetworkDifficulty(pindexTip);
+        if (pcoinsTip != NULL) {
+            SproutMerkleTree tree;
+            pcoinsTip->GetSproutAnchorAt(pcoinsTip->GetBestAnchor(SPROUT), tree);
+            snapshot->nSproutCommitments = tree.size();
+            snapshot->nCoinsCacheUsage = pcoinsTip->DynamicMemoryUsage();
+        }
+        snapshot->nNotarizedHeight = komodo_notarized_height(&snapshot->nPrevMoMHeight, &snapshot->notarizedHash, &snapshot->notarizedDestTxid);
+    }
+    std::atomic_store(&chainTipSnapshot, std::shared_ptr<const CChainTipSnapshot>(snapshot));
+}
+
+std::shared_ptr<const CChainTipSnapshot> GetChainTipSnapshot()
+{
+    return std::atomic_load(&chainTipSnapshot);
+}
+
 static void NotifyHeaderTip() {
     bool fNotify = false;
     bool fInitialBlockDownload = false;
@@ -4631,6 +5516,11 @@ static void NotifyHeaderTip() {
             fNotify = true;
             fInitialBlockDownload = IsInitialBlockDownload();
             pindexHeaderOld = pindexHeader;
+
+            // Only the headers moved, the rest of the snapshot stays as it is
+            std::shared_ptr<CChainTipSnapshot> snapshot = std::make_shared<CChainTipSnapshot>(*GetChainTipSnapshot());
+            snapshot->nHeadersHeight = pindexHeader ? pindexHeader->GetHeight() : -1;
+            std::atomic_store(&chainTipSnapshot, std::shared_ptr<const CChainTipSnapshot>(snapshot));
         }
     }
     // Send block tip changed notifications without cs_main
@@ -4663,11 +5553,18 @@ bool ActivateBestChain(bool fSkipdpow, CValidationState &state, CBlock *pblock)
 
             pindexMostWork = FindMostWorkChain();
 
-            // Whether we have anything to do at all.
-            if (pindexMostWork == NULL || pindexMostWork == chainActive.Tip())
+            // Whether we have anything to do at all. The tip may still have been
+            // moved back by InvalidateBlock, so the snapshot may still lag behind.
+            if (pindexMostWork == NULL || pindexMostWork == chainActive.Tip()) {
+                if (pindexOldTip != GetChainTipSnapshot()->pindexTip)
+                    PublishChainTipSnapshot();
                 return true;
+            }
 
-            if (!ActivateBestChainStep(fSkipdpow, state, pindexMostWork, pblock && pblock->GetHash() == pindexMostWork->GetBlockHash() ? pblock : NULL))
+            bool fStepOk = ActivateBestChainStep(fSkipdpow, state, pindexMostWork, pblock && pblock->GetHash() == pindexMostWork->GetBlockHash() ? pblock : NULL);
+            // Also after a failed step, which can leave the chain on a different tip
+            PublishChainTipSnapshot();
+            if (!fStepOk)
                 return false;
             pindexNewTip = chainActive.Tip();
             fInitialDownload = IsInitialBlockDownload();
@@ -4684,10 +5581,23 @@ bool ActivateBestChain(bool fSkipdpow, CValidationState &state, CBlock *pblock)
             // Don't relay blocks if pruning -- could cause a peer to try to download, resulting
             // in a stalled download if the block file is pruned before the request.
             if (nLocalServices & NODE_NETWORK) {
-                LOCK(cs_vNodes);
+                // Peers that asked for it get a new block we just received announced as cmpctblock right away
+                bool fCompact = !fInitialDownload && pblock && pblock->GetHash() == hashNewTip;
+                std::unique_ptr<CBlockHeaderAndShortTxIDs> pcmpctblock;
+                LOCK2(cs_main, cs_vNodes);
                 BOOST_FOREACH(CNode* pnode, vNodes)
                 if (chainActive.Height() > (pnode->nStartingHeight != -1 ? pnode->nStartingHeight - 2000 : nBlockEstimate))
-                    pnode->PushInventory(CInv(MSG_BLOCK, hashNewTip));
+                {
+                    CNodeState *nodestate = State(pnode->GetId());
+                    if (fCompact && nodestate && nodestate->fPreferHeaderAndIDs) {
+                        if (!pcmpctblock)
+                            pcmpctblock.reset(new CBlockHeaderAndShortTxIDs(*pblock));
+                        pnode->PushMessage("cmpctblock", *pcmpctblock);
+                        pnode->AddInventoryKnown(CInv(MSG_BLOCK, hashNewTip));
+                    } else {
+                        pnode->PushInventory(CInv(MSG_BLOCK, hashNewTip));
+                    }
+                }
             }
             // Notify external listeners about the new tip.
             GetMainSignals().UpdatedBlockTip(pindexNewTip);
@@ -4824,8 +5734,8 @@ CBlockIndex* AddToBlockIndex(const CBlockHeader& block)
         }
     }
     // Construct new block index object
-    CBlockIndex* pindexNew = new CBlockIndex(block);
-    assert(pindexNew);
+    CBlockIndex* pindexNew = blockIndexArena.Allocate();
+    *pindexNew = CBlockIndex(block);
     // We assign the sequence id to blocks only when the full data is available,
     // to avoid miners withholding blocks but broadcasting headers, to get a
     // competitive advantage.
@@ -4929,6 +5839,20 @@ bool ReceivedBlockTransactions(const CBlock &block, CValidationState& state, CBl
     return true;
 }
 
+static boost::filesystem::path BlockFilePath(int nFile, const char *prefix, bool fCold)
+{
+    std::string strName = strprintf("%s%05u.dat", prefix, nFile);
+    return fCold ? pathColdBlocks / strName : GetDataDir() / "blocks" / strName;
+}
+
+static bool IsColdBlockFile(int nFile)
+{
+    if (pathColdBlocks.empty())
+        return false;
+    LOCK(cs_ColdBlockFiles);
+    return setColdBlockFiles.count(nFile) != 0;
+}
+
 bool FindBlockPos(int32_t tmpflag,CValidationState &state, CDiskBlockPos &pos, unsigned int nAddSize, unsigned int nHeight, uint64_t nTime, bool fKnown)
 {
     std::vector<CBlockFileInfo> *ptr; int *lastfilep;
@@ -4957,6 +5881,9 @@ bool FindBlockPos(int32_t tmpflag,CValidationState &state, CDiskBlockPos &pos, u
         if (vinfoBlockFile.size() <= nFile) {
             vinfoBlockFile.resize(nFile + 1);
         }
+        // A reindex finds the files again where they are
+        if (fKnown && vinfoBlockFile[nFile].nTier == BLOCK_FILE_HOT && IsColdBlockFile(nFile))
+            vinfoBlockFile[nFile].nTier = BLOCK_FILE_COLD;
     }
 
     if (!fKnown) {
@@ -5003,6 +5930,7 @@ bool FindBlockPos(int32_t tmpflag,CValidationState &state, CDiskBlockPos &pos, u
                     tmpBlockFiles[1].SetNull();
                     pos.nFile = TMPFILE_START+1;
                     pos.nPos = (*ptr)[1].nSize;
+                    blockFileMapper.Invalidate(pos.nFile);
                     boost::filesystem::remove(GetBlockPosFilename(pos, "blk"));
                     LogPrintf("Prune: deleted temp blk (%05u)\n",nFile);
                 }
@@ -5030,6 +5958,7 @@ bool FindBlockPos(int32_t tmpflag,CValidationState &state, CDiskBlockPos &pos, u
                     tmpBlockFiles[0].SetNull();
                     pos.nFile = TMPFILE_START;
                     pos.nPos = (*ptr)[0].nSize;
+                    blockFileMapper.Invalidate(pos.nFile);
                     boost::filesystem::remove(GetBlockPosFilename(pos, "blk"));
                     LogPrintf("Prune: deleted temp blk (%05u)\n",nFile);
                 }
@@ -5477,14 +6406,23 @@ bool ContextualCheckBlock(int32_t slowflag,const CBlock& block, CValidationState
     const Consensus::Params& consensusParams = Params().GetConsensus();
     bool sapling = NetworkUpgradeActive(nHeight, consensusParams, Consensus::UPGRADE_SAPLING);
 
+    // Sapling proofs of all transactions in the block are verified in parallel,
+    // unless the block is buried under an assumed notarization
+    bool fSaplingChecks = !IsAssumedNotarized(nHeight, block.GetHash());
+    CCheckQueueControl<CSaplingCheck> control(nScriptCheckThreads ? &saplingcheckqueue : NULL);
+
     // Check that all transactions are finalized
     for (uint32_t i = 0; i < block.vtx.size(); i++) {
         const CTransaction& tx = block.vtx[i];
 
         // Check transaction contextually against consensus rules at block height
-        if (!ContextualCheckTransaction(slowflag,&block,pindexPrev,tx, state, nHeight, 100)) {
+        // Without Sapling checks they are collected but never run
+        std::vector<CSaplingCheck> vSaplingChecks;
+        if (!ContextualCheckTransaction(slowflag,&block,pindexPrev,tx, state, nHeight, 100, IsInitialBlockDownload, 1, (nScriptCheckThreads || !fSaplingChecks) ? &vSaplingChecks : NULL)) {
             return false; // Failure reason has been set in validation state object
         }
+        if (fSaplingChecks)
+            control.Add(vSaplingChecks);
 
         int nLockTimeFlags = 0;
         int64_t nLockTimeCutoff = (nLockTimeFlags & LOCKTIME_MEDIAN_TIME_PAST)
@@ -5507,6 +6445,17 @@ bool ContextualCheckBlock(int32_t slowflag,const CBlock& block, CValidationState
             return state.DoS(100, error("%s: block height mismatch in coinbase", __func__), REJECT_INVALID, "bad-cb-height");
         }
     }
+
+    if (!control.Wait())
+    {
+        // The queue does not report which check failed, so find the offending
+        // transaction serially to set the precise reject reason.
+        for (uint32_t i = 0; i < block.vtx.size(); i++) {
+            if (!ContextualCheckTransaction(slowflag,&block,pindexPrev,block.vtx[i], state, nHeight, 100))
+                return false;
+        }
+        return state.DoS(100, error("%s: Sapling proof verification failed", __func__), REJECT_INVALID, "bad-txns-sapling-proof-invalid");
+    }
     return true;
 }
 
@@ -5701,14 +6650,22 @@ bool AcceptBlock(int32_t *futureblockp,CBlock& block, CValidationState& state, C
 
     // Write block to history file
     try {
-        unsigned int nBlockSize = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
+        // A block written here may be compressed, one already on disk is kept as it is
+        std::vector<char> vRecord;
+        unsigned int nBlockSize;
+        if (dbp == NULL) {
+            UpdateBlockDictionary();
+            SerializeRecord(block, vRecord);
+            nBlockSize = vRecord.size();
+        } else
+            nBlockSize = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
         CDiskBlockPos blockPos;
         if (dbp != NULL)
             blockPos = *dbp;
         if (!FindBlockPos(usetmp,state, blockPos, nBlockSize+8, nHeight, block.GetBlockTime(), dbp != NULL))
             return error("AcceptBlock(): FindBlockPos failed");
         if (dbp == NULL)
-            if (!WriteBlockToDisk(block, blockPos, chainparams.MessageStart()))
+            if (!WriteBlockToDisk(vRecord, blockPos, chainparams.MessageStart()))
                 AbortNode(state, "Failed to write block");
         if (!ReceivedBlockTransactions(block, state, pindex, blockPos))
             return error("AcceptBlock(): ReceivedBlockTransactions failed");
@@ -5772,9 +6729,7 @@ CBlockIndex *oldkomodo_ensure(CBlock *pblock, uint256 hash)
     CBlockIndex *pindex=0,*previndex=0;
     if ( (pindex = komodo_getblockindex(hash)) == 0 )
     {
-        pindex = new CBlockIndex();
-        if (!pindex)
-            throw runtime_error("komodo_ensure: new CBlockIndex failed");
+        pindex = blockIndexArena.Allocate();
         BlockMap::iterator mi = mapBlockIndex.insert(make_pair(hash, pindex)).first;
         pindex->phashBlock = &((*mi).first);
     }
@@ -5995,6 +6950,7 @@ void UnlinkPrunedFiles(std::set<int>& setFilesToPrune)
 {
     for (set<int>::iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); ++it) {
         CDiskBlockPos pos(*it, 0);
+        blockFileMapper.Invalidate(*it);
         boost::filesystem::remove(GetBlockPosFilename(pos, "blk"));
         boost::filesystem::remove(GetBlockPosFilename(pos, "rev"));
         LogPrintf("Prune: %s deleted blk/rev (%05u)\n", __func__, *it);
@@ -6034,6 +6990,10 @@ void FindFilesToPrune(std::set<int>& setFilesToPrune)
             if (vinfoBlockFile[fileNumber].nHeightLast > nLastBlockWeCanPrune)
                 continue;
 
+            // nor files with blocks the wallet could not rebuild its witnesses from once they are gone
+            if (!pblocktree->HaveCompactBlockIndex(vinfoBlockFile[fileNumber].nHeightFirst, vinfoBlockFile[fileNumber].nHeightLast))
+                continue;
+
             PruneOneBlockFile(false, fileNumber);
             // Queue up the files for removal
             setFilesToPrune.insert(fileNumber);
@@ -6067,6 +7027,12 @@ FILE* OpenDiskFile(const CDiskBlockPos &pos, const char *prefix, bool fReadOnly)
     boost::filesystem::path path = GetBlockPosFilename(pos, prefix);
     boost::filesystem::create_directories(path.parent_path());
     FILE* file = fopen(path.string().c_str(), "rb+");
+    if (!file && !pathColdBlocks.empty()) {
+        // A move between the tiers that a crash interrupted leaves the rev file where the blk file is not
+        boost::filesystem::path other = BlockFilePath(pos.nFile, prefix, !IsColdBlockFile(pos.nFile));
+        if ((file = fopen(other.string().c_str(), "rb+")) != NULL)
+            path = other;
+    }
     if (!file && !fReadOnly)
         file = fopen(path.string().c_str(), "wb+");
     if (!file) {
@@ -6098,7 +7064,119 @@ FILE* OpenUndoFile(const CDiskBlockPos &pos, bool fReadOnly) {
 
 boost::filesystem::path GetBlockPosFilename(const CDiskBlockPos &pos, const char *prefix)
 {
-    return GetDataDir() / "blocks" / strprintf("%s%05u.dat", prefix, pos.nFile);
+    return BlockFilePath(pos.nFile, prefix, IsColdBlockFile(pos.nFile));
+}
+
+/**
+ * Finds the block files in pathColdBlocks. A move copies the rev file and
+ * then the blk file under temporary names and renames them in that order, so
+ * a blk file there means the move got that far and the datadir copies left by
+ * a crash are dropped, as are the temporary copies.
+ */
+static void LoadColdBlockFiles()
+{
+    std::set<int> setFound;
+    boost::system::error_code ec;
+    TryCreateDirectory(pathColdBlocks);
+    for (boost::filesystem::directory_iterator it(pathColdBlocks, ec); !ec && it != boost::filesystem::directory_iterator(); it.increment(ec)) {
+        std::string strName = it->path().filename().string();
+        if (strName.length() == 16 && strName.substr(12) == ".tmp")
+            boost::filesystem::remove(it->path(), ec);
+        else if (strName.length() == 12 && strName.substr(0, 3) == "blk" && strName.substr(8) == ".dat")
+            setFound.insert(atoi(strName.substr(3, 5)));
+    }
+    BOOST_FOREACH(int nFile, setFound) {
+        boost::filesystem::remove(BlockFilePath(nFile, "blk", false), ec);
+        if (boost::filesystem::exists(BlockFilePath(nFile, "rev", true), ec))
+            boost::filesystem::remove(BlockFilePath(nFile, "rev", false), ec);
+    }
+    LogPrintf("%s: %u block files in %s\n", __func__, setFound.size(), pathColdBlocks.string());
+    LOCK(cs_ColdBlockFiles);
+    setColdBlockFiles.swap(setFound);
+}
+
+//! Copies the rev and blk files of nFile to pathColdBlocks under temporary names, which are returned with the final ones
+static bool CopyBlockFileToColdStorage(int nFile, std::vector<std::pair<boost::filesystem::path, boost::filesystem::path> >& vCopies)
+{
+    const char* prefixes[] = {"rev", "blk"};
+    BOOST_FOREACH(const char* prefix, prefixes) {
+        boost::filesystem::path from = BlockFilePath(nFile, prefix, false), to = BlockFilePath(nFile, prefix, true);
+        if (!boost::filesystem::exists(from))
+            continue;
+        boost::filesystem::path tmp = to.string() + ".tmp";
+        vCopies.push_back(std::make_pair(tmp, to));
+        try {
+            boost::filesystem::copy_file(from, tmp, boost::filesystem::copy_option::overwrite_if_exists);
+        } catch (const boost::filesystem::filesystem_error& e) {
+            return error("%s: failed to copy %s: %s", __func__, from.string(), e.what());
+        }
+        FILE* file = fopen(tmp.string().c_str(), "rb+");
+        if (file == NULL)
+            return error("%s: failed to open %s", __func__, tmp.string());
+        FileCommit(file);
+        fclose(file);
+    }
+    return true;
+}
+
+//! Most block files moved in one run of MoveBlockFilesToColdStorage, which holds a scheduler thread
+static const int MAX_COLD_BLOCK_FILES_PER_RUN = 8;
+
+void MoveBlockFilesToColdStorage()
+{
+    if (pathColdBlocks.empty() || fReindex || fImporting)
+        return;
+    for (int nMoved = 0; nMoved < MAX_COLD_BLOCK_FILES_PER_RUN && !ShutdownRequested(); nMoved++) {
+        int nFile;
+        CBlockFileInfo info;
+        {
+            LOCK2(cs_main, cs_LastBlockFile);
+            if (chainActive.Height() < (int)nColdBlocksDepth)
+                return;
+            unsigned int nColdHeight = chainActive.Height() - nColdBlocksDepth;
+            // The last file is still written to
+            for (nFile = 0; nFile < nLastBlockFile; nFile++) {
+                const CBlockFileInfo& candidate = vinfoBlockFile[nFile];
+                if (candidate.nTier == BLOCK_FILE_HOT && candidate.nBlocks > 0 && candidate.nHeightLast < nColdHeight)
+                    break;
+            }
+            if (nFile >= nLastBlockFile)
+                return;
+            info = vinfoBlockFile[nFile];
+        }
+
+        // Copied without the locks, the files are only appended to with cs_main held
+        std::vector<std::pair<boost::filesystem::path, boost::filesystem::path> > vCopies;
+        bool fMoved = CopyBlockFileToColdStorage(nFile, vCopies);
+        {
+            LOCK2(cs_main, cs_LastBlockFile);
+            CBlockFileInfo& current = vinfoBlockFile[nFile];
+            // Undo data of blocks connected meanwhile is not in the copy, it is tried again later
+            if (current.nSize != info.nSize || current.nUndoSize != info.nUndoSize || current.nTier != BLOCK_FILE_HOT)
+                fMoved = false;
+            for (size_t i = 0; fMoved && i < vCopies.size(); i++)
+                fMoved = RenameOver(vCopies[i].first, vCopies[i].second);
+            if (fMoved) {
+                current.nTier = BLOCK_FILE_COLD;
+                setDirtyFileInfo.insert(nFile);
+                {
+                    LOCK(cs_ColdBlockFiles);
+                    setColdBlockFiles.insert(nFile);
+                }
+                blockFileMapper.Invalidate(nFile);
+            }
+        }
+        boost::system::error_code ec;
+        if (!fMoved) {
+            for (size_t i = 0; i < vCopies.size(); i++)
+                boost::filesystem::remove(vCopies[i].first, ec);
+            return;
+        }
+        // Readers that opened them before keep reading the removed files
+        boost::filesystem::remove(BlockFilePath(nFile, "blk", false), ec);
+        boost::filesystem::remove(BlockFilePath(nFile, "rev", false), ec);
+        LogPrintf("%s: moved blk/rev (%05u) to %s\n", __func__, nFile, pathColdBlocks.string());
+    }
 }
 
 CBlockIndex * InsertBlockIndex(uint256 hash)
@@ -6112,9 +7190,7 @@ CBlockIndex * InsertBlockIndex(uint256 hash)
         return (*mi).second;
 
     // Create new
-    CBlockIndex* pindexNew = new CBlockIndex();
-    if (!pindexNew)
-        throw runtime_error("LoadBlockIndex(): new CBlockIndex failed");
+    CBlockIndex* pindexNew = blockIndexArena.Allocate();
     mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
     pindexNew->phashBlock = &((*mi).first);
     //fprintf(stderr,"inserted to block index %s\n",hash.ToString().c_str());
@@ -6133,6 +7209,16 @@ bool static LoadBlockIndexDB()
     LogPrintf("%s: loaded guts\n", __func__);
     boost::this_thread::interruption_point();
 
+    uint256 hashSnapshotBase;
+    uint64_t nSnapshotChainTx = 0;
+    if (pblocktree->ReadSnapshotBase(hashSnapshotBase, nSnapshotChainTx)) {
+        BlockMap::iterator mi = mapBlockIndex.find(hashSnapshotBase);
+        if (mi != mapBlockIndex.end()) {
+            pindexSnapshotBase = mi->second;
+            LogPrintf("%s: chain state was loaded from a snapshot at height %d\n", __func__, pindexSnapshotBase->GetHeight());
+        }
+    }
+
     // Calculate chainPower
     vector<pair<int, CBlockIndex*> > vSortedByHeight;
     vSortedByHeight.reserve(mapBlockIndex.size());
@@ -6153,6 +7239,11 @@ bool static LoadBlockIndexDB()
     {
         CBlockIndex* pindex = item.second;
         pindex->chainPower = (pindex->pprev ? CChainPower(pindex) + pindex->pprev->chainPower : CChainPower(pindex)) + GetBlockProof(*pindex);
+        if (pindex == pindexSnapshotBase && pindex->nTx == 0) {
+            // The chain state starts here, the blocks before it were never received
+            pindex->nChainTx = nSnapshotChainTx;
+            pindex->nCachedBranchId = CurrentEpochBranchId(pindex->GetHeight(), chainparams.GetConsensus());
+        }
         // We can link the chain of blocks for which we've received transactions at some point.
         // Pruned nodes may have deleted the block.
         if (pindex->nTx > 0) {
@@ -6227,6 +7318,16 @@ bool static LoadBlockIndexDB()
             break;
         }
     }
+    // The tiers are where the files were found, which a crash during a move can leave unrecorded
+    for (size_t nFile = 0; nFile < vinfoBlockFile.size(); nFile++) {
+        unsigned int nTier = IsColdBlockFile(nFile) ? BLOCK_FILE_COLD : BLOCK_FILE_HOT;
+        if (vinfoBlockFile[nFile].nTier == nTier)
+            continue;
+        if (pathColdBlocks.empty())
+            return error("%s: block file %05u was moved to cold storage, -coldblocksdir is needed to read it", __func__, nFile);
+        vinfoBlockFile[nFile].nTier = nTier;
+        setDirtyFileInfo.insert(nFile);
+    }
 
     // Check presence of blk files
     LogPrintf("Checking all blk files are present...\n");
@@ -6285,6 +7386,17 @@ bool static LoadBlockIndexDB()
     pblocktree->ReadFlag("spentindex", fSpentIndex);
     LogPrintf("%s: spent index %s\n", __func__, fSpentIndex ? "enabled" : "disabled");
 
+    // Check whether we have a CC index
+    pblocktree->ReadFlag("ccindex", fCCIndex);
+    LogPrintf("%s: CC index %s\n", __func__, fCCIndex ? "enabled" : "disabled");
+
+    // Check whether indexes are being built online
+    LoadIndexBuildState();
+
+    // Check whether we have a compact block index
+    pblocktree->ReadFlag("compactblockindex", fCompactBlockIndex);
+    LogPrintf("%s: compact block index %s\n", __func__, fCompactBlockIndex ? "enabled" : "disabled");
+
     // Fill in-memory data
     BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
     {
@@ -6311,6 +7423,7 @@ bool static LoadBlockIndexDB()
     it->second->hashFinalSproutRoot = pcoinsTip->GetBestAnchor(SPROUT);
 
     PruneBlockIndexCandidates();
+    PublishChainTipSnapshot();
 
     double progress;
     if ( ASSETCHAINS_SYMBOL[0] == 0 ) {
@@ -6339,6 +7452,192 @@ bool static LoadBlockIndexDB()
     return true;
 }
 
+//! Reads one snapshot record into the matching output, returns false at the end record
+template <typename Stream>
+static bool ReadSnapshotRecord(Stream& s, unsigned char& type, uint256& key, CCoins& coins, SproutMerkleTree& sproutTree, SaplingMerkleTree& saplingTree)
+{
+    s >> type;
+    switch (type) {
+        case SNAPSHOT_RECORD_END:
+            return false;
+        case SNAPSHOT_RECORD_COINS:
+            s >> key >> coins;
+            break;
+        case SNAPSHOT_RECORD_SPROUT_ANCHOR:
+            s >> key >> sproutTree;
+            break;
+        case SNAPSHOT_RECORD_SAPLING_ANCHOR:
+            s >> key >> saplingTree;
+            break;
+        case SNAPSHOT_RECORD_SPROUT_NULLIFIER:
+        case SNAPSHOT_RECORD_SAPLING_NULLIFIER:
+            s >> key;
+            break;
+        default:
+            throw std::ios_base::failure("unknown snapshot record type");
+    }
+    return true;
+}
+
+bool LoadCoinsSnapshot(const boost::filesystem::path& path, const uint256& hashExpected, CCoinsSnapshotMetadata& metadata, std::string& strError)
+{
+    const CChainParams& chainparams = Params();
+    unsigned char type;
+    uint256 key;
+    CCoins coins;
+    SproutMerkleTree sproutTree;
+    SaplingMerkleTree saplingTree;
+    uint64_t nRecords = 0;
+
+    // Check the whole file against its checksum before anything is written
+    try {
+        CAutoFile file(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+        if (file.IsNull()) {
+            strError = "Cannot open snapshot file " + path.string();
+            return false;
+        }
+        CHashVerifier<CAutoFile> verifier(&file);
+        verifier >> metadata;
+        while (ReadSnapshotRecord(verifier, type, key, coins, sproutTree, saplingTree)) {
+            boost::this_thread::interruption_point();
+            nRecords++;
+        }
+        uint256 hashChecksum;
+        file >> hashChecksum;
+        if (hashChecksum != verifier.GetHash()) {
+            strError = "Snapshot checksum mismatch, the file is corrupted";
+            return false;
+        }
+        if (!hashExpected.IsNull() && hashChecksum != hashExpected) {
+            strError = "Snapshot checksum " + hashChecksum.GetHex() + " differs from the expected one";
+            return false;
+        }
+    } catch (const std::exception& e) {
+        strError = strprintf("Cannot read snapshot: %s", e.what());
+        return false;
+    }
+
+    LOCK(cs_main);
+    if (chainActive.Height() > 0) {
+        strError = "A snapshot can only be loaded before any block is connected";
+        return false;
+    }
+    BlockMap::iterator mi = mapBlockIndex.find(metadata.hashBlock);
+    if (mi == mapBlockIndex.end() || mi->second->GetHeight() != metadata.nHeight) {
+        strError = "The header of the snapshot base block is not known yet, wait for the headers to sync";
+        return false;
+    }
+    CBlockIndex* pindexBase = mi->second;
+    if (!IsNotarizedAncestor(pindexBase->GetHeight(), pindexBase->GetBlockHash())) {
+        strError = "The snapshot base block is not notarized, start with -assumenotarized=<notarized block hash>";
+        return false;
+    }
+    if (pindexBase->hashFinalSaplingRoot != metadata.hashSaplingAnchor) {
+        strError = "The Sapling anchor of the snapshot does not match its base block";
+        return false;
+    }
+    if (metadata.nChainTx == 0) {
+        strError = "The snapshot has no transaction count";
+        return false;
+    }
+
+    LogPrintf("Loading %u snapshot records at height %d\n", nRecords, metadata.nHeight);
+    pblocktree->WriteFlag("txoutsetloading", true);
+
+    // Add the records to the cache in batches, flushing it when it is full.
+    // Only the last batch moves the best block to the snapshot base.
+    try {
+        CAutoFile file(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+        if (file.IsNull()) {
+            strError = "Cannot open snapshot file " + path.string();
+            return false;
+        }
+        CCoinsSnapshotMetadata metadataReread;
+        file >> metadataReread;
+
+        bool fEnd = false;
+        while (!fEnd) {
+            CCoinsMap mapCoins;
+            CAnchorsSproutMap mapSproutAnchors;
+            CAnchorsSaplingMap mapSaplingAnchors;
+            CNullifiersMap mapSproutNullifiers;
+            CNullifiersMap mapSaplingNullifiers;
+            for (size_t i = 0; i < 10000; i++) {
+                if (!ReadSnapshotRecord(file, type, key, coins, sproutTree, saplingTree)) {
+                    fEnd = true;
+                    break;
+                }
+                switch (type) {
+                    case SNAPSHOT_RECORD_COINS: {
+                        CCoinsCacheEntry& entry = mapCoins[key];
+                        entry.coins.swap(coins);
+                        entry.flags = CCoinsCacheEntry::DIRTY | CCoinsCacheEntry::FRESH;
+                        break;
+                    }
+                    case SNAPSHOT_RECORD_SPROUT_ANCHOR: {
+                        CAnchorsSproutCacheEntry& entry = mapSproutAnchors[key];
+                        entry.entered = true;
+                        entry.tree = sproutTree;
+                        entry.flags = CAnchorsSproutCacheEntry::DIRTY;
+                        break;
+                    }
+                    case SNAPSHOT_RECORD_SAPLING_ANCHOR: {
+                        CAnchorsSaplingCacheEntry& entry = mapSaplingAnchors[key];
+                        entry.entered = true;
+                        entry.tree = saplingTree;
+                        entry.flags = CAnchorsSaplingCacheEntry::DIRTY;
+                        break;
+                    }
+                    case SNAPSHOT_RECORD_SPROUT_NULLIFIER:
+                    case SNAPSHOT_RECORD_SAPLING_NULLIFIER: {
+                        CNullifiersCacheEntry& entry = (type == SNAPSHOT_RECORD_SPROUT_NULLIFIER ? mapSproutNullifiers : mapSaplingNullifiers)[key];
+                        entry.entered = true;
+                        entry.flags = CNullifiersCacheEntry::DIRTY;
+                        break;
+                    }
+                }
+            }
+            boost::this_thread::interruption_point();
+            uint256 hashBlock = fEnd ? metadata.hashBlock : pcoinsTip->GetBestBlock();
+            uint256 hashSproutAnchor = fEnd ? metadata.hashSproutAnchor : pcoinsTip->GetBestAnchor(SPROUT);
+            uint256 hashSaplingAnchor = fEnd ? metadata.hashSaplingAnchor : pcoinsTip->GetBestAnchor(SAPLING);
+            if (!pcoinsTip->BatchWrite(mapCoins, hashBlock, hashSproutAnchor, hashSaplingAnchor,
+                                       mapSproutAnchors, mapSaplingAnchors, mapSproutNullifiers, mapSaplingNullifiers) ||
+                ((fEnd || pcoinsTip->DynamicMemoryUsage() > nCoinCacheUsage) && !pcoinsTip->Flush())) {
+                strError = "Failed to write the snapshot to the chain state database";
+                return false;
+            }
+        }
+    } catch (const std::exception& e) {
+        strError = strprintf("Cannot read snapshot: %s", e.what());
+        return false;
+    }
+
+    // The blocks before the base stay without data, the chain continues from it
+    pindexBase->nChainTx = metadata.nChainTx;
+    pindexBase->nCachedBranchId = CurrentEpochBranchId(pindexBase->GetHeight(), chainparams.GetConsensus());
+    pindexBase->hashFinalSproutRoot = metadata.hashSproutAnchor;
+    pindexBase->RaiseValidity(BLOCK_VALID_SCRIPTS);
+    setDirtyBlockIndex.insert(pindexBase);
+    pindexSnapshotBase = pindexBase;
+    pblocktree->WriteSnapshotBase(metadata.hashBlock, metadata.nChainTx);
+
+    chainActive.SetTip(pindexBase);
+    setBlockIndexCandidates.insert(pindexBase);
+    PruneBlockIndexCandidates();
+    PublishChainTipSnapshot();
+    mempool.clear();
+
+    CValidationState state;
+    if (!FlushStateToDisk(state, FLUSH_STATE_ALWAYS)) {
+        strError = "Failed to write the block index";
+        return false;
+    }
+    pblocktree->WriteFlag("txoutsetloading", false);
+    LogPrintf("Loaded snapshot, chain state is now at height %d\n", chainActive.Height());
+    return true;
+}
+
 CVerifyDB::CVerifyDB()
 {
     uiInterface.ShowProgress(_("Verifying blocks..."), 0, false);
@@ -6376,6 +7675,8 @@ bool CVerifyDB::VerifyDB(CCoinsView *coinsview, int nCheckLevel, int nCheckDepth
         uiInterface.ShowProgress(_("Verifying blocks..."), std::max(1, std::min(99, (int)(((double)(chainActive.Height() - pindex->GetHeight())) / (double)nCheckDepth * (nCheckLevel >= 4 ? 50 : 100)))), false);
         if (pindex->GetHeight() < chainActive.Height()-nCheckDepth)
             break;
+        if (pindexSnapshotBase && pindex->GetHeight() <= pindexSnapshotBase->GetHeight())
+            break; // Loaded from a snapshot, no block data
         CBlock block;
         // check level 0: read from disk
         if (!ReadBlockFromDisk(block, pindex,0))
@@ -6446,6 +7747,9 @@ bool RewindBlockIndex(const CChainParams& params, bool& clearWitnessCaches)
     // - BLOCK_ACTIVATES_UPGRADE is set only on blocks that activate upgrades.
     // - nCachedBranchId for each block matches what we expect.
     auto sufficientlyValidated = [&params](const CBlockIndex* pindex) {
+        // The state of the blocks up to a snapshot base came with the snapshot
+        if (pindexSnapshotBase && pindexSnapshotBase->GetAncestor(pindex->GetHeight()) == pindex)
+            return true;
         auto consensus = params.GetConsensus();
         bool fFlagSet = pindex->nStatus & BLOCK_ACTIVATES_UPGRADE;
         bool fFlagExpected = IsActivationHeightForAnyUpgrade(pindex->GetHeight(), consensus);
@@ -6584,6 +7888,7 @@ void UnloadBlockIndex()
     chainActive.SetTip(NULL);
     pindexBestInvalid = NULL;
     pindexBestHeader = NULL;
+    pindexSnapshotBase = NULL;
     mempool.clear();
     mapOrphanTransactions.clear();
     mapOrphanTransactionsByPrev.clear();
@@ -6602,10 +7907,9 @@ void UnloadBlockIndex()
     mapNodeState.clear();
     recentRejects.reset(NULL);
 
-    BOOST_FOREACH(BlockMap::value_type& entry, mapBlockIndex) {
-        delete entry.second;
-    }
+    std::atomic_store(&chainTipSnapshot, std::make_shared<const CChainTipSnapshot>());
     mapBlockIndex.clear();
+    blockIndexArena.Clear();
     fHavePruned = false;
 }
 
@@ -6613,6 +7917,8 @@ bool LoadBlockIndex()
 {
     // Load block index from databases
     KOMODO_LOADINGBLOCKS = 1;
+    if (!pathColdBlocks.empty())
+        LoadColdBlockFiles();
     if (!fReindex && !LoadBlockIndexDB())
     {
         KOMODO_LOADINGBLOCKS = 0;
@@ -6652,6 +7958,15 @@ bool InitBlockIndex() {
 
         fSpentIndex = GetBoolArg("-spentindex", DEFAULT_SPENTINDEX);
         pblocktree->WriteFlag("spentindex", fSpentIndex);
+
+        fCCIndex = GetBoolArg("-ccindex", DEFAULT_CCINDEX);
+        pblocktree->WriteFlag("ccindex", fCCIndex);
+
+        fCompactBlockIndex = GetBoolArg("-compactblockindex", DEFAULT_COMPACTBLOCKINDEX);
+        pblocktree->WriteFlag("compactblockindex", fCompactBlockIndex);
+
+        // The KV index is built as the blocks are connected
+        pblocktree->WriteFlag("kvindex", true);
         fprintf(stderr,"fAddressIndex.%d/%d fSpentIndex.%d/%d\n",fAddressIndex,DEFAULT_ADDRESSINDEX,fSpentIndex,DEFAULT_SPENTINDEX);
         LogPrintf("Initializing databases...\n");
     }
@@ -6660,12 +7975,13 @@ bool InitBlockIndex() {
         try {
             CBlock &block = const_cast<CBlock&>(Params().GenesisBlock());
             // Start new block file
-            unsigned int nBlockSize = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
+            std::vector<char> vRecord;
+            SerializeRecord(block, vRecord);
             CDiskBlockPos blockPos;
             CValidationState state;
-            if (!FindBlockPos(0,state, blockPos, nBlockSize+8, 0, block.GetBlockTime()))
+            if (!FindBlockPos(0,state, blockPos, vRecord.size()+8, 0, block.GetBlockTime()))
                 return error("LoadBlockIndex(): FindBlockPos failed");
-            if (!WriteBlockToDisk(block, blockPos, chainparams.MessageStart()))
+            if (!WriteBlockToDisk(vRecord, blockPos, chainparams.MessageStart()))
                 return error("LoadBlockIndex(): writing genesis block to disk failed");
             CBlockIndex *pindex = AddToBlockIndex(block);
             if ( pindex == 0 )
@@ -6688,6 +8004,10 @@ bool InitBlockIndex() {
 
 
 
+//! Records LoadExternalBlockFile reads before parsing them together, and the most bytes they may take
+static const unsigned int BLOCK_PARSE_BATCH_RECORDS = 64;
+static const unsigned int BLOCK_PARSE_BATCH_BYTES = 32 << 20;
+
 bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp)
 {
     const CChainParams& chainparams = Params();
@@ -6697,95 +8017,145 @@ bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp)
 
     int nLoaded = 0;
     try {
-        // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
+        // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor.
+        // It can rewind over a whole batch, to look for a record inside one that did not parse.
         //CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SIZE, MAX_BLOCK_SIZE+8, SER_DISK, CLIENT_VERSION);
-        CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SIZE(10000000), MAX_BLOCK_SIZE(10000000)+8, SER_DISK, CLIENT_VERSION);
+        CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SIZE(10000000) + BLOCK_PARSE_BATCH_BYTES, MAX_BLOCK_SIZE(10000000)+8 + BLOCK_PARSE_BATCH_BYTES, SER_DISK, CLIENT_VERSION);
         uint64_t nRewind = blkdat.GetPos();
-        while (!blkdat.eof()) {
-            boost::this_thread::interruption_point();
-
-            blkdat.SetPos(nRewind);
-            nRewind++; // start one byte further next time, in case of failure
-            blkdat.SetLimit(); // remove former limit
-            unsigned int nSize = 0;
-            try {
-                // locate a header
-                unsigned char buf[MESSAGE_START_SIZE];
-                blkdat.FindByte(Params().MessageStart()[0]);
-                nRewind = blkdat.GetPos()+1;
-                blkdat >> FLATDATA(buf);
-                if (memcmp(buf, Params().MessageStart(), MESSAGE_START_SIZE))
-                    continue;
-                // read size
-                blkdat >> nSize;
-                if (nSize < 80 || nSize > MAX_BLOCK_SIZE(10000000))
-                    continue;
-            } catch (const std::exception&) {
-                // no valid block header found; don't complain
-                break;
+        bool fEnd = false;
+        while (!fEnd) {
+            // Read a batch of records, parse them in parallel, then process the blocks in file order
+            std::vector<CBlockFileRecord> vRecords;
+            vRecords.reserve(BLOCK_PARSE_BATCH_RECORDS);
+            size_t nBatchBytes = 0;
+            while (vRecords.size() < BLOCK_PARSE_BATCH_RECORDS && nBatchBytes < BLOCK_PARSE_BATCH_BYTES) {
+                if (blkdat.eof()) {
+                    fEnd = true;
+                    break;
+                }
+                boost::this_thread::interruption_point();
+
+                blkdat.SetPos(nRewind);
+                nRewind++; // start one byte further next time, in case of failure
+                blkdat.SetLimit(); // remove former limit
+                unsigned int nSize = 0;
+                try {
+                    // locate a header
+                    unsigned char buf[MESSAGE_START_SIZE];
+                    blkdat.FindByte(Params().MessageStart()[0]);
+                    nRewind = blkdat.GetPos()+1;
+                    blkdat >> FLATDATA(buf);
+                    if (memcmp(buf, Params().MessageStart(), MESSAGE_START_SIZE))
+                        continue;
+                    // read size
+                    blkdat >> nSize;
+                    if (nSize < 80 || nSize > MAX_BLOCK_SIZE(10000000))
+                        continue;
+                } catch (const std::exception&) {
+                    // no valid block header found; don't complain
+                    fEnd = true;
+                    break;
+                }
+                try {
+                    // read block
+                    CBlockFileRecord rec;
+                    uint64_t nBlockPos = blkdat.GetPos();
+                    if (dbp) {
+                        rec.pos = *dbp;
+                        rec.pos.nPos = nBlockPos;
+                    }
+                    rec.nRewind = nRewind;
+                    blkdat.SetLimit(nBlockPos + nSize);
+                    blkdat.SetPos(nBlockPos);
+                    rec.vRecord.resize(nSize);
+                    blkdat.read(begin_ptr(rec.vRecord), nSize);
+                    nRewind = blkdat.GetPos();
+                    nBatchBytes += nSize + MESSAGE_START_SIZE + sizeof(nSize);
+                    vRecords.push_back(std::move(rec));
+                } catch (const std::exception& e) {
+                    LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+                }
             }
-            try {
-                // read block
-                CBlock block;
-                uint64_t nBlockPos = blkdat.GetPos();
-                if (dbp)
-                    dbp->nPos = nBlockPos;
-                blkdat.SetLimit(nBlockPos + nSize);
-                blkdat.SetPos(nBlockPos);
-                blkdat >> block;
-
-                nRewind = blkdat.GetPos();
-                // detect out of order blocks, and store them for later
-                uint256 hash = block.GetHash();
-                if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
-                    LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
-                             block.hashPrevBlock.ToString());
-                    if (dbp)
-                        mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
+
+            {
+                CCheckQueueControl<CBlockParseCheck> control(&blockparsecheckqueue);
+                std::vector<CBlockParseCheck> vChecks;
+                vChecks.reserve(vRecords.size());
+                for (CBlockFileRecord& rec : vRecords)
+                    vChecks.push_back(CBlockParseCheck(rec));
+                control.Add(vChecks);
+                control.Wait();
+            }
+
+            for (CBlockFileRecord& rec : vRecords) {
+                if (rec.fCorrupt) {
+                    // Look for the next record inside this one, as if the ones after it were not read yet
+                    LogPrintf("%s: %s\n", __func__, rec.strError);
+                    nRewind = rec.nRewind;
+                    fEnd = false;
+                    break;
+                }
+                if (!rec.strError.empty()) {
+                    LogPrintf("%s: Skipping %s\n", __func__, rec.strError);
                     continue;
                 }
+                try {
+                    CBlock& block = rec.block;
+                    CDiskBlockPos *pdbp = dbp ? &rec.pos : NULL;
+                    // detect out of order blocks, and store them for later
+                    uint256 hash = rec.hash;
+                    if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
+                        LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
+                                 block.hashPrevBlock.ToString());
+                        if (pdbp)
+                            mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *pdbp));
+                        continue;
+                    }
 
-                // process in case the block isn't known yet
-                if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
-                    CValidationState state;
-                    if (ProcessNewBlock(0,0,state, NULL, &block, true, dbp))
-                        nLoaded++;
-                    if (state.IsError())
-                        break;
-                } else if (hash != chainparams.GetConsensus().hashGenesisBlock && komodo_blockheight(hash) % 1000 == 0) {
-                    LogPrintf("Block Import: already had block %s at height %d\n", hash.ToString(), komodo_blockheight(hash));
-                }
+                    // process in case the block isn't known yet
+                    if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
+                        CValidationState state;
+                        if (ProcessNewBlock(0,0,state, NULL, &block, true, pdbp))
+                            nLoaded++;
+                        if (state.IsError()) {
+                            fEnd = true;
+                            break;
+                        }
+                    } else if (hash != chainparams.GetConsensus().hashGenesisBlock && komodo_blockheight(hash) % 1000 == 0) {
+                        LogPrintf("Block Import: already had block %s at height %d\n", hash.ToString(), komodo_blockheight(hash));
+                    }
 
-                NotifyHeaderTip();
+                    NotifyHeaderTip();
 
-                // Recursively process earlier encountered successors of this block
-                deque<uint256> queue;
-                queue.push_back(hash);
-                while (!queue.empty()) {
-                    uint256 head = queue.front();
-                    queue.pop_front();
-                    std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
-                    while (range.first != range.second) {
-                        std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
+                    // Recursively process earlier encountered successors of this block
+                    deque<uint256> queue;
+                    queue.push_back(hash);
+                    while (!queue.empty()) {
+                        uint256 head = queue.front();
+                        queue.pop_front();
+                        std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
+                        while (range.first != range.second) {
+                            std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
 
-                        if (ReadBlockFromDisk(mapBlockIndex.count(hash)!=0?mapBlockIndex[hash]->GetHeight():0,block, it->second,1))
-                        {
-                            LogPrintf("%s: Processing out of order child %s of %s\n", __func__, block.GetHash().ToString(),
-                                      head.ToString());
-                            CValidationState dummy;
-                            if (ProcessNewBlock(0,0,dummy, NULL, &block, true, &it->second))
+                            if (ReadBlockFromDisk(mapBlockIndex.count(hash)!=0?mapBlockIndex[hash]->GetHeight():0,block, it->second,1))
                             {
-                                nLoaded++;
-                                queue.push_back(block.GetHash());
+                                LogPrintf("%s: Processing out of order child %s of %s\n", __func__, block.GetHash().ToString(),
+                                          head.ToString());
+                                CValidationState dummy;
+                                if (ProcessNewBlock(0,0,dummy, NULL, &block, true, &it->second))
+                                {
+                                    nLoaded++;
+                                    queue.push_back(block.GetHash());
+                                }
                             }
+                            range.first++;
+                            mapBlocksUnknownParent.erase(it);
+                            NotifyHeaderTip();
                         }
-                        range.first++;
-                        mapBlocksUnknownParent.erase(it);
-                        NotifyHeaderTip();
                     }
+                } catch (const std::exception& e) {
+                    LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
                 }
-            } catch (const std::exception& e) {
-                LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
             }
         }
     } catch (const std::runtime_error& e) {
@@ -6805,6 +8175,11 @@ void static CheckBlockIndex()
 
     LOCK(cs_main);
 
+    // The invariants on block data and nChainTx assume the chain was connected from genesis
+    if (pindexSnapshotBase != NULL) {
+        return;
+    }
+
     // During a reindex, we read the genesis block and call CheckBlockIndex before ActivateBestChain,
     // so we have the genesis block in mapBlockIndex but no active chain.  (A few of the tests when
     // iterating the block tree require that chainActive has been initialized.)
@@ -6933,6 +8308,7 @@ void static CheckBlockIndex()
             }
         }
         // assert(pindex->GetBlockHash() == pindex->GetBlockHeader().GetHash()); // Perhaps too slow
+        assert(pindex->HasValidSkip()); // A wrong skip pointer still finds the ancestor, only slower
         // End: actual consistency checks.
 
         // Try descending into the first subnode.
@@ -7099,8 +8475,8 @@ void static ProcessGetData(CNode* pfrom)
 
     vector<CInv> vNotFound;
 
-    LOCK(cs_main);
-
+    // cs_main is only held to look the requests up, so serving blocks from
+    // disk does not hold up the message handler or other peers' requests.
     while (it != pfrom->vRecvGetData.end()) {
         // Don't bother if send buffer is too full to respond anyway
         if (pfrom->nSendSize >= SendBufferSize())
@@ -7111,47 +8487,78 @@ void static ProcessGetData(CNode* pfrom)
             boost::this_thread::interruption_point();
             it++;
 
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK)
+            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK)
             {
                 bool send = false;
-                BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
-                if (mi != mapBlockIndex.end())
+                bool fCompact = false;
+                CBlockIndex* pindex = NULL;
+                CDiskBlockPos pos;
                 {
-                    if (chainActive.Contains(mi->second)) {
-                        send = true;
-                    } else {
-                        static const int nOneMonth = 30 * 24 * 60 * 60;
-                        // To prevent fingerprinting attacks, only send blocks outside of the active
-                        // chain if they are valid, and no more than a month older (both in time, and in
-                        // best equivalent proof of work) than the best header chain we know about.
-                        send = mi->second->IsValid(BLOCK_VALID_SCRIPTS) && (pindexBestHeader != NULL) &&
-                        (pindexBestHeader->GetBlockTime() - mi->second->GetBlockTime() < nOneMonth) &&
-                        (GetBlockProofEquivalentTime(*pindexBestHeader, *mi->second, *pindexBestHeader, Params().GetConsensus()) < nOneMonth);
-                        if (!send) {
-                            LogPrintf("%s: ignoring request from peer=%i for old block that isn't in the main chain\n", __func__, pfrom->GetId());
+                    LOCK(cs_main);
+                    BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
+                    if (mi != mapBlockIndex.end())
+                    {
+                        if (chainActive.Contains(mi->second)) {
+                            send = true;
+                        } else {
+                            static const int nOneMonth = 30 * 24 * 60 * 60;
+                            // To prevent fingerprinting attacks, only send blocks outside of the active
+                            // chain if they are valid, and no more than a month older (both in time, and in
+                            // best equivalent proof of work) than the best header chain we know about.
+                            send = mi->second->IsValid(BLOCK_VALID_SCRIPTS) && (pindexBestHeader != NULL) &&
+                            (pindexBestHeader->GetBlockTime() - mi->second->GetBlockTime() < nOneMonth) &&
+                            (GetBlockProofEquivalentTime(*pindexBestHeader, *mi->second, *pindexBestHeader, Params().GetConsensus()) < nOneMonth);
+                            if (!send) {
+                                LogPrintf("%s: ignoring request from peer=%i for old block that isn't in the main chain\n", __func__, pfrom->GetId());
+                            }
                         }
                     }
+                    // Pruned nodes may have deleted the block, so check whether
+                    // it's available before trying to send.
+                    if (send && (mi->second->nStatus & BLOCK_HAVE_DATA))
+                    {
+                        pindex = mi->second;
+                        pos = pindex->GetBlockPos();
+                        // Older blocks are not in the peer's mempool any more, they are sent in full
+                        fCompact = inv.type == MSG_CMPCT_BLOCK && pindex->GetHeight() >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH;
+                    }
                 }
-                // Pruned nodes may have deleted the block, so check whether
-                // it's available before trying to send.
-                if (send && (mi->second->nStatus & BLOCK_HAVE_DATA))
+                if (pindex != NULL)
                 {
-                    // Send block from disk
+                    // Send block from disk. A full block is sent in its stored serialization,
+                    // only filtered and compact blocks need to be deserialized.
                     CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second,1))
+                    CMappedSpan span;
+                    std::vector<char> vRaw;
+                    bool fRaw = inv.type == MSG_BLOCK || (inv.type == MSG_CMPCT_BLOCK && !fCompact);
+                    bool fRead = fRaw ? ReadRawBlockFromDisk(span, vRaw, pos, inv.hash) :
+                        ReadBlockFromDisk(pindex->GetHeight(), block, pos, 1) && block.GetHash() == inv.hash;
+                    if (!fRead)
                     {
-                        assert(!"cannot load block from disk");
+                        // The block may have been pruned since it was looked up
+                        LOCK(cs_main);
+                        if (pindex->nStatus & BLOCK_HAVE_DATA)
+                            assert(!"cannot load block from disk");
+                        LogPrint("net", "%s: block %s requested by peer=%i was pruned\n", __func__, inv.hash.ToString(), pfrom->GetId());
                     }
                     else
                     {
-                        if (inv.type == MSG_BLOCK)
+                        if (fRaw)
                         {
                             //uint256 hash; int32_t z;
                             //hash = block.GetHash();
                             //for (z=31; z>=0; z--)
                             //    fprintf(stderr,"%02x",((uint8_t *)&hash)[z]);
                             //fprintf(stderr," send block %d\n",komodo_block2height(&block));
-                            pfrom->PushMessage("block", block);
+                            if (span.data != NULL)
+                                pfrom->PushMessageShared("block", span);
+                            else
+                                pfrom->PushMessage("block", CFlatData(vRaw));
+                        }
+                        else if (fCompact)
+                        {
+                            CBlockHeaderAndShortTxIDs cmpctblock(block);
+                            pfrom->PushMessage("cmpctblock", cmpctblock);
                         }
                         else // MSG_FILTERED_BLOCK)
                         {
@@ -7168,7 +8575,7 @@ void static ProcessGetData(CNode* pfrom)
                                 // however we MUST always provide at least what the remote peer needs
                                 typedef std::pair<unsigned int, uint256> PairType;
                                 BOOST_FOREACH(PairType& pair, merkleBlock.vMatchedTxn)
-                                if (!pfrom->setInventoryKnown.count(CInv(MSG_TX, pair.second)))
+                                if (!pfrom->filterInventoryKnown.contains(pair.second))
                                     pfrom->PushMessage("tx", block.vtx[pair.first]);
                             }
                             // else
@@ -7182,7 +8589,10 @@ void static ProcessGetData(CNode* pfrom)
                         // and we want it right after the last block so they don't
                         // wait for other stuff first.
                         vector<CInv> vInv;
-                        vInv.push_back(CInv(MSG_BLOCK, chainActive.Tip()->GetBlockHash()));
+                        {
+                            LOCK(cs_main);
+                            vInv.push_back(CInv(MSG_BLOCK, chainActive.Tip()->GetBlockHash()));
+                        }
                         pfrom->PushMessage("inv", vInv);
                         pfrom->hashContinue.SetNull();
                     }
@@ -7201,11 +8611,11 @@ void static ProcessGetData(CNode* pfrom)
                     }
                 }
                 if (!pushed && inv.type == MSG_TX) {
-                    CTransaction tx;
-                    if (mempool.lookup(inv.hash, tx)) {
+                    CTransactionRef tx = mempool.get(inv.hash);
+                    if (tx) {
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
                         ss.reserve(1000);
-                        ss << tx;
+                        ss << *tx;
                         pfrom->PushMessage("tx", ss);
                         pushed = true;
                     }
@@ -7218,7 +8628,7 @@ void static ProcessGetData(CNode* pfrom)
             // Track requests for our stuff.
             GetMainSignals().Inventory(inv.hash);
 
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK)
+            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK)
                 break;
         }
     }
@@ -7237,6 +8647,35 @@ void static ProcessGetData(CNode* pfrom)
     }
 }
 
+/** Validates a block received in full or reconstructed from a cmpctblock. Must be called without cs_main. */
+void static ProcessBlockFromPeer(CNode* pfrom, CBlock& block, const std::string& strCommand)
+{
+    CInv inv(MSG_BLOCK, block.GetHash());
+    CValidationState state;
+    // Process all blocks from whitelisted peers, even if not requested,
+    // unless we're still syncing with the network.
+    // Such an unrequested block may still be processed, subject to the
+    // conditions in AcceptBlock().
+    bool forceProcessing = pfrom->fWhitelisted && !IsInitialBlockDownload();
+    // Keep the notifications of the asynchronous listeners from piling up during a sync
+    SyncWithValidationInterfaceQueue(MAX_VALIDATION_QUEUE_PENDING);
+    ProcessNewBlock(0,0,state, pfrom, &block, forceProcessing, NULL);
+    int nDoS;
+    if (state.IsInvalid(nDoS)) {
+        pfrom->PushMessage("reject", strCommand, state.GetRejectCode(),
+                           state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), inv.hash);
+        if (nDoS > 0) {
+            LOCK(cs_main);
+            Misbehaving(pfrom->GetId(), nDoS);
+        }
+    } else {
+        // The peer gave us a new tip, let it announce the next ones with cmpctblock
+        LOCK(cs_main);
+        if (!IsInitialBlockDownload() && chainActive.Tip() != NULL && chainActive.Tip()->GetBlockHash() == inv.hash)
+            MaybeSetPeerAsAnnouncingHeaderAndIDs(State(pfrom->GetId()), pfrom);
+    }
+}
+
 #include "komodo_nSPV_defs.h"
 #include "komodo_nSPV.h"            // shared defines, structs, serdes, purge functions
 #include "komodo_nSPV_fullnode.h"   // nSPV fullnode handling of the getnSPV request messages
@@ -7435,6 +8874,28 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             LOCK(cs_main);
             State(pfrom->GetId())->fCurrentlyConnected = true;
         }
+
+        if (!KOMODO_NSPV_SUPERLITE) {
+            // Tell the peer we understand cmpctblock, but want new blocks announced with inv
+            // until it has proven to be a good source of them (see MaybeSetPeerAsAnnouncingHeaderAndIDs).
+            // Peers that do not know the message ignore it.
+            bool fAnnounceUsingCMPCTBLOCK = false;
+            uint64_t nCMPCTBLOCKVersion = CMPCTBLOCK_VERSION;
+            pfrom->PushMessage("sendcmpct", fAnnounceUsingCMPCTBLOCK, nCMPCTBLOCKVersion);
+        }
+    }
+
+
+    else if (strCommand == "sendcmpct")
+    {
+        bool fAnnounceUsingCMPCTBLOCK = false;
+        uint64_t nCMPCTBLOCKVersion = 0;
+        vRecv >> fAnnounceUsingCMPCTBLOCK >> nCMPCTBLOCKVersion;
+        if (nCMPCTBLOCKVersion == CMPCTBLOCK_VERSION) {
+            LOCK(cs_main);
+            State(pfrom->GetId())->fProvidesHeaderAndIDs = true;
+            State(pfrom->GetId())->fPreferHeaderAndIDs = fAnnounceUsingCMPCTBLOCK;
+        }
     }
 
 
@@ -7677,7 +9138,8 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                     CNodeState *nodestate = State(pfrom->GetId());
                     if (chainActive.Tip()->GetBlockTime() > GetTime() - chainparams.GetConsensus().nPowTargetSpacing * 20 &&
                         nodestate->nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
-                        vToFetch.push_back(inv);
+                        // A new block is mostly made of transactions we already have
+                        vToFetch.push_back(CInv(nodestate->fProvidesHeaderAndIDs ? MSG_CMPCT_BLOCK : MSG_BLOCK, inv.hash));
                         // Mark block as in flight already, even though the actual "getdata" message only goes out
                         // later (within the same cs_main lock, though).
                         MarkBlockAsInFlight(pfrom->GetId(), inv.hash, chainparams.GetConsensus());
@@ -7763,51 +9225,49 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         uint256 hashStop;
         vRecv >> locator >> hashStop;
 
-        LOCK(cs_main);
-
-        if (chainActive.LastTip() != 0 && chainActive.LastTip()->GetHeight() > 100000 && IsInitialBlockDownload())
-        {
-            //fprintf(stderr,"dont process getheaders during initial download\n");
-            return true;
-        }
-        CBlockIndex* pindex = NULL;
-        if (locator.IsNull())
+        // we must use CNetworkBlockHeader, as CBlockHeader won't include the 0x00 nTx count at the end for compatibility
+        vector<CNetworkBlockHeader> vHeaders;
         {
-            // If locator is null, return the hashStop block
-            BlockMap::iterator mi = mapBlockIndex.find(hashStop);
-            if (mi == mapBlockIndex.end())
+            // Only collecting the headers needs cs_main, not sending them
+            LOCK(cs_main);
+
+            if (chainActive.LastTip() != 0 && chainActive.LastTip()->GetHeight() > 100000 && IsInitialBlockDownload())
             {
-                //fprintf(stderr,"mi == end()\n");
+                //fprintf(stderr,"dont process getheaders during initial download\n");
                 return true;
             }
-            pindex = (*mi).second;
-        }
-        else
-        {
-            // Find the last block the caller has in the main chain
-            pindex = FindForkInGlobalIndex(chainActive, locator);
-            if (pindex)
-                pindex = chainActive.Next(pindex);
-        }
+            CBlockIndex* pindex = NULL;
+            if (locator.IsNull())
+            {
+                // If locator is null, return the hashStop block
+                BlockMap::iterator mi = mapBlockIndex.find(hashStop);
+                if (mi == mapBlockIndex.end())
+                {
+                    //fprintf(stderr,"mi == end()\n");
+                    return true;
+                }
+                pindex = (*mi).second;
+            }
+            else
+            {
+                // Find the last block the caller has in the main chain
+                pindex = FindForkInGlobalIndex(chainActive, locator);
+                if (pindex)
+                    pindex = chainActive.Next(pindex);
+            }
 
-        // we must use CNetworkBlockHeader, as CBlockHeader won't include the 0x00 nTx count at the end for compatibility
-        vector<CNetworkBlockHeader> vHeaders;
-        int nLimit = MAX_HEADERS_RESULTS;
-        LogPrint("net", "getheaders %d to %s from peer=%d\n", (pindex ? pindex->GetHeight() : -1), hashStop.ToString(), pfrom->id);
-        //if ( pfrom->lasthdrsreq >= chainActive.Height()-MAX_HEADERS_RESULTS || pfrom->lasthdrsreq != (int32_t)(pindex ? pindex->GetHeight() : -1) )// no need to ever suppress this
-        {
+            int nLimit = MAX_HEADERS_RESULTS;
+            LogPrint("net", "getheaders %d to %s from peer=%d\n", (pindex ? pindex->GetHeight() : -1), hashStop.ToString(), pfrom->id);
+            //if ( pfrom->lasthdrsreq >= chainActive.Height()-MAX_HEADERS_RESULTS || pfrom->lasthdrsreq != (int32_t)(pindex ? pindex->GetHeight() : -1) )// no need to ever suppress this
             pfrom->lasthdrsreq = (int32_t)(pindex ? pindex->GetHeight() : -1);
             for (; pindex; pindex = chainActive.Next(pindex))
             {
-                CBlockHeader h = pindex->GetBlockHeader();
-                //printf("size.%i, solution size.%i\n", (int)sizeof(h), (int)h.nSolution.size());
-                //printf("hash.%s prevhash.%s nonce.%s\n", h.GetHash().ToString().c_str(), h.hashPrevBlock.ToString().c_str(), h.nNonce.ToString().c_str());
                 vHeaders.push_back(pindex->GetBlockHeader());
                 if (--nLimit <= 0 || pindex->GetBlockHash() == hashStop)
                     break;
             }
-            pfrom->PushMessage("headers", vHeaders);
         }
+        pfrom->PushMessage("headers", vHeaders);
         /*else if ( IS_KOMODO_NOTARY != 0 )
         {
             static uint32_t counter;
@@ -7830,13 +9290,17 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         CInv inv(MSG_TX, tx.GetHash());
         pfrom->AddInventoryKnown(inv);
 
+        // Verify the proofs before taking cs_main, admission then finds them in the proof cache
+        if (!mempool.exists(inv.hash))
+            PreverifyShieldedTransactions(std::vector<const CTransaction*>(1, &tx));
+
         LOCK(cs_main);
 
         bool fMissingInputs = false;
         CValidationState state;
 
         pfrom->setAskFor.erase(inv.hash);
-        mapAlreadyAskedFor.erase(inv);
+        AskedForTimes().Erase(inv.hash);
 
         if (!AlreadyHave(inv) && AcceptToMemoryPool(mempool, state, tx, true, &fMissingInputs))
         {
@@ -7969,6 +9433,18 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             ReadCompactSize(vRecv); // ignore tx count; assume it is 0.
         }
 
+        // Verify the Equihash solutions of the headers we do not know yet in parallel and
+        // without holding cs_main, leaving the cheap linkage and difficulty checks below
+        std::vector<const CBlockHeader*> vNewHeaders;
+        {
+            LOCK(cs_main);
+            for (const CBlockHeader& header : headers) {
+                if (mapBlockIndex.count(header.GetHash()) == 0)
+                    vNewHeaders.push_back(&header);
+            }
+        }
+        bool fSolutionsValid = CheckEquihashSolutions(vNewHeaders);
+
         LOCK(cs_main);
 
         if (nCount == 0) {
@@ -7976,6 +9452,11 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             return true;
         }
 
+        if (!fSolutionsValid) {
+            Misbehaving(pfrom->GetId(), 100);
+            return error("header with invalid Equihash solution received");
+        }
+
         bool hasNewHeaders = true;
 
         // only KMD have checkpoints in sources, so, using IsInitialBlockDownload() here is
@@ -8051,6 +9532,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 
     else if (strCommand == "block" && !fImporting && !fReindex) // Ignore blocks received while importing
     {
+        size_t nBytes = vRecv.size();
         CBlock block;
         vRecv >> block;
 
@@ -8058,24 +9540,218 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         LogPrint("net", "received block %s peer=%d\n", inv.hash.ToString(), pfrom->id);
 
         pfrom->AddInventoryKnown(inv);
+        {
+            LOCK(cs_main);
+            RecordBlockDelivery(pfrom->GetId(), inv.hash, nBytes, nTimeReceived);
+        }
 
-        CValidationState state;
-        // Process all blocks from whitelisted peers, even if not requested,
-        // unless we're still syncing with the network.
-        // Such an unrequested block may still be processed, subject to the
-        // conditions in AcceptBlock().
-        bool forceProcessing = pfrom->fWhitelisted && !IsInitialBlockDownload();
-        ProcessNewBlock(0,0,state, pfrom, &block, forceProcessing, NULL);
-        int nDoS;
-        if (state.IsInvalid(nDoS)) {
-            pfrom->PushMessage("reject", strCommand, state.GetRejectCode(),
-                               state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), inv.hash);
-            if (nDoS > 0) {
+        ProcessBlockFromPeer(pfrom, block, strCommand);
+    }
+
+
+    else if (strCommand == "cmpctblock" && !fImporting && !fReindex) // Ignore blocks received while importing
+    {
+        CBlockHeaderAndShortTxIDs cmpctblock;
+        vRecv >> cmpctblock;
+        uint256 hash = cmpctblock.header.GetHash();
+
+        // As for headers, verify the Equihash solution of a new block without holding cs_main
+        bool fKnownHeader;
+        {
+            LOCK(cs_main);
+            fKnownHeader = mapBlockIndex.count(hash) != 0;
+        }
+        if (!fKnownHeader && !CheckEquihashSolutions(std::vector<const CBlockHeader*>(1, &cmpctblock.header))) {
+            LOCK(cs_main);
+            Misbehaving(pfrom->GetId(), 100);
+            return error("cmpctblock with invalid Equihash solution received");
+        }
+
+        CBlock block;
+        bool fBlockReconstructed = false;
+        {
+            LOCK(cs_main);
+
+            if (mapBlockIndex.count(cmpctblock.header.hashPrevBlock) == 0) {
+                // Doesn't connect, ask for the headers in between
+                if (!IsInitialBlockDownload())
+                    pfrom->PushMessage("getheaders", chainActive.GetLocator(pindexBestHeader), uint256());
+                return true;
+            }
+
+            CBlockIndex *pindex = NULL;
+            CValidationState state;
+            int32_t futureblock = 0;
+            if (!AcceptBlockHeader(&futureblock, cmpctblock.header, state, &pindex)) {
+                int nDoS;
+                if (state.IsInvalid(nDoS) && futureblock == 0)
+                {
+                    if (nDoS > 0)
+                        Misbehaving(pfrom->GetId(), nDoS/nDoS);
+                    return error("invalid header received in cmpctblock");
+                }
+            }
+            if (pindex == NULL)
+                return true;
+
+            UpdateBlockAvailability(pfrom->GetId(), hash);
+            pfrom->AddInventoryKnown(CInv(MSG_BLOCK, hash));
+
+            if (pindex->nStatus & BLOCK_HAVE_DATA) // Nothing to do here
+                return true;
+            if (pindex->chainPower < chainActive.Tip()->chainPower) // We know something better
+                return true;
+
+            map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
+            bool fInFlightFromPeer = itInFlight != mapBlocksInFlight.end() && itInFlight->second.first == pfrom->GetId();
+            CNodeState *nodestate = State(pfrom->GetId());
+
+            if (pindex->GetHeight() > chainActive.Height() + 2) {
+                // Too far ahead for our mempool to be of any use, get it in full if we asked for it
+                if (fInFlightFromPeer) {
+                    vector<CInv> vInv(1, CInv(MSG_BLOCK, hash));
+                    pfrom->PushMessage("getdata", vInv);
+                }
+                return true;
+            }
+
+            list<QueuedBlock>::iterator itQueued;
+            if (fInFlightFromPeer) {
+                itQueued = itInFlight->second.second;
+                if (itQueued->partialBlock) // Duplicate cmpctblock
+                    return true;
+            } else if (itInFlight == mapBlocksInFlight.end() && nodestate->nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+                MarkBlockAsInFlight(pfrom->GetId(), hash, chainparams.GetConsensus(), pindex, &itQueued);
+            } else {
+                // Another peer is sending the block, the header is all we take from this one
+                return true;
+            }
+
+            itQueued->partialBlock.reset(new PartiallyDownloadedBlock(&mempool));
+            PartiallyDownloadedBlock& partialBlock = *itQueued->partialBlock;
+            // Orphans are often the transactions of the block that we could not accept yet
+            std::vector<const CTransaction*> vExtraTxn;
+            vExtraTxn.reserve(mapOrphanTransactions.size());
+            for (map<uint256, COrphanTx>::const_iterator it = mapOrphanTransactions.begin(); it != mapOrphanTransactions.end(); ++it)
+                vExtraTxn.push_back(&it->second.tx);
+
+            ReadStatus status = partialBlock.InitData(cmpctblock, vExtraTxn);
+            if (status == READ_STATUS_INVALID) {
+                MarkBlockAsReceived(hash);
+                Misbehaving(pfrom->GetId(), 100);
+                return error("invalid cmpctblock %s from peer=%d", hash.ToString(), pfrom->id);
+            }
+
+            BlockTransactionsRequest req;
+            if (status == READ_STATUS_OK) {
+                for (size_t i = 0; i < cmpctblock.BlockTxCount(); i++) {
+                    if (!partialBlock.IsTxAvailable(i))
+                        req.indexes.push_back(i);
+                }
+                if (req.indexes.empty()) {
+                    // Every transaction was found
+                    status = partialBlock.FillBlock(block, std::vector<CTransaction>());
+                    fBlockReconstructed = status == READ_STATUS_OK;
+                }
+            }
+
+            if (status != READ_STATUS_OK) {
+                // Short ids collided, fall back to the full block, which stays in flight from this peer
+                itQueued->partialBlock.reset();
+                vector<CInv> vInv(1, CInv(MSG_BLOCK, hash));
+                pfrom->PushMessage("getdata", vInv);
+                return true;
+            }
+            if (!fBlockReconstructed) {
+                req.blockhash = hash;
+                pfrom->PushMessage("getblocktxn", req);
+            }
+        }
+
+        if (fBlockReconstructed)
+            ProcessBlockFromPeer(pfrom, block, strCommand);
+    }
+
+
+    else if (strCommand == "getblocktxn")
+    {
+        BlockTransactionsRequest req;
+        vRecv >> req;
+
+        int nHeight = 0;
+        CDiskBlockPos pos;
+        bool fSendFull = false;
+        {
+            LOCK(cs_main);
+            BlockMap::iterator it = mapBlockIndex.find(req.blockhash);
+            if (it == mapBlockIndex.end() || it->second == NULL || !(it->second->nStatus & BLOCK_HAVE_DATA)) {
+                LogPrint("net", "peer=%d sent us a getblocktxn for a block we don't have\n", pfrom->id);
+                return true;
+            }
+            nHeight = it->second->GetHeight();
+            pos = it->second->GetBlockPos();
+            // Deep blocks are not for relay, the peer gets the full block like for getdata
+            fSendFull = nHeight < chainActive.Height() - MAX_BLOCKTXN_DEPTH;
+        }
+
+        if (fSendFull) {
+            LogPrint("net", "peer=%d sent us a getblocktxn for a block > %i deep\n", pfrom->id, MAX_BLOCKTXN_DEPTH);
+            pfrom->vRecvGetData.push_back(CInv(MSG_BLOCK, req.blockhash));
+            ProcessGetData(pfrom);
+            return true;
+        }
+
+        CBlock block;
+        if (!ReadBlockFromDisk(nHeight, block, pos, 1) || block.GetHash() != req.blockhash) {
+            LogPrint("net", "cannot load block %s for getblocktxn from peer=%d\n", req.blockhash.ToString(), pfrom->id);
+            return true;
+        }
+
+        BlockTransactions resp(req);
+        for (size_t i = 0; i < req.indexes.size(); i++) {
+            if (req.indexes[i] >= block.vtx.size()) {
                 LOCK(cs_main);
-                Misbehaving(pfrom->GetId(), nDoS);
+                Misbehaving(pfrom->GetId(), 100);
+                return error("peer=%d sent us a getblocktxn with out-of-bounds tx indices", pfrom->id);
+            }
+            resp.txn[i] = block.vtx[req.indexes[i]];
+        }
+        pfrom->PushMessage("blocktxn", resp);
+    }
+
+
+    else if (strCommand == "blocktxn" && !fImporting && !fReindex) // Ignore blocks received while importing
+    {
+        BlockTransactions resp;
+        vRecv >> resp;
+
+        CBlock block;
+        {
+            LOCK(cs_main);
+
+            map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(resp.blockhash);
+            if (itInFlight == mapBlocksInFlight.end() || !itInFlight->second.second->partialBlock ||
+                    itInFlight->second.first != pfrom->GetId()) {
+                LogPrint("net", "peer=%d sent us blocktxn for block %s we weren't expecting\n", pfrom->id, resp.blockhash.ToString());
+                return true;
+            }
+
+            PartiallyDownloadedBlock& partialBlock = *itInFlight->second.second->partialBlock;
+            ReadStatus status = partialBlock.FillBlock(block, resp.txn);
+            if (status == READ_STATUS_INVALID) {
+                MarkBlockAsReceived(resp.blockhash);
+                Misbehaving(pfrom->GetId(), 100);
+                return error("peer=%d sent us invalid compact block/non-matching block transactions", pfrom->id);
+            } else if (status == READ_STATUS_FAILED) {
+                // Might have collided, fall back to getdata now
+                itInFlight->second.second->partialBlock.reset();
+                vector<CInv> vInv(1, CInv(MSG_BLOCK, resp.blockhash));
+                pfrom->PushMessage("getdata", vInv);
+                return true;
             }
         }
 
+        ProcessBlockFromPeer(pfrom, block, strCommand);
     }
 
 
@@ -8089,10 +9765,9 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         BOOST_FOREACH(uint256& hash, vtxid) {
             CInv inv(MSG_TX, hash);
             if (pfrom->pfilter) {
-                CTransaction tx;
-                bool fInMemPool = mempool.lookup(hash, tx);
-                if (!fInMemPool) continue; // another thread removed since queryHashes, maybe...
-                if (!pfrom->pfilter->IsRelevantAndUpdate(tx)) continue;
+                CTransactionRef tx = mempool.get(hash);
+                if (!tx) continue; // another thread removed since queryHashes, maybe...
+                if (!pfrom->pfilter->IsRelevantAndUpdate(*tx)) continue;
             }
             vInv.push_back(inv);
             if (vInv.size() == MAX_INV_SZ) {
@@ -8310,6 +9985,8 @@ bool ProcessMessages(CNode* pfrom)
 
         // Process message
         bool fRet = false;
+        std::string strStatsKey = GetMsgStatsKey(strCommand, nMessageSize ? &vRecv[0] : NULL, nMessageSize);
+        int64_t nHandlerStart = GetTimeMicros();
         try
         {
             fRet = ProcessMessage(pfrom, strCommand, vRecv, msg.nTime);
@@ -8341,6 +10018,9 @@ bool ProcessMessages(CNode* pfrom)
         } catch (...) {
             PrintExceptionContinue(NULL, "ProcessMessages()");
         }
+        int64_t nHandlerMicros = GetTimeMicros() - nHandlerStart;
+        pfrom->RecordMessageRecv(strStatsKey, CMessageHeader::HEADER_SIZE + nMessageSize, nHandlerMicros);
+        TRACE5(net, inbound_message, pfrom->id, strCommand.c_str(), nMessageSize, nHandlerMicros, fRet);
 
         if (!fRet)
             LogPrintf("%s(%s, %u bytes) FAILED peer=%d\n", __func__, SanitizeString(strCommand), nMessageSize, pfrom->id);
@@ -8492,38 +10172,57 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         // Message: inventory
         //
         vector<CInv> vInv;
-        vector<CInv> vInvWait;
         {
             LOCK(pto->cs_inventory);
             vInv.reserve(pto->vInventoryToSend.size());
-            vInvWait.reserve(pto->vInventoryToSend.size());
             BOOST_FOREACH(const CInv& inv, pto->vInventoryToSend)
             {
-                if (pto->setInventoryKnown.count(inv))
+                if (pto->filterInventoryKnown.contains(inv.hash))
                     continue;
-
-                // trickle out tx inv to protect privacy
-                if (inv.type == MSG_TX && !fSendTrickle)
+                pto->filterInventoryKnown.insert(inv.hash);
+                vInv.push_back(inv);
+                if (vInv.size() >= 1000)
                 {
-                    // 1/4 of tx invs blast to all immediately
-                    static uint256 hashSalt;
-                    if (hashSalt.IsNull())
-                        hashSalt = GetRandHash();
-                    uint256 hashRand = ArithToUint256(UintToArith256(inv.hash) ^ UintToArith256(hashSalt));
-                    hashRand = Hash(BEGIN(hashRand), END(hashRand));
-                    bool fTrickleWait = ((UintToArith256(hashRand) & 3) != 0);
+                    pto->PushMessage("inv", vInv);
+                    vInv.clear();
+                }
+            }
+            pto->vInventoryToSend.clear();
+        }
 
-                    if (fTrickleWait)
+        // Transactions are trickled out in batches on a random timer per peer and in random order,
+        // so the timing and order of the announcements do not reveal where a transaction came from
+        int64_t nNowInv = GetTimeMicros();
+        if (pto->nNextInvSend < nNowInv)
+        {
+            pto->nNextInvSend = PoissonNextSend(nNowInv, pto->fInbound ? INVENTORY_BROADCAST_INTERVAL : INVENTORY_BROADCAST_INTERVAL / 2);
+            vector<uint256> vHashes;
+            pto->nTxAnnounceSeq = GetTxAnnouncements(pto->nTxAnnounceSeq, vHashes, INVENTORY_BROADCAST_MAX);
+            if (pto->fRelayTxes && !vHashes.empty())
+            {
+                random_shuffle(vHashes.begin(), vHashes.end(), GetRandInt);
+                {
+                    // Peers with a bloom filter only get the transactions matching it
+                    LOCK(pto->cs_filter);
+                    if (pto->pfilter)
                     {
-                        vInvWait.push_back(inv);
-                        continue;
+                        vector<uint256> vRelevant;
+                        BOOST_FOREACH(const uint256& hash, vHashes)
+                        {
+                            CTransactionRef tx = mempool.get(hash);
+                            if (tx && pto->pfilter->IsRelevantAndUpdate(*tx))
+                                vRelevant.push_back(hash);
+                        }
+                        vHashes.swap(vRelevant);
                     }
                 }
-
-                // returns true if wasn't already contained in the set
-                if (pto->setInventoryKnown.insert(inv).second)
+                LOCK(pto->cs_inventory);
+                BOOST_FOREACH(const uint256& hash, vHashes)
                 {
-                    vInv.push_back(inv);
+                    if (pto->filterInventoryKnown.contains(hash))
+                        continue;
+                    pto->filterInventoryKnown.insert(hash);
+                    vInv.push_back(CInv(MSG_TX, hash));
                     if (vInv.size() >= 1000)
                     {
                         pto->PushMessage("inv", vInv);
@@ -8531,7 +10230,6 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
                     }
                 }
             }
-            pto->vInventoryToSend = vInvWait;
         }
         if (!vInv.empty())
             pto->PushMessage("inv", vInv);
@@ -8573,16 +10271,29 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         //
         static uint256 zero;
         vector<CInv> vGetData;
-        if (!pto->fDisconnect && !pto->fClient && (fFetch || !IsInitialBlockDownload()) && state.nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+        state.nBlocksInFlightLimit = GetBlocksInTransitLimit(&state, pto->nPingUsecTime);
+        if (!pto->fDisconnect && !pto->fClient && (fFetch || !IsInitialBlockDownload()) && state.nBlocksInFlight < state.nBlocksInFlightLimit) {
             vector<CBlockIndex*> vToDownload;
             NodeId staller = -1;
-            FindNextBlocksToDownload(pto->GetId(), MAX_BLOCKS_IN_TRANSIT_PER_PEER - state.nBlocksInFlight, vToDownload, staller);
+            CBlockIndex *pindexStalled = NULL;
+            FindNextBlocksToDownload(pto->GetId(), state.nBlocksInFlightLimit - state.nBlocksInFlight, vToDownload, staller, &pindexStalled);
             BOOST_FOREACH(CBlockIndex *pindex, vToDownload) {
                 vGetData.push_back(CInv(MSG_BLOCK, pindex->GetBlockHash()));
                 MarkBlockAsInFlight(pto->GetId(), pindex->GetBlockHash(), consensusParams, pindex);
                 LogPrint("net", "Requesting block %s (%d) peer=%d\n", pindex->GetBlockHash().ToString(),
                          pindex->GetHeight(), pto->id);
             }
+            if (staller != -1 && pindexStalled != NULL && state.nBlocksRedundant < MAX_REDUNDANT_BLOCKS_PER_PEER &&
+                mapBlocksRedundant.count(pindexStalled->GetBlockHash()) == 0 &&
+                state.dDownloadRate > State(staller)->dDownloadRate) {
+                // The window cannot move until a slower peer delivers the block at its head. Ask this
+                // peer for it as well: whichever copy arrives first is used, the other one is a duplicate.
+                mapBlocksRedundant[pindexStalled->GetBlockHash()] = std::make_pair(pto->GetId(), nNow);
+                state.nBlocksRedundant++;
+                vGetData.push_back(CInv(MSG_BLOCK, pindexStalled->GetBlockHash()));
+                LogPrint("net", "Requesting block %s (%d) peer=%d, also in flight from peer=%d\n", pindexStalled->GetBlockHash().ToString(),
+                         pindexStalled->GetHeight(), pto->id, staller);
+            }
             if (state.nBlocksInFlight == 0 && staller != -1) {
                 if (State(staller)->nStallingSince == 0) {
                     State(staller)->nStallingSince = nNow;
@@ -8646,10 +10357,8 @@ public:
     CMainCleanup() {}
     ~CMainCleanup() {
         // block headers
-        BlockMap::iterator it1 = mapBlockIndex.begin();
-        for (; it1 != mapBlockIndex.end(); it1++)
-            delete (*it1).second;
         mapBlockIndex.clear();
+        blockIndexArena.Clear();
 
         // orphan transactions
         mapOrphanTransactions.clear();
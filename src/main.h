@@ -46,7 +46,9 @@
 
 #include <algorithm>
 #include <exception>
+#include <functional>
 #include <map>
+#include <memory>
 #include <set>
 #include <stdint.h>
 #include <string>
@@ -57,8 +59,14 @@
 
 class CBlockIndex;
 class CBlockTreeDB;
+class CBlockUndo;
+class CBlockView;
 class CBloomFilter;
+struct CCompactBlock;
+struct CSaplingBlockCommitments;
 class CInv;
+class CSaplingCheck;
+class CCCEvalCheck;
 class CScriptCheck;
 class CValidationInterface;
 class CValidationState;
@@ -100,8 +108,17 @@ static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
-/** Number of blocks that can be requested at any given time from a single peer. */
+/** Number of blocks that can be requested at any given time from a single peer whose download rate is not known yet. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
+/** Bounds of the per-peer number of blocks in transit once the peer's download rate has been measured. */
+static const int MIN_ADAPTIVE_BLOCKS_IN_TRANSIT = 2;
+static const int MAX_ADAPTIVE_BLOCKS_IN_TRANSIT = 128;
+/** Seconds of download a peer's blocks in transit should cover, on top of its ping time. */
+static const int BLOCK_DOWNLOAD_TARGET_SECONDS = 4;
+/** Weight of the latest block in a peer's smoothed download rate. */
+static const double BLOCK_DOWNLOAD_RATE_WEIGHT = 0.125;
+/** Number of blocks holding up the download window that a peer is asked for while another peer has them in flight. */
+static const int MAX_REDUNDANT_BLOCKS_PER_PEER = 2;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
 static const unsigned int BLOCK_STALLING_TIMEOUT = 2;
 /** Number of headers sent in one getheaders result. We rely on the assumption that if a peer sends
@@ -128,6 +145,7 @@ static const bool DEFAULT_NSPV_PROCESSING = false;
 #define DEFAULT_ADDRESSINDEX (GetArg("-ac_cc",0) != 0 || GetArg("-ac_ccactivate",0) != 0)
 #define DEFAULT_SPENTINDEX (GetArg("-ac_cc",0) != 0 || GetArg("-ac_ccactivate",0) != 0)
 static const bool DEFAULT_TIMESTAMPINDEX = false;
+static const bool DEFAULT_COMPACTBLOCKINDEX = false;
 static const unsigned int DEFAULT_DB_MAX_OPEN_FILES = 1000;
 static const bool DEFAULT_DB_COMPRESSION = true;
 
@@ -151,6 +169,7 @@ extern CBlockPolicyEstimator feeEstimator;
 extern CTxMemPool mempool;
 typedef boost::unordered_map<uint256, CBlockIndex*, BlockHasher> BlockMap;
 extern BlockMap mapBlockIndex;
+extern CBlockIndexArena blockIndexArena;
 extern uint64_t nLastBlockTx;
 extern uint64_t nLastBlockSize;
 extern const std::string strMessageMagic;
@@ -161,10 +180,15 @@ extern bool fImporting;
 extern bool fReindex;
 extern int nScriptCheckThreads;
 extern bool fTxIndex;
+extern bool fCompactBlockIndex;
 extern bool fArchive;
 extern bool fIsBareMultisigStd;
 extern bool fCheckBlockIndex;
 extern bool fCheckpointsEnabled;
+/** Skip proof and script checks of notarized blocks during IBD (-assumenotarized) */
+extern bool fAssumeNotarized;
+/** The block assumed notarized, null to follow the latest known notarization */
+extern uint256 hashAssumeNotarized;
 // TODO: remove this flag by structuring our code such that
 // it is unneeded for testing
 extern bool fCoinbaseEnforcedProtectionEnabled;
@@ -199,6 +223,21 @@ static const unsigned int MIN_BLOCKS_TO_KEEP = 288;
 // Setting the target to > than 550MB will make it likely we can respect the target.
 static const uint64_t MIN_DISK_SPACE_FOR_BLOCK_FILES = 550 * 1024 * 1024;
 
+/** Where the blk and rev files of a block file are, see CBlockFileInfo::nTier */
+enum BlockFileTier {
+    BLOCK_FILE_HOT = 0,     //! in the blocks directory of the datadir
+    BLOCK_FILE_COLD = 1,    //! moved to -coldblocksdir
+};
+/** Directory the block files deeper than nColdBlocksDepth are moved to, empty when they stay in the datadir. */
+extern boost::filesystem::path pathColdBlocks;
+/** Block files whose blocks are all more than this many blocks below the tip are moved to pathColdBlocks. */
+extern unsigned int nColdBlocksDepth;
+static const unsigned int DEFAULT_COLD_BLOCKS_DEPTH = 10000;
+/** Block files above this depth are written to as the chain grows and reorganizes. */
+static const unsigned int MIN_COLD_BLOCKS_DEPTH = 1000;
+/** How often, in seconds, the scheduler looks for block files to move to pathColdBlocks */
+static const int64_t COLD_BLOCKS_INTERVAL = 60;
+
 /** Register with a network node to receive its signals */
 void RegisterNodeSignals(CNodeSignals& nodeSignals);
 /** Unregister a network node */
@@ -223,8 +262,10 @@ bool CheckDiskSpace(uint64_t nAdditionalBytes = 0);
 FILE* OpenBlockFile(const CDiskBlockPos &pos, bool fReadOnly = false);
 /** Open an undo file (rev?????.dat) */
 FILE* OpenUndoFile(const CDiskBlockPos &pos, bool fReadOnly = false);
-/** Translation to a filesystem path */
+/** Translation to a filesystem path, in the tier the file is in */
 boost::filesystem::path GetBlockPosFilename(const CDiskBlockPos &pos, const char *prefix);
+/** Moves the block files deeper than nColdBlocksDepth to pathColdBlocks, a few at a time */
+void MoveBlockFilesToColdStorage();
 /** Import blocks from an external file */
 bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp = NULL);
 /** Initialize a new block tree database + block data on disk */
@@ -244,10 +285,27 @@ bool ProcessMessages(CNode* pfrom);
 bool SendMessages(CNode* pto, bool fSendTrickle);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the Sapling proof checking thread */
+void ThreadSaplingCheck();
+/** Run an instance of the Equihash solution checking thread */
+void ThreadEquihashCheck();
+/** Run an instance of the thread verifying shielded proofs ahead of mempool admission */
+void ThreadShieldedProofCheck();
+/** Run an instance of the thread parsing block records for LoadExternalBlockFile */
+void ThreadBlockParse();
 /** Try to detect Partition (network isolation) attacks against us */
 void PartitionCheck(bool (*initialDownloadCheck)(), CCriticalSection& cs, const CBlockIndex *const &bestHeader, int64_t nPowTargetSpacing);
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload();
+/** Whether the block at nHeight is an ancestor of the -assumenotarized block, or of the latest known notarization */
+bool IsNotarizedAncestor(int nHeight, const uint256& hashBlock);
+/**
+ * Replace the chainstate of a node that has not connected any blocks with the
+ * snapshot at path, whose base block has to be notarized (see
+ * IsNotarizedAncestor). A non-null hashExpected is compared to the checksum
+ * of the snapshot.
+ */
+bool LoadCoinsSnapshot(const boost::filesystem::path& path, const uint256& hashExpected, CCoinsSnapshotMetadata& metadata, std::string& strError);
 /** Check if the daemon is in sync, if not, it returns 1 or if due to best header only, the difference in best
  * header and activeChain tip
  */
@@ -303,6 +361,11 @@ struct CNodeStateStats {
     int nSyncHeight;
     int nCommonHeight;
     std::vector<int> vHeightInFlight;
+    //! Smoothed rate of the blocks we requested from the peer, in bytes per second, 0 if none arrived yet
+    double dDownloadRate;
+    //! Number of blocks we currently allow in flight from the peer
+    int nBlocksInFlightLimit;
+    int nBlocksDownloaded;
 };
 
 struct CTimestampIndexIteratorKey {
@@ -566,6 +629,12 @@ struct CAddressIndexKey {
 
 };
 
+//! Receive address index entries in key order, return false to stop
+typedef std::function<bool(const CAddressUnspentKey&, const CAddressUnspentValue&)> AddressUnspentVisitor;
+typedef std::function<bool(const CAddressIndexKey&, CAmount)> AddressIndexVisitor;
+//! Receives timestamp index entries and the height of their block, -1 if the entry predates stored heights
+typedef std::function<bool(const CTimestampIndexKey&, int)> TimestampIndexVisitor;
+
 struct CAddressIndexIteratorKey {
     unsigned int type;
     uint160 hashBytes;
@@ -703,16 +772,18 @@ unsigned int GetP2SHSigOpCount(const CTransaction& tx, const CCoinsViewCache& ma
 /**
  * Check whether all inputs of this transaction are valid (no double spends, scripts & sigs, amounts)
  * This does not modify the UTXO set. If pvChecks is not NULL, script checks are pushed onto it
- * instead of being performed inline.
+ * instead of being performed inline. If pvEvalChecks is also not NULL, those of CC inputs leave
+ * the Eval conditions to the checks pushed onto it.
  */
 bool ContextualCheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &view, bool fScriptChecks,
                            unsigned int flags, bool cacheStore, PrecomputedTransactionData& txdata,
                            const Consensus::Params& consensusParams, uint32_t consensusBranchId,
-                           std::vector<CScriptCheck> *pvChecks = NULL);
+                           std::vector<CScriptCheck> *pvChecks = NULL, std::vector<CCCEvalCheck> *pvEvalChecks = NULL);
 
 /** Check a transaction contextually against a set of consensus rules */
 bool ContextualCheckTransaction(int32_t slowflag,const CBlock *block, CBlockIndex * const pindexPrev,const CTransaction& tx, CValidationState &state, int nHeight, int dosLevel,
-                                bool (*isInitBlockDownload)() = IsInitialBlockDownload,int32_t validateprices=1);
+                                bool (*isInitBlockDownload)() = IsInitialBlockDownload,int32_t validateprices=1,
+                                std::vector<CSaplingCheck> *pvSaplingChecks = NULL);
 
 /** Apply the effects of this transaction on the UTXO set represented by view */
 void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, int nHeight);
@@ -776,12 +847,14 @@ private:
     uint32_t consensusBranchId;
     ScriptError error;
     PrecomputedTransactionData *txdata;
+    //! Whether the Eval conditions of a CC input are left to a CCCEvalCheck
+    bool fSkipEval;
 
 public:
-    CScriptCheck(): amount(0), ptxTo(0), nIn(0), nFlags(0), cacheStore(false), consensusBranchId(0), error(SCRIPT_ERR_UNKNOWN_ERROR) {}
-    CScriptCheck(const CCoins& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn, uint32_t consensusBranchIdIn, PrecomputedTransactionData* txdataIn) :
+    CScriptCheck(): amount(0), ptxTo(0), nIn(0), nFlags(0), cacheStore(false), consensusBranchId(0), error(SCRIPT_ERR_UNKNOWN_ERROR), fSkipEval(false) {}
+    CScriptCheck(const CCoins& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn, uint32_t consensusBranchIdIn, PrecomputedTransactionData* txdataIn, bool fSkipEvalIn = false) :
         scriptPubKey(CCoinsViewCache::GetSpendFor(&txFromIn, txToIn.vin[nInIn])), amount(txFromIn.vout[txToIn.vin[nInIn].prevout.n].nValue),
-        ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), consensusBranchId(consensusBranchIdIn), error(SCRIPT_ERR_UNKNOWN_ERROR), txdata(txdataIn) { }
+        ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), consensusBranchId(consensusBranchIdIn), error(SCRIPT_ERR_UNKNOWN_ERROR), txdata(txdataIn), fSkipEval(fSkipEvalIn) { }
 
     bool operator()();
 
@@ -795,23 +868,248 @@ public:
         std::swap(consensusBranchId, check.consensusBranchId);
         std::swap(error, check.error);
         std::swap(txdata, check.txdata);
+        std::swap(fSkipEval, check.fSkipEval);
     }
 
     ScriptError GetScriptError() const { return error; }
+
+    //! A CC fulfillment costs more than a signature, and more again when its Eval conditions are run here
+    unsigned int GetCost() const {
+        if (!scriptPubKey.IsPayToCryptoCondition())
+            return 1;
+        return fSkipEval ? 4 : 16;
+    }
+};
+
+/**
+ * Closure representing the Eval conditions of a CC input whose script check
+ * was queued without them. Module validators read the chain through global
+ * state, and some take cs_main, which the thread connecting the block holds
+ * while it waits for the queue, so their part of the check is run on that
+ * thread, in block order, while the script check threads verify signatures.
+ * Note that this stores references to the transaction and its data.
+ */
+class CCCEvalCheck
+{
+private:
+    const CTransaction *ptxTo;
+    unsigned int nIn;
+    CAmount amount;
+    bool cacheStore;
+    PrecomputedTransactionData *txdata;
+
+public:
+    CCCEvalCheck(const CTransaction& txToIn, unsigned int nInIn, const CAmount& amountIn, bool cacheIn, PrecomputedTransactionData* txdataIn) :
+        ptxTo(&txToIn), nIn(nInIn), amount(amountIn), cacheStore(cacheIn), txdata(txdataIn) { }
+
+    bool operator()();
 };
 
+/**
+ * Closure representing the Sapling proof and signature verification of one
+ * transaction. The binding signature covers every spend and output, so the
+ * descriptions of a transaction are checked together in a single context.
+ * Note that this stores a reference to the transaction.
+ */
+class CSaplingCheck
+{
+private:
+    const CTransaction *ptx;
+    uint256 dataToBeSigned;
+    std::string strRejectReason;
+
+public:
+    CSaplingCheck(): ptx(0) {}
+    CSaplingCheck(const CTransaction& txIn, const uint256& dataToBeSignedIn) :
+        ptx(&txIn), dataToBeSigned(dataToBeSignedIn) { }
+
+    bool operator()();
+
+    void swap(CSaplingCheck &check) {
+        std::swap(ptx, check.ptx);
+        std::swap(dataToBeSigned, check.dataToBeSigned);
+        strRejectReason.swap(check.strRejectReason);
+    }
+
+    const std::string& GetRejectReason() const { return strRejectReason; }
+
+    //! One proof to verify for each spend and output
+    unsigned int GetCost() const {
+        return ptx == 0 ? 1 : std::max<size_t>(1, ptx->vShieldedSpend.size() + ptx->vShieldedOutput.size());
+    }
+};
+
+/**
+ * Closure representing the Equihash solution check of one block header.
+ * Note that this stores a reference to the header.
+ */
+class CEquihashCheck
+{
+private:
+    const CBlockHeader *pheader;
+
+public:
+    CEquihashCheck(): pheader(0) {}
+    CEquihashCheck(const CBlockHeader& headerIn) : pheader(&headerIn) { }
+
+    bool operator()();
+
+    void swap(CEquihashCheck &check) {
+        std::swap(pheader, check.pheader);
+    }
+
+    unsigned int GetCost() const { return 1; }
+};
+
+/** A block record read from a block file by LoadExternalBlockFile */
+struct CBlockFileRecord
+{
+    CDiskBlockPos pos;
+    //! Where to look for the next record when this one does not parse
+    uint64_t nRewind;
+    std::vector<char> vRecord;
+    CBlock block;
+    uint256 hash;
+    //! Why the record is skipped, empty when it parsed to a block with a matching merkle root
+    std::string strError;
+    //! Whether the record could not be deserialized at all
+    bool fCorrupt;
+
+    CBlockFileRecord() : nRewind(0), fCorrupt(false) {}
+};
+
+/**
+ * Closure parsing one block record: it inflates and deserializes the block,
+ * which computes the transaction hashes, hashes the header, checks the
+ * merkle root and verifies the Equihash solution, leaving the solution
+ * cached for the checks in ProcessNewBlock. None of this needs the chain,
+ * so the records of a block file are parsed in parallel while the blocks are
+ * still processed in file order.
+ */
+class CBlockParseCheck
+{
+private:
+    CBlockFileRecord *prec;
+
+public:
+    CBlockParseCheck(): prec(0) {}
+    CBlockParseCheck(CBlockFileRecord& recIn) : prec(&recIn) { }
+
+    bool operator()();
+
+    void swap(CBlockParseCheck &check) {
+        std::swap(prec, check.prec);
+    }
+
+    unsigned int GetCost() const { return 1; }
+};
+
+/**
+ * Checks the Equihash solutions of a batch of headers, such as those of one
+ * headers message, in parallel on the script check threads. Returns false if
+ * any of them is invalid.
+ */
+bool CheckEquihashSolutions(const std::vector<const CBlockHeader*>& vHeaders);
+
+/**
+ * Closure verifying the shielded proofs and signatures of one transaction
+ * before it is offered to AcceptToMemoryPool. A valid transaction is recorded
+ * in the proof cache. It always returns true, because AcceptToMemoryPool is
+ * what rejects an invalid transaction.
+ */
+class CShieldedProofCheck
+{
+private:
+    const CTransaction *ptx;
+    uint32_t consensusBranchId;
+
+public:
+    CShieldedProofCheck(): ptx(0), consensusBranchId(0) {}
+    CShieldedProofCheck(const CTransaction& txIn, uint32_t consensusBranchIdIn) :
+        ptx(&txIn), consensusBranchId(consensusBranchIdIn) { }
+
+    bool operator()();
+
+    void swap(CShieldedProofCheck &check) {
+        std::swap(ptx, check.ptx);
+        std::swap(consensusBranchId, check.consensusBranchId);
+    }
+
+    //! One proof to verify for each JoinSplit, spend and output
+    unsigned int GetCost() const {
+        return ptx == 0 ? 1 : std::max<size_t>(1, ptx->vjoinsplit.size() + ptx->vShieldedSpend.size() + ptx->vShieldedOutput.size());
+    }
+};
+
+/**
+ * Verifies the proofs of the shielded transactions in vtx for the next block,
+ * in parallel on the script check threads and without holding cs_main. The
+ * valid ones are cached, so AcceptToMemoryPool only does the serial checks
+ * for them. Must not be called with cs_main held if other threads should
+ * make progress meanwhile.
+ */
+void PreverifyShieldedTransactions(const std::vector<const CTransaction*>& vtx);
+
 bool GetTimestampIndex(const unsigned int &high, const unsigned int &low, const bool fActiveOnly, std::vector<std::pair<uint256, unsigned int> > &hashes);
+/**
+ * Visit the timestamp index from the key start on, up to but excluding the
+ * logical timestamp high, straight from the iterator. With fActiveOnly the
+ * blocks off the active chain are skipped, checked against the tip snapshot
+ * by the height stored with each entry rather than under cs_main.
+ */
+bool GetTimestampIndex(const CTimestampIndexKey& start, unsigned int high, bool fActiveOnly, const TimestampIndexVisitor& visit);
 bool GetSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value);
+//! Writes the timestamp index entries of a block, after those of its parent
+bool WriteBlockTimestampIndex(const CBlockIndex* pindex);
+/** Address type and hashes of an output script for the address index, 0 if it has none */
+int8_t GetAddressType(const CScript &scriptPubKey, CTxDestination &vDest, txnouttype &txType, std::vector<std::vector<unsigned char>> &vSols);
 bool GetAddressIndex(uint160 addressHash, int type,
                      std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
                      int start = 0, int end = 0);
 bool GetAddressUnspent(uint160 addressHash, int type,
                        std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &unspentOutputs);
+/**
+ * Visit the entries of one address straight from the index iterator, from
+ * the key start on (the address and type are taken from it), without
+ * collecting them first. AddressIndex stops after height end if positive.
+ */
+bool GetAddressIndex(const CAddressIndexKey& start, int end, const AddressIndexVisitor& visit);
+bool GetAddressUnspent(const CAddressUnspentKey& start, const AddressUnspentVisitor& visit);
 
 /** Functions for disk access for blocks */
 bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
+//! Writes a block serialized by SerializeRecord, so its size is known to FindBlockPos first
+bool WriteBlockToDisk(const std::vector<char>& vRecord, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos,bool checkPOW);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex,bool checkPOW);
+//! Reads the undo data of a connected block, checked against its parent
+bool ReadBlockUndoFromDisk(CBlockUndo& blockundo, const CBlockIndex* pindex);
+/**
+ * Reads the compact block index record of a block of the active chain. In prune
+ * mode it outlives the block, so the wallet advances its Sapling witnesses
+ * from the note commitments in it.
+ */
+bool ReadCompactBlock(const CBlockIndex* pindex, CCompactBlock& compact);
+/**
+ * Reads the Sapling note commitments of up to nCount consecutive blocks of the
+ * active chain from pindexStart. They come from the commitment lists kept for
+ * every block, from the block itself for one connected before they were kept.
+ */
+bool ReadSaplingCommitments(const CBlockIndex* pindexStart, int nCount, std::vector<CSaplingBlockCommitments>& vCommitments);
+/**
+ * The Sapling commitment tree after a block of the active chain: its anchor,
+ * or the nearest tree checkpoint below it with the commitments of the blocks
+ * since then appended.
+ */
+bool GetSaplingTreeAfter(const CBlockIndex* pindex, SaplingMerkleTree& tree);
+/**
+ * Reads the serialized block at pos without deserializing it, as a span of the
+ * mapped file if it can be mapped and into vRaw otherwise. A compressed block
+ * is inflated into vRaw. Fails unless the block header hashes to hash.
+ */
+bool ReadRawBlockFromDisk(CMappedSpan& span, std::vector<char>& vRaw, const CDiskBlockPos& pos, const uint256& hash);
+/** Reads a block as a view over the bytes left in span or vRaw, which have to be kept while the view is used */
+bool ReadBlockViewFromDisk(CMappedSpan& span, std::vector<char>& vRaw, const CBlockIndex* pindex, CBlockView& view);
 bool PruneOneBlockFile(bool tempfile, const int fileNumber);
 
 /** Functions for validating blocks and updating the block tree */
@@ -870,18 +1168,33 @@ public:
     unsigned int nHeightLast;  //! highest height of block in file
     uint64_t nTimeFirst;         //! earliest time of block in file
     uint64_t nTimeLast;          //! latest time of block in file
+    unsigned int nTier;        //! BlockFileTier of the blk and rev files
 
-    ADD_SERIALIZE_METHODS;
+    template <typename Stream>
+    void Serialize(Stream& s) const {
+        s << VARINT(nBlocks);
+        s << VARINT(nSize);
+        s << VARINT(nUndoSize);
+        s << VARINT(nHeightFirst);
+        s << VARINT(nHeightLast);
+        s << VARINT(nTimeFirst);
+        s << VARINT(nTimeLast);
+        s << VARINT(nTier);
+    }
 
-    template <typename Stream, typename Operation>
-    inline void SerializationOp(Stream& s, Operation ser_action) {
-        READWRITE(VARINT(nBlocks));
-        READWRITE(VARINT(nSize));
-        READWRITE(VARINT(nUndoSize));
-        READWRITE(VARINT(nHeightFirst));
-        READWRITE(VARINT(nHeightLast));
-        READWRITE(VARINT(nTimeFirst));
-        READWRITE(VARINT(nTimeLast));
+    //! The tier was added after the other fields, records written before are of files in the datadir
+    template <typename Stream>
+    void Unserialize(Stream& s) {
+        s >> VARINT(nBlocks);
+        s >> VARINT(nSize);
+        s >> VARINT(nUndoSize);
+        s >> VARINT(nHeightFirst);
+        s >> VARINT(nHeightLast);
+        s >> VARINT(nTimeFirst);
+        s >> VARINT(nTimeLast);
+        nTier = BLOCK_FILE_HOT;
+        if (!s.empty())
+            s >> VARINT(nTier);
     }
 
      void SetNull() {
@@ -892,6 +1205,7 @@ public:
          nHeightLast = 0;
          nTimeFirst = 0;
          nTimeLast = 0;
+         nTier = BLOCK_FILE_HOT;
      }
 
      CBlockFileInfo() {
@@ -934,9 +1248,59 @@ bool ReconsiderBlock(CValidationState& state, CBlockIndex *pindex);
 /** The currently-connected chain of blocks (protected by cs_main). */
 extern CChain chainActive;
 
+/**
+ * What the query RPCs report about the active chain, published whenever the
+ * tip changes so they can answer without waiting for cs_main while blocks are
+ * being connected. Published snapshots are never modified. Block index
+ * entries stay allocated until UnloadBlockIndex, so pindexTip can be walked
+ * through pprev and GetAncestor without the lock.
+ */
+struct CChainTipSnapshot
+{
+    //! Tip of the active chain, NULL before the block index is loaded
+    CBlockIndex* pindexTip;
+    int nHeight;
+    int64_t nMedianTimePast;
+    //! Height of pindexBestHeader, refreshed when only the headers advance as well
+    int nHeadersHeight;
+    double dNetworkDifficulty;
+    uint64_t nSproutCommitments;
+    //! Memory used by pcoinsTip
+    size_t nCoinsCacheUsage;
+
+    //! Last notarization seen by the komodo state
+    int32_t nNotarizedHeight;
+    int32_t nPrevMoMHeight;
+    uint256 notarizedHash;
+    uint256 notarizedDestTxid;
+
+    CChainTipSnapshot() : pindexTip(NULL), nHeight(-1), nMedianTimePast(0), nHeadersHeight(-1),
+                          dNetworkDifficulty(1.0), nSproutCommitments(0), nCoinsCacheUsage(0), nNotarizedHeight(0), nPrevMoMHeight(0) {}
+
+    //! The block of the active chain at nHeightIn, as of this snapshot
+    CBlockIndex* operator[](int nHeightIn) const {
+        if (pindexTip == NULL || nHeightIn < 0 || nHeightIn > nHeight)
+            return NULL;
+        return pindexTip->GetAncestor(nHeightIn);
+    }
+
+    bool Contains(const CBlockIndex* pindex) const {
+        return pindex != NULL && (*this)[pindex->GetHeight()] == pindex;
+    }
+};
+
+/** Publishes a snapshot of the current tip (requires cs_main). */
+void PublishChainTipSnapshot();
+
+/** The last published snapshot of the active chain, without taking any lock. */
+std::shared_ptr<const CChainTipSnapshot> GetChainTipSnapshot();
+
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern CCoinsViewCache *pcoinsTip;
 
+/** Layer below pcoinsTip that writes flushed coins in the background, if in use */
+extern CCoinsViewAsyncFlush *pcoinsAsyncFlush;
+
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern CBlockTreeDB *pblocktree;
 
@@ -20,10 +20,15 @@
 #ifndef BITCOIN_MEMUSAGE_H
 #define BITCOIN_MEMUSAGE_H
 
+#include "prevector.h"
+
 #include <stdlib.h>
 
+#include <list>
 #include <map>
+#include <memory>
 #include <set>
+#include <string>
 #include <vector>
 
 #include <boost/foreach.hpp>
@@ -109,6 +114,48 @@ static inline size_t DynamicUsage(const std::map<X, Y>& m)
     return MallocUsage(sizeof(stl_tree_node<std::pair<const X, Y> >)) * m.size();
 }
 
+template<typename X, typename Y>
+static inline size_t DynamicUsage(const std::multimap<X, Y>& m)
+{
+    return MallocUsage(sizeof(stl_tree_node<std::pair<const X, Y> >)) * m.size();
+}
+
+template<typename X>
+struct stl_list_node
+{
+private:
+    void* next;
+    void* prev;
+    X x;
+};
+
+template<typename X>
+static inline size_t DynamicUsage(const std::list<X>& l)
+{
+    return MallocUsage(sizeof(stl_list_node<X>)) * l.size();
+}
+
+static inline size_t DynamicUsage(const std::string& s)
+{
+    // Strings that fit the object itself are not allocated (libstdc++)
+    return s.capacity() > 15 ? MallocUsage(s.capacity() + 1) : 0;
+}
+
+struct stl_shared_counter
+{
+    void* class_type;
+    size_t use_count;
+    size_t weak_count;
+};
+
+template<typename X>
+static inline size_t DynamicUsage(const std::shared_ptr<X>& p)
+{
+    // make_shared puts the counter and the object in one block, but that
+    // can't be told from here, so count them as two
+    return p ? MallocUsage(sizeof(X)) + MallocUsage(sizeof(stl_shared_counter)) : 0;
+}
+
 // Boost data structures
 
 template<typename X>
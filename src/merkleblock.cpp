@@ -24,11 +24,54 @@
 #include "consensus/consensus.h"
 #include "utilstrencodings.h"
 #include "komodo_defs.h"
+#include "sync.h"
+
+#include <list>
+
 using namespace std;
 
+namespace {
+
+//! The elements of the blocks last sent to filtered peers, the most recent first
+static const size_t MAX_BLOOM_BLOCKS = 4;
+CCriticalSection cs_bloomblocks;
+list<pair<uint256, std::shared_ptr<const CBloomBlockElements> > > listBloomBlocks;
+
+}
+
+std::shared_ptr<const CBloomBlockElements> GetBloomBlockElements(const CBlock& block)
+{
+    const uint256 hash = block.GetHash();
+    {
+        LOCK(cs_bloomblocks);
+        for (list<pair<uint256, std::shared_ptr<const CBloomBlockElements> > >::iterator it = listBloomBlocks.begin(); it != listBloomBlocks.end(); ++it)
+        {
+            // A block mutated into the same hash by duplicating transactions doesn't have as many of them
+            if (it->first == hash && it->second->size() == block.vtx.size())
+            {
+                listBloomBlocks.splice(listBloomBlocks.begin(), listBloomBlocks, it);
+                return listBloomBlocks.front().second;
+            }
+        }
+    }
+
+    // Read out of the block without the lock, a block read twice at once costs less than peers waiting on each other
+    std::shared_ptr<CBloomBlockElements> pelements = std::make_shared<CBloomBlockElements>();
+    pelements->reserve(block.vtx.size());
+    for (const CTransaction& tx : block.vtx)
+        pelements->push_back(CBloomTransactionElements(tx));
+
+    LOCK(cs_bloomblocks);
+    listBloomBlocks.push_front(make_pair(hash, pelements));
+    if (listBloomBlocks.size() > MAX_BLOOM_BLOCKS)
+        listBloomBlocks.pop_back();
+    return pelements;
+}
+
 CMerkleBlock::CMerkleBlock(const CBlock& block, CBloomFilter& filter)
 {
     header = block.GetBlockHeader();
+    std::shared_ptr<const CBloomBlockElements> pelements = GetBloomBlockElements(block);
 
     vector<bool> vMatch;
     vector<uint256> vHashes;
@@ -39,7 +82,7 @@ CMerkleBlock::CMerkleBlock(const CBlock& block, CBloomFilter& filter)
     for (unsigned int i = 0; i < block.vtx.size(); i++)
     {
         const uint256& hash = block.vtx[i].GetHash();
-        if (filter.IsRelevantAndUpdate(block.vtx[i]))
+        if (filter.IsRelevantAndUpdate(block.vtx[i], (*pelements)[i]))
         {
             vMatch.push_back(true);
             vMatchedTxn.push_back(make_pair(i, hash));
@@ -75,24 +118,15 @@ CMerkleBlock::CMerkleBlock(const CBlock& block, const std::set<uint256>& txids)
     txn = CPartialMerkleTree(vHashes, vMatch);
 }
 
-uint256 CPartialMerkleTree::CalcHash(int height, unsigned int pos, const std::vector<uint256> &vTxid) {
-    if (height == 0) {
-        // hash at height 0 is the txid itself
-        return vTxid[pos];
-    } else {
-        // calculate left hash
-        uint256 left = CalcHash(height-1, pos*2, vTxid), right;
-        // calculate right hash if not beyond the end of the array - copy left hash otherwise
-        if (pos*2+1 < CalcTreeWidth(height-1))
-            right = CalcHash(height-1, pos*2+1, vTxid);
-        else
-            right = left;
-        // combine subhashes
-        return Hash(BEGIN(left), END(left), BEGIN(right), END(right));
-    }
+uint256 CPartialMerkleTree::CalcHash(int height, unsigned int pos, const std::vector<uint256> &vTree) {
+    // the levels are stored bottom up, starting with the txids themselves
+    unsigned int nOffset = 0;
+    for (int h = 0; h < height; h++)
+        nOffset += CalcTreeWidth(h);
+    return vTree[nOffset + pos];
 }
 
-void CPartialMerkleTree::TraverseAndBuild(int height, unsigned int pos, const std::vector<uint256> &vTxid, const std::vector<bool> &vMatch) {
+void CPartialMerkleTree::TraverseAndBuild(int height, unsigned int pos, const std::vector<uint256> &vTree, const std::vector<bool> &vMatch) {
     // determine whether this node is the parent of at least one matched txid
     bool fParentOfMatch = false;
     for (unsigned int p = pos << height; p < (pos+1) << height && p < nTransactions; p++)
@@ -101,12 +135,12 @@ void CPartialMerkleTree::TraverseAndBuild(int height, unsigned int pos, const st
     vBits.push_back(fParentOfMatch);
     if (height==0 || !fParentOfMatch) {
         // if at height 0, or nothing interesting below, store hash and stop
-        vHash.push_back(CalcHash(height, pos, vTxid));
+        vHash.push_back(CalcHash(height, pos, vTree));
     } else {
         // otherwise, don't store any hash, but descend into the subtrees
-        TraverseAndBuild(height-1, pos*2, vTxid, vMatch);
+        TraverseAndBuild(height-1, pos*2, vTree, vMatch);
         if (pos*2+1 < CalcTreeWidth(height-1))
-            TraverseAndBuild(height-1, pos*2+1, vTxid, vMatch);
+            TraverseAndBuild(height-1, pos*2+1, vTree, vMatch);
     }
 }
 
@@ -156,8 +190,12 @@ CPartialMerkleTree::CPartialMerkleTree(const std::vector<uint256> &vTxid, const
     while (CalcTreeWidth(nHeight) > 1)
         nHeight++;
 
+    // hash all levels of the tree at once, rather than node by node while traversing
+    std::vector<uint256> vTree;
+    ::BuildMerkleTree(NULL, vTxid, vTree);
+
     // traverse the partial tree
-    TraverseAndBuild(nHeight, 0, vTxid, vMatch);
+    TraverseAndBuild(nHeight, 0, vTree, vMatch);
 }
 
 CPartialMerkleTree::CPartialMerkleTree() : nTransactions(0), fBad(true) {}
@@ -26,6 +26,7 @@
 #include "primitives/block.h"
 #include "bloom.h"
 
+#include <memory>
 #include <vector>
 
 /** Data structure that represents a partial merkle tree.
@@ -82,11 +83,11 @@ protected:
         return (nTransactions+(1 << height)-1) >> height;
     }
 
-    /** calculate the hash of a node in the merkle tree (at leaf level: the txid itself) */
-    uint256 CalcHash(int height, unsigned int pos, const std::vector<uint256> &vTxid);
+    /** look up the hash of a node in the full merkle tree vTree, as built by BuildMerkleTree (at leaf level: the txid itself) */
+    uint256 CalcHash(int height, unsigned int pos, const std::vector<uint256> &vTree);
 
     /** recursive function that traverses tree nodes, storing the data as bits and hashes */
-    void TraverseAndBuild(int height, unsigned int pos, const std::vector<uint256> &vTxid, const std::vector<bool> &vMatch);
+    void TraverseAndBuild(int height, unsigned int pos, const std::vector<uint256> &vTree, const std::vector<bool> &vMatch);
 
     /**
      * recursive function that traverses tree nodes, consuming the bits and hashes produced by TraverseAndBuild.
@@ -150,7 +151,8 @@ public:
     /**
      * Create from a CBlock, filtering transactions according to filter
      * Note that this will call IsRelevantAndUpdate on the filter for each transaction,
-     * thus the filter will likely be modified.
+     * thus the filter will likely be modified. The elements of the transactions are
+     * those of GetBloomBlockElements, shared with the other peers the block is sent to.
      */
     CMerkleBlock(const CBlock& block, CBloomFilter& filter);
 
@@ -168,4 +170,10 @@ public:
     }
 };
 
+/**
+ * The bloom elements of the transactions of a block, read out of it once for all the
+ * filtered peers it is sent to. The last few blocks asked for are kept.
+ */
+std::shared_ptr<const CBloomBlockElements> GetBloomBlockElements(const CBlock& block);
+
 #endif // BITCOIN_MERKLEBLOCK_H
@@ -22,6 +22,9 @@
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "main.h"
+#include "net.h"
+#include "rpc/stats.h"
+#include "txmempool.h"
 #include "ui_interface.h"
 #include "util.h"
 #include "utiltime.h"
@@ -30,6 +33,7 @@
 
 #include <boost/thread.hpp>
 #include <boost/thread/synchronized_value.hpp>
+#include <deque>
 #include <string>
 #ifdef _WIN32
 #include <io.h>
@@ -95,8 +99,66 @@ AtomicCounter ehSolverRuns;
 AtomicCounter solutionTargetChecks;
 static AtomicCounter minedBlocks;
 AtomicTimer miningTimer;
+AtomicCounter blocksConnected;
+std::atomic<int> nStatsTipHeight(0);
+std::atomic<uint64_t> nStatsMempoolTxs(0);
+std::atomic<uint64_t> nStatsMempoolBytes(0);
+std::atomic<uint64_t> nStatsMempoolUsage(0);
+std::atomic<int> nStatsPeersInbound(0);
+std::atomic<int> nStatsPeersOutbound(0);
 CCriticalSection cs_metrics;
 
+static std::mutex cs_nodeStats;
+static std::deque<NodeStatsSample> dequeNodeStats;
+//! Totals at the last sample, the samples hold the differences
+static NodeStatsSample lastNodeStatsTotals;
+
+void SampleNodeStats()
+{
+    NodeStatsSample totals;
+    totals.nTime = GetTime();
+    totals.nBytesRecv = CNode::GetTotalBytesRecv();
+    totals.nBytesSent = CNode::GetTotalBytesSent();
+    totals.nBlocksConnected = blocksConnected.get();
+    totals.nTxsValidated = transactionsValidated.get();
+    totals.nTipHeight = nStatsTipHeight.load();
+    totals.nMempoolTxs = mempool.size();
+    nStatsMempoolTxs = totals.nMempoolTxs;
+    nStatsMempoolBytes = mempool.GetTotalTxSize();
+    nStatsMempoolUsage = mempool.DynamicMemoryUsage();
+    {
+        int nInbound = 0, nOutbound = 0;
+        LOCK(cs_vNodes);
+        for (const CNode* pnode : vNodes)
+            (pnode->fInbound ? nInbound : nOutbound)++;
+        nStatsPeersInbound = nInbound;
+        nStatsPeersOutbound = nOutbound;
+    }
+
+    std::lock_guard<std::mutex> lock(cs_nodeStats);
+    bool fFirst = lastNodeStatsTotals.nTime == 0;
+    NodeStatsSample sample = totals;
+    sample.nBytesRecv -= lastNodeStatsTotals.nBytesRecv;
+    sample.nBytesSent -= lastNodeStatsTotals.nBytesSent;
+    sample.nBlocksConnected -= lastNodeStatsTotals.nBlocksConnected;
+    sample.nTxsValidated -= lastNodeStatsTotals.nTxsValidated;
+    lastNodeStatsTotals = totals;
+    // The totals since startup are no second's worth
+    if (fFirst)
+        return;
+
+    dequeNodeStats.push_back(sample);
+    if (dequeNodeStats.size() > (size_t)NODE_STATS_HISTORY)
+        dequeNodeStats.pop_front();
+}
+
+std::vector<NodeStatsSample> GetNodeStatsHistory(int nSeconds)
+{
+    std::lock_guard<std::mutex> lock(cs_nodeStats);
+    size_t nSamples = std::min((size_t)std::max(nSeconds, 0), dequeNodeStats.size());
+    return std::vector<NodeStatsSample>(dequeNodeStats.end() - nSamples, dequeNodeStats.end());
+}
+
 double AtomicTimer::rate(const int64_t count)
 {
     std::unique_lock<std::mutex> lock(mtx);
@@ -261,6 +323,21 @@ int printStats(bool mining)
     }
     std::cout << "            " << _("Connections") << " | " << connections << std::endl;
     std::cout << "  " << _("Network solution rate") << " | " << netsolps << " Sol/s" << std::endl;
+
+    uint64_t nRPCCalls, nRPCErrors;
+    size_t nRPCInFlight;
+    rpcStats.GetTotals(nRPCCalls, nRPCErrors, nRPCInFlight);
+    if (nRPCCalls > 0 || nRPCInFlight > 0) {
+        std::cout << "              " << _("RPC calls") << " | " << nRPCCalls << " (" << nRPCErrors << " " << _("errors") << ", "
+                  << nRPCInFlight << " " << _("executing") << ")" << std::endl;
+        lines++;
+        std::vector<CRPCStats::InFlight> vInFlight = rpcStats.GetInFlight();
+        if (!vInFlight.empty()) {
+            std::cout << "       " << _("Longest RPC call") << " | " << vInFlight[0].strMethod
+                      << strprintf(" (%.1f s)", (GetTimeMicros() - vInFlight[0].nStartMicros) / 1000000.0) << std::endl;
+            lines++;
+        }
+    }
     if (mining && miningTimer.running()) {
         std::cout << "    " << _("Local solution rate") << " | " << strprintf("%.4f Sol/s", localsolps) << std::endl;
         lines++;
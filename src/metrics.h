@@ -22,6 +22,7 @@
 #include <atomic>
 #include <mutex>
 #include <string>
+#include <vector>
 
 extern int64_t nHashCount;
 
@@ -77,6 +78,36 @@ extern AtomicCounter transactionsValidated;
 extern AtomicCounter ehSolverRuns;
 extern AtomicCounter solutionTargetChecks;
 extern AtomicTimer miningTimer;
+extern AtomicCounter blocksConnected;
+//! Height of the tip, kept for the readers that don't take cs_main
+extern std::atomic<int> nStatsTipHeight;
+//! Mempool and peers as of the last SampleNodeStats, for the readers that don't take their locks
+extern std::atomic<uint64_t> nStatsMempoolTxs;
+extern std::atomic<uint64_t> nStatsMempoolBytes;
+extern std::atomic<uint64_t> nStatsMempoolUsage;
+extern std::atomic<int> nStatsPeersInbound;
+extern std::atomic<int> nStatsPeersOutbound;
+
+/** What the node did over one second, see GetNodeStatsHistory */
+struct NodeStatsSample {
+    int64_t nTime;
+    uint64_t nBytesRecv;
+    uint64_t nBytesSent;
+    uint64_t nBlocksConnected;
+    uint64_t nTxsValidated;
+    int nTipHeight;
+    uint64_t nMempoolTxs;
+
+    NodeStatsSample() : nTime(0), nBytesRecv(0), nBytesSent(0), nBlocksConnected(0), nTxsValidated(0), nTipHeight(0), nMempoolTxs(0) {}
+};
+
+//! Seconds of samples kept
+static const int NODE_STATS_HISTORY = 3600;
+
+//! Records the sample of the last second, scheduled every second
+void SampleNodeStats();
+//! Samples of the last nSeconds, the oldest first. Only takes the lock of the history.
+std::vector<NodeStatsSample> GetNodeStatsHistory(int nSeconds);
 
 void TrackMinedBlock(uint256 hash);
 
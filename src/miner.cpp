@@ -46,6 +46,7 @@
 #include "ui_interface.h"
 #include "util.h"
 #include "utilmoneystr.h"
+#include "util/trace.h"
 #ifdef ENABLE_WALLET
 #include "wallet/wallet.h"
 #endif
@@ -92,6 +93,37 @@ public:
     }
 };
 
+//
+// Most of the work of selecting a transaction is the same on every call at
+// the same tip: reading the coins it spends, its priority and fee, the
+// notaries signing it and the check of its scripts. CTemplateCandidate keeps
+// those results per mempool transaction until the tip moves, so a call only
+// does that work for transactions that entered the mempool since the last
+// one, plus the checks that depend on the block time.
+//
+class CTemplateCandidate
+{
+public:
+    set<uint256> setDependsOn;
+    std::vector<int8_t> vNotaries;
+    CAmount nTotalIn;
+    double dPriority;
+    unsigned int nTxSize;
+    bool fNotarisation;
+    bool fInputsChecked;
+    uint64_t nGeneration;
+
+    CTemplateCandidate() : nTotalIn(0), dPriority(0), nTxSize(0), fNotarisation(false), fInputsChecked(false), nGeneration(0)
+    {
+    }
+};
+
+// Guarded by cs_main
+static map<uint256, CTemplateCandidate> mapTemplateCandidates;
+static uint256 templateCandidatesTip;
+static uint8_t templateCandidatesNotaries[64][33];
+static uint64_t nTemplateGeneration = 0;
+
 uint64_t nLastBlockTx = 0;
 uint64_t nLastBlockSize = 0;
 
@@ -211,6 +243,7 @@ CBlockTemplate* CreateNewBlock(CPubKey _pk,const CScript& _scriptPubKeyIn, int32
     // Create new block
     if ( gpucount < 0 )
         gpucount = KOMODO_MAXGPUCOUNT;
+    int64_t nTimeStart = GetTimeMicros();
     std::unique_ptr<CBlockTemplate> pblocktemplate(new CBlockTemplate());
     if(!pblocktemplate.get())
     {
@@ -296,6 +329,15 @@ CBlockTemplate* CreateNewBlock(CPubKey _pk,const CScript& _scriptPubKeyIn, int32
         SaplingMerkleTree sapling_tree;
         assert(view.GetSaplingAnchorAt(view.GetBestAnchor(SAPLING), sapling_tree));
 
+        // Candidates computed for another tip or notary set are stale
+        if (templateCandidatesTip != pindexPrev->GetBlockHash() || memcmp(templateCandidatesNotaries, notarypubkeys, sizeof(notarypubkeys)) != 0)
+        {
+            mapTemplateCandidates.clear();
+            templateCandidatesTip = pindexPrev->GetBlockHash();
+            memcpy(templateCandidatesNotaries, notarypubkeys, sizeof(notarypubkeys));
+        }
+        nTemplateGeneration++;
+
         // Priority order to process transactions
         list<COrphan> vOrphan; // list memory doesn't move
         map<uint256, vector<COrphan*> > mapDependers;
@@ -334,104 +376,116 @@ CBlockTemplate* CreateNewBlock(CPubKey _pk,const CScript& _scriptPubKeyIn, int32
                 continue;
             }
 
-            COrphan* porphan = NULL;
-            double dPriority = 0;
-            CAmount nTotalIn = 0;
-            bool fMissingInputs = false;
-            bool fNotarisation = false;
-            std::vector<int8_t> TMP_NotarisationNotaries;
-            if (tx.IsCoinImport())
+            uint256 hash = tx.GetHash();
+            map<uint256, CTemplateCandidate>::iterator ci = mapTemplateCandidates.find(hash);
+            if (ci == mapTemplateCandidates.end())
             {
-                CAmount nValueIn = GetCoinImportValue(tx); // burn amount
-                nTotalIn += nValueIn;
-                dPriority += (double)nValueIn * 1000;  // flat multiplier... max = 1e16.
-            } else {
-                TMP_NotarisationNotaries.clear();
-                bool fToCryptoAddress = false;
-                if ( numSN != 0 && notarypubkeys[0][0] != 0 && komodo_is_notarytx(tx) == 1 )
-                    fToCryptoAddress = true;
-
-                BOOST_FOREACH(const CTxIn& txin, tx.vin)
+                CTemplateCandidate candidate;
+                double dPriority = 0;
+                CAmount nTotalIn = 0;
+                bool fMissingInputs = false;
+                std::vector<int8_t> TMP_NotarisationNotaries;
+                if (tx.IsCoinImport())
                 {
-                    if (tx.IsPegsImport() && txin.prevout.n==10e8)
-                    {
-                        CAmount nValueIn = GetCoinImportValue(tx); // burn amount
-                        nTotalIn += nValueIn;
-                        dPriority += (double)nValueIn * 1000;  // flat multiplier... max = 1e16.
-                        continue;
-                    }
-                    // Read prev transaction
-                    if (!view.HaveCoins(txin.prevout.hash))
+                    CAmount nValueIn = GetCoinImportValue(tx); // burn amount
+                    nTotalIn += nValueIn;
+                    dPriority += (double)nValueIn * 1000;  // flat multiplier... max = 1e16.
+                } else {
+                    bool fToCryptoAddress = false;
+                    if ( numSN != 0 && notarypubkeys[0][0] != 0 && komodo_is_notarytx(tx) == 1 )
+                        fToCryptoAddress = true;
+
+                    BOOST_FOREACH(const CTxIn& txin, tx.vin)
                     {
-                        // This should never happen; all transactions in the memory
-                        // pool should connect to either transactions in the chain
-                        // or other transactions in the memory pool.
-                        if (!mempool.mapTx.count(txin.prevout.hash))
+                        if (tx.IsPegsImport() && txin.prevout.n==10e8)
                         {
-                            LogPrintf("ERROR: mempool transaction missing input\n");
-                            // if (fDebug) assert("mempool transaction missing input" == 0);
-                            fMissingInputs = true;
-                            if (porphan)
-                                vOrphan.pop_back();
-                            break;
+                            CAmount nValueIn = GetCoinImportValue(tx); // burn amount
+                            nTotalIn += nValueIn;
+                            dPriority += (double)nValueIn * 1000;  // flat multiplier... max = 1e16.
+                            continue;
                         }
-
-                        // Has to wait for dependencies
-                        if (!porphan)
+                        // Read prev transaction
+                        if (!view.HaveCoins(txin.prevout.hash))
                         {
-                            // Use list for automatic deletion
-                            vOrphan.push_back(COrphan(&tx));
-                            porphan = &vOrphan.back();
+                            // This should never happen; all transactions in the memory
+                            // pool should connect to either transactions in the chain
+                            // or other transactions in the memory pool.
+                            if (!mempool.mapTx.count(txin.prevout.hash))
+                            {
+                                LogPrintf("ERROR: mempool transaction missing input\n");
+                                // if (fDebug) assert("mempool transaction missing input" == 0);
+                                fMissingInputs = true;
+                                break;
+                            }
+
+                            // Has to wait for dependencies
+                            candidate.setDependsOn.insert(txin.prevout.hash);
+                            nTotalIn += mempool.mapTx.find(txin.prevout.hash)->GetTx().vout[txin.prevout.n].nValue;
+                            continue;
                         }
-                        mapDependers[txin.prevout.hash].push_back(porphan);
-                        porphan->setDependsOn.insert(txin.prevout.hash);
-                        nTotalIn += mempool.mapTx.find(txin.prevout.hash)->GetTx().vout[txin.prevout.n].nValue;
-                        continue;
-                    }
-                    const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-                    assert(coins);
+                        const CCoins* coins = view.AccessCoins(txin.prevout.hash);
+                        assert(coins);
 
-                    CAmount nValueIn = coins->vout[txin.prevout.n].nValue;
-                    nTotalIn += nValueIn;
+                        CAmount nValueIn = coins->vout[txin.prevout.n].nValue;
+                        nTotalIn += nValueIn;
 
-                    int nConf = nHeight - coins->nHeight;
+                        int nConf = nHeight - coins->nHeight;
 
-                    uint8_t *script; int32_t scriptlen; uint256 hash; CTransaction tx1;
-                    // loop over notaries array and extract index of signers.
-                    if ( fToCryptoAddress && myGetTransaction(txin.prevout.hash,tx1,hash) )
-                    {
-                        for (int8_t i = 0; i < numSN; i++)
+                        uint8_t *script; int32_t scriptlen; uint256 hash; CTransaction tx1;
+                        // loop over notaries array and extract index of signers.
+                        if ( fToCryptoAddress && myGetTransaction(txin.prevout.hash,tx1,hash) )
                         {
-                            script = (uint8_t *)&tx1.vout[txin.prevout.n].scriptPubKey[0];
-                            scriptlen = (int32_t)tx1.vout[txin.prevout.n].scriptPubKey.size();
-                            if ( scriptlen == 35 && script[0] == 33 && script[34] == OP_CHECKSIG && memcmp(script+1,notarypubkeys[i],33) == 0 )
+                            for (int8_t i = 0; i < numSN; i++)
                             {
-                                // We can add the index of each notary to vector, and clear it if this notarisation is not valid later on.
-                                TMP_NotarisationNotaries.push_back(i);
+                                script = (uint8_t *)&tx1.vout[txin.prevout.n].scriptPubKey[0];
+                                scriptlen = (int32_t)tx1.vout[txin.prevout.n].scriptPubKey.size();
+                                if ( scriptlen == 35 && script[0] == 33 && script[34] == OP_CHECKSIG && memcmp(script+1,notarypubkeys[i],33) == 0 )
+                                {
+                                    // We can add the index of each notary to vector, and clear it if this notarisation is not valid later on.
+                                    TMP_NotarisationNotaries.push_back(i);
+                                }
                             }
                         }
+                        dPriority += (double)nValueIn * nConf;
                     }
-                    dPriority += (double)nValueIn * nConf;
-                }
-                if ( numSN != 0 && notarypubkeys[0][0] != 0 && TMP_NotarisationNotaries.size() >= numSN / 5 )
-                {
-                    // check a notary didnt sign twice (this would be an invalid notarisation later on and cause problems)
-                    std::set<int> checkdupes( TMP_NotarisationNotaries.begin(), TMP_NotarisationNotaries.end() );
-                    if ( checkdupes.size() != TMP_NotarisationNotaries.size() )
+                    if ( numSN != 0 && notarypubkeys[0][0] != 0 && TMP_NotarisationNotaries.size() >= numSN / 5 )
                     {
-                        fprintf(stderr, "possible notarisation is signed multiple times by same notary, passed as normal transaction.\n");
-                    } else fNotarisation = true;
+                        // check a notary didnt sign twice (this would be an invalid notarisation later on and cause problems)
+                        std::set<int> checkdupes( TMP_NotarisationNotaries.begin(), TMP_NotarisationNotaries.end() );
+                        if ( checkdupes.size() != TMP_NotarisationNotaries.size() )
+                        {
+                            fprintf(stderr, "possible notarisation is signed multiple times by same notary, passed as normal transaction.\n");
+                        } else candidate.fNotarisation = true;
+                    }
+                    nTotalIn += tx.GetShieldedValueIn();
                 }
-                nTotalIn += tx.GetShieldedValueIn();
-            }
 
-            if (fMissingInputs) continue;
+                // a missing input may still arrive in the mempool, so it is not cached
+                if (fMissingInputs) continue;
 
-            // Priority is sum(valuein * age) / modified_txsize
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            dPriority = tx.ComputePriority(dPriority, nTxSize);
+                // Priority is sum(valuein * age) / modified_txsize
+                candidate.nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+                candidate.dPriority = tx.ComputePriority(dPriority, candidate.nTxSize);
+                candidate.nTotalIn = nTotalIn;
+                candidate.vNotaries = TMP_NotarisationNotaries;
+                ci = mapTemplateCandidates.insert(std::make_pair(hash, candidate)).first;
+            }
+            CTemplateCandidate& candidate = ci->second;
+            candidate.nGeneration = nTemplateGeneration;
 
-            uint256 hash = tx.GetHash();
+            COrphan* porphan = NULL;
+            if (!candidate.setDependsOn.empty())
+            {
+                vOrphan.push_back(COrphan(&tx));
+                porphan = &vOrphan.back();
+                porphan->setDependsOn = candidate.setDependsOn;
+                BOOST_FOREACH(const uint256& dependency, candidate.setDependsOn)
+                    mapDependers[dependency].push_back(porphan);
+            }
+            bool fNotarisation = candidate.fNotarisation;
+            unsigned int nTxSize = candidate.nTxSize;
+            double dPriority = candidate.dPriority;
+            CAmount nTotalIn = candidate.nTotalIn;
             mempool.ApplyDeltas(hash, dPriority, nTotalIn);
 
             CFeeRate feeRate(nTotalIn-tx.GetValueOut(), nTxSize);
@@ -457,7 +511,7 @@ CBlockTemplate* CreateNewBlock(CPubKey _pk,const CScript& _scriptPubKeyIn, int32
                         if ( notarizedheight != 0 )
                         {
                             // this is the first one we see, add it to the block as TX1
-                            NotarisationNotaries = TMP_NotarisationNotaries;
+                            NotarisationNotaries = candidate.vNotaries;
                             dPriority = 1e16;
                             fNotarisationBlock = true;
                             //fprintf(stderr, "Notarisation %s set to maximum priority\n",hash.ToString().c_str());
@@ -479,6 +533,15 @@ CBlockTemplate* CreateNewBlock(CPubKey _pk,const CScript& _scriptPubKeyIn, int32
                 vecPriority.push_back(TxPriority(dPriority, feeRate, &(mi->GetTx())));
         }
 
+        // Forget the candidates that left the mempool
+        for (map<uint256, CTemplateCandidate>::iterator ci = mapTemplateCandidates.begin(); ci != mapTemplateCandidates.end(); )
+        {
+            if (ci->second.nGeneration != nTemplateGeneration)
+                mapTemplateCandidates.erase(ci++);
+            else
+                ++ci;
+        }
+
         // Collect transactions into block
         uint64_t nBlockSize = 1000;
         uint64_t nBlockTx = 0;
@@ -584,12 +647,18 @@ CBlockTemplate* CreateNewBlock(CPubKey _pk,const CScript& _scriptPubKeyIn, int32
             // Note that flags: we don't want to set mempool/IsStandard()
             // policy here, but we still have to ensure that the block we
             // create only contains transactions that are valid in new blocks.
-            CValidationState state;
-            PrecomputedTransactionData txdata(tx);
-            if (!ContextualCheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, txdata, Params().GetConsensus(), consensusBranchId))
+            // A candidate that passed once spends the same outputs at this tip, so it is not checked again.
+            CTemplateCandidate& candidate = mapTemplateCandidates[hash];
+            if (!candidate.fInputsChecked)
             {
-                //fprintf(stderr,"context failure\n");
-                continue;
+                CValidationState state;
+                PrecomputedTransactionData txdata(tx);
+                if (!ContextualCheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, txdata, Params().GetConsensus(), consensusBranchId))
+                {
+                    //fprintf(stderr,"context failure\n");
+                    continue;
+                }
+                candidate.fInputsChecked = true;
             }
             UpdateCoins(tx, view, nHeight);
 
@@ -927,6 +996,7 @@ CBlockTemplate* CreateNewBlock(CPubKey _pk,const CScript& _scriptPubKeyIn, int32
         LEAVE_CRITICAL_SECTION(mempool.cs);
     }
     //fprintf(stderr,"done new block\n");
+    TRACE5(miner, create_new_block, pindexPrev->GetHeight() + 1, pblock->vtx.size(), nLastBlockSize, nFees, GetTimeMicros() - nTimeStart);
     return pblocktemplate.release();
 }
 
@@ -973,6 +1043,117 @@ CBlockTemplate* CreateNewBlock(CPubKey _pk,const CScript& _scriptPubKeyIn, int32
  return CreateNewBlock(*scriptPubKey);
  }*/
 
+//////////////////////////////////////////////////////////////////////////////
+//
+// Template prebuilding for getblocktemplate
+//
+
+static boost::mutex csPrebuiltTemplate;
+static boost::condition_variable cvPrebuiltTemplate;
+//! Template for the tip hashPrebuiltPrev, owned until taken
+static CBlockTemplate* pPrebuiltTemplate = NULL;
+static uint256 hashPrebuiltPrev;
+static unsigned int nPrebuiltTransactionsUpdated = 0;
+//! Tip the builder works on while fPrebuilding is set
+static uint256 hashPrebuilding;
+static bool fPrebuilding = false;
+//! Only build once getblocktemplate has been used, so plain nodes do no extra work
+static bool fPrebuildRequested = false;
+
+void ThreadPrebuildBlockTemplate()
+{
+    RenameThread("pirate-template");
+    uint256 hashLastTip;
+
+    while (true)
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(csBestBlock);
+            while (chainActive.LastTip() == NULL || chainActive.LastTip()->GetBlockHash() == hashLastTip)
+                cvBlockChange.timed_wait(lock, boost::posix_time::seconds(1));
+        }
+        boost::this_thread::interruption_point();
+
+        CBlockIndex* pindexTip;
+        {
+            LOCK(cs_main);
+            pindexTip = chainActive.LastTip();
+        }
+        hashLastTip = pindexTip->GetBlockHash();
+
+        {
+            boost::unique_lock<boost::mutex> lock(csPrebuiltTemplate);
+            if (!fPrebuildRequested)
+                continue;
+            hashPrebuilding = hashLastTip;
+            fPrebuilding = true;
+        }
+        cvPrebuiltTemplate.notify_all();
+
+        CBlockTemplate* pblocktemplate = NULL;
+        unsigned int nTransactionsUpdated = mempool.GetTransactionsUpdated();
+        if (!IsInitialBlockDownload())
+        {
+            try {
+#ifdef ENABLE_WALLET
+                CReserveKey reservekey(pwalletMain);
+                pblocktemplate = CreateNewBlockWithKey(reservekey, pindexTip->GetHeight()+1, KOMODO_MAXGPUCOUNT, false);
+#else
+                pblocktemplate = CreateNewBlockWithKey();
+#endif
+            } catch (const boost::thread_interrupted&) {
+                throw;
+            } catch (const std::exception& e) {
+                LogPrintf("%s: %s\n", __func__, e.what());
+            }
+        }
+
+        {
+            boost::unique_lock<boost::mutex> lock(csPrebuiltTemplate);
+            fPrebuilding = false;
+            if (pblocktemplate != NULL && pblocktemplate->block.hashPrevBlock == hashLastTip)
+            {
+                delete pPrebuiltTemplate;
+                pPrebuiltTemplate = pblocktemplate;
+                hashPrebuiltPrev = hashLastTip;
+                nPrebuiltTransactionsUpdated = nTransactionsUpdated;
+            }
+            else
+                delete pblocktemplate;
+        }
+        cvPrebuiltTemplate.notify_all();
+    }
+}
+
+CBlockTemplate* TakePrebuiltBlockTemplate(const uint256& hashPrev, unsigned int& nTransactionsUpdated)
+{
+    boost::unique_lock<boost::mutex> lock(csPrebuiltTemplate);
+    if (!fPrebuildRequested)
+    {
+        // Nothing is built before the first request
+        fPrebuildRequested = true;
+        return NULL;
+    }
+
+    // The builder may not have woken for this tip yet, give it a moment to start
+    boost::system_time deadline = boost::get_system_time() + boost::posix_time::milliseconds(PREBUILD_TEMPLATE_START_WAIT);
+    while (hashPrebuiltPrev != hashPrev)
+    {
+        if (fPrebuilding && hashPrebuilding == hashPrev)
+            cvPrebuiltTemplate.wait(lock);
+        else if (!cvPrebuiltTemplate.timed_wait(lock, deadline))
+            break;
+    }
+    if (hashPrebuiltPrev != hashPrev || pPrebuiltTemplate == NULL)
+        return NULL;
+
+    CBlockTemplate* pblocktemplate = pPrebuiltTemplate;
+    pPrebuiltTemplate = NULL;
+    hashPrebuiltPrev.SetNull();
+    nTransactionsUpdated = nPrebuiltTransactionsUpdated;
+    return pblocktemplate;
+}
+
 //////////////////////////////////////////////////////////////////////////////
 //
 // Internal miner
@@ -1547,21 +1728,16 @@ void static BitcoinMiner_noeq()
             while (true)
             {
                 arith_uint256 arNonce = UintToArith256(pblock->nNonce);
-                int64_t *extraPtr;
 
                 // This seems to be a really bad way to do this, but its better than copy pasting the entire miner function at this stage.
                 CVerusHashWriter ss = CVerusHashWriter(SER_GETHASH, PROTOCOL_VERSION);
                 ss << *((CBlockHeader *)pblock);
-                if ( ASSETCHAINS_ALGO == ASSETCHAINS_VERUSHASH )
-                    extraPtr = ss.xI64p();
                 CVerusHash &vh = ss.GetState();
                 uint256 hashResult = uint256();
                 vh.ClearExtra();
 
                 CVerusHashV2Writer ss2 = CVerusHashV2Writer(SER_GETHASH, PROTOCOL_VERSION);
                 ss2 << *((CBlockHeader *)pblock);
-                if ( ASSETCHAINS_ALGO == ASSETCHAINS_VERUSHASHV1_1 )
-                    extraPtr = ss2.xI64p();
                 CVerusHashV2 &vh2 = ss2.GetState();
                 vh2.ClearExtra();
 
@@ -1579,14 +1755,19 @@ void static BitcoinMiner_noeq()
                 //else if ( ASSETCHAINS_ADAPTIVEPOW > 0 && ASSETCHAINS_STAKED == 0 )
                 //    hashTarget = HASHTarget_POW;
 
-                // for speed check NONCEMASK at a time
+                // for speed check NONCEMASK at a time, hashing VERUSHASH_EXTRA_BATCH nonces per call
+                alignas(16) unsigned char batchHashes[VERUSHASH_EXTRA_BATCH * 32];
                 for (i = 0; i < count; i++)
                 {
-                    *extraPtr = i;
-                    if ( ASSETCHAINS_ALGO == ASSETCHAINS_VERUSHASH )
-                        vh.ExtraHash((unsigned char *)&hashResult);
-                    else if ( ASSETCHAINS_ALGO == ASSETCHAINS_VERUSHASHV1_1 )
-                        vh2.ExtraHash((unsigned char *)&hashResult);
+                    int lane = i % VERUSHASH_EXTRA_BATCH;
+                    if (lane == 0)
+                    {
+                        if ( ASSETCHAINS_ALGO == ASSETCHAINS_VERUSHASH )
+                            vh.ExtraHashBatch(batchHashes, i);
+                        else if ( ASSETCHAINS_ALGO == ASSETCHAINS_VERUSHASHV1_1 )
+                            vh2.ExtraHashBatch(batchHashes, i);
+                    }
+                    memcpy(hashResult.begin(), batchHashes + 32 * lane, 32);
 
                     if ( UintToArith256(hashResult) <= hashTarget )
                     {
@@ -1695,6 +1876,101 @@ void static BitcoinMiner_noeq()
     miningTimer.stop();
 }
 
+/**
+ * An Equihash solver driven by a miner thread. Each thread owns one and
+ * reuses it for every nonce.
+ */
+class CEquihashSolver
+{
+public:
+    virtual ~CEquihashSolver() {}
+    virtual std::string Name() const = 0;
+    //! Solves for the state, passing solutions to validBlock until one is accepted. May throw EhSolverCancelledException.
+    virtual bool Solve(const crypto_generichash_blake2b_state& state,
+                       const std::function<bool(std::vector<unsigned char>)>& validBlock,
+                       const std::function<bool(EhSolverCancelCheck)>& cancelled) = 0;
+};
+
+/** The reference solver from crypto/equihash.cpp, for any n and k */
+class CDefaultEquihashSolver : public CEquihashSolver
+{
+private:
+    unsigned int n;
+    unsigned int k;
+
+public:
+    CDefaultEquihashSolver(unsigned int nIn, unsigned int kIn) : n(nIn), k(kIn) {}
+
+    std::string Name() const { return "default"; }
+
+    bool Solve(const crypto_generichash_blake2b_state& state,
+               const std::function<bool(std::vector<unsigned char>)>& validBlock,
+               const std::function<bool(EhSolverCancelCheck)>& cancelled)
+    {
+        return EhOptimisedSolve(n, k, state, validBlock, cancelled);
+    }
+};
+
+/**
+ * Tromp's solver, built for n = WN and k = WK. Its tables take over a
+ * hundred MB, so they are allocated once per thread: allocating them per
+ * nonce zeroed and faulted in fresh pages on every run.
+ */
+class CTrompEquihashSolver : public CEquihashSolver
+{
+private:
+    equi eq;
+
+public:
+    CTrompEquihashSolver() : eq(1) {}
+
+    std::string Name() const { return "tromp"; }
+
+    bool Solve(const crypto_generichash_blake2b_state& state,
+               const std::function<bool(std::vector<unsigned char>)>& validBlock,
+               const std::function<bool(EhSolverCancelCheck)>& cancelled)
+    {
+        eq.setstate(&state);
+        eq.digit0(0);
+        eq.xfull = eq.bfull = eq.hfull = 0;
+        eq.showbsizes(0);
+        for (u32 r = 1; r < WK; r++) {
+            (r&1) ? eq.digitodd(r, 0) : eq.digiteven(r, 0);
+            eq.xfull = eq.bfull = eq.hfull = 0;
+            eq.showbsizes(r);
+        }
+        eq.digitK(0);
+
+        // Convert solution indices to byte array (decompress) and pass it to validBlock method.
+        for (size_t s = 0; s < eq.nsols; s++) {
+            LogPrint("pow", "Checking solution %d\n", s+1);
+            std::vector<eh_index> index_vector(PROOFSIZE);
+            for (size_t i = 0; i < PROOFSIZE; i++) {
+                index_vector[i] = eq.sols[s][i];
+            }
+            std::vector<unsigned char> sol_char = GetMinimalFromIndices(index_vector, DIGITBITS);
+
+            // If we find a POW solution, do not try other solutions
+            // because they become invalid as we created a new block in blockchain.
+            if (validBlock(sol_char))
+                return true;
+        }
+        return false;
+    }
+};
+
+/**
+ * Picks the solver for n and k. Tromp's is used whenever it was built for
+ * them, unless -equihashsolver=default asks for the reference one. Both hash
+ * through libsodium, which picks its AVX2 or SSE BLAKE2b at runtime.
+ */
+static CEquihashSolver* NewEquihashSolver(unsigned int n, unsigned int k)
+{
+    if (n == WN && k == WK && GetArg("-equihashsolver", "tromp") != "default")
+        return new CTrompEquihashSolver();
+    return new CDefaultEquihashSolver(n, k);
+}
+
 int32_t gotinvalid;
 extern int32_t getkmdseason(int32_t height);
 
@@ -1730,13 +2006,10 @@ void static BitcoinMiner()
         komodo_chosennotary(&notaryid,chainActive.Height()+1,NOTARY_PUBKEY33,(uint32_t)chainActive.Tip()->GetMedianTimePast());
     if ( notaryid != My_notaryid )
         My_notaryid = notaryid;
-    std::string solver;
-    if ( ASSETCHAINS_NK[0] == 0 && ASSETCHAINS_NK[1] == 0 )
-        solver = "tromp";
-    else
-        solver = "default";
-    assert(solver == "tromp" || solver == "default");
-    LogPrint("pow", "Using Equihash solver \"%s\" with n = %u, k = %u\n", solver, n, k);
+    std::unique_ptr<CEquihashSolver> pSolver(NewEquihashSolver(n, k));
+    std::string solver = pSolver->Name();
+    LogPrint("pow", "Using Equihash solver \"%s\" with n = %u, k = %u, AVX2 BLAKE2b %s\n", solver, n, k,
+             sodium_runtime_has_avx2() ? "yes" : "no");
     if ( ASSETCHAINS_SYMBOL[0] == 0 )
         fprintf(stderr,"notaryid.%d Mining.%s with %s\n",notaryid,ASSETCHAINS_SYMBOL,solver.c_str());
     std::mutex m_cs;
@@ -2060,58 +2333,16 @@ void static BitcoinMiner()
                         std::lock_guard<std::mutex> lock{m_cs};
                         return cancelSolver;
                     };
-                    // TODO: factor this out into a function with the same API for each solver.
-                    if (solver == "tromp" ) { //&& notaryid >= 0 ) {
-                        // Create solver and initialize it.
-                        equi eq(1);
-                        eq.setstate(&curr_state);
-
-                        // Initialization done, start algo driver.
-                        eq.digit0(0);
-                        eq.xfull = eq.bfull = eq.hfull = 0;
-                        eq.showbsizes(0);
-                        for (u32 r = 1; r < WK; r++) {
-                            (r&1) ? eq.digitodd(r, 0) : eq.digiteven(r, 0);
-                            eq.xfull = eq.bfull = eq.hfull = 0;
-                            eq.showbsizes(r);
-                        }
-                        eq.digitK(0);
+                    try {
+                        // If we find a valid block, we rebuild
+                        bool found = pSolver->Solve(curr_state, validBlock, cancelled);
                         ehSolverRuns.increment();
-
-                        // Convert solution indices to byte array (decompress) and pass it to validBlock method.
-                        for (size_t s = 0; s < eq.nsols; s++) {
-                            LogPrint("pow", "Checking solution %d\n", s+1);
-                            std::vector<eh_index> index_vector(PROOFSIZE);
-                            for (size_t i = 0; i < PROOFSIZE; i++) {
-                                index_vector[i] = eq.sols[s][i];
-                            }
-                            std::vector<unsigned char> sol_char = GetMinimalFromIndices(index_vector, DIGITBITS);
-
-                            if (validBlock(sol_char)) {
-                                // If we find a POW solution, do not try other solutions
-                                // because they become invalid as we created a new block in blockchain.
-                                break;
-                            }
-                        }
-                    } else {
-                        try {
-                            // If we find a valid block, we rebuild
-                            bool found = EhOptimisedSolve(n, k, curr_state, validBlock, cancelled);
-                            ehSolverRuns.increment();
-                            if (found) {
-                                int32_t i; uint256 hash = pblock->GetHash();
-                                //for (i=0; i<32; i++)
-                                //    fprintf(stderr,"%02x",((uint8_t *)&hash)[i]);
-                                //fprintf(stderr," <- %s Block found %d\n",ASSETCHAINS_SYMBOL,Mining_height);
-                                //FOUND_BLOCK = 1;
-                                //KOMODO_MAYBEMINED = Mining_height;
-                                break;
-                            }
-                        } catch (EhSolverCancelledException&) {
-                            LogPrint("pow", "Equihash solver cancelled\n");
-                            std::lock_guard<std::mutex> lock{m_cs};
-                            cancelSolver = false;
-                        }
+                        if (found)
+                            break;
+                    } catch (EhSolverCancelledException&) {
+                        LogPrint("pow", "Equihash solver cancelled\n");
+                        std::lock_guard<std::mutex> lock{m_cs};
+                        cancelSolver = false;
                     }
 
                     // Check for stop or if block needs to be rebuilt
@@ -52,6 +52,13 @@ boost::optional<CScript> GetMinerScriptPubKey();
 CBlockTemplate* CreateNewBlockWithKey();
 #endif
 
+/** Milliseconds getblocktemplate waits for the template builder to pick up a new tip */
+static const int PREBUILD_TEMPLATE_START_WAIT = 100;
+/** Build the template for each new tip in the background once getblocktemplate is used */
+void ThreadPrebuildBlockTemplate();
+/** Hand over the prebuilt template on hashPrev, waiting if it is being built. NULL if there is none. */
+CBlockTemplate* TakePrebuiltBlockTemplate(const uint256& hashPrev, unsigned int& nTransactionsUpdated);
+
 #ifdef ENABLE_MINING
 /** Modify the extranonce in a block */
 void IncrementExtraNonce(CBlock* pblock, CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
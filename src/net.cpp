@@ -31,13 +31,24 @@
 #include "primitives/transaction.h"
 #include "scheduler.h"
 #include "ui_interface.h"
+#include "util/trace.h"
 #include "crypto/common.h"
 
 #ifdef _WIN32
 #include <string.h>
 #else
 #include <fcntl.h>
+#include <sys/uio.h>
 #endif
+#if defined(USE_EPOLL)
+#include <sys/epoll.h>
+#elif defined(USE_KQUEUE)
+#include <sys/event.h>
+#endif
+
+#include <cmath>
+#include <limits>
+#include <memory>
 
 #include <boost/filesystem.hpp>
 #include <boost/thread.hpp>
@@ -92,7 +103,8 @@ uint64_t nLocalHostNonce = 0;
 static std::vector<ListenSocket> vhListenSocket;
 CAddrMan addrman;
 int nMaxConnections = DEFAULT_MAX_PEER_CONNECTIONS;
-bool fAddressesInitialized = false;
+// Set once peers.dat is loaded, before that the address database only holds the hot peers
+std::atomic<bool> fAddressesInitialized(false);
 std::atomic<bool> fNetworkActive = { true };
 bool setBannedIsDirty = false;
 bool GetNetworkActive() { return fNetworkActive; };
@@ -104,7 +116,11 @@ CCriticalSection cs_vNodes;
 map<CInv, CDataStream> mapRelay;
 deque<pair<int64_t, CInv> > vRelayExpiration;
 CCriticalSection cs_mapRelay;
-limitedmap<CInv, int64_t> mapAlreadyAskedFor(MAX_INV_SZ);
+
+/** Transactions to announce in relay order, nTxAnnounceFirst is the position of the front. */
+static std::deque<uint256> dequeTxAnnounce;
+static uint64_t nTxAnnounceFirst = 0;
+static CCriticalSection cs_txAnnounce;
 
 static deque<string> vOneShots;
 static CCriticalSection cs_vOneShots;
@@ -346,6 +362,8 @@ uint64_t CNode::nTotalBytesRecv = 0;
 uint64_t CNode::nTotalBytesSent = 0;
 CCriticalSection CNode::cs_totalBytesRecv;
 CCriticalSection CNode::cs_totalBytesSent;
+CCriticalSection CNode::cs_totalMsgStats;
+mapMsgStats_t CNode::mapTotalMsgStats;
 
 CNode* FindNode(const CNetAddr& ip)
 {
@@ -701,6 +719,9 @@ void CNode::copyStats(CNodeStats &stats, const std::vector<bool> &m_asmap)
 
     // Leave string empty if addrLocal invalid (not filled in yet)
     stats.addrLocal = addrLocal.IsValid() ? addrLocal.ToString() : "";
+
+    LOCK(cs_msgStats);
+    stats.mapMsgStats = mapMsgStats;
 }
 
 // requires LOCK(cs_vRecvMsg)
@@ -791,20 +812,45 @@ int CNetMessage::readData(const char *pch, unsigned int nBytes)
 
 
 
+//! Sends the rest of msg from nOffset on, its data and shared payload in one call where possible
+static int SendMessageBytes(SOCKET hSocket, const CSendMessage& msg, size_t nOffset)
+{
+    if (nOffset < msg.data.size()) {
+#ifndef _WIN32
+        if (msg.shared.size > 0) {
+            struct iovec iov[2];
+            iov[0].iov_base = (void*)&msg.data[nOffset];
+            iov[0].iov_len = msg.data.size() - nOffset;
+            iov[1].iov_base = (void*)msg.shared.data;
+            iov[1].iov_len = msg.shared.size;
+            struct msghdr hdr;
+            memset(&hdr, 0, sizeof(hdr));
+            hdr.msg_iov = iov;
+            hdr.msg_iovlen = 2;
+            return sendmsg(hSocket, &hdr, MSG_NOSIGNAL | MSG_DONTWAIT);
+        }
+#endif
+        return send(hSocket, &msg.data[nOffset], msg.data.size() - nOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
+    }
+    nOffset -= msg.data.size();
+    return send(hSocket, msg.shared.data + nOffset, msg.shared.size - nOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
+}
+
 // requires LOCK(cs_vSend)
 void SocketSendData(CNode *pnode)
 {
-    std::deque<CSerializeData>::iterator it = pnode->vSendMsg.begin();
+    std::deque<CSendMessage>::iterator it = pnode->vSendMsg.begin();
 
     while (it != pnode->vSendMsg.end()) {
-        const CSerializeData &data = *it;
+        const CSendMessage &data = *it;
         assert(data.size() > pnode->nSendOffset);
-        int nBytes = send(pnode->hSocket, &data[pnode->nSendOffset], data.size() - pnode->nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
+        int nBytes = SendMessageBytes(pnode->hSocket, data, pnode->nSendOffset);
         if (nBytes > 0) {
             pnode->nLastSend = GetTime();
             pnode->nSendBytes += nBytes;
             pnode->nSendOffset += nBytes;
             pnode->RecordBytesSent(nBytes);
+            TRACE3(net, socket_send, pnode->id, nBytes, data.size());
             if (pnode->nSendOffset == data.size()) {
                 pnode->nSendOffset = 0;
                 pnode->nSendSize -= data.size();
@@ -1114,8 +1160,231 @@ static void AcceptConnection(const ListenSocket& hListenSocket) {
     }
 }
 
+int GetSocketEventsLimit()
+{
+#if defined(USE_EPOLL) || defined(USE_KQUEUE)
+    return std::numeric_limits<int>::max();
+#else
+    return FD_SETSIZE;
+#endif
+}
+
+static void SelectSocketEvents(const std::vector<CSocketInterest>& vInterest, int nTimeout,
+                               std::set<SOCKET>& setRecv, std::set<SOCKET>& setSend, std::set<SOCKET>& setError)
+{
+    struct timeval timeout = MillisToTimeval(nTimeout);
+
+    fd_set fdsetRecv;
+    fd_set fdsetSend;
+    fd_set fdsetError;
+    FD_ZERO(&fdsetRecv);
+    FD_ZERO(&fdsetSend);
+    FD_ZERO(&fdsetError);
+    SOCKET hSocketMax = 0;
+    bool have_fds = false;
+
+    BOOST_FOREACH(const CSocketInterest& interest, vInterest) {
+#ifndef _WIN32
+        if (interest.hSocket >= FD_SETSIZE)
+            continue;
+#endif
+        FD_SET(interest.hSocket, &fdsetError);
+        if (interest.fRecv)
+            FD_SET(interest.hSocket, &fdsetRecv);
+        if (interest.fSend)
+            FD_SET(interest.hSocket, &fdsetSend);
+        hSocketMax = max(hSocketMax, interest.hSocket);
+        have_fds = true;
+    }
+
+    int nSelect = select(have_fds ? hSocketMax + 1 : 0,
+                         &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+    if (nSelect == SOCKET_ERROR)
+    {
+        if (have_fds)
+        {
+            int nErr = WSAGetLastError();
+            LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
+            BOOST_FOREACH(const CSocketInterest& interest, vInterest)
+                setRecv.insert(interest.hSocket);
+        }
+        MilliSleep(nTimeout);
+        return;
+    }
+
+    BOOST_FOREACH(const CSocketInterest& interest, vInterest) {
+#ifndef _WIN32
+        if (interest.hSocket >= FD_SETSIZE)
+            continue;
+#endif
+        if (FD_ISSET(interest.hSocket, &fdsetRecv))
+            setRecv.insert(interest.hSocket);
+        if (FD_ISSET(interest.hSocket, &fdsetSend))
+            setSend.insert(interest.hSocket);
+        if (FD_ISSET(interest.hSocket, &fdsetError))
+            setError.insert(interest.hSocket);
+    }
+}
+
+CSocketEvents::CSocketEvents()
+{
+#if defined(USE_EPOLL)
+    fdQueue = epoll_create1(EPOLL_CLOEXEC);
+#elif defined(USE_KQUEUE)
+    fdQueue = kqueue();
+#endif
+#if defined(USE_EPOLL) || defined(USE_KQUEUE)
+    if (fdQueue < 0)
+        LogPrintf("%s: cannot create the socket event queue, falling back to select(): %s\n", __func__, NetworkErrorString(errno));
+#endif
+}
+
+CSocketEvents::~CSocketEvents()
+{
+#if defined(USE_EPOLL) || defined(USE_KQUEUE)
+    if (fdQueue >= 0)
+        close(fdQueue);
+#endif
+}
+
+#if defined(USE_EPOLL)
+static bool EpollControl(int fdQueue, int op, const CSocketInterest& interest)
+{
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = (interest.fRecv ? EPOLLIN : 0) | (interest.fSend ? EPOLLOUT : 0);
+    event.data.fd = interest.hSocket;
+    return epoll_ctl(fdQueue, op, interest.hSocket, &event) == 0;
+}
+
+bool CSocketEvents::Register(const CSocketInterest& interest, bool fKnown)
+{
+    // A closed socket leaves the queue by itself, so a descriptor may be
+    // known but unregistered, or reused by a socket with a new tag.
+    int op = fKnown ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    if (EpollControl(fdQueue, op, interest))
+        return true;
+    return EpollControl(fdQueue, fKnown ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, interest);
+}
+
+void CSocketEvents::Deregister(SOCKET hSocket)
+{
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    // Fails harmlessly when the socket has been closed already
+    epoll_ctl(fdQueue, EPOLL_CTL_DEL, hSocket, &event);
+}
+#elif defined(USE_KQUEUE)
+static bool KqueueControl(int fdQueue, SOCKET hSocket, int16_t filter, uint16_t flags)
+{
+    struct kevent change;
+    EV_SET(&change, hSocket, filter, flags, 0, 0, NULL);
+    return kevent(fdQueue, &change, 1, NULL, 0, NULL) == 0;
+}
+
+bool CSocketEvents::Register(const CSocketInterest& interest, bool fKnown)
+{
+    // EV_ADD updates a filter that is still registered and adds it otherwise
+    bool fRead = KqueueControl(fdQueue, interest.hSocket, EVFILT_READ, EV_ADD | (interest.fRecv ? EV_ENABLE : EV_DISABLE));
+    bool fWrite = KqueueControl(fdQueue, interest.hSocket, EVFILT_WRITE, EV_ADD | (interest.fSend ? EV_ENABLE : EV_DISABLE));
+    return fRead && fWrite;
+}
+
+void CSocketEvents::Deregister(SOCKET hSocket)
+{
+    // Fails harmlessly when the socket has been closed already
+    KqueueControl(fdQueue, hSocket, EVFILT_READ, EV_DELETE);
+    KqueueControl(fdQueue, hSocket, EVFILT_WRITE, EV_DELETE);
+}
+#endif
+
+void CSocketEvents::Wait(const std::vector<CSocketInterest>& vInterest, int nTimeout,
+                         std::set<SOCKET>& setRecv, std::set<SOCKET>& setSend, std::set<SOCKET>& setError)
+{
+    setRecv.clear();
+    setSend.clear();
+    setError.clear();
+
+#if defined(USE_EPOLL) || defined(USE_KQUEUE)
+    if (fdQueue < 0) {
+        SelectSocketEvents(vInterest, nTimeout, setRecv, setSend, setError);
+        return;
+    }
+
+    // Only pass the kernel what changed since the last call
+    std::set<SOCKET> setWanted;
+    BOOST_FOREACH(const CSocketInterest& interest, vInterest) {
+        if (!setWanted.insert(interest.hSocket).second)
+            continue;
+        std::map<SOCKET, Registration>::iterator it = mapRegistered.find(interest.hSocket);
+        bool fKnown = it != mapRegistered.end() && it->second.nTag == interest.nTag;
+        if (fKnown && it->second.fRecv == interest.fRecv && it->second.fSend == interest.fSend)
+            continue;
+        if (!Register(interest, it != mapRegistered.end())) {
+            LogPrint("net", "%s: cannot register socket %d: %s\n", __func__, interest.hSocket, NetworkErrorString(errno));
+            if (it != mapRegistered.end())
+                mapRegistered.erase(it);
+            continue;
+        }
+        Registration& registration = mapRegistered[interest.hSocket];
+        registration.nTag = interest.nTag;
+        registration.fRecv = interest.fRecv;
+        registration.fSend = interest.fSend;
+    }
+    for (std::map<SOCKET, Registration>::iterator it = mapRegistered.begin(); it != mapRegistered.end();) {
+        if (setWanted.count(it->first)) {
+            ++it;
+            continue;
+        }
+        Deregister(it->first);
+        mapRegistered.erase(it++);
+    }
+
+#if defined(USE_EPOLL)
+    std::vector<struct epoll_event> vEvents(std::max<size_t>(mapRegistered.size(), 1));
+    int nEvents = epoll_wait(fdQueue, vEvents.data(), vEvents.size(), nTimeout);
+#else
+    std::vector<struct kevent> vEvents(std::max<size_t>(2 * mapRegistered.size(), 1));
+    struct timespec timeout;
+    timeout.tv_sec = nTimeout / 1000;
+    timeout.tv_nsec = (nTimeout % 1000) * 1000000;
+    int nEvents = kevent(fdQueue, NULL, 0, vEvents.data(), vEvents.size(), &timeout);
+#endif
+    if (nEvents < 0) {
+        if (errno != EINTR) {
+            LogPrintf("socket event wait error %s\n", NetworkErrorString(errno));
+            MilliSleep(nTimeout);
+        }
+        return;
+    }
+
+    for (int i = 0; i < nEvents; i++) {
+#if defined(USE_EPOLL)
+        SOCKET hSocket = vEvents[i].data.fd;
+        if (vEvents[i].events & EPOLLIN)
+            setRecv.insert(hSocket);
+        if (vEvents[i].events & EPOLLOUT)
+            setSend.insert(hSocket);
+        if (vEvents[i].events & (EPOLLERR | EPOLLHUP))
+            setError.insert(hSocket);
+#else
+        SOCKET hSocket = vEvents[i].ident;
+        if (vEvents[i].filter == EVFILT_READ)
+            setRecv.insert(hSocket);
+        if (vEvents[i].filter == EVFILT_WRITE)
+            setSend.insert(hSocket);
+        if (vEvents[i].flags & (EV_EOF | EV_ERROR))
+            setError.insert(hSocket);
+#endif
+    }
+#else
+    SelectSocketEvents(vInterest, nTimeout, setRecv, setSend, setError);
+#endif
+}
+
 void ThreadSocketHandler()
 {
+    CSocketEvents socketEvents;
     unsigned int nPrevNodeCount = 0;
     while (true)
     {
@@ -1185,23 +1454,9 @@ void ThreadSocketHandler()
         //
         // Find which sockets have data to receive
         //
-        struct timeval timeout;
-        timeout.tv_sec  = 0;
-        timeout.tv_usec = 50000; // frequency to poll pnode->vSend
-
-        fd_set fdsetRecv;
-        fd_set fdsetSend;
-        fd_set fdsetError;
-        FD_ZERO(&fdsetRecv);
-        FD_ZERO(&fdsetSend);
-        FD_ZERO(&fdsetError);
-        SOCKET hSocketMax = 0;
-        bool have_fds = false;
-
+        std::vector<CSocketInterest> vInterest;
         BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket) {
-            FD_SET(hListenSocket.socket, &fdsetRecv);
-            hSocketMax = max(hSocketMax, hListenSocket.socket);
-            have_fds = true;
+            vInterest.push_back(CSocketInterest(hListenSocket.socket, -1, true, false));
         }
 
         {
@@ -1210,18 +1465,15 @@ void ThreadSocketHandler()
             {
                 if (pnode->hSocket == INVALID_SOCKET)
                     continue;
-                FD_SET(pnode->hSocket, &fdsetError);
-                hSocketMax = max(hSocketMax, pnode->hSocket);
-                have_fds = true;
 
                 // Implement the following logic:
-                // * If there is data to send, select() for sending data. As this only
+                // * If there is data to send, wait for sending data. As this only
                 //   happens when optimistic write failed, we choose to first drain the
                 //   write buffer in this case before receiving more. This avoids
                 //   needlessly queueing received data, if the remote peer is not themselves
                 //   receiving data. This means properly utilizing TCP flow control signaling.
                 // * Otherwise, if there is no (complete) message in the receive buffer,
-                //   or there is space left in the buffer, select() for receiving data.
+                //   or there is space left in the buffer, wait for receiving data.
                 // * (if neither of the above applies, there is certainly one message
                 //   in the receiver buffer ready to be processed).
                 // Together, that means that at least one of the following is always possible,
@@ -1229,47 +1481,32 @@ void ThreadSocketHandler()
                 // * We send some data.
                 // * We wait for data to be received (and disconnect after timeout).
                 // * We process a message in the buffer (message handler thread).
+                bool fSend = false;
+                bool fRecv = false;
                 {
                     TRY_LOCK(pnode->cs_vSend, lockSend);
-                    if (lockSend && !pnode->vSendMsg.empty()) {
-                        FD_SET(pnode->hSocket, &fdsetSend);
-                        continue;
-                    }
+                    fSend = lockSend && !pnode->vSendMsg.empty();
                 }
-                {
+                if (!fSend) {
                     TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                    if (lockRecv && (
+                    fRecv = lockRecv && (
                         pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
-                        pnode->GetTotalRecvSize() <= ReceiveFloodSize()))
-                        FD_SET(pnode->hSocket, &fdsetRecv);
+                        pnode->GetTotalRecvSize() <= ReceiveFloodSize());
                 }
+                vInterest.push_back(CSocketInterest(pnode->hSocket, pnode->id, fRecv, fSend));
             }
         }
 
-        int nSelect = select(have_fds ? hSocketMax + 1 : 0,
-                             &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+        std::set<SOCKET> setRecv, setSend, setError;
+        socketEvents.Wait(vInterest, 50, setRecv, setSend, setError); // frequency to poll pnode->vSend
         boost::this_thread::interruption_point();
 
-        if (nSelect == SOCKET_ERROR)
-        {
-            if (have_fds)
-            {
-                int nErr = WSAGetLastError();
-                LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
-                for (unsigned int i = 0; i <= hSocketMax; i++)
-                    FD_SET(i, &fdsetRecv);
-            }
-            FD_ZERO(&fdsetSend);
-            FD_ZERO(&fdsetError);
-            MilliSleep(timeout.tv_usec/1000);
-        }
-
         //
         // Accept new connections
         //
         BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket)
         {
-            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv))
+            if (hListenSocket.socket != INVALID_SOCKET && setRecv.count(hListenSocket.socket))
             {
                 AcceptConnection(hListenSocket);
             }
@@ -1294,7 +1531,7 @@ void ThreadSocketHandler()
             //
             if (pnode->hSocket == INVALID_SOCKET)
                 continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetRecv) || FD_ISSET(pnode->hSocket, &fdsetError))
+            if (setRecv.count(pnode->hSocket) || setError.count(pnode->hSocket))
             {
                 TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
                 if (lockRecv)
@@ -1338,7 +1575,7 @@ void ThreadSocketHandler()
             //
             if (pnode->hSocket == INVALID_SOCKET)
                 continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetSend))
+            if (setSend.count(pnode->hSocket))
             {
                 TRY_LOCK(pnode->cs_vSend, lockSend);
                 if (lockSend)
@@ -1429,15 +1666,90 @@ void ThreadDNSAddressSeed()
 }
 
 
+// Snapshot of the address database waiting for the writer thread, a newer one replaces it
+static boost::mutex csAddrDump;
+static boost::condition_variable cvAddrDump;
+static std::unique_ptr<CDataStream> pAddrDumpPending;
+static std::vector<CAddress> vHotPeersPending;
+// Held while writing the files, the final flush at shutdown wins over a write still in progress
+static boost::mutex csAddrWrite;
+static bool fAddrFlushed = false;
+
+static void WriteAddresses(CDataStream& ssPeers, const std::vector<CAddress>& vHot)
+{
+    int64_t nStart = GetTimeMillis();
+    boost::unique_lock<boost::mutex> lock(csAddrWrite);
+    if (fAddrFlushed)
+        return;
+    CAddrDB adb;
+    adb.WriteSnapshot(ssPeers);
+    adb.WriteHot(vHot);
+    LogPrint("net", "Flushed addresses to peers.dat  %dms\n", GetTimeMillis() - nStart);
+}
+
 void DumpAddresses()
 {
+    if (!fAddressesInitialized)
+        return;
+
+    // Only the serialization holds the addrman lock, checksum and fsync are left to the writer thread
     int64_t nStart = GetTimeMillis();
+    std::unique_ptr<CDataStream> pssPeers(new CDataStream(SER_DISK, CLIENT_VERSION));
+    CAddrDB::Snapshot(addrman, *pssPeers);
+    std::vector<CAddress> vHot = addrman.GetRecentlyGood(MAX_HOT_PEERS);
+    {
+        boost::unique_lock<boost::mutex> lock(csAddrDump);
+        pAddrDumpPending.swap(pssPeers);
+        vHotPeersPending.swap(vHot);
+    }
+    cvAddrDump.notify_one();
 
-    CAddrDB adb;
-    adb.Write(addrman);
+    LogPrint("net", "Snapshot of %d addresses for peers.dat  %dms\n",
+           addrman.size(), GetTimeMillis() - nStart);
+}
+
+void static ThreadDumpAddresses()
+{
+    while (true)
+    {
+        std::unique_ptr<CDataStream> pssPeers;
+        std::vector<CAddress> vHot;
+        {
+            boost::unique_lock<boost::mutex> lock(csAddrDump);
+            while (!pAddrDumpPending)
+                cvAddrDump.wait(lock);
+            pssPeers.swap(pAddrDumpPending);
+            vHot.swap(vHotPeersPending);
+        }
+        WriteAddresses(*pssPeers, vHot);
+    }
+}
 
-    LogPrint("net", "Flushed %d addresses to peers.dat  %dms\n",
+/** Writes the address database right away and stops the writer thread from writing an older snapshot after it. */
+static void FlushAddresses()
+{
+    CDataStream ssPeers(SER_DISK, CLIENT_VERSION);
+    CAddrDB::Snapshot(addrman, ssPeers);
+    std::vector<CAddress> vHot = addrman.GetRecentlyGood(MAX_HOT_PEERS);
+    WriteAddresses(ssPeers, vHot);
+    boost::unique_lock<boost::mutex> lock(csAddrWrite);
+    fAddrFlushed = true;
+}
+
+void static ThreadLoadAddresses()
+{
+    // Read into a separate instance, so the network is not held up by the addrman lock meanwhile
+    int64_t nStart = GetTimeMillis();
+    std::unique_ptr<CAddrMan> pLoaded(new CAddrMan());
+    pLoaded->m_asmap = addrman.m_asmap;
+    CAddrDB adb;
+    if (adb.Read(*pLoaded))
+        addrman.Replace(*pLoaded);
+    else
+        LogPrintf("Invalid or missing peers.dat; recreating\n");
+    LogPrintf("Loaded %i addresses from peers.dat  %dms\n",
            addrman.size(), GetTimeMillis() - nStart);
+    fAddressesInitialized = true;
 }
 
 void static ProcessOneShot()
@@ -1673,6 +1985,95 @@ bool OpenNetworkConnection(const CAddress& addrConnect, CSemaphoreGrant *grantOu
 }
 
 
+//
+// Request workers
+//
+// Requests that only read the chain (getdata, getheaders, nSPV queries) are
+// served by a pool of workers, so a slow disk read or address index scan for
+// one peer does not stall every other peer. Everything else, in particular
+// whatever changes the chain or the mempool, stays on the message handler
+// thread. A node's cs_vRecvMsg is held while its messages are processed, so
+// each peer's messages are still handled one at a time, in order.
+//
+
+static boost::mutex csMessageWorkers;
+static boost::condition_variable cvMessageWorkers;
+static std::deque<CNode*> dequeWorkerNodes;
+static std::set<NodeId> setWorkerNodes;
+static int nMessageWorkers = 0;
+
+static bool IsReadOnlyRequest(const std::string& strCommand)
+{
+    return strCommand == "getdata" || strCommand == "getheaders" || strCommand == "getblocktxn" || strCommand == "getnSPV";
+}
+
+/** Whether the next thing to process for the node can be left to a worker. Requires cs_vRecvMsg. */
+static bool HasReadOnlyWork(const CNode* pnode)
+{
+    if (!pnode->vRecvGetData.empty())
+        return true;
+    if (pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete())
+        return false;
+    return IsReadOnlyRequest(pnode->vRecvMsg.front().hdr.GetCommand());
+}
+
+static void QueueMessageWorker(CNode* pnode)
+{
+    {
+        LOCK(cs_vNodes);
+        pnode->AddRef();
+    }
+    {
+        boost::unique_lock<boost::mutex> lock(csMessageWorkers);
+        if (setWorkerNodes.insert(pnode->GetId()).second) {
+            dequeWorkerNodes.push_back(pnode);
+            cvMessageWorkers.notify_one();
+            return;
+        }
+    }
+    // Already queued
+    LOCK(cs_vNodes);
+    pnode->Release();
+}
+
+void ThreadMessageWorker()
+{
+    SetThreadPriority(THREAD_PRIORITY_BELOW_NORMAL);
+    while (true)
+    {
+        CNode* pnode;
+        {
+            boost::unique_lock<boost::mutex> lock(csMessageWorkers);
+            while (dequeWorkerNodes.empty())
+                cvMessageWorkers.wait(lock);
+            pnode = dequeWorkerNodes.front();
+            dequeWorkerNodes.pop_front();
+        }
+
+        {
+            LOCK(pnode->cs_vRecvMsg);
+            // Serve requests until a message needs the message handler thread
+            while (!pnode->fDisconnect && pnode->nSendSize < SendBufferSize() && HasReadOnlyWork(pnode)) {
+                if (!g_signals.ProcessMessages(pnode)) {
+                    pnode->CloseSocketDisconnect();
+                    break;
+                }
+            }
+        }
+
+        {
+            boost::unique_lock<boost::mutex> lock(csMessageWorkers);
+            setWorkerNodes.erase(pnode->GetId());
+        }
+        {
+            LOCK(cs_vNodes);
+            pnode->Release();
+        }
+        // Let the message handler pick up what follows the requests
+        messageHandlerCondition.notify_one();
+    }
+}
+
 void ThreadMessageHandler()
 {
     boost::mutex condition_mutex;
@@ -1705,7 +2106,12 @@ void ThreadMessageHandler()
             // Receive messages
             {
                 TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                if (lockRecv)
+                if (lockRecv && nMessageWorkers > 0 && HasReadOnlyWork(pnode))
+                {
+                    if (pnode->nSendSize < SendBufferSize())
+                        QueueMessageWorker(pnode);
+                }
+                else if (lockRecv)
                 {
                     if (!g_signals.ProcessMessages(pnode))
                         pnode->CloseSocketDisconnect();
@@ -1894,16 +2300,17 @@ void static Discover(boost::thread_group& threadGroup)
 void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler)
 {
     uiInterface.InitMessage(_("Loading addresses..."));
-    // Load addresses for peers.dat
-    int64_t nStart = GetTimeMillis();
+    // Start connecting to the peers that were good lately, peers.dat loads in the background
     {
         CAddrDB adb;
-        if (!adb.Read(addrman))
-            LogPrintf("Invalid or missing peers.dat; recreating\n");
+        std::vector<CAddress> vHot;
+        if (adb.ReadHot(vHot)) {
+            BOOST_FOREACH(const CAddress& addr, vHot)
+                addrman.Add(addr, addr);
+            LogPrintf("Loaded %i hot peers from hotpeers.dat\n", vHot.size());
+        }
     }
-    LogPrintf("Loaded %i addresses from peers.dat  %dms\n",
-           addrman.size(), GetTimeMillis() - nStart);
-    fAddressesInitialized = true;
+    threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "loadaddr", &ThreadLoadAddresses));
 
     if (semOutbound == NULL) {
         // initialize semaphore
@@ -1941,10 +2348,16 @@ void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler)
     threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "opencon", &ThreadOpenConnections));
 
     // Process messages
+    nMessageWorkers = std::max((int)GetArg("-msgworkers", DEFAULT_MESSAGE_WORKERS), 0);
     threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "msghand", &ThreadMessageHandler));
 
+    // Serve read-only requests
+    for (int i = 0; i < nMessageWorkers; i++)
+        threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "msgworker", &ThreadMessageWorker));
+
     // Dump network addresses
-    scheduler.scheduleEvery(&DumpAddresses, DUMP_ADDRESSES_INTERVAL);
+    threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "dumpaddr", &ThreadDumpAddresses));
+    scheduler.scheduleEvery(&DumpAddresses, DUMP_ADDRESSES_INTERVAL, "addrman");
 }
 
 bool StopNode()
@@ -1956,7 +2369,7 @@ bool StopNode()
 
     if (KOMODO_NSPV_FULLNODE && fAddressesInitialized)
     {
-        DumpAddresses();
+        FlushAddresses();
         fAddressesInitialized = false;
     }
 
@@ -2000,6 +2413,81 @@ public:
 }
 instance_of_cnetcleanup;
 
+CAskedForTimes::CAskedForTimes(size_t nSlots) :
+    vSlots(std::max<size_t>(nSlots, 1)),
+    k0(GetRand(std::numeric_limits<uint64_t>::max())),
+    k1(GetRand(std::numeric_limits<uint64_t>::max()))
+{
+    for (size_t i = 0; i < vSlots.size(); i++)
+        vSlots[i].nTime = 0;
+}
+
+size_t CAskedForTimes::SlotIndex(const uint256& hash) const
+{
+    return SipHashUint256(k0, k1, hash) % vSlots.size();
+}
+
+int64_t CAskedForTimes::Get(const uint256& hash) const
+{
+    const Slot& slot = vSlots[SlotIndex(hash)];
+    return slot.hash == hash ? slot.nTime : 0;
+}
+
+void CAskedForTimes::Set(const uint256& hash, int64_t nTime)
+{
+    Slot& slot = vSlots[SlotIndex(hash)];
+    slot.hash = hash;
+    slot.nTime = nTime;
+}
+
+void CAskedForTimes::Erase(const uint256& hash)
+{
+    Slot& slot = vSlots[SlotIndex(hash)];
+    if (slot.hash == hash) {
+        slot.hash.SetNull();
+        slot.nTime = 0;
+    }
+}
+
+SaltedInvHasher::SaltedInvHasher() :
+    k0(GetRand(std::numeric_limits<uint64_t>::max())),
+    k1(GetRand(std::numeric_limits<uint64_t>::max()))
+{
+}
+
+CAskedForTimes& AskedForTimes()
+{
+    // Created on first use, after the random generator is set up
+    static CAskedForTimes askedForTimes(MAPASKFOR_MAX_SZ);
+    return askedForTimes;
+}
+
+void QueueTxAnnouncement(const uint256& hash)
+{
+    LOCK(cs_txAnnounce);
+    dequeTxAnnounce.push_back(hash);
+    while (dequeTxAnnounce.size() > TX_ANNOUNCE_QUEUE_MAX) {
+        dequeTxAnnounce.pop_front();
+        nTxAnnounceFirst++;
+    }
+}
+
+uint64_t GetTxAnnouncements(uint64_t nFrom, std::vector<uint256>& vHashes, size_t nMax)
+{
+    LOCK(cs_txAnnounce);
+    // Announcements dropped before the peer got to them are skipped, a position past the end starts at the end
+    uint64_t nEnd = nTxAnnounceFirst + dequeTxAnnounce.size();
+    uint64_t nPos = std::min(std::max(nFrom, nTxAnnounceFirst), nEnd);
+    for (; nPos < nEnd && vHashes.size() < nMax; nPos++)
+        vHashes.push_back(dequeTxAnnounce[nPos - nTxAnnounceFirst]);
+    return nPos;
+}
+
+int64_t PoissonNextSend(int64_t nNow, int average_interval_seconds)
+{
+    return nNow + (int64_t)(log1p(GetRand(1ULL << 48) * -0.0000000000000035527136788 /* -1/2^48 */) * average_interval_seconds * -1000000.0 + 0.5);
+}
+
 void RelayTransaction(const CTransaction& tx)
 {
     CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
@@ -2024,18 +2512,8 @@ void RelayTransaction(const CTransaction& tx, const CDataStream& ss)
         mapRelay.insert(std::make_pair(inv, ss));
         vRelayExpiration.push_back(std::make_pair(GetTime() + 15 * 60, inv));
     }
-    LOCK(cs_vNodes);
-    BOOST_FOREACH(CNode* pnode, vNodes)
-    {
-        if(!pnode->fRelayTxes)
-            continue;
-        LOCK(pnode->cs_filter);
-        if (pnode->pfilter)
-        {
-            if (pnode->pfilter->IsRelevantAndUpdate(tx))
-                pnode->PushInventory(inv);
-        } else pnode->PushInventory(inv);
-    }
+    // Peers pick it up from the queue with their next announcements, filtered by what they know and want
+    QueueTxAnnouncement(inv.hash);
 }
 
 void CNode::RecordBytesRecv(uint64_t bytes)
@@ -2050,6 +2528,78 @@ void CNode::RecordBytesSent(uint64_t bytes)
     nTotalBytesSent += bytes;
 }
 
+/** Commands the stats are kept for by name, the rest are counted as "other" so peers cannot grow the maps. */
+static const char* const ppszStatsCommands[] = {
+    "version", "verack", "addr", "getaddr", "inv", "getdata", "notfound", "getblocks", "getheaders", "headers",
+    "tx", "block", "merkleblock", "mempool", "ping", "pong", "reject", "alert", "events", "filterload",
+    "filteradd", "filterclear", "sendcmpct", "cmpctblock", "getblocktxn", "blocktxn", "getnSPV", "nSPV"
+};
+
+/** nSPV request types, in pairs of a request and its response (see komodo_nSPV_defs.h) */
+static const char* const ppszNSPVTypes[] = {
+    "info", "utxos", "ntzs", "ntzsproof", "txproof", "spentinfo", "broadcast", "txids", "mempool",
+    "ccmoduleutxos", "remoterpc"
+};
+
+std::string GetMsgStatsKey(const std::string& strCommand, const char* pPayload, size_t nPayload)
+{
+    bool fKnown = false;
+    for (size_t i = 0; i < ARRAYLEN(ppszStatsCommands) && !fKnown; i++)
+        fKnown = strCommand == ppszStatsCommands[i];
+    if (!fKnown)
+        return "other";
+    if (strCommand != "getnSPV" && strCommand != "nSPV")
+        return strCommand;
+
+    // The payload is a serialized byte vector, its first byte is the request type
+    size_t nOffset = 1;
+    if (nPayload > 0 && (unsigned char)pPayload[0] >= 253)
+        nOffset = (unsigned char)pPayload[0] == 253 ? 3 : ((unsigned char)pPayload[0] == 254 ? 5 : 9);
+    if (nPayload <= nOffset)
+        return strCommand;
+    unsigned char nType = pPayload[nOffset];
+    if (nType / 2 >= ARRAYLEN(ppszNSPVTypes))
+        return strCommand + ":other";
+    return strCommand + ":" + ppszNSPVTypes[nType / 2];
+}
+
+void CNode::RecordMessageRecv(const std::string& strKey, uint64_t nBytes, int64_t nHandlerUsec)
+{
+    {
+        LOCK(cs_msgStats);
+        CMessageStats& stats = mapMsgStats[strKey];
+        stats.nMsgsRecv++;
+        stats.nBytesRecv += nBytes;
+        stats.nHandlerUsec += nHandlerUsec;
+    }
+    LOCK(cs_totalMsgStats);
+    CMessageStats& stats = mapTotalMsgStats[strKey];
+    stats.nMsgsRecv++;
+    stats.nBytesRecv += nBytes;
+    stats.nHandlerUsec += nHandlerUsec;
+}
+
+void CNode::RecordMessageSent(const std::string& strCommand, const char* pPayload, size_t nPayload, uint64_t nBytes)
+{
+    std::string strKey = GetMsgStatsKey(strCommand, pPayload, nPayload);
+    {
+        LOCK(cs_msgStats);
+        CMessageStats& stats = mapMsgStats[strKey];
+        stats.nMsgsSent++;
+        stats.nBytesSent += nBytes;
+    }
+    LOCK(cs_totalMsgStats);
+    CMessageStats& stats = mapTotalMsgStats[strKey];
+    stats.nMsgsSent++;
+    stats.nBytesSent += nBytes;
+}
+
+void CNode::GetTotalMsgStats(mapMsgStats_t& stats)
+{
+    LOCK(cs_totalMsgStats);
+    stats = mapTotalMsgStats;
+}
+
 uint64_t CNode::GetTotalBytesRecv()
 {
     LOCK(cs_totalBytesRecv);
@@ -2104,21 +2654,20 @@ void CNode::Fuzz(int nChance)
 CAddrDB::CAddrDB()
 {
     pathAddr = GetDataDir() / "peers.dat";
+    pathHot = GetDataDir() / "hotpeers.dat";
 }
 
-bool CAddrDB::Write(const CAddrMan& addr)
+/** Appends a checksum to the stream and replaces pathDest with it through a temporary file. */
+static bool CommitAddrStream(CDataStream& ss, const boost::filesystem::path& pathDest)
 {
     // Generate random temporary filename
     unsigned short randv = 0;
     GetRandBytes((unsigned char*)&randv, sizeof(randv));
-    std::string tmpfn = strprintf("peers.dat.%04x", randv);
+    std::string tmpfn = strprintf("%s.%04x", pathDest.filename().string(), randv);
 
-    // serialize addresses, checksum data up to that point, then append csum
-    CDataStream ssPeers(SER_DISK, CLIENT_VERSION);
-    ssPeers << FLATDATA(Params().MessageStart());
-    ssPeers << addr;
-    uint256 hash = Hash(ssPeers.begin(), ssPeers.end());
-    ssPeers << hash;
+    // checksum data up to that point, then append csum
+    uint256 hash = Hash(ss.begin(), ss.end());
+    ss << hash;
 
     // open temp output file, and associate with CAutoFile
     boost::filesystem::path pathTmp = GetDataDir() / tmpfn;
@@ -2129,7 +2678,7 @@ bool CAddrDB::Write(const CAddrMan& addr)
 
     // Write and commit header, data
     try {
-        fileout << ssPeers;
+        fileout << ss;
     }
     catch (const std::exception& e) {
         return error("%s: Serialize or I/O error - %s", __func__, e.what());
@@ -2137,34 +2686,35 @@ bool CAddrDB::Write(const CAddrMan& addr)
     FileCommit(fileout.Get());
     fileout.fclose();
 
-    // replace existing peers.dat, if any, with new peers.dat.XXXX
-    if (!RenameOver(pathTmp, pathAddr))
+    // replace the existing file, if any, with the new one
+    if (!RenameOver(pathTmp, pathDest))
         return error("%s: Rename-into-place failed", __func__);
 
     return true;
 }
 
-bool CAddrDB::Read(CAddrMan& addr)
+/** Reads a file written by CommitAddrStream, checking its checksum and network magic. */
+static bool ReadAddrStream(const boost::filesystem::path& pathSrc, CDataStream& ss)
 {
     // open input file, and associate with CAutoFile
-    FILE *file = fopen(pathAddr.string().c_str(), "rb");
+    FILE *file = fopen(pathSrc.string().c_str(), "rb");
     CAutoFile filein(file, SER_DISK, CLIENT_VERSION);
     if (filein.IsNull())
-        return error("%s: Failed to open file %s", __func__, pathAddr.string());
+        return error("%s: Failed to open file %s", __func__, pathSrc.string());
 
     // use file size to size memory buffer
-    int fileSize = boost::filesystem::file_size(pathAddr);
+    int fileSize = boost::filesystem::file_size(pathSrc);
     int dataSize = fileSize - sizeof(uint256);
     // Don't try to resize to a negative number if file is small
     if (dataSize < 0)
         dataSize = 0;
-    vector<unsigned char> vchData;
-    vchData.resize(dataSize);
+    ss.resize(dataSize);
     uint256 hashIn;
 
     // read data and checksum from file
     try {
-        filein.read((char *)&vchData[0], dataSize);
+        if (dataSize > 0)
+            filein.read(&ss[0], dataSize);
         filein >> hashIn;
     }
     catch (const std::exception& e) {
@@ -2172,22 +2722,52 @@ bool CAddrDB::Read(CAddrMan& addr)
     }
     filein.fclose();
 
-    CDataStream ssPeers(vchData, SER_DISK, CLIENT_VERSION);
-
     // verify stored checksum matches input data
-    uint256 hashTmp = Hash(ssPeers.begin(), ssPeers.end());
+    uint256 hashTmp = Hash(ss.begin(), ss.end());
     if (hashIn != hashTmp)
         return error("%s: Checksum mismatch, data corrupted", __func__);
 
     unsigned char pchMsgTmp[4];
     try {
         // de-serialize file header (network specific magic number) and ..
-        ssPeers >> FLATDATA(pchMsgTmp);
+        ss >> FLATDATA(pchMsgTmp);
 
         // ... verify the network matches ours
         if (memcmp(pchMsgTmp, Params().MessageStart(), sizeof(pchMsgTmp)))
             return error("%s: Invalid network magic number", __func__);
+    }
+    catch (const std::exception& e) {
+        return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+    }
+
+    return true;
+}
+
+void CAddrDB::Snapshot(const CAddrMan& addr, CDataStream& ssPeers)
+{
+    ssPeers << FLATDATA(Params().MessageStart());
+    ssPeers << addr;
+}
+
+bool CAddrDB::WriteSnapshot(CDataStream& ssPeers)
+{
+    return CommitAddrStream(ssPeers, pathAddr);
+}
 
+bool CAddrDB::Write(const CAddrMan& addr)
+{
+    CDataStream ssPeers(SER_DISK, CLIENT_VERSION);
+    Snapshot(addr, ssPeers);
+    return WriteSnapshot(ssPeers);
+}
+
+bool CAddrDB::Read(CAddrMan& addr)
+{
+    CDataStream ssPeers(SER_DISK, CLIENT_VERSION);
+    if (!ReadAddrStream(pathAddr, ssPeers))
+        return false;
+
+    try {
         // de-serialize address data into one CAddrMan object
         ssPeers >> addr;
     }
@@ -2198,13 +2778,39 @@ bool CAddrDB::Read(CAddrMan& addr)
     return true;
 }
 
+bool CAddrDB::WriteHot(const std::vector<CAddress>& vAddr)
+{
+    CDataStream ssHot(SER_DISK, CLIENT_VERSION);
+    ssHot << FLATDATA(Params().MessageStart());
+    ssHot << vAddr;
+    return CommitAddrStream(ssHot, pathHot);
+}
+
+bool CAddrDB::ReadHot(std::vector<CAddress>& vAddr)
+{
+    CDataStream ssHot(SER_DISK, CLIENT_VERSION);
+    if (!boost::filesystem::exists(pathHot) || !ReadAddrStream(pathHot, ssHot))
+        return false;
+
+    try {
+        ssHot >> vAddr;
+    }
+    catch (const std::exception& e) {
+        return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+    }
+    if (vAddr.size() > MAX_HOT_PEERS)
+        vAddr.resize(MAX_HOT_PEERS);
+
+    return true;
+}
+
 unsigned int ReceiveFloodSize() { return 1000*GetArg("-maxreceivebuffer", 5*1000); }
 unsigned int SendBufferSize() { return 1000*GetArg("-maxsendbuffer", 1*1000); }
 
 CNode::CNode(SOCKET hSocketIn, const CAddress& addrIn, const std::string& addrNameIn, bool fInboundIn) :
     ssSend(SER_NETWORK, INIT_PROTO_VERSION),
     addrKnown(5000, 0.001),
-    setInventoryKnown(SendBufferSize() / 1000)
+    filterInventoryKnown(INVENTORY_KNOWN_MAX, 0.000001)
 {
     nServices = 0;
     hSocket = hSocketIn;
@@ -2215,6 +2821,13 @@ CNode::CNode(SOCKET hSocketIn, const CAddress& addrIn, const std::string& addrNa
     nRecvBytes = 0;
     nTimeConnected = GetTime();
     nTimeOffset = 0;
+    // Only transactions relayed from now on are announced, the peer can ask for our mempool
+    std::vector<uint256> vNoHashes;
+    nTxAnnounceSeq = GetTxAnnouncements(std::numeric_limits<uint64_t>::max(), vNoHashes, 0);
+    nNextInvSend = 0;
+    nNSPVVersion = 0;
+    nNSPVReqSecond = 0;
+    nNSPVReqCount = 0;
     addr = addrIn;
     addrName = addrNameIn == "" ? addr.ToStringIPPort() : addrNameIn;
     nVersion = 0;
@@ -2278,12 +2891,7 @@ void CNode::AskFor(const CInv& inv)
 
     // We're using mapAskFor as a priority queue,
     // the key is the earliest time the request can be sent
-    int64_t nRequestTime;
-    limitedmap<CInv, int64_t>::const_iterator it = mapAlreadyAskedFor.find(inv);
-    if (it != mapAlreadyAskedFor.end())
-        nRequestTime = it->second;
-    else
-        nRequestTime = 0;
+    int64_t nRequestTime = AskedForTimes().Get(inv.hash);
     LogPrint("net", "askfor %s  %d (%s) peer=%d\n", inv.ToString(), nRequestTime, DateTimeStrFormat("%H:%M:%S", nRequestTime/1000000), id);
 
     // Make sure not to reuse time indexes to keep things in the same order
@@ -2295,10 +2903,7 @@ void CNode::AskFor(const CInv& inv)
 
     // Each retry is 2 minutes after the last
     nRequestTime = std::max(nRequestTime + 2 * 60 * 1000000, nNow);
-    if (it != mapAlreadyAskedFor.end())
-        mapAlreadyAskedFor.update(it, nRequestTime);
-    else
-        mapAlreadyAskedFor.insert(std::make_pair(inv, nRequestTime));
+    AskedForTimes().Set(inv.hash, nRequestTime);
     mapAskFor.insert(std::make_pair(nRequestTime, inv));
 }
 
@@ -2319,7 +2924,7 @@ void CNode::AbortMessage() UNLOCK_FUNCTION(cs_vSend)
     LogPrint("net", "(aborted)\n");
 }
 
-void CNode::EndMessage() UNLOCK_FUNCTION(cs_vSend)
+void CNode::EndMessage(const CMappedSpan* pShared) UNLOCK_FUNCTION(cs_vSend)
 {
     // The -*messagestest options are intentionally not documented in the help message,
     // since they are only used during development to debug the networking code and are
@@ -2340,10 +2945,15 @@ void CNode::EndMessage() UNLOCK_FUNCTION(cs_vSend)
     }
     // Set the size
     unsigned int nSize = ssSend.size() - CMessageHeader::HEADER_SIZE;
+    if (pShared != NULL) {
+        assert(nSize == 0);
+        nSize = pShared->size;
+    }
     WriteLE32((uint8_t*)&ssSend[CMessageHeader::MESSAGE_SIZE_OFFSET], nSize);
 
     // Set the checksum
-    uint256 hash = Hash(ssSend.begin() + CMessageHeader::HEADER_SIZE, ssSend.end());
+    uint256 hash = pShared != NULL ? Hash(pShared->data, pShared->data + pShared->size) :
+        Hash(ssSend.begin() + CMessageHeader::HEADER_SIZE, ssSend.end());
     unsigned int nChecksum = 0;
     memcpy(&nChecksum, &hash, sizeof(nChecksum));
     assert(ssSend.size () >= CMessageHeader::CHECKSUM_OFFSET + sizeof(nChecksum));
@@ -2351,8 +2961,17 @@ void CNode::EndMessage() UNLOCK_FUNCTION(cs_vSend)
 
     LogPrint("net", "(%d bytes) peer=%d\n", nSize, id);
 
-    std::deque<CSerializeData>::iterator it = vSendMsg.insert(vSendMsg.end(), CSerializeData());
-    ssSend.GetAndClear(*it);
+    const char* pchCommand = &ssSend[MESSAGE_START_SIZE];
+    std::string strCommand(pchCommand, strnlen(pchCommand, CMessageHeader::COMMAND_SIZE));
+    if (pShared != NULL)
+        RecordMessageSent(strCommand, pShared->data, pShared->size, CMessageHeader::HEADER_SIZE + nSize);
+    else
+        RecordMessageSent(strCommand, nSize ? &ssSend[CMessageHeader::HEADER_SIZE] : NULL, nSize, CMessageHeader::HEADER_SIZE + nSize);
+
+    std::deque<CSendMessage>::iterator it = vSendMsg.insert(vSendMsg.end(), CSendMessage());
+    ssSend.GetAndClear((*it).data);
+    if (pShared != NULL)
+        (*it).shared = *pShared;
     nSendSize += (*it).size();
 
     // If write queue empty, attempt "optimistic write"
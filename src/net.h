@@ -22,11 +22,10 @@
 #define BITCOIN_NET_H
 
 #include "addrdb.h"
+#include "blockfilemap.h"
 #include "bloom.h"
 #include "compat.h"
 #include "hash.h"
-#include "limitedmap.h"
-#include "mruset.h"
 #include "netbase.h"
 #include "protocol.h"
 #include "random.h"
@@ -37,7 +36,10 @@
 #include "util.h"
 
 #include <deque>
+#include <map>
+#include <set>
 #include <stdint.h>
+#include <unordered_set>
 
 #ifndef _WIN32
 #include <arpa/inet.h>
@@ -74,8 +76,20 @@ static const bool DEFAULT_LISTEN = true;
 static const size_t MAPASKFOR_MAX_SZ = MAX_INV_SZ;
 /** The maximum number of entries in setAskFor (larger due to getdata latency)*/
 static const size_t SETASKFOR_MAX_SZ = 2 * MAX_INV_SZ;
+/** Average delay between transaction announcements to an inbound peer in seconds, outbound peers get half of it. */
+static const int INVENTORY_BROADCAST_INTERVAL = 5;
+/** Maximum number of transactions announced to a peer at a time, the rest waits for the next announcement. */
+static const unsigned int INVENTORY_BROADCAST_MAX = 1000;
+/** Number of recent inventory items a peer is remembered to know. */
+static const unsigned int INVENTORY_KNOWN_MAX = 5000;
+/** Number of recently good peers saved apart from peers.dat, to connect to while it loads. */
+static const unsigned int MAX_HOT_PEERS = 32;
+/** Transaction announcements kept for the peers that have not sent them yet. */
+static const unsigned int TX_ANNOUNCE_QUEUE_MAX = MAX_INV_SZ;
 /** The maximum number of peer connections to maintain. */
 static const unsigned int DEFAULT_MAX_PEER_CONNECTIONS = 384;
+/** The default number of threads serving read-only peer requests next to the message handler. */
+static const int DEFAULT_MESSAGE_WORKERS = 2;
 /** The period before a network upgrade activates, where connections to upgrading peers are preferred (in blocks). */
 static const int NETWORK_UPGRADE_PEER_PREFERENCE_BLOCK_PERIOD = 24 * 24 * 3;
 
@@ -98,6 +112,61 @@ void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler);
 bool StopNode();
 void SocketSendData(CNode *pnode);
 
+/** A socket for CSocketEvents to wait on */
+struct CSocketInterest
+{
+    SOCKET hSocket;
+    //! Tells apart sockets reusing the descriptor of a closed one, the node id for peers
+    int64_t nTag;
+    bool fRecv;
+    bool fSend;
+
+    CSocketInterest(SOCKET hSocketIn, int64_t nTagIn, bool fRecvIn, bool fSendIn) :
+        hSocket(hSocketIn), nTag(nTagIn), fRecv(fRecvIn), fSend(fSendIn) {}
+};
+
+/**
+ * Waits for sockets to become readable or writable, for ThreadSocketHandler.
+ *
+ * With epoll or kqueue, sockets stay registered from one call to the next.
+ * Only changes of interest are passed to the kernel, and only the ready
+ * sockets come back. Otherwise, or if the queue cannot be created,
+ * select() is used, which skips descriptors at or above FD_SETSIZE. The
+ * registrations are level triggered, so a socket that is not drained is
+ * reported again on the next call. Not thread safe.
+ */
+class CSocketEvents
+{
+public:
+    CSocketEvents();
+    ~CSocketEvents();
+
+    //! Waits up to nTimeout milliseconds for the sockets in vInterest, filling the sets with those ready
+    void Wait(const std::vector<CSocketInterest>& vInterest, int nTimeout,
+              std::set<SOCKET>& setRecv, std::set<SOCKET>& setSend, std::set<SOCKET>& setError);
+
+private:
+#if defined(USE_EPOLL) || defined(USE_KQUEUE)
+    struct Registration {
+        int64_t nTag;
+        bool fRecv;
+        bool fSend;
+    };
+
+    int fdQueue;
+    std::map<SOCKET, Registration> mapRegistered;
+
+    bool Register(const CSocketInterest& interest, bool fKnown);
+    void Deregister(SOCKET hSocket);
+#endif
+
+    CSocketEvents(const CSocketEvents&);
+    CSocketEvents& operator=(const CSocketEvents&);
+};
+
+/** Number of descriptors the socket event loop can wait on, bounding -maxconnections */
+int GetSocketEventsLimit();
+
 void GetBanned(banmap_t &banmap);
 void SetBanned(const banmap_t &banmap);
 
@@ -195,7 +264,57 @@ extern CCriticalSection cs_vNodes;
 extern std::map<CInv, CDataStream> mapRelay;
 extern std::deque<std::pair<int64_t, CInv> > vRelayExpiration;
 extern CCriticalSection cs_mapRelay;
-extern limitedmap<CInv, int64_t> mapAlreadyAskedFor;
+
+/**
+ * When each transaction was last requested, so asking another peer for it
+ * waits until the first request timed out. A fixed table indexed by a salted
+ * hash of the txid: an entry colliding with an older one replaces it, which
+ * only lets the next request for the older one go out sooner.
+ */
+class CAskedForTimes
+{
+private:
+    struct Slot {
+        uint256 hash;
+        int64_t nTime;
+    };
+    std::vector<Slot> vSlots;
+    uint64_t k0, k1;
+
+    size_t SlotIndex(const uint256& hash) const;
+
+public:
+    explicit CAskedForTimes(size_t nSlots);
+
+    //! The time of the last request, 0 when it was not requested
+    int64_t Get(const uint256& hash) const;
+    void Set(const uint256& hash, int64_t nTime);
+    void Erase(const uint256& hash);
+};
+
+CAskedForTimes& AskedForTimes();
+
+/** Salted SipHash of an inventory hash for the hash sets of a peer, so the peer cannot aim for one bucket */
+class SaltedInvHasher
+{
+private:
+    uint64_t k0, k1;
+
+public:
+    SaltedInvHasher();
+
+    size_t operator()(const uint256& hash) const {
+        return SipHashUint256(k0, k1, hash);
+    }
+};
+
+/** Queues a transaction to announce, each peer sends it with the next batch of its announcements. */
+void QueueTxAnnouncement(const uint256& hash);
+/** Announcements after position nFrom, at most nMax, returns the position to continue from. */
+uint64_t GetTxAnnouncements(uint64_t nFrom, std::vector<uint256>& vHashes, size_t nMax);
+
+/** Return a timestamp in the future (in microseconds) for exponentially distributed events. */
+int64_t PoissonNextSend(int64_t nNow, int average_interval_seconds);
 
 extern std::vector<std::string> vAddedNodes;
 extern CCriticalSection cs_vAddedNodes;
@@ -214,6 +333,25 @@ struct LocalServiceInfo {
 extern CCriticalSection cs_mapLocalHost;
 extern std::map<CNetAddr, LocalServiceInfo> mapLocalHost;
 
+/** Traffic of one message type and the time its handler took, see CNode::RecordMessageRecv. */
+struct CMessageStats
+{
+    uint64_t nMsgsRecv;
+    uint64_t nBytesRecv;
+    uint64_t nMsgsSent;
+    uint64_t nBytesSent;
+    //! Time spent in ProcessMessage for the received messages, in microseconds
+    int64_t nHandlerUsec;
+
+    CMessageStats() : nMsgsRecv(0), nBytesRecv(0), nMsgsSent(0), nBytesSent(0), nHandlerUsec(0) {}
+};
+
+/** Statistics by message command. nSPV messages are split by request type, as in "getnSPV:utxos". */
+typedef std::map<std::string, CMessageStats> mapMsgStats_t;
+
+/** The mapMsgStats_t key of a message, from its command and payload. */
+std::string GetMsgStatsKey(const std::string& strCommand, const char* pPayload, size_t nPayload);
+
 class CNodeStats
 {
 public:
@@ -240,6 +378,7 @@ public:
     // Bind address of our side of the connection
     // CAddress addrBind; // https://github.com/bitcoin/bitcoin/commit/a7e3c2814c8e49197889a4679461be42254e5c51
     uint32_t m_mapped_as;
+    mapMsgStats_t mapMsgStats;
 };
 
 
@@ -284,6 +423,19 @@ public:
 };
 
 
+/**
+ * A message queued for sending. A shared payload, like a block in a mapped
+ * block file, is sent after data straight from where it is, without a copy.
+ */
+class CSendMessage {
+public:
+    CSerializeData data;
+    CMappedSpan shared;
+
+    size_t size() const { return data.size() + shared.size; }
+};
+
+
 
 
 
@@ -298,7 +450,7 @@ public:
     size_t nSendSize; // total size of all vSendMsg entries
     size_t nSendOffset; // offset inside the first vSendMsg already sent
     uint64_t nSendBytes;
-    std::deque<CSerializeData> vSendMsg;
+    std::deque<CSendMessage> vSendMsg;
     CCriticalSection cs_vSend;
 
     std::deque<CInv> vRecvGetData;
@@ -312,6 +464,10 @@ public:
     int64_t nTimeConnected;
     int64_t nTimeOffset;
     uint32_t prevtimes[16];
+    // nSPV protocol version from the peer's info response, and its pipelined requests in the current second
+    int32_t nNSPVVersion;
+    uint32_t nNSPVReqSecond;
+    int32_t nNSPVReqCount;
     // Address of this peer
     CAddress addr;
     // Bind address of our side of the connection
@@ -369,10 +525,14 @@ public:
     std::set<uint256> setKnown;
 
     // inventory based relay
-    mruset<CInv> setInventoryKnown;
+    CRollingBloomFilter filterInventoryKnown;
+    // block inventory, sent right away; transactions come from the global announcement queue
     std::vector<CInv> vInventoryToSend;
+    // position in the announcement queue and when to send the next batch from it
+    uint64_t nTxAnnounceSeq;
+    int64_t nNextInvSend;
     CCriticalSection cs_inventory;
-    std::set<uint256> setAskFor;
+    std::unordered_set<uint256, SaltedInvHasher> setAskFor;
     std::multimap<int64_t, CInv> mapAskFor;
 
     // Ping time measurement:
@@ -387,6 +547,10 @@ public:
     // Whether a ping is requested.
     bool fPingQueued;
 
+    // Traffic and handler time by message type
+    CCriticalSection cs_msgStats;
+    mapMsgStats_t mapMsgStats;
+
     CNode(SOCKET hSocketIn, const CAddress &addrIn, const std::string &addrNameIn = "", bool fInboundIn = false);
     ~CNode();
 
@@ -396,6 +560,8 @@ private:
     static CCriticalSection cs_totalBytesSent;
     static uint64_t nTotalBytesRecv;
     static uint64_t nTotalBytesSent;
+    static CCriticalSection cs_totalMsgStats;
+    static mapMsgStats_t mapTotalMsgStats;
 
     CNode(const CNode&);
     void operator=(const CNode&);
@@ -469,7 +635,7 @@ public:
     {
         {
             LOCK(cs_inventory);
-            setInventoryKnown.insert(inv);
+            filterInventoryKnown.insert(inv.hash);
         }
     }
 
@@ -477,7 +643,7 @@ public:
     {
         {
             LOCK(cs_inventory);
-            if (!setInventoryKnown.count(inv))
+            if (!filterInventoryKnown.contains(inv.hash))
                 vInventoryToSend.push_back(inv);
         }
     }
@@ -491,11 +657,26 @@ public:
     void AbortMessage() UNLOCK_FUNCTION(cs_vSend);
 
     // TODO: Document the precondition of this function.  Is cs_vSend locked?
-    void EndMessage() UNLOCK_FUNCTION(cs_vSend);
+    void EndMessage(const CMappedSpan* pShared = NULL) UNLOCK_FUNCTION(cs_vSend);
 
     void PushVersion();
 
 
+    //! Queues a message with the bytes of shared as its payload, which are sent without being copied
+    void PushMessageShared(const char* pszCommand, const CMappedSpan& shared)
+    {
+        try
+        {
+            BeginMessage(pszCommand);
+            EndMessage(&shared);
+        }
+        catch (...)
+        {
+            AbortMessage();
+            throw;
+        }
+    }
+
     void PushMessage(const char* pszCommand)
     {
         //fprintf(stderr,"push.(%s)\n",pszCommand);
@@ -692,6 +873,12 @@ public:
 
     static uint64_t GetTotalBytesRecv();
     static uint64_t GetTotalBytesSent();
+
+    // Per message type stats, nBytes includes the message header
+    void RecordMessageRecv(const std::string& strKey, uint64_t nBytes, int64_t nHandlerUsec);
+    void RecordMessageSent(const std::string& strCommand, const char* pPayload, size_t nPayload, uint64_t nBytes);
+
+    static void GetTotalMsgStats(mapMsgStats_t& stats);
 };
 
 
@@ -705,10 +892,17 @@ class CAddrDB
 {
 private:
     boost::filesystem::path pathAddr;
+    boost::filesystem::path pathHot;
 public:
     CAddrDB();
     bool Write(const CAddrMan& addr);
     bool Read(CAddrMan& addr);
+    //! Serialize the address database, so the slow part of Write can run without holding its lock
+    static void Snapshot(const CAddrMan& addr, CDataStream& ssPeers);
+    bool WriteSnapshot(CDataStream& ssPeers);
+    //! The few recently good peers connected to at startup, before the whole database is loaded
+    bool WriteHot(const std::vector<CAddress>& vAddr);
+    bool ReadHot(std::vector<CAddress>& vAddr);
 };
 
 #endif // BITCOIN_NET_H
@@ -7,12 +7,24 @@
 #include "notaries_staked.h"
 
 #include <boost/foreach.hpp>
+#include <boost/scoped_ptr.hpp>
 
 
 NotarisationDB *pnotarisations;
 
 
-NotarisationDB::NotarisationDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "notarisations", nCacheSize, fMemory, fWipe, false, 64) { }
+static const std::string SYMBOL_INDEX_FLAG = "symbolindex";
+
+NotarisationDB::NotarisationDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "notarisations", nCacheSize, fMemory, fWipe, false, 64)
+{
+    // An empty database gets the index from the first block on
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+    pcursor->SeekToFirst();
+    if (!pcursor->Valid())
+        Write(std::make_pair('F', SYMBOL_INDEX_FLAG), true);
+    fSymbolIndex = false;
+    Read(std::make_pair('F', SYMBOL_INDEX_FLAG), fSymbolIndex);
+}
 
 
 NotarisationsInBlock ScanBlockNotarisations(const CBlock &block, int nHeight)
@@ -110,6 +122,92 @@ void EraseBackNotarisations(const NotarisationsInBlock notarisations, CDBBatch &
     }
 }
 
+/*
+ * Index the first notarisation of each symbol in the block at height
+ */
+void WriteSymbolNotarisations(const NotarisationsInBlock notarisations, int height, CDBBatch &batch)
+{
+    std::set<std::string> seen;
+    BOOST_FOREACH(const Notarisation &n, notarisations)
+    {
+        if (seen.insert(n.second.symbol).second)
+            batch.Write(CNotarisationSymbolKey(n.second.symbol, height), n);
+    }
+}
+
+
+void EraseSymbolNotarisations(const NotarisationsInBlock notarisations, int height, CDBBatch &batch)
+{
+    BOOST_FOREACH(const Notarisation &n, notarisations)
+        batch.Erase(CNotarisationSymbolKey(n.second.symbol, height));
+}
+
+
+/*
+ * Fill the symbol index from the notarisations of the active chain, for
+ * databases created before it existed
+ */
+bool BuildNotarisationSymbolIndex()
+{
+    AssertLockHeld(cs_main);
+    if (pnotarisations->fSymbolIndex)
+        return true;
+
+    LogPrintf("Building the notarisations symbol index...\n");
+    for (int start=1; start<=chainActive.Height(); start+=10000) {
+        CDBBatch batch(*pnotarisations);
+        for (int h=start; h<start+10000 && h<=chainActive.Height(); h++) {
+            NotarisationsInBlock notarisations;
+            if (GetBlockNotarisations(*chainActive[h]->phashBlock, notarisations))
+                WriteSymbolNotarisations(notarisations, h, batch);
+        }
+        if (!pnotarisations->WriteBatch(batch))
+            return false;
+    }
+    if (!pnotarisations->Write(std::make_pair('F', SYMBOL_INDEX_FLAG), true, true))
+        return false;
+    pnotarisations->fSymbolIndex = true;
+    return true;
+}
+
+
+/*
+ * Get the newest notarisation for symbol from the symbol index, in a block
+ * from height down to minHeight. Return height of its block or 0.
+ */
+static int GetSymbolNotarisation(int height, int minHeight, const std::string& symbol, Notarisation& out)
+{
+    boost::scoped_ptr<CDBIterator> pcursor(pnotarisations->NewIterator());
+    pcursor->Seek(CNotarisationSymbolKey(symbol, height));
+    CNotarisationSymbolKey key;
+    if (!pcursor->Valid() || !pcursor->GetKey(key) || key.symbol != symbol || key.height < minHeight)
+        return 0;
+    if (!pcursor->GetValue(out))
+        return 0;
+    return key.height;
+}
+
+/*
+ * Get the oldest notarisation for symbol from the symbol index, in a block
+ * from height up to maxHeight. Return height of its block or 0.
+ */
+static int GetSymbolNotarisationFrom(int height, int maxHeight, const std::string& symbol, Notarisation& out)
+{
+    boost::scoped_ptr<CDBIterator> pcursor(pnotarisations->NewIterator());
+    pcursor->Seek(CNotarisationSymbolKey(symbol, height));
+    CNotarisationSymbolKey key;
+    // Newer heights sort before the seek position, unless it is at height itself
+    if (!pcursor->Valid())
+        pcursor->SeekToLast();
+    else if (!pcursor->GetKey(key) || key.symbol != symbol || key.height != height)
+        pcursor->Prev();
+    if (!pcursor->Valid() || !pcursor->GetKey(key) || key.symbol != symbol || key.height < height || key.height > maxHeight)
+        return 0;
+    if (!pcursor->GetValue(out))
+        return 0;
+    return key.height;
+}
+
 /*
  * Scan notarisationsdb backwards for blocks containing a notarisation
  * for given symbol. Return height of matched notarisation or 0.
@@ -119,6 +217,12 @@ int ScanNotarisationsDB(int height, std::string symbol, int scanLimitBlocks, Not
     if (height < 0 || height > chainActive.Height())
         return false;
 
+    if (pnotarisations->fSymbolIndex) {
+        if (scanLimitBlocks <= 0)
+            return 0;
+        return GetSymbolNotarisation(height, std::max(height - scanLimitBlocks + 1, 0), symbol, out);
+    }
+
     for (int i=0; i<scanLimitBlocks; i++) {
         if (i > height) break;
         NotarisationsInBlock notarisations;
@@ -142,6 +246,12 @@ int ScanNotarisationsDB2(int height, std::string symbol, int scanLimitBlocks, No
     maxheight = chainActive.Height();
     if ( height < 0 || height > maxheight )
         return false;
+    if ( pnotarisations->fSymbolIndex )
+    {
+        if ( scanLimitBlocks <= 0 )
+            return 0;
+        return GetSymbolNotarisationFrom(height,std::min(height+scanLimitBlocks-1,maxheight),symbol,out);
+    }
     for (i=0; i<scanLimitBlocks; i++)
     {
         ht = height+i;
@@ -6,10 +6,41 @@
 #include "cc/eval.h"
 
 
+/**
+ * Key of the index of notarisations by symbol and the height of the block
+ * holding them. Heights are stored inverted and big endian, so seeking to a
+ * height finds the newest notarisation at or below it.
+ */
+struct CNotarisationSymbolKey
+{
+    std::string symbol;
+    int height;
+
+    CNotarisationSymbolKey() : height(0) {}
+    CNotarisationSymbolKey(const std::string& symbolIn, int heightIn) : symbol(symbolIn), height(heightIn) {}
+
+    template<typename Stream>
+    void Serialize(Stream& s) const {
+        ser_writedata8(s, 'S');
+        ::Serialize(s, symbol);
+        ser_writedata32be(s, ~(uint32_t)height);
+    }
+    template<typename Stream>
+    void Unserialize(Stream& s) {
+        if (ser_readdata8(s) != 'S')
+            throw std::ios_base::failure("not a notarisation symbol key");
+        ::Unserialize(s, symbol);
+        height = ~ser_readdata32be(s);
+    }
+};
+
 class NotarisationDB : public CDBWrapper
 {
 public:
     NotarisationDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+
+    //! Whether the symbol index covers all blocks, otherwise lookups scan the blocks
+    bool fSymbolIndex;
 };
 
 
@@ -23,6 +54,9 @@ bool GetBlockNotarisations(uint256 blockHash, NotarisationsInBlock &nibs);
 bool GetBackNotarisation(uint256 notarisationHash, Notarisation &n);
 void WriteBackNotarisations(const NotarisationsInBlock notarisations, CDBBatch &batch);
 void EraseBackNotarisations(const NotarisationsInBlock notarisations, CDBBatch &batch);
+void WriteSymbolNotarisations(const NotarisationsInBlock notarisations, int height, CDBBatch &batch);
+void EraseSymbolNotarisations(const NotarisationsInBlock notarisations, int height, CDBBatch &batch);
+bool BuildNotarisationSymbolIndex();
 int ScanNotarisationsDB(int height, std::string symbol, int scanLimitBlocks, Notarisation& out);
 int ScanNotarisationsDB2(int height, std::string symbol, int scanLimitBlocks, Notarisation& out);
 bool IsTXSCL(const char* symbol);
@@ -0,0 +1,90 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "nspvcache.h"
+
+#include "memusage.h"
+
+CNSPVResponseCache nspvResponseCache;
+
+CNSPVResponseCache::CNSPVResponseCache() :
+    nBytes(0), nMaxBytes(DEFAULT_NSPV_CACHE_SIZE << 20), nGeneration(0), nHits(0), nMisses(0)
+{
+}
+
+size_t CNSPVResponseCache::EntryUsage(const bytes_t& request, const bytes_t& response)
+{
+    // The map and list nodes, the request is held by both
+    return memusage::MallocUsage(sizeof(std::pair<const bytes_t, Entry>) + 3 * sizeof(void*)) +
+        memusage::MallocUsage(sizeof(bytes_t) + 2 * sizeof(void*)) +
+        2 * memusage::DynamicUsage(request) + memusage::DynamicUsage(response);
+}
+
+void CNSPVResponseCache::Shrink(size_t nLimit)
+{
+    while (nBytes > nLimit && !lruRequests.empty()) {
+        std::map<bytes_t, Entry>::iterator it = mapEntries.find(lruRequests.back());
+        nBytes -= EntryUsage(it->first, it->second.response);
+        mapEntries.erase(it);
+        lruRequests.pop_back();
+    }
+}
+
+void CNSPVResponseCache::SetMaxBytes(size_t nMaxBytesIn)
+{
+    LOCK(cs);
+    nMaxBytes = nMaxBytesIn;
+    Shrink(nMaxBytes);
+}
+
+uint64_t CNSPVResponseCache::GetGeneration() const
+{
+    LOCK(cs);
+    return nGeneration;
+}
+
+bool CNSPVResponseCache::Lookup(const bytes_t& request, bytes_t& response)
+{
+    LOCK(cs);
+    std::map<bytes_t, Entry>::iterator it = mapEntries.find(request);
+    if (it == mapEntries.end()) {
+        nMisses++;
+        return false;
+    }
+    nHits++;
+    lruRequests.splice(lruRequests.begin(), lruRequests, it->second.itLRU);
+    response = it->second.response;
+    return true;
+}
+
+void CNSPVResponseCache::Store(const bytes_t& request, const bytes_t& response, uint64_t nGenerationIn)
+{
+    LOCK(cs);
+    size_t nUsage = EntryUsage(request, response);
+    if (nGenerationIn != nGeneration || nUsage > nMaxBytes || mapEntries.count(request))
+        return;
+    Shrink(nMaxBytes - nUsage);
+    Entry& entry = mapEntries[request];
+    entry.response = response;
+    entry.itLRU = lruRequests.insert(lruRequests.begin(), request);
+    nBytes += nUsage;
+}
+
+void CNSPVResponseCache::Invalidate()
+{
+    LOCK(cs);
+    nGeneration++;
+    mapEntries.clear();
+    lruRequests.clear();
+    nBytes = 0;
+}
+
+void CNSPVResponseCache::GetStats(uint64_t& nHitsOut, uint64_t& nMissesOut, size_t& nEntriesOut, size_t& nBytesOut) const
+{
+    LOCK(cs);
+    nHitsOut = nHits;
+    nMissesOut = nMisses;
+    nEntriesOut = mapEntries.size();
+    nBytesOut = nBytes;
+}
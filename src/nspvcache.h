@@ -0,0 +1,65 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_NSPVCACHE_H
+#define BITCOIN_NSPVCACHE_H
+
+#include "sync.h"
+
+#include <list>
+#include <map>
+#include <stdint.h>
+#include <vector>
+
+//! Default for -nspvcachesize, in MiB
+static const int64_t DEFAULT_NSPV_CACHE_SIZE = 32;
+
+/**
+ * Responses of the nSPV full node handlers, keyed by the request bytes (the
+ * request type followed by its arguments). The answers only depend on the
+ * chain, so the whole cache is dropped whenever the tip changes. Least
+ * recently used responses are evicted beyond the size limit.
+ */
+class CNSPVResponseCache
+{
+private:
+    typedef std::vector<uint8_t> bytes_t;
+
+    struct Entry {
+        bytes_t response;
+        std::list<bytes_t>::iterator itLRU;
+    };
+
+    mutable CCriticalSection cs;
+    std::map<bytes_t, Entry> mapEntries;
+    //! Requests of the entries, most recently used first
+    std::list<bytes_t> lruRequests;
+    size_t nBytes;
+    size_t nMaxBytes;
+    //! Bumped on every tip change, responses computed for an older tip are not stored
+    uint64_t nGeneration;
+    uint64_t nHits;
+    uint64_t nMisses;
+
+    static size_t EntryUsage(const bytes_t& request, const bytes_t& response);
+    void Shrink(size_t nLimit);
+
+public:
+    CNSPVResponseCache();
+
+    void SetMaxBytes(size_t nMaxBytesIn);
+
+    uint64_t GetGeneration() const;
+    bool Lookup(const bytes_t& request, bytes_t& response);
+    //! Stores the response, unless the tip changed since nGenerationIn was read
+    void Store(const bytes_t& request, const bytes_t& response, uint64_t nGenerationIn);
+    //! Called when the tip changes
+    void Invalidate();
+
+    void GetStats(uint64_t& nHitsOut, uint64_t& nMissesOut, size_t& nEntriesOut, size_t& nBytesOut) const;
+};
+
+extern CNSPVResponseCache nspvResponseCache;
+
+#endif // BITCOIN_NSPVCACHE_H
@@ -2,8 +2,13 @@
 #include "params.h"
 #include "ui_interface.h"
 
+#include <sys/stat.h>
+#include <unistd.h>
+
 std::map<std::string, ParamFile> mapParams;
 static const int K_READ_BUF_SIZE{ 1024 * 16 };
+//! Stamps of the parameter files found valid, in the parameter directory the daemons of all chains share
+static const char* PARAM_STAMPS_FILENAME = "paramstamps.dat";
 
 std::string CalcSha256(std::string filename)
 {
@@ -40,9 +45,92 @@ std::string CalcSha256(std::string filename)
 
 
 
+/**
+ * Size, modification time and inode of a file, empty when it can't be read.
+ * A parameter file with the stamp it had when its hash matched is taken as
+ * unchanged, librustzcash still checks its own hash of the files it loads.
+ */
+static std::string GetParamFileStamp(const boost::filesystem::path& path)
+{
+    struct stat st;
+    if (stat(path.string().c_str(), &st) != 0)
+        return "";
+    return strprintf("%llu %lld %llu", (unsigned long long)st.st_size, (long long)st.st_mtime, (unsigned long long)st.st_ino);
+}
+
+//! Stamp and hash of the verified parameter files by name, one "name size mtime inode hash" per line
+static void ReadParamStamps(const boost::filesystem::path& dir, std::map<std::string, std::string>& mapStamps)
+{
+    std::ifstream file((dir / PARAM_STAMPS_FILENAME).string());
+    std::string line;
+    while (std::getline(file, line)) {
+        size_t pos = line.find(' ');
+        if (pos != std::string::npos)
+            mapStamps.insert(std::make_pair(line.substr(0, pos), line.substr(pos + 1)));
+    }
+}
+
+/**
+ * The stamps of the parameter directory, where the daemons of the chains of a
+ * host find them whichever verified the files first, then those a daemon kept
+ * in its data directory when it couldn't write there.
+ */
+static std::map<std::string, std::string> ReadParamStamps()
+{
+    std::map<std::string, std::string> mapStamps;
+    ReadParamStamps(ZC_GetParamsDir(), mapStamps);
+    ReadParamStamps(GetDataDir(), mapStamps);
+    return mapStamps;
+}
+
+static bool WriteParamStamps(const boost::filesystem::path& dir, const std::map<std::string, std::string>& mapStamps)
+{
+    // Daemons started together write their own temporary files, the last rename wins
+    boost::filesystem::path path = dir / PARAM_STAMPS_FILENAME;
+    boost::filesystem::path pathTmp = dir / strprintf("%s.%d.new", PARAM_STAMPS_FILENAME, (int)getpid());
+    {
+        std::ofstream file(pathTmp.string(), std::ofstream::trunc);
+        for (const std::pair<std::string, std::string>& stamp : mapStamps)
+            file << stamp.first << " " << stamp.second << "\n";
+        if (!file.good()) {
+            LogPrintf("Unable to write %s\n", pathTmp.string());
+            boost::system::error_code ec;
+            boost::filesystem::remove(pathTmp, ec);
+            return false;
+        }
+    }
+    if (!RenameOver(pathTmp, path)) {
+        LogPrintf("Unable to rename %s to %s\n", pathTmp.string(), path.string());
+        return false;
+    }
+    return true;
+}
+
+static void WriteParamStamps(const std::map<std::string, std::string>& mapStamps)
+{
+    if (!WriteParamStamps(ZC_GetParamsDir(), mapStamps)) {
+        WriteParamStamps(GetDataDir(), mapStamps);
+        return;
+    }
+    // All the stamps are in the parameter directory now, including those that came from here
+    boost::system::error_code ec;
+    boost::filesystem::remove(GetDataDir() / PARAM_STAMPS_FILENAME, ec);
+}
+
 bool checkParams() {
     bool allVerified = true;
+    std::map<std::string, std::string> mapStamps = ReadParamStamps();
+    bool fStampsChanged = false;
     for (std::map<std::string, ParamFile>::iterator it = mapParams.begin(); it != mapParams.end(); ++it) {
+        // A file unchanged since it was verified is not hashed again
+        std::string stamp = GetParamFileStamp(it->second.path);
+        std::map<std::string, std::string>::const_iterator itStamp = mapStamps.find(it->second.name);
+        if (!stamp.empty() && itStamp != mapStamps.end() && itStamp->second == stamp + " " + it->second.hash) {
+            LogPrintf("%s unchanged since it was verified\n", it->second.name);
+            it->second.verified = true;
+            continue;
+        }
+
         std::string uiMessage = "Verifying " + it->second.name + "....";
         uiInterface.InitMessage(_(uiMessage.c_str()));
 
@@ -53,10 +141,17 @@ bool checkParams() {
 
         if (sha256Sum == it->second.hash) {
             it->second.verified = true;
+            if (!stamp.empty()) {
+                mapStamps[it->second.name] = stamp + " " + it->second.hash;
+                fStampsChanged = true;
+            }
         } else {
             allVerified = false;
+            fStampsChanged = mapStamps.erase(it->second.name) > 0 || fStampsChanged;
         }
     }
+    if (fStampsChanged)
+        WriteParamStamps(mapStamps);
     return allVerified;
 }
 
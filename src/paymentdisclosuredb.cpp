@@ -7,12 +7,42 @@
 #include "util.h"
 #include "dbwrapper.h"
 
+#include <leveldb/write_batch.h>
+
+#include <algorithm>
+#include <thread>
+
 #include <boost/filesystem.hpp>
 
 using namespace std;
 
 static boost::filesystem::path emptyPath;
 
+// Prefix of the index keys, the key strings of JSOutPoint::ToString() start with 'J'
+static const char DB_TXID_INDEX = 't';
+
+static std::string IndexKey(const PaymentDisclosureKey& key)
+{
+    CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+    ssKey << DB_TXID_INDEX << key;
+    return std::string(ssKey.begin(), ssKey.end());
+}
+
+static std::string IndexPrefix(const uint256& txid)
+{
+    CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+    ssKey << DB_TXID_INDEX << txid;
+    return std::string(ssKey.begin(), ssKey.end());
+}
+
+static std::string SerializeInfo(const PaymentDisclosureInfo& info)
+{
+    CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+    ssValue.reserve(GetSerializeSize(ssValue, info));
+    ssValue << info;
+    return std::string(ssValue.begin(), ssValue.end());
+}
+
 /**
  * Static method to return the shared/default payment disclosure database.
  */
@@ -54,18 +84,49 @@ bool PaymentDisclosureDB::Put(const PaymentDisclosureKey& key, const PaymentDisc
         return false;
     }
 
-    std::lock_guard<std::mutex> guard(lock_);
+    return PutBatch(std::vector<PaymentDisclosureKeyInfo>(1, PaymentDisclosureKeyInfo(key, info)));
+}
 
-    CDataStream ssValue(SER_DISK, CLIENT_VERSION);
-    ssValue.reserve(GetSerializeSize(ssValue, info));
-    ssValue << info;
-    leveldb::Slice slice(&ssValue[0], ssValue.size());
+bool PaymentDisclosureDB::PutBatch(const std::vector<PaymentDisclosureKeyInfo>& entries)
+{
+    if (db == nullptr) {
+        return false;
+    }
+
+    leveldb::WriteBatch batch;
+    for (const PaymentDisclosureKeyInfo& entry : entries) {
+        std::string strValue = SerializeInfo(entry.second);
+        batch.Put(entry.first.ToString(), strValue);
+        batch.Put(IndexKey(entry.first), strValue);
+    }
 
-    leveldb::Status status = db->Put(writeOptions, key.ToString(), slice);
+    std::lock_guard<std::mutex> guard(lock_);
+    leveldb::Status status = db->Write(writeOptions, &batch);
     dbwrapper_private::HandleError(status);
     return true;
 }
 
+void PaymentDisclosureDB::PutTransactionAsync(const std::string& strOperationId, const uint256& txid, std::vector<PaymentDisclosureKeyInfo> entries)
+{
+    for (PaymentDisclosureKeyInfo& entry : entries) {
+        entry.first.hash = txid;
+    }
+    // The thread keeps the database open until it is done
+    std::shared_ptr<PaymentDisclosureDB> db = sharedInstance();
+    std::thread([db, strOperationId, entries]() {
+        try {
+            if (!db->PutBatch(entries)) {
+                LogPrint("paymentdisclosure", "%s: Payment Disclosure: Error writing %u entries to database for txid %s\n", strOperationId, entries.size(), entries[0].first.hash.ToString());
+                return;
+            }
+        } catch (const std::exception& e) {
+            LogPrintf("%s: Payment Disclosure: Error writing to database: %s\n", strOperationId, e.what());
+            return;
+        }
+        LogPrint("paymentdisclosure", "%s: Payment Disclosure: Successfully added %u entries to database for txid %s\n", strOperationId, entries.size(), entries[0].first.hash.ToString());
+    }).detach();
+}
+
 bool PaymentDisclosureDB::Get(const PaymentDisclosureKey& key, PaymentDisclosureInfo& info)
 {
     if (db == nullptr) {
@@ -74,8 +135,11 @@ bool PaymentDisclosureDB::Get(const PaymentDisclosureKey& key, PaymentDisclosure
 
     std::lock_guard<std::mutex> guard(lock_);
 
+    // The key strings only have the start of the txid, entries written before the index only have them
     std::string strValue;
-    leveldb::Status status = db->Get(readOptions, key.ToString(), &strValue);
+    leveldb::Status status = db->Get(readOptions, IndexKey(key), &strValue);
+    if (status.IsNotFound())
+        status = db->Get(readOptions, key.ToString(), &strValue);
     if (!status.ok()) {
         if (status.IsNotFound())
             return false;
@@ -91,3 +155,38 @@ bool PaymentDisclosureDB::Get(const PaymentDisclosureKey& key, PaymentDisclosure
     }
     return true;
 }
+
+bool PaymentDisclosureDB::GetByTxid(const uint256& txid, std::vector<PaymentDisclosureKeyInfo>& entries)
+{
+    entries.clear();
+    if (db == nullptr) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> guard(lock_);
+
+    const std::string strPrefix = IndexPrefix(txid);
+    std::unique_ptr<leveldb::Iterator> it(db->NewIterator(readOptions));
+    for (it->Seek(strPrefix); it->Valid() && it->key().starts_with(strPrefix); it->Next()) {
+        try {
+            CDataStream ssKey(it->key().data(), it->key().data() + it->key().size(), SER_DISK, CLIENT_VERSION);
+            CDataStream ssValue(it->value().data(), it->value().data() + it->value().size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            PaymentDisclosureKeyInfo entry;
+            ssKey >> chType >> entry.first;
+            ssValue >> entry.second;
+            entries.push_back(entry);
+        } catch (const std::exception&) {
+            return false;
+        }
+    }
+    if (!it->status().ok()) {
+        LogPrintf("PaymentDisclosure: LevelDB read failure: %s\n", it->status().ToString());
+        dbwrapper_private::HandleError(it->status());
+    }
+    // js is serialized little endian
+    std::sort(entries.begin(), entries.end(), [](const PaymentDisclosureKeyInfo& a, const PaymentDisclosureKeyInfo& b) {
+        return a.first < b.first;
+    });
+    return true;
+}
@@ -12,12 +12,19 @@
 #include <mutex>
 #include <future>
 #include <memory>
+#include <vector>
 
 #include <boost/optional.hpp>
 
 #include <leveldb/db.h>
 
 
+/**
+ * Database of the payment disclosure info of the shielded outputs made by
+ * this node. An entry is written under the key string it always had, and
+ * again under an index key of the full txid, js and n, so the entries
+ * of a transaction are read with one range scan.
+ */
 class PaymentDisclosureDB
 {
 protected:
@@ -35,7 +42,17 @@ public:
     ~PaymentDisclosureDB();
 
     bool Put(const PaymentDisclosureKey& key, const PaymentDisclosureInfo& info);
+    //! Writes the entries, usually those of one transaction, in one batch
+    bool PutBatch(const std::vector<PaymentDisclosureKeyInfo>& entries);
     bool Get(const PaymentDisclosureKey& key, PaymentDisclosureInfo& info);
+    //! Reads the entries of a transaction in js then n order
+    bool GetByTxid(const uint256& txid, std::vector<PaymentDisclosureKeyInfo>& entries);
+
+    /**
+     * Writes the entries of the transaction txid on a background thread, so
+     * an operation that broadcast it doesn't wait on the database
+     */
+    static void PutTransactionAsync(const std::string& strOperationId, const uint256& txid, std::vector<PaymentDisclosureKeyInfo> entries);
 };
 
 
@@ -27,11 +27,15 @@
 #include "crypto/equihash.h"
 #include "primitives/block.h"
 #include "streams.h"
+#include "sync.h"
 #include "uint256.h"
 #include "util.h"
 
 #include "sodium.h"
 
+#include <deque>
+#include <set>
+
 #ifdef ENABLE_RUST
 #include "librustzcash.h"
 #endif // ENABLE_RUST
@@ -767,9 +771,17 @@ bool CheckEquihashSolution(const CBlockHeader *pblock, const CChainParams& param
 
     if ( Params().NetworkIDString() == "regtest" )
         return(true);
-    // Hash state
-    crypto_generichash_blake2b_state state;
-    EhInitialiseState(n, k, state);
+
+    // Oldest entries are evicted first
+    static CCriticalSection cs_equihashcache;
+    static std::set<uint256> setValidSolutions;
+    static std::deque<uint256> dequeValidSolutions;
+    const uint256 hash = pblock->GetHash();
+    {
+        LOCK(cs_equihashcache);
+        if (setValidSolutions.count(hash))
+            return true;
+    }
 
     // I = the block header minus nonce and solution.
     CEquihashInput I{*pblock};
@@ -778,15 +790,32 @@ bool CheckEquihashSolution(const CBlockHeader *pblock, const CChainParams& param
     ss << I;
     ss << pblock->nNonce;
 
-    // H(I||V||...
-    crypto_generichash_blake2b_update(&state, (unsigned char*)&ss[0], ss.size());
-
     bool isValid;
-    EhIsValidSolution(n, k, state, pblock->nSolution, isValid);
+    EhLeafHasher leaves;
+    if (leaves.Initialise(n, k, (unsigned char*)&ss[0], ss.size())) {
+        EhIsValidSolutionLeaves(n, k, leaves, pblock->nSolution, isValid);
+    } else {
+        // Hash state
+        crypto_generichash_blake2b_state state;
+        EhInitialiseState(n, k, state);
+
+        // H(I||V||...
+        crypto_generichash_blake2b_update(&state, (unsigned char*)&ss[0], ss.size());
+
+        EhIsValidSolution(n, k, state, pblock->nSolution, isValid);
+    }
 
     if (!isValid)
         return error("CheckEquihashSolution(): invalid solution");
 
+    LOCK(cs_equihashcache);
+    if (setValidSolutions.insert(hash).second) {
+        dequeValidSolutions.push_back(hash);
+        if (dequeValidSolutions.size() > EQUIHASH_CACHE_SIZE) {
+            setValidSolutions.erase(dequeValidSolutions.front());
+            dequeValidSolutions.pop_front();
+        }
+    }
     return true;
 }
 
@@ -39,7 +39,15 @@ unsigned int CalculateNextWorkRequired(arith_uint256 bnAvg,
 
 unsigned int lwmaGetNextPOSRequired(const CBlockIndex* pindexLast, const Consensus::Params& params);
 
-/** Check whether the Equihash solution in a block header is valid */
+//! Number of block hashes whose Equihash solution is remembered as valid
+static const size_t EQUIHASH_CACHE_SIZE = 20000;
+
+/**
+ * Check whether the Equihash solution in a block header is valid. The hashes
+ * of recently accepted headers are remembered, since the hash commits to the
+ * solution, so a block checked once is not verified again on its way through
+ * the header, block and connect checks.
+ */
 bool CheckEquihashSolution(const CBlockHeader *pblock, const CChainParams&);
 
 /** Check whether a block hash satisfies the proof-of-work requirement specified by nBits */
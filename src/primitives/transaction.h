@@ -37,6 +37,7 @@
 #endif
 
 #include <array>
+#include <memory>
 
 #include <boost/variant.hpp>
 
@@ -894,4 +895,13 @@ struct CMutableTransaction
     uint256 GetHash() const;
 };
 
+/**
+ * A transaction shared by whoever holds it, such as the mempool entry and
+ * the notifications queued for it, instead of each keeping a deep copy of
+ * its shielded data. The hash is cached in the CTransaction itself.
+ */
+typedef std::shared_ptr<const CTransaction> CTransactionRef;
+static inline CTransactionRef MakeTransactionRef() { return std::make_shared<const CTransaction>(); }
+template <typename Tx> static inline CTransactionRef MakeTransactionRef(Tx&& txIn) { return std::make_shared<const CTransaction>(std::forward<Tx>(txIn)); }
+
 #endif // BITCOIN_PRIMITIVES_TRANSACTION_H
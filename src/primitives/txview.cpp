@@ -0,0 +1,264 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "primitives/txview.h"
+
+#include "hash.h"
+#include "streams.h"
+#include "version.h"
+#include "zcash/JoinSplit.hpp"
+
+#include <assert.h>
+#include <string.h>
+
+#include <algorithm>
+
+static_assert(sizeof(libzcash::SaplingEncCiphertext) == ZC_SAPLING_ENCCIPHERTEXT_SIZE && alignof(libzcash::SaplingEncCiphertext) == 1,
+              "a note ciphertext has to be readable in place");
+
+namespace {
+
+// Field offsets in the serialization of the descriptions
+const uint32_t SPEND_NULLIFIER_OFFSET = 64;     // after cv and anchor
+const uint32_t OUTPUT_CMU_OFFSET = 32;          // after cv
+const uint32_t OUTPUT_EPK_OFFSET = 64;
+const uint32_t OUTPUT_CIPHERTEXT_OFFSET = 96;
+
+size_t SpendSize()
+{
+    static const size_t nSize = ::GetSerializeSize(SpendDescription(), SER_NETWORK, PROTOCOL_VERSION);
+    return nSize;
+}
+
+size_t OutputSize()
+{
+    static const size_t nSize = ::GetSerializeSize(OutputDescription(), SER_NETWORK, PROTOCOL_VERSION);
+    return nSize;
+}
+
+size_t JoinSplitSize(bool fGroth)
+{
+    // The stream version of a transaction before Overwinter selects the PHGR proof
+    static const size_t nPHGRSize = ::GetSerializeSize(JSDescription(), SER_NETWORK, PROTOCOL_VERSION);
+    static const size_t nProofSize = ::GetSerializeSize(libzcash::PHGRProof(), SER_NETWORK, PROTOCOL_VERSION);
+    return fGroth ? nPHGRSize - nProofSize + libzcash::GROTH_PROOF_SIZE : nPHGRSize;
+}
+
+//! Reads the count of a vector of fixed size elements, which has to fit in what is left
+uint32_t ReadCount(CSpanReader& s, size_t nElementSize)
+{
+    uint64_t nCount = ReadCompactSize(s);
+    if (nCount > s.size() / nElementSize)
+        throw std::ios_base::failure("CTransactionView: end of data");
+    return nCount;
+}
+
+}
+
+CTransactionView::CTransactionView() :
+    pBegin(NULL), nSize(0), fOverwintered(false), nVersion(0), nVersionGroupId(0), nLockTime(0), nExpiryHeight(0),
+    valueBalance(0), nSpendsOffset(0), nSpends(0), nShieldedOutputsOffset(0), nShieldedOutputs(0),
+    nJoinSplitsOffset(0), nJoinSplits(0), nJoinSplitSize(0), fHashed(false)
+{
+}
+
+CTransactionView::CTransactionView(const char* pData, size_t nSizeIn) : CTransactionView()
+{
+    pBegin = pData;
+    CSpanReader s(SER_NETWORK, PROTOCOL_VERSION, pData, nSizeIn);
+    auto offset = [&]() { return (uint32_t)(nSizeIn - s.size()); };
+
+    // Same layout as CTransaction::SerializationOp
+    uint32_t header;
+    s >> header;
+    fOverwintered = header >> 31;
+    nVersion = header & 0x7FFFFFFF;
+    if (fOverwintered)
+        s >> nVersionGroupId;
+    const bool isOverwinterV3 = fOverwintered && nVersionGroupId == OVERWINTER_VERSION_GROUP_ID && nVersion == OVERWINTER_TX_VERSION;
+    const bool isSaplingV4 = fOverwintered && nVersionGroupId == SAPLING_VERSION_GROUP_ID && nVersion == SAPLING_TX_VERSION;
+    if (fOverwintered && !(isOverwinterV3 || isSaplingV4))
+        throw std::ios_base::failure("Unknown transaction format");
+
+    // Counts aren't trusted for reserving beyond what the smallest input and output left would take
+    uint64_t nCount = ReadCompactSize(s);
+    vInputOffsets.reserve(std::min<uint64_t>(nCount, s.size() / 41));
+    for (uint64_t i = 0; i < nCount; i++) {
+        vInputOffsets.push_back(offset());
+        s.ignore(36);
+        s.ignore(ReadCompactSize(s));
+        s.ignore(4);
+    }
+    nCount = ReadCompactSize(s);
+    vOutputOffsets.reserve(std::min<uint64_t>(nCount, s.size() / 9));
+    for (uint64_t i = 0; i < nCount; i++) {
+        vOutputOffsets.push_back(offset());
+        s.ignore(8);
+        s.ignore(ReadCompactSize(s));
+    }
+    s >> nLockTime;
+    if (isOverwinterV3 || isSaplingV4)
+        s >> nExpiryHeight;
+    if (isSaplingV4) {
+        s >> valueBalance;
+        nSpends = ReadCount(s, SpendSize());
+        nSpendsOffset = offset();
+        s.ignore(nSpends * SpendSize());
+        nShieldedOutputs = ReadCount(s, OutputSize());
+        nShieldedOutputsOffset = offset();
+        s.ignore(nShieldedOutputs * OutputSize());
+    }
+    if (nVersion >= 2) {
+        nJoinSplitSize = JoinSplitSize(fOverwintered && nVersion >= SAPLING_TX_VERSION);
+        nJoinSplits = ReadCount(s, nJoinSplitSize);
+        nJoinSplitsOffset = offset();
+        s.ignore(nJoinSplits * nJoinSplitSize);
+        if (nJoinSplits > 0)
+            s.ignore(32 + 64); // joinSplitPubKey and joinSplitSig
+    }
+    if (isSaplingV4 && !(nSpends == 0 && nShieldedOutputs == 0))
+        s.ignore(64); // bindingSig
+    nSize = offset();
+}
+
+const char* CTransactionView::At(uint32_t nOffset, size_t nBytes) const
+{
+    assert(nOffset + nBytes <= nSize);
+    return pBegin + nOffset;
+}
+
+const uint256& CTransactionView::GetHash() const
+{
+    if (!fHashed) {
+        hash = Hash(pBegin, pBegin + nSize);
+        fHashed = true;
+    }
+    return hash;
+}
+
+bool CTransactionView::IsCoinBase() const
+{
+    return vInputOffsets.size() == 1 && GetPrevout(0).IsNull();
+}
+
+COutPoint CTransactionView::GetPrevout(size_t i) const
+{
+    CSpanReader s(SER_NETWORK, PROTOCOL_VERSION, At(vInputOffsets.at(i), 36), 36);
+    COutPoint prevout;
+    s >> prevout;
+    return prevout;
+}
+
+CTxIn CTransactionView::GetInput(size_t i) const
+{
+    CSpanReader s(SER_NETWORK, PROTOCOL_VERSION, At(vInputOffsets.at(i), 0), nSize - vInputOffsets[i]);
+    CTxIn txin;
+    s >> txin;
+    return txin;
+}
+
+CAmount CTransactionView::GetOutputValue(size_t i) const
+{
+    CSpanReader s(SER_NETWORK, PROTOCOL_VERSION, At(vOutputOffsets.at(i), 8), 8);
+    CAmount nValue;
+    s >> nValue;
+    return nValue;
+}
+
+CTxOut CTransactionView::GetOutput(size_t i) const
+{
+    CSpanReader s(SER_NETWORK, PROTOCOL_VERSION, At(vOutputOffsets.at(i), 0), nSize - vOutputOffsets[i]);
+    CTxOut txout;
+    s >> txout;
+    return txout;
+}
+
+uint256 CTransactionView::GetSpendNullifier(size_t i) const
+{
+    assert(i < nSpends);
+    uint256 nullifier;
+    memcpy(nullifier.begin(), At(nSpendsOffset + i * SpendSize() + SPEND_NULLIFIER_OFFSET, 32), 32);
+    return nullifier;
+}
+
+SpendDescription CTransactionView::GetSpend(size_t i) const
+{
+    assert(i < nSpends);
+    CSpanReader s(SER_NETWORK, PROTOCOL_VERSION, At(nSpendsOffset + i * SpendSize(), SpendSize()), SpendSize());
+    SpendDescription spend;
+    s >> spend;
+    return spend;
+}
+
+uint256 CTransactionView::GetShieldedOutputCmu(size_t i) const
+{
+    assert(i < nShieldedOutputs);
+    uint256 cmu;
+    memcpy(cmu.begin(), At(nShieldedOutputsOffset + i * OutputSize() + OUTPUT_CMU_OFFSET, 32), 32);
+    return cmu;
+}
+
+uint256 CTransactionView::GetShieldedOutputEphemeralKey(size_t i) const
+{
+    assert(i < nShieldedOutputs);
+    uint256 epk;
+    memcpy(epk.begin(), At(nShieldedOutputsOffset + i * OutputSize() + OUTPUT_EPK_OFFSET, 32), 32);
+    return epk;
+}
+
+const libzcash::SaplingEncCiphertext& CTransactionView::GetShieldedOutputCiphertext(size_t i) const
+{
+    assert(i < nShieldedOutputs);
+    return *reinterpret_cast<const libzcash::SaplingEncCiphertext*>(
+        At(nShieldedOutputsOffset + i * OutputSize() + OUTPUT_CIPHERTEXT_OFFSET, ZC_SAPLING_ENCCIPHERTEXT_SIZE));
+}
+
+OutputDescription CTransactionView::GetShieldedOutput(size_t i) const
+{
+    assert(i < nShieldedOutputs);
+    CSpanReader s(SER_NETWORK, PROTOCOL_VERSION, At(nShieldedOutputsOffset + i * OutputSize(), OutputSize()), OutputSize());
+    OutputDescription output;
+    s >> output;
+    return output;
+}
+
+JSDescription CTransactionView::GetJoinSplit(size_t i) const
+{
+    assert(i < nJoinSplits);
+    // The proof is read as the transaction's version selects
+    const uint32_t header = (fOverwintered ? 1u << 31 : 0) | nVersion;
+    CSpanReader s(SER_NETWORK, static_cast<int>(header), At(nJoinSplitsOffset + i * nJoinSplitSize, nJoinSplitSize), nJoinSplitSize);
+    JSDescription joinsplit;
+    s >> joinsplit;
+    return joinsplit;
+}
+
+CTransaction CTransactionView::ToTransaction() const
+{
+    CSpanReader s(SER_NETWORK, PROTOCOL_VERSION, pBegin, nSize);
+    CTransaction tx;
+    s >> tx;
+    return tx;
+}
+
+CBlockView::CBlockView(const char* pData, size_t nSizeIn) : pBegin(pData)
+{
+    CSpanReader s(SER_NETWORK, PROTOCOL_VERSION, pData, nSizeIn);
+    s >> header;
+    uint64_t nTx = ReadCompactSize(s);
+    vtx.reserve(std::min<uint64_t>(nTx, s.size() / 10));
+    for (uint64_t i = 0; i < nTx; i++) {
+        vtx.push_back(CTransactionView(pData + (nSizeIn - s.size()), s.size()));
+        s.ignore(vtx.back().size());
+    }
+    nSize = nSizeIn - s.size();
+}
+
+CBlock CBlockView::ToBlock() const
+{
+    CSpanReader s(SER_NETWORK, PROTOCOL_VERSION, pBegin, nSize);
+    CBlock block;
+    s >> block;
+    return block;
+}
@@ -0,0 +1,125 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_PRIMITIVES_TXVIEW_H
+#define BITCOIN_PRIMITIVES_TXVIEW_H
+
+#include "primitives/block.h"
+#include "primitives/transaction.h"
+#include "uint256.h"
+#include "zcash/NoteEncryption.hpp"
+
+#include <stdint.h>
+#include <vector>
+
+/**
+ * Read-only view of a serialized transaction over bytes it borrows, which
+ * have to outlive it. Parsing only records where the inputs, outputs and
+ * shielded descriptions are, the fields are read from the bytes when they
+ * are asked for, so the ciphertexts and proofs of a transaction that is only
+ * looked at are never copied. The hash is computed over the bytes the first
+ * time it is asked for and kept, so a view must not be shared between threads
+ * before then.
+ */
+class CTransactionView
+{
+public:
+    CTransactionView();
+    //! Parses the transaction at the front of [pData, pData + nSize), throws std::ios_base::failure if it is malformed
+    CTransactionView(const char* pData, size_t nSize);
+
+    //! The view covers [data(), data() + size())
+    const char* data() const { return pBegin; }
+    size_t size() const { return nSize; }
+    const uint256& GetHash() const;
+
+    bool IsOverwintered() const { return fOverwintered; }
+    int32_t GetVersion() const { return nVersion; }
+    uint32_t GetVersionGroupId() const { return nVersionGroupId; }
+    uint32_t GetLockTime() const { return nLockTime; }
+    uint32_t GetExpiryHeight() const { return nExpiryHeight; }
+    CAmount GetValueBalance() const { return valueBalance; }
+    bool IsCoinBase() const;
+
+    size_t GetInputCount() const { return vInputOffsets.size(); }
+    COutPoint GetPrevout(size_t i) const;
+    CTxIn GetInput(size_t i) const;
+
+    size_t GetOutputCount() const { return vOutputOffsets.size(); }
+    CAmount GetOutputValue(size_t i) const;
+    CTxOut GetOutput(size_t i) const;
+
+    size_t GetSpendCount() const { return nSpends; }
+    uint256 GetSpendNullifier(size_t i) const;
+    SpendDescription GetSpend(size_t i) const;
+
+    size_t GetShieldedOutputCount() const { return nShieldedOutputs; }
+    uint256 GetShieldedOutputCmu(size_t i) const;
+    uint256 GetShieldedOutputEphemeralKey(size_t i) const;
+    //! The note ciphertext of an output, in the borrowed bytes
+    const libzcash::SaplingEncCiphertext& GetShieldedOutputCiphertext(size_t i) const;
+    OutputDescription GetShieldedOutput(size_t i) const;
+
+    size_t GetJoinSplitCount() const { return nJoinSplits; }
+    JSDescription GetJoinSplit(size_t i) const;
+
+    //! Deserializes the whole transaction
+    CTransaction ToTransaction() const;
+
+private:
+    const char* pBegin;
+    size_t nSize;
+
+    bool fOverwintered;
+    int32_t nVersion;
+    uint32_t nVersionGroupId;
+    uint32_t nLockTime;
+    uint32_t nExpiryHeight;
+    CAmount valueBalance;
+
+    //! Offsets in the bytes of the inputs and outputs, whose sizes vary with their scripts
+    std::vector<uint32_t> vInputOffsets;
+    std::vector<uint32_t> vOutputOffsets;
+    uint32_t nSpendsOffset;
+    uint32_t nSpends;
+    uint32_t nShieldedOutputsOffset;
+    uint32_t nShieldedOutputs;
+    uint32_t nJoinSplitsOffset;
+    uint32_t nJoinSplits;
+    uint32_t nJoinSplitSize;
+
+    mutable bool fHashed;
+    mutable uint256 hash;
+
+    const char* At(uint32_t nOffset, size_t nBytes) const;
+};
+
+/**
+ * Read-only view of a serialized block over bytes it borrows, such as a
+ * block read with ReadRawBlockFromDisk. Only the header is deserialized, the
+ * transactions are views.
+ */
+class CBlockView
+{
+public:
+    CBlockView() : pBegin(NULL), nSize(0) {}
+    //! Parses the block in [pData, pData + nSize), throws std::ios_base::failure if it is malformed
+    CBlockView(const char* pData, size_t nSize);
+
+    const CBlockHeader& GetHeader() const { return header; }
+    uint256 GetHash() const { return header.GetHash(); }
+
+    const std::vector<CTransactionView>& GetTransactions() const { return vtx; }
+
+    //! Deserializes the whole block
+    CBlock ToBlock() const;
+
+private:
+    const char* pBegin;
+    size_t nSize;
+    CBlockHeader header;
+    std::vector<CTransactionView> vtx;
+};
+
+#endif // BITCOIN_PRIMITIVES_TXVIEW_H
@@ -0,0 +1,69 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "proofcache.h"
+
+#include "crypto/common.h"
+#include "cuckoocache.h"
+#include "util.h"
+
+namespace {
+
+/** Set of salted (txid, branch id) hashes */
+class CProofCache
+{
+private:
+    CCuckooCache cache;
+
+    uint256 Key(const uint256& txid, uint32_t consensusBranchId) const
+    {
+        unsigned char branch[4];
+        WriteLE32(branch, consensusBranchId);
+        uint256 key;
+        cache.Hasher().Write(txid.begin(), 32).Write(branch, 4).Finalize(key.begin());
+        return key;
+    }
+
+public:
+    CProofCache() : cache(GetArg("-maxproofcachesize", DEFAULT_MAX_PROOF_CACHE_SIZE)) {}
+
+    bool Get(const uint256& txid, uint32_t consensusBranchId)
+    {
+        return cache.Contains(Key(txid, consensusBranchId));
+    }
+
+    void Set(const uint256& txid, uint32_t consensusBranchId)
+    {
+        cache.Insert(Key(txid, consensusBranchId));
+    }
+
+    void GetSize(size_t& nEntries, size_t& nCapacity) const
+    {
+        nEntries = cache.Size();
+        nCapacity = cache.Capacity();
+    }
+};
+
+CProofCache& GetProofCache()
+{
+    static CProofCache proofCache;
+    return proofCache;
+}
+
+}
+
+bool ProofCacheContains(const uint256& txid, uint32_t consensusBranchId)
+{
+    return GetProofCache().Get(txid, consensusBranchId);
+}
+
+void ProofCacheAdd(const uint256& txid, uint32_t consensusBranchId)
+{
+    GetProofCache().Set(txid, consensusBranchId);
+}
+
+void GetProofCacheSize(size_t& nEntries, size_t& nCapacity)
+{
+    GetProofCache().GetSize(nEntries, nCapacity);
+}
@@ -0,0 +1,27 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_PROOFCACHE_H
+#define BITCOIN_PROOFCACHE_H
+
+#include "uint256.h"
+
+#include <stdint.h>
+
+/** Default for -maxproofcachesize, the number of transactions kept in the proof cache */
+static const int64_t DEFAULT_MAX_PROOF_CACHE_SIZE = 20000;
+
+/**
+ * Transactions whose JoinSplit and Sapling proofs and shielded signatures
+ * were verified, so a transaction accepted to the mempool is not verified
+ * again when it is mined. The signatures commit to the consensus branch id,
+ * so an entry is only valid for the branch it was verified under. The txid
+ * commits to the proofs and signatures themselves.
+ */
+bool ProofCacheContains(const uint256& txid, uint32_t consensusBranchId);
+void ProofCacheAdd(const uint256& txid, uint32_t consensusBranchId);
+//! Entries in the proof cache and the number it holds at most, without taking its lock
+void GetProofCacheSize(size_t& nEntries, size_t& nCapacity);
+
+#endif // BITCOIN_PROOFCACHE_H
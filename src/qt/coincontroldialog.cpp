@@ -223,11 +223,19 @@ void CoinControlDialog::showMenu(const QPoint &point)
                 unlockAction->setEnabled(false);
             }
         }
-        else // this means click on parent node in tree mode -> disable all
+        else // this means click on parent node in tree mode -> lock or unlock all its outputs
         {
             copyTransactionHashAction->setEnabled(false);
-            lockAction->setEnabled(false);
-            unlockAction->setEnabled(false);
+            bool fLocked = false, fUnlocked = false;
+            for (int i = 0; i < item->childCount(); i++) {
+                // locked outputs are the disabled ones
+                if (item->child(i)->isDisabled())
+                    fLocked = true;
+                else
+                    fUnlocked = true;
+            }
+            lockAction->setEnabled(fUnlocked);
+            unlockAction->setEnabled(fLocked);
         }
 
         // show context menu
@@ -265,26 +273,49 @@ void CoinControlDialog::copyTransactionHash()
     GUIUtil::setClipboard(contextMenuItem->text(COLUMN_TXHASH));
 }
 
+// outputs the context menu acts on, all those of an address for a parent node in tree mode
+QList<QTreeWidgetItem*> CoinControlDialog::contextMenuOutputs() const
+{
+    QList<QTreeWidgetItem*> items;
+    if (contextMenuItem->text(COLUMN_TXHASH).length() == 64)
+        items.append(contextMenuItem);
+    else
+        for (int i = 0; i < contextMenuItem->childCount(); i++)
+            items.append(contextMenuItem->child(i));
+    return items;
+}
+
 // context menu action: lock coin
 void CoinControlDialog::lockCoin()
 {
-    if (contextMenuItem->checkState(COLUMN_CHECKBOX) == Qt::Checked)
-        contextMenuItem->setCheckState(COLUMN_CHECKBOX, Qt::Unchecked);
-
-    COutPoint outpt(uint256S(contextMenuItem->text(COLUMN_TXHASH).toStdString()), contextMenuItem->text(COLUMN_VOUT_INDEX).toUInt());
-    model->lockCoin(outpt);
-    contextMenuItem->setDisabled(true);
-    contextMenuItem->setIcon(COLUMN_CHECKBOX, platformStyle->SingleColorIcon(":/icons/lock_closed"));
+    QList<QTreeWidgetItem*> items = contextMenuOutputs();
+    std::vector<COutPoint> vOutpts;
+    for (QTreeWidgetItem *item : items) {
+        if (item->isDisabled())
+            continue;
+        if (item->checkState(COLUMN_CHECKBOX) == Qt::Checked)
+            item->setCheckState(COLUMN_CHECKBOX, Qt::Unchecked);
+        vOutpts.push_back(COutPoint(uint256S(item->text(COLUMN_TXHASH).toStdString()), item->text(COLUMN_VOUT_INDEX).toUInt()));
+        item->setDisabled(true);
+        item->setIcon(COLUMN_CHECKBOX, platformStyle->SingleColorIcon(":/icons/lock_closed"));
+    }
+    model->lockCoins(vOutpts);
     updateLabelLocked();
 }
 
 // context menu action: unlock coin
 void CoinControlDialog::unlockCoin()
 {
-    COutPoint outpt(uint256S(contextMenuItem->text(COLUMN_TXHASH).toStdString()), contextMenuItem->text(COLUMN_VOUT_INDEX).toUInt());
-    model->unlockCoin(outpt);
-    contextMenuItem->setDisabled(false);
-    contextMenuItem->setIcon(COLUMN_CHECKBOX, QIcon());
+    QList<QTreeWidgetItem*> items = contextMenuOutputs();
+    std::vector<COutPoint> vOutpts;
+    for (QTreeWidgetItem *item : items) {
+        if (!item->isDisabled())
+            continue;
+        vOutpts.push_back(COutPoint(uint256S(item->text(COLUMN_TXHASH).toStdString()), item->text(COLUMN_VOUT_INDEX).toUInt()));
+        item->setDisabled(false);
+        item->setIcon(COLUMN_CHECKBOX, QIcon());
+    }
+    model->unlockCoins(vOutpts);
     updateLabelLocked();
 }
 
@@ -622,9 +653,17 @@ void CoinControlDialog::updateView()
     std::map<QString, std::vector<COutput> > mapCoins;
     model->listCoins(mapCoins);
 
+    // Locked coins are read once rather than taking the wallet lock per output
+    std::vector<COutPoint> vLocked;
+    model->listLockedCoins(vLocked);
+    std::set<COutPoint> setLocked(vLocked.begin(), vLocked.end());
+
+    // Items are built detached and added to the tree at once, every insertion
+    // into the tree is a model update of the view
+    QList<QTreeWidgetItem*> topLevelItems;
+
     for (const std::pair<QString, std::vector<COutput>>& coins : mapCoins) {
-        CCoinControlWidgetItem *itemWalletAddress = new CCoinControlWidgetItem();
-        itemWalletAddress->setCheckState(COLUMN_CHECKBOX, Qt::Unchecked);
+        CCoinControlWidgetItem *itemWalletAddress = nullptr;
         QString sWalletAddress = coins.first;
         QString sWalletLabel = model->getAddressTableModel()->labelForAddress(sWalletAddress);
         if (sWalletLabel.isEmpty())
@@ -633,7 +672,8 @@ void CoinControlDialog::updateView()
         if (treeMode)
         {
             // wallet address
-            ui->treeWidget->addTopLevelItem(itemWalletAddress);
+            itemWalletAddress = new CCoinControlWidgetItem();
+            topLevelItems.append(itemWalletAddress);
 
             itemWalletAddress->setFlags(flgTristate);
             itemWalletAddress->setCheckState(COLUMN_CHECKBOX, Qt::Unchecked);
@@ -653,7 +693,10 @@ void CoinControlDialog::updateView()
 
             CCoinControlWidgetItem *itemOutput;
             if (treeMode)    itemOutput = new CCoinControlWidgetItem(itemWalletAddress);
-            else             itemOutput = new CCoinControlWidgetItem(ui->treeWidget);
+            else {
+                itemOutput = new CCoinControlWidgetItem();
+                topLevelItems.append(itemOutput);
+            }
             itemOutput->setFlags(flgCheckbox);
             itemOutput->setCheckState(COLUMN_CHECKBOX,Qt::Unchecked);
 
@@ -678,10 +721,8 @@ void CoinControlDialog::updateView()
             }
             else if (!treeMode)
             {
-                QString sLabel = model->getAddressTableModel()->labelForAddress(sAddress);
-                if (sLabel.isEmpty())
-                    sLabel = tr("(no label)");
-                itemOutput->setText(COLUMN_LABEL, sLabel);
+                // the output pays to the wallet address itself
+                itemOutput->setText(COLUMN_LABEL, sWalletLabel);
             }
 
             // amount
@@ -704,9 +745,9 @@ void CoinControlDialog::updateView()
             itemOutput->setText(COLUMN_VOUT_INDEX, QString::number(out.i));
 
              // disable locked coins
-            if (model->isLockedCoin(txhash, out.i))
+            COutPoint outpt(txhash, out.i);
+            if (setLocked.count(outpt))
             {
-                COutPoint outpt(txhash, out.i);
                 coinControl->UnSelect(outpt); // just to be sure
                 itemOutput->setDisabled(true);
                 itemOutput->setIcon(COLUMN_CHECKBOX, platformStyle->SingleColorIcon(":/icons/lock_closed"));
@@ -726,6 +767,7 @@ void CoinControlDialog::updateView()
             itemWalletAddress->setData(COLUMN_AMOUNT, Qt::UserRole, QVariant((qlonglong)nSum));
         }
     }
+    ui->treeWidget->addTopLevelItems(topLevelItems);
 
     // expand all partially selected
     if (treeMode)
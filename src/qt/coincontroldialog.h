@@ -71,6 +71,7 @@ private:
 
     void sortView(int, Qt::SortOrder);
     void updateView();
+    QList<QTreeWidgetItem*> contextMenuOutputs() const;
 
     enum
     {
@@ -8,9 +8,12 @@
 #include <QFile>
 #include <QTextStream>
 
+//! Rows written between two progress signals
+static const int CSV_PROGRESS_ROWS = 1000;
+
 CSVModelWriter::CSVModelWriter(const QString &_filename, QObject *parent) :
     QObject(parent),
-    filename(_filename), model(0)
+    filename(_filename), model(0), fCancelled(false)
 {
 }
 
@@ -52,6 +55,7 @@ bool CSVModelWriter::write()
     if(!file.open(QIODevice::WriteOnly | QIODevice::Text))
         return false;
     QTextStream out(&file);
+    fCancelled = false;
 
     int numRows = 0;
     if(model)
@@ -73,6 +77,17 @@ bool CSVModelWriter::write()
     // Data rows
     for(int j=0; j<numRows; ++j)
     {
+        if(j % CSV_PROGRESS_ROWS == 0)
+        {
+            // A modal progress dialog connected to this processes the events, cancel() included
+            Q_EMIT progress(j, numRows);
+            if(fCancelled)
+            {
+                file.close();
+                file.remove();
+                return false;
+            }
+        }
         for(int i=0; i<columns.size(); ++i)
         {
             if(i!=0)
@@ -84,6 +99,7 @@ bool CSVModelWriter::write()
         }
         writeNewline(out);
     }
+    Q_EMIT progress(numRows, numRows);
 
     file.close();
 
@@ -30,9 +30,21 @@ public:
     */
     bool write();
 
+    /** Whether the last write() stopped on cancel() */
+    bool wasCancelled() const { return fCancelled; }
+
+public Q_SLOTS:
+    /** Stop writing at the next row, the partial file is removed */
+    void cancel() { fCancelled = true; }
+
+Q_SIGNALS:
+    /** Emitted every CSV_PROGRESS_ROWS rows written */
+    void progress(int rowsWritten, int rows);
+
 private:
     QString filename;
     const QAbstractItemModel *model;
+    bool fCancelled;
 
     struct Column
     {
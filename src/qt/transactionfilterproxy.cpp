@@ -18,8 +18,8 @@ const QDateTime TransactionFilterProxy::MAX_DATE = QDateTime::fromTime_t(0xFFFFF
 
 TransactionFilterProxy::TransactionFilterProxy(QObject *parent) :
     QSortFilterProxyModel(parent),
-    dateFrom(MIN_DATE),
-    dateTo(MAX_DATE),
+    timeFrom(MIN_DATE.toTime_t()),
+    timeTo(MAX_DATE.toTime_t()),
     addrPrefix(),
     typeFilter(ALL_TYPES),
     watchOnlyFilter(WatchOnlyFilter_All),
@@ -29,40 +29,68 @@ TransactionFilterProxy::TransactionFilterProxy(QObject *parent) :
 {
 }
 
+// The rows of the source are TransactionTableModel indexes pointing to their record
+static const TransactionRecord *sourceRecord(const QModelIndex &index)
+{
+    return static_cast<const TransactionRecord*>(index.internalPointer());
+}
+
 bool TransactionFilterProxy::filterAcceptsRow(int sourceRow, const QModelIndex &sourceParent) const
 {
     QModelIndex index = sourceModel()->index(sourceRow, 0, sourceParent);
-
-    int type = index.data(TransactionTableModel::TypeRole).toInt();
-    QDateTime datetime = index.data(TransactionTableModel::DateRole).toDateTime();
-    bool involvesWatchAddress = index.data(TransactionTableModel::WatchonlyRole).toBool();
-    QString address = index.data(TransactionTableModel::AddressRole).toString();
-    QString label = index.data(TransactionTableModel::LabelRole).toString();
-    qint64 amount = llabs(index.data(TransactionTableModel::AmountRole).toLongLong());
-    int status = index.data(TransactionTableModel::StatusRole).toInt();
-
-    if(!showInactive && status == TransactionStatus::Conflicted)
+    const TransactionRecord *rec = sourceRecord(index);
+    if (!rec)
         return false;
-    if(!(TYPE(type) & typeFilter))
+
+    // Each criterion is read from the record, the cheap ones first, so the
+    // label is only looked up for rows that pass them and whose address
+    // doesn't match the search text
+    if(!showInactive && rec->status.status == TransactionStatus::Conflicted)
         return false;
-    if (involvesWatchAddress && watchOnlyFilter == WatchOnlyFilter_No)
+    if(!(TYPE(rec->type) & typeFilter))
         return false;
-    if (!involvesWatchAddress && watchOnlyFilter == WatchOnlyFilter_Yes)
+    if (rec->involvesWatchAddress && watchOnlyFilter == WatchOnlyFilter_No)
         return false;
-    if(datetime < dateFrom || datetime > dateTo)
+    if (!rec->involvesWatchAddress && watchOnlyFilter == WatchOnlyFilter_Yes)
         return false;
-    if (!address.contains(addrPrefix, Qt::CaseInsensitive) && !label.contains(addrPrefix, Qt::CaseInsensitive))
+    if(rec->time < timeFrom || rec->time > timeTo)
         return false;
-    if(amount < minAmount)
+    if(llabs(rec->credit + rec->debit) < minAmount)
         return false;
+    if (!addrPrefix.isEmpty()) {
+        QString address = QString::fromStdString(rec->address);
+        if (!address.contains(addrPrefix, Qt::CaseInsensitive) &&
+            !index.data(TransactionTableModel::LabelRole).toString().contains(addrPrefix, Qt::CaseInsensitive))
+            return false;
+    }
 
     return true;
 }
 
+bool TransactionFilterProxy::lessThan(const QModelIndex &left, const QModelIndex &right) const
+{
+    // Compare the unformatted values of the records instead of boxing them
+    const TransactionRecord *recLeft = sourceRecord(left);
+    const TransactionRecord *recRight = sourceRecord(right);
+    if (recLeft && recRight && sortRole() == Qt::EditRole) {
+        switch (left.column()) {
+        case TransactionTableModel::Date:
+            return recLeft->time < recRight->time;
+        case TransactionTableModel::Amount:
+            return recLeft->credit + recLeft->debit < recRight->credit + recRight->debit;
+        case TransactionTableModel::Status:
+            return recLeft->status.sortKey < recRight->status.sortKey;
+        default:
+            break;
+        }
+    }
+    return QSortFilterProxyModel::lessThan(left, right);
+}
+
 void TransactionFilterProxy::setDateRange(const QDateTime &from, const QDateTime &to)
 {
-    this->dateFrom = from;
-    this->dateTo = to;
+    this->timeFrom = from.toTime_t();
+    this->timeTo = to.toTime_t();
     invalidateFilter();
 }
 
@@ -101,6 +129,15 @@ void TransactionFilterProxy::setShowInactive(bool _showInactive)
     invalidateFilter();
 }
 
+bool TransactionFilterProxy::canFetchMore(const QModelIndex &parent) const
+{
+    // A limited list already showing its rows doesn't need the older history,
+    // its view would otherwise fetch it all as long as the last row is visible
+    if (limitRows != -1 && QSortFilterProxyModel::rowCount(parent) >= limitRows)
+        return false;
+    return QSortFilterProxyModel::canFetchMore(parent);
+}
+
 int TransactionFilterProxy::rowCount(const QModelIndex &parent) const
 {
     if(limitRows != -1)
@@ -50,13 +50,16 @@ public:
     void setShowInactive(bool showInactive);
 
     int rowCount(const QModelIndex &parent = QModelIndex()) const;
+    bool canFetchMore(const QModelIndex &parent) const;
 
 protected:
     bool filterAcceptsRow(int source_row, const QModelIndex & source_parent) const;
+    bool lessThan(const QModelIndex &left, const QModelIndex &right) const;
 
 private:
-    QDateTime dateFrom;
-    QDateTime dateTo;
+    //! Date range in the seconds of TransactionRecord::time
+    qint64 timeFrom;
+    qint64 timeTo;
     QString addrPrefix;
     quint32 typeFilter;
     WatchOnlyFilter watchOnlyFilter;
@@ -27,6 +27,10 @@
 #include <QIcon>
 #include <QList>
 #include <QSettings>
+#include <QTimer>
+
+//! Wallet transactions decoded into records each time the view wants more rows
+static const int TX_TABLE_FETCH_SIZE = 200;
 
 // Amount column is right-aligned it contains numbers
 static int column_alignments[] = {
@@ -74,6 +78,15 @@ public:
      */
     QList<TransactionRecord> cachedWallet;
 
+    /* Wallet and archived transactions by (height, index), the most recent
+     * first. Only the ordering is read when the wallet is refreshed, the
+     * transactions are decoded into cachedWallet as the view scrolls to them.
+     */
+    std::vector<uint256> sortedTxids;
+    size_t nNextSorted = 0;
+    //! Transactions with records in cachedWallet, the ones added by updateWallet included
+    std::set<uint256> setLoaded;
+
     /* Query entire wallet anew from core.
      */
     void refreshWallet()
@@ -82,53 +95,67 @@ public:
         LogPrintf("Refreshing GUI Wallet from core\n");
 
         cachedWallet.clear();
+        sortedTxids.clear();
+        nNextSorted = 0;
+        setLoaded.clear();
 
-        bool fIncludeWatchonly = true;
         {
             LOCK2(cs_main, wallet->cs_wallet);
 
             //Get all Archived Transactions
-            uint256 ut;
             std::map<std::pair<int,int>, uint256> sortedArchive;
             for (map<uint256, ArchiveTxPoint>::iterator it = wallet->mapArcTxs.begin(); it != wallet->mapArcTxs.end(); ++it)
             {
-                uint256 txid = (*it).first;
-                ArchiveTxPoint arcTxPt = (*it).second;
-                std::pair<int,int> key;
+                const ArchiveTxPoint& arcTxPt = (*it).second;
+                if (arcTxPt.hashBlock.IsNull())
+                    continue;
 
-                if (!arcTxPt.hashBlock.IsNull() && mapBlockIndex[arcTxPt.hashBlock] != nullptr) {
-                    key = make_pair(mapBlockIndex[arcTxPt.hashBlock]->GetHeight(), arcTxPt.nIndex);
-                    sortedArchive[key] = txid;
-                }
+                BlockMap::const_iterator mi = mapBlockIndex.find(arcTxPt.hashBlock);
+                if (mi != mapBlockIndex.end() && mi->second != nullptr)
+                    sortedArchive[make_pair(mi->second->GetHeight(), arcTxPt.nIndex)] = (*it).first;
             }
 
-
             int nPosUnconfirmed = 0;
-            for (map<uint256, CWalletTx>::iterator it = wallet->mapWallet.begin(); it != wallet->mapWallet.end(); ++it) {
-                CWalletTx wtx = (*it).second;
-                std::pair<int,int> key;
-
-                if (wtx.GetDepthInMainChain() == 0) {
-                    ut = wtx.GetHash();
-                    key = make_pair(chainActive.Tip()->GetHeight() + 1,  nPosUnconfirmed);
-                    sortedArchive[key] = wtx.GetHash();
-                    nPosUnconfirmed++;
-                } else if (!wtx.hashBlock.IsNull() && mapBlockIndex[wtx.hashBlock] != nullptr) {
-                    key = make_pair(mapBlockIndex[wtx.hashBlock]->GetHeight(), wtx.nIndex);
-                    sortedArchive[key] = wtx.GetHash();
+            for (map<uint256, CWalletTx>::const_iterator it = wallet->mapWallet.begin(); it != wallet->mapWallet.end(); ++it) {
+                const CWalletTx& wtx = (*it).second;
+                BlockMap::const_iterator mi = wtx.hashBlock.IsNull() ? mapBlockIndex.end() : mapBlockIndex.find(wtx.hashBlock);
+
+                if (wtx.GetDepthInMainChain() != 0 && mi != mapBlockIndex.end() && mi->second != nullptr) {
+                    sortedArchive[make_pair(mi->second->GetHeight(), wtx.nIndex)] = (*it).first;
                 } else {
-                    key = make_pair(chainActive.Tip()->GetHeight() + 1,  nPosUnconfirmed);
-                    sortedArchive[key] = wtx.GetHash();
+                    sortedArchive[make_pair(chainActive.Tip()->GetHeight() + 1,  nPosUnconfirmed)] = (*it).first;
                     nPosUnconfirmed++;
                 }
             }
 
+            sortedTxids.reserve(sortedArchive.size());
+            for (map<std::pair<int,int>, uint256>::reverse_iterator it = sortedArchive.rbegin(); it != sortedArchive.rend(); ++it)
+                sortedTxids.push_back((*it).second);
+        }
 
+        cachedWallet = fetchMore();
+    }
 
-            for (map<std::pair<int,int>, uint256>::reverse_iterator it = sortedArchive.rbegin(); it != sortedArchive.rend(); ++it)
-            {
+    bool canFetchMore() const
+    {
+        return nNextSorted < sortedTxids.size();
+    }
 
-                uint256 txid = (*it).second;
+    /* Decode the next TX_TABLE_FETCH_SIZE transactions of sortedTxids that
+     * are shown. The caller appends the records to cachedWallet.
+     */
+    QList<TransactionRecord> fetchMore()
+    {
+        bool fIncludeWatchonly = true;
+        QList<TransactionRecord> fetched;
+        {
+            LOCK2(cs_main, wallet->cs_wallet);
+
+            for (int nTxs = 0; nNextSorted < sortedTxids.size() && nTxs < TX_TABLE_FETCH_SIZE; nNextSorted++)
+            {
+                uint256 txid = sortedTxids[nNextSorted];
+                if (setLoaded.count(txid))
+                    continue;
                 RpcArcTransaction arcTx;
 
                 if (wallet->mapWallet.count(txid)) {
@@ -156,11 +183,12 @@ public:
 
                 }
 
-                cachedWallet.append(TransactionRecord::decomposeTransaction(arcTx));
-
-                if (cachedWallet.size() >= 200) break;
+                fetched.append(TransactionRecord::decomposeTransaction(arcTx));
+                setLoaded.insert(txid);
+                nTxs++;
             }
         }
+        return fetched;
     }
 
     /* Update our model of the wallet incrementally, to synchronize our model of the wallet
@@ -172,14 +200,7 @@ public:
     {
 
         // Find bounds of this transaction in model
-        bool inModel = false;
-        QList<TransactionRecord>::iterator i;
-        for (i = cachedWallet.begin(); i != cachedWallet.end(); ++i) {
-            TransactionRecord tRecord = *i;
-            if (tRecord.hash == hash) {
-                inModel = true;
-            }
-        }
+        bool inModel = setLoaded.count(hash) > 0;
 
         QList<TransactionRecord>::iterator lower = qLowerBound(
             cachedWallet.begin(), cachedWallet.end(), hash, TxLessThan());
@@ -245,6 +266,7 @@ public:
                     parent->endRemoveRows();
                     break;
                 }
+                setLoaded.insert(hash);
 
                 // Added -- insert at the right position
                 QList<TransactionRecord> toInsert =
@@ -272,6 +294,7 @@ public:
             parent->beginRemoveRows(QModelIndex(), lowerIndex, upperIndex-1);
             cachedWallet.erase(lower, upper);
             parent->endRemoveRows();
+            setLoaded.erase(hash);
             break;
         case CT_UPDATED:
             // Miscellaneous updates -- nothing to do, status update will take care of this, and is only computed for
@@ -360,6 +383,11 @@ TransactionTableModel::TransactionTableModel(const PlatformStyle *_platformStyle
 
     connect(walletModel->getOptionsModel(), SIGNAL(displayUnitChanged(int)), this, SLOT(updateDisplayUnit()));
 
+    // Notifications of the wallet are applied in batches, at most once per delay
+    notifyTimer = new QTimer(this);
+    connect(notifyTimer, SIGNAL(timeout()), this, SLOT(processNotifications()));
+    notifyTimer->start(MODEL_UPDATE_DELAY);
+
     subscribeToCoreSignals();
 }
 
@@ -405,6 +433,26 @@ int TransactionTableModel::rowCount(const QModelIndex &parent) const
     return priv->size();
 }
 
+bool TransactionTableModel::canFetchMore(const QModelIndex &parent) const
+{
+    if (parent.isValid())
+        return false;
+    return priv->canFetchMore();
+}
+
+void TransactionTableModel::fetchMore(const QModelIndex &parent)
+{
+    if (parent.isValid())
+        return;
+    // The number of rows is only known once the page is decoded
+    QList<TransactionRecord> fetched = priv->fetchMore();
+    if (fetched.isEmpty())
+        return;
+    beginInsertRows(QModelIndex(), priv->size(), priv->size() + fetched.size() - 1);
+    priv->cachedWallet.append(fetched);
+    endInsertRows();
+}
+
 int TransactionTableModel::columnCount(const QModelIndex &parent) const
 {
     Q_UNUSED(parent);
@@ -904,68 +952,68 @@ void TransactionTableModel::updateDisplayUnit()
     Q_EMIT dataChanged(index(0, Amount), index(priv->size()-1, Amount));
 }
 
-// queue notifications to show a non freezing progress dialog e.g. for rescan
-struct TransactionNotification
-{
-public:
-    TransactionNotification() {}
-    TransactionNotification(uint256 _hash, ChangeType _status, bool _showTransaction):
-        hash(_hash), status(_status), showTransaction(_showTransaction) {}
-
-    void invoke(QObject *ttm)
-    {
-        QString strHash = QString::fromStdString(hash.GetHex());
-        qDebug() << "NotifyTransactionChanged: " + strHash + " status= " + QString::number(status);
-        QMetaObject::invokeMethod(ttm, "updateTransaction", Qt::QueuedConnection,
-                                  Q_ARG(QString, strHash),
-                                  Q_ARG(int, status),
-                                  Q_ARG(bool, showTransaction));
-    }
-private:
-    uint256 hash;
-    ChangeType status;
-    bool showTransaction;
-};
-
+/* Notifications of the wallet, queued by the core threads until the GUI
+ * applies them. A transaction notified several times is queued once, at
+ * its first position, with its last status. They are held while a progress
+ * dialog is shown e.g. for rescan, so the dialog doesn't freeze.
+ */
+static CCriticalSection cs_queueNotifications;
 static bool fQueueNotifications = false;
-static std::vector< TransactionNotification > vQueueNotifications;
+static std::vector<uint256> vQueueNotifications;
+static std::map<uint256, ChangeType> mapQueueNotifications;
 
 static void NotifyTransactionChanged(TransactionTableModel *ttm, CWallet *wallet, const uint256 &hash, ChangeType status)
 {
-    // Find transaction in wallet
-    std::map<uint256, CWalletTx>::iterator mi = wallet->mapWallet.find(hash);
-    // Determine whether to show transaction or not (determine this here so that no relocking is needed in GUI thread)
-    bool inWallet = mi != wallet->mapWallet.end();
-    bool showTransaction = (inWallet && TransactionRecord::showTransaction(mi->second));
-
-    TransactionNotification notification(hash, status, showTransaction);
-
-    if (fQueueNotifications)
-    {
-        vQueueNotifications.push_back(notification);
-        return;
-    }
-    notification.invoke(ttm);
+    Q_UNUSED(ttm);
+    Q_UNUSED(wallet);
+    LOCK(cs_queueNotifications);
+    std::pair<std::map<uint256, ChangeType>::iterator, bool> ret = mapQueueNotifications.insert(std::make_pair(hash, status));
+    if (ret.second)
+        vQueueNotifications.push_back(hash);
+    else
+        ret.first->second = status;
 }
 
 static void ShowProgress(TransactionTableModel *ttm, const std::string &title, int nProgress)
 {
+    LOCK(cs_queueNotifications);
     if (nProgress == 0)
         fQueueNotifications = true;
 
     if (nProgress == 100)
-    {
         fQueueNotifications = false;
-        if (vQueueNotifications.size() > 10) // prevent balloon spam, show maximum 10 balloons
-            QMetaObject::invokeMethod(ttm, "setProcessingQueuedTransactions", Qt::QueuedConnection, Q_ARG(bool, true));
-        for (unsigned int i = 0; i < vQueueNotifications.size(); ++i)
-        {
-            if (vQueueNotifications.size() - i <= 10)
-                QMetaObject::invokeMethod(ttm, "setProcessingQueuedTransactions", Qt::QueuedConnection, Q_ARG(bool, false));
+}
 
-            vQueueNotifications[i].invoke(ttm);
+void TransactionTableModel::processNotifications()
+{
+    std::vector<uint256> vHashes;
+    std::map<uint256, ChangeType> mapStatus;
+    {
+        LOCK(cs_queueNotifications);
+        if (fQueueNotifications || vQueueNotifications.empty())
+            return;
+        vHashes.swap(vQueueNotifications);
+        mapStatus.swap(mapQueueNotifications);
+    }
+
+    // Determine whether to show each transaction once for the batch
+    std::vector<bool> vShow(vHashes.size(), false);
+    {
+        LOCK2(cs_main, wallet->cs_wallet);
+        for (size_t i = 0; i < vHashes.size(); i++) {
+            std::map<uint256, CWalletTx>::iterator mi = wallet->mapWallet.find(vHashes[i]);
+            vShow[i] = mi != wallet->mapWallet.end() && TransactionRecord::showTransaction(mi->second);
         }
-        std::vector<TransactionNotification >().swap(vQueueNotifications); // clear
+    }
+
+    // prevent balloon spam, show maximum 10 balloons
+    fProcessingQueuedTransactions = vHashes.size() > 10;
+    for (size_t i = 0; i < vHashes.size(); i++) {
+        if (vHashes.size() - i <= 10)
+            fProcessingQueuedTransactions = false;
+
+        qDebug() << "NotifyTransactionChanged: " + QString::fromStdString(vHashes[i].GetHex()) + " status= " + QString::number(mapStatus[vHashes[i]]);
+        priv->updateWallet(vHashes[i], mapStatus[vHashes[i]], vShow[i]);
     }
 }
 
@@ -11,6 +11,7 @@
 #include <QStringList>
 
 class PlatformStyle;
+class QTimer;
 class TransactionRecord;
 class TransactionTablePriv;
 class WalletModel;
@@ -78,6 +79,9 @@ public:
 
     void refreshWallet();
     int rowCount(const QModelIndex &parent) const;
+    /** History is decoded a page at a time as the view scrolls to its end */
+    bool canFetchMore(const QModelIndex &parent) const;
+    void fetchMore(const QModelIndex &parent);
     int columnCount(const QModelIndex &parent) const;
     QVariant data(const QModelIndex &index, int role) const;
     QVariant headerData(int section, Qt::Orientation orientation, int role) const;
@@ -91,6 +95,7 @@ private:
     TransactionTablePriv *priv;
     bool fProcessingQueuedTransactions;
     const PlatformStyle *platformStyle;
+    QTimer *notifyTimer;
 
     void subscribeToCoreSignals();
     void unsubscribeFromCoreSignals();
@@ -110,6 +115,8 @@ private:
 public Q_SLOTS:
     /* New transaction, or transaction changed status */
     void updateTransaction(const QString &hash, int status, bool showTransaction);
+    /* Apply the transaction notifications of the wallet queued since the last call */
+    void processNotifications();
     void updateConfirmations();
     void updateDisplayUnit();
     /** Updates the column title to "Amount (DisplayUnit)" and emits headerDataChanged() signal for table headers to react. */
@@ -20,6 +20,7 @@
 
 #include "ui_interface.h"
 
+#include <QApplication>
 #include <QComboBox>
 #include <QDateTimeEdit>
 #include <QDesktopServices>
@@ -30,6 +31,7 @@
 #include <QLineEdit>
 #include <QMenu>
 #include <QPoint>
+#include <QProgressDialog>
 #include <QScrollBar>
 #include <QSignalMapper>
 #include <QTableView>
@@ -358,7 +360,27 @@ void TransactionView::exportClicked()
     if (filename.isNull())
         return;
 
+    QProgressDialog progressDialog(tr("Loading the transaction history..."), tr("Cancel"), 0, 0, this);
+    progressDialog.setWindowModality(Qt::WindowModal);
+    progressDialog.setMinimumDuration(0);
+    progressDialog.setAutoClose(false);
+    progressDialog.setAutoReset(false);
+
+    // The history is decoded a page at a time, all of it is exported
+    TransactionTableModel *ttm = model->getTransactionTableModel();
+    while (ttm->canFetchMore(QModelIndex()) && !progressDialog.wasCanceled()) {
+        ttm->fetchMore(QModelIndex());
+        progressDialog.setLabelText(tr("Loading the transaction history... %n transaction(s)", "", ttm->rowCount(QModelIndex())));
+        qApp->processEvents();
+    }
+    if (progressDialog.wasCanceled())
+        return;
+
     CSVModelWriter writer(filename);
+    progressDialog.setLabelText(tr("Exporting the transaction history..."));
+    progressDialog.setRange(0, transactionProxyModel->rowCount());
+    connect(&writer, SIGNAL(progress(int,int)), &progressDialog, SLOT(setValue(int)));
+    connect(&progressDialog, SIGNAL(canceled()), &writer, SLOT(cancel()));
 
     // name, column, role
     writer.setModel(transactionProxyModel);
@@ -372,7 +394,12 @@ void TransactionView::exportClicked()
     writer.addColumn(KomodoUnits::getAmountColumnTitle(model->getOptionsModel()->getDisplayUnit()), 0, TransactionTableModel::FormattedAmountRole);
     writer.addColumn(tr("ID"), 0, TransactionTableModel::TxIDRole);
 
-    if(!writer.write()) {
+    bool fWritten = writer.write();
+    progressDialog.close();
+    if (writer.wasCancelled()) {
+        return;
+    }
+    else if(!fWritten) {
         Q_EMIT message(tr("Exporting Failed"), tr("There was an error trying to save the transaction history to %1.").arg(filename),
             CClientUIInterface::MSG_ERROR);
     }
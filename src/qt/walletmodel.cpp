@@ -41,6 +41,7 @@
 #include "rpc/server.h"
 
 #include <stdint.h>
+#include <atomic>
 
 #include <QDebug>
 #include <QMessageBox>
@@ -360,8 +361,12 @@ void WalletModel::checkBalanceChanged()
     }
 }
 
+//! Set while a call to updateTransaction is queued, so a burst of transactions queues one
+static std::atomic<bool> fTransactionUpdateQueued(false);
+
 void WalletModel::updateTransaction()
 {
+    fTransactionUpdateQueued = false;
     // Balance and number of transactions might have changed
     fForceCheckBalanceChanged = true;
 }
@@ -1057,7 +1062,8 @@ static void NotifyTransactionChanged(WalletModel *walletmodel, CWallet *wallet,
     Q_UNUSED(wallet);
     Q_UNUSED(hash);
     Q_UNUSED(status);
-    QMetaObject::invokeMethod(walletmodel, "updateTransaction", Qt::QueuedConnection);
+    if (!fTransactionUpdateQueued.exchange(true))
+        QMetaObject::invokeMethod(walletmodel, "updateTransaction", Qt::QueuedConnection);
 }
 
 static void NotifyWatchonlyChanged(WalletModel *walletmodel, bool fHaveWatchonly)
@@ -1188,6 +1194,20 @@ void WalletModel::unlockCoin(COutPoint& output)
     wallet->UnlockCoin(output);
 }
 
+void WalletModel::lockCoins(const std::vector<COutPoint>& vOutpts)
+{
+    LOCK2(cs_main, wallet->cs_wallet);
+    for (COutPoint output : vOutpts)
+        wallet->LockCoin(output);
+}
+
+void WalletModel::unlockCoins(const std::vector<COutPoint>& vOutpts)
+{
+    LOCK2(cs_main, wallet->cs_wallet);
+    for (COutPoint output : vOutpts)
+        wallet->UnlockCoin(output);
+}
+
 void WalletModel::listLockedCoins(std::vector<COutPoint>& vOutpts)
 {
     LOCK2(cs_main, wallet->cs_wallet);
@@ -1278,6 +1298,20 @@ std::map<libzcash::PaymentAddress, CAmount> WalletModel::getZAddressBalances(int
 CAmount WalletModel::getBalanceZaddr(std::string sAddress, int minDepth, bool requireSpendingKey) const
 {
     LOCK2(cs_main, wallet->cs_wallet);
+
+    // Balances polled by the GUI are served from the wallet's balance cache
+    if (minDepth == 0 || minDepth == 1) {
+        CShieldedBalances balances = wallet->GetShieldedBalances();
+        if (sAddress == "")
+            return balances.GetTotal(minDepth, requireSpendingKey);
+        auto zaddr = DecodePaymentAddress(sAddress);
+        auto saplingAddress = boost::get<libzcash::SaplingPaymentAddress>(&zaddr);
+        if (saplingAddress != nullptr) {
+            auto it = balances.mapAddresses.find(*saplingAddress);
+            return it == balances.mapAddresses.end() ? 0 : it->second.Get(minDepth, requireSpendingKey);
+        }
+    }
+
     std::map<libzcash::PaymentAddress, CAmount> balances;
     wallet->getZAddressBalances(balances, minDepth, requireSpendingKey);
 
@@ -247,6 +247,9 @@ public:
     bool isLockedCoin(uint256 hash, unsigned int n) const;
     void lockCoin(COutPoint& output);
     void unlockCoin(COutPoint& output);
+    //! Lock or unlock outputs under one wallet lock
+    void lockCoins(const std::vector<COutPoint>& vOutpts);
+    void unlockCoins(const std::vector<COutPoint>& vOutpts);
     void listLockedCoins(std::vector<COutPoint>& vOutpts);
 
     void loadReceiveRequests(std::vector<std::string>& vReceiveRequests);
@@ -45,6 +45,8 @@ struct ZAddressTableEntry
     QString       address;
     CAmount       balance;
     bool          mine;
+    //! Decoded address, to look up its balance without decoding it on each block
+    libzcash::SaplingPaymentAddress zaddr;
 
     ZAddressTableEntry() {}
 };
@@ -114,43 +116,18 @@ public:
         fForceCheckBalanceChanged = false;
         cachedNumBlocks = chainActive.Height();
 
-        std::map<QString, CAmount> stringBalances;
-        std::map<libzcash::PaymentAddress, CAmount> balances;
-        wallet->getZAddressBalances(balances, 0, false);
+        // Served from the wallet's balance cache, only rebuilt when notes changed
+        CShieldedBalances balances = wallet->GetShieldedBalances();
 
-
-        std::set<libzcash::SaplingPaymentAddress> addresses;
-        wallet->GetSaplingPaymentAddresses(addresses);
-        for (auto addr : addresses) {
-            if (balances.count(addr) == 0)
-                balances[addr] = 0;
-        }
-
-        for(std::map<libzcash::PaymentAddress, CAmount>::iterator it = balances.begin(); it != balances.end(); it++) {
-            stringBalances[QString::fromStdString(EncodePaymentAddress(it->first))] = it->second;
+        for (int i = 0; i < cachedAddressTable.size(); i++) {
+            ZAddressTableEntry &entry = cachedAddressTable[i];
+            std::map<libzcash::SaplingPaymentAddress, CShieldedAddressBalance>::const_iterator it = balances.mapAddresses.find(entry.zaddr);
+            CAmount balance = it == balances.mapAddresses.end() ? 0 : it->second.Get(0, false);
+            if (entry.balance != balance) {
+                entry.balance = balance;
+                parent->emitDataChanged(i);
+            }
         }
-
-          for (std::map<QString, CAmount>::iterator bi = stringBalances.begin(); bi != stringBalances.end(); bi++) {
-              QString address = bi->first;
-              QList<ZAddressTableEntry>::iterator lower = qLowerBound(
-                  cachedAddressTable.begin(), cachedAddressTable.end(), address, ZAddressTableEntryLessThan());
-              QList<ZAddressTableEntry>::iterator upper = qUpperBound(
-                  cachedAddressTable.begin(), cachedAddressTable.end(), address, ZAddressTableEntryLessThan());
-              int lowerIndex = (lower - cachedAddressTable.begin());
-              int upperIndex = (upper - cachedAddressTable.begin());
-              bool inModel = (lower != upper);
-
-              if (inModel) {
-                  if (bi != stringBalances.end()) {
-                      CAmount balance = CAmount(bi->second);
-                      lower->balance = balance;
-                      parent->emitDataChanged(lowerIndex);
-                  } else {
-                      lower->balance = CAmount(0);
-                      parent->emitDataChanged(lowerIndex);
-                  }
-              }
-          }
     }
 
     void refreshAddressTable()
@@ -159,9 +136,7 @@ public:
         {
             LOCK2(cs_main, wallet->cs_wallet);
 
-            std::map<libzcash::PaymentAddress, CAmount> balances;
-            wallet->getZAddressBalances(balances, 1, false);
-
+            CShieldedBalances balances = wallet->GetShieldedBalances();
 
             for (const std::pair<libzcash::PaymentAddress, CAddressBookData>& item : wallet->mapZAddressBook)
             {
@@ -180,9 +155,9 @@ public:
                     }
 
                   CAmount balance = 0;
-                  std::map<libzcash::PaymentAddress, CAmount>::iterator it = balances.find(zaddr);
-                  if (it != balances.end()) {
-                      balance = it->second;
+                  std::map<libzcash::SaplingPaymentAddress, CShieldedAddressBalance>::const_iterator it = balances.mapAddresses.find(*saplingAddr);
+                  if (it != balances.mapAddresses.end()) {
+                      balance = it->second.Get(1, false);
                   }
 
                   ZAddressTableEntry::Type addressType = translateTransactionType(
@@ -195,6 +170,7 @@ public:
                   entry.address = QString::fromStdString(EncodePaymentAddress(zaddr));
                   entry.balance = balance;
                   entry.mine = mine;
+                  entry.zaddr = *saplingAddr;
                   cachedAddressTable.append(entry);
 
                 }
@@ -246,6 +222,7 @@ public:
                 newEntry.address = address;
                 newEntry.balance = 0;
                 newEntry.mine = mine;
+                newEntry.zaddr = *saplingAddr;
                 cachedAddressTable.insert(lowerIndex, newEntry);
                 parent->endInsertRows();
                 break;
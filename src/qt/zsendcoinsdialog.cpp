@@ -26,6 +26,7 @@
 #include "wallet/wallet_fees.h"
 #include "wallet/wallet.h"
 #include "key_io.h"
+#include "asyncrpcqueue.h"
 #include "wallet/asyncrpcoperation_sendmany.h"
 #include "rpc/server.h"
 #include "utilmoneystr.h"
@@ -43,10 +44,16 @@ ZSendCoinsDialog::ZSendCoinsDialog(const PlatformStyle *_platformStyle, QWidget
     clientModel(0),
     model(0),
     fNewRecipientAllowed(true),
-    platformStyle(_platformStyle)
+    platformStyle(_platformStyle),
+    operationTimer(0),
+    nOperationStart(0)
 {
     ui->setupUi(this);
 
+    // The sent operation runs in the async RPC queue, its state is polled until it is done
+    operationTimer = new QTimer(this);
+    connect(operationTimer, SIGNAL(timeout()), this, SLOT(updateOperationStatus()));
+
     ui->payFromAddress->setMaxVisibleItems(10);
     // ui->payFromAddress->setStyleSheet("QComboBox { combobox-popup: 0; }");
 
@@ -265,6 +272,11 @@ void ZSendCoinsDialog::on_sendButton_clicked()
     fNewRecipientAllowed = true;
 
     setOperationId(currentTransaction.getOperationId());
+    if (sendStatus.status == WalletModel::OK) {
+        nOperationStart = GetTime();
+        updateOperationStatus();
+        operationTimer->start(OPERATION_STATUS_DELAY);
+    }
 }
 
 void ZSendCoinsDialog::clear()
@@ -431,6 +443,39 @@ void ZSendCoinsDialog::updateDisplayUnit()
 void ZSendCoinsDialog::setOperationId(const AsyncRPCOperationId& operationId)
 {
     ui->operationId->setText(QString::fromStdString(operationId));
+    ui->labelResultHeadline->setText(tr("Operation ID (opid):"));
+    operationTimer->stop();
+}
+
+void ZSendCoinsDialog::updateOperationStatus()
+{
+    std::shared_ptr<AsyncRPCOperation> operation = getAsyncRPCQueue()->getOperationForId(ui->operationId->text().toStdString());
+    if (!operation) {
+        operationTimer->stop();
+        return;
+    }
+
+    if (operation->isReady() || operation->isExecuting()) {
+        // Notes are selected, witnessed and proven by the operation in one step
+        QString strState = operation->isReady() ? tr("queued") : tr("creating proofs");
+        ui->labelResultHeadline->setText(tr("Operation ID (opid), %1 for %n second(s):", "", GetTime() - nOperationStart).arg(strState));
+        return;
+    }
+
+    operationTimer->stop();
+    if (operation->isSuccess()) {
+        UniValue result = operation->getResult();
+        UniValue txid = result.isObject() ? find_value(result, "txid") : UniValue();
+        ui->labelResultHeadline->setText(tr("Operation ID (opid), sent:"));
+        if (txid.isStr())
+            ui->operationId->setToolTip(tr("Transaction ID: %1").arg(QString::fromStdString(txid.get_str())));
+    } else if (operation->isFailed()) {
+        ui->labelResultHeadline->setText(tr("Operation ID (opid), failed:"));
+        Q_EMIT message(tr("Send Coins"), tr("The transaction could not be sent: %1").arg(QString::fromStdString(operation->getErrorMessage())),
+            CClientUIInterface::MSG_ERROR);
+    } else {
+        ui->labelResultHeadline->setText(tr("Operation ID (opid), cancelled:"));
+    }
 }
 
 void ZSendCoinsDialog::processSendCoinsReturn(const WalletModel::SendCoinsReturn &sendCoinsReturn, const QString &msgArg)
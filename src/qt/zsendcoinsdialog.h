@@ -63,6 +63,11 @@ private:
     WalletModel *model;
     bool fNewRecipientAllowed;
     const PlatformStyle *platformStyle;
+    QTimer *operationTimer;
+    int64_t nOperationStart;
+
+    //! Milliseconds between the polls of the state of the sent operation
+    static const int OPERATION_STATUS_DELAY = 1000;
 
     // Process WalletModel::SendCoinsReturn and generate a pair consisting
     // of a message and message flags for use in Q_EMIT message().
@@ -77,6 +82,7 @@ private Q_SLOTS:
     void useAvailableBalance(SendCoinsEntry* entry);
     void updateDisplayUnit();
     void coinControlUpdateLabels();
+    void updateOperationStatus();
 
 Q_SIGNALS:
     // Fired when a message should be reported to the user
@@ -0,0 +1,190 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#if defined(HAVE_CONFIG_H)
+#include "config/bitcoin-config.h"
+#endif
+
+#include "replaybench.h"
+
+#include "blockconnectstats.h"
+#include "chain.h"
+#include "coins.h"
+#include "consensus/validation.h"
+#include "init.h"
+#include "main.h"
+#include "util.h"
+#include "utilstrencodings.h"
+#include "utiltime.h"
+#ifdef ENABLE_WALLET
+#include "wallet/wallet.h"
+#endif
+
+#include <stdio.h>
+#include <vector>
+
+#include <boost/algorithm/string.hpp>
+
+unsigned int nReplaySkip = 0;
+
+int32_t komodo_connectblock(bool fJustCheck, CBlockIndex *pindex, CBlock& block);
+
+namespace {
+
+const struct {
+    ReplayFeature feature;
+    const char* name;
+} replayFeatures[] = {
+    {REPLAY_PROOFS, "proofs"},
+    {REPLAY_SCRIPTS, "scripts"},
+    {REPLAY_CC, "cc"},
+    {REPLAY_KOMODO, "komodo"},
+    {REPLAY_WALLET, "wallet"},
+};
+
+//! The report goes to the console as well, it is what the run is for
+void Report(const std::string& str)
+{
+    LogPrintf("%s", str);
+    fputs(str.c_str(), stdout);
+}
+
+}
+
+bool ParseReplayBench(const std::string& strRange, const std::string& strSkip, int& nStart, int& nEnd, unsigned int& nSkip, std::string& strError)
+{
+    std::vector<std::string> vRange;
+    boost::split(vRange, strRange, boost::is_any_of(":"));
+    if (vRange.size() != 2 || !ParseInt32(vRange[0], &nStart) || !ParseInt32(vRange[1], &nEnd) || nStart < 0 || nEnd <= nStart) {
+        strError = strprintf("Invalid -replaybench '%s', expected <start>:<end> with start < end", strRange);
+        return false;
+    }
+
+    nSkip = 0;
+    std::vector<std::string> vSkip;
+    if (!strSkip.empty())
+        boost::split(vSkip, strSkip, boost::is_any_of(","));
+    for (const std::string& strFeature : vSkip) {
+        bool fFound = false;
+        for (const auto& feature : replayFeatures) {
+            if (strFeature == feature.name) {
+                nSkip |= feature.feature;
+                fFound = true;
+            }
+        }
+        if (!fFound) {
+            strError = strprintf("Unknown -replaybenchskip feature '%s', expected proofs, scripts, cc, komodo or wallet", strFeature);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool RunReplayBench(int nStart, int nEnd, unsigned int nSkip, std::string& strError)
+{
+    LOCK(cs_main);
+    if (chainActive.Tip() == NULL || nEnd > chainActive.Height()) {
+        strError = strprintf("-replaybench end %d is above the tip at %d", nEnd, chainActive.Height());
+        return false;
+    }
+    if (pcoinsTip->GetBestBlock() != chainActive.Tip()->GetBlockHash()) {
+        strError = "-replaybench needs the chainstate at the tip of the active chain";
+        return false;
+    }
+    if (fPruneMode && chainActive[nStart + 1] && !(chainActive[nStart + 1]->nStatus & BLOCK_HAVE_DATA)) {
+        strError = strprintf("-replaybench start %d is below the blocks kept by -prune", nStart);
+        return false;
+    }
+
+    std::string strSkipped;
+    for (const auto& feature : replayFeatures)
+        if (nSkip & feature.feature)
+            strSkipped += std::string(strSkipped.empty() ? "" : ",") + feature.name;
+    Report(strprintf("Replay benchmark of blocks %d to %d, skipping: %s\n", nStart + 1, nEnd, strSkipped.empty() ? "none" : strSkipped));
+
+    // Rewind a copy of the tip's coins, memory only like the checks of VerifyDB
+    CCoinsViewCache view(pcoinsTip);
+    CValidationState state;
+    int64_t nTimeRewind = GetTimeMicros();
+    for (CBlockIndex* pindex = chainActive.Tip(); pindex->GetHeight() > nStart; pindex = pindex->pprev) {
+        boost::this_thread::interruption_point();
+        CBlock block;
+        bool fClean = true;
+        if (!ReadBlockFromDisk(block, pindex, 0)) {
+            strError = strprintf("-replaybench could not read the block at %d", pindex->GetHeight());
+            return false;
+        }
+        if (!DisconnectBlock(block, state, pindex, view, &fClean) || !fClean) {
+            strError = strprintf("-replaybench could not rewind the block at %d", pindex->GetHeight());
+            return false;
+        }
+    }
+    nTimeRewind = GetTimeMicros() - nTimeRewind;
+    Report(strprintf("Rewound %d blocks in %.2fs, %.1f MiB of coins\n", chainActive.Height() - nStart, nTimeRewind * 0.000001, view.DynamicMemoryUsage() / 1048576.0));
+
+    CBlockConnectStats totalsBefore;
+    GetBlockConnectStats(0, totalsBefore);
+    nReplaySkip = nSkip;
+    int64_t nTimeStart = GetTimeMicros();
+    bool fOk = true;
+    for (int nHeight = nStart + 1; nHeight <= nEnd && !ShutdownRequested(); nHeight++) {
+        CBlockIndex* pindex = chainActive[nHeight];
+        int64_t nTimeBlock = GetTimeMicros();
+        StartBlockConnectStats();
+
+        CBlock block;
+        if (!ReadBlockFromDisk(block, pindex, 0)) {
+            strError = strprintf("-replaybench could not read the block at %d", nHeight);
+            fOk = false;
+            break;
+        }
+        int64_t nTimeRead = GetTimeMicros();
+        AddBlockConnectTime(CONNECT_STAGE_READ, nTimeRead - nTimeBlock);
+
+        if (!ConnectBlock(block, state, pindex, view, true, false)) {
+            strError = strprintf("-replaybench failed to connect the block at %d: %s", nHeight, state.GetRejectReason());
+            fOk = false;
+            break;
+        }
+        // Only checking leaves the best block, the next block connects on top of this one
+        view.SetBestBlock(pindex->GetBlockHash());
+        int64_t nTimeConnect = GetTimeMicros();
+
+        if (!(nSkip & REPLAY_KOMODO)) {
+            komodo_connectblock(true, pindex, block);
+            AddBlockConnectTime(CONNECT_STAGE_KOMODO, GetTimeMicros() - nTimeConnect);
+        }
+#ifdef ENABLE_WALLET
+        if (!(nSkip & REPLAY_WALLET) && pwalletMain) {
+            int64_t nTimeWallet = GetTimeMicros();
+            std::vector<const CTransaction*> vtx;
+            for (const CTransaction& tx : block.vtx)
+                vtx.push_back(&tx);
+            pwalletMain->FindMySaplingNotes(vtx);
+            AddBlockConnectTime(CONNECT_STAGE_WALLET, GetTimeMicros() - nTimeWallet);
+        }
+#endif
+        FinishBlockConnectStats(pindex, block.vtx.size(), GetTimeMicros() - nTimeBlock);
+    }
+    nReplaySkip = 0;
+    int64_t nTimeTotal = GetTimeMicros() - nTimeStart;
+
+    CBlockConnectStats totals;
+    GetBlockConnectStats(0, totals);
+    uint64_t nBlocks = totals.nBlocks - totalsBefore.nBlocks;
+    uint64_t nTx = totals.nTx - totalsBefore.nTx;
+    double dSeconds = std::max<int64_t>(nTimeTotal, 1) * 0.000001;
+    Report(strprintf("Replayed %u blocks, %u transactions in %.2fs: %.2f blocks/s, %.1f tx/s\n",
+        nBlocks, nTx, dSeconds, nBlocks / dSeconds, nTx / dSeconds));
+    Report(strprintf("%-12s %12s %8s %12s %12s\n", "stage", "ms", "share", "blocks/s", "tx/s"));
+    for (int stage = 0; stage < CONNECT_STAGE_COUNT; stage++) {
+        int64_t nMicros = totals.nStageMicros[stage] - totalsBefore.nStageMicros[stage];
+        if (nMicros <= 0)
+            continue;
+        double dStageSeconds = nMicros * 0.000001;
+        Report(strprintf("%-12s %12.1f %7.1f%% %12.1f %12.1f\n", GetBlockConnectStageName(stage), nMicros * 0.001,
+            100.0 * dStageSeconds / dSeconds, nBlocks / dStageSeconds, nTx / dStageSeconds));
+    }
+    return fOk;
+}
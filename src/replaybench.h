@@ -0,0 +1,40 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_REPLAYBENCH_H
+#define BITCOIN_REPLAYBENCH_H
+
+#include <string>
+
+/** Work of connecting a block that -replaybenchskip can turn off */
+enum ReplayFeature
+{
+    REPLAY_PROOFS  = (1 << 0), //!< JoinSplit and Sapling proofs and signatures, in CheckBlock
+    REPLAY_SCRIPTS = (1 << 1), //!< Script checks of the inputs
+    REPLAY_CC      = (1 << 2), //!< CC evals of the inputs, run with the scripts
+    REPLAY_KOMODO  = (1 << 3), //!< Parsing the notarisations with komodo_connectblock, without a state update
+    REPLAY_WALLET  = (1 << 4), //!< Trial decryption of the block's Sapling outputs with the wallet's keys
+};
+
+/**
+ * Features ConnectBlock leaves out, only ever set while -replaybench runs.
+ * Blocks that -checkpoints or -assumenotarized exempt skip proofs and
+ * scripts regardless.
+ */
+extern unsigned int nReplaySkip;
+
+//! Parses -replaybench=<start>:<end> and -replaybenchskip=<feature>,...
+bool ParseReplayBench(const std::string& strRange, const std::string& strSkip, int& nStart, int& nEnd, unsigned int& nSkip, std::string& strError);
+
+/**
+ * Replays the blocks of the active chain after nStart up to nEnd through
+ * ConnectBlock and reports the throughput of each stage. The coins of the
+ * tip are rewound to nStart in memory with the undo data, so nothing is
+ * written to the block index or the chainstate, and connects only check.
+ * The rewind is held in memory, so a start far below the tip takes memory
+ * in proportion to the coins those blocks changed.
+ */
+bool RunReplayBench(int nStart, int nEnd, unsigned int nSkip, std::string& strError);
+
+#endif // BITCOIN_REPLAYBENCH_H
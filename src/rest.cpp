@@ -18,17 +18,23 @@
  *                                                                            *
  ******************************************************************************/
 
+#include "base58.h"
 #include "primitives/block.h"
 #include "primitives/transaction.h"
 #include "main.h"
+#include "httprpc.h"
 #include "httpserver.h"
 #include "rpc/server.h"
 #include "streams.h"
 #include "sync.h"
+#include "txdb.h"
 #include "txmempool.h"
 #include "utilstrencodings.h"
 #include "version.h"
 
+#include <algorithm>
+#include <limits>
+
 #include <boost/algorithm/string.hpp>
 #include <boost/dynamic_bitset.hpp>
 
@@ -37,6 +43,9 @@
 using namespace std;
 
 static const size_t MAX_GETUTXOS_OUTPOINTS = 15; //allow a max of 15 outpoints to be queried at once
+static const size_t MAX_COMPACTBLOCKS_REPLY_BYTES = 16 * 1000 * 1000; //cap on one compact block reply, cuts the range short
+static const long DEFAULT_BLOCKHASHES_LIMIT = 1000; //hashes per /rest/blockhashes page unless a limit is given
+static const long MAX_BLOCKHASHES_LIMIT = 10000;
 
 enum RetFormat {
     RF_UNDEF,
@@ -77,6 +86,12 @@ extern UniValue mempoolInfoToJSON();
 extern UniValue mempoolToJSON(bool fVerbose = false);
 extern void ScriptPubKeyToJSON(const CScript& scriptPubKey, UniValue& out, bool fIncludeHex);
 extern UniValue blockheaderToJSON(const CBlockIndex* blockindex);
+extern UniValue blockToDeltasJSON(const CBlock& block, const CBlockIndex* blockindex);
+extern UniValue AddressUnspentToJSON(const CAddressUnspentKey& key, const CAddressUnspentValue& value);
+extern UniValue AddressDeltaToJSON(const CAddressIndexKey& key, CAmount amount);
+extern bool heightSort(std::pair<CAddressUnspentKey, CAddressUnspentValue> a, std::pair<CAddressUnspentKey, CAddressUnspentValue> b);
+extern bool ReadBlockHashesPage(const CTimestampIndexKey& start, unsigned int high, bool fActiveOnly, bool fLogicalTS, size_t nLimit, UniValue& hashes, std::string& strCursor);
+extern bool DecodeBlockHashesCursor(const std::string& strCursor, CTimestampIndexKey& key);
 
 static bool RESTERR(HTTPRequest* req, enum HTTPStatusCode status, string message)
 {
@@ -122,6 +137,55 @@ static bool ParseHashStr(const string& strReq, uint256& v)
     return true;
 }
 
+static bool ParseIndexAddress(const string& strAddress, uint160& hashBytes, int& type)
+{
+    CBitcoinAddress address(strAddress);
+    return address.GetIndexKey(hashBytes, type, false);
+}
+
+/** Sends index records serialized in binary or hex */
+static bool RESTWriteSerialized(HTTPRequest* req, enum RetFormat rf, const CDataStream& ss)
+{
+    switch (rf) {
+    case RF_BINARY: {
+        req->WriteHeader("Content-Type", "application/octet-stream");
+        req->WriteReply(HTTP_OK, ss.str());
+        return true;
+    }
+
+    case RF_HEX: {
+        string strHex = HexStr(ss.begin(), ss.end()) + "\n";
+        req->WriteHeader("Content-Type", "text/plain");
+        req->WriteReply(HTTP_OK, strHex);
+        return true;
+    }
+
+    default: {
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
+    }
+    }
+}
+
+/** Sends the JSON written by fn, streamed once it gets large */
+static bool RESTWriteJSON(HTTPRequest* req, const std::string& strURIPart, const boost::function<void(JSONStreamWriter&)>& fn)
+{
+    HTTPJSONReplyStream stream(req);
+    try {
+        fn(stream.Writer());
+        stream.Writer().WriteRaw("\n");
+        stream.Writer().Finish();
+    } catch (const UniValue& objError) {
+        if (!stream.Abandon(strURIPart))
+            return RESTERR(req, HTTP_INTERNAL_SERVER_ERROR, find_value(objError, "message").get_str());
+        return false;
+    } catch (const std::exception& e) {
+        if (!stream.Abandon(strURIPart))
+            return RESTERR(req, HTTP_INTERNAL_SERVER_ERROR, e.what());
+        return false;
+    }
+    return true;
+}
+
 static bool CheckWarmup(HTTPRequest* req)
 {
     std::string statusmessage;
@@ -204,6 +268,64 @@ static bool rest_headers(HTTPRequest* req,
     return true; // continue to process further HTTP reqs on this cxn
 }
 
+static bool rest_compactblocks(HTTPRequest* req,
+                               const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    if (!fCompactBlockIndex)
+        return RESTERR(req, HTTP_NOT_FOUND, "Compact block index not enabled. Restart with -compactblockindex.");
+    vector<string> params;
+    const RetFormat rf = ParseDataFormat(params, strURIPart);
+    vector<string> path;
+    boost::split(path, params[0], boost::is_any_of("/"));
+
+    if (path.size() != 2)
+        return RESTERR(req, HTTP_BAD_REQUEST, "No block count specified. Use /rest/compactblocks/<count>/<height>.<ext>.");
+
+    long count = strtol(path[0].c_str(), NULL, 10);
+    if (count < 1 || count > 2000)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Block count out of range: " + path[0]);
+
+    long height = strtol(path[1].c_str(), NULL, 10);
+    if (height < 0 || height > std::numeric_limits<int>::max() - count)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid height: " + path[1]);
+
+    // The records are stored pre-serialized and keyed by height, so the
+    // range is served straight from the database without taking cs_main.
+    // It ends early at the first height not (yet) connected.
+    std::vector<std::vector<unsigned char> > vCompactBlocks;
+    if (!pblocktree->ReadCompactBlockIndex(height, count, MAX_COMPACTBLOCKS_REPLY_BYTES, vCompactBlocks))
+        return RESTERR(req, HTTP_INTERNAL_SERVER_ERROR, "Error reading compact block index");
+
+    string strCompactBlocks;
+    BOOST_FOREACH(const std::vector<unsigned char>& vchCompactBlock, vCompactBlocks) {
+        strCompactBlocks.append(vchCompactBlock.begin(), vchCompactBlock.end());
+    }
+
+    switch (rf) {
+    case RF_BINARY: {
+        req->WriteHeader("Content-Type", "application/octet-stream");
+        req->WriteReply(HTTP_OK, strCompactBlocks);
+        return true;
+    }
+
+    case RF_HEX: {
+        string strHex = HexStr(strCompactBlocks.begin(), strCompactBlocks.end()) + "\n";
+        req->WriteHeader("Content-Type", "text/plain");
+        req->WriteReply(HTTP_OK, strHex);
+        return true;
+    }
+
+    default: {
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: .bin, .hex)");
+    }
+    }
+
+    // not reached
+    return true; // continue to process further HTTP reqs on this cxn
+}
+
 static bool rest_block(HTTPRequest* req,
                        const std::string& strURIPart,
                        bool showTxDetails)
@@ -605,24 +727,256 @@ static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
     return true; // continue to process further HTTP reqs on this cxn
 }
 
+static bool rest_addressutxos(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    vector<string> params;
+    const RetFormat rf = ParseDataFormat(params, strURIPart);
+
+    uint160 hashBytes;
+    int type = 0;
+    if (!ParseIndexAddress(params[0], hashBytes, type))
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid address: " + params[0]);
+
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > unspentOutputs;
+    if (!GetAddressUnspent(hashBytes, type, unspentOutputs))
+        return RESTERR(req, HTTP_NOT_FOUND, "No information available for address (requires -addressindex)");
+    std::sort(unspentOutputs.begin(), unspentOutputs.end(), heightSort);
+
+    if (rf == RF_JSON) {
+        return RESTWriteJSON(req, strURIPart, [&unspentOutputs](JSONStreamWriter& writer) {
+            writer.BeginArray();
+            for (size_t i = 0; i < unspentOutputs.size(); i++)
+                writer.Value(AddressUnspentToJSON(unspentOutputs[i].first, unspentOutputs[i].second));
+            writer.EndArray();
+        });
+    }
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << unspentOutputs;
+    return RESTWriteSerialized(req, rf, ss);
+}
+
+static bool rest_addressdeltas(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    vector<string> params;
+    const RetFormat rf = ParseDataFormat(params, strURIPart);
+
+    // <address>[/<start height>/<end height>]
+    vector<string> uriParts;
+    boost::split(uriParts, params[0], boost::is_any_of("/"));
+    int start = 0;
+    int end = 0;
+    if (uriParts.size() == 3) {
+        if (!ParseInt32(uriParts[1], &start) || !ParseInt32(uriParts[2], &end) || start <= 0 || end < start)
+            return RESTERR(req, HTTP_BAD_REQUEST, "Invalid height range: " + uriParts[1] + "/" + uriParts[2]);
+    } else if (uriParts.size() != 1) {
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid URI format. Expected /rest/addressdeltas/<address>[/<start>/<end>].<ext>");
+    }
+
+    uint160 hashBytes;
+    int type = 0;
+    if (!ParseIndexAddress(uriParts[0], hashBytes, type))
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid address: " + uriParts[0]);
+
+    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
+    if (!GetAddressIndex(hashBytes, type, addressIndex, start, end))
+        return RESTERR(req, HTTP_NOT_FOUND, "No information available for address (requires -addressindex)");
+
+    if (rf == RF_JSON) {
+        return RESTWriteJSON(req, strURIPart, [&addressIndex](JSONStreamWriter& writer) {
+            writer.BeginArray();
+            for (size_t i = 0; i < addressIndex.size(); i++)
+                writer.Value(AddressDeltaToJSON(addressIndex[i].first, addressIndex[i].second));
+            writer.EndArray();
+        });
+    }
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << addressIndex;
+    return RESTWriteSerialized(req, rf, ss);
+}
+
+/**
+ * Blocks of the active chain by logical timestamp, as getblockhashes with
+ * noOrphans and logicalTimes, one page at a time:
+ * /rest/blockhashes/<high>/<low>[/<limit>[/<cursor>]].json
+ */
+static bool rest_blockhashes(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    vector<string> params;
+    const RetFormat rf = ParseDataFormat(params, strURIPart);
+    if (rf != RF_JSON)
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: json)");
+
+    vector<string> uriParts;
+    boost::split(uriParts, params[0], boost::is_any_of("/"));
+    if (uriParts.size() < 2 || uriParts.size() > 4)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid URI format. Expected /rest/blockhashes/<high>/<low>[/<limit>[/<cursor>]].json");
+
+    int64_t high, low;
+    if (!ParseInt64(uriParts[0], &high) || !ParseInt64(uriParts[1], &low) || low < 0 || high < low || high > std::numeric_limits<unsigned int>::max())
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid timestamp range: " + uriParts[0] + "/" + uriParts[1]);
+
+    long limit = DEFAULT_BLOCKHASHES_LIMIT;
+    if (uriParts.size() > 2) {
+        limit = strtol(uriParts[2].c_str(), NULL, 10);
+        if (limit < 1 || limit > MAX_BLOCKHASHES_LIMIT)
+            return RESTERR(req, HTTP_BAD_REQUEST, "Limit out of range: " + uriParts[2]);
+    }
+
+    CTimestampIndexKey start((unsigned int)low, uint256());
+    if (uriParts.size() > 3 && (!DecodeBlockHashesCursor(uriParts[3], start) || start.timestamp < low))
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid cursor: " + uriParts[3]);
+
+    UniValue hashes(UniValue::VARR);
+    std::string strCursor;
+    if (!ReadBlockHashesPage(start, (unsigned int)high, true, true, limit, hashes, strCursor))
+        return RESTERR(req, HTTP_NOT_FOUND, "No information available for block hashes (requires -timestampindex)");
+
+    return RESTWriteJSON(req, strURIPart, [&hashes, &strCursor](JSONStreamWriter& writer) {
+        writer.BeginObject();
+        writer.KeyValue("hashes", hashes);
+        if (!strCursor.empty())
+            writer.KeyValue("cursor", strCursor);
+        writer.EndObject();
+    });
+}
+
+/**
+ * The JSON format is the one of getblockdeltas. The binary formats only carry
+ * what is not in the block itself: the spent index entries of the inputs of
+ * the block, in block order, to be combined with /rest/block/<hash>.bin.
+ */
+static bool rest_blockdeltas(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    vector<string> params;
+    const RetFormat rf = ParseDataFormat(params, strURIPart);
+
+    string hashStr = params[0];
+    uint256 hash;
+    if (!ParseHashStr(hashStr, hash))
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
+
+    CBlock block;
+    CBlockIndex* pblockindex = NULL;
+    UniValue objDeltas;
+    {
+        LOCK(cs_main);
+        if (mapBlockIndex.count(hash) == 0)
+            return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
+
+        pblockindex = mapBlockIndex[hash];
+        if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
+            return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not available (pruned data)");
+        if (!chainActive.Contains(pblockindex))
+            return RESTERR(req, HTTP_NOT_FOUND, hashStr + " is an orphan");
+
+        if (!ReadBlockFromDisk(block, pblockindex,1))
+            return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
+
+        if (rf == RF_JSON) {
+            try {
+                objDeltas = blockToDeltasJSON(block, pblockindex);
+            } catch (const UniValue& objError) {
+                return RESTERR(req, HTTP_INTERNAL_SERVER_ERROR, find_value(objError, "message").get_str());
+            }
+        }
+    }
+
+    if (rf == RF_JSON) {
+        return RESTWriteJSON(req, strURIPart, [&objDeltas](JSONStreamWriter& writer) {
+            writer.Value(objDeltas);
+        });
+    }
+
+    std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > spentInfo;
+    for (size_t i = 0; i < block.vtx.size(); i++) {
+        const CTransaction& tx = block.vtx[i];
+        if (tx.IsCoinBase())
+            continue;
+        for (size_t j = 0; j < tx.vin.size(); j++) {
+            CSpentIndexKey key(tx.vin[j].prevout.hash, tx.vin[j].prevout.n);
+            CSpentIndexValue value;
+            if (!GetSpentIndex(key, value))
+                return RESTERR(req, HTTP_NOT_FOUND, "Spent information not available (requires -spentindex)");
+            spentInfo.push_back(std::make_pair(key, value));
+        }
+    }
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << spentInfo;
+    return RESTWriteSerialized(req, rf, ss);
+}
+
+static bool rest_spentinfo(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    vector<string> params;
+    const RetFormat rf = ParseDataFormat(params, strURIPart);
+
+    // <txid>/<output index>
+    vector<string> uriParts;
+    boost::split(uriParts, params[0], boost::is_any_of("/"));
+    uint256 txid;
+    int32_t nOutput;
+    if (uriParts.size() != 2 || !ParseHashStr(uriParts[0], txid) || !ParseInt32(uriParts[1], &nOutput) || nOutput < 0)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid URI format. Expected /rest/spentinfo/<txid>/<n>.<ext>");
+
+    CSpentIndexKey key(txid, nOutput);
+    CSpentIndexValue value;
+    if (!GetSpentIndex(key, value))
+        return RESTERR(req, HTTP_NOT_FOUND, "Unable to get spent info (requires -spentindex)");
+
+    if (rf == RF_JSON) {
+        return RESTWriteJSON(req, strURIPart, [&value](JSONStreamWriter& writer) {
+            writer.BeginObject();
+            writer.KeyValue("txid", value.txid.GetHex());
+            writer.KeyValue("index", (int)value.inputIndex);
+            writer.KeyValue("height", value.blockHeight);
+            writer.EndObject();
+        });
+    }
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << value;
+    return RESTWriteSerialized(req, rf, ss);
+}
+
 static const struct {
     const char* prefix;
     bool (*handler)(HTTPRequest* req, const std::string& strReq);
+    //! Block dumps and index scans go to the slow lane
+    HTTPWorkLane lane;
 } uri_prefixes[] = {
-      {"/rest/tx/", rest_tx},
-      {"/rest/block/notxdetails/", rest_block_notxdetails},
-      {"/rest/block/", rest_block_extended},
-      {"/rest/chaininfo", rest_chaininfo},
-      {"/rest/mempool/info", rest_mempool_info},
-      {"/rest/mempool/contents", rest_mempool_contents},
-      {"/rest/headers/", rest_headers},
-      {"/rest/getutxos", rest_getutxos},
+      {"/rest/tx/", rest_tx, HTTP_LANE_NORMAL},
+      {"/rest/block/notxdetails/", rest_block_notxdetails, HTTP_LANE_SLOW},
+      {"/rest/block/", rest_block_extended, HTTP_LANE_SLOW},
+      {"/rest/chaininfo", rest_chaininfo, HTTP_LANE_PRIORITY},
+      {"/rest/mempool/info", rest_mempool_info, HTTP_LANE_PRIORITY},
+      {"/rest/mempool/contents", rest_mempool_contents, HTTP_LANE_SLOW},
+      {"/rest/headers/", rest_headers, HTTP_LANE_NORMAL},
+      {"/rest/compactblocks/", rest_compactblocks, HTTP_LANE_SLOW},
+      {"/rest/getutxos", rest_getutxos, HTTP_LANE_NORMAL},
+      {"/rest/addressutxos/", rest_addressutxos, HTTP_LANE_SLOW},
+      {"/rest/addressdeltas/", rest_addressdeltas, HTTP_LANE_SLOW},
+      {"/rest/blockdeltas/", rest_blockdeltas, HTTP_LANE_SLOW},
+      {"/rest/blockhashes/", rest_blockhashes, HTTP_LANE_NORMAL},
+      {"/rest/spentinfo/", rest_spentinfo, HTTP_LANE_NORMAL},
 };
 
 bool StartREST()
 {
     for (unsigned int i = 0; i < ARRAYLEN(uri_prefixes); i++)
-        RegisterHTTPHandler(uri_prefixes[i].prefix, false, uri_prefixes[i].handler);
+        RegisterHTTPHandler(uri_prefixes[i].prefix, false, uri_prefixes[i].handler, uri_prefixes[i].lane);
     return true;
 }
 
@@ -19,15 +19,23 @@
  ******************************************************************************/
 
 #include "amount.h"
+#include "blockcompress.h"
+#include "blockfilemap.h"
+#include "blockconnectstats.h"
 #include "chain.h"
 #include "chainparams.h"
 #include "checkpoints.h"
+#include "coinstats.h"
 #include "crosschain.h"
 #include "base58.h"
 #include "consensus/validation.h"
 #include "cc/eval.h"
+#include "indexbuilder.h"
+#include "kvindex.h"
 #include "main.h"
 #include "primitives/transaction.h"
+#include "rpc/cache.h"
+#include "rpc/jsonstream.h"
 #include "rpc/server.h"
 #include "streams.h"
 #include "sync.h"
@@ -126,6 +134,15 @@ static UniValue ValuePoolDesc(
     return rv;
 }
 
+//! Blocks below the tip getblockheader looks for before taking cs_main
+static const int RPC_RECENT_HEADERS = 100;
+
+/**
+ * Only reads the published chain tip snapshot. The header fields of a block
+ * index entry are set before it is published and then left alone, except the
+ * solution, which FlushStateToDisk trims and GetSolution reads under a lock
+ * of its own, so cs_main is not needed.
+ */
 UniValue blockheaderToJSON(const CBlockIndex* blockindex)
 {
     UniValue result(UniValue::VOBJ);
@@ -134,14 +151,14 @@ UniValue blockheaderToJSON(const CBlockIndex* blockindex)
         result.push_back(Pair("error", "null blockhash"));
         return(result);
     }
-    uint256 notarized_hash,notarized_desttxid; int32_t prevMoMheight,notarized_height;
-    notarized_height = komodo_notarized_height(&prevMoMheight,&notarized_hash,&notarized_desttxid);
-    result.push_back(Pair("last_notarized_height", notarized_height));
+    std::shared_ptr<const CChainTipSnapshot> tip = GetChainTipSnapshot();
+    result.push_back(Pair("last_notarized_height", tip->nNotarizedHeight));
     result.push_back(Pair("hash", blockindex->GetBlockHash().GetHex()));
     int confirmations = -1;
     // Only report confirmations if the block is on the main chain
-    if (chainActive.Contains(blockindex))
-        confirmations = chainActive.Height() - blockindex->GetHeight() + 1;
+    bool fActive = tip->Contains(blockindex);
+    if (fActive)
+        confirmations = tip->nHeight - blockindex->GetHeight() + 1;
     result.push_back(Pair("confirmations", komodo_dpowconfs(blockindex->GetHeight(),confirmations)));
     result.push_back(Pair("rawconfirmations", confirmations));
     result.push_back(Pair("height", blockindex->GetHeight()));
@@ -150,15 +167,24 @@ UniValue blockheaderToJSON(const CBlockIndex* blockindex)
     result.push_back(Pair("finalsaplingroot", blockindex->hashFinalSaplingRoot.GetHex()));
     result.push_back(Pair("time", (int64_t)blockindex->nTime));
     result.push_back(Pair("nonce", blockindex->nNonce.GetHex()));
-    result.push_back(Pair("solution", HexStr(blockindex->nSolution)));
+    result.push_back(Pair("solution", HexStr(blockindex->GetSolution())));
     result.push_back(Pair("bits", strprintf("%08x", blockindex->nBits)));
     result.push_back(Pair("difficulty", GetDifficulty(blockindex)));
     result.push_back(Pair("chainwork", blockindex->chainPower.chainWork.GetHex()));
-    result.push_back(Pair("segid", (int)komodo_segid(0,blockindex->GetHeight())));
+    // komodo_segid caches the segid in the index entry of the active chain, it
+    // only needs the chain (and the block from disk) the first time
+    int segid;
+    if (fActive && blockindex->segid >= -1) {
+        segid = blockindex->segid;
+    } else {
+        LOCK(cs_main);
+        segid = komodo_segid(0,blockindex->GetHeight());
+    }
+    result.push_back(Pair("segid", segid));
 
     if (blockindex->pprev)
         result.push_back(Pair("previousblockhash", blockindex->pprev->GetBlockHash().GetHex()));
-    CBlockIndex *pnext = chainActive.Next(blockindex);
+    const CBlockIndex *pnext = fActive ? (*tip)[blockindex->GetHeight() + 1] : NULL;
     if (pnext)
         result.push_back(Pair("nextblockhash", pnext->GetBlockHash().GetHex()));
     return result;
@@ -339,6 +365,41 @@ UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool tx
     return result;
 }
 
+/**
+ * Writes the same as blockToJSON with transaction details, converting one
+ * transaction at a time. Takes cs_main itself, only while converting.
+ */
+static void blockToJSONStream(JSONStreamWriter& stream, const CBlock& block, const CBlockIndex* blockindex)
+{
+    UniValue result;
+    {
+        LOCK(cs_main);
+        result = blockToJSON(block, blockindex, false);
+    }
+    const std::vector<std::string>& keys = result.getKeys();
+    const std::vector<UniValue>& values = result.getValues();
+    stream.BeginObject();
+    for (size_t i = 0; i < keys.size(); i++) {
+        if (keys[i] != "tx") {
+            stream.KeyValue(keys[i], values[i]);
+            continue;
+        }
+        stream.Key("tx");
+        stream.BeginArray();
+        BOOST_FOREACH(const CTransaction&tx, block.vtx)
+        {
+            UniValue objTx(UniValue::VOBJ);
+            {
+                LOCK(cs_main);
+                TxToJSON(tx, uint256(), objTx);
+            }
+            stream.Value(objTx);
+        }
+        stream.EndArray();
+    }
+    stream.EndObject();
+}
+
 UniValue getblockcount(const UniValue& params, bool fHelp, const CPubKey& mypk)
 {
     if (fHelp || params.size() != 0)
@@ -352,8 +413,7 @@ UniValue getblockcount(const UniValue& params, bool fHelp, const CPubKey& mypk)
             + HelpExampleRpc("getblockcount", "")
         );
 
-    LOCK(cs_main);
-    return chainActive.Height();
+    return GetChainTipSnapshot()->nHeight;
 }
 
 UniValue getbestblockhash(const UniValue& params, bool fHelp, const CPubKey& mypk)
@@ -369,8 +429,10 @@ UniValue getbestblockhash(const UniValue& params, bool fHelp, const CPubKey& myp
             + HelpExampleRpc("getbestblockhash", "")
         );
 
-    LOCK(cs_main);
-    return chainActive.LastTip()->GetBlockHash().GetHex();
+    std::shared_ptr<const CChainTipSnapshot> tip = GetChainTipSnapshot();
+    if (tip->pindexTip == NULL)
+        throw JSONRPCError(RPC_IN_WARMUP, "Block index not loaded yet");
+    return tip->pindexTip->GetBlockHash().GetHex();
 }
 
 UniValue getdifficulty(const UniValue& params, bool fHelp, const CPubKey& mypk)
@@ -386,8 +448,7 @@ UniValue getdifficulty(const UniValue& params, bool fHelp, const CPubKey& mypk)
             + HelpExampleRpc("getdifficulty", "")
         );
 
-    LOCK(cs_main);
-    return GetNetworkDifficulty();
+    return GetChainTipSnapshot()->dNetworkDifficulty;
 }
 
 bool NSPV_spentinmempool(uint256 &spenttxid,int32_t &spentvini,uint256 txid,int32_t vout);
@@ -528,6 +589,10 @@ UniValue getblockdeltas(const UniValue& params, bool fHelp, const CPubKey& mypk)
     if (fHelp || params.size() != 1)
         throw runtime_error("");
 
+    UniValue cached;
+    if (rpcResponseCache.Lookup("getblockdeltas", params, cached))
+        return cached;
+
     std::string strHash = params[0].get_str();
     uint256 hash(uint256S(strHash));
 
@@ -543,7 +608,47 @@ UniValue getblockdeltas(const UniValue& params, bool fHelp, const CPubKey& mypk)
     if(!ReadBlockFromDisk(block, pblockindex,1))
         throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
 
-    return blockToDeltasJSON(block, pblockindex);
+    UniValue result = blockToDeltasJSON(block, pblockindex);
+    rpcResponseCache.Store("getblockdeltas", params, result, pblockindex);
+    return result;
+}
+
+/**
+ * Reads up to nLimit entries, all of them if it is 0, of the timestamp index
+ * from start on into hashes. The cursor is the hex encoded key of the entry
+ * after the last one returned, empty when the range is exhausted.
+ */
+bool ReadBlockHashesPage(const CTimestampIndexKey& start, unsigned int high, bool fActiveOnly, bool fLogicalTS, size_t nLimit, UniValue& hashes, std::string& strCursor)
+{
+    strCursor.clear();
+    return GetTimestampIndex(start, high, fActiveOnly, [&](const CTimestampIndexKey& key, int nHeight) {
+        if (nLimit > 0 && hashes.size() == nLimit) {
+            CDataStream ss(SER_DISK, CLIENT_VERSION);
+            ss << key;
+            strCursor = HexStr(ss.begin(), ss.end());
+            return false;
+        }
+        if (fLogicalTS) {
+            UniValue item(UniValue::VOBJ);
+            item.push_back(Pair("blockhash", key.blockHash.GetHex()));
+            item.push_back(Pair("logicalts", (int)key.timestamp));
+            hashes.push_back(item);
+        } else {
+            hashes.push_back(key.blockHash.GetHex());
+        }
+        return true;
+    });
+}
+
+//! Start key of the page a cursor of ReadBlockHashesPage points to
+bool DecodeBlockHashesCursor(const std::string& strCursor, CTimestampIndexKey& key)
+{
+    std::vector<unsigned char> data(ParseHex(strCursor));
+    if (!IsHex(strCursor) || data.size() != key.GetSerializeSize(SER_DISK, CLIENT_VERSION))
+        return false;
+    CDataStream ss(data, SER_DISK, CLIENT_VERSION);
+    ss >> key;
+    return true;
 }
 
 UniValue getblockhashes(const UniValue& params, bool fHelp, const CPubKey& mypk)
@@ -559,6 +664,8 @@ UniValue getblockhashes(const UniValue& params, bool fHelp, const CPubKey& mypk)
             "    {\n"
             "      \"noOrphans\":true   (boolean) will only include blocks on the main chain\n"
             "      \"logicalTimes\":true   (boolean) will include logical timestamps with hashes\n"
+            "      \"limit\":n   (numeric, optional) return at most this many hashes\n"
+            "      \"cursor\":\"str\"   (string, optional) continue after the previous page, as returned with it\n"
             "    }\n"
             "\nResult:\n"
             "[\n"
@@ -570,6 +677,11 @@ UniValue getblockhashes(const UniValue& params, bool fHelp, const CPubKey& mypk)
             "    \"logicalts\": (numeric) The logical timestamp\n"
             "  }\n"
             "]\n"
+            "\nResult (with limit or cursor)\n"
+            "{\n"
+            "  \"hashes\"  (array) The hashes as above\n"
+            "  \"cursor\"  (string) Pass it to get the next page, missing on the last page\n"
+            "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getblockhashes", "1231614698 1231024505")
             + HelpExampleRpc("getblockhashes", "1231614698, 1231024505")
@@ -580,42 +692,51 @@ UniValue getblockhashes(const UniValue& params, bool fHelp, const CPubKey& mypk)
     unsigned int low = params[1].get_int();
     bool fActiveOnly = false;
     bool fLogicalTS = false;
+    bool fPaged = false;
+    size_t nLimit = 0;
+    CTimestampIndexKey start(low, uint256());
 
     if (params.size() > 2) {
         if (params[2].isObject()) {
             UniValue noOrphans = find_value(params[2].get_obj(), "noOrphans");
             UniValue returnLogical = find_value(params[2].get_obj(), "logicalTimes");
+            UniValue limitValue = find_value(params[2].get_obj(), "limit");
+            UniValue cursorValue = find_value(params[2].get_obj(), "cursor");
 
             if (noOrphans.isBool())
                 fActiveOnly = noOrphans.get_bool();
 
             if (returnLogical.isBool())
                 fLogicalTS = returnLogical.get_bool();
+
+            if (!limitValue.isNull()) {
+                if (!limitValue.isNum() || limitValue.get_int64() <= 0)
+                    throw JSONRPCError(RPC_INVALID_PARAMETER, "Limit is expected to be greater than zero");
+                nLimit = limitValue.get_int64();
+                fPaged = true;
+            }
+            if (!cursorValue.isNull()) {
+                if (!DecodeBlockHashesCursor(cursorValue.get_str(), start) || start.timestamp < low)
+                    throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid cursor");
+                fPaged = true;
+            }
         }
     }
 
-    std::vector<std::pair<uint256, unsigned int> > blockHashes;
-
-    if (fActiveOnly)
-        LOCK(cs_main);
-
-    if (!GetTimestampIndex(high, low, fActiveOnly, blockHashes)) {
+    // Entries come straight from the index iterator, the active chain is
+    // checked against the tip snapshot without holding cs_main
+    UniValue hashes(UniValue::VARR);
+    std::string strCursor;
+    if (!ReadBlockHashesPage(start, high, fActiveOnly, fLogicalTS, nLimit, hashes, strCursor)) {
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for block hashes");
     }
+    if (!fPaged)
+        return hashes;
 
-    UniValue result(UniValue::VARR);
-
-    for (std::vector<std::pair<uint256, unsigned int> >::const_iterator it=blockHashes.begin(); it!=blockHashes.end(); it++) {
-        if (fLogicalTS) {
-            UniValue item(UniValue::VOBJ);
-            item.push_back(Pair("blockhash", it->first.GetHex()));
-            item.push_back(Pair("logicalts", (int)it->second));
-            result.push_back(item);
-        } else {
-            result.push_back(it->first.GetHex());
-        }
-    }
-
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair("hashes", hashes));
+    if (!strCursor.empty())
+        result.push_back(Pair("cursor", strCursor));
     return result;
 }
 
@@ -634,13 +755,11 @@ UniValue getblockhash(const UniValue& params, bool fHelp, const CPubKey& mypk)
             + HelpExampleRpc("getblockhash", "1000")
         );
 
-    LOCK(cs_main);
-
     int nHeight = params[0].get_int();
-    if (nHeight < 0 || nHeight > chainActive.Height())
+    const CBlockIndex* pblockindex = (*GetChainTipSnapshot())[nHeight];
+    if (pblockindex == NULL)
         throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range");
 
-    CBlockIndex* pblockindex = chainActive[nHeight];
     return pblockindex->GetBlockHash().GetHex();
 }
 
@@ -753,8 +872,6 @@ UniValue getblockheader(const UniValue& params, bool fHelp, const CPubKey& mypk)
             + HelpExampleRpc("getblockheader", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\"")
         );
 
-    LOCK(cs_main);
-
     std::string strHash = params[0].get_str();
     uint256 hash(uint256S(strHash));
 
@@ -762,10 +879,22 @@ UniValue getblockheader(const UniValue& params, bool fHelp, const CPubKey& mypk)
     if (params.size() > 1)
         fVerbose = params[1].get_bool();
 
-    if (mapBlockIndex.count(hash) == 0)
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+    UniValue cached;
+    if (fVerbose && rpcResponseCache.Lookup("getblockheader", params, cached))
+        return cached;
 
-    CBlockIndex* pblockindex = mapBlockIndex[hash];
+    // Clients mostly poll the newest headers, those are found from the tip
+    // snapshot without cs_main. mapBlockIndex itself needs the lock.
+    CBlockIndex* pblockindex = GetChainTipSnapshot()->pindexTip;
+    for (int i = 0; i < RPC_RECENT_HEADERS && pblockindex != NULL && pblockindex->GetBlockHash() != hash; i++)
+        pblockindex = pblockindex->pprev;
+    if (pblockindex == NULL || pblockindex->GetBlockHash() != hash) {
+        LOCK(cs_main);
+        BlockMap::iterator mi = mapBlockIndex.find(hash);
+        if (mi == mapBlockIndex.end() || mi->second == NULL)
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+        pblockindex = mi->second;
+    }
 
     if (!fVerbose)
     {
@@ -775,7 +904,9 @@ UniValue getblockheader(const UniValue& params, bool fHelp, const CPubKey& mypk)
         return strHex;
     }
 
-    return blockheaderToJSON(pblockindex);
+    UniValue result = blockheaderToJSON(pblockindex);
+    rpcResponseCache.Store("getblockheader", params, result, pblockindex);
+    return result;
 }
 
 UniValue getblock(const UniValue& params, bool fHelp, const CPubKey& mypk)
@@ -827,94 +958,166 @@ UniValue getblock(const UniValue& params, bool fHelp, const CPubKey& mypk)
             + HelpExampleRpc("getblock", "12800")
         );
 
-    LOCK(cs_main);
+    UniValue cached;
+    if (rpcResponseCache.Lookup("getblock", params, cached))
+        return cached;
 
-    std::string strHash = params[0].get_str();
+    CBlock block;
+    // The raw block is served as it is stored, without deserializing it
+    CMappedSpan span;
+    std::vector<char> vRaw;
+    CBlockIndex* pblockindex;
+    int verbosity;
+    JSONStreamWriter* stream = NULL;
+    {
+        LOCK(cs_main);
 
-    // If height is supplied, find the hash
-    if (strHash.size() < (2 * sizeof(uint256))) {
-        // std::stoi allows characters, whereas we want to be strict
-        regex r("[[:digit:]]+");
-        if (!regex_match(strHash, r)) {
-            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid block height parameter");
-        }
+        std::string strHash = params[0].get_str();
 
-        int nHeight = -1;
-        try {
-            nHeight = std::stoi(strHash);
-        }
-        catch (const std::exception &e) {
-            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid block height parameter");
-        }
+        // If height is supplied, find the hash
+        if (strHash.size() < (2 * sizeof(uint256))) {
+            // std::stoi allows characters, whereas we want to be strict
+            regex r("[[:digit:]]+");
+            if (!regex_match(strHash, r)) {
+                throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid block height parameter");
+            }
 
-        if (nHeight < 0 || nHeight > chainActive.Height()) {
-            throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range");
+            int nHeight = -1;
+            try {
+                nHeight = std::stoi(strHash);
+            }
+            catch (const std::exception &e) {
+                throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid block height parameter");
+            }
+
+            if (nHeight < 0 || nHeight > chainActive.Height()) {
+                throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range");
+            }
+            strHash = chainActive[nHeight]->GetBlockHash().GetHex();
         }
-        strHash = chainActive[nHeight]->GetBlockHash().GetHex();
-    }
 
-    uint256 hash(uint256S(strHash));
+        uint256 hash(uint256S(strHash));
 
-    int verbosity = 1;
-    if (params.size() > 1) {
-        if(params[1].isNum()) {
-            verbosity = params[1].get_int();
-        } else {
-            verbosity = params[1].get_bool() ? 1 : 0;
+        verbosity = 1;
+        if (params.size() > 1) {
+            if(params[1].isNum()) {
+                verbosity = params[1].get_int();
+            } else {
+                verbosity = params[1].get_bool() ? 1 : 0;
+            }
         }
-    }
 
-    if (verbosity < 0 || verbosity > 2) {
-        throw JSONRPCError(RPC_INVALID_PARAMETER, "Verbosity must be in range from 0 to 2");
-    }
+        if (verbosity < 0 || verbosity > 2) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Verbosity must be in range from 0 to 2");
+        }
 
-    if (mapBlockIndex.count(hash) == 0)
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+        if (mapBlockIndex.count(hash) == 0)
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
 
-    CBlock block;
-    CBlockIndex* pblockindex = mapBlockIndex[hash];
+        pblockindex = mapBlockIndex[hash];
 
-    if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
-        throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
+        if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
 
-    if(!ReadBlockFromDisk(block, pblockindex,1))
-        throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+        if (verbosity == 0) {
+            if (!ReadRawBlockFromDisk(span, vRaw, pblockindex->GetBlockPos(), pblockindex->GetBlockHash()))
+                throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+        } else if(!ReadBlockFromDisk(block, pblockindex,1))
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
 
-    if (verbosity == 0)
-    {
-        CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
-        ssBlock << block;
-        std::string strHex = HexStr(ssBlock.begin(), ssBlock.end());
-        return strHex;
+        // Large blocks are streamed outside of cs_main when the transport allows
+        // it, the raw block then goes out as bytes when the reply is binary.
+        // Notarized blocks are built in memory instead when they can be cached.
+        bool fCache = verbosity != 0 && rpcResponseCache.IsImmutable(pblockindex);
+        if (verbosity == 0 || (verbosity == 2 && !fCache))
+            stream = RPCTakeReplyStream("getblock");
+
+        if (verbosity == 0 && !stream)
+        {
+            const char* pBlock = span.data != NULL ? span.data : begin_ptr(vRaw);
+            size_t nBlockSize = span.data != NULL ? span.size : vRaw.size();
+            return HexStr(pBlock, pBlock + nBlockSize);
+        }
+
+        if (!stream) {
+            UniValue result = blockToJSON(block, pblockindex, verbosity >= 2);
+            if (fCache)
+                rpcResponseCache.Store("getblock", params, result, pblockindex);
+            return result;
+        }
     }
 
-    return blockToJSON(block, pblockindex, verbosity >= 2);
+    if (verbosity == 0) {
+        const unsigned char* pBlock = (const unsigned char*)(span.data != NULL ? span.data : begin_ptr(vRaw));
+        size_t nBlockSize = span.data != NULL ? span.size : vRaw.size();
+        stream->Bytes(pBlock, pBlock + nBlockSize);
+    } else {
+        blockToJSONStream(*stream, block, pblockindex);
+    }
+    return NullUniValue;
 }
 
 UniValue gettxoutsetinfo(const UniValue& params, bool fHelp, const CPubKey& mypk)
 {
-    if (fHelp || params.size() != 0)
+    if (fHelp || params.size() > 1)
         throw runtime_error(
-            "gettxoutsetinfo\n"
+            "gettxoutsetinfo ( height )\n"
             "\nReturns statistics about the unspent transaction output set.\n"
-            "Note this call may take some time.\n"
+            "With -coinstatsindex they are read from the index, otherwise the whole set is scanned,\n"
+            "which may take some time.\n"
+            "\nArguments:\n"
+            "1. height         (numeric, optional) the height of the active chain to report, requires -coinstatsindex (default: the tip)\n"
             "\nResult:\n"
             "{\n"
             "  \"height\":n,     (numeric) The current block height (index)\n"
             "  \"bestblock\": \"hex\",   (string) the best block hash hex\n"
             "  \"transactions\": n,      (numeric) The number of transactions\n"
             "  \"txouts\": n,            (numeric) The number of output transactions\n"
-            "  \"bytes_serialized\": n,  (numeric) The serialized size\n"
-            "  \"hash_serialized\": \"hash\",   (string) The serialized hash\n"
+            "  \"bytes_serialized\": n,  (numeric) The serialized size, only when the set is scanned\n"
+            "  \"hash_serialized\": \"hash\",   (string) The serialized hash, only when the set is scanned\n"
+            "  \"muhash\": \"hash\",     (string) The MuHash3072 set hash of the unspent outputs, from the index for the\n"
+            "                            last " + strprintf("%d", COINSTATS_HASH_DEPTH) + " blocks\n"
             "  \"total_amount\": x.xxx          (numeric) The total amount\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("gettxoutsetinfo", "")
+            + HelpExampleCli("gettxoutsetinfo", "1000")
             + HelpExampleRpc("gettxoutsetinfo", "")
         );
 
     UniValue ret(UniValue::VOBJ);
 
+    if (fCoinStatsIndex) {
+        const CBlockIndex* pindex;
+        {
+            LOCK(cs_main);
+            pindex = chainActive.Tip();
+            if (params.size() > 0) {
+                int nHeight = params[0].get_int();
+                if (nHeight < 0 || nHeight > chainActive.Height())
+                    throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range");
+                pindex = chainActive[nHeight];
+            }
+        }
+        CCoinsStatsRecord record;
+        uint256 hashMuHash;
+        if (GetCoinsStatsAt(pindex, record, &hashMuHash)) {
+            ret.push_back(Pair("height", (int64_t)pindex->GetHeight()));
+            ret.push_back(Pair("bestblock", pindex->GetBlockHash().GetHex()));
+            ret.push_back(Pair("transactions", record.nTransactions));
+            ret.push_back(Pair("txouts", record.nTransactionOutputs));
+            if (!hashMuHash.IsNull())
+                ret.push_back(Pair("muhash", hashMuHash.GetHex()));
+            ret.push_back(Pair("total_amount", ValueFromAmount(record.nTotalAmount)));
+            return ret;
+        }
+        if (params.size() > 0)
+            throw JSONRPCError(RPC_MISC_ERROR, "No UTXO set statistics for this block yet");
+    } else if (params.size() > 0) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "A height requires -coinstatsindex");
+    }
+
+    // Without a record for the tip, the set is scanned
     CCoinsStats stats;
     FlushStateToDisk();
     if (pcoinsTip->GetStats(stats)) {
@@ -930,9 +1133,123 @@ UniValue gettxoutsetinfo(const UniValue& params, bool fHelp, const CPubKey& mypk
 }
 
 
+UniValue dumptxoutset(const UniValue& params, bool fHelp, const CPubKey& mypk)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "dumptxoutset \"path\"\n"
+            "\nWrites the coins, anchors and nullifiers at the current tip to a snapshot file that\n"
+            "a fresh node can start from with loadtxoutset.\n"
+            "Note this call may take some time.\n"
+            "\nArguments:\n"
+            "1. \"path\"        (string, required) the file to write, relative to the data directory unless absolute\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"base_hash\": \"hex\",   (string) the block the snapshot was taken at\n"
+            "  \"base_height\": n,      (numeric) the height of that block\n"
+            "  \"nchaintx\": n,         (numeric) the number of transactions up to that block\n"
+            "  \"path\": \"path\",       (string) the absolute path of the snapshot\n"
+            "  \"checksum\": \"hex\",    (string) the checksum to pass to loadtxoutset\n"
+            "  \"notarized\": true|false (boolean) whether the block is under a notarization; only such snapshots can be loaded\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("dumptxoutset", "\"utxo.dat\"")
+            + HelpExampleRpc("dumptxoutset", "\"utxo.dat\"")
+        );
+
+    boost::filesystem::path path = boost::filesystem::absolute(params[0].get_str(), GetDataDir());
+    if (boost::filesystem::exists(path))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, path.string() + " already exists");
+    boost::filesystem::path pathTemp = path.string() + ".incomplete";
+
+    CAutoFile file(fopen(pathTemp.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull())
+        throw JSONRPCError(RPC_MISC_ERROR, "Unable to open " + pathTemp.string() + " for writing");
+
+    // The snapshot is read from the database with a consistent iterator, so
+    // cs_main is not held while it is written
+    CCoinsSnapshotMetadata metadata;
+    uint256 hashChecksum;
+    FlushStateToDisk();
+    bool fWritten = false;
+    try {
+        fWritten = pcoinsTip->WriteSnapshot(file, metadata, hashChecksum);
+        if (fWritten)
+            FileCommit(file.Get());
+    } catch (const std::exception& e) {
+        file.fclose();
+        boost::filesystem::remove(pathTemp);
+        throw JSONRPCError(RPC_MISC_ERROR, std::string("Error writing snapshot: ") + e.what());
+    }
+    file.fclose();
+    if (!fWritten) {
+        boost::filesystem::remove(pathTemp);
+        throw JSONRPCError(RPC_MISC_ERROR, "Unable to write snapshot");
+    }
+    if (!RenameOver(pathTemp, path))
+        throw JSONRPCError(RPC_MISC_ERROR, "Unable to rename " + pathTemp.string() + " to " + path.string());
+
+    bool fNotarized;
+    {
+        LOCK(cs_main);
+        fNotarized = IsNotarizedAncestor(metadata.nHeight, metadata.hashBlock);
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("base_hash", metadata.hashBlock.GetHex()));
+    ret.push_back(Pair("base_height", metadata.nHeight));
+    ret.push_back(Pair("nchaintx", (int64_t)metadata.nChainTx));
+    ret.push_back(Pair("path", path.string()));
+    ret.push_back(Pair("checksum", hashChecksum.GetHex()));
+    ret.push_back(Pair("notarized", fNotarized));
+    return ret;
+}
+
+UniValue loadtxoutset(const UniValue& params, bool fHelp, const CPubKey& mypk)
+{
+    if (fHelp || params.size() < 1 || params.size() > 2)
+        throw runtime_error(
+            "loadtxoutset \"path\" ( \"checksum\" )\n"
+            "\nStarts a fresh node from a snapshot written by dumptxoutset. The history below the\n"
+            "snapshot is not validated, so the block it was taken at has to be under a notarization\n"
+            "(see -assumenotarized) and its header must already be known.\n"
+            "Note this call may take some time.\n"
+            "\nArguments:\n"
+            "1. \"path\"        (string, required) the snapshot file, relative to the data directory unless absolute\n"
+            "2. \"checksum\"    (string, optional) the checksum the snapshot must have, as returned by dumptxoutset\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"base_hash\": \"hex\",   (string) the block the snapshot was taken at, now the tip\n"
+            "  \"base_height\": n       (numeric) the height of that block\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("loadtxoutset", "\"utxo.dat\"")
+            + HelpExampleRpc("loadtxoutset", "\"utxo.dat\"")
+        );
+
+    boost::filesystem::path path = boost::filesystem::absolute(params[0].get_str(), GetDataDir());
+    uint256 hashExpected;
+    if (params.size() > 1) {
+        if (!IsHex(params[1].get_str()) || params[1].get_str().size() != 64)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "checksum must be a 64 character hex string");
+        hashExpected = uint256S(params[1].get_str());
+    }
+
+    CCoinsSnapshotMetadata metadata;
+    std::string strError;
+    if (!LoadCoinsSnapshot(path, hashExpected, metadata, strError))
+        throw JSONRPCError(RPC_MISC_ERROR, strError);
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("base_hash", metadata.hashBlock.GetHex()));
+    ret.push_back(Pair("base_height", metadata.nHeight));
+    return ret;
+}
+
+
 UniValue kvsearch(const UniValue& params, bool fHelp, const CPubKey& mypk)
 {
-    UniValue ret(UniValue::VOBJ); uint32_t flags; uint8_t value[IGUANA_MAXSCRIPTSIZE*8],key[IGUANA_MAXSCRIPTSIZE*8]; int32_t duration,j,height,valuesize,keylen; uint256 refpubkey; static uint256 zeroes;
+    UniValue ret(UniValue::VOBJ); uint32_t flags; uint8_t key[IGUANA_MAXSCRIPTSIZE*8]; int32_t duration,j,height,valuesize,keylen; uint256 refpubkey; static uint256 zeroes;
     if (fHelp || params.size() != 1 )
         throw runtime_error(
             "kvsearch key\n"
@@ -956,22 +1273,25 @@ UniValue kvsearch(const UniValue& params, bool fHelp, const CPubKey& mypk)
             + HelpExampleCli("kvsearch", "examplekey")
             + HelpExampleRpc("kvsearch", "\"examplekey\"")
         );
-    LOCK(cs_main);
+    // The KV index has its own lock, searches don't wait for cs_main
     if ( (keylen= (int32_t)strlen(params[0].get_str().c_str())) > 0 )
     {
+        CKVEntry entry; int32_t currentheight;
+        const std::string& strKey = params[0].get_str();
+        bool found = kvIndex.SearchTip(std::vector<unsigned char>(strKey.begin(),strKey.begin()+keylen),entry,currentheight);
         ret.push_back(Pair("coin",(char *)(ASSETCHAINS_SYMBOL[0] == 0 ? "KMD" : ASSETCHAINS_SYMBOL)));
-        ret.push_back(Pair("currentheight", (int64_t)chainActive.LastTip()->GetHeight()));
+        ret.push_back(Pair("currentheight", (int64_t)currentheight));
         ret.push_back(Pair("key",params[0].get_str()));
         ret.push_back(Pair("keylen",keylen));
         if ( keylen < sizeof(key) )
         {
-            memcpy(key,params[0].get_str().c_str(),keylen);
-            if ( (valuesize= komodo_kvsearch(&refpubkey,chainActive.LastTip()->GetHeight(),&flags,&height,value,key,keylen)) >= 0 )
+            if ( found )
             {
-                std::string val; char *valuestr;
-                val.resize(valuesize);
-                valuestr = (char *)val.data();
-                memcpy(valuestr,value,valuesize);
+                std::string val(entry.vchValue.begin(),entry.vchValue.end());
+                refpubkey = entry.pubkey;
+                height = entry.nHeight;
+                flags = entry.nFlags;
+                valuesize = (int32_t)entry.vchValue.size();
                 if ( memcmp(&zeroes,&refpubkey,sizeof(refpubkey)) != 0 )
                     ret.push_back(Pair("owner",refpubkey.GetHex()));
                 ret.push_back(Pair("height",height));
@@ -1601,10 +1921,10 @@ UniValue verifychain(const UniValue& params, bool fHelp, const CPubKey& mypk)
 }
 
 /** Implementation of IsSuperMajority with better feedback */
-static UniValue SoftForkMajorityDesc(int minVersion, CBlockIndex* pindex, int nRequired, const Consensus::Params& consensusParams)
+static UniValue SoftForkMajorityDesc(int minVersion, const CBlockIndex* pindex, int nRequired, const Consensus::Params& consensusParams)
 {
     int nFound = 0;
-    CBlockIndex* pstart = pindex;
+    const CBlockIndex* pstart = pindex;
     for (int i = 0; i < consensusParams.nMajorityWindow && pstart != NULL; i++)
     {
         if (pstart->nVersion >= minVersion)
@@ -1620,7 +1940,7 @@ static UniValue SoftForkMajorityDesc(int minVersion, CBlockIndex* pindex, int nR
     return rv;
 }
 
-static UniValue SoftForkDesc(const std::string &name, int version, CBlockIndex* pindex, const Consensus::Params& consensusParams)
+static UniValue SoftForkDesc(const std::string &name, int version, const CBlockIndex* pindex, const Consensus::Params& consensusParams)
 {
     UniValue rv(UniValue::VOBJ);
     rv.push_back(Pair("id", name));
@@ -1703,6 +2023,12 @@ UniValue getblockchaininfo(const UniValue& params, bool fHelp, const CPubKey& my
             "  \"consensus\": {               (object) branch IDs of the current and upcoming consensus rules\n"
             "     \"chaintip\": \"xxxxxxxx\",   (string) branch ID used to validate the current chain tip\n"
             "     \"nextblock\": \"xxxxxxxx\"   (string) branch ID that the next block will be validated under\n"
+            "  },\n"
+            "  \"indexbuild\": {              (object, optional) indexes being built in the background\n"
+            "     \"indexes\": [\"xxxx\", ...], (array) names of the indexes, queries on them fail until they are built\n"
+            "     \"height\": xxxxxx,          (numeric) height the indexes are built up to\n"
+            "     \"progress\": xxxx,          (numeric) height reached as a fraction of the chain height [0..1]\n"
+            "     \"error\": \"xxxx\"           (string, optional) why the build stopped\n"
             "  }\n"
             "}\n"
             "\nExamples:\n"
@@ -1710,34 +2036,34 @@ UniValue getblockchaininfo(const UniValue& params, bool fHelp, const CPubKey& my
             + HelpExampleRpc("getblockchaininfo", "")
         );
 
-    LOCK(cs_main);
+    std::shared_ptr<const CChainTipSnapshot> snapshot = GetChainTipSnapshot();
+    CBlockIndex* tip = snapshot->pindexTip;
+    if (tip == NULL)
+        throw JSONRPCError(RPC_IN_WARMUP, "Block index not loaded yet");
+
     double progress;
     if ( ASSETCHAINS_SYMBOL[0] == 0 ) {
-        progress = Checkpoints::GuessVerificationProgress(Params().Checkpoints(), chainActive.LastTip());
+        progress = Checkpoints::GuessVerificationProgress(Params().Checkpoints(), tip);
     } else {
         int32_t longestchain = KOMODO_LONGESTCHAIN;//komodo_longestchain();
-	    progress = (longestchain > 0 ) ? (double) chainActive.Height() / longestchain : 1.0;
+	    progress = (longestchain > 0 ) ? (double) snapshot->nHeight / longestchain : 1.0;
     }
     UniValue obj(UniValue::VOBJ);
     obj.push_back(Pair("chain",                 Params().NetworkIDString()));
-    obj.push_back(Pair("blocks",                (int)chainActive.Height()));
+    obj.push_back(Pair("blocks",                snapshot->nHeight));
     obj.push_back(Pair("synced",                KOMODO_INSYNC!=0));
-    obj.push_back(Pair("headers",               pindexBestHeader ? pindexBestHeader->GetHeight() : -1));
-    obj.push_back(Pair("bestblockhash",         chainActive.LastTip()->GetBlockHash().GetHex()));
-    obj.push_back(Pair("difficulty",            (double)GetNetworkDifficulty()));
+    obj.push_back(Pair("headers",               snapshot->nHeadersHeight));
+    obj.push_back(Pair("bestblockhash",         tip->GetBlockHash().GetHex()));
+    obj.push_back(Pair("difficulty",            snapshot->dNetworkDifficulty));
     obj.push_back(Pair("verificationprogress",  progress));
-    obj.push_back(Pair("chainwork",             chainActive.LastTip()->chainPower.chainWork.GetHex()));
+    obj.push_back(Pair("chainwork",             tip->chainPower.chainWork.GetHex()));
     if (ASSETCHAINS_LWMAPOS)
     {
-        obj.push_back(Pair("chainstake",        chainActive.LastTip()->chainPower.chainStake.GetHex()));
+        obj.push_back(Pair("chainstake",        tip->chainPower.chainStake.GetHex()));
     }
     obj.push_back(Pair("pruned",                fPruneMode));
+    obj.push_back(Pair("commitments",           snapshot->nSproutCommitments));
 
-    SproutMerkleTree tree;
-    pcoinsTip->GetSproutAnchorAt(pcoinsTip->GetBestAnchor(SPROUT), tree);
-    obj.push_back(Pair("commitments",           static_cast<uint64_t>(tree.size())));
-
-    CBlockIndex* tip = chainActive.LastTip();
     UniValue valuePools(UniValue::VARR);
     valuePools.push_back(ValuePoolDesc("sprout", tip->nChainSproutValue, boost::none));
     valuePools.push_back(ValuePoolDesc("sapling", tip->nChainSaplingValue, boost::none));
@@ -1761,9 +2087,27 @@ UniValue getblockchaininfo(const UniValue& params, bool fHelp, const CPubKey& my
     consensus.push_back(Pair("nextblock", HexInt(CurrentEpochBranchId(tip->GetHeight() + 1, consensusParams))));
     obj.push_back(Pair("consensus", consensus));
 
+    int nBuildFamilies, nBuildHeight;
+    std::string strBuildError;
+    GetIndexBuildProgress(nBuildFamilies, nBuildHeight, strBuildError);
+    if (nBuildFamilies != 0) {
+        UniValue indexes(UniValue::VARR);
+        for (const std::string& strName : IndexBuildFamilyNames(nBuildFamilies))
+            indexes.push_back(strName);
+        UniValue indexbuild(UniValue::VOBJ);
+        indexbuild.push_back(Pair("indexes", indexes));
+        indexbuild.push_back(Pair("height", std::max(nBuildHeight, 0)));
+        indexbuild.push_back(Pair("progress", snapshot->nHeight > 0 ? std::max(nBuildHeight, 0) / (double)snapshot->nHeight : 1.0));
+        if (!strBuildError.empty())
+            indexbuild.push_back(Pair("error", strBuildError));
+        obj.push_back(Pair("indexbuild", indexbuild));
+    }
+
     if (fPruneMode)
     {
-        CBlockIndex *block = chainActive.LastTip();
+        // Pruning changes nStatus under cs_main
+        LOCK(cs_main);
+        CBlockIndex *block = tip;
         while (block && block->pprev && (block->pprev->nStatus & BLOCK_HAVE_DATA))
             block = block->pprev;
 
@@ -1905,6 +2249,10 @@ UniValue mempoolInfoToJSON()
     ret.push_back(Pair("size", (int64_t) mempool.size()));
     ret.push_back(Pair("bytes", (int64_t) mempool.GetTotalTxSize()));
     ret.push_back(Pair("usage", (int64_t) mempool.DynamicMemoryUsage()));
+    size_t maxmempool = GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
+    ret.push_back(Pair("maxmempool", (int64_t) maxmempool));
+    ret.push_back(Pair("mempoolminfee", ValueFromAmount(mempool.GetMinFee(maxmempool).GetFeePerK())));
+    ret.push_back(Pair("evicted", (int64_t) mempool.GetEvictedCount()));
 
     if (Params().NetworkIDString() == "regtest") {
         ret.push_back(Pair("fullyNotified", mempool.IsFullyNotified()));
@@ -1924,6 +2272,9 @@ UniValue getmempoolinfo(const UniValue& params, bool fHelp, const CPubKey& mypk)
             "  \"size\": xxxxx                (numeric) Current tx count\n"
             "  \"bytes\": xxxxx               (numeric) Sum of all tx sizes\n"
             "  \"usage\": xxxxx               (numeric) Total memory usage for the mempool\n"
+            "  \"maxmempool\": xxxxx          (numeric) Maximum memory usage for the mempool (-maxmempool)\n"
+            "  \"mempoolminfee\": xxxxx       (numeric) Minimum fee per kB to enter the mempool, raised while it is full\n"
+            "  \"evicted\": xxxxx             (numeric) Transactions evicted to keep the mempool within maxmempool\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getmempoolinfo", "")
@@ -2014,6 +2365,95 @@ UniValue getchaintxstats(const UniValue& params, bool fHelp, const CPubKey& mypk
     return ret;
 }
 
+//! Stage times of stats in milliseconds
+static UniValue BlockConnectStagesToJSON(const CBlockConnectStats& stats)
+{
+    UniValue stages(UniValue::VOBJ);
+    for (int i = 0; i < CONNECT_STAGE_COUNT; i++)
+        stages.pushKV(GetBlockConnectStageName(i), stats.nStageMicros[i] * 0.001);
+    return stages;
+}
+
+UniValue getblockconnectstats(const UniValue& params, bool fHelp, const CPubKey& mypk)
+{
+    if (fHelp || params.size() > 1)
+        throw runtime_error(
+            "getblockconnectstats ( count )\n"
+            "\nReturns the time connecting each of the last blocks to the tip took, by stage, and the totals since startup.\n"
+            "Sapling proofs checked when the block was accepted, before it was connected, are not included.\n"
+            "\nArguments:\n"
+            "1. count    (numeric, optional, default=10) Number of blocks, at most " + strprintf("%u", BLOCK_CONNECT_STATS_HISTORY) + "\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"blocks\": [              (array) The blocks, the most recent first\n"
+            "    {\n"
+            "      \"height\": n,         (numeric) The height of the block\n"
+            "      \"hash\": \"hash\",      (string) The hash of the block\n"
+            "      \"txs\": n,            (numeric) The number of transactions in the block\n"
+            "      \"total_ms\": x.xx,    (numeric) The time ConnectTip took\n"
+            "      \"stages\": {          (object) The time of each stage in milliseconds\n"
+            "        \"read\": x.xx,      (numeric) Reading the block from disk\n"
+            "        \"proofs\": x.xx,    (numeric) CheckBlock and ContextualCheckBlock, with the JoinSplit and Sapling proofs\n"
+            "        \"inputs\": x.xx,    (numeric) Inputs, coins and commitment trees of the transactions\n"
+            "        \"cceval\": x.xx,    (numeric) CC evals\n"
+            "        \"scripts\": x.xx,   (numeric) Waiting for the script check threads\n"
+            "        \"index\": x.xx,     (numeric) Undo data, notarisations and index writes\n"
+            "        \"komodo\": x.xx,    (numeric) Notary state, miners and assets order book\n"
+            "        \"flush\": x.xx,     (numeric) Flushing the block to the coins cache\n"
+            "        \"chainstate\": x.xx, (numeric) Writing the chain state to disk\n"
+            "        \"mempool\": x.xx,   (numeric) Removing the confirmed and expired transactions from the mempool\n"
+            "        \"updatetip\": x.xx, (numeric) Updating the active chain\n"
+            "        \"wallet\": x.xx,    (numeric) Wallet callbacks for the confirmed and conflicted transactions\n"
+            "        \"chaintip\": x.xx   (numeric) ChainTip callbacks, that update the wallet witnesses\n"
+            "      }\n"
+            "    }, ...\n"
+            "  ],\n"
+            "  \"totals\": {              (object) Sums over all blocks connected since startup\n"
+            "    \"blocks\": n,           (numeric) The number of blocks\n"
+            "    \"txs\": n,              (numeric) The number of transactions\n"
+            "    \"total_ms\": x.xx,      (numeric) The time ConnectTip took\n"
+            "    \"stages\": { ... }      (object) The time of each stage, as for the blocks\n"
+            "  }\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getblockconnectstats", "")
+            + HelpExampleCli("getblockconnectstats", "100")
+            + HelpExampleRpc("getblockconnectstats", "100")
+        );
+
+    int nCount = 10;
+    if (params.size() > 0) {
+        nCount = params[0].get_int();
+        if (nCount < 0)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid count, must be non-negative");
+    }
+
+    CBlockConnectStats totals;
+    std::vector<CBlockConnectStats> vStats = GetBlockConnectStats(nCount, totals);
+
+    UniValue blocks(UniValue::VARR);
+    for (const CBlockConnectStats& stats : vStats) {
+        UniValue obj(UniValue::VOBJ);
+        obj.pushKV("height", stats.nHeight);
+        obj.pushKV("hash", stats.hash.GetHex());
+        obj.pushKV("txs", (uint64_t)stats.nTx);
+        obj.pushKV("total_ms", stats.nTotalMicros * 0.001);
+        obj.pushKV("stages", BlockConnectStagesToJSON(stats));
+        blocks.push_back(obj);
+    }
+
+    UniValue total(UniValue::VOBJ);
+    total.pushKV("blocks", totals.nBlocks);
+    total.pushKV("txs", (uint64_t)totals.nTx);
+    total.pushKV("total_ms", totals.nTotalMicros * 0.001);
+    total.pushKV("stages", BlockConnectStagesToJSON(totals));
+
+    UniValue ret(UniValue::VOBJ);
+    ret.pushKV("blocks", blocks);
+    ret.pushKV("totals", total);
+    return ret;
+}
+
 UniValue invalidateblock(const UniValue& params, bool fHelp, const CPubKey& mypk)
 {
     if (fHelp || params.size() != 1)
@@ -2091,6 +2531,139 @@ UniValue reconsiderblock(const UniValue& params, bool fHelp, const CPubKey& mypk
     return NullUniValue;
 }
 
+//! Size of the records compressed with vDict and the time per record to compress them and to read them back
+static UniValue BenchRecordCompression(const std::vector<std::vector<char> >& vRecords, size_t nRawBytes, int nLevel, const std::vector<unsigned char>& vDict)
+{
+    std::vector<std::vector<char> > vFrames(vRecords.size());
+    size_t nBytes = 0;
+    int64_t nStart = GetTimeMicros();
+    for (size_t i = 0; i < vRecords.size(); i++) {
+        if (!CompressRecord(begin_ptr(vRecords[i]), vRecords[i].size(), nLevel, vDict.empty() ? 0 : 1, vDict, vFrames[i]))
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Block compression failed");
+        nBytes += vFrames[i].size();
+    }
+    int64_t nCompress = GetTimeMicros() - nStart;
+
+    nStart = GetTimeMicros();
+    try {
+        for (size_t i = 0; i < vFrames.size(); i++) {
+            std::vector<char> vRaw;
+            DecompressRecord(begin_ptr(vFrames[i]), vFrames[i].size(), vDict, vRaw);
+            CBlock block;
+            CSpanReader reader(SER_DISK, CLIENT_VERSION, begin_ptr(vRaw), vRaw.size());
+            reader >> block;
+        }
+    } catch (const std::exception& e) {
+        throw JSONRPCError(RPC_INTERNAL_ERROR, std::string("Block decompression failed: ") + e.what());
+    }
+    int64_t nRead = GetTimeMicros() - nStart;
+
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("bytes", (uint64_t)nBytes));
+    obj.push_back(Pair("ratio", nBytes == 0 ? 0.0 : (double)nRawBytes / nBytes));
+    obj.push_back(Pair("compressus", nCompress / (int64_t)vRecords.size()));
+    obj.push_back(Pair("readus", nRead / (int64_t)vRecords.size()));
+    return obj;
+}
+
+UniValue benchblockcompression(const UniValue& params, bool fHelp, const CPubKey& mypk)
+{
+    if (fHelp || params.size() > 2)
+        throw runtime_error(
+            "benchblockcompression ( blocks level )\n"
+            "\nCompresses the last blocks of the active chain as -blockcompression would, without writing\n"
+            "them, and compares the space saved with the time to read each block back. The dictionary is\n"
+            "trained on the blocks before the ones measured, so they are not compressed with their own strings.\n"
+            "\nArguments:\n"
+            "1. blocks   (numeric, optional, default=200) the number of blocks to compress (1-10000)\n"
+            "2. level    (numeric, optional) the zlib level (1-9), by default that of -blockcompression or 6\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"blocks\": n,               (numeric) the number of blocks compressed\n"
+            "  \"level\": n,                (numeric) the zlib level\n"
+            "  \"bytes\": n,                (numeric) the size of the blocks uncompressed\n"
+            "  \"readus\": n,               (numeric) microseconds to deserialize a block uncompressed\n"
+            "  \"zlib\": {                  (object) compressed without a dictionary\n"
+            "    \"bytes\": n,              (numeric) the size of the blocks compressed\n"
+            "    \"ratio\": x.xxx,          (numeric) the uncompressed size over the compressed size\n"
+            "    \"compressus\": n,         (numeric) microseconds to compress a block\n"
+            "    \"readus\": n              (numeric) microseconds to decompress and deserialize a block\n"
+            "  },\n"
+            "  \"dictionary\": {            (object) compressed with a trained dictionary, as above and\n"
+            "    \"samples\": n,            (numeric) the number of blocks the dictionary was trained on\n"
+            "    \"dictionarybytes\": n,    (numeric) the size of the dictionary, 0 if none was trained\n"
+            "    ...\n"
+            "  }\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("benchblockcompression", "1000 6")
+            + HelpExampleRpc("benchblockcompression", "1000, 6")
+        );
+
+    int nBlocks = params.size() > 0 ? params[0].get_int() : 200;
+    if (nBlocks < 1 || nBlocks > 10000)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Block count out of range");
+    int nLevel = params.size() > 1 ? params[1].get_int() : (nBlockCompressionLevel > 0 ? nBlockCompressionLevel : 6);
+    if (nLevel < 1 || nLevel > 9)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Compression level out of range");
+
+    // The blocks measured, then the ones before them to train on
+    std::vector<const CBlockIndex*> vMeasured, vTraining;
+    {
+        LOCK(cs_main);
+        for (const CBlockIndex* pindex = chainActive.Tip(); pindex != NULL && (int)vTraining.size() < BLOCK_DICTIONARY_SAMPLE_BLOCKS; pindex = pindex->pprev) {
+            if (!(pindex->nStatus & BLOCK_HAVE_DATA))
+                continue;
+            if ((int)vMeasured.size() < nBlocks)
+                vMeasured.push_back(pindex);
+            else
+                vTraining.push_back(pindex);
+        }
+    }
+    if (vMeasured.empty())
+        throw JSONRPCError(RPC_MISC_ERROR, "No blocks on disk");
+
+    std::vector<std::vector<char> > vRecords, vSamples;
+    size_t nRawBytes = 0;
+    int64_t nRead = 0;
+    for (int fTraining = 0; fTraining < 2; fTraining++) {
+        const std::vector<const CBlockIndex*>& vIndexes = fTraining ? vTraining : vMeasured;
+        for (const CBlockIndex* pindex : vIndexes) {
+            CBlock block;
+            if (!ReadBlockFromDisk(block, pindex, false))
+                throw JSONRPCError(RPC_MISC_ERROR, "Can't read block from disk");
+            CDataStream ss(SER_DISK, CLIENT_VERSION);
+            ss << block;
+            std::vector<char> vRecord(ss.begin(), ss.end());
+            if (fTraining) {
+                vSamples.push_back(vRecord);
+                continue;
+            }
+            int64_t nStart = GetTimeMicros();
+            CSpanReader reader(SER_DISK, CLIENT_VERSION, begin_ptr(vRecord), vRecord.size());
+            reader >> block;
+            nRead += GetTimeMicros() - nStart;
+            nRawBytes += vRecord.size();
+            vRecords.push_back(vRecord);
+        }
+    }
+
+    std::vector<unsigned char> vNoDict, vDict;
+    TrainBlockDictionary(vSamples, vDict);
+
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair("blocks", (int)vRecords.size()));
+    result.push_back(Pair("level", nLevel));
+    result.push_back(Pair("bytes", (uint64_t)nRawBytes));
+    result.push_back(Pair("readus", nRead / (int64_t)vRecords.size()));
+    result.push_back(Pair("zlib", BenchRecordCompression(vRecords, nRawBytes, nLevel, vNoDict)));
+    UniValue dictionary = BenchRecordCompression(vRecords, nRawBytes, nLevel, vDict);
+    dictionary.push_back(Pair("samples", (int)vSamples.size()));
+    dictionary.push_back(Pair("dictionarybytes", (uint64_t)vDict.size()));
+    result.push_back(Pair("dictionary", dictionary));
+    return result;
+}
+
 static const CRPCCommand commands[] =
 { //  category              name                      actor (function)         okSafeMode
   //  --------------------- ------------------------  -----------------------  ----------
@@ -2102,16 +2675,20 @@ static const CRPCCommand commands[] =
     { "blockchain",         "getblockheader",         &getblockheader,         true  },
     { "blockchain",         "getchaintips",           &getchaintips,           true  },
     { "blockchain",         "getchaintxstats",        &getchaintxstats,        true  },
+    { "blockchain",         "getblockconnectstats",   &getblockconnectstats,   true  },
     { "blockchain",         "getdifficulty",          &getdifficulty,          true  },
     { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         true  },
     { "blockchain",         "getrawmempool",          &getrawmempool,          true  },
     { "blockchain",         "gettxout",               &gettxout,               true  },
     { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true  },
+    { "blockchain",         "dumptxoutset",           &dumptxoutset,           true  },
+    { "blockchain",         "loadtxoutset",           &loadtxoutset,           true  },
     { "blockchain",         "verifychain",            &verifychain,            true  },
 
     /* Not shown in help */
     { "hidden",             "invalidateblock",        &invalidateblock,        true  },
     { "hidden",             "reconsiderblock",        &reconsiderblock,        true  },
+    { "hidden",             "benchblockcompression",  &benchblockcompression,  true  },
 };
 
 void RegisterBlockchainRPCCommands(CRPCTable &tableRPC)
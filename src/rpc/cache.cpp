@@ -0,0 +1,143 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "rpc/cache.h"
+
+#include "main.h"
+#include "memusage.h"
+
+int32_t komodo_dpowconfs(int32_t height,int32_t numconfs);
+
+CRPCResponseCache rpcResponseCache;
+
+//! Heap memory of a UniValue tree
+static size_t UniValueUsage(const UniValue& val)
+{
+    size_t nUsage = memusage::MallocUsage(val.getValStr().capacity());
+    if (val.isObject()) {
+        const std::vector<std::string>& keys = val.getKeys();
+        nUsage += memusage::MallocUsage(keys.capacity() * sizeof(std::string));
+        for (size_t i = 0; i < keys.size(); i++)
+            nUsage += memusage::MallocUsage(keys[i].capacity());
+    }
+    if (val.isObject() || val.isArray()) {
+        const std::vector<UniValue>& values = val.getValues();
+        nUsage += memusage::MallocUsage(values.capacity() * sizeof(UniValue));
+        for (size_t i = 0; i < values.size(); i++)
+            nUsage += UniValueUsage(values[i]);
+    }
+    return nUsage;
+}
+
+//! Brings the fields of a reply that move with the tip up to date
+static void RefreshReply(UniValue& result, const CBlockIndex* pindex, const CChainTipSnapshot& tip)
+{
+    if (!result.isObject())
+        return;
+    int nConfirmations = tip.nHeight - pindex->GetHeight() + 1;
+    if (!find_value(result, "rawconfirmations").isNull())
+        result.pushKV("rawconfirmations", nConfirmations);
+    if (!find_value(result, "confirmations").isNull())
+        result.pushKV("confirmations", komodo_dpowconfs(pindex->GetHeight(), nConfirmations));
+    if (!find_value(result, "last_notarized_height").isNull())
+        result.pushKV("last_notarized_height", tip.nNotarizedHeight);
+}
+
+CRPCResponseCache::CRPCResponseCache() :
+    nBytes(0), nMaxBytes(DEFAULT_RPC_CACHE_SIZE << 20), nHits(0), nMisses(0)
+{
+}
+
+std::string CRPCResponseCache::MakeKey(const std::string& strMethod, const UniValue& params)
+{
+    return strMethod + '\0' + params.write();
+}
+
+void CRPCResponseCache::Erase(std::map<std::string, Entry>::iterator it)
+{
+    nBytes -= it->second.nUsage;
+    lruKeys.erase(it->second.itLRU);
+    mapEntries.erase(it);
+}
+
+void CRPCResponseCache::Shrink(size_t nLimit)
+{
+    while (nBytes > nLimit && !lruKeys.empty())
+        Erase(mapEntries.find(lruKeys.back()));
+}
+
+void CRPCResponseCache::SetMaxBytes(size_t nMaxBytesIn)
+{
+    LOCK(cs);
+    nMaxBytes = nMaxBytesIn;
+    Shrink(nMaxBytesIn);
+}
+
+bool CRPCResponseCache::IsImmutable(const CBlockIndex* pindex) const
+{
+    if (!IsEnabled() || pindex == NULL)
+        return false;
+    std::shared_ptr<const CChainTipSnapshot> tip = GetChainTipSnapshot();
+    return pindex->GetHeight() < tip->nNotarizedHeight && tip->Contains(pindex);
+}
+
+bool CRPCResponseCache::Lookup(const std::string& strMethod, const UniValue& params, UniValue& result)
+{
+    if (!IsEnabled())
+        return false;
+    std::string strKey = MakeKey(strMethod, params);
+    std::shared_ptr<const CChainTipSnapshot> tip = GetChainTipSnapshot();
+    const CBlockIndex* pindex;
+    {
+        LOCK(cs);
+        std::map<std::string, Entry>::iterator it = mapEntries.find(strKey);
+        if (it == mapEntries.end()) {
+            nMisses++;
+            return false;
+        }
+        if (!tip->Contains(it->second.pindex)) {
+            // Invalidated by hand, the reply describes a block off the chain
+            Erase(it);
+            nMisses++;
+            return false;
+        }
+        nHits++;
+        lruKeys.splice(lruKeys.begin(), lruKeys, it->second.itLRU);
+        result = it->second.result;
+        pindex = it->second.pindex;
+    }
+    RefreshReply(result, pindex, *tip);
+    return true;
+}
+
+void CRPCResponseCache::Store(const std::string& strMethod, const UniValue& params, const UniValue& result, const CBlockIndex* pindex)
+{
+    if (!IsImmutable(pindex))
+        return;
+    std::string strKey = MakeKey(strMethod, params);
+    // The key is held by the map and the list
+    size_t nUsage = memusage::MallocUsage(sizeof(std::pair<const std::string, Entry>) + 3 * sizeof(void*)) +
+        memusage::MallocUsage(sizeof(std::string) + 2 * sizeof(void*)) +
+        2 * memusage::MallocUsage(strKey.capacity()) + UniValueUsage(result);
+
+    LOCK(cs);
+    if (nUsage > nMaxBytes || mapEntries.count(strKey))
+        return;
+    Shrink(nMaxBytes - nUsage);
+    Entry& entry = mapEntries[strKey];
+    entry.result = result;
+    entry.pindex = pindex;
+    entry.nUsage = nUsage;
+    entry.itLRU = lruKeys.insert(lruKeys.begin(), strKey);
+    nBytes += nUsage;
+}
+
+void CRPCResponseCache::GetStats(uint64_t& nHitsOut, uint64_t& nMissesOut, size_t& nEntriesOut, size_t& nBytesOut) const
+{
+    LOCK(cs);
+    nHitsOut = nHits;
+    nMissesOut = nMisses;
+    nEntriesOut = mapEntries.size();
+    nBytesOut = nBytes;
+}
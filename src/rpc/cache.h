@@ -0,0 +1,77 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_RPC_CACHE_H
+#define BITCOIN_RPC_CACHE_H
+
+#include "sync.h"
+
+#include <atomic>
+#include <list>
+#include <map>
+#include <stdint.h>
+#include <string>
+
+#include <univalue.h>
+
+class CBlockIndex;
+
+//! Default for -rpccachesize, in MiB, the cache is opt-in
+static const int64_t DEFAULT_RPC_CACHE_SIZE = 0;
+
+/**
+ * Replies of RPC calls about blocks that are buried under a notarization, such
+ * as getblock, getblockheader and getrawtransaction of a confirmed transaction.
+ * Those never change, so explorers asking for the same blocks again get the
+ * stored reply without reading the block from disk or building the JSON.
+ *
+ * Replies are keyed by the method and its parameters and remember the block
+ * they describe. A block qualifies when it is on the active chain below the
+ * last notarized height, so its successor (nextblockhash) is final as well.
+ * The confirmation counts and notarized height in a stored reply are brought
+ * up to date on every hit, and replies whose block left the active chain are
+ * dropped. Least recently used replies are evicted beyond the size limit.
+ */
+class CRPCResponseCache
+{
+private:
+    struct Entry {
+        UniValue result;
+        const CBlockIndex* pindex;
+        size_t nUsage;
+        std::list<std::string>::iterator itLRU;
+    };
+
+    mutable CCriticalSection cs;
+    std::map<std::string, Entry> mapEntries;
+    //! Keys of the entries, most recently used first
+    std::list<std::string> lruKeys;
+    size_t nBytes;
+    std::atomic<size_t> nMaxBytes;
+    uint64_t nHits;
+    uint64_t nMisses;
+
+    static std::string MakeKey(const std::string& strMethod, const UniValue& params);
+    void Erase(std::map<std::string, Entry>::iterator it);
+    void Shrink(size_t nLimit);
+
+public:
+    CRPCResponseCache();
+
+    void SetMaxBytes(size_t nMaxBytesIn);
+    bool IsEnabled() const { return nMaxBytes.load() > 0; }
+
+    //! True if a reply about the block would be stored
+    bool IsImmutable(const CBlockIndex* pindex) const;
+
+    bool Lookup(const std::string& strMethod, const UniValue& params, UniValue& result);
+    //! Stores the reply, if the block it describes is immutable
+    void Store(const std::string& strMethod, const UniValue& params, const UniValue& result, const CBlockIndex* pindex);
+
+    void GetStats(uint64_t& nHitsOut, uint64_t& nMissesOut, size_t& nEntriesOut, size_t& nBytesOut) const;
+};
+
+extern CRPCResponseCache rpcResponseCache;
+
+#endif // BITCOIN_RPC_CACHE_H
@@ -41,6 +41,7 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "stop", 0 },
     { "setmocktime", 0 },
     { "getaddednodeinfo", 0 },
+    { "getnodestatshistory", 0 },
     { "setgenerate", 0 },
     { "setgenerate", 1 },
     { "generate", 0 },
@@ -90,6 +91,10 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "getblock", 1 },
     { "getblockheader", 1 },
     { "getchaintxstats", 0  },
+    { "getblockconnectstats", 0 },
+    { "getlockstats", 0 },
+    { "setlockprofile", 0 },
+    { "setlockprofile", 1 },
     { "getlastsegidstakes", 0 },
     { "gettransaction", 1 },
     { "getrawtransaction", 1 },
@@ -105,6 +110,7 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "gettxout", 1 },
     { "gettxout", 2 },
     { "gettxoutproof", 0 },
+    { "gettxoutsetinfo", 0 },
     { "lockunspent", 0 },
     { "lockunspent", 1 },
     { "importprivkey", 2 },
@@ -113,6 +119,8 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "importaddress", 2 },
     { "verifychain", 0 },
     { "verifychain", 1 },
+    { "benchblockcompression", 0 },
+    { "benchblockcompression", 1 },
     { "keypoolrefill", 0 },
     { "getrawmempool", 0 },
     { "estimatefee", 0 },
@@ -137,9 +145,15 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "zcrawjoinsplit", 4 },
     { "zcbenchmark", 1 },
     { "zcbenchmark", 2 },
+    { "zcbenchmark", 3 },
     { "getblocksubsidy", 0},
     { "z_listaddresses", 0},
+    { "z_getnewaddresses", 0},
+    { "z_getnewaddresskeys", 0},
     { "z_listreceivedbyaddress", 1},
+    { "z_listreceivedbyaddress", 2},
+    { "z_findmemo", 1},
+    { "z_findmemo", 2},
     { "z_listunspent", 0 },
     { "z_listunspent", 1 },
     { "z_listunspent", 2 },
@@ -153,12 +167,14 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "z_mergetoaddress", 2},
     { "z_mergetoaddress", 3},
     { "z_mergetoaddress", 4},
+    { "z_mergetoaddress", 7},
     { "z_viewtransaction", 1},
     { "z_sendmany", 1},
     { "z_sendmany", 2},
     { "z_sendmany", 3},
     { "z_shieldcoinbase", 2},
     { "z_shieldcoinbase", 3},
+    { "z_shieldcoinbase", 4},
     { "z_getoperationstatus", 0},
     { "z_getoperationresult", 0},
     { "paxprice", 4 },
@@ -170,6 +186,12 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "kvupdate", 4 },
     { "z_importkey", 2 },
     { "z_importviewingkey", 2 },
+    { "z_importkeys", 0 },
+    { "z_importkeys", 2 },
+    { "vkscanner_addviewingkey", 2 },
+    { "vkscanner_getbalance", 1 },
+    { "vkscanner_listnotes", 1 },
+    { "vkscanner_listnotes", 2 },
     { "z_getpaymentdisclosure", 1},
     { "z_getpaymentdisclosure", 2},
     // crosschain
@@ -180,11 +202,14 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "height_MoM", 1},
     { "calc_MoM", 2},
     { "migrate_completeimporttransaction", 1},
+    { "migrate_completeimporttransactions", 0},
+    { "migrate_completeimporttransactions", 1},
 
     { "getalldata", 0},
     { "getalldata", 1},
     { "getalldata", 2},
     { "getalldata", 3},
+    { "getalldata", 5},
     { "zs_listtransactions", 0},
     { "zs_listtransactions", 1},
     { "zs_listtransactions", 2},
@@ -623,6 +623,42 @@ UniValue migrate_completeimporttransaction(const UniValue& params, bool fHelp, c
     return ret;
 }
 
+UniValue migrate_completeimporttransactions(const UniValue& params, bool fHelp, const CPubKey& mypk)
+{
+    if (fHelp || params.size() < 1 || params.size() > 2)
+        throw runtime_error("migrate_completeimporttransactions [importTx, ...] [offset]\n\n"
+                "Does migrate_completeimporttransaction for an array of import txs in one pass.\n"
+                "Returns an object per import tx with ImportTxHex, or error if it could not be completed.\n"
+                "offset is optional, use it to increase the used KMD height, use when import fails.");
+
+    if (ASSETCHAINS_SYMBOL[0] != 0)
+        throw runtime_error("Must be called on KMD");
+
+    UniValue txs = params[0].get_array();
+    std::vector<CTransaction> importTxs(txs.size());
+    for (size_t i = 0; i < txs.size(); i++) {
+        if (!E_UNMARSHAL(ParseHexV(txs[i], "importTx"), ss >> importTxs[i]))
+            throw runtime_error(strprintf("Couldn't parse importTx %d", i));
+    }
+
+    int32_t offset = 0;
+    if ( params.size() == 2 )
+        offset = params[1].get_int();
+
+    std::vector<std::string> errors = CompleteImportTransactions(importTxs, offset);
+
+    UniValue ret(UniValue::VARR);
+    for (size_t i = 0; i < importTxs.size(); i++) {
+        UniValue entry(UniValue::VOBJ);
+        if (errors[i].empty())
+            entry.push_back(Pair("ImportTxHex", HexStr(E_MARSHAL(ss << importTxs[i]))));
+        else
+            entry.push_back(Pair("error", errors[i]));
+        ret.push_back(entry);
+    }
+    return ret;
+}
+
 /*
 * Alternate coin migration solution if MoMoM migration has failed
 *
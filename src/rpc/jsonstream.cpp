@@ -0,0 +1,233 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "rpc/jsonstream.h"
+
+#include "utilstrencodings.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace {
+const uint8_t CBOR_UNSIGNED = 0;
+const uint8_t CBOR_NEGATIVE = 1;
+const uint8_t CBOR_BYTES = 2;
+const uint8_t CBOR_TEXT = 3;
+const char CBOR_INDEFINITE_ARRAY = (char)0x9f;
+const char CBOR_INDEFINITE_MAP = (char)0xbf;
+const char CBOR_BREAK = (char)0xff;
+const char CBOR_FALSE = (char)0xf4;
+const char CBOR_TRUE = (char)0xf5;
+const char CBOR_NULL = (char)0xf6;
+const char CBOR_DOUBLE = (char)0xfb;
+}
+
+JSONStreamWriter::JSONStreamWriter(const FlushFunc& flush, size_t nChunkSize, Format format) :
+    flush(flush), nChunkSize(nChunkSize), format(format), fAfterKey(false), fFlushed(false)
+{
+    buffer.reserve(nChunkSize);
+}
+
+void JSONStreamWriter::Separate()
+{
+    if (fAfterKey) {
+        fAfterKey = false;
+        return;
+    }
+    if (!vEmpty.empty()) {
+        if (!vEmpty.back() && format == FORMAT_TEXT)
+            buffer += ',';
+        vEmpty.back() = false;
+    }
+}
+
+void JSONStreamWriter::Append(const char* data, size_t len)
+{
+    buffer.append(data, len);
+    if (buffer.size() >= nChunkSize) {
+        fFlushed = true;
+        flush(buffer, false);
+        buffer.clear();
+    }
+}
+
+void JSONStreamWriter::Append(const std::string& str)
+{
+    Append(str.data(), str.size());
+}
+
+void JSONStreamWriter::AppendCBORHead(uint8_t nMajor, uint64_t nArg)
+{
+    char head[9];
+    size_t nLen;
+    if (nArg < 24) {
+        head[0] = (char)(nMajor << 5 | nArg);
+        nLen = 1;
+    } else {
+        int nBytes = nArg <= 0xff ? 1 : nArg <= 0xffff ? 2 : nArg <= 0xffffffff ? 4 : 8;
+        head[0] = (char)(nMajor << 5 | (nBytes == 1 ? 24 : nBytes == 2 ? 25 : nBytes == 4 ? 26 : 27));
+        for (int i = 0; i < nBytes; i++)
+            head[1 + i] = (char)(nArg >> (8 * (nBytes - 1 - i)));
+        nLen = 1 + nBytes;
+    }
+    Append(head, nLen);
+}
+
+void JSONStreamWriter::AppendCBORString(uint8_t nMajor, const char* data, size_t len)
+{
+    AppendCBORHead(nMajor, len);
+    Append(data, len);
+}
+
+void JSONStreamWriter::BeginObject()
+{
+    Separate();
+    vEmpty.push_back(true);
+    if (format == FORMAT_CBOR)
+        Append(&CBOR_INDEFINITE_MAP, 1);
+    else
+        Append("{", 1);
+}
+
+void JSONStreamWriter::EndObject()
+{
+    assert(!vEmpty.empty() && !fAfterKey);
+    vEmpty.pop_back();
+    if (format == FORMAT_CBOR)
+        Append(&CBOR_BREAK, 1);
+    else
+        Append("}", 1);
+}
+
+void JSONStreamWriter::BeginArray()
+{
+    Separate();
+    vEmpty.push_back(true);
+    if (format == FORMAT_CBOR)
+        Append(&CBOR_INDEFINITE_ARRAY, 1);
+    else
+        Append("[", 1);
+}
+
+void JSONStreamWriter::EndArray()
+{
+    assert(!vEmpty.empty() && !fAfterKey);
+    vEmpty.pop_back();
+    if (format == FORMAT_CBOR)
+        Append(&CBOR_BREAK, 1);
+    else
+        Append("]", 1);
+}
+
+void JSONStreamWriter::Key(const std::string& key)
+{
+    assert(!vEmpty.empty() && !fAfterKey);
+    Separate();
+    if (format == FORMAT_CBOR)
+        AppendCBORString(CBOR_TEXT, key.data(), key.size());
+    else
+        Append(UniValue(key).write() + ":");
+    fAfterKey = true;
+}
+
+void JSONStreamWriter::Scalar(const UniValue& val)
+{
+    if (format == FORMAT_TEXT) {
+        Append(val.write());
+        return;
+    }
+
+    switch (val.getType()) {
+    case UniValue::VNULL:
+        Append(&CBOR_NULL, 1);
+        break;
+    case UniValue::VBOOL:
+        Append(val.get_bool() ? &CBOR_TRUE : &CBOR_FALSE, 1);
+        break;
+    case UniValue::VSTR:
+        AppendCBORString(CBOR_TEXT, val.get_str().data(), val.get_str().size());
+        break;
+    case UniValue::VNUM: {
+        // Numbers are kept as their JSON text, integers that fit stay exact
+        const std::string& str = val.getValStr();
+        int64_t n;
+        if (str.find_first_of(".eE") == std::string::npos && ParseInt64(str, &n)) {
+            if (n >= 0)
+                AppendCBORHead(CBOR_UNSIGNED, (uint64_t)n);
+            else
+                AppendCBORHead(CBOR_NEGATIVE, (uint64_t)(-(n + 1)));
+        } else {
+            double d = strtod(str.c_str(), NULL);
+            uint64_t bits;
+            static_assert(sizeof(bits) == sizeof(d), "double is not 64 bits");
+            memcpy(&bits, &d, sizeof(bits));
+            char out[9];
+            out[0] = CBOR_DOUBLE;
+            for (int i = 0; i < 8; i++)
+                out[1 + i] = (char)(bits >> (8 * (7 - i)));
+            Append(out, sizeof(out));
+        }
+        break;
+    }
+    default:
+        assert(!"not a scalar");
+    }
+}
+
+void JSONStreamWriter::Value(const UniValue& val)
+{
+    if (val.isObject()) {
+        BeginObject();
+        const std::vector<std::string>& keys = val.getKeys();
+        const std::vector<UniValue>& values = val.getValues();
+        for (size_t i = 0; i < keys.size(); i++)
+            KeyValue(keys[i], values[i]);
+        EndObject();
+    } else if (val.isArray()) {
+        BeginArray();
+        const std::vector<UniValue>& values = val.getValues();
+        for (size_t i = 0; i < values.size(); i++)
+            Value(values[i]);
+        EndArray();
+    } else {
+        Separate();
+        Scalar(val);
+    }
+}
+
+void JSONStreamWriter::KeyValue(const std::string& key, const UniValue& val)
+{
+    Key(key);
+    Value(val);
+}
+
+void JSONStreamWriter::Bytes(const unsigned char* begin, const unsigned char* end)
+{
+    Separate();
+    if (format == FORMAT_CBOR) {
+        AppendCBORString(CBOR_BYTES, (const char*)begin, end - begin);
+    } else {
+        Append("\"", 1);
+        Append(HexStr(begin, end));
+        Append("\"", 1);
+    }
+}
+
+void JSONStreamWriter::WriteRaw(const std::string& str)
+{
+    Append(str);
+}
+
+void JSONStreamWriter::Finish()
+{
+    flush(buffer, true);
+    buffer.clear();
+}
+
+void JSONStreamWriter::Discard()
+{
+    buffer.clear();
+}
@@ -0,0 +1,93 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_RPC_JSONSTREAM_H
+#define BITCOIN_RPC_JSONSTREAM_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <boost/function.hpp>
+
+#include <univalue.h>
+
+//! Size of the chunks handed to the flush function
+static const size_t DEFAULT_JSON_STREAM_CHUNK_SIZE = 64 * 1024;
+
+/**
+ * Writes a JSON document while it is generated, either as compact text, the
+ * same as UniValue::write, or as CBOR (RFC 7049). The output is buffered and
+ * handed to the flush function in chunks, so a large document never has to
+ * exist in memory as a whole, neither as a UniValue tree nor as a string.
+ * Separators are inserted automatically; the caller only has to produce a
+ * well formed sequence of calls.
+ *
+ * CBOR arrays and maps are written with indefinite length, integers as CBOR
+ * integers and other numbers as doubles. Binary data written with Bytes is a
+ * CBOR byte string, and a hex string in text JSON.
+ */
+class JSONStreamWriter
+{
+public:
+    enum Format {
+        FORMAT_TEXT,
+        FORMAT_CBOR,
+    };
+
+    /**
+     * Receives the output, with fLast set on the final call. The chunk may be
+     * consumed (swapped out or cleared). May throw to abort the writer.
+     */
+    typedef boost::function<void(std::string& chunk, bool fLast)> FlushFunc;
+
+    explicit JSONStreamWriter(const FlushFunc& flush, size_t nChunkSize = DEFAULT_JSON_STREAM_CHUNK_SIZE, Format format = FORMAT_TEXT);
+
+    Format GetFormat() const { return format; }
+
+    void BeginObject();
+    void EndObject();
+    void BeginArray();
+    void EndArray();
+    //! Key of the next member of the current object
+    void Key(const std::string& key);
+    //! Writes a complete value, arrays and objects element by element
+    void Value(const UniValue& val);
+    void KeyValue(const std::string& key, const UniValue& val);
+    //! Writes binary data as one value
+    void Bytes(const unsigned char* begin, const unsigned char* end);
+    //! Appends data as is, outside of the document structure
+    void WriteRaw(const std::string& str);
+
+    //! Hands the rest of the output to the flush function, as the last chunk
+    void Finish();
+    //! Drops the output that was not flushed yet
+    void Discard();
+
+    //! True once part of the output went to the flush function
+    bool Flushed() const { return fFlushed; }
+    //! True after a key was written and before its value
+    bool ExpectsValue() const { return fAfterKey; }
+
+private:
+    FlushFunc flush;
+    size_t nChunkSize;
+    Format format;
+    std::string buffer;
+    //! One entry per open array or object, true while it has no element
+    std::vector<bool> vEmpty;
+    bool fAfterKey;
+    bool fFlushed;
+
+    //! Separator before a new element
+    void Separate();
+    void Append(const std::string& str);
+    void Append(const char* data, size_t len);
+    //! CBOR initial byte and argument of a data item
+    void AppendCBORHead(uint8_t nMajor, uint64_t nArg);
+    void AppendCBORString(uint8_t nMajor, const char* data, size_t len);
+    void Scalar(const UniValue& val);
+};
+
+#endif // BITCOIN_RPC_JSONSTREAM_H
@@ -771,6 +771,7 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp, const CPubKey& myp
         (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 5))
     {
         // Clear pindexPrev so future calls make a new block, despite any failures from here on
+        CBlockIndex* pindexPrevLast = pindexPrev;
         pindexPrev = NULL;
 
         // Store the pindexBest used before CreateNewBlockWithKey, to avoid races
@@ -784,13 +785,20 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp, const CPubKey& myp
             delete pblocktemplate;
             pblocktemplate = NULL;
         }
-#ifdef ENABLE_WALLET
-        CReserveKey reservekey(pwalletMain);
+        bool fNewTip = pindexPrevLast != pindexPrevNew;
         LEAVE_CRITICAL_SECTION(cs_main);
-        pblocktemplate = CreateNewBlockWithKey(reservekey,pindexPrevNew->GetHeight()+1,KOMODO_MAXGPUCOUNT,false);
+        // On a new tip the template is usually ready, and the outrun one is useless to miners
+        if (fNewTip)
+            pblocktemplate = TakePrebuiltBlockTemplate(pindexPrevNew->GetBlockHash(), nTransactionsUpdatedLast);
+        if (!pblocktemplate)
+        {
+#ifdef ENABLE_WALLET
+            CReserveKey reservekey(pwalletMain);
+            pblocktemplate = CreateNewBlockWithKey(reservekey,pindexPrevNew->GetHeight()+1,KOMODO_MAXGPUCOUNT,false);
 #else
-        pblocktemplate = CreateNewBlockWithKey();
+            pblocktemplate = CreateNewBlockWithKey();
 #endif
+        }
         ENTER_CRITICAL_SECTION(cs_main);
         if (!pblocktemplate)
             throw std::runtime_error("CreateNewBlock(): create block failed");
@@ -24,6 +24,8 @@
 #include "main.h"
 #include "net.h"
 #include "netbase.h"
+#include "nspvcache.h"
+#include "rpc/jsonstream.h"
 #include "rpc/server.h"
 #include "txmempool.h"
 #include "util.h"
@@ -193,7 +195,7 @@ UniValue geterablockheights(const UniValue& params, bool fHelp, const CPubKey& m
 
 UniValue getinfo(const UniValue& params, bool fHelp, const CPubKey& mypk)
 {
-    uint256 notarized_hash,notarized_desttxid; int32_t prevMoMheight,notarized_height,longestchain,kmdnotarized_height,txid_height;
+    int32_t longestchain,kmdnotarized_height,txid_height;
     if (fHelp || params.size() != 0)
         throw runtime_error(
             "getinfo\n"
@@ -216,21 +218,24 @@ UniValue getinfo(const UniValue& params, bool fHelp, const CPubKey& mypk)
             "  \"paytxfee\": x.xxxx,         (numeric) the transaction fee set in " + CURRENCY_UNIT + "/kB\n"
             "  \"relayfee\": x.xxxx,         (numeric) minimum relay fee for non-free transactions in " + CURRENCY_UNIT + "/kB\n"
             "  \"errors\": \"...\"           (string) any error messages\n"
+            "  \"nspvcache\": {              (json object, only with -nspv_msg) the cache of answers to NSPV requests\n"
+            "    \"hits\": n,                (numeric) requests answered from the cache\n"
+            "    \"misses\": n,              (numeric) cacheable requests that had to be computed\n"
+            "    \"entries\": n,             (numeric) answers currently cached\n"
+            "    \"bytes\": n                (numeric) memory used by the cache\n"
+            "  }\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getinfo", "")
             + HelpExampleRpc("getinfo", "")
         );
-    //#ifdef ENABLE_WALLET
-    //    LOCK2(cs_main, pwalletMain ? &pwalletMain->cs_wallet : NULL);
-    //#else
-    LOCK(cs_main);
-    //#endif
+    // The chain fields come from the published tip snapshot, so getinfo does
+    // not wait for cs_main while blocks are connected
+    std::shared_ptr<const CChainTipSnapshot> tip = GetChainTipSnapshot();
+    const uint256& notarized_desttxid = tip->notarizedDestTxid;
 
     proxyType proxy;
     GetProxy(NET_IPV4, proxy);
-    notarized_height = komodo_notarized_height(&prevMoMheight,&notarized_hash,&notarized_desttxid);
-    //fprintf(stderr,"after notarized_height %u\n",(uint32_t)time(NULL));
 
     UniValue obj(UniValue::VOBJ);
     obj.push_back(Pair("version", CLIENT_VERSION));
@@ -239,9 +244,9 @@ UniValue getinfo(const UniValue& params, bool fHelp, const CPubKey& mypk)
     obj.push_back(Pair("PIRATEversion", CLIENT_BUILD));
     obj.push_back(Pair("synced", KOMODO_INSYNC!=0));
     //obj.push_back(Pair("VRSCversion", VERUS_VERSION));
-    obj.push_back(Pair("notarized", notarized_height));
-    obj.push_back(Pair("prevMoMheight", prevMoMheight));
-    obj.push_back(Pair("notarizedhash", notarized_hash.ToString()));
+    obj.push_back(Pair("notarized", tip->nNotarizedHeight));
+    obj.push_back(Pair("prevMoMheight", tip->nPrevMoMHeight));
+    obj.push_back(Pair("notarizedhash", tip->notarizedHash.ToString()));
     obj.push_back(Pair("notarizedtxid", notarized_desttxid.ToString()));
     if ( KOMODO_NSPV_FULLNODE )
     {
@@ -268,16 +273,17 @@ UniValue getinfo(const UniValue& params, bool fHelp, const CPubKey& mypk)
         }
 #endif
         //fprintf(stderr,"after wallet %u\n",(uint32_t)time(NULL));
-        obj.push_back(Pair("blocks",        (int)chainActive.Height()));
-        if ( (longestchain= KOMODO_LONGESTCHAIN) != 0 && chainActive.Height() > longestchain )
-            longestchain = chainActive.Height();
+        obj.push_back(Pair("blocks",        tip->nHeight));
+        if ( (longestchain= KOMODO_LONGESTCHAIN) != 0 && tip->nHeight > longestchain )
+            longestchain = tip->nHeight;
         //fprintf(stderr,"after longestchain %u\n",(uint32_t)time(NULL));
         obj.push_back(Pair("longestchain",        longestchain));
-        if ( chainActive.LastTip() != 0 )
-            obj.push_back(Pair("tiptime", (int)chainActive.LastTip()->nTime));
-        obj.push_back(Pair("difficulty",    (double)GetDifficulty()));
+        if ( tip->pindexTip != 0 )
+            obj.push_back(Pair("tiptime", (int)tip->pindexTip->nTime));
+        obj.push_back(Pair("difficulty",    tip->pindexTip != 0 ? GetDifficulty(tip->pindexTip) : 1.0));
 #ifdef ENABLE_WALLET
         if (pwalletMain) {
+            LOCK(pwalletMain->cs_wallet);
             obj.push_back(Pair("keypoololdest", pwalletMain->GetOldestKeyPoolTime()));
             obj.push_back(Pair("keypoolsize",   (int)pwalletMain->GetKeyPoolSize()));
         }
@@ -293,12 +299,23 @@ UniValue getinfo(const UniValue& params, bool fHelp, const CPubKey& mypk)
     obj.push_back(Pair("testnet",       Params().TestnetToBeDeprecatedFieldRPC()));
     obj.push_back(Pair("relayfee",      ValueFromAmount(::minRelayTxFee.GetFeePerK())));
     obj.push_back(Pair("errors",        GetWarnings("statusbar")));
+    if ( KOMODO_NSPV_FULLNODE && GetBoolArg("-nspv_msg", DEFAULT_NSPV_PROCESSING) )
+    {
+        uint64_t nHits, nMisses; size_t nEntries, nBytes;
+        nspvResponseCache.GetStats(nHits, nMisses, nEntries, nBytes);
+        UniValue cache(UniValue::VOBJ);
+        cache.push_back(Pair("hits", nHits));
+        cache.push_back(Pair("misses", nMisses));
+        cache.push_back(Pair("entries", (uint64_t)nEntries));
+        cache.push_back(Pair("bytes", (uint64_t)nBytes));
+        obj.push_back(Pair("nspvcache", cache));
+    }
      if ( NOTARY_PUBKEY33[0] != 0 ) {
         char pubkeystr[65]; int32_t notaryid; std::string notaryname;
         if ( (notaryid= StakedNotaryID(notaryname, (char *)NOTARY_ADDRESS.c_str())) != -1 ) {
             obj.push_back(Pair("notaryid",        notaryid));
             obj.push_back(Pair("notaryname",      notaryname));
-        } else if( (notaryid= komodo_whoami(pubkeystr,(int32_t)chainActive.LastTip()->GetHeight(),komodo_chainactive_timestamp())) >= 0 )  {
+        } else if( tip->pindexTip != 0 && (notaryid= komodo_whoami(pubkeystr,tip->nHeight,(uint32_t)tip->pindexTip->GetBlockTime())) >= 0 )  {
             obj.push_back(Pair("notaryid",        notaryid));
             if ( KOMODO_LASTMINED != 0 )
                 obj.push_back(Pair("lastmined", KOMODO_LASTMINED));
@@ -1009,6 +1026,87 @@ UniValue getaddressmempool(const UniValue& params, bool fHelp, const CPubKey& my
     return result;
 }
 
+/**
+ * Paging of getaddressutxos and getaddressdeltas. The addresses are read one
+ * after the other in the order given, each straight from the index iterator
+ * in key order, so a page never holds more than its limit in memory. The
+ * cursor is the hex encoded index key of the first entry of the next page.
+ */
+static bool ParseAddressPaging(const UniValue& params, size_t& nLimit, std::string& strCursor)
+{
+    nLimit = 0;
+    strCursor.clear();
+    if (!params[0].isObject())
+        return false;
+    const UniValue& limitValue = find_value(params[0].get_obj(), "limit");
+    const UniValue& cursorValue = find_value(params[0].get_obj(), "cursor");
+    if (!limitValue.isNull()) {
+        if (!limitValue.isNum() || limitValue.get_int64() <= 0)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Limit is expected to be greater than zero");
+        nLimit = limitValue.get_int64();
+    }
+    if (!cursorValue.isNull())
+        strCursor = cursorValue.get_str();
+    return !limitValue.isNull() || !cursorValue.isNull();
+}
+
+template <typename Key>
+static std::string EncodeAddressCursor(const Key& key)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << key;
+    return HexStr(ss.begin(), ss.end());
+}
+
+//! Returns the position of the address the cursor points into
+template <typename Key>
+static size_t DecodeAddressCursor(const std::string& strCursor, const std::vector<std::pair<uint160, int> >& addresses, Key& key)
+{
+    std::vector<unsigned char> data(ParseHex(strCursor));
+    if (!IsHex(strCursor) || data.size() != key.GetSerializeSize(SER_DISK, CLIENT_VERSION))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid cursor");
+    CDataStream ss(data, SER_DISK, CLIENT_VERSION);
+    ss >> key;
+    for (size_t i = 0; i < addresses.size(); i++) {
+        if (addresses[i].first == key.hashBytes && addresses[i].second == (int)key.type)
+            return i;
+    }
+    throw JSONRPCError(RPC_INVALID_PARAMETER, "Cursor does not belong to the addresses");
+}
+
+//! Ends a reply of an array named strKey followed by the members of extra
+static UniValue FinishAddressPage(JSONStreamWriter* stream, const std::string& strKey, const UniValue& entries, const UniValue& extra)
+{
+    if (stream) {
+        stream->EndArray();
+        for (size_t i = 0; i < extra.size(); i++)
+            stream->KeyValue(extra.getKeys()[i], extra.getValues()[i]);
+        stream->EndObject();
+        return NullUniValue;
+    }
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair(strKey, entries));
+    result.pushKVs(extra);
+    return result;
+}
+
+UniValue AddressUnspentToJSON(const CAddressUnspentKey& key, const CAddressUnspentValue& value)
+{
+    UniValue output(UniValue::VOBJ);
+    std::string address;
+    if (!getAddressFromIndex(key.type, key.hashBytes, address)) {
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Unknown address type");
+    }
+
+    output.push_back(Pair("address", address));
+    output.push_back(Pair("txid", key.txhash.GetHex()));
+    output.push_back(Pair("outputIndex", (int)key.index));
+    output.push_back(Pair("script", HexStr(value.script.begin(), value.script.end())));
+    output.push_back(Pair("satoshis", value.satoshis));
+    output.push_back(Pair("height", value.blockHeight));
+    return output;
+}
+
 UniValue getaddressutxos(const UniValue& params, bool fHelp, const CPubKey& mypk)
 {
     if (fHelp || params.size() > 2 || params.size() == 0)
@@ -1023,6 +1121,8 @@ UniValue getaddressutxos(const UniValue& params, bool fHelp, const CPubKey& mypk
             "      ,...\n"
             "    ],\n"
             "  \"chainInfo\"  (boolean) Include chain info with results\n"
+            "  \"limit\"  (number, optional) Return at most this many outputs, in index order instead of by height\n"
+            "  \"cursor\"  (string, optional) Continue after the previous page, as returned with it\n"
             "}\n"
             "\nCCvout (optional) Return CCvouts instead of normal vouts\n"
             "\nResult\n"
@@ -1036,6 +1136,11 @@ UniValue getaddressutxos(const UniValue& params, bool fHelp, const CPubKey& mypk
             "    \"satoshis\"  (number) The number of satoshis of the output\n"
             "  }\n"
             "]\n"
+            "\nResult (with limit or cursor)\n"
+            "{\n"
+            "  \"utxos\"  (array) The outputs as above\n"
+            "  \"cursor\"  (string) Pass it to get the next page, missing on the last page\n"
+            "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getaddressutxos", "'{\"addresses\": [\"RY5LccmGiX9bUHYGtSWQouNy1yFhc5rM87\"]}' (ccvout)")
             + HelpExampleRpc("getaddressutxos", "{\"addresses\": [\"RY5LccmGiX9bUHYGtSWQouNy1yFhc5rM87\"]} (ccvout)")
@@ -1055,6 +1160,53 @@ UniValue getaddressutxos(const UniValue& params, bool fHelp, const CPubKey& mypk
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
     }
 
+    size_t nLimit;
+    std::string strCursor;
+    if (ParseAddressPaging(params, nLimit, strCursor)) {
+        CAddressUnspentKey start;
+        size_t nFirst = strCursor.empty() ? 0 : DecodeAddressCursor(strCursor, addresses, start);
+
+        // Written one output at a time when the transport allows it
+        JSONStreamWriter* stream = RPCTakeReplyStream("getaddressutxos");
+        if (stream) {
+            stream->BeginObject();
+            stream->Key("utxos");
+            stream->BeginArray();
+        }
+
+        UniValue utxos(UniValue::VARR);
+        size_t nCount = 0;
+        std::string strNext;
+        for (size_t i = nFirst; i < addresses.size() && strNext.empty(); i++) {
+            if (i != nFirst || strCursor.empty())
+                start = CAddressUnspentKey(addresses[i].second, addresses[i].first, uint256(), 0);
+            bool fRead = GetAddressUnspent(start, [&](const CAddressUnspentKey& key, const CAddressUnspentValue& value) {
+                if (nLimit > 0 && nCount == nLimit) {
+                    strNext = EncodeAddressCursor(key);
+                    return false;
+                }
+                nCount++;
+                if (stream)
+                    stream->Value(AddressUnspentToJSON(key, value));
+                else
+                    utxos.push_back(AddressUnspentToJSON(key, value));
+                return true;
+            });
+            if (!fRead)
+                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+        }
+
+        UniValue extra(UniValue::VOBJ);
+        if (!strNext.empty())
+            extra.push_back(Pair("cursor", strNext));
+        if (includeChainInfo) {
+            std::shared_ptr<const CChainTipSnapshot> tip = GetChainTipSnapshot();
+            extra.push_back(Pair("hash", tip->pindexTip->GetBlockHash().GetHex()));
+            extra.push_back(Pair("height", tip->nHeight));
+        }
+        return FinishAddressPage(stream, "utxos", utxos, extra);
+    }
+
     std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > unspentOutputs;
 
     for (std::vector<std::pair<uint160, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
@@ -1065,22 +1217,22 @@ UniValue getaddressutxos(const UniValue& params, bool fHelp, const CPubKey& mypk
 
     std::sort(unspentOutputs.begin(), unspentOutputs.end(), heightSort);
 
+    // The outputs are sorted by height, so they are collected first, but
+    // written one at a time when the transport allows it
+    JSONStreamWriter* stream = RPCTakeReplyStream("getaddressutxos");
+    if (stream && !includeChainInfo) {
+        stream->BeginArray();
+        for (std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator it=unspentOutputs.begin(); it!=unspentOutputs.end(); it++) {
+            stream->Value(AddressUnspentToJSON(it->first, it->second));
+        }
+        stream->EndArray();
+        return NullUniValue;
+    }
+
     UniValue utxos(UniValue::VARR);
 
     for (std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator it=unspentOutputs.begin(); it!=unspentOutputs.end(); it++) {
-        UniValue output(UniValue::VOBJ);
-        std::string address;
-        if (!getAddressFromIndex(it->first.type, it->first.hashBytes, address)) {
-            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Unknown address type");
-        }
-
-        output.push_back(Pair("address", address));
-        output.push_back(Pair("txid", it->first.txhash.GetHex()));
-        output.push_back(Pair("outputIndex", (int)it->first.index));
-        output.push_back(Pair("script", HexStr(it->second.script.begin(), it->second.script.end())));
-        output.push_back(Pair("satoshis", it->second.satoshis));
-        output.push_back(Pair("height", it->second.blockHeight));
-        utxos.push_back(output);
+        utxos.push_back(AddressUnspentToJSON(it->first, it->second));
     }
 
     if (includeChainInfo) {
@@ -1096,6 +1248,23 @@ UniValue getaddressutxos(const UniValue& params, bool fHelp, const CPubKey& mypk
     }
 }
 
+UniValue AddressDeltaToJSON(const CAddressIndexKey& key, CAmount amount)
+{
+    std::string address;
+    if (!getAddressFromIndex(key.type, key.hashBytes, address)) {
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Unknown address type");
+    }
+
+    UniValue delta(UniValue::VOBJ);
+    delta.push_back(Pair("satoshis", amount));
+    delta.push_back(Pair("txid", key.txhash.GetHex()));
+    delta.push_back(Pair("index", (int)key.index));
+    delta.push_back(Pair("blockindex", (int)key.txindex));
+    delta.push_back(Pair("height", key.blockHeight));
+    delta.push_back(Pair("address", address));
+    return delta;
+}
+
 UniValue getaddressdeltas(const UniValue& params, bool fHelp, const CPubKey& mypk)
 {
     if (fHelp || params.size() > 2 || params.size() == 0 || !params[0].isObject())
@@ -1112,6 +1281,8 @@ UniValue getaddressdeltas(const UniValue& params, bool fHelp, const CPubKey& myp
             "  \"start\" (number) The start block height\n"
             "  \"end\" (number) The end block height\n"
             "  \"chainInfo\" (boolean) Include chain info in results, only applies if start and end specified\n"
+            "  \"limit\" (number, optional) Return at most this many deltas\n"
+            "  \"cursor\" (string, optional) Continue after the previous page, as returned with it\n"
             "}\n"
             "\nCCvout (optional) Return CCvouts instead of normal vouts\n"
             "\nResult:\n"
@@ -1124,6 +1295,12 @@ UniValue getaddressdeltas(const UniValue& params, bool fHelp, const CPubKey& myp
             "    \"address\"  (string) The base58check encoded address\n"
             "  }\n"
             "]\n"
+            "\nResult (with limit or cursor, or with chainInfo):\n"
+            "{\n"
+            "  \"deltas\"  (array) The deltas as above\n"
+            "  \"cursor\"  (string) Pass it to get the next page, missing on the last page\n"
+            "  \"start\", \"end\"  (object) The hash and height of the range, with chainInfo\n"
+            "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getaddressdeltas", "'{\"addresses\": [\"RY5LccmGiX9bUHYGtSWQouNy1yFhc5rM87\"]}' (ccvout)")
             + HelpExampleRpc("getaddressdeltas", "{\"addresses\": [\"RY5LccmGiX9bUHYGtSWQouNy1yFhc5rM87\"]} (ccvout)")
@@ -1159,67 +1336,86 @@ UniValue getaddressdeltas(const UniValue& params, bool fHelp, const CPubKey& myp
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
     }
 
-    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
-
-    for (std::vector<std::pair<uint160, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
-        if (start > 0 && end > 0) {
-            if (!GetAddressIndex((*it).first, (*it).second, addressIndex, start, end)) {
-                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
-            }
-        } else {
-            if (!GetAddressIndex((*it).first, (*it).second, addressIndex)) {
-                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
-            }
-        }
-    }
-
-    UniValue deltas(UniValue::VARR);
-
-    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=addressIndex.begin(); it!=addressIndex.end(); it++) {
-        std::string address;
-        if (!getAddressFromIndex(it->first.type, it->first.hashBytes, address)) {
-            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Unknown address type");
-        }
-
-        UniValue delta(UniValue::VOBJ);
-        delta.push_back(Pair("satoshis", it->second));
-        delta.push_back(Pair("txid", it->first.txhash.GetHex()));
-        delta.push_back(Pair("index", (int)it->first.index));
-        delta.push_back(Pair("blockindex", (int)it->first.txindex));
-        delta.push_back(Pair("height", it->first.blockHeight));
-        delta.push_back(Pair("address", address));
-        deltas.push_back(delta);
-    }
+    size_t nLimit;
+    std::string strCursor;
+    bool fPaged = ParseAddressPaging(params, nLimit, strCursor);
+    bool fRange = start > 0 && end > 0;
+    CAddressIndexKey startKey;
+    size_t nFirst = strCursor.empty() ? 0 : DecodeAddressCursor(strCursor, addresses, startKey);
+    if (!strCursor.empty() && fRange && (startKey.blockHeight < start || startKey.blockHeight > end))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Cursor is outside of the start and end range");
 
-    UniValue result(UniValue::VOBJ);
+    bool withChainInfo = includeChainInfo && fRange;
+    UniValue extra(UniValue::VOBJ);
 
-    if (includeChainInfo && start > 0 && end > 0) {
-        LOCK(cs_main);
+    if (withChainInfo) {
+        std::shared_ptr<const CChainTipSnapshot> tip = GetChainTipSnapshot();
 
-        if (start > chainActive.Height() || end > chainActive.Height()) {
+        if (start > tip->nHeight || end > tip->nHeight) {
             throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Start or end is outside chain range");
         }
 
-        CBlockIndex* startIndex = chainActive[start];
-        CBlockIndex* endIndex = chainActive[end];
-
         UniValue startInfo(UniValue::VOBJ);
         UniValue endInfo(UniValue::VOBJ);
 
-        startInfo.push_back(Pair("hash", startIndex->GetBlockHash().GetHex()));
+        startInfo.push_back(Pair("hash", (*tip)[start]->GetBlockHash().GetHex()));
         startInfo.push_back(Pair("height", start));
 
-        endInfo.push_back(Pair("hash", endIndex->GetBlockHash().GetHex()));
+        endInfo.push_back(Pair("hash", (*tip)[end]->GetBlockHash().GetHex()));
         endInfo.push_back(Pair("height", end));
 
-        result.push_back(Pair("deltas", deltas));
-        result.push_back(Pair("start", startInfo));
-        result.push_back(Pair("end", endInfo));
+        extra.push_back(Pair("start", startInfo));
+        extra.push_back(Pair("end", endInfo));
+    }
 
-        return result;
-    } else {
+    // Deltas go from the index iterator to the reply, one at a time when the
+    // transport allows it
+    bool fObject = fPaged || withChainInfo;
+    JSONStreamWriter* stream = RPCTakeReplyStream("getaddressdeltas");
+    if (stream) {
+        if (fObject) {
+            stream->BeginObject();
+            stream->Key("deltas");
+        }
+        stream->BeginArray();
+    }
+
+    UniValue deltas(UniValue::VARR);
+    size_t nCount = 0;
+    std::string strNext;
+    for (size_t i = nFirst; i < addresses.size() && strNext.empty(); i++) {
+        if (i != nFirst || strCursor.empty())
+            startKey = CAddressIndexKey(addresses[i].second, addresses[i].first, fRange ? start : 0, 0, uint256(), 0, false);
+        bool fRead = GetAddressIndex(startKey, fRange ? end : 0, [&](const CAddressIndexKey& key, CAmount amount) {
+            if (nLimit > 0 && nCount == nLimit) {
+                strNext = EncodeAddressCursor(key);
+                return false;
+            }
+            nCount++;
+            if (stream)
+                stream->Value(AddressDeltaToJSON(key, amount));
+            else
+                deltas.push_back(AddressDeltaToJSON(key, amount));
+            return true;
+        });
+        if (!fRead)
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+    }
+
+    if (!fObject) {
+        if (stream) {
+            stream->EndArray();
+            return NullUniValue;
+        }
         return deltas;
     }
+
+    // The cursor goes before the range information
+    UniValue tail(UniValue::VOBJ);
+    if (!strNext.empty())
+        tail.push_back(Pair("cursor", strNext));
+    tail.pushKVs(extra);
+    return FinishAddressPage(stream, "deltas", deltas, tail);
 }
 
 CAmount checkburnaddress(CAmount &received, int64_t &nNotaryPay, int32_t &height, std::string sAddress)
@@ -1499,6 +1695,24 @@ UniValue getaddresstxids(const UniValue& params, bool fHelp, const CPubKey& mypk
     std::set<std::pair<int, std::string> > txids;
     UniValue result(UniValue::VARR);
 
+    // Written one txid at a time when the transport allows it
+    JSONStreamWriter* stream = RPCTakeReplyStream("getaddresstxids");
+    if (stream) {
+        stream->BeginArray();
+        for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=addressIndex.begin(); it!=addressIndex.end(); it++) {
+            std::pair<int, std::string> txid(it->first.blockHeight, it->first.txhash.GetHex());
+            if (txids.insert(txid).second && addresses.size() == 1)
+                stream->Value(txid.second);
+        }
+        if (addresses.size() > 1) {
+            for (std::set<std::pair<int, std::string> >::const_iterator it=txids.begin(); it!=txids.end(); it++) {
+                stream->Value(it->second);
+            }
+        }
+        stream->EndArray();
+        return NullUniValue;
+    }
+
     for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=addressIndex.begin(); it!=addressIndex.end(); it++) {
         int height = it->first.blockHeight;
         std::string txid = it->first.txhash.GetHex();
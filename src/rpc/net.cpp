@@ -21,6 +21,7 @@
 
 #include "clientversion.h"
 #include "main.h"
+#include "metrics.h"
 #include "net.h"
 #include "netbase.h"
 #include "protocol.h"
@@ -76,6 +77,21 @@ UniValue ping(const UniValue& params, bool fHelp, const CPubKey& mypk)
     return NullUniValue;
 }
 
+static UniValue MsgStatsToJSON(const mapMsgStats_t& mapMsgStats)
+{
+    UniValue ret(UniValue::VOBJ);
+    for (mapMsgStats_t::const_iterator it = mapMsgStats.begin(); it != mapMsgStats.end(); ++it) {
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("msgsrecv", it->second.nMsgsRecv));
+        obj.push_back(Pair("bytesrecv", it->second.nBytesRecv));
+        obj.push_back(Pair("msgssent", it->second.nMsgsSent));
+        obj.push_back(Pair("bytessent", it->second.nBytesSent));
+        obj.push_back(Pair("handlertime", ((double)it->second.nHandlerUsec) / 1e6));
+        ret.push_back(Pair(it->first, obj));
+    }
+    return ret;
+}
+
 UniValue getpeerinfo(const UniValue& params, bool fHelp, const CPubKey& mypk)
 {
     if (fHelp || params.size() != 0)
@@ -107,7 +123,14 @@ UniValue getpeerinfo(const UniValue& params, bool fHelp, const CPubKey& mypk)
             "    \"inflight\": [\n"
             "       n,                        (numeric) The heights of blocks we're currently asking from this peer\n"
             "       ...\n"
-            "    ]\n"
+            "    ],\n"
+            "    \"downloadrate\": n,         (numeric) Smoothed rate of the blocks requested from this peer, in bytes per second\n"
+            "    \"blocksdownloaded\": n,     (numeric) The number of requested blocks received from this peer\n"
+            "    \"inflightlimit\": n,        (numeric) The number of blocks that may be in flight from this peer at once\n"
+            "    \"whitelisted\": true|false, (boolean) Whether the peer is whitelisted\n"
+            "    \"msgstats\": {              (json object) Traffic with this peer by message type, as in getnetmsgstats\n"
+            "       ...\n"
+            "    }\n"
             "  }\n"
             "  ,...\n"
             "]\n"
@@ -162,8 +185,12 @@ UniValue getpeerinfo(const UniValue& params, bool fHelp, const CPubKey& mypk)
                 heights.push_back(height);
             }
             obj.push_back(Pair("inflight", heights));
+            obj.push_back(Pair("downloadrate", statestats.dDownloadRate));
+            obj.push_back(Pair("blocksdownloaded", statestats.nBlocksDownloaded));
+            obj.push_back(Pair("inflightlimit", statestats.nBlocksInFlightLimit));
         }
         obj.push_back(Pair("whitelisted", stats.fWhitelisted));
+        obj.push_back(Pair("msgstats", MsgStatsToJSON(stats.mapMsgStats)));
 
         ret.push_back(obj);
     }
@@ -447,6 +474,80 @@ UniValue getnettotals(const UniValue& params, bool fHelp, const CPubKey& mypk)
     return obj;
 }
 
+UniValue getnetmsgstats(const UniValue& params, bool fHelp, const CPubKey& mypk)
+{
+    if (fHelp || params.size() > 0)
+        throw runtime_error(
+            "getnetmsgstats\n"
+            "\nReturns the network traffic and message handler time by message type, over all peers since startup.\n"
+            "nSPV messages are split by request type, as in \"getnSPV:utxos\". Unknown commands are counted as \"other\".\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"command\": {             (json object) The message type\n"
+            "    \"msgsrecv\": n,          (numeric) Number of messages received\n"
+            "    \"bytesrecv\": n,         (numeric) Bytes received, including message headers\n"
+            "    \"msgssent\": n,          (numeric) Number of messages sent\n"
+            "    \"bytessent\": n,         (numeric) Bytes sent, including message headers\n"
+            "    \"handlertime\": n        (numeric) Seconds spent processing the received messages\n"
+            "  },\n"
+            "  ...\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getnetmsgstats", "")
+            + HelpExampleRpc("getnetmsgstats", "")
+       );
+
+    mapMsgStats_t mapMsgStats;
+    CNode::GetTotalMsgStats(mapMsgStats);
+    return MsgStatsToJSON(mapMsgStats);
+}
+
+UniValue getnodestatshistory(const UniValue& params, bool fHelp, const CPubKey& mypk)
+{
+    if (fHelp || params.size() > 1)
+        throw runtime_error(
+            "getnodestatshistory ( seconds )\n"
+            "\nReturns what the node did in each of the last seconds: traffic, blocks connected, transactions\n"
+            "validated and the size of the mempool. It is read without taking the locks of the peers or the chain.\n"
+            "\nArguments:\n"
+            "1. seconds    (numeric, optional, default=60) Number of seconds, at most " + std::to_string(NODE_STATS_HISTORY) + "\n"
+            "\nResult:\n"
+            "[                          (json array) The seconds, the oldest first\n"
+            "  {\n"
+            "    \"time\": t,             (numeric) End of the second, in seconds since epoch\n"
+            "    \"bytesrecv\": n,        (numeric) Bytes received\n"
+            "    \"bytessent\": n,        (numeric) Bytes sent\n"
+            "    \"blocks\": n,           (numeric) Blocks connected to the tip\n"
+            "    \"txsvalidated\": n,     (numeric) Transactions validated\n"
+            "    \"height\": n,           (numeric) Height of the tip\n"
+            "    \"mempooltxs\": n        (numeric) Transactions in the mempool\n"
+            "  },\n"
+            "  ...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getnodestatshistory", "300")
+            + HelpExampleRpc("getnodestatshistory", "300")
+       );
+
+    int nSeconds = params.size() > 0 ? params[0].get_int() : 60;
+    if (nSeconds < 0 || nSeconds > NODE_STATS_HISTORY)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("seconds must be between 0 and %d", NODE_STATS_HISTORY));
+
+    UniValue ret(UniValue::VARR);
+    for (const NodeStatsSample& sample : GetNodeStatsHistory(nSeconds)) {
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("time", sample.nTime));
+        obj.push_back(Pair("bytesrecv", sample.nBytesRecv));
+        obj.push_back(Pair("bytessent", sample.nBytesSent));
+        obj.push_back(Pair("blocks", sample.nBlocksConnected));
+        obj.push_back(Pair("txsvalidated", sample.nTxsValidated));
+        obj.push_back(Pair("height", sample.nTipHeight));
+        obj.push_back(Pair("mempooltxs", sample.nMempoolTxs));
+        ret.push_back(obj);
+    }
+    return ret;
+}
+
 static UniValue GetNetworksInfo()
 {
     UniValue networks(UniValue::VARR);
@@ -682,6 +783,8 @@ static const CRPCCommand commands[] =
     { "network",            "disconnectnode",         &disconnectnode,         true  },
     { "network",            "getaddednodeinfo",       &getaddednodeinfo,       true  },
     { "network",            "getnettotals",           &getnettotals,           true  },
+    { "network",            "getnetmsgstats",         &getnetmsgstats,         true  },
+    { "network",            "getnodestatshistory",    &getnodestatshistory,    true  },
     { "network",            "getnetworkinfo",         &getnetworkinfo,         true  },
     { "network",            "setban",                 &setban,                 true  },
     { "network",            "listbanned",             &listbanned,             true  },
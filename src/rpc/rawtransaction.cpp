@@ -29,6 +29,8 @@
 #include "merkleblock.h"
 #include "net.h"
 #include "primitives/transaction.h"
+#include "rpc/cache.h"
+#include "rpc/jsonstream.h"
 #include "rpc/server.h"
 #include "transaction_builder.h"
 #include "script/script.h"
@@ -56,6 +58,7 @@ int32_t komodo_notarized_height(int32_t *prevMoMheightp,uint256 *hashp,uint256 *
 using namespace std;
 
 extern char ASSETCHAINS_SYMBOL[];
+extern bool fSpentIndex;
 int32_t komodo_dpowconfs(int32_t height,int32_t numconfs);
 
 void ScriptPubKeyToJSON(const CScript& scriptPubKey, UniValue& out, bool fIncludeHex)
@@ -531,8 +534,15 @@ UniValue getrawtransaction(const UniValue& params, bool fHelp, const CPubKey& my
     if (params.size() > 1)
         fVerbose = (params[1].get_int() != 0);
 
+    // With -spentindex the outputs report where they are spent, which changes
+    bool fCache = fVerbose && !fSpentIndex;
+    UniValue cached;
+    if (fCache && rpcResponseCache.Lookup("getrawtransaction", params, cached))
+        return cached;
+
     CTransaction tx;
     uint256 hashBlock;
+    const CBlockIndex* pblockindex = NULL;
     int nHeight = 0;
     int nConfirmations = 0;
     int nBlockTime = 0;
@@ -546,6 +556,7 @@ UniValue getrawtransaction(const UniValue& params, bool fHelp, const CPubKey& my
         if (mi != mapBlockIndex.end() && (*mi).second) {
             CBlockIndex* pindex = (*mi).second;
             if (chainActive.Contains(pindex)) {
+                pblockindex = pindex;
                 nHeight = pindex->GetHeight();
                 nConfirmations = 1 + chainActive.Height() - pindex->GetHeight();
                 nBlockTime = pindex->GetBlockTime();
@@ -557,14 +568,25 @@ UniValue getrawtransaction(const UniValue& params, bool fHelp, const CPubKey& my
         }
     }
 
-    string strHex = EncodeHexTx(tx);
-
-    if (!fVerbose)
-        return strHex;
+    if (!fVerbose) {
+        // Binary replies carry the transaction as bytes instead of hex
+        JSONStreamWriter* stream = RPCTakeReplyStream("getrawtransaction");
+        if (stream) {
+            CDataStream ssTx(SER_NETWORK, PROTOCOL_VERSION);
+            ssTx << tx;
+            const unsigned char* pTx = (const unsigned char*)&ssTx.begin()[0];
+            stream->Bytes(pTx, pTx + ssTx.size());
+            return NullUniValue;
+        }
+        return EncodeHexTx(tx);
+    }
 
+    string strHex = EncodeHexTx(tx);
     UniValue result(UniValue::VOBJ);
     result.push_back(Pair("hex", strHex));
     TxToJSONExpanded(tx, hashBlock, result, false, nHeight, nConfirmations, nBlockTime);
+    if (fCache)
+        rpcResponseCache.Store("getrawtransaction", params, result, pblockindex);
     return result;
 }
 
@@ -654,6 +676,10 @@ UniValue gettxoutproof(const UniValue& params, bool fHelp, const CPubKey& mypk)
        oneTxid = hash;
     }
 
+    UniValue cached;
+    if (rpcResponseCache.Lookup("gettxoutproof", params, cached))
+        return cached;
+
     LOCK(cs_main);
 
     CBlockIndex* pblockindex = NULL;
@@ -696,6 +722,7 @@ UniValue gettxoutproof(const UniValue& params, bool fHelp, const CPubKey& mypk)
     CMerkleBlock mb(block, setTxids);
     ssMB << mb;
     std::string strHex = HexStr(ssMB.begin(), ssMB.end());
+    rpcResponseCache.Store("gettxoutproof", params, strHex, pblockindex);
     return strHex;
 }
 
@@ -1364,7 +1391,18 @@ UniValue signrawtransaction(const UniValue& params, bool fHelp, const CPubKey& m
     {
         if ( txpow != 0 )
             mergedTx = mergedTxsave;
-        // Sign what we can:
+        // Sign what we can, all inputs together since the signature hashes
+        // don't cover the scriptSigs the loop below fills in:
+        std::vector<std::pair<CScript, CAmount>> vCoins(mergedTx.vin.size());
+        for (unsigned int i = 0; i < mergedTx.vin.size(); i++) {
+            const CCoins* coins = view.AccessCoins(mergedTx.vin[i].prevout.hash);
+            // Only sign SIGHASH_SINGLE if there's a corresponding output:
+            if (coins != NULL && coins->IsAvailable(mergedTx.vin[i].prevout.n) && (!fHashSingle || (i < mergedTx.vout.size())))
+                vCoins[i] = std::make_pair(coins->vout[mergedTx.vin[i].prevout.n].scriptPubKey, coins->vout[mergedTx.vin[i].prevout.n].nValue);
+        }
+        std::vector<SignatureData> vSigData;
+        ProduceSignatures(&keystore, CTransaction(mergedTx), vCoins, nHashType, consensusBranchId, vSigData, GetNumCores());
+
         for (unsigned int i = 0; i < mergedTx.vin.size(); i++) {
             CTxIn& txin = mergedTx.vin[i];
             const CCoins* coins = view.AccessCoins(txin.prevout.hash);
@@ -1375,10 +1413,7 @@ UniValue signrawtransaction(const UniValue& params, bool fHelp, const CPubKey& m
             const CScript& prevPubKey = coins->vout[txin.prevout.n].scriptPubKey;
             const CAmount& amount = coins->vout[txin.prevout.n].nValue;
 
-            SignatureData sigdata;
-            // Only sign SIGHASH_SINGLE if there's a corresponding output:
-            if (!fHashSingle || (i < mergedTx.vout.size()))
-                ProduceSignature(MutableTransactionSignatureCreator(&keystore, &mergedTx, i, amount, nHashType), prevPubKey, sigdata, consensusBranchId);
+            SignatureData sigdata = vSigData[i];
 
             // ... and merge in other signatures:
             BOOST_FOREACH(const CMutableTransaction& txv, txVariants) {
@@ -1523,6 +1558,7 @@ UniValue z_buildrawtransaction(const UniValue& params, bool fHelp, const CPubKey
   }
 
   libzcash::SaplingExtendedSpendingKey primaryKey;
+  pwalletMain->ApplyPendingWitnessRewind();
 
   for (int i = 0; i < tb.rawSpends.size(); i++) {
       SaplingOutPoint op = tb.rawSpends[i].op;
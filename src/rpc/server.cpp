@@ -24,12 +24,16 @@
 #include "init.h"
 #include "key_io.h"
 #include "random.h"
+#include "rpc/cache.h"
+#include "rpc/stats.h"
+#include "scheduler.h"
 #include "sync.h"
 #include "ui_interface.h"
 #include "util.h"
 #include "utilstrencodings.h"
 #include "asyncrpcqueue.h"
 
+#include <algorithm>
 #include <memory>
 
 #include <univalue.h>
@@ -287,6 +291,230 @@ UniValue stop(const UniValue& params, bool fHelp, const CPubKey& mypk)
     return buf;
 }
 
+UniValue getrpcstats(const UniValue& params, bool fHelp, const CPubKey& mypk)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getrpcstats\n"
+            "\nReturns statistics of the RPC calls since startup, and the calls executing now.\n"
+            "Percentiles are estimated from a histogram with power of two buckets.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"methods\": {\n"
+            "    \"method\": {\n"
+            "      \"calls\": n,               (numeric) Number of calls\n"
+            "      \"errors\": n,              (numeric) Number of calls that returned an error\n"
+            "      \"total_ms\": n,            (numeric) Total execution time in milliseconds\n"
+            "      \"max_ms\": n,              (numeric) Longest call\n"
+            "      \"p50_ms\": n,              (numeric) Median latency\n"
+            "      \"p95_ms\": n,              (numeric) 95th percentile latency\n"
+            "      \"p99_ms\": n,              (numeric) 99th percentile latency\n"
+            "      \"cs_main_wait_ms\": n,     (numeric) Total time spent waiting for the chain lock\n"
+            "      \"cs_wallet_wait_ms\": n    (numeric) Total time spent waiting for the wallet lock\n"
+            "    }, ...\n"
+            "  },\n"
+            "  \"inflight\": [               (array) The calls executing now, longest running first\n"
+            "    {\n"
+            "      \"method\": \"name\",       (string) The RPC method\n"
+            "      \"elapsed_ms\": n           (numeric) Time since the call started\n"
+            "    }, ...\n"
+            "  ],\n"
+            "  \"responsecache\": {         (object, only with -rpccachesize) The cache of replies about notarized blocks\n"
+            "    \"hits\": n,                 (numeric) Replies answered from the cache\n"
+            "    \"misses\": n,               (numeric) Lookups that were not in the cache\n"
+            "    \"entries\": n,              (numeric) Replies in the cache\n"
+            "    \"bytes\": n                 (numeric) Memory used by the cache\n"
+            "  }\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getrpcstats", "")
+            + HelpExampleRpc("getrpcstats", "")
+        );
+
+    UniValue result = rpcStats.ToJSON(GetTimeMicros());
+    if (rpcResponseCache.IsEnabled()) {
+        uint64_t nHits, nMisses; size_t nEntries, nBytes;
+        rpcResponseCache.GetStats(nHits, nMisses, nEntries, nBytes);
+        UniValue cache(UniValue::VOBJ);
+        cache.push_back(Pair("hits", nHits));
+        cache.push_back(Pair("misses", nMisses));
+        cache.push_back(Pair("entries", (uint64_t)nEntries));
+        cache.push_back(Pair("bytes", (uint64_t)nBytes));
+        result.push_back(Pair("responsecache", cache));
+    }
+    return result;
+}
+
+//! Lock name without the object it is reached through, so "pwalletMain->cs_wallet" is "cs_wallet"
+static std::string LockBaseName(const std::string& strName)
+{
+    size_t nPos = strName.find_last_of(">.");
+    return nPos == std::string::npos ? strName : strName.substr(nPos + 1);
+}
+
+UniValue getlockstats(const UniValue& params, bool fHelp, const CPubKey& mypk)
+{
+    if (fHelp || params.size() > 1)
+        throw runtime_error(
+            "getlockstats ( count )\n"
+            "\nReturns the contention of the locks taken since the lock profile was enabled or reset,\n"
+            "by lock and by the call sites that waited the longest. See setlockprofile.\n"
+            "\nArguments:\n"
+            "1. count    (numeric, optional, default=20) Number of call sites to return\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"enabled\": true|false,     (boolean) Whether the lock profile is collected\n"
+            "  \"locks\": {                 (object) Totals by lock name\n"
+            "    \"name\": {\n"
+            "      \"acquisitions\": n,     (numeric) Times the lock was taken\n"
+            "      \"contentions\": n,      (numeric) Times it had to wait for another thread\n"
+            "      \"wait_ms\": x.xx,       (numeric) Total time spent waiting\n"
+            "      \"hold_ms\": x.xx        (numeric) Total time it was held\n"
+            "    }, ...\n"
+            "  },\n"
+            "  \"sites\": [                 (array) Call sites, the longest total wait first\n"
+            "    {\n"
+            "      \"lock\": \"name\",        (string) The lock as written at the call site\n"
+            "      \"site\": \"file:line\",   (string) The LOCK, LOCK2 or TRY_LOCK\n"
+            "      \"acquisitions\": n,     (numeric) Times the lock was taken there\n"
+            "      \"contentions\": n,      (numeric) Times it had to wait\n"
+            "      \"wait_ms\": x.xx,       (numeric) Total time spent waiting\n"
+            "      \"max_wait_ms\": x.xx,   (numeric) Longest wait\n"
+            "      \"hold_ms\": x.xx,       (numeric) Total time it was held\n"
+            "      \"max_hold_ms\": x.xx    (numeric) Longest hold\n"
+            "    }, ...\n"
+            "  ]\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getlockstats", "")
+            + HelpExampleCli("getlockstats", "50")
+            + HelpExampleRpc("getlockstats", "50")
+        );
+
+    int nCount = 20;
+    if (params.size() > 0) {
+        nCount = params[0].get_int();
+        if (nCount < 0)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid count, must be non-negative");
+    }
+
+    std::vector<const CLockSite*> vSites;
+    for (const CLockSite* psite : GetLockSites())
+        if (psite->nAcquisitions > 0)
+            vSites.push_back(psite);
+    std::sort(vSites.begin(), vSites.end(), [](const CLockSite* a, const CLockSite* b) {
+        return a->nWaitMicros > b->nWaitMicros;
+    });
+
+    struct LockTotals
+    {
+        uint64_t nAcquisitions = 0;
+        uint64_t nContentions = 0;
+        int64_t nWaitMicros = 0;
+        int64_t nHoldMicros = 0;
+    };
+    std::map<std::string, LockTotals> mapLocks;
+    for (const CLockSite* psite : vSites) {
+        LockTotals& totals = mapLocks[LockBaseName(psite->pszName)];
+        totals.nAcquisitions += psite->nAcquisitions;
+        totals.nContentions += psite->nContentions;
+        totals.nWaitMicros += psite->nWaitMicros;
+        totals.nHoldMicros += psite->nHoldMicros;
+    }
+    UniValue locks(UniValue::VOBJ);
+    for (const std::pair<const std::string, LockTotals>& item : mapLocks) {
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("acquisitions", item.second.nAcquisitions));
+        obj.push_back(Pair("contentions", item.second.nContentions));
+        obj.push_back(Pair("wait_ms", item.second.nWaitMicros * 0.001));
+        obj.push_back(Pair("hold_ms", item.second.nHoldMicros * 0.001));
+        locks.push_back(Pair(item.first, obj));
+    }
+
+    UniValue sites(UniValue::VARR);
+    for (size_t i = 0; i < vSites.size() && (int)i < nCount; i++) {
+        const CLockSite* psite = vSites[i];
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("lock", psite->pszName));
+        obj.push_back(Pair("site", strprintf("%s:%d", psite->pszFile, psite->nLine)));
+        obj.push_back(Pair("acquisitions", (uint64_t)psite->nAcquisitions));
+        obj.push_back(Pair("contentions", (uint64_t)psite->nContentions));
+        obj.push_back(Pair("wait_ms", psite->nWaitMicros * 0.001));
+        obj.push_back(Pair("max_wait_ms", psite->nMaxWaitMicros * 0.001));
+        obj.push_back(Pair("hold_ms", psite->nHoldMicros * 0.001));
+        obj.push_back(Pair("max_hold_ms", psite->nMaxHoldMicros * 0.001));
+        sites.push_back(obj);
+    }
+
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair("enabled", (bool)fLockProfile));
+    result.push_back(Pair("locks", locks));
+    result.push_back(Pair("sites", sites));
+    return result;
+}
+
+UniValue setlockprofile(const UniValue& params, bool fHelp, const CPubKey& mypk)
+{
+    if (fHelp || params.size() < 1 || params.size() > 2)
+        throw runtime_error(
+            "setlockprofile enable ( reset )\n"
+            "\nStarts or stops collecting the lock profile that getlockstats returns.\n"
+            "\nArguments:\n"
+            "1. enable   (boolean, required) Whether to collect the profile\n"
+            "2. reset    (boolean, optional, default=false) Clear what was collected so far\n"
+            "\nExamples:\n"
+            + HelpExampleCli("setlockprofile", "true true")
+            + HelpExampleRpc("setlockprofile", "false")
+        );
+
+    if (params.size() > 1 && params[1].get_bool())
+        ResetLockSites();
+    fLockProfile = params[0].get_bool();
+    return NullUniValue;
+}
+
+UniValue getschedulerinfo(const UniValue& params, bool fHelp, const CPubKey& mypk)
+{
+    if (fHelp || params.size() > 0)
+        throw runtime_error(
+            "getschedulerinfo\n"
+            "\nReturns the queues of the periodic jobs, what they have waiting and how long their jobs took.\n"
+            "The jobs of a queue run one at a time, the -schedulerthreads threads are shared by all queues.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"name\": {                  (object) A queue\n"
+            "    \"pending\": n,            (numeric) Jobs scheduled\n"
+            "    \"due\": n,                (numeric) Jobs past their time, waiting for a thread or for the queue\n"
+            "    \"running\": true|false,   (boolean) Whether a job of the queue is running\n"
+            "    \"runs\": n,               (numeric) Jobs run\n"
+            "    \"run_ms\": x.xx,          (numeric) Total time the jobs took\n"
+            "    \"max_run_ms\": x.xx,      (numeric) Longest job\n"
+            "    \"max_delay_ms\": x.xx     (numeric) Longest a job started after its time\n"
+            "  }, ...\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getschedulerinfo", "")
+            + HelpExampleRpc("getschedulerinfo", "")
+        );
+
+    UniValue result(UniValue::VOBJ);
+    if (pschedulerMain == NULL)
+        return result;
+    for (const std::pair<const std::string, CScheduler::QueueStats>& entry : pschedulerMain->getQueueStats()) {
+        const CScheduler::QueueStats& stats = entry.second;
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("pending", (uint64_t)stats.nPending));
+        obj.push_back(Pair("due", (uint64_t)stats.nDue));
+        obj.push_back(Pair("running", stats.fRunning));
+        obj.push_back(Pair("runs", stats.nRuns));
+        obj.push_back(Pair("run_ms", stats.nRunMicros / 1000.0));
+        obj.push_back(Pair("max_run_ms", stats.nMaxRunMicros / 1000.0));
+        obj.push_back(Pair("max_delay_ms", stats.nMaxDelayMicros / 1000.0));
+        result.push_back(Pair(entry.first, obj));
+    }
+    return result;
+}
+
 /**
  * Call Table
  */
@@ -299,6 +527,10 @@ static const CRPCCommand vRPCCommands[] =
     { "control",            "getnotarysendmany",      &getnotarysendmany,      true  },
     { "control",            "geterablockheights",     &geterablockheights,     true  },
     { "control",            "stop",                   &stop,                   true  },
+    { "control",            "getrpcstats",            &getrpcstats,            true  },
+    { "control",            "getlockstats",           &getlockstats,           true  },
+    { "control",            "setlockprofile",         &setlockprofile,         true  },
+    { "control",            "getschedulerinfo",       &getschedulerinfo,       true  },
 
     /* P2P networking */
     { "network",            "getnetworkinfo",         &getnetworkinfo,         true  },
@@ -308,6 +540,8 @@ static const CRPCCommand vRPCCommands[] =
     { "network",            "getaddednodeinfo",       &getaddednodeinfo,       true  },
     { "network",            "getconnectioncount",     &getconnectioncount,     true  },
     { "network",            "getnettotals",           &getnettotals,           true  },
+    { "network",            "getnetmsgstats",         &getnetmsgstats,         true  },
+    { "network",            "getnodestatshistory",    &getnodestatshistory,    true  },
     { "network",            "getpeerinfo",            &getpeerinfo,            true  },
     { "network",            "ping",                   &ping,                   true  },
     { "network",            "setban",                 &setban,                 true  },
@@ -333,6 +567,8 @@ static const CRPCCommand vRPCCommands[] =
     { "blockchain",         "gettxoutproof",          &gettxoutproof,          true  },
     { "blockchain",         "verifytxoutproof",       &verifytxoutproof,       true  },
     { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true  },
+    { "blockchain",         "dumptxoutset",           &dumptxoutset,           true  },
+    { "blockchain",         "loadtxoutset",           &loadtxoutset,           true  },
     { "blockchain",         "verifychain",            &verifychain,            true  },
     { "blockchain",         "getspentinfo",           &getspentinfo,           false },
     //{ "blockchain",         "paxprice",               &paxprice,               true  },
@@ -359,6 +595,7 @@ static const CRPCCommand vRPCCommands[] =
     { "crosschain",         "migrate_createburntransaction", &migrate_createburntransaction, true },
     { "crosschain",         "migrate_createimporttransaction", &migrate_createimporttransaction, true  },
     { "crosschain",         "migrate_completeimporttransaction", &migrate_completeimporttransaction, true  },
+    { "crosschain",         "migrate_completeimporttransactions", &migrate_completeimporttransactions, true  },
     { "crosschain",         "migrate_checkburntransactionsource", &migrate_checkburntransactionsource, true },
     { "crosschain",         "migrate_createnotaryapprovaltransaction", &migrate_createnotaryapprovaltransaction, true },
     { "crosschain",         "selfimport", &selfimport, true  },
@@ -676,6 +913,7 @@ static const CRPCCommand vRPCCommands[] =
     { "wallet",             "z_getoperationresult",   &z_getoperationresult,   true  },
     { "wallet",             "z_listoperationids",     &z_listoperationids,     true  },
     { "wallet",             "z_getnewaddress",        &z_getnewaddress,        true  },
+    { "wallet",             "z_getnewaddresses",      &z_getnewaddresses,      true  },
     { "wallet",             "z_listaddresses",        &z_listaddresses,        true  },
     { "wallet",             "z_exportkey",            &z_exportkey,            true  },
     { "wallet",             "z_importkey",            &z_importkey,            true  },
@@ -731,20 +969,16 @@ bool StartRPC()
     fRPCRunning = true;
     g_rpcSignals.Started();
 
-    // Launch one async rpc worker.  The ability to launch multiple workers is not recommended at present and thus the option is disabled.
-    getAsyncRPCQueue()->addWorker();
-/*
-    int n = GetArg("-rpcasyncthreads", 1);
-    if (n<1) {
-        LogPrintf("ERROR: Invalid value %d for -rpcasyncthreads.  Must be at least 1.\n", n);
-        strerr = strprintf(_("An error occurred while setting up the Async RPC threads, invalid parameter value of %d (must be at least 1)."), n);
-        uiInterface.ThreadSafeMessageBox(strerr, "", CClientUIInterface::MSG_ERROR);
-        StartShutdown();
-        return;
-    }
+    // Operations of one kind select their notes and coins on their own, so
+    // they are never run side by side. Background operations leave at least
+    // one worker for payments.
+    std::shared_ptr<AsyncRPCQueue> q = getAsyncRPCQueue();
+    int n = std::max(1, (int)GetArg("-rpcasyncthreads", DEFAULT_ASYNC_RPC_THREADS));
+    q->setDefaultTypeLimit(1);
+    q->setBackgroundLimit(std::max(1, (int)GetArg("-rpcasyncprovers", n - 1)));
     for (int i = 0; i < n; i++)
-        getAsyncRPCQueue()->addWorker();
-*/
+        q->addWorker();
+    LogPrint("rpc", "Started %d async RPC workers\n", n);
     return true;
 }
 
@@ -846,21 +1080,150 @@ static UniValue JSONRPCExecOne(const UniValue& req)
     return rpc_result;
 }
 
-std::string JSONRPCExecBatch(const UniValue& vReq)
+static thread_local RPCReplyStreamScope* pReplyStreamScope = NULL;
+
+RPCReplyStreamScope::RPCReplyStreamScope(const std::string& strMethod, JSONStreamWriter* stream) :
+    strMethod(strMethod), stream(stream), fTaken(false), pPrev(pReplyStreamScope)
+{
+    pReplyStreamScope = this;
+}
+
+RPCReplyStreamScope::~RPCReplyStreamScope()
 {
+    pReplyStreamScope = pPrev;
+}
+
+JSONStreamWriter* RPCTakeReplyStream(const std::string& strMethod)
+{
+    RPCReplyStreamScope* scope = pReplyStreamScope;
+    if (scope == NULL || scope->fTaken || scope->strMethod != strMethod)
+        return NULL;
+    scope->fTaken = true;
+    return scope->stream;
+}
+
+/**
+ * Commands that are not thread safe within a batch: they change node or wallet
+ * state, so the requests after them in the batch expect their effects.
+ */
+static const char* const vBatchSequentialCommands[] = {
+    "stop", "setgenerate", "generate", "submitblock", "invalidateblock", "reconsiderblock",
+    "sendrawtransaction", "addnode", "disconnectnode", "setban", "clearbanned", "setmocktime",
+    "backupwallet", "dumpwallet", "encryptwallet", "importprivkey", "importwallet", "importaddress",
+    "keypoolrefill", "lockunspent", "move", "sendfrom", "sendmany", "sendtoaddress", "setaccount",
+    "setpubkey", "setstakingsplit", "settxfee", "walletlock", "walletpassphrasechange",
+    "walletpassphrase", "cleanwallettransactions", "opreturn_burn", "z_mergetoaddress", "z_sendmany",
+    "z_shieldcoinbase", "z_importkey", "z_importviewingkey", "z_importwallet", "z_exportwallet",
+};
+
+static bool IsBatchSequential(const UniValue& req)
+{
+    if (!req.isObject())
+        return false;
+    const UniValue& valMethod = find_value(req.get_obj(), "method");
+    if (!valMethod.isStr())
+        return false;
+    for (const char* strCommand : vBatchSequentialCommands) {
+        if (valMethod.get_str() == strCommand)
+            return true;
+    }
+    return false;
+}
+
+/**
+ * A run of requests of a batch that may execute concurrently. Shared with the
+ * queued helper tasks, which may only start after the batch returned; they then
+ * find nothing left to claim and never touch the requests or the replies.
+ */
+struct CRPCBatchSegment
+{
+    boost::mutex cs;
+    boost::condition_variable cond;
+    const UniValue* pvReq;
+    std::vector<UniValue>* pvReplies;
+    size_t nNext;
+    size_t nEnd;
+    size_t nDone;
+};
+
+static void RunBatchSegment(boost::shared_ptr<CRPCBatchSegment> segment)
+{
+    while (true) {
+        size_t reqIdx;
+        {
+            boost::unique_lock<boost::mutex> lock(segment->cs);
+            if (segment->nNext >= segment->nEnd)
+                return;
+            reqIdx = segment->nNext++;
+        }
+        // Each request has its own reply slot, no lock needed
+        (*segment->pvReplies)[reqIdx] = JSONRPCExecOne((*segment->pvReq)[reqIdx]);
+        {
+            boost::unique_lock<boost::mutex> lock(segment->cs);
+            if (++segment->nDone == segment->nEnd)
+                segment->cond.notify_all();
+        }
+    }
+}
+
+std::string JSONRPCExecBatch(const UniValue& vReq, int nMaxHelpers, const RPCTaskEnqueuer& enqueue)
+{
+    return JSONRPCExecBatchReplies(vReq, nMaxHelpers, enqueue).write() + "\n";
+}
+
+UniValue JSONRPCExecBatchReplies(const UniValue& vReq, int nMaxHelpers, const RPCTaskEnqueuer& enqueue)
+{
+    std::vector<UniValue> vReplies(vReq.size());
+    size_t reqIdx = 0;
+    while (reqIdx < vReq.size()) {
+        if (nMaxHelpers <= 0 || enqueue.empty() || IsBatchSequential(vReq[reqIdx])) {
+            vReplies[reqIdx] = JSONRPCExecOne(vReq[reqIdx]);
+            reqIdx++;
+            continue;
+        }
+
+        size_t nEnd = reqIdx + 1;
+        while (nEnd < vReq.size() && !IsBatchSequential(vReq[nEnd]))
+            nEnd++;
+
+        boost::shared_ptr<CRPCBatchSegment> segment(new CRPCBatchSegment());
+        segment->pvReq = &vReq;
+        segment->pvReplies = &vReplies;
+        segment->nNext = reqIdx;
+        segment->nEnd = nEnd;
+        segment->nDone = reqIdx;
+
+        // The calling thread takes part as well, so the batch finishes even if no helper ever runs
+        size_t nHelpers = std::min((size_t)nMaxHelpers, nEnd - reqIdx - 1);
+        for (size_t i = 0; i < nHelpers; i++) {
+            if (!enqueue(boost::bind(&RunBatchSegment, segment)))
+                break;
+        }
+        RunBatchSegment(segment);
+        {
+            boost::unique_lock<boost::mutex> lock(segment->cs);
+            while (segment->nDone < segment->nEnd)
+                segment->cond.wait(lock);
+        }
+        reqIdx = nEnd;
+    }
+
     UniValue ret(UniValue::VARR);
-    for (size_t reqIdx = 0; reqIdx < vReq.size(); reqIdx++)
-        ret.push_back(JSONRPCExecOne(vReq[reqIdx]));
+    for (size_t i = 0; i < vReplies.size(); i++)
+        ret.push_back(vReplies[i]);
 
-    return ret.write() + "\n";
+    return ret;
 }
 
 UniValue CRPCTable::execute(const std::string &strMethod, const UniValue &params) const
 {
+    // The scan status only reads atomics, so it is served while the wallet is still loading
+    bool fScanStatus = strMethod == "getwalletscanstatus";
+
     // Return immediately if in warmup
     {
         LOCK(cs_rpcWarmup);
-        if (fRPCInWarmup)
+        if (fRPCInWarmup && !fScanStatus)
             throw JSONRPCError(RPC_IN_WARMUP, rpcWarmupStatus);
     }
 
@@ -874,18 +1237,25 @@ UniValue CRPCTable::execute(const std::string &strMethod, const UniValue &params
     if (!fInitWitnessesBuilt && pcmd->name == "z_sendmany")
         throw JSONRPCError(RPC_DISABLED_BEFORE_WITNESSES, "RPC Command disabled until witnesses are built.");
 
-    if (fBuilingWitnessCache)
+    if (fBuilingWitnessCache && !fScanStatus)
         throw JSONRPCError(RPC_BUILDING_WITNESS_CACHE, "RPC Interface disabled while builing witness cache. Check the debug.log for progress.");
 
     g_rpcSignals.PreCommand(*pcmd);
 
+    RPCStatsScope stats(pcmd->name);
     try
     {
         // Execute
         return pcmd->actor(params, false, CPubKey());
     }
+    catch (const UniValue& objError)
+    {
+        stats.Failed();
+        throw;
+    }
     catch (const std::exception& e)
     {
+        stats.Failed();
         throw JSONRPCError(RPC_MISC_ERROR, e.what());
     }
 
@@ -209,7 +209,56 @@ extern void EnsureWalletIsUnlocked();
 bool StartRPC();
 void InterruptRPC();
 void StopRPC();
-std::string JSONRPCExecBatch(const UniValue& vReq);
+
+class JSONStreamWriter;
+
+/**
+ * Offers a stream for the result of the RPC executed on this thread while in
+ * scope. Set by the transport for requests that came in on their own.
+ */
+class RPCReplyStreamScope
+{
+public:
+    RPCReplyStreamScope(const std::string& strMethod, JSONStreamWriter* stream);
+    ~RPCReplyStreamScope();
+
+    //! True if the RPC wrote its result to the stream
+    bool Taken() const { return fTaken; }
+
+private:
+    std::string strMethod;
+    JSONStreamWriter* stream;
+    bool fTaken;
+    RPCReplyStreamScope* pPrev;
+
+    friend JSONStreamWriter* RPCTakeReplyStream(const std::string& strMethod);
+};
+
+/**
+ * Returns the stream the result of the current request can be written to
+ * while it is generated, or NULL if the result has to be returned. Only a
+ * call of strMethod that is the request itself gets the stream, not one made
+ * from another RPC or as part of a batch. An RPC taking the stream writes
+ * exactly one value to it, its return value is ignored. It should check its
+ * arguments and fail before writing, as errors after the first chunk went
+ * out can only truncate the reply; the stream may also throw when the
+ * client goes away. Locks should not be held while writing, a slow client
+ * makes the writes wait.
+ */
+JSONStreamWriter* RPCTakeReplyStream(const std::string& strMethod);
+
+/** Queues a task on another RPC thread, returns false if it could not be queued */
+typedef boost::function<bool(const boost::function<void(void)>&)> RPCTaskEnqueuer;
+/**
+ * Executes a JSON-RPC batch and returns the replies in request order. With
+ * nMaxHelpers above zero up to that many tasks are queued through enqueue to
+ * execute the requests concurrently with the calling thread. Requests of the
+ * commands that change node or wallet state are never run concurrently, they
+ * split the batch and run on their own once everything before them finished.
+ */
+std::string JSONRPCExecBatch(const UniValue& vReq, int nMaxHelpers = 0, const RPCTaskEnqueuer& enqueue = RPCTaskEnqueuer());
+/** The same, returning the array of replies to be encoded by the caller */
+UniValue JSONRPCExecBatchReplies(const UniValue& vReq, int nMaxHelpers = 0, const RPCTaskEnqueuer& enqueue = RPCTaskEnqueuer());
 
 extern std::string experimentalDisabledHelpMsg(const std::string& rpc, const std::string& enableArg);
 
@@ -228,6 +277,8 @@ extern UniValue addnode(const UniValue& params, bool fHelp, const CPubKey& mypk)
 extern UniValue disconnectnode(const UniValue& params, bool fHelp, const CPubKey& mypk);
 extern UniValue getaddednodeinfo(const UniValue& params, bool fHelp, const CPubKey& mypk);
 extern UniValue getnettotals(const UniValue& params, bool fHelp, const CPubKey& mypk);
+extern UniValue getnetmsgstats(const UniValue& params, bool fHelp, const CPubKey& mypk);
+extern UniValue getnodestatshistory(const UniValue& params, bool fHelp, const CPubKey& mypk);
 extern UniValue setban(const UniValue& params, bool fHelp, const CPubKey& mypk);
 extern UniValue listbanned(const UniValue& params, bool fHelp, const CPubKey& mypk);
 extern UniValue clearbanned(const UniValue& params, bool fHelp, const CPubKey& mypk);
@@ -460,11 +511,14 @@ extern UniValue getblockheader(const UniValue& params, bool fHelp, const CPubKey
 extern UniValue getlastsegidstakes(const UniValue& params, bool fHelp, const CPubKey& mypk);
 extern UniValue getblock(const UniValue& params, bool fHelp, const CPubKey& mypk);
 extern UniValue gettxoutsetinfo(const UniValue& params, bool fHelp, const CPubKey& mypk);
+extern UniValue dumptxoutset(const UniValue& params, bool fHelp, const CPubKey& mypk);
+extern UniValue loadtxoutset(const UniValue& params, bool fHelp, const CPubKey& mypk);
 extern UniValue gettxout(const UniValue& params, bool fHelp, const CPubKey& mypk);
 extern UniValue verifychain(const UniValue& params, bool fHelp, const CPubKey& mypk);
 extern UniValue getchaintips(const UniValue& params, bool fHelp, const CPubKey& mypk);
 extern UniValue invalidateblock(const UniValue& params, bool fHelp, const CPubKey& mypk);
 extern UniValue reconsiderblock(const UniValue& params, bool fHelp, const CPubKey& mypk);
+extern UniValue benchblockcompression(const UniValue& params, bool fHelp, const CPubKey& mypk);
 extern UniValue getspentinfo(const UniValue& params, bool fHelp, const CPubKey& mypk);
 extern UniValue selfimport(const UniValue& params, bool fHelp, const CPubKey& mypk);
 extern UniValue importdual(const UniValue& params, bool fHelp, const CPubKey& mypk);
@@ -501,12 +555,15 @@ extern UniValue z_importkey(const UniValue& params, bool fHelp, const CPubKey& m
 extern UniValue z_exportviewingkey(const UniValue& params, bool fHelp, const CPubKey& mypk); // in rpcdump.cpp
 extern UniValue z_importviewingkey(const UniValue& params, bool fHelp, const CPubKey& mypk); // in rpcdump.cpp
 extern UniValue z_getnewaddresskey(const UniValue& params, bool fHelp, const CPubKey& mypk); // in rpcwallet.cpp
+extern UniValue z_getnewaddresskeys(const UniValue& params, bool fHelp, const CPubKey& mypk); // in rpcwallet.cpp
 extern UniValue z_getnewaddress(const UniValue& params, bool fHelp, const CPubKey& mypk); // in rpcwallet.cpp
+extern UniValue z_getnewaddresses(const UniValue& params, bool fHelp, const CPubKey& mypk); // in rpcwallet.cpp
 extern UniValue z_setprimaryspendingkey(const UniValue& params, bool fHelp, const CPubKey& mypk); // in rpcwallet.cpp
 extern UniValue z_listaddresses(const UniValue& params, bool fHelp, const CPubKey& mypk); // in rpcwallet.cpp
 extern UniValue z_exportwallet(const UniValue& params, bool fHelp, const CPubKey& mypk); // in rpcdump.cpp
 extern UniValue z_importwallet(const UniValue& params, bool fHelp, const CPubKey& mypk); // in rpcdump.cpp
 extern UniValue z_listreceivedbyaddress(const UniValue& params, bool fHelp, const CPubKey& mypk); // in rpcwallet.cpp
+extern UniValue z_findmemo(const UniValue& params, bool fHelp, const CPubKey& mypk); // in rpcwallet.cpp
 extern UniValue z_getbalance(const UniValue& params, bool fHelp, const CPubKey& mypk); // in rpcwallet.cpp
 extern UniValue z_getbalances(const UniValue& params, bool fHelp, const CPubKey& mypk); // in rpcwallet.cpp
 extern UniValue z_gettotalbalance(const UniValue& params, bool fHelp, const CPubKey& mypk); // in rpcwallet.cpp
@@ -538,6 +595,7 @@ extern UniValue migrate_converttoexport(const UniValue& params, bool fHelp, cons
 extern UniValue migrate_createburntransaction(const UniValue& params, bool fHelp, const CPubKey& mypk);
 extern UniValue migrate_createimporttransaction(const UniValue& params, bool fHelp, const CPubKey& mypk);
 extern UniValue migrate_completeimporttransaction(const UniValue& params, bool fHelp, const CPubKey& mypk);
+extern UniValue migrate_completeimporttransactions(const UniValue& params, bool fHelp, const CPubKey& mypk);
 extern UniValue migrate_checkburntransactionsource(const UniValue& params, bool fHelp, const CPubKey& mypk);
 extern UniValue migrate_createnotaryapprovaltransaction(const UniValue& params, bool fHelp, const CPubKey& mypk);
 
@@ -0,0 +1,154 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "rpc/stats.h"
+
+#include "utiltime.h"
+
+#include <algorithm>
+
+CRPCStats rpcStats;
+
+static UniValue MicrosToMillis(int64_t nMicros)
+{
+    return UniValue((double)nMicros / 1000);
+}
+
+CRPCStats::MethodStats::MethodStats() :
+    nCalls(0), nErrors(0), nTotalMicros(0), nMaxMicros(0), nMainWaitMicros(0), nWalletWaitMicros(0)
+{
+    for (int i = 0; i < LATENCY_BUCKETS; i++)
+        vLatency[i] = 0;
+}
+
+int64_t CRPCStats::MethodStats::Percentile(double dFraction) const
+{
+    if (nCalls == 0)
+        return 0;
+    uint64_t nRank = std::max<uint64_t>(1, (uint64_t)(dFraction * nCalls + 0.5));
+    uint64_t nSeen = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        nSeen += vLatency[i];
+        if (nSeen >= nRank)
+            return std::min<int64_t>((int64_t)1 << i, nMaxMicros);
+    }
+    return nMaxMicros;
+}
+
+CRPCStats::CRPCStats() : nNextCall(0)
+{
+}
+
+uint64_t CRPCStats::Begin(const std::string& strMethod, int64_t nNowMicros)
+{
+    LOCK(cs);
+    uint64_t nCall = nNextCall++;
+    InFlight& call = mapInFlight[nCall];
+    call.strMethod = strMethod;
+    call.nStartMicros = nNowMicros;
+    return nCall;
+}
+
+void CRPCStats::End(uint64_t nCall, bool fError, const CLockWaitTimes& waits, int64_t nNowMicros)
+{
+    LOCK(cs);
+    std::map<uint64_t, InFlight>::iterator it = mapInFlight.find(nCall);
+    if (it == mapInFlight.end())
+        return;
+
+    int64_t nMicros = std::max<int64_t>(0, nNowMicros - it->second.nStartMicros);
+    MethodStats& stats = mapMethods[it->second.strMethod];
+    mapInFlight.erase(it);
+
+    stats.nCalls++;
+    if (fError)
+        stats.nErrors++;
+    stats.nTotalMicros += nMicros;
+    stats.nMaxMicros = std::max(stats.nMaxMicros, nMicros);
+    stats.nMainWaitMicros += waits.nMainMicros;
+    stats.nWalletWaitMicros += waits.nWalletMicros;
+
+    // The bucket is the bit length of the latency
+    int nBucket = 0;
+    while (nBucket < LATENCY_BUCKETS - 1 && (nMicros >> nBucket) != 0)
+        nBucket++;
+    stats.vLatency[nBucket]++;
+}
+
+std::map<std::string, CRPCStats::MethodStats> CRPCStats::GetMethods() const
+{
+    LOCK(cs);
+    return mapMethods;
+}
+
+std::vector<CRPCStats::InFlight> CRPCStats::GetInFlight() const
+{
+    LOCK(cs);
+    std::vector<InFlight> vCalls;
+    vCalls.reserve(mapInFlight.size());
+    // Ids are handed out in order, so the longest running calls come first
+    for (std::map<uint64_t, InFlight>::const_iterator it = mapInFlight.begin(); it != mapInFlight.end(); ++it)
+        vCalls.push_back(it->second);
+    return vCalls;
+}
+
+void CRPCStats::GetTotals(uint64_t& nCallsOut, uint64_t& nErrorsOut, size_t& nInFlightOut) const
+{
+    LOCK(cs);
+    nCallsOut = 0;
+    nErrorsOut = 0;
+    for (std::map<std::string, MethodStats>::const_iterator it = mapMethods.begin(); it != mapMethods.end(); ++it) {
+        nCallsOut += it->second.nCalls;
+        nErrorsOut += it->second.nErrors;
+    }
+    nInFlightOut = mapInFlight.size();
+}
+
+UniValue CRPCStats::ToJSON(int64_t nNowMicros) const
+{
+    std::map<std::string, MethodStats> methods = GetMethods();
+    std::vector<InFlight> vInFlight = GetInFlight();
+
+    UniValue objMethods(UniValue::VOBJ);
+    for (std::map<std::string, MethodStats>::const_iterator it = methods.begin(); it != methods.end(); ++it) {
+        const MethodStats& stats = it->second;
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("calls", stats.nCalls));
+        obj.push_back(Pair("errors", stats.nErrors));
+        obj.push_back(Pair("total_ms", MicrosToMillis(stats.nTotalMicros)));
+        obj.push_back(Pair("max_ms", MicrosToMillis(stats.nMaxMicros)));
+        obj.push_back(Pair("p50_ms", MicrosToMillis(stats.Percentile(0.50))));
+        obj.push_back(Pair("p95_ms", MicrosToMillis(stats.Percentile(0.95))));
+        obj.push_back(Pair("p99_ms", MicrosToMillis(stats.Percentile(0.99))));
+        obj.push_back(Pair("cs_main_wait_ms", MicrosToMillis(stats.nMainWaitMicros)));
+        obj.push_back(Pair("cs_wallet_wait_ms", MicrosToMillis(stats.nWalletWaitMicros)));
+        objMethods.push_back(Pair(it->first, obj));
+    }
+
+    UniValue arrInFlight(UniValue::VARR);
+    for (size_t i = 0; i < vInFlight.size(); i++) {
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("method", vInFlight[i].strMethod));
+        obj.push_back(Pair("elapsed_ms", MicrosToMillis(std::max<int64_t>(0, nNowMicros - vInFlight[i].nStartMicros))));
+        arrInFlight.push_back(obj);
+    }
+
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair("methods", objMethods));
+    result.push_back(Pair("inflight", arrInFlight));
+    return result;
+}
+
+RPCStatsScope::RPCStatsScope(const std::string& strMethod) :
+    fError(false), pPrevWaits(pLockWaitTimes)
+{
+    nCall = rpcStats.Begin(strMethod, GetTimeMicros());
+    pLockWaitTimes = &waits;
+}
+
+RPCStatsScope::~RPCStatsScope()
+{
+    pLockWaitTimes = pPrevWaits;
+    rpcStats.End(nCall, fError, waits, GetTimeMicros());
+}
@@ -0,0 +1,97 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_RPC_STATS_H
+#define BITCOIN_RPC_STATS_H
+
+#include "sync.h"
+
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <univalue.h>
+
+/**
+ * Per-method statistics of the RPC server: calls, errors, a latency
+ * histogram and the time spent waiting for cs_main and cs_wallet, plus the
+ * commands that are executing right now.
+ *
+ * Latencies go to power of two buckets of microseconds, bucket i holding the
+ * calls that took less than 2^i us. Percentiles are read off the histogram as
+ * the upper bound of their bucket, so they are accurate to a factor of two,
+ * which is enough to size the RPC threads and work queue.
+ */
+class CRPCStats
+{
+public:
+    static const int LATENCY_BUCKETS = 32;
+
+    struct MethodStats {
+        uint64_t nCalls;
+        uint64_t nErrors;
+        int64_t nTotalMicros;
+        int64_t nMaxMicros;
+        int64_t nMainWaitMicros;
+        int64_t nWalletWaitMicros;
+        uint64_t vLatency[LATENCY_BUCKETS];
+
+        MethodStats();
+        //! Latency below which the given fraction of the calls finished, in microseconds
+        int64_t Percentile(double dFraction) const;
+    };
+
+    struct InFlight {
+        std::string strMethod;
+        int64_t nStartMicros;
+    };
+
+private:
+    mutable CCriticalSection cs;
+    std::map<std::string, MethodStats> mapMethods;
+    std::map<uint64_t, InFlight> mapInFlight;
+    uint64_t nNextCall;
+
+public:
+    CRPCStats();
+
+    //! Registers a call that starts executing, returns its id for End
+    uint64_t Begin(const std::string& strMethod, int64_t nNowMicros);
+    void End(uint64_t nCall, bool fError, const CLockWaitTimes& waits, int64_t nNowMicros);
+
+    std::map<std::string, MethodStats> GetMethods() const;
+    std::vector<InFlight> GetInFlight() const;
+    //! Calls, errors and executing calls over all methods
+    void GetTotals(uint64_t& nCallsOut, uint64_t& nErrorsOut, size_t& nInFlightOut) const;
+
+    UniValue ToJSON(int64_t nNowMicros) const;
+};
+
+extern CRPCStats rpcStats;
+
+/**
+ * Accounts one RPC call in rpcStats for as long as it is alive, including the
+ * lock waits of the executing thread. Failed must be called when the call
+ * ends with an error.
+ */
+class RPCStatsScope
+{
+private:
+    uint64_t nCall;
+    bool fError;
+    CLockWaitTimes waits;
+    CLockWaitTimes* pPrevWaits;
+
+    RPCStatsScope(const RPCStatsScope&);
+    RPCStatsScope& operator=(const RPCStatsScope&);
+
+public:
+    explicit RPCStatsScope(const std::string& strMethod);
+    ~RPCStatsScope();
+
+    void Failed() { fError = true; }
+};
+
+#endif // BITCOIN_RPC_STATS_H
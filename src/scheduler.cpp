@@ -21,10 +21,13 @@
 
 #include "reverselock.h"
 
+#include <algorithm>
 #include <assert.h>
 #include <boost/bind.hpp>
 #include <utility>
 
+const std::string CScheduler::DEFAULT_QUEUE = "default";
+
 CScheduler::CScheduler() : nThreadsServicingQueue(0), stopRequested(false), stopWhenEmpty(false)
 {
 }
@@ -46,6 +49,14 @@ CScheduler::~CScheduler()
 }
 
 
+CScheduler::TaskMap::iterator CScheduler::nextRunnable()
+{
+    for (TaskMap::iterator it = taskQueue.begin(); it != taskQueue.end(); ++it)
+        if (!mapQueueStats[it->second.strQueue].fRunning)
+            return it;
+    return taskQueue.end();
+}
+
 void CScheduler::serviceQueue()
 {
     boost::unique_lock<boost::mutex> lock(newTaskMutex);
@@ -56,35 +67,47 @@ void CScheduler::serviceQueue()
     // is called.
     while (!shouldStop()) {
         try {
-            while (!shouldStop() && taskQueue.empty()) {
-                // Wait until there is something to do.
+            // Wait until there is a task of a queue that isn't busy, and
+            // then until its time or until a task is scheduled or finishes.
+            TaskMap::iterator it = nextRunnable();
+            if (it == taskQueue.end()) {
                 newTaskScheduled.wait(lock);
+                continue;
             }
-
-            // Wait until either there is a new task, or until
-            // the time of the first item on the queue:
-
             // Some boost versions have a conflicting overload of wait_until that returns void.
             // Explicitly use a template here to avoid hitting that overload.
-            while (!shouldStop() && !taskQueue.empty() &&
-                   newTaskScheduled.wait_until<>(lock, taskQueue.begin()->first) != boost::cv_status::timeout) {
-                // Keep waiting until timeout
-            }
-
-            // If there are multiple threads, the queue can empty while we're waiting (another
-            // thread may service the task we were waiting on).
-            if (shouldStop() || taskQueue.empty())
+            boost::chrono::system_clock::time_point t = it->first;
+            if (boost::chrono::system_clock::now() < t) {
+                newTaskScheduled.wait_until<>(lock, t);
                 continue;
+            }
 
-            Function f = taskQueue.begin()->second;
-            taskQueue.erase(taskQueue.begin());
+            Task task = it->second;
+            taskQueue.erase(it);
+            QueueStats& stats = mapQueueStats[task.strQueue];
+            stats.fRunning = true;
+            boost::chrono::steady_clock::time_point start = boost::chrono::steady_clock::now();
+            int64_t nDelayMicros = boost::chrono::duration_cast<boost::chrono::microseconds>(boost::chrono::system_clock::now() - t).count();
+            stats.nMaxDelayMicros = std::max(stats.nMaxDelayMicros, nDelayMicros);
 
-            {
+            try {
                 // Unlock before calling f, so it can reschedule itself or another task
                 // without deadlocking:
                 reverse_lock<boost::unique_lock<boost::mutex> > rlock(lock);
-                f();
+                task.f();
+            } catch (...) {
+                stats.fRunning = false;
+                newTaskScheduled.notify_all();
+                throw;
             }
+
+            int64_t nRunMicros = boost::chrono::duration_cast<boost::chrono::microseconds>(boost::chrono::steady_clock::now() - start).count();
+            stats.fRunning = false;
+            stats.nRuns++;
+            stats.nRunMicros += nRunMicros;
+            stats.nMaxRunMicros = std::max(stats.nMaxRunMicros, nRunMicros);
+            // The next task of the queue may be waiting for this one
+            newTaskScheduled.notify_all();
         } catch (...) {
             --nThreadsServicingQueue;
             throw;
@@ -105,29 +128,34 @@ void CScheduler::stop(bool drain)
     newTaskScheduled.notify_all();
 }
 
-void CScheduler::schedule(CScheduler::Function f, boost::chrono::system_clock::time_point t)
+void CScheduler::schedule(CScheduler::Function f, boost::chrono::system_clock::time_point t, const std::string& strQueue)
 {
     {
         boost::unique_lock<boost::mutex> lock(newTaskMutex);
-        taskQueue.insert(std::make_pair(t, f));
+        Task task;
+        task.f = f;
+        task.strQueue = strQueue;
+        taskQueue.insert(std::make_pair(t, task));
+        mapQueueStats[strQueue];
     }
-    newTaskScheduled.notify_one();
+    // Threads waiting for another queue have to look at this task as well
+    newTaskScheduled.notify_all();
 }
 
-void CScheduler::scheduleFromNow(CScheduler::Function f, int64_t deltaSeconds)
+void CScheduler::scheduleFromNow(CScheduler::Function f, int64_t deltaSeconds, const std::string& strQueue)
 {
-    schedule(f, boost::chrono::system_clock::now() + boost::chrono::seconds(deltaSeconds));
+    schedule(f, boost::chrono::system_clock::now() + boost::chrono::seconds(deltaSeconds), strQueue);
 }
 
-static void Repeat(CScheduler* s, CScheduler::Function f, int64_t deltaSeconds)
+static void Repeat(CScheduler* s, CScheduler::Function f, int64_t deltaSeconds, const std::string& strQueue)
 {
     f();
-    s->scheduleFromNow(boost::bind(&Repeat, s, f, deltaSeconds), deltaSeconds);
+    s->scheduleFromNow(boost::bind(&Repeat, s, f, deltaSeconds, strQueue), deltaSeconds, strQueue);
 }
 
-void CScheduler::scheduleEvery(CScheduler::Function f, int64_t deltaSeconds)
+void CScheduler::scheduleEvery(CScheduler::Function f, int64_t deltaSeconds, const std::string& strQueue)
 {
-    scheduleFromNow(boost::bind(&Repeat, this, f, deltaSeconds), deltaSeconds);
+    scheduleFromNow(boost::bind(&Repeat, this, f, deltaSeconds, strQueue), deltaSeconds, strQueue);
 }
 
 size_t CScheduler::getQueueInfo(boost::chrono::system_clock::time_point &first,
@@ -141,3 +169,17 @@ size_t CScheduler::getQueueInfo(boost::chrono::system_clock::time_point &first,
     }
     return result;
 }
+
+std::map<std::string, CScheduler::QueueStats> CScheduler::getQueueStats() const
+{
+    boost::unique_lock<boost::mutex> lock(newTaskMutex);
+    std::map<std::string, QueueStats> mapStats = mapQueueStats;
+    boost::chrono::system_clock::time_point now = boost::chrono::system_clock::now();
+    for (const TaskMap::value_type& entry : taskQueue) {
+        QueueStats& stats = mapStats[entry.second.strQueue];
+        stats.nPending++;
+        if (entry.first <= now)
+            stats.nDue++;
+    }
+    return mapStats;
+}
@@ -29,6 +29,7 @@
 #include <boost/chrono/chrono.hpp>
 #include <boost/thread.hpp>
 #include <map>
+#include <string>
 
 //
 // Simple class for background tasks that should be run
@@ -41,6 +42,10 @@
 // s->scheduleFromNow(boost::bind(Class::func, this, argument), 3);
 // boost::thread* t = new boost::thread(boost::bind(CScheduler::serviceQueue, s));
 //
+// Tasks go to named queues. The tasks of one queue run one at a time, in the
+// order of their times, while the threads running serviceQueue are shared by
+// all queues: a slow task only holds up the later tasks of its own queue.
+//
 // ... then at program shutdown, clean up the thread running serviceQueue:
 // t->interrupt();
 // t->join();
@@ -48,6 +53,10 @@
 // delete s; // Must be done after thread is interrupted/joined.
 //
 
+//! -schedulerthreads default
+static const int DEFAULT_SCHEDULER_THREADS = 2;
+static const int MAX_SCHEDULER_THREADS = 16;
+
 class CScheduler
 {
 public:
@@ -56,18 +65,35 @@ public:
 
     typedef boost::function<void(void)> Function;
 
-    // Call func at/after time t
-    void schedule(Function f, boost::chrono::system_clock::time_point t);
+    static const std::string DEFAULT_QUEUE;
+
+    // What a queue has waiting and how long its tasks took
+    struct QueueStats {
+        // Tasks scheduled, and those of them past their time
+        size_t nPending;
+        size_t nDue;
+        bool fRunning;
+        uint64_t nRuns;
+        int64_t nRunMicros;
+        int64_t nMaxRunMicros;
+        // Longest a task started after its time
+        int64_t nMaxDelayMicros;
+
+        QueueStats() : nPending(0), nDue(0), fRunning(false), nRuns(0), nRunMicros(0), nMaxRunMicros(0), nMaxDelayMicros(0) {}
+    };
+
+    // Call func at/after time t, after the earlier tasks of its queue
+    void schedule(Function f, boost::chrono::system_clock::time_point t, const std::string& strQueue = DEFAULT_QUEUE);
 
     // Convenience method: call f once deltaSeconds from now
-    void scheduleFromNow(Function f, int64_t deltaSeconds);
+    void scheduleFromNow(Function f, int64_t deltaSeconds, const std::string& strQueue = DEFAULT_QUEUE);
 
     // Another convenience method: call f approximately
     // every deltaSeconds forever, starting deltaSeconds from now.
     // To be more precise: every time f is finished, it
     // is rescheduled to run deltaSeconds later. If you
     // need more accurate scheduling, don't use this method.
-    void scheduleEvery(Function f, int64_t deltaSeconds);
+    void scheduleEvery(Function f, int64_t deltaSeconds, const std::string& strQueue = DEFAULT_QUEUE);
 
     // To keep things as simple as possible, there is no unschedule.
 
@@ -85,14 +111,26 @@ public:
     size_t getQueueInfo(boost::chrono::system_clock::time_point &first,
                         boost::chrono::system_clock::time_point &last) const;
 
+    // Stats of each queue that had a task scheduled
+    std::map<std::string, QueueStats> getQueueStats() const;
+
 private:
-    std::multimap<boost::chrono::system_clock::time_point, Function> taskQueue;
+    struct Task {
+        Function f;
+        std::string strQueue;
+    };
+    typedef std::multimap<boost::chrono::system_clock::time_point, Task> TaskMap;
+
+    TaskMap taskQueue;
+    std::map<std::string, QueueStats> mapQueueStats;
     boost::condition_variable newTaskScheduled;
     mutable boost::mutex newTaskMutex;
     int nThreadsServicingQueue;
     bool stopRequested;
     bool stopWhenEmpty;
     bool shouldStop() { return stopRequested || (stopWhenEmpty && taskQueue.empty()); }
+    // First task of a queue that isn't running a task, taskQueue.end() if there is none
+    TaskMap::iterator nextRunnable();
 };
 
 #endif
@@ -1396,9 +1396,12 @@ int TransactionSignatureChecker::CheckCryptoCondition(
         //fprintf(stderr,"checker.%p\n",(TransactionSignatureChecker*)checker);
         return ((TransactionSignatureChecker*)checker)->CheckEvalCondition(cond);
     };
+    VerifySecp256k1 verifySig = [] (const uint8_t *publicKey, const uint8_t *signature, const uint8_t *msg32, void *checker) {
+        return (int)((TransactionSignatureChecker*)checker)->VerifyCCSignature(publicKey, signature, uint256(std::vector<unsigned char>(msg32, msg32 + 32)));
+    };
     //fprintf(stderr,"non-checker path\n");
-    int out = cc_verify(cond, (const unsigned char*)&sighash, 32, 0,
-                        condBin.data(), condBin.size(), eval, (void*)this);
+    int out = cc_verifyExt(cond, (const unsigned char*)&sighash, 32, 0,
+                           condBin.data(), condBin.size(), eval, (void*)this, verifySig, (void*)this);
     //fprintf(stderr,"out.%d from cc_verify\n",(int32_t)out);
     cc_free(cond);
     return out;
@@ -1412,6 +1415,12 @@ int TransactionSignatureChecker::CheckEvalCondition(const CC *cond) const
 }
 
 
+bool TransactionSignatureChecker::VerifyCCSignature(const unsigned char *publicKey, const unsigned char *signature, const uint256& sighash) const
+{
+    return cc_secp256k1VerifyMsg32(publicKey, signature, sighash.begin()) == 1;
+}
+
+
 bool TransactionSignatureChecker::CheckLockTime(const CScriptNum& nLockTime) const
 {
     // There are two times of nLockTime: lock-by-blockheight
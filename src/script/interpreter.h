@@ -179,6 +179,8 @@ public:
         const CScript& scriptCode,
         uint32_t consensusBranchId) const;
     virtual int CheckEvalCondition(const CC *cond) const;
+    //! Checks a compact secp256k1 signature of a crypto-condition, by its 33 byte public key
+    virtual bool VerifyCCSignature(const unsigned char *publicKey, const unsigned char *signature, const uint256& sighash) const;
 };
 
 class MutableTransactionSignatureChecker : public TransactionSignatureChecker
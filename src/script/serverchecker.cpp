@@ -22,15 +22,12 @@
 #include "script/cc.h"
 #include "cc/eval.h"
 
+#include "cuckoocache.h"
+#include "main.h"
 #include "pubkey.h"
-#include "random.h"
 #include "uint256.h"
 #include "util.h"
 
-#undef __cpuid
-#include <boost/thread.hpp>
-#include <boost/tuple/tuple_comparison.hpp>
-
 namespace {
 
 /**
@@ -41,52 +38,66 @@ namespace {
 class CSignatureCache
 {
 private:
-     //! sigdata_type is (signature hash, signature, public key):
-    typedef boost::tuple<uint256, std::vector<unsigned char>, CPubKey> sigdata_type;
-    std::set< sigdata_type> setValid;
-    boost::shared_mutex cs_serverchecker;
+    CCuckooCache cache;
+
+    uint256 Key(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey) const
+    {
+        // The size of a public key follows from its first byte, so the signature can come last
+        uint256 key;
+        cache.Hasher().Write(hash.begin(), 32).Write(pubKey.begin(), pubKey.size()).Write(vchSig.data(), vchSig.size()).Finalize(key.begin());
+        return key;
+    }
 
 public:
+    // Since there can be no more than 20,000 signature operations per block
+    // 50,000 is a reasonable default, 1.6MB of keys
+    CSignatureCache() : cache(GetArg("-maxsigcachesize", 50000)) {}
+
     bool
     Get(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
     {
-        boost::shared_lock<boost::shared_mutex> lock(cs_serverchecker);
-
-        sigdata_type k(hash, vchSig, pubKey);
-        std::set<sigdata_type>::iterator mi = setValid.find(k);
-        if (mi != setValid.end())
-            return true;
-        return false;
+        return cache.Contains(Key(hash, vchSig, pubKey));
     }
 
     void Set(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
     {
-        // DoS prevention: limit cache size to less than 10MB
-        // (~200 bytes per cache entry times 50,000 entries)
-        // Since there can be no more than 20,000 signature operations per block
-        // 50,000 is a reasonable default.
-        int64_t nMaxCacheSize = GetArg("-maxservercheckersize", 50000);
-        if (nMaxCacheSize <= 0) return;
-
-        boost::unique_lock<boost::shared_mutex> lock(cs_serverchecker);
-
-        while (static_cast<int64_t>(setValid.size()) > nMaxCacheSize)
-        {
-            // Evict a random entry. Random because that helps
-            // foil would-be DoS attackers who might try to pre-generate
-            // and re-use a set of valid signatures just-slightly-greater
-            // than our cache size.
-            uint256 randomHash = GetRandHash();
-            std::vector<unsigned char> unused;
-            std::set<sigdata_type>::iterator it =
-                setValid.lower_bound(sigdata_type(randomHash, unused, unused));
-            if (it == setValid.end())
-                it = setValid.begin();
-            setValid.erase(*it);
-        }
-
-        sigdata_type k(hash, vchSig, pubKey);
-        setValid.insert(k);
+        cache.Insert(Key(hash, vchSig, pubKey));
+    }
+};
+
+/**
+ * Cache of crypto-condition evals found valid, so the module validator of a
+ * CC input accepted into the memory pool is not run again when the block
+ * that includes it is connected. Validators read the chain, so an entry is
+ * only good for the tip it was evaluated on, which also fixes the height and
+ * consensus branch the transaction is checked for, and it is keyed by that
+ * tip's hash next to the txid and input.
+ */
+class CCCEvalCache
+{
+private:
+    CCuckooCache cache;
+
+    uint256 Key(const uint256 &txid, unsigned int nIn, const uint256 &hashTip) const
+    {
+        unsigned char vin[4];
+        WriteLE32(vin, nIn);
+        uint256 key;
+        cache.Hasher().Write(txid.begin(), 32).Write(vin, 4).Write(hashTip.begin(), 32).Finalize(key.begin());
+        return key;
+    }
+
+public:
+    CCCEvalCache() : cache(GetArg("-maxccevalcachesize", DEFAULT_MAX_CCEVAL_CACHE_SIZE)) {}
+
+    bool Get(const uint256 &txid, unsigned int nIn, const uint256 &hashTip)
+    {
+        return cache.Contains(Key(txid, nIn, hashTip));
+    }
+
+    void Set(const uint256 &txid, unsigned int nIn, const uint256 &hashTip)
+    {
+        cache.Insert(Key(txid, nIn, hashTip));
     }
 };
 
@@ -116,8 +127,47 @@ bool ServerTransactionSignatureChecker::VerifySignature(const std::vector<unsign
  * code without pulling the whole bitcoin server code into bitcoin common was
  * using this class. Thus it has been renamed to ServerTransactionSignatureChecker.
  */
+/*
+ * Secp256k1 signatures of crypto-conditions are compact ECDSA signatures, which
+ * can't be verified in batches, so like the others they are remembered once
+ * found valid and not checked again when the block with the transaction is
+ * connected. They have their own cache as they are not in DER encoding.
+ */
+bool ServerTransactionSignatureChecker::VerifyCCSignature(const unsigned char *publicKey, const unsigned char *signature, const uint256& sighash) const
+{
+    static CSignatureCache ccSignatureCache;
+
+    const CPubKey pubkey(publicKey, publicKey + CPubKey::COMPRESSED_PUBLIC_KEY_SIZE);
+    const std::vector<unsigned char> vchSig(signature, signature + 64);
+    if (ccSignatureCache.Get(sighash, vchSig, pubkey))
+        return true;
+
+    if (!TransactionSignatureChecker::VerifyCCSignature(publicKey, signature, sighash))
+        return false;
+
+    if (store)
+        ccSignatureCache.Set(sighash, vchSig, pubkey);
+    return true;
+}
+
 int ServerTransactionSignatureChecker::CheckEvalCondition(const CC *cond) const
 {
     //fprintf(stderr,"call RunCCeval from ServerTransactionSignatureChecker::CheckEvalCondition\n");
-    return RunCCEval(cond, *txTo, nIn);
+    static CCCEvalCache evalCache;
+
+    if (skipEval)
+        return true;
+
+    const CBlockIndex *pindexTip = chainActive.Tip();
+    const uint256 hashTip = pindexTip != NULL ? pindexTip->GetBlockHash() : uint256();
+    const uint256 txid = txTo->GetHash();
+    if (evalCache.Get(txid, nIn, hashTip))
+        return true;
+
+    if (!RunCCEval(cond, *txTo, nIn))
+        return false;
+
+    if (store)
+        evalCache.Set(txid, nIn, hashTip);
+    return true;
 }
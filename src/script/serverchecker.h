@@ -27,17 +27,23 @@
 
 class CPubKey;
 
+//! Default for -maxccevalcachesize, the number of valid crypto-condition evals remembered
+static const int64_t DEFAULT_MAX_CCEVAL_CACHE_SIZE = 50000;
+
 class ServerTransactionSignatureChecker : public TransactionSignatureChecker
 {
 private:
     bool store;
+    //! Eval conditions pass unchecked, the caller runs them on its own thread
+    bool skipEval;
 
 public:
-    ServerTransactionSignatureChecker(const CTransaction* txToIn, unsigned int nIn, const CAmount& amount, bool storeIn, const PrecomputedTransactionData& txdataIn) : TransactionSignatureChecker(txToIn, nIn, amount, txdataIn), store(storeIn) {}
-    ServerTransactionSignatureChecker(const CTransaction* txToIn, unsigned int nIn, const CAmount& amount, bool storeIn) : TransactionSignatureChecker(txToIn, nIn, amount), store(storeIn) {}
+    ServerTransactionSignatureChecker(const CTransaction* txToIn, unsigned int nIn, const CAmount& amount, bool storeIn, const PrecomputedTransactionData& txdataIn, bool skipEvalIn = false) : TransactionSignatureChecker(txToIn, nIn, amount, txdataIn), store(storeIn), skipEval(skipEvalIn) {}
+    ServerTransactionSignatureChecker(const CTransaction* txToIn, unsigned int nIn, const CAmount& amount, bool storeIn) : TransactionSignatureChecker(txToIn, nIn, amount), store(storeIn), skipEval(false) {}
 
     bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const;
     int CheckEvalCondition(const CC *cond) const;
+    bool VerifyCCSignature(const unsigned char *publicKey, const unsigned char *signature, const uint256& sighash) const;
 };
 
 #endif // BITCOIN_SCRIPT_SERVERCHECKER_H
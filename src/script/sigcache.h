@@ -38,4 +38,7 @@ public:
     bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const;
 };
 
+//! Entries in the signature cache and the number it holds at most, without taking its lock
+void GetSignatureCacheSize(size_t& nEntries, size_t& nCapacity);
+
 #endif // BITCOIN_SCRIPT_SIGCACHE_H
@@ -28,9 +28,13 @@
 #include "cc/CCinclude.h"
 #include "cc/eval.h"
 #include "key_io.h"
+#include "util/parallel.h"
 
 #include <boost/foreach.hpp>
 
+#include <algorithm>
+#include <atomic>
+
 using namespace std;
 
 typedef vector<unsigned char> valtype;
@@ -46,22 +50,27 @@ extern int32_t KOMODO_NSPV;
 
 uint256 SIG_TXHASH;
 
-TransactionSignatureCreator::TransactionSignatureCreator(const CKeyStore* keystoreIn, const CTransaction* txToIn, unsigned int nInIn, const CAmount& amountIn, int nHashTypeIn) : BaseSignatureCreator(keystoreIn), txTo(txToIn), nIn(nInIn), nHashType(nHashTypeIn), amount(amountIn), checker(txTo, nIn, amountIn) {}
+TransactionSignatureCreator::TransactionSignatureCreator(const CKeyStore* keystoreIn, const CTransaction* txToIn, unsigned int nInIn, const CAmount& amountIn, int nHashTypeIn) : BaseSignatureCreator(keystoreIn), txTo(txToIn), nIn(nInIn), nHashType(nHashTypeIn), amount(amountIn), txdata(NULL), checker(txTo, nIn, amountIn) {}
+
+TransactionSignatureCreator::TransactionSignatureCreator(const CKeyStore* keystoreIn, const CTransaction* txToIn, unsigned int nInIn, const CAmount& amountIn, const PrecomputedTransactionData& txdataIn, int nHashTypeIn) : BaseSignatureCreator(keystoreIn), txTo(txToIn), nIn(nInIn), nHashType(nHashTypeIn), amount(amountIn), txdata(&txdataIn), checker(txTo, nIn, amountIn, txdataIn) {}
 
 bool TransactionSignatureCreator::CreateSig(std::vector<unsigned char>& vchSig, const CKeyID& address, const CScript& scriptCode, uint32_t consensusBranchId, CKey *pprivKey, void *extraData) const
 {
     CKey key; uint256 hash;
     try {
-        hash = SignatureHash(scriptCode, *txTo, nIn, nHashType, amount, consensusBranchId);
+        hash = SignatureHash(scriptCode, *txTo, nIn, nHashType, amount, consensusBranchId, txdata);
     } catch (logic_error ex) {
         {
             fprintf(stderr,"logic error\n");
         return false;
         }
     }
-    SIG_TXHASH = hash;
     if ( KOMODO_NSPV_SUPERLITE )
+    {
+        // Only read by the NSPV client, which signs one input at a time
+        SIG_TXHASH = hash;
         key = DecodeSecret(NSPV_wifstr);
+    }
     else if (pprivKey)
         key = *pprivKey;
     else if (!keystore || !keystore->GetKey(address, key))
@@ -449,6 +458,35 @@ bool ProduceSignature(const BaseSignatureCreator& creator, const CScript& fromPu
     return solved && VerifyScript(sigdata.scriptSig, fromPubKey, STANDARD_SCRIPT_VERIFY_FLAGS, creator.Checker(), consensusBranchId);
 }
 
+bool ProduceSignatures(
+    const CKeyStore* keystore,
+    const CTransaction& txTo,
+    const std::vector<std::pair<CScript, CAmount>>& vCoins,
+    int nHashType,
+    uint32_t consensusBranchId,
+    std::vector<SignatureData>& vSigData,
+    int nThreads)
+{
+    assert(vCoins.size() == txTo.vin.size());
+    vSigData.assign(vCoins.size(), SignatureData());
+    const PrecomputedTransactionData txdata(txTo);
+
+    // Crypto-condition fulfillments and the NSPV client's key are signed on the calling thread
+    bool fSerial = KOMODO_NSPV_SUPERLITE;
+    for (const std::pair<CScript, CAmount>& coin : vCoins)
+        fSerial = fSerial || coin.first.IsPayToCryptoCondition();
+    size_t nWorkers = fSerial ? 1 : std::max<size_t>(1, std::min<size_t>(std::min(nThreads, MAX_SIGNATURE_THREADS), vCoins.size() / MIN_SIGNATURES_PER_THREAD));
+
+    std::atomic<bool> fSigned(true);
+    ParallelFor(vCoins.size(), nWorkers, [&](size_t i) {
+        if (vCoins[i].first.empty())
+            return;
+        if (!ProduceSignature(TransactionSignatureCreator(keystore, &txTo, i, vCoins[i].second, txdata, nHashType), vCoins[i].first, vSigData[i], consensusBranchId))
+            fSigned = false;
+    });
+    return fSigned;
+}
+
 SignatureData DataFromTransaction(const CMutableTransaction& tx, unsigned int nIn)
 {
     SignatureData data;
@@ -23,6 +23,9 @@
 
 #include "script/interpreter.h"
 
+#include <utility>
+#include <vector>
+
 class CKey;
 class CKeyID;
 class CKeyStore;
@@ -58,10 +61,13 @@ class TransactionSignatureCreator : public BaseSignatureCreator {
     unsigned int nIn;
     int nHashType;
     CAmount amount;
+    const PrecomputedTransactionData* txdata;
     const TransactionSignatureChecker checker;
 
 public:
     TransactionSignatureCreator(const CKeyStore* keystoreIn, const CTransaction* txToIn, unsigned int nInIn, const CAmount& amountIn, int nHashTypeIn=SIGHASH_ALL);
+    //! Takes the digests shared by the signature hashes of all inputs from txdataIn, which must outlive the creator
+    TransactionSignatureCreator(const CKeyStore* keystoreIn, const CTransaction* txToIn, unsigned int nInIn, const CAmount& amountIn, const PrecomputedTransactionData& txdataIn, int nHashTypeIn=SIGHASH_ALL);
     const BaseSignatureChecker& Checker() const { return checker; }
     bool CreateSig(std::vector<unsigned char>& vchSig, const CKeyID& keyid, const CScript& scriptCode, uint32_t consensusBranchId, CKey *key = NULL, void *extraData = NULL) const;
 };
@@ -91,6 +97,27 @@ struct SignatureData {
 /** Produce a script signature using a generic signature creator. */
 bool ProduceSignature(const BaseSignatureCreator& creator, const CScript& scriptPubKey, SignatureData& sigdata, uint32_t consensusBranchId);
 
+//! Inputs signed per thread before ProduceSignatures starts another
+static const unsigned int MIN_SIGNATURES_PER_THREAD = 8;
+//! Most threads a transaction's inputs are signed on
+static const int MAX_SIGNATURE_THREADS = 8;
+
+/**
+ * Produce the script signatures of the inputs of txTo, given the script and
+ * value of the coin each spends, on up to nThreads threads. The ZIP 243
+ * digests shared by the signature hashes are computed once for all inputs.
+ * Inputs whose coin script is empty are skipped and keep an empty sigdata.
+ * Returns whether all the other inputs were signed.
+ */
+bool ProduceSignatures(
+    const CKeyStore* keystore,
+    const CTransaction& txTo,
+    const std::vector<std::pair<CScript, CAmount>>& vCoins,
+    int nHashType,
+    uint32_t consensusBranchId,
+    std::vector<SignatureData>& vSigData,
+    int nThreads = 1);
+
 /** Produce a script signature for a transaction. */
 bool SignSignature(
     const CKeyStore &keystore,
@@ -513,6 +513,54 @@ public:
     }
 };
 
+/** Deserializes from memory it does not own, such as a mapped file, without
+ *  copying it into a buffer first. The memory has to outlive the reader.
+ */
+class CSpanReader
+{
+private:
+    const int nType;
+    const int nVersion;
+
+    const char* pBegin;
+    const char* pEnd;
+
+public:
+    CSpanReader(int nTypeIn, int nVersionIn, const char* pData, size_t nSize) :
+        nType(nTypeIn), nVersion(nVersionIn), pBegin(pData), pEnd(pData + nSize) {}
+
+    //
+    // Stream subset
+    //
+    int GetType() const          { return nType; }
+    int GetVersion() const       { return nVersion; }
+    size_t size() const          { return pEnd - pBegin; }
+    bool empty() const           { return pBegin == pEnd; }
+
+    void read(char* pch, size_t nSize)
+    {
+        if (nSize > size())
+            throw std::ios_base::failure("CSpanReader::read: end of data");
+        memcpy(pch, pBegin, nSize);
+        pBegin += nSize;
+    }
+
+    void ignore(size_t nSize)
+    {
+        if (nSize > size())
+            throw std::ios_base::failure("CSpanReader::ignore: end of data");
+        pBegin += nSize;
+    }
+
+    template<typename T>
+    CSpanReader& operator>>(T& obj)
+    {
+        // Unserialize from this stream
+        ::Unserialize(*this, obj);
+        return (*this);
+    }
+};
+
 /** Non-refcounted RAII wrapper around a FILE* that implements a ring buffer to
  *  deserialize from. It guarantees the ability to rewind a given number of bytes.
  *
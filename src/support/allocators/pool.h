@@ -0,0 +1,194 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SUPPORT_ALLOCATORS_POOL_H
+#define BITCOIN_SUPPORT_ALLOCATORS_POOL_H
+
+#include "memusage.h"
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+/**
+ * Arena for many small allocations of a few sizes, such as the nodes of a
+ * node based map.
+ *
+ * Blocks are carved from large chunks and freed blocks are kept in a free
+ * list per size, so they are reused without going through malloc. The chunks
+ * are only returned when the pool is destroyed. Allocations over
+ * MAX_BLOCK_SIZE bytes, like the bucket array of a hash map, are passed on to
+ * operator new but are still counted, so DynamicMemoryUsage is the exact
+ * footprint of everything allocated through the pool.
+ *
+ * Not thread safe; the owner has to serialize access.
+ */
+class PoolResource
+{
+public:
+    //! Size of each chunk blocks are carved from
+    static const size_t CHUNK_SIZE = 256 * 1024;
+    //! Larger allocations are not pooled
+    static const size_t MAX_BLOCK_SIZE = 256;
+    //! Granularity and alignment of the pooled blocks
+    static const size_t BLOCK_ALIGN = sizeof(void*);
+
+private:
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    //! Free list for each block size in units of BLOCK_ALIGN
+    FreeBlock* vFreeLists[MAX_BLOCK_SIZE / BLOCK_ALIGN + 1];
+    std::vector<char*> vChunks;
+    char* pChunkPos;
+    char* pChunkEnd;
+    size_t nLargeUsage;
+    //! Bytes of the pooled blocks currently handed out
+    size_t nPooledInUse;
+
+    static size_t BlockUnits(size_t bytes) {
+        return (bytes + BLOCK_ALIGN - 1) / BLOCK_ALIGN;
+    }
+
+    static bool IsPooled(size_t bytes, size_t alignment) {
+        return bytes <= MAX_BLOCK_SIZE && alignment <= BLOCK_ALIGN;
+    }
+
+    PoolResource(const PoolResource&);
+    PoolResource& operator=(const PoolResource&);
+
+public:
+    PoolResource() : pChunkPos(nullptr), pChunkEnd(nullptr), nLargeUsage(0), nPooledInUse(0) {
+        for (size_t i = 0; i < sizeof(vFreeLists) / sizeof(vFreeLists[0]); i++) {
+            vFreeLists[i] = nullptr;
+        }
+    }
+
+    ~PoolResource() {
+        for (char* pChunk : vChunks) {
+            ::operator delete(pChunk);
+        }
+    }
+
+    void* Allocate(size_t bytes, size_t alignment) {
+        if (!IsPooled(bytes, alignment)) {
+            nLargeUsage += memusage::MallocUsage(bytes);
+            return ::operator new(bytes);
+        }
+
+        size_t nUnits = BlockUnits(bytes);
+        nPooledInUse += nUnits * BLOCK_ALIGN;
+        if (vFreeLists[nUnits] != nullptr) {
+            FreeBlock* pBlock = vFreeLists[nUnits];
+            vFreeLists[nUnits] = pBlock->next;
+            return pBlock;
+        }
+
+        size_t nBlockSize = nUnits * BLOCK_ALIGN;
+        if (pChunkPos == nullptr || (size_t)(pChunkEnd - pChunkPos) < nBlockSize) {
+            // Keep what is left of the chunk as a free block before starting the next one
+            if (pChunkPos != nullptr && pChunkPos != pChunkEnd) {
+                size_t nLeftUnits = (pChunkEnd - pChunkPos) / BLOCK_ALIGN;
+                FreeBlock* pBlock = new (pChunkPos) FreeBlock;
+                pBlock->next = vFreeLists[nLeftUnits];
+                vFreeLists[nLeftUnits] = pBlock;
+            }
+            char* pChunk = static_cast<char*>(::operator new(CHUNK_SIZE));
+            vChunks.push_back(pChunk);
+            pChunkPos = pChunk;
+            pChunkEnd = pChunk + CHUNK_SIZE;
+        }
+
+        void* p = pChunkPos;
+        pChunkPos += nBlockSize;
+        return p;
+    }
+
+    void Deallocate(void* p, size_t bytes, size_t alignment) {
+        if (!IsPooled(bytes, alignment)) {
+            nLargeUsage -= memusage::MallocUsage(bytes);
+            ::operator delete(p);
+            return;
+        }
+
+        size_t nUnits = BlockUnits(bytes);
+        nPooledInUse -= nUnits * BLOCK_ALIGN;
+        FreeBlock* pBlock = new (p) FreeBlock;
+        pBlock->next = vFreeLists[nUnits];
+        vFreeLists[nUnits] = pBlock;
+    }
+
+    //! Memory held by the pool, including unused chunk space and free blocks
+    size_t DynamicMemoryUsage() const {
+        return memusage::MallocUsage(CHUNK_SIZE) * vChunks.size() + memusage::DynamicUsage(vChunks) + nLargeUsage;
+    }
+
+    //! Memory of the allocations not yet returned, free blocks are reused before the pool grows
+    size_t UsedMemoryUsage() const {
+        return nPooledInUse + nLargeUsage;
+    }
+};
+
+/**
+ * Allocator drawing from a PoolResource. A default constructed allocator has
+ * no pool and uses operator new, so containers using it can still be created
+ * anywhere. Copies of a container do not share the pool of the original.
+ */
+template <typename T>
+class pool_allocator
+{
+public:
+    typedef T value_type;
+    typedef std::false_type propagate_on_container_copy_assignment;
+    typedef std::false_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    PoolResource* pool;
+
+    pool_allocator() throw() : pool(nullptr) {}
+    explicit pool_allocator(PoolResource* poolIn) throw() : pool(poolIn) {}
+    template <typename U>
+    pool_allocator(const pool_allocator<U>& a) throw() : pool(a.pool) {}
+
+    template <typename _Other>
+    struct rebind {
+        typedef pool_allocator<_Other> other;
+    };
+
+    T* allocate(std::size_t n)
+    {
+        if (pool == nullptr)
+            return static_cast<T*>(::operator new(n * sizeof(T)));
+        return static_cast<T*>(pool->Allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* p, std::size_t n)
+    {
+        if (pool == nullptr)
+            ::operator delete(p);
+        else
+            pool->Deallocate(p, n * sizeof(T), alignof(T));
+    }
+
+    pool_allocator select_on_container_copy_construction() const
+    {
+        return pool_allocator();
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const pool_allocator<T>& a, const pool_allocator<U>& b)
+{
+    return a.pool == b.pool;
+}
+
+template <typename T, typename U>
+bool operator!=(const pool_allocator<T>& a, const pool_allocator<U>& b)
+{
+    return a.pool != b.pool;
+}
+
+#endif // BITCOIN_SUPPORT_ALLOCATORS_POOL_H
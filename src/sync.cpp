@@ -23,10 +23,94 @@
 #include "utilstrencodings.h"
 
 #include <stdio.h>
+#include <string.h>
 
 #include <boost/foreach.hpp>
 #include <boost/thread.hpp>
 
+thread_local CLockWaitTimes* pLockWaitTimes = NULL;
+
+int64_t LockWaitStart()
+{
+    return GetTimeMicros();
+}
+
+void LockWaitEnd(const char* pszName, int64_t nStart)
+{
+    int64_t nWait = GetTimeMicros() - nStart;
+    // Names are as written at the LOCK, like "cs_main" or "pwalletMain->cs_wallet"
+    if (strstr(pszName, "cs_main") != NULL)
+        pLockWaitTimes->nMainMicros += nWait;
+    else if (strstr(pszName, "cs_wallet") != NULL)
+        pLockWaitTimes->nWalletMicros += nWait;
+    else
+        pLockWaitTimes->nOtherMicros += nWait;
+}
+
+std::atomic<bool> fLockProfile(DEFAULT_LOCKPROFILE);
+
+//! Head of the list of lock sites, pushed on without a lock
+static std::atomic<CLockSite*> pLockSites(NULL);
+
+static void AtomicMax(std::atomic<int64_t>& value, int64_t n)
+{
+    int64_t nPrev = value.load(std::memory_order_relaxed);
+    while (n > nPrev && !value.compare_exchange_weak(nPrev, n, std::memory_order_relaxed))
+        ;
+}
+
+CLockSite::CLockSite(const char* pszNameIn, const char* pszFileIn, int nLineIn) :
+    pszName(pszNameIn), pszFile(pszFileIn), nLine(nLineIn), nAcquisitions(0), nContentions(0),
+    nWaitMicros(0), nMaxWaitMicros(0), nHoldMicros(0), nMaxHoldMicros(0)
+{
+    pnext = pLockSites.load();
+    while (!pLockSites.compare_exchange_weak(pnext, this))
+        ;
+}
+
+int64_t CLockSite::Acquired(int64_t nStart, bool fContended)
+{
+    nAcquisitions.fetch_add(1, std::memory_order_relaxed);
+    if (!fContended)
+        return nStart;
+    int64_t nNow = LockWaitStart();
+    nContentions.fetch_add(1, std::memory_order_relaxed);
+    nWaitMicros.fetch_add(nNow - nStart, std::memory_order_relaxed);
+    AtomicMax(nMaxWaitMicros, nNow - nStart);
+    return nNow;
+}
+
+void CLockSite::Released(int64_t nHoldStart)
+{
+    int64_t nHold = LockWaitStart() - nHoldStart;
+    nHoldMicros.fetch_add(nHold, std::memory_order_relaxed);
+    AtomicMax(nMaxHoldMicros, nHold);
+}
+
+void CLockSite::Reset()
+{
+    nAcquisitions = 0;
+    nContentions = 0;
+    nWaitMicros = 0;
+    nMaxWaitMicros = 0;
+    nHoldMicros = 0;
+    nMaxHoldMicros = 0;
+}
+
+std::vector<const CLockSite*> GetLockSites()
+{
+    std::vector<const CLockSite*> vSites;
+    for (const CLockSite* psite = pLockSites.load(); psite != NULL; psite = psite->pnext)
+        vSites.push_back(psite);
+    return vSites;
+}
+
+void ResetLockSites()
+{
+    for (CLockSite* psite = pLockSites.load(); psite != NULL; psite = psite->pnext)
+        psite->Reset();
+}
+
 #ifdef DEBUG_LOCKCONTENTION
 void PrintLockContention(const char* pszName, const char* pszFile, int nLine)
 {
@@ -23,6 +23,10 @@
 
 #include "threadsafety.h"
 
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+
 #undef __cpuid
 #include <boost/thread/condition_variable.hpp>
 #include <boost/thread/locks.hpp>
@@ -115,24 +119,96 @@ void static inline AssertLockHeldInternal(const char* pszName, const char* pszFi
 void PrintLockContention(const char* pszName, const char* pszFile, int nLine);
 #endif
 
+/**
+ * Time a thread spent blocked on contended locks, in microseconds. Only
+ * collected while pLockWaitTimes is set for the thread, so the RPC server can
+ * tell how long a call waited for cs_main or cs_wallet.
+ */
+struct CLockWaitTimes
+{
+    int64_t nMainMicros;
+    int64_t nWalletMicros;
+    int64_t nOtherMicros;
+
+    CLockWaitTimes() : nMainMicros(0), nWalletMicros(0), nOtherMicros(0) {}
+};
+
+extern thread_local CLockWaitTimes* pLockWaitTimes;
+
+int64_t LockWaitStart();
+//! Adds the wait since nStart to pLockWaitTimes, by the name the lock was taken with
+void LockWaitEnd(const char* pszName, int64_t nStart);
+
+//! Default for -lockprofile
+static const bool DEFAULT_LOCKPROFILE = false;
+
+/**
+ * Contention profile of the locks taken with LOCK, LOCK2 and TRY_LOCK, by
+ * call site. Each site is a static of the function it is in, linked into a
+ * list the first time it runs, so with the profile off a lock only costs one
+ * load more. With fLockProfile on, each acquisition adds the time it waited
+ * when the lock was taken, and the time it was held until its scope ended.
+ */
+struct CLockSite
+{
+    const char* pszName;
+    const char* pszFile;
+    int nLine;
+    std::atomic<uint64_t> nAcquisitions;
+    std::atomic<uint64_t> nContentions;
+    std::atomic<int64_t> nWaitMicros;
+    std::atomic<int64_t> nMaxWaitMicros;
+    std::atomic<int64_t> nHoldMicros;
+    std::atomic<int64_t> nMaxHoldMicros;
+    CLockSite* pnext;
+
+    CLockSite(const char* pszNameIn, const char* pszFileIn, int nLineIn);
+
+    //! Records an acquisition that started at nStart, and returns when the lock was held from
+    int64_t Acquired(int64_t nStart, bool fContended);
+    void Released(int64_t nHoldStart);
+    void Reset();
+};
+
+extern std::atomic<bool> fLockProfile;
+
+//! Sites that took a lock since startup, the most recently registered first
+std::vector<const CLockSite*> GetLockSites();
+void ResetLockSites();
+
 /** Wrapper around boost::unique_lock<Mutex> */
 template <typename Mutex>
 class SCOPED_LOCKABLE CMutexLock
 {
 private:
     boost::unique_lock<Mutex> lock;
+    CLockSite* psite;
+    //! When the profile started timing the hold, -1 if it isn't
+    int64_t nHoldStart;
 
     void Enter(const char* pszName, const char* pszFile, int nLine)
     {
         EnterCritical(pszName, pszFile, nLine, (void*)(lock.mutex()));
-#ifdef DEBUG_LOCKCONTENTION
+        bool fProfile = psite != NULL && fLockProfile.load(std::memory_order_relaxed);
+        int64_t nStart = fProfile ? LockWaitStart() : 0;
         if (!lock.try_lock()) {
+#ifdef DEBUG_LOCKCONTENTION
             PrintLockContention(pszName, pszFile, nLine);
 #endif
-            lock.lock();
-#ifdef DEBUG_LOCKCONTENTION
+            if (pLockWaitTimes == NULL && !fProfile) {
+                lock.lock();
+            } else {
+                if (!fProfile)
+                    nStart = LockWaitStart();
+                lock.lock();
+                if (pLockWaitTimes != NULL)
+                    LockWaitEnd(pszName, nStart);
+                if (fProfile)
+                    nHoldStart = psite->Acquired(nStart, true);
+            }
+        } else if (fProfile) {
+            nHoldStart = psite->Acquired(nStart, false);
         }
-#endif
     }
 
     bool TryEnter(const char* pszName, const char* pszFile, int nLine)
@@ -141,11 +217,13 @@ private:
         lock.try_lock();
         if (!lock.owns_lock())
             LeaveCritical();
+        else if (psite != NULL && fLockProfile.load(std::memory_order_relaxed))
+            nHoldStart = psite->Acquired(LockWaitStart(), false);
         return lock.owns_lock();
     }
 
 public:
-    CMutexLock(Mutex& mutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false) EXCLUSIVE_LOCK_FUNCTION(mutexIn) : lock(mutexIn, boost::defer_lock)
+    CMutexLock(Mutex& mutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false, CLockSite* psiteIn = NULL) EXCLUSIVE_LOCK_FUNCTION(mutexIn) : lock(mutexIn, boost::defer_lock), psite(psiteIn), nHoldStart(-1)
     {
         if (fTry)
             TryEnter(pszName, pszFile, nLine);
@@ -153,7 +231,7 @@ public:
             Enter(pszName, pszFile, nLine);
     }
 
-    CMutexLock(Mutex* pmutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false) EXCLUSIVE_LOCK_FUNCTION(pmutexIn)
+    CMutexLock(Mutex* pmutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false, CLockSite* psiteIn = NULL) EXCLUSIVE_LOCK_FUNCTION(pmutexIn) : psite(psiteIn), nHoldStart(-1)
     {
         if (!pmutexIn) return;
 
@@ -166,8 +244,11 @@ public:
 
     ~CMutexLock() UNLOCK_FUNCTION()
     {
-        if (lock.owns_lock())
+        if (lock.owns_lock()) {
             LeaveCritical();
+            if (nHoldStart >= 0)
+                psite->Released(nHoldStart);
+        }
     }
 
     operator bool()
@@ -178,9 +259,15 @@ public:
 
 typedef CMutexLock<CCriticalSection> CCriticalBlock;
 
-#define LOCK(cs) CCriticalBlock criticalblock(cs, #cs, __FILE__, __LINE__)
-#define LOCK2(cs1, cs2) CCriticalBlock criticalblock1(cs1, #cs1, __FILE__, __LINE__), criticalblock2(cs2, #cs2, __FILE__, __LINE__)
-#define TRY_LOCK(cs, name) CCriticalBlock name(cs, #cs, __FILE__, __LINE__, true)
+#define LOCK(cs)                                           \
+    static CLockSite locksite(#cs, __FILE__, __LINE__); \
+    CCriticalBlock criticalblock(cs, #cs, __FILE__, __LINE__, false, &locksite)
+#define LOCK2(cs1, cs2)                                                                            \
+    static CLockSite locksite1(#cs1, __FILE__, __LINE__), locksite2(#cs2, __FILE__, __LINE__); \
+    CCriticalBlock criticalblock1(cs1, #cs1, __FILE__, __LINE__, false, &locksite1), criticalblock2(cs2, #cs2, __FILE__, __LINE__, false, &locksite2)
+#define TRY_LOCK(cs, name)                                      \
+    static CLockSite name##_locksite(#cs, __FILE__, __LINE__); \
+    CCriticalBlock name(cs, #cs, __FILE__, __LINE__, true, &name##_locksite)
 
 #define ENTER_CRITICAL_SECTION(cs)                            \
     {                                                         \
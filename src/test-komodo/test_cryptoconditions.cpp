@@ -133,6 +133,45 @@ TEST_F(CCTest, testVerifyCryptoCondition)
     ASSERT_FALSE(CCVerify(mtxTo, cond));
 }
 
+static bool CCVerifyStore(const CMutableTransaction &mtxTo, const CC *cond, bool store) {
+    CAmount amount;
+    ScriptError error;
+    CTransaction txTo(mtxTo);
+    PrecomputedTransactionData txdata(txTo);
+    auto checker = ServerTransactionSignatureChecker(&txTo, 0, amount, store, txdata);
+    return VerifyScript(CCSig(cond), CCPubKey(cond), 0, checker, 0, &error);
+};
+
+
+TEST_F(CCTest, testVerifyCachedSignatures)
+{
+    CMutableTransaction mtxTo;
+    CKey otherKey;
+    otherKey.MakeNewKey(true);
+
+    // 1 of 2 signed by the notary key, the other node is pruned to a condition
+    CC *cond = CCNewThreshold(1, { CCNewSecp256k1(notaryKey.GetPubKey()), CCNewSecp256k1(otherKey.GetPubKey()) });
+    CCSign(mtxTo, cond);
+    ASSERT_TRUE(CCVerifyStore(mtxTo, cond, false));
+    // stored, then found in the cache
+    ASSERT_TRUE(CCVerifyStore(mtxTo, cond, true));
+    ASSERT_TRUE(CCVerifyStore(mtxTo, cond, true));
+    ASSERT_TRUE(CCVerifyStore(mtxTo, cond, false));
+
+    // a cached signature is not valid for another transaction
+    CMutableTransaction mtxOther = mtxTo;
+    mtxOther.nLockTime = 1;
+    ASSERT_FALSE(CCVerifyStore(mtxOther, cond, true));
+
+    // nor once changed
+    uint8_t *sig = cond->subconditions[0]->signature;
+    sig[10] ^= 1;
+    ASSERT_FALSE(CCVerifyStore(mtxTo, cond, false));
+    ASSERT_FALSE(CCVerifyStore(mtxTo, cond, true));
+    sig[10] ^= 1;
+    ASSERT_TRUE(CCVerifyStore(mtxTo, cond, false));
+}
+
 extern Eval* EVAL_TEST;
 
 TEST_F(CCTest, testVerifyEvalCondition)
@@ -518,4 +518,48 @@ BOOST_AUTO_TEST_CASE(caddrinfo_get_new_bucket)
     //  than 64 buckets.
     BOOST_CHECK(buckets.size() > 64);
 }
+
+BOOST_AUTO_TEST_CASE(addrman_recently_good)
+{
+    CAddrManTest addrman;
+    CNetAddr source = CNetAddr("252.2.2.2");
+
+    CService addr1 = CService("250.1.1.1", 8333);
+    CService addr2 = CService("250.2.2.2", 8333);
+    CService addr3 = CService("250.3.3.3", 8333);
+    addrman.Add(CAddress(addr1), source);
+    addrman.Add(CAddress(addr2), source);
+    addrman.Add(CAddress(addr3), source);
+    int64_t nNow = GetTime();
+    addrman.Good(addr1, nNow - 100);
+    addrman.Good(addr2, nNow);
+
+    // Only tried addresses, the last connected first
+    std::vector<CAddress> vGood = addrman.GetRecentlyGood(5);
+    BOOST_CHECK_EQUAL(vGood.size(), 2U);
+    BOOST_CHECK(vGood[0] == addr2);
+    BOOST_CHECK(vGood[1] == addr1);
+    BOOST_CHECK_EQUAL(addrman.GetRecentlyGood(1).size(), 1U);
+}
+
+BOOST_AUTO_TEST_CASE(addrman_replace)
+{
+    CAddrManTest addrman, loaded;
+    CNetAddr source = CNetAddr("252.2.2.2");
+
+    CService addrHot = CService("250.1.1.1", 8333);
+    addrman.Add(CAddress(addrHot), source);
+    addrman.Good(addrHot);
+    for (int i = 1; i < 10; i++)
+        loaded.Add(CAddress(CService("251." + boost::to_string(i) + ".1.1", 8333)), source);
+
+    // The loaded addresses are taken over and ours are kept, with their tried state
+    addrman.Replace(loaded);
+    BOOST_CHECK_EQUAL(addrman.size(), 10U);
+    std::vector<CAddress> vGood = addrman.GetRecentlyGood(5);
+    BOOST_CHECK_EQUAL(vGood.size(), 1U);
+    BOOST_CHECK(vGood[0] == addrHot);
+    BOOST_CHECK(addrman.Find(CNetAddr("251.5.1.1")) != NULL);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -4,6 +4,7 @@
 
 #include "util.h"
 
+#include "support/allocators/pool.h"
 #include "support/allocators/secure.h"
 #include "test/test_bitcoin.h"
 
@@ -117,4 +118,38 @@ BOOST_AUTO_TEST_CASE(test_LockedPageManagerBase)
     BOOST_CHECK((last_unlock_len & (test_page_size-1)) == 0); // always unlock entire pages
 }
 
+BOOST_AUTO_TEST_CASE(pool_resource_reuse)
+{
+    PoolResource pool;
+    BOOST_CHECK_EQUAL(pool.DynamicMemoryUsage(), 0);
+
+    std::vector<void*> vBlocks;
+    for (int i = 0; i < 1000; i++) {
+        void* p = pool.Allocate(40, 8);
+        memset(p, i % 256, 40);
+        vBlocks.push_back(p);
+    }
+    size_t nUsage = pool.DynamicMemoryUsage();
+    BOOST_CHECK(nUsage >= memusage::MallocUsage(PoolResource::CHUNK_SIZE));
+
+    // Freed blocks are handed out again without growing the pool
+    for (void* p : vBlocks) {
+        pool.Deallocate(p, 40, 8);
+    }
+    for (int i = 0; i < 1000; i++) {
+        vBlocks[i] = pool.Allocate(40, 8);
+    }
+    BOOST_CHECK_EQUAL(pool.DynamicMemoryUsage(), nUsage);
+
+    // Large allocations bypass the chunks but are counted
+    void* pLarge = pool.Allocate(PoolResource::MAX_BLOCK_SIZE + 1, 8);
+    BOOST_CHECK_EQUAL(pool.DynamicMemoryUsage(), nUsage + memusage::MallocUsage(PoolResource::MAX_BLOCK_SIZE + 1));
+    pool.Deallocate(pLarge, PoolResource::MAX_BLOCK_SIZE + 1, 8);
+    BOOST_CHECK_EQUAL(pool.DynamicMemoryUsage(), nUsage);
+
+    for (void* p : vBlocks) {
+        pool.Deallocate(p, 40, 8);
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,67 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "amqp/amqpnotificationinterface.h"
+#include "arith_uint256.h"
+#include "chain.h"
+#include "utiltime.h"
+#include "validationinterface.h"
+
+#include "test/test_bitcoin.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(amqp_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(amqp_stalled_broker_load)
+{
+    // Nothing listens on port 1, so the publisher keeps reconnecting as it would to a broker that is down
+    std::map<std::string, std::string> args;
+    args["-amqppubhashblock"] = "amqp://127.0.0.1:1/blocks";
+    args["-amqpqueuesize"] = "100";
+    AMQPNotificationInterface* amqp = AMQPNotificationInterface::CreateWithArguments(args);
+    BOOST_REQUIRE(amqp);
+    RegisterAsyncValidationInterface(amqp);
+    StartValidationInterfaceQueue();
+
+    std::vector<uint256> vHash(10000);
+    std::vector<CBlockIndex> vIndex(vHash.size());
+    for (size_t i = 0; i < vIndex.size(); i++) {
+        vHash[i] = ArithToUint256(arith_uint256(i));
+        vIndex[i].phashBlock = &vHash[i];
+    }
+
+    int64_t nStart = GetTimeMicros();
+    int64_t nMaxSignalMicros = 0;
+    for (const CBlockIndex& index : vIndex) {
+        int64_t nSignal = GetTimeMicros();
+        GetMainSignals().UpdatedBlockTip(&index);
+        nMaxSignalMicros = std::max(nMaxSignalMicros, GetTimeMicros() - nSignal);
+    }
+    SyncWithValidationInterfaceQueue();
+    int64_t nElapsed = GetTimeMicros() - nStart;
+
+    // Neither the signalling thread nor the publisher waits on the connection,
+    // which would take the reconnect backoff or the idle timeout
+    BOOST_CHECK(nMaxSignalMicros < 100 * 1000);
+    BOOST_CHECK(nElapsed < 2 * 1000 * 1000);
+
+    std::vector<AMQPSenderStats> vStats = GetAMQPSenderStats();
+    BOOST_REQUIRE_EQUAL(vStats.size(), 1);
+    BOOST_CHECK(!vStats[0].fConnected);
+    BOOST_CHECK_EQUAL(vStats[0].nSent, 0);
+    BOOST_CHECK_EQUAL(vStats[0].nQueued, 100);
+    BOOST_CHECK_EQUAL(vStats[0].nDropped, vIndex.size() - 100);
+
+    StopValidationInterfaceQueue();
+    UnregisterAsyncValidationInterface(amqp);
+    delete amqp;
+    BOOST_CHECK(GetAMQPSenderStats().empty());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
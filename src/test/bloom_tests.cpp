@@ -5,6 +5,7 @@
 #include "bloom.h"
 
 #include "clientversion.h"
+#include "hash.h"
 #include "key.h"
 #include "key_io.h"
 #include "merkleblock.h"
@@ -179,6 +180,37 @@ BOOST_AUTO_TEST_CASE(bloom_match)
     BOOST_CHECK_MESSAGE(!filter.IsRelevantAndUpdate(tx), "Simple Bloom filter matched COutPoint for an output we didn't care about");
 }
 
+BOOST_AUTO_TEST_CASE(bloom_match_elements)
+{
+    // More hash functions than lanes, and a tweak, so the seeds of every lane count
+    CBloomFilter filter(20, 0.000001, 2147483649UL, BLOOM_UPDATE_ALL);
+    CBloomFilter sparse(1000, 0.01, 5, BLOOM_UPDATE_NONE);
+    for (unsigned int nSize = 1; nSize <= 41; nSize += 2)
+    {
+        vector<unsigned char> data(nSize);
+        GetRandBytes(data.data(), data.size());
+        filter.insert(data);
+        sparse.insert(data);
+        BOOST_CHECK(filter.contains(CBloomElement(data.data(), data.data() + data.size())));
+        BOOST_CHECK(sparse.contains(CBloomElement(data.data(), data.data() + data.size())));
+    }
+    // Other elements of every length of block and tail match as the bytes do
+    for (unsigned int nSize = 1; nSize <= 64; nSize++)
+    {
+        vector<unsigned char> data(nSize);
+        GetRandBytes(data.data(), data.size());
+        CBloomElement element(data.data(), data.data() + data.size());
+        uint32_t vHashes[BLOOM_HASH_LANES];
+        for (unsigned int i = 0; i < BLOOM_HASH_LANES; i++)
+            vHashes[i] = i * 0xFBA4C795 + nSize;
+        element.Hash(vHashes, BLOOM_HASH_LANES);
+        for (unsigned int i = 0; i < BLOOM_HASH_LANES; i++)
+            BOOST_CHECK_EQUAL(vHashes[i], MurmurHash3(i * 0xFBA4C795 + nSize, data));
+        BOOST_CHECK_EQUAL(filter.contains(element), filter.contains(data));
+        BOOST_CHECK_EQUAL(sparse.contains(element), sparse.contains(data));
+    }
+}
+
 BOOST_AUTO_TEST_CASE(merkle_block_1)
 {
     // Random real block (0000000000013b8ab2cd513b0261a14096412195a72a0c4827d229dcc7e0f7af)
@@ -534,4 +566,29 @@ BOOST_AUTO_TEST_CASE(rolling_bloom)
     }
 }
 
+BOOST_AUTO_TEST_CASE(scalable_bloom)
+{
+    // Start small so the filter has to grow several times
+    CScalableBloomFilter filter(100, 0.01);
+    std::vector<uint256> vInserted;
+    for (int i = 0; i < 5000; i++) {
+        vInserted.push_back(GetRandHash());
+        filter.insert(vInserted.back());
+    }
+    BOOST_CHECK_EQUAL(filter.size(), 5000);
+
+    // No false negatives, also for keys inserted into earlier layers
+    for (const uint256& key : vInserted) {
+        BOOST_CHECK(filter.contains(key));
+    }
+
+    int nFalsePositives = 0;
+    for (int i = 0; i < 10000; i++) {
+        if (filter.contains(GetRandHash()))
+            nFalsePositives++;
+    }
+    // Expect below 100 (1%)
+    BOOST_CHECK(nFalsePositives < 150);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -16,6 +16,8 @@
 
 #include <vector>
 #include <map>
+#include <condition_variable>
+#include <mutex>
 
 #include <boost/test/unit_test.hpp>
 #include "zcash/IncrementalMerkleTree.hpp"
@@ -192,6 +194,50 @@ public:
     bool GetStats(CCoinsStats& stats) const { return false; }
 };
 
+//! Holds writes until opened, like a slow database, leaving the passed maps unchanged
+class CCoinsViewGatedTest : public CCoinsViewTest
+{
+    std::mutex mutex;
+    std::condition_variable cond;
+    bool fOpen;
+
+public:
+    CCoinsViewGatedTest() : fOpen(true) {}
+
+    void Close() {
+        std::unique_lock<std::mutex> lock(mutex);
+        fOpen = false;
+    }
+
+    void Open() {
+        std::unique_lock<std::mutex> lock(mutex);
+        fOpen = true;
+        cond.notify_all();
+    }
+
+    bool BatchWrite(CCoinsMap& mapCoins,
+                    const uint256& hashBlock,
+                    const uint256& hashSproutAnchor,
+                    const uint256& hashSaplingAnchor,
+                    CAnchorsSproutMap& mapSproutAnchors,
+                    CAnchorsSaplingMap& mapSaplingAnchors,
+                    CNullifiersMap& mapSproutNullifiers,
+                    CNullifiersMap& mapSaplingNullifiers)
+    {
+        CCoinsMap coins(mapCoins);
+        CAnchorsSproutMap sproutAnchors(mapSproutAnchors);
+        CAnchorsSaplingMap saplingAnchors(mapSaplingAnchors);
+        CNullifiersMap sproutNullifiers(mapSproutNullifiers);
+        CNullifiersMap saplingNullifiers(mapSaplingNullifiers);
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cond.wait(lock, [this]() { return fOpen; });
+        }
+        return CCoinsViewTest::BatchWrite(coins, hashBlock, hashSproutAnchor, hashSaplingAnchor,
+                                          sproutAnchors, saplingAnchors, sproutNullifiers, saplingNullifiers);
+    }
+};
+
 class CCoinsViewCacheTest : public CCoinsViewCache
 {
 public:
@@ -200,11 +246,7 @@ public:
     void SelfTest() const
     {
         // Manually recompute the dynamic usage of the whole data, and compare it.
-        size_t ret = memusage::DynamicUsage(cacheCoins) +
-                     memusage::DynamicUsage(cacheSproutAnchors) +
-                     memusage::DynamicUsage(cacheSaplingAnchors) +
-                     memusage::DynamicUsage(cacheSproutNullifiers) +
-                     memusage::DynamicUsage(cacheSaplingNullifiers);
+        size_t ret = cachePool.DynamicMemoryUsage();
         for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end(); it++) {
             ret += it->second.coins.DynamicMemoryUsage();
         }
@@ -595,6 +637,59 @@ BOOST_AUTO_TEST_CASE(anchors_flush_test)
     }
 }
 
+BOOST_AUTO_TEST_CASE(async_flush_test)
+{
+    CCoinsViewGatedTest base;
+    CCoinsViewAsyncFlush async(&base);
+    TxWithNullifiers txWithNullifiers;
+    uint256 txid = GetRandHash();
+    uint256 hashBlock = GetRandHash();
+
+    base.Close();
+    {
+        CCoinsViewCacheTest cache(&async);
+        {
+            CCoinsModifier coins = cache.ModifyCoins(txid);
+            coins->vout.resize(1);
+            coins->vout[0].nValue = 1;
+        }
+        cache.SetNullifiers(txWithNullifiers.tx, true);
+        cache.SetBestBlock(hashBlock);
+        BOOST_CHECK(cache.Flush());
+    }
+
+    // While the write is held the frozen entries are served
+    BOOST_CHECK(async.HaveCoins(txid));
+    BOOST_CHECK(!base.HaveCoins(txid));
+    BOOST_CHECK(async.GetNullifier(txWithNullifiers.sproutNullifier, SPROUT));
+    BOOST_CHECK(async.GetNullifier(txWithNullifiers.saplingNullifier, SAPLING));
+    BOOST_CHECK(async.GetBestBlock() == hashBlock);
+
+    base.Open();
+    BOOST_CHECK(async.Sync());
+    BOOST_CHECK(base.HaveCoins(txid));
+    BOOST_CHECK(base.GetNullifier(txWithNullifiers.saplingNullifier, SAPLING));
+    BOOST_CHECK(base.GetBestBlock() == hashBlock);
+
+    // A spend is not visible in the base view until written
+    base.Close();
+    {
+        CCoinsViewCacheTest cache(&async);
+        cache.ModifyCoins(txid)->Clear();
+        cache.SetNullifiers(txWithNullifiers.tx, false);
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK(!async.HaveCoins(txid));
+    BOOST_CHECK(base.HaveCoins(txid));
+    BOOST_CHECK(!async.GetNullifier(txWithNullifiers.sproutNullifier, SPROUT));
+
+    base.Open();
+    BOOST_CHECK(async.Sync());
+    CCoins coins;
+    BOOST_CHECK(!base.GetCoins(txid, coins) || coins.IsPruned());
+    BOOST_CHECK(!base.GetNullifier(txWithNullifiers.sproutNullifier, SPROUT));
+}
+
 BOOST_AUTO_TEST_CASE(chained_joinsplits)
 {
     // TODO update this or add a similar test when the SaplingNote class exist
@@ -2,7 +2,9 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "blockcompress.h"
 #include "compressor.h"
+#include "random.h"
 #include "util.h"
 #include "test/test_bitcoin.h"
 
@@ -62,4 +64,60 @@ BOOST_AUTO_TEST_CASE(compress_amounts)
         BOOST_CHECK(TestDecode(i));
 }
 
+//! Record of random fields between strings common to all records
+static std::vector<char> MakeRecord(const std::string& strCommon)
+{
+    std::vector<char> vRecord;
+    for (int i = 0; i < 20; i++) {
+        unsigned char random[32];
+        GetRandBytes(random, sizeof(random));
+        vRecord.insert(vRecord.end(), random, random + sizeof(random));
+        vRecord.insert(vRecord.end(), strCommon.begin(), strCommon.end());
+    }
+    return vRecord;
+}
+
+BOOST_AUTO_TEST_CASE(compress_records)
+{
+    const std::string strCommon = "\x76\xa9\x14 common script template and transaction fields \x88\xac";
+    std::vector<std::vector<char> > vSamples;
+    for (int i = 0; i < 16; i++)
+        vSamples.push_back(MakeRecord(strCommon));
+    std::vector<unsigned char> vDict, vNoDict;
+    BOOST_CHECK(TrainBlockDictionary(vSamples, vDict));
+    BOOST_CHECK(!vDict.empty() && vDict.size() <= MAX_BLOCK_DICTIONARY_SIZE);
+
+    // Random records share nothing to train on
+    std::vector<std::vector<char> > vRandom(16, std::vector<char>(1000));
+    for (std::vector<char>& sample : vRandom)
+        GetRandBytes((unsigned char*)&sample[0], sample.size());
+    std::vector<unsigned char> vRandomDict;
+    BOOST_CHECK(!TrainBlockDictionary(vRandom, vRandomDict));
+
+    std::vector<char> vRecord = MakeRecord(strCommon), vPlain, vWithDict, vRaw;
+    BOOST_CHECK(!IsCompressedRecord(&vRecord[0], vRecord.size()));
+    BOOST_CHECK(CompressRecord(&vRecord[0], vRecord.size(), 6, 0, vNoDict, vPlain));
+    BOOST_CHECK(CompressRecord(&vRecord[0], vRecord.size(), 6, 7, vDict, vWithDict));
+    BOOST_CHECK(IsCompressedRecord(&vWithDict[0], vWithDict.size()));
+    BOOST_CHECK_EQUAL(GetRecordDictionaryId(&vWithDict[0]), 7U);
+    BOOST_CHECK(vWithDict.size() < vPlain.size());
+
+    BOOST_CHECK_EQUAL(DecompressRecord(&vPlain[0], vPlain.size(), vNoDict, vRaw), vPlain.size());
+    BOOST_CHECK(vRaw == vRecord);
+    // Bytes after the frame, like the checksum of undo data, are not part of it
+    std::vector<char> vTrailed = vWithDict;
+    vTrailed.resize(vTrailed.size() + 32);
+    BOOST_CHECK_EQUAL(DecompressRecord(&vTrailed[0], vTrailed.size(), vDict, vRaw), vWithDict.size());
+    BOOST_CHECK(vRaw == vRecord);
+
+    // A missing or wrong dictionary and a corrupt or truncated stream are caught
+    BOOST_CHECK_THROW(DecompressRecord(&vWithDict[0], vWithDict.size(), vNoDict, vRaw), std::ios_base::failure);
+    std::vector<unsigned char> vWrongDict(vRandom[0].begin(), vRandom[0].end());
+    BOOST_CHECK_THROW(DecompressRecord(&vWithDict[0], vWithDict.size(), vWrongDict, vRaw), std::ios_base::failure);
+    std::vector<char> vCorrupt = vPlain;
+    vCorrupt[vCorrupt.size() / 2] ^= 0x55;
+    BOOST_CHECK_THROW(DecompressRecord(&vCorrupt[0], vCorrupt.size(), vNoDict, vRaw), std::ios_base::failure);
+    BOOST_CHECK_THROW(DecompressRecord(&vPlain[0], vPlain.size() - 1, vNoDict, vRaw), std::ios_base::failure);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -8,6 +8,9 @@
 #include "crypto/sha512.h"
 #include "crypto/hmac_sha256.h"
 #include "crypto/hmac_sha512.h"
+#include "crypto/muhash.h"
+#include "crypto/verus_hash.h"
+#include "hash.h"
 #include "random.h"
 #include "utilstrencodings.h"
 #include "test/test_bitcoin.h"
@@ -248,4 +251,98 @@ BOOST_AUTO_TEST_CASE(hmac_sha512_testvectors) {
                    "b6022cac3c4982b10d5eeb55c3e4de15134676fb6de0446065c97440fa8c6a58");
 }
 
+BOOST_AUTO_TEST_CASE(sha256d64)
+{
+    // Counts around the 8, 4 and 2 way kernels, so every combination of them is used
+    for (int n = 0; n <= 34; n++) {
+        std::vector<unsigned char> in(64 * n), out(32 * n);
+        for (int i = 0; i < 64 * n; i++) {
+            in[i] = insecure_rand() & 0xff;
+        }
+        SHA256D64(out.data(), in.data(), n);
+        for (int i = 0; i < n; i++) {
+            uint256 expected = Hash(in.begin() + 64 * i, in.begin() + 64 * (i + 1));
+            BOOST_CHECK(memcmp(out.data() + 32 * i, expected.begin(), 32) == 0);
+        }
+    }
+}
+
+static uint256 FinalizeMuHash(const MuHash3072& muhash)
+{
+    uint256 hash;
+    muhash.Finalize(hash.begin());
+    return hash;
+}
+
+BOOST_AUTO_TEST_CASE(muhash)
+{
+    unsigned char vElements[3][32];
+    for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 32; j++)
+            vElements[i][j] = insecure_rand() & 0xff;
+
+    // The hash only depends on the set, not on the order of the updates
+    MuHash3072 a, b;
+    a.Insert(vElements[0], 32).Insert(vElements[1], 32);
+    b.Insert(vElements[2], 32).Insert(vElements[1], 32).Insert(vElements[0], 32).Remove(vElements[2], 32);
+    BOOST_CHECK(FinalizeMuHash(a) == FinalizeMuHash(b));
+    BOOST_CHECK(FinalizeMuHash(a) != FinalizeMuHash(MuHash3072()));
+
+    MuHash3072 c;
+    c.Insert(vElements[0], 32).Remove(vElements[0], 32);
+    BOOST_CHECK(FinalizeMuHash(c) == FinalizeMuHash(MuHash3072()));
+
+    // Sets combine by multiplication
+    MuHash3072 d, e;
+    d.Insert(vElements[0], 32);
+    e.Insert(vElements[1], 32);
+    d *= e;
+    BOOST_CHECK(FinalizeMuHash(d) == FinalizeMuHash(a));
+
+    unsigned char vBytes[MuHash3072::SERIALIZED_SIZE];
+    b.ToBytes(vBytes);
+    MuHash3072 f;
+    f.FromBytes(vBytes);
+    BOOST_CHECK(FinalizeMuHash(f) == FinalizeMuHash(a));
+
+    Num3072 x(vBytes), y = x.GetInverse();
+    y.Multiply(x);
+    unsigned char vOne[Num3072::BYTE_SIZE];
+    y.ToBytes(vOne);
+    BOOST_CHECK(vOne[0] == 1);
+    for (size_t i = 1; i < Num3072::BYTE_SIZE; i++)
+        BOOST_CHECK(vOne[i] == 0);
+}
+
+BOOST_AUTO_TEST_CASE(verushash_extra_batch)
+{
+    CVerusHash::init();
+    CVerusHashV2::init();
+
+    std::vector<unsigned char> data(100);
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = insecure_rand() & 0xff;
+    }
+    CVerusHash vh;
+    vh.Write(data.data(), data.size());
+    vh.ClearExtra();
+    CVerusHashV2 vh2;
+    vh2.Write(data.data(), data.size());
+    vh2.ClearExtra();
+
+    const int64_t nonce = 0x12345678;
+    alignas(16) unsigned char hashes[VERUSHASH_EXTRA_BATCH * 32], hashes2[VERUSHASH_EXTRA_BATCH * 32];
+    vh.ExtraHashBatch(hashes, nonce);
+    vh2.ExtraHashBatch(hashes2, nonce);
+    for (int i = 0; i < VERUSHASH_EXTRA_BATCH; i++) {
+        unsigned char expected[32];
+        *vh.ExtraI64Ptr() = nonce + i;
+        vh.ExtraHash(expected);
+        BOOST_CHECK(memcmp(hashes + 32 * i, expected, 32) == 0);
+        *vh2.ExtraI64Ptr() = nonce + i;
+        vh2.ExtraHash(expected);
+        BOOST_CHECK(memcmp(hashes2 + 32 * i, expected, 32) == 0);
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
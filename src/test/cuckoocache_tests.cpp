@@ -0,0 +1,68 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "cuckoocache.h"
+
+#include "random.h"
+#include "test/test_bitcoin.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(cuckoocache_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(cuckoocache_insert_contains)
+{
+    CCuckooCache cache(1000);
+    std::vector<uint256> keys;
+    for (int i = 0; i < 500; i++) {
+        keys.push_back(GetRandHash());
+        cache.Insert(keys.back());
+    }
+    // Half full, every key finds a free slot
+    for (const uint256& key : keys)
+        BOOST_CHECK(cache.Contains(key));
+    BOOST_CHECK(!cache.Contains(GetRandHash()));
+    BOOST_CHECK(!cache.Contains(uint256()));
+}
+
+BOOST_AUTO_TEST_CASE(cuckoocache_full)
+{
+    CCuckooCache cache(1000);
+    std::vector<uint256> keys;
+    for (int i = 0; i < 4000; i++) {
+        keys.push_back(GetRandHash());
+        cache.Insert(keys.back());
+    }
+    // The table holds at most its size, and nearly fills before dropping keys
+    int nFound = 0;
+    for (const uint256& key : keys)
+        nFound += cache.Contains(key) ? 1 : 0;
+    BOOST_CHECK(nFound <= 1000);
+    BOOST_CHECK(nFound >= 900);
+    BOOST_CHECK_EQUAL(cache.Size(), nFound);
+    BOOST_CHECK_EQUAL(cache.Capacity(), 1000);
+}
+
+BOOST_AUTO_TEST_CASE(cuckoocache_disabled)
+{
+    CCuckooCache cache(0);
+    uint256 key = GetRandHash();
+    cache.Insert(key);
+    BOOST_CHECK(!cache.Contains(key));
+}
+
+BOOST_AUTO_TEST_CASE(cuckoocache_salted_keys)
+{
+    // The same data gives other keys in another cache
+    CCuckooCache cache1(10), cache2(10);
+    const unsigned char data[] = "data";
+    uint256 key1, key2;
+    cache1.Hasher().Write(data, sizeof(data)).Finalize(key1.begin());
+    cache2.Hasher().Write(data, sizeof(data)).Finalize(key2.begin());
+    BOOST_CHECK(key1 != key2);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
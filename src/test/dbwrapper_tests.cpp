@@ -67,7 +67,12 @@ BOOST_AUTO_TEST_CASE(dbwrapper_batch)
         // Remove key3 before it's even been written
         batch.Erase(key3);
 
+        // Each write is a type byte, two length bytes, the key and the value
+        BOOST_CHECK_EQUAL(batch.SizeEstimate(), 3 * (3 + 1 + 32) + (2 + 1));
+
         dbw.WriteBatch(batch);
+        batch.Clear();
+        BOOST_CHECK_EQUAL(batch.SizeEstimate(), 0);
 
         BOOST_CHECK(dbw.Read(key, res));
         BOOST_CHECK_EQUAL(res.ToString(), in.ToString());
@@ -258,4 +258,31 @@ BOOST_AUTO_TEST_CASE(zs_address_test)
     }
 }
 
+BOOST_AUTO_TEST_CASE(address_encoding_cache)
+{
+    // Encoded addresses are cached, the same bytes on another network still give its own encoding
+    std::vector<unsigned char, secure_allocator<unsigned char>> rawSeed(32);
+    HDSeed seed(rawSeed);
+    auto addr = libzcash::SaplingExtendedSpendingKey::Master(seed).DefaultAddress();
+    CKeyID keyid(uint160(ParseHex("8ba0e1e9e5ce6aa28b2fd13d1e1c251c1f1b0b4f")));
+
+    SelectParams(CBaseChainParams::REGTEST);
+    std::string zRegtest = EncodePaymentAddress(addr);
+    std::string tRegtest = EncodeDestination(keyid);
+    BOOST_CHECK_EQUAL(EncodePaymentAddress(addr), zRegtest);
+    BOOST_CHECK_EQUAL(EncodeDestination(keyid), tRegtest);
+
+    SelectParams(CBaseChainParams::MAIN);
+    std::string zMain = EncodePaymentAddress(addr);
+    BOOST_CHECK(zMain.compare(0, Params().Bech32HRP(CChainParams::SAPLING_PAYMENT_ADDRESS).size(), Params().Bech32HRP(CChainParams::SAPLING_PAYMENT_ADDRESS)) == 0);
+    BOOST_CHECK(zMain != zRegtest);
+    BOOST_CHECK(boost::get<SaplingPaymentAddress>(DecodePaymentAddress(zMain)) == addr);
+    std::string tMain = EncodeDestination(keyid);
+    BOOST_CHECK(boost::get<CKeyID>(DecodeDestination(tMain)) == keyid);
+
+    SelectParams(CBaseChainParams::REGTEST);
+    BOOST_CHECK_EQUAL(EncodePaymentAddress(addr), zRegtest);
+    SelectParams(CBaseChainParams::MAIN);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -3,7 +3,10 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "chainparams.h"
+#include "compactblockindex.h"
+#include "kvindex.h"
 #include "main.h"
+#include "txdb.h"
 
 #include "test/test_bitcoin.h"
 
@@ -101,4 +104,180 @@ BOOST_AUTO_TEST_CASE(test_combiner_all)
     BOOST_CHECK(Test());
 }
 
+BOOST_AUTO_TEST_CASE(chain_tip_snapshot)
+{
+    std::vector<CBlockIndex> vBlocks(20);
+    for (size_t i = 0; i < vBlocks.size(); i++) {
+        vBlocks[i].SetHeight(i);
+        vBlocks[i].pprev = i ? &vBlocks[i - 1] : NULL;
+        vBlocks[i].BuildSkip();
+    }
+    // A fork off block 9
+    CBlockIndex fork;
+    fork.SetHeight(10);
+    fork.pprev = &vBlocks[9];
+    fork.BuildSkip();
+
+    CChainTipSnapshot empty;
+    BOOST_CHECK(empty[0] == NULL);
+    BOOST_CHECK(!empty.Contains(&vBlocks[0]));
+
+    CChainTipSnapshot snapshot;
+    snapshot.pindexTip = &vBlocks[15];
+    snapshot.nHeight = 15;
+    BOOST_CHECK(snapshot[0] == &vBlocks[0]);
+    BOOST_CHECK(snapshot[7] == &vBlocks[7]);
+    BOOST_CHECK(snapshot[15] == &vBlocks[15]);
+    BOOST_CHECK(snapshot[16] == NULL);
+    BOOST_CHECK(snapshot[-1] == NULL);
+    BOOST_CHECK(snapshot.Contains(&vBlocks[10]));
+    BOOST_CHECK(!snapshot.Contains(&vBlocks[16]));
+    BOOST_CHECK(!snapshot.Contains(&fork));
+    BOOST_CHECK(!snapshot.Contains(NULL));
+}
+
+BOOST_AUTO_TEST_CASE(trimmed_solution_read_back)
+{
+    CBlockHeader header;
+    header.nTime = 1234;
+    header.nSolution.assign(1344, 0x5a);
+    uint256 hash = header.GetHash();
+    CBlockIndex index(header);
+    index.phashBlock = &hash;
+
+    std::vector<std::pair<int, const CBlockFileInfo*> > vFiles;
+    std::vector<const CBlockIndex*> vBlocks(1, &index);
+    BOOST_REQUIRE(pblocktree->WriteBatchSync(vFiles, 0, vBlocks));
+
+    index.TrimSolution();
+    BOOST_CHECK(!index.HasSolution());
+    BOOST_CHECK(index.nSolution.empty());
+    BOOST_CHECK(index.GetSolution() == header.nSolution);
+    BOOST_CHECK(index.GetBlockHeader().GetHash() == hash);
+    // Written again, the entry still has its solution on disk
+    BOOST_CHECK(CDiskBlockIndex(&index).GetBlockHash() == hash);
+}
+
+BOOST_AUTO_TEST_CASE(skip_pointers_audit)
+{
+    std::vector<CBlockIndex> vBlocks(1000);
+    for (size_t i = 0; i < vBlocks.size(); i++) {
+        vBlocks[i].SetHeight(i);
+        vBlocks[i].pprev = i ? &vBlocks[i - 1] : NULL;
+        vBlocks[i].BuildSkip();
+    }
+    for (const CBlockIndex& index : vBlocks)
+        BOOST_CHECK(index.HasValidSkip());
+    // Falling back to pprev still finds ancestors, but the audit catches it
+    vBlocks[500].pskip = vBlocks[500].pprev;
+    BOOST_CHECK(!vBlocks[500].HasValidSkip());
+    BOOST_CHECK(vBlocks[999].GetAncestor(100) == &vBlocks[100]);
+}
+
+BOOST_AUTO_TEST_CASE(block_file_info_tier)
+{
+    CBlockFileInfo info;
+    info.AddBlock(100, 1500000000);
+    info.nSize = 1000;
+    info.nTier = BLOCK_FILE_COLD;
+    BOOST_REQUIRE(pblocktree->WriteBatchSync(std::vector<std::pair<int, const CBlockFileInfo*> >(1, std::make_pair(7, &info)), 7,
+                                             std::vector<const CBlockIndex*>()));
+    CBlockFileInfo read;
+    BOOST_REQUIRE(pblocktree->ReadBlockFileInfo(7, read));
+    BOOST_CHECK_EQUAL(read.nTier, BLOCK_FILE_COLD);
+    BOOST_CHECK_EQUAL(read.nSize, 1000);
+    BOOST_CHECK_EQUAL(read.nHeightLast, 100);
+
+    // Written before the tier was, the files are in the datadir
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << info;
+    ss.resize(ss.size() - 1);
+    ss >> read;
+    BOOST_CHECK_EQUAL(read.nTier, BLOCK_FILE_HOT);
+    BOOST_CHECK_EQUAL(read.nTimeLast, 1500000000);
+}
+
+BOOST_AUTO_TEST_CASE(sapling_commitments_round_trip)
+{
+    CBlock block;
+    for (int i = 0; i < 3; i++) {
+        CMutableTransaction mtx;
+        mtx.nLockTime = i;
+        // The middle transaction has no Sapling outputs
+        mtx.vShieldedOutput.resize(i == 1 ? 0 : 2);
+        for (size_t n = 0; n < mtx.vShieldedOutput.size(); n++)
+            mtx.vShieldedOutput[n].cm = uint256S(strprintf("%x", 10 * i + n + 1));
+        block.vtx.push_back(CTransaction(mtx));
+    }
+    CSaplingBlockCommitments commitments(block);
+    BOOST_REQUIRE_EQUAL(commitments.vtx.size(), 2);
+    BOOST_CHECK(commitments.vtx[1].txid == block.vtx[2].GetHash());
+    std::vector<uint256> vCommitments = commitments.GetCommitments();
+    BOOST_REQUIRE_EQUAL(vCommitments.size(), 4);
+    BOOST_CHECK(vCommitments[2] == uint256S("15"));
+
+    SaplingMerkleTree tree;
+    tree.append(uint256S("01"));
+    commitments.checkpoint = tree;
+    BOOST_REQUIRE(pblocktree->WriteSaplingCommitments(100, commitments));
+    BOOST_REQUIRE(pblocktree->WriteSaplingCommitments(101, CSaplingBlockCommitments()));
+    BOOST_REQUIRE(pblocktree->WriteSaplingCommitments(103, CSaplingBlockCommitments()));
+
+    // Reading stops at the first height without a record
+    std::vector<CSaplingBlockCommitments> vRead;
+    BOOST_REQUIRE(pblocktree->ReadSaplingCommitments(100, 10, vRead));
+    BOOST_REQUIRE_EQUAL(vRead.size(), 2);
+    BOOST_CHECK(vRead[0].hash == block.GetHash());
+    BOOST_CHECK(vRead[0].GetCommitments() == vCommitments);
+    BOOST_REQUIRE(vRead[0].checkpoint);
+    BOOST_CHECK(vRead[0].checkpoint->root() == tree.root());
+    BOOST_CHECK(!vRead[1].checkpoint);
+
+    for (int nHeight = 100; nHeight < 104; nHeight++)
+        pblocktree->EraseSaplingCommitments(nHeight);
+}
+
+BOOST_AUTO_TEST_CASE(kvindex_disconnect_restores_versions)
+{
+    LOCK(cs_main);
+    CKVIndex index;
+    std::vector<uint256> vHashes;
+    std::vector<CBlockIndex> vBlocks(2);
+    for (int i = 0; i < 2; i++) {
+        vHashes.push_back(uint256S(strprintf("%x", i + 1)));
+        vBlocks[i].phashBlock = &vHashes[i];
+        vBlocks[i].SetHeight(200 + i);
+    }
+    const std::vector<unsigned char> vchKey = {'k', 'e', 'y'};
+    CKVEntry entry;
+    entry.nHeight = 200;
+    entry.vchValue = {'a'};
+    index.Update(vchKey, entry);
+    // Pending updates are only seen by the block's own updates
+    CKVEntry found;
+    int nHeight;
+    BOOST_CHECK(index.Search(vchKey, 200, found));
+    BOOST_CHECK(!index.SearchTip(vchKey, found, nHeight));
+    BOOST_REQUIRE(index.ConnectBlock(&vBlocks[0]));
+
+    entry.nHeight = 201;
+    entry.vchValue = {'b'};
+    index.Update(vchKey, entry);
+    BOOST_REQUIRE(index.ConnectBlock(&vBlocks[1]));
+    BOOST_REQUIRE(index.SearchTip(vchKey, found, nHeight));
+    BOOST_CHECK_EQUAL(nHeight, 201);
+    BOOST_CHECK(found.vchValue == entry.vchValue);
+    // Expired entries are hidden, not dropped; without flags they last a day of blocks
+    BOOST_CHECK(!index.Search(vchKey, 201 + 1441, found));
+    BOOST_CHECK(index.Search(vchKey, 201, found));
+
+    BOOST_REQUIRE(index.DisconnectBlock(&vBlocks[1]));
+    BOOST_REQUIRE(index.SearchTip(vchKey, found, nHeight));
+    BOOST_CHECK_EQUAL(nHeight, 200);
+    BOOST_CHECK(found.vchValue == std::vector<unsigned char>(1, 'a'));
+    BOOST_REQUIRE(index.DisconnectBlock(&vBlocks[0]));
+    BOOST_CHECK(!index.Search(vchKey, 200, found));
+    BOOST_CHECK_EQUAL(index.Size(), 0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
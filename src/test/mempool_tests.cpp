@@ -2,7 +2,9 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "cc/eval.h"
 #include "consensus/upgrades.h"
+#include "key.h"
 #include "main.h"
 #include "txmempool.h"
 #include "util.h"
@@ -212,6 +214,78 @@ BOOST_AUTO_TEST_CASE(RemoveWithoutBranchId) {
     BOOST_CHECK_EQUAL(pool.size(), 0);
 }
 
+BOOST_AUTO_TEST_CASE(RemoveExpired) {
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+    entry.hadNoDependencies = true;
+
+    // Expiry heights 0 (never expires) and 1 to 10
+    for (auto i = 0; i < 11; i++) {
+        CMutableTransaction tx = CMutableTransaction();
+        tx.fOverwintered = true;
+        tx.nVersion = OVERWINTER_TX_VERSION;
+        tx.nVersionGroupId = OVERWINTER_VERSION_GROUP_ID;
+        tx.nExpiryHeight = i;
+        tx.vout.resize(1);
+        tx.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        tx.vout[0].nValue = (i + 1) * COIN;
+        pool.addUnchecked(tx.GetHash(), entry.FromTx(tx));
+    }
+    BOOST_CHECK_EQUAL(pool.size(), 11);
+
+    // Expired once the height is past the expiry height
+    pool.removeExpired(5);
+    BOOST_CHECK_EQUAL(pool.size(), 7);
+    for (CTxMemPool::indexed_transaction_set::const_iterator it = pool.mapTx.begin(); it != pool.mapTx.end(); it++) {
+        BOOST_CHECK(it->GetTx().nExpiryHeight == 0 || it->GetTx().nExpiryHeight >= 5);
+    }
+
+    pool.removeExpired(100);
+    BOOST_CHECK_EQUAL(pool.size(), 1);
+    BOOST_CHECK_EQUAL(pool.mapTx.begin()->GetTx().nExpiryHeight, 0);
+}
+
+BOOST_AUTO_TEST_CASE(TrimToSize) {
+    CTxMemPool pool(CFeeRate(1000));
+    TestMemPoolEntryHelper entry;
+    entry.hadNoDependencies = true;
+
+    // Fees 1000 to 10000, with a child of the lowest fee transaction paying more
+    std::vector<uint256> vHashes;
+    for (auto i = 1; i < 11; i++) {
+        CMutableTransaction tx = CMutableTransaction();
+        tx.vout.resize(1);
+        tx.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        tx.vout[0].nValue = i * COIN;
+        pool.addUnchecked(tx.GetHash(), entry.Fee(i * 1000LL).FromTx(tx));
+        vHashes.push_back(tx.GetHash());
+    }
+    CMutableTransaction txChild = CMutableTransaction();
+    txChild.vin.resize(1);
+    txChild.vin[0].prevout = COutPoint(vHashes[0], 0);
+    txChild.vout.resize(1);
+    txChild.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txChild.vout[0].nValue = COIN;
+    pool.addUnchecked(txChild.GetHash(), entry.Fee(20000LL).FromTx(txChild));
+    BOOST_CHECK_EQUAL(pool.size(), 11);
+    BOOST_CHECK(pool.GetMinFee(pool.DynamicMemoryUsage()) == CFeeRate(0));
+
+    // Room enough for everything
+    pool.TrimToSize(pool.DynamicMemoryUsage());
+    BOOST_CHECK_EQUAL(pool.size(), 11);
+
+    // The lowest fee rate transaction goes with its descendant
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
+    BOOST_CHECK_EQUAL(pool.size(), 9);
+    BOOST_CHECK(!pool.exists(vHashes[0]));
+    BOOST_CHECK(!pool.exists(txChild.GetHash()));
+    BOOST_CHECK_EQUAL(pool.GetEvictedCount(), 2);
+    BOOST_CHECK(pool.GetMinFee(pool.DynamicMemoryUsage()) > CFeeRate(1000));
+
+    pool.TrimToSize(0);
+    BOOST_CHECK_EQUAL(pool.size(), 0);
+}
+
 // Test that nCheckFrequency is set correctly when calling setSanityCheck().
 // https://github.com/zcash/zcash/issues/3134
 BOOST_AUTO_TEST_CASE(SetSanityCheck) {
@@ -222,4 +296,74 @@ BOOST_AUTO_TEST_CASE(SetSanityCheck) {
     BOOST_CHECK_EQUAL(pool.GetCheckFrequency(), 0);
 }
 
+BOOST_AUTO_TEST_CASE(CCIndex) {
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+    CKey key;
+    key.MakeNewKey(true);
+    const CKeyID keyid = key.GetPubKey().GetID();
+
+    // A data transaction of an oracle, funcid 'D', paying to the key
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig = CScript() << OP_11;
+    tx.vout.resize(2);
+    tx.vout[0].scriptPubKey = GetScriptForDestination(keyid);
+    tx.vout[0].nValue = 10000;
+    tx.vout[1].scriptPubKey = CScript() << OP_RETURN << std::vector<unsigned char>{EVAL_ORACLES, 'D', 1, 2, 3};
+    tx.vout[1].nValue = 0;
+    pool.addUnchecked(tx.GetHash(), entry.FromTx(tx));
+
+    std::vector<CTransaction> txs;
+    pool.getCCEvalTxs(EVAL_ORACLES, 'D', txs);
+    BOOST_CHECK_EQUAL(txs.size(), 1);
+    txs.clear();
+    pool.getCCEvalTxs(EVAL_ORACLES, 0, txs);
+    BOOST_CHECK_EQUAL(txs.size(), 1);
+    txs.clear();
+    pool.getCCEvalTxs(EVAL_ORACLES, 'F', txs);
+    BOOST_CHECK_EQUAL(txs.size(), 0);
+
+    std::vector<std::pair<COutPoint, CTxOut> > outputs;
+    pool.getAddressOutputs(keyid, outputs);
+    BOOST_CHECK_EQUAL(outputs.size(), 1);
+    BOOST_CHECK(outputs[0].first == COutPoint(tx.GetHash(), 0));
+
+    std::list<CTransaction> removed;
+    pool.remove(tx, removed);
+    txs.clear();
+    outputs.clear();
+    pool.getCCEvalTxs(EVAL_ORACLES, 'D', txs);
+    pool.getAddressOutputs(keyid, outputs);
+    BOOST_CHECK_EQUAL(txs.size(), 0);
+    BOOST_CHECK_EQUAL(outputs.size(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolSharedTxTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+
+    CMutableTransaction tx;
+    tx.vout.resize(1);
+    tx.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx.vout[0].nValue = COIN;
+    uint256 hash = tx.GetHash();
+    pool.addUnchecked(hash, entry.FromTx(tx));
+
+    // Every holder gets the entry's transaction, not a copy of it
+    CTransactionRef shared = pool.get(hash);
+    BOOST_REQUIRE(shared);
+    BOOST_CHECK(shared == pool.get(hash));
+    BOOST_CHECK(shared.get() == &pool.mapTx.find(hash)->GetTx());
+    BOOST_CHECK(shared->GetHash() == hash);
+    BOOST_CHECK(!pool.get(uint256S("01")));
+
+    // It outlives its removal from the pool
+    std::list<CTransaction> removed;
+    pool.remove(*shared, removed, true);
+    BOOST_CHECK(!pool.get(hash));
+    BOOST_CHECK(shared->GetHash() == hash);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,195 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "net.h"
+#include "util.h"
+#include "test/test_bitcoin.h"
+
+#include <algorithm>
+#include <limits>
+#include <set>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(net_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(socket_events_limit)
+{
+#if defined(USE_EPOLL) || defined(USE_KQUEUE)
+    BOOST_CHECK(GetSocketEventsLimit() > FD_SETSIZE);
+#else
+    BOOST_CHECK_EQUAL(GetSocketEventsLimit(), FD_SETSIZE);
+#endif
+}
+
+#ifndef _WIN32
+// A shared payload goes out exactly like the same bytes serialized into the message
+BOOST_AUTO_TEST_CASE(send_shared_payload)
+{
+    int fds[2];
+    BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    CNode node(fds[0], CAddress(CService("127.0.0.1", 7770)), "", true);
+
+    std::vector<char> vPayload(5000);
+    for (size_t i = 0; i < vPayload.size(); i++)
+        vPayload[i] = (char)(i * 7);
+    CMappedSpan shared;
+    shared.data = begin_ptr(vPayload);
+    shared.size = vPayload.size();
+
+    node.PushMessageShared("block", shared);
+    node.PushMessage("block", CFlatData(vPayload));
+
+    size_t nMessageSize = CMessageHeader::HEADER_SIZE + vPayload.size();
+    std::vector<char> vReceived(2 * nMessageSize);
+    size_t nReceived = 0;
+    while (nReceived < vReceived.size()) {
+        ssize_t nBytes = recv(fds[1], &vReceived[nReceived], vReceived.size() - nReceived, 0);
+        BOOST_REQUIRE(nBytes > 0);
+        nReceived += nBytes;
+    }
+    BOOST_CHECK(std::equal(vReceived.begin(), vReceived.begin() + nMessageSize, vReceived.begin() + nMessageSize));
+    BOOST_CHECK(std::equal(vPayload.begin(), vPayload.end(), vReceived.begin() + CMessageHeader::HEADER_SIZE));
+    BOOST_CHECK(node.vSendMsg.empty());
+    close(fds[1]);
+}
+#endif
+
+#if defined(USE_EPOLL) || defined(USE_KQUEUE)
+// More sockets than select() can watch, as with a large -maxconnections
+BOOST_AUTO_TEST_CASE(socket_events_many_sockets)
+{
+    const int nPairs = FD_SETSIZE / 2 + 64;
+    if (RaiseFileDescriptorLimit(2 * nPairs + 64) < 2 * nPairs + 64) {
+        BOOST_TEST_MESSAGE("Not enough file descriptors, skipping");
+        return;
+    }
+
+    std::vector<SOCKET> vLocal, vRemote;
+    for (int i = 0; i < nPairs; i++) {
+        int fds[2];
+        BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+        vLocal.push_back(fds[0]);
+        vRemote.push_back(fds[1]);
+    }
+    BOOST_CHECK(vRemote.back() >= FD_SETSIZE);
+
+    std::vector<CSocketInterest> vInterest;
+    for (int i = 0; i < nPairs; i++) {
+        vInterest.push_back(CSocketInterest(vLocal[i], i, true, false));
+    }
+
+    CSocketEvents socketEvents;
+    std::set<SOCKET> setRecv, setSend, setError;
+    socketEvents.Wait(vInterest, 0, setRecv, setSend, setError);
+    BOOST_CHECK(setRecv.empty());
+    BOOST_CHECK(setSend.empty());
+
+    // Only the sockets with data are reported, including the ones past FD_SETSIZE
+    std::set<SOCKET> setWritten;
+    for (int i = 0; i < nPairs; i += 7) {
+        BOOST_REQUIRE(write(vRemote[i], "x", 1) == 1);
+        setWritten.insert(vLocal[i]);
+    }
+    socketEvents.Wait(vInterest, 1000, setRecv, setSend, setError);
+    BOOST_CHECK(setRecv == setWritten);
+
+    // Changing the interest is picked up
+    for (size_t i = 0; i < vInterest.size(); i++) {
+        vInterest[i].fRecv = false;
+        vInterest[i].fSend = true;
+    }
+    socketEvents.Wait(vInterest, 1000, setRecv, setSend, setError);
+    BOOST_CHECK(setRecv.empty());
+    BOOST_CHECK_EQUAL(setSend.size(), (size_t)nPairs);
+
+    for (int i = 0; i < nPairs; i++) {
+        close(vLocal[i]);
+        close(vRemote[i]);
+    }
+}
+
+// A descriptor reused by a new socket is registered again
+BOOST_AUTO_TEST_CASE(socket_events_reused_descriptor)
+{
+    CSocketEvents socketEvents;
+    std::set<SOCKET> setRecv, setSend, setError;
+
+    int fds[2];
+    BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    std::vector<CSocketInterest> vInterest(1, CSocketInterest(fds[0], 1, true, false));
+    socketEvents.Wait(vInterest, 0, setRecv, setSend, setError);
+    BOOST_CHECK(setRecv.empty());
+    close(fds[0]);
+    close(fds[1]);
+
+    int fdsNew[2];
+    BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fdsNew) == 0);
+    BOOST_REQUIRE(write(fdsNew[1], "x", 1) == 1);
+    vInterest[0] = CSocketInterest(fdsNew[0], 2, true, false);
+    socketEvents.Wait(vInterest, 1000, setRecv, setSend, setError);
+    BOOST_CHECK_EQUAL(setRecv.size(), 1U);
+    BOOST_CHECK(setRecv.count(fdsNew[0]));
+    close(fdsNew[0]);
+    close(fdsNew[1]);
+}
+#endif
+
+BOOST_AUTO_TEST_CASE(msg_stats_key)
+{
+    BOOST_CHECK_EQUAL(GetMsgStatsKey("tx", NULL, 0), "tx");
+    BOOST_CHECK_EQUAL(GetMsgStatsKey("bogus", NULL, 0), "other");
+
+    // nSPV payloads are a byte vector starting with the request type
+    const char utxos[] = {3, 0x02, 0x11, 0x22};
+    BOOST_CHECK_EQUAL(GetMsgStatsKey("getnSPV", utxos, sizeof(utxos)), "getnSPV:utxos");
+    const char inforesp[] = {2, 0x01, 0x00};
+    BOOST_CHECK_EQUAL(GetMsgStatsKey("nSPV", inforesp, sizeof(inforesp)), "nSPV:info");
+    const char unknown[] = {1, 0x7f};
+    BOOST_CHECK_EQUAL(GetMsgStatsKey("nSPV", unknown, sizeof(unknown)), "nSPV:other");
+    BOOST_CHECK_EQUAL(GetMsgStatsKey("getnSPV", NULL, 0), "getnSPV");
+}
+
+BOOST_AUTO_TEST_CASE(asked_for_times)
+{
+    CAskedForTimes times(16);
+    uint256 hash1 = GetRandHash(), hash2 = GetRandHash();
+    BOOST_CHECK_EQUAL(times.Get(hash1), 0);
+    times.Set(hash1, 100);
+    BOOST_CHECK_EQUAL(times.Get(hash1), 100);
+    // A colliding entry takes the slot over, the older one then reads as never requested
+    times.Set(hash2, 200);
+    BOOST_CHECK_EQUAL(times.Get(hash2), 200);
+    BOOST_CHECK(times.Get(hash1) == 100 || times.Get(hash1) == 0);
+    times.Erase(hash2);
+    BOOST_CHECK_EQUAL(times.Get(hash2), 0);
+}
+
+BOOST_AUTO_TEST_CASE(tx_announce_queue)
+{
+    std::vector<uint256> vHashes;
+    uint64_t nPos = GetTxAnnouncements(std::numeric_limits<uint64_t>::max(), vHashes, 0);
+    BOOST_CHECK(vHashes.empty());
+
+    std::vector<uint256> vQueued;
+    for (int i = 0; i < 3; i++) {
+        vQueued.push_back(GetRandHash());
+        QueueTxAnnouncement(vQueued.back());
+    }
+    nPos = GetTxAnnouncements(nPos, vHashes, 2);
+    BOOST_CHECK_EQUAL(vHashes.size(), 2U);
+    nPos = GetTxAnnouncements(nPos, vHashes, 2);
+    BOOST_CHECK(vHashes == vQueued);
+    vHashes.clear();
+    GetTxAnnouncements(nPos, vHashes, 2);
+    BOOST_CHECK(vHashes.empty());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -4,7 +4,10 @@
 
 #include "rpc/server.h"
 #include "rpc/client.h"
+#include "rpc/jsonstream.h"
+#include "rpc/stats.h"
 
+#include "httpmetrics.h"
 #include "key_io.h"
 #include "netbase.h"
 #include "utilstrencodings.h"
@@ -339,6 +342,156 @@ BOOST_AUTO_TEST_CASE(rpc_raw_create_overwinter_v3)
     UpdateNetworkUpgradeParameters(Consensus::UPGRADE_OVERWINTER, Consensus::NetworkUpgrade::NO_ACTIVATION_HEIGHT);
 }
 
+struct EnqueueOnThread
+{
+    boost::thread_group* threads;
+
+    bool operator()(const boost::function<void(void)>& task) const
+    {
+        threads->create_thread(task);
+        return true;
+    }
+};
+
+static bool EnqueueNever(const boost::function<void(void)>&)
+{
+    return false;
+}
+
+BOOST_AUTO_TEST_CASE(rpc_batch_parallel)
+{
+    UniValue vReq(UniValue::VARR);
+    for (int i = 0; i < 20; i++) {
+        UniValue req(UniValue::VOBJ);
+        req.push_back(Pair("id", i));
+        req.push_back(Pair("method", i == 7 ? "setmocktime" : (i % 3 ? "getblockcount" : "nosuchmethod")));
+        req.push_back(Pair("params", UniValue(UniValue::VARR)));
+        vReq.push_back(req);
+    }
+    vReq.push_back(UniValue(UniValue::VSTR, "not a request"));
+    std::string strSequential = JSONRPCExecBatch(vReq);
+
+    boost::thread_group threads;
+    EnqueueOnThread enqueue = {&threads};
+    std::string strParallel = JSONRPCExecBatch(vReq, 3, enqueue);
+    threads.join_all();
+    BOOST_CHECK_EQUAL(strParallel, strSequential);
+
+    // A batch still completes when none of the helpers can be queued
+    BOOST_CHECK_EQUAL(JSONRPCExecBatch(vReq, 3, EnqueueNever), strSequential);
+
+    UniValue ret;
+    BOOST_CHECK(ret.read(strParallel));
+    BOOST_CHECK_EQUAL(ret.size(), vReq.size());
+    for (int i = 0; i < 20; i++)
+        BOOST_CHECK_EQUAL(find_value(ret[i].get_obj(), "id").get_int(), i);
+}
+
+struct JSONStreamCollector
+{
+    std::string* out;
+    int* nChunks;
+    bool* fFinished;
+
+    void operator()(std::string& chunk, bool fLast) const
+    {
+        BOOST_CHECK(!*fFinished);
+        *out += chunk;
+        (*nChunks)++;
+        *fFinished = fLast;
+    }
+};
+
+BOOST_AUTO_TEST_CASE(rpc_json_stream)
+{
+    UniValue val;
+    BOOST_CHECK(val.read("{\"a\":[1,2.5,\"x\\\"y\",null,true,{},[]],\"b\":{\"c\":[{\"d\":-3}]},\"e\":\"\\u00e9\"}"));
+
+    // Written as a whole, in chunks of a few bytes
+    std::string out;
+    int nChunks = 0;
+    bool fFinished = false;
+    JSONStreamCollector collector = {&out, &nChunks, &fFinished};
+    JSONStreamWriter writer(collector, 8);
+    writer.Value(val);
+    BOOST_CHECK(writer.Flushed());
+    writer.Finish();
+    BOOST_CHECK(fFinished);
+    BOOST_CHECK(nChunks > 1);
+    BOOST_CHECK_EQUAL(out, val.write());
+
+    // Built up member by member, the way the RPCs stream their results
+    out.clear();
+    nChunks = 0;
+    fFinished = false;
+    JSONStreamWriter writer2(collector);
+    writer2.BeginObject();
+    writer2.KeyValue("a", val["a"]);
+    writer2.Key("b");
+    writer2.BeginObject();
+    writer2.Key("c");
+    writer2.BeginArray();
+    writer2.Value(val["b"]["c"][0]);
+    writer2.EndArray();
+    writer2.EndObject();
+    writer2.KeyValue("e", val["e"]);
+    writer2.EndObject();
+    BOOST_CHECK(!writer2.Flushed());
+    writer2.Finish();
+    BOOST_CHECK_EQUAL(nChunks, 1);
+    BOOST_CHECK_EQUAL(out, val.write());
+}
+
+BOOST_AUTO_TEST_CASE(rpc_json_stream_cbor)
+{
+    UniValue val;
+    BOOST_CHECK(val.read("{\"a\":[1,-2,\"x\",true,null]}"));
+
+    std::string out;
+    int nChunks = 0;
+    bool fFinished = false;
+    JSONStreamCollector collector = {&out, &nChunks, &fFinished};
+    JSONStreamWriter writer(collector, DEFAULT_JSON_STREAM_CHUNK_SIZE, JSONStreamWriter::FORMAT_CBOR);
+    writer.Value(val);
+    writer.Finish();
+    const unsigned char expected[] = {0xbf, 0x61, 'a', 0x9f, 0x01, 0x21, 0x61, 'x', 0xf5, 0xf6, 0xff, 0xff};
+    BOOST_CHECK_EQUAL(HexStr(out), HexStr(expected, expected + sizeof(expected)));
+
+    // Bytes are a byte string in CBOR and hex in text
+    const unsigned char data[] = {0xde, 0xad};
+    out.clear();
+    JSONStreamWriter writer2(collector, DEFAULT_JSON_STREAM_CHUNK_SIZE, JSONStreamWriter::FORMAT_CBOR);
+    writer2.Bytes(data, data + sizeof(data));
+    writer2.Finish();
+    BOOST_CHECK_EQUAL(HexStr(out), "42dead");
+    out.clear();
+    JSONStreamWriter writer3(collector);
+    writer3.Bytes(data, data + sizeof(data));
+    writer3.Finish();
+    BOOST_CHECK_EQUAL(out, "\"dead\"");
+}
+
+BOOST_AUTO_TEST_CASE(rpc_reply_stream_scope)
+{
+    std::string out;
+    int nChunks = 0;
+    bool fFinished = false;
+    JSONStreamCollector collector = {&out, &nChunks, &fFinished};
+    JSONStreamWriter writer(collector);
+
+    BOOST_CHECK(RPCTakeReplyStream("getblock") == NULL);
+    {
+        RPCReplyStreamScope scope("getblock", &writer);
+        BOOST_CHECK(RPCTakeReplyStream("getaddressdeltas") == NULL);
+        BOOST_CHECK(!scope.Taken());
+        BOOST_CHECK(RPCTakeReplyStream("getblock") == &writer);
+        BOOST_CHECK(scope.Taken());
+        // Only the request itself gets the stream
+        BOOST_CHECK(RPCTakeReplyStream("getblock") == NULL);
+    }
+    BOOST_CHECK(RPCTakeReplyStream("getblock") == NULL);
+}
+
 BOOST_AUTO_TEST_CASE(rpc_getnetworksolps)
 {
     BOOST_CHECK_NO_THROW(CallRPC("getnetworksolps"));
@@ -346,4 +499,104 @@ BOOST_AUTO_TEST_CASE(rpc_getnetworksolps)
     BOOST_CHECK_NO_THROW(CallRPC("getnetworksolps 120 -1"));
 }
 
+BOOST_AUTO_TEST_CASE(rpc_stats)
+{
+    CRPCStats stats;
+    CLockWaitTimes waits;
+    waits.nMainMicros = 300;
+    waits.nWalletMicros = 20;
+
+    // 100 calls of 100us, one of 50ms that fails
+    for (int i = 0; i < 100; i++) {
+        uint64_t nCall = stats.Begin("getinfo", 1000);
+        stats.End(nCall, false, waits, 1100);
+    }
+    uint64_t nSlow = stats.Begin("getinfo", 1000);
+    uint64_t nRunning = stats.Begin("getblock", 2000);
+    BOOST_CHECK_EQUAL(stats.GetInFlight().size(), 2);
+    stats.End(nSlow, true, CLockWaitTimes(), 51000);
+
+    std::vector<CRPCStats::InFlight> vInFlight = stats.GetInFlight();
+    BOOST_CHECK_EQUAL(vInFlight.size(), 1);
+    BOOST_CHECK_EQUAL(vInFlight[0].strMethod, "getblock");
+
+    std::map<std::string, CRPCStats::MethodStats> methods = stats.GetMethods();
+    BOOST_CHECK_EQUAL(methods.count("getblock"), 0);
+    const CRPCStats::MethodStats& info = methods["getinfo"];
+    BOOST_CHECK_EQUAL(info.nCalls, 101);
+    BOOST_CHECK_EQUAL(info.nErrors, 1);
+    BOOST_CHECK_EQUAL(info.nMaxMicros, 50000);
+    BOOST_CHECK_EQUAL(info.nMainWaitMicros, 30000);
+    BOOST_CHECK_EQUAL(info.nWalletWaitMicros, 2000);
+    // 100us falls in the bucket below 128us
+    BOOST_CHECK_EQUAL(info.Percentile(0.50), 128);
+    BOOST_CHECK_EQUAL(info.Percentile(0.99), 128);
+    BOOST_CHECK_EQUAL(info.Percentile(1.0), 50000);
+
+    uint64_t nCalls, nErrors;
+    size_t nInFlight;
+    stats.GetTotals(nCalls, nErrors, nInFlight);
+    BOOST_CHECK_EQUAL(nCalls, 101);
+    BOOST_CHECK_EQUAL(nErrors, 1);
+    BOOST_CHECK_EQUAL(nInFlight, 1);
+
+    UniValue json = stats.ToJSON(5000);
+    BOOST_CHECK_EQUAL(find_value(json["methods"]["getinfo"], "calls").get_int(), 101);
+    BOOST_CHECK_EQUAL(find_value(json["inflight"][0], "elapsed_ms").get_real(), 3.0);
+    stats.End(nRunning, false, CLockWaitTimes(), 6000);
+    BOOST_CHECK(stats.GetInFlight().empty());
+
+    // Lock waits are attributed by the name the lock was taken with
+    CLockWaitTimes threadWaits;
+    pLockWaitTimes = &threadWaits;
+    LockWaitEnd("cs_main", LockWaitStart() - 1000);
+    LockWaitEnd("pwalletMain->cs_wallet", LockWaitStart() - 2000);
+    LockWaitEnd("cs_vNodes", LockWaitStart() - 3000);
+    pLockWaitTimes = NULL;
+    BOOST_CHECK(threadWaits.nMainMicros >= 1000 && threadWaits.nMainMicros < 2000);
+    BOOST_CHECK(threadWaits.nWalletMicros >= 2000 && threadWaits.nWalletMicros < 3000);
+    BOOST_CHECK(threadWaits.nOtherMicros >= 3000);
+}
+
+BOOST_AUTO_TEST_CASE(rpc_lockstats)
+{
+    CCriticalSection cs_locktest;
+    BOOST_CHECK_NO_THROW(CallRPC("setlockprofile true true"));
+    for (int i = 0; i < 3; i++) {
+        LOCK(cs_locktest);
+    }
+    BOOST_CHECK_NO_THROW(CallRPC("setlockprofile false"));
+    {
+        // Not counted with the profile off
+        LOCK(cs_locktest);
+    }
+
+    const CLockSite* psite = NULL;
+    for (const CLockSite* p : GetLockSites())
+        if (std::string(p->pszName) == "cs_locktest" && p->nAcquisitions > 0)
+            psite = p;
+    BOOST_REQUIRE(psite != NULL);
+    BOOST_CHECK_EQUAL(psite->nAcquisitions, 3);
+    BOOST_CHECK_EQUAL(psite->nContentions, 0);
+
+    UniValue r;
+    BOOST_CHECK_NO_THROW(r = CallRPC("getlockstats"));
+    BOOST_CHECK_EQUAL(find_value(r.get_obj(), "enabled").get_bool(), false);
+    BOOST_CHECK_EQUAL(find_value(r["locks"]["cs_locktest"], "acquisitions").get_int(), 3);
+    BOOST_CHECK_THROW(CallRPC("getlockstats -1"), runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(rpc_prometheus_metrics)
+{
+    {
+        RPCStatsScope scope("metricstest");
+    }
+    std::string strMetrics = GetPrometheusMetrics();
+    BOOST_CHECK(strMetrics.find("# TYPE pirate_chain_height gauge\n") != std::string::npos);
+    BOOST_CHECK(strMetrics.find("# TYPE pirate_rpc_duration_seconds histogram\n") != std::string::npos);
+    BOOST_CHECK(strMetrics.find("pirate_rpc_duration_seconds_bucket{method=\"metricstest\",le=\"+Inf\"} 1\n") != std::string::npos);
+    BOOST_CHECK(strMetrics.find("pirate_rpc_duration_seconds_count{method=\"metricstest\"} 1\n") != std::string::npos);
+    BOOST_CHECK(strMetrics.find("pirate_cache_capacity{cache=\"signature\"}") != std::string::npos);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
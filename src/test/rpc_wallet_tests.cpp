@@ -824,6 +824,72 @@ BOOST_AUTO_TEST_CASE(rpc_wallet_async_operations_parallel_cancel)
     BOOST_CHECK(ids.size()==0);
 }
 
+// Records the order operations start in
+class PriorityOperation : public MockSleepOperation {
+public:
+    OperationPriority priority;
+    std::string type;
+    std::vector<std::string>* order;
+    std::mutex* order_lock;
+    PriorityOperation(OperationPriority p, std::string t, std::vector<std::string>* o, std::mutex* l, int naptime) :
+        MockSleepOperation(naptime), priority(p), type(t), order(o), order_lock(l) {}
+    virtual OperationPriority getPriority() const { return priority; }
+    virtual std::string getType() const { return type; }
+    virtual void main() {
+        {
+            std::lock_guard<std::mutex> guard(*order_lock);
+            order->push_back(type);
+        }
+        MockSleepOperation::main();
+    }
+};
+
+// This tests priorities, concurrency limits and the reported queue wait
+BOOST_AUTO_TEST_CASE(rpc_wallet_async_operations_priorities)
+{
+    std::vector<std::string> order;
+    std::mutex order_lock;
+
+    std::shared_ptr<AsyncRPCQueue> q = std::make_shared<AsyncRPCQueue>();
+    q->setDefaultTypeLimit(1);
+    q->setBackgroundLimit(1);
+
+    // Queued before the workers start, so the start order is decided by priority
+    std::shared_ptr<AsyncRPCOperation> merge1(new PriorityOperation(OperationPriority::BACKGROUND, "merge1", &order, &order_lock, 500));
+    std::shared_ptr<AsyncRPCOperation> merge2(new PriorityOperation(OperationPriority::BACKGROUND, "merge2", &order, &order_lock, 500));
+    std::shared_ptr<AsyncRPCOperation> send1(new PriorityOperation(OperationPriority::HIGH, "send", &order, &order_lock, 500));
+    std::shared_ptr<AsyncRPCOperation> send2(new PriorityOperation(OperationPriority::HIGH, "send", &order, &order_lock, 500));
+    q->addOperation(merge1);
+    q->addOperation(merge2);
+    q->addOperation(send1);
+    q->addOperation(send2);
+    BOOST_CHECK(q->getOperationCount() == 4);
+    BOOST_CHECK(!find_value(merge1->getStatus(), "queue_wait_secs").isNull());
+
+    q->addWorker();
+    q->addWorker();
+    q->addWorker();
+    std::this_thread::sleep_for(std::chrono::milliseconds(250));
+
+    // One send at a time, and one background operation on the third worker
+    {
+        std::lock_guard<std::mutex> guard(order_lock);
+        BOOST_CHECK_EQUAL(order.size(), 2);
+        BOOST_CHECK_EQUAL(order[0], "send");
+        BOOST_CHECK_EQUAL(order[1], "merge1");
+    }
+    BOOST_CHECK(send2->isReady());
+    BOOST_CHECK(merge2->isReady());
+
+    q->finishAndWait();
+    BOOST_CHECK_EQUAL(order.size(), 4);
+    BOOST_CHECK(send2->isSuccess());
+    BOOST_CHECK(merge2->isSuccess());
+    UniValue status = merge2->getStatus();
+    BOOST_CHECK(find_value(status, "queue_wait_secs").get_real() >= 0.4);
+    BOOST_CHECK(!find_value(status, "execution_secs").isNull());
+}
+
 // This tests z_getoperationstatus, z_getoperationresult, z_listoperationids
 BOOST_AUTO_TEST_CASE(rpc_z_getoperations)
 {
@@ -1526,7 +1592,7 @@ BOOST_AUTO_TEST_CASE(rpc_z_shieldcoinbase_parameters)
 
     BOOST_CHECK_THROW(CallRPC("z_shieldcoinbase"), runtime_error);
     BOOST_CHECK_THROW(CallRPC("z_shieldcoinbase toofewargs"), runtime_error);
-    BOOST_CHECK_THROW(CallRPC("z_shieldcoinbase too many args shown here"), runtime_error);
+    BOOST_CHECK_THROW(CallRPC("z_shieldcoinbase too many args are shown here"), runtime_error);
 
     // bad from address
     BOOST_CHECK_THROW(CallRPC("z_shieldcoinbase "
@@ -1561,6 +1627,20 @@ BOOST_AUTO_TEST_CASE(rpc_z_shieldcoinbase_parameters)
     "100 -1"
     ), runtime_error);
 
+    // invalid maxtxs, must be at least 1
+    BOOST_CHECK_THROW(CallRPC("z_shieldcoinbase "
+    "tmRr6yJonqGK23UVhrKuyvTpF8qxQQjKigJ "
+    "tnpoQJVnYBZZqkFadj2bJJLThNCxbADGB5gSGeYTAGGrT5tejsxY9Zc1BtY8nnHmZkB "
+    "0.0001 50 0"
+    ), runtime_error);
+
+    // more than one transaction requires a Sapling address
+    BOOST_CHECK_THROW(CallRPC("z_shieldcoinbase "
+    "tmRr6yJonqGK23UVhrKuyvTpF8qxQQjKigJ "
+    "tnpoQJVnYBZZqkFadj2bJJLThNCxbADGB5gSGeYTAGGrT5tejsxY9Zc1BtY8nnHmZkB "
+    "0.0001 50 2"
+    ), runtime_error);
+
     // Mutable tx containing contextual information we need to build tx
     UniValue retValue = CallRPC("getblockcount");
     int nHeight = retValue.get_int();
@@ -1676,7 +1756,7 @@ BOOST_AUTO_TEST_CASE(rpc_z_mergetoaddress_parameters)
 
     BOOST_CHECK_THROW(CallRPC("z_mergetoaddress"), runtime_error);
     BOOST_CHECK_THROW(CallRPC("z_mergetoaddress toofewargs"), runtime_error);
-    BOOST_CHECK_THROW(CallRPC("z_mergetoaddress just too many args present for this method"), runtime_error);
+    BOOST_CHECK_THROW(CallRPC("z_mergetoaddress just too many args are present for this method"), runtime_error);
 
     // bad from address
     BOOST_CHECK_THROW(CallRPC("z_mergetoaddress "
@@ -1745,6 +1825,10 @@ BOOST_AUTO_TEST_CASE(rpc_z_mergetoaddress_parameters)
     BOOST_CHECK_THROW(CallRPC(string("z_mergetoaddress [\"tmRr6yJonqGK23UVhrKuyvTpF8qxQQjKigJ\"] ")
             + zaddr1 + " 0.0001 100 100 " + badmemo), runtime_error);
 
+    // more than one transaction requires a Sapling address
+    BOOST_CHECK_THROW(CallRPC(string("z_mergetoaddress [\"tmRr6yJonqGK23UVhrKuyvTpF8qxQQjKigJ\"] ")
+            + zaddr1 + " 0.0001 100 100 0.0001 00 2"), runtime_error);
+
     // Mutable tx containing contextual information we need to build tx
     UniValue retValue = CallRPC("getblockcount");
     int nHeight = retValue.get_int();
@@ -109,4 +109,78 @@ BOOST_AUTO_TEST_CASE(manythreads)
     BOOST_CHECK_EQUAL(counterSum, 200);
 }
 
+static void serialTask(boost::mutex& mutex, int& nRunning, int& nMaxRunning, int& nRuns)
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        nMaxRunning = std::max(nMaxRunning, ++nRunning);
+    }
+    MicroSleep(100);
+    boost::unique_lock<boost::mutex> lock(mutex);
+    nRunning--;
+    nRuns++;
+}
+
+BOOST_AUTO_TEST_CASE(serial_queues)
+{
+    // The tasks of a queue never overlap, even with threads to spare
+    CScheduler scheduler;
+    boost::mutex mutex;
+    int nRunning = 0, nMaxRunning = 0, nRuns = 0;
+    boost::chrono::system_clock::time_point now = boost::chrono::system_clock::now();
+    for (int i = 0; i < 20; i++)
+        scheduler.schedule(boost::bind(&serialTask, boost::ref(mutex), boost::ref(nRunning), boost::ref(nMaxRunning), boost::ref(nRuns)), now, "serial");
+
+    boost::thread_group threads;
+    for (int i = 0; i < 4; i++)
+        threads.create_thread(boost::bind(&CScheduler::serviceQueue, &scheduler));
+    scheduler.stop(true);
+    threads.join_all();
+
+    BOOST_CHECK_EQUAL(nRuns, 20);
+    BOOST_CHECK_EQUAL(nMaxRunning, 1);
+    std::map<std::string, CScheduler::QueueStats> mapStats = scheduler.getQueueStats();
+    BOOST_REQUIRE(mapStats.count("serial"));
+    BOOST_CHECK_EQUAL(mapStats["serial"].nRuns, 20);
+    BOOST_CHECK_EQUAL(mapStats["serial"].nPending, 0);
+    BOOST_CHECK(!mapStats["serial"].fRunning);
+}
+
+static void waitTask(boost::mutex& mutex, boost::condition_variable& cond, bool& fRelease)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (!fRelease)
+        cond.wait(lock);
+}
+
+static void releaseTask(boost::mutex& mutex, boost::condition_variable& cond, bool& fRelease)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    fRelease = true;
+    cond.notify_all();
+}
+
+BOOST_AUTO_TEST_CASE(slow_queue_does_not_block)
+{
+    // The slow task only returns once the task of the other queue ran
+    CScheduler scheduler;
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    bool fRelease = false;
+    boost::chrono::system_clock::time_point now = boost::chrono::system_clock::now();
+    scheduler.schedule(boost::bind(&waitTask, boost::ref(mutex), boost::ref(cond), boost::ref(fRelease)), now, "slow");
+    scheduler.schedule(boost::bind(&releaseTask, boost::ref(mutex), boost::ref(cond), boost::ref(fRelease)), now + boost::chrono::milliseconds(1), "fast");
+
+    boost::thread_group threads;
+    for (int i = 0; i < 2; i++)
+        threads.create_thread(boost::bind(&CScheduler::serviceQueue, &scheduler));
+    scheduler.stop(true);
+    threads.join_all();
+
+    BOOST_CHECK(fRelease);
+    std::map<std::string, CScheduler::QueueStats> mapStats = scheduler.getQueueStats();
+    BOOST_CHECK_EQUAL(mapStats["slow"].nRuns, 1);
+    BOOST_CHECK_EQUAL(mapStats["fast"].nRuns, 1);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -19,6 +19,7 @@
 #include "script/script_error.h"
 #include "script/sign.h"
 #include "primitives/transaction.h"
+#include "primitives/txview.h"
 
 #include "sodium.h"
 
@@ -854,4 +855,105 @@ BOOST_AUTO_TEST_CASE(test_IsStandardV2)
     BOOST_CHECK(!IsStandardTx(t, reason));
 }
 
+BOOST_AUTO_TEST_CASE(produce_signatures)
+{
+    // Inputs signed together on several threads verify one by one
+    uint32_t consensusBranchId = NetworkUpgradeInfo[Consensus::UPGRADE_SAPLING].nBranchId;
+    CBasicKeyStore keystore;
+    CMutableTransaction mtx;
+    mtx.fOverwintered = true;
+    mtx.nVersion = SAPLING_TX_VERSION;
+    mtx.nVersionGroupId = SAPLING_VERSION_GROUP_ID;
+    std::vector<std::pair<CScript, CAmount>> vCoins;
+    for (int i = 0; i < 40; i++) {
+        CKey key;
+        key.MakeNewKey(true);
+        keystore.AddKey(key);
+        mtx.vin.push_back(CTxIn(COutPoint(GetRandHash(), i)));
+        vCoins.push_back(std::make_pair(GetScriptForDestination(key.GetPubKey().GetID()), 1000 + i));
+    }
+    mtx.vout.resize(1);
+    mtx.vout[0].nValue = 1000;
+    mtx.vout[0].scriptPubKey = vCoins[0].first;
+
+    std::vector<SignatureData> vSigData;
+    BOOST_CHECK(ProduceSignatures(&keystore, CTransaction(mtx), vCoins, SIGHASH_ALL, consensusBranchId, vSigData, 4));
+    BOOST_CHECK_EQUAL(vSigData.size(), 40);
+    for (int i = 0; i < 40; i++)
+        UpdateTransaction(mtx, i, vSigData[i]);
+    CTransaction tx(mtx);
+    for (int i = 0; i < 40; i++)
+        BOOST_CHECK(VerifyScript(tx.vin[i].scriptSig, vCoins[i].first, STANDARD_SCRIPT_VERIFY_FLAGS, TransactionSignatureChecker(&tx, i, vCoins[i].second), consensusBranchId));
+
+    // One input without its key fails the batch, and inputs without a coin are skipped
+    CKey other;
+    other.MakeNewKey(true);
+    vCoins[5].first = GetScriptForDestination(other.GetPubKey().GetID());
+    BOOST_CHECK(!ProduceSignatures(&keystore, tx, vCoins, SIGHASH_ALL, consensusBranchId, vSigData, 4));
+    vCoins[5].first = CScript();
+    BOOST_CHECK(ProduceSignatures(&keystore, tx, vCoins, SIGHASH_ALL, consensusBranchId, vSigData, 4));
+    BOOST_CHECK(vSigData[5].scriptSig.empty());
+}
+
+BOOST_AUTO_TEST_CASE(transaction_view)
+{
+    CMutableTransaction mtx;
+    mtx.fOverwintered = true;
+    mtx.nVersion = SAPLING_TX_VERSION;
+    mtx.nVersionGroupId = SAPLING_VERSION_GROUP_ID;
+    mtx.nExpiryHeight = 1234;
+    mtx.vin.push_back(CTxIn(COutPoint(GetRandHash(), 3), CScript() << OP_TRUE));
+    mtx.vout.resize(2);
+    mtx.vout[0].nValue = 1000;
+    mtx.vout[1].nValue = 2000;
+    mtx.vout[1].scriptPubKey = CScript() << OP_TRUE << OP_DROP << OP_TRUE;
+    mtx.valueBalance = -500;
+    mtx.vShieldedSpend.resize(1);
+    mtx.vShieldedSpend[0].nullifier = GetRandHash();
+    mtx.vShieldedOutput.resize(1);
+    mtx.vShieldedOutput[0].cm = GetRandHash();
+    mtx.vShieldedOutput[0].ephemeralKey = GetRandHash();
+    mtx.vShieldedOutput[0].encCiphertext[0] = 0x5a;
+    mtx.vShieldedOutput[0].encCiphertext[ZC_SAPLING_ENCCIPHERTEXT_SIZE - 1] = 0xa5;
+    CTransaction tx(mtx);
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << tx;
+    // Trailing bytes aren't part of the view
+    ss << uint32_t(0);
+    CTransactionView view(&ss.begin()[0], ss.size());
+    BOOST_CHECK_EQUAL(view.size(), ss.size() - 4);
+    BOOST_CHECK(view.GetHash() == tx.GetHash());
+    BOOST_CHECK_EQUAL(view.GetExpiryHeight(), 1234);
+    BOOST_CHECK_EQUAL(view.GetValueBalance(), -500);
+    BOOST_CHECK_EQUAL(view.GetInputCount(), 1);
+    BOOST_CHECK(view.GetPrevout(0) == tx.vin[0].prevout);
+    BOOST_CHECK(!view.IsCoinBase());
+    BOOST_CHECK_EQUAL(view.GetOutputCount(), 2);
+    BOOST_CHECK_EQUAL(view.GetOutputValue(1), 2000);
+    BOOST_CHECK(view.GetOutput(1) == tx.vout[1]);
+    BOOST_CHECK_EQUAL(view.GetSpendCount(), 1);
+    BOOST_CHECK(view.GetSpendNullifier(0) == tx.vShieldedSpend[0].nullifier);
+    BOOST_CHECK_EQUAL(view.GetShieldedOutputCount(), 1);
+    BOOST_CHECK(view.GetShieldedOutputCmu(0) == tx.vShieldedOutput[0].cm);
+    BOOST_CHECK(view.GetShieldedOutputEphemeralKey(0) == tx.vShieldedOutput[0].ephemeralKey);
+    BOOST_CHECK(view.GetShieldedOutputCiphertext(0) == tx.vShieldedOutput[0].encCiphertext);
+    BOOST_CHECK_EQUAL(view.GetJoinSplitCount(), 0);
+    BOOST_CHECK(view.ToTransaction().GetHash() == tx.GetHash());
+
+    // A view of a block has views of its transactions
+    CBlock block;
+    block.vtx.push_back(tx);
+    block.vtx.push_back(tx);
+    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
+    ssBlock << block;
+    CBlockView blockView(&ssBlock.begin()[0], ssBlock.size());
+    BOOST_CHECK(blockView.GetHash() == block.GetHash());
+    BOOST_CHECK_EQUAL(blockView.GetTransactions().size(), 2);
+    BOOST_CHECK(blockView.GetTransactions()[1].GetHash() == tx.GetHash());
+
+    // A truncated transaction is rejected
+    BOOST_CHECK_THROW(CTransactionView(&ss.begin()[0], ss.size() - 100), std::ios_base::failure);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
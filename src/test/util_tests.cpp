@@ -8,11 +8,14 @@
 #include "primitives/transaction.h"
 #include "random.h"
 #include "sync.h"
+#include "util/parallel.h"
 #include "utilstrencodings.h"
 #include "utilmoneystr.h"
 #include "test/test_bitcoin.h"
 
 #include <stdint.h>
+#include <atomic>
+#include <stdexcept>
 #include <vector>
 
 #include <boost/test/unit_test.hpp>
@@ -487,4 +490,44 @@ BOOST_AUTO_TEST_CASE(test_ParseFixedPoint)
     BOOST_CHECK(!ParseFixedPoint("1.", 8, &amount));
 }
 
+BOOST_AUTO_TEST_CASE(util_ParallelFor)
+{
+    for (int nThreads : {0, 1, 4, 16}) {
+        std::vector<std::atomic<int>> vRuns(1000);
+        ParallelFor(vRuns.size(), nThreads, [&](size_t i) { vRuns[i]++; });
+        for (const std::atomic<int>& nRuns : vRuns)
+            BOOST_CHECK_EQUAL(nRuns, 1);
+
+        std::vector<int> vCovered(1003);
+        ParallelForRanges(vCovered.size(), nThreads, [&](size_t nBegin, size_t nEnd) {
+            for (size_t i = nBegin; i < nEnd; i++)
+                vCovered[i]++;
+        });
+        for (int nCovered : vCovered)
+            BOOST_CHECK_EQUAL(nCovered, 1);
+    }
+
+    // Nested calls run on the pool as well, the callers keep working on their own items
+    std::atomic<int> nInner(0);
+    ParallelFor(8, 8, [&](size_t) {
+        ParallelFor(100, 4, [&](size_t) { nInner++; });
+    });
+    BOOST_CHECK_EQUAL(nInner, 800);
+
+    // An exception on any thread reaches the caller, once the other threads are done
+    std::atomic<int> nBusy(0);
+    BOOST_CHECK_THROW(ParallelFor(1000, 8, [&](size_t i) {
+        nBusy++;
+        if (i == 500)
+            throw std::runtime_error("item 500");
+        nBusy--;
+    }), std::runtime_error);
+    BOOST_CHECK_EQUAL(nBusy, 1);
+
+    // and the pool is still usable afterwards
+    std::atomic<int> nRuns(0);
+    ParallelFor(100, 8, [&](size_t) { nRuns++; });
+    BOOST_CHECK_EQUAL(nRuns, 100);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
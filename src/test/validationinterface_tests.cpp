@@ -0,0 +1,93 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chain.h"
+#include "primitives/block.h"
+#include "primitives/transaction.h"
+#include "validationinterface.h"
+
+#include "test/test_bitcoin.h"
+
+#include <vector>
+
+#include <boost/thread.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(validationinterface_tests, BasicTestingSetup)
+
+namespace {
+
+class CTestListener : public CValidationInterface
+{
+public:
+    std::vector<const CBlockIndex*> vTips;
+    std::vector<size_t> vSaplingTreeSizes;
+    std::vector<size_t> vBlockTxs;
+    boost::thread::id threadId;
+
+protected:
+    void UpdatedBlockTip(const CBlockIndex* pindex)
+    {
+        vTips.push_back(pindex);
+        threadId = boost::this_thread::get_id();
+    }
+
+    void ChainTip(const CBlockIndex* pindex, const CBlock* pblock, const SproutMerkleTree& sproutTree, const SaplingMerkleTree& saplingTree, bool added)
+    {
+        vSaplingTreeSizes.push_back(saplingTree.size());
+        vBlockTxs.push_back(pblock ? pblock->vtx.size() : 0);
+    }
+};
+
+}
+
+BOOST_AUTO_TEST_CASE(async_listener_in_order)
+{
+    CTestListener listener;
+    RegisterAsyncValidationInterface(&listener);
+    StartValidationInterfaceQueue();
+
+    std::vector<CBlockIndex> vIndex(100);
+    for (const CBlockIndex& index : vIndex)
+        GetMainSignals().UpdatedBlockTip(&index);
+    {
+        // The listener gets its own copies of what only lives for the signal
+        CBlock block;
+        block.vtx.resize(3);
+        SproutMerkleTree sproutTree;
+        SaplingMerkleTree saplingTree;
+        saplingTree.append(uint256S("01"));
+        GetMainSignals().ChainTip(&vIndex[0], &block, sproutTree, saplingTree, true);
+    }
+    SyncWithValidationInterfaceQueue();
+    BOOST_CHECK_EQUAL(ValidationInterfaceQueuePending(), 0);
+
+    BOOST_REQUIRE_EQUAL(listener.vTips.size(), vIndex.size());
+    for (size_t i = 0; i < vIndex.size(); i++)
+        BOOST_CHECK(listener.vTips[i] == &vIndex[i]);
+    BOOST_CHECK(listener.threadId != boost::this_thread::get_id());
+    BOOST_REQUIRE_EQUAL(listener.vSaplingTreeSizes.size(), 1);
+    BOOST_CHECK_EQUAL(listener.vSaplingTreeSizes[0], 1);
+    BOOST_CHECK_EQUAL(listener.vBlockTxs[0], 3);
+
+    StopValidationInterfaceQueue();
+    UnregisterAsyncValidationInterface(&listener);
+}
+
+BOOST_AUTO_TEST_CASE(async_listener_without_queue)
+{
+    // Until the queue runs, the listener is called in place
+    CTestListener listener;
+    RegisterAsyncValidationInterface(&listener);
+    CBlockIndex index;
+    GetMainSignals().UpdatedBlockTip(&index);
+    BOOST_REQUIRE_EQUAL(listener.vTips.size(), 1);
+    BOOST_CHECK(listener.threadId == boost::this_thread::get_id());
+    UnregisterAsyncValidationInterface(&listener);
+
+    GetMainSignals().UpdatedBlockTip(&index);
+    BOOST_CHECK_EQUAL(listener.vTips.size(), 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -7,6 +7,11 @@
 #include "main.h"
 #include "pubkey.h"
 #include "script/sign.h"
+#include "util.h"
+#include "util/parallel.h"
+
+#include <algorithm>
+#include <atomic>
 
 #include <boost/variant.hpp>
 #include <librustzcash.h>
@@ -23,7 +28,8 @@ SpendDescriptionInfo::SpendDescriptionInfo(
 TransactionBuilder::TransactionBuilder(
     const Consensus::Params& consensusParams,
     int nHeight,
-    CKeyStore* keystore) : consensusParams(consensusParams), nHeight(nHeight), keystore(keystore)
+    CKeyStore* keystore) : consensusParams(consensusParams), nHeight(nHeight), keystore(keystore),
+    nThreads(std::min(GetNumCores(), MAX_TRANSACTION_BUILDER_THREADS))
 {
     mtx = CreateNewContextualCMutableTransaction(consensusParams, nHeight);
 }
@@ -138,6 +144,11 @@ void TransactionBuilder::SetFee(CAmount fee)
     this->fee = fee;
 }
 
+void TransactionBuilder::SetThreads(int nThreads)
+{
+    this->nThreads = nThreads;
+}
+
 void TransactionBuilder::SetExpiryHeight(int nHeight)
 {
     this->mtx.nExpiryHeight = nHeight;
@@ -205,22 +216,51 @@ boost::optional<CTransaction> TransactionBuilder::Build()
     // Sapling spends and outputs
     //
 
+    // Nullifiers, witness paths and note encryption do not touch the proving
+    // context, so they are prepared up front on the worker threads. The proofs
+    // themselves all accumulate into the one context that later produces the
+    // binding signature, and are therefore created in order.
+    int nWorkers = std::max(1, std::min(nThreads, MAX_TRANSACTION_BUILDER_THREADS));
+
+    std::vector<boost::optional<uint256>> vSpendNullifiers(spends.size());
+    std::vector<std::vector<unsigned char>> vSpendWitnesses(spends.size());
+    std::vector<boost::optional<uint256>> vOutputCommitments(outputs.size());
+    std::vector<boost::optional<libzcash::SaplingNotePlaintextEncryptionResult>> vOutputEncryptions(outputs.size());
+
+    ParallelFor(spends.size() + outputs.size(), nWorkers, [&](size_t i) {
+        if (i < spends.size()) {
+            const SpendDescriptionInfo& spend = spends[i];
+            if (!spend.note.cm()) {
+                return;
+            }
+            vSpendNullifiers[i] = spend.note.nullifier(
+                spend.expsk.full_viewing_key(), spend.witness.position());
+
+            CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+            ss << spend.witness.path();
+            vSpendWitnesses[i].assign(ss.begin(), ss.end());
+        } else {
+            i -= spends.size();
+            const OutputDescriptionInfo& output = outputs[i];
+            vOutputCommitments[i] = output.note.cm();
+            if (!vOutputCommitments[i]) {
+                return;
+            }
+            libzcash::SaplingNotePlaintext notePlaintext(output.note, output.memo);
+            vOutputEncryptions[i] = notePlaintext.encrypt(output.note.pk_d);
+        }
+    });
+
     auto ctx = librustzcash_sapling_proving_ctx_init();
 
     // Create Sapling SpendDescriptions
-    for (auto spend : spends) {
-        auto cm = spend.note.cm();
-        auto nf = spend.note.nullifier(
-            spend.expsk.full_viewing_key(), spend.witness.position());
-        if (!(cm && nf)) {
+    for (size_t i = 0; i < spends.size(); i++) {
+        const SpendDescriptionInfo& spend = spends[i];
+        if (!vSpendNullifiers[i]) {
             librustzcash_sapling_proving_ctx_free(ctx);
             return boost::none;
         }
 
-        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-        ss << spend.witness.path();
-        std::vector<unsigned char> witness(ss.begin(), ss.end());
-
         SpendDescription sdesc;
         if (!librustzcash_sapling_spend_proof(
                 ctx,
@@ -231,7 +271,7 @@ boost::optional<CTransaction> TransactionBuilder::Build()
                 spend.alpha.begin(),
                 spend.note.value(),
                 spend.anchor.begin(),
-                witness.data(),
+                vSpendWitnesses[i].data(),
                 sdesc.cv.begin(),
                 sdesc.rk.begin(),
                 sdesc.zkproof.data())) {
@@ -240,27 +280,18 @@ boost::optional<CTransaction> TransactionBuilder::Build()
         }
 
         sdesc.anchor = spend.anchor;
-        sdesc.nullifier = *nf;
+        sdesc.nullifier = *vSpendNullifiers[i];
         mtx.vShieldedSpend.push_back(sdesc);
     }
 
     // Create Sapling OutputDescriptions
-    for (auto output : outputs) {
-        auto cm = output.note.cm();
-        if (!cm) {
+    for (size_t i = 0; i < outputs.size(); i++) {
+        const OutputDescriptionInfo& output = outputs[i];
+        if (!(vOutputCommitments[i] && vOutputEncryptions[i])) {
             librustzcash_sapling_proving_ctx_free(ctx);
             return boost::none;
         }
-
-        libzcash::SaplingNotePlaintext notePlaintext(output.note, output.memo);
-
-        auto res = notePlaintext.encrypt(output.note.pk_d);
-        if (!res) {
-            librustzcash_sapling_proving_ctx_free(ctx);
-            return boost::none;
-        }
-        auto enc = res.get();
-        auto encryptor = enc.second;
+        const auto& encryptor = vOutputEncryptions[i]->second;
 
         OutputDescription odesc;
         if (!librustzcash_sapling_output_proof(
@@ -276,9 +307,17 @@ boost::optional<CTransaction> TransactionBuilder::Build()
             return boost::none;
         }
 
-        odesc.cm = *cm;
+        odesc.cm = *vOutputCommitments[i];
         odesc.ephemeralKey = encryptor.get_epk();
-        odesc.encCiphertext = enc.first;
+        odesc.encCiphertext = vOutputEncryptions[i]->first;
+        mtx.vShieldedOutput.push_back(odesc);
+    }
+
+    // The outgoing ciphertexts depend on the value commitments from the proofs
+    ParallelFor(outputs.size(), nWorkers, [&](size_t i) {
+        const OutputDescriptionInfo& output = outputs[i];
+        OutputDescription& odesc = mtx.vShieldedOutput[i];
+        auto& encryptor = vOutputEncryptions[i]->second;
 
         libzcash::SaplingOutgoingPlaintext outPlaintext(output.note.pk_d, encryptor.get_esk());
         odesc.outCiphertext = outPlaintext.encrypt(
@@ -286,8 +325,7 @@ boost::optional<CTransaction> TransactionBuilder::Build()
             odesc.cv,
             odesc.cm,
             encryptor);
-        mtx.vShieldedOutput.push_back(odesc);
-    }
+    });
 
     // add op_return if there is one to add
     AddOpRetLast();
@@ -309,13 +347,13 @@ boost::optional<CTransaction> TransactionBuilder::Build()
     }
 
     // Create Sapling spendAuth and binding signatures
-    for (size_t i = 0; i < spends.size(); i++) {
+    ParallelFor(spends.size(), nWorkers, [&](size_t i) {
         librustzcash_sapling_spend_sig(
             spends[i].expsk.ask.begin(),
             spends[i].alpha.begin(),
             dataToBeSigned.begin(),
             mtx.vShieldedSpend[i].spendAuthSig.data());
-    }
+    });
     librustzcash_sapling_binding_sig(
         ctx,
         mtx.valueBalance,
@@ -326,20 +364,37 @@ boost::optional<CTransaction> TransactionBuilder::Build()
 
     // Transparent signatures
     CTransaction txNewConst(mtx);
+    std::vector<std::pair<CScript, CAmount>> vCoins;
+    for (const TransparentInputInfo& tIn : tIns) {
+        vCoins.push_back(std::make_pair(tIn.scriptPubKey, tIn.value));
+    }
+    std::vector<SignatureData> vSigData;
+    if (!ProduceSignatures(keystore, txNewConst, vCoins, SIGHASH_ALL, consensusBranchId, vSigData, nThreads)) {
+        return boost::none;
+    }
     for (int nIn = 0; nIn < mtx.vin.size(); nIn++) {
-        auto tIn = tIns[nIn];
-        SignatureData sigdata;
-        bool signSuccess = ProduceSignature(
-            TransactionSignatureCreator(
-                keystore, &txNewConst, nIn, tIn.value, SIGHASH_ALL),
-            tIn.scriptPubKey, sigdata, consensusBranchId);
-
-        if (!signSuccess) {
-            return boost::none;
-        } else {
-            UpdateTransaction(mtx, nIn, sigdata);
-        }
+        UpdateTransaction(mtx, nIn, vSigData[nIn]);
     }
 
     return CTransaction(mtx);
 }
+
+std::vector<boost::optional<CTransaction>> BuildTransactions(std::vector<TransactionBuilder>& builders, int nThreads,
+                                                             std::atomic<size_t>* pnBuilt)
+{
+    std::vector<boost::optional<CTransaction>> results(builders.size());
+    int nWorkers = std::max(1, std::min(nThreads, (int)builders.size()));
+
+    // Share the cores between the transactions built at the same time
+    int nBuilderThreads = std::max(1, std::min(GetNumCores(), MAX_TRANSACTION_BUILDER_THREADS) / nWorkers);
+    for (TransactionBuilder& builder : builders) {
+        builder.SetThreads(nBuilderThreads);
+    }
+
+    ParallelFor(builders.size(), nWorkers, [&](size_t i) {
+        results[i] = builders[i].Build();
+        if (pnBuilt)
+            ++*pnBuilt;
+    });
+    return results;
+}
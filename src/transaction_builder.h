@@ -18,8 +18,13 @@
 #include "zcash/Note.hpp"
 #include "zcash/NoteEncryption.hpp"
 
+#include <atomic>
+
 #include <boost/optional.hpp>
 
+//! Upper bound on the worker threads Build() uses to prepare Sapling descriptions
+static const int MAX_TRANSACTION_BUILDER_THREADS = 8;
+
 struct SpendDescriptionInfo {
     libzcash::SaplingExpandedSpendingKey expsk;
     libzcash::SaplingNote note;
@@ -123,6 +128,7 @@ private:
     const CKeyStore* keystore;
     CMutableTransaction mtx;
     CAmount fee = 10000;
+    int nThreads = 1;
 
     std::vector<SpendDescriptionInfo> spends;
     std::vector<OutputDescriptionInfo> outputs;
@@ -156,6 +162,10 @@ public:
 
     void SetExpiryHeight(int nHeight);
 
+    // Sets the number of threads Build() may use, capped at
+    // MAX_TRANSACTION_BUILDER_THREADS.
+    void SetThreads(int nThreads);
+
     CTransaction getTransaction() {return mtx;}
 
     // Returns false if the anchor does not match the anchor used by
@@ -202,4 +212,11 @@ public:
     boost::optional<CTransaction> Build();
 };
 
+// Builds independent transactions on up to nThreads threads, each with its
+// own proving context. The builders must not spend the same notes. Results
+// are returned in builder order. If pnBuilt is given it is incremented as
+// each transaction is done, for the progress of the caller's operation.
+std::vector<boost::optional<CTransaction>> BuildTransactions(std::vector<TransactionBuilder>& builders, int nThreads,
+                                                             std::atomic<size_t>* pnBuilt = nullptr);
+
 #endif /* TRANSACTION_BUILDER_H */
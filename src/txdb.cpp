@@ -20,8 +20,14 @@
 
 #include "txdb.h"
 
+#include "ccindex.h"
 #include "chainparams.h"
+#include "coinstats.h"
+#include "compactblockindex.h"
+#include "crypto/muhash.h"
 #include "hash.h"
+#include "indexbuilder.h"
+#include "kvindex.h"
 #include "main.h"
 #include "pow.h"
 #include "uint256.h"
@@ -29,8 +35,12 @@
 
 #include "ui_interface.h"
 #include "init.h"
+#include "util/parallel.h"
 
 #include <stdint.h>
+#include <atomic>
+#include <set>
+#include <type_traits>
 
 #include <boost/thread.hpp>
 
@@ -50,6 +60,10 @@ static const char DB_ADDRESSUNSPENTINDEX = 'u';
 static const char DB_TIMESTAMPINDEX = 'S';
 static const char DB_BLOCKHASHINDEX = 'z';
 static const char DB_SPENTINDEX = 'p';
+static const char DB_COMPACTBLOCKINDEX = 'k';
+static const char DB_SAPLING_COMMITMENTS = 'W';
+static const char DB_KVINDEX = 'V';
+static const char DB_KVUNDO = 'v';
 static const char DB_BLOCK_INDEX = 'b';
 
 static const char DB_BEST_BLOCK = 'B';
@@ -58,6 +72,18 @@ static const char DB_BEST_SAPLING_ANCHOR = 'z';
 static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
+static const char DB_SNAPSHOT_BASE = 'L';
+static const char DB_INDEX_BUILD = 'I';
+static const char DB_COINSTATS = 'C';
+static const char DB_COINSTATS_HASH = 'H';
+static const char DB_CCUNSPENTINDEX = 'e';
+static const char DB_CCOUTPOINT = 'E';
+static const char DB_TOKENUNSPENTINDEX = 'o';
+static const char DB_TOKENOUTPOINT = 'O';
+static const char DB_TOKENINFO = 'N';
+static const char DB_ORACLEDATAINDEX = 'D';
+static const char DB_GATEWAYSINDEX = 'G';
+static const char DB_HEAD_BLOCKS = 'h';
 
 
 CCoinsViewDB::CCoinsViewDB(std::string dbName, size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / dbName, nCacheSize, fMemory, fWipe) {
@@ -81,15 +107,51 @@ bool CCoinsViewDB::GetSproutAnchorAt(const uint256 &rt, SproutMerkleTree &tree)
 }
 
 bool CCoinsViewDB::GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree) const {
+    std::shared_ptr<const SaplingMerkleTree> sharedTree = GetSharedSaplingAnchorAt(rt);
+    if (!sharedTree)
+        return false;
+
+    tree = *sharedTree;
+    return true;
+}
+
+std::shared_ptr<const SaplingMerkleTree> CCoinsViewDB::GetSharedSaplingAnchorAt(const uint256 &rt) const {
     if (rt == SaplingMerkleTree::empty_root()) {
-        SaplingMerkleTree new_tree;
-        tree = new_tree;
-        return true;
+        return std::make_shared<SaplingMerkleTree>();
+    }
+
+    {
+        LOCK(cs_saplingAnchorCache);
+        std::map<uint256, SaplingAnchorLRU::iterator>::iterator it = mapSaplingAnchorCache.find(rt);
+        if (it != mapSaplingAnchorCache.end()) {
+            lruSaplingAnchors.splice(lruSaplingAnchors.begin(), lruSaplingAnchors, it->second);
+            return it->second->second;
+        }
     }
 
-    bool read = db.Read(make_pair(DB_SAPLING_ANCHOR, rt), tree);
+    std::shared_ptr<SaplingMerkleTree> tree = std::make_shared<SaplingMerkleTree>();
+    if (!db.Read(make_pair(DB_SAPLING_ANCHOR, rt), *tree))
+        return nullptr;
+
+    LOCK(cs_saplingAnchorCache);
+    if (mapSaplingAnchorCache.count(rt) == 0) {
+        lruSaplingAnchors.push_front(std::make_pair(rt, tree));
+        mapSaplingAnchorCache[rt] = lruSaplingAnchors.begin();
+        if (lruSaplingAnchors.size() > SAPLING_ANCHOR_CACHE_SIZE) {
+            mapSaplingAnchorCache.erase(lruSaplingAnchors.back().first);
+            lruSaplingAnchors.pop_back();
+        }
+    }
+    return tree;
+}
 
-    return read;
+void CCoinsViewDB::UncacheSaplingAnchor(const uint256 &rt) {
+    LOCK(cs_saplingAnchorCache);
+    std::map<uint256, SaplingAnchorLRU::iterator>::iterator it = mapSaplingAnchorCache.find(rt);
+    if (it != mapSaplingAnchorCache.end()) {
+        lruSaplingAnchors.erase(it->second);
+        mapSaplingAnchorCache.erase(it);
+    }
 }
 
 bool CCoinsViewDB::GetNullifier(const uint256 &nf, ShieldedType type) const {
@@ -105,6 +167,11 @@ bool CCoinsViewDB::GetNullifier(const uint256 &nf, ShieldedType type) const {
         default:
             throw runtime_error("Unknown shielded type");
     }
+    {
+        LOCK(cs_nullifierFilters);
+        if (nullifierFilters[type] && !nullifierFilters[type]->contains(nf))
+            return false;
+    }
     return db.Read(make_pair(dbChar, nf), spent);
 }
 
@@ -142,25 +209,24 @@ uint256 CCoinsViewDB::GetBestAnchor(ShieldedType type) const {
     return hashBestAnchor;
 }
 
-void BatchWriteNullifiers(CDBBatch& batch, CNullifiersMap& mapToUse, const char& dbChar)
+void BatchWriteNullifiers(CDBBatch& batch, const CNullifiersMap& mapToUse, const char& dbChar, const std::function<void()>& writeIfFull)
 {
-    for (CNullifiersMap::iterator it = mapToUse.begin(); it != mapToUse.end();) {
+    for (CNullifiersMap::const_iterator it = mapToUse.begin(); it != mapToUse.end(); ++it) {
         if (it->second.flags & CNullifiersCacheEntry::DIRTY) {
             if (!it->second.entered)
                 batch.Erase(make_pair(dbChar, it->first));
             else
                 batch.Write(make_pair(dbChar, it->first), true);
             // TODO: changed++? ... See comment in CCoinsViewDB::BatchWrite. If this is needed we could return an int
+            writeIfFull();
         }
-        CNullifiersMap::iterator itOld = it++;
-        mapToUse.erase(itOld);
     }
 }
 
 template<typename Map, typename MapIterator, typename MapEntry, typename Tree>
-void BatchWriteAnchors(CDBBatch& batch, Map& mapToUse, const char& dbChar)
+void BatchWriteAnchors(CDBBatch& batch, const Map& mapToUse, const char& dbChar, const std::function<void()>& writeIfFull)
 {
-    for (MapIterator it = mapToUse.begin(); it != mapToUse.end();) {
+    for (MapIterator it = mapToUse.begin(); it != mapToUse.end(); ++it) {
         if (it->second.flags & MapEntry::DIRTY) {
             if (!it->second.entered)
                 batch.Erase(make_pair(dbChar, it->first));
@@ -170,9 +236,21 @@ void BatchWriteAnchors(CDBBatch& batch, Map& mapToUse, const char& dbChar)
                 }
             }
             // TODO: changed++?
+            writeIfFull();
+        }
+    }
+}
+
+void CCoinsViewDB::AddToNullifierFilters(const CNullifiersMap &mapNullifiers, ShieldedType type) {
+    AssertLockHeld(cs_nullifierFilters);
+    // Spends that are undone stay in the filters, which only costs a disk read
+    for (CNullifiersMap::const_iterator it = mapNullifiers.begin(); it != mapNullifiers.end(); ++it) {
+        if ((it->second.flags & CNullifiersCacheEntry::DIRTY) && it->second.entered) {
+            if (nullifierFilters[type])
+                nullifierFilters[type]->insert(it->first);
+            if (loadingNullifierFilters[type])
+                loadingNullifierFilters[type]->insert(it->first);
         }
-        MapIterator itOld = it++;
-        mapToUse.erase(itOld);
     }
 }
 
@@ -184,27 +262,68 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins,
                               CAnchorsSaplingMap &mapSaplingAnchors,
                               CNullifiersMap &mapSproutNullifiers,
                               CNullifiersMap &mapSaplingNullifiers) {
+    // Held until the batch is written, so a filter being loaded either sees
+    // these nullifiers in its database snapshot or gets them added here
+    LOCK(cs_nullifierFilters);
+    AddToNullifierFilters(mapSproutNullifiers, SPROUT);
+    AddToNullifierFilters(mapSaplingNullifiers, SAPLING);
+
+    // A large flush is written in several batches, so LevelDB is not handed
+    // one the size of the cache. The first one also writes the blocks the
+    // database goes from and to, which the last one erases with the best
+    // block; until then the database is between both and is not used.
+    const size_t nBatchSize = std::max<int64_t>(GetArg("-dbbatchsize", nDefaultDbBatchSize), 1 << 20);
+    const int64_t nStart = GetTimeMicros();
     CDBBatch batch(db);
+    size_t nBatches = 0, nBytes = 0, nLargest = 0;
+    auto writeBatch = [&]() {
+        nBatches++;
+        nBytes += batch.SizeEstimate();
+        nLargest = std::max(nLargest, batch.SizeEstimate());
+        db.WriteBatch(batch);
+        batch.Clear();
+    };
+    std::function<void()> writeIfFull = [&]() {
+        if (batch.SizeEstimate() < nBatchSize)
+            return;
+        if (nBatches == 0) {
+            uint256 hashOld = GetBestBlock();
+            std::vector<uint256> vHeads;
+            vHeads.push_back(hashBlock.IsNull() ? hashOld : hashBlock);
+            vHeads.push_back(hashOld);
+            batch.Write(DB_HEAD_BLOCKS, vHeads);
+        }
+        LogPrint("coindb", "Writing partial batch of %.2f MiB\n", batch.SizeEstimate() * (1.0 / 1048576.0));
+        writeBatch();
+    };
+
     size_t count = 0;
     size_t changed = 0;
-    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
+    // The maps are only read, so CCoinsViewAsyncFlush can serve them to
+    // other threads while they are being written
+    for (CCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); ++it) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
             if (it->second.coins.IsPruned())
                 batch.Erase(make_pair(DB_COINS, it->first));
             else
                 batch.Write(make_pair(DB_COINS, it->first), it->second.coins);
             changed++;
+            writeIfFull();
         }
         count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
     }
 
-    ::BatchWriteAnchors<CAnchorsSproutMap, CAnchorsSproutMap::iterator, CAnchorsSproutCacheEntry, SproutMerkleTree>(batch, mapSproutAnchors, DB_SPROUT_ANCHOR);
-    ::BatchWriteAnchors<CAnchorsSaplingMap, CAnchorsSaplingMap::iterator, CAnchorsSaplingCacheEntry, SaplingMerkleTree>(batch, mapSaplingAnchors, DB_SAPLING_ANCHOR);
+    // Trees of removed anchors must not be served from memory afterwards
+    for (CAnchorsSaplingMap::iterator it = mapSaplingAnchors.begin(); it != mapSaplingAnchors.end(); ++it) {
+        if ((it->second.flags & CAnchorsSaplingCacheEntry::DIRTY) && !it->second.entered)
+            UncacheSaplingAnchor(it->first);
+    }
+
+    ::BatchWriteAnchors<CAnchorsSproutMap, CAnchorsSproutMap::const_iterator, CAnchorsSproutCacheEntry, SproutMerkleTree>(batch, mapSproutAnchors, DB_SPROUT_ANCHOR, writeIfFull);
+    ::BatchWriteAnchors<CAnchorsSaplingMap, CAnchorsSaplingMap::const_iterator, CAnchorsSaplingCacheEntry, SaplingMerkleTree>(batch, mapSaplingAnchors, DB_SAPLING_ANCHOR, writeIfFull);
 
-    ::BatchWriteNullifiers(batch, mapSproutNullifiers, DB_NULLIFIER);
-    ::BatchWriteNullifiers(batch, mapSaplingNullifiers, DB_SAPLING_NULLIFIER);
+    ::BatchWriteNullifiers(batch, mapSproutNullifiers, DB_NULLIFIER, writeIfFull);
+    ::BatchWriteNullifiers(batch, mapSaplingNullifiers, DB_SAPLING_NULLIFIER, writeIfFull);
 
     if (!hashBlock.IsNull())
         batch.Write(DB_BEST_BLOCK, hashBlock);
@@ -212,12 +331,120 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins,
         batch.Write(DB_BEST_SPROUT_ANCHOR, hashSproutAnchor);
     if (!hashSaplingAnchor.IsNull())
         batch.Write(DB_BEST_SAPLING_ANCHOR, hashSaplingAnchor);
+    if (nBatches > 0)
+        batch.Erase(DB_HEAD_BLOCKS);
 
     LogPrint("coindb", "Committing %u changed transactions (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
-    return db.WriteBatch(batch);
+    writeBatch();
+    LogPrint("coindb", "Committed %.2f MiB in %u batches (largest %.2f MiB) to coin database in %.2fms\n",
+        nBytes * (1.0 / 1048576.0), (unsigned int)nBatches, nLargest * (1.0 / 1048576.0), (GetTimeMicros() - nStart) * 0.001);
+    return true;
 }
 
-CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe, bool compression, int maxOpenFiles) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe, compression, maxOpenFiles) {
+std::vector<uint256> CCoinsViewDB::GetHeadBlocks() const {
+    std::vector<uint256> vHeads;
+    if (!db.Read(DB_HEAD_BLOCKS, vHeads))
+        return std::vector<uint256>();
+    return vHeads;
+}
+
+const char* BlockTreeIndexName(BlockTreeIndex index)
+{
+    static const char* const vNames[BLOCKTREE_INDEX_COUNT] = {"txindex", "addressindex", "addressunspent", "spentindex", "timestampindex", "coinstats", "ccindex"};
+    return vNames[index];
+}
+
+CBlockTreeDBSizes CBlockTreeDBSizes::Split(size_t nTotalCache, int nTotalFiles, bool fTxIndex, bool fAddressIndex, bool fSpentIndex, bool fTimestampIndex, bool fCoinStatsIndex, bool fCCIndex)
+{
+    static const size_t nMinCache = 1 << 20;
+    static const int nMinFiles = 64;
+    // Relative load of the block index and of each index, the address indexes take most of the writes and scans
+    static const int nBlockIndexWeight = 2;
+    static const int vIndexWeight[BLOCKTREE_INDEX_COUNT] = {2, 3, 3, 2, 1, 1, 2};
+    const bool vEnabled[BLOCKTREE_INDEX_COUNT] = {fTxIndex, fAddressIndex, fAddressIndex, fSpentIndex, fTimestampIndex, fCoinStatsIndex, fCCIndex};
+
+    // Disabled indexes only hold their minimal share, the rest goes to the enabled ones
+    size_t nFreeCache = nTotalCache;
+    int nFreeFiles = nTotalFiles;
+    int nTotalWeight = nBlockIndexWeight;
+    for (int i = 0; i < BLOCKTREE_INDEX_COUNT; i++) {
+        if (vEnabled[i]) {
+            nTotalWeight += vIndexWeight[i];
+        } else {
+            nFreeCache -= std::min(nFreeCache, nMinCache);
+            nFreeFiles -= std::min(nFreeFiles, nMinFiles);
+        }
+    }
+
+    CBlockTreeDBSizes sizes;
+    sizes.nBlockIndexCache = std::max(nMinCache, nFreeCache / nTotalWeight * nBlockIndexWeight);
+    sizes.nBlockIndexFiles = std::max(nMinFiles, nFreeFiles / nTotalWeight * nBlockIndexWeight);
+    for (int i = 0; i < BLOCKTREE_INDEX_COUNT; i++) {
+        sizes.vIndexCache[i] = vEnabled[i] ? std::max(nMinCache, nFreeCache / nTotalWeight * vIndexWeight[i]) : nMinCache;
+        sizes.vIndexFiles[i] = vEnabled[i] ? std::max(nMinFiles, nFreeFiles / nTotalWeight * vIndexWeight[i]) : nMinFiles;
+    }
+    return sizes;
+}
+
+/**
+ * Moves the entries with the given key prefix from the block index database
+ * to an index database. Each batch is synced to the index database before it
+ * is erased from the block index, so an interrupted move is picked up again
+ * on the next start.
+ */
+static bool MoveEntries(CDBWrapper& from, CDBWrapper& to, char chPrefix, const char* pszName)
+{
+    static const size_t nBatchBytes = 16 << 20;
+
+    boost::scoped_ptr<CDBIterator> pcursor(from.NewIterator());
+    pcursor->Seek(chPrefix);
+
+    uint64_t nMoved = 0;
+    std::string strKey, strValue;
+    while (true) {
+        CDBBatch batchTo(to);
+        CDBBatch batchFrom(from);
+        size_t nBytes = 0;
+        for (; pcursor->Valid() && nBytes < nBatchBytes; pcursor->Next()) {
+            pcursor->GetRaw(strKey, strValue);
+            if (strKey.empty() || strKey[0] != chPrefix)
+                break;
+            batchTo.WriteRaw(strKey, strValue);
+            batchFrom.EraseRaw(strKey);
+            nBytes += strKey.size() + strValue.size();
+            nMoved++;
+        }
+        if (nBytes == 0)
+            break;
+        if (!to.WriteBatch(batchTo, true) || !from.WriteBatch(batchFrom))
+            return error("%s: failed to move %s entries", __func__, pszName);
+    }
+    if (nMoved > 0)
+        LogPrintf("Moved %u %s entries out of the block index database\n", nMoved, pszName);
+    return true;
+}
+
+CBlockTreeDB::CBlockTreeDB(const CBlockTreeDBSizes& sizes, bool fMemory, bool fWipe, bool compression) : CDBWrapper(GetDataDir() / "blocks" / "index", sizes.nBlockIndexCache, fMemory, fWipe, compression, sizes.nBlockIndexFiles) {
+    OpenIndexes(sizes, fMemory, fWipe, compression);
+}
+
+CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe, bool compression, int maxOpenFiles) : CBlockTreeDB(CBlockTreeDBSizes::Split(nCacheSize, maxOpenFiles, true, true, true, true, true, true), fMemory, fWipe, compression) {
+}
+
+void CBlockTreeDB::OpenIndexes(const CBlockTreeDBSizes& sizes, bool fMemory, bool fWipe, bool compression)
+{
+    for (int i = 0; i < BLOCKTREE_INDEX_COUNT; i++)
+        vIndexDB[i].reset(new CDBWrapper(GetDataDir() / "blocks" / BlockTreeIndexName((BlockTreeIndex)i), sizes.vIndexCache[i], fMemory, fWipe, compression, sizes.vIndexFiles[i]));
+
+    if (fWipe)
+        return;
+    // Trees written before the indexes had their own databases keep them in blocks/index
+    MoveEntries(*this, IndexDB(BLOCKTREE_TXINDEX), DB_TXINDEX, "txindex");
+    MoveEntries(*this, IndexDB(BLOCKTREE_ADDRESSINDEX), DB_ADDRESSINDEX, "addressindex");
+    MoveEntries(*this, IndexDB(BLOCKTREE_ADDRESSUNSPENT), DB_ADDRESSUNSPENTINDEX, "addressunspent");
+    MoveEntries(*this, IndexDB(BLOCKTREE_SPENTINDEX), DB_SPENTINDEX, "spentindex");
+    MoveEntries(*this, IndexDB(BLOCKTREE_TIMESTAMPINDEX), DB_TIMESTAMPINDEX, "timestampindex");
+    MoveEntries(*this, IndexDB(BLOCKTREE_TIMESTAMPINDEX), DB_BLOCKHASHINDEX, "blockhashindex");
 }
 
 bool CBlockTreeDB::ReadBlockFileInfo(int nFile, CBlockFileInfo &info) {
@@ -286,16 +513,168 @@ bool CCoinsViewDB::GetStats(CCoinsStats &stats) const {
     return true;
 }
 
+//! Reads the value of a single character key through a cursor, so it matches what the cursor iterates
+template <typename V>
+static bool ReadAtCursor(CDBIterator *pcursor, char key, V &value) {
+    char keyFound;
+    pcursor->Seek(key);
+    return pcursor->Valid() && pcursor->GetKeySize() == 1 && pcursor->GetKey(keyFound) && keyFound == key &&
+        pcursor->GetValue(value);
+}
+
+//! Writes every record with a key prefix dbChar as type, key and, unless it is a nullifier, value
+template <typename V>
+static bool WriteSnapshotRecords(CDBIterator *pcursor, CHashForwarder<CAutoFile> &stream, char dbChar, unsigned char type, uint64_t &nRecords) {
+    pcursor->Seek(dbChar);
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        std::pair<char, uint256> key;
+        if (!pcursor->GetKey(key) || key.first != dbChar)
+            break;
+        stream << type << key.second;
+        if (!std::is_same<V, bool>::value) {
+            V value;
+            if (!pcursor->GetValue(value))
+                return error("CCoinsViewDB::WriteSnapshot() : unable to read value");
+            stream << value;
+        }
+        nRecords++;
+        pcursor->Next();
+    }
+    return true;
+}
+
+bool CCoinsViewDB::WriteSnapshot(CAutoFile &file, CCoinsSnapshotMetadata &metadata, uint256 &hashChecksum) const {
+    // The cursor sees the database as of its creation, so the best block and
+    // anchors are read through it to match the records
+    boost::scoped_ptr<CDBIterator> pcursor(const_cast<CDBWrapper*>(&db)->NewIterator());
+    if (!ReadAtCursor(pcursor.get(), DB_BEST_BLOCK, metadata.hashBlock))
+        return error("CCoinsViewDB::WriteSnapshot() : no best block");
+    if (!ReadAtCursor(pcursor.get(), DB_BEST_SPROUT_ANCHOR, metadata.hashSproutAnchor))
+        metadata.hashSproutAnchor = SproutMerkleTree::empty_root();
+    if (!ReadAtCursor(pcursor.get(), DB_BEST_SAPLING_ANCHOR, metadata.hashSaplingAnchor))
+        metadata.hashSaplingAnchor = SaplingMerkleTree::empty_root();
+    {
+        LOCK(cs_main);
+        BlockMap::const_iterator it = mapBlockIndex.find(metadata.hashBlock);
+        if (it == mapBlockIndex.end())
+            return error("CCoinsViewDB::WriteSnapshot() : best block not in the block index");
+        metadata.nHeight = it->second->GetHeight();
+        metadata.nChainTx = it->second->nChainTx;
+    }
+
+    CHashForwarder<CAutoFile> stream(&file);
+    stream << metadata;
+    uint64_t nRecords = 0;
+    if (!WriteSnapshotRecords<CCoins>(pcursor.get(), stream, DB_COINS, SNAPSHOT_RECORD_COINS, nRecords) ||
+        !WriteSnapshotRecords<SproutMerkleTree>(pcursor.get(), stream, DB_SPROUT_ANCHOR, SNAPSHOT_RECORD_SPROUT_ANCHOR, nRecords) ||
+        !WriteSnapshotRecords<SaplingMerkleTree>(pcursor.get(), stream, DB_SAPLING_ANCHOR, SNAPSHOT_RECORD_SAPLING_ANCHOR, nRecords) ||
+        !WriteSnapshotRecords<bool>(pcursor.get(), stream, DB_NULLIFIER, SNAPSHOT_RECORD_SPROUT_NULLIFIER, nRecords) ||
+        !WriteSnapshotRecords<bool>(pcursor.get(), stream, DB_SAPLING_NULLIFIER, SNAPSHOT_RECORD_SAPLING_NULLIFIER, nRecords))
+        return false;
+    stream << (unsigned char)SNAPSHOT_RECORD_END;
+    hashChecksum = stream.GetHash();
+    file << hashChecksum;
+
+    LogPrintf("Wrote a snapshot of %u records at height %d\n", nRecords, metadata.nHeight);
+    return true;
+}
+
+bool CCoinsViewDB::ForEachCoins(uint256 &hashBlock, const std::function<void(const uint256&, const CCoins&)>& visit) const {
+    boost::scoped_ptr<CDBIterator> pcursor(const_cast<CDBWrapper*>(&db)->NewIterator());
+    if (!ReadAtCursor(pcursor.get(), DB_BEST_BLOCK, hashBlock))
+        return error("CCoinsViewDB::ForEachCoins() : no best block");
+
+    for (pcursor->Seek(DB_COINS); pcursor->Valid(); pcursor->Next()) {
+        boost::this_thread::interruption_point();
+        std::pair<char, uint256> key;
+        CCoins coins;
+        if (!pcursor->GetKey(key) || key.first != DB_COINS)
+            break;
+        if (!pcursor->GetValue(coins))
+            return error("CCoinsViewDB::ForEachCoins() : unable to read value");
+        visit(key.second, coins);
+    }
+    return true;
+}
+
+void CCoinsViewDB::LoadNullifierFilters() {
+    int64_t nStart = GetTimeMillis();
+    boost::scoped_ptr<CDBIterator> pcursor;
+    {
+        LOCK(cs_nullifierFilters);
+        loadingNullifierFilters[SPROUT].reset(new CScalableBloomFilter(NULLIFIER_FILTER_INITIAL_CAPACITY, NULLIFIER_FILTER_FP_RATE));
+        loadingNullifierFilters[SAPLING].reset(new CScalableBloomFilter(NULLIFIER_FILTER_INITIAL_CAPACITY, NULLIFIER_FILTER_FP_RATE));
+        pcursor.reset(db.NewIterator());
+    }
+
+    try {
+        const ShieldedType types[] = {SPROUT, SAPLING};
+        for (ShieldedType type : types) {
+            char dbChar = type == SPROUT ? DB_NULLIFIER : DB_SAPLING_NULLIFIER;
+            std::vector<uint256> vNullifiers;
+            pcursor->Seek(dbChar);
+            while (true) {
+                std::pair<char, uint256> key;
+                bool fValid = pcursor->Valid() && pcursor->GetKey(key) && key.first == dbChar;
+                if (fValid) {
+                    vNullifiers.push_back(key.second);
+                    pcursor->Next();
+                }
+                if (!fValid || vNullifiers.size() >= 4096) {
+                    boost::this_thread::interruption_point();
+                    LOCK(cs_nullifierFilters);
+                    for (const uint256& nf : vNullifiers) {
+                        loadingNullifierFilters[type]->insert(nf);
+                    }
+                    vNullifiers.clear();
+                }
+                if (!fValid)
+                    break;
+            }
+        }
+    } catch (const boost::thread_interrupted&) {
+        LOCK(cs_nullifierFilters);
+        loadingNullifierFilters[SPROUT].reset();
+        loadingNullifierFilters[SAPLING].reset();
+        throw;
+    }
+
+    LOCK(cs_nullifierFilters);
+    nullifierFilters[SPROUT] = std::move(loadingNullifierFilters[SPROUT]);
+    nullifierFilters[SAPLING] = std::move(loadingNullifierFilters[SAPLING]);
+    LogPrintf("Loaded nullifier filters: %u Sprout, %u Sapling nullifiers, %u KiB, %dms\n",
+        nullifierFilters[SPROUT]->size(), nullifierFilters[SAPLING]->size(),
+        (nullifierFilters[SPROUT]->GetMemorySize() + nullifierFilters[SAPLING]->GetMemorySize()) / 1024,
+        GetTimeMillis() - nStart);
+}
+
 bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo) {
+    // Entries are written in batches of at most -dbbatchsize, the last one
+    // synced. Each entry stands on its own, and the file info goes first so
+    // no entry points past the end the block files are known to have.
+    const size_t nBatchSize = std::max<int64_t>(GetArg("-dbbatchsize", nDefaultDbBatchSize), 1 << 20);
+    const int64_t nStart = GetTimeMicros();
     CDBBatch batch(*this);
+    size_t nBatches = 1, nBytes = 0;
     for (std::vector<std::pair<int, const CBlockFileInfo*> >::const_iterator it=fileInfo.begin(); it != fileInfo.end(); it++) {
         batch.Write(make_pair(DB_BLOCK_FILES, it->first), *it->second);
     }
     batch.Write(DB_LAST_BLOCK, nLastFile);
     for (std::vector<const CBlockIndex*>::const_iterator it=blockinfo.begin(); it != blockinfo.end(); it++) {
         batch.Write(make_pair(DB_BLOCK_INDEX, (*it)->GetBlockHash()), CDiskBlockIndex(*it));
+        if (batch.SizeEstimate() >= nBatchSize) {
+            nBatches++;
+            nBytes += batch.SizeEstimate();
+            WriteBatch(batch);
+            batch.Clear();
+        }
     }
-    return WriteBatch(batch, true);
+    nBytes += batch.SizeEstimate();
+    WriteBatch(batch, true);
+    LogPrint("coindb", "Committed %.2f MiB in %u batches to block index in %.2fms\n",
+        nBytes * (1.0 / 1048576.0), (unsigned int)nBatches, (GetTimeMicros() - nStart) * 0.001);
+    return true;
 }
 
 bool CBlockTreeDB::EraseBatchSync(const std::vector<const CBlockIndex*>& blockinfo) {
@@ -306,23 +685,31 @@ bool CBlockTreeDB::EraseBatchSync(const std::vector<const CBlockIndex*>& blockin
     return WriteBatch(batch, true);
 }
 
+bool CBlockTreeDB::ReadDiskBlockIndex(const uint256& hash, CDiskBlockIndex& dbindex) {
+    return Read(make_pair(DB_BLOCK_INDEX, hash), dbindex);
+}
+
 bool CBlockTreeDB::ReadTxIndex(const uint256 &txid, CDiskTxPos &pos) {
-    return Read(make_pair(DB_TXINDEX, txid), pos);
+    CDBWrapper& db = IndexDB(BLOCKTREE_TXINDEX);
+    return db.Read(make_pair(DB_TXINDEX, txid), pos);
 }
 
 bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> >&vect) {
-    CDBBatch batch(*this);
+    CDBWrapper& db = IndexDB(BLOCKTREE_TXINDEX);
+    CDBBatch batch(db);
     for (std::vector<std::pair<uint256,CDiskTxPos> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
         batch.Write(make_pair(DB_TXINDEX, it->first), it->second);
-    return WriteBatch(batch);
+    return db.WriteBatch(batch);
 }
 
 bool CBlockTreeDB::ReadSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value) {
-    return Read(make_pair(DB_SPENTINDEX, key), value);
+    CDBWrapper& db = IndexDB(BLOCKTREE_SPENTINDEX);
+    return db.Read(make_pair(DB_SPENTINDEX, key), value);
 }
 
 bool CBlockTreeDB::UpdateSpentIndex(const std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> >&vect) {
-    CDBBatch batch(*this);
+    CDBWrapper& db = IndexDB(BLOCKTREE_SPENTINDEX);
+    CDBBatch batch(db);
     for (std::vector<std::pair<CSpentIndexKey,CSpentIndexValue> >::const_iterator it=vect.begin(); it!=vect.end(); it++) {
         if (it->second.IsNull()) {
             batch.Erase(make_pair(DB_SPENTINDEX, it->first));
@@ -330,11 +717,12 @@ bool CBlockTreeDB::UpdateSpentIndex(const std::vector<std::pair<CSpentIndexKey,
             batch.Write(make_pair(DB_SPENTINDEX, it->first), it->second);
         }
     }
-    return WriteBatch(batch);
+    return db.WriteBatch(batch);
 }
 
 bool CBlockTreeDB::UpdateAddressUnspentIndex(const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue > >&vect) {
-    CDBBatch batch(*this);
+    CDBWrapper& db = IndexDB(BLOCKTREE_ADDRESSUNSPENT);
+    CDBBatch batch(db);
     for (std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator it=vect.begin(); it!=vect.end(); it++) {
         if (it->second.IsNull()) {
             batch.Erase(make_pair(DB_ADDRESSUNSPENTINDEX, it->first));
@@ -342,97 +730,104 @@ bool CBlockTreeDB::UpdateAddressUnspentIndex(const std::vector<std::pair<CAddres
             batch.Write(make_pair(DB_ADDRESSUNSPENTINDEX, it->first), it->second);
         }
     }
-    return WriteBatch(batch);
+    return db.WriteBatch(batch);
 }
 
 bool CBlockTreeDB::ReadAddressUnspentIndex(uint160 addressHash, int type,
                                            std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &unspentOutputs) {
+    return ReadAddressUnspentIndex(CAddressUnspentKey(type, addressHash, uint256(), 0),
+        [&](const CAddressUnspentKey& key, const CAddressUnspentValue& value) {
+            unspentOutputs.push_back(make_pair(key, value));
+            return true;
+        });
+}
 
-    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+bool CBlockTreeDB::ReadAddressUnspentIndex(const CAddressUnspentKey& start, const AddressUnspentVisitor& visit) {
+    CDBWrapper& db = IndexDB(BLOCKTREE_ADDRESSUNSPENT);
+    boost::scoped_ptr<CDBIterator> pcursor(db.NewIterator());
 
-    pcursor->Seek(make_pair(DB_ADDRESSUNSPENTINDEX, CAddressIndexIteratorKey(type, addressHash)));
+    pcursor->Seek(make_pair(DB_ADDRESSUNSPENTINDEX, start));
 
     while (pcursor->Valid()) {
         boost::this_thread::interruption_point();
+        pair<char, CAddressUnspentKey> keyObj;
         try {
-            CDataStream ssKey(SER_DISK, CLIENT_VERSION);
-            pair<char, CAddressUnspentKey> keyObj;
             pcursor->GetKey(keyObj);
-            char chType = keyObj.first;
-            CAddressUnspentKey indexKey = keyObj.second;
-
-            if (chType == DB_ADDRESSUNSPENTINDEX && indexKey.hashBytes == addressHash) {
-                try {
-                    CAddressUnspentValue nValue;
-                    pcursor->GetValue(nValue);
-                    unspentOutputs.push_back(make_pair(indexKey, nValue));
-                    pcursor->Next();
-                } catch (const std::exception& e) {
-                    return error("failed to get address unspent value");
-                }
-            } else {
-                break;
-            }
         } catch (const std::exception& e) {
             break;
         }
+        if (keyObj.first != DB_ADDRESSUNSPENTINDEX || keyObj.second.hashBytes != start.hashBytes)
+            break;
+
+        CAddressUnspentValue nValue;
+        try {
+            pcursor->GetValue(nValue);
+        } catch (const std::exception& e) {
+            return error("failed to get address unspent value");
+        }
+        // Outside of the try blocks, errors of the visitor are its own
+        if (!visit(keyObj.second, nValue))
+            break;
+        pcursor->Next();
     }
     return true;
 }
 
 bool CBlockTreeDB::WriteAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount > >&vect) {
-    CDBBatch batch(*this);
+    CDBWrapper& db = IndexDB(BLOCKTREE_ADDRESSINDEX);
+    CDBBatch batch(db);
     for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
         batch.Write(make_pair(DB_ADDRESSINDEX, it->first), it->second);
-    return WriteBatch(batch);
+    return db.WriteBatch(batch);
 }
 
 bool CBlockTreeDB::EraseAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount > >&vect) {
-    CDBBatch batch(*this);
+    CDBWrapper& db = IndexDB(BLOCKTREE_ADDRESSINDEX);
+    CDBBatch batch(db);
     for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
         batch.Erase(make_pair(DB_ADDRESSINDEX, it->first));
-    return WriteBatch(batch);
+    return db.WriteBatch(batch);
 }
 
 bool CBlockTreeDB::ReadAddressIndex(uint160 addressHash, int type,
                                     std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
                                     int start, int end) {
+    // The lowest key at the start height, the same as seeking to the height prefix
+    CAddressIndexKey startKey(type, addressHash, start > 0 && end > 0 ? start : 0, 0, uint256(), 0, false);
+    return ReadAddressIndex(startKey, end, [&](const CAddressIndexKey& key, CAmount amount) {
+        addressIndex.push_back(make_pair(key, amount));
+        return true;
+    });
+}
 
-    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+bool CBlockTreeDB::ReadAddressIndex(const CAddressIndexKey& start, int end, const AddressIndexVisitor& visit) {
+    CDBWrapper& db = IndexDB(BLOCKTREE_ADDRESSINDEX);
+    boost::scoped_ptr<CDBIterator> pcursor(db.NewIterator());
 
-    if (start > 0 && end > 0) {
-        pcursor->Seek(make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorHeightKey(type, addressHash, start)));
-    } else {
-        pcursor->Seek(make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorKey(type, addressHash)));
-    }
+    pcursor->Seek(make_pair(DB_ADDRESSINDEX, start));
 
     while (pcursor->Valid()) {
         boost::this_thread::interruption_point();
+        pair<char, CAddressIndexKey> keyObj;
         try {
-            pair<char, CAddressIndexKey> keyObj;
             pcursor->GetKey(keyObj);
-            char chType = keyObj.first;
-            CAddressIndexKey indexKey = keyObj.second;
-
-            if (chType == DB_ADDRESSINDEX && indexKey.hashBytes == addressHash) {
-                if (end > 0 && indexKey.blockHeight > end) {
-                    break;
-                }
-                try {
-                    CAmount nValue;
-                    pcursor->GetValue(nValue);
-
-                    addressIndex.push_back(make_pair(indexKey, nValue));
-                    pcursor->Next();
-                } catch (const std::exception& e) {
-                    return error("failed to get address index value");
-                }
-            } else {
-                break;
-            }
         } catch (const std::exception& e) {
             break;
         }
+        if (keyObj.first != DB_ADDRESSINDEX || keyObj.second.hashBytes != start.hashBytes)
+            break;
+        if (end > 0 && keyObj.second.blockHeight > end)
+            break;
+
+        CAmount nValue;
+        try {
+            pcursor->GetValue(nValue);
+        } catch (const std::exception& e) {
+            return error("failed to get address index value");
+        }
+        if (!visit(keyObj.second, nValue))
+            break;
+        pcursor->Next();
     }
 
     return true;
@@ -461,102 +856,178 @@ uint32_t komodo_segid32(char *coinaddr);
     {"RD6GgnrMpPaTSMn8vai6yiGA7mN4QGPVMY", 1} \
 };
 
-bool CBlockTreeDB::Snapshot2(std::map <std::string, CAmount> &addressAmounts, UniValue *ret)
+//! Threads reading the address unspent index for a snapshot
+static const int MAX_SNAPSHOT_THREADS = 8;
+
+/** Balance of an address in the unspent index */
+struct CAddressBalance
+{
+    CAmount nAmount;
+    unsigned char type;
+    uint160 hashBytes;
+};
+
+/** Totals of the address unspent index, as of a block */
+struct CAddressBalances
+{
+    uint256 hashBlock;
+    int nHeight;
+    //! Highest balances first, equal balances in no particular order
+    std::vector<CAddressBalance> vBalances;
+    int64_t total, utxos, ignoredAddresses, cryptoConditionsUTXOs, cryptoConditionsTotals;
+
+    CAddressBalances() : nHeight(0), total(0), utxos(0), ignoredAddresses(0), cryptoConditionsUTXOs(0), cryptoConditionsTotals(0) {}
+};
+
+//! Balances of the last snapshot, reused while the tip stays the same
+static CCriticalSection cs_addressBalances;
+static std::shared_ptr<const CAddressBalances> cachedAddressBalances;
+
+static std::string AddressBalanceString(const CAddressBalance& balance)
 {
-    int64_t total = 0; int64_t totalAddresses = 0; std::string address;
-    int64_t utxos = 0; int64_t ignoredAddresses = 0, cryptoConditionsUTXOs = 0, cryptoConditionsTotals = 0;
-    DECLARE_IGNORELIST
-    boost::scoped_ptr<CDBIterator> iter(NewIterator());
-    //std::map <std::string, CAmount> addressAmounts;
-    for (iter->SeekToLast(); iter->Valid(); iter->Prev())
+    std::string address;
+    getAddressFromIndex(balance.type, balance.hashBytes, address);
+    return address;
+}
+
+static std::shared_ptr<const CAddressBalances> ReadAddressBalances(CDBWrapper& db)
+{
+    const leveldb::Snapshot* psnapshot;
+    std::shared_ptr<CAddressBalances> balances = std::make_shared<CAddressBalances>();
     {
-        boost::this_thread::interruption_point();
-        try
-        {
-            std::vector<unsigned char> slKey = std::vector<unsigned char>();
-            pair<char, CAddressIndexIteratorKey> keyObj;
-            iter->GetKey(keyObj);
-            char chType = keyObj.first;
-            CAddressIndexIteratorKey indexKey = keyObj.second;
-            //fprintf(stderr, "chType=%d\n", chType);
-            if (chType == DB_ADDRESSUNSPENTINDEX)
-            {
-                try {
-                    CAmount nValue;
-                    iter->GetValue(nValue);
-                    if ( nValue == 0 )
-                        continue;
-                    getAddressFromIndex(indexKey.type, indexKey.hashBytes, address);
-                    if ( indexKey.type == 3 )
-                    {
-                        cryptoConditionsUTXOs++;
-                        cryptoConditionsTotals += nValue;
-                        total += nValue;
-                        continue;
-                    }
-                    std::map <std::string, int>::iterator ignored = ignoredMap.find(address);
-                    if (ignored != ignoredMap.end())
-                    {
-                        fprintf(stderr,"ignoring %s\n", address.c_str());
-                        ignoredAddresses++;
-                        continue;
-                    }
-                    std::map <std::string, CAmount>::iterator pos = addressAmounts.find(address);
-                    if ( pos == addressAmounts.end() )
-                    {
-                        // insert new address + utxo amount
-                        //fprintf(stderr, "inserting new address %s with amount %li\n", address.c_str(), nValue);
-                        addressAmounts[address] = nValue;
-                        totalAddresses++;
-                    }
-                    else
-                    {
-                        // update unspent tally for this address
-                        //fprintf(stderr, "updating address %s with new utxo amount %li\n", address.c_str(), nValue);
-                        addressAmounts[address] += nValue;
-                    }
-                    //fprintf(stderr,"{\"%s\", %.8f},\n",address.c_str(),(double)nValue/COIN);
-                    // total += nValue;
-                    utxos++;
-                    total += nValue;
+        // The index is written under cs_main with the block, so the snapshot matches the tip
+        LOCK2(cs_main, cs_addressBalances);
+        if (chainActive.Tip() == NULL)
+            return NULL;
+        if (cachedAddressBalances && cachedAddressBalances->hashBlock == chainActive.Tip()->GetBlockHash())
+            return cachedAddressBalances;
+        balances->hashBlock = chainActive.Tip()->GetBlockHash();
+        balances->nHeight = chainActive.Height();
+        psnapshot = db.GetSnapshot();
+    }
+
+    std::set<uint160> setIgnored;
+    {
+        DECLARE_IGNORELIST
+        for (const std::pair<std::string, int>& ignored : ignoredMap) {
+            CKeyID keyID;
+            if (CBitcoinAddress(ignored.first).GetKeyID(keyID))
+                setIgnored.insert(keyID);
+        }
+    }
+
+    // Keys are ordered by address type and hash, so the outputs of an address
+    // are adjacent and each range of one type and first hash byte is summed on its own
+    static const int RANGES = 3 * 256;
+    std::vector<CAddressBalances> vRanges(RANGES);
+    int nThreads = std::max(1, std::min(GetNumCores(), MAX_SNAPSHOT_THREADS));
+    std::atomic<int> nNextRange(0);
+    std::atomic<bool> fFailed(false);
+
+    ParallelFor(nThreads, nThreads, [&](size_t) {
+        boost::scoped_ptr<CDBIterator> pcursor(db.NewIterator(psnapshot));
+        for (int nRange = nNextRange++; nRange < RANGES; nRange = nNextRange++) {
+            if (ShutdownRequested() || fFailed)
+                return;
+
+            unsigned char type = 1 + nRange / 256, first = nRange % 256;
+            CAddressBalances& range = vRanges[nRange];
+            pcursor->Seek(make_pair(DB_ADDRESSUNSPENTINDEX, make_pair(type, first)));
+            for (; pcursor->Valid(); pcursor->Next()) {
+                std::pair<char, CAddressIndexIteratorKey> key;
+                if (!pcursor->GetKey(key) || key.first != DB_ADDRESSUNSPENTINDEX || key.second.type != type || *key.second.hashBytes.begin() != first)
+                    break;
+                CAmount nValue;
+                if (!pcursor->GetValue(nValue)) {
+                    fprintf(stderr, "%s: LevelDB addressindex exception!\n", __func__);
+                    fFailed = true;
+                    return;
                 }
-                catch (const std::exception& e)
-                {
-                    fprintf(stderr, "DONE %s: LevelDB addressindex exception! - %s\n", __func__, e.what());
-                    return false; //break; this means failiure of DB? we need to exit here if so for consensus code!
+                if (nValue == 0)
+                    continue;
+                if (type == 3) {
+                    range.cryptoConditionsUTXOs++;
+                    range.cryptoConditionsTotals += nValue;
+                    range.total += nValue;
+                    continue;
+                }
+                if (type == 1 && setIgnored.count(key.second.hashBytes)) {
+                    range.ignoredAddresses++;
+                    continue;
+                }
+                range.utxos++;
+                range.total += nValue;
+                if (!range.vBalances.empty() && range.vBalances.back().hashBytes == key.second.hashBytes) {
+                    range.vBalances.back().nAmount += nValue;
+                } else {
+                    CAddressBalance balance;
+                    balance.nAmount = nValue;
+                    balance.type = type;
+                    balance.hashBytes = key.second.hashBytes;
+                    range.vBalances.push_back(balance);
                 }
             }
         }
-        catch (const std::exception& e)
-        {
-            fprintf(stderr, "DONE reading index entries\n");
-            break;
-        }
+    });
+    db.ReleaseSnapshot(psnapshot);
+    if (fFailed || ShutdownRequested())
+        return NULL;
+
+    size_t nBalances = 0;
+    for (const CAddressBalances& range : vRanges)
+        nBalances += range.vBalances.size();
+    balances->vBalances.reserve(nBalances);
+    for (const CAddressBalances& range : vRanges) {
+        balances->vBalances.insert(balances->vBalances.end(), range.vBalances.begin(), range.vBalances.end());
+        balances->total += range.total;
+        balances->utxos += range.utxos;
+        balances->ignoredAddresses += range.ignoredAddresses;
+        balances->cryptoConditionsUTXOs += range.cryptoConditionsUTXOs;
+        balances->cryptoConditionsTotals += range.cryptoConditionsTotals;
     }
-    //fprintf(stderr, "total=%f, totalAddresses=%li, utxos=%li, ignored=%li\n", (double) total / COIN, totalAddresses, utxos, ignoredAddresses);
+    std::sort(balances->vBalances.begin(), balances->vBalances.end(), [](const CAddressBalance& a, const CAddressBalance& b) {
+        return a.nAmount > b.nAmount;
+    });
+
+    LOCK(cs_addressBalances);
+    cachedAddressBalances = balances;
+    return balances;
+}
+
+static void PushAddressBalancesTotals(const CAddressBalances& balances, UniValue *ret)
+{
+    int64_t total = balances.total; int64_t totalAddresses = balances.vBalances.size();
+    // Total circulating supply without CC vouts.
+    ret->push_back(make_pair("total", (double) (total)/ COIN ));
+    // Average amount in each address of this snapshot
+    ret->push_back(make_pair("average",(double) (total/COIN) / totalAddresses ));
+    // Total number of utxos processed in this snaphot
+    ret->push_back(make_pair("utxos", balances.utxos));
+    // Total number of addresses in this snaphot
+    ret->push_back(make_pair("total_addresses", totalAddresses ));
+    // Total number of ignored addresses in this snaphot
+    ret->push_back(make_pair("ignored_addresses", balances.ignoredAddresses));
+    // Total number of crypto condition utxos we skipped
+    ret->push_back(make_pair("skipped_cc_utxos", balances.cryptoConditionsUTXOs));
+    // Total value of skipped crypto condition utxos
+    ret->push_back(make_pair("cc_utxo_value", (double) balances.cryptoConditionsTotals / COIN));
+    // total of all the address's, does not count coins in CC vouts.
+    ret->push_back(make_pair("total_includeCCvouts", (double) (total+balances.cryptoConditionsTotals)/ COIN ));
+    // The snapshot finished at this block height
+    ret->push_back(make_pair("ending_height", balances.nHeight));
+}
+
+bool CBlockTreeDB::Snapshot2(std::map <std::string, CAmount> &addressAmounts, UniValue *ret)
+{
+    std::shared_ptr<const CAddressBalances> balances = ReadAddressBalances(IndexDB(BLOCKTREE_ADDRESSUNSPENT));
+    if (!balances)
+        return false; // this means failiure of DB? we need to exit here if so for consensus code!
+    for (const CAddressBalance& balance : balances->vBalances)
+        addressAmounts[AddressBalanceString(balance)] += balance.nAmount;
 
     // this is for the snapshot RPC, you can skip this by passing a 0 as the last argument.
     if (ret)
-    {
-        // Total circulating supply without CC vouts.
-        ret->push_back(make_pair("total", (double) (total)/ COIN ));
-        // Average amount in each address of this snapshot
-        ret->push_back(make_pair("average",(double) (total/COIN) / totalAddresses ));
-        // Total number of utxos processed in this snaphot
-        ret->push_back(make_pair("utxos", utxos));
-        // Total number of addresses in this snaphot
-        ret->push_back(make_pair("total_addresses", totalAddresses ));
-        // Total number of ignored addresses in this snaphot
-        ret->push_back(make_pair("ignored_addresses", ignoredAddresses));
-        // Total number of crypto condition utxos we skipped
-        ret->push_back(make_pair("skipped_cc_utxos", cryptoConditionsUTXOs));
-        // Total value of skipped crypto condition utxos
-        ret->push_back(make_pair("cc_utxo_value", (double) cryptoConditionsTotals / COIN));
-        // total of all the address's, does not count coins in CC vouts.
-        ret->push_back(make_pair("total_includeCCvouts", (double) (total+cryptoConditionsTotals)/ COIN ));
-        // The snapshot finished at this block height
-        ret->push_back(make_pair("ending_height", chainActive.Height()));
-    }
+        PushAddressBalancesTotals(*balances, ret);
     return true;
 }
 
@@ -564,28 +1035,40 @@ extern std::vector <std::pair<CAmount, CTxDestination>> vAddressSnapshot;
 
 UniValue CBlockTreeDB::Snapshot(int top)
 {
-    int topN = 0;
     std::vector <std::pair<CAmount, std::string>> vaddr;
-    //std::vector <std::vector <std::pair<CAmount, CScript>>> tokenids;
-    std::map <std::string, CAmount> addressAmounts;
     UniValue result(UniValue::VOBJ);
     UniValue addressesSorted(UniValue::VARR);
     result.push_back(Pair("start_time", (int) time(NULL)));
-    if ( (vAddressSnapshot.size() > 0 && top < 0) || (Snapshot2(addressAmounts,&result) && top >= 0) )
+    bool fSnapshot = false;
+    if ( top < 0 )
     {
-        if ( top > -1 )
-        {
-            for (std::pair<std::string, CAmount> element : addressAmounts)
-                vaddr.push_back( make_pair(element.second, element.first) );
-            std::sort(vaddr.rbegin(), vaddr.rend());
-        }
-        else
+        LOCK(cs_main);
+        for ( auto address : vAddressSnapshot )
+            vaddr.push_back(make_pair(address.first, CBitcoinAddress(address.second).ToString()));
+        fSnapshot = vaddr.size() > 0;
+    }
+    else
+    {
+        std::shared_ptr<const CAddressBalances> balances = ReadAddressBalances(IndexDB(BLOCKTREE_ADDRESSUNSPENT));
+        if ( balances )
         {
-            for ( auto address : vAddressSnapshot )
-                vaddr.push_back(make_pair(address.first, CBitcoinAddress(address.second).ToString()));
-            top = vAddressSnapshot.size();
+            PushAddressBalancesTotals(*balances, &result);
+            // Only the addresses that can make the top N are encoded; the ones tied
+            // with the last of them are ordered by address like the full list is
+            size_t nCount = top > 0 ? std::min((size_t)top, balances->vBalances.size()) : balances->vBalances.size();
+            if ( nCount > 0 )
+            {
+                CAmount nCutoff = balances->vBalances[nCount - 1].nAmount;
+                for (size_t i = 0; i < balances->vBalances.size() && balances->vBalances[i].nAmount >= nCutoff; i++)
+                    vaddr.push_back(make_pair(balances->vBalances[i].nAmount, AddressBalanceString(balances->vBalances[i])));
+                std::sort(vaddr.rbegin(), vaddr.rend());
+                vaddr.resize(nCount);
+            }
+            fSnapshot = true;
         }
-        int topN = 0;
+    }
+    if ( fSnapshot )
+    {
         for (std::vector<std::pair<CAmount, std::string>>::iterator it = vaddr.begin(); it!=vaddr.end(); ++it)
         {
           	UniValue obj(UniValue::VOBJ);
@@ -595,10 +1078,6 @@ UniValue CBlockTreeDB::Snapshot(int top)
           	obj.push_back( make_pair("amount", amount) );
             obj.push_back( make_pair("segid",(int32_t)komodo_segid32((char *)it->second.c_str()) & 0x3f) );
           	addressesSorted.push_back(obj);
-            topN++;
-            // If requested, only show top N addresses in output JSON
-           	if ( top == topN )
-                break;
         }
     	// Array of all addreses with balances
         result.push_back(make_pair("addresses", addressesSorted));
@@ -606,63 +1085,237 @@ UniValue CBlockTreeDB::Snapshot(int top)
     return(result);
 }
 
-bool CBlockTreeDB::WriteTimestampIndex(const CTimestampIndexKey &timestampIndex) {
-    CDBBatch batch(*this);
-    batch.Write(make_pair(DB_TIMESTAMPINDEX, timestampIndex), 0);
-    return WriteBatch(batch);
+bool CBlockTreeDB::WriteTimestampIndex(const CTimestampIndexKey &timestampIndex, int nHeight) {
+    CDBWrapper& db = IndexDB(BLOCKTREE_TIMESTAMPINDEX);
+    CDBBatch batch(db);
+    // The height lets readers check the entry against the active chain without the block index
+    batch.Write(make_pair(DB_TIMESTAMPINDEX, timestampIndex), nHeight);
+    return db.WriteBatch(batch);
 }
 
-bool CBlockTreeDB::ReadTimestampIndex(const unsigned int &high, const unsigned int &low, const bool fActiveOnly, std::vector<std::pair<uint256, unsigned int> > &hashes) {
+bool CBlockTreeDB::ReadTimestampIndex(const CTimestampIndexKey &start, unsigned int high,
+                                      const std::function<bool(const CTimestampIndexKey&, int)>& visit) {
+    CDBWrapper& db = IndexDB(BLOCKTREE_TIMESTAMPINDEX);
+    boost::scoped_ptr<CDBIterator> pcursor(db.NewIterator());
 
-    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
-
-    pcursor->Seek(make_pair(DB_TIMESTAMPINDEX, CTimestampIndexIteratorKey(low)));
+    pcursor->Seek(make_pair(DB_TIMESTAMPINDEX, start));
 
     while (pcursor->Valid()) {
         boost::this_thread::interruption_point();
+        pair<char, CTimestampIndexKey> keyObj;
         try {
-            pair<char, CTimestampIndexKey> keyObj;
             pcursor->GetKey(keyObj);
-            char chType = keyObj.first;
-            CTimestampIndexKey indexKey = keyObj.second;
-
-            if (chType == DB_TIMESTAMPINDEX && indexKey.timestamp < high) {
-                if (fActiveOnly) {
-                    if (blockOnchainActive(indexKey.blockHash)) {
-                        hashes.push_back(std::make_pair(indexKey.blockHash, indexKey.timestamp));
-                    }
-                } else {
-                    hashes.push_back(std::make_pair(indexKey.blockHash, indexKey.timestamp));
-                }
-
-                pcursor->Next();
-            } else {
-                break;
-            }
         } catch (const std::exception& e) {
             break;
         }
+        if (keyObj.first != DB_TIMESTAMPINDEX || keyObj.second.timestamp >= high)
+            break;
+
+        // Entries written before the height was stored hold 0
+        int nHeight = 0;
+        if (!pcursor->GetValue(nHeight))
+            return error("failed to get timestamp index value");
+        if (!visit(keyObj.second, nHeight > 0 ? nHeight : -1))
+            break;
+        pcursor->Next();
     }
 
     return true;
 }
 
 bool CBlockTreeDB::WriteTimestampBlockIndex(const CTimestampBlockIndexKey &blockhashIndex, const CTimestampBlockIndexValue &logicalts) {
-    CDBBatch batch(*this);
+    CDBWrapper& db = IndexDB(BLOCKTREE_TIMESTAMPINDEX);
+    CDBBatch batch(db);
     batch.Write(make_pair(DB_BLOCKHASHINDEX, blockhashIndex), logicalts);
-    return WriteBatch(batch);
+    return db.WriteBatch(batch);
 }
 
 bool CBlockTreeDB::ReadTimestampBlockIndex(const uint256 &hash, unsigned int &ltimestamp) {
-
+    CDBWrapper& db = IndexDB(BLOCKTREE_TIMESTAMPINDEX);
     CTimestampBlockIndexValue(lts);
-    if (!Read(std::make_pair(DB_BLOCKHASHINDEX, hash), lts))
+    if (!db.Read(std::make_pair(DB_BLOCKHASHINDEX, hash), lts))
 	return false;
 
     ltimestamp = lts.ltimestamp;
     return true;
 }
 
+bool CBlockTreeDB::WriteCompactBlockIndex(const CCompactBlockIndexKey &key, const std::vector<unsigned char> &vchCompactBlock) {
+    CDBBatch batch(*this);
+    batch.Write(make_pair(DB_COMPACTBLOCKINDEX, key), vchCompactBlock);
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::EraseCompactBlockIndex(const CCompactBlockIndexKey &key) {
+    CDBBatch batch(*this);
+    batch.Erase(make_pair(DB_COMPACTBLOCKINDEX, key));
+    return WriteBatch(batch);
+}
+
+/**
+ * Read the serialized compact blocks of up to nCount consecutive heights from
+ * nStartHeight, stopping early at the first missing height or once nMaxBytes
+ * have been collected.
+ */
+bool CBlockTreeDB::ReadCompactBlockIndex(int nStartHeight, int nCount, size_t nMaxBytes, std::vector<std::vector<unsigned char> > &vCompactBlocks) {
+
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+
+    pcursor->Seek(make_pair(DB_COMPACTBLOCKINDEX, CCompactBlockIndexKey(nStartHeight)));
+
+    size_t nBytes = 0;
+    int nHeight = nStartHeight;
+    while (pcursor->Valid() && nHeight < nStartHeight + nCount && nBytes < nMaxBytes) {
+        boost::this_thread::interruption_point();
+        pair<char, CCompactBlockIndexKey> key;
+        if (!pcursor->GetKey(key) || key.first != DB_COMPACTBLOCKINDEX || key.second.height != nHeight)
+            break;
+
+        std::vector<unsigned char> vchCompactBlock;
+        if (!pcursor->GetValue(vchCompactBlock))
+            return error("failed to get compact block index value");
+
+        nBytes += vchCompactBlock.size();
+        vCompactBlocks.push_back(vchCompactBlock);
+        nHeight++;
+        pcursor->Next();
+    }
+
+    return true;
+}
+
+bool CBlockTreeDB::HaveCompactBlockIndex(int nFirstHeight, int nLastHeight) {
+
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+
+    pcursor->Seek(make_pair(DB_COMPACTBLOCKINDEX, CCompactBlockIndexKey(nFirstHeight)));
+
+    // The keys are in height order, so the range is complete if they follow each other
+    for (int nHeight = nFirstHeight; nHeight <= nLastHeight; nHeight++) {
+        pair<char, CCompactBlockIndexKey> key;
+        if (!pcursor->Valid() || !pcursor->GetKey(key) || key.first != DB_COMPACTBLOCKINDEX || key.second.height != nHeight)
+            return false;
+        pcursor->Next();
+    }
+
+    return true;
+}
+
+bool CBlockTreeDB::WriteSaplingCommitments(int nHeight, const CSaplingBlockCommitments &commitments) {
+    return Write(make_pair(DB_SAPLING_COMMITMENTS, CCompactBlockIndexKey(nHeight)), commitments);
+}
+
+bool CBlockTreeDB::EraseSaplingCommitments(int nHeight) {
+    return Erase(make_pair(DB_SAPLING_COMMITMENTS, CCompactBlockIndexKey(nHeight)));
+}
+
+bool CBlockTreeDB::ReadSaplingCommitments(int nStartHeight, int nCount, std::vector<CSaplingBlockCommitments> &vCommitments) {
+
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+
+    // Big endian heights, the records of consecutive blocks are read in one pass
+    pcursor->Seek(make_pair(DB_SAPLING_COMMITMENTS, CCompactBlockIndexKey(nStartHeight)));
+
+    for (int nHeight = nStartHeight; nHeight < nStartHeight + nCount && pcursor->Valid(); nHeight++) {
+        boost::this_thread::interruption_point();
+        pair<char, CCompactBlockIndexKey> key;
+        if (!pcursor->GetKey(key) || key.first != DB_SAPLING_COMMITMENTS || key.second.height != nHeight)
+            break;
+
+        CSaplingBlockCommitments commitments;
+        if (!pcursor->GetValue(commitments))
+            return error("failed to get Sapling commitments at height %d", nHeight);
+        vCommitments.push_back(commitments);
+        pcursor->Next();
+    }
+
+    return true;
+}
+
+bool CBlockTreeDB::WriteKVBlock(int nHeight, const CKVBlockUndo &undo, const std::map<std::vector<unsigned char>, CKVEntry> &mapEntries) {
+    CDBBatch batch(*this);
+    for (std::map<std::vector<unsigned char>, CKVEntry>::const_iterator it = mapEntries.begin(); it != mapEntries.end(); it++)
+        batch.Write(make_pair(DB_KVINDEX, CKVIndexKey(it->first, nHeight)), it->second);
+    batch.Write(make_pair(DB_KVUNDO, CCompactBlockIndexKey(nHeight)), undo);
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::EraseKVBlock(int nHeight, const CKVBlockUndo &undo) {
+    CDBBatch batch(*this);
+    for (std::vector<std::vector<unsigned char> >::const_iterator it = undo.vKeys.begin(); it != undo.vKeys.end(); it++)
+        batch.Erase(make_pair(DB_KVINDEX, CKVIndexKey(*it, nHeight)));
+    batch.Erase(make_pair(DB_KVUNDO, CCompactBlockIndexKey(nHeight)));
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::ReadKVBlockUndo(int nHeight, CKVBlockUndo &undo) {
+    return Read(make_pair(DB_KVUNDO, CCompactBlockIndexKey(nHeight)), undo);
+}
+
+bool CBlockTreeDB::ReadKVBlockUndos(int nStartHeight, std::vector<std::pair<int, CKVBlockUndo> > &vUndo) {
+
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+
+    pcursor->Seek(make_pair(DB_KVUNDO, CCompactBlockIndexKey(nStartHeight)));
+
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        pair<char, CCompactBlockIndexKey> key;
+        if (!pcursor->GetKey(key) || key.first != DB_KVUNDO)
+            break;
+
+        CKVBlockUndo undo;
+        if (!pcursor->GetValue(undo))
+            return error("failed to get the KV undo record at height %d", key.second.height);
+        vUndo.push_back(make_pair(key.second.height, undo));
+        pcursor->Next();
+    }
+
+    return true;
+}
+
+bool CBlockTreeDB::ReadKVEntry(const std::vector<unsigned char> &vchKey, int nMaxHeight, CKVEntry &entry) {
+
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+
+    // The versions of the key follow each other in height order
+    pcursor->Seek(make_pair(DB_KVINDEX, CKVIndexKey(vchKey, 0)));
+
+    bool fFound = false;
+    while (pcursor->Valid()) {
+        pair<char, CKVIndexKey> key;
+        if (!pcursor->GetKey(key) || key.first != DB_KVINDEX || key.second.vchKey != vchKey || key.second.nBlockHeight > nMaxHeight)
+            break;
+        if (!pcursor->GetValue(entry))
+            return error("failed to get a KV entry at height %d", key.second.nBlockHeight);
+        fFound = true;
+        pcursor->Next();
+    }
+
+    return fFound;
+}
+
+bool CBlockTreeDB::ReadKVEntries(std::map<std::vector<unsigned char>, CKVEntry> &mapEntries) {
+
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+
+    pcursor->Seek(DB_KVINDEX);
+
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        pair<char, CKVIndexKey> key;
+        if (!pcursor->GetKey(key) || key.first != DB_KVINDEX)
+            break;
+
+        // The last version of each key is read last
+        if (!pcursor->GetValue(mapEntries[key.second.vchKey]))
+            return error("failed to get a KV entry at height %d", key.second.nBlockHeight);
+        pcursor->Next();
+    }
+
+    return true;
+}
+
 bool CBlockTreeDB::WriteFlag(const std::string &name, bool fValue) {
     return Write(std::make_pair(DB_FLAG, name), fValue ? '1' : '0');
 }
@@ -675,7 +1328,58 @@ bool CBlockTreeDB::ReadFlag(const std::string &name, bool &fValue) {
     return true;
 }
 
-void komodo_index2pubkey33(uint8_t *pubkey33,CBlockIndex *pindex,int32_t height);
+bool CBlockTreeDB::WriteSnapshotBase(const uint256 &hash, uint64_t nChainTx) {
+    return Write(DB_SNAPSHOT_BASE, std::make_pair(hash, nChainTx));
+}
+
+bool CBlockTreeDB::ReadSnapshotBase(uint256 &hash, uint64_t &nChainTx) {
+    std::pair<uint256, uint64_t> base;
+    if (!Read(DB_SNAPSHOT_BASE, base))
+        return false;
+    hash = base.first;
+    nChainTx = base.second;
+    return true;
+}
+
+bool CBlockTreeDB::WriteIndexBuildState(const CIndexBuildState &buildState) {
+    return Write(DB_INDEX_BUILD, buildState);
+}
+
+bool CBlockTreeDB::ReadIndexBuildState(CIndexBuildState &buildState) {
+    return Read(DB_INDEX_BUILD, buildState);
+}
+
+bool CBlockTreeDB::EraseIndexBuildState() {
+    return Erase(DB_INDEX_BUILD);
+}
+
+bool CBlockTreeDB::WriteCoinsStats(const uint256 &hash, const CCoinsStatsRecord &record, const MuHash3072 *pmuhash) {
+    CDBWrapper& db = IndexDB(BLOCKTREE_COINSTATS);
+    CDBBatch batch(db);
+    batch.Write(make_pair(DB_COINSTATS, hash), record);
+    if (pmuhash) {
+        std::vector<unsigned char> vch(MuHash3072::SERIALIZED_SIZE);
+        pmuhash->ToBytes(&vch[0]);
+        batch.Write(make_pair(DB_COINSTATS_HASH, hash), vch);
+    }
+    return db.WriteBatch(batch);
+}
+
+bool CBlockTreeDB::ReadCoinsStats(const uint256 &hash, CCoinsStatsRecord &record) {
+    return IndexDB(BLOCKTREE_COINSTATS).Read(make_pair(DB_COINSTATS, hash), record);
+}
+
+bool CBlockTreeDB::ReadCoinsStatsHash(const uint256 &hash, MuHash3072 &muhash) {
+    std::vector<unsigned char> vch;
+    if (!IndexDB(BLOCKTREE_COINSTATS).Read(make_pair(DB_COINSTATS_HASH, hash), vch) || vch.size() != MuHash3072::SERIALIZED_SIZE)
+        return false;
+    muhash.FromBytes(&vch[0]);
+    return true;
+}
+
+bool CBlockTreeDB::EraseCoinsStatsHash(const uint256 &hash) {
+    return IndexDB(BLOCKTREE_COINSTATS).Erase(make_pair(DB_COINSTATS_HASH, hash));
+}
 
 bool CBlockTreeDB::blockOnchainActive(const uint256 &hash) {
     BlockMap::const_iterator it = mapBlockIndex.find(hash);
@@ -688,39 +1392,64 @@ bool CBlockTreeDB::blockOnchainActive(const uint256 &hash) {
     return true;
 }
 
+//! Most threads loading the block index
+static const int MAX_BLOCK_INDEX_LOAD_THREADS = 8;
+
+namespace {
+//! A block index entry read by a loader thread, linked to its parent once all are read
+struct CLoadedBlockIndex {
+    uint256 hash;
+    uint256 hashPrev;
+    CBlockIndex* pindex;
+};
+}
+
 bool CBlockTreeDB::LoadBlockIndexGuts()
 {
-    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
-
-    pcursor->Seek(make_pair(DB_BLOCK_INDEX, uint256()));
-    int64_t count = 0; int reportDone = 0;
     uiInterface.ShowProgress(_("Loading guts..."), 0, false);
 
-    // Load mapBlockIndex
-    while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
-        if (ShutdownRequested()) return false;
-
-        std::pair<char, uint256> key;
-
-        if (pcursor->GetKey(key) && key.first == DB_BLOCK_INDEX) {
+    // Block hashes are uniform, so the entries are split by the first byte of
+    // the key's hash into ranges that threads read and deserialize on their own
+    static const int RANGES = 256;
+    std::vector<std::vector<CLoadedBlockIndex>> vRanges(RANGES);
+    int nThreads = std::max(1, std::min(GetNumCores(), MAX_BLOCK_INDEX_LOAD_THREADS));
+    std::vector<CBlockIndexArena> vArenas(nThreads);
+    std::vector<std::string> vErrors(nThreads);
+    std::atomic<int> nNextRange(0);
+    std::atomic<int> nRangesDone(0);
+    int reportDone = 0;
+
+    ParallelFor(nThreads, nThreads, [&](size_t nThread) {
+        boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+        for (int nRange = nNextRange++; nRange < RANGES; nRange = nNextRange++) {
+            if (ShutdownRequested())
+                return;
+
+            uint256 hashStart;
+            *hashStart.begin() = nRange;
+            pcursor->Seek(make_pair(DB_BLOCK_INDEX, hashStart));
+            while (pcursor->Valid()) {
+                std::pair<char, uint256> key;
+                if (!pcursor->GetKey(key) || key.first != DB_BLOCK_INDEX || *key.second.begin() != nRange)
+                    break;
 
-            if (count++ % 256 == 0) {
-                uint32_t high = 0x100 * *key.second.begin() + *(key.second.begin() + 1);
-                int percentageDone = (int)(high * 100.0 / 65536.0 + 0.5);
-                uiInterface.ShowProgress(_("Loading guts..."), percentageDone, false);
-                if (reportDone < percentageDone/10) {
-                    // report max. every 10% step
-                    LogPrintf("[%d%%]...", percentageDone); /* Continued */
-                    reportDone = percentageDone/10;
+                CDiskBlockIndex diskindex;
+                if (!pcursor->GetValue(diskindex)) {
+                    vErrors[nThread] = "failed to read value";
+                    return;
                 }
-            }
+                CLoadedBlockIndex loaded;
+                loaded.hash = diskindex.GetBlockHash();
+                // Consistency check
+                if (loaded.hash != key.second) {
+                    vErrors[nThread] = strprintf("block header inconsistency detected: key = %s, on-disk = %s",
+                                                 key.second.ToString(), diskindex.ToString());
+                    return;
+                }
+                loaded.hashPrev = diskindex.hashPrev;
 
-            CDiskBlockIndex diskindex;
-            if (pcursor->GetValue(diskindex)) {
                 // Construct block index object
-                CBlockIndex* pindexNew = InsertBlockIndex(diskindex.GetBlockHash());
-                pindexNew->pprev          = InsertBlockIndex(diskindex.hashPrev);
+                CBlockIndex* pindexNew = vArenas[nThread].Allocate();
                 pindexNew->SetHeight(diskindex.GetHeight());
                 pindexNew->nFile          = diskindex.nFile;
                 pindexNew->nDataPos       = diskindex.nDataPos;
@@ -732,7 +1461,8 @@ bool CBlockTreeDB::LoadBlockIndexGuts()
                 pindexNew->nTime          = diskindex.nTime;
                 pindexNew->nBits          = diskindex.nBits;
                 pindexNew->nNonce         = diskindex.nNonce;
-                pindexNew->nSolution      = diskindex.nSolution;
+                pindexNew->nSolution.swap(diskindex.nSolution);
+                pindexNew->TrimSolution();
                 pindexNew->nStatus        = diskindex.nStatus;
                 pindexNew->nCachedBranchId = diskindex.nCachedBranchId;
                 pindexNew->nTx            = diskindex.nTx;
@@ -740,25 +1470,58 @@ bool CBlockTreeDB::LoadBlockIndexGuts()
                 pindexNew->nSaplingValue  = diskindex.nSaplingValue;
                 pindexNew->segid          = diskindex.segid;
                 pindexNew->nNotaryPay     = diskindex.nNotaryPay;
-//fprintf(stderr,"loadguts ht.%d\n",pindexNew->GetHeight());
-                // Consistency checks
-                auto header = pindexNew->GetBlockHeader();
-                if (header.GetHash() != pindexNew->GetBlockHash())
-                    return error("LoadBlockIndex(): block header inconsistency detected: on-disk = %s, in-memory = %s",
-                                 diskindex.ToString(),  pindexNew->ToString());
-                if ( 0 ) // POW will be checked before any block is connected
-                {
-                    uint8_t pubkey33[33];
-                    komodo_index2pubkey33(pubkey33,pindexNew,pindexNew->GetHeight());
-                    if (!CheckProofOfWork(header,pubkey33,pindexNew->GetHeight(),Params().GetConsensus()))
-                        return error("LoadBlockIndex(): CheckProofOfWork failed: %s", pindexNew->ToString());
-                }
+                // POW and the komodo notary data of the block are checked when it is connected
+                loaded.pindex = pindexNew;
+                vRanges[nRange].push_back(loaded);
                 pcursor->Next();
+            }
+
+            int nDone = ++nRangesDone;
+            if (nThread == 0) {
+                int percentageDone = (int)(nDone * 100.0 / RANGES + 0.5);
+                uiInterface.ShowProgress(_("Loading guts..."), percentageDone, false);
+                if (reportDone < percentageDone/10) {
+                    // report max. every 10% step
+                    LogPrintf("[%d%%]...", percentageDone); /* Continued */
+                    reportDone = percentageDone/10;
+                }
+            }
+        }
+    });
+
+    boost::this_thread::interruption_point();
+    if (ShutdownRequested()) return false;
+    for (const std::string& strError : vErrors) {
+        if (!strError.empty())
+            return error("LoadBlockIndex(): %s", strError);
+    }
+
+    // Load mapBlockIndex, inserting every entry before linking them so
+    // parents are found instead of created as placeholders
+    size_t nLoaded = 0;
+    for (const std::vector<CLoadedBlockIndex>& vLoaded : vRanges) {
+        nLoaded += vLoaded.size();
+    }
+    mapBlockIndex.reserve(mapBlockIndex.size() + nLoaded);
+    for (CBlockIndexArena& arena : vArenas) {
+        blockIndexArena.Splice(arena);
+    }
+    for (std::vector<CLoadedBlockIndex>& vLoaded : vRanges) {
+        for (CLoadedBlockIndex& loaded : vLoaded) {
+            BlockMap::iterator mi = mapBlockIndex.insert(make_pair(loaded.hash, (CBlockIndex*)NULL)).first;
+            if (mi->second == NULL) {
+                mi->second = loaded.pindex;
             } else {
-                return error("LoadBlockIndex() : failed to read value");
+                // Keep the address of an entry that already exists
+                *mi->second = *loaded.pindex;
+                loaded.pindex = mi->second;
             }
-        } else {
-            break;
+            loaded.pindex->phashBlock = &((*mi).first);
+        }
+    }
+    for (const std::vector<CLoadedBlockIndex>& vLoaded : vRanges) {
+        for (const CLoadedBlockIndex& loaded : vLoaded) {
+            loaded.pindex->pprev = InsertBlockIndex(loaded.hashPrev);
         }
     }
 
@@ -767,3 +1530,238 @@ bool CBlockTreeDB::LoadBlockIndexGuts()
 
     return true;
 }
+
+bool CBlockTreeDB::UpdateCCUnspentIndex(const std::vector<std::pair<CCCUnspentKey, CAddressUnspentValue> > &vCreated, const std::vector<COutPoint> &vSpent,
+                                        const std::vector<std::pair<CTokenUnspentKey, CAddressUnspentValue> > &vTokenCreated,
+                                        const std::vector<std::pair<uint256, CTokenIndexInfo> > &vTokens) {
+    CDBWrapper& db = IndexDB(BLOCKTREE_CCINDEX);
+    CDBBatch batch(db);
+    std::map<COutPoint, CCCUnspentKey> mapCreated;
+    for (const std::pair<CCCUnspentKey, CAddressUnspentValue>& created : vCreated) {
+        const COutPoint outpoint(created.first.txhash, created.first.index);
+        batch.Write(make_pair(DB_CCUNSPENTINDEX, created.first), created.second);
+        batch.Write(make_pair(DB_CCOUTPOINT, outpoint), created.first);
+        mapCreated[outpoint] = created.first;
+    }
+    std::map<COutPoint, CTokenUnspentKey> mapTokenCreated;
+    for (const std::pair<CTokenUnspentKey, CAddressUnspentValue>& created : vTokenCreated) {
+        const COutPoint outpoint(created.first.txhash, created.first.index);
+        batch.Write(make_pair(DB_TOKENUNSPENTINDEX, created.first), created.second);
+        batch.Write(make_pair(DB_TOKENOUTPOINT, outpoint), created.first);
+        mapTokenCreated[outpoint] = created.first;
+    }
+    for (const std::pair<uint256, CTokenIndexInfo>& token : vTokens)
+        batch.Write(make_pair(DB_TOKENINFO, token.first), token.second);
+    // The batch is applied in order, so an output spent in the same blocks is erased again
+    for (const COutPoint& outpoint : vSpent) {
+        CCCUnspentKey key;
+        std::map<COutPoint, CCCUnspentKey>::const_iterator it = mapCreated.find(outpoint);
+        if (it != mapCreated.end())
+            key = it->second;
+        else if (!db.Read(make_pair(DB_CCOUTPOINT, outpoint), key))
+            continue; // a CC output without an opreturn is not indexed
+        batch.Erase(make_pair(DB_CCUNSPENTINDEX, key));
+
+        // Only CC outputs with an opreturn can be tokens
+        CTokenUnspentKey tokenKey;
+        std::map<COutPoint, CTokenUnspentKey>::const_iterator itToken = mapTokenCreated.find(outpoint);
+        if (itToken != mapTokenCreated.end())
+            tokenKey = itToken->second;
+        else if (!db.Read(make_pair(DB_TOKENOUTPOINT, outpoint), tokenKey))
+            continue;
+        batch.Erase(make_pair(DB_TOKENUNSPENTINDEX, tokenKey));
+    }
+    return db.WriteBatch(batch);
+}
+
+bool CBlockTreeDB::UndoCCUnspentIndex(const std::vector<std::pair<CCCUnspentKey, CAddressUnspentValue> > &vCreated,
+                                      const std::vector<std::pair<COutPoint, CAddressUnspentValue> > &vRestored) {
+    CDBWrapper& db = IndexDB(BLOCKTREE_CCINDEX);
+    CDBBatch batch(db);
+    for (const std::pair<COutPoint, CAddressUnspentValue>& restored : vRestored) {
+        CCCUnspentKey key;
+        if (db.Read(make_pair(DB_CCOUTPOINT, restored.first), key))
+            batch.Write(make_pair(DB_CCUNSPENTINDEX, key), restored.second);
+        CTokenUnspentKey tokenKey;
+        if (db.Read(make_pair(DB_TOKENOUTPOINT, restored.first), tokenKey))
+            batch.Write(make_pair(DB_TOKENUNSPENTINDEX, tokenKey), restored.second);
+    }
+    // Erased after the restores, which covers the outputs the block created and spent itself
+    for (const std::pair<CCCUnspentKey, CAddressUnspentValue>& created : vCreated) {
+        const COutPoint outpoint(created.first.txhash, created.first.index);
+        batch.Erase(make_pair(DB_CCUNSPENTINDEX, created.first));
+        batch.Erase(make_pair(DB_CCOUTPOINT, outpoint));
+        CTokenUnspentKey tokenKey;
+        if (db.Read(make_pair(DB_TOKENOUTPOINT, outpoint), tokenKey)) {
+            batch.Erase(make_pair(DB_TOKENUNSPENTINDEX, tokenKey));
+            batch.Erase(make_pair(DB_TOKENOUTPOINT, outpoint));
+        }
+        // A token is created by a transaction that is its own reference
+        if (created.first.refid == created.first.txhash)
+            batch.Erase(make_pair(DB_TOKENINFO, created.first.txhash));
+    }
+    return db.WriteBatch(batch);
+}
+
+bool CBlockTreeDB::ReadTokenUnspentIndex(const uint256 &tokenid, const uint160 *paddressHash,
+                                         std::vector<std::pair<CTokenUnspentKey, CAddressUnspentValue> > &vect) {
+    CDBWrapper& db = IndexDB(BLOCKTREE_CCINDEX);
+    boost::scoped_ptr<CDBIterator> pcursor(db.NewIterator());
+
+    if (paddressHash)
+        pcursor->Seek(make_pair(DB_TOKENUNSPENTINDEX, make_pair(tokenid, *paddressHash)));
+    else
+        pcursor->Seek(make_pair(DB_TOKENUNSPENTINDEX, tokenid));
+
+    for (; pcursor->Valid(); pcursor->Next()) {
+        boost::this_thread::interruption_point();
+        std::pair<char, CTokenUnspentKey> key;
+        if (!pcursor->GetKey(key) || key.first != DB_TOKENUNSPENTINDEX || key.second.tokenid != tokenid)
+            break;
+        if (paddressHash && key.second.addressHash != *paddressHash)
+            break;
+        CAddressUnspentValue value;
+        if (!pcursor->GetValue(value))
+            return error("failed to get token unspent value");
+        vect.push_back(make_pair(key.second, value));
+    }
+    return true;
+}
+
+bool CBlockTreeDB::ReadTokenInfo(const uint256 &tokenid, CTokenIndexInfo &info) {
+    return IndexDB(BLOCKTREE_CCINDEX).Read(make_pair(DB_TOKENINFO, tokenid), info);
+}
+
+bool CBlockTreeDB::WriteOracleDataIndex(const std::vector<std::pair<COracleDataKey, COracleDataValue> > &vect) {
+    CDBWrapper& db = IndexDB(BLOCKTREE_CCINDEX);
+    CDBBatch batch(db);
+    for (std::vector<std::pair<COracleDataKey, COracleDataValue> >::const_iterator it = vect.begin(); it != vect.end(); it++)
+        batch.Write(make_pair(DB_ORACLEDATAINDEX, it->first), it->second);
+    return db.WriteBatch(batch);
+}
+
+bool CBlockTreeDB::EraseOracleDataIndex(const std::vector<std::pair<COracleDataKey, COracleDataValue> > &vect) {
+    CDBWrapper& db = IndexDB(BLOCKTREE_CCINDEX);
+    CDBBatch batch(db);
+    for (std::vector<std::pair<COracleDataKey, COracleDataValue> >::const_iterator it = vect.begin(); it != vect.end(); it++)
+        batch.Erase(make_pair(DB_ORACLEDATAINDEX, it->first));
+    return db.WriteBatch(batch);
+}
+
+bool CBlockTreeDB::ReadOracleDataIndex(const uint256 &oracletxid, const uint160 &batonHash, int nMax,
+                                       std::vector<std::pair<COracleDataKey, COracleDataValue> > &vect) {
+    CDBWrapper& db = IndexDB(BLOCKTREE_CCINDEX);
+    boost::scoped_ptr<CDBIterator> pcursor(db.NewIterator());
+
+    // Sorts after every entry of the baton address, the walk goes backwards from there
+    pcursor->Seek(make_pair(DB_ORACLEDATAINDEX, COracleDataKey(oracletxid, batonHash, -1, 0xffffffff, uint256())));
+    if (pcursor->Valid())
+        pcursor->Prev();
+    else
+        pcursor->SeekToLast();
+
+    for (; pcursor->Valid(); pcursor->Prev()) {
+        boost::this_thread::interruption_point();
+        std::pair<char, COracleDataKey> key;
+        if (!pcursor->GetKey(key) || key.first != DB_ORACLEDATAINDEX || key.second.oracletxid != oracletxid || key.second.batonHash != batonHash)
+            break;
+        COracleDataValue value;
+        if (!pcursor->GetValue(value))
+            return error("failed to get oracle data value");
+        vect.push_back(make_pair(key.second, value));
+        if (nMax > 0 && (int)vect.size() >= nMax)
+            break;
+    }
+    return true;
+}
+
+bool CBlockTreeDB::IsCCOutputUnspent(const COutPoint &outpoint) {
+    CDBWrapper& db = IndexDB(BLOCKTREE_CCINDEX);
+    CCCUnspentKey key;
+    return db.Read(make_pair(DB_CCOUTPOINT, outpoint), key) && db.Exists(make_pair(DB_CCUNSPENTINDEX, key));
+}
+
+bool CBlockTreeDB::WriteGatewaysIndex(const std::vector<std::pair<CGatewaysIndexKey, CAddressUnspentValue> > &vect) {
+    CDBWrapper& db = IndexDB(BLOCKTREE_CCINDEX);
+    CDBBatch batch(db);
+    for (std::vector<std::pair<CGatewaysIndexKey, CAddressUnspentValue> >::const_iterator it = vect.begin(); it != vect.end(); it++)
+        batch.Write(make_pair(DB_GATEWAYSINDEX, it->first), it->second);
+    return db.WriteBatch(batch);
+}
+
+bool CBlockTreeDB::EraseGatewaysIndex(const std::vector<std::pair<CGatewaysIndexKey, CAddressUnspentValue> > &vect) {
+    CDBWrapper& db = IndexDB(BLOCKTREE_CCINDEX);
+    CDBBatch batch(db);
+    for (std::vector<std::pair<CGatewaysIndexKey, CAddressUnspentValue> >::const_iterator it = vect.begin(); it != vect.end(); it++)
+        batch.Erase(make_pair(DB_GATEWAYSINDEX, it->first));
+    return db.WriteBatch(batch);
+}
+
+bool CBlockTreeDB::ReadGatewaysIndex(const uint256 &refid, uint8_t funcid, std::vector<std::pair<CGatewaysIndexKey, CAddressUnspentValue> > &vect) {
+    CDBWrapper& db = IndexDB(BLOCKTREE_CCINDEX);
+    boost::scoped_ptr<CDBIterator> pcursor(db.NewIterator());
+
+    pcursor->Seek(make_pair(DB_GATEWAYSINDEX, make_pair(refid, funcid)));
+    for (; pcursor->Valid(); pcursor->Next()) {
+        boost::this_thread::interruption_point();
+        std::pair<char, CGatewaysIndexKey> key;
+        if (!pcursor->GetKey(key) || key.first != DB_GATEWAYSINDEX || key.second.refid != refid || key.second.funcid != funcid)
+            break;
+        CAddressUnspentValue value;
+        if (!pcursor->GetValue(value))
+            return error("failed to get gateway index value");
+        vect.push_back(make_pair(key.second, value));
+    }
+    return true;
+}
+
+bool CBlockTreeDB::ReadTokenIds(std::vector<uint256> &vTokenIds) {
+    CDBWrapper& db = IndexDB(BLOCKTREE_CCINDEX);
+    boost::scoped_ptr<CDBIterator> pcursor(db.NewIterator());
+
+    for (pcursor->Seek(DB_TOKENINFO); pcursor->Valid(); pcursor->Next()) {
+        boost::this_thread::interruption_point();
+        std::pair<char, uint256> key;
+        if (!pcursor->GetKey(key) || key.first != DB_TOKENINFO)
+            break;
+        vTokenIds.push_back(key.second);
+    }
+    return true;
+}
+
+bool CBlockTreeDB::ReadCCUnspentIndex(uint8_t evalcode, int funcid, const uint256 *prefid,
+                                      std::vector<std::pair<CCCUnspentKey, CAddressUnspentValue> > &vect) {
+    CDBWrapper& db = IndexDB(BLOCKTREE_CCINDEX);
+    boost::scoped_ptr<CDBIterator> pcursor(db.NewIterator());
+
+    // With a reference and any funcid, the funcids present are visited one seek each
+    int nFuncid = funcid < 0 ? 0 : funcid;
+    while (nFuncid <= 0xff) {
+        if (prefid)
+            pcursor->Seek(make_pair(DB_CCUNSPENTINDEX, make_pair(make_pair(evalcode, (uint8_t)nFuncid), *prefid)));
+        else
+            pcursor->Seek(make_pair(DB_CCUNSPENTINDEX, make_pair(evalcode, (uint8_t)nFuncid)));
+
+        int nNextFuncid = 0x100;
+        for (; pcursor->Valid(); pcursor->Next()) {
+            boost::this_thread::interruption_point();
+            std::pair<char, CCCUnspentKey> key;
+            if (!pcursor->GetKey(key) || key.first != DB_CCUNSPENTINDEX || key.second.evalcode != evalcode)
+                break;
+            if (funcid >= 0 && key.second.funcid != funcid)
+                break;
+            if (prefid && (key.second.funcid != nFuncid || key.second.refid != *prefid)) {
+                nNextFuncid = key.second.funcid > nFuncid ? key.second.funcid : nFuncid + 1;
+                break;
+            }
+            CAddressUnspentValue value;
+            if (!pcursor->GetValue(value))
+                return error("failed to get CC unspent value");
+            vect.push_back(make_pair(key.second, value));
+        }
+        if (funcid >= 0 || !prefid)
+            break;
+        nFuncid = nNextFuncid;
+    }
+    return true;
+}
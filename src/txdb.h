@@ -21,10 +21,15 @@
 #ifndef BITCOIN_TXDB_H
 #define BITCOIN_TXDB_H
 
+#include "bloom.h"
 #include "coins.h"
 #include "dbwrapper.h"
+#include "sync.h"
 
+#include <functional>
+#include <list>
 #include <map>
+#include <memory>
 #include <string>
 #include <utility>
 #include <vector>
@@ -32,8 +37,18 @@
 
 class CBlockFileInfo;
 class CBlockIndex;
+class CDiskBlockIndex;
+class CCoinsStatsRecord;
+class CIndexBuildState;
+class MuHash3072;
 struct CDiskTxPos;
 struct CAddressUnspentKey;
+struct CCCUnspentKey;
+struct CTokenUnspentKey;
+struct CTokenIndexInfo;
+struct COracleDataKey;
+struct COracleDataValue;
+struct CGatewaysIndexKey;
 struct CAddressUnspentValue;
 struct CAddressIndexKey;
 struct CAddressIndexIteratorKey;
@@ -43,6 +58,10 @@ struct CTimestampIndexIteratorKey;
 struct CTimestampBlockIndexKey;
 struct CTimestampBlockIndexValue;
 struct CSpentIndexKey;
+struct CCompactBlockIndexKey;
+struct CSaplingBlockCommitments;
+struct CKVEntry;
+struct CKVBlockUndo;
 struct CSpentIndexValue;
 class uint256;
 
@@ -52,6 +71,14 @@ static const int64_t nDefaultDbCache = 450;
 static const int64_t nMaxDbCache = sizeof(void*) > 4 ? 16384 : 1024;
 //! min. -dbcache in (MiB)
 static const int64_t nMinDbCache = 4;
+//! -dbbatchsize default (bytes), changes beyond it are written to LevelDB in several batches
+static const int64_t nDefaultDbBatchSize = 16 << 20;
+//! Number of recently read Sapling trees kept deserialized by CCoinsViewDB
+static const size_t SAPLING_ANCHOR_CACHE_SIZE = 1000;
+//! Number of nullifiers the in-memory nullifier filters are first sized for
+static const size_t NULLIFIER_FILTER_INITIAL_CAPACITY = 1 << 20;
+//! False-positive rate of the in-memory nullifier filters
+static const double NULLIFIER_FILTER_FP_RATE = 0.01;
 
 /** CCoinsView backed by the coin database (chainstate/) */
 class CCoinsViewDB : public CCoinsView
@@ -59,16 +86,40 @@ class CCoinsViewDB : public CCoinsView
 protected:
     CDBWrapper db;
     CCoinsViewDB(std::string dbName, size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+
+    typedef std::list<std::pair<uint256, std::shared_ptr<const SaplingMerkleTree>>> SaplingAnchorLRU;
+
+    //! Recently read Sapling trees, most recently used first
+    mutable CCriticalSection cs_saplingAnchorCache;
+    mutable SaplingAnchorLRU lruSaplingAnchors;
+    mutable std::map<uint256, SaplingAnchorLRU::iterator> mapSaplingAnchorCache;
+
+    void UncacheSaplingAnchor(const uint256 &rt);
+
+    /**
+     * Filters over the Sprout and Sapling nullifiers in the database, indexed
+     * by ShieldedType. A nullifier missing from its filter is not read from
+     * disk. Until LoadNullifierFilters has finished, every lookup goes to disk.
+     */
+    mutable CCriticalSection cs_nullifierFilters;
+    std::unique_ptr<CScalableBloomFilter> nullifierFilters[2];
+    //! Filters being loaded, which BatchWrite already adds new nullifiers to
+    std::unique_ptr<CScalableBloomFilter> loadingNullifierFilters[2];
+
+    void AddToNullifierFilters(const CNullifiersMap &mapNullifiers, ShieldedType type);
 public:
     CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
 
     bool GetSproutAnchorAt(const uint256 &rt, SproutMerkleTree &tree) const;
     bool GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree) const;
+    std::shared_ptr<const SaplingMerkleTree> GetSharedSaplingAnchorAt(const uint256 &rt) const;
     bool GetNullifier(const uint256 &nf, ShieldedType type) const;
     bool GetCoins(const uint256 &txid, CCoins &coins) const;
     bool HaveCoins(const uint256 &txid) const;
     uint256 GetBestBlock() const;
     uint256 GetBestAnchor(ShieldedType type) const;
+    //! The blocks of an unfinished flush, the one written and the one before it; empty when there is none
+    std::vector<uint256> GetHeadBlocks() const;
     bool BatchWrite(CCoinsMap &mapCoins,
                     const uint256 &hashBlock,
                     const uint256 &hashSproutAnchor,
@@ -78,19 +129,66 @@ public:
                     CNullifiersMap &mapSproutNullifiers,
                     CNullifiersMap &mapSaplingNullifiers);
     bool GetStats(CCoinsStats &stats) const;
+    bool WriteSnapshot(CAutoFile &file, CCoinsSnapshotMetadata &metadata, uint256 &hashChecksum) const;
+    //! Calls visit for every transaction with unspent outputs, as of hashBlock, from one consistent view of the database
+    bool ForEachCoins(uint256 &hashBlock, const std::function<void(const uint256&, const CCoins&)>& visit) const;
+
+    //! Builds the nullifier filters from the database; meant to run on its own thread at startup
+    void LoadNullifierFilters();
+};
+
+/** Indexes kept in a database of their own under blocks/, next to the block index */
+enum BlockTreeIndex {
+    BLOCKTREE_TXINDEX,
+    BLOCKTREE_ADDRESSINDEX,
+    BLOCKTREE_ADDRESSUNSPENT,
+    BLOCKTREE_SPENTINDEX,
+    BLOCKTREE_TIMESTAMPINDEX,
+    BLOCKTREE_COINSTATS,
+    BLOCKTREE_CCINDEX,
+    BLOCKTREE_INDEX_COUNT
 };
 
-/** Access to the block database (blocks/index/) */
+//! Directory of the index database under blocks/
+const char* BlockTreeIndexName(BlockTreeIndex index);
+
+/** Cache and open files of the block index database and of each index database */
+struct CBlockTreeDBSizes
+{
+    size_t nBlockIndexCache;
+    int nBlockIndexFiles;
+    size_t vIndexCache[BLOCKTREE_INDEX_COUNT];
+    int vIndexFiles[BLOCKTREE_INDEX_COUNT];
+
+    //! Shares out the totals by the expected load, indexes that are not enabled get a minimal share
+    static CBlockTreeDBSizes Split(size_t nTotalCache, int nTotalFiles, bool fTxIndex, bool fAddressIndex, bool fSpentIndex, bool fTimestampIndex, bool fCoinStatsIndex, bool fCCIndex);
+};
+
+/**
+ * Access to the block database (blocks/index/) and the index databases next
+ * to it. Each index has its own LevelDB instance, so scans of one do not
+ * evict the cache of the others and a compaction of the large address index
+ * does not hold up block index writes. Entries of a tree that still keeps the
+ * indexes in blocks/index are moved when it is opened.
+ */
 class CBlockTreeDB : public CDBWrapper
 {
 public:
+    CBlockTreeDB(const CBlockTreeDBSizes& sizes, bool fMemory = false, bool fWipe = false, bool compression = true);
+    //! Shares nCacheSize out as if all indexes were enabled
     CBlockTreeDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false, bool compression = true, int maxOpenFiles = 1000);
 private:
+    std::unique_ptr<CDBWrapper> vIndexDB[BLOCKTREE_INDEX_COUNT];
+
     CBlockTreeDB(const CBlockTreeDB&);
     void operator=(const CBlockTreeDB&);
+
+    void OpenIndexes(const CBlockTreeDBSizes& sizes, bool fMemory, bool fWipe, bool compression);
+    CDBWrapper& IndexDB(BlockTreeIndex index) const { return *vIndexDB[index]; }
 public:
     bool WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo);
     bool EraseBatchSync(const std::vector<const CBlockIndex*>& blockinfo);
+    bool ReadDiskBlockIndex(const uint256& hash, CDiskBlockIndex& dbindex);
     bool ReadBlockFileInfo(int nFile, CBlockFileInfo &fileinfo);
     bool ReadLastBlockFile(int &nFile);
     bool WriteReindexing(bool fReindex);
@@ -102,17 +200,81 @@ public:
     bool UpdateAddressUnspentIndex(const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue > >&vect);
     bool ReadAddressUnspentIndex(uint160 addressHash, int type,
                                  std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &vect);
+    //! Visits the unspent outputs of the address from the key start on
+    bool ReadAddressUnspentIndex(const CAddressUnspentKey& start,
+                                 const std::function<bool(const CAddressUnspentKey&, const CAddressUnspentValue&)>& visit);
     bool WriteAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect);
     bool EraseAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect);
     bool ReadAddressIndex(uint160 addressHash, int type,
                           std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
                           int start = 0, int end = 0);
-    bool WriteTimestampIndex(const CTimestampIndexKey &timestampIndex);
-    bool ReadTimestampIndex(const unsigned int &high, const unsigned int &low, const bool fActiveOnly, std::vector<std::pair<uint256, unsigned int> > &vect);
+    //! Visits the entries of the address from the key start on, up to height end if it is positive
+    bool ReadAddressIndex(const CAddressIndexKey& start, int end,
+                          const std::function<bool(const CAddressIndexKey&, CAmount)>& visit);
+    bool WriteTimestampIndex(const CTimestampIndexKey &timestampIndex, int nHeight);
+    //! Visits the entries from the key start on with a timestamp below high, and the height stored with them
+    bool ReadTimestampIndex(const CTimestampIndexKey &start, unsigned int high,
+                            const std::function<bool(const CTimestampIndexKey&, int)>& visit);
     bool WriteTimestampBlockIndex(const CTimestampBlockIndexKey &blockhashIndex, const CTimestampBlockIndexValue &logicalts);
     bool ReadTimestampBlockIndex(const uint256 &hash, unsigned int &logicalTS);
+    bool WriteCompactBlockIndex(const CCompactBlockIndexKey &key, const std::vector<unsigned char> &vchCompactBlock);
+    bool EraseCompactBlockIndex(const CCompactBlockIndexKey &key);
+    bool ReadCompactBlockIndex(int nStartHeight, int nCount, size_t nMaxBytes, std::vector<std::vector<unsigned char> > &vCompactBlocks);
+    //! Whether there is a compact block for every height from nFirstHeight to nLastHeight
+    bool HaveCompactBlockIndex(int nFirstHeight, int nLastHeight);
+    bool WriteSaplingCommitments(int nHeight, const CSaplingBlockCommitments &commitments);
+    bool EraseSaplingCommitments(int nHeight);
+    //! Reads the commitment lists of up to nCount consecutive heights from nStartHeight, stopping at the first missing one
+    bool ReadSaplingCommitments(int nStartHeight, int nCount, std::vector<CSaplingBlockCommitments> &vCommitments);
+    //! Writes the versions of the KV entries a block updated, and the keys to undo them with
+    bool WriteKVBlock(int nHeight, const CKVBlockUndo &undo, const std::map<std::vector<unsigned char>, CKVEntry> &mapEntries);
+    bool EraseKVBlock(int nHeight, const CKVBlockUndo &undo);
+    bool ReadKVBlockUndo(int nHeight, CKVBlockUndo &undo);
+    //! Reads the undo records of the blocks from nStartHeight on, in height order
+    bool ReadKVBlockUndos(int nStartHeight, std::vector<std::pair<int, CKVBlockUndo> > &vUndo);
+    //! Reads the latest version of an entry written at or below nMaxHeight
+    bool ReadKVEntry(const std::vector<unsigned char> &vchKey, int nMaxHeight, CKVEntry &entry);
+    //! Reads the latest version of every entry
+    bool ReadKVEntries(std::map<std::vector<unsigned char>, CKVEntry> &mapEntries);
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
+    //! The block the chainstate was loaded from a snapshot at, and its nChainTx
+    bool WriteSnapshotBase(const uint256 &hash, uint64_t nChainTx);
+    bool ReadSnapshotBase(uint256 &hash, uint64_t &nChainTx);
+    //! Progress of the online index builder, absent when no index is being built
+    bool WriteIndexBuildState(const CIndexBuildState &buildState);
+    bool ReadIndexBuildState(CIndexBuildState &buildState);
+    bool EraseIndexBuildState();
+    //! UTXO set totals after each block; the set hash is only kept for recent blocks
+    bool WriteCoinsStats(const uint256 &hash, const CCoinsStatsRecord &record, const MuHash3072 *pmuhash);
+    bool ReadCoinsStats(const uint256 &hash, CCoinsStatsRecord &record);
+    bool ReadCoinsStatsHash(const uint256 &hash, MuHash3072 &muhash);
+    bool EraseCoinsStatsHash(const uint256 &hash);
+    //! Adds the CC outputs and tokens a block created and removes the outputs it spent
+    bool UpdateCCUnspentIndex(const std::vector<std::pair<CCCUnspentKey, CAddressUnspentValue> > &vCreated, const std::vector<COutPoint> &vSpent,
+                              const std::vector<std::pair<CTokenUnspentKey, CAddressUnspentValue> > &vTokenCreated,
+                              const std::vector<std::pair<uint256, CTokenIndexInfo> > &vTokens);
+    //! Undoes UpdateCCUnspentIndex, vRestored holds the spent outputs from the undo data
+    bool UndoCCUnspentIndex(const std::vector<std::pair<CCCUnspentKey, CAddressUnspentValue> > &vCreated,
+                            const std::vector<std::pair<COutPoint, CAddressUnspentValue> > &vRestored);
+    //! Unspent CC outputs with evalcode; funcid < 0 and prefid NULL match any funcid and reference
+    bool ReadCCUnspentIndex(uint8_t evalcode, int funcid, const uint256 *prefid,
+                            std::vector<std::pair<CCCUnspentKey, CAddressUnspentValue> > &vect);
+    //! Unspent outputs of tokenid, only those held by the address paddressHash unless it is NULL
+    bool ReadTokenUnspentIndex(const uint256 &tokenid, const uint160 *paddressHash,
+                               std::vector<std::pair<CTokenUnspentKey, CAddressUnspentValue> > &vect);
+    bool ReadTokenInfo(const uint256 &tokenid, CTokenIndexInfo &info);
+    bool ReadTokenIds(std::vector<uint256> &vTokenIds);
+    bool WriteOracleDataIndex(const std::vector<std::pair<COracleDataKey, COracleDataValue> > &vect);
+    bool EraseOracleDataIndex(const std::vector<std::pair<COracleDataKey, COracleDataValue> > &vect);
+    //! Entries under the baton address batonHash of oracletxid, the most recent first and at most nMax unless it is 0
+    bool ReadOracleDataIndex(const uint256 &oracletxid, const uint160 &batonHash, int nMax,
+                             std::vector<std::pair<COracleDataKey, COracleDataValue> > &vect);
+    //! Whether the indexed CC output outpoint is unspent
+    bool IsCCOutputUnspent(const COutPoint &outpoint);
+    bool WriteGatewaysIndex(const std::vector<std::pair<CGatewaysIndexKey, CAddressUnspentValue> > &vect);
+    bool EraseGatewaysIndex(const std::vector<std::pair<CGatewaysIndexKey, CAddressUnspentValue> > &vect);
+    bool ReadGatewaysIndex(const uint256 &refid, uint8_t funcid, std::vector<std::pair<CGatewaysIndexKey, CAddressUnspentValue> > &vect);
     bool LoadBlockIndexGuts();
     bool blockOnchainActive(const uint256 &hash);
     UniValue Snapshot(int top);
@@ -23,8 +23,10 @@
 #include "clientversion.h"
 #include "consensus/consensus.h"
 #include "consensus/validation.h"
+#include "komodo_defs.h"
 #include "main.h"
 #include "policy/fees.h"
+#include "random.h"
 #include "streams.h"
 #include "timedata.h"
 #include "util.h"
@@ -36,7 +38,7 @@
 using namespace std;
 
 CTxMemPoolEntry::CTxMemPoolEntry():
-    nFee(0), nTxSize(0), nModSize(0), nUsageSize(0), nTime(0), dPriority(0.0),
+    tx(MakeTransactionRef()), nFee(0), nTxSize(0), nModSize(0), nUsageSize(0), nTime(0), dPriority(0.0),
     hadNoDependencies(false), spendsCoinbase(false)
 {
     nHeight = MEMPOOL_HEIGHT;
@@ -46,12 +48,12 @@ CTxMemPoolEntry::CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee,
                                  int64_t _nTime, double _dPriority,
                                  unsigned int _nHeight, bool poolHasNoInputsOf,
                                  bool _spendsCoinbase, uint32_t _nBranchId):
-    tx(_tx), nFee(_nFee), nTime(_nTime), dPriority(_dPriority), nHeight(_nHeight),
+    tx(MakeTransactionRef(_tx)), nFee(_nFee), nTime(_nTime), dPriority(_dPriority), nHeight(_nHeight),
     hadNoDependencies(poolHasNoInputsOf),
     spendsCoinbase(_spendsCoinbase), nBranchId(_nBranchId)
 {
-    nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-    nModSize = tx.CalculateModifiedSize(nTxSize);
+    nTxSize = ::GetSerializeSize(*tx, SER_NETWORK, PROTOCOL_VERSION);
+    nModSize = tx->CalculateModifiedSize(nTxSize);
     nUsageSize = RecursiveDynamicUsage(tx);
     feeRate = CFeeRate(nFee, nTxSize);
 }
@@ -64,14 +66,22 @@ CTxMemPoolEntry::CTxMemPoolEntry(const CTxMemPoolEntry& other)
 double
 CTxMemPoolEntry::GetPriority(unsigned int currentHeight) const
 {
-    CAmount nValueIn = tx.GetValueOut()+nFee;
+    CAmount nValueIn = tx->GetValueOut()+nFee;
     double deltaPriority = ((double)(currentHeight-nHeight)*nValueIn)/nModSize;
     double dResult = dPriority + deltaPriority;
     return dResult;
 }
 
+SaltedOutpointHasher::SaltedOutpointHasher() : salt(GetRandHash()) {}
+
+SaltedSpentIndexKeyHasher::SaltedSpentIndexKeyHasher() : salt(GetRandHash()) {}
+
 CTxMemPool::CTxMemPool(const CFeeRate& _minRelayFee) :
-    nTransactionsUpdated(0)
+    nTransactionsUpdated(0), minReasonableRelayFee(_minRelayFee),
+    mapSproutNullifiers(0, CCoinsKeyHasher(), std::equal_to<uint256>(), nullifierMap::allocator_type(&indexPool)),
+    mapSaplingNullifiers(0, CCoinsKeyHasher(), std::equal_to<uint256>(), nullifierMap::allocator_type(&indexPool)),
+    mapSpent(0, SaltedSpentIndexKeyHasher(), std::equal_to<CSpentIndexKey>(), mapSpentIndex::allocator_type(&indexPool)),
+    mapNextTx(0, SaltedOutpointHasher(), std::equal_to<COutPoint>(), nextTxMap::allocator_type(&indexPool))
 {
     // Sanity checks off by default for performance, because otherwise
     // accepting transactions becomes O(N^2) where N is the number
@@ -90,12 +100,10 @@ void CTxMemPool::pruneSpent(const uint256 &hashTx, CCoins &coins)
 {
     LOCK(cs);
 
-    std::map<COutPoint, CInPoint>::iterator it = mapNextTx.lower_bound(COutPoint(hashTx, 0));
-
-    // iterate over all COutPoints in mapNextTx whose hash equals the provided hashTx
-    while (it != mapNextTx.end() && it->first.hash == hashTx) {
-        coins.Spend(it->first.n); // and remove those outputs from coins
-        it++;
+    // look up each output of hashTx in mapNextTx
+    for (unsigned int n = 0; n < coins.vout.size(); n++) {
+        if (mapNextTx.count(COutPoint(hashTx, n)))
+            coins.Spend(n); // and remove those outputs from coins
     }
 }
 
@@ -112,6 +120,68 @@ void CTxMemPool::AddTransactionsUpdated(unsigned int n)
 }
 
 
+// Evalcodes and funcids of the opreturn of tx, with those of the module data a tokens opreturn carries
+void CCMempoolEvalKeys(const CTransaction &tx, std::vector<std::pair<uint8_t, uint8_t> > &keys);
+
+//! Index key of the address of out, false when it has none
+static bool GetOutputAddressKey(const CTxOut &out, uint160 &hashBytes)
+{
+    CTxDestination dest;
+    int keyType;
+    return ExtractDestination(out.scriptPubKey, dest) && CBitcoinAddress(dest).GetIndexKey(hashBytes, keyType, out.scriptPubKey.IsPayToCryptoCondition());
+}
+
+void CTxMemPool::addCCIndex(const CTransaction &tx)
+{
+    const uint256 &hash = tx.GetHash();
+    std::vector<std::pair<uint8_t, uint8_t> > keys;
+    CCMempoolEvalKeys(tx, keys);
+    for (const std::pair<uint8_t, uint8_t> &key : keys)
+        setCCEval.insert(std::make_pair(key, hash));
+    for (unsigned int k = 0; k < tx.vout.size(); k++) {
+        uint160 hashBytes;
+        if (GetOutputAddressKey(tx.vout[k], hashBytes))
+            setOutputAddress.insert(std::make_pair(hashBytes, COutPoint(hash, k)));
+    }
+}
+
+void CTxMemPool::removeCCIndex(const CTransaction &tx)
+{
+    // The keys are derived from tx again, as when it was added
+    const uint256 &hash = tx.GetHash();
+    std::vector<std::pair<uint8_t, uint8_t> > keys;
+    CCMempoolEvalKeys(tx, keys);
+    for (const std::pair<uint8_t, uint8_t> &key : keys)
+        setCCEval.erase(std::make_pair(key, hash));
+    for (unsigned int k = 0; k < tx.vout.size(); k++) {
+        uint160 hashBytes;
+        if (GetOutputAddressKey(tx.vout[k], hashBytes))
+            setOutputAddress.erase(std::make_pair(hashBytes, COutPoint(hash, k)));
+    }
+}
+
+void CTxMemPool::getCCEvalTxs(uint8_t evalcode, uint8_t funcid, std::vector<CTransaction> &txs) const
+{
+    LOCK(cs);
+    for (ccEvalSet::const_iterator it = setCCEval.lower_bound(std::make_pair(std::make_pair(evalcode, funcid), uint256()));
+         it != setCCEval.end() && it->first.first == evalcode && (funcid == 0 || it->first.second == funcid); it++) {
+        indexed_transaction_set::const_iterator itTx = mapTx.find(it->second);
+        if (itTx != mapTx.end())
+            txs.push_back(itTx->GetTx());
+    }
+}
+
+void CTxMemPool::getAddressOutputs(const uint160 &addressHash, std::vector<std::pair<COutPoint, CTxOut> > &outputs) const
+{
+    LOCK(cs);
+    for (outputAddressSet::const_iterator it = setOutputAddress.lower_bound(std::make_pair(addressHash, COutPoint(uint256(), 0)));
+         it != setOutputAddress.end() && it->first == addressHash; it++) {
+        indexed_transaction_set::const_iterator itTx = mapTx.find(it->second.hash);
+        if (itTx != mapTx.end())
+            outputs.push_back(std::make_pair(it->second, itTx->GetTx().vout[it->second.n]));
+    }
+}
+
 bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry, bool fCurrentEstimate)
 {
     // Add to memory pool without checking anything.
@@ -137,6 +207,7 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
     for (const SpendDescription &spendDescription : tx.vShieldedSpend) {
         mapSaplingNullifiers[spendDescription.nullifier] = &tx;
     }
+    addCCIndex(tx);
     nTransactionsUpdated++;
     totalTxSize += entry.GetTxSize();
     cachedInnerUsage += entry.DynamicMemoryUsage();
@@ -347,7 +418,7 @@ void CTxMemPool::remove(const CTransaction &origTx, std::list<CTransaction>& rem
             // happen during chain re-orgs if origTx isn't re-accepted into
             // the mempool for any reason.
             for (unsigned int i = 0; i < origTx.vout.size(); i++) {
-                std::map<COutPoint, CInPoint>::iterator it = mapNextTx.find(COutPoint(origTx.GetHash(), i));
+                nextTxMap::iterator it = mapNextTx.find(COutPoint(origTx.GetHash(), i));
                 if (it == mapNextTx.end())
                     continue;
                 txToRemove.push_back(it->second.ptx->GetHash());
@@ -362,7 +433,7 @@ void CTxMemPool::remove(const CTransaction &origTx, std::list<CTransaction>& rem
             const CTransaction& tx = mapTx.find(hash)->GetTx();
             if (fRecursive) {
                 for (unsigned int i = 0; i < tx.vout.size(); i++) {
-                    std::map<COutPoint, CInPoint>::iterator it = mapNextTx.find(COutPoint(hash, i));
+                    nextTxMap::iterator it = mapNextTx.find(COutPoint(hash, i));
                     if (it == mapNextTx.end())
                         continue;
                     txToRemove.push_back(it->second.ptx->GetHash());
@@ -379,6 +450,7 @@ void CTxMemPool::remove(const CTransaction &origTx, std::list<CTransaction>& rem
             for (const SpendDescription &spendDescription : tx.vShieldedSpend) {
                 mapSaplingNullifiers.erase(spendDescription.nullifier);
             }
+            removeCCIndex(tx);
             removed.push_back(tx);
             totalTxSize -= mapTx.find(hash)->GetTxSize();
             cachedInnerUsage -= mapTx.find(hash)->DynamicMemoryUsage();
@@ -476,7 +548,7 @@ void CTxMemPool::removeConflicts(const CTransaction &tx, std::list<CTransaction>
     list<CTransaction> result;
     LOCK(cs);
     BOOST_FOREACH(const CTxIn &txin, tx.vin) {
-        std::map<COutPoint, CInPoint>::iterator it = mapNextTx.find(txin.prevout);
+        nextTxMap::iterator it = mapNextTx.find(txin.prevout);
         if (it != mapNextTx.end()) {
             const CTransaction &txConflict = *it->second.ptx;
             if (txConflict != tx)
@@ -488,7 +560,7 @@ void CTxMemPool::removeConflicts(const CTransaction &tx, std::list<CTransaction>
 
     BOOST_FOREACH(const JSDescription &joinsplit, tx.vjoinsplit) {
         BOOST_FOREACH(const uint256 &nf, joinsplit.nullifiers) {
-            std::map<uint256, const CTransaction*>::iterator it = mapSproutNullifiers.find(nf);
+            nullifierMap::iterator it = mapSproutNullifiers.find(nf);
             if (it != mapSproutNullifiers.end()) {
                 const CTransaction &txConflict = *it->second;
                 if (txConflict != tx) {
@@ -498,7 +570,7 @@ void CTxMemPool::removeConflicts(const CTransaction &tx, std::list<CTransaction>
         }
     }
     for (const SpendDescription &spendDescription : tx.vShieldedSpend) {
-        std::map<uint256, const CTransaction*>::iterator it = mapSaplingNullifiers.find(spendDescription.nullifier);
+        nullifierMap::iterator it = mapSaplingNullifiers.find(spendDescription.nullifier);
         if (it != mapSaplingNullifiers.end()) {
             const CTransaction &txConflict = *it->second;
             if (txConflict != tx) {
@@ -513,23 +585,39 @@ extern char ASSETCHAINS_SYMBOL[];
 
 void CTxMemPool::removeExpired(unsigned int nBlockHeight)
 {
-    CBlockIndex *tipindex;
+    CBlockIndex *tipindex = chainActive.LastTip();
     // Remove expired txs from the mempool
     LOCK(cs);
     list<CTransaction> transactionsToRemove;
-    for (indexed_transaction_set::const_iterator it = mapTx.begin(); it != mapTx.end(); it++)
+    std::set<uint256> setToRemove;
+
+    // Expired once the block height passes the expiry height
+    const indexed_transaction_set::nth_index<2>::type& byExpiry = mapTx.get<2>();
+    indexed_transaction_set::nth_index<2>::type::const_iterator expiryEnd = byExpiry.lower_bound(nBlockHeight);
+    for (indexed_transaction_set::nth_index<2>::type::const_iterator it = byExpiry.begin(); it != expiryEnd; it++)
     {
         const CTransaction& tx = it->GetTx();
-        tipindex = chainActive.LastTip();
+        if (IsExpiredTx(tx, nBlockHeight) && setToRemove.insert(tx.GetHash()).second)
+            transactionsToRemove.push_back(tx);
+    }
 
-        bool fInterestNotValidated = ASSETCHAINS_SYMBOL[0] == 0 && tipindex != 0 && komodo_validate_interest(tx,tipindex->GetHeight()+1,tipindex->GetMedianTimePast() + 777,0) < 0;
-        if (IsExpiredTx(tx, nBlockHeight) || fInterestNotValidated)
+    // Only lock times older than KOMODO_MAXMEMPOOLTIME before the median time past can violate the interest rule
+    if (ASSETCHAINS_SYMBOL[0] == 0 && tipindex != 0)
+    {
+        uint32_t cmptime = tipindex->GetMedianTimePast() + 777;
+        const indexed_transaction_set::nth_index<3>::type& byLockTime = mapTx.get<3>();
+        indexed_transaction_set::nth_index<3>::type::const_iterator lockTimeEnd = byLockTime.lower_bound(cmptime - KOMODO_MAXMEMPOOLTIME);
+        for (indexed_transaction_set::nth_index<3>::type::const_iterator it = byLockTime.begin(); it != lockTimeEnd; it++)
         {
-            if (fInterestNotValidated && tipindex != 0)
-                LogPrintf("Removing interest violate txid.%s nHeight.%d nTime.%u vs locktime.%u\n",tx.GetHash().ToString(),tipindex->GetHeight()+1,tipindex->GetMedianTimePast() + 777,tx.nLockTime);
-            transactionsToRemove.push_back(tx);
+            const CTransaction& tx = it->GetTx();
+            if (komodo_validate_interest(tx,tipindex->GetHeight()+1,cmptime,0) < 0 && setToRemove.insert(tx.GetHash()).second)
+            {
+                LogPrintf("Removing interest violate txid.%s nHeight.%d nTime.%u vs locktime.%u\n",tx.GetHash().ToString(),tipindex->GetHeight()+1,cmptime,tx.nLockTime);
+                transactionsToRemove.push_back(tx);
+            }
         }
     }
+
     for (const CTransaction& tx : transactionsToRemove) {
         list<CTransaction> removed;
         remove(tx, removed, true);
@@ -591,6 +679,8 @@ void CTxMemPool::clear()
     LOCK(cs);
     mapTx.clear();
     mapNextTx.clear();
+    setCCEval.clear();
+    setOutputAddress.clear();
     totalTxSize = 0;
     cachedInnerUsage = 0;
     ++nTransactionsUpdated;
@@ -632,7 +722,7 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
                 assert(coins && coins->IsAvailable(txin.prevout.n));
             }
             // Check whether its inputs are marked in mapNextTx.
-            std::map<COutPoint, CInPoint>::const_iterator it3 = mapNextTx.find(txin.prevout);
+            nextTxMap::const_iterator it3 = mapNextTx.find(txin.prevout);
             assert(it3 != mapNextTx.end());
             assert(it3->second.ptx == &tx);
             assert(it3->second.n == i);
@@ -694,7 +784,7 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
             stepsSinceLastRemove = 0;
         }
     }
-    for (std::map<COutPoint, CInPoint>::const_iterator it = mapNextTx.begin(); it != mapNextTx.end(); it++) {
+    for (nextTxMap::const_iterator it = mapNextTx.begin(); it != mapNextTx.end(); it++) {
         uint256 hash = it->second.ptx->GetHash();
         indexed_transaction_set::const_iterator it2 = mapTx.find(hash);
         const CTransaction& tx = it2->GetTx();
@@ -713,7 +803,7 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
 
 void CTxMemPool::checkNullifiers(ShieldedType type) const
 {
-    const std::map<uint256, const CTransaction*>* mapToUse;
+    const nullifierMap* mapToUse;
     switch (type) {
         case SPROUT:
             mapToUse = &mapSproutNullifiers;
@@ -752,6 +842,15 @@ bool CTxMemPool::lookup(uint256 hash, CTransaction& result) const
     return true;
 }
 
+CTransactionRef CTxMemPool::get(const uint256& hash) const
+{
+    LOCK(cs);
+    indexed_transaction_set::const_iterator i = mapTx.find(hash);
+    if (i == mapTx.end())
+        return CTransactionRef();
+    return i->GetSharedTx();
+}
+
 CFeeRate CTxMemPool::estimateFee(int nBlocks) const
 {
     LOCK(cs);
@@ -812,7 +911,7 @@ void CTxMemPool::PrioritiseTransaction(const uint256 hash, const string strHash,
 void CTxMemPool::ApplyDeltas(const uint256 hash, double &dPriorityDelta, CAmount &nFeeDelta)
 {
     LOCK(cs);
-    std::map<uint256, std::pair<double, CAmount> >::iterator pos = mapDeltas.find(hash);
+    boost::unordered_map<uint256, std::pair<double, CAmount>, CCoinsKeyHasher>::iterator pos = mapDeltas.find(hash);
     if (pos == mapDeltas.end())
         return;
     const std::pair<double, CAmount> &deltas = pos->second;
@@ -859,13 +958,14 @@ void CTxMemPool::NotifyRecentlyAdded()
         mapRecentlyAddedTx.clear();
     }
 
-    // A race condition can occur here between these SyncWithWallets calls, and
+    // A race condition can occur here between this SyncWithWallets call, and
     // the ones triggered by block logic (in ConnectTip and DisconnectTip). It
     // is harmless because calling SyncWithWallets(_, NULL) does not alter the
     // wallet transaction's block information.
-    for (auto tx : txs) {
+    // The whole batch is passed at once so a wallet locks and decrypts once.
+    if (!txs.empty()) {
         try {
-            SyncWithWallets(tx, NULL);
+            SyncWithWallets(txs, NULL);
         } catch (const boost::thread_interrupted&) {
             throw;
         } catch (const std::exception& e) {
@@ -914,6 +1014,79 @@ bool CCoinsViewMemPool::HaveCoins(const uint256 &txid) const {
 
 size_t CTxMemPool::DynamicMemoryUsage() const {
     LOCK(cs);
-    // Estimate the overhead of mapTx to be 6 pointers + an allocation, as no exact formula for boost::multi_index_contained is implemented.
-    return memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 6 * sizeof(void*)) * mapTx.size() + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) + cachedInnerUsage;
+    // Estimate the overhead of mapTx to be 3 pointers per ordered index + an allocation, as no exact formula for boost::multi_index_contained is implemented.
+    // indexPool holds the nodes and buckets of mapNextTx, the nullifier maps and mapSpent. Only what is in use
+    // counts, blocks freed by removed entries are reused, so evicting does shrink the usage TrimToSize sees.
+    return memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 12 * sizeof(void*)) * mapTx.size() + indexPool.UsedMemoryUsage() + memusage::DynamicUsage(mapDeltas) +
+        memusage::DynamicUsage(mapRecentlyAddedTx) + memusage::DynamicUsage(setCCEval) + memusage::DynamicUsage(setOutputAddress) + cachedInnerUsage;
+}
+
+void CTxMemPool::TrimToSize(size_t sizelimit, std::list<CTransaction>* pvRemoved)
+{
+    LOCK(cs);
+    while (!mapTx.empty() && DynamicMemoryUsage() > sizelimit) {
+        // The fee rate index sorts the highest fee rate first
+        const CTransaction& tx = mapTx.get<1>().rbegin()->GetTx();
+
+        // The fee rate of the package going with it, so the minimum fee rate says what would have stayed
+        CAmount nPackageFees = 0;
+        size_t nPackageSize = 0;
+        std::set<uint256> setPackage;
+        std::deque<uint256> queue;
+        queue.push_back(tx.GetHash());
+        while (!queue.empty()) {
+            uint256 hash = queue.front();
+            queue.pop_front();
+            indexed_transaction_set::const_iterator it = mapTx.find(hash);
+            if (it == mapTx.end() || !setPackage.insert(hash).second)
+                continue;
+            nPackageFees += it->GetFee();
+            nPackageSize += it->GetTxSize();
+            for (unsigned int n = 0; n < it->GetTx().vout.size(); n++) {
+                nextTxMap::iterator nit = mapNextTx.find(COutPoint(hash, n));
+                if (nit != mapNextTx.end())
+                    queue.push_back(nit->second.ptx->GetHash());
+            }
+        }
+        CFeeRate removedRate(nPackageFees, nPackageSize);
+        double dNewMinimum = (double)(removedRate.GetFeePerK() + minReasonableRelayFee.GetFeePerK());
+        if (dNewMinimum > rollingMinimumFeeRate) {
+            rollingMinimumFeeRate = dNewMinimum;
+            lastRollingFeeUpdate = GetTime();
+        }
+
+        std::list<CTransaction> removed;
+        remove(CTransaction(tx), removed, true);
+        nEvicted += removed.size();
+        LogPrint("mempool", "Evicted %u transactions at fee rate %s to keep the mempool under %u bytes\n", removed.size(), removedRate.ToString(), sizelimit);
+        if (pvRemoved)
+            pvRemoved->splice(pvRemoved->end(), removed);
+    }
+}
+
+CFeeRate CTxMemPool::GetMinFee(size_t sizelimit) const
+{
+    LOCK(cs);
+    if (rollingMinimumFeeRate == 0)
+        return CFeeRate(0);
+
+    int64_t nNow = GetTime();
+    if (nNow > lastRollingFeeUpdate + 10) {
+        // Decay faster the more room there is
+        double halflife = ROLLING_FEE_HALFLIFE;
+        size_t usage = DynamicMemoryUsage();
+        if (usage < sizelimit / 4)
+            halflife /= 4;
+        else if (usage < sizelimit / 2)
+            halflife /= 2;
+
+        rollingMinimumFeeRate = rollingMinimumFeeRate / pow(2.0, (nNow - lastRollingFeeUpdate) / halflife);
+        lastRollingFeeUpdate = nNow;
+
+        if (rollingMinimumFeeRate < (double)minReasonableRelayFee.GetFeePerK() / 2) {
+            rollingMinimumFeeRate = 0;
+            return CFeeRate(0);
+        }
+    }
+    return std::max(CFeeRate((CAmount)rollingMinimumFeeRate), minReasonableRelayFee);
 }
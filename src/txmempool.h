@@ -21,7 +21,9 @@
 #ifndef BITCOIN_TXMEMPOOL_H
 #define BITCOIN_TXMEMPOOL_H
 
+#include <limits>
 #include <list>
+#include <set>
 
 #include "addressindex.h"
 #include "spentindex.h"
@@ -33,6 +35,7 @@
 #undef foreach
 #include "boost/multi_index_container.hpp"
 #include "boost/multi_index/ordered_index.hpp"
+#include "boost/unordered_map.hpp"
 
 class CAutoFile;
 
@@ -50,6 +53,10 @@ inline bool AllowFree(double dPriority)
 
 /** Fake height value used in CCoins to signify they are only in the memory pool (since 0.8) */
 static const unsigned int MEMPOOL_HEIGHT = 0x7FFFFFFF;
+/** Default for -maxmempool, maximum megabytes of memory the mempool may use */
+static const unsigned int DEFAULT_MAX_MEMPOOL_SIZE = 300;
+/** Half life in seconds of the minimum fee rate raised by evictions */
+static const unsigned int ROLLING_FEE_HALFLIFE = 60 * 60 * 12;
 
 /**
  * CTxMemPool stores these:
@@ -57,7 +64,7 @@ static const unsigned int MEMPOOL_HEIGHT = 0x7FFFFFFF;
 class CTxMemPoolEntry
 {
 private:
-    CTransaction tx;
+    CTransactionRef tx;
     CAmount nFee; //! Cached to avoid expensive parent-transaction lookups
     size_t nTxSize; //! ... and avoid recomputing tx size
     size_t nModSize; //! ... and modified size for priority
@@ -77,7 +84,8 @@ public:
     CTxMemPoolEntry();
     CTxMemPoolEntry(const CTxMemPoolEntry& other);
 
-    const CTransaction& GetTx() const { return this->tx; }
+    const CTransaction& GetTx() const { return *this->tx; }
+    CTransactionRef GetSharedTx() const { return this->tx; }
     double GetPriority(unsigned int currentHeight) const;
     CAmount GetFee() const { return nFee; }
     CFeeRate GetFeeRate() const { return feeRate; }
@@ -101,6 +109,33 @@ struct mempoolentry_txid
     }
 };
 
+// extracts the height after which a TxMemPoolEntry's transaction expires, the maximum if it never does
+struct mempoolentry_expiryheight
+{
+    typedef uint32_t result_type;
+    result_type operator() (const CTxMemPoolEntry &entry) const
+    {
+        const CTransaction& tx = entry.GetTx();
+        if (tx.nExpiryHeight == 0 || tx.IsCoinBase())
+            return std::numeric_limits<uint32_t>::max();
+        return tx.nExpiryHeight;
+    }
+};
+
+// extracts the lock time a TxMemPoolEntry's transaction is checked against by the KMD interest rule,
+// the maximum if the rule does not apply to it (lock time by height)
+struct mempoolentry_interestlocktime
+{
+    typedef uint32_t result_type;
+    result_type operator() (const CTxMemPoolEntry &entry) const
+    {
+        const CTransaction& tx = entry.GetTx();
+        if (tx.nLockTime < LOCKTIME_THRESHOLD)
+            return std::numeric_limits<uint32_t>::max();
+        return tx.nLockTime;
+    }
+};
+
 class CompareTxMemPoolEntryByFee
 {
 public:
@@ -114,6 +149,33 @@ public:
 
 class CBlockPolicyEstimator;
 
+/** Salted hash of an outpoint for the mempool's hash maps, so peers cannot aim for one bucket */
+class SaltedOutpointHasher
+{
+private:
+    uint256 salt;
+
+public:
+    SaltedOutpointHasher();
+
+    size_t operator()(const COutPoint& outpoint) const {
+        return outpoint.hash.GetHash(salt) ^ ((uint64_t)outpoint.n * 0x9e3779b97f4a7c15ull);
+    }
+};
+
+class SaltedSpentIndexKeyHasher
+{
+private:
+    uint256 salt;
+
+public:
+    SaltedSpentIndexKeyHasher();
+
+    size_t operator()(const CSpentIndexKey& key) const {
+        return key.txid.GetHash(salt) ^ ((uint64_t)key.outputIndex * 0x9e3779b97f4a7c15ull);
+    }
+};
+
 /** An inpoint - a combination of a transaction and an index n into its vin */
 class CInPoint
 {
@@ -146,16 +208,35 @@ private:
     CBlockPolicyEstimator* minerPolicyEstimator;
 
     uint64_t totalTxSize = 0; //! sum of all mempool tx' byte sizes
-    uint64_t cachedInnerUsage; //! sum of dynamic memory usage of all the map elements (NOT the maps themselves)
+    uint64_t cachedInnerUsage = 0; //! sum of dynamic memory usage of all the map elements (NOT the maps themselves)
+
+    CFeeRate minReasonableRelayFee; //! the fee rate eviction raises the minimum fee rate above
+    mutable double rollingMinimumFeeRate = 0; //! minimum fee rate in satoshis per kB to enter, after evictions
+    mutable int64_t lastRollingFeeUpdate = 0;
+    uint64_t nEvicted = 0; //! transactions evicted by TrimToSize
 
     std::map<uint256, const CTransaction*> mapRecentlyAddedTx;
     uint64_t nRecentlyAddedSequence = 0;
     uint64_t nNotifiedSequence = 0;
 
-    std::map<uint256, const CTransaction*> mapSproutNullifiers;
-    std::map<uint256, const CTransaction*> mapSaplingNullifiers;
+    //! Nodes of the hash maps below are drawn from this pool, guarded by cs
+    PoolResource indexPool;
+
+    typedef boost::unordered_map<uint256, const CTransaction*, CCoinsKeyHasher, std::equal_to<uint256>,
+        pool_allocator<std::pair<const uint256, const CTransaction*>>> nullifierMap;
+    nullifierMap mapSproutNullifiers;
+    nullifierMap mapSaplingNullifiers;
+
+    //! Transactions by the evalcode and funcid of their CC opreturn, for the CC modules' mempool lookups
+    typedef std::set<std::pair<std::pair<uint8_t, uint8_t>, uint256> > ccEvalSet;
+    ccEvalSet setCCEval;
+    //! Outputs by the index key of the address they pay to, CC or not
+    typedef std::set<std::pair<uint160, COutPoint> > outputAddressSet;
+    outputAddressSet setOutputAddress;
 
     void checkNullifiers(ShieldedType type) const;
+    void addCCIndex(const CTransaction &tx);
+    void removeCCIndex(const CTransaction &tx);
     
 public:
     typedef boost::multi_index_container<
@@ -167,7 +248,11 @@ public:
             boost::multi_index::ordered_non_unique<
                 boost::multi_index::identity<CTxMemPoolEntry>,
                 CompareTxMemPoolEntryByFee
-            >
+            >,
+            // sorted by expiry height, for removeExpired
+            boost::multi_index::ordered_non_unique<mempoolentry_expiryheight>,
+            // sorted by lock time where the interest rule applies, for removeExpired
+            boost::multi_index::ordered_non_unique<mempoolentry_interestlocktime>
         >
     > indexed_transaction_set;
 
@@ -178,18 +263,21 @@ private:
     typedef std::map<CMempoolAddressDeltaKey, CMempoolAddressDelta, CMempoolAddressDeltaKeyCompare> addressDeltaMap;
     addressDeltaMap mapAddress;
 
-    typedef std::map<uint256, std::vector<CMempoolAddressDeltaKey> > addressDeltaMapInserted;
+    typedef boost::unordered_map<uint256, std::vector<CMempoolAddressDeltaKey>, CCoinsKeyHasher> addressDeltaMapInserted;
     addressDeltaMapInserted mapAddressInserted;
 
-    typedef std::map<CSpentIndexKey, CSpentIndexValue, CSpentIndexKeyCompare> mapSpentIndex;
+    typedef boost::unordered_map<CSpentIndexKey, CSpentIndexValue, SaltedSpentIndexKeyHasher, std::equal_to<CSpentIndexKey>,
+        pool_allocator<std::pair<const CSpentIndexKey, CSpentIndexValue>>> mapSpentIndex;
     mapSpentIndex mapSpent;
 
-    typedef std::map<uint256, std::vector<CSpentIndexKey> > mapSpentIndexInserted;
+    typedef boost::unordered_map<uint256, std::vector<CSpentIndexKey>, CCoinsKeyHasher> mapSpentIndexInserted;
     mapSpentIndexInserted mapSpentInserted;
 
 public:
-    std::map<COutPoint, CInPoint> mapNextTx;
-    std::map<uint256, std::pair<double, CAmount> > mapDeltas;
+    typedef boost::unordered_map<COutPoint, CInPoint, SaltedOutpointHasher, std::equal_to<COutPoint>,
+        pool_allocator<std::pair<const COutPoint, CInPoint>>> nextTxMap;
+    nextTxMap mapNextTx;
+    boost::unordered_map<uint256, std::pair<double, CAmount>, CCoinsKeyHasher> mapDeltas;
 
     CTxMemPool(const CFeeRate& _minRelayFee);
     ~CTxMemPool();
@@ -212,6 +300,11 @@ public:
     void addSpentIndex(const CTxMemPoolEntry &entry, const CCoinsViewCache &view);
     bool getSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value);
     bool removeSpentIndex(const uint256 txhash);
+
+    //! Transactions whose CC opreturn has evalcode and funcid, any funcid when it is 0
+    void getCCEvalTxs(uint8_t evalcode, uint8_t funcid, std::vector<CTransaction> &txs) const;
+    //! Outputs paying to the address with index key addressHash
+    void getAddressOutputs(const uint160 &addressHash, std::vector<std::pair<COutPoint, CTxOut> > &outputs) const;
     void remove(const CTransaction &tx, std::list<CTransaction>& removed, bool fRecursive = false);
     void removeWithAnchor(const uint256 &invalidRoot, ShieldedType type);
     void removeForReorg(const CCoinsViewCache *pcoins, unsigned int nMemPoolHeight, int flags);
@@ -260,6 +353,8 @@ public:
     }
 
     bool lookup(uint256 hash, CTransaction& result) const;
+    //! The transaction shared with its entry, null when it is not in the pool
+    CTransactionRef get(const uint256& hash) const;
 
     /** Estimate fee rate needed to get into the next nBlocks */
     CFeeRate estimateFee(int nBlocks) const;
@@ -273,6 +368,20 @@ public:
 
     size_t DynamicMemoryUsage() const;
 
+    /**
+     * Evicts the transaction with the lowest fee rate, together with its
+     * descendants in the pool, until the pool uses at most sizelimit bytes.
+     * The minimum fee rate is raised above the fee rate of each evicted package.
+     */
+    void TrimToSize(size_t sizelimit, std::list<CTransaction>* pvRemoved = NULL);
+    /** The minimum fee rate to enter a pool limited to sizelimit bytes, decaying back to zero once it has room */
+    CFeeRate GetMinFee(size_t sizelimit) const;
+    uint64_t GetEvictedCount() const
+    {
+        LOCK(cs);
+        return nEvicted;
+    }
+
     /** Return nCheckFrequency */
     uint32_t GetCheckFrequency() const {
         return nCheckFrequency;
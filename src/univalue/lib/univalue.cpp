@@ -77,12 +77,35 @@ bool ParseDouble(const std::string& str, double *out)
 
 const UniValue NullUniValue;
 
+UniValue::UniValue(const UniValue& other) :
+    typ(other.typ), val(other.val), keys(other.keys), values(other.values),
+    keyIndex(other.keyIndex ? new std::unordered_map<std::string, size_t>(*other.keyIndex) : NULL)
+{
+}
+
+UniValue& UniValue::operator=(const UniValue& other)
+{
+    // Copied first, other may be one of our own values
+    UniValue tmp(other);
+    *this = std::move(tmp);
+    return *this;
+}
+
 void UniValue::clear()
 {
     typ = VNULL;
     val.clear();
     keys.clear();
     values.clear();
+    keyIndex.reset();
+}
+
+void UniValue::reserve(size_t n)
+{
+    if (typ == VOBJ)
+        keys.reserve(n);
+    if (typ == VOBJ || typ == VARR)
+        values.reserve(n);
 }
 
 bool UniValue::setNull()
@@ -119,22 +142,36 @@ bool UniValue::setNumStr(const std::string& val_)
     return true;
 }
 
-bool UniValue::setInt(uint64_t val_)
+// Integers are always valid numbers, so they are formatted without a stream and not parsed back
+static void formatInt(uint64_t n, bool negative, std::string& out)
 {
-    std::ostringstream oss;
-
-    oss << val_;
+    char buf[24];
+    char *end = buf + sizeof(buf);
+    char *p = end;
+    do {
+        *--p = '0' + (n % 10);
+        n /= 10;
+    } while (n);
+    if (negative)
+        *--p = '-';
+    out.assign(p, end);
+}
 
-    return setNumStr(oss.str());
+bool UniValue::setInt(uint64_t val_)
+{
+    clear();
+    typ = VNUM;
+    formatInt(val_, false, val);
+    return true;
 }
 
 bool UniValue::setInt(int64_t val_)
 {
-    std::ostringstream oss;
-
-    oss << val_;
-
-    return setNumStr(oss.str());
+    clear();
+    typ = VNUM;
+    // Negated as unsigned, so the lowest int64_t doesn't overflow
+    formatInt(val_ < 0 ? -(uint64_t)val_ : (uint64_t)val_, val_ < 0, val);
+    return true;
 }
 
 bool UniValue::setFloat(double val_)
@@ -156,6 +193,14 @@ bool UniValue::setStr(const std::string& val_)
     return true;
 }
 
+bool UniValue::setStr(std::string&& val_)
+{
+    clear();
+    typ = VSTR;
+    val = std::move(val_);
+    return true;
+}
+
 bool UniValue::setArray()
 {
     clear();
@@ -179,6 +224,15 @@ bool UniValue::push_back(const UniValue& val_)
     return true;
 }
 
+bool UniValue::push_back(UniValue&& val_)
+{
+    if (typ != VARR)
+        return false;
+
+    values.push_back(std::move(val_));
+    return true;
+}
+
 bool UniValue::push_backV(const std::vector<UniValue>& vec)
 {
     if (typ != VARR)
@@ -189,10 +243,50 @@ bool UniValue::push_backV(const std::vector<UniValue>& vec)
     return true;
 }
 
+bool UniValue::push_backV(std::vector<UniValue>&& vec)
+{
+    if (typ != VARR)
+        return false;
+
+    if (values.empty()) {
+        values = std::move(vec);
+    } else {
+        values.reserve(values.size() + vec.size());
+        for (size_t i = 0; i < vec.size(); i++)
+            values.push_back(std::move(vec[i]));
+    }
+    vec.clear();
+
+    return true;
+}
+
+void UniValue::indexKey(size_t idx)
+{
+    if (!keyIndex) {
+        if (keys.size() < UNIVALUE_KEY_INDEX_MIN)
+            return;
+        keyIndex.reset(new std::unordered_map<std::string, size_t>());
+        keyIndex->reserve(keys.size() * 2);
+        for (size_t i = 0; i < keys.size(); i++)
+            keyIndex->emplace(keys[i], i);
+        return;
+    }
+    // A duplicate key keeps the index of its first value, as the linear search finds
+    keyIndex->emplace(keys[idx], idx);
+}
+
 void UniValue::__pushKV(const std::string& key, const UniValue& val_)
 {
     keys.push_back(key);
     values.push_back(val_);
+    indexKey(keys.size() - 1);
+}
+
+void UniValue::__pushKV(const std::string& key, UniValue&& val_)
+{
+    keys.push_back(key);
+    values.push_back(std::move(val_));
+    indexKey(keys.size() - 1);
 }
 
 bool UniValue::pushKV(const std::string& key, const UniValue& val_)
@@ -208,11 +302,26 @@ bool UniValue::pushKV(const std::string& key, const UniValue& val_)
     return true;
 }
 
+bool UniValue::pushKV(const std::string& key, UniValue&& val_)
+{
+    if (typ != VOBJ)
+        return false;
+
+    size_t idx;
+    if (findKey(key, idx))
+        values[idx] = std::move(val_);
+    else
+        __pushKV(key, std::move(val_));
+    return true;
+}
+
 bool UniValue::pushKVs(const UniValue& obj)
 {
     if (typ != VOBJ || obj.typ != VOBJ)
         return false;
 
+    keys.reserve(keys.size() + obj.keys.size());
+    values.reserve(values.size() + obj.values.size());
     for (size_t i = 0; i < obj.keys.size(); i++)
         __pushKV(obj.keys[i], obj.values.at(i));
 
@@ -231,6 +340,14 @@ void UniValue::getObjMap(std::map<std::string,UniValue>& kv) const
 
 bool UniValue::findKey(const std::string& key, size_t& retIdx) const
 {
+    if (keyIndex) {
+        std::unordered_map<std::string, size_t>::const_iterator it = keyIndex->find(key);
+        if (it == keyIndex->end())
+            return false;
+        retIdx = it->second;
+        return true;
+    }
+
     for (size_t i = 0; i < keys.size(); i++) {
         if (keys[i] == key) {
             retIdx = i;
@@ -298,9 +415,9 @@ const char *uvTypeName(UniValue::VType t)
 
 const UniValue& find_value(const UniValue& obj, const std::string& name)
 {
-    for (unsigned int i = 0; i < obj.keys.size(); i++)
-        if (obj.keys[i] == name)
-            return obj.values.at(i);
+    size_t i;
+    if (obj.findKey(name, i))
+        return obj.values.at(i);
 
     return NullUniValue;
 }
@@ -0,0 +1,125 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Times building, writing, reading and looking up documents shaped like the
+// replies and requests of the busiest RPCs. Not run by make check.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <sstream>
+#include <string>
+#include <univalue.h>
+
+static UniValue MakeTransaction(int n)
+{
+    UniValue tx(UniValue::VOBJ);
+    tx.reserve(12);
+    tx.pushKV("txid", std::string(64, 'a' + n % 6));
+    tx.pushKV("version", 4);
+    tx.pushKV("locktime", 0);
+    tx.pushKV("hex", std::string(2000, '0' + n % 10));
+    UniValue vin(UniValue::VARR);
+    vin.reserve(4);
+    for (int i = 0; i < 4; i++) {
+        UniValue in(UniValue::VOBJ);
+        in.pushKV("txid", std::string(64, 'f'));
+        in.pushKV("vout", i);
+        UniValue sig(UniValue::VOBJ);
+        sig.pushKV("asm", std::string(140, 'c') + " [ALL]");
+        sig.pushKV("hex", std::string(140, 'd'));
+        in.pushKV("scriptSig", std::move(sig));
+        in.pushKV("sequence", (int64_t)4294967295LL);
+        vin.push_back(std::move(in));
+    }
+    tx.pushKV("vin", std::move(vin));
+    UniValue vout(UniValue::VARR);
+    for (int i = 0; i < 2; i++) {
+        UniValue out(UniValue::VOBJ);
+        out.pushKV("value", 1.2345678);
+        out.pushKV("valueSat", (int64_t)123456780 + i);
+        out.pushKV("n", i);
+        UniValue script(UniValue::VOBJ);
+        script.pushKV("asm", "OP_DUP OP_HASH160 " + std::string(40, 'e') + " OP_EQUALVERIFY OP_CHECKSIG");
+        script.pushKV("type", "pubkeyhash");
+        out.pushKV("scriptPubKey", std::move(script));
+        vout.push_back(std::move(out));
+    }
+    tx.pushKV("vout", std::move(vout));
+    return tx;
+}
+
+template <typename F>
+static void Bench(const char *name, int nIterations, F f)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int i = 0; i < nIterations; i++)
+        f();
+    double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    printf("%-32s %10.2f us/op\n", name, us / nIterations);
+}
+
+int main(int argc, char *argv[])
+{
+    int nScale = argc > 1 ? atoi(argv[1]) : 1;
+    if (nScale < 1)
+        nScale = 1;
+
+    // A verbose block of 500 transactions
+    UniValue block(UniValue::VOBJ);
+    Bench("build verbose block", 10 * nScale, [&]() {
+        block.setObject();
+        UniValue txs(UniValue::VARR);
+        txs.reserve(500);
+        for (int i = 0; i < 500; i++)
+            txs.push_back(MakeTransaction(i));
+        block.pushKV("tx", std::move(txs));
+    });
+    std::string strBlock;
+    Bench("write verbose block", 10 * nScale, [&]() { strBlock = block.write(); });
+    Bench("write verbose block pretty", 10 * nScale, [&]() { strBlock = block.write(4); });
+    strBlock = block.write();
+    UniValue parsed;
+    Bench("read verbose block", 10 * nScale, [&]() {
+        if (!parsed.read(strBlock))
+            abort();
+    });
+
+    // z_sendmany style recipients
+    UniValue recipients(UniValue::VARR);
+    for (int i = 0; i < 1000; i++) {
+        UniValue r(UniValue::VOBJ);
+        r.pushKV("address", "zs1" + std::string(75, 'q'));
+        r.pushKV("amount", 0.0001);
+        r.pushKV("memo", std::string(1024, 'f'));
+        recipients.push_back(std::move(r));
+    }
+    std::string strRecipients = recipients.write();
+    Bench("read 1000 recipients", 20 * nScale, [&]() {
+        if (!parsed.read(strRecipients))
+            abort();
+    });
+
+    // Lookups in an object of many keys, as in notes or balances by address
+    UniValue wide(UniValue::VOBJ);
+    for (int i = 0; i < 5000; i++) {
+        std::ostringstream key;
+        key << "address" << i;
+        wide.pushKV(key.str(), (int64_t)i);
+    }
+    int64_t nSum = 0;
+    Bench("find_value in 5000 keys", 20000 * nScale, [&]() {
+        nSum += find_value(wide, "address4999").get_int64();
+    });
+    Bench("pushKV into 5000 keys", 100 * nScale, [&]() {
+        UniValue copy(UniValue::VOBJ);
+        copy.reserve(wide.size());
+        const std::vector<std::string>& keys = wide.getKeys();
+        for (size_t i = 0; i < keys.size(); i++)
+            copy.pushKV(keys[i], wide[i]);
+    });
+
+    return nSum == 0;
+}
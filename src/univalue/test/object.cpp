@@ -8,6 +8,8 @@
 #include <string>
 #include <map>
 #include <cassert>
+#include <limits>
+#include <sstream>
 #include <stdexcept>
 #include <univalue.h>
 
@@ -393,6 +395,77 @@ BOOST_AUTO_TEST_CASE(univalue_readwrite)
     BOOST_CHECK(!v.read("{} 42"));
 }
 
+BOOST_AUTO_TEST_CASE(univalue_move)
+{
+    UniValue arr(UniValue::VARR);
+    UniValue inner(UniValue::VOBJ);
+    inner.pushKV("key", std::string(100, 'x'));
+    BOOST_CHECK(arr.push_back(std::move(inner)));
+    BOOST_CHECK_EQUAL(arr.size(), 1);
+    BOOST_CHECK_EQUAL(arr[0]["key"].getValStr(), std::string(100, 'x'));
+
+    UniValue obj(UniValue::VOBJ);
+    BOOST_CHECK(obj.pushKV("arr", std::move(arr)));
+    BOOST_CHECK_EQUAL(obj["arr"].size(), 1);
+
+    std::vector<UniValue> vec(3, UniValue(5));
+    UniValue arr2(UniValue::VARR);
+    arr2.reserve(6);
+    BOOST_CHECK(arr2.push_backV(std::move(vec)));
+    BOOST_CHECK(arr2.push_backV(std::vector<UniValue>(2, UniValue("a"))));
+    BOOST_CHECK_EQUAL(arr2.size(), 5);
+    BOOST_CHECK_EQUAL(arr2[4].getValStr(), "a");
+
+    // Lowest and highest integers are formatted without a stream
+    BOOST_CHECK_EQUAL(UniValue(std::numeric_limits<int64_t>::min()).getValStr(), "-9223372036854775808");
+    BOOST_CHECK_EQUAL(UniValue(std::numeric_limits<uint64_t>::max()).getValStr(), "18446744073709551615");
+    BOOST_CHECK_EQUAL(UniValue((int64_t)0).getValStr(), "0");
+}
+
+BOOST_AUTO_TEST_CASE(univalue_key_index)
+{
+    UniValue obj(UniValue::VOBJ);
+    for (size_t i = 0; i < 2 * UNIVALUE_KEY_INDEX_MIN; i++) {
+        std::ostringstream key;
+        key << "key" << i;
+        obj.pushKV(key.str(), (int64_t)i);
+    }
+    BOOST_CHECK_EQUAL(obj.size(), 2 * UNIVALUE_KEY_INDEX_MIN);
+    BOOST_CHECK_EQUAL(find_value(obj, "key0").get_int(), 0);
+    BOOST_CHECK_EQUAL(find_value(obj, "key40").get_int(), 40);
+    BOOST_CHECK(find_value(obj, "key1000").isNull());
+
+    // Replacing a value keeps its position, a duplicate key finds the first value
+    obj.pushKV("key40", "forty");
+    BOOST_CHECK_EQUAL(obj.size(), 2 * UNIVALUE_KEY_INDEX_MIN);
+    BOOST_CHECK_EQUAL(obj["key40"].get_str(), "forty");
+    obj.__pushKV("key3", "three");
+    BOOST_CHECK_EQUAL(obj["key3"].get_int(), 3);
+
+    // Copies and parsed objects are indexed too
+    UniValue copy = obj;
+    obj.clear();
+    BOOST_CHECK(!obj.exists("key3"));
+    BOOST_CHECK_EQUAL(copy["key63"].get_int(), 63);
+    UniValue parsed;
+    BOOST_CHECK(parsed.read(copy.write()));
+    BOOST_CHECK_EQUAL(parsed["key40"].get_str(), "forty");
+    BOOST_CHECK_EQUAL(parsed["key3"].get_int(), 3);
+    BOOST_CHECK(!parsed.exists("three"));
+}
+
+BOOST_AUTO_TEST_CASE(univalue_escape)
+{
+    UniValue v(UniValue::VOBJ);
+    v.pushKV("a\"b", std::string("tab\there\x01 caf\xc3\xa9 \\ end"));
+    BOOST_CHECK_EQUAL(v.write(), "{\"a\\\"b\":\"tab\\there\\u0001 caf\xc3\xa9 \\\\ end\"}");
+    UniValue parsed;
+    BOOST_CHECK(parsed.read(v.write()));
+    BOOST_CHECK_EQUAL(parsed["a\"b"].get_str(), v["a\"b"].get_str());
+    BOOST_CHECK(parsed.read("[\"\\u00e9abc\\uD834\\uDD1Exyz\"]"));
+    BOOST_CHECK_EQUAL(parsed[0].get_str(), "\xc3\xa9" "abc\xf0\x9d\x84\x9exyz");
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
 int main (int argc, char *argv[])
@@ -403,6 +476,9 @@ int main (int argc, char *argv[])
     univalue_array();
     univalue_object();
     univalue_readwrite();
+    univalue_move();
+    univalue_key_index();
+    univalue_escape();
     return 0;
 }
 
@@ -0,0 +1,192 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_UTIL_PARALLEL_H
+#define BITCOIN_UTIL_PARALLEL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//! Most threads the pool behind ParallelFor starts
+static const size_t MAX_PARALLEL_POOL_THREADS = 64;
+
+namespace parallel {
+
+/**
+ * One ParallelFor call. Its caller works on it until no item is left and
+ * pool threads join in when they are free, so a call never waits for a pool
+ * thread to become free, which also makes nested calls safe.
+ */
+class Job
+{
+private:
+    const std::function<void(size_t)>& f;
+    const size_t nItems;
+    std::atomic<size_t> nNext;
+
+    std::mutex cs;
+    std::condition_variable condDone;
+    //! Pool threads working on the job
+    int nJoined = 0;
+    //! Set once the caller is out of items, pool threads then no longer join
+    bool fClosed = false;
+    std::exception_ptr error;
+
+public:
+    Job(const std::function<void(size_t)>& fIn, size_t nItemsIn) : f(fIn), nItems(nItemsIn), nNext(0) {}
+
+    //! Runs items until none is left, the first exception skips those not started yet
+    void Work() {
+        try {
+            for (size_t i = nNext++; i < nItems; i = nNext++) {
+                f(i);
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(cs);
+            if (!error)
+                error = std::current_exception();
+            nNext = nItems;
+        }
+    }
+
+    //! Work() for a pool thread, unless the caller is already done
+    void Join() {
+        {
+            std::lock_guard<std::mutex> lock(cs);
+            if (fClosed)
+                return;
+            nJoined++;
+        }
+        Work();
+        std::lock_guard<std::mutex> lock(cs);
+        if (--nJoined == 0)
+            condDone.notify_one();
+    }
+
+    //! Called by the caller after its own Work(): waits for the pool threads and rethrows the first exception
+    void Finish() {
+        std::unique_lock<std::mutex> lock(cs);
+        fClosed = true;
+        condDone.wait(lock, [this] { return nJoined == 0; });
+        if (error)
+            std::rethrow_exception(error);
+    }
+};
+
+/** Threads started on first use and kept for the later calls, up to MAX_PARALLEL_POOL_THREADS */
+class Pool
+{
+private:
+    std::mutex cs;
+    std::condition_variable cond;
+    std::deque<std::shared_ptr<Job>> queue;
+    std::vector<std::thread> threads;
+    //! Threads not working on a job, including those just started
+    size_t nIdle = 0;
+    bool fStop = false;
+
+    void Thread() {
+        std::unique_lock<std::mutex> lock(cs);
+        while (true) {
+            cond.wait(lock, [this] { return fStop || !queue.empty(); });
+            if (fStop)
+                return;
+            std::shared_ptr<Job> job = queue.front();
+            queue.pop_front();
+            nIdle--;
+            lock.unlock();
+            job->Join();
+            job.reset();
+            lock.lock();
+            nIdle++;
+        }
+    }
+
+public:
+    ~Pool() {
+        {
+            std::lock_guard<std::mutex> lock(cs);
+            fStop = true;
+        }
+        cond.notify_all();
+        for (std::thread& t : threads) {
+            t.join();
+        }
+    }
+
+    //! Asks for n pool threads to join the job
+    void Post(const std::shared_ptr<Job>& job, size_t n) {
+        {
+            std::lock_guard<std::mutex> lock(cs);
+            queue.insert(queue.end(), n, job);
+            // Enough idle threads for everything queued, other jobs included
+            while (nIdle < queue.size() && threads.size() < MAX_PARALLEL_POOL_THREADS) {
+                threads.emplace_back(&Pool::Thread, this);
+                nIdle++;
+            }
+        }
+        cond.notify_all();
+    }
+};
+
+inline Pool& GetPool()
+{
+    static Pool pool;
+    return pool;
+}
+
+} // namespace parallel
+
+/**
+ * Runs f(0) ... f(nItems - 1) on up to nThreads threads, the calling thread
+ * included, and returns once all are done. Items are handed out one at a
+ * time, so uneven costs even out. The other threads come from a shared pool
+ * and are not started anew on every call. If f throws, the items not started
+ * yet are skipped and the first exception is rethrown to the caller.
+ */
+inline void ParallelFor(size_t nItems, int nThreads, const std::function<void(size_t)>& f)
+{
+    size_t nWorkers = std::min((size_t)std::max(nThreads, 1), nItems);
+    if (nWorkers <= 1) {
+        for (size_t i = 0; i < nItems; i++) {
+            f(i);
+        }
+        return;
+    }
+
+    std::shared_ptr<parallel::Job> job = std::make_shared<parallel::Job>(f, nItems);
+    parallel::GetPool().Post(job, nWorkers - 1);
+    job->Work();
+    job->Finish();
+}
+
+/**
+ * Runs f(nBegin, nEnd) for up to nThreads consecutive ranges that split
+ * [0, nItems), as ParallelFor does, for work too fine grained to hand out
+ * an item at a time.
+ */
+inline void ParallelForRanges(size_t nItems, int nThreads, const std::function<void(size_t, size_t)>& f)
+{
+    size_t nRanges = std::min((size_t)std::max(nThreads, 1), nItems);
+    if (nRanges <= 1) {
+        f(0, nItems);
+        return;
+    }
+
+    size_t nChunk = (nItems + nRanges - 1) / nRanges;
+    nRanges = (nItems + nChunk - 1) / nChunk;
+    ParallelFor(nRanges, nRanges, [&](size_t n) {
+        f(n * nChunk, std::min(nItems, (n + 1) * nChunk));
+    });
+}
+
+#endif // BITCOIN_UTIL_PARALLEL_H
@@ -0,0 +1,53 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_UTIL_TRACE_H
+#define BITCOIN_UTIL_TRACE_H
+
+#if defined(HAVE_CONFIG_H)
+#include "config/bitcoin-config.h"
+#endif
+
+/**
+ * Static tracepoints (USDT), built in with --enable-usdt. A tracepoint is a
+ * nop in the code and a note in the ELF that bpftrace, bcc or SystemTap use
+ * to attach to it on a running node. Its arguments are still computed when
+ * nothing is attached, so pass values that are at hand anyway rather than
+ * ones that cost something. Without --enable-usdt they compile to nothing.
+ *
+ * The context is the provider (validation, mempool, net, wallet, komodo,
+ * miner) and the event the probe name, see contrib/tracing for the
+ * arguments of each one.
+ */
+#ifdef ENABLE_TRACING
+
+#include <sys/sdt.h>
+
+#define TRACE(context, event) DTRACE_PROBE(context, event)
+#define TRACE1(context, event, a) DTRACE_PROBE1(context, event, a)
+#define TRACE2(context, event, a, b) DTRACE_PROBE2(context, event, a, b)
+#define TRACE3(context, event, a, b, c) DTRACE_PROBE3(context, event, a, b, c)
+#define TRACE4(context, event, a, b, c, d) DTRACE_PROBE4(context, event, a, b, c, d)
+#define TRACE5(context, event, a, b, c, d, e) DTRACE_PROBE5(context, event, a, b, c, d, e)
+#define TRACE6(context, event, a, b, c, d, e, f) DTRACE_PROBE6(context, event, a, b, c, d, e, f)
+
+#else
+
+// The arguments are referenced but never evaluated, so locals kept only for a
+// tracepoint don't warn as unused
+template <typename... Args>
+inline void TraceUnused(const Args&...) {}
+#define TRACE_UNUSED(...) do { if (false) TraceUnused(__VA_ARGS__); } while (0)
+
+#define TRACE(context, event) do { } while (0)
+#define TRACE1(context, event, a) TRACE_UNUSED(a)
+#define TRACE2(context, event, a, b) TRACE_UNUSED(a, b)
+#define TRACE3(context, event, a, b, c) TRACE_UNUSED(a, b, c)
+#define TRACE4(context, event, a, b, c, d) TRACE_UNUSED(a, b, c, d)
+#define TRACE5(context, event, a, b, c, d, e) TRACE_UNUSED(a, b, c, d, e)
+#define TRACE6(context, event, a, b, c, d, e, f) TRACE_UNUSED(a, b, c, d, e, f)
+
+#endif
+
+#endif // BITCOIN_UTIL_TRACE_H
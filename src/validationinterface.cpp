@@ -5,56 +5,322 @@
 
 #include "validationinterface.h"
 
+#include "chain.h"
+#include "consensus/validation.h"
+#include "main.h"
+#include "primitives/block.h"
+#include "primitives/transaction.h"
+#include "util.h"
+
+#include <deque>
+#include <functional>
+#include <memory>
+
+#include <boost/thread.hpp>
+
 static CMainSignals g_signals;
+//! Signals of the listeners that run on the validation queue thread
+static CMainSignals g_asyncSignals;
 
 CMainSignals& GetMainSignals()
 {
     return g_signals;
 }
 
+namespace {
+
+/** Runs the callbacks of the asynchronous listeners on one thread, in the order they were queued */
+class CValidationQueue
+{
+private:
+    boost::mutex cs;
+    //! Signalled when a callback is queued and when one has run
+    boost::condition_variable cond;
+    std::deque<std::function<void()> > queue;
+    bool fRunning;
+    bool fStop;
+    bool fBusy;
+    boost::thread thread;
+
+    void Thread()
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        while (true) {
+            while (queue.empty() && !fStop)
+                cond.wait(lock);
+            // Stopping only once what was queued has run
+            if (queue.empty())
+                return;
+            std::function<void()> func = std::move(queue.front());
+            queue.pop_front();
+            fBusy = true;
+            lock.unlock();
+            try {
+                func();
+            } catch (const std::exception& e) {
+                PrintExceptionContinue(&e, "validation");
+            }
+            lock.lock();
+            fBusy = false;
+            cond.notify_all();
+        }
+    }
+
+public:
+    CValidationQueue() : fRunning(false), fStop(false), fBusy(false) {}
+
+    void Push(std::function<void()> func)
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            if (fRunning) {
+                queue.push_back(std::move(func));
+                cond.notify_all();
+                return;
+            }
+        }
+        func();
+    }
+
+    void Start()
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (fRunning)
+            return;
+        fRunning = true;
+        fStop = false;
+        thread = boost::thread(boost::bind(&TraceThread<boost::function<void()> >, "validation",
+                                           boost::function<void()>(boost::bind(&CValidationQueue::Thread, this))));
+    }
+
+    void Stop()
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            if (!fRunning)
+                return;
+            fStop = true;
+            cond.notify_all();
+        }
+        thread.join();
+        boost::unique_lock<boost::mutex> lock(cs);
+        fRunning = false;
+        cond.notify_all();
+    }
+
+    size_t Pending()
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        return queue.size() + (fBusy ? 1 : 0);
+    }
+
+    void Sync(size_t nMaxPending)
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        while (fRunning && queue.size() + (fBusy ? 1 : 0) > nMaxPending)
+            cond.wait(lock);
+    }
+};
+
+CValidationQueue validationQueue;
+
+boost::mutex cs_asyncInterfaces;
+int nAsyncInterfaces = 0;
+//! Connections of g_signals that queue the signals for g_asyncSignals
+std::vector<boost::signals2::connection> vForwarders;
+
+/**
+ * Copy of the block of a signal, shared by the callbacks queued for it. The
+ * transactions of a block are signalled one at a time, so the last copy is
+ * reused while they are.
+ */
+std::shared_ptr<const CBlock> SharedBlock(const CBlock* pblock)
+{
+    static boost::mutex cs_lastBlock;
+    static std::shared_ptr<const CBlock> lastBlock;
+    static uint256 lastHash;
+    if (pblock == NULL)
+        return std::shared_ptr<const CBlock>();
+    uint256 hash = pblock->GetHash();
+    boost::unique_lock<boost::mutex> lock(cs_lastBlock);
+    if (!lastBlock || hash != lastHash || lastBlock->vtx.size() != pblock->vtx.size()) {
+        lastBlock = std::make_shared<const CBlock>(*pblock);
+        lastHash = hash;
+    }
+    return lastBlock;
+}
+
+/**
+ * The transaction of a signal, shared with the copy of its block or its
+ * mempool entry when it has one, and only copied otherwise.
+ */
+CTransactionRef SharedTransaction(const CTransaction& tx, const std::shared_ptr<const CBlock>& block, const CBlock* pblock)
+{
+    if (block && !pblock->vtx.empty() && &tx >= &pblock->vtx.front() && &tx <= &pblock->vtx.back())
+        return CTransactionRef(block, &block->vtx[&tx - &pblock->vtx.front()]);
+    CTransactionRef pooled = mempool.get(tx.GetHash());
+    if (pooled)
+        return pooled;
+    return MakeTransactionRef(tx);
+}
+
+void ConnectForwarders()
+{
+    vForwarders.push_back(g_signals.UpdatedBlockTip.connect([](const CBlockIndex* pindex) {
+        validationQueue.Push([pindex] { g_asyncSignals.UpdatedBlockTip(pindex); });
+    }));
+    vForwarders.push_back(g_signals.SyncTransaction.connect([](const CTransaction& tx, const CBlock* pblock) {
+        std::shared_ptr<const CBlock> block = SharedBlock(pblock);
+        CTransactionRef shared = SharedTransaction(tx, block, pblock);
+        validationQueue.Push([shared, block] { g_asyncSignals.SyncTransaction(*shared, block.get()); });
+    }));
+    vForwarders.push_back(g_signals.SyncTransactions.connect([](const std::vector<CTransaction>& vtx, const CBlock* pblock) {
+        std::shared_ptr<const CBlock> block = SharedBlock(pblock);
+        std::shared_ptr<const std::vector<CTransaction> > txs = std::make_shared<const std::vector<CTransaction> >(vtx);
+        validationQueue.Push([txs, block] { g_asyncSignals.SyncTransactions(*txs, block.get()); });
+    }));
+    vForwarders.push_back(g_signals.EraseTransaction.connect([](const uint256& hash) {
+        validationQueue.Push([hash] { g_asyncSignals.EraseTransaction(hash); });
+    }));
+    vForwarders.push_back(g_signals.RescanWallet.connect([] {
+        validationQueue.Push([] { g_asyncSignals.RescanWallet(); });
+    }));
+    vForwarders.push_back(g_signals.UpdatedTransaction.connect([](const uint256& hash) {
+        validationQueue.Push([hash] { g_asyncSignals.UpdatedTransaction(hash); });
+    }));
+    vForwarders.push_back(g_signals.ChainTip.connect([](const CBlockIndex* pindex, const CBlock* pblock, const SproutMerkleTree& sproutTree, const SaplingMerkleTree& saplingTree, bool added) {
+        std::shared_ptr<const CBlock> block = SharedBlock(pblock);
+        std::shared_ptr<const SproutMerkleTree> sprout = std::make_shared<const SproutMerkleTree>(sproutTree);
+        std::shared_ptr<const SaplingMerkleTree> sapling = std::make_shared<const SaplingMerkleTree>(saplingTree);
+        validationQueue.Push([pindex, block, sprout, sapling, added] { g_asyncSignals.ChainTip(pindex, block.get(), *sprout, *sapling, added); });
+    }));
+    vForwarders.push_back(g_signals.SetBestChain.connect([](const CBlockLocator& locator) {
+        validationQueue.Push([locator] { g_asyncSignals.SetBestChain(locator); });
+    }));
+    vForwarders.push_back(g_signals.Inventory.connect([](const uint256& hash) {
+        validationQueue.Push([hash] { g_asyncSignals.Inventory(hash); });
+    }));
+    vForwarders.push_back(g_signals.Broadcast.connect([](int64_t nBestBlockTime) {
+        validationQueue.Push([nBestBlockTime] { g_asyncSignals.Broadcast(nBestBlockTime); });
+    }));
+    vForwarders.push_back(g_signals.BlockChecked.connect([](const CBlock& block, const CValidationState& state) {
+        std::shared_ptr<const CBlock> shared = SharedBlock(&block);
+        validationQueue.Push([shared, state] { g_asyncSignals.BlockChecked(*shared, state); });
+    }));
+}
+
+void DisconnectForwarders()
+{
+    for (boost::signals2::connection& forwarder : vForwarders)
+        forwarder.disconnect();
+    vForwarders.clear();
+}
+
+} // anon namespace
+
+void ConnectValidationInterface(CMainSignals& signals, CValidationInterface* pIn) {
+    signals.UpdatedBlockTip.connect(boost::bind(&CValidationInterface::UpdatedBlockTip, pIn, _1));
+    signals.SyncTransaction.connect(boost::bind(&CValidationInterface::SyncTransaction, pIn, _1, _2));
+    signals.SyncTransactions.connect(boost::bind(&CValidationInterface::SyncTransactions, pIn, _1, _2));
+    signals.EraseTransaction.connect(boost::bind(&CValidationInterface::EraseFromWallet, pIn, _1));
+    signals.UpdatedTransaction.connect(boost::bind(&CValidationInterface::UpdatedTransaction, pIn, _1));
+    signals.RescanWallet.connect(boost::bind(&CValidationInterface::RescanWallet, pIn));
+    signals.ChainTip.connect(boost::bind(&CValidationInterface::ChainTip, pIn, _1, _2, _3, _4, _5));
+    signals.SetBestChain.connect(boost::bind(&CValidationInterface::SetBestChain, pIn, _1));
+    signals.Inventory.connect(boost::bind(&CValidationInterface::Inventory, pIn, _1));
+    signals.Broadcast.connect(boost::bind(&CValidationInterface::ResendWalletTransactions, pIn, _1));
+    signals.BlockChecked.connect(boost::bind(&CValidationInterface::BlockChecked, pIn, _1, _2));
+}
+
+void DisconnectValidationInterface(CMainSignals& signals, CValidationInterface* pIn) {
+    signals.BlockChecked.disconnect(boost::bind(&CValidationInterface::BlockChecked, pIn, _1, _2));
+    signals.Broadcast.disconnect(boost::bind(&CValidationInterface::ResendWalletTransactions, pIn, _1));
+    signals.Inventory.disconnect(boost::bind(&CValidationInterface::Inventory, pIn, _1));
+    signals.ChainTip.disconnect(boost::bind(&CValidationInterface::ChainTip, pIn, _1, _2, _3, _4, _5));
+    signals.SetBestChain.disconnect(boost::bind(&CValidationInterface::SetBestChain, pIn, _1));
+    signals.UpdatedTransaction.disconnect(boost::bind(&CValidationInterface::UpdatedTransaction, pIn, _1));
+    signals.EraseTransaction.disconnect(boost::bind(&CValidationInterface::EraseFromWallet, pIn, _1));
+    signals.SyncTransactions.disconnect(boost::bind(&CValidationInterface::SyncTransactions, pIn, _1, _2));
+    signals.SyncTransaction.disconnect(boost::bind(&CValidationInterface::SyncTransaction, pIn, _1, _2));
+    signals.RescanWallet.disconnect(boost::bind(&CValidationInterface::RescanWallet, pIn));
+    signals.UpdatedBlockTip.disconnect(boost::bind(&CValidationInterface::UpdatedBlockTip, pIn, _1));
+}
+
+static void DisconnectAllSlots(CMainSignals& signals) {
+    signals.BlockChecked.disconnect_all_slots();
+    signals.Broadcast.disconnect_all_slots();
+    signals.Inventory.disconnect_all_slots();
+    signals.ChainTip.disconnect_all_slots();
+    signals.SetBestChain.disconnect_all_slots();
+    signals.UpdatedTransaction.disconnect_all_slots();
+    signals.EraseTransaction.disconnect_all_slots();
+    signals.SyncTransactions.disconnect_all_slots();
+    signals.SyncTransaction.disconnect_all_slots();
+    signals.RescanWallet.disconnect_all_slots();
+    signals.UpdatedBlockTip.disconnect_all_slots();
+}
+
 void RegisterValidationInterface(CValidationInterface* pwalletIn) {
-    g_signals.UpdatedBlockTip.connect(boost::bind(&CValidationInterface::UpdatedBlockTip, pwalletIn, _1));
-    g_signals.SyncTransaction.connect(boost::bind(&CValidationInterface::SyncTransaction, pwalletIn, _1, _2));
-    g_signals.EraseTransaction.connect(boost::bind(&CValidationInterface::EraseFromWallet, pwalletIn, _1));
-    g_signals.UpdatedTransaction.connect(boost::bind(&CValidationInterface::UpdatedTransaction, pwalletIn, _1));
-    g_signals.RescanWallet.connect(boost::bind(&CValidationInterface::RescanWallet, pwalletIn));
-    g_signals.ChainTip.connect(boost::bind(&CValidationInterface::ChainTip, pwalletIn, _1, _2, _3, _4, _5));
-    g_signals.SetBestChain.connect(boost::bind(&CValidationInterface::SetBestChain, pwalletIn, _1));
-    g_signals.Inventory.connect(boost::bind(&CValidationInterface::Inventory, pwalletIn, _1));
-    g_signals.Broadcast.connect(boost::bind(&CValidationInterface::ResendWalletTransactions, pwalletIn, _1));
-    g_signals.BlockChecked.connect(boost::bind(&CValidationInterface::BlockChecked, pwalletIn, _1, _2));
+    ConnectValidationInterface(g_signals, pwalletIn);
 }
 
 void UnregisterValidationInterface(CValidationInterface* pwalletIn) {
-    g_signals.BlockChecked.disconnect(boost::bind(&CValidationInterface::BlockChecked, pwalletIn, _1, _2));
-    g_signals.Broadcast.disconnect(boost::bind(&CValidationInterface::ResendWalletTransactions, pwalletIn, _1));
-    g_signals.Inventory.disconnect(boost::bind(&CValidationInterface::Inventory, pwalletIn, _1));
-    g_signals.ChainTip.disconnect(boost::bind(&CValidationInterface::ChainTip, pwalletIn, _1, _2, _3, _4, _5));
-    g_signals.SetBestChain.disconnect(boost::bind(&CValidationInterface::SetBestChain, pwalletIn, _1));
-    g_signals.UpdatedTransaction.disconnect(boost::bind(&CValidationInterface::UpdatedTransaction, pwalletIn, _1));
-    g_signals.EraseTransaction.disconnect(boost::bind(&CValidationInterface::EraseFromWallet, pwalletIn, _1));
-    g_signals.SyncTransaction.disconnect(boost::bind(&CValidationInterface::SyncTransaction, pwalletIn, _1, _2));
-    g_signals.RescanWallet.disconnect(boost::bind(&CValidationInterface::RescanWallet, pwalletIn));
-    g_signals.UpdatedBlockTip.disconnect(boost::bind(&CValidationInterface::UpdatedBlockTip, pwalletIn, _1));
+    DisconnectValidationInterface(g_signals, pwalletIn);
 }
 
 void UnregisterAllValidationInterfaces() {
-    g_signals.BlockChecked.disconnect_all_slots();
-    g_signals.Broadcast.disconnect_all_slots();
-    g_signals.Inventory.disconnect_all_slots();
-    g_signals.ChainTip.disconnect_all_slots();
-    g_signals.SetBestChain.disconnect_all_slots();
-    g_signals.UpdatedTransaction.disconnect_all_slots();
-    g_signals.EraseTransaction.disconnect_all_slots();
-    g_signals.SyncTransaction.disconnect_all_slots();
-    g_signals.RescanWallet.disconnect_all_slots();
-    g_signals.UpdatedBlockTip.disconnect_all_slots();
+    boost::unique_lock<boost::mutex> lock(cs_asyncInterfaces);
+    DisconnectAllSlots(g_signals);
+    DisconnectAllSlots(g_asyncSignals);
+    vForwarders.clear();
+    nAsyncInterfaces = 0;
+}
+
+void RegisterAsyncValidationInterface(CValidationInterface* pIn) {
+    boost::unique_lock<boost::mutex> lock(cs_asyncInterfaces);
+    ConnectValidationInterface(g_asyncSignals, pIn);
+    // The signals are only queued while someone listens to them
+    if (nAsyncInterfaces++ == 0)
+        ConnectForwarders();
+}
+
+void UnregisterAsyncValidationInterface(CValidationInterface* pIn) {
+    boost::unique_lock<boost::mutex> lock(cs_asyncInterfaces);
+    DisconnectValidationInterface(g_asyncSignals, pIn);
+    if (nAsyncInterfaces > 0 && --nAsyncInterfaces == 0)
+        DisconnectForwarders();
+}
+
+void StartValidationInterfaceQueue() {
+    validationQueue.Start();
+}
+
+void StopValidationInterfaceQueue() {
+    validationQueue.Stop();
+}
+
+size_t ValidationInterfaceQueuePending() {
+    return validationQueue.Pending();
+}
+
+void SyncWithValidationInterfaceQueue(size_t nMaxPending) {
+    validationQueue.Sync(nMaxPending);
 }
 
 void SyncWithWallets(const CTransaction &tx, const CBlock *pblock) {
     g_signals.SyncTransaction(tx, pblock);
 }
 
+void SyncWithWallets(const std::vector<CTransaction> &vtx, const CBlock *pblock) {
+    g_signals.SyncTransactions(vtx, pblock);
+}
+
+void CValidationInterface::SyncTransactions(const std::vector<CTransaction> &vtx, const CBlock *pblock) {
+    for (const CTransaction &tx : vtx) {
+        SyncTransaction(tx, pblock);
+    }
+}
+
 void EraseFromWallets(const uint256 &hash) {
     g_signals.EraseTransaction(hash);
 }
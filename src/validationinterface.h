@@ -8,16 +8,23 @@
 
 #include <boost/signals2/signal.hpp>
 
+#include <stddef.h>
+#include <vector>
+
 #include "zcash/IncrementalMerkleTree.hpp"
 
 class CBlock;
 class CBlockIndex;
 struct CBlockLocator;
+struct CMainSignals;
 class CTransaction;
 class CValidationInterface;
 class CValidationState;
 class uint256;
 
+//! Callbacks queued for the asynchronous listeners before blocks from peers wait for them
+static const size_t MAX_VALIDATION_QUEUE_PENDING = 1000;
+
 // These functions dispatch to one or all registered wallets
 
 /** Register a wallet to receive updates from core */
@@ -26,28 +33,54 @@ void RegisterValidationInterface(CValidationInterface* pwalletIn);
 void UnregisterValidationInterface(CValidationInterface* pwalletIn);
 /** Unregister all wallets from core */
 void UnregisterAllValidationInterfaces();
+/**
+ * Register a listener that doesn't need cs_main. It is called from the
+ * validation queue thread, in the order of the signals, with copies of their
+ * arguments that live until it returns; the commitment trees of a ChainTip
+ * and the block of a signal are copied once for all such listeners.
+ */
+void RegisterAsyncValidationInterface(CValidationInterface* pIn);
+void UnregisterAsyncValidationInterface(CValidationInterface* pIn);
+/** Start the thread of the asynchronous listeners. Until it runs they are called in place. */
+void StartValidationInterfaceQueue();
+/** Run the callbacks still queued, then stop the thread */
+void StopValidationInterfaceQueue();
+/** Callbacks queued or running for the asynchronous listeners */
+size_t ValidationInterfaceQueuePending();
+/**
+ * Wait until at most nMaxPending callbacks are queued or running. Must be
+ * called without cs_main, which the listeners may take.
+ */
+void SyncWithValidationInterfaceQueue(size_t nMaxPending = 0);
 /** Push an updated transaction to all registered wallets */
 void SyncWithWallets(const CTransaction& tx, const CBlock* pblock = NULL);
+/** Push a batch of updated transactions to all registered wallets */
+void SyncWithWallets(const std::vector<CTransaction>& vtx, const CBlock* pblock = NULL);
 /** Erase a transaction from all registered wallets */
 void EraseFromWallets(const uint256 &hash);
 /** Rescan all registered wallets */
 void RescanWallets();
 
+/** Connect the callbacks of pIn to signals, or disconnect them */
+void ConnectValidationInterface(CMainSignals& signals, CValidationInterface* pIn);
+void DisconnectValidationInterface(CMainSignals& signals, CValidationInterface* pIn);
+
 class CValidationInterface {
 protected:
     virtual void UpdatedBlockTip(const CBlockIndex *pindex) {}
     virtual void SyncTransaction(const CTransaction &tx, const CBlock *pblock) {}
+    //! By default the transactions are passed to SyncTransaction one at a time
+    virtual void SyncTransactions(const std::vector<CTransaction> &vtx, const CBlock *pblock);
     virtual void EraseFromWallet(const uint256 &hash) {}
     virtual void RescanWallet() {}
-    virtual void ChainTip(const CBlockIndex *pindex, const CBlock *pblock, SproutMerkleTree sproutTree, SaplingMerkleTree saplingTree, bool added) {}
+    virtual void ChainTip(const CBlockIndex *pindex, const CBlock *pblock, const SproutMerkleTree& sproutTree, const SaplingMerkleTree& saplingTree, bool added) {}
     virtual void SetBestChain(const CBlockLocator &locator) {}
     virtual void UpdatedTransaction(const uint256 &hash) {}
     virtual void Inventory(const uint256 &hash) {}
     virtual void ResendWalletTransactions(int64_t nBestBlockTime) {}
     virtual void BlockChecked(const CBlock&, const CValidationState&) {}
-    friend void ::RegisterValidationInterface(CValidationInterface*);
-    friend void ::UnregisterValidationInterface(CValidationInterface*);
-    friend void ::UnregisterAllValidationInterfaces();
+    friend void ::ConnectValidationInterface(CMainSignals&, CValidationInterface*);
+    friend void ::DisconnectValidationInterface(CMainSignals&, CValidationInterface*);
 };
 
 struct CMainSignals {
@@ -55,6 +88,8 @@ struct CMainSignals {
     boost::signals2::signal<void (const CBlockIndex *)> UpdatedBlockTip;
     /** Notifies listeners of updated transaction data (transaction, and optionally the block it is found in. */
     boost::signals2::signal<void (const CTransaction &, const CBlock *)> SyncTransaction;
+    /** Notifies listeners of a batch of updated transactions, all from the same block if one is given. */
+    boost::signals2::signal<void (const std::vector<CTransaction> &, const CBlock *)> SyncTransactions;
     /** Notifies listeners of an erased transaction. */
     boost::signals2::signal<void (const uint256 &)> EraseTransaction;
     /** Notifies listeners of the need to rescan the wallet. */
@@ -62,7 +97,7 @@ struct CMainSignals {
     /** Notifies listeners of an updated transaction without new data (for now: a coinbase potentially becoming visible). */
     boost::signals2::signal<void (const uint256 &)> UpdatedTransaction;
     /** Notifies listeners of a change to the tip of the active block chain. */
-    boost::signals2::signal<void (const CBlockIndex *, const CBlock *, SproutMerkleTree, SaplingMerkleTree, bool)> ChainTip;
+    boost::signals2::signal<void (const CBlockIndex *, const CBlock *, const SproutMerkleTree &, const SaplingMerkleTree &, bool)> ChainTip;
     /** Notifies listeners of a new active block chain. */
     boost::signals2::signal<void (const CBlockLocator &)> SetBestChain;
     /** Notifies listeners about an inventory item being seen on the network. */
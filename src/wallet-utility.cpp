@@ -6,6 +6,7 @@
 #include "util.h"
 #include "base58.h"
 #include "wallet/crypter.h"
+#include <boost/filesystem.hpp>
 #include <boost/foreach.hpp>
 
 #include "komodo_defs.h"
@@ -44,6 +45,12 @@ void show_help()
         << " -dumppass (Optional)if you want to extract private keys associated with addresses"
         << std::endl
         << "    -pass=<walletpassphrase> if you have encrypted private keys stored in your wallet"
+        << std::endl
+        << " -rebuild=<name> (Optional) writes a fresh wallet <name> in the datadir with the keys, addresses and settings"
+        << std::endl
+        << "    of the wallet but none of its transactions, then run pirated -wallet=<name> -rebuildwallet on the"
+        << std::endl
+        << "    same datadir, with its chain synced, to rescan it on every core without connecting to the network"
         << std::endl;
 }
 
@@ -69,6 +76,8 @@ class WalletUtilityDB : public CDB
         std::string getCryptedKey(CDataStream ssKey, CDataStream ssValue, std::string masterPass);
         bool updateMasterKeys(CDataStream ssKey, CDataStream ssValue);
         bool parseKeys(bool dumppriv, std::string masterPass);
+        bool writeRecord(CDataStream& ssKey, CDataStream& ssValue);
+        bool copyKeys(WalletUtilityDB& dbOut);
 
         bool DecryptSecret(const std::vector<unsigned char>& vchCiphertext, const uint256& nIV, CKeyingMaterial& vchPlaintext);
         bool Unlock();
@@ -327,12 +336,113 @@ bool WalletUtilityDB::parseKeys(bool dumppriv, std::string masterPass)
 }
 
 
+/*
+ * Record types a rescan writes again, left out of a rebuilt wallet
+ */
+static bool IsRescannedRecord(const std::string& strType)
+{
+    return strType == "tx" || strType == "arctx" || strType == "arczcop" || strType == "arczsop" ||
+        strType == "bestblock" || strType == "witnesscachesize";
+}
+
+
+/*
+ * Write a record as it was read, keys included
+ */
+bool WalletUtilityDB::writeRecord(CDataStream& ssKey, CDataStream& ssValue)
+{
+    Dbt datKey(&ssKey[0], ssKey.size());
+    Dbt datValue(&ssValue[0], ssValue.size());
+    int ret = pdb->put(activeTxn, &datKey, &datValue, DB_NOOVERWRITE);
+
+    memset(datKey.get_data(), 0, datKey.get_size());
+    memset(datValue.get_data(), 0, datValue.get_size());
+    return ret == 0;
+}
+
+
+/*
+ * Copy every record but the transactions and the chain position to dbOut,
+ * which pirated then rescans from the genesis as it has no best block
+ */
+bool WalletUtilityDB::copyKeys(WalletUtilityDB& dbOut)
+{
+    bool fOk = true;
+    unsigned int nCopied = 0, nSkipped = 0;
+
+    try {
+        Dbc* pcursor = GetCursor();
+        if (!pcursor)
+        {
+            std::cout << "Error getting wallet database cursor" << std::endl;
+            return false;
+        }
+
+        if (!dbOut.TxnBegin())
+        {
+            pcursor->close();
+            std::cout << "Error starting a transaction on the new wallet" << std::endl;
+            return false;
+        }
+
+        while (true)
+        {
+            CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+            CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+            int ret = ReadAtCursor(pcursor, ssKey, ssValue);
+
+            if (ret == DB_NOTFOUND)
+                break;
+            else if (ret != 0)
+            {
+                std::cout << "Error reading next record from wallet database" << std::endl;
+                fOk = false;
+                break;
+            }
+
+            std::string strType;
+            CDataStream(ssKey) >> strType;
+            if (IsRescannedRecord(strType))
+            {
+                nSkipped++;
+                continue;
+            }
+
+            if (!dbOut.writeRecord(ssKey, ssValue))
+            {
+                std::cout << "Error writing a " << strType << " record to the new wallet" << std::endl;
+                fOk = false;
+                break;
+            }
+            nCopied++;
+        }
+        pcursor->close();
+
+        if (fOk)
+            fOk = dbOut.TxnCommit();
+        else
+            dbOut.TxnAbort();
+    } catch (DbException &e) {
+        std::cout << "DBException caught " << e.get_errno() << std::endl;
+        fOk = false;
+    } catch (std::exception &e) {
+        std::cout << "Exception caught " << e.what() << std::endl;
+        fOk = false;
+    }
+
+    if (fOk)
+        std::cout << "Copied " << nCopied << " records, left out " << nSkipped << " transaction and chain records" << std::endl;
+    return fOk;
+}
+
+
 int main(int argc, char* argv[])
 {
     ParseParameters(argc, argv);
     std::string walletFile = GetArg("-wallet", "wallet.dat");
     std::string masterPass = GetArg("-pass", "");
     bool fDumpPass = GetBoolArg("-dumppass", false);
+    std::string rebuildFile = GetArg("-rebuild", "");
     bool help = GetBoolArg("-h", false);
     bool result = false;
 
@@ -344,7 +454,18 @@ int main(int argc, char* argv[])
 
     try {
         SelectParamsFromCommandLine();
-        result = WalletUtilityDB(walletFile, "r").parseKeys(fDumpPass, masterPass);
+        if (rebuildFile != "")
+        {
+            if (rebuildFile == walletFile || boost::filesystem::exists(GetDataDir() / rebuildFile))
+            {
+                std::cout << "The wallet to rebuild into, " << rebuildFile << ", must not exist yet" << std::endl;
+                return -1;
+            }
+            WalletUtilityDB dbOut(rebuildFile, "cr+");
+            result = WalletUtilityDB(walletFile, "r").copyKeys(dbOut);
+        }
+        else
+            result = WalletUtilityDB(walletFile, "r").parseKeys(fDumpPass, masterPass);
     }
     catch (const std::exception& e) {
         std::cout << "Error opening wallet file " << walletFile << std::endl;
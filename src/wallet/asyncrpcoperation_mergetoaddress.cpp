@@ -39,6 +39,7 @@
 #include "wallet.h"
 #include "walletdb.h"
 #include "zcash/IncrementalMerkleTree.hpp"
+#include "asyncrpcoperation_saplingconsolidation.h"
 
 #include <chrono>
 #include <iostream>
@@ -80,7 +81,7 @@ AsyncRPCOperation_mergetoaddress::AsyncRPCOperation_mergetoaddress(
                                                                    CAmount fee,
                                                                    UniValue contextInfo) :
 tx_(contextualTx), utxoInputs_(utxoInputs), sproutNoteInputs_(sproutNoteInputs),
-saplingNoteInputs_(saplingNoteInputs), recipient_(recipient), fee_(fee), contextinfo_(contextInfo)
+saplingNoteInputs_(saplingNoteInputs), nTxsBuilt_(0), recipient_(recipient), fee_(fee), contextinfo_(contextInfo)
 {
     if (fee < 0 || fee > MAX_MONEY) {
         throw JSONRPCError(RPC_INVALID_PARAMETER, "Fee is out of range");
@@ -137,6 +138,31 @@ saplingNoteInputs_(saplingNoteInputs), recipient_(recipient), fee_(fee), context
     paymentDisclosureMode = fExperimentalMode && GetBoolArg("-paymentdisclosure", true);
 }
 
+template <typename T>
+static std::vector<T> FlattenInputs(const std::vector<MergeToAddressTxInputs>& txInputs, std::vector<T> MergeToAddressTxInputs::*member)
+{
+    std::vector<T> inputs;
+    for (const MergeToAddressTxInputs& tx : txInputs) {
+        inputs.insert(inputs.end(), (tx.*member).begin(), (tx.*member).end());
+    }
+    return inputs;
+}
+
+AsyncRPCOperation_mergetoaddress::AsyncRPCOperation_mergetoaddress(
+                                                                   TransactionBuilder builder,
+                                                                   std::vector<MergeToAddressTxInputs> txInputs,
+                                                                   MergeToAddressRecipient recipient,
+                                                                   CAmount fee,
+                                                                   UniValue contextInfo) :
+AsyncRPCOperation_mergetoaddress(builder, CMutableTransaction(),
+                                 FlattenInputs(txInputs, &MergeToAddressTxInputs::utxoInputs),
+                                 std::vector<MergeToAddressInputSproutNote>(),
+                                 FlattenInputs(txInputs, &MergeToAddressTxInputs::saplingNoteInputs),
+                                 recipient, fee, contextInfo)
+{
+    txInputs_ = txInputs;
+}
+
 AsyncRPCOperation_mergetoaddress::~AsyncRPCOperation_mergetoaddress()
 {
 }
@@ -212,18 +238,165 @@ void AsyncRPCOperation_mergetoaddress::main()
 
     // !!! Payment disclosure START
     if (success && paymentDisclosureMode && paymentDisclosureData_.size() > 0) {
-        uint256 txidhash = tx_.GetHash();
-        std::shared_ptr<PaymentDisclosureDB> db = PaymentDisclosureDB::sharedInstance();
-        for (PaymentDisclosureKeyInfo p : paymentDisclosureData_) {
-            p.first.hash = txidhash;
-            if (!db->Put(p.first, p.second)) {
-                LogPrint("paymentdisclosure", "%s: Payment Disclosure: Error writing entry to database for key %s\n", getId(), p.first.ToString());
-            } else {
-                LogPrint("paymentdisclosure", "%s: Payment Disclosure: Successfully added entry to database for key %s\n", getId(), p.first.ToString());
+        PaymentDisclosureDB::PutTransactionAsync(getId(), tx_.GetHash(), paymentDisclosureData_);
+    }
+    // !!! Payment disclosure END
+}
+
+void AsyncRPCOperation_mergetoaddress::add_builder_inputs_and_output(
+                                                                     TransactionBuilder& builder,
+                                                                     const std::vector<MergeToAddressInputUTXO>& utxoInputs,
+                                                                     const std::vector<MergeToAddressInputSaplingNote>& saplingNoteInputs,
+                                                                     CAmount sendAmount)
+{
+    for (const MergeToAddressInputUTXO& t : utxoInputs) {
+        COutPoint outPoint = std::get<0>(t);
+        CAmount amount = std::get<1>(t);
+        CScript scriptPubKey = std::get<2>(t);
+        builder.AddTransparentInput(outPoint, scriptPubKey, amount);
+    }
+
+    boost::optional<uint256> ovk;
+    // Select Sapling notes
+    std::vector<SaplingOutPoint> saplingOPs;
+    std::vector<SaplingNote> saplingNotes;
+    std::vector<SaplingExpandedSpendingKey> expsks;
+    for (const MergeToAddressInputSaplingNote& saplingNoteInput: saplingNoteInputs) {
+        saplingOPs.push_back(std::get<0>(saplingNoteInput));
+        saplingNotes.push_back(std::get<1>(saplingNoteInput));
+        auto expsk = std::get<3>(saplingNoteInput);
+        expsks.push_back(expsk);
+        if (!ovk) {
+            ovk = expsk.full_viewing_key().ovk;
+        }
+    }
+
+    // Fetch Sapling anchor and witnesses
+    uint256 anchor;
+    std::vector<boost::optional<SaplingWitness>> witnesses;
+    {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+        pwalletMain->GetSaplingNoteWitnesses(saplingOPs, witnesses, anchor);
+    }
+
+    // Add Sapling spends
+    for (size_t i = 0; i < saplingNotes.size(); i++) {
+        if (!witnesses[i]) {
+            throw JSONRPCError(RPC_WALLET_ERROR, "Missing witness for Sapling note");
+        }
+        assert(builder.AddSaplingSpend(expsks[i], saplingNotes[i], anchor, witnesses[i].get()));
+    }
+
+    if (isToTaddr_) {
+        if (!builder.AddTransparentOutput(toTaddr_, sendAmount)) {
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid output address, not a valid taddr.");
+        }
+    } else {
+        std::string zaddr = std::get<0>(recipient_);
+        std::string memo = std::get<1>(recipient_);
+        std::array<unsigned char, ZC_MEMO_SIZE> hexMemo = get_memo_from_hex_string(memo);
+        auto saplingPaymentAddress = boost::get<libzcash::SaplingPaymentAddress>(&toPaymentAddress_);
+        if (saplingPaymentAddress == nullptr) {
+            // This should never happen as we have already determined that the payment is to sapling
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Could not get Sapling payment address.");
+        }
+        if (saplingNoteInputs.size() == 0 && utxoInputs.size() > 0) {
+            // Sending from t-addresses, which we don't have ovks for. Instead,
+            // generate a common one from the HD seed. This ensures the data is
+            // recoverable, while keeping it logically separate from the ZIP 32
+            // Sapling key hierarchy, which the user might not be using.
+            HDSeed seed;
+            if (!pwalletMain->GetHDSeed(seed)) {
+                throw JSONRPCError(
+                                   RPC_WALLET_ERROR,
+                                   "AsyncRPCOperation_sendmany: HD seed not found");
             }
+            ovk = ovkForShieldingFromTaddr(seed);
+        }
+        if (!ovk) {
+            throw JSONRPCError(RPC_WALLET_ERROR, "Sending to a Sapling address requires an ovk.");
         }
+        builder.AddSaplingOutput(ovk.get(), *saplingPaymentAddress, sendAmount, hexMemo);
     }
-    // !!! Payment disclosure END
+}
+
+/**
+ * Builds a transaction for each set of inputs on the consolidation threads,
+ * then sends those which were built. The operation fails only if none was sent.
+ */
+bool AsyncRPCOperation_mergetoaddress::main_impl_multi()
+{
+    assert(isUsingBuilder_);
+
+    std::vector<TransactionBuilder> builders;
+    for (size_t i = 0; i < txInputs_.size(); i++) {
+        CAmount targetAmount = 0;
+        for (const MergeToAddressInputUTXO& t : txInputs_[i].utxoInputs) {
+            targetAmount += std::get<1>(t);
+        }
+        for (const MergeToAddressInputSaplingNote& t : txInputs_[i].saplingNoteInputs) {
+            targetAmount += std::get<2>(t);
+        }
+        if (targetAmount <= fee_) {
+            throw JSONRPCError(RPC_WALLET_INSUFFICIENT_FUNDS,
+                               strprintf("Insufficient funds in transaction %d, have %s and miners fee is %s",
+                                         i, FormatMoney(targetAmount), FormatMoney(fee_)));
+        }
+
+        TransactionBuilder builder = builder_;
+        builder.SetFee(fee_);
+        add_builder_inputs_and_output(builder, txInputs_[i].utxoInputs, txInputs_[i].saplingNoteInputs, targetAmount - fee_);
+        builders.push_back(builder);
+    }
+
+    int64_t nBuildStart = GetTimeMillis();
+    std::vector<boost::optional<CTransaction>> txs = BuildTransactions(builders, nConsolidationThreads, &nTxsBuilt_);
+    LogPrint("zrpc", "%s: built %d transactions in %.1fs\n", getId(), txs.size(), (GetTimeMillis() - nBuildStart) / 1000.0);
+
+    UniValue txids(UniValue::VARR);
+    UniValue errors(UniValue::VARR);
+    for (size_t i = 0; i < txs.size(); i++) {
+        if (!txs[i]) {
+            errors.push_back(strprintf("Failed to build transaction %d.", i));
+            continue;
+        }
+        if (!testmode) {
+            UniValue params = UniValue(UniValue::VARR);
+            params.push_back(EncodeHexTx(txs[i].get()));
+            try {
+                UniValue sendResultValue = sendrawtransaction(params, false, CPubKey());
+                if (sendResultValue.isNull()) {
+                    errors.push_back(strprintf("sendrawtransaction did not return an error or a txid for transaction %d.", i));
+                    continue;
+                }
+            } catch (const UniValue& objError) {
+                errors.push_back(strprintf("Transaction %d: %s", i, find_value(objError, "message").get_str()));
+                continue;
+            }
+        }
+        if (txids.empty()) {
+            tx_ = txs[i].get();
+        }
+        txids.push_back(txs[i]->GetHash().ToString());
+    }
+
+    if (txids.empty()) {
+        throw JSONRPCError(RPC_WALLET_ERROR, errors.empty() ? "No transaction was built." : errors[0].get_str());
+    }
+
+    UniValue o(UniValue::VOBJ);
+    if (testmode) {
+        // Test mode does not send the transactions to the network.
+        o.push_back(Pair("test", 1));
+    }
+    o.push_back(Pair("txid", tx_.GetHash().ToString()));
+    o.push_back(Pair("num_tx_created", (uint64_t)txids.size()));
+    o.push_back(Pair("txids", txids));
+    if (!errors.empty()) {
+        o.push_back(Pair("errors", errors));
+    }
+    set_result(o);
+    return true;
 }
 
 // Notes:
@@ -233,6 +406,10 @@ bool AsyncRPCOperation_mergetoaddress::main_impl()
 {
     assert(isToTaddr_ != isToZaddr_);
 
+    if (txInputs_.size() > 1) {
+        return main_impl_multi();
+    }
+
     bool isPureTaddrOnlyTx = (sproutNoteInputs_.empty() && saplingNoteInputs_.empty() && isToTaddr_);
     CAmount minersFee = fee_;
 
@@ -317,78 +494,7 @@ bool AsyncRPCOperation_mergetoaddress::main_impl()
      */
     if (isUsingBuilder_) {
         builder_.SetFee(minersFee);
-
-
-        for (const MergeToAddressInputUTXO& t : utxoInputs_) {
-            COutPoint outPoint = std::get<0>(t);
-            CAmount amount = std::get<1>(t);
-            CScript scriptPubKey = std::get<2>(t);
-            builder_.AddTransparentInput(outPoint, scriptPubKey, amount);
-        }
-
-        boost::optional<uint256> ovk;
-        // Select Sapling notes
-        std::vector<SaplingOutPoint> saplingOPs;
-        std::vector<SaplingNote> saplingNotes;
-        std::vector<SaplingExpandedSpendingKey> expsks;
-        for (const MergeToAddressInputSaplingNote& saplingNoteInput: saplingNoteInputs_) {
-            saplingOPs.push_back(std::get<0>(saplingNoteInput));
-            saplingNotes.push_back(std::get<1>(saplingNoteInput));
-            auto expsk = std::get<3>(saplingNoteInput);
-            expsks.push_back(expsk);
-            if (!ovk) {
-                ovk = expsk.full_viewing_key().ovk;
-            }
-        }
-
-        // Fetch Sapling anchor and witnesses
-        uint256 anchor;
-        std::vector<boost::optional<SaplingWitness>> witnesses;
-        {
-            LOCK2(cs_main, pwalletMain->cs_wallet);
-            pwalletMain->GetSaplingNoteWitnesses(saplingOPs, witnesses, anchor);
-        }
-
-        // Add Sapling spends
-        for (size_t i = 0; i < saplingNotes.size(); i++) {
-            if (!witnesses[i]) {
-                throw JSONRPCError(RPC_WALLET_ERROR, "Missing witness for Sapling note");
-            }
-            assert(builder_.AddSaplingSpend(expsks[i], saplingNotes[i], anchor, witnesses[i].get()));
-        }
-
-        if (isToTaddr_) {
-            if (!builder_.AddTransparentOutput(toTaddr_, sendAmount)) {
-                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid output address, not a valid taddr.");
-            }
-        } else {
-            std::string zaddr = std::get<0>(recipient_);
-            std::string memo = std::get<1>(recipient_);
-            std::array<unsigned char, ZC_MEMO_SIZE> hexMemo = get_memo_from_hex_string(memo);
-            auto saplingPaymentAddress = boost::get<libzcash::SaplingPaymentAddress>(&toPaymentAddress_);
-            if (saplingPaymentAddress == nullptr) {
-                // This should never happen as we have already determined that the payment is to sapling
-                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Could not get Sapling payment address.");
-            }
-            if (saplingNoteInputs_.size() == 0 && utxoInputs_.size() > 0) {
-                // Sending from t-addresses, which we don't have ovks for. Instead,
-                // generate a common one from the HD seed. This ensures the data is
-                // recoverable, while keeping it logically separate from the ZIP 32
-                // Sapling key hierarchy, which the user might not be using.
-                HDSeed seed;
-                if (!pwalletMain->GetHDSeed(seed)) {
-                    throw JSONRPCError(
-                                       RPC_WALLET_ERROR,
-                                       "AsyncRPCOperation_sendmany: HD seed not found");
-                }
-                ovk = ovkForShieldingFromTaddr(seed);
-            }
-            if (!ovk) {
-                throw JSONRPCError(RPC_WALLET_ERROR, "Sending to a Sapling address requires an ovk.");
-            }
-            builder_.AddSaplingOutput(ovk.get(), *saplingPaymentAddress, sendAmount, hexMemo);
-        }
-
+        add_builder_inputs_and_output(builder_, utxoInputs_, saplingNoteInputs_, sendAmount);
 
         // Build the transaction
         auto maybe_tx = builder_.Build();
@@ -1063,13 +1169,19 @@ std::array<unsigned char, ZC_MEMO_SIZE> AsyncRPCOperation_mergetoaddress::get_me
 UniValue AsyncRPCOperation_mergetoaddress::getStatus() const
 {
     UniValue v = AsyncRPCOperation::getStatus();
-    if (contextinfo_.isNull()) {
+    if (contextinfo_.isNull() && txInputs_.size() <= 1) {
         return v;
     }
 
     UniValue obj = v.get_obj();
-    obj.push_back(Pair("method", "z_mergetoaddress"));
-    obj.push_back(Pair("params", contextinfo_));
+    if (!contextinfo_.isNull()) {
+        obj.push_back(Pair("method", "z_mergetoaddress"));
+        obj.push_back(Pair("params", contextinfo_));
+    }
+    if (txInputs_.size() > 1) {
+        obj.push_back(Pair("txs_built", (uint64_t)nTxsBuilt_.load()));
+        obj.push_back(Pair("txs", (uint64_t)txInputs_.size()));
+    }
     return obj;
 }
 
@@ -30,6 +30,7 @@
 #include "zcash/JoinSplit.hpp"
 
 #include <array>
+#include <atomic>
 #include <tuple>
 #include <unordered_map>
 
@@ -51,6 +52,12 @@ typedef std::tuple<SaplingOutPoint, SaplingNote, CAmount, SaplingExpandedSpendin
 // A recipient is a tuple of address, memo (optional if zaddr)
 typedef std::tuple<std::string, std::string> MergeToAddressRecipient;
 
+// Inputs of one of the transactions of an operation merging in more than one
+struct MergeToAddressTxInputs {
+    std::vector<MergeToAddressInputUTXO> utxoInputs;
+    std::vector<MergeToAddressInputSaplingNote> saplingNoteInputs;
+};
+
 // Package of info which is passed to perform_joinsplit methods.
 struct MergeToAddressJSInfo {
     std::vector<JSInput> vjsin;
@@ -79,6 +86,13 @@ public:
                                      MergeToAddressRecipient recipient,
                                      CAmount fee = MERGE_TO_ADDRESS_OPERATION_DEFAULT_MINERS_FEE,
                                      UniValue contextInfo = NullUniValue);
+    // Merges without Sprout in a transaction for each set of inputs, all built in parallel
+    AsyncRPCOperation_mergetoaddress(
+                                     TransactionBuilder builder,
+                                     std::vector<MergeToAddressTxInputs> txInputs,
+                                     MergeToAddressRecipient recipient,
+                                     CAmount fee = MERGE_TO_ADDRESS_OPERATION_DEFAULT_MINERS_FEE,
+                                     UniValue contextInfo = NullUniValue);
     virtual ~AsyncRPCOperation_mergetoaddress();
     
     // We don't want to be copied or moved around
@@ -90,6 +104,10 @@ public:
     virtual void main();
     
     virtual UniValue getStatus() const;
+
+    virtual std::string getType() const { return "z_mergetoaddress"; }
+
+    virtual OperationPriority getPriority() const { return OperationPriority::BACKGROUND; }
     
     bool testmode = false; // Set to true to disable sending txs and generating proofs
     
@@ -119,6 +137,9 @@ private:
     std::vector<MergeToAddressInputUTXO> utxoInputs_;
     std::vector<MergeToAddressInputSproutNote> sproutNoteInputs_;
     std::vector<MergeToAddressInputSaplingNote> saplingNoteInputs_;
+    // Inputs of each transaction when there is more than one, the vectors above have them all
+    std::vector<MergeToAddressTxInputs> txInputs_;
+    std::atomic<size_t> nTxsBuilt_;
     
     TransactionBuilder builder_;
     CTransaction tx_;
@@ -126,6 +147,15 @@ private:
     std::array<unsigned char, ZC_MEMO_SIZE> get_memo_from_hex_string(std::string s);
     bool main_impl();
     
+    bool main_impl_multi();
+    
+    // Adds the inputs and the output of sendAmount to the recipient, throws if they can't be
+    void add_builder_inputs_and_output(
+                                       TransactionBuilder& builder,
+                                       const std::vector<MergeToAddressInputUTXO>& utxoInputs,
+                                       const std::vector<MergeToAddressInputSaplingNote>& saplingNoteInputs,
+                                       CAmount sendAmount);
+    
     // JoinSplit without any input notes to spend
     UniValue perform_joinsplit(MergeToAddressJSInfo&);
     
@@ -13,6 +13,7 @@
 #include "wallet.h"
 
 CAmount fConsolidationTxFee = DEFAULT_CONSOLIDATION_FEE;
+int nConsolidationThreads = 1;
 bool fConsolidationMapUsed = false;
 const int CONSOLIDATION_EXPIRY_DELTA = 40;
 
@@ -75,7 +76,7 @@ bool AsyncRPCOperation_saplingconsolidation::main_impl() {
     auto nextActivationHeight = NextActivationHeight(targetHeight_, consensusParams);
     if (nextActivationHeight && targetHeight_ + CONSOLIDATION_EXPIRY_DELTA >= nextActivationHeight.get()) {
         LogPrint("zrpcunsafe", "%s: Consolidation txs would be created before a NU activation but may expire after. Skipping this round.\n", getId());
-        setConsolidationResult(0, 0, std::vector<std::string>());
+        setConsolidationResult(0, 0, std::vector<std::string>(), 0, 0);
         return true;
     }
 
@@ -117,11 +118,18 @@ bool AsyncRPCOperation_saplingconsolidation::main_impl() {
     }
 
     int numTxCreated = 0;
+    int numNotesSpent = 0;
     std::vector<std::string> consolidationTxIds;
     CAmount amountConsolidated = 0;
-    CCoinsViewCache coinsView(pcoinsTip);
     bool consolidationComplete = true;
 
+    // The note sets of the transactions are disjoint, so they are all
+    // prepared first, built in parallel and committed together
+    size_t nMaxTxs = nConsolidationThreads * CONSOLIDATION_TXS_PER_THREAD;
+    std::vector<TransactionBuilder> builders;
+    std::vector<CAmount> vAmounts;
+    std::vector<int> vNotes;
+
     for (std::map<libzcash::SaplingPaymentAddress, std::vector<SaplingNoteEntry>>::iterator it = mapAddresses.begin(); it != mapAddresses.end(); it++) {
         auto addr = (*it).first;
         auto saplingEntries = (*it).second;
@@ -129,24 +137,21 @@ bool AsyncRPCOperation_saplingconsolidation::main_impl() {
         libzcash::SaplingExtendedSpendingKey extsk;
         if (pwalletMain->GetSaplingExtendedSpendingKey(addr, extsk)) {
 
-            std::vector<SaplingNoteEntry> fromNotes;
-            CAmount amountToSend = 0;
-            int maxQuantity = rand() % 35 + 10;
-
-            //Count Notes availiable for this address
-            int targetCount = pwalletMain->targetConsolidationQty;
-            int noteCount = 0;
+            //Notes availiable for this address
+            std::vector<SaplingNoteEntry> candidateNotes;
             for (const SaplingNoteEntry& saplingEntry : saplingEntries) {
 
               libzcash::SaplingIncomingViewingKey ivk;
               pwalletMain->GetSaplingIncomingViewingKey(boost::get<libzcash::SaplingPaymentAddress>(saplingEntry.address), ivk);
 
               if (ivk == extsk.expsk.full_viewing_key().in_viewing_key() && saplingEntry.address == addr) {
-                noteCount ++;
+                candidateNotes.push_back(saplingEntry);
               }
             }
 
             //Don't consolidate if under the threshold
+            int targetCount = pwalletMain->targetConsolidationQty;
+            int noteCount = candidateNotes.size();
             if (noteCount < targetCount){
                 continue;
             }
@@ -154,105 +159,124 @@ bool AsyncRPCOperation_saplingconsolidation::main_impl() {
             //if we make it here then we need to consolidate and the routine is considered incomplete
             consolidationComplete = false;
 
-            for (const SaplingNoteEntry& saplingEntry : saplingEntries) {
+            //Split the notes into transactions until the address is under the threshold
+            size_t nextNote = 0;
+            while (noteCount >= targetCount && builders.size() < nMaxTxs) {
 
-                libzcash::SaplingIncomingViewingKey ivk;
-                pwalletMain->GetSaplingIncomingViewingKey(boost::get<libzcash::SaplingPaymentAddress>(saplingEntry.address), ivk);
-
-                //Select Notes from that same address we will be sending to.
-                if (ivk == extsk.expsk.full_viewing_key().in_viewing_key() && saplingEntry.address == addr) {
-                  amountToSend += CAmount(saplingEntry.note.value());
-                  fromNotes.push_back(saplingEntry);
-                }
-
-                //Only use a randomly determined number of notes between 10 and 45
-                if (fromNotes.size() >= maxQuantity)
+                //Only use a randomly determined number of notes between 10 and 45, minimum 2 - 12 required
+                int maxQuantity = rand() % 35 + 10;
+                int minQuantity = rand() % 10 + 2;
+                if (candidateNotes.size() - nextNote < minQuantity)
                   break;
 
-            }
-
-            //random minimum 2 - 12 required
-            int minQuantity = rand() % 10 + 2;
-            if (fromNotes.size() < minQuantity)
-              continue;
+                std::vector<SaplingNoteEntry> fromNotes;
+                CAmount amountToSend = 0;
+                while (nextNote < candidateNotes.size() && fromNotes.size() < maxQuantity) {
+                  amountToSend += CAmount(candidateNotes[nextNote].note.value());
+                  fromNotes.push_back(candidateNotes[nextNote]);
+                  nextNote++;
+                }
+                noteCount -= fromNotes.size() - 1;
 
-            CAmount fee = fConsolidationTxFee;
-            if (amountToSend <= fConsolidationTxFee) {
-              fee = 0;
-            }
-            amountConsolidated += amountToSend;
-            auto builder = TransactionBuilder(consensusParams, targetHeight_, pwalletMain);
-            {
-                LOCK2(cs_main, pwalletMain->cs_wallet);
-                builder.SetExpiryHeight(chainActive.Tip()->GetHeight()+ CONSOLIDATION_EXPIRY_DELTA);
-            }
-            LogPrint("zrpcunsafe", "%s: Beginning creating transaction with Sapling output amount=%s\n", getId(), FormatMoney(amountToSend - fee));
-
-            // Select Sapling notes
-            std::vector<SaplingOutPoint> ops;
-            std::vector<libzcash::SaplingNote> notes;
-            for (auto fromNote : fromNotes) {
-                ops.push_back(fromNote.op);
-                notes.push_back(fromNote.note);
-            }
+                CAmount fee = fConsolidationTxFee;
+                if (amountToSend <= fConsolidationTxFee) {
+                  fee = 0;
+                }
+                auto builder = TransactionBuilder(consensusParams, targetHeight_, pwalletMain);
+                {
+                    LOCK2(cs_main, pwalletMain->cs_wallet);
+                    builder.SetExpiryHeight(chainActive.Tip()->GetHeight()+ CONSOLIDATION_EXPIRY_DELTA);
+                }
+                LogPrint("zrpcunsafe", "%s: Beginning creating transaction with Sapling output amount=%s\n", getId(), FormatMoney(amountToSend - fee));
+
+                // Select Sapling notes
+                std::vector<SaplingOutPoint> ops;
+                std::vector<libzcash::SaplingNote> notes;
+                for (auto fromNote : fromNotes) {
+                    ops.push_back(fromNote.op);
+                    notes.push_back(fromNote.note);
+                }
 
-            // Fetch Sapling anchor and witnesses
-            uint256 anchor;
-            std::vector<boost::optional<SaplingWitness>> witnesses;
-            {
-                LOCK2(cs_main, pwalletMain->cs_wallet);
-                pwalletMain->GetSaplingNoteWitnesses(ops, witnesses, anchor);
-            }
+                // Fetch Sapling anchor and witnesses
+                uint256 anchor;
+                std::vector<boost::optional<SaplingWitness>> witnesses;
+                {
+                    LOCK2(cs_main, pwalletMain->cs_wallet);
+                    pwalletMain->GetSaplingNoteWitnesses(ops, witnesses, anchor);
+                }
 
-            // Add Sapling spends
-            for (size_t i = 0; i < notes.size(); i++) {
-                if (!witnesses[i]) {
-                    LogPrint("zrpcunsafe", "%s: Missing Witnesses. Stopping.\n", getId());
-                    break;
+                // Add Sapling spends
+                bool fMissingWitness = false;
+                for (size_t i = 0; i < notes.size(); i++) {
+                    if (!witnesses[i]) {
+                        fMissingWitness = true;
+                        break;
+                    }
+                    builder.AddSaplingSpend(extsk.expsk, notes[i], anchor, witnesses[i].get());
+                }
+                if (fMissingWitness) {
+                    LogPrint("zrpcunsafe", "%s: Missing Witnesses. Skipping transaction.\n", getId());
+                    continue;
                 }
-                builder.AddSaplingSpend(extsk.expsk, notes[i], anchor, witnesses[i].get());
-            }
 
+                builder.SetFee(fee);
+                builder.AddSaplingOutput(extsk.expsk.ovk, addr, amountToSend - fee);
+                builders.push_back(builder);
+                vAmounts.push_back(amountToSend - fee);
+                vNotes.push_back(notes.size());
+            }
+        }
+    }
 
-            builder.SetFee(fee);
-            builder.AddSaplingOutput(extsk.expsk.ovk, addr, amountToSend - fee);
-            //CTransaction tx = builder.Build();
+    int64_t nBuildStart = GetTimeMillis();
+    std::vector<boost::optional<CTransaction>> txs = BuildTransactions(builders, nConsolidationThreads);
+    double buildSeconds = (GetTimeMillis() - nBuildStart) / 1000.0;
 
-            auto maybe_tx = builder.Build();
-            if (!maybe_tx) {
-                LogPrint("zrpcunsafe", "%s: Failed to build transaction.", getId());
-                break;
-            }
-            CTransaction tx = maybe_tx.get();
+    if (isCancelled()) {
+        LogPrint("zrpcunsafe", "%s: Canceled. Stopping.\n", getId());
+        txs.clear();
+    }
 
-            if (isCancelled()) {
-                LogPrint("zrpcunsafe", "%s: Canceled. Stopping.\n", getId());
-                break;
+    {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+        for (size_t i = 0; i < txs.size(); i++) {
+            if (!txs[i]) {
+                LogPrint("zrpcunsafe", "%s: Failed to build transaction.\n", getId());
+                continue;
             }
-
+            CTransaction tx = txs[i].get();
             pwalletMain->CommitAutomatedTx(tx);
             LogPrint("zrpcunsafe", "%s: Committed consolidation transaction with txid=%s\n", getId(), tx.GetHash().ToString());
-            amountConsolidated += amountToSend - fee;
+            numTxCreated++;
+            numNotesSpent += vNotes[i];
+            amountConsolidated += vAmounts[i];
             consolidationTxIds.push_back(tx.GetHash().ToString());
-
         }
     }
 
+    if (!builders.empty()) {
+        LogPrintf("%s: Built %d of %d consolidation transactions spending %d notes in %.1fs on %d threads (%.1f notes/s)\n",
+            getId(), numTxCreated, builders.size(), numNotesSpent, buildSeconds, std::min<int>(nConsolidationThreads, builders.size()),
+            buildSeconds > 0 ? numNotesSpent / buildSeconds : 0.0);
+    }
+
     if (consolidationComplete) {
         pwalletMain->nextConsolidation = pwalletMain->initializeConsolidationInterval + chainActive.Tip()->GetHeight();
         pwalletMain->fConsolidationRunning = false;
     }
 
     LogPrint("zrpcunsafe", "%s: Created %d transactions with total Sapling output amount=%s\n", getId(), numTxCreated, FormatMoney(amountConsolidated));
-    setConsolidationResult(numTxCreated, amountConsolidated, consolidationTxIds);
+    setConsolidationResult(numTxCreated, amountConsolidated, consolidationTxIds, numNotesSpent, buildSeconds);
     return true;
 
 }
 
-void AsyncRPCOperation_saplingconsolidation::setConsolidationResult(int numTxCreated, const CAmount& amountConsolidated, const std::vector<std::string>& consolidationTxIds) {
+void AsyncRPCOperation_saplingconsolidation::setConsolidationResult(int numTxCreated, const CAmount& amountConsolidated, const std::vector<std::string>& consolidationTxIds, int numNotesSpent, double buildSeconds) {
     UniValue res(UniValue::VOBJ);
     res.push_back(Pair("num_tx_created", numTxCreated));
     res.push_back(Pair("amount_consolidated", FormatMoney(amountConsolidated)));
+    res.push_back(Pair("num_notes_spent", numNotesSpent));
+    res.push_back(Pair("build_seconds", buildSeconds));
     UniValue txIds(UniValue::VARR);
     for (const std::string& txId : consolidationTxIds) {
         txIds.push_back(txId);
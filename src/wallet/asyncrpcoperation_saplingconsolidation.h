@@ -9,6 +9,14 @@ static const CAmount DEFAULT_CONSOLIDATION_FEE = 10000;
 extern CAmount fConsolidationTxFee;
 extern bool fConsolidationMapUsed;
 
+//! -consolidationthreads default (0 = auto)
+static const int DEFAULT_CONSOLIDATION_THREADS = 0;
+//! Maximum number of threads building consolidation and sweep transactions
+static const int MAX_CONSOLIDATION_THREADS = 16;
+//! Consolidation or sweep transactions prepared per build thread in each round
+static const int CONSOLIDATION_TXS_PER_THREAD = 4;
+extern int nConsolidationThreads;
+
 class AsyncRPCOperation_saplingconsolidation : public AsyncRPCOperation
 {
 public:
@@ -27,11 +35,15 @@ public:
 
     virtual UniValue getStatus() const;
 
+    virtual std::string getType() const { return "saplingconsolidation"; }
+
+    virtual OperationPriority getPriority() const { return OperationPriority::BACKGROUND; }
+
 private:
     int targetHeight_;
 
     bool main_impl();
 
-    void setConsolidationResult(int numTxCreated, const CAmount& amountConsolidated, const std::vector<std::string>& consolidationTxIds);
+    void setConsolidationResult(int numTxCreated, const CAmount& amountConsolidated, const std::vector<std::string>& consolidationTxIds, int numNotesSpent, double buildSeconds);
 
 };
@@ -56,7 +56,8 @@ extern char ASSETCHAINS_SYMBOL[65];
 
 int32_t komodo_dpowconfs(int32_t height,int32_t numconfs);
 int32_t komodo_blockheight(uint256 hash);
-int tx_height( const uint256 &hash );
+int32_t komodo_dpownotarizedheight();
+int32_t komodo_dpowconfs_notarized(int32_t notarizedheight,int32_t txheight,int32_t numconfs);
 bool komodo_hardfork_active(uint32_t time);
 extern UniValue signrawtransaction(const UniValue& params, bool fHelp, const CPubKey& mypk);
 extern UniValue sendrawtransaction(const UniValue& params, bool fHelp, const CPubKey& mypk);
@@ -212,16 +213,7 @@ void AsyncRPCOperation_sendmany::main() {
 
     // !!! Payment disclosure START
     if (success && paymentDisclosureMode && paymentDisclosureData_.size()>0) {
-        uint256 txidhash = tx_.GetHash();
-        std::shared_ptr<PaymentDisclosureDB> db = PaymentDisclosureDB::sharedInstance();
-        for (PaymentDisclosureKeyInfo p : paymentDisclosureData_) {
-            p.first.hash = txidhash;
-            if (!db->Put(p.first, p.second)) {
-                LogPrint("paymentdisclosure", "%s: Payment Disclosure: Error writing entry to database for key %s\n", getId(), p.first.ToString());
-            } else {
-                LogPrint("paymentdisclosure", "%s: Payment Disclosure: Successfully added entry to database for key %s\n", getId(), p.first.ToString());
-            }
-        }
+        PaymentDisclosureDB::PutTransactionAsync(getId(), tx_.GetHash(), paymentDisclosureData_);
     }
     // !!! Payment disclosure END
 }
@@ -462,33 +454,15 @@ bool AsyncRPCOperation_sendmany::main_impl() {
             assert(builder_.SendChangeTo(changeAddr));
         }
 
-        // Select Sapling notes
-        std::vector<SaplingOutPoint> ops;
-        std::vector<SaplingNote> notes;
+        // Select Sapling notes, their witnesses were selected with them
         CAmount sum = 0;
-        for (auto t : z_sapling_inputs_) {
-            ops.push_back(t.op);
-            notes.push_back(t.note);
-            sum += t.note.value();
-            if (sum >= targetAmount) {
-                break;
-            }
-        }
-
-        // Fetch Sapling anchor and witnesses
-        uint256 anchor;
-        std::vector<boost::optional<SaplingWitness>> witnesses;
-        {
-            LOCK2(cs_main, pwalletMain->cs_wallet);
-            pwalletMain->GetSaplingNoteWitnesses(ops, witnesses, anchor);
-        }
-
-        // Add Sapling spends
-        for (size_t i = 0; i < notes.size(); i++) {
-            if (!witnesses[i]) {
+        for (size_t i = 0; i < z_sapling_inputs_.size() && sum < targetAmount; i++) {
+            if (i >= z_sapling_witnesses_.size()) {
                 throw JSONRPCError(RPC_WALLET_ERROR, "Missing witness for Sapling note");
             }
-            assert(builder_.AddSaplingSpend(expsk, notes[i], anchor, witnesses[i].get()));
+            const SaplingNote& note = z_sapling_inputs_[i].note;
+            assert(builder_.AddSaplingSpend(expsk, note, z_sapling_anchor_, z_sapling_witnesses_[i]));
+            sum += note.value();
         }
 
         // Add Sapling outputs
@@ -1059,6 +1033,7 @@ bool AsyncRPCOperation_sendmany::find_utxos(bool fAcceptCoinbase=false) {
     LOCK2(cs_main, pwalletMain->cs_wallet);
     pwalletMain->AvailableCoins(vecOutputs, false, NULL, true, fAcceptCoinbase);
 
+    int32_t notarizedHeight = komodo_dpownotarizedheight();
     BOOST_FOREACH(const COutput& out, vecOutputs) {
         CTxDestination dest;
 
@@ -1067,8 +1042,7 @@ bool AsyncRPCOperation_sendmany::find_utxos(bool fAcceptCoinbase=false) {
         }
 
         if( mindepth_ > 1 ) {
-            int nHeight    = tx_height(out.tx->GetHash());
-            int dpowconfs  = komodo_dpowconfs(nHeight, out.nDepth);
+            int dpowconfs  = komodo_dpowconfs_notarized(notarizedHeight, out.tx->GetHeightInMainChain(), out.nDepth);
             if (dpowconfs < mindepth_) {
                 continue;
             }
@@ -1118,17 +1092,26 @@ bool AsyncRPCOperation_sendmany::find_utxos(bool fAcceptCoinbase=false) {
 bool AsyncRPCOperation_sendmany::find_unspent_notes() {
     std::vector<CSproutNotePlaintextEntry> sproutEntries;
     std::vector<SaplingNoteEntry> saplingEntries;
-    {
-        LOCK2(cs_main, pwalletMain->cs_wallet);
-        pwalletMain->GetFilteredNotes(sproutEntries, saplingEntries, fromaddress_, mindepth_);
-    }
 
-    // If using the TransactionBuilder, we only want Sapling notes.
+    // If using the TransactionBuilder, we only want Sapling notes, selected
+    // largest first from the address's notes until they cover the payment.
     // If not using it, we only want Sprout notes.
-    // TODO: Refactor `GetFilteredNotes()` so we only fetch what we need.
     if (isUsingBuilder_) {
-        sproutEntries.clear();
+        CAmount targetAmount = fee_;
+        for (SendManyRecipient & t : t_outputs_) {
+            targetAmount += std::get<1>(t);
+        }
+        for (SendManyRecipient & t : z_outputs_) {
+            targetAmount += std::get<1>(t);
+        }
+        auto saplingAddress = boost::get<libzcash::SaplingPaymentAddress>(&frompaymentaddress_);
+        if (saplingAddress != nullptr) {
+            pwalletMain->SelectSaplingNotes(*saplingAddress, targetAmount, mindepth_,
+                saplingEntries, z_sapling_witnesses_, z_sapling_anchor_);
+        }
     } else {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+        pwalletMain->GetFilteredNotes(sproutEntries, saplingEntries, fromaddress_, mindepth_);
         saplingEntries.clear();
     }
 
@@ -1165,10 +1148,7 @@ bool AsyncRPCOperation_sendmany::find_unspent_notes() {
         [](SendManyInputJSOP i, SendManyInputJSOP j) -> bool {
             return std::get<2>(i) > std::get<2>(j);
         });
-    std::sort(z_sapling_inputs_.begin(), z_sapling_inputs_.end(),
-        [](SaplingNoteEntry i, SaplingNoteEntry j) -> bool {
-            return i.note.value() > j.note.value();
-        });
+    // z_sapling_inputs_ are already in descending order
 
     return true;
 }
@@ -88,6 +88,10 @@ public:
 
     virtual UniValue getStatus() const;
 
+    virtual std::string getType() const { return "z_sendmany"; }
+
+    virtual OperationPriority getPriority() const { return OperationPriority::HIGH; }
+
     bool testmode = false;  // Set to true to disable sending txs and generating proofs
 
     bool paymentDisclosureMode = true; // Set to true to save esk for encrypted notes in payment disclosure database.
@@ -119,6 +123,9 @@ private:
     std::vector<SendManyInputUTXO> t_inputs_;
     std::vector<SendManyInputJSOP> z_sprout_inputs_;
     std::vector<SaplingNoteEntry> z_sapling_inputs_;
+    // Witnesses of z_sapling_inputs_ at z_sapling_anchor_, when selected by CWallet::SelectSaplingNotes
+    std::vector<SaplingWitness> z_sapling_witnesses_;
+    uint256 z_sapling_anchor_;
 
     TransactionBuilder builder_;
     CTransaction tx_;
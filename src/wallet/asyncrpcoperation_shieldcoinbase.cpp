@@ -46,6 +46,7 @@
 #include <string>
 
 #include "asyncrpcoperation_shieldcoinbase.h"
+#include "asyncrpcoperation_saplingconsolidation.h"
 
 #include "paymentdisclosure.h"
 #include "paymentdisclosuredb.h"
@@ -77,7 +78,7 @@ AsyncRPCOperation_shieldcoinbase::AsyncRPCOperation_shieldcoinbase(
         std::string toAddress,
         CAmount fee,
         UniValue contextInfo) :
-        builder_(builder), tx_(contextualTx), inputs_(inputs), fee_(fee), contextinfo_(contextInfo)
+        builder_(builder), tx_(contextualTx), inputs_(inputs), nTxsBuilt_(0), fee_(fee), contextinfo_(contextInfo)
 {
     assert(contextualTx.nVersion >= 2);  // transaction format version must support vjoinsplit
 
@@ -111,6 +112,27 @@ AsyncRPCOperation_shieldcoinbase::AsyncRPCOperation_shieldcoinbase(
     paymentDisclosureMode = fExperimentalMode && GetBoolArg("-paymentdisclosure", true);
 }
 
+static std::vector<ShieldCoinbaseUTXO> FlattenInputs(const std::vector<std::vector<ShieldCoinbaseUTXO>>& txInputs)
+{
+    std::vector<ShieldCoinbaseUTXO> inputs;
+    for (const std::vector<ShieldCoinbaseUTXO>& v : txInputs) {
+        inputs.insert(inputs.end(), v.begin(), v.end());
+    }
+    return inputs;
+}
+
+AsyncRPCOperation_shieldcoinbase::AsyncRPCOperation_shieldcoinbase(
+        TransactionBuilder builder,
+        CMutableTransaction contextualTx,
+        std::vector<std::vector<ShieldCoinbaseUTXO>> txInputs,
+        std::string toAddress,
+        CAmount fee,
+        UniValue contextInfo) :
+        AsyncRPCOperation_shieldcoinbase(builder, contextualTx, FlattenInputs(txInputs), toAddress, fee, contextInfo)
+{
+    txInputs_ = txInputs;
+}
+
 AsyncRPCOperation_shieldcoinbase::~AsyncRPCOperation_shieldcoinbase() {
 }
 
@@ -182,21 +204,15 @@ void AsyncRPCOperation_shieldcoinbase::main() {
 
     // !!! Payment disclosure START
     if (success && paymentDisclosureMode && paymentDisclosureData_.size()>0) {
-        uint256 txidhash = tx_.GetHash();
-        std::shared_ptr<PaymentDisclosureDB> db = PaymentDisclosureDB::sharedInstance();
-        for (PaymentDisclosureKeyInfo p : paymentDisclosureData_) {
-            p.first.hash = txidhash;
-            if (!db->Put(p.first, p.second)) {
-                LogPrint("paymentdisclosure", "%s: Payment Disclosure: Error writing entry to database for key %s\n", getId(), p.first.ToString());
-            } else {
-                LogPrint("paymentdisclosure", "%s: Payment Disclosure: Successfully added entry to database for key %s\n", getId(), p.first.ToString());
-            }
-        }
+        PaymentDisclosureDB::PutTransactionAsync(getId(), tx_.GetHash(), paymentDisclosureData_);
     }
     // !!! Payment disclosure END
 }
 
 bool AsyncRPCOperation_shieldcoinbase::main_impl() {
+    if (txInputs_.size() > 1) {
+        return main_impl_multi();
+    }
 
     CAmount minersFee = fee_;
 
@@ -268,6 +284,108 @@ bool ShieldToAddress::operator()(const libzcash::SproutPaymentAddress &zaddr) co
 extern UniValue signrawtransaction(const UniValue& params, bool fHelp, const CPubKey& mypk);
 extern UniValue sendrawtransaction(const UniValue& params, bool fHelp, const CPubKey& mypk);
 
+void AsyncRPCOperation_shieldcoinbase::add_transparent_inputs(TransactionBuilder& builder, const std::vector<ShieldCoinbaseUTXO>& inputs) {
+    for (const ShieldCoinbaseUTXO& t : inputs) {
+        if (t.amount >= ASSETCHAINS_TIMELOCKGTE)
+        {
+            builder.SetLockTime((uint32_t)(chainActive.Height()));
+            builder.AddTransparentInput(COutPoint(t.txid, t.vout), t.scriptPubKey, t.amount, 0xfffffffe);
+        }
+        else
+        {
+            builder.AddTransparentInput(COutPoint(t.txid, t.vout), t.scriptPubKey, t.amount);
+        }
+    }
+}
+
+/**
+ * Builds a transaction for each set of inputs on the consolidation threads,
+ * then sends those which were built. The operation fails only if none was sent.
+ */
+bool AsyncRPCOperation_shieldcoinbase::main_impl_multi() {
+    const libzcash::SaplingPaymentAddress* zaddr = boost::get<libzcash::SaplingPaymentAddress>(&tozaddr_);
+    if (zaddr == nullptr) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Shielding in more than one transaction requires a Sapling address");
+    }
+
+    // See ShieldToAddress for the ovk
+    HDSeed seed;
+    if (!pwalletMain->GetHDSeed(seed)) {
+        throw JSONRPCError(
+            RPC_WALLET_ERROR,
+            "CWallet::GenerateNewSaplingZKey(): HD seed not found");
+    }
+    uint256 ovk = ovkForShieldingFromTaddr(seed);
+
+    std::vector<TransactionBuilder> builders;
+    for (size_t i = 0; i < txInputs_.size(); i++) {
+        CAmount targetAmount = 0;
+        for (const ShieldCoinbaseUTXO& utxo : txInputs_[i]) {
+            targetAmount += utxo.amount;
+        }
+        if (targetAmount <= fee_) {
+            throw JSONRPCError(RPC_WALLET_INSUFFICIENT_FUNDS,
+                strprintf("Insufficient coinbase funds in transaction %d, have %s and miners fee is %s",
+                i, FormatMoney(targetAmount), FormatMoney(fee_)));
+        }
+
+        TransactionBuilder builder = builder_;
+        builder.SetFee(fee_);
+        add_transparent_inputs(builder, txInputs_[i]);
+        builder.SendChangeTo(*zaddr, ovk);
+        builders.push_back(builder);
+    }
+
+    int64_t nBuildStart = GetTimeMillis();
+    std::vector<boost::optional<CTransaction>> txs = BuildTransactions(builders, nConsolidationThreads, &nTxsBuilt_);
+    LogPrint("zrpc", "%s: built %d transactions in %.1fs\n", getId(), txs.size(), (GetTimeMillis() - nBuildStart) / 1000.0);
+
+    UniValue txids(UniValue::VARR);
+    UniValue errors(UniValue::VARR);
+    for (size_t i = 0; i < txs.size(); i++) {
+        if (!txs[i]) {
+            errors.push_back(strprintf("Failed to build transaction %d.", i));
+            continue;
+        }
+        if (!testmode) {
+            UniValue params = UniValue(UniValue::VARR);
+            params.push_back(EncodeHexTx(txs[i].get()));
+            try {
+                UniValue sendResultValue = sendrawtransaction(params, false, CPubKey());
+                if (sendResultValue.isNull()) {
+                    errors.push_back(strprintf("sendrawtransaction did not return an error or a txid for transaction %d.", i));
+                    continue;
+                }
+            } catch (const UniValue& objError) {
+                errors.push_back(strprintf("Transaction %d: %s", i, find_value(objError, "message").get_str()));
+                continue;
+            }
+        }
+        if (txids.empty()) {
+            tx_ = txs[i].get();
+        }
+        txids.push_back(txs[i]->GetHash().ToString());
+    }
+
+    if (txids.empty()) {
+        throw JSONRPCError(RPC_WALLET_ERROR, errors.empty() ? "No transaction was built." : errors[0].get_str());
+    }
+
+    UniValue o(UniValue::VOBJ);
+    if (testmode) {
+        // Test mode does not send the transactions to the network.
+        o.push_back(Pair("test", 1));
+    }
+    o.push_back(Pair("txid", tx_.GetHash().ToString()));
+    o.push_back(Pair("num_tx_created", (uint64_t)txids.size()));
+    o.push_back(Pair("txids", txids));
+    if (!errors.empty()) {
+        o.push_back(Pair("errors", errors));
+    }
+    set_result(o);
+    return true;
+}
+
 bool ShieldToAddress::operator()(const libzcash::SaplingPaymentAddress &zaddr) const {
     m_op->builder_.SetFee(m_op->fee_);
 
@@ -284,17 +402,7 @@ bool ShieldToAddress::operator()(const libzcash::SaplingPaymentAddress &zaddr) c
     uint256 ovk = ovkForShieldingFromTaddr(seed);
 
     // Add transparent inputs
-    for (auto t : m_op->inputs_) {
-        if (t.amount >= ASSETCHAINS_TIMELOCKGTE)
-        {
-            m_op->builder_.SetLockTime((uint32_t)(chainActive.Height()));
-            m_op->builder_.AddTransparentInput(COutPoint(t.txid, t.vout), t.scriptPubKey, t.amount, 0xfffffffe);
-        }
-        else
-        {
-            m_op->builder_.AddTransparentInput(COutPoint(t.txid, t.vout), t.scriptPubKey, t.amount);
-        }
-    }
+    m_op->add_transparent_inputs(m_op->builder_, m_op->inputs_);
 
     // Send all value to the target z-addr
     m_op->builder_.SendChangeTo(zaddr, ovk);
@@ -569,13 +677,19 @@ UniValue AsyncRPCOperation_shieldcoinbase::perform_joinsplit(ShieldCoinbaseJSInf
  */
 UniValue AsyncRPCOperation_shieldcoinbase::getStatus() const {
     UniValue v = AsyncRPCOperation::getStatus();
-    if (contextinfo_.isNull()) {
+    if (contextinfo_.isNull() && txInputs_.size() <= 1) {
         return v;
     }
 
     UniValue obj = v.get_obj();
-    obj.push_back(Pair("method", "z_shieldcoinbase"));
-    obj.push_back(Pair("params", contextinfo_ ));
+    if (!contextinfo_.isNull()) {
+        obj.push_back(Pair("method", "z_shieldcoinbase"));
+        obj.push_back(Pair("params", contextinfo_ ));
+    }
+    if (txInputs_.size() > 1) {
+        obj.push_back(Pair("txs_built", (uint64_t)nTxsBuilt_.load()));
+        obj.push_back(Pair("txs", (uint64_t)txInputs_.size()));
+    }
     return obj;
 }
 
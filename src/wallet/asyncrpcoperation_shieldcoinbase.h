@@ -28,6 +28,7 @@
 #include "zcash/Address.hpp"
 #include "wallet.h"
 
+#include <atomic>
 #include <unordered_map>
 #include <tuple>
 
@@ -65,6 +66,14 @@ public:
         std::string toAddress,
         CAmount fee = SHIELD_COINBASE_DEFAULT_MINERS_FEE,
         UniValue contextInfo = NullUniValue);
+    // Shields to a Sapling address in a transaction for each set of inputs, all built in parallel
+    AsyncRPCOperation_shieldcoinbase(
+        TransactionBuilder builder,
+        CMutableTransaction contextualTx,
+        std::vector<std::vector<ShieldCoinbaseUTXO>> txInputs,
+        std::string toAddress,
+        CAmount fee = SHIELD_COINBASE_DEFAULT_MINERS_FEE,
+        UniValue contextInfo = NullUniValue);
     virtual ~AsyncRPCOperation_shieldcoinbase();
 
     // We don't want to be copied or moved around
@@ -77,6 +86,10 @@ public:
 
     virtual UniValue getStatus() const;
 
+    virtual std::string getType() const { return "z_shieldcoinbase"; }
+
+    virtual OperationPriority getPriority() const { return OperationPriority::BACKGROUND; }
+
     bool testmode = false;  // Set to true to disable sending txs and generating proofs
     bool cheatSpend = false; // set when this is shielding a cheating coinbase
 
@@ -95,12 +108,19 @@ private:
     unsigned char joinSplitPrivKey_[crypto_sign_SECRETKEYBYTES];
 
     std::vector<ShieldCoinbaseUTXO> inputs_;
+    // Inputs of each transaction when there is more than one, inputs_ has them all
+    std::vector<std::vector<ShieldCoinbaseUTXO>> txInputs_;
+    std::atomic<size_t> nTxsBuilt_;
 
     TransactionBuilder builder_;
     CTransaction tx_;
 
     bool main_impl();
 
+    bool main_impl_multi();
+
+    void add_transparent_inputs(TransactionBuilder& builder, const std::vector<ShieldCoinbaseUTXO>& inputs);
+
     // JoinSplit without any input notes to spend
     UniValue perform_joinsplit(ShieldCoinbaseJSInfo &);
 
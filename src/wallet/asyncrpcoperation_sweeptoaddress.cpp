@@ -1,5 +1,6 @@
 #include "assert.h"
 #include "boost/variant/static_visitor.hpp"
+#include "asyncrpcoperation_saplingconsolidation.h"
 #include "asyncrpcoperation_sweeptoaddress.h"
 #include "init.h"
 #include "key_io.h"
@@ -75,7 +76,7 @@ bool AsyncRPCOperation_sweeptoaddress::main_impl() {
     auto nextActivationHeight = NextActivationHeight(targetHeight_, consensusParams);
     if (nextActivationHeight && targetHeight_ + SWEEP_EXPIRY_DELTA >= nextActivationHeight.get()) {
         LogPrint("zrpcunsafe", "%s: Sweep txs would be created before a NU activation but may expire after. Skipping this round.\n", getId());
-        setSweepResult(0, 0, std::vector<std::string>());
+        setSweepResult(0, 0, std::vector<std::string>(), 0, 0);
         return true;
     }
 
@@ -129,11 +130,18 @@ bool AsyncRPCOperation_sweeptoaddress::main_impl() {
     }
 
     int numTxCreated = 0;
+    int numNotesSpent = 0;
     std::vector<std::string> sweepTxIds;
     CAmount amountSwept = 0;
-    CCoinsViewCache coinsView(pcoinsTip);
     bool sweepComplete = true;
 
+    // The note sets of the transactions are disjoint, so they are all
+    // prepared first, built in parallel and committed together
+    size_t nMaxTxs = nConsolidationThreads * CONSOLIDATION_TXS_PER_THREAD;
+    std::vector<TransactionBuilder> builders;
+    std::vector<CAmount> vAmounts;
+    std::vector<int> vNotes;
+
     for (std::map<libzcash::SaplingPaymentAddress, std::vector<SaplingNoteEntry>>::iterator it = mapAddresses.begin(); it != mapAddresses.end(); it++) {
         auto addr = (*it).first;
         auto saplingEntries = (*it).second;
@@ -141,126 +149,139 @@ bool AsyncRPCOperation_sweeptoaddress::main_impl() {
         libzcash::SaplingExtendedSpendingKey extsk;
         if (pwalletMain->GetSaplingExtendedSpendingKey(addr, extsk)) {
 
-            std::vector<SaplingNoteEntry> fromNotes;
-            CAmount amountToSend = pwalletMain->targetSweepQty;
-            int maxQuantity = 50;
-
-            //Count Notes availiable for this address
-            int targetCount = 0;
-            int noteCount = 0;
+            //Notes availiable for this address
+            std::vector<SaplingNoteEntry> candidateNotes;
             for (const SaplingNoteEntry& saplingEntry : saplingEntries) {
 
               libzcash::SaplingIncomingViewingKey ivk;
               pwalletMain->GetSaplingIncomingViewingKey(boost::get<libzcash::SaplingPaymentAddress>(saplingEntry.address), ivk);
 
               if (ivk == extsk.expsk.full_viewing_key().in_viewing_key() && saplingEntry.address == addr) {
-                noteCount ++;
+                candidateNotes.push_back(saplingEntry);
               }
             }
 
             //Don't sweep if under the threshold
-            if (noteCount <= targetCount){
+            int targetCount = 0;
+            if (candidateNotes.size() <= targetCount){
                 continue;
             }
 
             //if we make it here then we need to sweep and the routine is considered incomplete
             sweepComplete = false;
 
-            for (const SaplingNoteEntry& saplingEntry : saplingEntries) {
-
-                libzcash::SaplingIncomingViewingKey ivk;
-                pwalletMain->GetSaplingIncomingViewingKey(boost::get<libzcash::SaplingPaymentAddress>(saplingEntry.address), ivk);
-
-                //Select Notes from that same address we will be sending to.
-                if (ivk == extsk.expsk.full_viewing_key().in_viewing_key() && saplingEntry.address == addr) {
-                  amountToSend += CAmount(saplingEntry.note.value());
-                  fromNotes.push_back(saplingEntry);
+            //Split the notes into transactions of at most maxQuantity notes
+            int maxQuantity = 50;
+            size_t nextNote = 0;
+            while (nextNote < candidateNotes.size() && builders.size() < nMaxTxs) {
+
+                std::vector<SaplingNoteEntry> fromNotes;
+                CAmount amountToSend = pwalletMain->targetSweepQty;
+                while (nextNote < candidateNotes.size() && fromNotes.size() < maxQuantity) {
+                  amountToSend += CAmount(candidateNotes[nextNote].note.value());
+                  fromNotes.push_back(candidateNotes[nextNote]);
+                  nextNote++;
                 }
 
-                if (fromNotes.size() >= maxQuantity)
-                  break;
-
-            }
-
-            int minQuantity = 1;
-            if (fromNotes.size() < minQuantity)
-              continue;
-
-            CAmount fee = fSweepTxFee;
-            if (amountToSend <= fSweepTxFee) {
-              fee = 0;
-            }
-            amountSwept += amountToSend;
-            auto builder = TransactionBuilder(consensusParams, targetHeight_, pwalletMain);
-            {
-                LOCK2(cs_main, pwalletMain->cs_wallet);
-                builder.SetExpiryHeight(chainActive.Tip()->GetHeight()+ SWEEP_EXPIRY_DELTA);
-            }
-            LogPrint("zrpcunsafe", "%s: Beginning creating transaction with Sapling output amount=%s\n", getId(), FormatMoney(amountToSend - fee));
-
-            // Select Sapling notes
-            std::vector<SaplingOutPoint> ops;
-            std::vector<libzcash::SaplingNote> notes;
-            for (auto fromNote : fromNotes) {
-                ops.push_back(fromNote.op);
-                notes.push_back(fromNote.note);
-            }
+                CAmount fee = fSweepTxFee;
+                if (amountToSend <= fSweepTxFee) {
+                  fee = 0;
+                }
+                auto builder = TransactionBuilder(consensusParams, targetHeight_, pwalletMain);
+                {
+                    LOCK2(cs_main, pwalletMain->cs_wallet);
+                    builder.SetExpiryHeight(chainActive.Tip()->GetHeight()+ SWEEP_EXPIRY_DELTA);
+                }
+                LogPrint("zrpcunsafe", "%s: Beginning creating transaction with Sapling output amount=%s\n", getId(), FormatMoney(amountToSend - fee));
+
+                // Select Sapling notes
+                std::vector<SaplingOutPoint> ops;
+                std::vector<libzcash::SaplingNote> notes;
+                for (auto fromNote : fromNotes) {
+                    ops.push_back(fromNote.op);
+                    notes.push_back(fromNote.note);
+                }
 
-            // Fetch Sapling anchor and witnesses
-            uint256 anchor;
-            std::vector<boost::optional<SaplingWitness>> witnesses;
-            {
-                LOCK2(cs_main, pwalletMain->cs_wallet);
-                pwalletMain->GetSaplingNoteWitnesses(ops, witnesses, anchor);
-            }
+                // Fetch Sapling anchor and witnesses
+                uint256 anchor;
+                std::vector<boost::optional<SaplingWitness>> witnesses;
+                {
+                    LOCK2(cs_main, pwalletMain->cs_wallet);
+                    pwalletMain->GetSaplingNoteWitnesses(ops, witnesses, anchor);
+                }
 
-            // Add Sapling spends
-            for (size_t i = 0; i < notes.size(); i++) {
-                if (!witnesses[i]) {
-                    LogPrint("zrpcunsafe", "%s: Missing Witnesses. Stopping.\n", getId());
-                    break;
+                // Add Sapling spends
+                bool fMissingWitness = false;
+                for (size_t i = 0; i < notes.size(); i++) {
+                    if (!witnesses[i]) {
+                        fMissingWitness = true;
+                        break;
+                    }
+                    builder.AddSaplingSpend(extsk.expsk, notes[i], anchor, witnesses[i].get());
+                }
+                if (fMissingWitness) {
+                    LogPrint("zrpcunsafe", "%s: Missing Witnesses. Skipping transaction.\n", getId());
+                    continue;
                 }
-                builder.AddSaplingSpend(extsk.expsk, notes[i], anchor, witnesses[i].get());
+
+                builder.SetFee(fee);
+                builder.AddSaplingOutput(extsk.expsk.ovk, sweepAddress, amountToSend - fee);
+                builders.push_back(builder);
+                vAmounts.push_back(amountToSend - fee);
+                vNotes.push_back(notes.size());
             }
+        }
+    }
 
-            builder.SetFee(fee);
-            builder.AddSaplingOutput(extsk.expsk.ovk, sweepAddress, amountToSend - fee);
+    int64_t nBuildStart = GetTimeMillis();
+    std::vector<boost::optional<CTransaction>> txs = BuildTransactions(builders, nConsolidationThreads);
+    double buildSeconds = (GetTimeMillis() - nBuildStart) / 1000.0;
 
-            auto maybe_tx = builder.Build();
-            if (!maybe_tx) {
-                LogPrint("zrpcunsafe", "%s: Failed to build transaction.", getId());
-                break;
-            }
-            CTransaction tx = maybe_tx.get();
+    if (isCancelled()) {
+        LogPrint("zrpcunsafe", "%s: Canceled. Stopping.\n", getId());
+        txs.clear();
+    }
 
-            if (isCancelled()) {
-                LogPrint("zrpcunsafe", "%s: Canceled. Stopping.\n", getId());
-                break;
+    {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+        for (size_t i = 0; i < txs.size(); i++) {
+            if (!txs[i]) {
+                LogPrint("zrpcunsafe", "%s: Failed to build transaction.\n", getId());
+                continue;
             }
-
+            CTransaction tx = txs[i].get();
             pwalletMain->CommitAutomatedTx(tx);
             LogPrint("zrpcunsafe", "%s: Committed sweep transaction with txid=%s\n", getId(), tx.GetHash().ToString());
-            amountSwept += amountToSend - fee;
+            numTxCreated++;
+            numNotesSpent += vNotes[i];
+            amountSwept += vAmounts[i];
             sweepTxIds.push_back(tx.GetHash().ToString());
-
         }
     }
 
+    if (!builders.empty()) {
+        LogPrintf("%s: Built %d of %d sweep transactions spending %d notes in %.1fs on %d threads (%.1f notes/s)\n",
+            getId(), numTxCreated, builders.size(), numNotesSpent, buildSeconds, std::min<int>(nConsolidationThreads, builders.size()),
+            buildSeconds > 0 ? numNotesSpent / buildSeconds : 0.0);
+    }
+
     if (sweepComplete) {
         pwalletMain->nextSweep = pwalletMain->sweepInterval + chainActive.Tip()->GetHeight();
         pwalletMain->fSweepRunning = false;
     }
 
     LogPrint("zrpcunsafe", "%s: Created %d transactions with total Sapling output amount=%s\n", getId(), numTxCreated, FormatMoney(amountSwept));
-    setSweepResult(numTxCreated, amountSwept, sweepTxIds);
+    setSweepResult(numTxCreated, amountSwept, sweepTxIds, numNotesSpent, buildSeconds);
     return true;
 
 }
 
-void AsyncRPCOperation_sweeptoaddress::setSweepResult(int numTxCreated, const CAmount& amountSwept, const std::vector<std::string>& sweepTxIds) {
+void AsyncRPCOperation_sweeptoaddress::setSweepResult(int numTxCreated, const CAmount& amountSwept, const std::vector<std::string>& sweepTxIds, int numNotesSpent, double buildSeconds) {
     UniValue res(UniValue::VOBJ);
     res.push_back(Pair("num_tx_created", numTxCreated));
     res.push_back(Pair("amount_swept", FormatMoney(amountSwept)));
+    res.push_back(Pair("num_notes_spent", numNotesSpent));
+    res.push_back(Pair("build_seconds", buildSeconds));
     UniValue txIds(UniValue::VARR);
     for (const std::string& txId : sweepTxIds) {
         txIds.push_back(txId);
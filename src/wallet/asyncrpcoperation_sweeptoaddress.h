@@ -28,12 +28,16 @@ public:
 
     virtual UniValue getStatus() const;
 
+    virtual std::string getType() const { return "sweeptoaddress"; }
+
+    virtual OperationPriority getPriority() const { return OperationPriority::BACKGROUND; }
+
 private:
     int targetHeight_;
     bool fromRPC_;
 
     bool main_impl();
 
-    void setSweepResult(int numTxCreated, const CAmount& amountSwept, const std::vector<std::string>& sweepTxIds);
+    void setSweepResult(int numTxCreated, const CAmount& amountSwept, const std::vector<std::string>& sweepTxIds, int numNotesSpent, double buildSeconds);
 
 };
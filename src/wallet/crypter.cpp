@@ -19,28 +19,82 @@
 
 #include "crypter.h"
 
+#include "crypto/common.h"
+#include "crypto/sha256.h"
+#include "crypto/sha512.h"
+#include "memusage.h"
 #include "script/script.h"
 #include "script/standard.h"
 #include "streams.h"
 #include "util.h"
+#include "util/parallel.h"
+#include "utiltime.h"
 
+#include <algorithm>
+#include <functional>
 #include <string>
 #include <vector>
 #include <boost/foreach.hpp>
 #include <openssl/aes.h>
 #include <openssl/evp.h>
+#include <sodium.h>
+
+bool fBackgroundKeyCheck = DEFAULT_BACKGROUND_KEY_CHECK;
 
 using namespace libzcash;
 
-bool CCrypter::SetKeyFromPassphrase(const SecureString& strKeyData, const std::vector<unsigned char>& chSalt, const unsigned int nRounds, const unsigned int nDerivationMethod)
+//! Key and IV of method 2 into chKeyIV, see CMasterKey
+static bool DeriveArgon2idLanes(const SecureString& strKeyData, const std::vector<unsigned char>& chSalt, unsigned int nPasses,
+                                const std::vector<unsigned char>& vchParameters, unsigned char chKeyIV[CSHA512::OUTPUT_SIZE])
+{
+    uint32_t nMemoryKiB, nLanes;
+    try {
+        CDataStream ss(vchParameters, SER_NETWORK, PROTOCOL_VERSION);
+        ss >> nMemoryKiB >> nLanes;
+    } catch (const std::exception&) {
+        return false;
+    }
+    if (nLanes < 1 || nLanes > MAX_WALLET_KDF_LANES)
+        return false;
+    size_t nLaneMemory = (size_t)nMemoryKiB * 1024 / nLanes;
+    if (nLaneMemory < crypto_pwhash_MEMLIMIT_MIN)
+        return false;
+
+    std::vector<unsigned char, secure_allocator<unsigned char> > vchLanes(nLanes * CSHA512::OUTPUT_SIZE);
+    std::atomic<bool> fDerived(true);
+    ParallelFor(nLanes, nLanes, [&](size_t nLane) {
+        unsigned char chLane[4], chLaneSalt[CSHA256::OUTPUT_SIZE];
+        WriteLE32(chLane, nLane);
+        CSHA256().Write(chSalt.data(), chSalt.size()).Write(chLane, sizeof(chLane)).Finalize(chLaneSalt);
+        if (crypto_pwhash(&vchLanes[nLane * CSHA512::OUTPUT_SIZE], CSHA512::OUTPUT_SIZE, strKeyData.data(), strKeyData.size(),
+                          chLaneSalt, nPasses, nLaneMemory, crypto_pwhash_ALG_ARGON2ID13) != 0)
+            fDerived = false;
+    });
+    if (!fDerived)
+        return false;
+    CSHA512().Write(vchLanes.data(), vchLanes.size()).Finalize(chKeyIV);
+    return true;
+}
+
+bool CCrypter::SetKeyFromPassphrase(const SecureString& strKeyData, const std::vector<unsigned char>& chSalt, const unsigned int nRounds, const unsigned int nDerivationMethod,
+                                    const std::vector<unsigned char>& vchOtherDerivationParameters)
 {
     if (nRounds < 1 || chSalt.size() != WALLET_CRYPTO_SALT_SIZE)
         return false;
 
     int i = 0;
-    if (nDerivationMethod == 0)
+    if (nDerivationMethod == WALLET_KDF_EVP_SHA512)
         i = EVP_BytesToKey(EVP_aes_256_cbc(), EVP_sha512(), &chSalt[0],
                           (unsigned char *)&strKeyData[0], strKeyData.size(), nRounds, chKey, chIV);
+    else if (nDerivationMethod == WALLET_KDF_ARGON2ID_LANES) {
+        unsigned char chKeyIV[CSHA512::OUTPUT_SIZE];
+        if (DeriveArgon2idLanes(strKeyData, chSalt, nRounds, vchOtherDerivationParameters, chKeyIV)) {
+            memcpy(chKey, chKeyIV, WALLET_CRYPTO_KEY_SIZE);
+            memcpy(chIV, chKeyIV + WALLET_CRYPTO_KEY_SIZE, WALLET_CRYPTO_KEY_SIZE);
+            i = WALLET_CRYPTO_KEY_SIZE;
+        }
+        memory_cleanse(chKeyIV, sizeof(chKeyIV));
+    }
 
     if (i != (int)WALLET_CRYPTO_KEY_SIZE)
     {
@@ -53,6 +107,35 @@ bool CCrypter::SetKeyFromPassphrase(const SecureString& strKeyData, const std::v
     return true;
 }
 
+bool CalibrateMasterKeyDerivation(CMasterKey& kMasterKey, const SecureString& strPassphrase)
+{
+    uint32_t nMemoryKiB = std::min<int64_t>(std::max<int64_t>(GetArg("-walletkdfmemory", DEFAULT_WALLET_KDF_MEMORY), 1), 4096) * 1024;
+    uint32_t nLanes = std::max(1, std::min<int>(GetNumCores(), MAX_WALLET_KDF_LANES));
+    int64_t nTargetMillis = std::max<int64_t>(GetArg("-walletkdftime", DEFAULT_WALLET_KDF_TIME), 1);
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << nMemoryKiB << nLanes;
+    kMasterKey.nDerivationMethod = WALLET_KDF_ARGON2ID_LANES;
+    kMasterKey.vchOtherDerivationParameters = std::vector<unsigned char>(ss.begin(), ss.end());
+
+    // The time grows linearly with the passes, so time one and then the estimate
+    CCrypter crypter;
+    kMasterKey.nDeriveIterations = 1;
+    int64_t nStartTime = GetTimeMillis();
+    if (!crypter.SetKeyFromPassphrase(strPassphrase, kMasterKey))
+        return false;
+    kMasterKey.nDeriveIterations = std::max<int64_t>(1, nTargetMillis / std::max<int64_t>(1, GetTimeMillis() - nStartTime));
+
+    if (kMasterKey.nDeriveIterations > 1) {
+        nStartTime = GetTimeMillis();
+        if (!crypter.SetKeyFromPassphrase(strPassphrase, kMasterKey))
+            return false;
+        double nPasses = kMasterKey.nDeriveIterations;
+        kMasterKey.nDeriveIterations = std::max<int64_t>(1, (nPasses + nPasses * nTargetMillis / std::max<int64_t>(1, GetTimeMillis() - nStartTime)) / 2);
+    }
+    return true;
+}
+
 bool CCrypter::SetKey(const CKeyingMaterial& chNewKey, const std::vector<unsigned char>& chNewIV)
 {
     if (chNewKey.size() != WALLET_CRYPTO_KEY_SIZE || chNewIV.size() != WALLET_CRYPTO_KEY_SIZE)
@@ -227,6 +310,93 @@ bool CCryptoKeyStore::Lock()
     return true;
 }
 
+//! Minimum number of keys each thread of a thorough check decrypts
+static const size_t KEY_CHECK_MIN_KEYS_PER_THREAD = 256;
+
+/**
+ * Decrypts up to nMax keys of each kind, all of them if it is 0, and sets
+ * keyPass when one decrypts and keyFail when one does not. Every key is
+ * decrypted and checked against its public part on its own, so the keys of
+ * a thorough check are split across threads.
+ */
+static void CheckCryptedKeys(const CKeyingMaterial& vMasterKeyIn,
+                             const CryptedKeyMap& mapKeys,
+                             const CryptedSproutSpendingKeyMap& mapSproutKeys,
+                             const CryptedSaplingSpendingKeyMap& mapSaplingKeys,
+                             size_t nMax, bool& keyPass, bool& keyFail)
+{
+    std::vector<std::function<bool()>> vChecks;
+    for (CryptedKeyMap::const_iterator mi = mapKeys.begin(); mi != mapKeys.end() && (nMax == 0 || vChecks.size() < nMax); ++mi) {
+        const CryptedKeyMap::mapped_type& entry = mi->second;
+        vChecks.push_back([&vMasterKeyIn, &entry]() {
+            CKey key;
+            return DecryptKey(vMasterKeyIn, entry.second, entry.first, key);
+        });
+    }
+    size_t nChecks = vChecks.size();
+    for (CryptedSproutSpendingKeyMap::const_iterator mi = mapSproutKeys.begin(); mi != mapSproutKeys.end() && (nMax == 0 || vChecks.size() < nChecks + nMax); ++mi) {
+        const CryptedSproutSpendingKeyMap::value_type& entry = *mi;
+        vChecks.push_back([&vMasterKeyIn, &entry]() {
+            libzcash::SproutSpendingKey sk;
+            return DecryptSproutSpendingKey(vMasterKeyIn, entry.second, entry.first, sk);
+        });
+    }
+    nChecks = vChecks.size();
+    for (CryptedSaplingSpendingKeyMap::const_iterator mi = mapSaplingKeys.begin(); mi != mapSaplingKeys.end() && (nMax == 0 || vChecks.size() < nChecks + nMax); ++mi) {
+        const CryptedSaplingSpendingKeyMap::value_type& entry = *mi;
+        vChecks.push_back([&vMasterKeyIn, &entry]() {
+            libzcash::SaplingExtendedSpendingKey sk;
+            return DecryptSaplingSpendingKey(vMasterKeyIn, entry.second, entry.first, sk);
+        });
+    }
+
+    std::atomic<bool> fPass(false), fFail(false);
+    auto check = [&](size_t nBegin, size_t nEnd) {
+        for (size_t n = nBegin; n < nEnd && !fFail; n++) {
+            if (vChecks[n]())
+                fPass = true;
+            else
+                fFail = true;
+        }
+    };
+
+    size_t nThreads = std::min<size_t>(std::max(GetNumCores(), 1), vChecks.size() / KEY_CHECK_MIN_KEYS_PER_THREAD);
+    ParallelForRanges(vChecks.size(), nThreads, check);
+    keyPass = keyPass || fPass;
+    keyFail = keyFail || fFail;
+}
+
+void CCryptoKeyStore::StartBackgroundKeyCheck(const CKeyingMaterial& vMasterKeyIn)
+{
+    if (fKeyCheckRunning)
+        return;
+    if (threadKeyCheck.joinable())
+        threadKeyCheck.join();
+
+    // The check works on a copy, keys added meanwhile are encrypted with the same master key
+    fKeyCheckRunning = true;
+    threadKeyCheck = std::thread([this, vMasterKeyIn](CryptedKeyMap mapKeys, CryptedSproutSpendingKeyMap mapSproutKeys, CryptedSaplingSpendingKeyMap mapSaplingKeys) {
+        RenameThread("pirate-keycheck");
+        int64_t nStart = GetTimeMillis();
+        bool keyPass = false;
+        bool keyFail = false;
+        CheckCryptedKeys(vMasterKeyIn, mapKeys, mapSproutKeys, mapSaplingKeys, 0, keyPass, keyFail);
+        if (keyFail)
+        {
+            // The sample decrypted with this master key
+            LogPrintf("The wallet is probably corrupted: Some keys decrypt but not all.\n");
+            assert(false);
+        }
+        {
+            LOCK(cs_KeyStore);
+            fDecryptionThoroughlyChecked = true;
+        }
+        LogPrintf("%s: all %u wallet keys decrypt, checked in %dms\n", __func__,
+            mapKeys.size() + mapSproutKeys.size() + mapSaplingKeys.size(), GetTimeMillis() - nStart);
+        fKeyCheckRunning = false;
+    }, mapCryptedKeys, mapCryptedSproutSpendingKeys, mapCryptedSaplingSpendingKeys);
+}
+
 bool CCryptoKeyStore::Unlock(const CKeyingMaterial& vMasterKeyIn)
 {
     {
@@ -245,51 +415,11 @@ bool CCryptoKeyStore::Unlock(const CKeyingMaterial& vMasterKeyIn)
                 keyPass = true;
             }
         }
-        CryptedKeyMap::const_iterator mi = mapCryptedKeys.begin();
-        for (; mi != mapCryptedKeys.end(); ++mi)
-        {
-            const CPubKey &vchPubKey = (*mi).second.first;
-            const std::vector<unsigned char> &vchCryptedSecret = (*mi).second.second;
-            CKey key;
-            if (!DecryptKey(vMasterKeyIn, vchCryptedSecret, vchPubKey, key))
-            {
-                keyFail = true;
-                break;
-            }
-            keyPass = true;
-            if (fDecryptionThoroughlyChecked)
-                break;
-        }
-        CryptedSproutSpendingKeyMap::const_iterator miSprout = mapCryptedSproutSpendingKeys.begin();
-        for (; miSprout != mapCryptedSproutSpendingKeys.end(); ++miSprout)
-        {
-            const libzcash::SproutPaymentAddress &address = (*miSprout).first;
-            const std::vector<unsigned char> &vchCryptedSecret = (*miSprout).second;
-            libzcash::SproutSpendingKey sk;
-            if (!DecryptSproutSpendingKey(vMasterKeyIn, vchCryptedSecret, address, sk))
-            {
-                keyFail = true;
-                break;
-            }
-            keyPass = true;
-            if (fDecryptionThoroughlyChecked)
-                break;
-        }
-        CryptedSaplingSpendingKeyMap::const_iterator miSapling = mapCryptedSaplingSpendingKeys.begin();
-        for (; miSapling != mapCryptedSaplingSpendingKeys.end(); ++miSapling)
-        {
-            const libzcash::SaplingExtendedFullViewingKey &extfvk = (*miSapling).first;
-            const std::vector<unsigned char> &vchCryptedSecret = (*miSapling).second;
-            libzcash::SaplingExtendedSpendingKey sk;
-            if (!DecryptSaplingSpendingKey(vMasterKeyIn, vchCryptedSecret, extfvk, sk))
-            {
-                keyFail = true;
-                break;
-            }
-            keyPass = true;
-            if (fDecryptionThoroughlyChecked)
-                break;
-        }
+        // Once every key was found to decrypt, or while that is checked in the background,
+        // one key of each kind tells whether the master key is the right one
+        const bool fThorough = !fDecryptionThoroughlyChecked && !fBackgroundKeyCheck;
+        CheckCryptedKeys(vMasterKeyIn, mapCryptedKeys, mapCryptedSproutSpendingKeys, mapCryptedSaplingSpendingKeys,
+                         fThorough ? 0 : 1, keyPass, keyFail);
         if (keyPass && keyFail)
         {
             LogPrintf("The wallet is probably corrupted: Some keys decrypt but not all.\n");
@@ -298,7 +428,10 @@ bool CCryptoKeyStore::Unlock(const CKeyingMaterial& vMasterKeyIn)
         if (keyFail || !keyPass)
             return false;
         vMasterKey = vMasterKeyIn;
-        fDecryptionThoroughlyChecked = true;
+        if (fThorough)
+            fDecryptionThoroughlyChecked = true;
+        else if (!fDecryptionThoroughlyChecked)
+            StartBackgroundKeyCheck(vMasterKeyIn);
     }
     NotifyStatusChanged(this);
     return true;
@@ -553,11 +686,11 @@ bool CCryptoKeyStore::GetSaplingSpendingKey(const libzcash::SaplingExtendedFullV
         if (!IsCrypted())
             return CBasicKeyStore::GetSaplingSpendingKey(extfvk, skOut);
 
-        for (auto entry : mapCryptedSaplingSpendingKeys) {
-            if (entry.first == extfvk) {
-                const std::vector<unsigned char> &vchCryptedSecret = entry.second;
-                return DecryptSaplingSpendingKey(vMasterKey, vchCryptedSecret, entry.first, skOut);
-            }
+        CryptedSaplingSpendingKeyMap::const_iterator mi = mapCryptedSaplingSpendingKeys.find(extfvk);
+        if (mi != mapCryptedSaplingSpendingKeys.end())
+        {
+            const std::vector<unsigned char> &vchCryptedSecret = (*mi).second;
+            return DecryptSaplingSpendingKey(vMasterKey, vchCryptedSecret, (*mi).first, skOut);
         }
     }
     return false;
@@ -637,3 +770,18 @@ bool CCryptoKeyStore::EncryptKeys(CKeyingMaterial& vMasterKeyIn)
     }
     return true;
 }
+
+size_t CCryptoKeyStore::CryptedKeysDynamicUsage(size_t& nEntries) const
+{
+    LOCK2(cs_KeyStore, cs_SpendingKeyStore);
+    nEntries = mapCryptedKeys.size() + mapCryptedSproutSpendingKeys.size() + mapCryptedSaplingSpendingKeys.size();
+    size_t nUsage = memusage::DynamicUsage(mapCryptedKeys) + memusage::DynamicUsage(mapCryptedSproutSpendingKeys) +
+                    memusage::DynamicUsage(mapCryptedSaplingSpendingKeys);
+    for (const CryptedKeyMap::value_type& key : mapCryptedKeys)
+        nUsage += memusage::DynamicUsage(key.second.second);
+    for (const CryptedSproutSpendingKeyMap::value_type& key : mapCryptedSproutSpendingKeys)
+        nUsage += memusage::DynamicUsage(key.second);
+    for (const CryptedSaplingSpendingKeyMap::value_type& key : mapCryptedSaplingSpendingKeys)
+        nUsage += memusage::DynamicUsage(key.second);
+    return nUsage;
+}
@@ -27,11 +27,35 @@
 #include "zcash/Address.hpp"
 #include "zcash/address/zip32.h"
 
+#include <atomic>
+#include <thread>
+
 class uint256;
 
 const unsigned int WALLET_CRYPTO_KEY_SIZE = 32;
 const unsigned int WALLET_CRYPTO_SALT_SIZE = 8;
 
+//! Master key derivation methods, see CMasterKey
+const unsigned int WALLET_KDF_EVP_SHA512 = 0;
+const unsigned int WALLET_KDF_ARGON2ID_LANES = 2;
+//! Default for -walletkdfmemory, in MiB
+static const unsigned int DEFAULT_WALLET_KDF_MEMORY = 64;
+//! Default for -walletkdftime, in milliseconds
+static const unsigned int DEFAULT_WALLET_KDF_TIME = 250;
+//! Most Argon2id lanes a master key is derived on
+static const unsigned int MAX_WALLET_KDF_LANES = 16;
+
+//! Default for -backgroundkeycheck
+static const bool DEFAULT_BACKGROUND_KEY_CHECK = true;
+
+/**
+ * With -backgroundkeycheck the first unlock of an encrypted wallet only
+ * decrypts one key of each kind, as later unlocks do, and the check that
+ * every key decrypts runs on its own threads after the wallet is unlocked.
+ * Keys are always decrypted when they are used.
+ */
+extern bool fBackgroundKeyCheck;
+
 /**
  * Private key encryption is done based on a CMasterKey,
  * which holds a salt and random encryption key.
@@ -42,6 +66,14 @@ const unsigned int WALLET_CRYPTO_SALT_SIZE = 8;
  * vchOtherDerivationParameters is provided for alternative algorithms
  * which may require more parameters (such as scrypt).
  *
+ * With method 2 the passphrase goes through nLanes independent Argon2id
+ * runs of nDeriveIterations passes, each over nMemoryKiB / nLanes of
+ * memory and salted with the master key salt and its lane number, derived
+ * on one thread per lane. The key and IV are the SHA512 of the lane
+ * outputs. nMemoryKiB and nLanes are the other derivation parameters.
+ * Encrypting a wallet or changing its passphrase calibrates the passes to
+ * -walletkdftime on this machine, and moves older master keys to method 2.
+ *
  * Wallet Private Keys are then encrypted using AES-256-CBC
  * with the double-sha256 of the public key as the IV, and the
  * master key's key as the encryption key (see keystore.[ch]).
@@ -55,6 +87,7 @@ public:
     std::vector<unsigned char> vchSalt;
     //! 0 = EVP_sha512()
     //! 1 = scrypt()
+    //! 2 = Argon2id lanes
     unsigned int nDerivationMethod;
     unsigned int nDeriveIterations;
     //! Use this for more parameters to key derivation,
@@ -105,7 +138,12 @@ private:
     bool fKeySet;
 
 public:
-    bool SetKeyFromPassphrase(const SecureString &strKeyData, const std::vector<unsigned char>& chSalt, const unsigned int nRounds, const unsigned int nDerivationMethod);
+    bool SetKeyFromPassphrase(const SecureString &strKeyData, const std::vector<unsigned char>& chSalt, const unsigned int nRounds, const unsigned int nDerivationMethod,
+                              const std::vector<unsigned char>& vchOtherDerivationParameters = std::vector<unsigned char>());
+    bool SetKeyFromPassphrase(const SecureString &strKeyData, const CMasterKey& kMasterKey)
+    {
+        return SetKeyFromPassphrase(strKeyData, kMasterKey.vchSalt, kMasterKey.nDeriveIterations, kMasterKey.nDerivationMethod, kMasterKey.vchOtherDerivationParameters);
+    }
     bool Encrypt(const CKeyingMaterial& vchPlaintext, std::vector<unsigned char> &vchCiphertext);
     bool Decrypt(const std::vector<unsigned char>& vchCiphertext, CKeyingMaterial& vchPlaintext);
     bool SetKey(const CKeyingMaterial& chNewKey, const std::vector<unsigned char>& chNewIV);
@@ -137,6 +175,13 @@ public:
     }
 };
 
+/**
+ * Set kMasterKey to derive with Argon2id on one lane per core, up to
+ * MAX_WALLET_KDF_LANES, over -walletkdfmemory MiB, with the passes that take
+ * about -walletkdftime milliseconds here. Returns false if a derivation fails.
+ */
+bool CalibrateMasterKeyDerivation(CMasterKey& kMasterKey, const SecureString& strPassphrase);
+
 /** Keystore which keeps the private keys encrypted.
  * It derives from the basic key store, which is used if no encryption is active.
  */
@@ -157,6 +202,13 @@ private:
     //! keeps track of whether Unlock has run a thorough check before
     bool fDecryptionThoroughlyChecked;
 
+    //! thread of the thorough check with -backgroundkeycheck, and whether it still runs
+    std::thread threadKeyCheck;
+    std::atomic<bool> fKeyCheckRunning;
+
+    //! starts the thorough check of the keys as they are now, requires cs_KeyStore and cs_SpendingKeyStore
+    void StartBackgroundKeyCheck(const CKeyingMaterial& vMasterKeyIn);
+
 protected:
     bool SetCrypted();
 
@@ -165,9 +217,18 @@ protected:
 
     bool Unlock(const CKeyingMaterial& vMasterKeyIn);
 
+    //! Estimated dynamic memory of the encrypted keys, their count in nEntries
+    size_t CryptedKeysDynamicUsage(size_t& nEntries) const;
+
 public:
-    CCryptoKeyStore() : fUseCrypto(false), fDecryptionThoroughlyChecked(false)
+    CCryptoKeyStore() : fUseCrypto(false), fDecryptionThoroughlyChecked(false), fKeyCheckRunning(false)
+    {
+    }
+
+    ~CCryptoKeyStore()
     {
+        if (threadKeyCheck.joinable())
+            threadKeyCheck.join();
     }
 
     bool IsCrypted() const
@@ -576,6 +576,64 @@ TEST(WalletTests, FindMySaplingNotesWithIvkOnly) {
     UpdateNetworkUpgradeParameters(Consensus::UPGRADE_OVERWINTER, Consensus::NetworkUpgrade::NO_ACTIVATION_HEIGHT);
 }
 
+TEST(WalletTests, TrialDecryptSaplingOutputsThreaded) {
+    SelectParams(CBaseChainParams::REGTEST);
+    UpdateNetworkUpgradeParameters(Consensus::UPGRADE_OVERWINTER, Consensus::NetworkUpgrade::ALWAYS_ACTIVE);
+    UpdateNetworkUpgradeParameters(Consensus::UPGRADE_SAPLING, Consensus::NetworkUpgrade::ALWAYS_ACTIVE);
+    auto consensusParams = Params().GetConsensus();
+
+    std::vector<unsigned char, secure_allocator<unsigned char>> rawSeed(32);
+    HDSeed seed(rawSeed);
+    auto sk = libzcash::SaplingExtendedSpendingKey::Master(seed);
+    auto expsk = sk.expsk;
+    auto fvk = expsk.full_viewing_key();
+    auto pk = sk.DefaultAddress();
+    auto ivk = fvk.in_viewing_key();
+
+    libzcash::SaplingNote note(pk, 50000);
+    auto cm = note.cm().get();
+    SaplingMerkleTree tree;
+    tree.append(cm);
+    auto anchor = tree.root();
+    auto witness = tree.witness();
+
+    auto builder = TransactionBuilder(consensusParams, 1);
+    ASSERT_TRUE(builder.AddSaplingSpend(expsk, note, anchor, witness));
+    builder.AddSaplingOutput(fvk.ovk, pk, 25000, {});
+    auto maybe_tx = builder.Build();
+    ASSERT_EQ(static_cast<bool>(maybe_tx), true);
+    auto tx = maybe_tx.get();
+
+    // Bury the wallet key among enough unrelated keys to use several threads
+    std::vector<libzcash::SaplingIncomingViewingKey> vIvks;
+    for (int i = 0; i < 300; i++) {
+        vIvks.push_back(libzcash::SaplingIncomingViewingKey(GetRandHash()));
+    }
+    vIvks.insert(vIvks.begin() + 200, ivk);
+
+    int nSavedThreads = nSaplingDecryptThreads;
+    std::vector<SaplingTrialDecryptionResult> vSerial, vThreaded;
+    nSaplingDecryptThreads = 1;
+    CWallet::TrialDecryptSaplingOutputs(tx.vShieldedOutput, vIvks, vSerial);
+    nSaplingDecryptThreads = 4;
+    CWallet::TrialDecryptSaplingOutputs(tx.vShieldedOutput, vIvks, vThreaded);
+    nSaplingDecryptThreads = nSavedThreads;
+
+    ASSERT_EQ(tx.vShieldedOutput.size(), vSerial.size());
+    ASSERT_EQ(vSerial.size(), vThreaded.size());
+    for (size_t i = 0; i < vSerial.size(); i++) {
+        ASSERT_TRUE(static_cast<bool>(vSerial[i].plaintext));
+        ASSERT_TRUE(static_cast<bool>(vThreaded[i].plaintext));
+        EXPECT_EQ(200, vSerial[i].nKey);
+        EXPECT_EQ(vSerial[i].nKey, vThreaded[i].nKey);
+        EXPECT_EQ(vSerial[i].plaintext->value(), vThreaded[i].plaintext->value());
+    }
+
+    // Revert to default
+    UpdateNetworkUpgradeParameters(Consensus::UPGRADE_SAPLING, Consensus::NetworkUpgrade::NO_ACTIVATION_HEIGHT);
+    UpdateNetworkUpgradeParameters(Consensus::UPGRADE_OVERWINTER, Consensus::NetworkUpgrade::NO_ACTIVATION_HEIGHT);
+}
+
 TEST(WalletTests, FindMySproutNotes) {
     CWallet wallet;
 
@@ -1600,6 +1658,207 @@ TEST(WalletTests, ClearNoteWitnessCache) {
     EXPECT_EQ(0, wallet.nWitnessCacheSize);
 }
 
+/**
+ * Caches witnesses as the wallet did before NoteWitnessCache, a full copy per
+ * block in a list, next to a NoteWitnessCache fed the same blocks.
+ */
+static void AdvanceWitnessCaches(SaplingMerkleTree& tree, std::list<SaplingWitness>& witnessList,
+                                 NoteWitnessCache<SaplingWitness>& witnesses, int nBlocks)
+{
+    for (int i = 0; i < nBlocks; i++) {
+        std::vector<uint256> vCommitments;
+        for (int j = 0; j <= i % 3; j++) {
+            vCommitments.push_back(GetRandHash());
+            tree.append(vCommitments.back());
+        }
+        SaplingWitness witness = witnessList.front();
+        for (const uint256& commitment : vCommitments)
+            witness.append(commitment);
+        witnessList.push_front(witness);
+        witnesses.advance(vCommitments);
+    }
+}
+
+static void StartWitnessCaches(SaplingMerkleTree& tree, std::list<SaplingWitness>& witnessList,
+                               NoteWitnessCache<SaplingWitness>& witnesses)
+{
+    tree.append(GetRandHash());
+    witnessList.push_front(tree.witness());
+    witnesses.push_front(tree.witness());
+}
+
+TEST(WalletTests, NoteWitnessCacheMatchesList) {
+    SaplingMerkleTree tree;
+    std::list<SaplingWitness> witnessList;
+    NoteWitnessCache<SaplingWitness> witnesses;
+    StartWitnessCaches(tree, witnessList, witnesses);
+    AdvanceWitnessCaches(tree, witnessList, witnesses, 3 * WITNESS_CACHE_CHECKPOINT_INTERVAL + 2);
+
+    EXPECT_EQ(witnessList.size(), witnesses.size());
+    EXPECT_EQ(witnessList, witnesses.to_list());
+    EXPECT_EQ(tree.root(), witnesses.front().root());
+
+    NoteWitnessCache<SaplingWitness> witnesses2;
+    witnesses2.from_list(witnessList);
+    EXPECT_EQ(witnessList, witnesses2.to_list());
+    EXPECT_EQ(witnesses.front(), witnesses2.front());
+}
+
+TEST(WalletTests, NoteWitnessCachePopAcrossCheckpoint) {
+    SaplingMerkleTree tree;
+    std::list<SaplingWitness> witnessList;
+    NoteWitnessCache<SaplingWitness> witnesses;
+    StartWitnessCaches(tree, witnessList, witnesses);
+    // The newest checkpoint holds the two newest witnesses
+    AdvanceWitnessCaches(tree, witnessList, witnesses, 2 * WITNESS_CACHE_CHECKPOINT_INTERVAL + 1);
+    ASSERT_EQ(2 * WITNESS_CACHE_CHECKPOINT_INTERVAL + 2, witnesses.size());
+
+    // A reorg drops the newest witnesses down into the checkpoint before
+    for (int i = 0; i < 4; i++) {
+        witnessList.pop_front();
+        witnesses.pop_front();
+        EXPECT_EQ(witnessList.size(), witnesses.size());
+        EXPECT_EQ(witnessList.front(), witnesses.front());
+        EXPECT_EQ(witnessList, witnesses.to_list());
+    }
+
+    // and the blocks of the new chain are cached from there, again across a checkpoint
+    AdvanceWitnessCaches(tree, witnessList, witnesses, WITNESS_CACHE_CHECKPOINT_INTERVAL + 3);
+    EXPECT_EQ(witnessList.size(), witnesses.size());
+    EXPECT_EQ(witnessList.front(), witnesses.front());
+    EXPECT_EQ(witnessList, witnesses.to_list());
+
+    while (!witnessList.empty()) {
+        witnessList.pop_front();
+        witnesses.pop_front();
+        ASSERT_EQ(witnessList.size(), witnesses.size());
+        if (!witnessList.empty())
+            EXPECT_EQ(witnessList.front(), witnesses.front());
+    }
+    EXPECT_TRUE(witnesses.empty());
+}
+
+TEST(WalletTests, NoteWitnessCacheTrimAndResize) {
+    SaplingMerkleTree tree;
+    std::list<SaplingWitness> witnessList;
+    NoteWitnessCache<SaplingWitness> witnesses;
+    StartWitnessCaches(tree, witnessList, witnesses);
+    AdvanceWitnessCaches(tree, witnessList, witnesses, 4 * WITNESS_CACHE_CHECKPOINT_INTERVAL + 4);
+
+    // Old witnesses leave a checkpoint at a time, the newest ones stay as they were
+    for (size_t nKeep : {35, 30, 21, 12, 2}) {
+        witnesses.trim(nKeep);
+        EXPECT_GE(witnesses.size(), nKeep);
+        EXPECT_LT(witnesses.size(), nKeep + WITNESS_CACHE_CHECKPOINT_INTERVAL);
+        std::list<SaplingWitness> witnessList2 = witnessList;
+        witnessList2.resize(witnesses.size());
+        EXPECT_EQ(witnessList2, witnesses.to_list());
+        EXPECT_EQ(witnessList.front(), witnesses.front());
+    }
+
+    NoteWitnessCache<SaplingWitness> witnesses1 = witnesses;
+    witnesses1.resize(1);
+    ASSERT_EQ(1, witnesses1.size());
+    EXPECT_EQ(witnessList.front(), witnesses1.front());
+    EXPECT_EQ(std::list<SaplingWitness>(1, witnessList.front()), witnesses1.to_list());
+
+    // A witness cached after the resize is derived from the one left
+    witnessList.resize(1);
+    AdvanceWitnessCaches(tree, witnessList, witnesses1, 2);
+    EXPECT_EQ(witnessList, witnesses1.to_list());
+
+    witnesses1.resize(0);
+    EXPECT_TRUE(witnesses1.empty());
+    EXPECT_TRUE(witnesses1.to_list().empty());
+}
+
+TEST(WalletTests, NoteWitnessCacheSerialisation) {
+    SaplingMerkleTree tree;
+    std::list<SaplingWitness> witnessList;
+    NoteWitnessCache<SaplingWitness> witnesses;
+    StartWitnessCaches(tree, witnessList, witnesses);
+
+    // With the newest witness a checkpoint, which is then not written twice, and in between
+    for (int nBlocks : {(int)WITNESS_CACHE_CHECKPOINT_INTERVAL, 3}) {
+        AdvanceWitnessCaches(tree, witnessList, witnesses, nBlocks);
+
+        CDataStream ss(SER_DISK, CLIENT_VERSION);
+        ss << witnesses;
+        NoteWitnessCache<SaplingWitness> witnesses2;
+        ss >> witnesses2;
+
+        EXPECT_TRUE(ss.empty());
+        EXPECT_EQ(witnesses, witnesses2);
+        EXPECT_EQ(witnesses.size(), witnesses2.size());
+        EXPECT_EQ(witnesses.front(), witnesses2.front());
+        EXPECT_EQ(witnessList, witnesses2.to_list());
+    }
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << NoteWitnessCache<SaplingWitness>();
+    NoteWitnessCache<SaplingWitness> witnesses3 = witnesses;
+    ss >> witnesses3;
+    EXPECT_TRUE(witnesses3.empty());
+}
+
+TEST(WalletTests, SaplingNoteDataSerialisation) {
+    SaplingMerkleTree tree;
+    std::list<SaplingWitness> witnessList;
+    NoteWitnessCache<SaplingWitness> witnesses;
+    StartWitnessCaches(tree, witnessList, witnesses);
+    AdvanceWitnessCaches(tree, witnessList, witnesses, WITNESS_CACHE_CHECKPOINT_INTERVAL + 5);
+
+    SaplingNoteData nd(libzcash::SaplingIncomingViewingKey(GetRandHash()), GetRandHash());
+    nd.witnesses = witnesses;
+    nd.witnessHeight = 1000;
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << nd;
+    CDataStream ssVersion = ss;
+    int nVersion;
+    ssVersion >> nVersion;
+    EXPECT_TRUE(nVersion & SAPLING_NOTE_DATA_COMPACT_WITNESSES);
+
+    SaplingNoteData nd2;
+    ss >> nd2;
+    EXPECT_TRUE(ss.empty());
+    EXPECT_EQ(nd, nd2);
+    EXPECT_EQ(nd.witnesses, nd2.witnesses);
+    EXPECT_EQ(witnessList, nd2.witnesses.to_list());
+}
+
+TEST(WalletTests, SaplingNoteDataLoadsFullWitnessList) {
+    SaplingMerkleTree tree;
+    std::list<SaplingWitness> witnessList;
+    NoteWitnessCache<SaplingWitness> witnesses;
+    StartWitnessCaches(tree, witnessList, witnesses);
+    AdvanceWitnessCaches(tree, witnessList, witnesses, WITNESS_CACHE_CHECKPOINT_INTERVAL + 5);
+
+    // A record written before the flag, with a full copy of every witness
+    libzcash::SaplingIncomingViewingKey ivk(GetRandHash());
+    boost::optional<uint256> nullifier = GetRandHash();
+    int witnessHeight = 1000;
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << (int)CLIENT_VERSION << ivk << nullifier << witnessList << witnessHeight;
+
+    SaplingNoteData nd;
+    ss >> nd;
+    EXPECT_TRUE(ss.empty());
+    EXPECT_EQ(ivk, nd.ivk);
+    EXPECT_TRUE(nullifier == nd.nullifier);
+    EXPECT_EQ(witnessHeight, nd.witnessHeight);
+    EXPECT_EQ(witnessList.size(), nd.witnesses.size());
+    EXPECT_EQ(witnessList.front(), nd.witnesses.front());
+    EXPECT_EQ(witnessList, nd.witnesses.to_list());
+
+    // and is written back with the flag
+    CDataStream ss2(SER_DISK, CLIENT_VERSION);
+    ss2 << nd;
+    int nVersion;
+    ss2 >> nVersion;
+    EXPECT_TRUE(nVersion & SAPLING_NOTE_DATA_COMPACT_WITNESSES);
+}
+
 TEST(WalletTests, WriteWitnessCache) {
     TestWallet wallet;
     MockWalletDB walletdb;
@@ -2157,3 +2416,41 @@ TEST(WalletTests, SaplingNoteLocking) {
     EXPECT_FALSE(wallet.IsLockedNote(sop1));
     EXPECT_FALSE(wallet.IsLockedNote(sop2));
 }
+
+TEST(WalletTests, SaplingMemoLookup) {
+    TestWallet wallet;
+    LOCK(wallet.cs_wallet);
+    SaplingOutPoint sop1 {uint256(), 1};
+    SaplingOutPoint sop2 {uint256(), 2};
+    SaplingOutPoint sop3 {uint256(), 3};
+
+    std::array<unsigned char, ZC_MEMO_SIZE> memo1 {};
+    std::array<unsigned char, ZC_MEMO_SIZE> memo2 {};
+    std::string text1 = "invoice-1024";
+    std::string text2 = "invoice-2048 paid";
+    std::copy(text1.begin(), text1.end(), memo1.begin());
+    std::copy(text2.begin(), text2.end(), memo2.begin());
+    wallet.AddSaplingMemo(sop1, memo1);
+    wallet.AddSaplingMemo(sop2, memo2);
+
+    // Kept without the trailing zeros, read back padded
+    EXPECT_EQ(wallet.mapSaplingMemos[sop1].size(), text1.size());
+    std::array<unsigned char, ZC_MEMO_SIZE> memo;
+    memo.fill(0xff);
+    EXPECT_TRUE(wallet.GetSaplingMemo(sop2, memo));
+    EXPECT_EQ(memo, memo2);
+    EXPECT_FALSE(wallet.GetSaplingMemo(sop3, memo));
+
+    std::vector<SaplingOutPoint> v;
+    std::string prefix = "invoice-";
+    wallet.FindSaplingMemos(std::vector<unsigned char>(prefix.begin(), prefix.end()), false, v);
+    EXPECT_EQ(v.size(), 2);
+
+    v.clear();
+    std::string middle = "2048";
+    wallet.FindSaplingMemos(std::vector<unsigned char>(middle.begin(), middle.end()), false, v);
+    EXPECT_TRUE(v.empty());
+    wallet.FindSaplingMemos(std::vector<unsigned char>(middle.begin(), middle.end()), true, v);
+    ASSERT_EQ(v.size(), 1);
+    EXPECT_EQ(v[0], sop2);
+}
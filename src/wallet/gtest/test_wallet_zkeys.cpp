@@ -106,6 +106,42 @@ TEST(wallet_zkeys_tests, StoreAndLoadSaplingZkeys) {
     EXPECT_TRUE(wallet.HaveSaplingIncomingViewingKey(dpa2));
 }
 
+TEST(wallet_zkeys_tests, GenerateNewSaplingZKeys) {
+    SelectParams(CBaseChainParams::MAIN);
+
+    CWallet wallet;
+
+    // No HD seed in the wallet
+    EXPECT_ANY_THROW(wallet.GenerateNewSaplingZKeys(2));
+
+    CKeyingMaterial rawSeed(32, 0);
+    HDSeed seed(rawSeed);
+    wallet.LoadHDSeed(seed);
+
+    auto m = libzcash::SaplingExtendedSpendingKey::Master(seed);
+    auto m_32h_cth = m.Derive(32 | ZIP32_HARDENED_KEY_LIMIT).Derive(Params().BIP44CoinType() | ZIP32_HARDENED_KEY_LIMIT);
+
+    // A key the wallet already has is skipped
+    auto sk1 = m_32h_cth.Derive(1 | ZIP32_HARDENED_KEY_LIMIT);
+    ASSERT_TRUE(wallet.AddSaplingZKey(sk1, sk1.DefaultAddress()));
+
+    auto vAddrs = wallet.GenerateNewSaplingZKeys(3);
+    ASSERT_EQ(3, vAddrs.size());
+    EXPECT_EQ(vAddrs[0], m_32h_cth.Derive(0 | ZIP32_HARDENED_KEY_LIMIT).DefaultAddress());
+    EXPECT_EQ(vAddrs[1], m_32h_cth.Derive(2 | ZIP32_HARDENED_KEY_LIMIT).DefaultAddress());
+    EXPECT_EQ(vAddrs[2], m_32h_cth.Derive(3 | ZIP32_HARDENED_KEY_LIMIT).DefaultAddress());
+    for (const auto& addr : vAddrs)
+        EXPECT_TRUE(wallet.HaveSaplingIncomingViewingKey(addr));
+    EXPECT_TRUE(wallet.primarySaplingSpendingKey == m_32h_cth.Derive(0 | ZIP32_HARDENED_KEY_LIMIT));
+
+    // Single keys continue after the batch
+    EXPECT_EQ(wallet.GenerateNewSaplingZKey(), m_32h_cth.Derive(4 | ZIP32_HARDENED_KEY_LIMIT).DefaultAddress());
+
+    libzcash::SaplingIncomingViewingKey ivk;
+    ASSERT_TRUE(wallet.GetSaplingIncomingViewingKey(vAddrs[1], ivk));
+    EXPECT_EQ("m/32'/" + std::to_string(Params().BIP44CoinType()) + "'/2'", wallet.mapSaplingZKeyMetadata[ivk].hdKeypath);
+}
+
 /**
  * This test covers methods on CWallet
  * GenerateNewSproutZKey()
@@ -327,6 +363,38 @@ TEST(wallet_zkeys_tests, WriteViewingKeyDirectToDB) {
     ASSERT_EQ(vk, vkOut);
 }
 
+/**
+ * This test covers the key generation saved by CWallet::BumpKeyGeneration()
+ * and read back by LoadWallet()
+ */
+TEST(wallet_zkeys_tests, KeyGenerationPersisted) {
+    SelectParams(CBaseChainParams::TESTNET);
+
+    boost::filesystem::path pathTemp = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    boost::filesystem::create_directories(pathTemp);
+    mapArgs["-datadir"] = pathTemp.string();
+
+    bool fFirstRun;
+    CWallet wallet("wallet-keygen.dat");
+    ASSERT_EQ(DB_LOAD_OK, wallet.LoadWallet(fFirstRun));
+
+    CKeyingMaterial rawSeed(32, 0);
+    HDSeed seed(rawSeed);
+    wallet.LoadHDSeed(seed);
+
+    // adding a key bumps the generation
+    LOCK(wallet.cs_wallet);
+    uint64_t nGeneration = wallet.GetKeyGeneration();
+    wallet.GenerateNewSaplingZKey();
+    ASSERT_GT(wallet.GetKeyGeneration(), nGeneration);
+    nGeneration = wallet.GetKeyGeneration();
+
+    // a fresh wallet on the same file starts from the saved generation
+    CWallet wallet2("wallet-keygen.dat");
+    ASSERT_EQ(DB_LOAD_OK, wallet2.LoadWallet(fFirstRun));
+    ASSERT_EQ(nGeneration, wallet2.GetKeyGeneration());
+}
+
 
 
 /**
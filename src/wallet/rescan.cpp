@@ -0,0 +1,95 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "wallet/rescan.h"
+
+#include "chain.h"
+#include "main.h"
+#include "util.h"
+
+int nRescanPrefetchThreads = DEFAULT_RESCAN_PREFETCH_THREADS;
+
+CWalletRescanPrefetcher::CWalletRescanPrefetcher(const CWallet* pwalletIn, const std::vector<const CBlockIndex*>& vIndexIn,
+                                                 int nThreads, size_t nMaxAheadIn) :
+    pwallet(pwalletIn), vIndex(vIndexIn), nMaxAhead(std::max<size_t>(nMaxAheadIn, 1)),
+    nNextRead(0), nNextReturn(0), fStop(false)
+{
+    nThreads = std::max(1, std::min<int>(nThreads, vIndex.size()));
+    for (int i = 0; i < nThreads && !vIndex.empty(); i++) {
+        vThreads.emplace_back(&CWalletRescanPrefetcher::ThreadPrefetch, this);
+    }
+}
+
+CWalletRescanPrefetcher::~CWalletRescanPrefetcher()
+{
+    Stop();
+}
+
+void CWalletRescanPrefetcher::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        fStop = true;
+    }
+    condSpace.notify_all();
+    condReady.notify_all();
+    for (std::thread& t : vThreads) {
+        if (t.joinable())
+            t.join();
+    }
+    vThreads.clear();
+}
+
+void CWalletRescanPrefetcher::ThreadPrefetch()
+{
+    RenameThread("pirate-rescan");
+    while (true) {
+        size_t nPos;
+        {
+            std::unique_lock<std::mutex> lock(cs);
+            condSpace.wait(lock, [this] { return fStop || nNextRead >= vIndex.size() || nNextRead < nNextReturn + nMaxAhead; });
+            if (fStop || nNextRead >= vIndex.size())
+                return;
+            nPos = nNextRead++;
+        }
+
+        std::shared_ptr<CRescanBlock> pblock = std::make_shared<CRescanBlock>();
+        pblock->pindex = vIndex[nPos];
+        pblock->fRead = ReadBlockFromDisk(pblock->block, pblock->pindex, 1);
+        if (pblock->fRead) {
+            // Keys are only counted before decrypting; if one is added while
+            // we work the commit stage sees a different count and decrypts again.
+            pblock->nSaplingKeys = pwallet->GetSaplingKeyCount();
+            pblock->vSaplingNotes.resize(pblock->block.vtx.size());
+            for (size_t i = 0; i < pblock->block.vtx.size(); i++) {
+                if (!pblock->block.vtx[i].vShieldedOutput.empty())
+                    pblock->vSaplingNotes[i] = pwallet->FindMySaplingNotes(pblock->block.vtx[i]);
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(cs);
+            mapReady[nPos] = pblock;
+        }
+        condReady.notify_all();
+    }
+}
+
+bool CWalletRescanPrefetcher::Next(std::shared_ptr<CRescanBlock>& blockOut)
+{
+    {
+        std::unique_lock<std::mutex> lock(cs);
+        if (nNextReturn >= vIndex.size())
+            return false;
+        condReady.wait(lock, [this] { return fStop || mapReady.count(nNextReturn) > 0; });
+        if (fStop)
+            return false;
+        auto it = mapReady.find(nNextReturn);
+        blockOut = it->second;
+        mapReady.erase(it);
+        nNextReturn++;
+    }
+    condSpace.notify_all();
+    return true;
+}
@@ -0,0 +1,83 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef KOMODO_WALLET_RESCAN_H
+#define KOMODO_WALLET_RESCAN_H
+
+#include "primitives/block.h"
+#include "wallet/wallet.h"
+
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class CBlockIndex;
+
+//! Number of reader threads used to fetch blocks ahead of a rescan
+static const int DEFAULT_RESCAN_PREFETCH_THREADS = 2;
+//! Maximum number of blocks held in memory ahead of the rescan cursor
+static const size_t DEFAULT_RESCAN_PREFETCH_BLOCKS = 64;
+
+//! Number of reader threads of the rescans, set by -rescanthreads
+extern int nRescanPrefetchThreads;
+
+/** A block read from disk ahead of the rescan cursor, with its Sapling outputs already trial decrypted. */
+struct CRescanBlock
+{
+    const CBlockIndex* pindex;
+    CBlock block;
+    bool fRead;
+
+    //! FindMySaplingNotes results, one entry per transaction in block.vtx
+    std::vector<std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap>> vSaplingNotes;
+    //! Number of Sapling keys in the wallet when vSaplingNotes was computed
+    size_t nSaplingKeys;
+
+    CRescanBlock() : pindex(NULL), fRead(false), nSaplingKeys(0) {}
+};
+
+/**
+ * Reads and deserializes the blocks of a rescan on background threads and
+ * trial decrypts their Sapling outputs, so that ScanForWalletTransactions only
+ * has to apply the results in chain order while it holds the wallet lock.
+ *
+ * At most nMaxAhead blocks are kept in memory beyond the one last returned by
+ * Next().
+ */
+class CWalletRescanPrefetcher
+{
+public:
+    CWalletRescanPrefetcher(const CWallet* pwalletIn, const std::vector<const CBlockIndex*>& vIndexIn,
+                            int nThreads = DEFAULT_RESCAN_PREFETCH_THREADS,
+                            size_t nMaxAheadIn = DEFAULT_RESCAN_PREFETCH_BLOCKS);
+    ~CWalletRescanPrefetcher();
+
+    //! Wait for the next block in chain order. Returns false once every block has been returned.
+    bool Next(std::shared_ptr<CRescanBlock>& blockOut);
+
+    //! Stop the reader threads; Next() returns false afterwards.
+    void Stop();
+
+private:
+    void ThreadPrefetch();
+
+    const CWallet* pwallet;
+    std::vector<const CBlockIndex*> vIndex;
+    size_t nMaxAhead;
+
+    std::mutex cs;
+    std::condition_variable condReady;
+    std::condition_variable condSpace;
+    std::map<size_t, std::shared_ptr<CRescanBlock>> mapReady;
+    size_t nNextRead;
+    size_t nNextReturn;
+    bool fStop;
+
+    std::vector<std::thread> vThreads;
+};
+
+#endif // KOMODO_WALLET_RESCAN_H
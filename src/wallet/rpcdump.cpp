@@ -913,6 +913,156 @@ UniValue z_importviewingkey(const UniValue& params, bool fHelp, const CPubKey& m
   return result;
 }
 
+UniValue z_importkeys(const UniValue& params, bool fHelp, const CPubKey& mypk)
+{
+    if (!EnsureWalletIsAvailable(fHelp))
+        return NullUniValue;
+
+    if (fHelp || params.size() < 1 || params.size() > 3)
+        throw runtime_error(
+            "z_importkeys [\"key\"|{\"key\":\"key\",\"startHeight\":n},...] ( rescan startHeight )\n"
+            "\nAdds Sapling spending keys and viewing keys to your wallet, then rescans the chain once\n"
+            "from the lowest start height of the keys that were added, instead of once per key.\n"
+            "\nArguments:\n"
+            "1. keys               (array, required) The zkeys (see z_exportkey) and viewing keys (see z_exportviewingkey),\n"
+            "                      as strings or as objects with their own startHeight\n"
+            "2. rescan             (string, optional, default=\"whenkeyisnew\") Rescan the wallet for transactions - can be \"yes\", \"no\" or \"whenkeyisnew\"\n"
+            "3. startHeight        (numeric, optional, default=0) Block height to start rescan from, for keys without one\n"
+            "\nNote: This call can take minutes to complete if rescan is true, see getwalletscanstatus for its progress.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"keys\" : [                  (array) The keys, in the order given\n"
+            "    {\n"
+            "      \"kind\" : \"xxxx\",          (string) \"spending\" or \"viewing\"\n"
+            "      \"address\" : \"address\",    (string) The address of the key (for a viewing key, its default address)\n"
+            "      \"result\" : \"xxxx\",        (string) \"added\", \"exists\", or \"spendingkeyexists\" for a viewing key whose spending key is in the wallet\n"
+            "    }\n"
+            "    ,...\n"
+            "  ],\n"
+            "  \"rescanHeight\" : n          (numeric, optional) The height the rescan started from, if there was one\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("z_importkeys", "'[\"mykey\", {\"key\":\"myvkey\",\"startHeight\":30000}]'") +
+            "\nAs a JSON-RPC call\n"
+            + HelpExampleRpc("z_importkeys", "[\"mykey\", \"myvkey\"], \"yes\", 20000")
+        );
+
+    LOCK2(cs_main, pwalletMain->cs_wallet);
+
+    EnsureWalletIsUnlocked();
+
+    // Whether to perform rescan after import
+    bool fRescan = true;
+    bool fIgnoreExistingKey = true;
+    if (params.size() > 1) {
+        auto rescan = params[1].get_str();
+        if (rescan.compare("whenkeyisnew") != 0) {
+            fIgnoreExistingKey = false;
+            if (rescan.compare("no") == 0) {
+                fRescan = false;
+            } else if (rescan.compare("yes") != 0) {
+                throw JSONRPCError(
+                    RPC_INVALID_PARAMETER,
+                    "rescan must be \"yes\", \"no\" or \"whenkeyisnew\"");
+            }
+        }
+    }
+
+    // Height to rescan from, for the keys that don't have their own
+    int nDefaultHeight = 0;
+    if (params.size() > 2)
+        nDefaultHeight = params[2].get_int();
+
+    // Decode all the keys before adding any, so a typo doesn't leave half of them imported
+    const UniValue& keys = params[0].get_array();
+    std::vector<std::pair<libzcash::SpendingKey, libzcash::ViewingKey>> vKeys;
+    std::vector<bool> vIsSpendingKey;
+    std::vector<int> vHeights;
+    for (size_t i = 0; i < keys.size(); i++) {
+        std::string strKey;
+        int nHeight = nDefaultHeight;
+        if (keys[i].isStr()) {
+            strKey = keys[i].get_str();
+        } else if (keys[i].isObject()) {
+            const UniValue& key = find_value(keys[i], "key");
+            if (!key.isStr())
+                throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Key %u is missing its key", i));
+            strKey = key.get_str();
+            const UniValue& height = find_value(keys[i], "startHeight");
+            if (!height.isNull())
+                nHeight = height.get_int();
+        } else {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Key %u must be a string or an object", i));
+        }
+        if (nHeight < 0 || nHeight > chainActive.Height())
+            throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Block height of key %u out of range", i));
+
+        auto spendingkey = DecodeSpendingKey(strKey);
+        if (IsValidSpendingKey(spendingkey)) {
+            if (boost::get<libzcash::SaplingExtendedSpendingKey>(&spendingkey) == nullptr)
+                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, strprintf("Invalid spending key %u, Sprout not supported", i));
+            vKeys.push_back(std::make_pair(spendingkey, libzcash::ViewingKey()));
+            vIsSpendingKey.push_back(true);
+        } else {
+            auto viewingkey = DecodeViewingKey(strKey);
+            if (!IsValidViewingKey(viewingkey))
+                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, strprintf("Invalid spending or viewing key %u", i));
+            if (boost::get<libzcash::SaplingExtendedFullViewingKey>(&viewingkey) == nullptr)
+                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, strprintf("Invalid viewing key %u, Sprout not supported", i));
+            vKeys.push_back(std::make_pair(libzcash::SpendingKey(), viewingkey));
+            vIsSpendingKey.push_back(false);
+        }
+        vHeights.push_back(nHeight);
+    }
+
+    UniValue results(UniValue::VARR);
+    int nRescanHeight = -1;
+    for (size_t i = 0; i < vKeys.size(); i++) {
+        UniValue entry(UniValue::VOBJ);
+        KeyAddResult addResult;
+        if (vIsSpendingKey[i]) {
+            const libzcash::SpendingKey& spendingkey = vKeys[i].first;
+            addResult = boost::apply_visitor(AddSpendingKeyToWallet(pwalletMain, Params().GetConsensus()), spendingkey);
+            auto zInfo = boost::apply_visitor(libzcash::AddressInfoFromSpendingKey{}, spendingkey);
+            if (addResult == KeyAdded)
+                pwalletMain->SetZAddressBook(zInfo.second, zInfo.first, "");
+            entry.pushKV("kind", "spending");
+            entry.pushKV("address", EncodePaymentAddress(zInfo.second));
+        } else {
+            const libzcash::ViewingKey& viewingkey = vKeys[i].second;
+            addResult = boost::apply_visitor(AddViewingKeyToWallet(pwalletMain), viewingkey);
+            auto addrInfo = boost::apply_visitor(libzcash::AddressInfoFromViewingKey{}, viewingkey);
+            if (addResult == KeyAdded)
+                pwalletMain->SetZAddressBook(addrInfo.second, addrInfo.first, "");
+            entry.pushKV("kind", "viewing");
+            entry.pushKV("address", EncodePaymentAddress(addrInfo.second));
+        }
+        if (addResult == KeyNotAdded)
+            throw JSONRPCError(RPC_WALLET_ERROR, strprintf("Error adding key %u to wallet", i));
+        entry.pushKV("result", addResult == KeyAdded ? "added" : addResult == KeyAlreadyExists ? "exists" : "spendingkeyexists");
+        results.push_back(entry);
+
+        // Keys that were there only count for the rescan when it is forced
+        bool fScanKey = addResult == KeyAdded || (addResult == KeyAlreadyExists && !fIgnoreExistingKey);
+        if (fScanKey && (nRescanHeight < 0 || vHeights[i] < nRescanHeight))
+            nRescanHeight = vHeights[i];
+    }
+    pwalletMain->MarkDirty();
+
+    // whenever a key is imported, we need to scan the whole chain
+    pwalletMain->nTimeFirstKey = 1; // 0 would be considered 'no value'
+
+    UniValue result(UniValue::VOBJ);
+    result.pushKV("keys", results);
+    // One scan for all the keys, the outputs of each block are decrypted with all of them at once
+    if (fRescan && nRescanHeight >= 0) {
+        pwalletMain->ScanForWalletTransactions(chainActive[nRescanHeight], true, true);
+        result.pushKV("rescanHeight", nRescanHeight);
+    }
+
+    return result;
+}
+
 UniValue z_exportkey(const UniValue& params, bool fHelp, const CPubKey& mypk)
 {
     if (!EnsureWalletIsAvailable(fHelp))
@@ -236,6 +236,7 @@ void getSproutReceives(RpcTx &tx, vector<TransactionReceivedZC> &vReceived, bool
 template<typename RpcTx>
 void getSaplingSpends(RpcTx &tx, std::set<uint256> &ivks, std::set<uint256> &ivksOut, vector<TransactionSpendZS> &vSpend, bool fIncludeWatchonly) {
     // Sapling Inputs belonging to the wallet
+    const std::vector<uint256> vIvks(ivks.begin(), ivks.end());
     for (int i = 0; i < tx.vShieldedSpend.size(); i++) {
 
         TransactionSpendZS spend;
@@ -278,29 +279,25 @@ void getSaplingSpends(RpcTx &tx, std::set<uint256> &ivks, std::set<uint256> &ivk
             }
         }
 
-        for (std::set<uint256>::iterator it = ivks.begin(); it != ivks.end(); it++) {
-            auto ivk = SaplingIncomingViewingKey(*it);
-            auto pt = libzcash::SaplingNotePlaintext::decrypt(output.encCiphertext,ivk,output.ephemeralKey,output.cm);
-
-            if (pt) {
-                ivksOut.insert(ivk);
-                auto note = pt.get();
-                auto pa = ivk.address(note.d);
-                auto address = pa.get();
-                spend.encodedAddress = EncodePaymentAddress(address);
-                spend.amount = note.value();
-                spend.spendShieldedOutputIndex = (int)op.n;
-                spend.spendTxid = op.hash.ToString();
-
-                libzcash::SaplingExtendedFullViewingKey extfvk;
-                pwalletMain->GetSaplingFullViewingKey(ivk, extfvk);
-                spend.spendable = pwalletMain->HaveSaplingSpendingKey(extfvk);
-
-                if (spend.spendable || fIncludeWatchonly)
-                    vSpend.push_back(spend);
-                //ivk found no need ot try anymore
-                break;
-            }
+        // The first key that decrypts the output, of all those tried at once
+        auto matches = libzcash::SaplingNotePlaintext::decrypt_batch(output.encCiphertext,vIvks,output.ephemeralKey,output.cm);
+        if (!matches.empty()) {
+            auto ivk = SaplingIncomingViewingKey(vIvks[matches[0].first]);
+            ivksOut.insert(ivk);
+            auto note = matches[0].second;
+            auto pa = ivk.address(note.d);
+            auto address = pa.get();
+            spend.encodedAddress = EncodePaymentAddress(address);
+            spend.amount = note.value();
+            spend.spendShieldedOutputIndex = (int)op.n;
+            spend.spendTxid = op.hash.ToString();
+
+            libzcash::SaplingExtendedFullViewingKey extfvk;
+            pwalletMain->GetSaplingFullViewingKey(ivk, extfvk);
+            spend.spendable = pwalletMain->HaveSaplingSpendingKey(extfvk);
+
+            if (spend.spendable || fIncludeWatchonly)
+                vSpend.push_back(spend);
         }
 
     }
@@ -364,48 +361,49 @@ void getSaplingSends(RpcTx &tx, std::set<uint256> &ovks, std::set<uint256> &ovks
 template<typename RpcTx>
 void getSaplingReceives(RpcTx &tx, std::set<uint256> &ivks, std::set<uint256> &ivksOut, vector<TransactionReceivedZS> &vReceived, bool fIncludeWatchonly) {
 
+    // Every output against every key at once, on the -zdecryptthreads workers.
+    // A result holds the first key of ivks that decrypts the output, the one
+    // trying the keys in turn stopped at.
+    std::vector<SaplingIncomingViewingKey> vIvks(ivks.begin(), ivks.end());
+    std::vector<SaplingTrialDecryptionResult> vResults;
+    CWallet::TrialDecryptSaplingOutputs(tx.vShieldedOutput, vIvks, vResults);
+
     for (int i = 0; i < tx.vShieldedOutput.size(); i++) {
         TransactionReceivedZS received;
-        const OutputDescription& output = tx.vShieldedOutput[i];
-
-        for (std::set<uint256>::iterator it = ivks.begin(); it != ivks.end(); it++) {
-            auto ivk = SaplingIncomingViewingKey(*it);
-            auto pt = libzcash::SaplingNotePlaintext::decrypt(output.encCiphertext,ivk,output.ephemeralKey,output.cm);
-
-            if (pt) {
-                ivksOut.insert(ivk);
-                auto note = pt.get();
-                auto pa = ivk.address(note.d);
-                auto address = pa.get();
-                auto memo = note.memo();
-                received.encodedAddress = EncodePaymentAddress(address);
-                received.amount = note.value();
-                received.shieldedOutputIndex = i;
-                received.memo = HexStr(memo);
-
-                libzcash::SaplingExtendedFullViewingKey extfvk;
-                pwalletMain->GetSaplingFullViewingKey(ivk, extfvk);
-                received.spendable = pwalletMain->HaveSaplingSpendingKey(extfvk);
-
-                // If the leading byte is 0xF4 or lower, the memo field should be interpreted as a
-                // UTF-8-encoded text string.
-                if (memo[0] <= 0xf4) {
-                    // Trim off trailing zeroes
-                    auto end = std::find_if(
-                        memo.rbegin(),
-                        memo.rend(),
-                        [](unsigned char v) { return v != 0; });
-                    std::string memoStr(memo.begin(), end.base());
-                    if (utf8::is_valid(memoStr)) {
-                        received.memoStr = memoStr;
-                    }
-                }
+        auto pt = vResults[i].plaintext;
+
+        if (pt) {
+            auto ivk = vIvks[vResults[i].nKey];
+            ivksOut.insert(ivk);
+            auto note = pt.get();
+            auto pa = ivk.address(note.d);
+            auto address = pa.get();
+            auto memo = note.memo();
+            received.encodedAddress = EncodePaymentAddress(address);
+            received.amount = note.value();
+            received.shieldedOutputIndex = i;
+            received.memo = HexStr(memo);
 
-                if (received.spendable || fIncludeWatchonly)
-                    vReceived.push_back(received);
-                //ivk found no need to try anymore
-                break;
+            libzcash::SaplingExtendedFullViewingKey extfvk;
+            pwalletMain->GetSaplingFullViewingKey(ivk, extfvk);
+            received.spendable = pwalletMain->HaveSaplingSpendingKey(extfvk);
+
+            // If the leading byte is 0xF4 or lower, the memo field should be interpreted as a
+            // UTF-8-encoded text string.
+            if (memo[0] <= 0xf4) {
+                // Trim off trailing zeroes
+                auto end = std::find_if(
+                    memo.rbegin(),
+                    memo.rend(),
+                    [](unsigned char v) { return v != 0; });
+                std::string memoStr(memo.begin(), end.base());
+                if (utf8::is_valid(memoStr)) {
+                    received.memoStr = memoStr;
+                }
             }
+
+            if (received.spendable || fIncludeWatchonly)
+                vReceived.push_back(received);
         }
     }
 }
@@ -471,6 +469,21 @@ void getAllSaplingIVKs(std::set<uint256> &ivks, bool fIncludeWatchonly) {
 }
 
 
+bool saveRpcArcTx(CWalletDB &walletdb, const RpcArcTransaction &arcTx, bool fIncludeWatchonly) {
+    AssertLockHeld(cs_main);
+    // Archived transactions getRpcArcTx did not find in the active chain
+    if (arcTx.archiveType == ARCHIVED && arcTx.blockHash.IsNull())
+        return false;
+
+    RpcArcTxRecord record;
+    record.nKeyGeneration = pwalletMain->GetKeyGeneration();
+    BlockMap::const_iterator mi = mapBlockIndex.find(arcTx.blockHash);
+    if (!arcTx.blockHash.IsNull() && mi != mapBlockIndex.end() && mi->second != NULL)
+        record.nHeight = mi->second->GetHeight();
+    record.arcTx = arcTx;
+    return walletdb.WriteRpcArcTx(arcTx.txid, fIncludeWatchonly, record);
+}
+
 void getRpcArcTx(uint256 &txid, RpcArcTransaction &arcTx, bool fIncludeWatchonly, bool rescan) {
 
     LOCK2(cs_main, pwalletMain->cs_wallet);
@@ -520,6 +533,23 @@ void getRpcArcTx(uint256 &txid, RpcArcTransaction &arcTx, bool fIncludeWatchonly
             return;
         }
 
+        // Decoded before, unless a key was added since or the transaction moved to another block
+        RpcArcTxRecord record;
+        if (!rescan && CWalletDB(pwalletMain->strWalletFile).ReadRpcArcTx(txid, fIncludeWatchonly, record) &&
+            record.nKeyGeneration == pwalletMain->GetKeyGeneration() && record.arcTx.blockHash == hashBlock) {
+            arcTx = record.arcTx;
+            // The record may be of when it was still a wallet transaction
+            arcTx.archiveType = ARCHIVED;
+            arcTx.category = arcTx.coinbase ? "generate" : "standard";
+            arcTx.nTime = arcTx.nBlockTime;
+            arcTx.expiryHeight = 0;
+            int nHeight = chainActive.Tip()->GetHeight();
+            int txHeight = pindex->GetHeight();
+            arcTx.rawconfirmations = nHeight - txHeight + 1;
+            arcTx.confirmations = komodo_dpowconfs(txHeight, nHeight - txHeight + 1);
+            return;
+        }
+
         //Get Tx from block
         CBlock block;
         ReadBlockFromDisk(block, pindex, 1);
@@ -611,7 +641,6 @@ void getRpcArcTx(uint256 &txid, RpcArcTransaction &arcTx, bool fIncludeWatchonly
     for(int i = 0; i < arcTx.vZsReceived.size(); i++) {
         arcTx.addresses.insert(arcTx.vZsReceived[i].encodedAddress);
     }
-
 }
 
 void getRpcArcTx(CWalletTx &tx, RpcArcTransaction &arcTx, bool fIncludeWatchonly, bool rescan) {
@@ -910,6 +939,239 @@ void getRpcArcTxJSONReceives(RpcArcTransaction &arcTx, UniValue& ArcTxJSON, bool
     }
 }
 
+/**
+ * What zs_listtransactions and the per address list RPCs report, built by
+ * GetRpcArcTxSnapshot from the decoded transactions and published for them to
+ * read without cs_main or cs_wallet. Published snapshots are never modified.
+ */
+class RpcArcTxSnapshot
+{
+public:
+    //! A listed transaction, with what changes as the chain grows filled in as of pindexTip
+    struct Entry {
+        std::shared_ptr<const RpcArcTxRecord> record;
+        int rawconfirmations;
+        int confirmations;
+        string category;
+
+        RpcArcTransaction Get() const {
+            RpcArcTransaction arcTx = record->arcTx;
+            arcTx.rawconfirmations = rawconfirmations;
+            arcTx.confirmations = confirmations;
+            arcTx.category = category;
+            return arcTx;
+        }
+    };
+
+    //! What it was built from, it is stale once any of them changed
+    uint64_t nKeyGeneration;
+    uint64_t nTxGeneration;
+    const CBlockIndex* pindexTip;
+    int nHeight;
+
+    //! The decoded transactions of the wallet, reused by the next snapshot
+    std::map<uint256, std::shared_ptr<const RpcArcTxRecord>> mapRecords;
+    //! By height and position in the block, those not in a block yet after the tip
+    std::map<std::pair<int,int>, Entry> mapListed;
+
+    RpcArcTxSnapshot() : nKeyGeneration(0), nTxGeneration(0), pindexTip(NULL), nHeight(-1) {}
+};
+
+//! Held while a snapshot is rebuilt, the snapshots are only accessed through std::atomic_load and std::atomic_store
+static CCriticalSection cs_arcTxSnapshot;
+//! Without and with watch-only transactions
+static std::shared_ptr<const RpcArcTxSnapshot> arcTxSnapshots[2];
+
+static bool IsCurrentRpcArcTxSnapshot(const std::shared_ptr<const RpcArcTxSnapshot>& snapshot) {
+    return snapshot &&
+        snapshot->pindexTip == GetChainTipSnapshot()->pindexTip &&
+        snapshot->nKeyGeneration == pwalletMain->GetKeyGeneration() &&
+        snapshot->nTxGeneration == pwalletMain->GetTxGeneration();
+}
+
+/**
+ * The published snapshot, rebuilt first if the chain tip or the wallet moved
+ * on. A rebuild reads the records it lacks from the wallet db without holding
+ * any lock, then holds cs_main and cs_wallet only to order the transactions
+ * and fill in their confirmations; transactions are only read from their
+ * block and trial decrypted when they have no valid record, and those records
+ * are saved after the locks are released.
+ */
+static std::shared_ptr<const RpcArcTxSnapshot> GetRpcArcTxSnapshot(bool fIncludeWatchonly) {
+    std::shared_ptr<const RpcArcTxSnapshot> snapshot = std::atomic_load(&arcTxSnapshots[fIncludeWatchonly]);
+    if (IsCurrentRpcArcTxSnapshot(snapshot))
+        return snapshot;
+
+    LOCK(cs_arcTxSnapshot);
+    snapshot = std::atomic_load(&arcTxSnapshots[fIncludeWatchonly]);
+    if (IsCurrentRpcArcTxSnapshot(snapshot))
+        return snapshot;
+
+    std::vector<uint256> vMissing;
+    {
+        LOCK(pwalletMain->cs_wallet);
+        for (map<uint256, ArchiveTxPoint>::const_iterator it = pwalletMain->mapArcTxs.begin(); it != pwalletMain->mapArcTxs.end(); ++it) {
+            if (!snapshot || !snapshot->mapRecords.count(it->first))
+                vMissing.push_back(it->first);
+        }
+        for (map<uint256, CWalletTx>::const_iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); ++it) {
+            if ((!snapshot || !snapshot->mapRecords.count(it->first)) && !pwalletMain->mapArcTxs.count(it->first))
+                vMissing.push_back(it->first);
+        }
+    }
+
+    std::map<uint256, std::shared_ptr<const RpcArcTxRecord>> mapRead;
+    if (!vMissing.empty()) {
+        CWalletDB walletdb(pwalletMain->strWalletFile);
+        for (const uint256& txid : vMissing) {
+            std::shared_ptr<RpcArcTxRecord> record = std::make_shared<RpcArcTxRecord>();
+            if (walletdb.ReadRpcArcTx(txid, fIncludeWatchonly, *record))
+                mapRead[txid] = record;
+        }
+    }
+
+    std::shared_ptr<RpcArcTxSnapshot> next = std::make_shared<RpcArcTxSnapshot>();
+    std::vector<std::shared_ptr<const RpcArcTxRecord>> vDecoded;
+    {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+        next->nKeyGeneration = pwalletMain->GetKeyGeneration();
+        next->nTxGeneration = pwalletMain->GetTxGeneration();
+        // Stamped with the published tip, which only lags chainActive while an invalidated block is unwound
+        next->pindexTip = GetChainTipSnapshot()->pindexTip;
+        next->nHeight = chainActive.Height();
+
+        // A record of the last snapshot or from the db, if it is still valid
+        auto findRecord = [&](const uint256& txid, const uint256& hashBlock) {
+            std::shared_ptr<const RpcArcTxRecord> record;
+            if (snapshot) {
+                std::map<uint256, std::shared_ptr<const RpcArcTxRecord>>::const_iterator it = snapshot->mapRecords.find(txid);
+                if (it != snapshot->mapRecords.end())
+                    record = it->second;
+            }
+            if (!record) {
+                std::map<uint256, std::shared_ptr<const RpcArcTxRecord>>::const_iterator it = mapRead.find(txid);
+                if (it != mapRead.end())
+                    record = it->second;
+            }
+            if (record && (record->nKeyGeneration != next->nKeyGeneration || record->arcTx.blockHash != hashBlock))
+                record.reset();
+            return record;
+        };
+
+        //Archived Transactions, in their block while it is in the active chain
+        for (map<uint256, ArchiveTxPoint>::const_iterator it = pwalletMain->mapArcTxs.begin(); it != pwalletMain->mapArcTxs.end(); ++it) {
+            uint256 txid = it->first;
+            if (pwalletMain->mapWallet.count(txid) || it->second.hashBlock.IsNull())
+                continue;
+
+            std::shared_ptr<const RpcArcTxRecord> record = findRecord(txid, it->second.hashBlock);
+            if (!record) {
+                std::shared_ptr<RpcArcTxRecord> decoded = std::make_shared<RpcArcTxRecord>();
+                getRpcArcTx(txid, decoded->arcTx, fIncludeWatchonly, false);
+                if (decoded->arcTx.blockHash.IsNull())
+                    continue;
+                decoded->nKeyGeneration = next->nKeyGeneration;
+                decoded->nHeight = mapBlockIndex[decoded->arcTx.blockHash]->GetHeight();
+                record = decoded;
+                vDecoded.push_back(record);
+            }
+            next->mapRecords[txid] = record;
+
+            const CBlockIndex* pindex = chainActive[record->nHeight];
+            if (pindex == NULL || pindex->GetBlockHash() != record->arcTx.blockHash)
+                continue;
+
+            RpcArcTxSnapshot::Entry entry;
+            entry.record = record;
+            entry.rawconfirmations = next->nHeight - record->nHeight + 1;
+            entry.confirmations = komodo_dpowconfs(record->nHeight, entry.rawconfirmations);
+            entry.category = record->arcTx.coinbase ? "generate" : "standard";
+            next->mapListed[make_pair(record->nHeight, record->arcTx.blockIndex)] = entry;
+        }
+
+        //Wallet Transactions, those not in a block yet after the tip
+        int nPosUnconfirmed = 0;
+        for (map<uint256, CWalletTx>::const_iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); ++it) {
+            const CWalletTx& wtx = it->second;
+
+            if (!CheckFinalTx(wtx))
+                continue;
+
+            int nDepth = wtx.GetDepthInMainChain();
+            if (nDepth < 0)
+                continue;
+
+            if (wtx.mapSaplingNoteData.size() == 0 && wtx.mapSproutNoteData.size() == 0 && !wtx.IsTrusted())
+                continue;
+
+            std::shared_ptr<const RpcArcTxRecord> record = findRecord(wtx.GetHash(), wtx.hashBlock);
+            if (record && record->arcTx.blockIndex != wtx.nIndex)
+                record.reset();
+            if (!record) {
+                std::shared_ptr<RpcArcTxRecord> decoded = std::make_shared<RpcArcTxRecord>();
+                CWalletTx tx = wtx;
+                getRpcArcTx(tx, decoded->arcTx, fIncludeWatchonly, false);
+                decoded->nKeyGeneration = next->nKeyGeneration;
+                BlockMap::const_iterator mi = mapBlockIndex.find(wtx.hashBlock);
+                if (!wtx.hashBlock.IsNull() && mi != mapBlockIndex.end() && mi->second != NULL)
+                    decoded->nHeight = mi->second->GetHeight();
+                record = decoded;
+                vDecoded.push_back(record);
+            }
+            next->mapRecords[wtx.GetHash()] = record;
+
+            RpcArcTxSnapshot::Entry entry;
+            entry.record = record;
+            entry.rawconfirmations = nDepth;
+            entry.confirmations = record->nHeight >= 0 ? komodo_dpowconfs(record->nHeight, nDepth) : 0;
+            entry.category = record->arcTx.category;
+            if (wtx.IsCoinBase()) {
+                if (nDepth < 1)
+                    entry.category = "orphan";
+                else if (wtx.GetBlocksToMaturity() > 0)
+                    entry.category = "immature";
+                else
+                    entry.category = "generate";
+            }
+
+            if (nDepth > 0 && record->nHeight >= 0)
+                next->mapListed[make_pair(record->nHeight, wtx.nIndex)] = entry;
+            else
+                next->mapListed[make_pair(next->nHeight + 1, nPosUnconfirmed++)] = entry;
+        }
+    }
+
+    if (!vDecoded.empty()) {
+        CWalletDB walletdb(pwalletMain->strWalletFile);
+        for (const std::shared_ptr<const RpcArcTxRecord>& record : vDecoded)
+            walletdb.WriteRpcArcTx(record->arcTx.txid, fIncludeWatchonly, *record);
+    }
+
+    std::atomic_store(&arcTxSnapshots[fIncludeWatchonly], std::shared_ptr<const RpcArcTxSnapshot>(next));
+    return next;
+}
+
+//! The minimum confirmations and filter type arguments of the list RPCs
+static bool filterRpcArcTx(const RpcArcTxSnapshot::Entry& entry, int nHeight, int64_t nMinConfirms, int64_t nFilterType, int64_t nFilter, uint64_t t) {
+    //Exclude transactions with block height lower the type 3 filter minimum
+    if (nFilterType == 3 && nHeight < nFilter)
+        return false;
+
+    //Excude transactions with less confirmations than required
+    if (entry.rawconfirmations < nMinConfirms)
+        return false;
+
+    //Exclude Transactions older that max days old
+    if (entry.rawconfirmations > 0 && nFilterType == 1 && entry.record->arcTx.nBlockTime < (t - (nFilter * 60 * 60 * 24)))
+        return false;
+
+    //Exclude transactions with greater than max confirmations
+    if (nFilterType == 2 && entry.rawconfirmations > nFilter)
+        return false;
+
+    return true;
+}
+
 UniValue zs_listtransactions(const UniValue& params, bool fHelp, const CPubKey& mypk)
 {
   if (!EnsureWalletIsAvailable(fHelp))
@@ -1010,8 +1272,6 @@ UniValue zs_listtransactions(const UniValue& params, bool fHelp, const CPubKey&
         + HelpExampleRpc("zs_listtransactions", "1 1 30 200")
     );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
-
     UniValue ret(UniValue::VARR);
 
     //param values`
@@ -1046,103 +1306,18 @@ UniValue zs_listtransactions(const UniValue& params, bool fHelp, const CPubKey&
     if (nFilter < 0)
         throw runtime_error("Filter must be equal or greater than 0.");
 
-    //get Sorted Archived Transactions
-    std::map<std::pair<int,int>, uint256> sortedArchive;
-    for (map<uint256, ArchiveTxPoint>::iterator it = pwalletMain->mapArcTxs.begin(); it != pwalletMain->mapArcTxs.end(); ++it)
-    {
-      uint256 txid = (*it).first;
-      ArchiveTxPoint arcTxPt = (*it).second;
-      std::pair<int,int> key;
-
-      if (!arcTxPt.hashBlock.IsNull() && mapBlockIndex[arcTxPt.hashBlock] != nullptr) {
-        key = make_pair(mapBlockIndex[arcTxPt.hashBlock]->GetHeight(), arcTxPt.nIndex);
-        sortedArchive[key] = txid;
-      }
-    }
-
-    //add any missing wallet transactions - unconfimred & conflicted
-    int nPosUnconfirmed = 0;
-    for (map<uint256,CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); ++it) {
-      CWalletTx wtx = (*it).second;
-      std::pair<int,int> key;
-
-      if (wtx.GetDepthInMainChain() == 0) {
-        key = make_pair(chainActive.Tip()->GetHeight() + 1,  nPosUnconfirmed);
-        sortedArchive[key] = wtx.GetHash();
-        nPosUnconfirmed++;
-      } else if (!wtx.hashBlock.IsNull() && mapBlockIndex[wtx.hashBlock] != nullptr) {
-        key = make_pair(mapBlockIndex[wtx.hashBlock]->GetHeight(), wtx.nIndex);
-        sortedArchive[key] = wtx.GetHash();
-      } else {
-        key = make_pair(chainActive.Tip()->GetHeight() + 1,  nPosUnconfirmed);
-        sortedArchive[key] = wtx.GetHash();
-        nPosUnconfirmed++;
-      }
-
-    }
+    std::shared_ptr<const RpcArcTxSnapshot> snapshot = GetRpcArcTxSnapshot(fIncludeWatchonly);
 
     uint64_t t = GetTime();
-    int chainHeight = chainActive.Tip()->GetHeight();
     //Reverse Iterate thru transactions
-    for (map<std::pair<int,int>, uint256>::reverse_iterator it = sortedArchive.rbegin(); it != sortedArchive.rend(); ++it)
+    for (map<std::pair<int,int>, RpcArcTxSnapshot::Entry>::const_reverse_iterator it = snapshot->mapListed.rbegin(); it != snapshot->mapListed.rend(); ++it)
     {
-        uint256 txid = (*it).second;
-        RpcArcTransaction arcTx;
+        const RpcArcTxSnapshot::Entry& entry = (*it).second;
 
-        //Exclude transactions with block height lower the type 3 filter minimum
-        if (nFilterType == 3 && (*it).first.first < nFilter)
+        if (!filterRpcArcTx(entry, (*it).first.first, nMinConfirms, nFilterType, nFilter, t))
             continue;
 
-        if (pwalletMain->mapWallet.count(txid)) {
-
-            CWalletTx& wtx = pwalletMain->mapWallet[txid];
-
-            if (!CheckFinalTx(wtx))
-                continue;
-
-            if (wtx.GetDepthInMainChain() < 0)
-                continue;
-
-            if (wtx.mapSaplingNoteData.size() == 0 && wtx.mapSproutNoteData.size() == 0 && !wtx.IsTrusted())
-                continue;
-
-            //Excude transactions with less confirmations than required
-            if (wtx.GetDepthInMainChain() < nMinConfirms)
-                continue;
-
-            //Exclude Transactions older that max days old
-            if (wtx.GetDepthInMainChain() > 0 && nFilterType == 1 && mapBlockIndex[wtx.hashBlock]->GetBlockTime() < (t - (nFilter * 60 * 60 * 24)))
-                continue;
-
-            //Exclude transactions with greater than max confirmations
-            if (nFilterType == 2 && wtx.GetDepthInMainChain() > nFilter)
-                continue;
-
-            getRpcArcTx(wtx, arcTx, fIncludeWatchonly, false);
-
-        } else {
-
-            int confirms = chainHeight - (*it).first.first + 1;
-
-            //Excude transactions with less confirmations than required
-            if (confirms < nMinConfirms)
-                continue;
-
-            //Exclude transactions with greater than max confirmations
-            if (nFilterType == 2 && confirms > nFilter)
-                continue;
-
-            //Archived Transactions
-            getRpcArcTx(txid, arcTx, fIncludeWatchonly, false);
-
-            if (arcTx.blockHash.IsNull() || mapBlockIndex[arcTx.blockHash] == nullptr)
-                continue;
-
-            //Exclude Transactions older that max days old
-            if (confirms > 0 && nFilterType == 1 && mapBlockIndex[arcTx.blockHash]->GetBlockTime() < (t - (nFilter * 60 * 60 * 24)))
-                continue;
-
-        }
+        RpcArcTransaction arcTx = entry.Get();
 
         UniValue txObj(UniValue::VOBJ);
         getRpcArcTxJSONHeader(arcTx, txObj);
@@ -1353,8 +1528,6 @@ UniValue zs_listspentbyaddress(const UniValue& params, bool fHelp, const CPubKey
         + HelpExampleRpc("zs_listspentbyaddress", "t1KzZ5n2TPEGYXTZ3WYGL1AYEumEQaRoHaL")
     );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
-
     UniValue ret(UniValue::VARR);
 
     //param values`
@@ -1414,126 +1587,22 @@ UniValue zs_listspentbyaddress(const UniValue& params, bool fHelp, const CPubKey
     if (!isTAddress && !isZcAddress && !isZsAddress)
         return ret;
 
-    //Get set of txids that the encoded address was used in
-    std::map<std::string, std::set<uint256>>::iterator ait;
-    ait = pwalletMain->mapAddressTxids.find(encodedAddress);
-    std::set<uint256> txids;
-
-    if (ait != pwalletMain->mapAddressTxids.end()) {
-        txids = ait->second;
-    } else {
-        return ret;
-    }
-
-    //get Sorted Archived Transactions
-    std::map<std::pair<int,int>, uint256> sortedArchive;
-    for (map<uint256, ArchiveTxPoint>::iterator it = pwalletMain->mapArcTxs.begin(); it != pwalletMain->mapArcTxs.end(); ++it)
-    {
-      uint256 txid = (*it).first;
-      ArchiveTxPoint arcTxPt = (*it).second;
-      std::pair<int,int> key;
-
-      std::set<uint256>::iterator txit;
-      txit = txids.find(txid);
-      if (txit == txids.end()) {
-          continue;
-      }
-
-      if (!arcTxPt.hashBlock.IsNull() && mapBlockIndex[arcTxPt.hashBlock] != nullptr) {
-        key = make_pair(mapBlockIndex[arcTxPt.hashBlock]->GetHeight(), arcTxPt.nIndex);
-        sortedArchive[key] = txid;
-      }
-    }
-
-    //add any missing wallet transactions - unconfimred & conflicted
-    int nPosUnconfirmed = 0;
-    for (map<uint256,CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); ++it) {
-      CWalletTx wtx = (*it).second;
-      std::pair<int,int> key;
-
-      std::set<uint256>::iterator txit;
-      txit = txids.find(wtx.GetHash());
-      if (txit == txids.end()) {
-          continue;
-      }
-
-      if (wtx.GetDepthInMainChain() == 0) {
-        key = make_pair(chainActive.Tip()->GetHeight() + 1,  nPosUnconfirmed);
-        sortedArchive[key] = wtx.GetHash();
-        nPosUnconfirmed++;
-      } else if (!wtx.hashBlock.IsNull() && mapBlockIndex[wtx.hashBlock] != nullptr) {
-        key = make_pair(mapBlockIndex[wtx.hashBlock]->GetHeight(), wtx.nIndex);
-        sortedArchive[key] = wtx.GetHash();
-      } else {
-        key = make_pair(chainActive.Tip()->GetHeight() + 1,  nPosUnconfirmed);
-        sortedArchive[key] = wtx.GetHash();
-        nPosUnconfirmed++;
-      }
-
-    }
+    std::shared_ptr<const RpcArcTxSnapshot> snapshot = GetRpcArcTxSnapshot(fIncludeWatchonly);
 
     uint64_t t = GetTime();
-    int chainHeight = chainActive.Tip()->GetHeight();
     //Reverse Iterate thru transactions
-    for (map<std::pair<int,int>, uint256>::reverse_iterator it = sortedArchive.rbegin(); it != sortedArchive.rend(); ++it)
+    for (map<std::pair<int,int>, RpcArcTxSnapshot::Entry>::const_reverse_iterator it = snapshot->mapListed.rbegin(); it != snapshot->mapListed.rend(); ++it)
     {
-        uint256 txid = (*it).second;
-        RpcArcTransaction arcTx;
+        const RpcArcTxSnapshot::Entry& entry = (*it).second;
 
-        //Exclude transactions with block height lower the type 3 filter minimum
-        if (nFilterType == 3 && (*it).first.first < nFilter)
+        //Only transactions the encoded address was used in
+        if (!entry.record->arcTx.addresses.count(encodedAddress))
             continue;
 
-        if (pwalletMain->mapWallet.count(txid)) {
-
-            CWalletTx& wtx = pwalletMain->mapWallet[txid];
-
-            if (!CheckFinalTx(wtx))
-                continue;
-
-            if (wtx.GetDepthInMainChain() < 0)
-                continue;
-
-            if (wtx.mapSaplingNoteData.size() == 0 && wtx.mapSproutNoteData.size() == 0 && !wtx.IsTrusted())
-                continue;
-
-            //Excude transactions with less confirmations than required
-            if (wtx.GetDepthInMainChain() < nMinConfirms)
-                continue;
-
-            //Exclude Transactions older that max days old
-            if (wtx.GetDepthInMainChain() > 0 && nFilterType == 1 && mapBlockIndex[wtx.hashBlock]->GetBlockTime() < (t - (nFilter * 60 * 60 * 24)))
-                continue;
-
-            //Exclude transactions with greater than max confirmations
-            if (nFilterType == 2 && wtx.GetDepthInMainChain() > nFilter)
-                continue;
-
-            getRpcArcTx(wtx, arcTx, fIncludeWatchonly, false);
-
-        } else {
-
-            int confirms = chainHeight - (*it).first.first + 1;
-
-            //Excude transactions with less confirmations than required
-            if (confirms < nMinConfirms)
-                continue;
-
-            //Exclude transactions with greater than max confirmations
-            if (nFilterType == 2 && confirms > nFilter)
-                continue;
-
-            //Archived Transactions
-            getRpcArcTx(txid, arcTx, fIncludeWatchonly, false);
+        if (!filterRpcArcTx(entry, (*it).first.first, nMinConfirms, nFilterType, nFilter, t))
+            continue;
 
-            if (arcTx.blockHash.IsNull() || mapBlockIndex[arcTx.blockHash] == nullptr)
-                continue;
-
-            //Exclude Transactions older that max days old
-            if (confirms > 0 && nFilterType == 1 && mapBlockIndex[arcTx.blockHash]->GetBlockTime() < (t - (nFilter * 60 * 60 * 24)))
-                continue;
-
-        }
+        RpcArcTransaction arcTx = entry.Get();
 
         bool containsAddress = false;
         UniValue txObj(UniValue::VOBJ);
@@ -1644,8 +1713,6 @@ UniValue zs_listreceivedbyaddress(const UniValue& params, bool fHelp, const CPub
         + HelpExampleRpc("zs_listreceivedbyaddress", "t1KzZ5n2TPEGYXTZ3WYGL1AYEumEQaRoHaL")
     );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
-
     UniValue ret(UniValue::VARR);
 
     //param values`
@@ -1705,125 +1772,22 @@ UniValue zs_listreceivedbyaddress(const UniValue& params, bool fHelp, const CPub
     if (!isTAddress && !isZcAddress && !isZsAddress)
         return ret;
 
-    //Get set of txids that the encoded address was used in
-    std::map<std::string, std::set<uint256>>::iterator ait;
-    ait = pwalletMain->mapAddressTxids.find(encodedAddress);
-    std::set<uint256> txids;
-    if (ait != pwalletMain->mapAddressTxids.end()) {
-        txids = ait->second;
-    } else {
-        return ret;
-    }
-
-    //get Sorted Archived Transactions
-    std::map<std::pair<int,int>, uint256> sortedArchive;
-    for (map<uint256, ArchiveTxPoint>::iterator it = pwalletMain->mapArcTxs.begin(); it != pwalletMain->mapArcTxs.end(); ++it)
-    {
-      uint256 txid = (*it).first;
-      ArchiveTxPoint arcTxPt = (*it).second;
-      std::pair<int,int> key;
-
-      std::set<uint256>::iterator txit;
-      txit = txids.find(txid);
-      if (txit == txids.end()) {
-          continue;
-      }
-
-      if (!arcTxPt.hashBlock.IsNull() && mapBlockIndex[arcTxPt.hashBlock] != nullptr) {
-        key = make_pair(mapBlockIndex[arcTxPt.hashBlock]->GetHeight(), arcTxPt.nIndex);
-        sortedArchive[key] = txid;
-      }
-    }
-
-    //add any missing wallet transactions - unconfimred & conflicted
-    int nPosUnconfirmed = 0;
-    for (map<uint256,CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); ++it) {
-      CWalletTx wtx = (*it).second;
-      std::pair<int,int> key;
-
-      std::set<uint256>::iterator txit;
-      txit = txids.find(wtx.GetHash());
-      if (txit == txids.end()) {
-          continue;
-      }
-
-      if (wtx.GetDepthInMainChain() == 0) {
-        key = make_pair(chainActive.Tip()->GetHeight() + 1,  nPosUnconfirmed);
-        sortedArchive[key] = wtx.GetHash();
-        nPosUnconfirmed++;
-      } else if (!wtx.hashBlock.IsNull() && mapBlockIndex[wtx.hashBlock] != nullptr) {
-        key = make_pair(mapBlockIndex[wtx.hashBlock]->GetHeight(), wtx.nIndex);
-        sortedArchive[key] = wtx.GetHash();
-      } else {
-        key = make_pair(chainActive.Tip()->GetHeight() + 1,  nPosUnconfirmed);
-        sortedArchive[key] = wtx.GetHash();
-        nPosUnconfirmed++;
-      }
-
-    }
+    std::shared_ptr<const RpcArcTxSnapshot> snapshot = GetRpcArcTxSnapshot(fIncludeWatchonly);
 
     uint64_t t = GetTime();
-    int chainHeight = chainActive.Tip()->GetHeight();
     //Reverse Iterate thru transactions
-    for (map<std::pair<int,int>, uint256>::reverse_iterator it = sortedArchive.rbegin(); it != sortedArchive.rend(); ++it)
+    for (map<std::pair<int,int>, RpcArcTxSnapshot::Entry>::const_reverse_iterator it = snapshot->mapListed.rbegin(); it != snapshot->mapListed.rend(); ++it)
     {
-        uint256 txid = (*it).second;
-        RpcArcTransaction arcTx;
+        const RpcArcTxSnapshot::Entry& entry = (*it).second;
 
-        //Exclude transactions with block height lower the type 3 filter minimum
-        if (nFilterType == 3 && (*it).first.first < nFilter)
+        //Only transactions the encoded address was used in
+        if (!entry.record->arcTx.addresses.count(encodedAddress))
             continue;
 
-        if (pwalletMain->mapWallet.count(txid)) {
-
-            CWalletTx& wtx = pwalletMain->mapWallet[txid];
-
-            if (!CheckFinalTx(wtx))
-                continue;
-
-            if (wtx.GetDepthInMainChain() < 0)
-                continue;
-
-            if (wtx.mapSaplingNoteData.size() == 0 && wtx.mapSproutNoteData.size() == 0 && !wtx.IsTrusted())
-                continue;
-
-            //Excude transactions with less confirmations than required
-            if (wtx.GetDepthInMainChain() < nMinConfirms)
-                continue;
-
-            //Exclude Transactions older that max days old
-            if (wtx.GetDepthInMainChain() > 0 && nFilterType == 1 && mapBlockIndex[wtx.hashBlock]->GetBlockTime() < (t - (nFilter * 60 * 60 * 24)))
-                continue;
-
-            //Exclude transactions with greater than max confirmations
-            if (nFilterType == 2 && wtx.GetDepthInMainChain() > nFilter)
-                continue;
-
-            getRpcArcTx(wtx, arcTx, fIncludeWatchonly, false);
-
-        } else {
-
-            int confirms = chainHeight - (*it).first.first + 1;
-
-            //Excude transactions with less confirmations than required
-            if (confirms < nMinConfirms)
-                continue;
-
-            //Exclude transactions with greater than max confirmations
-            if (nFilterType == 2 && confirms > nFilter)
-                continue;
-
-            //Archived Transactions
-            getRpcArcTx(txid, arcTx, fIncludeWatchonly, false);
-
-            if (arcTx.blockHash.IsNull() || mapBlockIndex[arcTx.blockHash] == nullptr)
-                continue;
+        if (!filterRpcArcTx(entry, (*it).first.first, nMinConfirms, nFilterType, nFilter, t))
+            continue;
 
-            //Exclude Transactions older that max days old
-            if (confirms > 0 && nFilterType == 1 && mapBlockIndex[arcTx.blockHash]->GetBlockTime() < (t - (nFilter * 60 * 60 * 24)))
-                continue;
-
-        }
+        RpcArcTransaction arcTx = entry.Get();
 
         bool containsAddress = false;
         UniValue txObj(UniValue::VOBJ);
@@ -1933,8 +1897,6 @@ UniValue zs_listsentbyaddress(const UniValue& params, bool fHelp, const CPubKey&
         + HelpExampleRpc("zs_listsentbyaddress", "t1KzZ5n2TPEGYXTZ3WYGL1AYEumEQaRoHaL")
     );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
-
     UniValue ret(UniValue::VARR);
 
     //param values`
@@ -1996,127 +1958,22 @@ UniValue zs_listsentbyaddress(const UniValue& params, bool fHelp, const CPubKey&
     if (!isTAddress && !isZcAddress && !isZsAddress)
         return ret;
 
-    //Get set of txids that the encoded address was used in
-    std::map<std::string, std::set<uint256>>::iterator ait;
-    ait = pwalletMain->mapAddressTxids.find(encodedAddress);
-    std::set<uint256> txids;
-
-    if (ait != pwalletMain->mapAddressTxids.end()) {
-        txids = ait->second;
-    } else {
-        return ret;
-    }
-
-    //get Sorted Archived Transactions
-    std::map<std::pair<int,int>, uint256> sortedArchive;
-    for (map<uint256, ArchiveTxPoint>::iterator it = pwalletMain->mapArcTxs.begin(); it != pwalletMain->mapArcTxs.end(); ++it)
-    {
-      uint256 txid = (*it).first;
-      ArchiveTxPoint arcTxPt = (*it).second;
-      std::pair<int,int> key;
-
-      std::set<uint256>::iterator txit;
-      txit = txids.find(txid);
-      if (txit == txids.end()) {
-          continue;
-      }
-
-      if (!arcTxPt.hashBlock.IsNull() && mapBlockIndex[arcTxPt.hashBlock] != nullptr) {
-        key = make_pair(mapBlockIndex[arcTxPt.hashBlock]->GetHeight(), arcTxPt.nIndex);
-        sortedArchive[key] = txid;
-      }
-    }
-
-    //add any missing wallet transactions - unconfimred & conflicted
-    int nPosUnconfirmed = 0;
-    for (map<uint256,CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); ++it) {
-      CWalletTx wtx = (*it).second;
-      std::pair<int,int> key;
-
-      std::set<uint256>::iterator txit;
-      txit = txids.find(wtx.GetHash());
-      if (txit == txids.end()) {
-          continue;
-      }
-
-      if (wtx.GetDepthInMainChain() == 0) {
-        key = make_pair(chainActive.Tip()->GetHeight() + 1,  nPosUnconfirmed);
-        sortedArchive[key] = wtx.GetHash();
-        nPosUnconfirmed++;
-      } else if (!wtx.hashBlock.IsNull() && mapBlockIndex[wtx.hashBlock] != nullptr) {
-        key = make_pair(mapBlockIndex[wtx.hashBlock]->GetHeight(), wtx.nIndex);
-        sortedArchive[key] = wtx.GetHash();
-      } else {
-        key = make_pair(chainActive.Tip()->GetHeight() + 1,  nPosUnconfirmed);
-        sortedArchive[key] = wtx.GetHash();
-        nPosUnconfirmed++;
-      }
-
-    }
+    std::shared_ptr<const RpcArcTxSnapshot> snapshot = GetRpcArcTxSnapshot(fIncludeWatchonly);
 
     uint64_t t = GetTime();
-    int chainHeight = chainActive.Tip()->GetHeight();
     //Reverse Iterate thru transactions
-    for (map<std::pair<int,int>, uint256>::reverse_iterator it = sortedArchive.rbegin(); it != sortedArchive.rend(); ++it)
+    for (map<std::pair<int,int>, RpcArcTxSnapshot::Entry>::const_reverse_iterator it = snapshot->mapListed.rbegin(); it != snapshot->mapListed.rend(); ++it)
     {
-        uint256 txid = (*it).second;
-        RpcArcTransaction arcTx;
+        const RpcArcTxSnapshot::Entry& entry = (*it).second;
 
-        //Exclude transactions with block height lower the type 3 filter minimum
-        if (nFilterType == 3 && (*it).first.first < nFilter)
+        //Only transactions the encoded address was used in
+        if (!entry.record->arcTx.addresses.count(encodedAddress))
             continue;
 
-        if (pwalletMain->mapWallet.count(txid)) {
-
-
-            CWalletTx& wtx = pwalletMain->mapWallet[txid];
-
-            if (!CheckFinalTx(wtx))
-                continue;
-
-            if (wtx.GetDepthInMainChain() < 0)
-                continue;
-
-            if (wtx.mapSaplingNoteData.size() == 0 && wtx.mapSproutNoteData.size() == 0 && !wtx.IsTrusted())
-                continue;
-
-            //Excude transactions with less confirmations than required
-            if (wtx.GetDepthInMainChain() < nMinConfirms)
-                continue;
-
-            //Exclude Transactions older that max days old
-            if (wtx.GetDepthInMainChain() > 0 && nFilterType == 1 && mapBlockIndex[wtx.hashBlock]->GetBlockTime() < (t - (nFilter * 60 * 60 * 24)))
-                continue;
-
-            //Exclude transactions with greater than max confirmations
-            if (nFilterType == 2 && wtx.GetDepthInMainChain() > nFilter)
-                continue;
-
-            getRpcArcTx(wtx, arcTx, fIncludeWatchonly, false);
-
-        } else {
-
-            int confirms = chainHeight - (*it).first.first + 1;
-
-            //Excude transactions with less confirmations than required
-            if (confirms < nMinConfirms)
-                continue;
-
-            //Exclude transactions with greater than max confirmations
-            if (nFilterType == 2 && confirms > nFilter)
-                continue;
-
-            //Archived Transactions
-            getRpcArcTx(txid, arcTx, fIncludeWatchonly, false);
-
-            if (arcTx.blockHash.IsNull() || mapBlockIndex[arcTx.blockHash] == nullptr)
-                continue;
-
-            //Exclude Transactions older that max days old
-            if (confirms > 0 && nFilterType == 1 && mapBlockIndex[arcTx.blockHash]->GetBlockTime() < (t - (nFilter * 60 * 60 * 24)))
-                continue;
+        if (!filterRpcArcTx(entry, (*it).first.first, nMinConfirms, nFilterType, nFilter, t))
+            continue;
 
-        }
+        RpcArcTransaction arcTx = entry.Get();
 
         if (arcTx.spentFrom.size() > 0) {
             bool containsAddress = false;
@@ -2167,7 +2024,7 @@ UniValue zs_listsentbyaddress(const UniValue& params, bool fHelp, const CPubKey&
 **/
 UniValue getalldata(const UniValue& params, bool fHelp, const CPubKey& mypk)
 {
-    if (fHelp || params.size() > 4)
+    if (fHelp || params.size() > 6)
         throw runtime_error(
             "getalldata \"datatype transactiontype \"\n"
             "\n"
@@ -2188,19 +2045,44 @@ UniValue getalldata(const UniValue& params, bool fHelp, const CPubKey& mypk)
             "                    Other number: Return all transactions\n"
             "3. \"transactioncount\"     (integer, optional) \n"
             "4. \"Include Watch Only\"   (bool, optional, Default = false) \n"
+            "5. \"sinceblockhash\"       (string, optional) Only return transactions after this block, and the balances\n"
+            "                    of the addresses they touch. Pass the bestblockhash of the previous call; if it is\n"
+            "                    no longer in the main chain the full data is returned and incremental is false\n"
+            "6. \"skip\"                 (integer, optional, Default = 0) Number of newest transactions to skip, to page\n"
+            "                    through the list transactioncount at a time\n"
             "\nResult:\n"
             "\nExamples:\n"
             + HelpExampleCli("getalldata", "0")
+            + HelpExampleCli("getalldata", "0 0 200 false \"000000000b7e1f6a4e3ca6e1d2c0cc9d3de6b9a1c7c82b1f2b56e0ba2f4c8d1e\" 0")
             + HelpExampleRpc("getalldata", "0")
         );
 
     LOCK(cs_main);
 
     bool fIncludeWatchonly = false;
-    if (params.size() == 4) {
+    if (params.size() >= 4) {
         fIncludeWatchonly = params[3].get_bool();
     }
 
+    //Incremental mode, only report what changed after sinceHeight
+    bool fIncremental = false;
+    int sinceHeight = -1;
+    if (params.size() >= 5 && !params[4].get_str().empty()) {
+        uint256 sinceHash = ParseHashV(params[4], "sinceblockhash");
+        BlockMap::iterator mi = mapBlockIndex.find(sinceHash);
+        if (mi != mapBlockIndex.end() && mi->second != nullptr && chainActive.Contains(mi->second)) {
+            fIncremental = true;
+            sinceHeight = mi->second->GetHeight();
+        }
+    }
+
+    int nSkip = 0;
+    if (params.size() >= 6) {
+        nSkip = params[5].get_int();
+        if (nSkip < 0)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "skip must be equal or greater than 0");
+    }
+
     UniValue returnObj(UniValue::VOBJ);
     int connectionCount = 0;
     {
@@ -2271,11 +2153,11 @@ UniValue getalldata(const UniValue& params, bool fHelp, const CPubKey& mypk)
 
 
     //Create Ordered List
-    map<int64_t,CWalletTx> orderedTxs;
+    map<int64_t,const CWalletTx*> orderedTxs;
     for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); ++it) {
       const uint256& wtxid = it->first;
       const CWalletTx& wtx = (*it).second;
-      orderedTxs.insert(std::pair<int64_t,CWalletTx>(wtx.nOrderPos, wtx));
+      orderedTxs.insert(std::make_pair(wtx.nOrderPos, &wtx));
 
       unsigned int txType = 0;
       // 0 Unassigend
@@ -2463,39 +2345,24 @@ UniValue getalldata(const UniValue& params, bool fHelp, const CPubKey& mypk)
     returnObj.push_back(Pair("lockedbalance", FormatMoney(locked)));
     returnObj.push_back(Pair("immaturebalance", FormatMoney(immature)));
 
-    //get all t address
-    UniValue addressbalance(UniValue::VARR);
-    UniValue addrlist(UniValue::VOBJ);
-
-    if (params.size() > 0 && (params[0].get_int() == 1 || params[0].get_int() == 0))
-    {
-      for (map<string, balancestruct>::iterator it = addressBalances.begin(); it != addressBalances.end(); ++it) {
-        UniValue addr(UniValue::VOBJ);
-        addr.push_back(Pair("amount", ValueFromAmount(it->second.confirmed)));
-        addr.push_back(Pair("unconfirmed", ValueFromAmount(it->second.unconfirmed)));
-        addr.push_back(Pair("locked", ValueFromAmount(it->second.locked)));
-        addr.push_back(Pair("immature", ValueFromAmount(it->second.immature)));
-        addr.push_back(Pair("spendable", it->second.spendable));
-        addrlist.push_back(Pair(it->first, addr));
-      }
-    }
-
-    addressbalance.push_back(addrlist);
-    returnObj.push_back(Pair("addressbalance", addressbalance));
-
-
     //get transactions
     uint64_t t = GetTime();
     int nCount = 200;
     UniValue trans(UniValue::VARR);
     UniValue transTime(UniValue::VARR);
+    bool fHasMore = false;
+    std::set<string> changedAddresses;
 
-    if (params.size() == 3)
+    if (params.size() >= 3)
     {
       nCount = params[2].get_int();
     }
 
-    if (params.size() > 0 && (params[0].get_int() == 2 || params[0].get_int() == 0))
+    //The changed addresses of the incremental mode come from the transaction scan
+    bool fIncludeAddresses = params.size() > 0 && (params[0].get_int() == 1 || params[0].get_int() == 0);
+    bool fIncludeTransactions = params.size() > 0 && (params[0].get_int() == 2 || params[0].get_int() == 0);
+
+    if (fIncludeTransactions || (fIncludeAddresses && fIncremental))
     {
         int day = 365 * 30; //30 Years
         if(params.size() > 1)
@@ -2544,8 +2411,8 @@ UniValue getalldata(const UniValue& params, bool fHelp, const CPubKey& mypk)
 
         //add any missing wallet transactions - unconfimred & conflicted
         int nPosUnconfirmed = 0;
-        for (map<int64_t,CWalletTx>::reverse_iterator it = orderedTxs.rbegin(); it != orderedTxs.rend(); ++it) {
-          CWalletTx wtx = (*it).second;
+        for (map<int64_t,const CWalletTx*>::reverse_iterator it = orderedTxs.rbegin(); it != orderedTxs.rend(); ++it) {
+          const CWalletTx& wtx = *(*it).second;
           std::pair<int,int> key;
 
           if (!CheckFinalTx(wtx))
@@ -2579,9 +2446,19 @@ UniValue getalldata(const UniValue& params, bool fHelp, const CPubKey& mypk)
 
         }
 
+        int nSkipped = 0;
         for (map<std::pair<int,int>, uint256>::reverse_iterator it = sortedArchive.rbegin(); it != sortedArchive.rend(); ++it)
         {
 
+            //Newest first, so the incremental scan ends at the first old transaction
+            if (fIncremental && (*it).first.first <= sinceHeight)
+                break;
+
+            if (trans.size() >= nCount) {
+                fHasMore = true;
+                break;
+            }
+
             uint256 txid = (*it).second;
             RpcArcTransaction arcTx;
 
@@ -2596,6 +2473,20 @@ UniValue getalldata(const UniValue& params, bool fHelp, const CPubKey& mypk)
                 getRpcArcTx(txid, arcTx, fIncludeWatchonly, false);
             }
 
+            if (arcTx.vTReceived.size() + arcTx.vZcReceived.size() + arcTx.vZsReceived.size() + arcTx.spentFrom.size() == 0)
+                continue;
+
+            if (fIncremental)
+                changedAddresses.insert(arcTx.addresses.begin(), arcTx.addresses.end());
+
+            if (!fIncludeTransactions)
+                continue;
+
+            if (nSkipped < nSkip) {
+                nSkipped++;
+                continue;
+            }
+
             UniValue txObj(UniValue::VOBJ);
             getRpcArcTxJSONHeader(arcTx, txObj);
 
@@ -2609,11 +2500,7 @@ UniValue getalldata(const UniValue& params, bool fHelp, const CPubKey& mypk)
             getRpcArcTxJSONReceives(arcTx,receive);
             txObj.push_back(Pair("received", receive));
 
-            if (arcTx.vTReceived.size() + arcTx.vZcReceived.size() + arcTx.vZsReceived.size() + arcTx.spentFrom.size() > 0)
-                trans.push_back(txObj);
-
-            if (trans.size() >= nCount) break;
-
+            trans.push_back(txObj);
         }
 
         vector<UniValue> arrTmp = trans.getValues();
@@ -2625,6 +2512,30 @@ UniValue getalldata(const UniValue& params, bool fHelp, const CPubKey& mypk)
         trans.push_backV(arrTmp);
     }
 
+    //get all t address
+    UniValue addressbalance(UniValue::VARR);
+    UniValue addrlist(UniValue::VOBJ);
+
+    if (fIncludeAddresses)
+    {
+      for (map<string, balancestruct>::iterator it = addressBalances.begin(); it != addressBalances.end(); ++it) {
+        if (fIncremental && changedAddresses.count(it->first) == 0)
+            continue;
+        UniValue addr(UniValue::VOBJ);
+        addr.push_back(Pair("amount", ValueFromAmount(it->second.confirmed)));
+        addr.push_back(Pair("unconfirmed", ValueFromAmount(it->second.unconfirmed)));
+        addr.push_back(Pair("locked", ValueFromAmount(it->second.locked)));
+        addr.push_back(Pair("immature", ValueFromAmount(it->second.immature)));
+        addr.push_back(Pair("spendable", it->second.spendable));
+        addrlist.push_back(Pair(it->first, addr));
+      }
+    }
+
+    addressbalance.push_back(addrlist);
+    returnObj.push_back(Pair("addressbalance", addressbalance));
+
+    returnObj.push_back(Pair("incremental", fIncremental));
+    returnObj.push_back(Pair("hasmore", fHasMore));
     returnObj.push_back(Pair("listtransactions", trans));
     return returnObj;
 }
@@ -30,6 +30,18 @@ public:
     string spendTxid;
     int spendVout;
     bool spendable;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(encodedAddress);
+        READWRITE(encodedScriptPubKey);
+        READWRITE(amount);
+        READWRITE(spendTxid);
+        READWRITE(spendVout);
+        READWRITE(spendable);
+    }
 };
 
 class TransactionSendT
@@ -40,6 +52,17 @@ public:
     CAmount amount;
     int vout;
     bool mine;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(encodedAddress);
+        READWRITE(encodedScriptPubKey);
+        READWRITE(amount);
+        READWRITE(vout);
+        READWRITE(mine);
+    }
 };
 
 class TransactionReceivedT
@@ -50,6 +73,17 @@ public:
     CAmount amount;
     int vout;
     bool spendable;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(encodedAddress);
+        READWRITE(encodedScriptPubKey);
+        READWRITE(amount);
+        READWRITE(vout);
+        READWRITE(spendable);
+    }
 };
 
 
@@ -62,6 +96,18 @@ public:
     int spendJsIndex;
     int spendJsOutIndex;
     bool spendable;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(encodedAddress);
+        READWRITE(amount);
+        READWRITE(spendTxid);
+        READWRITE(spendJsIndex);
+        READWRITE(spendJsOutIndex);
+        READWRITE(spendable);
+    }
 };
 
 class TransactionReceivedZC
@@ -74,6 +120,19 @@ public:
     string memo;
     string memoStr;
     bool spendable;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(encodedAddress);
+        READWRITE(amount);
+        READWRITE(jsIndex);
+        READWRITE(jsOutIndex);
+        READWRITE(memo);
+        READWRITE(memoStr);
+        READWRITE(spendable);
+    }
 };
 
 class TransactionSpendZS
@@ -84,6 +143,17 @@ public:
     string spendTxid;
     int spendShieldedOutputIndex;
     bool spendable;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(encodedAddress);
+        READWRITE(amount);
+        READWRITE(spendTxid);
+        READWRITE(spendShieldedOutputIndex);
+        READWRITE(spendable);
+    }
 };
 
 class TransactionSendZS
@@ -95,6 +165,18 @@ public:
     string memo;
     string memoStr;
     bool mine;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(encodedAddress);
+        READWRITE(amount);
+        READWRITE(shieldedOutputIndex);
+        READWRITE(memo);
+        READWRITE(memoStr);
+        READWRITE(mine);
+    }
 };
 
 class TransactionReceivedZS
@@ -106,6 +188,18 @@ public:
     string memo;
     string memoStr;
     bool spendable;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(encodedAddress);
+        READWRITE(amount);
+        READWRITE(shieldedOutputIndex);
+        READWRITE(memo);
+        READWRITE(memoStr);
+        READWRITE(spendable);
+    }
 };
 
 enum ArchiveType {
@@ -144,6 +238,68 @@ public:
       std::vector<TransactionReceivedT> vTReceived;
       std::vector<TransactionReceivedZC> vZcReceived;
       std::vector<TransactionReceivedZS> vZsReceived;
+
+      ADD_SERIALIZE_METHODS;
+
+      template <typename Stream, typename Operation>
+      inline void SerializationOp(Stream& s, Operation ser_action) {
+          READWRITE(txid);
+          READWRITE(coinbase);
+          READWRITE(category);
+          READWRITE(blockHash);
+          READWRITE(blockIndex);
+          READWRITE(nBlockTime);
+          READWRITE(confirmations);
+          READWRITE(rawconfirmations);
+          READWRITE(nTime);
+          READWRITE(expiryHeight);
+          READWRITE(size);
+          READWRITE(transparentValue);
+          READWRITE(sproutValue);
+          READWRITE(sproutValueSpent);
+          READWRITE(saplingValue);
+          READWRITE(archiveType);
+          READWRITE(ivks);
+          READWRITE(ovks);
+          READWRITE(spentFrom);
+          READWRITE(addresses);
+          READWRITE(vTSpend);
+          READWRITE(vZcSpend);
+          READWRITE(vZsSpend);
+          READWRITE(vTSend);
+          READWRITE(vZsSend);
+          READWRITE(vTReceived);
+          READWRITE(vZcReceived);
+          READWRITE(vZsReceived);
+      }
+};
+
+/**
+ * A decoded transaction as saved in the wallet db ("arcrpctx", keyed by txid
+ * and watch-only setting), so the list RPCs neither read its block nor trial
+ * decrypt it again, also after a restart. It is valid while the transaction
+ * is in blockHash and the wallet is at the same key generation; a rescan
+ * decodes and saves it again. Confirmations are filled in on use.
+ */
+class RpcArcTxRecord
+{
+public:
+      //! CWallet::GetKeyGeneration when it was decoded
+      uint64_t nKeyGeneration;
+      //! Height of arcTx.blockHash, -1 if it was not in a block
+      int nHeight;
+      RpcArcTransaction arcTx;
+
+      RpcArcTxRecord() : nKeyGeneration(0), nHeight(-1) {}
+
+      ADD_SERIALIZE_METHODS;
+
+      template <typename Stream, typename Operation>
+      inline void SerializationOp(Stream& s, Operation ser_action) {
+          READWRITE(nKeyGeneration);
+          READWRITE(nHeight);
+          READWRITE(arcTx);
+      }
 };
 
 class RpcArcTransactions
@@ -186,6 +342,8 @@ void getAllSaplingIVKs(std::set<uint256> &ivks, bool fIncludeWatchonly = false);
 
 void getRpcArcTx(CWalletTx &tx, RpcArcTransaction &arcTx, bool fIncludeWatchonly = false, bool rescan = false);
 void getRpcArcTx(uint256 &txid, RpcArcTransaction &arcTx, bool fIncludeWatchonly = false, bool rescan = false);
+//! Saves a transaction getRpcArcTx decoded as its RpcArcTxRecord (requires cs_main)
+bool saveRpcArcTx(CWalletDB &walletdb, const RpcArcTransaction &arcTx, bool fIncludeWatchonly);
 
 void getRpcArcTxJSONHeader(RpcArcTransaction &arcTx, UniValue& ArcTxJSON);
 void getRpcArcTxJSONSpends(RpcArcTransaction &arcTx, UniValue& ArcTxJSON, bool filterAddress = false, string addressString = "");
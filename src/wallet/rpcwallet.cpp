@@ -53,6 +53,7 @@
 #include <stdint.h>
 
 #include <boost/assign/list_of.hpp>
+#include <boost/filesystem.hpp>
 //#include <utf8.h>
 
 #include <univalue.h>
@@ -74,6 +75,8 @@ extern UniValue TxJoinSplitToJSON(const CTransaction& tx);
 extern int32_t KOMODO_INSYNC;
 uint32_t komodo_segid32(char *coinaddr);
 int32_t komodo_dpowconfs(int32_t height,int32_t numconfs);
+int32_t komodo_dpownotarizedheight();
+int32_t komodo_dpowconfs_notarized(int32_t notarizedheight,int32_t txheight,int32_t numconfs);
 int32_t komodo_isnotaryvout(char *coinaddr,uint32_t tiptime); // from ac_private chains only
 CBlockIndex *komodo_getblockindex(uint256 hash);
 
@@ -88,7 +91,12 @@ UniValue z_getoperationstatus_IMPL(const UniValue&, bool);
 #define VALID_PLAN_NAME(x)  (strlen(x) <= PLAN_NAME_MAX)
 #define THROW_IF_SYNCING(INSYNC)  if (INSYNC == 0) { throw runtime_error(strprintf("%s: Chain still syncing at height %d, aborting to prevent linkability analysis!",__FUNCTION__,chainActive.Tip()->GetHeight())); }
 
-int tx_height( const uint256 &hash );
+
+//! Height of the block a wallet note was confirmed in, derived from its depth, 0 while unconfirmed
+static int NoteEntryHeight(int confirmations)
+{
+    return confirmations > 0 ? chainActive.Height() - confirmations + 1 : 0;
+}
 
 std::string HelpRequiringPassphrase()
 {
@@ -595,7 +603,7 @@ UniValue kvupdate(const UniValue& params, bool fHelp, const CPubKey& mypk)
 {
     static uint256 zeroes;
     CWalletTx wtx; UniValue ret(UniValue::VOBJ);
-    uint8_t keyvalue[IGUANA_MAXSCRIPTSIZE*8],opretbuf[IGUANA_MAXSCRIPTSIZE*8]; int32_t i,coresize,haveprivkey,duration,opretlen,height; uint16_t keylen=0,valuesize=0,refvaluesize=0; uint8_t *key,*value=0; uint32_t flags,tmpflags,n; struct komodo_kv *ptr; uint64_t fee; uint256 privkey,pubkey,refpubkey,sig;
+    uint8_t keyvalue[IGUANA_MAXSCRIPTSIZE*8],opretbuf[IGUANA_MAXSCRIPTSIZE*8]; int32_t i,coresize,haveprivkey,duration,opretlen,height; uint16_t keylen=0,valuesize=0,refvaluesize=0; uint8_t *key,*value=0; uint32_t flags,tmpflags,n; uint64_t fee; uint256 privkey,pubkey,refpubkey,sig;
     if (fHelp || params.size() < 3 )
         throw runtime_error(
             "kvupdate key \"value\" days passphrase\n"
@@ -968,6 +976,7 @@ UniValue getreceivedbyaddress(const UniValue& params, bool fHelp, const CPubKey&
 
     // Tally
     CAmount nAmount = 0;
+    int32_t notarizedHeight = komodo_dpownotarizedheight();
     for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); ++it)
     {
         const CWalletTx& wtx = (*it).second;
@@ -978,8 +987,7 @@ UniValue getreceivedbyaddress(const UniValue& params, bool fHelp, const CPubKey&
             if (txout.scriptPubKey == scriptPubKey) {
                 int nDepth    = wtx.GetDepthInMainChain();
                 if( nMinDepth > 1 ) {
-                    int nHeight    = tx_height(wtx.GetHash());
-                    int dpowconfs  = komodo_dpowconfs(nHeight, nDepth);
+                    int dpowconfs  = komodo_dpowconfs_notarized(notarizedHeight, wtx.GetHeightInMainChain(), nDepth);
                     if (dpowconfs >= nMinDepth) {
                         nAmount   += txout.nValue; // komodo_interest?
                     }
@@ -1057,6 +1065,7 @@ CAmount GetAccountBalance(CWalletDB& walletdb, const string& strAccount, int nMi
     CAmount nBalance = 0;
 
     // Tally wallet transactions
+    int32_t notarizedHeight = komodo_dpownotarizedheight();
     for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); ++it)
     {
         const CWalletTx& wtx = (*it).second;
@@ -1068,8 +1077,7 @@ CAmount GetAccountBalance(CWalletDB& walletdb, const string& strAccount, int nMi
 
         int nDepth    = wtx.GetDepthInMainChain();
         if( nMinDepth > 1 ) {
-            int nHeight    = tx_height(wtx.GetHash());
-            int dpowconfs  = komodo_dpowconfs(nHeight, nDepth);
+            int dpowconfs  = komodo_dpowconfs_notarized(notarizedHeight, wtx.GetHeightInMainChain(), nDepth);
             if (nReceived != 0 && dpowconfs >= nMinDepth) {
                 nBalance += nReceived;
             }
@@ -1238,6 +1246,7 @@ UniValue getbalance(const UniValue& params, bool fHelp, const CPubKey& mypk)
         // (GetBalance() sums up all unspent TxOuts)
         // getbalance and "getbalance * 1 true" should return the same number
         CAmount nBalance = 0;
+        int32_t notarizedHeight = komodo_dpownotarizedheight();
         for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); ++it)
         {
             const CWalletTx& wtx = (*it).second;
@@ -1252,8 +1261,7 @@ UniValue getbalance(const UniValue& params, bool fHelp, const CPubKey& mypk)
 
             int nDepth    = wtx.GetDepthInMainChain();
             if( nMinDepth > 1 ) {
-                 int nHeight    = tx_height(wtx.GetHash());
-                 int dpowconfs  = komodo_dpowconfs(nHeight, nDepth);
+                 int dpowconfs  = komodo_dpowconfs_notarized(notarizedHeight, wtx.GetHeightInMainChain(), nDepth);
                  if (dpowconfs >= nMinDepth) {
                     BOOST_FOREACH(const COutputEntry& r, listReceived)
                         nBalance += r.amount;
@@ -1364,6 +1372,7 @@ UniValue movecmd(const UniValue& params, bool fHelp, const CPubKey& mypk)
 
     if (!walletdb.TxnCommit())
         throw JSONRPCError(RPC_DATABASE_ERROR, "database error");
+    pwalletMain->fAccountingEntries = true;
 
     return true;
 }
@@ -1637,6 +1646,7 @@ UniValue ListReceived(const UniValue& params, bool fByAccounts)
 
     // Tally
     std::map<CTxDestination, tallyitem> mapTally;
+    int32_t notarizedHeight = komodo_dpownotarizedheight();
     for (const std::pair<uint256, CWalletTx>& pairWtx : pwalletMain->mapWallet) {
         const CWalletTx& wtx = pairWtx.second;
 
@@ -1645,8 +1655,7 @@ UniValue ListReceived(const UniValue& params, bool fByAccounts)
 
         int nDepth    = wtx.GetDepthInMainChain();
         if( nMinDepth > 1 ) {
-            int nHeight   = tx_height(wtx.GetHash());
-            int dpowconfs = komodo_dpowconfs(nHeight, nDepth);
+            int dpowconfs  = komodo_dpowconfs_notarized(notarizedHeight, wtx.GetHeightInMainChain(), nDepth);
             if (dpowconfs < nMinDepth)
                 continue;
         } else {
@@ -2290,9 +2299,10 @@ UniValue gettransaction(const UniValue& params, bool fHelp, const CPubKey& mypk)
             filter = filter | ISMINE_WATCH_ONLY;
 
     UniValue entry(UniValue::VOBJ);
-    if (!pwalletMain->mapWallet.count(hash))
+    CWalletTx wtxPaged;
+    if (!pwalletMain->mapWallet.count(hash) && !pwalletMain->GetPagedWalletTx(hash, wtxPaged))
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid or non-wallet transaction id");
-    const CWalletTx& wtx = pwalletMain->mapWallet[hash];
+    const CWalletTx& wtx = pwalletMain->mapWallet.count(hash) ? pwalletMain->mapWallet[hash] : wtxPaged;
 
     CAmount nCredit = wtx.GetCredit(filter);
     CAmount nDebit = wtx.GetDebit(filter);
@@ -2802,6 +2812,9 @@ UniValue getwalletinfo(const UniValue& params, bool fHelp, const CPubKey& mypk)
             "  \"unlocked_until\": ttt,      (numeric) the timestamp in seconds since epoch (midnight Jan 1 1970 GMT) that the wallet is unlocked for transfers, or 0 if the wallet is locked\n"
             "  \"paytxfee\": x.xxxx,         (numeric) the transaction fee configuration, set in " + CURRENCY_UNIT + "/kB\n"
             "  \"seedfp\": \"uint256\",        (string) the BLAKE2b-256 hash of the HD seed\n"
+            "  \"writebatches\": xxxx,       (numeric) wallet write batches committed since startup\n"
+            "  \"writebatchrecords\": xxxx,  (numeric) records written by those batches\n"
+            "  \"lastwritebatchrecords\": xx, (numeric) records coalesced by the last batch\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getwalletinfo", "")
@@ -2824,6 +2837,139 @@ UniValue getwalletinfo(const UniValue& params, bool fHelp, const CPubKey& mypk)
     uint256 seedFp = pwalletMain->GetHDChain().seedFp;
     if (!seedFp.IsNull())
          obj.push_back(Pair("seedfp", seedFp.GetHex()));
+    obj.push_back(Pair("writebatches", pwalletMain->nWriteBatches));
+    obj.push_back(Pair("writebatchrecords", pwalletMain->nWriteBatchRecords));
+    obj.push_back(Pair("lastwritebatchrecords", (uint64_t)pwalletMain->nLastWriteBatchRecords));
+    return obj;
+}
+
+UniValue getwalletmemoryinfo(const UniValue& params, bool fHelp, const CPubKey& mypk)
+{
+    if (!EnsureWalletIsAvailable(fHelp))
+        return NullUniValue;
+
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getwalletmemoryinfo\n"
+            "Returns an estimate of the memory held by the wallet, by structure.\n"
+            "Walks every wallet transaction, so it takes a while on large wallets.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"structures\": {\n"
+            "    \"name\": {                 (object) transactions, sapling_witnesses, nullifiers, keys, ...\n"
+            "      \"entries\": xxxx,        (numeric) entries in the structure\n"
+            "      \"bytes\": xxxx,          (numeric) estimated dynamic memory, in bytes\n"
+            "      \"disk_bytes\": xxxx,     (numeric) serialized size of the records in the wallet file, 0 for indexes\n"
+            "    }, ...\n"
+            "  },\n"
+            "  \"total_bytes\": xxxx,       (numeric) the sum of bytes\n"
+            "  \"total_disk_bytes\": xxxx,  (numeric) the sum of disk_bytes\n"
+            "  \"wallet_file_bytes\": xxxx, (numeric) size of the wallet file\n"
+            "  \"memory_budget\": xxxx,     (numeric) -walletmemorybudget in bytes, 0 when unlimited\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getwalletmemoryinfo", "")
+            + HelpExampleRpc("getwalletmemoryinfo", "")
+        );
+
+    std::vector<CWalletMemoryUsage> vUsage = pwalletMain->GetMemoryUsage();
+
+    UniValue structures(UniValue::VOBJ);
+    uint64_t nTotalBytes = 0, nTotalDiskBytes = 0;
+    for (const CWalletMemoryUsage& usage : vUsage) {
+        UniValue entry(UniValue::VOBJ);
+        entry.push_back(Pair("entries", (uint64_t)usage.nEntries));
+        entry.push_back(Pair("bytes", (uint64_t)usage.nBytes));
+        entry.push_back(Pair("disk_bytes", usage.nDiskBytes));
+        structures.push_back(Pair(usage.name, entry));
+        nTotalBytes += usage.nBytes;
+        nTotalDiskBytes += usage.nDiskBytes;
+    }
+
+    uint64_t nFileBytes = 0;
+    boost::system::error_code ec;
+    boost::filesystem::path pathWallet = GetDataDir() / pwalletMain->strWalletFile;
+    if (pwalletMain->fFileBacked && boost::filesystem::exists(pathWallet, ec))
+        nFileBytes = boost::filesystem::file_size(pathWallet, ec);
+
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("structures", structures));
+    obj.push_back(Pair("total_bytes", nTotalBytes));
+    obj.push_back(Pair("total_disk_bytes", nTotalDiskBytes));
+    obj.push_back(Pair("wallet_file_bytes", ec ? 0 : nFileBytes));
+    obj.push_back(Pair("memory_budget", (uint64_t)nWalletMemoryBudget << 20));
+    return obj;
+}
+
+static UniValue ScanProgressToJSON(const CWalletScanProgress& progress, int nHeight)
+{
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("active", nHeight >= 0));
+    if (nHeight < 0)
+        return obj;
+
+    int nTarget = progress.nTargetHeight;
+    int64_t nBlocks = progress.nBlocks;
+    int64_t nElapsed = GetTimeMillis() - progress.nStartMillis;
+    double dBlocksPerSecond = nElapsed > 0 ? nBlocks * 1000.0 / nElapsed : 0.0;
+    obj.push_back(Pair("height", nHeight));
+    obj.push_back(Pair("start_height", (int)progress.nStartHeight));
+    obj.push_back(Pair("target_height", nTarget));
+    obj.push_back(Pair("blocks_done", nBlocks));
+    obj.push_back(Pair("elapsed_seconds", nElapsed / 1000.0));
+    obj.push_back(Pair("blocks_per_second", dBlocksPerSecond));
+    if (dBlocksPerSecond > 0.0)
+        obj.push_back(Pair("eta_seconds", std::max(0, nTarget - nHeight) / dBlocksPerSecond));
+    return obj;
+}
+
+UniValue getwalletscanstatus(const UniValue& params, bool fHelp, const CPubKey& mypk)
+{
+    if (!EnsureWalletIsAvailable(fHelp))
+        return NullUniValue;
+
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getwalletscanstatus\n"
+            "Returns the progress of the running wallet rescan and witness cache rebuild.\n"
+            "Takes no locks, so it answers while a scan is running, including during startup.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"rescan\": {\n"
+            "    \"active\": true|false,        (boolean) whether a rescan is running; the other fields are only set when it is\n"
+            "    \"height\": n,                 (numeric) the block being scanned\n"
+            "    \"start_height\": n,           (numeric) the first block of the scan\n"
+            "    \"target_height\": n,          (numeric) the last block of the scan\n"
+            "    \"blocks_done\": n,            (numeric) blocks scanned so far\n"
+            "    \"elapsed_seconds\": x.x,      (numeric) time since the scan started\n"
+            "    \"blocks_per_second\": x.x,    (numeric) average rate of the scan\n"
+            "    \"eta_seconds\": x.x,          (numeric, optional) estimated time left at that rate\n"
+            "    \"outputs_decrypted\": n,      (numeric) Sapling outputs trial decrypted\n"
+            "    \"notes_found\": n             (numeric) notes found in the transactions added to the wallet\n"
+            "  },\n"
+            "  \"witness_cache\": {\n"
+            "    \"active\": true|false,        (boolean) whether a witness cache rebuild is running\n"
+            "    ...                            the same progress fields as the rescan\n"
+            "    \"witnesses_updated\": n       (numeric) note witnesses advanced so far\n"
+            "  }\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getwalletscanstatus", "")
+            + HelpExampleRpc("getwalletscanstatus", "")
+        );
+
+    UniValue rescan = ScanProgressToJSON(walletRescanProgress, nWalletRescanHeight);
+    if (rescan["active"].get_bool()) {
+        rescan.push_back(Pair("outputs_decrypted", (int64_t)walletRescanProgress.nOutputs));
+        rescan.push_back(Pair("notes_found", (int64_t)walletRescanProgress.nNotes));
+    }
+    UniValue witness = ScanProgressToJSON(walletWitnessProgress, nWalletWitnessHeight);
+    if (witness["active"].get_bool())
+        witness.push_back(Pair("witnesses_updated", (int64_t)walletWitnessProgress.nWitnesses));
+
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("rescan", rescan));
+    obj.push_back(Pair("witness_cache", witness));
     return obj;
 }
 
@@ -2841,8 +2987,6 @@ UniValue resendwallettransactions(const UniValue& params, bool fHelp, const CPub
             "Returns array of transaction ids that were re-broadcast.\n"
             );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
-
     std::vector<uint256> txids = pwalletMain->ResendWalletTransactionsBefore(GetTime());
     UniValue result(UniValue::VARR);
     BOOST_FOREACH(const uint256& txid, txids)
@@ -2928,11 +3072,11 @@ UniValue listunspent(const UniValue& params, bool fHelp, const CPubKey& mypk)
     assert(pwalletMain != NULL);
     LOCK2(cs_main, pwalletMain->cs_wallet);
     pwalletMain->AvailableCoins(vecOutputs, false, NULL, true);
+    int32_t notarizedHeight = komodo_dpownotarizedheight();
     BOOST_FOREACH(const COutput& out, vecOutputs) {
         int nDepth    = out.tx->GetDepthInMainChain();
         if( nMinDepth > 1 ) {
-            int nHeight    = tx_height(out.tx->GetHash());
-            int dpowconfs  = komodo_dpowconfs(nHeight, nDepth);
+            int dpowconfs  = komodo_dpowconfs_notarized(notarizedHeight, out.tx->GetHeightInMainChain(), nDepth);
             if (dpowconfs < nMinDepth || dpowconfs > nMaxDepth)
                 continue;
         } else {
@@ -3174,6 +3318,7 @@ UniValue z_listunspent(const UniValue& params, bool fHelp, const CPubKey& mypk)
     }
 
     std::set<std::pair<PaymentAddress, uint256>> nullifierSet = pwalletMain->GetNullifiersForAddresses(zaddrs);
+    int32_t notarizedHeight = komodo_dpownotarizedheight();
     for (std::map<libzcash::SaplingPaymentAddress, std::vector<SaplingNoteEntry>>::iterator it = mapResults.begin(); it != mapResults.end(); it++) {
 
         std::vector<SaplingNoteEntry> entries = (*it).second;
@@ -3184,8 +3329,7 @@ UniValue z_listunspent(const UniValue& params, bool fHelp, const CPubKey& mypk)
 
             UniValue obj(UniValue::VOBJ);
 
-            int nHeight   = tx_height(entry.op.hash);
-            int dpowconfs = komodo_dpowconfs(nHeight, entry.confirmations);
+            int dpowconfs = komodo_dpowconfs_notarized(notarizedHeight, NoteEntryHeight(entry.confirmations), entry.confirmations);
 
             // Only return notarized results when minconf>1
             if (nMinDepth > 1 && dpowconfs == 1)
@@ -3367,8 +3511,30 @@ UniValue zc_benchmark(const UniValue& params, bool fHelp, const CPubKey& mypk)
                 sample_times.insert(sample_times.end(), vals.begin(), vals.end());
             }
 #endif
-        } else if (benchmarktype == "verifyequihash") {
-            sample_times.push_back(benchmark_verify_equihash());
+        } else if (benchmarktype == "verifyequihash" || benchmarktype == "verifyequihashsodium") {
+            // Leaves four at a time as nodes check them, or one at a time with libsodium
+            sample_times.push_back(benchmark_verify_equihash(benchmarktype == "verifyequihash"));
+        } else if (benchmarktype == "verifyequihashbatch") {
+            // Number of headers verified together, by default those of a full headers message
+            int nHeaders = MAX_HEADERS_RESULTS;
+            if (params.size() >= 3) {
+                nHeaders = params[2].get_int();
+            }
+            sample_times.push_back(benchmark_verify_equihash_batch(nHeaders));
+        } else if (benchmarktype == "verushash" || benchmarktype == "verushashbatch") {
+            // Number of nonces hashed, one at a time or VERUSHASH_EXTRA_BATCH per call as the miner does
+            int nHashes = 1000000;
+            if (params.size() >= 3) {
+                nHashes = params[2].get_int();
+            }
+            sample_times.push_back(benchmark_verushash(nHashes, benchmarktype == "verushashbatch"));
+        } else if (benchmarktype == "appendsaplingcommitments" || benchmarktype == "appendsaplingcommitmentsbatch") {
+            // Number of note commitments added to the tree, by default about those of a full block
+            int nCommitments = 2000;
+            if (params.size() >= 3) {
+                nCommitments = params[2].get_int();
+            }
+            sample_times.push_back(benchmark_append_sapling_commitments(nCommitments, benchmarktype == "appendsaplingcommitmentsbatch"));
         } else if (benchmarktype == "validatelargetx") {
             // Number of inputs in the spending transaction that we will simulate
             int nInputs = 11130;
@@ -3408,6 +3574,24 @@ UniValue zc_benchmark(const UniValue& params, bool fHelp, const CPubKey& mypk)
             sample_times.push_back(benchmark_verify_sapling_spend());
         } else if (benchmarktype == "verifysaplingoutput") {
             sample_times.push_back(benchmark_verify_sapling_output());
+        } else if (benchmarktype == "buildsaplingtx") {
+            // Number of Sapling outputs of the transaction, spending one note
+            int nOutputs = 10;
+            if (params.size() >= 3) {
+                nOutputs = params[2].get_int();
+            }
+            if (nOutputs < 1) {
+                throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid number of outputs");
+            }
+            if (params.size() < 4) {
+                // One sample each at 1, 2, 4 and 8 threads
+                for (int nThreads = 1; nThreads <= 8; nThreads *= 2) {
+                    sample_times.push_back(benchmark_build_sapling_tx(nOutputs, nThreads));
+                }
+            } else {
+                int nThreads = params[3].get_int();
+                sample_times.push_back(benchmark_build_sapling_tx(nOutputs, nThreads));
+            }
         } else {
             throw JSONRPCError(RPC_TYPE_ERROR, "Invalid benchmarktype");
         }
@@ -3820,6 +4004,81 @@ UniValue z_getnewaddress(const UniValue& params, bool fHelp, const CPubKey& mypk
 
 }
 
+UniValue z_getnewaddresses(const UniValue& params, bool fHelp, const CPubKey& mypk)
+{
+    if (!EnsureWalletIsAvailable(fHelp))
+        return NullUniValue;
+
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "z_getnewaddresses count\n"
+            "\nReturns count new diversified shielded addresses for receiving payments.\n"
+            "\nArguments:\n"
+            "1. count        (numeric, required) The number of addresses to create (1 to " + std::to_string(MAX_NEW_DIVERSIFIED_ADDRESSES) + ").\n"
+            "\nResult:\n"
+            "[\n"
+            "  \"" + strprintf("%s",komodo_chainname()) + "_address\"    (string) A new diversified shielded address.\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("z_getnewaddresses","1000")
+            + HelpExampleRpc("z_getnewaddresses","1000")
+        );
+
+    int nCount = params[0].get_int();
+    if (nCount < 1 || nCount > MAX_NEW_DIVERSIFIED_ADDRESSES)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Invalid count, must be between 1 and %d", MAX_NEW_DIVERSIFIED_ADDRESSES));
+
+    LOCK2(cs_main, pwalletMain->cs_wallet);
+
+    EnsureWalletIsUnlocked();
+
+    UniValue result(UniValue::VARR);
+    for (const SaplingPaymentAddress& zAddress : pwalletMain->GenerateNewSaplingDiversifiedAddresses(nCount)) {
+        pwalletMain->SetZAddressBook(zAddress, "z-sapling", "");
+        result.push_back(EncodePaymentAddress(zAddress));
+    }
+    return result;
+}
+
+UniValue z_getnewaddresskeys(const UniValue& params, bool fHelp, const CPubKey& mypk)
+{
+    if (!EnsureWalletIsAvailable(fHelp))
+        return NullUniValue;
+
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "z_getnewaddresskeys count\n"
+            "This creates count new sapling extended spending keys at the next\n"
+            "account indexes and returns their shielded addresses for receiving payments.\n"
+            "\nArguments:\n"
+            "1. count        (numeric, required) The number of keys to create (1 to " + std::to_string(MAX_NEW_SAPLING_ZKEYS) + ").\n"
+            "\nResult:\n"
+            "[\n"
+            "  \"" + strprintf("%s",komodo_chainname()) + "_address\"    (string) The default address of a new spending key.\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("z_getnewaddresskeys","100")
+            + HelpExampleRpc("z_getnewaddresskeys","100")
+        );
+
+    int nCount = params[0].get_int();
+    if (nCount < 1 || nCount > MAX_NEW_SAPLING_ZKEYS)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Invalid count, must be between 1 and %d", MAX_NEW_SAPLING_ZKEYS));
+
+    LOCK2(cs_main, pwalletMain->cs_wallet);
+
+    EnsureWalletIsUnlocked();
+
+    UniValue result(UniValue::VARR);
+    for (const SaplingPaymentAddress& zAddress : pwalletMain->GenerateNewSaplingZKeys(nCount)) {
+        pwalletMain->SetZAddressBook(zAddress, "z-sapling", "");
+        result.push_back(EncodePaymentAddress(zAddress));
+    }
+    return result;
+}
+
 UniValue z_setprimaryspendingkey(const UniValue& params, bool fHelp, const CPubKey& mypk)
 {
     if (!EnsureWalletIsAvailable(fHelp))
@@ -3925,11 +4184,11 @@ CAmount getBalanceTaddr(std::string transparentAddress, int minDepth=1, bool ign
 
     pwalletMain->AvailableCoins(vecOutputs, false, NULL, true);
 
+    int32_t notarizedHeight = komodo_dpownotarizedheight();
     BOOST_FOREACH(const COutput& out, vecOutputs) {
         int nDepth    = out.tx->GetDepthInMainChain();
         if( minDepth > 1 ) {
-            int nHeight    = tx_height(out.tx->GetHash());
-            int dpowconfs  = komodo_dpowconfs(nHeight, nDepth);
+            int dpowconfs  = komodo_dpowconfs_notarized(notarizedHeight, out.tx->GetHeightInMainChain(), nDepth);
             if (dpowconfs < minDepth) {
                 continue;
             }
@@ -3965,6 +4224,20 @@ CAmount getBalanceZaddr(std::string address, int minDepth = 1, bool ignoreUnspen
     std::vector<CSproutNotePlaintextEntry> sproutEntries;
     std::vector<SaplingNoteEntry> saplingEntries;
     LOCK2(cs_main, pwalletMain->cs_wallet);
+
+    // The common depths are served from the wallet's balance cache
+    if (minDepth == 0 || minDepth == 1) {
+        CShieldedBalances balances = pwalletMain->GetShieldedBalances();
+        if (address.empty())
+            return balances.GetTotal(minDepth, ignoreUnspendable);
+        auto zaddr = DecodePaymentAddress(address);
+        auto saplingAddress = boost::get<libzcash::SaplingPaymentAddress>(&zaddr);
+        if (saplingAddress != nullptr) {
+            auto it = balances.mapAddresses.find(*saplingAddress);
+            return it == balances.mapAddresses.end() ? 0 : it->second.Get(minDepth, ignoreUnspendable);
+        }
+    }
+
     pwalletMain->GetFilteredNotes(sproutEntries, saplingEntries, address, minDepth, true, ignoreUnspendable);
     for (auto & entry : sproutEntries) {
         balance += CAmount(entry.plaintext.value());
@@ -3981,18 +4254,19 @@ UniValue z_listreceivedbyaddress(const UniValue& params, bool fHelp, const CPubK
     if (!EnsureWalletIsAvailable(fHelp))
         return NullUniValue;
 
-    if (fHelp || params.size()==0 || params.size() >2)
+    if (fHelp || params.size()==0 || params.size() >3)
         throw runtime_error(
-            "z_listreceivedbyaddress \"address\" ( minconf )\n"
+            "z_listreceivedbyaddress \"address\" ( minconf includememo )\n"
             "\nReturn a list of amounts received by a zaddr belonging to the node’s wallet.\n"
             "\nArguments:\n"
             "1. \"address\"      (string) The private address.\n"
             "2. minconf          (numeric, optional, default=1) Only include transactions confirmed at least this many times.\n"
+            "3. includememo      (boolean, optional, default=true) Include the memos, Sapling notes are not decrypted without them.\n"
             "\nResult:\n"
             "{\n"
             "  \"txid\": xxxxx,           (string) the transaction id\n"
             "  \"amount\": xxxxx,         (numeric) the amount of value in the note\n"
-            "  \"memo\": xxxxx,           (string) hexadecimal string representation of memo field\n"
+            "  \"memo\": xxxxx,           (string) hexadecimal string representation of memo field, if includememo\n"
             "  \"confirmations\" : n,     (numeric) the number of confirmations\n"
             "  \"jsindex\" (sprout) : n,     (numeric) the joinsplit index\n"
             "  \"jsoutindex\" (sprout) : n,     (numeric) the output index of the joinsplit\n"
@@ -4013,6 +4287,10 @@ UniValue z_listreceivedbyaddress(const UniValue& params, bool fHelp, const CPubK
     if (nMinDepth < 0) {
         throw JSONRPCError(RPC_INVALID_PARAMETER, "Minimum number of confirmations cannot be less than 0");
     }
+    bool fIncludeMemo = true;
+    if (params.size() > 2) {
+        fIncludeMemo = params[2].get_bool();
+    }
 
     // Check that the from address is valid.
     auto fromaddress = params[0].get_str();
@@ -4031,7 +4309,14 @@ UniValue z_listreceivedbyaddress(const UniValue& params, bool fHelp, const CPubK
     UniValue result(UniValue::VARR);
     std::vector<CSproutNotePlaintextEntry> sproutEntries;
     std::vector<SaplingNoteEntry> saplingEntries;
-    pwalletMain->GetFilteredNotes(sproutEntries, saplingEntries, fromaddress, nMinDepth, false, false);
+    std::vector<SaplingReceivedEntry> saplingReceived;
+    auto saplingAddress = boost::get<libzcash::SaplingPaymentAddress>(&zaddr);
+    if (saplingAddress != nullptr) {
+        // Amounts are in the note index and memos in the wallet once decrypted
+        pwalletMain->GetReceivedSaplingNotes(*saplingAddress, nMinDepth, saplingReceived);
+    } else {
+        pwalletMain->GetFilteredNotes(sproutEntries, saplingEntries, fromaddress, nMinDepth, false, false);
+    }
 
     std::set<std::pair<PaymentAddress, uint256>> nullifierSet;
     auto hasSpendingKey = boost::apply_visitor(HaveSpendingKeyForPaymentAddress(pwalletMain), zaddr);
@@ -4040,10 +4325,10 @@ UniValue z_listreceivedbyaddress(const UniValue& params, bool fHelp, const CPubK
     }
 
     if (boost::get<libzcash::SproutPaymentAddress>(&zaddr) != nullptr) {
+        int32_t notarizedHeight = komodo_dpownotarizedheight();
         for (CSproutNotePlaintextEntry & entry : sproutEntries) {
             UniValue obj(UniValue::VOBJ);
-            int nHeight   = tx_height(entry.jsop.hash);
-            int dpowconfs = komodo_dpowconfs(nHeight, entry.confirmations);
+            int dpowconfs = komodo_dpowconfs_notarized(notarizedHeight, NoteEntryHeight(entry.confirmations), entry.confirmations);
             // Only return notarized results when minconf>1
             if (nMinDepth > 1 && dpowconfs == 1)
                 continue;
@@ -4061,25 +4346,119 @@ UniValue z_listreceivedbyaddress(const UniValue& params, bool fHelp, const CPubK
             }
             result.push_back(obj);
         }
-    } else if (boost::get<libzcash::SaplingPaymentAddress>(&zaddr) != nullptr) {
-        for (SaplingNoteEntry & entry : saplingEntries) {
+    } else if (saplingAddress != nullptr) {
+        int32_t notarizedHeight = komodo_dpownotarizedheight();
+        std::array<unsigned char, ZC_MEMO_SIZE> memo;
+        for (SaplingReceivedEntry & entry : saplingReceived) {
             UniValue obj(UniValue::VOBJ);
 
-            int nHeight   = tx_height(entry.op.hash);
-            int dpowconfs = komodo_dpowconfs(nHeight, entry.confirmations);
+            int dpowconfs = komodo_dpowconfs_notarized(notarizedHeight, NoteEntryHeight(entry.confirmations), entry.confirmations);
             // Only return notarized results when minconf>1
             if (nMinDepth > 1 && dpowconfs == 1)
                 continue;
 
             obj.push_back(Pair("txid", entry.op.hash.ToString()));
-            obj.push_back(Pair("amount", ValueFromAmount(CAmount(entry.note.value()))));
-            obj.push_back(Pair("memo", HexStr(entry.memo)));
+            obj.push_back(Pair("amount", ValueFromAmount(entry.value)));
+            if (fIncludeMemo && pwalletMain->GetSaplingMemo(entry.op, memo)) {
+                obj.push_back(Pair("memo", HexStr(memo)));
+            }
             obj.push_back(Pair("outindex", (int)entry.op.n));
             obj.push_back(Pair("rawconfirmations", entry.confirmations));
             obj.push_back(Pair("confirmations", dpowconfs));
             if (hasSpendingKey) {
-              obj.push_back(Pair("change", pwalletMain->IsNoteSaplingChange(nullifierSet, entry.address, entry.op)));
+              obj.push_back(Pair("change", pwalletMain->IsNoteSaplingChange(nullifierSet, *saplingAddress, entry.op)));
+            }
+            result.push_back(obj);
+        }
+    }
+    return result;
+}
+
+UniValue z_findmemo(const UniValue& params, bool fHelp, const CPubKey& mypk)
+{
+    if (!EnsureWalletIsAvailable(fHelp))
+        return NullUniValue;
+
+    if (fHelp || params.size() == 0 || params.size() > 3)
+        throw runtime_error(
+            "z_findmemo \"text\" ( substring minconf )\n"
+            "\nReturn the Sapling notes of the wallet whose memo starts with, or contains, the given text,\n"
+            "such as a payment reference. Memos are looked up in the wallet, notes are only decrypted\n"
+            "the first time their memo is needed.\n"
+            "\nArguments:\n"
+            "1. \"text\"         (string) The text to look for.\n"
+            "2. substring      (boolean, optional, default=false) Match the text anywhere in the memo, not only at its start.\n"
+            "3. minconf        (numeric, optional, default=1) Only include notes confirmed at least this many times.\n"
+            "\nResult:\n"
+            "[{\n"
+            "  \"txid\": xxxxx,           (string) the transaction id\n"
+            "  \"outindex\": n,           (numeric) the output index\n"
+            "  \"address\": xxxxx,        (string) the address that received the note\n"
+            "  \"amount\": xxxxx,         (numeric) the amount of value in the note\n"
+            "  \"memo\": xxxxx,           (string) hexadecimal string representation of memo field\n"
+            "  \"memoStr\": xxxxx,        (string) the memo as text, if it is text\n"
+            "  \"rawconfirmations\" : n,  (numeric) the number of confirmations\n"
+            "  \"confirmations\" : n,     (numeric) the number of notarized confirmations\n"
+            "}, ...]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("z_findmemo", "\"invoice-1024\"")
+            + HelpExampleCli("z_findmemo", "\"1024\" true")
+            + HelpExampleRpc("z_findmemo", "\"invoice-1024\"")
+        );
+
+    LOCK2(cs_main, pwalletMain->cs_wallet);
+
+    std::string strText = params[0].get_str();
+    if (strText.empty()) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Text to look for cannot be empty");
+    }
+    bool fSubstring = false;
+    if (params.size() > 1) {
+        fSubstring = params[1].get_bool();
+    }
+    int nMinDepth = 1;
+    if (params.size() > 2) {
+        nMinDepth = params[2].get_int();
+    }
+    if (nMinDepth < 0) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Minimum number of confirmations cannot be less than 0");
+    }
+
+    // Notes received before their memo was kept are decrypted once here
+    pwalletMain->FillSaplingMemos();
+    std::vector<SaplingOutPoint> vOutPoints;
+    pwalletMain->FindSaplingMemos(std::vector<unsigned char>(strText.begin(), strText.end()), fSubstring, vOutPoints);
+
+    UniValue result(UniValue::VARR);
+    int32_t notarizedHeight = komodo_dpownotarizedheight();
+    std::array<unsigned char, ZC_MEMO_SIZE> memo;
+    for (const SaplingOutPoint& op : vOutPoints) {
+        auto itTx = pwalletMain->mapWallet.find(op.hash);
+        auto itAddrs = pwalletMain->mapSaplingNoteIndexTxAddresses.find(op.hash);
+        if (itTx == pwalletMain->mapWallet.end() || itAddrs == pwalletMain->mapSaplingNoteIndexTxAddresses.end())
+            continue;
+        int nDepth = itTx->second.GetDepthInMainChain();
+        int dpowconfs = komodo_dpowconfs_notarized(notarizedHeight, itTx->second.GetHeightInMainChain(), nDepth);
+        if ((nMinDepth > 1 ? dpowconfs : nDepth) < nMinDepth)
+            continue;
+
+        for (const libzcash::SaplingPaymentAddress& address : itAddrs->second) {
+            const std::map<SaplingOutPoint, CSaplingNoteIndexEntry>& notes = pwalletMain->mapSaplingNoteIndex[address];
+            auto itNote = notes.find(op);
+            if (itNote == notes.end() || !pwalletMain->GetSaplingMemo(op, memo))
+                continue;
+            UniValue obj(UniValue::VOBJ);
+            obj.push_back(Pair("txid", op.hash.ToString()));
+            obj.push_back(Pair("outindex", (int)op.n));
+            obj.push_back(Pair("address", EncodePaymentAddress(address)));
+            obj.push_back(Pair("amount", ValueFromAmount(itNote->second.value)));
+            obj.push_back(Pair("memo", HexStr(memo)));
+            if (memo[0] <= 0xf4) {
+                auto end = std::find_if(memo.rbegin(), memo.rend(), [](unsigned char v) { return v != 0; });
+                obj.push_back(Pair("memoStr", std::string(memo.begin(), end.base())));
             }
+            obj.push_back(Pair("rawconfirmations", nDepth));
+            obj.push_back(Pair("confirmations", dpowconfs));
             result.push_back(obj);
         }
     }
@@ -4193,10 +4572,10 @@ UniValue z_getbalances(const UniValue& params, bool fHelp, const CPubKey& mypk)
     pwalletMain->GetFilteredNotes(sproutEntries, saplingEntries, zaddrs, 0, 99999999, true, !fIncludeWatchonly, false);
     std::map<libzcash::SaplingPaymentAddress, std::vector<CAmount>> mapResults;
 
+    int32_t notarizedHeight = komodo_dpownotarizedheight();
     for (auto & entry : saplingEntries) {
         //Get Note depths
-        int nHeight   = tx_height(entry.op.hash);
-        int dpowconfs = komodo_dpowconfs(nHeight, entry.confirmations);
+        int dpowconfs = komodo_dpowconfs_notarized(notarizedHeight, NoteEntryHeight(entry.confirmations), entry.confirmations);
 
         //Map all balances by address
         std::map<libzcash::SaplingPaymentAddress, std::vector<CAmount>>::iterator it;
@@ -4930,14 +5309,17 @@ When estimating the number of coinbase utxos we can shield in a single transacti
 
 #define SHIELD_COINBASE_DEFAULT_LIMIT 50
 
+// Most transactions z_shieldcoinbase and z_mergetoaddress build in one operation
+#define MAX_TXS_PER_OPERATION 100
+
 UniValue z_shieldcoinbase(const UniValue& params, bool fHelp, const CPubKey& mypk)
 {
     if (!EnsureWalletIsAvailable(fHelp))
         return NullUniValue;
 
-    if (fHelp || params.size() < 2 || params.size() > 4)
+    if (fHelp || params.size() < 2 || params.size() > 5)
         throw runtime_error(
-            "z_shieldcoinbase \"fromaddress\" \"tozaddress\" ( fee ) ( limit )\n"
+            "z_shieldcoinbase \"fromaddress\" \"tozaddress\" ( fee ) ( limit ) ( maxtxs )\n"
             "\nShield transparent coinbase funds by sending to a shielded zaddr.  This is an asynchronous operation and utxos"
             "\nselected for shielding will be locked.  If there is an error, they are unlocked.  The RPC call `listlockunspent`"
             "\ncan be used to return a list of locked utxos.  The number of coinbase utxos selected for shielding can be limited"
@@ -4953,12 +5335,15 @@ UniValue z_shieldcoinbase(const UniValue& params, bool fHelp, const CPubKey& myp
             + strprintf("%s", FormatMoney(SHIELD_COINBASE_DEFAULT_MINERS_FEE)) + ") The fee amount to attach to this transaction.\n"
             "4. limit                 (numeric, optional, default="
             + strprintf("%d", SHIELD_COINBASE_DEFAULT_LIMIT) + ") Limit on the maximum number of utxos to shield.  Set to 0 to use node option -mempooltxinputlimit (before Overwinter), or as many as will fit in the transaction (after Overwinter).\n"
+            "5. maxtxs                (numeric, optional, default=1) Split the utxos over up to this many transactions, each with its own fee and\n"
+            "                         limit of utxos, which are built in parallel (see -consolidationthreads). Above 1 the toaddress has to be a Sapling address.\n"
             "\nResult:\n"
             "{\n"
             "  \"remainingUTXOs\": xxx       (numeric) Number of coinbase utxos still available for shielding.\n"
             "  \"remainingValue\": xxx       (numeric) Value of coinbase utxos still available for shielding.\n"
             "  \"shieldingUTXOs\": xxx        (numeric) Number of coinbase utxos being shielded.\n"
             "  \"shieldingValue\": xxx        (numeric) Value of coinbase utxos being shielded.\n"
+            "  \"shieldingTxs\": xxx          (numeric, only with maxtxs above 1) Number of transactions the utxos are split over.\n"
             "  \"opid\": xxx          (string) An operationid to pass to z_getoperationstatus to get the result of the operation.\n"
             "}\n"
             "\nExamples:\n"
@@ -5005,6 +5390,21 @@ UniValue z_shieldcoinbase(const UniValue& params, bool fHelp, const CPubKey& myp
         }
     }
 
+    size_t nMaxTxs = 1;
+    if (params.size() > 4) {
+        int n = params[4].get_int();
+        if (n < 1 || n > MAX_TXS_PER_OPERATION) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Invalid parameter, maxtxs must be between 1 and %d", MAX_TXS_PER_OPERATION));
+        }
+        nMaxTxs = n;
+        if (nMaxTxs > 1) {
+            auto res = DecodePaymentAddress(destaddress);
+            if (boost::get<libzcash::SaplingPaymentAddress>(&res) == nullptr) {
+                throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid parameter, maxtxs above 1 requires a Sapling toaddress");
+            }
+        }
+    }
+
     int nextBlockHeight = chainActive.Height() + 1;
     bool overwinterActive = NetworkUpgradeActive(nextBlockHeight, Params().GetConsensus(), Consensus::UPGRADE_OVERWINTER);
     unsigned int max_tx_size = MAX_TX_SIZE_AFTER_SAPLING;
@@ -5025,11 +5425,13 @@ UniValue z_shieldcoinbase(const UniValue& params, bool fHelp, const CPubKey& myp
         }
     }
 
-    // Prepare to get coinbase utxos
-    std::vector<ShieldCoinbaseUTXO> inputs;
+    // Prepare to get coinbase utxos, in the inputs of up to nMaxTxs transactions
+    std::vector<std::vector<ShieldCoinbaseUTXO>> txInputs(1);
+    std::vector<CAmount> vTxValues(1, 0);
     CAmount shieldedValue = 0;
     CAmount remainingValue = 0;
-    size_t estimatedTxSize = 2000;  // 1802 joinsplit description + tx overhead + wiggle room
+    const size_t baseTxSize = 2000;  // 1802 joinsplit description + tx overhead + wiggle room
+    size_t estimatedTxSize = baseTxSize;
 
     #ifdef __LP64__
     uint64_t utxoCounter = 0;
@@ -5077,13 +5479,21 @@ UniValue z_shieldcoinbase(const UniValue& params, bool fHelp, const CPubKey& myp
         if (!maxedOutFlag) {
             size_t increase = (boost::get<CScriptID>(&address) != nullptr) ? CTXIN_SPEND_P2SH_SIZE : CTXIN_SPEND_DUST_SIZE;
             if (estimatedTxSize + increase >= max_tx_size ||
-                (mempoolLimit > 0 && utxoCounter > mempoolLimit))
+                (mempoolLimit > 0 && txInputs.back().size() >= mempoolLimit))
             {
-                maxedOutFlag = true;
-            } else {
+                if (txInputs.size() < nMaxTxs) {
+                    txInputs.emplace_back();
+                    vTxValues.push_back(0);
+                    estimatedTxSize = baseTxSize;
+                } else {
+                    maxedOutFlag = true;
+                }
+            }
+            if (!maxedOutFlag) {
                 estimatedTxSize += increase;
                 ShieldCoinbaseUTXO utxo = {out.tx->GetHash(), out.i, scriptPubKey, nValue};
-                inputs.push_back(utxo);
+                txInputs.back().push_back(utxo);
+                vTxValues.back() += nValue;
                 shieldedValue += nValue;
             }
         }
@@ -5093,6 +5503,19 @@ UniValue z_shieldcoinbase(const UniValue& params, bool fHelp, const CPubKey& myp
         }
     }
 
+    // A last transaction which would be mostly fee is left for a later call
+    while (txInputs.size() > 1 && vTxValues.back() < 2 * nFee) {
+        shieldedValue -= vTxValues.back();
+        remainingValue += vTxValues.back();
+        txInputs.pop_back();
+        vTxValues.pop_back();
+    }
+
+    std::vector<ShieldCoinbaseUTXO> inputs;
+    for (const std::vector<ShieldCoinbaseUTXO>& v : txInputs) {
+        inputs.insert(inputs.end(), v.begin(), v.end());
+    }
+
     #ifdef __LP64__
     uint64_t numUtxos = inputs.size();
     #else
@@ -5139,7 +5562,12 @@ UniValue z_shieldcoinbase(const UniValue& params, bool fHelp, const CPubKey& myp
 
     // Create operation and add to global queue
     std::shared_ptr<AsyncRPCQueue> q = getAsyncRPCQueue();
-    std::shared_ptr<AsyncRPCOperation> operation( new AsyncRPCOperation_shieldcoinbase(builder, contextualTx, inputs, destaddress, nFee, contextInfo) );
+    std::shared_ptr<AsyncRPCOperation> operation;
+    if (txInputs.size() > 1) {
+        operation.reset(new AsyncRPCOperation_shieldcoinbase(builder, contextualTx, txInputs, destaddress, nFee, contextInfo));
+    } else {
+        operation.reset(new AsyncRPCOperation_shieldcoinbase(builder, contextualTx, inputs, destaddress, nFee, contextInfo));
+    }
     q->addOperation(operation);
     AsyncRPCOperationId operationId = operation->getId();
 
@@ -5149,6 +5577,9 @@ UniValue z_shieldcoinbase(const UniValue& params, bool fHelp, const CPubKey& myp
     o.push_back(Pair("remainingValue", ValueFromAmount(remainingValue)));
     o.push_back(Pair("shieldingUTXOs", static_cast<uint64_t>(numUtxos)));
     o.push_back(Pair("shieldingValue", ValueFromAmount(shieldedValue)));
+    if (nMaxTxs > 1) {
+        o.push_back(Pair("shieldingTxs", static_cast<uint64_t>(txInputs.size())));
+    }
     o.push_back(Pair("opid", operationId));
     return o;
 }
@@ -5259,9 +5690,9 @@ UniValue z_mergetoaddress(const UniValue& params, bool fHelp, const CPubKey& myp
         strDisabledMsg = experimentalDisabledHelpMsg("z_mergetoaddress", enableArg);
     }
 
-    if (fHelp || params.size() < 2 || params.size() > 7)
+    if (fHelp || params.size() < 2 || params.size() > 8)
         throw runtime_error(
-            "z_mergetoaddress [\"fromaddress\", ... ] \"toaddress\" ( fee ) ( transparent_limit ) ( shielded_limit ) ( memo )\n"
+            "z_mergetoaddress [\"fromaddress\", ... ] \"toaddress\" ( fee ) ( transparent_limit ) ( shielded_limit ) ( maximum_utxo_size ) ( memo ) ( maxtxs )\n"
             + strDisabledMsg +
             "\nMerge multiple UTXOs and notes into a single UTXO or note.  Coinbase UTXOs are ignored; use `z_shieldcoinbase`"
             "\nto combine those into a single note."
@@ -5292,6 +5723,8 @@ UniValue z_mergetoaddress(const UniValue& params, bool fHelp, const CPubKey& myp
             + strprintf("%d Sprout or %d Sapling Notes", MERGE_TO_ADDRESS_DEFAULT_SPROUT_LIMIT, MERGE_TO_ADDRESS_DEFAULT_SAPLING_LIMIT) + ") Limit on the maximum number of notes to merge.  Set to 0 to merge as many as will fit in the transaction.\n"
             "5. maximum_utxo_size       (numeric, optional) eg, 0.0001 anything under 10000 satoshies will be merged, ignores 10,000 sat p2pk utxo that iguana uses, and merges coinbase utxo.\n"
             "6. \"memo\"                (string, optional) Encoded as hex. When toaddress is a z-addr, this will be stored in the memo field of the new note.\n"
+            "7. maxtxs                (numeric, optional, default=1) Split the UTXOs and notes over up to this many transactions, each with its own fee and\n"
+            "                         limits, which are built in parallel (see -consolidationthreads). Above 1 the toaddress has to be a Sapling address.\n"
 
             "\nResult:\n"
             "{\n"
@@ -5303,6 +5736,7 @@ UniValue z_mergetoaddress(const UniValue& params, bool fHelp, const CPubKey& myp
             "  \"mergingTransparentValue\": xxx      (numeric) Value of UTXOs being merged.\n"
             "  \"mergingNotes\": xxx                 (numeric) Number of notes being merged.\n"
             "  \"mergingShieldedValue\": xxx         (numeric) Value of notes being merged.\n"
+            "  \"mergingTxs\": xxx                   (numeric, only with maxtxs above 1) Number of transactions the inputs are split over.\n"
             "  \"opid\": xxx          (string) An operationid to pass to z_getoperationstatus to get the result of the operation.\n"
             "}\n"
             "\nExamples:\n"
@@ -5448,12 +5882,24 @@ UniValue z_mergetoaddress(const UniValue& params, bool fHelp, const CPubKey& myp
         }
     }
 
+    size_t nMaxTxs = 1;
+    if (params.size() > 7) {
+        int n = params[7].get_int();
+        if (n < 1 || n > MAX_TXS_PER_OPERATION) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Invalid parameter, maxtxs must be between 1 and %d", MAX_TXS_PER_OPERATION));
+        }
+        nMaxTxs = n;
+        if (nMaxTxs > 1 && !isToSaplingZaddr) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid parameter, maxtxs above 1 requires a Sapling toaddress");
+        }
+    }
+
     MergeToAddressRecipient recipient(destaddress, memo);
 
-    // Prepare to get UTXOs and notes
-    std::vector<MergeToAddressInputUTXO> utxoInputs;
+    // Prepare to get UTXOs and notes, in the inputs of up to nMaxTxs transactions.
+    // Only a Sapling merge can have more than one, so Sprout notes are kept apart.
+    std::vector<MergeToAddressTxInputs> txInputs(1);
     std::vector<MergeToAddressInputSproutNote> sproutNoteInputs;
-    std::vector<MergeToAddressInputSaplingNote> saplingNoteInputs;
     CAmount mergedUTXOValue = 0;
     CAmount mergedNoteValue = 0;
     CAmount remainingUTXOValue = 0;
@@ -5465,12 +5911,13 @@ UniValue z_mergetoaddress(const UniValue& params, bool fHelp, const CPubKey& myp
     size_t mempoolLimit = (nUTXOLimit != 0) ? nUTXOLimit : (overwinterActive ? 0 : (size_t)GetArg("-mempooltxinputlimit", 0));
 
     unsigned int max_tx_size = saplingActive ? MAX_TX_SIZE_AFTER_SAPLING : MAX_TX_SIZE_BEFORE_SAPLING;
-    size_t estimatedTxSize = 200;  // tx overhead + wiggle room
+    size_t baseTxSize = 200;  // tx overhead + wiggle room
     if (isToSproutZaddr) {
-        estimatedTxSize += JOINSPLIT_SIZE;
+        baseTxSize += JOINSPLIT_SIZE;
     } else if (isToSaplingZaddr) {
-        estimatedTxSize += OUTPUTDESCRIPTION_SIZE;
+        baseTxSize += OUTPUTDESCRIPTION_SIZE;
     }
+    size_t estimatedTxSize = baseTxSize;
 
     if (useAnyUTXO || taddrs.size() > 0) {
         // Get available utxos
@@ -5509,13 +5956,19 @@ UniValue z_mergetoaddress(const UniValue& params, bool fHelp, const CPubKey& myp
             if (!maxedOutUTXOsFlag) {
                 size_t increase = (boost::get<CScriptID>(&address) != nullptr) ? CTXIN_SPEND_P2SH_SIZE : CTXIN_SPEND_DUST_SIZE;
                 if (estimatedTxSize + increase >= max_tx_size ||
-                    (mempoolLimit > 0 && utxoCounter > mempoolLimit))
+                    (mempoolLimit > 0 && txInputs.back().utxoInputs.size() >= mempoolLimit))
                 {
-                    maxedOutUTXOsFlag = true;
-                } else {
+                    if (txInputs.size() < nMaxTxs) {
+                        txInputs.emplace_back();
+                        estimatedTxSize = baseTxSize;
+                    } else {
+                        maxedOutUTXOsFlag = true;
+                    }
+                }
+                if (!maxedOutUTXOsFlag) {
                     estimatedTxSize += increase;
                     COutPoint utxo(out.tx->GetHash(), out.i);
-                    utxoInputs.emplace_back(utxo, nValue, scriptPubKey);
+                    txInputs.back().utxoInputs.emplace_back(utxo, nValue, scriptPubKey);
                     mergedUTXOValue += nValue;
                 }
             }
@@ -5584,16 +6037,22 @@ UniValue z_mergetoaddress(const UniValue& params, bool fHelp, const CPubKey& myp
             if (!maxedOutNotesFlag) {
                 size_t increase = SPENDDESCRIPTION_SIZE;
                 if (estimatedTxSize + increase >= max_tx_size ||
-                    (saplingNoteLimit > 0 && noteCounter > saplingNoteLimit))
+                    (saplingNoteLimit > 0 && txInputs.back().saplingNoteInputs.size() >= saplingNoteLimit))
                 {
-                    maxedOutNotesFlag = true;
-                } else {
+                    if (txInputs.size() < nMaxTxs) {
+                        txInputs.emplace_back();
+                        estimatedTxSize = baseTxSize;
+                    } else {
+                        maxedOutNotesFlag = true;
+                    }
+                }
+                if (!maxedOutNotesFlag) {
                     estimatedTxSize += increase;
                     libzcash::SaplingExtendedSpendingKey extsk;
                     if (!pwalletMain->GetSaplingExtendedSpendingKey(entry.address, extsk)) {
                         throw JSONRPCError(RPC_INVALID_PARAMETER, "Could not find spending key for payment address.");
                     }
-                    saplingNoteInputs.emplace_back(entry.op, entry.note, nValue, extsk.expsk);
+                    txInputs.back().saplingNoteInputs.emplace_back(entry.op, entry.note, nValue, extsk.expsk);
                     mergedNoteValue += nValue;
                 }
             }
@@ -5604,6 +6063,32 @@ UniValue z_mergetoaddress(const UniValue& params, bool fHelp, const CPubKey& myp
         }
     }
 
+    // A last transaction which would be mostly fee is left for a later call
+    while (txInputs.size() > 1) {
+        CAmount utxoValue = 0, noteValue = 0;
+        for (const MergeToAddressInputUTXO& t : txInputs.back().utxoInputs) {
+            utxoValue += std::get<1>(t);
+        }
+        for (const MergeToAddressInputSaplingNote& t : txInputs.back().saplingNoteInputs) {
+            noteValue += std::get<2>(t);
+        }
+        if (utxoValue + noteValue >= 2 * nFee) {
+            break;
+        }
+        mergedUTXOValue -= utxoValue;
+        remainingUTXOValue += utxoValue;
+        mergedNoteValue -= noteValue;
+        remainingNoteValue += noteValue;
+        txInputs.pop_back();
+    }
+
+    std::vector<MergeToAddressInputUTXO> utxoInputs;
+    std::vector<MergeToAddressInputSaplingNote> saplingNoteInputs;
+    for (const MergeToAddressTxInputs& tx : txInputs) {
+        utxoInputs.insert(utxoInputs.end(), tx.utxoInputs.begin(), tx.utxoInputs.end());
+        saplingNoteInputs.insert(saplingNoteInputs.end(), tx.saplingNoteInputs.begin(), tx.saplingNoteInputs.end());
+    }
+
     size_t numUtxos = utxoInputs.size();
     size_t numNotes = sproutNoteInputs.size() + saplingNoteInputs.size();
 
@@ -5657,8 +6142,12 @@ UniValue z_mergetoaddress(const UniValue& params, bool fHelp, const CPubKey& myp
 
     // Create operation and add to global queue
     std::shared_ptr<AsyncRPCQueue> q = getAsyncRPCQueue();
-    std::shared_ptr<AsyncRPCOperation> operation(
-                                                 new AsyncRPCOperation_mergetoaddress(builder, contextualTx, utxoInputs, sproutNoteInputs, saplingNoteInputs, recipient, nFee, contextInfo) );
+    std::shared_ptr<AsyncRPCOperation> operation;
+    if (txInputs.size() > 1) {
+        operation.reset(new AsyncRPCOperation_mergetoaddress(builder.get(), txInputs, recipient, nFee, contextInfo));
+    } else {
+        operation.reset(new AsyncRPCOperation_mergetoaddress(builder, contextualTx, utxoInputs, sproutNoteInputs, saplingNoteInputs, recipient, nFee, contextInfo));
+    }
     q->addOperation(operation);
     AsyncRPCOperationId operationId = operation->getId();
 
@@ -5672,6 +6161,9 @@ UniValue z_mergetoaddress(const UniValue& params, bool fHelp, const CPubKey& myp
     o.push_back(Pair("mergingTransparentValue", ValueFromAmount(mergedUTXOValue)));
     o.push_back(Pair("mergingNotes", static_cast<uint64_t>(numNotes)));
     o.push_back(Pair("mergingShieldedValue", ValueFromAmount(mergedNoteValue)));
+    if (nMaxTxs > 1) {
+        o.push_back(Pair("mergingTxs", static_cast<uint64_t>(txInputs.size())));
+    }
     o.push_back(Pair("opid", operationId));
     return o;
 }
@@ -8654,6 +9146,7 @@ extern UniValue z_exportkey(const UniValue& params, bool fHelp, const CPubKey& m
 extern UniValue z_importkey(const UniValue& params, bool fHelp, const CPubKey& mypk);
 extern UniValue z_exportviewingkey(const UniValue& params, bool fHelp, const CPubKey& mypk);
 extern UniValue z_importviewingkey(const UniValue& params, bool fHelp, const CPubKey& mypk);
+extern UniValue z_importkeys(const UniValue& params, bool fHelp, const CPubKey& mypk);
 extern UniValue z_exportwallet(const UniValue& params, bool fHelp, const CPubKey& mypk);
 extern UniValue z_importwallet(const UniValue& params, bool fHelp, const CPubKey& mypk);
 
@@ -8681,6 +9174,8 @@ static const CRPCCommand commands[] =
     { "wallet",             "gettransaction",           &gettransaction,           false },
     { "wallet",             "getunconfirmedbalance",    &getunconfirmedbalance,    false },
     { "wallet",             "getwalletinfo",            &getwalletinfo,            false },
+    { "wallet",             "getwalletmemoryinfo",      &getwalletmemoryinfo,      false },
+    { "wallet",             "getwalletscanstatus",      &getwalletscanstatus,      true  },
     { "wallet",             "convertpassphrase",        &convertpassphrase,        true  },
     { "wallet",             "importprivkey",            &importprivkey,            true  },
     { "wallet",             "importwallet",             &importwallet,             true  },
@@ -8711,6 +9206,7 @@ static const CRPCCommand commands[] =
     { "wallet",             "zcrawreceive",             &zc_raw_receive,           true  },
     { "wallet",             "zcsamplejoinsplit",        &zc_sample_joinsplit,      true  },
     { "wallet",             "z_listreceivedbyaddress",  &z_listreceivedbyaddress,  false },
+    { "wallet",             "z_findmemo",               &z_findmemo,               false },
     { "wallet",             "z_listunspent",            &z_listunspent,            false },
     { "wallet",             "z_getbalance",             &z_getbalance,             false },
     { "wallet",             "z_gettotalbalance",        &z_gettotalbalance,        false },
@@ -8721,13 +9217,16 @@ static const CRPCCommand commands[] =
     { "wallet",             "z_getoperationresult",     &z_getoperationresult,     true  },
     { "wallet",             "z_listoperationids",       &z_listoperationids,       true  },
     { "wallet",             "z_getnewaddresskey",       &z_getnewaddresskey,       true  },
+    { "wallet",             "z_getnewaddresskeys",      &z_getnewaddresskeys,      true  },
     { "wallet",             "z_getnewaddress",          &z_getnewaddress,          true  },
+    { "wallet",             "z_getnewaddresses",        &z_getnewaddresses,        true  },
     { "wallet",             "z_setprimaryspendingkey",  &z_setprimaryspendingkey,  true  },
     { "wallet",             "z_listaddresses",          &z_listaddresses,          true  },
     { "wallet",             "z_exportkey",              &z_exportkey,              true  },
     { "wallet",             "z_importkey",              &z_importkey,              true  },
     { "wallet",             "z_exportviewingkey",       &z_exportviewingkey,       true  },
     { "wallet",             "z_importviewingkey",       &z_importviewingkey,       true  },
+    { "wallet",             "z_importkeys",             &z_importkeys,             true  },
     { "wallet",             "z_exportwallet",           &z_exportwallet,           true  },
     { "wallet",             "z_importwallet",           &z_importwallet,           true  },
     { "wallet",             "z_viewtransaction",        &z_viewtransaction,        true  },
@@ -2,6 +2,7 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "wallet/vkscanner.h"
 #include "wallet/wallet.h"
 
 #include <set>
@@ -307,4 +308,67 @@ BOOST_AUTO_TEST_CASE(coin_selection_tests)
     empty_wallet();
 }
 
+BOOST_AUTO_TEST_CASE(coin_selection_without_change)
+{
+    CoinSet setCoinsRet;
+    CAmount nValueRet;
+
+    LOCK(wallet.cs_wallet);
+
+    // Only 5 + 2 cents and 20 satoshis come within a change output of the target
+    empty_wallet();
+    add_coin(5 * CENT);
+    add_coin(3 * CENT);
+    add_coin(2 * CENT + 20);
+    add_coin(1 * CENT);
+    BOOST_CHECK(wallet.SelectCoinsMinConf(7 * CENT + 10, 1, 6, vCoins, setCoinsRet, nValueRet));
+    BOOST_CHECK_EQUAL(nValueRet, 7 * CENT + 20);
+    BOOST_CHECK_EQUAL(setCoinsRet.size(), 2U);
+
+    // Many coins of the same value are searched as one
+    empty_wallet();
+    for (int i = 0; i < 10000; i++)
+        add_coin(1 * CENT);
+    add_coin(3 * COIN);
+    BOOST_CHECK(wallet.SelectCoinsMinConf(3 * COIN + 2 * CENT, 1, 6, vCoins, setCoinsRet, nValueRet));
+    BOOST_CHECK_EQUAL(nValueRet, 3 * COIN + 2 * CENT);
+    empty_wallet();
+}
+
+BOOST_AUTO_TEST_CASE(vkscanner_db_round_trip)
+{
+    CViewingKeyScannerDB db(1 << 20, true);
+    CScannerKey key;
+    key.nStartHeight = 100;
+    CScannerNote note;
+    note.ivk = uint256S("01");
+    note.nValue = 5 * COIN;
+    note.nHeight = 120;
+    SaplingOutPoint op(uint256S("02"), 1);
+
+    CDBBatch batch(db);
+    CViewingKeyScannerDB::WriteKey(batch, "a", uint256S("01"), key);
+    CViewingKeyScannerDB::WriteKey(batch, "b", uint256S("01"), key);
+    CViewingKeyScannerDB::WriteKey(batch, "b", uint256S("03"), key);
+    CViewingKeyScannerDB::WriteNote(batch, "a", op, note);
+    CViewingKeyScannerDB::WriteBestBlock(batch, uint256S("04"));
+    BOOST_CHECK(db.WriteBatch(batch));
+
+    // Records of one tenant don't run into those of the next, nor keys into notes
+    std::map<std::string, std::map<uint256, CScannerKey>> mapKeys;
+    std::map<std::string, std::map<SaplingOutPoint, CScannerNote>> mapNotes;
+    BOOST_CHECK(db.LoadKeys(mapKeys));
+    BOOST_CHECK(db.LoadNotes(mapNotes));
+    BOOST_CHECK_EQUAL(mapKeys.size(), 2);
+    BOOST_CHECK_EQUAL(mapKeys["a"].size(), 1);
+    BOOST_CHECK_EQUAL(mapKeys["b"].size(), 2);
+    BOOST_CHECK_EQUAL(mapKeys["b"][uint256S("03")].nStartHeight, 100);
+    BOOST_CHECK_EQUAL(mapNotes.size(), 1);
+    BOOST_CHECK_EQUAL(mapNotes["a"][op].nValue, 5 * COIN);
+    BOOST_CHECK(!mapNotes["a"][op].IsSpent());
+    uint256 hashBest;
+    BOOST_CHECK(db.ReadBestBlock(hashBest));
+    BOOST_CHECK(hashBest == uint256S("04"));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,774 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "wallet/vkscanner.h"
+
+#include "blockfilemap.h"
+#include "chain.h"
+#include "key_io.h"
+#include "main.h"
+#include "primitives/block.h"
+#include "primitives/txview.h"
+#include "rpc/server.h"
+#include "util.h"
+#include "util/parallel.h"
+#include "wallet/wallet.h"
+#include "zcash/Note.hpp"
+
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
+
+#include <univalue.h>
+
+using namespace std;
+
+static const char DB_KEY = 'k';
+static const char DB_NOTE = 'n';
+static const char DB_BEST_BLOCK = 'B';
+
+CViewingKeyScanner* pviewingKeyScanner = NULL;
+
+CViewingKeyScannerDB::CViewingKeyScannerDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "vkscanner", nCacheSize, fMemory, fWipe) {
+}
+
+void CViewingKeyScannerDB::WriteKey(CDBBatch& batch, const std::string& tenant, const uint256& ivk, const CScannerKey& key) {
+    batch.Write(make_pair(DB_KEY, make_pair(tenant, ivk)), key);
+}
+
+void CViewingKeyScannerDB::EraseKey(CDBBatch& batch, const std::string& tenant, const uint256& ivk) {
+    batch.Erase(make_pair(DB_KEY, make_pair(tenant, ivk)));
+}
+
+void CViewingKeyScannerDB::WriteNote(CDBBatch& batch, const std::string& tenant, const SaplingOutPoint& op, const CScannerNote& note) {
+    batch.Write(make_pair(DB_NOTE, make_pair(tenant, op)), note);
+}
+
+void CViewingKeyScannerDB::EraseNote(CDBBatch& batch, const std::string& tenant, const SaplingOutPoint& op) {
+    batch.Erase(make_pair(DB_NOTE, make_pair(tenant, op)));
+}
+
+void CViewingKeyScannerDB::WriteBestBlock(CDBBatch& batch, const uint256& hash) {
+    batch.Write(DB_BEST_BLOCK, hash);
+}
+
+bool CViewingKeyScannerDB::ReadBestBlock(uint256& hash) {
+    return Read(DB_BEST_BLOCK, hash);
+}
+
+bool CViewingKeyScannerDB::LoadKeys(std::map<std::string, std::map<uint256, CScannerKey>>& mapKeys) {
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+    // Keys are ordered by type, so each type is one contiguous range
+    pcursor->Seek(make_pair(DB_KEY, make_pair(std::string(), uint256())));
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        std::pair<char, std::pair<std::string, uint256>> key;
+        if (!pcursor->GetKey(key) || key.first != DB_KEY)
+            break;
+        CScannerKey scannerKey;
+        if (!pcursor->GetValue(scannerKey))
+            return error("%s: failed to read the key of tenant %s", __func__, key.second.first);
+        mapKeys[key.second.first][key.second.second] = scannerKey;
+        pcursor->Next();
+    }
+    return true;
+}
+
+bool CViewingKeyScannerDB::LoadNotes(std::map<std::string, std::map<SaplingOutPoint, CScannerNote>>& mapNotes) {
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+    pcursor->Seek(make_pair(DB_NOTE, make_pair(std::string(), SaplingOutPoint())));
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        std::pair<char, std::pair<std::string, SaplingOutPoint>> key;
+        if (!pcursor->GetKey(key) || key.first != DB_NOTE)
+            break;
+        CScannerNote note;
+        if (!pcursor->GetValue(note))
+            return error("%s: failed to read a note of tenant %s", __func__, key.second.first);
+        mapNotes[key.second.first][key.second.second] = note;
+        pcursor->Next();
+    }
+    return true;
+}
+
+/**
+ * Trial decrypts the outputs with the keys of vChunks, one task per output
+ * and chunk, shared out between -zdecryptthreads workers. Each chunk's key
+ * agreements are batched by AttemptSaplingEncDecryption. Every matching key
+ * of an output is returned, in chunk order.
+ */
+static void TrialDecryptScannerOutputs(
+    const std::vector<const CScannerOutput*>& vOutputs,
+    const std::vector<std::vector<uint256>>& vChunks,
+    std::vector<std::vector<std::pair<uint256, libzcash::SaplingNotePlaintext>>>& vResults)
+{
+    vResults.assign(vOutputs.size(), std::vector<std::pair<uint256, libzcash::SaplingNotePlaintext>>());
+    const size_t nTasks = vOutputs.size() * vChunks.size();
+    if (nTasks == 0)
+        return;
+
+    std::vector<std::vector<std::pair<size_t, libzcash::SaplingNotePlaintext>>> vTaskResults(nTasks);
+    ParallelFor(nTasks, nSaplingDecryptThreads, [&](size_t n) {
+        const CScannerOutput& output = *vOutputs[n / vChunks.size()];
+        vTaskResults[n] = libzcash::SaplingNotePlaintext::decrypt_batch(
+            *output.pCiphertext, vChunks[n % vChunks.size()], output.epk, output.cmu);
+    });
+
+    for (size_t n = 0; n < nTasks; n++) {
+        const std::vector<uint256>& vChunk = vChunks[n % vChunks.size()];
+        for (const std::pair<size_t, libzcash::SaplingNotePlaintext>& match : vTaskResults[n])
+            vResults[n / vChunks.size()].push_back(std::make_pair(vChunk[match.first], match.second));
+    }
+}
+
+std::vector<CScannerTx> CScannerTx::FromBlock(const CBlock& block)
+{
+    std::vector<CScannerTx> vtx(block.vtx.size());
+    for (size_t i = 0; i < block.vtx.size(); i++) {
+        const CTransaction& tx = block.vtx[i];
+        vtx[i].hash = tx.GetHash();
+        for (const SpendDescription& spend : tx.vShieldedSpend)
+            vtx[i].vNullifiers.push_back(spend.nullifier);
+        for (const OutputDescription& output : tx.vShieldedOutput)
+            vtx[i].vOutputs.push_back(CScannerOutput(output.cm, output.ephemeralKey, &output.encCiphertext));
+    }
+    return vtx;
+}
+
+std::vector<CScannerTx> CScannerTx::FromBlockView(const CBlockView& block)
+{
+    const std::vector<CTransactionView>& vtxView = block.GetTransactions();
+    std::vector<CScannerTx> vtx(vtxView.size());
+    for (size_t i = 0; i < vtxView.size(); i++) {
+        const CTransactionView& tx = vtxView[i];
+        // Transactions without Sapling data don't need their hash
+        if (tx.GetSpendCount() == 0 && tx.GetShieldedOutputCount() == 0)
+            continue;
+        vtx[i].hash = tx.GetHash();
+        for (size_t j = 0; j < tx.GetSpendCount(); j++)
+            vtx[i].vNullifiers.push_back(tx.GetSpendNullifier(j));
+        for (size_t j = 0; j < tx.GetShieldedOutputCount(); j++)
+            vtx[i].vOutputs.push_back(CScannerOutput(tx.GetShieldedOutputCmu(j), tx.GetShieldedOutputEphemeralKey(j),
+                                                     &tx.GetShieldedOutputCiphertext(j)));
+    }
+    return vtx;
+}
+
+static std::vector<std::vector<uint256>> MakeIvkChunks(const std::vector<uint256>& vIvks)
+{
+    std::vector<std::vector<uint256>> vChunks;
+    for (size_t i = 0; i < vIvks.size(); i += VKSCANNER_KEY_CHUNK)
+        vChunks.push_back(std::vector<uint256>(vIvks.begin() + i, vIvks.begin() + std::min(vIvks.size(), i + VKSCANNER_KEY_CHUNK)));
+    return vChunks;
+}
+
+CViewingKeyScanner::CViewingKeyScanner(size_t nCacheSize, bool fMemory, bool fWipe) :
+    db(nCacheSize, fMemory, fWipe), pindexBest(NULL)
+{
+}
+
+void CViewingKeyScanner::AddKeyOwner(const std::string& tenant, const uint256& ivk, const CScannerKey& key)
+{
+    CKeyOwners& owners = mapKeyOwners[ivk];
+    owners.fvk = key.extfvk.fvk;
+    owners.setTenants.insert(tenant);
+}
+
+void CViewingKeyScanner::RebuildIvkChunks()
+{
+    std::vector<uint256> vIvks;
+    vIvks.reserve(mapKeyOwners.size());
+    for (const std::pair<const uint256, CKeyOwners>& entry : mapKeyOwners)
+        vIvks.push_back(entry.first);
+    vIvkChunks = MakeIvkChunks(vIvks);
+}
+
+bool CViewingKeyScanner::Load(std::string& strError)
+{
+    LOCK2(cs_main, cs_vkscanner);
+
+    if (!db.LoadKeys(mapTenantKeys) || !db.LoadNotes(mapTenantNotes)) {
+        strError = "failed to read the viewing key scanner database";
+        return false;
+    }
+    int nMinStartHeight = -1;
+    for (const std::pair<const std::string, std::map<uint256, CScannerKey>>& tenant : mapTenantKeys) {
+        for (const std::pair<const uint256, CScannerKey>& key : tenant.second) {
+            AddKeyOwner(tenant.first, key.first, key.second);
+            if (nMinStartHeight < 0 || key.second.nStartHeight < nMinStartHeight)
+                nMinStartHeight = key.second.nStartHeight;
+        }
+    }
+    RebuildIvkChunks();
+    for (const std::pair<const std::string, std::map<SaplingOutPoint, CScannerNote>>& tenant : mapTenantNotes)
+        for (const std::pair<const SaplingOutPoint, CScannerNote>& note : tenant.second)
+            if (!note.second.IsSpent())
+                mapNullifiers.insert(std::make_pair(note.second.nullifier, std::make_pair(tenant.first, note.first)));
+
+    CDBBatch batch(db);
+    const CBlockIndex* pindexStart = NULL;
+    uint256 hashBest;
+    if (db.ReadBestBlock(hashBest) && mapBlockIndex.count(hashBest)) {
+        pindexBest = mapBlockIndex[hashBest];
+        // Blocks the node no longer has on its active chain are undone
+        DisconnectTo(chainActive.FindFork(pindexBest), batch);
+        pindexStart = chainActive.Next(pindexBest);
+    } else if (nMinStartHeight >= 0) {
+        // The block index was rebuilt, all the keys are scanned again
+        LogPrintf("%s: last block scanned not found, rescanning from height %d\n", __func__, nMinStartHeight);
+        for (const std::pair<const std::string, std::map<SaplingOutPoint, CScannerNote>>& tenant : mapTenantNotes)
+            for (const std::pair<const SaplingOutPoint, CScannerNote>& note : tenant.second)
+                CViewingKeyScannerDB::EraseNote(batch, tenant.first, note.first);
+        mapTenantNotes.clear();
+        mapNullifiers.clear();
+        pindexStart = chainActive[std::min(nMinStartHeight, chainActive.Height())];
+    } else {
+        pindexBest = chainActive.Tip();
+    }
+
+    if (pindexStart != NULL) {
+        LogPrintf("%s: scanning blocks %d to %d\n", __func__, pindexStart->GetHeight(), chainActive.Height());
+        if (!ScanBlocks(pindexStart, chainActive.Tip(), vIvkChunks, batch, strError))
+            return false;
+        pindexBest = chainActive.Tip();
+    }
+    if (pindexBest != NULL)
+        CViewingKeyScannerDB::WriteBestBlock(batch, pindexBest->GetBlockHash());
+    if (!db.WriteBatch(batch, true)) {
+        strError = "failed to write the viewing key scanner database";
+        return false;
+    }
+    return true;
+}
+
+void CViewingKeyScanner::ConnectBlock(const CBlockIndex* pindex, const std::vector<CScannerTx>& vtx, uint64_t nPosition,
+                                      const std::vector<std::vector<uint256>>& vChunks, CDBBatch& batch)
+{
+    AssertLockHeld(cs_vkscanner);
+
+    std::vector<const CScannerOutput*> vOutputs;
+    for (const CScannerTx& tx : vtx)
+        for (const CScannerOutput& output : tx.vOutputs)
+            vOutputs.push_back(&output);
+    std::vector<std::vector<std::pair<uint256, libzcash::SaplingNotePlaintext>>> vResults;
+    TrialDecryptScannerOutputs(vOutputs, vChunks, vResults);
+
+    // Transactions in block order, so a note can be spent later in the block it is received in
+    size_t nOutput = 0;
+    for (const CScannerTx& tx : vtx) {
+        const uint256& hash = tx.hash;
+        for (const uint256& nullifier : tx.vNullifiers) {
+            auto range = mapNullifiers.equal_range(nullifier);
+            for (auto it = range.first; it != range.second; it++) {
+                CScannerNote& note = mapTenantNotes[it->second.first][it->second.second];
+                note.nSpentHeight = pindex->GetHeight();
+                note.spendTxid = hash;
+                CViewingKeyScannerDB::WriteNote(batch, it->second.first, it->second.second, note);
+            }
+            mapNullifiers.erase(range.first, range.second);
+        }
+
+        for (uint32_t i = 0; i < tx.vOutputs.size(); i++, nOutput++, nPosition++) {
+            for (const std::pair<uint256, libzcash::SaplingNotePlaintext>& match : vResults[nOutput]) {
+                const CKeyOwners& owners = mapKeyOwners.at(match.first);
+                libzcash::SaplingIncomingViewingKey ivk(match.first);
+                auto address = ivk.address(match.second.d);
+                auto note = match.second.note(ivk);
+                if (!address || !note)
+                    continue;
+                auto nullifier = note->nullifier(owners.fvk, nPosition);
+                if (!nullifier)
+                    continue;
+
+                CScannerNote scannerNote;
+                scannerNote.ivk = match.first;
+                scannerNote.address = address.get();
+                scannerNote.nValue = note->value();
+                scannerNote.nullifier = nullifier.get();
+                scannerNote.nHeight = pindex->GetHeight();
+                SaplingOutPoint op(hash, i);
+                for (const std::string& tenant : owners.setTenants) {
+                    mapTenantNotes[tenant][op] = scannerNote;
+                    mapNullifiers.insert(std::make_pair(scannerNote.nullifier, std::make_pair(tenant, op)));
+                    CViewingKeyScannerDB::WriteNote(batch, tenant, op, scannerNote);
+                }
+            }
+        }
+    }
+}
+
+void CViewingKeyScanner::DisconnectTo(const CBlockIndex* pindexFork, CDBBatch& batch)
+{
+    AssertLockHeld(cs_vkscanner);
+
+    int nForkHeight = pindexFork ? pindexFork->GetHeight() : -1;
+    if (pindexBest == NULL || pindexBest->GetHeight() <= nForkHeight)
+        return;
+
+    for (std::pair<const std::string, std::map<SaplingOutPoint, CScannerNote>>& tenant : mapTenantNotes) {
+        std::map<SaplingOutPoint, CScannerNote>::iterator it = tenant.second.begin();
+        while (it != tenant.second.end()) {
+            CScannerNote& note = it->second;
+            if (note.nHeight > nForkHeight) {
+                // Its nullifier is only in mapNullifiers while it is unspent
+                auto range = mapNullifiers.equal_range(note.nullifier);
+                for (auto itNf = range.first; itNf != range.second; itNf++) {
+                    if (itNf->second.first == tenant.first && itNf->second.second == it->first) {
+                        mapNullifiers.erase(itNf);
+                        break;
+                    }
+                }
+                CViewingKeyScannerDB::EraseNote(batch, tenant.first, it->first);
+                tenant.second.erase(it++);
+                continue;
+            }
+            if (note.nSpentHeight > nForkHeight) {
+                note.nSpentHeight = -1;
+                note.spendTxid.SetNull();
+                mapNullifiers.insert(std::make_pair(note.nullifier, std::make_pair(tenant.first, it->first)));
+                CViewingKeyScannerDB::WriteNote(batch, tenant.first, it->first, note);
+            }
+            it++;
+        }
+    }
+    pindexBest = pindexFork;
+}
+
+bool CViewingKeyScanner::ScanBlocks(const CBlockIndex* pindexStart, const CBlockIndex* pindexEnd,
+                                    const std::vector<std::vector<uint256>>& vChunks, CDBBatch& batch, std::string& strError)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_vkscanner);
+
+    if (pindexStart == NULL || pindexEnd == NULL || pindexStart->GetHeight() > pindexEnd->GetHeight())
+        return true;
+
+    uint64_t nPosition = 0;
+    if (pindexStart->pprev != NULL) {
+        std::shared_ptr<const SaplingMerkleTree> pSaplingTree = pcoinsTip->GetSharedSaplingAnchorAt(pindexStart->pprev->hashFinalSaplingRoot);
+        if (!pSaplingTree) {
+            strError = strprintf("no Sapling commitment tree for block %d", pindexStart->pprev->GetHeight());
+            return false;
+        }
+        nPosition = pSaplingTree->size();
+    }
+
+    for (int nHeight = pindexStart->GetHeight(); nHeight <= pindexEnd->GetHeight(); nHeight++) {
+        boost::this_thread::interruption_point();
+        const CBlockIndex* pindex = pindexEnd->GetAncestor(nHeight);
+        // Read as a view, so the ciphertexts are trial decrypted where they are in the block file
+        CMappedSpan span;
+        std::vector<char> vRaw;
+        CBlockView block;
+        // Pruned blocks only have compact blocks left, whose ciphertexts are too short to trial decrypt
+        if (!(pindex->nStatus & BLOCK_HAVE_DATA) || !ReadBlockViewFromDisk(span, vRaw, pindex, block)) {
+            strError = strprintf("failed to read block %d", nHeight);
+            return false;
+        }
+        std::vector<CScannerTx> vtx = CScannerTx::FromBlockView(block);
+        ConnectBlock(pindex, vtx, nPosition, vChunks, batch);
+        for (const CScannerTx& tx : vtx)
+            nPosition += tx.vOutputs.size();
+    }
+    return true;
+}
+
+void CViewingKeyScanner::EraseNotesOfKey(const std::string& tenant, const uint256& ivk)
+{
+    AssertLockHeld(cs_vkscanner);
+
+    std::map<std::string, std::map<SaplingOutPoint, CScannerNote>>::iterator itNotes = mapTenantNotes.find(tenant);
+    if (itNotes == mapTenantNotes.end())
+        return;
+    std::map<SaplingOutPoint, CScannerNote>::iterator it = itNotes->second.begin();
+    while (it != itNotes->second.end()) {
+        if (it->second.ivk != ivk) {
+            it++;
+            continue;
+        }
+        auto range = mapNullifiers.equal_range(it->second.nullifier);
+        for (auto itNf = range.first; itNf != range.second; itNf++) {
+            if (itNf->second.first == tenant) {
+                mapNullifiers.erase(itNf);
+                break;
+            }
+        }
+        itNotes->second.erase(it++);
+    }
+    if (itNotes->second.empty())
+        mapTenantNotes.erase(itNotes);
+}
+
+bool CViewingKeyScanner::AddKey(const std::string& tenant, const libzcash::SaplingExtendedFullViewingKey& extfvk, int nStartHeight, std::string& strError)
+{
+    LOCK2(cs_main, cs_vkscanner);
+
+    uint256 ivk = extfvk.fvk.in_viewing_key();
+    std::map<std::string, std::map<uint256, CScannerKey>>::const_iterator itTenant = mapTenantKeys.find(tenant);
+    if (itTenant != mapTenantKeys.end() && itTenant->second.count(ivk)) {
+        strError = "the tenant already has this key";
+        return false;
+    }
+
+    // The key is scanned alone for this tenant up to the scanner's tip, then it joins the others
+    bool fNewIvk = mapKeyOwners.count(ivk) == 0;
+    CKeyOwners ownersBefore;
+    if (!fNewIvk)
+        ownersBefore = mapKeyOwners[ivk];
+    CKeyOwners& owners = mapKeyOwners[ivk];
+    owners.fvk = extfvk.fvk;
+    owners.setTenants.clear();
+    owners.setTenants.insert(tenant);
+
+    CDBBatch batch(db);
+    CScannerKey key(extfvk, nStartHeight);
+    bool fAdded = pindexBest == NULL || nStartHeight > pindexBest->GetHeight() ||
+        ScanBlocks(pindexBest->GetAncestor(nStartHeight), pindexBest, MakeIvkChunks(std::vector<uint256>(1, ivk)), batch, strError);
+    if (fAdded) {
+        CViewingKeyScannerDB::WriteKey(batch, tenant, ivk, key);
+        fAdded = db.WriteBatch(batch, true);
+        if (!fAdded)
+            strError = "failed to write the viewing key scanner database";
+    }
+    if (!fAdded) {
+        EraseNotesOfKey(tenant, ivk);
+        if (fNewIvk)
+            mapKeyOwners.erase(ivk);
+        else
+            mapKeyOwners[ivk] = ownersBefore;
+        return false;
+    }
+
+    mapKeyOwners[ivk].setTenants.insert(ownersBefore.setTenants.begin(), ownersBefore.setTenants.end());
+    mapTenantKeys[tenant][ivk] = key;
+    if (fNewIvk)
+        RebuildIvkChunks();
+    return true;
+}
+
+bool CViewingKeyScanner::RemoveTenant(const std::string& tenant)
+{
+    LOCK(cs_vkscanner);
+
+    std::map<std::string, std::map<uint256, CScannerKey>>::iterator itKeys = mapTenantKeys.find(tenant);
+    if (itKeys == mapTenantKeys.end())
+        return false;
+
+    CDBBatch batch(db);
+    bool fRemovedIvk = false;
+    for (const std::pair<const uint256, CScannerKey>& key : itKeys->second) {
+        CKeyOwners& owners = mapKeyOwners[key.first];
+        owners.setTenants.erase(tenant);
+        if (owners.setTenants.empty()) {
+            mapKeyOwners.erase(key.first);
+            fRemovedIvk = true;
+        }
+        CViewingKeyScannerDB::EraseKey(batch, tenant, key.first);
+    }
+    mapTenantKeys.erase(itKeys);
+
+    std::map<std::string, std::map<SaplingOutPoint, CScannerNote>>::iterator itNotes = mapTenantNotes.find(tenant);
+    if (itNotes != mapTenantNotes.end()) {
+        for (const std::pair<const SaplingOutPoint, CScannerNote>& note : itNotes->second) {
+            auto range = mapNullifiers.equal_range(note.second.nullifier);
+            for (auto itNf = range.first; itNf != range.second; itNf++) {
+                if (itNf->second.first == tenant) {
+                    mapNullifiers.erase(itNf);
+                    break;
+                }
+            }
+            CViewingKeyScannerDB::EraseNote(batch, tenant, note.first);
+        }
+        mapTenantNotes.erase(itNotes);
+    }
+    if (fRemovedIvk)
+        RebuildIvkChunks();
+    return db.WriteBatch(batch, true);
+}
+
+bool CViewingKeyScanner::GetKeys(const std::string& tenant, std::map<uint256, CScannerKey>& mapKeysOut) const
+{
+    LOCK(cs_vkscanner);
+    std::map<std::string, std::map<uint256, CScannerKey>>::const_iterator it = mapTenantKeys.find(tenant);
+    if (it == mapTenantKeys.end())
+        return false;
+    mapKeysOut = it->second;
+    return true;
+}
+
+bool CViewingKeyScanner::GetNotes(const std::string& tenant, std::map<SaplingOutPoint, CScannerNote>& mapNotesOut) const
+{
+    LOCK(cs_vkscanner);
+    if (!mapTenantKeys.count(tenant))
+        return false;
+    std::map<std::string, std::map<SaplingOutPoint, CScannerNote>>::const_iterator it = mapTenantNotes.find(tenant);
+    if (it != mapTenantNotes.end())
+        mapNotesOut = it->second;
+    else
+        mapNotesOut.clear();
+    return true;
+}
+
+int CViewingKeyScanner::GetHeight() const
+{
+    LOCK(cs_vkscanner);
+    return pindexBest ? pindexBest->GetHeight() : -1;
+}
+
+void CViewingKeyScanner::GetStats(size_t& nTenants, size_t& nKeys, size_t& nNotes) const
+{
+    LOCK(cs_vkscanner);
+    nTenants = mapTenantKeys.size();
+    nKeys = mapKeyOwners.size();
+    nNotes = 0;
+    for (const std::pair<const std::string, std::map<SaplingOutPoint, CScannerNote>>& tenant : mapTenantNotes)
+        nNotes += tenant.second.size();
+}
+
+void CViewingKeyScanner::ChainTip(const CBlockIndex* pindex, const CBlock* pblock, const SproutMerkleTree& sproutTree, const SaplingMerkleTree& saplingTree, bool added)
+{
+    LOCK(cs_vkscanner);
+
+    CDBBatch batch(db);
+    if (added) {
+        if (pblock == NULL || pindex->pprev != pindexBest) {
+            LogPrintf("%s: block %s does not follow the last block scanned, skipped\n", __func__, pindex->GetBlockHash().ToString());
+            return;
+        }
+        // The tree is the one before the block
+        ConnectBlock(pindex, CScannerTx::FromBlock(*pblock), saplingTree.size(), vIvkChunks, batch);
+        pindexBest = pindex;
+    } else {
+        if (pindex != pindexBest)
+            return;
+        DisconnectTo(pindex->pprev, batch);
+    }
+    if (pindexBest != NULL)
+        CViewingKeyScannerDB::WriteBestBlock(batch, pindexBest->GetBlockHash());
+    if (!db.WriteBatch(batch))
+        LogPrintf("%s: failed to write the viewing key scanner database\n", __func__);
+}
+
+static CViewingKeyScanner* EnsureViewingKeyScanner()
+{
+    if (pviewingKeyScanner == NULL)
+        throw JSONRPCError(RPC_MISC_ERROR, "The viewing key scanner is disabled, start with -vkscanner");
+    return pviewingKeyScanner;
+}
+
+static UniValue NoteToJSON(const SaplingOutPoint& op, const CScannerNote& note, int nTipHeight)
+{
+    UniValue entry(UniValue::VOBJ);
+    entry.pushKV("txid", op.hash.GetHex());
+    entry.pushKV("outindex", (int)op.n);
+    entry.pushKV("address", EncodePaymentAddress(note.address));
+    entry.pushKV("amount", ValueFromAmount(note.nValue));
+    entry.pushKV("amountZat", note.nValue);
+    entry.pushKV("height", note.nHeight);
+    entry.pushKV("confirmations", nTipHeight - note.nHeight + 1);
+    entry.pushKV("spent", note.IsSpent());
+    if (note.IsSpent()) {
+        entry.pushKV("spentHeight", note.nSpentHeight);
+        entry.pushKV("spendTxid", note.spendTxid.GetHex());
+    }
+    return entry;
+}
+
+UniValue vkscanner_addviewingkey(const UniValue& params, bool fHelp, const CPubKey& mypk)
+{
+    if (fHelp || params.size() < 2 || params.size() > 3)
+        throw runtime_error(
+            "vkscanner_addviewingkey \"tenant\" \"vkey\" ( startHeight )\n"
+            "\nAdds a Sapling viewing key to a tenant of the viewing key scanner, and scans the chain for it.\n"
+            "\nArguments:\n"
+            "1. \"tenant\"         (string, required) The tenant, created with its first key\n"
+            "2. \"vkey\"           (string, required) The Sapling extended full viewing key (see z_exportviewingkey)\n"
+            "3. startHeight      (numeric, optional, default=0) Block height to start scanning from\n"
+            "\nNote: This call can take minutes to complete for a low startHeight.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"tenant\" : \"tenant\",     (string) The tenant\n"
+            "  \"address\" : \"address\",   (string) The default address of the key\n"
+            "  \"height\" : n             (numeric) The height the scanner is at\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("vkscanner_addviewingkey", "\"customer1\" \"zxviews1...\" 1000000")
+            + HelpExampleRpc("vkscanner_addviewingkey", "\"customer1\", \"zxviews1...\", 1000000")
+        );
+
+    CViewingKeyScanner* pscanner = EnsureViewingKeyScanner();
+
+    std::string tenant = params[0].get_str();
+    if (tenant.empty())
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Tenant must not be empty");
+    auto viewingkey = DecodeViewingKey(params[1].get_str());
+    const libzcash::SaplingExtendedFullViewingKey* extfvk = boost::get<libzcash::SaplingExtendedFullViewingKey>(&viewingkey);
+    if (extfvk == NULL)
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid viewing key, only Sapling extended full viewing keys are supported");
+    int nStartHeight = 0;
+    if (params.size() > 2)
+        nStartHeight = params[2].get_int();
+    if (nStartHeight < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range");
+
+    std::string strError;
+    if (!pscanner->AddKey(tenant, *extfvk, nStartHeight, strError))
+        throw JSONRPCError(RPC_WALLET_ERROR, "Error adding key: " + strError);
+
+    UniValue result(UniValue::VOBJ);
+    result.pushKV("tenant", tenant);
+    result.pushKV("address", EncodePaymentAddress(extfvk->DefaultAddress()));
+    result.pushKV("height", pscanner->GetHeight());
+    return result;
+}
+
+UniValue vkscanner_removetenant(const UniValue& params, bool fHelp, const CPubKey& mypk)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "vkscanner_removetenant \"tenant\"\n"
+            "\nRemoves a tenant of the viewing key scanner, with its keys and notes.\n"
+            "\nArguments:\n"
+            "1. \"tenant\"         (string, required) The tenant\n"
+            "\nExamples:\n"
+            + HelpExampleCli("vkscanner_removetenant", "\"customer1\"")
+            + HelpExampleRpc("vkscanner_removetenant", "\"customer1\"")
+        );
+
+    if (!EnsureViewingKeyScanner()->RemoveTenant(params[0].get_str()))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Unknown tenant");
+    return NullUniValue;
+}
+
+UniValue vkscanner_getbalance(const UniValue& params, bool fHelp, const CPubKey& mypk)
+{
+    if (fHelp || params.size() < 1 || params.size() > 2)
+        throw runtime_error(
+            "vkscanner_getbalance \"tenant\" ( minconf )\n"
+            "\nReturns the balance of the unspent notes of a tenant of the viewing key scanner.\n"
+            "\nArguments:\n"
+            "1. \"tenant\"         (string, required) The tenant\n"
+            "2. minconf          (numeric, optional, default=1) Only include notes confirmed at least this many times\n"
+            "\nResult:\n"
+            "amount              (numeric) The balance in " + CURRENCY_UNIT + "\n"
+            "\nExamples:\n"
+            + HelpExampleCli("vkscanner_getbalance", "\"customer1\" 5")
+            + HelpExampleRpc("vkscanner_getbalance", "\"customer1\", 5")
+        );
+
+    CViewingKeyScanner* pscanner = EnsureViewingKeyScanner();
+    int nMinDepth = 1;
+    if (params.size() > 1)
+        nMinDepth = params[1].get_int();
+    if (nMinDepth < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Minimum number of confirmations cannot be less than 0");
+
+    std::map<SaplingOutPoint, CScannerNote> mapNotes;
+    if (!pscanner->GetNotes(params[0].get_str(), mapNotes))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Unknown tenant");
+    int nTipHeight = pscanner->GetHeight();
+    CAmount nBalance = 0;
+    for (const std::pair<const SaplingOutPoint, CScannerNote>& note : mapNotes)
+        if (!note.second.IsSpent() && nTipHeight - note.second.nHeight + 1 >= nMinDepth)
+            nBalance += note.second.nValue;
+    return ValueFromAmount(nBalance);
+}
+
+UniValue vkscanner_listnotes(const UniValue& params, bool fHelp, const CPubKey& mypk)
+{
+    if (fHelp || params.size() < 1 || params.size() > 3)
+        throw runtime_error(
+            "vkscanner_listnotes \"tenant\" ( minconf includeSpent )\n"
+            "\nReturns the notes found for a tenant of the viewing key scanner.\n"
+            "\nArguments:\n"
+            "1. \"tenant\"         (string, required) The tenant\n"
+            "2. minconf          (numeric, optional, default=1) Only include notes confirmed at least this many times\n"
+            "3. includeSpent     (boolean, optional, default=false) Also include the spent notes\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"txid\" : \"txid\",          (string) The transaction of the note\n"
+            "    \"outindex\" : n,           (numeric) The index of its Sapling output\n"
+            "    \"address\" : \"address\",    (string) The address it was sent to\n"
+            "    \"amount\" : x.xxx,         (numeric) Its value in " + CURRENCY_UNIT + "\n"
+            "    \"amountZat\" : n,          (numeric) Its value in zatoshis\n"
+            "    \"height\" : n,             (numeric) The height of its block\n"
+            "    \"confirmations\" : n,      (numeric) Its confirmations\n"
+            "    \"spent\" : true|false,     (boolean) Whether it was spent\n"
+            "    \"spentHeight\" : n,        (numeric, optional) The height it was spent at\n"
+            "    \"spendTxid\" : \"txid\"      (string, optional) The transaction that spent it\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("vkscanner_listnotes", "\"customer1\"")
+            + HelpExampleRpc("vkscanner_listnotes", "\"customer1\", 1, true")
+        );
+
+    CViewingKeyScanner* pscanner = EnsureViewingKeyScanner();
+    int nMinDepth = 1;
+    if (params.size() > 1)
+        nMinDepth = params[1].get_int();
+    if (nMinDepth < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Minimum number of confirmations cannot be less than 0");
+    bool fIncludeSpent = false;
+    if (params.size() > 2)
+        fIncludeSpent = params[2].get_bool();
+
+    std::map<SaplingOutPoint, CScannerNote> mapNotes;
+    if (!pscanner->GetNotes(params[0].get_str(), mapNotes))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Unknown tenant");
+    int nTipHeight = pscanner->GetHeight();
+    UniValue result(UniValue::VARR);
+    for (const std::pair<const SaplingOutPoint, CScannerNote>& note : mapNotes) {
+        if ((note.second.IsSpent() && !fIncludeSpent) || nTipHeight - note.second.nHeight + 1 < nMinDepth)
+            continue;
+        result.push_back(NoteToJSON(note.first, note.second, nTipHeight));
+    }
+    return result;
+}
+
+UniValue vkscanner_getinfo(const UniValue& params, bool fHelp, const CPubKey& mypk)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "vkscanner_getinfo\n"
+            "\nReturns the state of the viewing key scanner.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"height\" : n,            (numeric) The height of the last block scanned\n"
+            "  \"tenants\" : n,           (numeric) The number of tenants\n"
+            "  \"keys\" : n,              (numeric) The number of distinct keys trial decrypted with\n"
+            "  \"notes\" : n              (numeric) The number of notes of all tenants\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("vkscanner_getinfo", "")
+            + HelpExampleRpc("vkscanner_getinfo", "")
+        );
+
+    CViewingKeyScanner* pscanner = EnsureViewingKeyScanner();
+    size_t nTenants, nKeys, nNotes;
+    pscanner->GetStats(nTenants, nKeys, nNotes);
+    UniValue result(UniValue::VOBJ);
+    result.pushKV("height", pscanner->GetHeight());
+    result.pushKV("tenants", (uint64_t)nTenants);
+    result.pushKV("keys", (uint64_t)nKeys);
+    result.pushKV("notes", (uint64_t)nNotes);
+    return result;
+}
+
+static const CRPCCommand commands[] =
+{   //  category              name                            actor (function)              okSafeMode
+    //  --------------------- ------------------------        -----------------------       ----------
+    {   "vkscanner",          "vkscanner_addviewingkey",      &vkscanner_addviewingkey,     true },
+    {   "vkscanner",          "vkscanner_removetenant",       &vkscanner_removetenant,      true },
+    {   "vkscanner",          "vkscanner_getbalance",         &vkscanner_getbalance,        true },
+    {   "vkscanner",          "vkscanner_listnotes",          &vkscanner_listnotes,         true },
+    {   "vkscanner",          "vkscanner_getinfo",            &vkscanner_getinfo,           true },
+};
+
+void RegisterViewingKeyScannerRPCCommands(CRPCTable& tableRPC)
+{
+    for (unsigned int vcidx = 0; vcidx < ARRAYLEN(commands); vcidx++)
+        tableRPC.appendCommand(commands[vcidx].name, &commands[vcidx]);
+}
@@ -0,0 +1,204 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_WALLET_VKSCANNER_H
+#define BITCOIN_WALLET_VKSCANNER_H
+
+#include "amount.h"
+#include "dbwrapper.h"
+#include "primitives/transaction.h"
+#include "serialize.h"
+#include "sync.h"
+#include "uint256.h"
+#include "validationinterface.h"
+#include "zcash/Address.hpp"
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+class CBlock;
+class CBlockIndex;
+class CBlockView;
+class CRPCTable;
+
+//! -vkscanner default
+static const bool DEFAULT_VKSCANNER = false;
+//! Cache size of the viewing key scanner database
+static const size_t VKSCANNER_DB_CACHE = 8 << 20;
+//! Keys of the scanner trial decrypted as one task of a block's outputs
+static const size_t VKSCANNER_KEY_CHUNK = 512;
+
+/** A viewing key a tenant of the scanner watches, and the height it is scanned from */
+struct CScannerKey
+{
+    libzcash::SaplingExtendedFullViewingKey extfvk;
+    int nStartHeight;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(extfvk);
+        READWRITE(nStartHeight);
+    }
+
+    CScannerKey() : nStartHeight(0) {}
+    CScannerKey(const libzcash::SaplingExtendedFullViewingKey& extfvkIn, int nStartHeightIn) :
+        extfvk(extfvkIn), nStartHeight(nStartHeightIn) {}
+};
+
+/** A note received by a key of a tenant, and the transaction that spent it if any */
+struct CScannerNote
+{
+    uint256 ivk;
+    libzcash::SaplingPaymentAddress address;
+    CAmount nValue;
+    uint256 nullifier;
+    int nHeight;
+    //! -1 while the note is unspent
+    int nSpentHeight;
+    uint256 spendTxid;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(ivk);
+        READWRITE(address);
+        READWRITE(nValue);
+        READWRITE(nullifier);
+        READWRITE(nHeight);
+        READWRITE(nSpentHeight);
+        READWRITE(spendTxid);
+    }
+
+    CScannerNote() : nValue(0), nHeight(-1), nSpentHeight(-1) {}
+
+    bool IsSpent() const { return nSpentHeight >= 0; }
+};
+
+/** The fields of a Sapling output the scanner reads, pointing at the ciphertext of the block they were taken from */
+struct CScannerOutput
+{
+    uint256 cmu;
+    uint256 epk;
+    const libzcash::SaplingEncCiphertext* pCiphertext;
+
+    CScannerOutput(const uint256& cmuIn, const uint256& epkIn, const libzcash::SaplingEncCiphertext* pCiphertextIn) :
+        cmu(cmuIn), epk(epkIn), pCiphertext(pCiphertextIn) {}
+};
+
+/** The Sapling spends and outputs of a transaction, as the scanner reads them from a block or a block view */
+struct CScannerTx
+{
+    uint256 hash;
+    std::vector<uint256> vNullifiers;
+    std::vector<CScannerOutput> vOutputs;
+
+    static std::vector<CScannerTx> FromBlock(const CBlock& block);
+    static std::vector<CScannerTx> FromBlockView(const CBlockView& block);
+};
+
+/** LevelDB store (vkscanner/) of the keys and notes of the scanner's tenants, and the block it scanned last */
+class CViewingKeyScannerDB : public CDBWrapper
+{
+public:
+    CViewingKeyScannerDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+private:
+    CViewingKeyScannerDB(const CViewingKeyScannerDB&);
+    void operator=(const CViewingKeyScannerDB&);
+public:
+    static void WriteKey(CDBBatch& batch, const std::string& tenant, const uint256& ivk, const CScannerKey& key);
+    static void EraseKey(CDBBatch& batch, const std::string& tenant, const uint256& ivk);
+    static void WriteNote(CDBBatch& batch, const std::string& tenant, const SaplingOutPoint& op, const CScannerNote& note);
+    static void EraseNote(CDBBatch& batch, const std::string& tenant, const SaplingOutPoint& op);
+    static void WriteBestBlock(CDBBatch& batch, const uint256& hash);
+    bool ReadBestBlock(uint256& hash);
+
+    bool LoadKeys(std::map<std::string, std::map<uint256, CScannerKey>>& mapKeys);
+    bool LoadNotes(std::map<std::string, std::map<SaplingOutPoint, CScannerNote>>& mapNotes);
+};
+
+/**
+ * Watch-only scanner of Sapling viewing keys for many tenants, kept out of
+ * CWallet so that their keys neither slow down the wallet's own scanning nor
+ * contend on cs_wallet. It listens to connected and disconnected blocks from
+ * the validation queue thread, and trial decrypts each block's outputs once
+ * with the keys of all tenants, split into chunks of VKSCANNER_KEY_CHUNK keys
+ * across -zdecryptthreads workers. A key shared by several tenants is only
+ * tried once.
+ *
+ * Nothing here takes cs_wallet; cs_vkscanner is taken after cs_main.
+ */
+class CViewingKeyScanner : public CValidationInterface
+{
+public:
+    CViewingKeyScanner(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+
+    //! Loads the database, then brings the scanner to the tip of chainActive. Takes cs_main.
+    bool Load(std::string& strError);
+
+    /**
+     * Adds a key to a tenant, scanning the blocks from nStartHeight to the
+     * scanner's tip for it alone. Returns false, with nothing changed, if the
+     * tenant already has the key or a block can't be read.
+     */
+    bool AddKey(const std::string& tenant, const libzcash::SaplingExtendedFullViewingKey& extfvk, int nStartHeight, std::string& strError);
+    //! Removes the keys and notes of a tenant, returns false if there is no such tenant
+    bool RemoveTenant(const std::string& tenant);
+
+    bool GetKeys(const std::string& tenant, std::map<uint256, CScannerKey>& mapKeysOut) const;
+    bool GetNotes(const std::string& tenant, std::map<SaplingOutPoint, CScannerNote>& mapNotesOut) const;
+    //! Height of the last block scanned, -1 before the first
+    int GetHeight() const;
+    void GetStats(size_t& nTenants, size_t& nKeys, size_t& nNotes) const;
+
+protected:
+    void ChainTip(const CBlockIndex* pindex, const CBlock* pblock, const SproutMerkleTree& sproutTree, const SaplingMerkleTree& saplingTree, bool added);
+
+private:
+    struct CKeyOwners
+    {
+        libzcash::SaplingFullViewingKey fvk;
+        std::set<std::string> setTenants;
+    };
+
+    mutable CCriticalSection cs_vkscanner;
+    CViewingKeyScannerDB db;
+
+    std::map<std::string, std::map<uint256, CScannerKey>> mapTenantKeys;
+    std::map<std::string, std::map<SaplingOutPoint, CScannerNote>> mapTenantNotes;
+    //! Tenants of each ivk
+    std::map<uint256, CKeyOwners> mapKeyOwners;
+    //! Every ivk of mapKeyOwners, in chunks of VKSCANNER_KEY_CHUNK
+    std::vector<std::vector<uint256>> vIvkChunks;
+    //! Tenant and outpoint of the unspent notes, by nullifier
+    std::multimap<uint256, std::pair<std::string, SaplingOutPoint>> mapNullifiers;
+    const CBlockIndex* pindexBest;
+
+    void AddKeyOwner(const std::string& tenant, const uint256& ivk, const CScannerKey& key);
+    void RebuildIvkChunks();
+    //! Drops the notes of one key of a tenant from memory, when adding the key fails
+    void EraseNotesOfKey(const std::string& tenant, const uint256& ivk);
+    /**
+     * Applies a block to the notes of the keys in vChunks, which has to
+     * follow the block last scanned for them. nPosition is the size of the
+     * Sapling commitment tree before the block, vtx its transactions in order.
+     */
+    void ConnectBlock(const CBlockIndex* pindex, const std::vector<CScannerTx>& vtx, uint64_t nPosition,
+                      const std::vector<std::vector<uint256>>& vChunks, CDBBatch& batch);
+    //! Undoes the blocks above pindexFork
+    void DisconnectTo(const CBlockIndex* pindexFork, CDBBatch& batch);
+    //! Reads and connects the blocks from pindexStart to pindexEnd for the keys in vChunks
+    bool ScanBlocks(const CBlockIndex* pindexStart, const CBlockIndex* pindexEnd,
+                    const std::vector<std::vector<uint256>>& vChunks, CDBBatch& batch, std::string& strError);
+};
+
+extern CViewingKeyScanner* pviewingKeyScanner;
+
+void RegisterViewingKeyScannerRPCCommands(CRPCTable& tableRPC);
+
+#endif // BITCOIN_WALLET_VKSCANNER_H
@@ -23,9 +23,11 @@
 #include "asyncrpcqueue.h"
 #include "checkpoints.h"
 #include "coincontrol.h"
+#include "compactblockindex.h"
 #include "consensus/upgrades.h"
 #include "consensus/validation.h"
 #include "consensus/consensus.h"
+#include "core_memusage.h"
 #include "init.h"
 #include "key_io.h"
 #include "main.h"
@@ -36,6 +38,8 @@
 #include "script/sign.h"
 #include "timedata.h"
 #include "utilmoneystr.h"
+#include "util/parallel.h"
+#include "util/trace.h"
 #include "zcash/Note.hpp"
 #include "crypter.h"
 #include "coins.h"
@@ -44,8 +48,12 @@
 #include "zcash/address/zip32.h"
 #include "cc/CCinclude.h"
 #include "rpcpiratewallet.h"
+#include "wallet/rescan.h"
 
 #include <assert.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
 
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/filesystem.hpp>
@@ -71,14 +79,32 @@ bool fWalletRbf = DEFAULT_WALLET_RBF;
 
 CBlockIndex *komodo_chainactive(int32_t height);
 extern std::string DONATION_PUBKEY;
-int32_t komodo_dpowconfs(int32_t height,int32_t numconfs);
-int tx_height( const uint256 &hash );
+int32_t komodo_dpownotarizedheight();
+int32_t komodo_dpowconfs_notarized(int32_t notarizedheight,int32_t txheight,int32_t numconfs);
 int scanperc;
 bool fTxDeleteEnabled = false;
 bool fTxConflictDeleteEnabled = false;
 int fDeleteInterval = DEFAULT_TX_DELETE_INTERVAL;
 unsigned int fDeleteTransactionsAfterNBlocks = DEFAULT_TX_RETENTION_BLOCKS;
 unsigned int fKeepLastNTransactions = DEFAULT_TX_RETENTION_LASTTX;
+int nSaplingDecryptThreads = 0;
+int nWitnessCacheThreads = 0;
+unsigned int nWalletMemoryBudget = DEFAULT_WALLET_MEMORY_BUDGET;
+std::atomic<int> nWalletRescanHeight(-1);
+std::atomic<int> nWalletWitnessHeight(-1);
+CWalletScanProgress walletRescanProgress;
+CWalletScanProgress walletWitnessProgress;
+
+void CWalletScanProgress::Start(int nStart, int nTarget)
+{
+    nStartHeight = nStart;
+    nTargetHeight = nTarget;
+    nStartMillis = GetTimeMillis();
+    nBlocks = 0;
+    nOutputs = 0;
+    nNotes = 0;
+    nWitnesses = 0;
+}
 
 /**
  * Fees smaller than this (in satoshi) are considered zero fee (for transaction creation)
@@ -204,6 +230,108 @@ SaplingPaymentAddress CWallet::GenerateNewSaplingZKey()
     return addr;
 }
 
+/**
+ * Generate nCount new Sapling spending keys at the next account indexes and
+ * return their default payment addresses. The account keys are derived in
+ * parallel over consecutive index ranges, skipping keys already known to the
+ * wallet, then added to the keystore together and written with the HD chain
+ * in a single wallet database transaction.
+ */
+std::vector<SaplingPaymentAddress> CWallet::GenerateNewSaplingZKeys(int nCount)
+{
+    AssertLockHeld(cs_wallet); // mapSaplingZKeyMetadata
+
+    if (nCount <= 0)
+        return std::vector<SaplingPaymentAddress>();
+
+    int64_t nCreationTime = GetTime();
+
+    // Try to get the seed
+    HDSeed seed;
+    if (!GetHDSeed(seed))
+        throw std::runtime_error("CWallet::GenerateNewSaplingZKeys(): HD seed not found");
+
+    auto m = libzcash::SaplingExtendedSpendingKey::Master(seed);
+    uint32_t bip44CoinType = Params().BIP44CoinType();
+
+    // Same keypath scheme of m/32'/coin_type'/account' as GenerateNewSaplingZKey
+    auto m_32h = m.Derive(32 | ZIP32_HARDENED_KEY_LIMIT);
+    auto m_32h_cth = m_32h.Derive(bip44CoinType | ZIP32_HARDENED_KEY_LIMIT);
+
+    int nThreads = std::max(1, std::min(GetNumCores(), MAX_SAPLING_DECRYPT_THREADS));
+    uint32_t nNext = hdChain.saplingAccountCounter;
+    std::vector<std::pair<uint32_t, libzcash::SaplingExtendedSpendingKey>> vNew;
+    std::vector<SaplingPaymentAddress> vAddresses;
+    while ((int)vNew.size() < nCount) {
+        uint32_t nRange = nCount - vNew.size();
+        if (nNext >= ZIP32_HARDENED_KEY_LIMIT - nRange)
+            throw std::runtime_error("CWallet::GenerateNewSaplingZKeys(): Account indexes exhausted");
+
+        std::vector<SaplingPaymentAddress> vDefaultAddrs;
+        std::vector<libzcash::SaplingExtendedSpendingKey> vKeys =
+            m_32h_cth.DeriveRange(nNext | ZIP32_HARDENED_KEY_LIMIT, nRange, nThreads, &vDefaultAddrs);
+        for (uint32_t n = 0; n < nRange; n++) {
+            if (HaveSaplingSpendingKey(vKeys[n].ToXFVK()))
+                continue;
+            vNew.push_back(std::make_pair(nNext + n, vKeys[n]));
+            vAddresses.push_back(vDefaultAddrs[n]);
+        }
+        nNext += nRange;
+    }
+
+    // Continue after the last key on the next call
+    hdChain.saplingAccountCounter = vNew.back().first + 1;
+
+    std::unique_ptr<CWalletDB> pwalletdb;
+    if (fFileBacked) {
+        pwalletdb.reset(new CWalletDB(strWalletFile));
+        if (!pwalletdb->TxnBegin())
+            throw std::runtime_error("CWallet::GenerateNewSaplingZKeys(): Writing keys to the wallet failed");
+        // Encrypted keys are written as the keystore encrypts them, into the same transaction
+        if (IsCrypted())
+            pwalletdbEncryption = pwalletdb.get();
+    }
+
+    // The keys go straight to the keystore, so the generation is bumped here, in the same transaction
+    uint64_t nGeneration = ++nKeyGeneration;
+    bool fAdded = !pwalletdb || pwalletdb->WriteKeyGeneration(nGeneration);
+    for (const std::pair<uint32_t, libzcash::SaplingExtendedSpendingKey>& item : vNew) {
+        const libzcash::SaplingExtendedSpendingKey& xsk = item.second;
+        auto ivk = xsk.expsk.full_viewing_key().in_viewing_key();
+        CKeyMetadata& metadata = mapSaplingZKeyMetadata[ivk];
+        metadata = CKeyMetadata(nCreationTime);
+        metadata.hdKeypath = "m/32'/" + std::to_string(bip44CoinType) + "'/" + std::to_string(item.first) + "'";
+        metadata.seedFp = hdChain.seedFp;
+
+        //Set Primary key for diversification
+        if (item.first == 0) {
+            primarySaplingSpendingKey = xsk;
+            fAdded = fAdded && (!pwalletdb || IsCrypted() || pwalletdb->WritePrimarySaplingSpendingKey(xsk));
+        }
+
+        fAdded = fAdded && CCryptoKeyStore::AddSaplingSpendingKey(xsk) &&
+            (!pwalletdb || IsCrypted() || pwalletdb->WriteSaplingZKey(ivk, xsk, metadata));
+        if (!fAdded)
+            break;
+    }
+    fShieldedBalancesDirty = true;
+    nTimeFirstKey = 1; // No birthday information for viewing keys.
+
+    if (pwalletdb) {
+        if (IsCrypted())
+            pwalletdbEncryption = NULL;
+        fAdded = fAdded && pwalletdb->WriteHDChain(hdChain);
+        if (!fAdded || !pwalletdb->TxnCommit()) {
+            pwalletdb->TxnAbort();
+            throw std::runtime_error("CWallet::GenerateNewSaplingZKeys(): Writing keys to the wallet failed");
+        }
+    } else if (!fAdded) {
+        throw std::runtime_error("CWallet::GenerateNewSaplingZKeys(): Adding key to keystore failed");
+    }
+
+    return vAddresses;
+}
+
 // Generate a new Sapling diversified payment address
 SaplingPaymentAddress CWallet::GenerateNewSaplingDiversifiedAddress()
 {
@@ -312,6 +440,134 @@ SaplingPaymentAddress CWallet::GenerateNewSaplingDiversifiedAddress()
     return addr;
 }
 
+// Low 64 bits of a diversifier index, little endian as incremented above
+static uint64_t DiversifierIndexLow(const blob88& diversifier)
+{
+    uint64_t n = 0;
+    for (int j = 7; j >= 0; j--) {
+        n = (n << 8) | diversifier.begin()[j];
+    }
+    return n;
+}
+
+static blob88 DiversifierIndexWithLow(const blob88& diversifier, uint64_t n)
+{
+    blob88 ret = diversifier;
+    for (int j = 0; j < 8; j++) {
+        ret.begin()[j] = n & 0xff;
+        n >>= 8;
+    }
+    return ret;
+}
+
+/**
+ * Generate nCount new Sapling diversified payment addresses of the primary
+ * spending key. Valid diversifiers are searched in parallel over
+ * consecutive index ranges after the last used one, the addresses are then
+ * added to the keystore together and written in a single wallet database
+ * transaction. Each address is recorded with its diversifier index.
+ */
+std::vector<SaplingPaymentAddress> CWallet::GenerateNewSaplingDiversifiedAddresses(int nCount)
+{
+    AssertLockHeld(cs_wallet); // mapSaplingZKeyMetadata
+
+    std::vector<SaplingPaymentAddress> vAddresses;
+
+    // The first calls may have to create the primary spending key
+    while (pwalletMain->primarySaplingSpendingKey == boost::none && (int)vAddresses.size() < nCount) {
+        vAddresses.push_back(GenerateNewSaplingDiversifiedAddress());
+    }
+    if ((int)vAddresses.size() >= nCount)
+        return vAddresses;
+
+    libzcash::SaplingExtendedSpendingKey extsk = pwalletMain->primarySaplingSpendingKey.get();
+    libzcash::SaplingExtendedFullViewingKey xfvk = extsk.ToXFVK();
+    auto ivk = extsk.expsk.full_viewing_key().in_viewing_key();
+
+    blob88 diversifier;
+    for (int j = 0; j < diversifier.size(); j++) {
+        diversifier.begin()[j] = 0;
+    }
+    LastDiversifierPath::const_iterator itLast = mapLastDiversifierPath.find(ivk);
+    if (itLast != mapLastDiversifierPath.end()) {
+        diversifier = itLast->second;
+    }
+    uint64_t nNext = DiversifierIndexLow(diversifier);
+
+    int nThreads = std::max(1, std::min(GetNumCores(), MAX_SAPLING_DECRYPT_THREADS));
+    std::vector<std::pair<SaplingPaymentAddress, blob88>> vNew;
+    std::set<SaplingPaymentAddress> setNew;
+    while ((int)(vAddresses.size() + vNew.size()) < nCount) {
+        // About half of the diversifiers are valid
+        uint64_t nWanted = nCount - vAddresses.size() - vNew.size();
+        uint64_t nRange = nWanted * 2 + 16;
+        if (nNext > std::numeric_limits<uint64_t>::max() - nRange)
+            throw std::runtime_error("CWallet::GenerateNewSaplingDiversifiedAddresses(): Unable to find new diversified address with the current key");
+
+        std::vector<std::vector<std::pair<SaplingPaymentAddress, blob88>>> vFound(nThreads);
+        uint64_t nChunk = (nRange + nThreads - 1) / nThreads;
+        ParallelFor(nThreads, nThreads, [&](size_t nThread) {
+            uint64_t nBegin = nNext + nThread * nChunk;
+            uint64_t nEnd = std::min(nNext + nRange, nBegin + nChunk);
+            while (nBegin < nEnd) {
+                auto found = xfvk.Address(DiversifierIndexWithLow(diversifier, nBegin));
+                if (!found)
+                    break;
+                uint64_t nFound = DiversifierIndexLow(found.get().first);
+                if (nFound >= nEnd || nFound < nBegin)
+                    break;
+                vFound[nThread].push_back(std::make_pair(found.get().second, found.get().first));
+                nBegin = nFound + 1;
+            }
+        });
+        nNext += nRange;
+
+        // Ranges are in index order, so are the addresses taken from them
+        for (const std::vector<std::pair<SaplingPaymentAddress, blob88>>& vRange : vFound) {
+            for (const std::pair<SaplingPaymentAddress, blob88>& item : vRange) {
+                if ((int)(vAddresses.size() + vNew.size()) >= nCount)
+                    break;
+                libzcash::SaplingIncomingViewingKey ivkExisting;
+                if (GetSaplingIncomingViewingKey(item.first, ivkExisting) || setNew.count(item.first))
+                    continue;
+                vNew.push_back(item);
+                setNew.insert(item.first);
+            }
+        }
+    }
+
+    // Continue after the last address on the next call
+    blob88 lastDiversifier = DiversifierIndexWithLow(diversifier, DiversifierIndexLow(vNew.back().second) + 1);
+
+    for (const std::pair<SaplingPaymentAddress, blob88>& item : vNew) {
+        if (!CCryptoKeyStore::AddSaplingIncomingViewingKey(ivk, item.first) ||
+            !CCryptoKeyStore::AddSaplingDiversifiedAddess(item.first, ivk, item.second)) {
+            throw std::runtime_error("CWallet::GenerateNewSaplingDiversifiedAddresses(): Adding address to keystore failed");
+        }
+        vAddresses.push_back(item.first);
+    }
+    if (!CCryptoKeyStore::AddLastDiversifierUsed(ivk, lastDiversifier)) {
+        throw std::runtime_error("CWallet::GenerateNewSaplingDiversifiedAddresses(): AddLastDiversifierUsed failed");
+    }
+
+    if (fFileBacked && !IsCrypted()) {
+        CWalletDB walletdb(strWalletFile);
+        bool fWritten = walletdb.TxnBegin();
+        for (const std::pair<SaplingPaymentAddress, blob88>& item : vNew) {
+            fWritten = fWritten &&
+                walletdb.WriteSaplingPaymentAddress(item.first, ivk) &&
+                walletdb.WriteSaplingDiversifiedAddress(item.first, ivk, item.second);
+        }
+        fWritten = fWritten && walletdb.WriteLastDiversifierUsed(ivk, lastDiversifier);
+        if (!fWritten || !walletdb.TxnCommit()) {
+            walletdb.TxnAbort();
+            throw std::runtime_error("CWallet::GenerateNewSaplingDiversifiedAddresses(): Writing addresses to the wallet failed");
+        }
+    }
+
+    return vAddresses;
+}
+
 bool CWallet::SetPrimarySpendingKey(
     const libzcash::SaplingExtendedSpendingKey &extsk)
 {
@@ -330,16 +586,30 @@ bool CWallet::SetPrimarySpendingKey(
       return true;
 }
 
+void CWallet::BumpKeyGeneration()
+{
+    uint64_t nGeneration = ++nKeyGeneration;
+    if (!fFileBacked)
+        return;
+    // Saved ahead of the key, so decoded transactions older than the key never look valid
+    if (pwalletdbEncryption)
+        pwalletdbEncryption->WriteKeyGeneration(nGeneration);
+    else
+        CWalletDB(strWalletFile).WriteKeyGeneration(nGeneration);
+}
+
 // Add spending key to keystore
 bool CWallet::AddSaplingZKey(
     const libzcash::SaplingExtendedSpendingKey &sk,
     const libzcash::SaplingPaymentAddress &defaultAddr)
 {
+    BumpKeyGeneration();
     AssertLockHeld(cs_wallet); // mapSaplingZKeyMetadata
 
     if (!CCryptoKeyStore::AddSaplingSpendingKey(sk)) {
         return false;
     }
+    fShieldedBalancesDirty = true;
 
     nTimeFirstKey = 1; // No birthday information for viewing keys.
     if (!fFileBacked) {
@@ -359,6 +629,7 @@ bool CWallet::AddSaplingIncomingViewingKey(
     const libzcash::SaplingIncomingViewingKey &ivk,
     const libzcash::SaplingPaymentAddress &addr)
 {
+    BumpKeyGeneration();
     AssertLockHeld(cs_wallet); // mapSaplingZKeyMetadata
 
     if (!CCryptoKeyStore::AddSaplingIncomingViewingKey(ivk, addr)) {
@@ -378,6 +649,7 @@ bool CWallet::AddSaplingIncomingViewingKey(
 
 bool CWallet::AddSaplingFullViewingKey(const libzcash::SaplingExtendedFullViewingKey &extfvk)
 {
+    BumpKeyGeneration();
     AssertLockHeld(cs_wallet);
 
     if (!CCryptoKeyStore::AddSaplingFullViewingKey(extfvk)) {
@@ -436,6 +708,7 @@ bool CWallet::AddLastDiversifierUsed(
 // Add spending key to keystore and persist to disk
 bool CWallet::AddSproutZKey(const libzcash::SproutSpendingKey &key)
 {
+    BumpKeyGeneration();
     AssertLockHeld(cs_wallet); // mapSproutZKeyMetadata
     auto addr = key.address();
 
@@ -485,9 +758,12 @@ CPubKey CWallet::GenerateNewKey()
 
 bool CWallet::AddKeyPubKey(const CKey& secret, const CPubKey &pubkey)
 {
+    BumpKeyGeneration();
     AssertLockHeld(cs_wallet); // mapKeyMetadata
     if (!CCryptoKeyStore::AddKeyPubKey(secret, pubkey))
         return false;
+    fTransparentCoinIndexDirty = true;
+    fAddressGroupingsDirty = true;
 
     // check if we need to remove from watch-only
     CScript script;
@@ -508,6 +784,7 @@ bool CWallet::AddKeyPubKey(const CKey& secret, const CPubKey &pubkey)
 bool CWallet::AddCryptedKey(const CPubKey &vchPubKey,
                             const vector<unsigned char> &vchCryptedSecret)
 {
+    BumpKeyGeneration();
 
     if (!CCryptoKeyStore::AddCryptedKey(vchPubKey, vchCryptedSecret))
         return false;
@@ -533,6 +810,7 @@ bool CWallet::AddCryptedSproutSpendingKey(
     const libzcash::ReceivingKey &rk,
     const std::vector<unsigned char> &vchCryptedSecret)
 {
+    BumpKeyGeneration();
     if (!CCryptoKeyStore::AddCryptedSproutSpendingKey(address, rk, vchCryptedSecret))
         return false;
     if (!fFileBacked)
@@ -557,6 +835,7 @@ bool CWallet::AddCryptedSproutSpendingKey(
 bool CWallet::AddCryptedSaplingSpendingKey(const libzcash::SaplingExtendedFullViewingKey &extfvk,
                                            const std::vector<unsigned char> &vchCryptedSecret)
 {
+    BumpKeyGeneration();
     if (!CCryptoKeyStore::AddCryptedSaplingSpendingKey(extfvk, vchCryptedSecret))
         return false;
     if (!fFileBacked)
@@ -666,6 +945,7 @@ bool CWallet::LoadZKey(const libzcash::SproutSpendingKey &key)
 
 bool CWallet::AddSproutViewingKey(const libzcash::SproutViewingKey &vk)
 {
+    BumpKeyGeneration();
     if (!CCryptoKeyStore::AddSproutViewingKey(vk)) {
         return false;
     }
@@ -678,6 +958,7 @@ bool CWallet::AddSproutViewingKey(const libzcash::SproutViewingKey &vk)
 
 bool CWallet::RemoveSproutViewingKey(const libzcash::SproutViewingKey &vk)
 {
+    BumpKeyGeneration();
     AssertLockHeld(cs_wallet);
     if (!CCryptoKeyStore::RemoveSproutViewingKey(vk)) {
         return false;
@@ -698,8 +979,11 @@ bool CWallet::LoadSproutViewingKey(const libzcash::SproutViewingKey &vk)
 
 bool CWallet::AddCScript(const CScript& redeemScript)
 {
+    BumpKeyGeneration();
     if (!CCryptoKeyStore::AddCScript(redeemScript))
         return false;
+    fTransparentCoinIndexDirty = true;
+    fAddressGroupingsDirty = true;
     if (!fFileBacked)
         return true;
     return CWalletDB(strWalletFile).WriteCScript(Hash160(redeemScript), redeemScript);
@@ -723,8 +1007,11 @@ bool CWallet::LoadCScript(const CScript& redeemScript)
 
 bool CWallet::AddWatchOnly(const CScript &dest)
 {
+    BumpKeyGeneration();
     if (!CCryptoKeyStore::AddWatchOnly(dest))
         return false;
+    fTransparentCoinIndexDirty = true;
+    fAddressGroupingsDirty = true;
     nTimeFirstKey = 1; // No birthday information for watch-only keys.
     NotifyWatchonlyChanged(true);
     if (!fFileBacked)
@@ -734,9 +1021,12 @@ bool CWallet::AddWatchOnly(const CScript &dest)
 
 bool CWallet::RemoveWatchOnly(const CScript &dest)
 {
+    BumpKeyGeneration();
     AssertLockHeld(cs_wallet);
     if (!CCryptoKeyStore::RemoveWatchOnly(dest))
         return false;
+    fTransparentCoinIndexDirty = true;
+    fAddressGroupingsDirty = true;
     if (!HaveWatchOnly())
         NotifyWatchonlyChanged(false);
     if (fFileBacked)
@@ -771,7 +1061,7 @@ bool CWallet::Unlock(const SecureString& strWalletPassphrase)
         LOCK(cs_wallet);
         BOOST_FOREACH(const MasterKeyMap::value_type& pMasterKey, mapMasterKeys)
         {
-            if(!crypter.SetKeyFromPassphrase(strWalletPassphrase, pMasterKey.second.vchSalt, pMasterKey.second.nDeriveIterations, pMasterKey.second.nDerivationMethod))
+            if(!crypter.SetKeyFromPassphrase(strWalletPassphrase, pMasterKey.second))
                 return false;
             if (!crypter.Decrypt(pMasterKey.second.vchCryptedKey, vMasterKey))
                 continue; // try another master key
@@ -794,26 +1084,19 @@ bool CWallet::ChangeWalletPassphrase(const SecureString& strOldWalletPassphrase,
         CKeyingMaterial vMasterKey;
         BOOST_FOREACH(MasterKeyMap::value_type& pMasterKey, mapMasterKeys)
         {
-            if(!crypter.SetKeyFromPassphrase(strOldWalletPassphrase, pMasterKey.second.vchSalt, pMasterKey.second.nDeriveIterations, pMasterKey.second.nDerivationMethod))
+            if(!crypter.SetKeyFromPassphrase(strOldWalletPassphrase, pMasterKey.second))
                 return false;
             if (!crypter.Decrypt(pMasterKey.second.vchCryptedKey, vMasterKey))
                 return false;
             if (CCryptoKeyStore::Unlock(vMasterKey))
             {
-                int64_t nStartTime = GetTimeMillis();
-                crypter.SetKeyFromPassphrase(strNewWalletPassphrase, pMasterKey.second.vchSalt, pMasterKey.second.nDeriveIterations, pMasterKey.second.nDerivationMethod);
-                pMasterKey.second.nDeriveIterations = pMasterKey.second.nDeriveIterations * (100 / ((double)(GetTimeMillis() - nStartTime)));
-
-                nStartTime = GetTimeMillis();
-                crypter.SetKeyFromPassphrase(strNewWalletPassphrase, pMasterKey.second.vchSalt, pMasterKey.second.nDeriveIterations, pMasterKey.second.nDerivationMethod);
-                pMasterKey.second.nDeriveIterations = (pMasterKey.second.nDeriveIterations + pMasterKey.second.nDeriveIterations * 100 / ((double)(GetTimeMillis() - nStartTime))) / 2;
-
-                if (pMasterKey.second.nDeriveIterations < 25000)
-                    pMasterKey.second.nDeriveIterations = 25000;
+                // Master keys of any method move to the current one with the new passphrase
+                if (!CalibrateMasterKeyDerivation(pMasterKey.second, strNewWalletPassphrase))
+                    return false;
 
-                LogPrintf("Wallet passphrase changed to an nDeriveIterations of %i\n", pMasterKey.second.nDeriveIterations);
+                LogPrintf("Wallet passphrase changed to Argon2id with %i passes\n", pMasterKey.second.nDeriveIterations);
 
-                if (!crypter.SetKeyFromPassphrase(strNewWalletPassphrase, pMasterKey.second.vchSalt, pMasterKey.second.nDeriveIterations, pMasterKey.second.nDerivationMethod))
+                if (!crypter.SetKeyFromPassphrase(strNewWalletPassphrase, pMasterKey.second))
                     return false;
                 if (!crypter.Encrypt(vMasterKey, pMasterKey.second.vchCryptedKey))
                     return false;
@@ -830,10 +1113,12 @@ bool CWallet::ChangeWalletPassphrase(const SecureString& strOldWalletPassphrase,
 
 void CWallet::ChainTip(const CBlockIndex *pindex,
                        const CBlock *pblock,
-                       SproutMerkleTree sproutTree,
-                       SaplingMerkleTree saplingTree,
+                       const SproutMerkleTree& sproutTree,
+                       const SaplingMerkleTree& saplingTree,
                        bool added)
 {
+    // Note depths changed with the tip
+    MarkShieldedBalancesDirty();
 
     if (added) {
         // Prevent witness cache building && consolidation transactions
@@ -843,30 +1128,64 @@ void CWallet::ChainTip(const CBlockIndex *pindex,
         if (!initialDownloadCheck &&
             pblock->GetBlockTime() > GetTime() - 8640) //Last 144 blocks 2.4 * 60 * 60
         {
-            BuildWitnessCache(pindex, false);
-            RunSaplingConsolidation(pindex->GetHeight());
-            RunSaplingSweep(pindex->GetHeight());
-            DeleteWalletTransactions(pindex);
-        } else {
-            //Build intial witnesses on every block
-            BuildWitnessCache(pindex, true);
-            if (initialDownloadCheck && pindex->GetHeight() % fDeleteInterval == 0) {
-                DeleteWalletTransactions(pindex);
-            }
-
-            //Build full witness cache 1 hour before IsInitialBlockDownload() unlocks
-            if (pblock->GetBlockTime() > GetTime() - nMaxTipAge - 3600) {
+            {
+                // The block's wallet writes are synced to disk once
+                LOCK2(cs_main, cs_wallet);
+                bool fBatch = BeginWriteBatch();
                 BuildWitnessCache(pindex, false);
+                RunSaplingConsolidation(pindex->GetHeight());
+                RunSaplingSweep(pindex->GetHeight());
+                if (fBatch)
+                    CommitWriteBatch();
             }
+        } else {
+            {
+                LOCK2(cs_main, cs_wallet);
+                bool fBatch = BeginWriteBatch();
+                //Build intial witnesses on every block
+                BuildWitnessCache(pindex, true);
 
+                //Build full witness cache 1 hour before IsInitialBlockDownload() unlocks
+                if (pblock->GetBlockTime() > GetTime() - nMaxTipAge - 3600) {
+                    BuildWitnessCache(pindex, false);
+                }
+                if (fBatch)
+                    CommitWriteBatch();
+            }
         }
 
+        //Delete spent history a slice at a time
+        DeleteWalletTransactions(pindex);
+
     } else {
-        DecrementNoteWitnesses(pindex);
+        {
+            LOCK(cs_wallet);
+            if (nPendingRewindTip >= 0 && pindex->GetHeight() != nPendingRewindFork)
+                ApplyPendingWitnessRewind();
+            if (nPendingRewindTip < 0)
+                nPendingRewindTip = pindex->GetHeight();
+            nPendingRewindFork = pindex->GetHeight() - 1;
+        }
         UpdateNullifierNoteMapForBlock(pblock);
     }
 }
 
+void CWallet::UpdatedBlockTip(const CBlockIndex *pindex)
+{
+    // The end of a reorg that only disconnected blocks
+    ApplyPendingWitnessRewind();
+}
+
+void CWallet::ApplyPendingWitnessRewind()
+{
+    LOCK(cs_wallet);
+    if (nPendingRewindTip < 0)
+        return;
+    int nTipHeight = nPendingRewindTip;
+    nPendingRewindTip = -1;
+    RewindNoteWitnesses(nTipHeight, nPendingRewindFork);
+}
+
 void CWallet::RunSaplingSweep(int blockHeight) {
     if (!NetworkUpgradeActive(blockHeight, Params().GetConsensus(), Consensus::UPGRADE_SAPLING)) {
         return;
@@ -944,10 +1263,68 @@ void CWallet::CommitAutomatedTx(const CTransaction& tx) {
 
 void CWallet::SetBestChain(const CBlockLocator& loc)
 {
+    LOCK(cs_wallet);
+    ApplyPendingWitnessRewind();
+    if (pwalletdbBatch) {
+        SetBestChainINTERNAL(*pwalletdbBatch, loc);
+        return;
+    }
     CWalletDB walletdb(strWalletFile);
     SetBestChainINTERNAL(walletdb, loc);
 }
 
+/**
+ * Starts a write batch: until CommitWriteBatch(), the wallet records written
+ * while scanning blocks share one database transaction, so they are synced
+ * to disk once instead of once per record. cs_wallet must be held for the
+ * lifetime of the batch, nothing else may write to the wallet file meanwhile.
+ */
+bool CWallet::BeginWriteBatch()
+{
+    AssertLockHeld(cs_wallet);
+    if (!fFileBacked || pwalletdbBatch)
+        return false;
+
+    pwalletdbBatch = new CWalletDB(strWalletFile, "r+", false);
+    if (!pwalletdbBatch->BatchBegin()) {
+        LogPrintf("BeginWriteBatch(): Couldn't start wallet write batch\n");
+        delete pwalletdbBatch;
+        pwalletdbBatch = NULL;
+        return false;
+    }
+    return true;
+}
+
+bool CWallet::CommitWriteBatch(const CBlockLocator* ploc)
+{
+    AssertLockHeld(cs_wallet);
+    if (!pwalletdbBatch)
+        return false;
+
+    if (ploc)
+        SetBestChainINTERNAL(*pwalletdbBatch, *ploc);
+
+    unsigned int nRecords = pwalletdbBatch->GetBatchRecords();
+    bool fCommitted = pwalletdbBatch->BatchCommit();
+    delete pwalletdbBatch;
+    pwalletdbBatch = NULL;
+
+    if (!fCommitted) {
+        // The best block was not written either, so the blocks are scanned
+        // again on restart. Have the next witness cache update rewrite the
+        // transactions in the meantime.
+        LogPrintf("CommitWriteBatch(): Couldn't commit %u wallet records\n", nRecords);
+        writeTxFailed = true;
+        return false;
+    }
+
+    nWriteBatches++;
+    nWriteBatchRecords += nRecords;
+    nLastWriteBatchRecords = nRecords;
+    LogPrint("db", "CommitWriteBatch(): Committed %u wallet records\n", nRecords);
+    return true;
+}
+
 std::set<std::pair<libzcash::PaymentAddress, uint256>> CWallet::GetNullifiersForAddresses(
         const std::set<libzcash::PaymentAddress> & addresses)
 {
@@ -1341,8 +1718,9 @@ void CWallet::LoadArcTxs(const uint256& wtxid, const ArchiveTxPoint& arcTxPt)
     mapArcTxs[wtxid] = arcTxPt;
 }
 
-void CWallet::AddToArcTxs(const uint256& wtxid, ArchiveTxPoint& arcTxPt, bool rescan)
+void CWallet::AddToArcTxs(const uint256& wtxid, ArchiveTxPoint& arcTxPt, bool rescan, CWalletDB* pwalletdb)
 {
+    nTxGeneration++;
     mapArcTxs[wtxid] = arcTxPt;
 
     uint256 txid = wtxid;
@@ -1352,6 +1730,8 @@ void CWallet::AddToArcTxs(const uint256& wtxid, ArchiveTxPoint& arcTxPt, bool re
     arcTxPt.ivks = arcTx.ivks;
     arcTxPt.ovks = arcTx.ovks;
     mapArcTxs[wtxid] = arcTxPt;
+    if (pwalletdb)
+        saveRpcArcTx(*pwalletdb, arcTx, true);
 
     //Update Address txid map
     for (auto it = arcTx.addresses.begin(); it != arcTx.addresses.end(); ++it) {
@@ -1372,8 +1752,9 @@ void CWallet::AddToArcTxs(const uint256& wtxid, ArchiveTxPoint& arcTxPt, bool re
     }
 }
 
-void CWallet::AddToArcTxs(const CWalletTx& wtx, ArchiveTxPoint& arcTxPt, bool rescan)
+void CWallet::AddToArcTxs(const CWalletTx& wtx, ArchiveTxPoint& arcTxPt, bool rescan, CWalletDB* pwalletdb)
 {
+    nTxGeneration++;
     mapArcTxs[wtx.GetHash()] = arcTxPt;
 
     CWalletTx tx = wtx;
@@ -1384,6 +1765,8 @@ void CWallet::AddToArcTxs(const CWalletTx& wtx, ArchiveTxPoint& arcTxPt, bool re
     arcTxPt.ivks = arcTx.ivks;
     arcTxPt.ovks = arcTx.ovks;
     mapArcTxs[wtx.GetHash()] = arcTxPt;
+    if (pwalletdb)
+        saveRpcArcTx(*pwalletdb, arcTx, true);
 
     //Update Address txid map
     for (auto it = arcTx.addresses.begin(); it != arcTx.addresses.end(); ++it) {
@@ -1413,6 +1796,83 @@ void CWallet::AddToArcSaplingOutPoints(const uint256& nullifier, const SaplingOu
     mapArcSaplingOutPoints[nullifier] = op;
 }
 
+void CWallet::LoadSaplingMemo(const SaplingOutPoint& op, const std::vector<unsigned char>& vchMemo)
+{
+    if (vchMemo.size() > ZC_MEMO_SIZE)
+        return;
+    std::pair<std::map<SaplingOutPoint, std::vector<unsigned char>>::iterator, bool> ret = mapSaplingMemos.insert(std::make_pair(op, vchMemo));
+    if (!ret.second) {
+        setSaplingMemosByMemo.erase(std::make_pair(ret.first->second, op));
+        ret.first->second = vchMemo;
+    }
+    setSaplingMemosByMemo.insert(std::make_pair(vchMemo, op));
+}
+
+void CWallet::AddSaplingMemo(const SaplingOutPoint& op, const std::array<unsigned char, ZC_MEMO_SIZE>& memo, CWalletDB* pwalletdb)
+{
+    AssertLockHeld(cs_wallet);
+    if (mapSaplingMemos.count(op))
+        return;
+    // Most memos are empty or short text, padded with zeros
+    std::array<unsigned char, ZC_MEMO_SIZE>::const_reverse_iterator end = std::find_if(memo.rbegin(), memo.rend(), [](unsigned char v) { return v != 0; });
+    std::vector<unsigned char> vchMemo(memo.begin(), end.base());
+    LoadSaplingMemo(op, vchMemo);
+    if (fFileBacked && pwalletdb && !pwalletdb->WriteSaplingMemo(op, vchMemo))
+        LogPrintf("%s: failed to write the memo of %s\n", __func__, op.ToString());
+}
+
+bool CWallet::GetSaplingMemo(const SaplingOutPoint& op, std::array<unsigned char, ZC_MEMO_SIZE>& memo)
+{
+    AssertLockHeld(cs_wallet);
+    std::map<SaplingOutPoint, std::vector<unsigned char>>::const_iterator it = mapSaplingMemos.find(op);
+    if (it != mapSaplingMemos.end()) {
+        memo.fill(0);
+        std::copy(it->second.begin(), it->second.end(), memo.begin());
+        return true;
+    }
+
+    std::map<uint256, CWalletTx>::const_iterator itTx = mapWallet.find(op.hash);
+    if (itTx == mapWallet.end())
+        return false;
+    auto decrypted = itTx->second.DecryptSaplingNote(op);
+    if (!decrypted)
+        return false;
+    memo = decrypted->first.memo();
+    AddSaplingMemo(op, memo);
+    return true;
+}
+
+void CWallet::FillSaplingMemos()
+{
+    AssertLockHeld(cs_wallet);
+    std::array<unsigned char, ZC_MEMO_SIZE> memo;
+    for (const std::pair<const libzcash::SaplingPaymentAddress, std::map<SaplingOutPoint, CSaplingNoteIndexEntry>>& addressNotes : mapSaplingNoteIndex) {
+        for (const std::pair<const SaplingOutPoint, CSaplingNoteIndexEntry>& note : addressNotes.second) {
+            if (!mapSaplingMemos.count(note.first))
+                GetSaplingMemo(note.first, memo);
+        }
+    }
+}
+
+void CWallet::FindSaplingMemos(const std::vector<unsigned char>& vchText, bool fSubstring, std::vector<SaplingOutPoint>& vOutPoints) const
+{
+    AssertLockHeld(cs_wallet);
+    if (fSubstring) {
+        for (const std::pair<const SaplingOutPoint, std::vector<unsigned char>>& item : mapSaplingMemos) {
+            if (std::search(item.second.begin(), item.second.end(), vchText.begin(), vchText.end()) != item.second.end())
+                vOutPoints.push_back(item.first);
+        }
+        return;
+    }
+    // The memos starting with vchText follow each other in the set from where vchText would be
+    std::set<std::pair<std::vector<unsigned char>, SaplingOutPoint>>::const_iterator it = setSaplingMemosByMemo.lower_bound(std::make_pair(vchText, SaplingOutPoint()));
+    for (; it != setSaplingMemosByMemo.end(); ++it) {
+        if (it->first.size() < vchText.size() || !std::equal(vchText.begin(), vchText.end(), it->first.begin()))
+            break;
+        vOutPoints.push_back(it->second);
+    }
+}
+
 void CWallet::AddToSpends(const uint256& wtxid)
 {
     assert(mapWallet.count(wtxid));
@@ -1436,6 +1896,7 @@ void CWallet::AddToSpends(const uint256& wtxid)
 void CWallet::ClearNoteWitnessCache()
 {
     LOCK(cs_wallet);
+    nPendingRewindTip = -1;
     for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
         for (mapSproutNoteData_t::value_type& item : wtxItem.second.mapSproutNoteData) {
             item.second.witnesses.clear();
@@ -1448,7 +1909,27 @@ void CWallet::ClearNoteWitnessCache()
     }
 }
 
+template<typename NoteData>
+static void RewindNoteWitnessCache(NoteData* nd, int nTipHeight, int nForkHeight)
+{
+    for (int nHeight = nTipHeight; nHeight > nForkHeight; nHeight--) {
+        // Only decrement witnesses that are not above the height of the block
+        // being removed, the new witness cache height is one below it.
+        if (nd->witnessHeight <= nHeight && nd->witnesses.size() > 1) {
+            nd->witnesses.pop_front();
+            nd->witnessHeight = nHeight - 1;
+        }
+    }
+}
+
 void CWallet::DecrementNoteWitnesses(const CBlockIndex* pindex)
+{
+    LOCK(cs_wallet);
+    ApplyPendingWitnessRewind();
+    RewindNoteWitnesses(pindex->GetHeight(), pindex->GetHeight() - 1);
+}
+
+void CWallet::RewindNoteWitnesses(int nTipHeight, int nForkHeight)
 {
     LOCK(cs_wallet);
 
@@ -1458,32 +1939,14 @@ void CWallet::DecrementNoteWitnesses(const CBlockIndex* pindex)
         //Sprout
         for (auto& item : wtxItem.second.mapSproutNoteData) {
             auto* nd = &(item.second);
-            if (nd->nullifier && pwalletMain->GetSproutSpendDepth(*item.second.nullifier) <= WITNESS_CACHE_SIZE) {
-              // Only decrement witnesses that are not above the current height
-                if (nd->witnessHeight <= pindex->GetHeight()) {
-                    if (nd->witnesses.size() > 1) {
-                        // indexHeight is the height of the block being removed, so
-                        // the new witness cache height is one below it.
-                        nd->witnesses.pop_front();
-                        nd->witnessHeight = pindex->GetHeight() - 1;
-                    }
-                }
-            }
+            if (nd->nullifier && GetSproutSpendDepth(*item.second.nullifier) <= WITNESS_CACHE_SIZE)
+                RewindNoteWitnessCache(nd, nTipHeight, nForkHeight);
         }
         //Sapling
         for (auto& item : wtxItem.second.mapSaplingNoteData) {
             auto* nd = &(item.second);
-            if (nd->nullifier && pwalletMain->GetSaplingSpendDepth(*item.second.nullifier) <= WITNESS_CACHE_SIZE) {
-                // Only decrement witnesses that are not above the current height
-                if (nd->witnessHeight <= pindex->GetHeight()) {
-                    if (nd->witnesses.size() > 1) {
-                        // indexHeight is the height of the block being removed, so
-                        // the new witness cache height is one below it.
-                        nd->witnesses.pop_front();
-                        nd->witnessHeight = pindex->GetHeight() - 1;
-                    }
-                }
-            }
+            if (nd->nullifier && GetSaplingSpendDepth(*item.second.nullifier) <= WITNESS_CACHE_SIZE)
+                RewindNoteWitnessCache(nd, nTipHeight, nForkHeight);
         }
     }
     assert(KOMODO_REWIND != 0 || WITNESS_CACHE_SIZE != _COINBASE_MATURITY+10);
@@ -1513,6 +1976,29 @@ int CWallet::SaplingWitnessMinimumHeight(const uint256& nullifier, int nWitnessH
     return nMinimumHeight;
 }
 
+/**
+ * Reads the Sapling note commitments of a block's transactions, and the block
+ * itself if the Sprout ones are needed too and it wasn't pruned. Otherwise
+ * they come from the commitment lists, or from the compact block record of a
+ * pruned block, which don't keep those of Sprout.
+ */
+static bool ReadBlockNoteCommitments(const CBlockIndex* pindex, bool fSprout, CBlock& block, bool& fPruned, CSaplingBlockCommitments& saplingCommitments)
+{
+  block.SetNull();
+  fPruned = fHavePruned && !(pindex->nStatus & BLOCK_HAVE_DATA);
+  if (fSprout && !fPruned) {
+    if (!ReadBlockFromDisk(block, pindex, 1))
+      return false;
+    saplingCommitments = CSaplingBlockCommitments(block);
+    return true;
+  }
+  std::vector<CSaplingBlockCommitments> vCommitments;
+  if (!ReadSaplingCommitments(pindex, 1, vCommitments) || vCommitments.empty())
+    return false;
+  saplingCommitments = vCommitments[0];
+  return true;
+}
+
 int CWallet::VerifyAndSetInitialWitness(const CBlockIndex* pindex, bool witnessOnly)
 {
   LOCK2(cs_main, cs_wallet);
@@ -1521,6 +2007,8 @@ int CWallet::VerifyAndSetInitialWitness(const CBlockIndex* pindex, bool witnessO
   int nWitnessTotalTxCount = mapWallet.size();
   int nMinimumHeight = pindex->GetHeight();
   bool walletHasNotes = false; //Use to enable z_sendmany when no notes are present
+  std::vector<CWalletTx*> vSaplingWtx;
+  std::vector<SaplingNoteData*> vSaplingRebuilt;
 
   for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
 
@@ -1600,7 +2088,7 @@ int CWallet::VerifyAndSetInitialWitness(const CBlockIndex* pindex, bool witnessO
 
               // Increment existing witness until the end of the block
               if (!nd->witnesses.empty()) {
-                nd->witnesses.front().append(note_commitment);
+                nd->witnesses.append_front(note_commitment);
               }
 
               //Only needed for intial witness
@@ -1672,24 +2160,27 @@ int CWallet::VerifyAndSetInitialWitness(const CBlockIndex* pindex, bool witnessO
 
         SaplingMerkleTree saplingTree;
         blockRoot = pblockindex->pprev->hashFinalSaplingRoot;
-        pcoinsTip->GetSaplingAnchorAt(blockRoot, saplingTree);
+        std::shared_ptr<const SaplingMerkleTree> pSaplingTree = pcoinsTip->GetSharedSaplingAnchorAt(blockRoot);
+        if (pSaplingTree)
+            saplingTree = *pSaplingTree;
 
         //Cycle through blocks and transactions building sapling tree until the commitment needed is reached
-        const CBlock* pblock;
         CBlock block;
-        ReadBlockFromDisk(block, pblockindex, 1);
-        pblock = &block;
+        bool fPruned;
+        CSaplingBlockCommitments saplingCommitments;
+        if (!ReadBlockNoteCommitments(pblockindex, false, block, fPruned, saplingCommitments))
+          LogPrintf("No Sapling note commitments for block %d, cannot set the witness for tx %s\n", pblockindex->GetHeight(), wtxHash.ToString());
 
-        for (const CTransaction& tx : block.vtx) {
-          auto hash = tx.GetHash();
+        for (const CSaplingTxCommitments& ctx : saplingCommitments.vtx) {
+          auto hash = ctx.txid;
 
           // Sapling
-          for (uint32_t i = 0; i < tx.vShieldedOutput.size(); i++) {
-            const uint256& note_commitment = tx.vShieldedOutput[i].cm;
+          for (uint32_t i = 0; i < ctx.cmus.size(); i++) {
+            const uint256& note_commitment = ctx.cmus[i];
 
             // Increment existing witness until the end of the block
             if (!nd->witnesses.empty()) {
-              nd->witnesses.front().append(note_commitment);
+              nd->witnesses.append_front(note_commitment);
             }
 
             //Only needed for intial witness
@@ -1707,11 +2198,19 @@ int CWallet::VerifyAndSetInitialWitness(const CBlockIndex* pindex, bool witnessO
           }
         }
         nd->witnessHeight = pblockindex->GetHeight();
-        UpdateSaplingNullifierNoteMapWithTx(wtxItem.second);
-        nMinimumHeight = SaplingWitnessMinimumHeight(*item.second.nullifier, nd->witnessHeight, nMinimumHeight);
+        //Nullifiers of rebuilt notes are derived together below
+        if (vSaplingWtx.empty() || vSaplingWtx.back() != &wtxItem.second)
+          vSaplingWtx.push_back(&wtxItem.second);
+        vSaplingRebuilt.push_back(nd);
       }
     }
   }
+
+  UpdateSaplingNullifierNoteMapWithTxs(vSaplingWtx);
+  for (const SaplingNoteData* nd : vSaplingRebuilt) {
+    if (nd->nullifier)
+      nMinimumHeight = SaplingWitnessMinimumHeight(*nd->nullifier, nd->witnessHeight, nMinimumHeight);
+  }
   //enable z_sendmany when the wallet has no Notes
   if (!IsInitialBlockDownload()) {
       if (!walletHasNotes || nMinimumHeight == pindex->GetHeight()) {
@@ -1722,9 +2221,33 @@ int CWallet::VerifyAndSetInitialWitness(const CBlockIndex* pindex, bool witnessO
   return nMinimumHeight;
 }
 
+/**
+ * Advance each note's newest cached witness by one block: the block's
+ * commitments are appended to it and recorded in the cache, on up to
+ * -witnessthreads threads for large sets.
+ */
+template<typename NoteData>
+static void AdvanceNoteWitnesses(const std::vector<NoteData*>& vNotes, const std::vector<uint256>& vCommitments, int nHeight)
+{
+  size_t nThreads = 1;
+  if (nWitnessCacheThreads > 1 && !vCommitments.empty()) {
+    nThreads = std::min<size_t>(nWitnessCacheThreads, vNotes.size() / WITNESS_CACHE_MIN_NOTES_PER_THREAD);
+  }
+
+  ParallelForRanges(vNotes.size(), nThreads, [&](size_t nBegin, size_t nEnd) {
+    for (size_t n = nBegin; n < nEnd; n++) {
+      NoteData* nd = vNotes[n];
+      nd->witnesses.advance(vCommitments);
+      nd->witnesses.trim(WITNESS_CACHE_SIZE);
+      nd->witnessHeight = nHeight;
+    }
+  });
+}
+
 void CWallet::BuildWitnessCache(const CBlockIndex* pindex, bool witnessOnly)
 {
   LOCK2(cs_main, cs_wallet);
+  ApplyPendingWitnessRewind();
 
   int startHeight = VerifyAndSetInitialWitness(pindex, witnessOnly) + 1;
 
@@ -1737,10 +2260,44 @@ void CWallet::BuildWitnessCache(const CBlockIndex* pindex, bool witnessOnly)
       fBuilingWitnessCache = true;
   }
 
-  uint256 sproutRoot;
-  uint256 saplingRoot;
   CBlockIndex* pblockindex = chainActive[startHeight];
   int height = chainActive.Height();
+  walletWitnessProgress.Start(startHeight, pindex->GetHeight());
+
+  //Collect the notes with witnesses to maintain once, neither their depth nor
+  //their spend depth can change while cs_main is held
+  std::vector<SproutNoteData*> vSproutNotes;
+  std::vector<SaplingNoteData*> vSaplingNotes;
+  for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
+
+    if (wtxItem.second.mapSproutNoteData.empty() && wtxItem.second.mapSaplingNoteData.empty())
+      continue;
+
+    if (wtxItem.second.GetDepthInMainChain() > 0) {
+
+      //Notes spent deeper than any reorg only keep their newest witness,
+      //the older ones can never be needed again
+      for (mapSproutNoteData_t::value_type& item : wtxItem.second.mapSproutNoteData) {
+        auto* nd = &(item.second);
+        if (nd->nullifier && !nd->witnesses.empty()) {
+          if (GetSproutSpendDepth(*nd->nullifier) <= WITNESS_CACHE_SIZE)
+            vSproutNotes.push_back(nd);
+          else if (nd->witnesses.size() > 1)
+            nd->witnesses.resize(1);
+        }
+      }
+
+      for (mapSaplingNoteData_t::value_type& item : wtxItem.second.mapSaplingNoteData) {
+        auto* nd = &(item.second);
+        if (nd->nullifier && !nd->witnesses.empty()) {
+          if (GetSaplingSpendDepth(*nd->nullifier) <= WITNESS_CACHE_SIZE)
+            vSaplingNotes.push_back(nd);
+          else if (nd->witnesses.size() > 1)
+            nd->witnesses.resize(1);
+        }
+      }
+    }
+  }
 
   //Show in UI
   bool uiShown = false;
@@ -1754,6 +2311,8 @@ void CWallet::BuildWitnessCache(const CBlockIndex* pindex, bool witnessOnly)
     if (ShutdownRequested()) {
         break;
     }
+    nWalletWitnessHeight = pblockindex->GetHeight();
+    int64_t nTimeBlock = GetTimeMicros();
 
     if (pblockindex->GetHeight() % 100 == 0 && pblockindex->GetHeight() < height - 5) {
       if (!uiShown) {
@@ -1765,87 +2324,65 @@ void CWallet::BuildWitnessCache(const CBlockIndex* pindex, bool witnessOnly)
       uiInterface.InitMessage(_(("Building Witnesses for block " + std::to_string(pblockindex->GetHeight())).c_str()) + ((" " + std::to_string(scanperc)).c_str()) + ("%"));
     }
 
-    SproutMerkleTree sproutTree;
-    sproutRoot = pblockindex->pprev->hashFinalSproutRoot;
-    pcoinsTip->GetSproutAnchorAt(sproutRoot, sproutTree);
-
-    SaplingMerkleTree saplingTree;
-    saplingRoot = pblockindex->pprev->hashFinalSaplingRoot;
-    pcoinsTip->GetSaplingAnchorAt(saplingRoot, saplingTree);
-
-    //Cycle through blocks and transactions building sapling tree until the commitment needed is reached
+    //Pull the block's note commitments out once, every tracked witness is advanced from the same lists
     CBlock block;
-    ReadBlockFromDisk(block, pblockindex, 1);
+    bool fPruned;
+    CSaplingBlockCommitments saplingCommitments;
+    if (!ReadBlockNoteCommitments(pblockindex, !vSproutNotes.empty(), block, fPruned, saplingCommitments)) {
+      LogPrintf("No note commitments for block %d, witnesses are not advanced past it\n", pblockindex->GetHeight());
+      break;
+    }
+    if (fPruned && !vSproutNotes.empty()) {
+      LogPrintf("Block %d is pruned, Sprout witnesses are not advanced past it\n", pblockindex->GetHeight());
+      vSproutNotes.clear();
+    }
 
-    for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
+    std::vector<uint256> vSproutCommitments;
+    for (const CTransaction& tx : block.vtx) {
+      for (size_t i = 0; i < tx.vjoinsplit.size(); i++) {
+        const JSDescription& jsdesc = tx.vjoinsplit[i];
+        for (uint8_t j = 0; j < jsdesc.commitments.size(); j++) {
+          vSproutCommitments.push_back(jsdesc.commitments[j]);
+        }
+      }
+    }
+    std::vector<uint256> vSaplingCommitments = saplingCommitments.GetCommitments();
 
-      if (wtxItem.second.mapSproutNoteData.empty() && wtxItem.second.mapSaplingNoteData.empty())
-        continue;
+    std::vector<SproutNoteData*> vSproutAdvance;
+    for (SproutNoteData* nd : vSproutNotes) {
+      if (nd->witnessHeight == pblockindex->GetHeight() - 1)
+        vSproutAdvance.push_back(nd);
+    }
+    std::vector<SaplingNoteData*> vSaplingAdvance;
+    for (SaplingNoteData* nd : vSaplingNotes) {
+      if (nd->witnessHeight == pblockindex->GetHeight() - 1)
+        vSaplingAdvance.push_back(nd);
+    }
 
-      if (wtxItem.second.GetDepthInMainChain() > 0) {
+    AdvanceNoteWitnesses(vSproutAdvance, vSproutCommitments, pblockindex->GetHeight());
+    AdvanceNoteWitnesses(vSaplingAdvance, vSaplingCommitments, pblockindex->GetHeight());
+    TRACE5(wallet, build_witness_cache, pblockindex->GetHeight(), vSproutAdvance.size(), vSaplingAdvance.size(),
+           vSaplingCommitments.size(), GetTimeMicros() - nTimeBlock);
+    walletWitnessProgress.nWitnesses += vSproutAdvance.size() + vSaplingAdvance.size();
+    walletWitnessProgress.nBlocks++;
 
-        //Sprout
-        for (mapSproutNoteData_t::value_type& item : wtxItem.second.mapSproutNoteData) {
-          auto* nd = &(item.second);
-          if (nd->nullifier && nd->witnessHeight == pblockindex->GetHeight() - 1
-              && GetSproutSpendDepth(*item.second.nullifier) <= WITNESS_CACHE_SIZE) {
+    if (pblockindex == pindex)
+      break;
 
+    pblockindex = chainActive.Next(pblockindex);
 
-            nd->witnesses.push_front(nd->witnesses.front());
-            while (nd->witnesses.size() > WITNESS_CACHE_SIZE) {
-                nd->witnesses.pop_back();
-            }
-
-            for (const CTransaction& tx : block.vtx) {
-              for (size_t i = 0; i < tx.vjoinsplit.size(); i++) {
-                const JSDescription& jsdesc = tx.vjoinsplit[i];
-                for (uint8_t j = 0; j < jsdesc.commitments.size(); j++) {
-                  const uint256& note_commitment = jsdesc.commitments[j];
-                  nd->witnesses.front().append(note_commitment);
-                }
-              }
-            }
-            nd->witnessHeight = pblockindex->GetHeight();
-          }
-        }
-
-        //Sapling
-        for (mapSaplingNoteData_t::value_type& item : wtxItem.second.mapSaplingNoteData) {
-          auto* nd = &(item.second);
-          if (nd->nullifier && nd->witnessHeight == pblockindex->GetHeight() - 1
-              && GetSaplingSpendDepth(*item.second.nullifier) <= WITNESS_CACHE_SIZE) {
-
-            nd->witnesses.push_front(nd->witnesses.front());
-            while (nd->witnesses.size() > WITNESS_CACHE_SIZE) {
-                nd->witnesses.pop_back();
-            }
-
-            for (const CTransaction& tx : block.vtx) {
-              for (uint32_t i = 0; i < tx.vShieldedOutput.size(); i++) {
-                const uint256& note_commitment = tx.vShieldedOutput[i].cm;
-                nd->witnesses.front().append(note_commitment);
-              }
-            }
-            nd->witnessHeight = pblockindex->GetHeight();
-          }
-        }
-      }
-    }
-
-    if (pblockindex == pindex)
-      break;
-
-    pblockindex = chainActive.Next(pblockindex);
-
-  }
+  }
+  nWalletWitnessHeight = -1;
 
   //If the wallet if flagged as have failt to save a tx, we will do it here.
   if (writeTxFailed) {
-      CWalletDB *pwalletdb = new CWalletDB(strWalletFile);
+      CWalletDB *pwalletdb = pwalletdbBatch ? pwalletdbBatch : new CWalletDB(strWalletFile);
       ArchiveTxPoint arcTxPt;
       for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
           wtxItem.second.WriteToDisk(pwalletdb, arcTxPt, false);
       }
+      if (pwalletdb != pwalletdbBatch)
+          delete pwalletdb;
   }
 
   if (uiShown) {
@@ -1873,20 +2410,12 @@ bool CWallet::EncryptWallet(const SecureString& strWalletPassphrase)
     GetRandBytes(&kMasterKey.vchSalt[0], WALLET_CRYPTO_SALT_SIZE);
 
     CCrypter crypter;
-    int64_t nStartTime = GetTimeMillis();
-    crypter.SetKeyFromPassphrase(strWalletPassphrase, kMasterKey.vchSalt, 25000, kMasterKey.nDerivationMethod);
-    kMasterKey.nDeriveIterations = 2500000 / ((double)(GetTimeMillis() - nStartTime));
-
-    nStartTime = GetTimeMillis();
-    crypter.SetKeyFromPassphrase(strWalletPassphrase, kMasterKey.vchSalt, kMasterKey.nDeriveIterations, kMasterKey.nDerivationMethod);
-    kMasterKey.nDeriveIterations = (kMasterKey.nDeriveIterations + kMasterKey.nDeriveIterations * 100 / ((double)(GetTimeMillis() - nStartTime))) / 2;
-
-    if (kMasterKey.nDeriveIterations < 25000)
-        kMasterKey.nDeriveIterations = 25000;
+    if (!CalibrateMasterKeyDerivation(kMasterKey, strWalletPassphrase))
+        return false;
 
-    LogPrintf("Encrypting Wallet with an nDeriveIterations of %i\n", kMasterKey.nDeriveIterations);
+    LogPrintf("Encrypting Wallet with Argon2id with %i passes\n", kMasterKey.nDeriveIterations);
 
-    if (!crypter.SetKeyFromPassphrase(strWalletPassphrase, kMasterKey.vchSalt, kMasterKey.nDeriveIterations, kMasterKey.nDerivationMethod))
+    if (!crypter.SetKeyFromPassphrase(strWalletPassphrase, kMasterKey))
         return false;
     if (!crypter.Encrypt(vMasterKey, kMasterKey.vchCryptedKey))
         return false;
@@ -2107,6 +2636,7 @@ void CWallet::MarkDirty()
         LOCK(cs_wallet);
         BOOST_FOREACH(PAIRTYPE(const uint256, CWalletTx)& item, mapWallet)
             item.second.MarkDirty();
+        fShieldedBalancesDirty = true;
     }
 }
 
@@ -2213,8 +2743,12 @@ void CWallet::UpdateSproutNullifierNoteMapWithTx(CWalletTx& wtx) {
                 item.second.nullifier = nullifier;
 
                 //write the ArcOp to disk
-                CWalletDB walletdb(strWalletFile, "r+", false);
-                wtx.WriteArcSproutOpToDisk(&walletdb, nullifier, item.first);
+                if (pwalletdbBatch) {
+                    wtx.WriteArcSproutOpToDisk(pwalletdbBatch, nullifier, item.first);
+                } else {
+                    CWalletDB walletdb(strWalletFile, "r+", false);
+                    wtx.WriteArcSproutOpToDisk(&walletdb, nullifier, item.first);
+                }
             }
         }
     }
@@ -2224,53 +2758,212 @@ void CWallet::UpdateSproutNullifierNoteMapWithTx(CWalletTx& wtx) {
  * Update mapSaplingNullifiersToNotes, computing the nullifier from a cached witness if necessary.
  */
 void CWallet::UpdateSaplingNullifierNoteMapWithTx(CWalletTx& wtx) {
+    std::vector<CWalletTx*> vWtx(1, &wtx);
+    UpdateSaplingNullifierNoteMapWithTxs(vWtx);
+}
+
+namespace {
+struct SaplingNullifierJob {
+    CWalletTx* pwtx;
+    SaplingOutPoint op;
+    SaplingExtendedFullViewingKey extfvk;
+    uint64_t position;
+    uint256 nullifier;
+};
+}
+
+/**
+ * Update mapSaplingNullifiersToNotes for several transactions at once.
+ * The nullifiers of large sets are derived on up to -zdecryptthreads
+ * threads, then applied to the wallet in note order.
+ */
+void CWallet::UpdateSaplingNullifierNoteMapWithTxs(const std::vector<CWalletTx*>& vWtx) {
     LOCK(cs_wallet);
 
-    for (mapSaplingNoteData_t::value_type &item : wtx.mapSaplingNoteData) {
-        SaplingOutPoint op = item.first;
-        SaplingNoteData nd = item.second;
+    std::vector<SaplingNullifierJob> vJobs;
+    for (CWalletTx* pwtx : vWtx) {
+        for (mapSaplingNoteData_t::value_type &item : pwtx->mapSaplingNoteData) {
+            SaplingNoteData& nd = item.second;
 
-        if (nd.witnesses.empty()) {
-            // If there are no witnesses, erase the nullifier and associated mapping.
-            if (item.second.nullifier) {
-                mapSaplingNullifiersToNotes.erase(item.second.nullifier.get());
+            if (nd.witnesses.empty()) {
+                // If there are no witnesses, erase the nullifier and associated mapping.
+                if (nd.nullifier) {
+                    mapSaplingNullifiersToNotes.erase(nd.nullifier.get());
+                }
+                nd.nullifier = boost::none;
             }
-            item.second.nullifier = boost::none;
-        }
-        else {
-            uint64_t position = nd.witnesses.front().position();
             // Skip if we only have incoming viewing key
-            if (mapSaplingFullViewingKeys.count(nd.ivk) != 0) {
-                SaplingExtendedFullViewingKey extfvk = mapSaplingFullViewingKeys.at(nd.ivk);
-                OutputDescription output = wtx.vShieldedOutput[op.n];
-                auto optPlaintext = SaplingNotePlaintext::decrypt(output.encCiphertext, nd.ivk, output.ephemeralKey, output.cm);
-                if (!optPlaintext) {
-                    // An item in mapSaplingNoteData must have already been successfully decrypted,
-                    // otherwise the item would not exist in the first place.
-                    assert(false);
-                }
-                auto optNote = optPlaintext.get().note(nd.ivk);
-                if (!optNote) {
-                    assert(false);
-                }
-                auto optNullifier = optNote.get().nullifier(extfvk.fvk, position);
-                if (!optNullifier) {
-                    // This should not happen.  If it does, maybe the position has been corrupted or miscalculated?
-                    assert(false);
-                }
-                uint256 nullifier = optNullifier.get();
-                mapSaplingNullifiersToNotes[nullifier] = op;
-                mapArcSaplingOutPoints[nullifier] = op;
-                item.second.nullifier = nullifier;
+            else if (mapSaplingFullViewingKeys.count(nd.ivk) != 0) {
+                SaplingNullifierJob job;
+                job.pwtx = pwtx;
+                job.op = item.first;
+                job.extfvk = mapSaplingFullViewingKeys.at(nd.ivk);
+                job.position = nd.witnesses.front().position();
+                vJobs.push_back(job);
+            }
+        }
+    }
 
-                //write the ArcOp to disk
-                CWalletDB walletdb(strWalletFile, "r+", false);
-                wtx.WriteArcSaplingOpToDisk(&walletdb, nullifier, op);
+    auto derive = [&](size_t nBegin, size_t nEnd) {
+        for (size_t n = nBegin; n < nEnd; n++) {
+            SaplingNullifierJob& job = vJobs[n];
+            const SaplingNoteData& nd = job.pwtx->mapSaplingNoteData.at(job.op);
+            const OutputDescription& output = job.pwtx->vShieldedOutput[job.op.n];
+            auto optPlaintext = SaplingNotePlaintext::decrypt(output.encCiphertext, nd.ivk, output.ephemeralKey, output.cm);
+            if (!optPlaintext) {
+                // An item in mapSaplingNoteData must have already been successfully decrypted,
+                // otherwise the item would not exist in the first place.
+                assert(false);
+            }
+            auto optNote = optPlaintext.get().note(nd.ivk);
+            if (!optNote) {
+                assert(false);
+            }
+            auto optNullifier = optNote.get().nullifier(job.extfvk.fvk, job.position);
+            if (!optNullifier) {
+                // This should not happen.  If it does, maybe the position has been corrupted or miscalculated?
+                assert(false);
             }
+            job.nullifier = optNullifier.get();
+        }
+    };
+
+    size_t nThreads = 1;
+    if (nSaplingDecryptThreads > 1) {
+        nThreads = std::min<size_t>(nSaplingDecryptThreads, vJobs.size() / SAPLING_NULLIFIER_MIN_NOTES_PER_THREAD);
+    }
+    ParallelForRanges(vJobs.size(), nThreads, derive);
+
+    if (!vJobs.empty()) {
+        CWalletDB *pwalletdb = pwalletdbBatch ? pwalletdbBatch : new CWalletDB(strWalletFile, "r+", false);
+        for (const SaplingNullifierJob& job : vJobs) {
+            CWalletTx& wtx = *job.pwtx;
+            mapSaplingNullifiersToNotes[job.nullifier] = job.op;
+            mapArcSaplingOutPoints[job.nullifier] = job.op;
+            wtx.mapSaplingNoteData[job.op].nullifier = job.nullifier;
+
+            //write the ArcOp to disk
+            wtx.WriteArcSaplingOpToDisk(pwalletdb, job.nullifier, job.op);
+        }
+        if (pwalletdb != pwalletdbBatch)
+            delete pwalletdb;
+    }
+
+    for (CWalletTx* pwtx : vWtx) {
+        if (pwtx->mapSaplingNoteData.empty()) {
+            EraseFromSaplingNoteIndex(pwtx->GetHash());
+        } else {
+            UpdateSaplingNoteIndexWithTx(*pwtx);
         }
     }
 }
 
+/**
+ * Replace the mapSaplingNoteIndex entries of a transaction with its current
+ * note data.
+ */
+void CWallet::UpdateSaplingNoteIndexWithTx(const CWalletTx& wtx) {
+    LOCK(cs_wallet);
+    fShieldedBalancesDirty = true;
+
+    uint256 hash = wtx.GetHash();
+    EraseFromSaplingNoteIndex(hash);
+
+    for (const mapSaplingNoteData_t::value_type &item : wtx.mapSaplingNoteData) {
+        const SaplingOutPoint &op = item.first;
+        const SaplingNoteData &nd = item.second;
+
+        // Address and value are only cached in memory, fall back to decrypting
+        // the note when they have not been filled in yet.
+        libzcash::SaplingPaymentAddress address = nd.address;
+        CAmount value = nd.value;
+        if (address == libzcash::SaplingPaymentAddress()) {
+            auto decrypted = wtx.DecryptSaplingNote(op);
+            if (!decrypted)
+                continue;
+            value = decrypted->first.value();
+            address = decrypted->second;
+        }
+
+        mapSaplingNoteIndex[address][op] = CSaplingNoteIndexEntry(value, nd.nullifier);
+        mapSaplingNoteIndexTxAddresses[hash].insert(address);
+        mapSaplingNotesByValue[address].insert(std::make_pair(value, op));
+    }
+}
+
+void CWallet::EraseFromSaplingNoteIndex(const uint256& hash) {
+    LOCK(cs_wallet);
+    fShieldedBalancesDirty = true;
+
+    auto itTx = mapSaplingNoteIndexTxAddresses.find(hash);
+    if (itTx == mapSaplingNoteIndexTxAddresses.end())
+        return;
+
+    for (const libzcash::SaplingPaymentAddress &address : itTx->second) {
+        auto itAddr = mapSaplingNoteIndex.find(address);
+        if (itAddr == mapSaplingNoteIndex.end())
+            continue;
+        auto &notes = itAddr->second;
+        auto itBegin = notes.lower_bound(SaplingOutPoint(hash, 0));
+        auto itEnd = notes.upper_bound(SaplingOutPoint(hash, std::numeric_limits<uint32_t>::max()));
+        auto &notesByValue = mapSaplingNotesByValue[address];
+        for (auto it = itBegin; it != itEnd; ++it) {
+            notesByValue.erase(std::make_pair(it->second.value, it->first));
+        }
+        if (notesByValue.empty())
+            mapSaplingNotesByValue.erase(address);
+        notes.erase(itBegin, itEnd);
+        if (notes.empty())
+            mapSaplingNoteIndex.erase(itAddr);
+    }
+    mapSaplingNoteIndexTxAddresses.erase(itTx);
+}
+
+void CWallet::UpdateTransparentCoinIndexWithTx(const CWalletTx& wtx) {
+    LOCK(cs_wallet);
+    if (fTransparentCoinIndexDirty)
+        return;
+    for (const CTxOut& txout : wtx.vout) {
+        if (IsMine(txout) != ISMINE_NO) {
+            setTransparentCoinTxs.insert(wtx.GetHash());
+            return;
+        }
+    }
+}
+
+void CWallet::EraseFromTransparentCoinIndex(const uint256& hash) {
+    LOCK(cs_wallet);
+    bool fHadCoins = setTransparentCoinTxs.erase(hash) != 0;
+    std::map<uint256, CWalletTx>::const_iterator it = mapWallet.find(hash);
+    if (fHadCoins || fTransparentCoinIndexDirty || (it != mapWallet.end() && !it->second.vin.empty()))
+        fAddressGroupingsDirty = true;
+}
+
+void CWallet::EraseFromRebroadcastQueue(const uint256& hash) {
+    LOCK(cs_wallet);
+    std::map<uint256, CWalletTx>::const_iterator it = mapWallet.find(hash);
+    if (it != mapWallet.end())
+        setRebroadcastQueue.erase(std::make_pair((int64_t)it->second.nTimeReceived, hash));
+}
+
+const std::set<uint256>& CWallet::GetTransparentCoinTxs() const
+{
+    AssertLockHeld(cs_wallet);
+    if (fTransparentCoinIndexDirty) {
+        setTransparentCoinTxs.clear();
+        for (const std::pair<const uint256, CWalletTx>& item : mapWallet) {
+            for (const CTxOut& txout : item.second.vout) {
+                if (IsMine(txout) != ISMINE_NO) {
+                    setTransparentCoinTxs.insert(item.first);
+                    break;
+                }
+            }
+        }
+        fTransparentCoinIndexDirty = false;
+    }
+    return setTransparentCoinTxs;
+}
+
 /**
  * Iterate over transactions in a block and update the cached Sapling nullifiers
  * for transactions which belong to the wallet.
@@ -2278,14 +2971,16 @@ void CWallet::UpdateSaplingNullifierNoteMapWithTx(CWalletTx& wtx) {
 void CWallet::UpdateNullifierNoteMapForBlock(const CBlock *pblock) {
     LOCK(cs_wallet);
 
+    std::vector<CWalletTx*> vWtx;
     for (const CTransaction& tx : pblock->vtx) {
         auto hash = tx.GetHash();
         bool txIsOurs = mapWallet.count(hash);
         if (txIsOurs) {
             UpdateSproutNullifierNoteMapWithTx(mapWallet[hash]);
-            UpdateSaplingNullifierNoteMapWithTx(mapWallet[hash]);
+            vWtx.push_back(&mapWallet[hash]);
         }
     }
+    UpdateSaplingNullifierNoteMapWithTxs(vWtx);
 }
 
 bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletDB* pwalletdb, bool fRescan)
@@ -2297,7 +2992,12 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
         mapWallet[hash] = wtxIn;
         mapWallet[hash].BindWallet(this);
         UpdateNullifierNoteMapWithTx(mapWallet[hash]);
+        UpdateTransparentCoinIndexWithTx(mapWallet[hash]);
+        AddToAddressGroupings(mapWallet[hash], true);
         AddToSpends(hash);
+        // Confirmed ones are dropped by the first rebroadcast
+        if (!wtxIn.IsCoinBase())
+            setRebroadcastQueue.insert(std::make_pair((int64_t)wtxIn.nTimeReceived, hash));
     }
     else
     {
@@ -2308,6 +3008,14 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
         wtx.BindWallet(this);
         UpdateNullifierNoteMapWithTx(wtx);
         bool fInsertedNew = ret.second;
+        if (fInsertedNew)
+            UpdateSaplingNoteIndexWithTx(wtx);
+        // Also for a tx already there, a rescan after an import finds outputs that became ours
+        UpdateTransparentCoinIndexWithTx(wtx);
+        if (fInsertedNew)
+            AddToAddressGroupings(wtx, true);
+        if (fInsertedNew)
+            mapPagedTxDebits.erase(hash); // paged out history seen again by a rescan
         if (fInsertedNew)
         {
             wtx.nTimeReceived = GetTime();
@@ -2362,6 +3070,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
         }
 
         bool fUpdated = false;
+        bool fConfirmed = false;
         if (!fInsertedNew)
         {
             // Merge
@@ -2369,6 +3078,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
             {
                 wtx.hashBlock = wtxIn.hashBlock;
                 fUpdated = true;
+                fConfirmed = true;
             }
             if (wtxIn.nIndex != -1 && (wtxIn.vMerkleBranch != wtx.vMerkleBranch || wtxIn.nIndex != wtx.nIndex))
             {
@@ -2386,24 +3096,36 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
             }
         }
 
+        if (!wtx.IsCoinBase() && (fInsertedNew || wtxIn.hashBlock.IsNull()))
+            setRebroadcastQueue.insert(std::make_pair((int64_t)wtx.nTimeReceived, hash));
+
         //// debug print
         LogPrintf("AddToWallet %s  %s%s\n", wtxIn.GetHash().ToString(), (fInsertedNew ? "new" : ""), (fUpdated ? "update" : ""));
 
+        if (fUpdated) {
+            UpdateSaplingNoteIndexWithTx(wtx);
+        }
+
         // Write to disk and update tx archive map
         if (fInsertedNew || fUpdated) {
             ArchiveTxPoint arcTxPt = ArchiveTxPoint(wtx.hashBlock, wtx.nIndex);
-            AddToArcTxs(wtx, arcTxPt, true);
+            AddToArcTxs(wtx, arcTxPt, true, pwalletdb);
             if (!wtx.WriteToDisk(pwalletdb, arcTxPt, true))
                 writeTxFailed = true;
+            if (fTxDeleteQueueLoaded)
+                QueueTxForDelete(wtx);
         }
 
         // Break debit/credit balance caches:
         wtx.MarkDirty();
+        fShieldedBalancesDirty = true;
 
         // Notify UI of new or updated transaction
         if (!fRescan) {
             NotifyTransactionChanged(this, hash, fInsertedNew ? CT_NEW : CT_UPDATED);
             NotifyBalanceChanged();
+            if (!NotifyShieldedEvent.empty())
+                NotifyShieldedEvents(wtx, fInsertedNew, fConfirmed, pwalletdb);
         }
         // notify an external script when a wallet transaction comes in or is updated
         std::string strCmd = GetArg("-walletnotify", "");
@@ -2418,6 +3140,50 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
     return true;
 }
 
+void CWallet::NotifyShieldedEvents(const CWalletTx& wtx, bool fInsertedNew, bool fConfirmed, CWalletDB* pwalletdb)
+{
+    AssertLockHeld(cs_wallet);
+    uint256 txid = wtx.GetHash();
+    int nDepth = wtx.GetDepthInMainChain();
+    if (!fInsertedNew) {
+        if (fConfirmed)
+            NotifyShieldedEvent(CWalletShieldedEvent(CWalletShieldedEvent::TX_CONFIRMED, txid, wtx.hashBlock, nDepth));
+        return;
+    }
+
+    for (const mapSaplingNoteData_t::value_type& item : wtx.mapSaplingNoteData) {
+        auto decrypted = wtx.DecryptSaplingNote(item.first);
+        if (!decrypted)
+            continue;
+        CWalletShieldedEvent event(CWalletShieldedEvent::NOTE_RECEIVED, txid, wtx.hashBlock, nDepth);
+        event.nIndex = item.first.n;
+        event.address = EncodePaymentAddress(decrypted->second);
+        event.nValue = decrypted->first.value();
+        event.memo = HexStr(decrypted->first.memo());
+        // Written in the same batch as the transaction
+        AddSaplingMemo(item.first, decrypted->first.memo(), pwalletdb);
+        NotifyShieldedEvent(event);
+    }
+
+    for (size_t i = 0; i < wtx.vShieldedSpend.size(); i++) {
+        std::map<uint256, SaplingOutPoint>::const_iterator it = mapSaplingNullifiersToNotes.find(wtx.vShieldedSpend[i].nullifier);
+        if (it == mapSaplingNullifiersToNotes.end())
+            continue;
+        CWalletShieldedEvent event(CWalletShieldedEvent::NOTE_SPENT, txid, wtx.hashBlock, nDepth);
+        event.nIndex = i;
+        event.spentNote = it->second;
+        std::map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(it->second.hash);
+        if (mi != mapWallet.end()) {
+            auto decrypted = mi->second.DecryptSaplingNote(it->second);
+            if (decrypted) {
+                event.address = EncodePaymentAddress(decrypted->second);
+                event.nValue = decrypted->first.value();
+            }
+        }
+        NotifyShieldedEvent(event);
+    }
+}
+
 bool CWallet::UpdatedNoteData(const CWalletTx& wtxIn, CWalletTx& wtx)
 {
     bool unchangedSproutFlag = (wtxIn.mapSproutNoteData.empty() || wtxIn.mapSproutNoteData == wtx.mapSproutNoteData);
@@ -2426,8 +3192,7 @@ bool CWallet::UpdatedNoteData(const CWalletTx& wtxIn, CWalletTx& wtx)
         // Ensure we keep any cached witnesses we may already have
         for (const std::pair <JSOutPoint, SproutNoteData> nd : wtx.mapSproutNoteData) {
             if (tmp.count(nd.first) && nd.second.witnesses.size() > 0) {
-                tmp.at(nd.first).witnesses.assign(
-                        nd.second.witnesses.cbegin(), nd.second.witnesses.cend());
+                tmp.at(nd.first).witnesses = nd.second.witnesses;
             }
             tmp.at(nd.first).witnessHeight = nd.second.witnessHeight;
         }
@@ -2442,8 +3207,7 @@ bool CWallet::UpdatedNoteData(const CWalletTx& wtxIn, CWalletTx& wtx)
 
         for (const std::pair <SaplingOutPoint, SaplingNoteData> nd : wtx.mapSaplingNoteData) {
             if (tmp.count(nd.first) && nd.second.witnesses.size() > 0) {
-                tmp.at(nd.first).witnesses.assign(
-                        nd.second.witnesses.cbegin(), nd.second.witnesses.cend());
+                tmp.at(nd.first).witnesses = nd.second.witnesses;
             }
             tmp.at(nd.first).witnessHeight = nd.second.witnessHeight;
         }
@@ -2460,7 +3224,8 @@ bool CWallet::UpdatedNoteData(const CWalletTx& wtxIn, CWalletTx& wtx)
  * pblock is optional, but should be provided if the transaction is known to be in a block.
  * If fUpdate is true, existing transactions will be updated.
  */
-bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate, bool fRescan)
+bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate, bool fRescan,
+                                       const std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap>* pSaplingNotes)
 {
     {
         AssertLockHeld(cs_wallet);
@@ -2469,7 +3234,7 @@ bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pbl
         bool fExisted = mapWallet.count(tx.GetHash()) != 0;
         if (fExisted && !fUpdate) return false;
         auto sproutNoteData = FindMySproutNotes(tx);
-        auto saplingNoteDataAndAddressesToAdd = FindMySaplingNotes(tx);
+        auto saplingNoteDataAndAddressesToAdd = pSaplingNotes ? *pSaplingNotes : FindMySaplingNotes(tx);
         auto saplingNoteData = saplingNoteDataAndAddressesToAdd.first;
         auto addressesToAdd = saplingNoteDataAndAddressesToAdd.second;
         for (const auto &addressToAdd : addressesToAdd) {
@@ -2538,6 +3303,8 @@ bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pbl
 
             // Do not flush the wallet here for performance reasons
             // this is safe, as in case of a crash, we rescan the necessary blocks on startup through our SetBestChain-mechanism
+            if (pwalletdbBatch)
+                return AddToWallet(wtx, false, pwalletdbBatch, fRescan);
             CWalletDB walletdb(strWalletFile, "r+", false);
 
             return AddToWallet(wtx, false, &walletdb, fRescan);
@@ -2555,11 +3322,32 @@ void CWallet::SyncTransaction(const CTransaction& tx, const CBlock* pblock)
     MarkAffectedTransactionsDirty(tx);
 }
 
+void CWallet::SyncTransactions(const std::vector<CTransaction>& vtx, const CBlock* pblock)
+{
+    // Trial decrypt the whole batch before taking cs_wallet, and only once.
+    // Keys are counted first; if one is added meanwhile the results may miss
+    // its notes, so AddToWalletIfInvolvingMe decrypts again.
+    std::vector<const CTransaction*> vptx;
+    for (const CTransaction& tx : vtx) {
+        vptx.push_back(&tx);
+    }
+    size_t nSaplingKeys = GetSaplingKeyCount();
+    std::vector<std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap>> vSaplingNotes = FindMySaplingNotes(vptx);
+
+    LOCK(cs_wallet);
+    bool fUseSaplingNotes = nSaplingKeys == GetSaplingKeyCount();
+    for (size_t i = 0; i < vtx.size(); i++) {
+        if (AddToWalletIfInvolvingMe(vtx[i], pblock, true, false, fUseSaplingNotes ? &vSaplingNotes[i] : NULL))
+            MarkAffectedTransactionsDirty(vtx[i]);
+    }
+}
+
 void CWallet::MarkAffectedTransactionsDirty(const CTransaction& tx)
 {
     // If a transaction changes 'conflicted' state, that changes the balance
     // available of the outputs it spends. So force those to be
     // recomputed, also:
+    fShieldedBalancesDirty = true;
     BOOST_FOREACH(const CTxIn& txin, tx.vin)
     {
         if (mapWallet.count(txin.prevout.hash))
@@ -2589,8 +3377,21 @@ void CWallet::EraseFromWallet(const uint256 &hash)
         return;
     {
         LOCK(cs_wallet);
-        if (mapWallet.erase(hash))
-            CWalletDB(strWalletFile).EraseTx(hash);
+        EraseFromSaplingNoteIndex(hash);
+        EraseFromTransparentCoinIndex(hash);
+        EraseFromRebroadcastQueue(hash);
+        CWalletDB walletdb(strWalletFile);
+        std::map<SaplingOutPoint, std::vector<unsigned char>>::iterator itMemo = mapSaplingMemos.lower_bound(SaplingOutPoint(hash, 0));
+        while (itMemo != mapSaplingMemos.end() && itMemo->first.hash == hash) {
+            walletdb.EraseSaplingMemo(itMemo->first);
+            setSaplingMemosByMemo.erase(std::make_pair(itMemo->second, itMemo->first));
+            mapSaplingMemos.erase(itMemo++);
+        }
+        if (mapWallet.erase(hash)) {
+            nTxGeneration++;
+            walletdb.EraseTx(hash);
+            walletdb.EraseRpcArcTx(hash);
+        }
     }
     return;
 }
@@ -2693,79 +3494,142 @@ mapSproutNoteData_t CWallet::FindMySproutNotes(const CTransaction &tx) const
  */
 std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap> CWallet::FindMySaplingNotes(const CTransaction &tx) const
 {
-    LOCK(cs_SpendingKeyStore);
-    uint256 hash = tx.GetHash();
+    return FindMySaplingNotes(std::vector<const CTransaction*>(1, &tx))[0];
+}
 
-    mapSaplingNoteData_t noteData;
-    SaplingIncomingViewingKeyMap viewingKeysToAdd;
+std::vector<std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap>> CWallet::FindMySaplingNotes(const std::vector<const CTransaction*> &vtx) const
+{
+    std::vector<std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap>> vNotes(vtx.size());
 
-    std::set <SaplingIncomingViewingKey> keysTried;
+    // The outputs of all transactions are decrypted in one pass, so a batch of
+    // small transactions still keeps every decryption thread busy.
+    std::vector<OutputDescription> vOutputs;
+    for (const CTransaction* ptx : vtx) {
+        vOutputs.insert(vOutputs.end(), ptx->vShieldedOutput.begin(), ptx->vShieldedOutput.end());
+    }
+    if (vOutputs.empty()) {
+        return vNotes;
+    }
+    int64_t nTimeStart = GetTimeMicros();
+
+    // Keys from full viewing keys are tried first, followed by the remaining
+    // incoming viewing keys, each key being tried at most once per output.
+    // The table is a copy taken under cs_SpendingKeyStore, the decryption runs
+    // without it so key lookups and imports are not held up meanwhile.
+    std::shared_ptr<const std::vector<SaplingIncomingViewingKey>> pIvks = GetSaplingIvkTable();
+    const std::vector<SaplingIncomingViewingKey>& vIvks = *pIvks;
 
     // Protocol Spec: 4.19 Block Chain Scanning (Sapling)
-    for (uint32_t i = 0; i < tx.vShieldedOutput.size(); ++i) {
-        const OutputDescription output = tx.vShieldedOutput[i];
-        bool found = false;
-        for (auto it = mapSaplingFullViewingKeys.begin(); it != mapSaplingFullViewingKeys.end(); ++it) {
-            SaplingIncomingViewingKey ivk = it->first;
-            keysTried.insert(ivk);
-            auto result = SaplingNotePlaintext::decrypt(output.encCiphertext, ivk, output.ephemeralKey, output.cm);
-            if (result) {
-                auto address = ivk.address(result.get().d);
-                if (address && mapSaplingIncomingViewingKeys.count(address.get()) == 0) {
-                    viewingKeysToAdd[address.get()] = ivk;
-                }
-                // We don't cache the nullifier here as computing it requires knowledge of the note position
-                // in the commitment tree, which can only be determined when the transaction has been mined.
-                SaplingOutPoint op {hash, i};
-                SaplingNoteData nd;
-                nd.ivk = ivk;
-
-                //Cache Address and value - in Memory Only
-                auto note = result.get();
-                nd.value = note.value();
-                nd.address = address.get();
-
-                noteData.insert(std::make_pair(op, nd));
-                found = true;
-                break;
+    std::vector<SaplingTrialDecryptionResult> vResults;
+    TrialDecryptSaplingOutputs(vOutputs, vIvks, vResults);
+
+    LOCK(cs_SpendingKeyStore);
+    size_t nResult = 0;
+    size_t nFound = 0;
+    for (size_t n = 0; n < vtx.size(); n++) {
+        uint256 hash = vtx[n]->GetHash();
+        mapSaplingNoteData_t& noteData = vNotes[n].first;
+        SaplingIncomingViewingKeyMap& viewingKeysToAdd = vNotes[n].second;
+
+        for (uint32_t i = 0; i < vtx[n]->vShieldedOutput.size(); ++i, ++nResult) {
+            if (!vResults[nResult].plaintext) {
+                continue;
+            }
+
+            const SaplingIncomingViewingKey &ivk = vIvks[vResults[nResult].nKey];
+            auto note = vResults[nResult].plaintext.get();
+            auto address = ivk.address(note.d);
+            if (!address) {
+                continue;
+            }
+            if (mapSaplingIncomingViewingKeys.count(address.get()) == 0) {
+                viewingKeysToAdd[address.get()] = ivk;
             }
+
+            // We don't cache the nullifier here as computing it requires knowledge of the note position
+            // in the commitment tree, which can only be determined when the transaction has been mined.
+            SaplingOutPoint op {hash, i};
+            SaplingNoteData nd;
+            nd.ivk = ivk;
+
+            //Cache Address and value - in Memory Only
+            nd.value = note.value();
+            nd.address = address.get();
+
+            noteData.insert(std::make_pair(op, nd));
+            nFound++;
         }
-        if (!found) {
-            for (auto it = setSaplingIncomingViewingKeys.begin(); it != setSaplingIncomingViewingKeys.end(); ++it) {
-                SaplingIncomingViewingKey ivk = *it;
-                std::set <SaplingIncomingViewingKey>::iterator kit = keysTried.find(ivk);
-                if (kit == keysTried.end()) {
-                  keysTried.insert(ivk);
-                  auto result = SaplingNotePlaintext::decrypt(output.encCiphertext, ivk, output.ephemeralKey, output.cm);
-                  if (!result) {
-                      continue;
-                  }
+    }
 
-                  //add address
-                  auto address = ivk.address(result.get().d);
-                  if (address && mapSaplingIncomingViewingKeys.count(address.get()) == 0) {
-                      viewingKeysToAdd[address.get()] = ivk;
-                  }
+    TRACE5(wallet, find_sapling_notes, vtx.size(), vOutputs.size(), vIvks.size(), nFound, GetTimeMicros() - nTimeStart);
+    return vNotes;
+}
 
-                  // We don't cache the nullifier here as computing it requires knowledge of the note position
-                  // in the commitment tree, which can only be determined when the transaction has been mined.
-                  SaplingOutPoint op {hash, i};
-                  SaplingNoteData nd;
-                  nd.ivk = ivk;
+size_t CWallet::GetSaplingKeyCount() const
+{
+    LOCK(cs_SpendingKeyStore);
+    return mapSaplingFullViewingKeys.size() + setSaplingIncomingViewingKeys.size();
+}
 
-                  //Cache Address and value - in Memory Only
-                  auto note = result.get();
-                  nd.value = note.value();
-                  nd.address = address.get();
+/**
+ * Trial decrypts every output against every key in vIvks. For each output the
+ * result holds the plaintext under the lowest indexed key that decrypts it, so
+ * the outcome does not depend on how the (output, key) pairs are split
+ * between the -zdecryptthreads threads large batches use.
+ */
+void CWallet::TrialDecryptSaplingOutputs(
+    const std::vector<OutputDescription> &vOutputs,
+    const std::vector<SaplingIncomingViewingKey> &vIvks,
+    std::vector<SaplingTrialDecryptionResult> &vResults)
+{
+    vResults.assign(vOutputs.size(), SaplingTrialDecryptionResult());
+    if (vOutputs.empty() || vIvks.empty()) {
+        return;
+    }
 
-                  noteData.insert(std::make_pair(op, nd));
-                  break;
-                }
+    const size_t nKeys = vIvks.size();
+    const size_t nPairs = vOutputs.size() * nKeys;
+
+    // Index of the lowest matching key per output, nKeys if none found yet.
+    std::vector<std::atomic<size_t>> vBestKey(vOutputs.size());
+    for (size_t i = 0; i < vBestKey.size(); i++) {
+        vBestKey[i] = nKeys;
+    }
+    std::mutex csResults;
+
+    auto decryptRange = [&](size_t nBegin, size_t nEnd) {
+        for (size_t n = nBegin; n < nEnd; n++) {
+            size_t nOutput = n / nKeys;
+            size_t nKey = n % nKeys;
+            if (vBestKey[nOutput] <= nKey) {
+                // Already decrypted with a preferred key, skip the rest of this output.
+                n = (nOutput + 1) * nKeys - 1;
+                continue;
+            }
+
+            const OutputDescription &output = vOutputs[nOutput];
+            auto result = SaplingNotePlaintext::decrypt(output.encCiphertext, vIvks[nKey], output.ephemeralKey, output.cm);
+            if (!result) {
+                continue;
+            }
+
+            std::lock_guard<std::mutex> lock(csResults);
+            if (nKey < vBestKey[nOutput]) {
+                vBestKey[nOutput] = nKey;
+                vResults[nOutput].nKey = nKey;
+                vResults[nOutput].plaintext = result;
             }
         }
+    };
+
+    int nThreads = nSaplingDecryptThreads;
+    if (nThreads > 1 && nPairs >= SAPLING_DECRYPT_BATCH_MIN_PAIRS) {
+        nThreads = std::min<size_t>(nThreads, nPairs / (SAPLING_DECRYPT_BATCH_MIN_PAIRS / 4));
+    } else {
+        nThreads = 1;
     }
 
-    return std::make_pair(noteData, viewingKeysToAdd);
+    ParallelForRanges(nPairs, nThreads, decryptRange);
 }
 
 bool CWallet::IsSproutNullifierFromMe(const uint256& nullifier) const
@@ -2797,6 +3661,7 @@ void CWallet::GetSproutNoteWitnesses(std::vector<JSOutPoint> notes,
                                      uint256 &final_anchor)
 {
     LOCK(cs_wallet);
+    ApplyPendingWitnessRewind();
     witnesses.resize(notes.size());
     boost::optional<uint256> rt;
     int i = 0;
@@ -2824,6 +3689,7 @@ void CWallet::GetSaplingNoteWitnesses(std::vector<SaplingOutPoint> notes,
                                       uint256 &final_anchor)
 {
     LOCK(cs_wallet);
+    ApplyPendingWitnessRewind();
     witnesses.resize(notes.size());
     boost::optional<uint256> rt;
     int i = 0;
@@ -3703,7 +4569,11 @@ void CWallet::DeleteTransactions(std::vector<uint256> &removeTxs, std::vector<ui
     CWalletDB walletdb(strWalletFile, "r+", false);
 
     for (int i = 0; i < removeTxs.size(); i++) {
+        EraseFromSaplingNoteIndex(removeTxs[i]);
+        EraseFromTransparentCoinIndex(removeTxs[i]);
+        EraseFromRebroadcastQueue(removeTxs[i]);
         if (mapWallet.erase(removeTxs[i])) {
+            nTxGeneration++;
             walletdb.EraseTx(removeTxs[i]);
             LogPrint("deletetx","Delete Tx - Deleting tx %s, %i.\n", removeTxs[i].ToString(),i);
         } else {
@@ -3715,7 +4585,9 @@ void CWallet::DeleteTransactions(std::vector<uint256> &removeTxs, std::vector<ui
     //Remove Conflicted ArcTx transactions from the wallet database
     for (int i = 0; i < removeArcTxs.size(); i++) {
         if (mapArcTxs.erase(removeArcTxs[i])) {
+            nTxGeneration++;
             walletdb.EraseArcTx(removeArcTxs[i]);
+            walletdb.EraseRpcArcTx(removeArcTxs[i]);
             //remove conflicted transactions from GUI
             NotifyTransactionChanged(this, removeArcTxs[i], CT_DELETED);
             LogPrint("deletetx","Delete Tx - Deleting Arc tx %s, %i.\n", removeArcTxs[i].ToString(),i);
@@ -3726,216 +4598,457 @@ void CWallet::DeleteTransactions(std::vector<uint256> &removeTxs, std::vector<ui
     }
 }
 
-void CWallet::DeleteWalletTransactions(const CBlockIndex* pindex) {
+/**
+ * Whether every note and output of wtx was spent more than nMinSpendDepth
+ * blocks ago and none of the transactions it spends from are still in the
+ * wallet (setGone holds transactions about to leave it). Such a transaction
+ * no longer affects the balance or the spent state of the rest of the wallet.
+ */
+bool CWallet::IsSpentHistory(const CWalletTx& wtx, unsigned int nMinSpendDepth, const std::set<uint256>* setGone) const
+{
+    AssertLockHeld(cs_wallet);
+    const uint256& wtxid = wtx.GetHash();
+
+    auto fParentInWallet = [&](const uint256& parentHash) {
+        if (parentHash == wtxid || (setGone && setGone->count(parentHash)))
+            return false;
+        return GetWalletTx(parentHash) != NULL;
+    };
 
-      LOCK2(cs_main, cs_wallet);
+    //Check for unspent inputs or spend less than N Blocks ago. (Sapling)
+    for (auto & pair : wtx.mapSaplingNoteData) {
+        const SaplingNoteData& nd = pair.second;
+        if (!nd.nullifier || GetSaplingSpendDepth(*nd.nullifier) <= nMinSpendDepth)
+            return false;
+    }
 
-      int nDeleteAfter = (int)fDeleteTransactionsAfterNBlocks;
-      bool runCompact = false;
-      auto startTime = GetTime();
+    //Check for outputs that no longer have parents in the wallet. Exclude parents that are in the same transaction. (Sapling)
+    for (const SpendDescription& spendDesc : wtx.vShieldedSpend) {
+        if (IsSaplingNullifierFromMe(spendDesc.nullifier)) {
+            auto it = mapSaplingNullifiersToNotes.find(spendDesc.nullifier);
+            if (it != mapSaplingNullifiersToNotes.end() && fParentInWallet(it->second.hash))
+                return false;
+        }
+    }
 
-      if (pindex && fTxDeleteEnabled) {
+    //Check for unspent inputs or spend less than N Blocks ago. (Sprout)
+    for (auto & pair : wtx.mapSproutNoteData) {
+        const SproutNoteData& nd = pair.second;
+        if (!nd.nullifier || GetSproutSpendDepth(*nd.nullifier) <= nMinSpendDepth)
+            return false;
+    }
 
-        //Check for acentries - exit function if found
-        {
-            std::list<CAccountingEntry> acentries;
-            CWalletDB walletdb(strWalletFile);
-            walletdb.ListAccountCreditDebit("*", acentries);
-            if (acentries.size() > 0) {
-                LogPrintf("deletetx not compatible to account entries\n");
-                return;
+    //Check for outputs that no longer have parents in the wallet. Exclude parents that are in the same transaction. (Sprout)
+    for (const JSDescription& jsdesc : wtx.vjoinsplit) {
+        for (const uint256 &nullifier : jsdesc.nullifiers) {
+            if (IsSproutNullifierFromMe(nullifier)) {
+                auto it = mapSproutNullifiersToNotes.find(nullifier);
+                if (it != mapSproutNullifiersToNotes.end() && fParentInWallet(it->second.hash))
+                    return false;
             }
         }
-        //delete transactions
+    }
 
-        //Sort Transactions by block and block index
-        int64_t maxOrderPos = 0;
-        std::map<std::pair<int,int>, CWalletTx> mapSorted;
-        ReorderWalletTransactions(mapSorted, maxOrderPos);
-        if (maxOrderPos > int64_t(mapSorted.size())*10) {
-          //reset the postion when the max postion is 10x bigger than the
-          //number of transactions in the wallet
-          UpdateWalletTransactionOrder(mapSorted, true);
-        }
-        else {
-          UpdateWalletTransactionOrder(mapSorted, false);
-        }
-        auto reorderTime = GetTime();
-        LogPrint("deletetx","Delete Tx - Time to Reorder %s\n", DateTimeStrFormat("%H:%M:%S", reorderTime-startTime));
+    //Check for unspent inputs or spend less than N Blocks ago. (Transparent)
+    for (unsigned int i = 0; i < wtx.vout.size(); i++) {
+        if (IsMine(wtx.vout[i]) && GetSpendDepth(wtxid, i) <= nMinSpendDepth)
+            return false;
+    }
 
-        //Process Transactions in sorted order
-        int txConflictCount = 0;
-        int txUnConfirmed = 0;
-        int txCount = 0;
-        int txSaveCount = 0;
-        std::vector<uint256> removeTxs;
-        std::vector<uint256> removeArcTxs;
+    //Check for output with that no longer have parents in the wallet. (Transparent)
+    for (const CTxIn& txin : wtx.vin) {
+        if (fParentInWallet(txin.prevout.hash))
+            return false;
+    }
 
-        for (auto & item : mapSorted)
-        {
+    return true;
+}
 
-          CWalletTx& wtx = item.second;
-          const uint256& wtxid = wtx.GetHash();
-          bool deleteTx = true;
-          txCount += 1;
-          int wtxDepth = wtx.GetDepthInMainChain();
+/**
+ * Pages fully spent history out of mapWallet, oldest first, until the
+ * resident transactions fit in -walletmemorybudget. Only transactions whose
+ * outputs were all spent deeper than the witness cache (so no reorg can
+ * unspend them) and whose parents leave too are paged out, the balance and
+ * spent state of the resident transactions do not change.
+ */
+void CWallet::PageOutSpentHistory()
+{
+    LOCK2(cs_main, cs_wallet);
+    if (nWalletMemoryBudget == 0 || !fFileBacked)
+        return;
 
-          //Keep anything newer than N Blocks
-          if (wtxDepth == 0)
-            txUnConfirmed++;
+    uint64_t nBudget = (uint64_t)nWalletMemoryBudget << 20;
+    uint64_t nResident = 0;
+    std::vector<std::pair<std::pair<int, int>, uint256>> vSorted;
+    for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
+        const CWalletTx& wtx = wtxItem.second;
+        nResident += ::GetSerializeSize(wtx, SER_DISK, CLIENT_VERSION);
+        if (wtx.GetDepthInMainChain() > (int)WITNESS_CACHE_SIZE) {
+            int nHeight = mapBlockIndex[wtx.hashBlock]->GetHeight();
+            vSorted.push_back(std::make_pair(std::make_pair(nHeight, wtx.nIndex), wtxItem.first));
+        }
+    }
+    if (nResident <= nBudget)
+        return;
 
-          if (wtxDepth < nDeleteAfter && wtxDepth >= 0) {
-            deleteTx = false;
-            txSaveCount++;
+    // Parents sort before their children, so a single pass sees them leave first
+    std::sort(vSorted.begin(), vSorted.end());
+    std::set<uint256> setPaged;
+    uint64_t nPaged = 0;
+    for (const std::pair<std::pair<int, int>, uint256>& item : vSorted) {
+        if (nResident - nPaged <= nBudget)
+            break;
+        const CWalletTx& wtx = mapWallet[item.second];
+        if (!IsSpentHistory(wtx, WITNESS_CACHE_SIZE, &setPaged))
             continue;
-          } else if (wtxDepth == -1) {
-            //Enabled by default
-            if (!fTxConflictDeleteEnabled) {
-              deleteTx = false;
-              txSaveCount++;
-              continue;
-            } else {
-              removeArcTxs.push_back(wtxid);
-              txConflictCount++;
-            }
-          } else {
+        setPaged.insert(item.second);
+        nPaged += ::GetSerializeSize(wtx, SER_DISK, CLIENT_VERSION);
+    }
 
-            //Check for unspent inputs or spend less than N Blocks ago. (Sapling)
-            for (auto & pair : wtx.mapSaplingNoteData) {
-              SaplingNoteData nd = pair.second;
-              if (!nd.nullifier || pwalletMain->GetSaplingSpendDepth(*nd.nullifier) <= fDeleteTransactionsAfterNBlocks) {
-                deleteTx = false;
-                continue;
-              }
-            }
+    // Debits need the parents, take them before anything leaves
+    for (const uint256& hash : setPaged) {
+        const CWalletTx& wtx = mapWallet[hash];
+        mapPagedTxDebits[hash] = std::make_pair(wtx.GetDebit(ISMINE_SPENDABLE), wtx.GetDebit(ISMINE_WATCH_ONLY));
+    }
+    for (const uint256& hash : setPaged) {
+        EraseFromSaplingNoteIndex(hash);
+        EraseFromTransparentCoinIndex(hash);
+        EraseFromRebroadcastQueue(hash);
+        mapWallet.erase(hash);
+    }
+    nTxGeneration++;
 
-            if (!deleteTx) {
-              txSaveCount++;
-              continue;
-            }
+    LogPrintf("Paged out %u spent wallet transactions (%u of %u KiB resident)\n",
+        setPaged.size(), (nResident - nPaged) >> 10, nResident >> 10);
+}
 
-            //Check for outputs that no longer have parents in the wallet. Exclude parents that are in the same transaction. (Sapling)
-            for (int i = 0; i < wtx.vShieldedSpend.size(); i++) {
-              const SpendDescription& spendDesc = wtx.vShieldedSpend[i];
-              if (pwalletMain->IsSaplingNullifierFromMe(spendDesc.nullifier)) {
-                const uint256& parentHash = pwalletMain->mapSaplingNullifiersToNotes[spendDesc.nullifier].hash;
-                const CWalletTx* parent = pwalletMain->GetWalletTx(parentHash);
-                if (parent != NULL && parentHash != wtxid) {
-                  deleteTx = false;
-                  continue;
-                }
-              }
-            }
+/**
+ * Reads a transaction paged out by PageOutSpentHistory back from wallet.dat.
+ */
+std::vector<CWalletMemoryUsage> CWallet::GetMemoryUsage() const
+{
+    LOCK(cs_wallet);
+    std::vector<CWalletMemoryUsage> vUsage;
+
+    size_t nTxBytes = memusage::DynamicUsage(mapWallet);
+    uint64_t nTxDisk = 0;
+    size_t nSproutNotes = 0, nSproutNoteBytes = 0, nSproutWitnesses = 0, nSproutWitnessBytes = 0;
+    size_t nSaplingNotes = 0, nSaplingNoteBytes = 0, nSaplingWitnesses = 0, nSaplingWitnessBytes = 0;
+    uint64_t nSproutWitnessDisk = 0, nSaplingWitnessDisk = 0;
+    for (const std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
+        const CWalletTx& wtx = wtxItem.second;
+        nTxDisk += ::GetSerializeSize(wtx, SER_DISK, CLIENT_VERSION);
+        nTxBytes += RecursiveDynamicUsage(wtx) +
+                    memusage::DynamicUsage(wtx.vjoinsplit) +
+                    memusage::DynamicUsage(wtx.vShieldedSpend) +
+                    memusage::DynamicUsage(wtx.vShieldedOutput) +
+                    memusage::DynamicUsage(wtx.vMerkleBranch) +
+                    memusage::DynamicUsage(wtx.mapValue) +
+                    memusage::DynamicUsage(wtx.vOrderForm) +
+                    memusage::DynamicUsage(wtx.strFromAccount);
+        for (const std::pair<const std::string, std::string>& value : wtx.mapValue)
+            nTxBytes += memusage::DynamicUsage(value.first) + memusage::DynamicUsage(value.second);
+        for (const std::pair<std::string, std::string>& order : wtx.vOrderForm)
+            nTxBytes += memusage::DynamicUsage(order.first) + memusage::DynamicUsage(order.second);
+
+        nSproutNotes += wtx.mapSproutNoteData.size();
+        nSproutNoteBytes += memusage::DynamicUsage(wtx.mapSproutNoteData);
+        for (const std::pair<const JSOutPoint, SproutNoteData>& nd : wtx.mapSproutNoteData) {
+            nSproutWitnesses += nd.second.witnesses.size();
+            nSproutWitnessBytes += nd.second.witnesses.DynamicMemoryUsage();
+            nSproutWitnessDisk += ::GetSerializeSize(nd.second.witnesses.to_list(), SER_DISK, CLIENT_VERSION);
+        }
+        nSaplingNotes += wtx.mapSaplingNoteData.size();
+        nSaplingNoteBytes += memusage::DynamicUsage(wtx.mapSaplingNoteData);
+        for (const std::pair<const SaplingOutPoint, SaplingNoteData>& nd : wtx.mapSaplingNoteData) {
+            nSaplingWitnesses += nd.second.witnesses.size();
+            nSaplingWitnessBytes += nd.second.witnesses.DynamicMemoryUsage();
+            nSaplingWitnessDisk += ::GetSerializeSize(nd.second.witnesses, SER_DISK, CLIENT_VERSION);
+        }
+    }
+    vUsage.push_back(CWalletMemoryUsage("transactions", mapWallet.size(), nTxBytes, nTxDisk));
+    vUsage.push_back(CWalletMemoryUsage("sprout_notes", nSproutNotes, nSproutNoteBytes));
+    vUsage.push_back(CWalletMemoryUsage("sprout_witnesses", nSproutWitnesses, nSproutWitnessBytes, nSproutWitnessDisk));
+    vUsage.push_back(CWalletMemoryUsage("sapling_notes", nSaplingNotes, nSaplingNoteBytes));
+    vUsage.push_back(CWalletMemoryUsage("sapling_witnesses", nSaplingWitnesses, nSaplingWitnessBytes, nSaplingWitnessDisk));
+
+    size_t nArcBytes = memusage::DynamicUsage(mapArcTxs) + memusage::DynamicUsage(mapArcJSOutPoints) + memusage::DynamicUsage(mapArcSaplingOutPoints);
+    uint64_t nArcDisk = 0;
+    for (const std::pair<const uint256, ArchiveTxPoint>& arcTx : mapArcTxs) {
+        nArcBytes += memusage::DynamicUsage(arcTx.second.ivks) + memusage::DynamicUsage(arcTx.second.ovks);
+        nArcDisk += ::GetSerializeSize(arcTx.second, SER_DISK, CLIENT_VERSION);
+    }
+    vUsage.push_back(CWalletMemoryUsage("archive", mapArcTxs.size() + mapArcJSOutPoints.size() + mapArcSaplingOutPoints.size(), nArcBytes, nArcDisk));
+
+    vUsage.push_back(CWalletMemoryUsage("nullifiers", mapSproutNullifiersToNotes.size() + mapSaplingNullifiersToNotes.size(),
+        memusage::DynamicUsage(mapSproutNullifiersToNotes) + memusage::DynamicUsage(mapSaplingNullifiersToNotes)));
+    vUsage.push_back(CWalletMemoryUsage("spends", mapTxSpends.size() + mapTxSproutNullifiers.size() + mapTxSaplingNullifiers.size(),
+        memusage::DynamicUsage(mapTxSpends) + memusage::DynamicUsage(mapTxSproutNullifiers) + memusage::DynamicUsage(mapTxSaplingNullifiers)));
+
+    size_t nNoteIndexEntries = 0;
+    size_t nNoteIndexBytes = memusage::DynamicUsage(mapSaplingNoteIndex) + memusage::DynamicUsage(mapSaplingNoteIndexTxAddresses) + memusage::DynamicUsage(mapSaplingNotesByValue);
+    for (const auto& index : mapSaplingNoteIndex) {
+        nNoteIndexEntries += index.second.size();
+        nNoteIndexBytes += memusage::DynamicUsage(index.second);
+    }
+    for (const auto& txAddresses : mapSaplingNoteIndexTxAddresses)
+        nNoteIndexBytes += memusage::DynamicUsage(txAddresses.second);
+    for (const auto& byValue : mapSaplingNotesByValue)
+        nNoteIndexBytes += memusage::DynamicUsage(byValue.second);
+    vUsage.push_back(CWalletMemoryUsage("sapling_note_index", nNoteIndexEntries, nNoteIndexBytes));
+    vUsage.push_back(CWalletMemoryUsage("transparent_coin_index", setTransparentCoinTxs.size(), memusage::DynamicUsage(setTransparentCoinTxs)));
+    vUsage.push_back(CWalletMemoryUsage("rebroadcast_queue", setRebroadcastQueue.size(), memusage::DynamicUsage(setRebroadcastQueue)));
+
+    size_t nAddressTxids = 0;
+    size_t nAddressTxidBytes = memusage::DynamicUsage(mapAddressTxids);
+    for (const std::pair<const std::string, std::set<uint256>>& address : mapAddressTxids) {
+        nAddressTxids += address.second.size();
+        nAddressTxidBytes += memusage::DynamicUsage(address.first) + memusage::DynamicUsage(address.second);
+    }
+    vUsage.push_back(CWalletMemoryUsage("address_txids", nAddressTxids, nAddressTxidBytes));
+
+    vUsage.push_back(CWalletMemoryUsage("paged_transactions", mapPagedTxDebits.size(), memusage::DynamicUsage(mapPagedTxDebits)));
+    vUsage.push_back(CWalletMemoryUsage("delete_queue", mapTxDeleteQueue.size(),
+        memusage::DynamicUsage(setTxDeleteQueue) + memusage::DynamicUsage(mapTxDeleteQueue)));
+
+    // Key records are small and fixed size, the map nodes are what they cost
+    size_t nKeys;
+    size_t nKeyBytes = CryptedKeysDynamicUsage(nKeys);
+    {
+        LOCK2(cs_KeyStore, cs_SpendingKeyStore);
+        nKeys += mapKeys.size() + mapScripts.size() + setWatchOnly.size() + mapSproutSpendingKeys.size() +
+                 mapSproutViewingKeys.size() + mapSaplingSpendingKeys.size() + mapSaplingFullViewingKeys.size() +
+                 mapSaplingIncomingViewingKeys.size() + mapSaplingPaymentAddresses.size();
+        nKeyBytes += memusage::DynamicUsage(mapKeys) + memusage::DynamicUsage(mapScripts) +
+                     memusage::DynamicUsage(setWatchOnly) + memusage::DynamicUsage(setSaplingWatchOnly) +
+                     memusage::DynamicUsage(mapSproutSpendingKeys) + memusage::DynamicUsage(mapSproutViewingKeys) +
+                     memusage::DynamicUsage(mapNoteDecryptors) + memusage::DynamicUsage(mapSaplingSpendingKeys) +
+                     memusage::DynamicUsage(mapSaplingFullViewingKeys) + memusage::DynamicUsage(mapSaplingIncomingViewingKeys) +
+                     memusage::DynamicUsage(setSaplingIncomingViewingKeys) + memusage::DynamicUsage(setSaplingOutgoingViewingKeys) +
+                     memusage::DynamicUsage(mapSaplingPaymentAddresses) + memusage::DynamicUsage(mapLastDiversifierPath);
+        for (const ScriptMap::value_type& script : mapScripts)
+            nKeyBytes += RecursiveDynamicUsage(script.second);
+    }
+    vUsage.push_back(CWalletMemoryUsage("keys", nKeys, nKeyBytes));
+    vUsage.push_back(CWalletMemoryUsage("key_metadata", mapKeyMetadata.size() + mapSproutZKeyMetadata.size() + mapSaplingZKeyMetadata.size(),
+        memusage::DynamicUsage(mapKeyMetadata) + memusage::DynamicUsage(mapSproutZKeyMetadata) + memusage::DynamicUsage(mapSaplingZKeyMetadata)));
+
+    size_t nAddressBookBytes = memusage::DynamicUsage(mapAddressBook) + memusage::DynamicUsage(mapZAddressBook);
+    for (const std::pair<const CTxDestination, CAddressBookData>& entry : mapAddressBook)
+        nAddressBookBytes += memusage::DynamicUsage(entry.second.name) + memusage::DynamicUsage(entry.second.purpose) + memusage::DynamicUsage(entry.second.destdata);
+    for (const std::pair<const libzcash::PaymentAddress, CAddressBookData>& entry : mapZAddressBook)
+        nAddressBookBytes += memusage::DynamicUsage(entry.second.name) + memusage::DynamicUsage(entry.second.purpose) + memusage::DynamicUsage(entry.second.destdata);
+    vUsage.push_back(CWalletMemoryUsage("address_book", mapAddressBook.size() + mapZAddressBook.size(), nAddressBookBytes));
+    vUsage.push_back(CWalletMemoryUsage("keypool", setKeyPool.size(), memusage::DynamicUsage(setKeyPool)));
+    vUsage.push_back(CWalletMemoryUsage("locked_outputs", setLockedCoins.size() + setLockedSproutNotes.size() + setLockedSaplingNotes.size(),
+        memusage::DynamicUsage(setLockedCoins) + memusage::DynamicUsage(setLockedSproutNotes) + memusage::DynamicUsage(setLockedSaplingNotes)));
+    return vUsage;
+}
+
+bool CWallet::GetPagedWalletTx(const uint256& hash, CWalletTx& wtxRet) const
+{
+    AssertLockHeld(cs_wallet);
+    std::map<uint256, std::pair<CAmount, CAmount>>::const_iterator it = mapPagedTxDebits.find(hash);
+    if (it == mapPagedTxDebits.end())
+        return false;
 
-            if (!deleteTx) {
-              txSaveCount++;
-              continue;
-            }
+    if (!CWalletDB(strWalletFile).ReadTx(hash, wtxRet))
+        return false;
+    wtxRet.BindWallet(const_cast<CWallet*>(this));
+    wtxRet.nDebitCached = it->second.first;
+    wtxRet.fDebitCached = true;
+    wtxRet.nWatchDebitCached = it->second.second;
+    wtxRet.fWatchDebitCached = true;
+    return true;
+}
 
-            //Check for unspent inputs or spend less than N Blocks ago. (Sprout)
-            for (auto & pair : wtx.mapSproutNoteData) {
-              SproutNoteData nd = pair.second;
-              if (!nd.nullifier || pwalletMain->GetSproutSpendDepth(*nd.nullifier) <= fDeleteTransactionsAfterNBlocks) {
-                deleteTx = false;
-                continue;
-              }
-            }
+/**
+ * Queues a transaction for -deletetx at nHeight, or keeps it at its queued
+ * height if that is later.
+ */
+void CWallet::QueueTxForDelete(const uint256& hash, int nHeight)
+{
+    AssertLockHeld(cs_wallet);
+    std::map<uint256, int>::iterator it = mapTxDeleteQueue.find(hash);
+    if (it != mapTxDeleteQueue.end()) {
+        if (it->second >= nHeight)
+            return;
+        setTxDeleteQueue.erase(std::make_pair(it->second, hash));
+        it->second = nHeight;
+    } else {
+        mapTxDeleteQueue[hash] = nHeight;
+    }
+    setTxDeleteQueue.insert(std::make_pair(nHeight, hash));
+}
 
-            if (!deleteTx) {
-              txSaveCount++;
-              continue;
-            }
+/**
+ * Queues a new or updated transaction once it is -keeptxfornblocks deep, and
+ * the wallet transactions it spends from once their spend is that deep.
+ */
+void CWallet::QueueTxForDelete(const CWalletTx& wtx)
+{
+    AssertLockHeld(cs_wallet);
+    if (!fTxDeleteEnabled)
+        return;
 
-            //Check for outputs that no longer have parents in the wallet. Exclude parents that are in the same transaction. (Sprout)
-            for (int i = 0; i < wtx.vjoinsplit.size(); i++) {
-              const JSDescription& jsdesc = wtx.vjoinsplit[i];
-              for (const uint256 &nullifier : jsdesc.nullifiers) {
-                // JSOutPoint op = pwalletMain->mapSproutNullifiersToNotes[nullifier];
-                if (pwalletMain->IsSproutNullifierFromMe(nullifier)) {
-                  const uint256& parentHash = pwalletMain->mapSproutNullifiersToNotes[nullifier].hash;
-                  const CWalletTx* parent = pwalletMain->GetWalletTx(parentHash);
-                  if (parent != NULL && parentHash != wtxid) {
-                    deleteTx = false;
-                    continue;
-                  }
-                }
-              }
-            }
+    int nHeight = chainActive.Height();
+    BlockMap::const_iterator mi = mapBlockIndex.find(wtx.hashBlock);
+    if (mi != mapBlockIndex.end() && chainActive.Contains(mi->second))
+        nHeight = mi->second->GetHeight();
+    nHeight += fDeleteTransactionsAfterNBlocks;
 
-            if (!deleteTx) {
-              txSaveCount++;
-              continue;
-            }
+    const uint256& wtxid = wtx.GetHash();
+    QueueTxForDelete(wtxid, nHeight);
+    for (const CTxIn& txin : wtx.vin) {
+        if (txin.prevout.hash != wtxid && mapWallet.count(txin.prevout.hash))
+            QueueTxForDelete(txin.prevout.hash, nHeight);
+    }
+    for (const SpendDescription& spendDesc : wtx.vShieldedSpend) {
+        std::map<uint256, SaplingOutPoint>::const_iterator it = mapSaplingNullifiersToNotes.find(spendDesc.nullifier);
+        if (it != mapSaplingNullifiersToNotes.end() && it->second.hash != wtxid && mapWallet.count(it->second.hash))
+            QueueTxForDelete(it->second.hash, nHeight);
+    }
+    for (const JSDescription& jsdesc : wtx.vjoinsplit) {
+        for (const uint256& nullifier : jsdesc.nullifiers) {
+            std::map<uint256, JSOutPoint>::const_iterator it = mapSproutNullifiersToNotes.find(nullifier);
+            if (it != mapSproutNullifiersToNotes.end() && it->second.hash != wtxid && mapWallet.count(it->second.hash))
+                QueueTxForDelete(it->second.hash, nHeight);
+        }
+    }
+}
 
-            //Check for unspent inputs or spend less than N Blocks ago. (Transparent)
-            for (unsigned int i = 0; i < wtx.vout.size(); i++) {
-              CTxDestination address;
-              ExtractDestination(wtx.vout[i].scriptPubKey, address);
-              if(IsMine(wtx.vout[i])) {
-                if (pwalletMain->GetSpendDepth(wtx.GetHash(), i) <= fDeleteTransactionsAfterNBlocks) {
-                  deleteTx = false;
-                  continue;
-                }
-              }
-            }
+/**
+ * Fills the -deletetx queue from the loaded wallet, once. Afterwards
+ * AddToWallet keeps it up to date.
+ */
+void CWallet::LoadTxDeleteQueue()
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+    if (fTxDeleteQueueLoaded)
+        return;
+    fTxDeleteQueueLoaded = true;
 
-            if (!deleteTx) {
-              txSaveCount++;
-              continue;
-            }
+    std::list<CAccountingEntry> acentries;
+    CWalletDB(strWalletFile).ListAccountCreditDebit("*", acentries);
+    if (acentries.size() > 0)
+        fAccountingEntries = true;
 
-            //Chcek for output with that no longer have parents in the wallet. (Transparent)
-            for (int i = 0; i < wtx.vin.size(); i++) {
-              const CTxIn& txin = wtx.vin[i];
-              const uint256& parentHash = txin.prevout.hash;
-              const CWalletTx* parent = pwalletMain->GetWalletTx(txin.prevout.hash);
-              if (parent != NULL && parentHash != wtxid) {
-                deleteTx = false;
-                continue;
-              }
-            }
+    for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
+        QueueTxForDelete(wtxItem.second);
+    }
+    LogPrint("deletetx","Delete Tx - Queued %u transactions\n", setTxDeleteQueue.size());
+}
+
+/**
+ * Deletes the queued transactions that became spent history (see
+ * IsSpentHistory) by pindex, checking at most nMaxTxs of them so the cost
+ * per block stays bounded. The wallet file is compacted every
+ * -deleteinterval blocks when something was deleted.
+ */
+void CWallet::DeleteWalletTransactions(const CBlockIndex* pindex, unsigned int nMaxTxs) {
+
+      LOCK2(cs_main, cs_wallet);
+
+      if (!pindex || !fTxDeleteEnabled)
+          return;
+
+      LoadTxDeleteQueue();
+      //deletetx is not compatible to account entries
+      if (fAccountingEntries)
+          return;
 
-            if (!deleteTx) {
-              txSaveCount++;
+      int nTipHeight = pindex->GetHeight();
+      int nDeleteAfter = (int)fDeleteTransactionsAfterNBlocks;
+      std::vector<uint256> removeTxs;
+      std::vector<uint256> removeArcTxs;
+      std::set<uint256> setGone;
+      unsigned int nChecked = 0;
+
+      while (!setTxDeleteQueue.empty() && nChecked < nMaxTxs) {
+          std::set<std::pair<int, uint256>>::iterator it = setTxDeleteQueue.begin();
+          if (it->first > nTipHeight)
+              break;
+
+          //Keep Last N Transactions
+          if (mapWallet.size() - removeTxs.size() <= fKeepLastNTransactions)
+              break;
+
+          uint256 wtxid = it->second;
+          setTxDeleteQueue.erase(it);
+          mapTxDeleteQueue.erase(wtxid);
+          nChecked++;
+
+          const CWalletTx* wtx = GetWalletTx(wtxid);
+          if (wtx == NULL)
               continue;
-            }
 
-            //Keep Last N Transactions
-            if (mapSorted.size() - txCount < fKeepLastNTransactions + txConflictCount + txUnConfirmed) {
-              deleteTx = false;
-              txSaveCount++;
+          int wtxDepth = wtx->GetDepthInMainChain();
+          if (wtxDepth == -1) {
+              //Conflicted transactions stay out of the queue unless deleting them is enabled
+              if (fTxConflictDeleteEnabled) {
+                  removeArcTxs.push_back(wtxid);
+                  removeTxs.push_back(wtxid);
+                  setGone.insert(wtxid);
+              }
               continue;
-            }
           }
 
-          //Collect everything else for deletion
-          if (deleteTx && int(removeTxs.size()) < MAX_DELETE_TX_SIZE) {
-            removeTxs.push_back(wtxid);
-            runCompact = true;
-          } else {
-            break; //no need to continue with the loop
+          //Keep anything newer than N Blocks, unconfirmed transactions are checked again N blocks from now
+          if (wtxDepth < nDeleteAfter) {
+              QueueTxForDelete(wtxid, nTipHeight + nDeleteAfter - wtxDepth);
+              continue;
           }
-        }
-
-        auto selectTime = GetTime();
-        LogPrint("deletetx","Delete Tx - Time to Select %s\n", DateTimeStrFormat("%H:%M:%S", selectTime - reorderTime));
 
-        //Delete Transactions from wallet
-        DeleteTransactions(removeTxs, removeArcTxs);
-
-        auto deleteTime = GetTime();
-        LogPrint("deletetx","Delete Tx - Time to Delete %s\n", DateTimeStrFormat("%H:%M:%S", deleteTime - selectTime));
-        LogPrintf("Delete Tx - Total Transaction Count %i, Transactions Deleted %i\n ", txCount, int(removeTxs.size()));
+          //Transactions with unspent outputs or parents in the wallet leave the queue until that changes
+          if (!IsSpentHistory(*wtx, fDeleteTransactionsAfterNBlocks, &setGone))
+              continue;
 
-        if (runCompact) {
-          CWalletDB::Compact(bitdb,strWalletFile);
-        }
+          removeTxs.push_back(wtxid);
+          setGone.insert(wtxid);
+      }
 
-        auto totalTime = GetTime();
-        LogPrint("deletetx","Delete Tx - Time to Run Total Function %s\n", DateTimeStrFormat("%H:%M:%S", totalTime - startTime));
+      //Children of deleted transactions may be deleted now that their parents are gone
+      for (const uint256& wtxid : removeTxs) {
+          const CWalletTx& wtx = mapWallet[wtxid];
+          std::vector<uint256> vChildren;
+          for (unsigned int i = 0; i < wtx.vout.size(); i++) {
+              auto range = mapTxSpends.equal_range(COutPoint(wtxid, i));
+              for (TxSpends::const_iterator it = range.first; it != range.second; ++it)
+                  vChildren.push_back(it->second);
+          }
+          for (const std::pair<const SaplingOutPoint, SaplingNoteData>& nd : wtx.mapSaplingNoteData) {
+              if (!nd.second.nullifier)
+                  continue;
+              auto range = mapTxSaplingNullifiers.equal_range(*nd.second.nullifier);
+              for (TxNullifiers::const_iterator it = range.first; it != range.second; ++it)
+                  vChildren.push_back(it->second);
+          }
+          for (const std::pair<const JSOutPoint, SproutNoteData>& nd : wtx.mapSproutNoteData) {
+              if (!nd.second.nullifier)
+                  continue;
+              auto range = mapTxSproutNullifiers.equal_range(*nd.second.nullifier);
+              for (TxNullifiers::const_iterator it = range.first; it != range.second; ++it)
+                  vChildren.push_back(it->second);
+          }
+          for (const uint256& child : vChildren) {
+              if (!setGone.count(child) && mapWallet.count(child))
+                  QueueTxForDelete(child, nTipHeight + 1);
+          }
       }
 
+      //Delete Transactions from wallet
+      if (!removeTxs.empty()) {
+          DeleteTransactions(removeTxs, removeArcTxs);
+          nTxDeletedSinceCompact += removeTxs.size();
+          LogPrint("deletetx","Delete Tx - Checked %u, Transactions Deleted %i, Queued %u\n", nChecked, int(removeTxs.size()), setTxDeleteQueue.size());
+      }
 
+      if (nTxDeletedSinceCompact > 0 && nTipHeight % fDeleteInterval == 0) {
+          LogPrintf("Delete Tx - Transactions Deleted %u, compacting wallet\n", nTxDeletedSinceCompact);
+          CWalletDB::Compact(bitdb,strWalletFile);
+          nTxDeletedSinceCompact = 0;
+      }
 }
 
 
@@ -3971,6 +5084,7 @@ bool CWallet::initalizeArcTx() {
                 }
             }
         }
+        UpdateSaplingNoteIndexWithTx(it->second);
     }
 
     for (map<uint256, ArchiveTxPoint>::iterator it = mapArcTxs.begin(); it != mapArcTxs.end(); it++) {
@@ -3982,6 +5096,12 @@ bool CWallet::initalizeArcTx() {
 
 }
 
+static double GetRescanBlocksPerSecond(int nBlocks, int64_t nStartMillis)
+{
+    int64_t nElapsed = GetTimeMillis() - nStartMillis;
+    return nElapsed > 0 ? nBlocks * 1000.0 / nElapsed : 0.0;
+}
+
 /**
  * Scan the block chain (starting in pindexStart) for transactions
  * from or to us. If fUpdate is true, found transactions that already
@@ -4019,35 +5139,69 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate, b
         uiInterface.ShowProgress(_("Rescanning..."), 0, false); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
         double dProgressStart = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false);
         double dProgressTip = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), chainActive.LastTip(), false);
+
+        // The chain cannot move while we hold cs_main, so the blocks to scan
+        // are known up front and can be read and decrypted ahead of the cursor.
+        std::vector<const CBlockIndex*> vScanIndex;
+        for (CBlockIndex* pindexScan = pindex; pindexScan; pindexScan = chainActive.Next(pindexScan))
+            vScanIndex.push_back(pindexScan);
+        // Keeps as many blocks ahead as the default for each pair of readers
+        CWalletRescanPrefetcher prefetcher(this, vScanIndex, nRescanPrefetchThreads,
+                                           DEFAULT_RESCAN_PREFETCH_BLOCKS * std::max(1, nRescanPrefetchThreads / DEFAULT_RESCAN_PREFETCH_THREADS));
+        walletRescanProgress.Start(pindex ? pindex->GetHeight() : -1, chainActive.Height());
+
+        int64_t nScanStart = GetTimeMillis();
+        int nBlocksScanned = 0;
+        int nBlocksPruned = 0;
+        std::shared_ptr<CRescanBlock> prefetched;
+        bool fBatch = BeginWriteBatch();
         while (pindex)
         {
+            nWalletRescanHeight = pindex->GetHeight();
             if (pindex->GetHeight() % 100 == 0 && dProgressTip - dProgressStart > 0.0)
             {
                 scanperc = (int)((Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100);
-                uiInterface.ShowProgress(_(("Rescanning - Currently on block " + std::to_string(pindex->GetHeight()) + "...").c_str()), std::max(1, std::min(99, scanperc)), false);
-                uiInterface.InitMessage(_(("Rescanning - Currently on block " + std::to_string(pindex->GetHeight())).c_str()) + ((" " + std::to_string(scanperc)).c_str()) + ("%"));
+                std::string strRate = strprintf(" (%.1f blocks/s)", GetRescanBlocksPerSecond(nBlocksScanned, nScanStart));
+                uiInterface.ShowProgress(_(("Rescanning - Currently on block " + std::to_string(pindex->GetHeight()) + strRate + "...").c_str()), std::max(1, std::min(99, scanperc)), false);
+                uiInterface.InitMessage(_(("Rescanning - Currently on block " + std::to_string(pindex->GetHeight())).c_str()) + ((" " + std::to_string(scanperc)).c_str()) + ("%") + strRate);
             }
 
             bool blockInvolvesMe = false;
-            CBlock block;
-            ReadBlockFromDisk(block, pindex,1);
-            BOOST_FOREACH(CTransaction& tx, block.vtx)
+            if (!prefetcher.Next(prefetched) || prefetched->pindex != pindex) {
+                // Should not happen, but fall back to reading the block here
+                prefetched = std::make_shared<CRescanBlock>();
+                prefetched->pindex = pindex;
+                prefetched->fRead = ReadBlockFromDisk(prefetched->block, pindex, 1);
+            }
+            if (!prefetched->fRead && fHavePruned && !(pindex->nStatus & BLOCK_HAVE_DATA))
+                nBlocksPruned++;
+            bool fUseSaplingNotes = prefetched->fRead &&
+                prefetched->vSaplingNotes.size() == prefetched->block.vtx.size() &&
+                prefetched->nSaplingKeys == GetSaplingKeyCount();
+            CBlock& block = prefetched->block;
+            for (size_t i = 0; i < block.vtx.size(); i++)
             {
-                if (AddToWalletIfInvolvingMe(tx, &block, fUpdate, true)) {
+                const CTransaction& tx = block.vtx[i];
+                walletRescanProgress.nOutputs += tx.vShieldedOutput.size();
+                if (AddToWalletIfInvolvingMe(tx, &block, fUpdate, true, fUseSaplingNotes ? &prefetched->vSaplingNotes[i] : NULL)) {
                     blockInvolvesMe = true;
                     txList.insert(tx.GetHash());
                     ret++;
+                    std::map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(tx.GetHash());
+                    if (mi != mapWallet.end())
+                        walletRescanProgress.nNotes += mi->second.mapSproutNoteData.size() + mi->second.mapSaplingNoteData.size();
                 }
             }
+            nBlocksScanned++;
+            walletRescanProgress.nBlocks++;
 
             SproutMerkleTree sproutTree;
-            SaplingMerkleTree saplingTree;
             // This should never fail: we should always be able to get the tree
             // state on the path to the tip of our chain
             assert(pcoinsTip->GetSproutAnchorAt(pindex->hashSproutAnchor, sproutTree));
             if (pindex->pprev) {
                 if (NetworkUpgradeActive(pindex->pprev->GetHeight(), Params().GetConsensus(), Consensus::UPGRADE_SAPLING)) {
-                    assert(pcoinsTip->GetSaplingAnchorAt(pindex->pprev->hashFinalSaplingRoot, saplingTree));
+                    assert(pcoinsTip->GetSharedSaplingAnchorAt(pindex->pprev->hashFinalSaplingRoot));
                 }
             }
 
@@ -4055,22 +5209,39 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate, b
             if (blockInvolvesMe)
                 BuildWitnessCache(pindex, true);
 
-            //Delete Transactions
-            if (pindex->GetHeight() % fDeleteInterval == 0)
-                DeleteWalletTransactions(pindex);
+            //Delete Transactions, outside of the write batch as it may compact the wallet file
+            if (pindex->GetHeight() % fDeleteInterval == 0) {
+                if (fBatch)
+                    CommitWriteBatch();
+                DeleteWalletTransactions(pindex, MAX_DELETE_TX_SIZE);
+                fBatch = BeginWriteBatch();
+            } else if (fBatch && nBlocksScanned % WALLET_RESCAN_BATCH_BLOCKS == 0) {
+                CommitWriteBatch();
+                fBatch = BeginWriteBatch();
+            }
 
             if (GetTime() >= nNow + 60) {
                 nNow = GetTime();
-                LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->GetHeight(), Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex));
+                LogPrintf("Still rescanning. At block %d. Progress=%f, %.1f blocks/s\n", pindex->GetHeight(), Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex), GetRescanBlocksPerSecond(nBlocksScanned, nScanStart));
             }
             pindex = chainActive.Next(pindex);
         }
+        prefetcher.Stop();
+        nWalletRescanHeight = -1;
 
+        LogPrintf("Rescanned %d blocks in %.1fs (%.1f blocks/s)\n", nBlocksScanned, (GetTimeMillis() - nScanStart) / 1000.0, GetRescanBlocksPerSecond(nBlocksScanned, nScanStart));
+        if (nBlocksPruned > 0)
+            LogPrintf("Rescan skipped %d pruned blocks, transactions in them are not found\n", nBlocksPruned);
         uiInterface.ShowProgress(_("Rescanning..."), 100, false); // hide progress dialog in GUI
 
         //Update all witness caches
         BuildWitnessCache(chainActive.Tip(), false);
 
+        // Last batch records the scan as complete along with its writes
+        if (fBatch) {
+            CBlockLocator loc = chainActive.GetLocator();
+            CommitWriteBatch(&loc);
+        }
     }
 
     for (set<uint256>::iterator it = txList.begin(); it != txList.end(); ++it)
@@ -4365,39 +5536,39 @@ bool CWalletTx::IsTrusted() const
 std::vector<uint256> CWallet::ResendWalletTransactionsBefore(int64_t nTime)
 {
     std::vector<uint256> result;
-
-    LOCK(cs_wallet);
-    // Sort them in chronological order
-    multimap<unsigned int, CWalletTx*> mapSorted;
-    uint32_t now = (uint32_t)time(NULL);
-    std::vector<uint256> vwtxh;
-    BOOST_FOREACH(PAIRTYPE(const uint256, CWalletTx)& item, mapWallet)
-    {
-        CWalletTx& wtx = item.second;
-        // Don't rebroadcast if newer than nTime:
-        if (wtx.nTimeReceived > nTime)
-            continue;
-
-        if ( (wtx.nLockTime >= LOCKTIME_THRESHOLD && wtx.nLockTime < now-KOMODO_MAXMEMPOOLTIME) )
-        {
-            //LogPrintf("skip Relaying wtx %s nLockTime %u vs now.%u\n", wtx.GetHash().ToString(),(uint32_t)wtx.nLockTime,now);
-            //vwtxh.push_back(wtx.GetHash());
-            continue;
-        }
-        mapSorted.insert(make_pair(wtx.nTimeReceived, &wtx));
-    }
-    BOOST_FOREACH(PAIRTYPE(const unsigned int, CWalletTx*)& item, mapSorted)
+    std::vector<CTransaction> vRelay;
     {
-        if ( item.second != 0 )
-        {
-            CWalletTx &wtx = *item.second;
-            if (wtx.RelayWalletTransaction())
-                result.push_back(wtx.GetHash());
+        LOCK2(cs_main, cs_wallet);
+        uint32_t now = (uint32_t)time(NULL);
+        int nNextHeight = chainActive.Height() + 1;
+        // In chronological order, up to the first one newer than nTime
+        std::set<std::pair<int64_t, uint256>>::iterator it = setRebroadcastQueue.begin();
+        while (it != setRebroadcastQueue.end() && it->first <= nTime) {
+            std::map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(it->second);
+            if (mi == mapWallet.end()) {
+                it = setRebroadcastQueue.erase(it);
+                continue;
+            }
+            const CWalletTx& wtx = mi->second;
+            int nDepth = wtx.GetDepthInMainChain();
+            // Done with unless it comes back without a block
+            if (nDepth > 0 || IsExpiredTx(wtx, nNextHeight) ||
+                (wtx.nLockTime >= LOCKTIME_THRESHOLD && wtx.nLockTime < now-KOMODO_MAXMEMPOOLTIME)) {
+                it = setRebroadcastQueue.erase(it);
+                continue;
+            }
+            // One out of the mempool as well (depth -1) stays queued, it can get back in
+            if (nDepth == 0)
+                vRelay.push_back(wtx);
+            ++it;
         }
     }
-    for (auto hash : vwtxh)
-    {
-        EraseFromWallets(hash);
+
+    // Relayed without cs_wallet
+    for (const CTransaction& tx : vRelay) {
+        LogPrintf("Relaying wtx %s\n", tx.GetHash().ToString());
+        RelayTransaction(tx);
+        result.push_back(tx.GetHash());
     }
     return result;
 }
@@ -4556,9 +5727,11 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        for (const uint256& wtxid : GetTransparentCoinTxs())
         {
-            const uint256& wtxid = it->first;
+            map<uint256, CWalletTx>::const_iterator it = mapWallet.find(wtxid);
+            if (it == mapWallet.end())
+                continue;
             const CWalletTx* pcoin = &(*it).second;
 
             if (!CheckFinalTx(*pcoin))
@@ -4749,6 +5922,65 @@ static void ApproximateBestSubset(vector<pair<CAmount, pair<const CWalletTx*,uns
     }
 }
 
+static const size_t BNB_TOTAL_TRIES = 100000;
+
+/**
+ * Depth first search for the subset of vValue, sorted by decreasing value,
+ * whose total is at least nTargetValue and at most nTargetValue + nCostOfChange,
+ * so the transaction needs no change output. A branch is cut as soon as it
+ * overshoots the window or can no longer reach the target. Of the subsets
+ * found within BNB_TOTAL_TRIES steps the one closest to the target wins.
+ */
+static bool SelectCoinsBnB(const vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > >& vValue, const CAmount& nTotalLower, const CAmount& nTargetValue, const CAmount& nCostOfChange, vector<char>& vfBest, CAmount& nBest)
+{
+    vfBest.clear();
+    if (nTotalLower < nTargetValue)
+        return false;
+
+    vector<char> vfIncluded(vValue.size(), false);
+    CAmount nSelected = 0;
+    // Total of the coins from i on, which are not decided yet
+    CAmount nRemaining = nTotalLower;
+    size_t i = 0;
+    for (size_t nTries = 0; nTries < BNB_TOTAL_TRIES; nTries++) {
+        bool fBacktrack = false;
+        if (nSelected + nRemaining < nTargetValue || nSelected > nTargetValue + nCostOfChange) {
+            fBacktrack = true;
+        } else if (nSelected >= nTargetValue) {
+            if (vfBest.empty() || nSelected < nBest) {
+                vfBest = vfIncluded;
+                nBest = nSelected;
+                if (nBest == nTargetValue)
+                    break;
+            }
+            fBacktrack = true;
+        }
+
+        if (fBacktrack) {
+            // Undo the coins left out since the last one taken, then leave that one out
+            while (i > 0 && !vfIncluded[i - 1]) {
+                i--;
+                nRemaining += vValue[i].first;
+            }
+            if (i == 0)
+                break;
+            i--;
+            vfIncluded[i] = false;
+            nSelected -= vValue[i].first;
+            i++;
+        } else {
+            nRemaining -= vValue[i].first;
+            // Taking a coin of the same value as the one just left out repeats a branch
+            if (i == 0 || vfIncluded[i - 1] || vValue[i].first != vValue[i - 1].first) {
+                vfIncluded[i] = true;
+                nSelected += vValue[i].first;
+            }
+            i++;
+        }
+    }
+    return !vfBest.empty();
+}
+
 bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, vector<COutput> vCoins,set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet) const
 {
     int32_t count = 0; //uint64_t lowest_interest = 0;
@@ -4833,11 +6065,26 @@ bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int
         return true;
     }
 
-    // Solve subset sum by stochastic approximation
     sort(vValue.rbegin(), vValue.rend(), CompareValueOnly());
     vector<char> vfBest;
     CAmount nBest;
 
+    // Inputs that leave less than a change output is worth go without change,
+    // CreateTransaction adds what is left to the fee
+    CAmount nCostOfChange = CTxOut(0, CScript() << OP_DUP << OP_HASH160 << ToByteVector(uint160()) << OP_EQUALVERIFY << OP_CHECKSIG).GetDustThreshold(::minRelayTxFee);
+    if (SelectCoinsBnB(vValue, nTotalLower, nTargetValue, nCostOfChange, vfBest, nBest))
+    {
+        for (unsigned int i = 0; i < vValue.size(); i++)
+            if (vfBest[i])
+            {
+                setCoinsRet.insert(vValue[i].second);
+                nValueRet += vValue[i].first;
+            }
+        LogPrint("selectcoins", "SelectCoins() branch and bound: total %s\n", FormatMoney(nBest));
+        return true;
+    }
+
+    // Solve subset sum by stochastic approximation
     ApproximateBestSubset(vValue, nTotalLower, nTargetValue, vfBest, nBest, 1000);
     if (nBest != nTargetValue && nTotalLower >= nTargetValue + CENT)
         ApproximateBestSubset(vValue, nTotalLower, nTargetValue + CENT, vfBest, nBest, 1000);
@@ -5297,27 +6544,35 @@ bool CWallet::CreateTransaction(const vector<CRecipient>& vecSend, CWalletTx& wt
                 auto consensusBranchId = CurrentEpochBranchId(chainActive.Height() + 1, Params().GetConsensus());
 
                 // Sign
-                int nIn = 0;
                 CTransaction txNewConst(txNew);
-                BOOST_FOREACH(const PAIRTYPE(const CWalletTx*,unsigned int)& coin, setCoins)
-                {
-                    bool signSuccess;
-                    const CScript& scriptPubKey = coin.first->vout[coin.second].scriptPubKey;
-                    SignatureData sigdata;
-                    if (sign)
-                        signSuccess = ProduceSignature(TransactionSignatureCreator(this, &txNewConst, nIn, coin.first->vout[coin.second].nValue, SIGHASH_ALL), scriptPubKey, sigdata, consensusBranchId);
-                    else
-                        signSuccess = ProduceSignature(DummySignatureCreator(this), scriptPubKey, sigdata, consensusBranchId);
-
-                    if (!signSuccess)
+                if (sign) {
+                    std::vector<std::pair<CScript, CAmount>> vCoins;
+                    BOOST_FOREACH(const PAIRTYPE(const CWalletTx*,unsigned int)& coin, setCoins)
+                        vCoins.push_back(std::make_pair(coin.first->vout[coin.second].scriptPubKey, coin.first->vout[coin.second].nValue));
+                    std::vector<SignatureData> vSigData;
+                    if (!ProduceSignatures(this, txNewConst, vCoins, SIGHASH_ALL, consensusBranchId, vSigData, GetNumCores()))
                     {
                         strFailReason = _("Signing transaction failed");
                         return false;
-                    } else {
-                        UpdateTransaction(txNew, nIn, sigdata);
                     }
+                    for (int nIn = 0; nIn < (int)vSigData.size(); nIn++)
+                        UpdateTransaction(txNew, nIn, vSigData[nIn]);
+                } else {
+                    int nIn = 0;
+                    BOOST_FOREACH(const PAIRTYPE(const CWalletTx*,unsigned int)& coin, setCoins)
+                    {
+                        const CScript& scriptPubKey = coin.first->vout[coin.second].scriptPubKey;
+                        SignatureData sigdata;
+                        if (!ProduceSignature(DummySignatureCreator(this), scriptPubKey, sigdata, consensusBranchId))
+                        {
+                            strFailReason = _("Signing transaction failed");
+                            return false;
+                        } else {
+                            UpdateTransaction(txNew, nIn, sigdata);
+                        }
 
-                    nIn++;
+                        nIn++;
+                    }
                 }
 
                 unsigned int nBytes = ::GetSerializeSize(txNew, SER_NETWORK, PROTOCOL_VERSION);
@@ -5534,6 +6789,8 @@ bool CWallet::SetAddressBook(const CTxDestination& address, const string& strNam
         mapAddressBook[address].name = strName;
         if (!strPurpose.empty()) /* update purpose only if requested */
             mapAddressBook[address].purpose = strPurpose;
+        // An address book entry isn't change
+        fAddressGroupingsDirty = true;
     }
     NotifyAddressBookChanged(this, address, strName, ::IsMine(*this, address) != ISMINE_NO,
                              strPurpose, (fUpdated ? CT_UPDATED : CT_NEW) );
@@ -5582,6 +6839,7 @@ bool CWallet::DelAddressBook(const CTxDestination& address)
             }
         }
         mapAddressBook.erase(address);
+        fAddressGroupingsDirty = true;
     }
 
     NotifyAddressBookChanged(this, address, "", ::IsMine(*this, address) != ISMINE_NO, "", CT_DELETED);
@@ -5774,9 +7032,12 @@ std::map<CTxDestination, CAmount> CWallet::GetAddressBalances()
 
     {
         LOCK(cs_wallet);
-        BOOST_FOREACH(PAIRTYPE(uint256, CWalletTx) walletEntry, mapWallet)
+        for (const uint256& wtxid : GetTransparentCoinTxs())
         {
-            CWalletTx *pcoin = &walletEntry.second;
+            map<uint256, CWalletTx>::const_iterator it = mapWallet.find(wtxid);
+            if (it == mapWallet.end())
+                continue;
+            const CWalletTx *pcoin = &it->second;
 
             if (!CheckFinalTx(*pcoin) || !pcoin->IsTrusted())
                 continue;
@@ -5796,10 +7057,7 @@ std::map<CTxDestination, CAmount> CWallet::GetAddressBalances()
                 if(!ExtractDestination(pcoin->vout[i].scriptPubKey, addr))
                     continue;
 
-                CAmount n = IsSpent(walletEntry.first, i) ? 0 : pcoin->vout[i].nValue;
-
-                if (!balances.count(addr))
-                    balances[addr] = 0;
+                CAmount n = IsSpent(wtxid, i) ? 0 : pcoin->vout[i].nValue;
                 balances[addr] += n;
             }
         }
@@ -5808,97 +7066,101 @@ std::map<CTxDestination, CAmount> CWallet::GetAddressBalances()
     return balances;
 }
 
-set< set<CTxDestination> > CWallet::GetAddressGroupings()
+CTxDestination CAddressGroupings::Find(const CTxDestination& address)
 {
-    AssertLockHeld(cs_wallet); // mapWallet
-    set< set<CTxDestination> > groupings;
-    set<CTxDestination> grouping;
+    std::map<CTxDestination, CTxDestination>::iterator it = mapParent.find(address);
+    if (it == mapParent.end()) {
+        mapParent.insert(std::make_pair(address, address));
+        return address;
+    }
+    if (it->second == address)
+        return address;
+    // Point the address at the root directly, so the next find is one step
+    CTxDestination root = Find(it->second);
+    it->second = root;
+    return root;
+}
 
-    BOOST_FOREACH(PAIRTYPE(uint256, CWalletTx) walletEntry, mapWallet)
-    {
-        CWalletTx *pcoin = &walletEntry.second;
+void CAddressGroupings::Merge(const CTxDestination& a, const CTxDestination& b)
+{
+    CTxDestination rootA = Find(a);
+    CTxDestination rootB = Find(b);
+    if (rootA != rootB)
+        mapParent[rootB] = rootA;
+}
 
-        if (pcoin->vin.size() > 0)
-        {
-            bool any_mine = false;
-            // group all input addresses with each other
-            BOOST_FOREACH(CTxIn txin, pcoin->vin)
-            {
-                CTxDestination address;
-                if(!IsMine(txin)) /* If this input isn't mine, ignore it */
-                    continue;
-                if(!ExtractDestination(mapWallet[txin.prevout.hash].vout[txin.prevout.n].scriptPubKey, address))
-                    continue;
-                grouping.insert(address);
-                any_mine = true;
-            }
+std::set<std::set<CTxDestination>> CAddressGroupings::Get()
+{
+    std::map<CTxDestination, std::set<CTxDestination>> mapGroups;
+    for (const std::pair<const CTxDestination, CTxDestination>& item : mapParent)
+        mapGroups[Find(item.first)].insert(item.first);
+    std::set<std::set<CTxDestination>> groupings;
+    for (const std::pair<const CTxDestination, std::set<CTxDestination>>& group : mapGroups)
+        groupings.insert(group.second);
+    return groupings;
+}
 
-            // group change with input addresses
-            if (any_mine)
-            {
-               BOOST_FOREACH(CTxOut txout, pcoin->vout)
-                   if (IsChange(txout))
-                   {
-                       CTxDestination txoutAddr;
-                       if(!ExtractDestination(txout.scriptPubKey, txoutAddr))
-                           continue;
-                       grouping.insert(txoutAddr);
-                   }
-            }
-            if (grouping.size() > 0)
-            {
-                groupings.insert(grouping);
-                grouping.clear();
-            }
-        }
+void CWallet::AddToAddressGroupings(const CWalletTx& wtx, bool fIncremental)
+{
+    LOCK(cs_wallet);
+    if (fIncremental && fAddressGroupingsDirty)
+        return;
+
+    // group all input addresses with each other
+    boost::optional<CTxDestination> first;
+    for (const CTxIn& txin : wtx.vin)
+    {
+        CTxDestination address;
+        if (!IsMine(txin)) /* If this input isn't mine, ignore it */
+            continue;
+        std::map<uint256, CWalletTx>::const_iterator it = mapWallet.find(txin.prevout.hash);
+        if (!ExtractDestination(it->second.vout[txin.prevout.n].scriptPubKey, address))
+            continue;
+        if (first)
+            addressGroupings.Merge(*first, address);
+        else
+            first = addressGroupings.Find(address);
+    }
 
-        // group lone addrs by themselves
-        for (unsigned int i = 0; i < pcoin->vout.size(); i++)
-            if (IsMine(pcoin->vout[i]))
+    // group change with input addresses
+    if (first)
+    {
+        for (const CTxOut& txout : wtx.vout)
+            if (IsChange(txout))
             {
-                CTxDestination address;
-                if(!ExtractDestination(pcoin->vout[i].scriptPubKey, address))
+                CTxDestination txoutAddr;
+                if (!ExtractDestination(txout.scriptPubKey, txoutAddr))
                     continue;
-                grouping.insert(address);
-                groupings.insert(grouping);
-                grouping.clear();
+                addressGroupings.Merge(*first, txoutAddr);
             }
     }
 
-    set< set<CTxDestination>* > uniqueGroupings; // a set of pointers to groups of addresses
-    map< CTxDestination, set<CTxDestination>* > setmap;  // map addresses to the unique group containing it
-    BOOST_FOREACH(set<CTxDestination> grouping, groupings)
-    {
-        // make a set of all the groups hit by this new group
-        set< set<CTxDestination>* > hits;
-        map< CTxDestination, set<CTxDestination>* >::iterator it;
-        BOOST_FOREACH(CTxDestination address, grouping)
-            if ((it = setmap.find(address)) != setmap.end())
-                hits.insert((*it).second);
-
-        // merge all hit groups into a new single group and delete old groups
-        set<CTxDestination>* merged = new set<CTxDestination>(grouping);
-        BOOST_FOREACH(set<CTxDestination>* hit, hits)
+    // group lone addrs by themselves
+    uint256 hash = wtx.GetHash();
+    for (unsigned int i = 0; i < wtx.vout.size(); i++)
+        if (IsMine(wtx.vout[i]))
         {
-            merged->insert(hit->begin(), hit->end());
-            uniqueGroupings.erase(hit);
-            delete hit;
+            CTxDestination address;
+            if (!ExtractDestination(wtx.vout[i].scriptPubKey, address))
+                continue;
+            addressGroupings.Find(address);
+            // A spend added before this tx didn't see its inputs as ours
+            if (fIncremental && mapTxSpends.count(COutPoint(hash, i)))
+                fAddressGroupingsDirty = true;
         }
-        uniqueGroupings.insert(merged);
-
-        // update setmap
-        BOOST_FOREACH(CTxDestination element, *merged)
-            setmap[element] = merged;
-    }
+}
 
-    set< set<CTxDestination> > ret;
-    BOOST_FOREACH(set<CTxDestination>* uniqueGrouping, uniqueGroupings)
+set< set<CTxDestination> > CWallet::GetAddressGroupings()
+{
+    AssertLockHeld(cs_wallet); // mapWallet
+    if (fAddressGroupingsDirty)
     {
-        ret.insert(*uniqueGrouping);
-        delete uniqueGrouping;
+        addressGroupings.Clear();
+        for (const std::pair<const uint256, CWalletTx>& item : mapWallet)
+            AddToAddressGroupings(item.second, false);
+        fAddressGroupingsDirty = false;
     }
-
-    return ret;
+    return addressGroupings.Get();
 }
 
 std::set<CTxDestination> CWallet::GetAccountAddresses(const std::string& strAccount) const
@@ -5975,6 +7237,7 @@ void CWallet::UpdatedTransaction(const uint256 &hashTx)
         // Only notify UI if this transaction is in this wallet
         map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(hashTx);
         if (mi != mapWallet.end()) {
+            nTxGeneration++;
             NotifyTransactionChanged(this, hashTx, CT_UPDATED);
             NotifyBalanceChanged();
         }
@@ -6056,18 +7319,21 @@ void CWallet::LockNote(const SaplingOutPoint& output)
 {
     AssertLockHeld(cs_wallet);
     setLockedSaplingNotes.insert(output);
+    fShieldedBalancesDirty = true;
 }
 
 void CWallet::UnlockNote(const SaplingOutPoint& output)
 {
     AssertLockHeld(cs_wallet);
     setLockedSaplingNotes.erase(output);
+    fShieldedBalancesDirty = true;
 }
 
 void CWallet::UnlockAllSaplingNotes()
 {
     AssertLockHeld(cs_wallet);
     setLockedSaplingNotes.clear();
+    fShieldedBalancesDirty = true;
 }
 
 bool CWallet::IsLockedNote(const SaplingOutPoint& output) const
@@ -6309,6 +7575,14 @@ int CMerkleTx::GetDepthInMainChain(const CBlockIndex* &pindexRet) const
     return nResult;
 }
 
+int CMerkleTx::GetHeightInMainChain() const
+{
+    const CBlockIndex *pindex = NULL;
+    if (GetDepthInMainChainINTERNAL(pindex) <= 0 || pindex == NULL)
+        return 0;
+    return pindex->GetHeight();
+}
+
 int CMerkleTx::GetBlocksToMaturity() const
 {
     if ( ASSETCHAINS_SYMBOL[0] == 0 )
@@ -6370,6 +7644,81 @@ void CWallet::getZAddressBalances(std::map<libzcash::PaymentAddress, CAmount> &b
     }
 }
 
+void CWallet::MarkShieldedBalancesDirty()
+{
+    LOCK(cs_wallet);
+    fShieldedBalancesDirty = true;
+}
+
+CShieldedBalances CWallet::GetShieldedBalances()
+{
+    LOCK2(cs_main, cs_wallet);
+
+    if (!fShieldedBalancesDirty)
+        return cachedShieldedBalances;
+
+    CShieldedBalances balances;
+    std::map<uint256, int> mapTxDepth;
+    for (const auto & addressNotes : mapSaplingNoteIndex) {
+        CShieldedAddressBalance addressBalance;
+        bool fHaveNotes = false;
+
+        for (const auto & note : addressNotes.second) {
+            const SaplingOutPoint & op = note.first;
+            // Held by z_mergetoaddress or a z_sendmany in flight, as GetFilteredNotes skips them
+            if (setLockedSaplingNotes.count(op))
+                continue;
+
+            // Every note of a transaction shares its depth, -1 marks a filtered transaction
+            auto itDepth = mapTxDepth.find(op.hash);
+            if (itDepth == mapTxDepth.end()) {
+                int nDepth = -1;
+                auto itTx = mapWallet.find(op.hash);
+                if (itTx != mapWallet.end() && CheckFinalTx(itTx->second) && itTx->second.GetBlocksToMaturity() <= 0)
+                    nDepth = itTx->second.GetDepthInMainChain();
+                itDepth = mapTxDepth.insert(std::make_pair(op.hash, nDepth)).first;
+            }
+            if (itDepth->second < 0)
+                continue;
+
+            const CWalletTx & wtx = mapWallet.at(op.hash);
+            auto itNote = wtx.mapSaplingNoteData.find(op);
+            if (itNote == wtx.mapSaplingNoteData.end())
+                continue;
+            const SaplingNoteData & nd = itNote->second;
+            if (nd.nullifier && IsSaplingSpent(*nd.nullifier))
+                continue;
+
+            if (!fHaveNotes) {
+                libzcash::SaplingExtendedFullViewingKey extfvk;
+                addressBalance.fSpendable = GetSaplingFullViewingKey(nd.ivk, extfvk) && HaveSaplingSpendingKey(extfvk);
+                fHaveNotes = true;
+            }
+
+            if (itDepth->second > 0)
+                addressBalance.confirmed += note.second.value;
+            else
+                addressBalance.unconfirmed += note.second.value;
+        }
+
+        if (!fHaveNotes)
+            continue;
+
+        if (addressBalance.fSpendable) {
+            balances.spendableConfirmed += addressBalance.confirmed;
+            balances.spendableUnconfirmed += addressBalance.unconfirmed;
+        } else {
+            balances.watchConfirmed += addressBalance.confirmed;
+            balances.watchUnconfirmed += addressBalance.unconfirmed;
+        }
+        balances.mapAddresses[addressNotes.first] = addressBalance;
+    }
+
+    cachedShieldedBalances = balances;
+    fShieldedBalancesDirty = false;
+    return balances;
+}
+
 /**
  * Find notes in the wallet filtered by payment address, min depth and ability to spend.
  * These notes are decrypted and added to the output parameter vector, outEntries.
@@ -6408,103 +7757,59 @@ void CWallet::GetFilteredNotes(
 {
     LOCK2(cs_main, cs_wallet);
 
-    for (auto & p : mapWallet) {
-        CWalletTx wtx = p.second;
+    // Only the transactions holding notes for the requested addresses are
+    // visited. Sprout notes are no longer tracked, so Sprout addresses in the
+    // filter never match.
+    std::map<uint256, std::vector<SaplingOutPoint>> mapCandidates;
+    if (filterAddresses.empty()) {
+        for (const auto & addressNotes : mapSaplingNoteIndex) {
+            for (const auto & note : addressNotes.second) {
+                mapCandidates[note.first.hash].push_back(note.first);
+            }
+        }
+    } else {
+        for (const PaymentAddress & filterAddress : filterAddresses) {
+            auto saplingAddress = boost::get<libzcash::SaplingPaymentAddress>(&filterAddress);
+            if (saplingAddress == nullptr)
+                continue;
+            auto itAddr = mapSaplingNoteIndex.find(*saplingAddress);
+            if (itAddr == mapSaplingNoteIndex.end())
+                continue;
+            for (const auto & note : itAddr->second) {
+                mapCandidates[note.first.hash].push_back(note.first);
+            }
+        }
+    }
+
+    int32_t notarizedHeight = komodo_dpownotarizedheight();
+    for (auto & candidate : mapCandidates) {
+        auto itTx = mapWallet.find(candidate.first);
+        if (itTx == mapWallet.end())
+            continue;
+        const CWalletTx& wtx = itTx->second;
 
         // Filter the transactions before checking for notes
         if (!CheckFinalTx(wtx) || wtx.GetBlocksToMaturity() > 0)
             continue;
 
+        int nDepth = wtx.GetDepthInMainChain();
         if (minDepth > 1) {
-            int nHeight    = tx_height(wtx.GetHash());
-            int nDepth     = wtx.GetDepthInMainChain();
-            int dpowconfs  = komodo_dpowconfs(nHeight,nDepth);
+            int dpowconfs  = komodo_dpowconfs_notarized(notarizedHeight, wtx.GetHeightInMainChain(), nDepth);
             if ( dpowconfs < minDepth || dpowconfs > maxDepth) {
                 continue;
             }
         } else {
-            if ( wtx.GetDepthInMainChain() < minDepth ||
-                wtx.GetDepthInMainChain() > maxDepth) {
+            if ( nDepth < minDepth ||
+                nDepth > maxDepth) {
                 continue;
             }
         }
 
-        // for (auto & pair : wtx.mapSproutNoteData) {
-        //     JSOutPoint jsop = pair.first;
-        //     SproutNoteData nd = pair.second;
-        //     SproutPaymentAddress pa = nd.address;
-        //
-        //     // skip notes which belong to a different payment address in the wallet
-        //     if (!(filterAddresses.empty() || filterAddresses.count(pa))) {
-        //         continue;
-        //     }
-        //
-        //     // skip note which has been spent
-        //     if (ignoreSpent && nd.nullifier && IsSproutSpent(*nd.nullifier)) {
-        //         continue;
-        //     }
-        //
-        //     // skip notes which cannot be spent
-        //     if (requireSpendingKey && !HaveSproutSpendingKey(pa)) {
-        //         continue;
-        //     }
-        //
-        //     // skip locked notes
-        //     if (ignoreLocked && IsLockedNote(jsop)) {
-        //         continue;
-        //     }
-        //
-        //     int i = jsop.js; // Index into CTransaction.vjoinsplit
-        //     int j = jsop.n; // Index into JSDescription.ciphertexts
-        //
-        //     // Get cached decryptor
-        //     ZCNoteDecryption decryptor;
-        //     if (!GetNoteDecryptor(pa, decryptor)) {
-        //         // Note decryptors are created when the wallet is loaded, so it should always exist
-        //         throw std::runtime_error(strprintf("Could not find note decryptor for payment address %s", EncodePaymentAddress(pa)));
-        //     }
-        //
-        //     // determine amount of funds in the note
-        //     auto hSig = wtx.vjoinsplit[i].h_sig(*pzcashParams, wtx.joinSplitPubKey);
-        //     try {
-        //         SproutNotePlaintext plaintext = SproutNotePlaintext::decrypt(
-        //                 decryptor,
-        //                 wtx.vjoinsplit[i].ciphertexts[j],
-        //                 wtx.vjoinsplit[i].ephemeralKey,
-        //                 hSig,
-        //                 (unsigned char) j);
-        //
-        //         sproutEntries.push_back(CSproutNotePlaintextEntry{jsop, pa, plaintext, wtx.GetDepthInMainChain()});
-        //
-        //     } catch (const note_decryption_failed &err) {
-        //         // Couldn't decrypt with this spending key
-        //         throw std::runtime_error(strprintf("Could not decrypt note for payment address %s", EncodePaymentAddress(pa)));
-        //     } catch (const std::exception &exc) {
-        //         // Unexpected failure
-        //         throw std::runtime_error(strprintf("Error while decrypting note for payment address %s: %s", EncodePaymentAddress(pa), exc.what()));
-        //     }
-        // }
-
-        for (auto & pair : wtx.mapSaplingNoteData) {
-            SaplingOutPoint op = pair.first;
-            SaplingNoteData nd = pair.second;
-
-            auto maybe_pt = SaplingNotePlaintext::decrypt(
-                wtx.vShieldedOutput[op.n].encCiphertext,
-                nd.ivk,
-                wtx.vShieldedOutput[op.n].ephemeralKey,
-                wtx.vShieldedOutput[op.n].cm);
-            assert(static_cast<bool>(maybe_pt));
-            auto notePt = maybe_pt.get();
-
-            auto maybe_pa = nd.ivk.address(notePt.d);
-            assert(static_cast<bool>(maybe_pa));
-            auto pa = maybe_pa.get();
-
-            // skip notes which belong to a different payment address in the wallet
-            if (!(filterAddresses.empty() || filterAddresses.count(pa))) {
+        for (const SaplingOutPoint & op : candidate.second) {
+            auto itNote = wtx.mapSaplingNoteData.find(op);
+            if (itNote == wtx.mapSaplingNoteData.end())
                 continue;
-            }
+            const SaplingNoteData & nd = itNote->second;
 
             if (ignoreSpent && nd.nullifier && IsSaplingSpent(*nd.nullifier)) {
                 continue;
@@ -6525,14 +7830,161 @@ void CWallet::GetFilteredNotes(
                  continue;
              }
 
+            auto maybe_pt = SaplingNotePlaintext::decrypt(
+                wtx.vShieldedOutput[op.n].encCiphertext,
+                nd.ivk,
+                wtx.vShieldedOutput[op.n].ephemeralKey,
+                wtx.vShieldedOutput[op.n].cm);
+            assert(static_cast<bool>(maybe_pt));
+            auto notePt = maybe_pt.get();
+
+            auto maybe_pa = nd.ivk.address(notePt.d);
+            assert(static_cast<bool>(maybe_pa));
+            auto pa = maybe_pa.get();
+
             auto note = notePt.note(nd.ivk).get();
             saplingEntries.push_back(SaplingNoteEntry {
-                op, pa, note, notePt.memo(), wtx.GetDepthInMainChain() });
+                op, pa, note, notePt.memo(), nDepth });
+        }
+    }
+}
+
+/**
+ * Find the notes received by a Sapling address with at least minDepth
+ * confirmations, spent or not, with the values of the note index, so that
+ * none of them is decrypted. Filtered as GetFilteredNotes does for a single
+ * address without requiring spending keys.
+ */
+void CWallet::GetReceivedSaplingNotes(const libzcash::SaplingPaymentAddress& address,
+                                      int minDepth,
+                                      std::vector<SaplingReceivedEntry>& entries)
+{
+    LOCK2(cs_main, cs_wallet);
+
+    auto itAddr = mapSaplingNoteIndex.find(address);
+    if (itAddr == mapSaplingNoteIndex.end())
+        return;
+
+    int32_t notarizedHeight = komodo_dpownotarizedheight();
+    for (const auto & note : itAddr->second) {
+        const SaplingOutPoint & op = note.first;
+        auto itTx = mapWallet.find(op.hash);
+        if (itTx == mapWallet.end())
+            continue;
+        const CWalletTx& wtx = itTx->second;
+
+        if (!CheckFinalTx(wtx) || wtx.GetBlocksToMaturity() > 0)
+            continue;
+
+        int nDepth = wtx.GetDepthInMainChain();
+        if (minDepth > 1) {
+            int dpowconfs = komodo_dpowconfs_notarized(notarizedHeight, wtx.GetHeightInMainChain(), nDepth);
+            if (dpowconfs < minDepth)
+                continue;
+        } else if (nDepth < minDepth) {
+            continue;
         }
+
+        if (IsLockedNote(op))
+            continue;
+
+        entries.push_back(SaplingReceivedEntry { op, note.second.value, nDepth });
     }
 }
 
 
+/**
+ * Select spendable notes of a Sapling address for a payment of nTarget,
+ * largest first, walking the address's notes in mapSaplingNotesByValue.
+ * Selection stops as soon as the target is reached, so only the selected
+ * notes are decrypted. The witnesses of the selected notes are returned
+ * with them, notes whose newest witness is at a different anchor than the
+ * first one are skipped. Returns false when all spendable notes of the
+ * address together do not reach nTarget, saplingEntries holds them all then.
+ */
+bool CWallet::SelectSaplingNotes(const libzcash::SaplingPaymentAddress& address,
+                                 CAmount nTarget,
+                                 int minDepth,
+                                 std::vector<SaplingNoteEntry>& saplingEntries,
+                                 std::vector<SaplingWitness>& witnesses,
+                                 uint256& anchor)
+{
+    LOCK2(cs_main, cs_wallet);
+
+    CAmount nSelected = 0;
+    boost::optional<uint256> rt;
+    auto itAddr = mapSaplingNotesByValue.find(address);
+    if (itAddr == mapSaplingNotesByValue.end())
+        return nTarget <= 0;
+
+    int32_t notarizedHeight = komodo_dpownotarizedheight();
+    for (auto itNote = itAddr->second.rbegin(); itNote != itAddr->second.rend() && nSelected < nTarget; ++itNote) {
+        const SaplingOutPoint& op = itNote->second;
+        auto itTx = mapWallet.find(op.hash);
+        if (itTx == mapWallet.end())
+            continue;
+        const CWalletTx& wtx = itTx->second;
+
+        if (!CheckFinalTx(wtx) || wtx.GetBlocksToMaturity() > 0)
+            continue;
+
+        int nDepth = wtx.GetDepthInMainChain();
+        if (minDepth > 1) {
+            int dpowconfs  = komodo_dpowconfs_notarized(notarizedHeight, wtx.GetHeightInMainChain(), nDepth);
+            if (dpowconfs < minDepth)
+                continue;
+        } else if (nDepth < minDepth) {
+            continue;
+        }
+
+        auto itNd = wtx.mapSaplingNoteData.find(op);
+        if (itNd == wtx.mapSaplingNoteData.end())
+            continue;
+        const SaplingNoteData& nd = itNd->second;
+
+        if (nd.nullifier && IsSaplingSpent(*nd.nullifier))
+            continue;
+        if (IsLockedNote(op))
+            continue;
+
+        // skip notes which cannot be spent
+        libzcash::SaplingExtendedFullViewingKey extfvk;
+        if (!(GetSaplingFullViewingKey(nd.ivk, extfvk) && HaveSaplingSpendingKey(extfvk)))
+            continue;
+
+        if (nd.witnesses.empty())
+            continue;
+        const SaplingWitness& witness = nd.witnesses.front();
+        if (!rt) {
+            rt = witness.root();
+        } else if (*rt != witness.root()) {
+            continue;
+        }
+
+        auto maybe_pt = SaplingNotePlaintext::decrypt(
+            wtx.vShieldedOutput[op.n].encCiphertext,
+            nd.ivk,
+            wtx.vShieldedOutput[op.n].ephemeralKey,
+            wtx.vShieldedOutput[op.n].cm);
+        assert(static_cast<bool>(maybe_pt));
+        auto notePt = maybe_pt.get();
+
+        auto maybe_pa = nd.ivk.address(notePt.d);
+        assert(static_cast<bool>(maybe_pa));
+
+        auto note = notePt.note(nd.ivk).get();
+        saplingEntries.push_back(SaplingNoteEntry {
+            op, maybe_pa.get(), note, notePt.memo(), nDepth });
+        witnesses.push_back(witness);
+        nSelected += note.value();
+    }
+
+    if (rt) {
+        anchor = *rt;
+    }
+    return nSelected >= nTarget;
+}
+
 //
 // Shielded key and address generalizations
 //
@@ -38,11 +38,13 @@
 #include "wallet/wallet_ismine.h"
 #include "wallet/walletdb.h"
 #include "wallet/rpcwallet.h"
+#include "wallet/witnesscache.h"
 #include "zcash/Address.hpp"
 #include "zcash/address/zip32.h"
 #include "base58.h"
 
 #include <algorithm>
+#include <atomic>
 #include <map>
 #include <set>
 #include <stdexcept>
@@ -69,6 +71,36 @@ extern bool fTxConflictDeleteEnabled;
 extern int fDeleteInterval;
 extern unsigned int fDeleteTransactionsAfterNBlocks;
 extern unsigned int fKeepLastNTransactions;
+extern int nSaplingDecryptThreads;
+extern int nWitnessCacheThreads;
+extern unsigned int nWalletMemoryBudget;
+//! Block the running rescan and witness cache rebuild are at, -1 when idle. Read without cs_wallet.
+extern std::atomic<int> nWalletRescanHeight;
+extern std::atomic<int> nWalletWitnessHeight;
+
+/**
+ * Progress of a rescan or witness cache rebuild, published with atomics so
+ * getwalletscanstatus can report it while the scan holds cs_main and cs_wallet.
+ */
+struct CWalletScanProgress
+{
+    std::atomic<int> nStartHeight;
+    std::atomic<int> nTargetHeight;
+    std::atomic<int64_t> nStartMillis;
+    std::atomic<int64_t> nBlocks;
+    //! Sapling outputs trial decrypted
+    std::atomic<int64_t> nOutputs;
+    //! Notes found in the transactions added to the wallet
+    std::atomic<int64_t> nNotes;
+    //! Witnesses advanced by a block
+    std::atomic<int64_t> nWitnesses;
+
+    CWalletScanProgress() : nStartHeight(-1), nTargetHeight(-1), nStartMillis(0), nBlocks(0), nOutputs(0), nNotes(0), nWitnesses(0) {}
+
+    void Start(int nStart, int nTarget);
+};
+extern CWalletScanProgress walletRescanProgress;
+extern CWalletScanProgress walletWitnessProgress;
 
 
 
@@ -112,6 +144,33 @@ static const unsigned int DEFAULT_TX_RETENTION_LASTTX = 200;
 //Amount of transactions to delete per run while syncing
 static const int MAX_DELETE_TX_SIZE = 50000;
 
+//! Wallet transactions checked for deletion with each new block
+static const unsigned int WALLET_TX_DELETE_SLICE = 100;
+
+//! Most diversified addresses z_getnewaddresses creates per call
+static const int MAX_NEW_DIVERSIFIED_ADDRESSES = 10000;
+//! Most spending keys z_getnewaddresskeys creates per call, each is trial decrypted with from then on
+static const int MAX_NEW_SAPLING_ZKEYS = 1000;
+
+//! -zdecryptthreads default (0 = auto)
+static const int DEFAULT_SAPLING_DECRYPT_THREADS = 0;
+//! Maximum number of Sapling trial decryption threads
+static const int MAX_SAPLING_DECRYPT_THREADS = 16;
+//! Minimum number of (output, key) pairs before trial decryption is spread across threads
+static const size_t SAPLING_DECRYPT_BATCH_MIN_PAIRS = 256;
+//! Minimum number of Sapling nullifiers each thread derives
+static const size_t SAPLING_NULLIFIER_MIN_NOTES_PER_THREAD = 32;
+//! -witnessthreads default (0 = auto)
+static const int DEFAULT_WITNESS_CACHE_THREADS = 0;
+//! Maximum number of witness cache threads
+static const int MAX_WITNESS_CACHE_THREADS = 16;
+//! Minimum number of witnesses each witness cache thread advances
+static const size_t WITNESS_CACHE_MIN_NOTES_PER_THREAD = 64;
+//! -walletmemorybudget default in MiB (0 = keep every transaction resident)
+static const unsigned int DEFAULT_WALLET_MEMORY_BUDGET = 0;
+//! Blocks scanned per wallet write batch during a rescan
+static const int WALLET_RESCAN_BATCH_BLOCKS = 1000;
+
 class CBlockIndex;
 class CCoinControl;
 class COutput;
@@ -271,7 +330,7 @@ public:
      * Cached incremental witnesses for spendable Notes.
      * Beginning of the list is the most recent witness.
      */
-    std::list<SproutWitness> witnesses;
+    NoteWitnessCache<SproutWitness> witnesses;
 
     /**
      * Block height corresponding to the most current witness.
@@ -299,7 +358,13 @@ public:
     inline void SerializationOp(Stream& s, Operation ser_action) {
         READWRITE(address);
         READWRITE(nullifier);
-        READWRITE(witnesses);
+        // Sprout records carry no version, the witnesses stay full copies on disk
+        std::list<SproutWitness> witnessList;
+        if (!ser_action.ForRead())
+            witnessList = witnesses.to_list();
+        READWRITE(witnessList);
+        if (ser_action.ForRead())
+            witnesses.from_list(witnessList);
         READWRITE(witnessHeight);
     }
 
@@ -317,6 +382,9 @@ public:
     }
 };
 
+//! Flag in the serialized SaplingNoteData version: the witnesses are stored as a NoteWitnessCache
+static const int SAPLING_NOTE_DATA_COMPACT_WITNESSES = 0x40000000;
+
 class SaplingNoteData
 {
 public:
@@ -328,7 +396,7 @@ public:
     SaplingNoteData(libzcash::SaplingIncomingViewingKey ivk) : ivk {ivk}, witnessHeight {-1}, nullifier(), witnessRootValidated {false}, value {0} { }
     SaplingNoteData(libzcash::SaplingIncomingViewingKey ivk, uint256 n) : ivk {ivk}, witnessHeight {-1}, nullifier(n), witnessRootValidated {false}, value {0} { }
 
-    std::list<SaplingWitness> witnesses;
+    NoteWitnessCache<SaplingWitness> witnesses;
     int witnessHeight;
     libzcash::SaplingIncomingViewingKey ivk;
     boost::optional<uint256> nullifier;
@@ -342,13 +410,19 @@ public:
 
     template <typename Stream, typename Operation>
     inline void SerializationOp(Stream& s, Operation ser_action) {
-        int nVersion = s.GetVersion();
+        int nVersion = s.GetVersion() | SAPLING_NOTE_DATA_COMPACT_WITNESSES;
         if (!(s.GetType() & SER_GETHASH)) {
             READWRITE(nVersion);
         }
         READWRITE(ivk);
         READWRITE(nullifier);
-        READWRITE(witnesses);
+        if (nVersion & SAPLING_NOTE_DATA_COMPACT_WITNESSES) {
+            READWRITE(witnesses);
+        } else {
+            std::list<SaplingWitness> witnessList;
+            READWRITE(witnessList);
+            witnesses.from_list(witnessList);
+        }
         READWRITE(witnessHeight);
     }
 
@@ -383,6 +457,89 @@ struct SaplingNoteEntry
     int confirmations;
 };
 
+/** Sapling note received by an address, as the note index has it without decrypting the note. */
+struct SaplingReceivedEntry
+{
+    SaplingOutPoint op;
+    CAmount value;
+    int confirmations;
+};
+
+/**
+ * Union-find of transparent addresses, see CWallet::GetAddressGroupings.
+ * Groups only ever merge, so adding a transaction is a few finds.
+ */
+class CAddressGroupings
+{
+private:
+    std::map<CTxDestination, CTxDestination> mapParent;
+
+public:
+    //! The address that stands for the group of address, which is added alone if new
+    CTxDestination Find(const CTxDestination& address);
+    void Merge(const CTxDestination& a, const CTxDestination& b);
+    std::set<std::set<CTxDestination>> Get();
+    size_t Size() const { return mapParent.size(); }
+    void Clear() { mapParent.clear(); }
+};
+
+/** Sapling note index entry, see CWallet::mapSaplingNoteIndex. */
+struct CSaplingNoteIndexEntry
+{
+    CAmount value;
+    boost::optional<uint256> nullifier;
+
+    CSaplingNoteIndexEntry() : value(0) {}
+    CSaplingNoteIndexEntry(CAmount valueIn, const boost::optional<uint256>& nullifierIn) : value(valueIn), nullifier(nullifierIn) {}
+};
+
+/** Shielded balance of one Sapling address, see CWallet::GetShieldedBalances. */
+struct CShieldedAddressBalance
+{
+    CAmount confirmed;
+    CAmount unconfirmed;
+    bool fSpendable;
+
+    CShieldedAddressBalance() : confirmed(0), unconfirmed(0), fSpendable(false) {}
+
+    //! Balance as getBalanceZaddr would report it, minDepth must be 0 or 1
+    CAmount Get(int minDepth, bool requireSpendingKey) const {
+        if (requireSpendingKey && !fSpendable)
+            return 0;
+        return confirmed + (minDepth == 0 ? unconfirmed : 0);
+    }
+};
+
+/** Wallet wide shielded balances, see CWallet::GetShieldedBalances. */
+struct CShieldedBalances
+{
+    CAmount spendableConfirmed;
+    CAmount spendableUnconfirmed;
+    CAmount watchConfirmed;
+    CAmount watchUnconfirmed;
+    std::map<libzcash::SaplingPaymentAddress, CShieldedAddressBalance> mapAddresses;
+
+    CShieldedBalances() : spendableConfirmed(0), spendableUnconfirmed(0), watchConfirmed(0), watchUnconfirmed(0) {}
+
+    //! Total as getBalanceZaddr("") would report it, minDepth must be 0 or 1
+    CAmount GetTotal(int minDepth, bool requireSpendingKey) const {
+        CAmount total = spendableConfirmed + (minDepth == 0 ? spendableUnconfirmed : 0);
+        if (!requireSpendingKey)
+            total += watchConfirmed + (minDepth == 0 ? watchUnconfirmed : 0);
+        return total;
+    }
+};
+
+/** Result of trial decrypting one Sapling output against a list of incoming viewing keys. */
+struct SaplingTrialDecryptionResult
+{
+    //! Index into the key list of the key that decrypted the output
+    size_t nKey;
+    boost::optional<libzcash::SaplingNotePlaintext> plaintext;
+
+    SaplingTrialDecryptionResult() : nKey(0) {}
+};
+
 /** A transaction with a merkle branch linking it to the block chain. */
 class CMerkleTx : public CTransaction
 {
@@ -440,6 +597,8 @@ public:
     int GetDepthInMainChain(const CBlockIndex* &pindexRet) const;
     int GetDepthInMainChain() const { const CBlockIndex *pindexRet; return GetDepthInMainChain(pindexRet); }
     bool IsInMainChain() const { const CBlockIndex *pindexRet; return GetDepthInMainChainINTERNAL(pindexRet) > 0; }
+    //! Height of the block containing the transaction, taken from the block index, 0 if not in the main chain
+    int GetHeightInMainChain() const;
     int GetBlocksToMaturity() const;
     bool AcceptToMemoryPool(bool fLimitFree=true, bool fRejectAbsurdFee=true);
 
@@ -788,6 +947,45 @@ private:
 };
 
 
+/** A Sapling note of the wallet received or spent, or a wallet transaction confirmed, see CWallet::NotifyShieldedEvent */
+struct CWalletShieldedEvent
+{
+    enum Type {
+        NOTE_RECEIVED,
+        NOTE_SPENT,
+        TX_CONFIRMED,
+    };
+
+    Type type;
+    uint256 txid;
+    uint256 hashBlock;
+    int nConfirmations;
+    //! Output of the note received, or spend of the transaction spending it
+    int nIndex;
+    //! The note spent, for NOTE_SPENT
+    SaplingOutPoint spentNote;
+    std::string address;
+    CAmount nValue;
+    //! Hex encoded memo, for NOTE_RECEIVED
+    std::string memo;
+
+    CWalletShieldedEvent(Type typeIn, const uint256& txidIn, const uint256& hashBlockIn, int nConfirmationsIn) :
+        type(typeIn), txid(txidIn), hashBlock(hashBlockIn), nConfirmations(nConfirmationsIn), nIndex(-1), nValue(0) {}
+};
+
+/** Memory held by one group of the wallet's in-memory structures, see CWallet::GetMemoryUsage */
+struct CWalletMemoryUsage
+{
+    std::string name;
+    size_t nEntries;
+    size_t nBytes;
+    //! Serialized size of the records kept in wallet.dat, 0 for derived indexes
+    uint64_t nDiskBytes;
+
+    CWalletMemoryUsage(const std::string& nameIn, size_t nEntriesIn, size_t nBytesIn, uint64_t nDiskBytesIn = 0) :
+        name(nameIn), nEntries(nEntriesIn), nBytes(nBytesIn), nDiskBytes(nDiskBytesIn) {}
+};
+
 /**
  * A CWallet is an extension of a keystore, which also maintains a set of transactions and balances,
  * and provides the ability to create new transactions.
@@ -837,6 +1035,50 @@ private:
     void AddToSaplingSpends(const uint256& nullifier, const uint256& wtxid);
     void AddToSpends(const uint256& wtxid);
 
+    //! Cached result of GetShieldedBalances, recomputed when fShieldedBalancesDirty is set
+    CShieldedBalances cachedShieldedBalances;
+    bool fShieldedBalancesDirty;
+
+    //! Bumped whenever a key, script or watch-only address is added or removed, see GetKeyGeneration
+    std::atomic<uint64_t> nKeyGeneration;
+    //! Bumped whenever a transaction is added to, updated in or removed from mapWallet or mapArcTxs
+    std::atomic<uint64_t> nTxGeneration;
+
+    //! Bumps nKeyGeneration and saves it, through pwalletdbEncryption while that has a transaction open
+    void BumpKeyGeneration();
+
+    /**
+     * Transactions in mapWallet with a transparent output of ours, the only
+     * ones AvailableCoins has to visit. Entries are added by AddToWallet and
+     * removed with the transaction; spent state and depth depend on other
+     * transactions and on the chain and are checked on lookup. Keys and
+     * scripts that are added can make outputs already in the wallet ours, so
+     * they have the index rebuilt on its next use.
+     */
+    mutable std::set<uint256> setTransparentCoinTxs;
+    mutable bool fTransparentCoinIndexDirty;
+    const std::set<uint256>& GetTransparentCoinTxs() const;
+
+    /**
+     * Transactions which may still need rebroadcasting, as (nTimeReceived,
+     * hash) so they are ordered by when they become due. AddToWallet adds a
+     * transaction that is new or comes back without a block, as on a
+     * disconnect. ResendWalletTransactionsBefore drops those it finds
+     * confirmed or expired, and they leave with the transaction otherwise.
+     */
+    std::set<std::pair<int64_t, uint256>> setRebroadcastQueue;
+
+    /**
+     * The groups of GetAddressGroupings, joined as AddToWallet adds
+     * transactions. Groups can't be split, so erasing a transaction with
+     * transparent inputs or outputs, as well as anything that changes what
+     * is ours or change, has them rebuilt on their next use instead.
+     */
+    CAddressGroupings addressGroupings;
+    bool fAddressGroupingsDirty;
+    //! Incrementally, a transaction that can't be added marks the groupings for a rebuild
+    void AddToAddressGroupings(const CWalletTx& wtx, bool fIncremental);
+
 public:
     /*
      * Size of the incremental witness cache for the notes in our wallet.
@@ -866,8 +1108,9 @@ public:
     std::map<std::string, std::set<uint256>> mapAddressTxids;
     std::map<uint256, ArchiveTxPoint> mapArcTxs;
     void LoadArcTxs(const uint256& wtxid, const ArchiveTxPoint& arcTxPt);
-    void AddToArcTxs(const uint256& wtxid, ArchiveTxPoint& arcTxPt, bool rescan);
-    void AddToArcTxs(const CWalletTx& wtx, ArchiveTxPoint& arcTxPt, bool rescan);
+    //! Given a handle, the decoded transaction is saved too, see RpcArcTxRecord
+    void AddToArcTxs(const uint256& wtxid, ArchiveTxPoint& arcTxPt, bool rescan, CWalletDB* pwalletdb = NULL);
+    void AddToArcTxs(const CWalletTx& wtx, ArchiveTxPoint& arcTxPt, bool rescan, CWalletDB* pwalletdb = NULL);
 
     std::map<uint256, JSOutPoint> mapArcJSOutPoints;
     void AddToArcJSOutPoints(const uint256& nullifier, const JSOutPoint& op);
@@ -875,6 +1118,16 @@ public:
     std::map<uint256, SaplingOutPoint> mapArcSaplingOutPoints;
     void AddToArcSaplingOutPoints(const uint256& nullifier, const SaplingOutPoint& op);
 
+    void LoadSaplingMemo(const SaplingOutPoint& op, const std::vector<unsigned char>& vchMemo);
+    //! Keeps the memo of a note just decrypted, and writes it with pwalletdb if it is new and one is given
+    void AddSaplingMemo(const SaplingOutPoint& op, const std::array<unsigned char, ZC_MEMO_SIZE>& memo, CWalletDB* pwalletdb = NULL);
+    //! The memo of a note of the wallet, from mapSaplingMemos or else decrypted and kept
+    bool GetSaplingMemo(const SaplingOutPoint& op, std::array<unsigned char, ZC_MEMO_SIZE>& memo);
+    //! Decrypts and keeps the memos of the notes in mapWallet that have none in mapSaplingMemos yet
+    void FillSaplingMemos();
+    //! Notes whose memo starts with vchText, or contains it if fSubstring
+    void FindSaplingMemos(const std::vector<unsigned char>& vchText, bool fSubstring, std::vector<SaplingOutPoint>& vOutPoints) const;
+
 protected:
 
     int SproutWitnessMinimumHeight(const uint256& nullifier, int nWitnessHeight, int nMinimumHeight);
@@ -889,6 +1142,15 @@ protected:
      * pindex is the old tip being disconnected.
      */
     void DecrementNoteWitnesses(const CBlockIndex* pindex);
+    /**
+     * Rolls the witnesses back from nTipHeight to nForkHeight in one pass over
+     * the wallet, as DecrementNoteWitnesses for each block in between would.
+     */
+    void RewindNoteWitnesses(int nTipHeight, int nForkHeight);
+
+    //! Witness rollback recorded by ChainTip for the blocks disconnected in a row, -1 if none
+    int nPendingRewindTip;
+    int nPendingRewindFork;
 
     template <typename WalletDB>
     void SetBestChainINTERNAL(WalletDB& walletdb, const CBlockLocator& loc) {
@@ -942,6 +1204,7 @@ private:
 
 protected:
     bool UpdatedNoteData(const CWalletTx& wtxIn, CWalletTx& wtx);
+    void NotifyShieldedEvents(const CWalletTx& wtx, bool fInsertedNew, bool fConfirmed, CWalletDB* pwalletdb);
     void MarkAffectedTransactionsDirty(const CTransaction& tx);
 
     /* the hd chain data model (chain counters) */
@@ -993,6 +1256,8 @@ public:
     {
         delete pwalletdbEncryption;
         pwalletdbEncryption = NULL;
+        delete pwalletdbBatch;
+        pwalletdbBatch = NULL;
     }
 
     void SetNull()
@@ -1008,6 +1273,13 @@ public:
         nTimeFirstKey = 0;
         fBroadcastTransactions = false;
         nWitnessCacheSize = 0;
+        nPendingRewindTip = -1;
+        nPendingRewindFork = -1;
+        fShieldedBalancesDirty = true;
+        fTransparentCoinIndexDirty = true;
+        fAddressGroupingsDirty = true;
+        nKeyGeneration = 0;
+        nTxGeneration = 0;
     }
 
     /**
@@ -1062,9 +1334,65 @@ public:
 
     std::map<uint256, SaplingOutPoint> mapSaplingNullifiersToNotes;
 
+    /**
+     * Index of the Sapling notes in mapWallet by payment address, so that
+     * filtered note queries only visit the transactions holding matching
+     * notes. Entries are replaced whenever a transaction's note data changes
+     * (AddToWallet, UpdateSaplingNullifierNoteMapWithTx) and removed with the
+     * transaction. Spent state and depth are not cached here as they depend
+     * on other transactions and on the chain; they are checked on lookup.
+     */
+    std::map<libzcash::SaplingPaymentAddress, std::map<SaplingOutPoint, CSaplingNoteIndexEntry>> mapSaplingNoteIndex;
+    //! Addresses each transaction has entries for in mapSaplingNoteIndex
+    std::map<uint256, std::set<libzcash::SaplingPaymentAddress>> mapSaplingNoteIndexTxAddresses;
+    //! The notes of mapSaplingNoteIndex by address in order of value, see SelectSaplingNotes
+    std::map<libzcash::SaplingPaymentAddress, std::set<std::pair<CAmount, SaplingOutPoint>>> mapSaplingNotesByValue;
+
+    /**
+     * Memos of the wallet's Sapling notes without their trailing zeros, written
+     * to the wallet when the note is first decrypted, so that listing notes
+     * doesn't decrypt them again for their memos.
+     */
+    std::map<SaplingOutPoint, std::vector<unsigned char>> mapSaplingMemos;
+    //! The notes of mapSaplingMemos in order of their memos, see FindSaplingMemos
+    std::set<std::pair<std::vector<unsigned char>, SaplingOutPoint>> setSaplingMemosByMemo;
+
     std::map<uint256, CWalletTx> mapWallet;
     bool writeTxFailed = false;
 
+    /**
+     * Fully spent history paged out of mapWallet to stay within
+     * -walletmemorybudget. The transactions stay in wallet.dat and are read
+     * back on demand by GetPagedWalletTx. Their spendable and watch-only
+     * debits are kept here, as their parents are usually paged out as well.
+     */
+    std::map<uint256, std::pair<CAmount, CAmount>> mapPagedTxDebits;
+
+    /**
+     * Open while a write batch is active (BeginWriteBatch/CommitWriteBatch).
+     * Transaction, archive and best block writes made under cs_wallet go
+     * through it and are committed to disk together.
+     */
+    CWalletDB *pwalletdbBatch = NULL;
+    //! Write batches committed, and the records they coalesced
+    uint64_t nWriteBatches = 0;
+    uint64_t nWriteBatchRecords = 0;
+    unsigned int nLastWriteBatchRecords = 0;
+
+    /**
+     * Candidates for -deletetx, by the height they may first be deleted at:
+     * confirmation or latest spend of an output plus -keeptxfornblocks.
+     * Transactions that still have unspent outputs leave the queue and are
+     * queued again when an output gets spent or a parent is deleted.
+     * mapTxDeleteQueue holds the queued height of each candidate.
+     */
+    std::set<std::pair<int, uint256>> setTxDeleteQueue;
+    std::map<uint256, int> mapTxDeleteQueue;
+    bool fTxDeleteQueueLoaded = false;
+    //! Set when the wallet has accounting entries, which -deletetx does not support
+    bool fAccountingEntries = false;
+    unsigned int nTxDeletedSinceCompact = 0;
+
     int64_t nOrderPosNext;
     std::map<uint256, int> mapRequestCount;
 
@@ -1197,8 +1525,10 @@ public:
       */
     //! Generates new Sapling key
     libzcash::SaplingPaymentAddress GenerateNewSaplingZKey();
+    std::vector<libzcash::SaplingPaymentAddress> GenerateNewSaplingZKeys(int nCount);
     //! Generates new Sapling diversified payment address
     libzcash::SaplingPaymentAddress GenerateNewSaplingDiversifiedAddress();
+    std::vector<libzcash::SaplingPaymentAddress> GenerateNewSaplingDiversifiedAddresses(int nCount);
     //Set Primary key for address diversification
     bool SetPrimarySpendingKey(
         const libzcash::SaplingExtendedSpendingKey &extsk);
@@ -1264,12 +1594,20 @@ public:
     void UpdateNullifierNoteMapWithTx(const CWalletTx& wtx);
     void UpdateSproutNullifierNoteMapWithTx(CWalletTx& wtx);
     void UpdateSaplingNullifierNoteMapWithTx(CWalletTx& wtx);
+    void UpdateSaplingNullifierNoteMapWithTxs(const std::vector<CWalletTx*>& vWtx);
+    void UpdateSaplingNoteIndexWithTx(const CWalletTx& wtx);
+    void EraseFromSaplingNoteIndex(const uint256& hash);
+    void UpdateTransparentCoinIndexWithTx(const CWalletTx& wtx);
+    void EraseFromTransparentCoinIndex(const uint256& hash);
+    void EraseFromRebroadcastQueue(const uint256& hash);
     void UpdateNullifierNoteMapForBlock(const CBlock* pblock);
     bool AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletDB* pwalletdb, bool fRescan = false);
     void EraseFromWallet(const uint256 &hash);
     void SyncTransaction(const CTransaction& tx, const CBlock* pblock);
+    void SyncTransactions(const std::vector<CTransaction>& vtx, const CBlock* pblock);
     void RescanWallet();
-    bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate, bool fRescan = false);
+    bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate, bool fRescan = false,
+                                  const std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap>* pSaplingNotes = NULL);
     void WitnessNoteCommitment(
          std::vector<uint256> commitments,
          std::vector<boost::optional<SproutWitness>>& witnesses,
@@ -1277,7 +1615,15 @@ public:
     void ReorderWalletTransactions(std::map<std::pair<int,int>, CWalletTx> &mapSorted, int64_t &maxOrderPos);
     void UpdateWalletTransactionOrder(std::map<std::pair<int,int>, CWalletTx> &mapSorted, bool resetOrder);
     void DeleteTransactions(std::vector<uint256> &removeTxs, std::vector<uint256> &removeArcTxs);
-    void DeleteWalletTransactions(const CBlockIndex* pindex);
+    void QueueTxForDelete(const uint256& hash, int nHeight);
+    void QueueTxForDelete(const CWalletTx& wtx);
+    void LoadTxDeleteQueue();
+    void DeleteWalletTransactions(const CBlockIndex* pindex, unsigned int nMaxTxs = WALLET_TX_DELETE_SLICE);
+    bool IsSpentHistory(const CWalletTx& wtx, unsigned int nMinSpendDepth, const std::set<uint256>* setGone = NULL) const;
+    void PageOutSpentHistory();
+    //! Estimated dynamic memory of the wallet's maps, by group. Walks every transaction.
+    std::vector<CWalletMemoryUsage> GetMemoryUsage() const;
+    bool GetPagedWalletTx(const uint256& hash, CWalletTx& wtxRet) const;
     bool initalizeArcTx();
     int ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate = false, bool fIgnoreBirthday = false);
     void ReacceptWalletTransactions();
@@ -1323,6 +1669,20 @@ public:
         uint8_t n) const;
     mapSproutNoteData_t FindMySproutNotes(const CTransaction& tx) const;
     std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap> FindMySaplingNotes(const CTransaction& tx) const;
+    //! FindMySaplingNotes for each transaction, with the outputs of all of them trial decrypted together
+    std::vector<std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap>> FindMySaplingNotes(const std::vector<const CTransaction*>& vtx) const;
+    //! Number of Sapling full and incoming viewing keys, used to detect stale trial decryption results
+    size_t GetSaplingKeyCount() const;
+    //! Changes whenever what IsMine or the Sapling key lookups say can change, for caches of what they said
+    uint64_t GetKeyGeneration() const { return nKeyGeneration; }
+    //! Saved with the decoded transactions, so they are still valid after a restart
+    void LoadKeyGeneration(uint64_t nGeneration) { nKeyGeneration = nGeneration; }
+    //! Changes whenever the transactions the list RPCs report can change, other than by the chain tip moving
+    uint64_t GetTxGeneration() const { return nTxGeneration; }
+    static void TrialDecryptSaplingOutputs(
+        const std::vector<OutputDescription>& vOutputs,
+        const std::vector<libzcash::SaplingIncomingViewingKey>& vIvks,
+        std::vector<SaplingTrialDecryptionResult>& vResults);
     bool IsSproutNullifierFromMe(const uint256& nullifier) const;
     bool IsSaplingNullifierFromMe(const uint256& nullifier) const;
 
@@ -1349,12 +1709,21 @@ public:
     CAmount GetCredit(const CTransaction& tx, int32_t voutNum, const isminefilter& filter) const;
     CAmount GetCredit(const CTransaction& tx, const isminefilter& filter) const;
     CAmount GetChange(const CTransaction& tx) const;
-    void ChainTip(const CBlockIndex *pindex, const CBlock *pblock, SproutMerkleTree sproutTree, SaplingMerkleTree saplingTree, bool added);
+    void ChainTip(const CBlockIndex *pindex, const CBlock *pblock, const SproutMerkleTree& sproutTree, const SaplingMerkleTree& saplingTree, bool added);
+    void UpdatedBlockTip(const CBlockIndex *pindex);
+    /**
+     * The blocks of a reorg only record how far the witnesses go back, and
+     * they are rolled back once, before they are next advanced, read or saved.
+     */
+    void ApplyPendingWitnessRewind();
     void RunSaplingSweep(int blockHeight);
     void RunSaplingConsolidation(int blockHeight);
     void CommitAutomatedTx(const CTransaction& tx);
     /** Saves witness caches and best block locator to disk. */
     void SetBestChain(const CBlockLocator& loc);
+    bool BeginWriteBatch();
+    //! Commits the active write batch, with the best block if ploc is given
+    bool CommitWriteBatch(const CBlockLocator* ploc = NULL);
     std::set<std::pair<libzcash::PaymentAddress, uint256>> GetNullifiersForAddresses(const std::set<libzcash::PaymentAddress> & addresses);
     bool IsNoteSproutChange(const std::set<std::pair<libzcash::PaymentAddress, uint256>> & nullifierSet, const libzcash::PaymentAddress & address, const JSOutPoint & entry);
     bool IsNoteSaplingChange(const std::set<std::pair<libzcash::PaymentAddress, uint256>> & nullifierSet, const libzcash::PaymentAddress & address, const SaplingOutPoint & entry);
@@ -1427,6 +1796,14 @@ public:
     boost::signals2::signal<void (CWallet *wallet, const uint256 &hashTx,
             ChangeType status)> NotifyTransactionChanged;
 
+    /**
+     * Sapling note received or spent, or wallet transaction confirmed. Not
+     * raised during a rescan, and the notes are only decrypted for it when
+     * something is connected.
+     * @note called with lock cs_wallet held.
+     */
+    boost::signals2::signal<void (const CWalletShieldedEvent& event)> NotifyShieldedEvent;
+
     boost::signals2::signal<void ()> NotifyBalanceChanged;
     /** Show progress e.g. for rescan */
     boost::signals2::signal<void (const std::string &title, int nProgress)> ShowProgress;
@@ -1463,6 +1840,13 @@ public:
 
     //Get Address balance for the GUI
     void getZAddressBalances(std::map<libzcash::PaymentAddress, CAmount> &balances, int minDepth, bool requireSpendingKey);
+    /**
+     * Shielded balances at minimum depth 0 and 1, with and without spending
+     * keys. They are recomputed from the note index at most once per wallet
+     * or chain tip change, instead of one GetFilteredNotes pass per query.
+     */
+    CShieldedBalances GetShieldedBalances();
+    void MarkShieldedBalancesDirty();
 
     /* Find notes filtered by payment address, min depth, ability to spend */
     void GetFilteredNotes(std::vector<CSproutNotePlaintextEntry>& sproutEntries,
@@ -1483,6 +1867,20 @@ public:
                           bool requireSpendingKey=true,
                           bool ignoreLocked=true);
 
+    /* Notes received by a Sapling address with at least minDepth confirmations, not decrypted */
+    void GetReceivedSaplingNotes(const libzcash::SaplingPaymentAddress& address,
+                                 int minDepth,
+                                 std::vector<SaplingReceivedEntry>& entries);
+
+    /* Select spendable notes of a Sapling address, largest first, until they
+       add up to nTarget, along with their witnesses at a common anchor */
+    bool SelectSaplingNotes(const libzcash::SaplingPaymentAddress& address,
+                            CAmount nTarget,
+                            int minDepth,
+                            std::vector<SaplingNoteEntry>& saplingEntries,
+                            std::vector<SaplingWitness>& witnesses,
+                            uint256& anchor);
+
     // staking functions
     bool VerusSelectStakeOutput(CBlock *pBlock, arith_uint256 &hashResult, CTransaction &stakeSource, int32_t &voutNum, int32_t nHeight, uint32_t &bnTarget) const;
     int32_t VerusStakeTransaction(CBlock *pBlock, CMutableTransaction &txNew, uint32_t &bnTarget, arith_uint256 &hashResult, uint8_t *utxosig, CPubKey pk) const;
@@ -0,0 +1,153 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "wallet/walletarchivedb.h"
+
+#include "util.h"
+#include "wallet/wallet.h"
+
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
+
+using namespace std;
+
+static const char DB_ARCTX = 'a';
+static const char DB_ARCSPROUTOP = 'z';
+static const char DB_ARCSAPLINGOP = 's';
+
+CWalletArchiveDB* pwalletArchiveDB = NULL;
+
+std::string CWalletArchiveDB::ArchiveDirName(const std::string& strWalletFile) {
+    // The archive of the default wallet keeps the directory it always had
+    if (strWalletFile == "wallet.dat")
+        return "walletarchive";
+    return "walletarchive-" + strWalletFile;
+}
+
+CWalletArchiveDB::CWalletArchiveDB(const std::string& strWalletFile, size_t nCacheSize, bool fMemory, bool fWipe) :
+    CDBWrapper(GetDataDir() / ArchiveDirName(strWalletFile), nCacheSize, fMemory, fWipe), batchPending(*this) {
+}
+
+CWalletArchiveDB::~CWalletArchiveDB() {
+    try {
+        Sync();
+    } catch (const std::exception& e) {
+        LogPrintf("%s: %s\n", __func__, e.what());
+    }
+}
+
+template <typename K, typename V>
+void CWalletArchiveDB::WritePending(const K& key, const V& value) {
+    LOCK(cs);
+    batchPending.Write(key, value);
+    if (batchPending.SizeEstimate() > WALLET_ARCHIVE_DB_MAX_PENDING) {
+        WriteBatch(batchPending);
+        batchPending.Clear();
+    }
+}
+
+template <typename K>
+void CWalletArchiveDB::ErasePending(const K& key) {
+    LOCK(cs);
+    batchPending.Erase(key);
+}
+
+bool CWalletArchiveDB::Sync() {
+    LOCK(cs);
+    bool fSynced = WriteBatch(batchPending, true);
+    batchPending.Clear();
+    return fSynced;
+}
+
+bool CWalletArchiveDB::WriteArcTx(const uint256& hash, const ArchiveTxPoint& arcTxPoint) {
+    WritePending(make_pair(DB_ARCTX, hash), arcTxPoint);
+    return true;
+}
+
+bool CWalletArchiveDB::EraseArcTx(const uint256& hash) {
+    ErasePending(make_pair(DB_ARCTX, hash));
+    return true;
+}
+
+bool CWalletArchiveDB::WriteArcSproutOp(const uint256& nullifier, const JSOutPoint& op) {
+    WritePending(make_pair(DB_ARCSPROUTOP, nullifier), op);
+    return true;
+}
+
+bool CWalletArchiveDB::EraseArcSproutOp(const uint256& nullifier) {
+    ErasePending(make_pair(DB_ARCSPROUTOP, nullifier));
+    return true;
+}
+
+bool CWalletArchiveDB::WriteArcSaplingOp(const uint256& nullifier, const SaplingOutPoint& op) {
+    WritePending(make_pair(DB_ARCSAPLINGOP, nullifier), op);
+    return true;
+}
+
+bool CWalletArchiveDB::EraseArcSaplingOp(const uint256& nullifier) {
+    ErasePending(make_pair(DB_ARCSAPLINGOP, nullifier));
+    return true;
+}
+
+bool CWalletArchiveDB::WriteMigration(const std::map<uint256, ArchiveTxPoint>& mapArcTxs,
+                                      const std::map<uint256, SaplingOutPoint>& mapArcSaplingOutPoints) {
+    CDBBatch batch(*this);
+    for (std::map<uint256, ArchiveTxPoint>::const_iterator it = mapArcTxs.begin(); it != mapArcTxs.end(); it++)
+        batch.Write(make_pair(DB_ARCTX, it->first), it->second);
+    for (std::map<uint256, SaplingOutPoint>::const_iterator it = mapArcSaplingOutPoints.begin(); it != mapArcSaplingOutPoints.end(); it++)
+        batch.Write(make_pair(DB_ARCSAPLINGOP, it->first), it->second);
+    return WriteBatch(batch, true);
+}
+
+unsigned int CWalletArchiveDB::LoadArchive(CWallet* pwallet) {
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+    unsigned int nArcTx = 0;
+
+    // Keys are ordered by type, so each type is one contiguous range
+    pcursor->Seek(make_pair(DB_ARCTX, uint256()));
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        std::pair<char, uint256> key;
+        if (!pcursor->GetKey(key) || key.first != DB_ARCTX)
+            break;
+        // As in wallet.dat, records of an older ArchiveTxPoint format are
+        // skipped, which triggers a zap and rescan.
+        ArchiveTxPoint arcTxPt;
+        if (pcursor->GetValue(arcTxPt)) {
+            pwallet->LoadArcTxs(key.second, arcTxPt);
+            nArcTx++;
+        }
+        pcursor->Next();
+    }
+
+    pcursor->Seek(make_pair(DB_ARCSAPLINGOP, uint256()));
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        std::pair<char, uint256> key;
+        if (!pcursor->GetKey(key) || key.first != DB_ARCSAPLINGOP)
+            break;
+        SaplingOutPoint op;
+        if (pcursor->GetValue(op))
+            pwallet->AddToArcSaplingOutPoints(key.second, op);
+        pcursor->Next();
+    }
+
+    return nArcTx;
+}
+
+bool CWalletArchiveDB::EraseAll() {
+    Sync();
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+    CDBBatch batch(*this);
+
+    pcursor->SeekToFirst();
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        std::pair<char, uint256> key;
+        if (pcursor->GetKey(key))
+            batch.Erase(key);
+        pcursor->Next();
+    }
+    return WriteBatch(batch, true);
+}
@@ -0,0 +1,80 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_WALLET_WALLETARCHIVEDB_H
+#define BITCOIN_WALLET_WALLETARCHIVEDB_H
+
+#include "dbwrapper.h"
+#include "sync.h"
+#include "uint256.h"
+
+#include <map>
+
+class ArchiveTxPoint;
+class CWallet;
+class JSOutPoint;
+class SaplingOutPoint;
+
+//! -walletarchivedb default
+static const bool DEFAULT_WALLET_ARCHIVE_DB = false;
+//! Cache size of the wallet archive database
+static const size_t WALLET_ARCHIVE_DB_CACHE = 8 << 20;
+//! Pending writes past this size are written out before the next Sync(), unsynced
+static const size_t WALLET_ARCHIVE_DB_MAX_PENDING = 16 << 20;
+
+/**
+ * LevelDB store (walletarchive/ for wallet.dat, walletarchive-<file>/ for
+ * any other -wallet) for the archived transaction records (arctx, arczcop,
+ * arczsop) of the wallet file. These are by far the most numerous records of
+ * an old wallet, kept out of Berkeley DB they no longer weigh on its log,
+ * flushes and compaction. The records can be rebuilt by a rescan, as wallet
+ * file backups do not include them.
+ *
+ * Writes are kept in a batch that Sync() writes out and syncs, which the
+ * wallet does as it writes its best block, so the archive on disk is never
+ * behind the blocks the wallet counts as scanned.
+ */
+class CWalletArchiveDB : public CDBWrapper
+{
+public:
+    CWalletArchiveDB(const std::string& strWalletFile, size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    ~CWalletArchiveDB();
+private:
+    CWalletArchiveDB(const CWalletArchiveDB&);
+    void operator=(const CWalletArchiveDB&);
+
+    CCriticalSection cs;
+    //! Writes since the last Sync(), guarded by cs
+    CDBBatch batchPending;
+
+    template <typename K, typename V>
+    void WritePending(const K& key, const V& value);
+    template <typename K>
+    void ErasePending(const K& key);
+public:
+    //! Directory of the archive of a wallet file, relative to the data directory
+    static std::string ArchiveDirName(const std::string& strWalletFile);
+
+    bool WriteArcTx(const uint256& hash, const ArchiveTxPoint& arcTxPoint);
+    bool EraseArcTx(const uint256& hash);
+    bool WriteArcSproutOp(const uint256& nullifier, const JSOutPoint& op);
+    bool EraseArcSproutOp(const uint256& nullifier);
+    bool WriteArcSaplingOp(const uint256& nullifier, const SaplingOutPoint& op);
+    bool EraseArcSaplingOp(const uint256& nullifier);
+
+    //! Writes the pending records and syncs them to disk
+    bool Sync();
+
+    //! Writes the records migrated from wallet.dat in one synced batch
+    bool WriteMigration(const std::map<uint256, ArchiveTxPoint>& mapArcTxs,
+                        const std::map<uint256, SaplingOutPoint>& mapArcSaplingOutPoints);
+    //! Loads all records into the wallet, returns the number of archived transactions
+    unsigned int LoadArchive(CWallet* pwallet);
+    //! Removes all records, used by -zapwallettxes
+    bool EraseAll();
+};
+
+extern CWalletArchiveDB* pwalletArchiveDB;
+
+#endif // BITCOIN_WALLET_WALLETARCHIVEDB_H
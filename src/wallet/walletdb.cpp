@@ -30,6 +30,7 @@
 #include "util.h"
 #include "utiltime.h"
 #include "wallet/wallet.h"
+#include "wallet/walletarchivedb.h"
 #include "zcash/Proof.hpp"
 #include "komodo_defs.h"
 
@@ -48,6 +49,36 @@ extern CBlockIndex *komodo_blockindex(uint256 hash);
 // CWalletDB
 //
 
+bool CWalletDB::BatchBegin()
+{
+    if (fBatch || !CDB::TxnBegin())
+        return false;
+    fBatch = true;
+    fBatchFailed = false;
+    nBatchRecords = 0;
+    return true;
+}
+
+bool CWalletDB::BatchCommit()
+{
+    if (!fBatch)
+        return false;
+    fBatch = false;
+    if (fBatchFailed) {
+        CDB::TxnAbort();
+        return false;
+    }
+    return CDB::TxnCommit();
+}
+
+void CWalletDB::BatchAbort()
+{
+    if (!fBatch)
+        return;
+    fBatch = false;
+    CDB::TxnAbort();
+}
+
 bool CWalletDB::WriteName(const string& strAddress, const string& strName)
 {
     nWalletDBUpdated++;
@@ -78,6 +109,8 @@ bool CWalletDB::ErasePurpose(const string& strPurpose)
 bool CWalletDB::WriteArcTx(uint256 hash, ArchiveTxPoint arcTxPoint, bool txnProtected)
 {
     nWalletDBUpdated++;
+    if (pwalletArchiveDB)
+        return pwalletArchiveDB->WriteArcTx(hash, arcTxPoint);
     if (txnProtected) {
         return WriteTxn(std::make_pair(std::string("arctx"), hash), arcTxPoint, __FUNCTION__);
     } else {
@@ -88,30 +121,40 @@ bool CWalletDB::WriteArcTx(uint256 hash, ArchiveTxPoint arcTxPoint, bool txnProt
 bool CWalletDB::EraseArcTx(uint256 hash)
 {
     nWalletDBUpdated++;
+    if (pwalletArchiveDB)
+        return pwalletArchiveDB->EraseArcTx(hash);
     return Erase(std::make_pair(std::string("arctx"), hash));
 }
 
 bool CWalletDB::WriteArcSproutOp(uint256 nullifier, JSOutPoint op)
 {
     nWalletDBUpdated++;
+    if (pwalletArchiveDB)
+        return pwalletArchiveDB->WriteArcSproutOp(nullifier, op);
     return WriteTxn(std::make_pair(std::string("arczcop"), nullifier), op, __FUNCTION__);
 }
 
 bool CWalletDB::EraseArcSproutOp(uint256 nullifier)
 {
     nWalletDBUpdated++;
+    if (pwalletArchiveDB)
+        return pwalletArchiveDB->EraseArcSproutOp(nullifier);
     return Erase(std::make_pair(std::string("arczcop"), nullifier));
 }
 
 bool CWalletDB::WriteArcSaplingOp(uint256 nullifier, SaplingOutPoint op)
 {
     nWalletDBUpdated++;
+    if (pwalletArchiveDB)
+        return pwalletArchiveDB->WriteArcSaplingOp(nullifier, op);
     return WriteTxn(std::make_pair(std::string("arczsop"), nullifier), op, __FUNCTION__);
 }
 
 bool CWalletDB::EraseArcSaplingOp(uint256 nullifier)
 {
     nWalletDBUpdated++;
+    if (pwalletArchiveDB)
+        return pwalletArchiveDB->EraseArcSaplingOp(nullifier);
     return Erase(std::make_pair(std::string("arczsop"), nullifier));
 }
 //End Historical Wallet Tx
@@ -126,12 +169,37 @@ bool CWalletDB::WriteTx(uint256 hash, const CWalletTx& wtx, bool txnProtected)
     }
 }
 
+bool CWalletDB::ReadTx(uint256 hash, CWalletTx& wtx)
+{
+    return Read(std::make_pair(std::string("tx"), hash), wtx);
+}
+
 bool CWalletDB::EraseTx(uint256 hash)
 {
     nWalletDBUpdated++;
     return Erase(std::make_pair(std::string("tx"), hash));
 }
 
+bool CWalletDB::WriteSaplingMemo(const SaplingOutPoint& op, const std::vector<unsigned char>& vchMemo)
+{
+    nWalletDBUpdated++;
+    return Write(std::make_pair(std::string("saplingmemo"), op), vchMemo);
+}
+
+bool CWalletDB::EraseSaplingMemo(const SaplingOutPoint& op)
+{
+    nWalletDBUpdated++;
+    return Erase(std::make_pair(std::string("saplingmemo"), op));
+}
+
+bool CWalletDB::EraseRpcArcTx(const uint256& txid)
+{
+    nWalletDBUpdated++;
+    // Erasing a record that is not there succeeds
+    bool fErased = Erase(std::make_pair(std::string("arcrpctx"), std::make_pair(txid, false)));
+    return Erase(std::make_pair(std::string("arcrpctx"), std::make_pair(txid, true))) && fErased;
+}
+
 bool CWalletDB::WriteKey(const CPubKey& vchPubKey, const CPrivKey& vchPrivKey, const CKeyMetadata& keyMeta)
 {
     nWalletDBUpdated++;
@@ -322,6 +390,9 @@ bool CWalletDB::EraseWatchOnly(const CScript &dest)
 bool CWalletDB::WriteBestBlock(const CBlockLocator& locator)
 {
     nWalletDBUpdated++;
+    // The archived records of the blocks up to the best block go to disk first
+    if (pwalletArchiveDB && !pwalletArchiveDB->Sync())
+        return false;
     return Write(std::string("bestblock"), locator);
 }
 
@@ -348,6 +419,12 @@ bool CWalletDB::WriteWitnessCacheSize(int64_t nWitnessCacheSize)
     return Write(std::string("witnesscachesize"), nWitnessCacheSize);
 }
 
+bool CWalletDB::WriteKeyGeneration(uint64_t nKeyGeneration)
+{
+    nWalletDBUpdated++;
+    return Write(std::string("keygeneration"), nKeyGeneration);
+}
+
 bool CWalletDB::ReadPool(int64_t nPool, CKeyPool& keypool)
 {
     return Read(std::make_pair(std::string("pool"), nPool), keypool);
@@ -631,6 +708,15 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
             catch (...) {}
 
         }
+        else if (strType == "saplingmemo")
+        {
+            SaplingOutPoint op;
+            ssKey >> op;
+            std::vector<unsigned char> vchMemo;
+            ssValue >> vchMemo;
+
+            pwallet->LoadSaplingMemo(op, vchMemo);
+        }
         else if (strType == "arczcop")
         {
             // uint256 nullifier;
@@ -1036,6 +1122,12 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
         {
             ssValue >> pwallet->nWitnessCacheSize;
         }
+        else if (strType == "keygeneration")
+        {
+            uint64_t nKeyGeneration;
+            ssValue >> nKeyGeneration;
+            pwallet->LoadKeyGeneration(nKeyGeneration);
+        }
         else if (strType == "hdseed")
         {
             uint256 seedFp;
@@ -1183,6 +1275,13 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
         deadTxns.clear();
     }
 
+    if (pwalletArchiveDB && result != DB_CORRUPT) {
+        LOCK(pwallet->cs_wallet);
+        if (!MigrateArchive(pwallet))
+            return DB_CORRUPT;
+        wss.nArcTx += pwalletArchiveDB->LoadArchive(pwallet);
+    }
+
     if (fNoncriticalErrors && result == DB_LOAD_OK)
         result = DB_NONCRITICAL_ERROR;
 
@@ -1222,6 +1321,40 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
     return result;
 }
 
+/**
+ * Moves the archived transaction records read from wallet.dat to the wallet
+ * archive database. They are erased from wallet.dat only once the archive
+ * has synced them, an interrupted migration is simply repeated.
+ */
+bool CWalletDB::MigrateArchive(CWallet* pwallet)
+{
+    if (pwallet->mapArcTxs.empty() && pwallet->mapArcSaplingOutPoints.empty())
+        return true;
+
+    LogPrintf("Moving %u archived transactions to the wallet archive database\n", pwallet->mapArcTxs.size());
+    if (!pwalletArchiveDB->WriteMigration(pwallet->mapArcTxs, pwallet->mapArcSaplingOutPoints)) {
+        LogPrintf("MigrateArchive(): Failed to write the wallet archive database\n");
+        return false;
+    }
+
+    if (!TxnBegin())
+        return false;
+    for (std::map<uint256, ArchiveTxPoint>::iterator it = pwallet->mapArcTxs.begin(); it != pwallet->mapArcTxs.end(); ++it) {
+        if (!Erase(std::make_pair(std::string("arctx"), it->first))) {
+            TxnAbort();
+            return false;
+        }
+    }
+    for (std::map<uint256, SaplingOutPoint>::iterator it = pwallet->mapArcSaplingOutPoints.begin(); it != pwallet->mapArcSaplingOutPoints.end(); ++it) {
+        if (!Erase(std::make_pair(std::string("arczsop"), it->first))) {
+            TxnAbort();
+            return false;
+        }
+    }
+    nWalletDBUpdated++;
+    return TxnCommit();
+}
+
 DBErrors CWalletDB::FindWalletTxToZap(CWallet* pwallet, vector<uint256>& vTxHash, vector<CWalletTx>& vWtx, vector<uint256>& vArcHash, vector<uint256>& vArcSproutNullifier, vector<uint256>& vArcSaplingNullifier)
 {
     pwallet->vchDefaultKey = CPubKey();
@@ -1326,21 +1459,25 @@ DBErrors CWalletDB::ZapWalletTx(CWallet* pwallet, vector<CWalletTx>& vWtx)
             return DB_CORRUPT;
     }
 
+    // erase the archive database, and below any records still in wallet.dat
+    if (pwalletArchiveDB && !pwalletArchiveDB->EraseAll())
+        return DB_CORRUPT;
+
     // erase each archive TX
     BOOST_FOREACH (uint256& arcHash, vArcTxHash) {
-        if (!EraseArcTx(arcHash))
+        if (!Erase(std::make_pair(std::string("arctx"), arcHash)))
             return DB_CORRUPT;
     }
 
     // erase each archive Nullier SaplingOutput set
     BOOST_FOREACH (uint256& arcNullifier, vArcSproutNullifier) {
-        if (!EraseArcSproutOp(arcNullifier))
+        if (!Erase(std::make_pair(std::string("arczcop"), arcNullifier)))
             return DB_CORRUPT;
     }
 
     // erase each archive Nullier SaplingOutput set
     BOOST_FOREACH (uint256& arcNullifier, vArcSaplingNullifier) {
-        if (!EraseArcSaplingOp(arcNullifier))
+        if (!Erase(std::make_pair(std::string("arczsop"), arcNullifier)))
             return DB_CORRUPT;
     }
     return DB_LOAD_OK;
@@ -139,14 +139,60 @@ class CWalletDB : public CDB
 public:
     CWalletDB(const std::string& strFilename, const char* pszMode = "r+", bool fFlushOnClose = true) : CDB(strFilename, pszMode, fFlushOnClose)
     {
+        fBatch = false;
+        fBatchFailed = false;
+        nBatchRecords = 0;
     }
 
+    /**
+     * Write batch: until BatchCommit(), every record written through this
+     * handle, including WriteTxn and nested TxnBegin/TxnCommit pairs, joins a
+     * single database transaction that is committed (and synced) once.
+     */
+    bool BatchBegin();
+    bool BatchCommit();
+    void BatchAbort();
+    bool IsBatchActive() const { return fBatch; }
+    unsigned int GetBatchRecords() const { return nBatchRecords; }
+
+    // Inside a batch the enclosing transaction is reused
+    bool TxnBegin()
+    {
+        if (fBatch)
+            return !fBatchFailed;
+        return CDB::TxnBegin();
+    }
+
+    bool TxnCommit()
+    {
+        if (fBatch)
+            return !fBatchFailed;
+        return CDB::TxnCommit();
+    }
+
+    bool TxnAbort()
+    {
+        if (fBatch) {
+            fBatchFailed = true;
+            return true;
+        }
+        return CDB::TxnAbort();
+    }
 
     template <typename K, typename T>
     bool WriteTxn(const K& key, const T& value, std::string calling, bool fOverwrite = true)
     {
 
         LOCK(bitdb.cs_db);
+        if (fBatch) {
+            // A failed write poisons the batch, retrying inside it is pointless
+            if (!Write(key, value, fOverwrite)) {
+                LogPrintf("%s: Failed to write in batch.\n", calling);
+                return false;
+            }
+            return true;
+        }
+
         bool txnWrite = false;
         int retries = 0;
 
@@ -197,8 +243,29 @@ public:
     //End Historical Wallet Tx
 
     bool WriteTx(uint256 hash, const CWalletTx& wtx, bool txnProtected);
+    bool ReadTx(uint256 hash, CWalletTx& wtx);
     bool EraseTx(uint256 hash);
 
+    bool WriteSaplingMemo(const SaplingOutPoint& op, const std::vector<unsigned char>& vchMemo);
+    bool EraseSaplingMemo(const SaplingOutPoint& op);
+
+    //! Decoded transactions of the list RPCs, Record is RpcArcTxRecord (wallet/rpcpiratewallet.h)
+    template <typename Record>
+    bool WriteRpcArcTx(const uint256& txid, bool fIncludeWatchonly, const Record& record)
+    {
+        nWalletDBUpdated++;
+        return Write(std::make_pair(std::string("arcrpctx"), std::make_pair(txid, fIncludeWatchonly)), record);
+    }
+
+    template <typename Record>
+    bool ReadRpcArcTx(const uint256& txid, bool fIncludeWatchonly, Record& record)
+    {
+        return Read(std::make_pair(std::string("arcrpctx"), std::make_pair(txid, fIncludeWatchonly)), record);
+    }
+
+    //! Erases the records of both watch-only settings
+    bool EraseRpcArcTx(const uint256& txid);
+
     bool WriteKey(const CPubKey& vchPubKey, const CPrivKey& vchPrivKey, const CKeyMetadata &keyMeta);
     bool WriteCryptedKey(const CPubKey& vchPubKey, const std::vector<unsigned char>& vchCryptedSecret, const CKeyMetadata &keyMeta);
     bool WriteMasterKey(unsigned int nID, const CMasterKey& kMasterKey);
@@ -217,6 +284,8 @@ public:
 
     bool WriteWitnessCacheSize(int64_t nWitnessCacheSize);
 
+    bool WriteKeyGeneration(uint64_t nKeyGeneration);
+
     bool ReadPool(int64_t nPool, CKeyPool& keypool);
     bool WritePool(int64_t nPool, const CKeyPool& keypool);
     bool ErasePool(int64_t nPool);
@@ -239,6 +308,7 @@ public:
     DBErrors LoadWallet(CWallet* pwallet);
     DBErrors FindWalletTxToZap(CWallet* pwallet, std::vector<uint256>& vTxHash, std::vector<CWalletTx>& vWtx, std::vector<uint256>& vArcHash, std::vector<uint256>& vArcSproutNullifier, std::vector<uint256>& vArcSaplingNullifier);
     DBErrors ZapWalletTx(CWallet* pwallet, std::vector<CWalletTx>& vWtx);
+    bool MigrateArchive(CWallet* pwallet);
     static bool Compact(CDBEnv& dbenv, const std::string& strFile);
     static bool Recover(CDBEnv& dbenv, const std::string& filename, bool fOnlyKeys);
     static bool Recover(CDBEnv& dbenv, const std::string& filename);
@@ -281,10 +351,45 @@ public:
     bool WriteSaplingExtendedFullViewingKey(const libzcash::SaplingExtendedFullViewingKey &extfvk);
     bool EraseSaplingExtendedFullViewingKey(const libzcash::SaplingExtendedFullViewingKey &extfvk);
 
+protected:
+    template <typename K, typename T>
+    bool Write(const K& key, const T& value, bool fOverwrite = true)
+    {
+        if (fBatch && fBatchFailed)
+            return false;
+        bool ret = CDB::Write(key, value, fOverwrite);
+        if (fBatch) {
+            if (ret)
+                nBatchRecords++;
+            else
+                fBatchFailed = true;
+        }
+        return ret;
+    }
+
+    template <typename K>
+    bool Erase(const K& key)
+    {
+        if (fBatch && fBatchFailed)
+            return false;
+        bool ret = CDB::Erase(key);
+        if (fBatch) {
+            if (ret)
+                nBatchRecords++;
+            else
+                fBatchFailed = true;
+        }
+        return ret;
+    }
+
 private:
     CWalletDB(const CWalletDB&);
     void operator=(const CWalletDB&);
 
+    bool fBatch;
+    bool fBatchFailed;
+    unsigned int nBatchRecords;
+
     bool WriteAccountingEntry(const uint64_t nAccEntryNum, const CAccountingEntry& acentry);
 };
 
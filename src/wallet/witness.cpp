@@ -3,7 +3,9 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "compactblockindex.h"
 #include "init.h"
+#include "main.h"
 #include "rpc/server.h"
 #include "wallet.h"
 #include "witness.h"
@@ -70,32 +72,32 @@ UniValue getsaplingwitness(const UniValue& params, bool fHelp,  const CPubKey& m
 
   //Get the sapling tree as of the previous block
   SaplingMerkleTree saplingTree;
-  pcoinsTip->GetSaplingAnchorAt(pblockindex->pprev->hashFinalSaplingRoot, saplingTree);
-
-  //Cycle through block and transactions build sapling tree until the commitment needed is reached
-  CBlock pblock;
-  ReadBlockFromDisk(pblock, pblockindex, false);
-  for (const CTransaction& tx : pblock.vtx) {
-      auto hash = tx.GetHash();
-
-      //Check if output exists
-      if (hash == ctxhash && (tx.vShieldedOutput.size() == 0 || tx.vShieldedOutput.size() < nSheildedOutputIndex + 1))
-          throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Sapling Output does not exist");
-
-      for (int64_t i = 0; i < tx.vShieldedOutput.size(); i++) {
-          const uint256& note_commitment = tx.vShieldedOutput[i].cm;
-          saplingTree.append(note_commitment);
-
-          if (hash == ctxhash && i == nSheildedOutputIndex) {
+  if (!GetSaplingTreeAfter(pblockindex->pprev, saplingTree))
+      throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't get the Sapling tree of the previous block");
+
+  //Cycle through the block's note commitments, building the sapling tree until the commitment needed is reached
+  std::vector<CSaplingBlockCommitments> vCommitments;
+  if (!ReadSaplingCommitments(pblockindex, 1, vCommitments) || vCommitments.empty())
+      throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read the Sapling commitments of the block");
+  bool fFound = false;
+  for (const CSaplingTxCommitments& ctx : vCommitments[0].vtx) {
+      for (int64_t i = 0; i < ctx.cmus.size(); i++) {
+          saplingTree.append(ctx.cmus[i]);
+
+          if (ctx.txid == ctxhash && i == nSheildedOutputIndex) {
             CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
             ss << saplingTree.witness();
             wit.push_back(Pair("height", nHeight));
-            wit.push_back(Pair("txhash", hash.ToString()));
+            wit.push_back(Pair("txhash", ctx.txid.ToString()));
             wit.push_back(Pair("sheildedoutputindex", i));
             wit.push_back(Pair("witness", HexStr(ss.begin(), ss.end())));
+            fFound = true;
           }
       }
   }
+  //Transactions without Sapling outputs have no commitments listed
+  if (!fFound)
+      throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Sapling Output does not exist");
 
   return wit;
 
@@ -152,67 +154,56 @@ UniValue getsaplingwitnessatheight(const UniValue& params, bool fHelp,  const CP
   if (!saplingActive)
       throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Sapling not active");
 
+  if (toHeight > chainActive.Height())
+      throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range");
+
   //Get the blocckindex of the previous block
   CBlockIndex* pblockindex = chainActive[nHeight];
 
   //Get the sapling tree as of the previous block
   SaplingMerkleTree saplingTree;
   auto witness = saplingTree.witness();
-  pcoinsTip->GetSaplingAnchorAt(pblockindex->pprev->hashFinalSaplingRoot, saplingTree);
-
-  //Cycle through block and transactions build sapling tree until the commitment needed is reached
-  CBlock pblock;
-  ReadBlockFromDisk(pblock, pblockindex, false);
-  for (const CTransaction& tx : pblock.vtx) {
-      auto hash = tx.GetHash();
-
-      //Check if output exists
-      if (hash == ctxhash && (tx.vShieldedOutput.size() == 0 || tx.vShieldedOutput.size() < nSheildedOutputIndex + 1))
-          throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Sapling Output does not exist");
-
-      for (int64_t i = 0; i < tx.vShieldedOutput.size(); i++) {
-          const uint256& note_commitment = tx.vShieldedOutput[i].cm;
+  if (!GetSaplingTreeAfter(pblockindex->pprev, saplingTree))
+      throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't get the Sapling tree of the previous block");
+
+  //Cycle through the block's note commitments, building the sapling tree until the commitment needed is reached
+  std::vector<CSaplingBlockCommitments> vCommitments;
+  if (!ReadSaplingCommitments(pblockindex, 1, vCommitments) || vCommitments.empty())
+      throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read the Sapling commitments of the block");
+  bool fFound = false;
+  for (const CSaplingTxCommitments& ctx : vCommitments[0].vtx) {
+      for (int64_t i = 0; i < ctx.cmus.size(); i++) {
+          const uint256& note_commitment = ctx.cmus[i];
+          if (fFound) {
+            witness.append(note_commitment);
+            continue;
+          }
           saplingTree.append(note_commitment);
-          if (hash == ctxhash && i == nSheildedOutputIndex) {
+          if (ctx.txid == ctxhash && i == nSheildedOutputIndex) {
             witness = saplingTree.witness();
-          }
-          if (hash == ctxhash && i > nSheildedOutputIndex) {
-            witness.append(note_commitment);
+            fFound = true;
           }
       }
   }
-
-
-  for (int64_t j = nHeight + 1; j <= toHeight; j++) {
-    UniValue jsonblock(UniValue::VOBJ);
-    std::string strHash = chainActive[j]->GetBlockHash().GetHex();
-
-    uint256 hash(uint256S(strHash));
-
-    CBlock block;
-    CBlockIndex* pblockindex = mapBlockIndex[hash];
-
-    if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
-        throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
-
-    if(!ReadBlockFromDisk(block, pblockindex, false))
-        throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
-
-
-    // UniValue jsontxs(UniValue::VARR);
-    for (const CTransaction& tx : block.vtx) {
-      for (int64_t i = 0; i < tx.vShieldedOutput.size(); i++) {
-        const uint256& note_commitment = tx.vShieldedOutput[i].cm;
-        saplingTree.append(note_commitment);
-        witness.append(note_commitment);
-      }
+  if (!fFound)
+      throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Sapling Output does not exist");
+
+  //The commitment lists of the following blocks are read a batch at a time, no block is read
+  static const int WITNESS_COMMITMENTS_BATCH = 1000;
+  for (int64_t j = nHeight + 1; j <= toHeight; j += WITNESS_COMMITMENTS_BATCH) {
+    if (!ReadSaplingCommitments(chainActive[j], std::min<int64_t>(WITNESS_COMMITMENTS_BATCH, toHeight - j + 1), vCommitments))
+      throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read the Sapling commitments of the blocks");
+    for (const CSaplingBlockCommitments& commitments : vCommitments) {
+      std::vector<uint256> vBlockCommitments = commitments.GetCommitments();
+      witness.append_batch(std::vector<libzcash::PedersenHash>(vBlockCommitments.begin(), vBlockCommitments.end()));
     }
+  }
 
-    if (j == toHeight) {
-      wit.push_back(Pair("hash", block.GetHash().GetHex()));
-      wit.push_back(Pair("height", j));
-      wit.push_back(Pair("finalsaplingroot", block.hashFinalSaplingRoot.GetHex()));
-    }
+  if (toHeight > nHeight) {
+    CBlockIndex* pindexTo = chainActive[toHeight];
+    wit.push_back(Pair("hash", pindexTo->GetBlockHash().GetHex()));
+    wit.push_back(Pair("height", toHeight));
+    wit.push_back(Pair("finalsaplingroot", pindexTo->hashFinalSaplingRoot.GetHex()));
   }
 
   CDataStream iss(SER_NETWORK, PROTOCOL_VERSION);
@@ -0,0 +1,223 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_WALLET_WITNESSCACHE_H
+#define BITCOIN_WALLET_WITNESSCACHE_H
+
+#include "memusage.h"
+#include "serialize.h"
+#include "uint256.h"
+
+#include <list>
+#include <vector>
+
+//! A full witness is kept every this many blocks in a note's witness cache
+static const size_t WITNESS_CACHE_CHECKPOINT_INTERVAL = 10;
+
+/**
+ * The cached witnesses of a note, newest first, as used by std::list before.
+ *
+ * Instead of a full copy of the witness per block, the cache keeps a full
+ * witness (checkpoint) every WITNESS_CACHE_CHECKPOINT_INTERVAL blocks and
+ * for the blocks in between only the note commitments that were appended.
+ * Any cached witness can be rebuilt from the checkpoint before it, which is
+ * only needed when a reorg drops the newest ones. The newest witness is kept
+ * in full as well, as it is advanced and read on every block.
+ */
+template<typename Witness>
+class NoteWitnessCache
+{
+private:
+    struct Checkpoint {
+        Witness witness;
+        //! Commitments of each block after the checkpoint, oldest first
+        std::vector<std::vector<uint256>> vBlocks;
+
+        ADD_SERIALIZE_METHODS;
+
+        template <typename Stream, typename Operation>
+        inline void SerializationOp(Stream& s, Operation ser_action) {
+            READWRITE(witness);
+            READWRITE(vBlocks);
+        }
+
+        friend bool operator==(const Checkpoint& a, const Checkpoint& b) {
+            return a.witness == b.witness && a.vBlocks == b.vBlocks;
+        }
+    };
+
+    //! Newest checkpoint first
+    std::list<Checkpoint> checkpoints;
+    //! The newest witness, valid unless the cache is empty
+    Witness newest;
+    size_t nSize = 0;
+
+    void RebuildNewest() {
+        if (checkpoints.empty())
+            return;
+        const Checkpoint& front = checkpoints.front();
+        newest = front.witness;
+        for (const std::vector<uint256>& vCommitments : front.vBlocks) {
+            for (const uint256& commitment : vCommitments) {
+                newest.append(commitment);
+            }
+        }
+    }
+
+public:
+    bool empty() const { return nSize == 0; }
+    size_t size() const { return nSize; }
+
+    const Witness& front() const { return newest; }
+
+    size_t DynamicMemoryUsage() const {
+        size_t nUsage = memusage::DynamicUsage(checkpoints) + newest.DynamicMemoryUsage();
+        for (const Checkpoint& checkpoint : checkpoints) {
+            nUsage += checkpoint.witness.DynamicMemoryUsage() + memusage::DynamicUsage(checkpoint.vBlocks);
+            for (const std::vector<uint256>& vCommitments : checkpoint.vBlocks)
+                nUsage += memusage::DynamicUsage(vCommitments);
+        }
+        return nUsage;
+    }
+
+    void clear() {
+        checkpoints.clear();
+        newest = Witness();
+        nSize = 0;
+    }
+
+    //! Adds a witness that is not derived from the cached ones
+    void push_front(const Witness& witness) {
+        Checkpoint checkpoint;
+        checkpoint.witness = witness;
+        checkpoints.push_front(checkpoint);
+        newest = witness;
+        nSize++;
+    }
+
+    //! Appends a commitment of the current block to the newest witness
+    void append_front(const uint256& commitment) {
+        if (checkpoints.empty())
+            return;
+        newest.append(commitment);
+        Checkpoint& front = checkpoints.front();
+        if (front.vBlocks.empty())
+            front.witness = newest;
+        else
+            front.vBlocks.back().push_back(commitment);
+    }
+
+    //! Caches the witness of the next block, the newest witness with the block's commitments appended
+    void advance(const std::vector<uint256>& vCommitments) {
+        if (checkpoints.empty())
+            return;
+        for (const uint256& commitment : vCommitments) {
+            newest.append(commitment);
+        }
+        if (checkpoints.front().vBlocks.size() + 1 >= WITNESS_CACHE_CHECKPOINT_INTERVAL) {
+            Checkpoint checkpoint;
+            checkpoint.witness = newest;
+            checkpoints.push_front(checkpoint);
+        } else {
+            checkpoints.front().vBlocks.push_back(vCommitments);
+        }
+        nSize++;
+    }
+
+    //! Drops the newest witness
+    void pop_front() {
+        if (checkpoints.empty())
+            return;
+        if (checkpoints.front().vBlocks.empty())
+            checkpoints.pop_front();
+        else
+            checkpoints.front().vBlocks.pop_back();
+        nSize--;
+        RebuildNewest();
+    }
+
+    /**
+     * Drops old witnesses while at least nKeep remain. Witnesses leave a
+     * checkpoint at a time, so up to WITNESS_CACHE_CHECKPOINT_INTERVAL - 1
+     * more may be kept.
+     */
+    void trim(size_t nKeep) {
+        while (!checkpoints.empty()) {
+            size_t nBack = checkpoints.back().vBlocks.size() + 1;
+            if (nSize - nBack < nKeep)
+                break;
+            checkpoints.pop_back();
+            nSize -= nBack;
+        }
+    }
+
+    //! Keeps the newest n witnesses, or at least n of them for n > 1 (see trim)
+    void resize(size_t n) {
+        if (n >= nSize)
+            return;
+        if (n == 0) {
+            clear();
+        } else if (n == 1) {
+            Witness witness = newest;
+            clear();
+            push_front(witness);
+        } else {
+            trim(n);
+        }
+    }
+
+    //! All cached witnesses, newest first
+    std::list<Witness> to_list() const {
+        std::list<Witness> witnesses;
+        for (const Checkpoint& checkpoint : checkpoints) {
+            std::list<Witness> vCheckpointWitnesses;
+            Witness witness = checkpoint.witness;
+            vCheckpointWitnesses.push_front(witness);
+            for (const std::vector<uint256>& vCommitments : checkpoint.vBlocks) {
+                for (const uint256& commitment : vCommitments) {
+                    witness.append(commitment);
+                }
+                vCheckpointWitnesses.push_front(witness);
+            }
+            witnesses.splice(witnesses.end(), vCheckpointWitnesses);
+        }
+        return witnesses;
+    }
+
+    //! Replaces the cache with full witnesses, newest first, as stored by older versions
+    void from_list(const std::list<Witness>& witnesses) {
+        clear();
+        for (typename std::list<Witness>::const_reverse_iterator it = witnesses.rbegin(); it != witnesses.rend(); ++it) {
+            push_front(*it);
+        }
+    }
+
+    template<typename Stream>
+    void Serialize(Stream& s) const {
+        ::Serialize(s, checkpoints);
+        if (!checkpoints.empty() && !checkpoints.front().vBlocks.empty())
+            ::Serialize(s, newest);
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s) {
+        clear();
+        ::Unserialize(s, checkpoints);
+        for (const Checkpoint& checkpoint : checkpoints) {
+            nSize += checkpoint.vBlocks.size() + 1;
+        }
+        if (!checkpoints.empty()) {
+            if (checkpoints.front().vBlocks.empty())
+                newest = checkpoints.front().witness;
+            else
+                ::Unserialize(s, newest);
+        }
+    }
+
+    friend bool operator==(const NoteWitnessCache& a, const NoteWitnessCache& b) {
+        return a.nSize == b.nSize && a.checkpoints == b.checkpoints;
+    }
+};
+
+#endif // BITCOIN_WALLET_WITNESSCACHE_H
@@ -1,10 +1,13 @@
+#include <algorithm>
 #include <stdexcept>
+#include <thread>
 
 #include <boost/foreach.hpp>
 
 #include "zcash/IncrementalMerkleTree.hpp"
 #include "crypto/sha256.h"
 #include "zcash/util.h"
+#include "util/parallel.h"
 #include "librustzcash.h"
 
 namespace libzcash {
@@ -27,6 +30,32 @@ PedersenHash PedersenHash::combine(
     return res;
 }
 
+// Pedersen hashes are slow enough for a thread to pay off from a few pairs
+static const size_t PEDERSEN_ROW_MIN_PAIRS_PER_THREAD = 16;
+
+void PedersenHash::combine_row(
+    const std::vector<PedersenHash>& row,
+    size_t depth,
+    std::vector<PedersenHash>& out
+)
+{
+    size_t pairs = row.size() / 2;
+    out.resize(pairs);
+
+    size_t threads = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()),
+                                      pairs / PEDERSEN_ROW_MIN_PAIRS_PER_THREAD);
+    ParallelForRanges(pairs, threads, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            librustzcash_merkle_hash(
+                depth,
+                row[2*i].begin(),
+                row[2*i+1].begin(),
+                out[i].begin()
+            );
+        }
+    });
+}
+
 PedersenHash PedersenHash::uncommitted() {
     PedersenHash res = PedersenHash();
 
@@ -51,6 +80,18 @@ SHA256Compress SHA256Compress::combine(
     return res;
 }
 
+void SHA256Compress::combine_row(
+    const std::vector<SHA256Compress>& row,
+    size_t depth,
+    std::vector<SHA256Compress>& out
+)
+{
+    out.resize(row.size() / 2);
+    for (size_t i = 0; i < out.size(); i++) {
+        out[i] = combine(row[2*i], row[2*i+1], depth);
+    }
+}
+
 template <size_t Depth, typename Hash>
 class PathFiller {
 private:
@@ -168,6 +209,56 @@ void IncrementalMerkleTree<Depth, Hash>::append(Hash obj) {
 // This is for allowing the witness to determine if a subtree has filled
 // to a particular depth, or for append() to ensure we're not appending
 // to a full tree.
+template<size_t Depth, typename Hash>
+void IncrementalMerkleTree<Depth, Hash>::append_batch(const std::vector<Hash>& objs) {
+    if (objs.empty()) {
+        return;
+    }
+    if (size() + objs.size() > (size_t(1) << Depth)) {
+        throw std::runtime_error("tree is full");
+    }
+
+    // The leaves not yet folded into the parents, starting at an even
+    // position of the tree
+    std::vector<Hash> row;
+    row.reserve(objs.size() + 2);
+    if (left) {
+        row.push_back(*left);
+    }
+    if (right) {
+        row.push_back(*right);
+    }
+    row.insert(row.end(), objs.begin(), objs.end());
+
+    // The last one or two leaves stay unfolded, as after append()
+    size_t keep = (row.size() % 2 == 1) ? 1 : 2;
+    left = row[row.size() - keep];
+    right = boost::none;
+    if (keep == 2) {
+        right = row.back();
+    }
+    row.resize(row.size() - keep);
+
+    std::vector<Hash> next;
+    for (size_t d = 0; !row.empty(); d++) {
+        // Hash the nodes of depth d into those of depth d+1, which start
+        // with the collapsed left sibling when there is one
+        Hash::combine_row(row, d, next);
+        row.swap(next);
+        if (d < parents.size() && parents[d]) {
+            row.insert(row.begin(), *parents[d]);
+            parents[d] = boost::none;
+        }
+        if (row.size() % 2 == 1) {
+            if (d >= parents.size()) {
+                parents.resize(d + 1);
+            }
+            parents[d] = row.back();
+            row.pop_back();
+        }
+    }
+}
+
 template<size_t Depth, typename Hash>
 bool IncrementalMerkleTree<Depth, Hash>::is_complete(size_t depth) const {
     if (!left || !right) {
@@ -348,6 +439,28 @@ void IncrementalWitness<Depth, Hash>::append(Hash obj) {
     }
 }
 
+template<size_t Depth, typename Hash>
+void IncrementalWitness<Depth, Hash>::append_batch(const std::vector<Hash>& objs) {
+    size_t i = 0;
+    while (i < objs.size()) {
+        if (!cursor) {
+            append(objs[i++]);
+            continue;
+        }
+
+        // Fill the cursor at once, up to the leaves it still has room for
+        size_t room = (size_t(1) << cursor_depth) - cursor->size();
+        size_t n = std::min(room, objs.size() - i);
+        cursor->append_batch(std::vector<Hash>(objs.begin() + i, objs.begin() + i + n));
+        i += n;
+
+        if (cursor->is_complete(cursor_depth)) {
+            filled.push_back(cursor->root(cursor_depth));
+            cursor = boost::none;
+        }
+    }
+}
+
 template class IncrementalMerkleTree<INCREMENTAL_MERKLE_TREE_DEPTH, SHA256Compress>;
 template class IncrementalMerkleTree<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, SHA256Compress>;
 
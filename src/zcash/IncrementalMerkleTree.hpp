@@ -101,6 +101,9 @@ public:
     size_t size() const;
 
     void append(Hash obj);
+    // Same as appending each of objs in turn, hashing each level of the
+    // new nodes as one row
+    void append_batch(const std::vector<Hash>& objs);
     Hash root() const {
         return root(Depth, std::deque<Hash>());
     }
@@ -179,6 +182,13 @@ public:
     }
 
     void append(Hash obj);
+    void append_batch(const std::vector<Hash>& objs);
+
+    size_t DynamicMemoryUsage() const {
+        return tree.DynamicMemoryUsage() +
+               filled.size() * 32 + // filled
+               (cursor ? cursor->DynamicMemoryUsage() : 0); // cursor
+    }
 
     ADD_SERIALIZE_METHODS;
 
@@ -224,6 +234,13 @@ public:
         size_t depth
     );
 
+    // Combines each pair of row into out
+    static void combine_row(
+        const std::vector<SHA256Compress>& row,
+        size_t depth,
+        std::vector<SHA256Compress>& out
+    );
+
     static SHA256Compress uncommitted() {
         return SHA256Compress();
     }
@@ -240,6 +257,13 @@ public:
         size_t depth
     );
 
+    // Combines each pair of row into out, on several threads for long rows
+    static void combine_row(
+        const std::vector<PedersenHash>& row,
+        size_t depth,
+        std::vector<PedersenHash>& out
+    );
+
     static PedersenHash uncommitted();
 };
 
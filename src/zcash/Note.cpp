@@ -190,23 +190,18 @@ boost::optional<SaplingOutgoingPlaintext> SaplingOutgoingPlaintext::decrypt(
     }
 }
 
-boost::optional<SaplingNotePlaintext> SaplingNotePlaintext::decrypt(
-    const SaplingEncCiphertext &ciphertext,
+//! Note of the plaintext of an incoming ciphertext, if it is the one committed to by cmu
+static boost::optional<SaplingNotePlaintext> IncomingNotePlaintext(
+    const SaplingEncPlaintext &pt,
     const uint256 &ivk,
-    const uint256 &epk,
     const uint256 &cmu
 )
 {
-    auto pt = AttemptSaplingEncDecryption(ciphertext, ivk, epk);
-    if (!pt) {
-        return boost::none;
-    }
-
     // Deserialize from the plaintext
     SaplingNotePlaintext ret;
     try {
         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-        ss << pt.get();
+        ss << pt;
         ss >> ret;
         assert(ss.size() == 0);
     } catch (const boost::thread_interrupted&) {
@@ -239,6 +234,37 @@ boost::optional<SaplingNotePlaintext> SaplingNotePlaintext::decrypt(
     return ret;
 }
 
+boost::optional<SaplingNotePlaintext> SaplingNotePlaintext::decrypt(
+    const SaplingEncCiphertext &ciphertext,
+    const uint256 &ivk,
+    const uint256 &epk,
+    const uint256 &cmu
+)
+{
+    auto pt = AttemptSaplingEncDecryption(ciphertext, ivk, epk);
+    if (!pt) {
+        return boost::none;
+    }
+    return IncomingNotePlaintext(pt.get(), ivk, cmu);
+}
+
+std::vector<std::pair<size_t, SaplingNotePlaintext>> SaplingNotePlaintext::decrypt_batch(
+    const SaplingEncCiphertext &ciphertext,
+    const std::vector<uint256> &ivks,
+    const uint256 &epk,
+    const uint256 &cmu
+)
+{
+    std::vector<std::pair<size_t, SaplingNotePlaintext>> ret;
+    for (const std::pair<size_t, SaplingEncPlaintext>& match : AttemptSaplingEncDecryption(ciphertext, ivks, epk)) {
+        auto note = IncomingNotePlaintext(match.second, ivks[match.first], cmu);
+        if (note) {
+            ret.push_back(std::make_pair(match.first, note.get()));
+        }
+    }
+    return ret;
+}
+
 boost::optional<SaplingNotePlaintext> SaplingNotePlaintext::decrypt(
     const SaplingEncCiphertext &ciphertext,
     const uint256 &epk,
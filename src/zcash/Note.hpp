@@ -142,6 +142,15 @@ public:
         const uint256 &cmu
     );
 
+    // Plaintexts of the note under each of ivks that decrypts it, with the
+    // index of the key
+    static std::vector<std::pair<size_t, SaplingNotePlaintext>> decrypt_batch(
+        const SaplingEncCiphertext &ciphertext,
+        const std::vector<uint256> &ivks,
+        const uint256 &epk,
+        const uint256 &cmu
+    );
+
     boost::optional<SaplingNote> note(const SaplingIncomingViewingKey& ivk) const;
 
     virtual ~SaplingNotePlaintext() {}
@@ -187,6 +187,61 @@ boost::optional<SaplingEncPlaintext> AttemptSaplingEncDecryption(
     return plaintext;
 }
 
+std::vector<std::pair<size_t, SaplingEncPlaintext>> AttemptSaplingEncDecryption(
+    const SaplingEncCiphertext &ciphertext,
+    const std::vector<uint256> &ivks,
+    const uint256 &epk
+)
+{
+    std::vector<std::pair<size_t, SaplingEncPlaintext>> matches;
+
+    // KDF_Sapling of each key agreement, from a state that is past the
+    // personalization
+    unsigned char personalization[crypto_generichash_blake2b_PERSONALBYTES] = {};
+    memcpy(personalization, "Zcash_SaplingKDF", 16);
+    crypto_generichash_blake2b_state kdf_state;
+    if (crypto_generichash_blake2b_init_salt_personal(&kdf_state,
+                                                      NULL, 0, // No key.
+                                                      NOTEENCRYPTION_CIPHER_KEYSIZE,
+                                                      NULL,    // No salt.
+                                                      personalization
+                                                     ) != 0)
+    {
+        throw std::logic_error("hash function failure");
+    }
+
+    // The nonce is zero because we never reuse keys
+    unsigned char cipher_nonce[crypto_aead_chacha20poly1305_IETF_NPUBBYTES] = {};
+
+    for (size_t i = 0; i < ivks.size(); i++) {
+        uint256 dhsecret;
+        if (!librustzcash_sapling_ka_agree(epk.begin(), ivks[i].begin(), dhsecret.begin())) {
+            continue;
+        }
+
+        // Construct the symmetric key
+        unsigned char K[NOTEENCRYPTION_CIPHER_KEYSIZE];
+        crypto_generichash_blake2b_state state = kdf_state;
+        crypto_generichash_blake2b_update(&state, dhsecret.begin(), 32);
+        crypto_generichash_blake2b_update(&state, epk.begin(), 32);
+        crypto_generichash_blake2b_final(&state, K, NOTEENCRYPTION_CIPHER_KEYSIZE);
+
+        SaplingEncPlaintext plaintext;
+        if (crypto_aead_chacha20poly1305_ietf_decrypt(
+            plaintext.begin(), NULL,
+            NULL,
+            ciphertext.begin(), ZC_SAPLING_ENCCIPHERTEXT_SIZE,
+            NULL,
+            0,
+            cipher_nonce, K) == 0)
+        {
+            matches.push_back(std::make_pair(i, plaintext));
+        }
+    }
+
+    return matches;
+}
+
 boost::optional<SaplingEncPlaintext> AttemptSaplingEncDecryption (
     const SaplingEncCiphertext &ciphertext,
     const uint256 &epk,
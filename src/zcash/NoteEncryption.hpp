@@ -73,6 +73,16 @@ boost::optional<SaplingEncPlaintext> AttemptSaplingEncDecryption(
     const uint256 &epk
 );
 
+// Attempts to decrypt a Sapling note with each of ivks, returning the index of
+// every key that decrypts it and its plaintext. The ephemeral key and the KDF
+// personalization are only set up once. This will not check that the contents
+// of the ciphertext are correct.
+std::vector<std::pair<size_t, SaplingEncPlaintext>> AttemptSaplingEncDecryption(
+    const SaplingEncCiphertext &ciphertext,
+    const std::vector<uint256> &ivks,
+    const uint256 &epk
+);
+
 // Attempts to decrypt a Sapling note using outgoing plaintext.
 // This will not check that the contents of the ciphertext are correct.
 boost::optional<SaplingEncPlaintext> AttemptSaplingEncDecryption (
@@ -7,12 +7,15 @@
 #include "hash.h"
 #include "random.h"
 #include "streams.h"
+#include "util/parallel.h"
 #include "version.h"
 #include "zcash/prf.h"
 
 #include <librustzcash.h>
 #include <sodium.h>
 
+#include <algorithm>
+
 const unsigned char ZCASH_HD_SEED_FP_PERSONAL[crypto_generichash_blake2b_PERSONALBYTES] =
     {'Z', 'c', 'a', 's', 'h', '_', 'H', 'D', '_', 'S', 'e', 'e', 'd', '_', 'F', 'P'};
 
@@ -146,6 +149,30 @@ SaplingExtendedSpendingKey SaplingExtendedSpendingKey::Derive(uint32_t i) const
     return xsk_i;
 }
 
+std::vector<SaplingExtendedSpendingKey> SaplingExtendedSpendingKey::DeriveRange(
+    uint32_t i,
+    uint32_t nCount,
+    int nThreads,
+    std::vector<libzcash::SaplingPaymentAddress>* pvDefaultAddrs) const
+{
+    std::vector<SaplingExtendedSpendingKey> vKeys(nCount);
+    if (pvDefaultAddrs) {
+        pvDefaultAddrs->resize(nCount);
+    }
+
+    // Each child only depends on the parent
+    ParallelForRanges(nCount, nThreads, [&](size_t nBegin, size_t nEnd) {
+        for (size_t n = nBegin; n < nEnd; n++) {
+            vKeys[n] = Derive(i + n);
+            if (pvDefaultAddrs) {
+                (*pvDefaultAddrs)[n] = vKeys[n].DefaultAddress();
+            }
+        }
+    });
+
+    return vKeys;
+}
+
 SaplingExtendedFullViewingKey SaplingExtendedSpendingKey::ToXFVK() const
 {
     SaplingExtendedFullViewingKey ret;
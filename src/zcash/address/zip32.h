@@ -118,6 +118,15 @@ struct SaplingExtendedSpendingKey {
     static SaplingExtendedSpendingKey Master(const HDSeed& seed);
 
     SaplingExtendedSpendingKey Derive(uint32_t i) const;
+    // Derives the children i to i + nCount - 1, split across up to nThreads
+    // threads; i includes the hardened bit when wanted. The default address
+    // of each child, which costs more than the derivation, is computed on the
+    // same threads when pvDefaultAddrs is given.
+    std::vector<SaplingExtendedSpendingKey> DeriveRange(
+        uint32_t i,
+        uint32_t nCount,
+        int nThreads,
+        std::vector<libzcash::SaplingPaymentAddress>* pvDefaultAddrs = nullptr) const;
 
     SaplingExtendedFullViewingKey ToXFVK() const;
 
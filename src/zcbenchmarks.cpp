@@ -10,7 +10,9 @@
 #include "init.h"
 #include "primitives/transaction.h"
 #include "base58.h"
+#include "crypto/common.h"
 #include "crypto/equihash.h"
+#include "crypto/verus_hash.h"
 #include "chain.h"
 #include "chainparams.h"
 #include "consensus/upgrades.h"
@@ -22,6 +24,7 @@
 #include "script/sign.h"
 #include "sodium.h"
 #include "streams.h"
+#include "transaction_builder.h"
 #include "txdb.h"
 #include "utiltest.h"
 #include "wallet/wallet.h"
@@ -214,14 +217,96 @@ std::vector<double> benchmark_solve_equihash_threaded(int nThreads)
 }
 #endif // ENABLE_MINING
 
-double benchmark_verify_equihash()
+// Checks the solution itself, CheckEquihashSolution would find it in its cache after the first sample
+double benchmark_verify_equihash(bool fMultiWay)
 {
     CChainParams params = Params(CBaseChainParams::MAIN);
     CBlock genesis = Params(CBaseChainParams::MAIN).GenesisBlock();
     CBlockHeader genesis_header = genesis.GetBlockHeader();
+    unsigned int n = params.EquihashN();
+    unsigned int k = params.EquihashK();
+    CEquihashInput I{genesis_header};
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << I;
+    ss << genesis_header.nNonce;
+
+    bool isValid;
+    struct timeval tv_start;
+    timer_start(tv_start);
+    EhLeafHasher leaves;
+    if (fMultiWay && leaves.Initialise(n, k, (unsigned char*)&ss[0], ss.size())) {
+        EhIsValidSolutionLeaves(n, k, leaves, genesis_header.nSolution, isValid);
+    } else {
+        crypto_generichash_blake2b_state state;
+        EhInitialiseState(n, k, state);
+        crypto_generichash_blake2b_update(&state, (unsigned char*)&ss[0], ss.size());
+        EhIsValidSolution(n, k, state, genesis_header.nSolution, isValid);
+    }
+    assert(isValid);
+    return timer_stop(tv_start);
+}
+
+double benchmark_verify_equihash_batch(size_t nHeaders)
+{
+    CBlock genesis = Params(CBaseChainParams::MAIN).GenesisBlock();
+    std::vector<CBlockHeader> headers(nHeaders, genesis.GetBlockHeader());
+    std::vector<const CBlockHeader*> vHeaders;
+    for (const CBlockHeader& header : headers) {
+        vHeaders.push_back(&header);
+    }
+    struct timeval tv_start;
+    timer_start(tv_start);
+    CheckEquihashSolutions(vHeaders);
+    return timer_stop(tv_start);
+}
+
+// Single threaded, so nHashes over the running time is the hash rate of one core
+double benchmark_verushash(size_t nHashes, bool fBatch)
+{
+    CBlock genesis = Params(CBaseChainParams::MAIN).GenesisBlock();
+    CVerusHashV2Writer ss(SER_GETHASH, PROTOCOL_VERSION);
+    ss << genesis.GetBlockHeader();
+    CVerusHashV2 &vh = ss.GetState();
+    vh.ClearExtra();
+
+    alignas(16) unsigned char hashes[VERUSHASH_EXTRA_BATCH * 32];
     struct timeval tv_start;
     timer_start(tv_start);
-    CheckEquihashSolution(&genesis_header, params);
+    if (fBatch) {
+        for (size_t i = 0; i < nHashes; i += VERUSHASH_EXTRA_BATCH) {
+            vh.ExtraHashBatch(hashes, i);
+        }
+    } else {
+        for (size_t i = 0; i < nHashes; i++) {
+            *vh.ExtraI64Ptr() = i;
+            vh.ExtraHash(hashes);
+        }
+    }
+    return timer_stop(tv_start);
+}
+
+// nCommitments added to an empty Sapling tree, one at a time or as one batch as ConnectBlock does
+double benchmark_append_sapling_commitments(size_t nCommitments, bool fBatch)
+{
+    std::vector<libzcash::PedersenHash> vCommitments;
+    for (size_t i = 0; i < nCommitments; i++) {
+        uint256 cm;
+        // Small values are valid Jubjub base field elements
+        WriteLE32(cm.begin(), i & 0xffffff);
+        vCommitments.push_back(cm);
+    }
+
+    SaplingMerkleTree tree;
+    struct timeval tv_start;
+    timer_start(tv_start);
+    if (fBatch) {
+        tree.append_batch(vCommitments);
+    } else {
+        for (const libzcash::PedersenHash& cm : vCommitments) {
+            tree.append(cm);
+        }
+    }
+    tree.root();
     return timer_stop(tv_start);
 }
 
@@ -630,3 +715,40 @@ double benchmark_verify_sapling_output()
     }
     return timer_stop(tv_start);
 }
+
+// Build a transaction spending one Sapling note into nOutputs Sapling outputs
+double benchmark_build_sapling_tx(size_t nOutputs, int nThreads)
+{
+    auto sk = libzcash::SaplingSpendingKey::random();
+    auto expsk = sk.expanded_spending_key();
+    auto fvk = expsk.full_viewing_key();
+    auto address = sk.default_address();
+
+    CAmount fee = 10000;
+    SaplingNote note(address, nOutputs * COIN + fee);
+    SaplingMerkleTree tree;
+    auto maybe_cm = note.cm();
+    if (!maybe_cm) {
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Could not create note commitment");
+    }
+    tree.append(maybe_cm.get());
+    auto anchor = tree.root();
+    auto witness = tree.witness();
+
+    auto builder = TransactionBuilder(Params().GetConsensus(), chainActive.Height() + 1);
+    builder.SetFee(fee);
+    builder.SetThreads(nThreads);
+    builder.AddSaplingSpend(expsk, note, anchor, witness);
+    for (size_t i = 0; i < nOutputs; i++) {
+        builder.AddSaplingOutput(fvk.ovk, sk.default_address(), COIN);
+    }
+
+    struct timeval tv_start;
+    timer_start(tv_start);
+    auto maybe_tx = builder.Build();
+    double t = timer_stop(tv_start);
+    if (!maybe_tx) {
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "TransactionBuilder::Build() failed");
+    }
+    return t;
+}
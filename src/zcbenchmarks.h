@@ -11,7 +11,10 @@ extern std::vector<double> benchmark_create_joinsplit_threaded(int nThreads);
 extern double benchmark_solve_equihash();
 extern std::vector<double> benchmark_solve_equihash_threaded(int nThreads);
 extern double benchmark_verify_joinsplit(const JSDescription &joinsplit);
-extern double benchmark_verify_equihash();
+extern double benchmark_verify_equihash(bool fMultiWay);
+extern double benchmark_verify_equihash_batch(size_t nHeaders);
+extern double benchmark_verushash(size_t nHashes, bool fBatch);
+extern double benchmark_append_sapling_commitments(size_t nCommitments, bool fBatch);
 extern double benchmark_large_tx(size_t nInputs);
 extern double benchmark_try_decrypt_notes(size_t nAddrs);
 extern double benchmark_increment_note_witnesses(size_t nTxs);
@@ -23,5 +26,6 @@ extern double benchmark_create_sapling_spend();
 extern double benchmark_create_sapling_output();
 extern double benchmark_verify_sapling_spend();
 extern double benchmark_verify_sapling_output();
+extern double benchmark_build_sapling_tx(size_t nOutputs, int nThreads);
 
 #endif
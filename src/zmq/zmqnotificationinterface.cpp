@@ -4,18 +4,24 @@
 
 #include "zmqnotificationinterface.h"
 #include "zmqpublishnotifier.h"
+#include "zmqsender.h"
 
 #include "version.h"
 #include "main.h"
 #include "streams.h"
 #include "util.h"
+#ifdef ENABLE_WALLET
+#include "wallet/wallet.h"
+#endif
+
+#include <boost/bind.hpp>
 
 void zmqError(const char *str)
 {
     LogPrint("zmq", "zmq: Error: %s, errno=%s\n", str, zmq_strerror(errno));
 }
 
-CZMQNotificationInterface::CZMQNotificationInterface() : pcontext(NULL)
+CZMQNotificationInterface::CZMQNotificationInterface() : pcontext(NULL), psender(NULL)
 {
 }
 
@@ -27,6 +33,11 @@ CZMQNotificationInterface::~CZMQNotificationInterface()
     {
         delete *i;
     }
+    for (std::list<CZMQAbstractNotifier*>::iterator i=walletNotifiers.begin(); i!=walletNotifiers.end(); ++i)
+    {
+        delete *i;
+    }
+    delete psender;
 }
 
 CZMQNotificationInterface* CZMQNotificationInterface::CreateWithArguments(const std::map<std::string, std::string> &args)
@@ -40,6 +51,11 @@ CZMQNotificationInterface* CZMQNotificationInterface::CreateWithArguments(const
     factories["pubrawblock"] = CZMQAbstractNotifier::Create<CZMQPublishRawBlockNotifier>;
     factories["pubrawtx"] = CZMQAbstractNotifier::Create<CZMQPublishRawTransactionNotifier>;
     factories["pubcheckedblock"] = CZMQAbstractNotifier::Create<CZMQPublishCheckedBlockNotifier>;
+#ifdef ENABLE_WALLET
+    factories["pubwalletnote"] = CZMQAbstractNotifier::Create<CZMQPublishWalletNoteNotifier>;
+    factories["pubwalletspend"] = CZMQAbstractNotifier::Create<CZMQPublishWalletSpendNotifier>;
+    factories["pubwalletconfirm"] = CZMQAbstractNotifier::Create<CZMQPublishWalletConfirmNotifier>;
+#endif
 
     for (std::map<std::string, CZMQNotifierFactory>::const_iterator i=factories.begin(); i!=factories.end(); ++i)
     {
@@ -58,7 +74,19 @@ CZMQNotificationInterface* CZMQNotificationInterface::CreateWithArguments(const
     if (!notifiers.empty())
     {
         notificationInterface = new CZMQNotificationInterface();
-        notificationInterface->notifiers = notifiers;
+        for (std::list<CZMQAbstractNotifier*>::iterator i=notifiers.begin(); i!=notifiers.end(); ++i)
+        {
+            if ((*i)->GetType().compare(0, 9, "pubwallet") == 0)
+                notificationInterface->walletNotifiers.push_back(*i);
+            else
+                notificationInterface->notifiers.push_back(*i);
+        }
+
+        int64_t nHighWaterMark = DEFAULT_ZMQ_HWM;
+        std::map<std::string, std::string>::const_iterator hwm = args.find("-zmqhwm");
+        if (hwm != args.end())
+            nHighWaterMark = atoi64(hwm->second);
+        notificationInterface->psender = new CZMQSender(std::max<int64_t>(nHighWaterMark, 1));
 
         if (!notificationInterface->Initialize())
         {
@@ -84,8 +112,10 @@ bool CZMQNotificationInterface::Initialize()
         return false;
     }
 
-    std::list<CZMQAbstractNotifier*>::iterator i=notifiers.begin();
-    for (; i!=notifiers.end(); ++i)
+    std::list<CZMQAbstractNotifier*> all(notifiers);
+    all.insert(all.end(), walletNotifiers.begin(), walletNotifiers.end());
+    std::list<CZMQAbstractNotifier*>::iterator i=all.begin();
+    for (; i!=all.end(); ++i)
     {
         CZMQAbstractNotifier *notifier = *i;
         if (notifier->Initialize(pcontext))
@@ -99,11 +129,25 @@ bool CZMQNotificationInterface::Initialize()
         }
     }
 
-    if (i!=notifiers.end())
+    if (i!=all.end())
     {
+        // Only the notifiers before the failed one have a socket to close
+        for (std::list<CZMQAbstractNotifier*>::iterator j=all.begin(); j!=i; ++j)
+            (*j)->Shutdown();
+        zmq_ctx_destroy(pcontext);
+        pcontext = 0;
         return false;
     }
 
+    // From here on the sockets are only used from the sender thread
+    for (i=all.begin(); i!=all.end(); ++i)
+    {
+        CZMQAbstractPublishNotifier *publisher = dynamic_cast<CZMQAbstractPublishNotifier*>(*i);
+        if (publisher)
+            publisher->SetSender(psender);
+    }
+    psender->Start();
+
     return true;
 }
 
@@ -111,9 +155,17 @@ bool CZMQNotificationInterface::Initialize()
 void CZMQNotificationInterface::Shutdown()
 {
     LogPrint("zmq", "zmq: Shutdown notification interface\n");
+    walletConnection.disconnect();
     if (pcontext)
     {
-        for (std::list<CZMQAbstractNotifier*>::iterator i=notifiers.begin(); i!=notifiers.end(); ++i)
+        // Sends what is still queued before the sockets go
+        psender->Stop();
+        LogPrint("zmq", "   Sent %u messages, dropped %u past the high-water mark\n", psender->GetSent(), psender->GetDropped());
+
+        boost::unique_lock<boost::mutex> lock(cs_walletNotifiers);
+        std::list<CZMQAbstractNotifier*> all(notifiers);
+        all.insert(all.end(), walletNotifiers.begin(), walletNotifiers.end());
+        for (std::list<CZMQAbstractNotifier*>::iterator i=all.begin(); i!=all.end(); ++i)
         {
             CZMQAbstractNotifier *notifier = *i;
             LogPrint("zmq", "   Shutdown notifier %s at %s\n", notifier->GetType(), notifier->GetAddress());
@@ -136,6 +188,8 @@ void CZMQNotificationInterface::UpdatedBlockTip(const CBlockIndex *pindex)
         }
         else
         {
+            // Its messages still queued go out before its socket closes
+            psender->Sync();
             notifier->Shutdown();
             i = notifiers.erase(i);
         }
@@ -157,6 +211,8 @@ void CZMQNotificationInterface::BlockChecked(const CBlock& block, const CValidat
         }
         else
         {
+            // Its messages still queued go out before its socket closes
+            psender->Sync();
             notifier->Shutdown();
             i = notifiers.erase(i);
         }
@@ -174,8 +230,32 @@ void CZMQNotificationInterface::SyncTransaction(const CTransaction &tx, const CB
         }
         else
         {
+            // Its messages still queued go out before its socket closes
+            psender->Sync();
             notifier->Shutdown();
             i = notifiers.erase(i);
         }
     }
 }
+
+#ifdef ENABLE_WALLET
+void CZMQNotificationInterface::RegisterWallet(CWallet *pwallet)
+{
+    if (walletNotifiers.empty())
+        return;
+    walletConnection = pwallet->NotifyShieldedEvent.connect(boost::bind(&CZMQNotificationInterface::WalletEvent, this, _1));
+}
+#endif
+
+void CZMQNotificationInterface::WalletEvent(const CWalletShieldedEvent &event)
+{
+    boost::unique_lock<boost::mutex> lock(cs_walletNotifiers);
+    if (!pcontext)
+        return;
+    for (std::list<CZMQAbstractNotifier*>::iterator i = walletNotifiers.begin(); i!=walletNotifiers.end(); ++i)
+    {
+        CZMQAbstractNotifier *notifier = *i;
+        if (!notifier->NotifyWalletEvent(event))
+            LogPrint("zmq", "zmq: Notifier %s failed to publish a wallet event\n", notifier->GetType());
+    }
+}
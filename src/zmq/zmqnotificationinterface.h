@@ -5,13 +5,23 @@
 #ifndef BITCOIN_ZMQ_ZMQNOTIFICATIONINTERFACE_H
 #define BITCOIN_ZMQ_ZMQNOTIFICATIONINTERFACE_H
 
+#if defined(HAVE_CONFIG_H)
+#include "config/bitcoin-config.h"
+#endif
+
 #include "validationinterface.h"
 #include "consensus/validation.h"
 #include <string>
 #include <map>
 
+#include <boost/signals2/connection.hpp>
+#include <boost/thread/mutex.hpp>
+
 class CBlockIndex;
+class CWallet;
 class CZMQAbstractNotifier;
+class CZMQSender;
+struct CWalletShieldedEvent;
 
 class CZMQNotificationInterface : public CValidationInterface
 {
@@ -20,6 +30,11 @@ public:
 
     static CZMQNotificationInterface* CreateWithArguments(const std::map<std::string, std::string> &args);
 
+#ifdef ENABLE_WALLET
+    //! Publish the events of the wallet on the wallet topics
+    void RegisterWallet(CWallet *pwallet);
+#endif
+
 protected:
     bool Initialize();
     void Shutdown();
@@ -32,8 +47,17 @@ protected:
 private:
     CZMQNotificationInterface();
 
+    void WalletEvent(const CWalletShieldedEvent &event);
+
     void *pcontext;
+    CZMQSender *psender;
     std::list<CZMQAbstractNotifier*> notifiers;
+
+    //! Wallet topics, signalled with cs_wallet held from the thread that
+    //! changed the wallet, so kept apart from the validation queue notifiers
+    boost::mutex cs_walletNotifiers;
+    std::list<CZMQAbstractNotifier*> walletNotifiers;
+    boost::signals2::connection walletConnection;
 };
 
 #endif // BITCOIN_ZMQ_ZMQNOTIFICATIONINTERFACE_H
@@ -3,8 +3,15 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "zmqpublishnotifier.h"
+#include "zmqsender.h"
 #include "main.h"
 #include "util.h"
+#ifdef ENABLE_WALLET
+#include "rpc/server.h"
+#include "wallet/wallet.h"
+
+#include <univalue.h>
+#endif
 
 static std::multimap<std::string, CZMQAbstractPublishNotifier*> mapPublishNotifiers;
 
@@ -13,6 +20,9 @@ static const char *MSG_HASHTX    = "hashtx";
 static const char *MSG_RAWBLOCK  = "rawblock";
 static const char *MSG_RAWTX     = "rawtx";
 static const char *MSG_CHECKEDBLOCK = "checkedblock";
+static const char *MSG_WALLETNOTE    = "walletnote";
+static const char *MSG_WALLETSPEND   = "walletspend";
+static const char *MSG_WALLETCONFIRM = "walletconfirm";
 
 // Internal function to send multipart message
 static int zmq_send_multipart(void *sock, const void* data, size_t size, ...)
@@ -128,13 +138,14 @@ void CZMQAbstractPublishNotifier::Shutdown()
 
 bool CZMQAbstractPublishNotifier::SendMessage(const char *command, const void* data, size_t size)
 {
-    assert(psocket);
+    if (psender)
+    {
+        /* numbered when queued, so a message dropped by the sender shows as a gap */
+        psender->Push(this, command, data, size, nSequence++);
+        return true;
+    }
 
-    /* send three parts, command & data & a LE 4byte sequence number */
-    unsigned char msgseq[sizeof(uint32_t)];
-    WriteLE32(&msgseq[0], nSequence);
-    int rc = zmq_send_multipart(psocket, command, strlen(command), data, size, msgseq, (size_t)sizeof(uint32_t), (void*)0);
-    if (rc == -1)
+    if (!SendQueuedMessage(command, data, size, nSequence))
         return false;
 
     /* increment memory only sequence number after sending */
@@ -143,6 +154,17 @@ bool CZMQAbstractPublishNotifier::SendMessage(const char *command, const void* d
     return true;
 }
 
+bool CZMQAbstractPublishNotifier::SendQueuedMessage(const char *command, const void* data, size_t size, uint32_t nSeq)
+{
+    assert(psocket);
+
+    /* send three parts, command & data & a LE 4byte sequence number */
+    unsigned char msgseq[sizeof(uint32_t)];
+    WriteLE32(&msgseq[0], nSeq);
+    int rc = zmq_send_multipart(psocket, command, strlen(command), data, size, msgseq, (size_t)sizeof(uint32_t), (void*)0);
+    return rc != -1;
+}
+
 bool CZMQPublishHashBlockNotifier::NotifyBlock(const CBlockIndex *pindex)
 {
     uint256 hash = pindex->GetBlockHash();
@@ -204,3 +226,57 @@ bool CZMQPublishRawTransactionNotifier::NotifyTransaction(const CTransaction &tr
     ss << transaction;
     return SendMessage(MSG_RAWTX, &(*ss.begin()), ss.size());
 }
+
+#ifdef ENABLE_WALLET
+static UniValue WalletEventToJSON(const CWalletShieldedEvent &event)
+{
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("txid", event.txid.GetHex()));
+    if (event.type == CWalletShieldedEvent::NOTE_RECEIVED) {
+        obj.push_back(Pair("output", event.nIndex));
+    } else if (event.type == CWalletShieldedEvent::NOTE_SPENT) {
+        obj.push_back(Pair("spend", event.nIndex));
+        obj.push_back(Pair("spenttxid", event.spentNote.hash.GetHex()));
+        obj.push_back(Pair("spentoutput", (int)event.spentNote.n));
+    }
+    if (event.type != CWalletShieldedEvent::TX_CONFIRMED) {
+        obj.push_back(Pair("address", event.address));
+        obj.push_back(Pair("value", ValueFromAmount(event.nValue)));
+        obj.push_back(Pair("valueZat", event.nValue));
+    }
+    if (event.type == CWalletShieldedEvent::NOTE_RECEIVED)
+        obj.push_back(Pair("memo", event.memo));
+    obj.push_back(Pair("confirmations", event.nConfirmations));
+    if (!event.hashBlock.IsNull())
+        obj.push_back(Pair("blockhash", event.hashBlock.GetHex()));
+    return obj;
+}
+
+static bool PublishWalletEvent(CZMQAbstractPublishNotifier *notifier, const char *command, const CWalletShieldedEvent &event)
+{
+    LogPrint("zmq", "zmq: Publish %s %s\n", command, event.txid.GetHex());
+    std::string json = WalletEventToJSON(event).write();
+    return notifier->SendMessage(command, json.data(), json.size());
+}
+
+bool CZMQPublishWalletNoteNotifier::NotifyWalletEvent(const CWalletShieldedEvent &event)
+{
+    if (event.type != CWalletShieldedEvent::NOTE_RECEIVED)
+        return true;
+    return PublishWalletEvent(this, MSG_WALLETNOTE, event);
+}
+
+bool CZMQPublishWalletSpendNotifier::NotifyWalletEvent(const CWalletShieldedEvent &event)
+{
+    if (event.type != CWalletShieldedEvent::NOTE_SPENT)
+        return true;
+    return PublishWalletEvent(this, MSG_WALLETSPEND, event);
+}
+
+bool CZMQPublishWalletConfirmNotifier::NotifyWalletEvent(const CWalletShieldedEvent &event)
+{
+    if (event.type != CWalletShieldedEvent::TX_CONFIRMED)
+        return true;
+    return PublishWalletEvent(this, MSG_WALLETCONFIRM, event);
+}
+#endif // ENABLE_WALLET
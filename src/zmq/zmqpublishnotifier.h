@@ -8,21 +8,29 @@
 #include "zmqabstractnotifier.h"
 
 class CBlockIndex;
+class CZMQSender;
 
 class CZMQAbstractPublishNotifier : public CZMQAbstractNotifier
 {
 private:
     uint32_t nSequence; //! upcounting per message sequence number
+    CZMQSender *psender;
 
 public:
+    CZMQAbstractPublishNotifier() : nSequence(0), psender(0) { }
 
-    /* send zmq multipart message
+    void SetSender(CZMQSender *s) { psender = s; }
+
+    /* queue a message on the sender, or send it in place without one */
+    bool SendMessage(const char *command, const void* data, size_t size);
+
+    /* send zmq multipart message, from the sender thread
        parts:
           * command
           * data
           * message sequence number
     */
-    bool SendMessage(const char *command, const void* data, size_t size);
+    bool SendQueuedMessage(const char *command, const void* data, size_t size, uint32_t nSeq);
 
     bool Initialize(void *pcontext);
     void Shutdown();
@@ -58,4 +66,25 @@ public:
     bool NotifyBlock(const CBlock &block);
 };
 
+#ifdef ENABLE_WALLET
+/* The wallet topics publish a JSON object, see doc/zmq.md */
+class CZMQPublishWalletNoteNotifier : public CZMQAbstractPublishNotifier
+{
+public:
+    bool NotifyWalletEvent(const CWalletShieldedEvent &event);
+};
+
+class CZMQPublishWalletSpendNotifier : public CZMQAbstractPublishNotifier
+{
+public:
+    bool NotifyWalletEvent(const CWalletShieldedEvent &event);
+};
+
+class CZMQPublishWalletConfirmNotifier : public CZMQAbstractPublishNotifier
+{
+public:
+    bool NotifyWalletEvent(const CWalletShieldedEvent &event);
+};
+#endif // ENABLE_WALLET
+
 #endif // BITCOIN_ZMQ_ZMQPUBLISHNOTIFIER_H
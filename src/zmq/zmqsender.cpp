@@ -0,0 +1,99 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "zmqsender.h"
+#include "zmqpublishnotifier.h"
+
+#include "util.h"
+
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+
+CZMQSender::CZMQSender(size_t nHighWaterMarkIn) :
+    nHighWaterMark(std::max<size_t>(nHighWaterMarkIn, 1)), fRunning(false), fStop(false), fBusy(false), nSent(0), nDropped(0)
+{
+}
+
+CZMQSender::~CZMQSender()
+{
+    Stop();
+}
+
+void CZMQSender::Thread()
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    while (true) {
+        while (queue.empty() && !fStop)
+            cond.wait(lock);
+        // Stopping only once what was queued has been sent
+        if (queue.empty())
+            return;
+        std::deque<Message> batch;
+        batch.swap(queue);
+        fBusy = true;
+        lock.unlock();
+        for (const Message& msg : batch) {
+            if (msg.notifier->SendQueuedMessage(msg.command, msg.data.data(), msg.data.size(), msg.nSequence))
+                nSent++;
+        }
+        lock.lock();
+        fBusy = false;
+        cond.notify_all();
+    }
+}
+
+void CZMQSender::Start()
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    if (fRunning)
+        return;
+    fRunning = true;
+    fStop = false;
+    thread = boost::thread(boost::bind(&TraceThread<boost::function<void()> >, "zmqsend",
+                                       boost::function<void()>(boost::bind(&CZMQSender::Thread, this))));
+}
+
+void CZMQSender::Stop()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (!fRunning)
+            return;
+        fStop = true;
+        cond.notify_all();
+    }
+    thread.join();
+    boost::unique_lock<boost::mutex> lock(cs);
+    fRunning = false;
+    cond.notify_all();
+}
+
+void CZMQSender::Push(CZMQAbstractPublishNotifier* notifier, const char* command, const void* data, size_t size, uint32_t nSequence)
+{
+    const unsigned char* begin = (const unsigned char*)data;
+    Message msg = {notifier, command, std::vector<unsigned char>(begin, begin + size), nSequence};
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (fRunning) {
+            if (queue.size() >= nHighWaterMark) {
+                queue.pop_front();
+                if (nDropped++ % nHighWaterMark == 0)
+                    LogPrint("zmq", "zmq: Send queue full, dropped %u messages so far\n", nDropped.load());
+            }
+            queue.push_back(std::move(msg));
+            cond.notify_all();
+            return;
+        }
+    }
+    // Before the thread runs the message is sent in place
+    if (notifier->SendQueuedMessage(command, msg.data.data(), msg.data.size(), nSequence))
+        nSent++;
+}
+
+void CZMQSender::Sync()
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    while (fRunning && (!queue.empty() || fBusy))
+        cond.wait(lock);
+}
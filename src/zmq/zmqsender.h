@@ -0,0 +1,67 @@
+// Copyright (c) 2020 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_ZMQ_ZMQSENDER_H
+#define BITCOIN_ZMQ_ZMQSENDER_H
+
+#include <atomic>
+#include <deque>
+#include <stdint.h>
+#include <vector>
+
+#include <boost/thread.hpp>
+
+class CZMQAbstractPublishNotifier;
+
+//! -zmqhwm default
+static const unsigned int DEFAULT_ZMQ_HWM = 1000;
+
+/**
+ * Sends the messages of the ZMQ publishers from one thread. A notifier only
+ * copies its message into the queue, so a slow subscriber never holds up the
+ * thread that signalled it, and the sockets are only ever used from the
+ * sender thread. Each wakeup sends everything queued meanwhile as one batch.
+ * Past the high-water mark the oldest messages are dropped.
+ */
+class CZMQSender
+{
+private:
+    struct Message
+    {
+        CZMQAbstractPublishNotifier* notifier;
+        const char* command;
+        std::vector<unsigned char> data;
+        uint32_t nSequence;
+    };
+
+    boost::mutex cs;
+    //! Signalled when a message is queued and when a batch has been sent
+    boost::condition_variable cond;
+    std::deque<Message> queue;
+    size_t nHighWaterMark;
+    bool fRunning;
+    bool fStop;
+    bool fBusy;
+    boost::thread thread;
+    std::atomic<uint64_t> nSent;
+    std::atomic<uint64_t> nDropped;
+
+    void Thread();
+
+public:
+    explicit CZMQSender(size_t nHighWaterMarkIn);
+    ~CZMQSender();
+
+    void Start();
+    //! Sends what is still queued, then stops the thread
+    void Stop();
+    void Push(CZMQAbstractPublishNotifier* notifier, const char* command, const void* data, size_t size, uint32_t nSequence);
+    //! Waits until the queued messages have been sent
+    void Sync();
+
+    uint64_t GetSent() const { return nSent; }
+    uint64_t GetDropped() const { return nDropped; }
+};
+
+#endif // BITCOIN_ZMQ_ZMQSENDER_H